@@ -217,27 +217,27 @@ class Controls {
                         if (view.screenOption != 2) // 2 is "touch only"
                             x -= 256;
                         if (x >= 0)
-                            DeSmuME.touchScreenTouch((int) x, (int) y);
+                            DeSmuME.input().touch((int) x, (int) y, event.getEventTime() * 1000000L);
                     } else {
                         if (x < 256)
-                            DeSmuME.touchScreenTouch((int) x, (int) y);
+                            DeSmuME.input().touch((int) x, (int) y, event.getEventTime() * 1000000L);
                     }
                 } else {
                     if (!view.lcdSwap) {
                         if (view.screenOption != 2) // 2 is "touch only"
                             y -= 192;
                         if (y >= 0)
-                            DeSmuME.touchScreenTouch((int) x, (int) y);
+                            DeSmuME.input().touch((int) x, (int) y, event.getEventTime() * 1000000L);
                     } else {
                         if (y < 192)
-                            DeSmuME.touchScreenTouch((int) x, (int) y);
+                            DeSmuME.input().touch((int) x, (int) y, event.getEventTime() * 1000000L);
                     }
                 }
 
                 break;
             case MotionEvent.ACTION_UP:
             case MotionEvent.ACTION_CANCEL:
-                DeSmuME.touchScreenRelease();
+                DeSmuME.input().release(event.getEventTime() * 1000000L);
                 if (touchButton.bitmap != null && !view.forceTouchScreen && touchButton.position.contains((int) event.getX(), (int) event.getY())) {
                     DeSmuME.touchScreenMode = false;
                 }
@@ -282,7 +282,7 @@ class Controls {
                     }
 /*
                     if (fastForwardButton.bitmap != null && fastForwardButton.position.contains(x, y))
-                        DeSmuME.fastForwardMode = true;
+                        DeSmuME.fastForward(true);
 */
                     if (!pressedButton && view.alwaysTouch)
                         return touchScreenProcess(event);
@@ -298,7 +298,7 @@ class Controls {
                     }
 /*
                     if (fastForwardButton.bitmap != null && fastForwardButton.position.contains((int) event.getX(), (int) event.getY()))
-                        DeSmuME.fastForwardMode = false;
+                        DeSmuME.fastForward(false);
 */
                     if (view.alwaysTouch)
                         touchScreenProcess(event);
@@ -315,7 +315,7 @@ class Controls {
                     activeTouches.remove(id);
 /*
                     if (fastForwardButton.bitmap != null && fastForwardButton.position.contains((int) event.getX(), (int) event.getY()))
-                        DeSmuME.fastForwardMode = false;
+                        DeSmuME.fastForward(false);
 */
                 }
                 break;
@@ -356,9 +356,7 @@ class Controls {
     }
 
     private void sendStates() {
-        DeSmuME.setButtons(buttonStates[Button.BUTTON_L], buttonStates[Button.BUTTON_R], buttonStates[Button.BUTTON_UP], buttonStates[Button.BUTTON_DOWN], buttonStates[Button.BUTTON_LEFT], buttonStates[Button.BUTTON_RIGHT],
-                buttonStates[Button.BUTTON_A], buttonStates[Button.BUTTON_B], buttonStates[Button.BUTTON_X], buttonStates[Button.BUTTON_Y],
-                buttonStates[Button.BUTTON_START], buttonStates[Button.BUTTON_SELECT], DeSmuME.lidOpen ? 1 : 0);
+        DeSmuME.input().buttons(buttonStates, DeSmuME.lidOpen, System.nanoTime());
 
     }
 
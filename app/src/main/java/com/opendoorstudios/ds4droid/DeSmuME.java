@@ -19,9 +19,13 @@ package com.opendoorstudios.ds4droid;
 
 import android.content.Context;
 import android.content.SharedPreferences;
+import android.content.res.AssetManager;
 import android.graphics.Bitmap;
 import android.preference.PreferenceManager;
 import android.util.Log;
+import android.view.Surface;
+
+import java.nio.ByteBuffer;
 
 public class DeSmuME {
 
@@ -34,6 +38,8 @@ public class DeSmuME {
     public static Context context;
     static boolean touchScreenMode = false;
     static boolean fastForwardMode = false;
+    // Fast forward as fast as the device goes, showing a frame now and then and without sound
+    static boolean turboMode = false;
     static boolean inited = false;
     static boolean romLoaded = false;
     static boolean lidOpen = true;
@@ -76,26 +82,123 @@ public class DeSmuME {
 
     static native int getCPUType();
 
-    static native void init();
+    // memoryClass is ActivityManager.getMemoryClass(), which the native caches are sized from.
+    // assets are where the Vulkan renderer loads its shaders from
+    static native void init(int memoryClass, AssetManager assets);
+
+    // ComponentCallbacks2.onTrimMemory's level, called with the frame lock held
+    static native void trimMemory(int level);
+
+    // The native emulation thread runs frames while it is running, and paces them itself
+    static native void setRunning(boolean run);
+
+    // Whoever holds the frame lock runs between two of the emulation thread's frames
+    static native void lockFrame();
 
-    static native void runCore();
+    static native void unlockFrame();
+
+    static native void setFastForward(boolean enable, boolean turbo);
+
+    static void fastForward(boolean enable) {
+        fastForwardMode = enable;
+        setFastForward(enable, turboMode);
+    }
 
     static native void resize(Bitmap bitmap);
 
     static native int draw(Bitmap bitmapMain, Bitmap bitmapTouch, boolean rotate);
 
-    static native void touchScreenTouch(int x, int y);
+    static native void setDrawSurface(Surface surface);
+
+    static native int drawSurface(int[] rects, boolean rotate);
 
-    static native void touchScreenRelease();
+    // The native input queue's memory, which InputQueue writes the events into
+    static native ByteBuffer getInputBuffer();
 
-    static native void setButtons(int l, int r, int up, int down, int left, int right, int a, int b, int x, int y, int start, int select, int lid);
+    static native void commitInput(int writePos);
+
+    // Microseconds from the input to the frame it got into, on average since the last call
+    static native int getInputLatency();
+
+    // The frames run ahead now, and the microseconds each frame had left of its time on average since the last call
+    static native int getRunAheadFrames();
+    static native int getRunAheadHeadroom();
+
+    private static InputQueue inputQueue = null;
+
+    // Once the library is loaded
+    static InputQueue input() {
+        if (inputQueue == null)
+            inputQueue = new InputQueue();
+        return inputQueue;
+    }
 
     static native boolean loadRom(String path);
 
     static native void setWorkingDir(String path, String temp);
 
+    static native byte[] readRomInfo(String path);
+
+    // the start of the header and the banner of an .nds file, for the rom browser, or null if it can't be read.
+    // for any thread
+    public static byte[] getRomInfo(String path) {
+        synchronized (DeSmuME.class) {
+            load();
+        }
+        return readRomInfo(path);
+    }
+
+    static native int[] decodeRomIcons(byte[] info);
+
+    // the still and animated icons of what getRomInfo returned, as 32x32 ARGB_8888 frames after a short header (see
+    // decodeRomIcons in main.cpp), or null if there is no banner. for any thread
+    public static int[] getRomIcons(byte[] info) {
+        synchronized (DeSmuME.class) {
+            load();
+        }
+        return decodeRomIcons(info);
+    }
+
+    interface StateSavedListener {
+        void onStateSaved(int slot, boolean ok);
+    }
+
+    static volatile StateSavedListener stateSavedListener = null;
+
+    // saveState returns once the state is taken, and the file is written after. this is called from the
+    // native thread that writes it, once it is done
+    static void stateSaved(int slot, boolean ok) {
+        StateSavedListener listener = stateSavedListener;
+        if (listener != null)
+            listener.onStateSaved(slot, ok);
+    }
+
     static native void saveState(int slot);
 
+    static native void flushBackup();
+
+    static final int NETPLAY_OFF = 0;
+    static final int NETPLAY_WAITING = 1;
+    static final int NETPLAY_CONNECTED = 2;
+
+    static native boolean netplayHost(int port);
+
+    // connects and takes the host's game, so it blocks on the network
+    static native boolean netplayJoin(String host, int port);
+
+    static native void netplayStop();
+
+    static native int netplayStatus();
+
+    // records to an mp4 with the hardware encoders, from android 8.0 and only while the screens are drawn with GLES
+    static native boolean canRecord();
+
+    static native boolean startRecording(String path);
+
+    static native void stopRecording();
+
+    static native boolean isRecording();
+
     static native void restoreState(int slot);
 
     static native void loadSettings();
@@ -104,6 +207,43 @@ public class DeSmuME {
 
     static native int getNativeHeight();
 
+    static native int getLineReuse();
+
+    static native int getSoundSilent();
+
+    static native int getAdpcmCached();
+
+    static native int getSkipped3D();
+
+    static native boolean waitForFrame(int timeoutMs);
+
+    static native int getDroppedFrames();
+
+    static native int getRepeatedFrames();
+
+    static native int getSoundUnderruns();
+
+    static native int getSoundOverruns();
+
+    //p50, p95, p99 and worst in microseconds, frames over budget and frames counted, for the emulation and then
+    //for the presented frames
+    static final int FRAME_TIMES = 12;
+
+    static native int getFrameTimes(int[] out);
+
+    static native void resetFrameTimes();
+
+    //the zones of frameprofile.h, in its order
+    static final int PROFILE_ZONES = 9;
+    static final int PROFILE_FRAMES = 256;
+
+    static native int getProfile(int[] out);
+
+    static native String dumpProfile();
+
+    //the big allocations of the emulator and what they hold, a line each
+    static native String getMemoryUsage();
+
     static native void setFilter(int index);
 
     static native void change3D(int set);
@@ -144,8 +284,22 @@ public class DeSmuME {
 
     static native void changeSoundSynchMode(int mode);
 
+    static native void changeSoundSynchMethod(int method);
+
     static int getSettingInt(String name, int def) {
+        return getSettingInt(PreferenceManager.getDefaultSharedPreferences(context), name, def);
+    }
+
+    // All the settings the native side reads, in one call from loadSettings
+    static int[] getSettings(String[] names, int[] defs) {
         SharedPreferences pm = PreferenceManager.getDefaultSharedPreferences(context);
+        int[] ret = new int[names.length];
+        for (int i = 0; i < names.length; i++)
+            ret[i] = getSettingInt(pm, names[i], defs[i]);
+        return ret;
+    }
+
+    private static int getSettingInt(SharedPreferences pm, String name, int def) {
         if (!pm.contains(name))
             return def;
         try {
@@ -17,22 +17,23 @@ You should have received a copy of the GNU General Public License
 along with the this software.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+import android.app.ActivityManager;
+import android.content.Context;
 import android.os.Environment;
 import android.preference.PreferenceManager;
 
 import java.io.File;
 import java.util.concurrent.atomic.AtomicBoolean;
-import java.util.concurrent.locks.Lock;
-import java.util.concurrent.locks.ReentrantLock;
 
 class EmulatorThread extends Thread {
 
     final AtomicBoolean paused = new AtomicBoolean(false);
     private final AtomicBoolean finished = new AtomicBoolean(false);
     private final Object dormant = new Object();
-    boolean frameFinished = false;
+    private boolean woken = false;
     long lastDraw = 0;
-    Lock inFrameLock = new ReentrantLock();
+    // Held by the native emulation thread for each frame it runs; what holds it runs between two frames
+    final FrameLock inFrameLock = new FrameLock();
     int fps = 1;
     long frameCounter = 0;
     private boolean soundPaused = true;
@@ -41,6 +42,7 @@ class EmulatorThread extends Thread {
     private Integer pendingSoundChange = null;
     private Integer pendingCPUChange = null;
     private Integer pendingSoundSyncModeChange = null;
+    private Integer pendingSoundSyncMethodChange = null;
     private MainActivity activity = null;
 
     EmulatorThread(MainActivity activity) {
@@ -52,34 +54,56 @@ class EmulatorThread extends Thread {
         this.activity = activity;
     }
 
-    void loadRom(String path) {
-        pendingRomLoad = path;
+    static class FrameLock {
+        void lock() {
+            DeSmuME.lockFrame();
+        }
+
+        void unlock() {
+            DeSmuME.unlockFrame();
+        }
+    }
+
+    private void wake() {
         synchronized (dormant) {
+            woken = true;
             dormant.notifyAll();
         }
     }
 
+    void loadRom(String path) {
+        pendingRomLoad = path;
+        wake();
+    }
+
     void change3D(int set) {
         pending3DChange = set;
+        wake();
     }
 
     void changeSound(int set) {
         pendingSoundChange = set;
+        wake();
     }
 
     void changeCPUMode(int set) {
         pendingCPUChange = set;
+        wake();
     }
 
     void changeSoundSyncMode(int set) {
         pendingSoundSyncModeChange = set;
+        wake();
+    }
+
+    void changeSoundSyncMethod(int set) {
+        pendingSoundSyncMethodChange = set;
+        wake();
     }
 
     public void setCancel(boolean set) {
         finished.set(set);
-        synchronized (dormant) {
-            dormant.notifyAll();
-        }
+        wake();
     }
 
     public void setPause(boolean set) {
@@ -89,9 +113,13 @@ class EmulatorThread extends Thread {
             DeSmuME.setMicPaused(set ? 1 : 0);
             soundPaused = set;
         }
-        synchronized (dormant) {
-            dormant.notifyAll();
+        if (set && DeSmuME.romLoaded) {
+            // the game's save goes to its file now, in case the app doesn't come back from being paused
+            inFrameLock.lock();
+            DeSmuME.flushBackup();
+            inFrameLock.unlock();
         }
+        wake();
     }
 
     @Override
@@ -121,11 +149,14 @@ class EmulatorThread extends Thread {
                 }
             }
 
-            DeSmuME.init();
+            DeSmuME.init(((ActivityManager) activity.getSystemService(Context.ACTIVITY_SERVICE)).getMemoryClass(), activity.getAssets());
             DeSmuME.inited = true;
         }
 
+        // The frames run on the native emulation thread. This one does what has to be done between them, and starts
+        // and stops it
         while (!finished.get()) {
+            inFrameLock.lock();
             if (pendingRomLoad != null) {
                 activity.msgHandler.sendEmptyMessage(MainActivity.LOADING_START);
                 if (DeSmuME.romLoaded)
@@ -159,31 +190,31 @@ class EmulatorThread extends Thread {
                 DeSmuME.changeSoundSynchMode(pendingSoundSyncModeChange);
                 pendingSoundSyncModeChange = null;
             }
+            if (pendingSoundSyncMethodChange != null) {
+                DeSmuME.changeSoundSynchMethod(pendingSoundSyncMethodChange);
+                pendingSoundSyncMethodChange = null;
+            }
+            inFrameLock.unlock();
 
-            if (!paused.get()) {
-
-                if (soundPaused) {
-                    DeSmuME.setSoundPaused(0);
-                    DeSmuME.setMicPaused(0);
-                    soundPaused = false;
-                }
+            final boolean run = !paused.get();
+            if (run && soundPaused) {
+                DeSmuME.setSoundPaused(0);
+                DeSmuME.setMicPaused(0);
+                soundPaused = false;
+            }
+            DeSmuME.setRunning(run);
 
-                inFrameLock.lock();
-                do {
-                    DeSmuME.runCore();
-                } while (DeSmuME.fastForwardMode);
-                inFrameLock.unlock();
-                frameFinished = true;
-
-            } else {
-                //hacky, but keeps thread alive so we don't lose contexts
-                try {
-                    synchronized (dormant) {
+            //hacky, but keeps thread alive so we don't lose contexts
+            synchronized (dormant) {
+                while (!woken) {
+                    try {
                         dormant.wait();
+                    } catch (InterruptedException ignored) {
                     }
-                } catch (InterruptedException ignored) {
                 }
+                woken = false;
             }
         }
+        DeSmuME.setRunning(false);
     }
 }
@@ -0,0 +1,89 @@
+package com.opendoorstudios.ds4droid;
+
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+// The buttons and touches, queued for the emulation thread to apply at the start of its next frame.
+// The buffer is the native queue's own memory (android/inputqueue.h, which has the same layout): the events
+// are written here and published with commitInput, and the native side only moves the read position.
+class InputQueue {
+
+    private static final int TYPE_BUTTONS = 0;
+    private static final int TYPE_TOUCH = 1;
+    private static final int TYPE_RELEASE = 2;
+
+    private static final int READ_POS = 0;
+    private static final int LATEST_BUTTONS = 68;
+    private static final int LATEST_TOUCH = 72;
+    private static final int DROPPED = 76;
+    private static final int RECORDS = 128;
+    private static final int RECORD_SIZE = 16;
+    private static final int SIZE = 256;
+
+    private final ByteBuffer buffer;
+    private int writePos = 0;
+    private int dropped = 0;
+
+    InputQueue() {
+        buffer = DeSmuME.getInputBuffer().order(ByteOrder.nativeOrder());
+    }
+
+    // The bits in NDS_setPad's order
+    void buttons(int[] states, boolean lidOpen, long timeNs) {
+        final int mask = bit(states[Button.BUTTON_RIGHT], 0) | bit(states[Button.BUTTON_LEFT], 1)
+                | bit(states[Button.BUTTON_DOWN], 2) | bit(states[Button.BUTTON_UP], 3)
+                | bit(states[Button.BUTTON_SELECT], 4) | bit(states[Button.BUTTON_START], 5)
+                | bit(states[Button.BUTTON_B], 6) | bit(states[Button.BUTTON_A], 7)
+                | bit(states[Button.BUTTON_Y], 8) | bit(states[Button.BUTTON_X], 9)
+                | bit(states[Button.BUTTON_L], 10) | bit(states[Button.BUTTON_R], 11)
+                | (lidOpen ? 0 : 1 << 13);
+        push(TYPE_BUTTONS, mask, LATEST_BUTTONS, mask, timeNs);
+    }
+
+    void touch(int x, int y, long timeNs) {
+        x = Math.max(0, Math.min(x, 255));
+        y = Math.max(0, Math.min(y, 192));
+        push(TYPE_TOUCH, x | (y << 16), LATEST_TOUCH, x | (y << 16) | (1 << 31), timeNs);
+    }
+
+    void release(long timeNs) {
+        push(TYPE_RELEASE, 0, LATEST_TOUCH, 0, timeNs);
+    }
+
+    private static int bit(int state, int bit) {
+        return state != 0 ? 1 << bit : 0;
+    }
+
+    // Events come from the ui thread, but the lock keeps the queue whole if some other thread ever sends one
+    private synchronized void push(int type, int data, int latest, int latestValue, long timeNs) {
+        buffer.putInt(latest, latestValue);
+        if (writePos - buffer.getInt(READ_POS) >= SIZE) {
+            // The emulation isn't running to take them. It picks up the latest state when it catches up
+            buffer.putInt(DROPPED, ++dropped);
+            DeSmuME.commitInput(writePos);
+            return;
+        }
+        final int at = RECORDS + (writePos & (SIZE - 1)) * RECORD_SIZE;
+        buffer.putLong(at, timeNs);
+        buffer.putInt(at + 8, type);
+        buffer.putInt(at + 12, data);
+        DeSmuME.commitInput(++writePos);
+    }
+}
@@ -34,11 +34,13 @@ import android.graphics.Canvas;
 import android.graphics.Color;
 import android.graphics.Paint;
 import android.graphics.PixelFormat;
+import android.graphics.PorterDuff;
 import android.graphics.Rect;
 import android.os.Bundle;
 import android.os.Environment;
 import android.os.Handler;
 import android.os.Message;
+import android.os.SystemClock;
 import android.preference.PreferenceManager;
 import android.util.Log;
 import android.view.KeyEvent;
@@ -49,6 +51,8 @@ import android.view.MotionEvent;
 import android.view.SurfaceHolder;
 import android.view.SurfaceHolder.Callback;
 import android.view.SurfaceView;
+import android.widget.EditText;
+import android.widget.Toast;
 
 import com.opendoorstudios.ds4droid.NDSScanner.CollectionActivity;
 
@@ -56,6 +60,7 @@ import net.sf.sevenzipjbinding.SevenZip;
 import net.sf.sevenzipjbinding.SevenZipNativeInitializationException;
 
 import java.io.File;
+import java.text.SimpleDateFormat;
 import java.util.Date;
 import java.util.Locale;
 import java.util.Timer;
@@ -74,7 +79,8 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
     static Controls controls;
     NDSView view;
     Dialog loadingDialog = null;
-    Timer drawtimer;
+    Thread drawThread;
+    volatile boolean drawing = false;
     SharedPreferences prefs = null;
     @SuppressLint("HandlerLeak")
     Handler msgHandler = new Handler() {
@@ -143,6 +149,11 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
 
         controls = new Controls(view);
 
+        DeSmuME.stateSavedListener = (slot, ok) -> {
+            view.stateText = (ok ? "Saved " : "Couldn't save ") + getStateName(slot);
+            view.stateDrawStart = System.currentTimeMillis();
+        };
+
         Settings.applyDefaults(this);
         prefs = PreferenceManager.getDefaultSharedPreferences(MainActivity.this);
         prefs.registerOnSharedPreferenceChangeListener(this);
@@ -234,22 +245,39 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
         cancelAutosave();
     }
 
+    // What the caches hold is given back, so that the app isn't the first to go when the system needs memory
+    @Override
+    public void onTrimMemory(int level) {
+        super.onTrimMemory(level);
+        if (DeSmuME.inited && coreThread != null) {
+            coreThread.inFrameLock.lock();
+            DeSmuME.trimMemory(level);
+            coreThread.inFrameLock.unlock();
+        }
+    }
+
     void startDrawTimer() {
-        drawtimer = new Timer();
-        drawtimer.schedule(new TimerTask() {
-            public void run() {
-                if (coreThread.frameFinished) {
-                    coreThread.frameFinished = false;
+        stopDrawTimer();
+        drawing = true;
+        //the native frame queue wakes us for every new frame (on the following vsync when pacing is on)
+        drawThread = new Thread(() -> {
+            while (drawing) {
+                if (DeSmuME.waitForFrame(100))
                     view.postInvalidate();
-                }
-
             }
-        }, 12, 12);
+        }, "DrawPump");
+        drawThread.start();
     }
 
     void stopDrawTimer() {
-        if (drawtimer != null)
-            drawtimer.cancel();
+        drawing = false;
+        if (drawThread != null) {
+            try {
+                drawThread.join();
+            } catch (InterruptedException ignored) {
+            }
+            drawThread = null;
+        }
     }
 
     @Override
@@ -264,6 +292,11 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
         pauseEmulation();
         menu.findItem(R.id.cheats).setVisible(DeSmuME.romLoaded);
         menu.findItem(R.id.lid).setChecked(DeSmuME.lidOpen);
+        menu.findItem(R.id.dumpprofile).setVisible(prefs.getBoolean(Settings.PROFILER, false));
+        final boolean canRecord = DeSmuME.romLoaded && DeSmuME.canRecord();
+        menu.findItem(R.id.record).setVisible(canRecord);
+        if (canRecord)
+            menu.findItem(R.id.record).setTitle(DeSmuME.isRecording() ? R.string.StopRecording : R.string.Record);
 
         final String defaultWorkingDir = Environment.getExternalStorageDirectory().getAbsolutePath() + "/nds4droid";
         final String statesPath = prefs.getString(Settings.DESMUME_PATH, defaultWorkingDir) + "/States/";
@@ -402,6 +435,12 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
                 finish();
                 System.exit(0);
                 break;
+            case R.id.netplay:
+                showNetplayDialog();
+                return true;
+            case R.id.record:
+                toggleRecording();
+                break;
             case R.id.lid:
                 if (coreThread != null) {
                     boolean newState = !DeSmuME.lidOpen;
@@ -412,6 +451,16 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
             case R.id.about:
                 startActivity(new Intent(this, About.class));
                 break;
+            case R.id.dumpprofile: {
+                if (coreThread != null)
+                    coreThread.inFrameLock.lock();
+                final String profile = DeSmuME.dumpProfile();
+                if (coreThread != null)
+                    coreThread.inFrameLock.unlock();
+                view.stateText = profile != null ? "Profile written to " + profile + ".csv/.json" : "Couldn't write the profile";
+                view.stateDrawStart = System.currentTimeMillis();
+            }
+            break;
             default:
                 return false;
         }
@@ -419,6 +468,64 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
         return true;
     }
 
+    static final int NETPLAY_PORT = 7040;
+
+    void showNetplayDialog() {
+        if (!DeSmuME.romLoaded) {
+            runEmulation();
+            return;
+        }
+        final EditText address = new EditText(this);
+        address.setHint(R.string.NetplayAddress);
+        address.setSingleLine();
+        AlertDialog.Builder builder = new AlertDialog.Builder(this);
+        builder.setTitle(R.string.Netplay);
+        if (DeSmuME.netplayStatus() == DeSmuME.NETPLAY_OFF) {
+            builder.setMessage(R.string.NetplayDesc).setView(address)
+                    .setPositiveButton(R.string.NetplayJoin, (dialog, which) -> joinNetplay(address.getText().toString().trim()))
+                    .setNeutralButton(R.string.NetplayHost, (dialog, which) -> {
+                        final boolean hosting = DeSmuME.netplayHost(NETPLAY_PORT);
+                        Toast.makeText(this, hosting ? R.string.NetplayHosting : R.string.NetplayFailed, Toast.LENGTH_LONG).show();
+                    });
+        } else {
+            builder.setMessage(R.string.NetplayRunning)
+                    .setPositiveButton(R.string.NetplayStop, (dialog, which) -> DeSmuME.netplayStop());
+        }
+        builder.setOnDismissListener(dialog -> runEmulation()).create().show();
+    }
+
+    void toggleRecording() {
+        if (coreThread != null)
+            coreThread.inFrameLock.lock();
+        if (DeSmuME.isRecording()) {
+            DeSmuME.stopRecording();
+            view.stateText = "Recording saved";
+        } else {
+            final String defaultWorkingDir = Environment.getExternalStorageDirectory().getAbsolutePath() + "/nds4droid";
+            final File dir = new File(prefs.getString(Settings.DESMUME_PATH, defaultWorkingDir) + "/Recordings");
+            dir.mkdirs();
+            String name = new File(DeSmuME.loadedRom).getName();
+            if (name.lastIndexOf('.') > 0)
+                name = name.substring(0, name.lastIndexOf('.'));
+            name += new SimpleDateFormat("-yyyyMMdd-HHmmss", Locale.US).format(new Date()) + ".mp4";
+            final boolean started = DeSmuME.startRecording(new File(dir, name).getAbsolutePath());
+            view.stateText = started ? "Recording to " + name : "Couldn't start recording";
+        }
+        if (coreThread != null)
+            coreThread.inFrameLock.unlock();
+        view.stateDrawStart = System.currentTimeMillis();
+    }
+
+    void joinNetplay(final String host) {
+        if (host.length() == 0)
+            return;
+        // the host's game comes over the network, which can't be waited on here
+        new Thread(() -> {
+            final boolean joined = DeSmuME.netplayJoin(host, NETPLAY_PORT);
+            runOnUiThread(() -> Toast.makeText(this, joined ? R.string.NetplayJoined : R.string.NetplayFailed, Toast.LENGTH_LONG).show());
+        }).start();
+    }
+
     void restoreState(int slot) {
         if (DeSmuME.romLoaded) {
             coreThread.inFrameLock.lock();
@@ -434,16 +541,17 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
             coreThread.inFrameLock.lock();
             DeSmuME.saveState(slot);
             coreThread.inFrameLock.unlock();
-            view.stateText = "Saved " + getStateName(slot);
-            view.stateDrawStart = System.currentTimeMillis();
         }
     }
 
     @Override
     public void onSharedPreferenceChanged(SharedPreferences sharedPreferences, String key) {
 
-        if (DeSmuME.inited)
+        if (DeSmuME.inited) {
             DeSmuME.loadSettings();
+            //the frame times are for comparing settings, so they start over with each change
+            DeSmuME.resetFrameTimes();
+        }
         loadJavaSettings(key);
 
     }
@@ -456,6 +564,9 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
 
         if (view != null) {
             view.showfps = prefs.getBoolean(Settings.SHOW_FPS, false);
+            view.showProfile = prefs.getBoolean(Settings.PROFILER, false);
+            view.directDraw = prefs.getBoolean(Settings.DIRECT_DRAW, true);
+            DeSmuME.turboMode = prefs.getBoolean(Settings.TURBO, false);
             view.showTouchMessage = prefs.getBoolean(Settings.SHOW_TOUCH_MESSAGE, true);
             view.showSoundMessage = prefs.getBoolean(Settings.SHOW_SOUND_MESSAGE, true);
             view.lcdSwap = prefs.getBoolean(Settings.LCD_SWAP, false);
@@ -473,6 +584,9 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
                         DeSmuME.setFilter(newFilter);
                         view.forceResize();
                         break;
+                    case Settings.GPU_FILTER:
+                        view.forceResize();
+                        break;
                     case Settings.RENDERER:
                         int new3D = DeSmuME.getSettingInt(Settings.RENDERER, 2);
                         if (coreThread != null)
@@ -485,6 +599,7 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
                         break;
                     case Settings.CPU_MODE:
                     case Settings.JIT_SIZE:
+                    case Settings.JIT_CACHE_SIZE:
                         int newCpuMode = DeSmuME.getSettingInt(Settings.CPU_MODE, 0);
                         if (coreThread != null)
                             coreThread.changeCPUMode(newCpuMode);
@@ -494,6 +609,11 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
                         if (coreThread != null)
                             coreThread.changeSoundSyncMode(newSoundSyncMode);
                         break;
+                    case Settings.SOUND_SYNC_METHOD:
+                        int newSoundSyncMethod = DeSmuME.getSettingInt(Settings.SOUND_SYNC_METHOD, 0);
+                        if (coreThread != null)
+                            coreThread.changeSoundSyncMethod(newSoundSyncMethod);
+                        break;
                     case Settings.ENABLE_AUTOSAVE:
                     case Settings.AUTOSVAE_FREQUENCY:
                         cancelAutosave();
@@ -559,6 +679,13 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
         final Paint hudPaint = new Paint();
         final float defhudsize = 15;
         public boolean showfps = false;
+        public boolean showProfile = false;
+        public boolean directDraw = false;
+        boolean surfaceValid = false;
+        boolean surfaceAttached = false;
+        boolean directDrawFailed = false;
+        final int[] directRects = new int[8];
+        final Rect noRect = new Rect(0, 0, 0, 0);
         public boolean showTouchMessage = false;
         public boolean showSoundMessage = false;
         public boolean lcdSwap = false;
@@ -580,8 +707,25 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
         String stateText = null;
         long stateDrawStart = 0;
         int fpsData = 0;
+        int lineReuse = 0;
+        int droppedFrames = 0;
+        int repeatedFrames = 0;
+        int soundUnderruns = 0;
+        int soundOverruns = 0;
+        int soundSilent = 0;
+        int adpcmCached = 0;
+        int skipped3d = 0;
         int screenOption = 0;
         String fpsText = null;
+        final int[] frameTimes = new int[DeSmuME.FRAME_TIMES];
+        String frameTimesText = null;
+        long frameTimesUpdated = 0;
+        final int[] profileData = new int[DeSmuME.PROFILE_FRAMES * DeSmuME.PROFILE_ZONES];
+        final float[] profileLines = new float[DeSmuME.PROFILE_FRAMES * 4];
+        final Paint profilePaint = new Paint();
+        //NDS_exec, armInnerLoop, GPU_RenderLine, gfx3d_doFlush, SoftRastRender, SoftRastRenderFinish, SPU_Emulate_user, draw, filter
+        final int[] profileColors = {Color.WHITE, Color.RED, Color.GREEN, Color.BLUE, Color.CYAN, Color.MAGENTA, Color.YELLOW,
+                Color.rgb(255, 128, 0), Color.GRAY};
 
         public NDSView(Context context) {
             super(context);
@@ -601,9 +745,21 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
             doForceResize = true;
         }
 
+        void putRect(int index, Rect rect) {
+            directRects[index * 4] = rect.left;
+            directRects[index * 4 + 1] = rect.top;
+            directRects[index * 4 + 2] = rect.right;
+            directRects[index * 4 + 3] = rect.bottom;
+        }
+
         @Override
         public void onDraw(Canvas canvas) {
-            canvas.drawColor(Color.BLACK);
+            //with direct drawing the screens are in the surface behind this view, which then only carries the overlays
+            final boolean direct = directDraw && !directDrawFailed && surfaceValid && DeSmuME.inited;
+            if (direct)
+                canvas.drawColor(Color.TRANSPARENT, PorterDuff.Mode.CLEAR);
+            else
+                canvas.drawColor(Color.BLACK);
 
             if (showTouchMessage) {
                 prefs.edit().putBoolean(Settings.SHOW_TOUCH_MESSAGE, showTouchMessage = false).apply();
@@ -631,11 +787,31 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
                     return;
 
 
-                int data = DeSmuME.fastForwardMode ? fpsData : DeSmuME.draw(emuBitmapMain, emuBitmapTouch, landscape && dontRotate);
-
                 final boolean drawTouch = destTouch.left != 0 || destTouch.right != 0;
 
-                if (lcdSwap) {
+                int data = fpsData;
+                if (direct) {
+                    if (!surfaceAttached) {
+                        DeSmuME.setDrawSurface(getHolder().getSurface());
+                        surfaceAttached = true;
+                    }
+                    if (!DeSmuME.fastForwardMode || DeSmuME.turboMode) {
+                        putRect(0, lcdSwap && drawTouch ? destTouch : destMain);
+                        putRect(1, drawTouch ? (lcdSwap ? destMain : destTouch) : noRect);
+                        data = DeSmuME.drawSurface(directRects, landscape && dontRotate);
+                        if (data == -1) {
+                            //the native side could not use the surface (or the screen filter has to run on the CPU); go back to the bitmaps
+                            directDrawFailed = true;
+                            canvas.drawColor(Color.BLACK);
+                            data = DeSmuME.draw(emuBitmapMain, emuBitmapTouch, landscape && dontRotate);
+                        }
+                    }
+                } else if (!DeSmuME.fastForwardMode || DeSmuME.turboMode)
+                    data = DeSmuME.draw(emuBitmapMain, emuBitmapTouch, landscape && dontRotate);
+
+                if (direct && !directDrawFailed) {
+                    //the screens are already in the surface
+                } else if (lcdSwap) {
                     if (drawTouch) {
                         canvas.drawBitmap(emuBitmapTouch, srcMain, destMain, emuPaint);
                         canvas.drawBitmap(emuBitmapMain, srcTouch, destTouch, emuPaint);
@@ -672,21 +848,95 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
                 }
 
                 if (showfps) {
-                    if (data != fpsData || fpsText == null) {
+                    int reuse = DeSmuME.getLineReuse();
+                    int dropped = DeSmuME.getDroppedFrames();
+                    int repeated = DeSmuME.getRepeatedFrames();
+                    int underruns = DeSmuME.getSoundUnderruns();
+                    int overruns = DeSmuME.getSoundOverruns();
+                    int silent = DeSmuME.getSoundSilent();
+                    int cached = DeSmuME.getAdpcmCached();
+                    int skipped = DeSmuME.getSkipped3D();
+                    if (data != fpsData || reuse != lineReuse || dropped != droppedFrames || repeated != repeatedFrames
+                            || underruns != soundUnderruns || overruns != soundOverruns
+                            || silent != soundSilent || cached != adpcmCached || skipped != skipped3d || fpsText == null) {
                         int fps = (data >> 24) & 0xFF;
                         int fps3d = (data >> 16) & 0xFF;
                         int cpuload0 = (data >> 8) & 0xFF;
                         int cpuload1 = data & 0xFF;
 
-                        fpsText = "FPS: " + fps + "/" + fps3d + "(" + cpuload0 + "%/" + cpuload1 + "%)";
+                        fpsText = "FPS: " + fps + "/" + fps3d + "(" + cpuload0 + "%/" + cpuload1 + "%) 2D: " + reuse + "% Drop: " + dropped + " Rep: " + repeated
+                                + " Snd: " + underruns + "/" + overruns + " SPU: " + silent + "%/" + cached + "%" + " 3D skip: " + skipped;
                         fpsData = data;
+                        lineReuse = reuse;
+                        droppedFrames = dropped;
+                        repeatedFrames = repeated;
+                        soundUnderruns = underruns;
+                        soundOverruns = overruns;
+                        soundSilent = silent;
+                        adpcmCached = cached;
+                        skipped3d = skipped;
                     }
                     canvas.drawText(fpsText, 10, curhudsize, hudPaint);
+
+                    final long now = SystemClock.uptimeMillis();
+                    if (frameTimesText == null || now - frameTimesUpdated >= 500) {
+                        DeSmuME.getFrameTimes(frameTimes);
+                        frameTimesText = "Emu: " + frameTimeText(frameTimes, 0) + " Present: " + frameTimeText(frameTimes, 6)
+                                + String.format(Locale.US, " Input: %.1fms", DeSmuME.getInputLatency() / 1000.0f);
+                        final int ahead = DeSmuME.getRunAheadFrames();
+                        final int headroom = DeSmuME.getRunAheadHeadroom();
+                        if (ahead > 0)
+                            frameTimesText += String.format(Locale.US, " Ahead: %d (%.1fms left)", ahead, headroom / 1000.0f);
+                        frameTimesUpdated = now;
+                    }
+                    canvas.drawText(frameTimesText, 10, curhudsize * 3, hudPaint);
                 }
+
+                if (showProfile)
+                    drawProfile(canvas);
             }
 
         }
 
+        //p50/p95/p99 in milliseconds, and how many of the frames went over a 60fps frame
+        String frameTimeText(int[] times, int offset) {
+            return String.format(Locale.US, "%.1f/%.1f/%.1fms %d/%d", times[offset] / 1000.0f, times[offset + 1] / 1000.0f,
+                    times[offset + 2] / 1000.0f, times[offset + 4], times[offset + 5]);
+        }
+
+        //a line for each zone over the last frames, at the bottom left. the dim line across it is a 60fps frame
+        void drawProfile(Canvas canvas) {
+            final int frames = DeSmuME.getProfile(profileData);
+            if (frames < 2)
+                return;
+
+            final float graphWidth = getWidth() / 3.0f;
+            final float graphHeight = getHeight() / 4.0f;
+            final float left = 10;
+            final float bottom = getHeight() - 10;
+            final float step = graphWidth / (DeSmuME.PROFILE_FRAMES - 1);
+            //microseconds to pixels, with two frames' time the top of the graph
+            final float scale = graphHeight / 33333.0f;
+
+            profilePaint.setStrokeWidth(1);
+            profilePaint.setColor(Color.argb(128, 255, 255, 255));
+            canvas.drawLine(left, bottom - graphHeight / 2, left + graphWidth, bottom - graphHeight / 2, profilePaint);
+
+            for (int zone = 0; zone < DeSmuME.PROFILE_ZONES; zone++) {
+                int points = 0;
+                for (int i = 1; i < frames; i++) {
+                    final float prev = Math.min(profileData[(i - 1) * DeSmuME.PROFILE_ZONES + zone] * scale, graphHeight);
+                    final float cur = Math.min(profileData[i * DeSmuME.PROFILE_ZONES + zone] * scale, graphHeight);
+                    profileLines[points++] = left + (i - 1) * step;
+                    profileLines[points++] = bottom - prev;
+                    profileLines[points++] = left + i * step;
+                    profileLines[points++] = bottom - cur;
+                }
+                profilePaint.setColor(profileColors[zone]);
+                canvas.drawLines(profileLines, 0, points, profilePaint);
+            }
+        }
+
         @Override
         public boolean onTouchEvent(MotionEvent event) {
             return controls.onTouchEvent(event);
@@ -698,6 +948,7 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
                 sourceWidth = DeSmuME.getNativeWidth();
                 sourceHeight = DeSmuME.getNativeHeight();
                 resized = true;
+                directDrawFailed = false;
 
                 screenOption = Integer.valueOf(prefs.getString(Settings.SPECIFIC_SCREEN_ONLY, "0"));
                 final boolean hasScreenFilter = DeSmuME.getSettingInt(Settings.SCREEN_FILTER, 0) != 0;
@@ -834,10 +1085,21 @@ public class MainActivity extends Activity implements OnSharedPreferenceChangeLi
 
         @Override
         public void surfaceCreated(SurfaceHolder arg0) {
+            synchronized (view) {
+                surfaceValid = true;
+                directDrawFailed = false;
+            }
         }
 
         @Override
         public void surfaceDestroyed(SurfaceHolder arg0) {
+            synchronized (view) {
+                surfaceValid = false;
+                if (surfaceAttached) {
+                    DeSmuME.setDrawSurface(null);
+                    surfaceAttached = false;
+                }
+            }
         }
 
         @Override
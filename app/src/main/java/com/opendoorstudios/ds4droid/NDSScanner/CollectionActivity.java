@@ -4,6 +4,7 @@ import android.app.Activity;
 import android.app.ProgressDialog;
 import android.content.Intent;
 import android.graphics.Bitmap;
+import android.graphics.drawable.AnimationDrawable;
 import android.graphics.drawable.BitmapDrawable;
 import android.graphics.drawable.ColorDrawable;
 import android.graphics.drawable.Drawable;
@@ -175,24 +176,22 @@ public class CollectionActivity extends Activity implements GridView.OnItemClick
             }
 
             final ImageView image_view = view.findViewById(R.id.icon);
+            image_view.setTag(rom);
             if (rom.isIconLoaded()) {
-                image_view.setImageBitmap(rom.getIcon());
-                image_view.getDrawable().setFilterBitmap(false);
+                setIcon(image_view, rom, false);
 
-                // Delegate icon loading to an AsyncTask
+                // Delegate icon loading to an AsyncTask. the view may have been reused for another rom by the time it is done
             } else {
                 image_view.setImageDrawable(null);
                 new AsyncTask<Void, Void, Bitmap>() {
                     protected Bitmap doInBackground(Void... xx) {
+                        collection.loadIcons(rom);
                         return rom.getIcon();
                     }
 
                     protected void onPostExecute(Bitmap result) {
-                        Drawable[] transition = new Drawable[]{new ColorDrawable(0), new BitmapDrawable(getResources(), result)};
-                        transition[1].setFilterBitmap(false);
-                        TransitionDrawable drawable = new TransitionDrawable(transition);
-                        image_view.setImageDrawable(drawable);
-                        drawable.startTransition(100);
+                        if (image_view.getTag() == rom && result != null)
+                            setIcon(image_view, rom, true);
                     }
                 }.execute();
             }
@@ -201,6 +200,33 @@ public class CollectionActivity extends Activity implements GridView.OnItemClick
             return view;
         }
 
+        // the rom's icon, animated if it has a dsi animated icon
+        private void setIcon(ImageView image_view, NdsRom rom, boolean fade) {
+            final int steps = rom.getIconAnimationLength();
+            if (steps > 0) {
+                final AnimationDrawable animation = new AnimationDrawable();
+                for (int i = 0; i < steps; i++) {
+                    final Drawable frame = new BitmapDrawable(getResources(), rom.getIconAnimationFrame(i));
+                    frame.setFilterBitmap(false);
+                    animation.addFrame(frame, rom.getIconAnimationDuration(i));
+                }
+                animation.setOneShot(false);
+                image_view.setImageDrawable(animation);
+                animation.start();
+            } else if (fade) {
+                Drawable[] transition = new Drawable[]{new ColorDrawable(0), new BitmapDrawable(getResources(), rom.getIcon())};
+                transition[1].setFilterBitmap(false);
+                TransitionDrawable drawable = new TransitionDrawable(transition);
+                image_view.setImageDrawable(drawable);
+                drawable.startTransition(100);
+            } else {
+                image_view.setImageBitmap(rom.getIcon());
+                image_view.getDrawable().setFilterBitmap(false);
+            }
+        }
+
+        //----------------------------------------------------------------------
+
         @Override
         public void onScanStarted(RomCollection collection) {
             pd = new ProgressDialog(CollectionActivity.this);
@@ -1,10 +1,10 @@
 package com.opendoorstudios.ds4droid.NDSScanner;
 
 import android.graphics.Bitmap;
-import android.graphics.Canvas;
-import android.graphics.Paint;
 import android.util.Log;
 
+import com.opendoorstudios.ds4droid.DeSmuME;
+
 import net.sf.sevenzipjbinding.ExtractOperationResult;
 import net.sf.sevenzipjbinding.IInArchive;
 import net.sf.sevenzipjbinding.SevenZip;
@@ -40,6 +40,8 @@ public class NdsRom {
     SEVENZ_PATTERN = "^.*\\.(7Z|7z)$";
     // title, gamecode, makercode are tightly packed; no offset needed until info
     private static final int INFO_OFFSET = 0x56, INFO_ADDRESS = 0x68, ICON_OFFSET = 0x20;
+    // what getRomInfo returns and the database keeps: the start of the header, then the banner if there is one
+    private static final int INFO_HEADER_SIZE = 0x200, INFO_BANNER_SIZE = 0x840;
     protected final byte[] TITLE_BYTES = new byte[12],
             GAMECODE_BYTES = new byte[4],
             MAKERCODE_BYTES = new byte[2],
@@ -55,8 +57,11 @@ public class NdsRom {
             TITLE_IT_BYTES = new byte[256], // Italian
             TITLE_ES_BYTES = new byte[256]; // Spanish
     private final File FILE;
+    private byte[] info;
     private long game_code;
+    private int[] icons;
     private Bitmap icon;
+    private Bitmap[] icon_frames;
     private String title_jp, title_en, title_fr, title_de, title_it, title_es;
 
     //--------------------------------------------------------------------------
@@ -106,11 +111,76 @@ public class NdsRom {
         }
     }
 
+    private NdsRom(File file, byte[] info) {
+        FILE = file;
+        this.info = info;
+        final ByteBuffer buffer = ByteBuffer.wrap(info);
+        buffer.get(TITLE_BYTES).get(GAMECODE_BYTES).get(MAKERCODE_BYTES);
+        if (info.length >= INFO_HEADER_SIZE + INFO_BANNER_SIZE) {
+            buffer.position(INFO_ADDRESS);
+            buffer.get(INFO_BYTES);
+            buffer.position(INFO_HEADER_SIZE + ICON_OFFSET);
+            buffer.get(ICON_BYTES).get(PALETTE_BYTES)
+                    .get(TITLE_JP_BYTES).get(TITLE_EN_BYTES).get(TITLE_FR_BYTES)
+                    .get(TITLE_DE_BYTES).get(TITLE_IT_BYTES).get(TITLE_ES_BYTES);
+        }
+    }
+
     public static NdsRom MakeRom(File f) {
         final InputStream stream = NdsRom.getRomStream(f);
         return new NdsRom(f, stream);
     }
 
+    // from what getInfo returned
+    public static NdsRom MakeRom(File f, byte[] info) {
+        return new NdsRom(f, info);
+    }
+
+    // for the collection: .nds files have just their header and banner read, natively. archives are
+    // checked for a rom and read the slow way. null if the file has no rom
+    static NdsRom ScanRom(File f) {
+        final String name = f.getName();
+        if (name.matches(ROM_PATTERN)) {
+            final byte[] info = DeSmuME.getRomInfo(f.getAbsolutePath());
+            return info != null ? new NdsRom(f, info) : null;
+        }
+        try {
+            if (name.matches(ZIP_PATTERN)) {
+                if (!isRomArchive(new ZipFile(f)))
+                    return null;
+            } else if (name.matches(SEVENZ_PATTERN)) {
+                if (!isRomArchive(new RandomAccessFile(f, "r")))
+                    return null;
+            } else {
+                return null;
+            }
+        } catch (IOException e) {
+            return null;
+        }
+        final InputStream stream = NdsRom.getRomStream(f);
+        return stream != null ? new NdsRom(f, stream) : null;
+    }
+
+    //--------------------------------------------------------------------------
+
+    // the header and banner in the layout of getRomInfo, for the database
+    byte[] getInfo() {
+        if (info != null)
+            return info;
+        final boolean banner = composeInt(INFO_BYTES) > 0;
+        final ByteBuffer buffer = ByteBuffer.allocate(INFO_HEADER_SIZE + (banner ? INFO_BANNER_SIZE : 0));
+        buffer.put(TITLE_BYTES).put(GAMECODE_BYTES).put(MAKERCODE_BYTES);
+        if (banner) {
+            buffer.position(INFO_ADDRESS);
+            buffer.put(INFO_BYTES);
+            buffer.position(INFO_HEADER_SIZE + ICON_OFFSET);
+            buffer.put(ICON_BYTES).put(PALETTE_BYTES)
+                    .put(TITLE_JP_BYTES).put(TITLE_EN_BYTES).put(TITLE_FR_BYTES)
+                    .put(TITLE_DE_BYTES).put(TITLE_IT_BYTES).put(TITLE_ES_BYTES);
+        }
+        return buffer.array();
+    }
+
     //--------------------------------------------------------------------------
 
     private static int composeInt(byte[] bytes) {
@@ -277,44 +347,70 @@ public class NdsRom {
 
     //--------------------------------------------------------------------------
 
+    // the icons, decoded natively from the banner. null if there is no banner
+    int[] decodeIcons() {
+        return composeInt(INFO_BYTES) > 0 ? DeSmuME.getRomIcons(getInfo()) : null;
+    }
+
+    boolean hasIcons() {
+        return icons != null;
+    }
+
+    void setIcons(int[] icons) {
+        this.icons = icons;
+    }
+
+    // how the database keeps the icons
+    static byte[] packIcons(int[] icons) {
+        if (icons == null)
+            return null;
+        final ByteBuffer buffer = ByteBuffer.allocate(icons.length * 4).order(ByteOrder.LITTLE_ENDIAN);
+        buffer.asIntBuffer().put(icons);
+        return buffer.array();
+    }
+
+    static int[] unpackIcons(byte[] blob) {
+        if (blob == null)
+            return null;
+        final int[] icons = new int[blob.length / 4];
+        ByteBuffer.wrap(blob).order(ByteOrder.LITTLE_ENDIAN).asIntBuffer().get(icons);
+        return icons;
+    }
+
+    //--------------------------------------------------------------------------
+
     public Bitmap getIcon() {
-        if (icon == null && composeInt(INFO_BYTES) > 0) {
-            icon = Bitmap.createBitmap(32, 32, Bitmap.Config.ARGB_8888);
-            Canvas canvas = new Canvas(icon);
-            Paint paint = new Paint();
-
-            int x, y, index_a, index_b, color_a, color_b;
-            ByteBuffer palette = ByteBuffer.wrap(PALETTE_BYTES).order(ByteOrder.LITTLE_ENDIAN);
-
-            for (int i = 0; i < 512; i++) {
-                index_a = (ICON_BYTES[i]) & 15;
-                index_b = (ICON_BYTES[i] >>> 4) & 15;
-
-                color_a = palette.getShort(index_a * 2);
-                color_b = palette.getShort(index_b * 2);
-
-                // Oh fuck me
-                x = (2 * (i % 4))
-                        + (8 * ((i / 32) % 4));
-                y = ((i / 4) % 8)
-                        + (8 * (i / 128));
-
-                // X b b b b b g g|g g g r r r r r
-                paint.setARGB(index_a != 0 ? 255 : 0,
-                        (color_a << 3) & 255,
-                        (color_a >>> 2) & 255,
-                        (color_a >>> 7) & 255);
-                canvas.drawPoint(x, y, paint);
-                paint.setARGB(index_b != 0 ? 255 : 0,
-                        (color_b << 3) & 255,
-                        (color_b >>> 2) & 255,
-                        (color_b >>> 7) & 255);
-                canvas.drawPoint(x + 1, y, paint);
-            }
+        if (icon == null) {
+            if (icons == null)
+                icons = decodeIcons();
+            if (icons != null)
+                icon = getIconFrame(0);
         }
         return icon;
     }
 
+    private Bitmap getIconFrame(int frame) {
+        if (icon_frames == null)
+            icon_frames = new Bitmap[icons[0]];
+        if (icon_frames[frame] == null)
+            icon_frames[frame] = Bitmap.createBitmap(icons, 2 + icons[1] + frame * 32 * 32, 32, 32, 32, Bitmap.Config.ARGB_8888);
+        return icon_frames[frame];
+    }
+
+    // the steps of the dsi animated icon, 0 if there isn't one. call after getIcon
+    public int getIconAnimationLength() {
+        return icons != null ? icons[1] : 0;
+    }
+
+    public Bitmap getIconAnimationFrame(int step) {
+        return getIconFrame(icons[2 + step] & 0xFFFF);
+    }
+
+    // in milliseconds
+    public int getIconAnimationDuration(int step) {
+        return (icons[2 + step] >>> 16) * 1000 / 60;
+    }
+
     //--------------------------------------------------------------------------
 
     public boolean isIconLoaded() {
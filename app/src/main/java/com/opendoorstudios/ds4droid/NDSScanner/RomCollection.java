@@ -11,11 +11,18 @@ import android.util.Log;
 import java.io.File;
 import java.io.FileFilter;
 import java.io.IOException;
-import java.io.InputStream;
 import java.io.RandomAccessFile;
+import java.util.ArrayList;
+import java.util.HashMap;
 import java.util.HashSet;
 import java.util.LinkedList;
+import java.util.List;
+import java.util.Map;
 import java.util.Set;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Future;
 import java.util.zip.ZipFile;
 
 //==============================================================================
@@ -63,7 +70,12 @@ public class RomCollection {
             ALL_ROMS_FILTER = file -> NDS_FILTER.accept(file)
                     || ZIP_FILTER.accept(file)
                     /*|| RAR_FILTER.accept( file )*/
-                    || SEVENZ_FILTER.accept(file);
+                    || SEVENZ_FILTER.accept(file),
+
+    // by name only, what is inside an archive is checked when it gets scanned
+    CANDIDATE_FILTER = file -> !file.isDirectory() && (file.getName().matches(NdsRom.ROM_PATTERN)
+                    || file.getName().matches(NdsRom.ZIP_PATTERN)
+                    || file.getName().matches(NdsRom.SEVENZ_PATTERN));
     private final File ROOT;
     private final Set<ScanListener> LISTENERS = new HashSet<>();
     private SQLiteDatabase DB;
@@ -107,26 +119,55 @@ public class RomCollection {
             public Void doInBackground(Void... x) {
                 SharedPreferences prefs = context.getSharedPreferences("ndsscanner", Context.MODE_PRIVATE);
 
-                // Delete first, ask questions later
-                Cursor cursor = DB.query("roms", new String[]{"path"}, null, null, null, null, null);
+                // Delete first, ask questions later. the rest is remembered with the time the file had when it was read
+                final Map<String, Long> known = new HashMap<>();
+                Cursor cursor = DB.query("roms", new String[]{"path", "mtime"}, null, null, null, null, null);
                 DB.beginTransaction();
                 while (cursor.moveToNext()) {
                     if (!new File(cursor.getString(0)).exists()) {
                         DB.delete("roms", "path=?", new String[]{cursor.getString(0)});
+                    } else if (!cursor.isNull(1)) {
+                        known.put(cursor.getString(0), cursor.getLong(1));
                     }
                 }
                 DB.setTransactionSuccessful();
                 DB.endTransaction();
                 cursor.close();
 
-                long last_scan = prefs.getLong("last_scan", 0);
                 boolean recursive = prefs.getBoolean("recursive", true);
 
+                final List<File> files = new ArrayList<>();
+                scanDirectory(ROOT, recursive, 0, files);
+
+                // only the new and changed files get read, on a thread per core
+                final ExecutorService pool = Executors.newFixedThreadPool(Runtime.getRuntime().availableProcessors());
+                final List<File> scanned = new ArrayList<>();
+                final List<Future<ContentValues>> results = new ArrayList<>();
+                for (final File f : files) {
+                    final long mtime = f.lastModified();
+                    final Long old = known.get(f.getAbsolutePath());
+                    if (old != null && old == mtime)
+                        continue;
+                    scanned.add(f);
+                    results.add(pool.submit(() -> scanRom(f, mtime)));
+                }
+                pool.shutdown();
+
                 DB.beginTransaction();
-                scanDirectory(ROOT, last_scan, recursive, 0);
+                for (int i = 0; i < results.size(); i++) {
+                    ContentValues vals = null;
+                    try {
+                        vals = results.get(i).get();
+                    } catch (InterruptedException | ExecutionException e) {
+                        Log.d("nds4droid", "Unable to scan " + scanned.get(i).getAbsolutePath());
+                    }
+                    if (vals != null)
+                        DB.insertWithOnConflict("roms", null, vals, SQLiteDatabase.CONFLICT_REPLACE);
+                    else
+                        DB.delete("roms", "path=?", new String[]{scanned.get(i).getAbsolutePath()});
+                }
                 DB.setTransactionSuccessful();
                 DB.endTransaction();
-                prefs.edit().putLong("last_scan", System.currentTimeMillis()).apply();
                 return null;
             }
 
@@ -150,35 +191,21 @@ public class RomCollection {
 
     //--------------------------------------------------------------------------
 
-    private void scanDirectory(File file, long last_scan, boolean recursive, int recursionLevel) {
-
-        ContentValues vals = new ContentValues();
-        NdsRom rom;
-        InputStream stream;
+    // collects the files that may be roms. every directory is listed on each scan, since a directory's time
+    // doesn't change with what happens further down in it; the files themselves are only read when they changed
+    private void scanDirectory(File file, boolean recursive, int recursionLevel, List<File> files) {
 
         if (recursionLevel > 5)
             return; //if the ROMs are more than 5 layers deep... well... they'll just have to use the file browser
 
         try {
-            // Insert DB entries for all matching rom files
-            for (File f : file.listFiles(ALL_ROMS_FILTER)) {
-                vals.clear();
-
-                rom = NdsRom.MakeRom(f);
-                if (f == null)
-                    continue;
-
-                vals.put("path", f.getAbsolutePath());
-                vals.put("title", rom.getTitle());
-                vals.put("gamecode", rom.getGameCode());
-
-                DB.insertWithOnConflict("roms", null, vals, SQLiteDatabase.CONFLICT_IGNORE);
+            for (File f : file.listFiles(CANDIDATE_FILTER)) {
+                files.add(f);
             }
 
             // Subdirectories
             if (recursive) for (File dir : file.listFiles(DIR_FILTER)) {
-                if (dir.lastModified() > last_scan)
-                    scanDirectory(dir, last_scan, true, recursionLevel + 1);
+                scanDirectory(dir, true, recursionLevel + 1, files);
             }
         } catch (Exception e) {
             //on my x86 emulator I'm not allowed to read /mnt/sdcard/.android_secure
@@ -190,6 +217,49 @@ public class RomCollection {
 
     //--------------------------------------------------------------------------
 
+    // runs on the scanning pool
+    private static ContentValues scanRom(File f, long mtime) {
+        final NdsRom rom = NdsRom.ScanRom(f);
+        if (rom == null)
+            return null;
+
+        final ContentValues vals = new ContentValues();
+        vals.put("path", f.getAbsolutePath());
+        vals.put("title", rom.getTitle());
+        vals.put("gamecode", rom.getGameCode());
+        vals.put("mtime", mtime);
+        vals.put("info", rom.getInfo());
+        vals.put("icons", NdsRom.packIcons(rom.decodeIcons()));
+        return vals;
+    }
+
+    //--------------------------------------------------------------------------
+
+    // gives rom the icons the database has for it, decoding them (and keeping them for next time) if it has none.
+    // getRoms leaves them out, so that they are only held for the roms that get shown
+    public void loadIcons(NdsRom rom) {
+        if (rom.hasIcons())
+            return;
+        final String path = rom.getFile().getAbsolutePath();
+        final Cursor c = DB.query("roms", new String[]{"icons"}, "path=?", new String[]{path}, null, null, null);
+        final byte[] blob = c.moveToFirst() && !c.isNull(0) ? c.getBlob(0) : null;
+        c.close();
+        if (blob != null) {
+            rom.setIcons(NdsRom.unpackIcons(blob));
+            return;
+        }
+
+        final int[] icons = rom.decodeIcons();
+        rom.setIcons(icons);
+        if (icons != null) {
+            final ContentValues vals = new ContentValues();
+            vals.put("icons", NdsRom.packIcons(icons));
+            DB.update("roms", vals, "path=?", new String[]{path});
+        }
+    }
+
+    //--------------------------------------------------------------------------
+
     public void addListener(ScanListener listener) {
         LISTENERS.add(listener);
     }
@@ -211,10 +281,12 @@ public class RomCollection {
     public NdsRom[] getRoms() {
         if (roms == null) {
             final LinkedList<NdsRom> list = new LinkedList<>();
-            Cursor c = DB.query("roms", new String[]{"path"},
+            Cursor c = DB.query("roms", new String[]{"path", "info"},
                     null, null, null, null, "title");
             while (c.moveToNext()) {
-                final NdsRom rom = NdsRom.MakeRom(new File(c.getString(0)));
+                // what the scan read, rather than reading every file again
+                final File file = new File(c.getString(0));
+                final NdsRom rom = c.isNull(1) ? NdsRom.MakeRom(file) : NdsRom.MakeRom(file, c.getBlob(1));
                 if (rom == null)
                     continue;
                 list.add(rom);
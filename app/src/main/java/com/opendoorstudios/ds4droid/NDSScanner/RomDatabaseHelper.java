@@ -9,7 +9,7 @@ public class RomDatabaseHelper extends SQLiteOpenHelper {
     //--------------------------------------------------------------------------
 
     public static final String DB_NAME = "roms.db";
-    public static final int DB_VERSION = 1;
+    public static final int DB_VERSION = 3;
 
     //--------------------------------------------------------------------------
 
@@ -25,7 +25,10 @@ public class RomDatabaseHelper extends SQLiteOpenHelper {
                 "CREATE TABLE roms            ( " +
                         "path     TEXT PRIMARY KEY, " +
                         "title    TEXT            , " +
-                        "gamecode TEXT              " +
+                        "gamecode TEXT            , " +
+                        "mtime    INTEGER         , " +
+                        "info     BLOB            , " +
+                        "icons    BLOB              " +
                         ");");
     }
 
@@ -34,6 +37,13 @@ public class RomDatabaseHelper extends SQLiteOpenHelper {
     @Override
     public void onUpgrade(SQLiteDatabase db, int old_version, int new_version) {
         switch (old_version) {
+            case 1:
+                // when the file was read and what was in it, so a rescan only reads files that changed
+                db.execSQL("ALTER TABLE roms ADD COLUMN mtime INTEGER;");
+                db.execSQL("ALTER TABLE roms ADD COLUMN info BLOB;");
+            case 2:
+                // the icons decoded from info, filled in by the scan or the first time the collection shows them
+                db.execSQL("ALTER TABLE roms ADD COLUMN icons BLOB;");
         }
     }
 
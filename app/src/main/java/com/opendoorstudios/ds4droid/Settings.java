@@ -37,7 +37,12 @@ public class Settings extends PreferenceActivity {
     public static final String SHOW_TOUCH_MESSAGE = "ShowTouchMessage";
     public static final String DESMUME_PATH = "DeSmuMEPath";
     public static final String SHOW_FPS = "DisplayFps";
+    public static final String PROFILER = "Profiler";
+    public static final String SYSTEM_TRACE = "SystemTrace";
     public static final String FRAME_SKIP = "FrameSkip";
+    public static final String COST_FRAME_SKIP = "CostFrameSkip";
+    public static final String RUN_AHEAD = "RunAhead";
+    public static final String TURBO = "Turbo";
     public static final String SCREEN_FILTER = "Filter";
     public static final String RENDERER = "Renderer";
     public static final String ENABLE_SOUND = "SoundCore";
@@ -67,6 +72,7 @@ public class Settings extends PreferenceActivity {
     public static final String DONT_ROTATE_LCDS = "WindowRotate";
     public static final String LANGUAGE = "Language";
     public static final String ENABLE_MICROPHONE = "EnableMicrophone";
+    public static final String MIC_BUFFER = "MicBuffer";
     public static final String ALWAYS_TOUCH = "Controls.AlwaysTouch";
     public static final String MAINTAIN_ASPECT_RATIO = "MaintainAspectRatio";
     public static final String MAIN_SCREEN_ONLY = "MainScreenOnly";
@@ -75,8 +81,29 @@ public class Settings extends PreferenceActivity {
     public static final String LAST_ROM_DIR = "LastROMDir";
     public static final String CPU_MODE = "CpuMode";
     public static final String SOUND_SYNC_MODE = "SynchMode";
+    public static final String SOUND_SYNC_METHOD = "SynchMethod";
+    public static final String AUDIO_THREAD = "AudioThread";
     public static final String JIT_SIZE = "JitSize";
+    public static final String JIT_CACHE_SIZE = "JitCacheSize";
+    public static final String CPU_SKEW = "CpuSkew";
+    public static final String SDK_HLE = "SdkHle";
+    public static final String GAME_PRESETS = "GamePresets";
+    public static final String CORE_PLACEMENT = "CorePlacement";
+    public static final String ROM_CACHE_SIZE = "RomCacheSize";
+    public static final String QUICK_SAVE_COMPRESSION = "QuickSaveCompression";
     public static final String ENABLE_FOG = "EnableFog";
+    public static final String PIPELINED_RENDER = "PipelinedRender";
+    public static final String GPU_COMPOSITE = "GPUComposite";
+    public static final String SOFTRAST_SCALE = "SoftRastScale";
+    public static final String QUALITY_GOVERNOR = "QualityGovernor";
+    public static final String PERSISTENT_TEXCACHE = "PersistentTexCache";
+    public static final String PARALLEL_GPU_2D = "ParallelGPU2D";
+    public static final String THREADED_GEOMETRY = "ThreadedGeometry";
+    public static final String DIRECT_DRAW = "DirectDraw";
+    public static final String GPU_FILTER = "GPUFilter";
+    public static final String VSYNC_PACING = "VsyncPacing";
+    public static final String DISPLAY_PACING = "DisplayPacing";
+    public static final String DISPLAY_LOCK_AUDIO = "DisplayLockAudio";
     public static final String ENABLE_AUTOSAVE = "EnableAutosave";
     public static final String AUTOSVAE_FREQUENCY = "AutosaveFrequency";
     public static final String DISABLE_ROM_BROWSER = "DisableROMBrowser";
@@ -189,8 +216,24 @@ public class Settings extends PreferenceActivity {
             editor.putBoolean(SHOW_TOUCH_MESSAGE, true);
         if (!prefs.contains(SHOW_FPS))
             editor.putBoolean(SHOW_FPS, true);
+        if (!prefs.contains(PROFILER))
+            editor.putBoolean(PROFILER, false);
+        if (!prefs.contains(SYSTEM_TRACE))
+            editor.putBoolean(SYSTEM_TRACE, false);
+        if (!prefs.contains(DIRECT_DRAW))
+            editor.putBoolean(DIRECT_DRAW, true);
+        if (!prefs.contains(GPU_FILTER))
+            editor.putBoolean(GPU_FILTER, true);
+        if (!prefs.contains(VSYNC_PACING))
+            editor.putBoolean(VSYNC_PACING, true);
+        if (!prefs.contains(DISPLAY_PACING))
+            editor.putBoolean(DISPLAY_PACING, false);
+        if (!prefs.contains(DISPLAY_LOCK_AUDIO))
+            editor.putBoolean(DISPLAY_LOCK_AUDIO, false);
         if (!prefs.contains(FRAME_SKIP))
             editor.putString(FRAME_SKIP, "3");
+        if (!prefs.contains(COST_FRAME_SKIP))
+            editor.putBoolean(COST_FRAME_SKIP, false);
         if (!prefs.contains(SCREEN_FILTER))
             editor.putString(SCREEN_FILTER, "0");
         if (!prefs.contains(RENDERER))
@@ -205,6 +248,8 @@ public class Settings extends PreferenceActivity {
             editor.putBoolean(DONT_ROTATE_LCDS, false);
         if (!prefs.contains(ENABLE_MICROPHONE))
             editor.putBoolean(ENABLE_MICROPHONE, true);
+        if (!prefs.contains(MIC_BUFFER))
+            editor.putString(MIC_BUFFER, "40");
         if (!prefs.contains(MAINTAIN_ASPECT_RATIO))
             editor.putBoolean(MAINTAIN_ASPECT_RATIO, true);
         if (!prefs.contains(MAIN_SCREEN_ONLY))
@@ -217,10 +262,28 @@ public class Settings extends PreferenceActivity {
             editor.putString(CPU_MODE, "0");
         if (!prefs.contains(SOUND_SYNC_MODE))
             editor.putString(SOUND_SYNC_MODE, "0");
+        if (!prefs.contains(SOUND_SYNC_METHOD))
+            editor.putString(SOUND_SYNC_METHOD, "0");
+        if (!prefs.contains(AUDIO_THREAD))
+            editor.putBoolean(AUDIO_THREAD, false);
         if (!prefs.contains(ENABLE_FOG))
             editor.putBoolean(ENABLE_FOG, true);
         if (!prefs.contains(JIT_SIZE))
             editor.putInt(JIT_SIZE, 10);
+        if (!prefs.contains(JIT_CACHE_SIZE))
+            editor.putString(JIT_CACHE_SIZE, "2");
+        if (!prefs.contains(CPU_SKEW))
+            editor.putString(CPU_SKEW, "0");
+        if (!prefs.contains(SDK_HLE))
+            editor.putBoolean(SDK_HLE, true);
+        if (!prefs.contains(GAME_PRESETS))
+            editor.putBoolean(GAME_PRESETS, true);
+        if (!prefs.contains(CORE_PLACEMENT))
+            editor.putString(CORE_PLACEMENT, "0");
+        if (!prefs.contains(ROM_CACHE_SIZE))
+            editor.putString(ROM_CACHE_SIZE, "2");
+        if (!prefs.contains(QUICK_SAVE_COMPRESSION))
+            editor.putString(QUICK_SAVE_COMPRESSION, "1");
         if (!prefs.contains(ENABLE_AUTOSAVE))
             editor.putBoolean(ENABLE_AUTOSAVE, false);
         if (!prefs.contains(AUTOSVAE_FREQUENCY))
@@ -23,3 +23,8 @@ endif
 
 include $(LOCAL_BUILD_PATH)/cpudetect/cpudetect.mk
 include $(LOCAL_BUILD_PATH)/desmume/src/android/7z/7z.mk
+
+# ndk-build DESMUME_BENCHMARK=1 also builds the benchmarks
+ifeq ($(DESMUME_BENCHMARK),1)
+include $(LOCAL_BUILD_PATH)/benchmark.mk
+endif
@@ -0,0 +1,49 @@
+# Android ndk makefile for desmumebench, the benchmarks of the core's kernels
+#
+# It is only built when asked for:
+#   ndk-build DESMUME_BENCHMARK=1
+# and runs from adb shell next to the library it links against:
+#   adb push libs/arm64-v8a/desmumebench libs/arm64-v8a/libdesmumearm64.so /data/local/tmp
+#   adb shell "cd /data/local/tmp && LD_LIBRARY_PATH=. ./desmumebench -c 4 game.nds game.dst"
+# The flags have to be the ones the library was built with, since they change the core's headers.
+
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+
+LOCAL_MODULE    		:= 	desmumebench
+LOCAL_C_INCLUDES		:= 	$(LOCAL_PATH)/desmume/src \
+							$(LOCAL_PATH)/desmume/src/android \
+							$(LOCAL_PATH)/desmume/src/android/7z/CPP \
+							$(LOCAL_PATH)/desmume/src/android/7z/CPP/include_windows \
+
+LOCAL_SRC_FILES			:= 	desmume/src/android/benchmark.cpp \
+							desmume/src/android/drawbench.cpp
+
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_SHARED_LIBRARIES 	:= libdesmumeneon
+LOCAL_ARM_NEON 			:= true
+LOCAL_ARM_MODE 			:= arm
+LOCAL_CFLAGS			:= -DANDROID -DHAVE_LIBZ -DNO_MEMDEBUG -DNO_GPUDEBUG -DHAVE_JIT -DHAVE_NEON=1 -mfloat-abi=softfp -mfpu=neon-fp16 -marm -march=armv7-a -mtune=cortex-a7
+endif
+
+ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+LOCAL_SHARED_LIBRARIES 	:= libdesmumearm64
+LOCAL_ARM_MODE 			:= arm
+LOCAL_CFLAGS			:= -DANDROID -DHAVE_LIBZ -DNO_MEMDEBUG -DNO_GPUDEBUG -DHAVE_JIT -march=armv8-a -mtune=cortex-a53 -fpermissive
+endif
+
+ifeq ($(TARGET_ARCH_ABI),x86)
+LOCAL_SHARED_LIBRARIES 	:= libdesmumex86
+LOCAL_CFLAGS			:= -DANDROID -DHAVE_LIBZ -DNO_MEMDEBUG -DNO_GPUDEBUG -DHAVE_JIT -march=i686 -mtune=atom -mssse3 -mfpmath=sse -m32 -fno-branch-count-reg
+endif
+
+ifeq ($(TARGET_ARCH_ABI),x86_64)
+LOCAL_SHARED_LIBRARIES 	:= libdesmumex64
+LOCAL_CFLAGS			:= -DANDROID -DHAVE_LIBZ -DNO_MEMDEBUG -DNO_GPUDEBUG -DHAVE_JIT -mtune=atom -mssse3 -mfpmath=sse -m64 -fno-branch-count-reg
+endif
+
+LOCAL_LDLIBS 			:= -llog -lz
+
+include $(BUILD_EXECUTABLE)
@@ -20,6 +20,7 @@
 #include "FIFO.h"
 
 #include <string.h>
+#include <algorithm>
 
 #include "armcpu.h"
 #include "debug.h"
@@ -32,101 +33,100 @@
 // ========================================================= IPC FIFO
 IPC_FIFO ipc_fifo[2];
 
+//the empty and full bits of IPCFIFOCNT aren't kept up to date as words go through: they follow from the sizes of the
+//two fifos, and IPC_FIFOreadCnt() works them out when the register is read. the register itself holds the rest
+#define IPCFIFOCNT_STATUS (IPCFIFOCNT_SENDEMPTY | IPCFIFOCNT_SENDFULL | IPCFIFOCNT_RECVEMPTY | IPCFIFOCNT_RECVFULL)
+
+static FORCEINLINE u16 IPC_FIFOcntStored(u8 proc) { return T1ReadWord(MMU.MMU_MEM[proc][0x40], 0x184); }
+static FORCEINLINE void IPC_FIFOcntStore(u8 proc, u16 cnt) { T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt); }
+
+//the irq is flagged whatever happens, but unlike setIF() this only stops the cpu loop to look at it if the receiving
+//cpu can act on it now: it's enabled in IE, and either the cpu is halted waiting for one or IME lets it through.
+//a write to IE or IME reschedules by itself, so one that only becomes takeable later is still seen then
+static void IPC_FIFOirq(u8 proc, u32 num)
+{
+	MMU.reg_IF_bits[proc] |= 1 << num;
+	armcpu_t &cpu = proc ? NDS_ARM7 : NDS_ARM9;
+	if((MMU.reg_IE[proc] & (1 << num)) && (cpu.waitIRQ || MMU.reg_IME[proc]))
+		NDS_Reschedule();
+}
+
 void IPC_FIFOinit(u8 proc)
 {
 	memset(&ipc_fifo[proc], 0, sizeof(IPC_FIFO));
-	T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, 0x00000101);
+	IPC_FIFOcntStore(proc, IPCFIFOCNT_SENDEMPTY | IPCFIFOCNT_RECVEMPTY);
+}
+
+u16 IPC_FIFOreadCnt(u8 proc)
+{
+	u16 cnt = IPC_FIFOcntStored(proc) & ~IPCFIFOCNT_STATUS;
+	const u8 sendSize = ipc_fifo[proc].size;
+	const u8 recvSize = ipc_fifo[proc^1].size;
+	if(sendSize == 0) cnt |= IPCFIFOCNT_SENDEMPTY;
+	if(sendSize == IPC_FIFO_SIZE) cnt |= IPCFIFOCNT_SENDFULL;
+	if(recvSize == 0) cnt |= IPCFIFOCNT_RECVEMPTY;
+	if(recvSize == IPC_FIFO_SIZE) cnt |= IPCFIFOCNT_RECVFULL;
+	//kept in the register too, for whatever looks at the io memory directly (savestates, debuggers)
+	IPC_FIFOcntStore(proc, cnt);
+	return cnt;
 }
 
 void IPC_FIFOsend(u8 proc, u32 val)
 {
-	u16 cnt_l = T1ReadWord(MMU.MMU_MEM[proc][0x40], 0x184);
+	NDS_SyncCpus();
+	u16 cnt_l = IPC_FIFOcntStored(proc);
 	if (!(cnt_l & IPCFIFOCNT_FIFOENABLE)) return;			// FIFO disabled
 	u8	proc_remote = proc ^ 1;
 
-	if (ipc_fifo[proc].size > 15)
+	IPC_FIFO &fifo = ipc_fifo[proc];
+	if (fifo.size == IPC_FIFO_SIZE)
 	{
-		cnt_l |= IPCFIFOCNT_FIFOERROR;
-		T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
+		IPC_FIFOcntStore(proc, cnt_l | IPCFIFOCNT_FIFOERROR);
 		return;
 	}
 
-	u16 cnt_r = T1ReadWord(MMU.MMU_MEM[proc_remote][0x40], 0x184);
+	//LOG("IPC%s send FIFO 0x%08X size %03i (l 0x%X, tail %02i)\n",
+	//	proc?"7":"9", val, fifo.size, cnt_l, fifo.tail);
 
-	//LOG("IPC%s send FIFO 0x%08X size %03i (l 0x%X, tail %02i) (r 0x%X, tail %02i)\n", 
-	//	proc?"7":"9", val, ipc_fifo[proc].size, cnt_l, ipc_fifo[proc].tail, cnt_r, ipc_fifo[proc^1].tail);
-	
-	cnt_l &= 0xBFFC;		// clear send empty bit & full
-	cnt_r &= 0xBCFF;		// set recv empty bit & full
-	ipc_fifo[proc].buf[ipc_fifo[proc].tail] = val;
-	ipc_fifo[proc].tail++;
-	ipc_fifo[proc].size++;
-	if (ipc_fifo[proc].tail > 15) ipc_fifo[proc].tail = 0;
-	
-	if (ipc_fifo[proc].size > 15)
-	{
-		cnt_l |= IPCFIFOCNT_SENDFULL;		// set send full bit
-		cnt_r |= IPCFIFOCNT_RECVFULL;		// set recv full bit
-	}
+	fifo.buf[fifo.tail] = val;
+	fifo.tail = (fifo.tail + 1) & (IPC_FIFO_SIZE - 1);
+	fifo.size++;
 
-	T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
-	T1WriteWord(MMU.MMU_MEM[proc_remote][0x40], 0x184, cnt_r);
-
-	if(cnt_r&IPCFIFOCNT_RECVIRQEN)
-		NDS_makeIrq(proc_remote, IRQ_BIT_IPCFIFO_RECVNONEMPTY);
-
-	NDS_Reschedule();
+	if(IPC_FIFOcntStored(proc_remote) & IPCFIFOCNT_RECVIRQEN)
+		IPC_FIFOirq(proc_remote, IRQ_BIT_IPCFIFO_RECVNONEMPTY);
 }
 
 u32 IPC_FIFOrecv(u8 proc)
 {
-	u16 cnt_l = T1ReadWord(MMU.MMU_MEM[proc][0x40], 0x184);
+	NDS_SyncCpus();
+	u16 cnt_l = IPC_FIFOcntStored(proc);
 	if (!(cnt_l & IPCFIFOCNT_FIFOENABLE)) return (0);									// FIFO disabled
 	u8	proc_remote = proc ^ 1;
 
-	u32 val = 0;
-
-	if ( ipc_fifo[proc_remote].size == 0 )		// remote FIFO error
+	IPC_FIFO &fifo = ipc_fifo[proc_remote];
+	if ( fifo.size == 0 )		// remote FIFO error
 	{
-		cnt_l |= IPCFIFOCNT_FIFOERROR;
-		T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
+		IPC_FIFOcntStore(proc, cnt_l | IPCFIFOCNT_FIFOERROR);
 		return (0);
 	}
 
-	u16 cnt_r = T1ReadWord(MMU.MMU_MEM[proc_remote][0x40], 0x184);
+	u32 val = fifo.buf[fifo.head];
+	fifo.head = (fifo.head + 1) & (IPC_FIFO_SIZE - 1);
+	fifo.size--;
 
-	cnt_l &= 0xBCFF;		// clear send full bit & empty
-	cnt_r &= 0xBFFC;		// set recv full bit & empty
+	//LOG("IPC%s recv FIFO 0x%08X size %03i (l 0x%X, head %02i)\n",
+	//	proc?"7":"9", val, fifo.size, cnt_l, fifo.head);
 
-	val = ipc_fifo[proc_remote].buf[ipc_fifo[proc_remote].head];
-	ipc_fifo[proc_remote].head++;
-	ipc_fifo[proc_remote].size--;
-	if (ipc_fifo[proc_remote].head > 15) ipc_fifo[proc_remote].head = 0;
-	
-	//LOG("IPC%s recv FIFO 0x%08X size %03i (l 0x%X, tail %02i) (r 0x%X, tail %02i)\n", 
-	//	proc?"7":"9", val, ipc_fifo[proc].size, cnt_l, ipc_fifo[proc].tail, cnt_r, ipc_fifo[proc^1].tail);
-
-	if ( ipc_fifo[proc_remote].size == 0 )		// FIFO empty
-	{
-		cnt_l |= IPCFIFOCNT_RECVEMPTY;
-		cnt_r |= IPCFIFOCNT_SENDEMPTY;
-
-		if(cnt_r&IPCFIFOCNT_SENDIRQEN)
-			NDS_makeIrq(proc_remote, IRQ_BIT_IPCFIFO_SENDEMPTY);
-	}
-
-	T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
-	T1WriteWord(MMU.MMU_MEM[proc_remote][0x40], 0x184, cnt_r);
-
-	NDS_Reschedule();
+	if ( fifo.size == 0 && (IPC_FIFOcntStored(proc_remote) & IPCFIFOCNT_SENDIRQEN) )		// FIFO empty
+		IPC_FIFOirq(proc_remote, IRQ_BIT_IPCFIFO_SENDEMPTY);
 
 	return (val);
 }
 
 void IPC_FIFOcnt(u8 proc, u16 val)
 {
-	u16 cnt_l = T1ReadWord(MMU.MMU_MEM[proc][0x40], 0x184);
-	u16 cnt_r = T1ReadWord(MMU.MMU_MEM[proc^1][0x40], 0x184);
+	NDS_SyncCpus();
+	u16 cnt_l = IPC_FIFOcntStored(proc);
 
 	if (val & IPCFIFOCNT_FIFOERROR)
 	{
@@ -137,30 +137,19 @@ void IPC_FIFOcnt(u8 proc, u16 val)
 	if (val & IPCFIFOCNT_SENDCLEAR)
 	{
 		ipc_fifo[proc].head = 0; ipc_fifo[proc].tail = 0; ipc_fifo[proc].size = 0;
-
-		cnt_l |= IPCFIFOCNT_SENDEMPTY;
-		cnt_r |= IPCFIFOCNT_RECVEMPTY;
-		
-		cnt_l &= ~IPCFIFOCNT_SENDFULL;
-		cnt_r &= ~IPCFIFOCNT_RECVFULL;
-
 	}
 	cnt_l &= ~IPCFIFOCNT_WRITEABLE;
 	cnt_l |= val & IPCFIFOCNT_WRITEABLE;
+	IPC_FIFOcntStore(proc, cnt_l);
 
 	//IPCFIFOCNT_SENDIRQEN may have been set (and/or the fifo may have been cleared) so we may need to trigger this irq
 	//(this approach is used by libnds fifo system on occasion in fifoInternalSend, and began happening frequently for value32 with r4326)
-	if(cnt_l&IPCFIFOCNT_SENDIRQEN) if(cnt_l & IPCFIFOCNT_SENDEMPTY)
-		NDS_makeIrq(proc, IRQ_BIT_IPCFIFO_SENDEMPTY);
+	if(cnt_l&IPCFIFOCNT_SENDIRQEN) if(ipc_fifo[proc].size == 0)
+		IPC_FIFOirq(proc, IRQ_BIT_IPCFIFO_SENDEMPTY);
 
 	//IPCFIFOCNT_RECVIRQEN may have been set so we may need to trigger this irq
-	if(cnt_l&IPCFIFOCNT_RECVIRQEN) if(!(cnt_l & IPCFIFOCNT_RECVEMPTY))
-		NDS_makeIrq(proc, IRQ_BIT_IPCFIFO_RECVNONEMPTY);
-
-	T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
-	T1WriteWord(MMU.MMU_MEM[proc^1][0x40], 0x184, cnt_r);
-
-	NDS_Reschedule();
+	if(cnt_l&IPCFIFOCNT_RECVIRQEN) if(ipc_fifo[proc^1].size != 0)
+		IPC_FIFOirq(proc, IRQ_BIT_IPCFIFO_RECVNONEMPTY);
 }
 
 // ========================================================= GFX FIFO
@@ -205,6 +194,28 @@ static bool IsMatrixStackCommand(u8 cmd)
 	return cmd == 0x11 || cmd == 0x12;
 }
 
+//while a batch is open, sends skip the per-command event handling and reschedule.
+//the fifo only grows during a batch, so handling events after the first and the last send
+//raises the same flags, dma triggers and irq changes as doing it after every send.
+static bool gxfifo_batching = false;
+static u32 gxfifo_batchSends = 0;
+
+void GFX_FIFObeginBatch()
+{
+	gxfifo_batching = true;
+	gxfifo_batchSends = 0;
+}
+
+void GFX_FIFOendBatch()
+{
+	gxfifo_batching = false;
+	if(gxfifo_batchSends == 0) return;
+
+	GXF_FIFO_handleEvents();
+	NDS_RescheduleGXFIFO(gxfifo_batchSends);
+	gxfifo_batchSends = 0;
+}
+
 void GFX_FIFOsend(u8 cmd, u32 param)
 {
 	//INFO("gxFIFO: send 0x%02X = 0x%08X (size %03i/0x%02X) gxstat 0x%08X\n", cmd, param, gxFIFO.size, gxFIFO.size, gxstat);
@@ -238,11 +249,18 @@ void GFX_FIFOsend(u8 cmd, u32 param)
 		gxFIFO.matrix_stack_op_size++;
 
 	if(gxFIFO.size>=HACK_GXIFO_SIZE) {
-		printf("--FIFO FULL-- : %d\n",gxFIFO.size);
+		CORELOG_INFO("--FIFO FULL-- : %d\n",gxFIFO.size);
 	}
 	
 	//gxstat |= 0x08000000;		// set busy flag
 
+	if(gxfifo_batching)
+	{
+		if(gxfifo_batchSends++ == 0)
+			GXF_FIFO_handleEvents();
+		return;
+	}
+
 	GXF_FIFO_handleEvents();
 
 	NDS_RescheduleGXFIFO(1);
@@ -267,7 +285,7 @@ BOOL GFX_PIPErecv(u8 *cmd, u32 *param)
 	{
 		gxFIFO.matrix_stack_op_size--;
 		if(gxFIFO.matrix_stack_op_size>0x10000000)
-			printf("bad news disaster in matrix_stack_op_size\n");
+			CORELOG_INFO("bad news disaster in matrix_stack_op_size\n");
 	}
 
 	gxFIFO.head++;
@@ -279,6 +297,34 @@ BOOL GFX_PIPErecv(u8 *cmd, u32 *param)
 	return (TRUE);
 }
 
+//pops up to max commands in one go for the gxfifo sequencer.
+//the fifo only shrinks here, so the events are handled once, after the last pop.
+u32 GFX_PIPErecvBatch(u8 *cmd, u32 *param, u32 max)
+{
+	u32 count = gxFIFO.size < max ? gxFIFO.size : max;
+
+	for(u32 i=0;i<count;i++)
+	{
+		cmd[i] = gxFIFO.cmd[gxFIFO.head];
+		param[i] = gxFIFO.param[gxFIFO.head];
+
+		if(IsMatrixStackCommand(cmd[i]))
+		{
+			gxFIFO.matrix_stack_op_size--;
+			if(gxFIFO.matrix_stack_op_size>0x10000000)
+				CORELOG_INFO("bad news disaster in matrix_stack_op_size\n");
+		}
+
+		gxFIFO.head++;
+		if (gxFIFO.head > HACK_GXIFO_SIZE-1) gxFIFO.head = 0;
+	}
+	gxFIFO.size -= count;
+
+	GXF_FIFO_handleEvents();
+
+	return count;
+}
+
 void GFX_FIFOcnt(u32 val)
 {
 	////INFO("gxFIFO: write cnt 0x%08X (prev 0x%08X) FIFO size %03i PIPE size %03i\n", val, gxstat, gxFIFO.size, gxPIPE.size);
@@ -326,3 +372,31 @@ u32 DISP_FIFOrecv()
 		disp_fifo.head = 0;
 	return (val);
 }
+
+void DISP_FIFOsendBlock(const u32 *src, u32 count)
+{
+	while (count)
+	{
+		const u32 n = std::min(count, 0x6000 - disp_fifo.tail);
+		memcpy(&disp_fifo.buf[disp_fifo.tail], src, n * sizeof(u32));
+		disp_fifo.tail += n;
+		if (disp_fifo.tail > 0x5FFF)
+			disp_fifo.tail = 0;
+		src += n;
+		count -= n;
+	}
+}
+
+void DISP_FIFOrecvBlock(u32 *dst, u32 count)
+{
+	while (count)
+	{
+		const u32 n = std::min(count, 0x6000 - disp_fifo.head);
+		memcpy(dst, &disp_fifo.buf[disp_fifo.head], n * sizeof(u32));
+		disp_fifo.head += n;
+		if (disp_fifo.head > 0x5FFF)
+			disp_fifo.head = 0;
+		dst += n;
+		count -= n;
+	}
+}
@@ -24,9 +24,12 @@
 #include "types.h"
 
 //=================================================== IPC FIFO
+#define IPC_FIFO_SIZE 16
+
+//the words one cpu has sent and the other hasn't read yet, as a ring
 typedef struct
 {
-	u32		buf[16];
+	u32		buf[IPC_FIFO_SIZE];
 	
 	u8		head;
 	u8		tail;
@@ -37,6 +40,8 @@ extern IPC_FIFO ipc_fifo[2];
 extern void IPC_FIFOinit(u8 proc);
 extern void IPC_FIFOsend(u8 proc, u32 val);
 extern u32 IPC_FIFOrecv(u8 proc);
+//IPCFIFOCNT as the cpu reads it
+extern u16 IPC_FIFOreadCnt(u8 proc);
 extern void IPC_FIFOcnt(u8 proc, u16 val);
 
 //=================================================== GFX FIFO
@@ -73,6 +78,9 @@ extern void GFX_PIPEclear();
 extern void GFX_FIFOclear();
 extern void GFX_FIFOsend(u8 cmd, u32 param);
 extern BOOL GFX_PIPErecv(u8 *cmd, u32 *param);
+extern u32 GFX_PIPErecvBatch(u8 *cmd, u32 *param, u32 max);
+extern void GFX_FIFObeginBatch();
+extern void GFX_FIFOendBatch();
 extern void GFX_FIFOcnt(u32 val);
 
 //=================================================== Display memory FIFO
@@ -87,5 +95,8 @@ extern DISP_FIFO disp_fifo;
 extern void DISP_FIFOinit();
 extern void DISP_FIFOsend(u32 val);
 extern u32 DISP_FIFOrecv();
+//the same as count sends or receives in a row, a copy at a time. the words are as the host has them
+extern void DISP_FIFOsendBlock(const u32 *src, u32 count);
+extern void DISP_FIFOrecvBlock(u32 *dst, u32 count);
 
 #endif
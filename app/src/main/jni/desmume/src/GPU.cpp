@@ -38,6 +38,12 @@
 #include "readwrite.h"
 #include "matrix.h"
 #include "emufile.h"
+#include "frameprofile.h"
+#include "hostcpu.h"
+
+#ifdef ENABLE_NEON
+#include <arm_neon.h>
+#endif
 
 #ifdef FASTBUILD
 	#undef FORCEINLINE
@@ -56,7 +62,12 @@ GPU::MosaicLookup GPU::mosaicLookup;
 //#define DEBUG_TRI
 
 CACHE_ALIGN u8 GPU_screen[4*256*192];
-CACHE_ALIGN u8 sprWin[256];
+CACHE_ALIGN u32 GPU_screenNative[2*256*192];
+GPUCompositeFrame gpuComposite;
+
+static volatile int gpuOutputFormatWanted = GPU_OUTPUT_RGB555;
+//taken by each engine at its line 0, since they can render on threads of their own
+static GPUOutputFormat gpuOutputFormat[2] = { GPU_OUTPUT_RGB555, GPU_OUTPUT_RGB555 };
 
 
 u16			gpu_angle = 0;
@@ -114,8 +125,14 @@ CACHE_ALIGN u8 gpuBlendTable555[17][17][32][32];
 /*****************************************************************************/
 
 
+//the fade and blend tables come to 2.5MB, more than is worth having in the binary, so they are still filled in
+//here, but once for both gpus
 static void GPU_InitFadeColors()
 {
+	static bool initialized = false;
+	if(initialized) return;
+	initialized = true;
+
 	/*
 	NOTE: gbatek (in the reference above) seems to expect 6bit values 
 	per component, but as desmume works with 5bit per component, 
@@ -170,6 +187,8 @@ static void GPU_InitFadeColors()
 
 static CACHE_ALIGN GPU GPU_main, GPU_sub;
 
+static void GPU_SelectKernels();
+
 GPU * GPU_Init(u8 l)
 {
 	GPU * g;
@@ -179,6 +198,7 @@ GPU * GPU_Init(u8 l)
 
 	GPU_Reset(g, l);
 	GPU_InitFadeColors();
+	GPU_SelectKernels();
 
 	g->curr_win[0] = win_empty;
 	g->curr_win[1] = win_empty;
@@ -214,6 +234,9 @@ void GPU_Reset(GPU *g, u8 l)
 
 	g->bg0HasHighestPrio = TRUE;
 
+	if(g->core == GPU_MAIN)
+		memset(gpuComposite.lines, 0, sizeof(gpuComposite.lines));
+
 	if(g->core == GPU_SUB)
 	{
 		g->oam = (MMU.ARM9_OAM + ADDRESS_STEP_1KB);
@@ -294,7 +317,7 @@ static void GPU_resortBGs(GPU *gpu)
 				printf("... ", item->BGs[j]);
 		}
 	}
-	printf("\n");
+	CORELOG_INFO("\n");
 #endif
 }
 
@@ -501,58 +524,85 @@ FORCEINLINE u8 GPU::withinRect(u16 x) const
 
 
 
-//  Now assumes that *draw and *effect are different from 0 when called, so we can avoid
-// setting some values twice
-FORCEINLINE void GPU::renderline_checkWindows(u16 x, bool &draw, bool &effect) const
-{
-	// Check if win0 if enabled, and only check if it is
-	// howevever, this has already been taken care of by the window precalculation
-	//if (WIN0_ENABLED)
-	{
-		// it is in win0, do we display ?
-		// high priority	
-		if (withinRect<0>(x))
-		{
-			//INFO("bg%i passed win0 : (%i %i) was within (%i %i)(%i %i)\n", bgnum, x, gpu->currLine, gpu->WIN0H0, gpu->WIN0V0, gpu->WIN0H1, gpu->WIN0V1);
-			draw = (WININ0 >> currBgNum)&1;
-			effect = (WININ0_SPECIAL);
-			return;
-		}
-	}
-
-	// Check if win1 if enabled, and only check if it is
-	//if (WIN1_ENABLED)
-	// howevever, this has already been taken care of by the window precalculation
-	{
-		// it is in win1, do we display ?
-		// mid priority
-		if(withinRect<1>(x))
-		{
-			//INFO("bg%i passed win1 : (%i %i) was within (%i %i)(%i %i)\n", bgnum, x, gpu->currLine, gpu->WIN1H0, gpu->WIN1V0, gpu->WIN1H1, gpu->WIN1V1);
-			draw	= (WININ1 >> currBgNum)&1;
-			effect = (WININ1_SPECIAL);
-			return;
-		}
-	}
-
-	//if(true) //sprwin test hack
-	if (WINOBJ_ENABLED)
+//builds windowMask for the current line, from the x windows selected by setup_windows and the obj window
+//drawn by the sprites. every pixel gets the control bits of the highest priority window it is in
+void GPU::setup_windowMask()
+{
+	const u8 out = WINOUT | (WINOUT_SPECIAL << 5);
+	const u8 in0 = WININ0 | (WININ0_SPECIAL << 5);
+	const u8 in1 = WININ1 | (WININ1_SPECIAL << 5);
+	const u8 obj = WINOBJ_ENABLED ? (WINOBJ | (WINOBJ_SPECIAL << 5)) : out;
+
+#if defined(ENABLE_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i out_v = _mm_set1_epi8(out);
+	const __m128i in0_v = _mm_set1_epi8(in0);
+	const __m128i in1_v = _mm_set1_epi8(in1);
+	const __m128i obj_v = _mm_set1_epi8(obj);
+	__m128i layers = zero;
+
+	for(int x = 0; x < 256; x += 16)
+	{
+		//each select mask is set where the pixel is outside that window, so the lower priority value is kept there
+		const __m128i outside0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(curr_win[0] + x)), zero);
+		const __m128i outside1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(curr_win[1] + x)), zero);
+		const __m128i outsideObj = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(sprWin + x)), zero);
+
+		__m128i mask = _mm_or_si128(_mm_and_si128(outsideObj, out_v), _mm_andnot_si128(outsideObj, obj_v));
+		mask = _mm_or_si128(_mm_and_si128(outside1, mask), _mm_andnot_si128(outside1, in1_v));
+		mask = _mm_or_si128(_mm_and_si128(outside0, mask), _mm_andnot_si128(outside0, in0_v));
+		_mm_storeu_si128((__m128i *)(windowMask + x), mask);
+		layers = _mm_or_si128(layers, mask);
+	}
+	layers = _mm_or_si128(layers, _mm_srli_si128(layers, 8));
+	layers = _mm_or_si128(layers, _mm_srli_si128(layers, 4));
+	layers = _mm_or_si128(layers, _mm_srli_si128(layers, 2));
+	layers = _mm_or_si128(layers, _mm_srli_si128(layers, 1));
+	windowLayers = (u8)_mm_cvtsi128_si32(layers);
+#elif defined(ENABLE_NEON)
+	const uint8x16_t out_v = vdupq_n_u8(out);
+	const uint8x16_t in0_v = vdupq_n_u8(in0);
+	const uint8x16_t in1_v = vdupq_n_u8(in1);
+	const uint8x16_t obj_v = vdupq_n_u8(obj);
+	uint8x16_t layers = vdupq_n_u8(0);
+
+	for(int x = 0; x < 256; x += 16)
+	{
+		const uint8x16_t win0 = vld1q_u8(curr_win[0] + x);
+		const uint8x16_t win1 = vld1q_u8(curr_win[1] + x);
+		const uint8x16_t winObj = vld1q_u8(sprWin + x);
+
+		uint8x16_t mask = vbslq_u8(vtstq_u8(winObj, winObj), obj_v, out_v);
+		mask = vbslq_u8(vtstq_u8(win1, win1), in1_v, mask);
+		mask = vbslq_u8(vtstq_u8(win0, win0), in0_v, mask);
+		vst1q_u8(windowMask + x, mask);
+		layers = vorrq_u8(layers, mask);
+	}
+	uint8x8_t layers8 = vorr_u8(vget_low_u8(layers), vget_high_u8(layers));
+	layers8 = vorr_u8(layers8, vreinterpret_u8_u64(vshr_n_u64(vreinterpret_u64_u8(layers8), 32)));
+	layers8 = vorr_u8(layers8, vreinterpret_u8_u64(vshr_n_u64(vreinterpret_u64_u8(layers8), 16)));
+	layers8 = vorr_u8(layers8, vreinterpret_u8_u64(vshr_n_u64(vreinterpret_u64_u8(layers8), 8)));
+	windowLayers = vget_lane_u8(layers8, 0);
+#else
+	u8 layers = 0;
+	for(int x = 0; x < 256; x++)
 	{
-		// it is in winOBJ, do we display ?
-		// low priority
-		if (sprWin[x])
-		{
-			draw	= (WINOBJ >> currBgNum)&1;
-			effect	= (WINOBJ_SPECIAL);
-			return;
-		}
+		if(curr_win[0][x]) windowMask[x] = in0;
+		else if(curr_win[1][x]) windowMask[x] = in1;
+		else if(sprWin[x]) windowMask[x] = obj;
+		else windowMask[x] = out;
+		layers |= windowMask[x];
 	}
+	windowLayers = layers;
+#endif
+}
 
-	if (WINOBJ_ENABLED | WIN1_ENABLED | WIN0_ENABLED)
-	{
-		draw	= (WINOUT >> currBgNum) & 1;
-		effect	= (WINOUT_SPECIAL);
-	}
+//only called when at least one window is enabled, so the mask decides both draw and effect for every pixel
+FORCEINLINE void GPU::renderline_checkWindows(u16 x, bool &draw, bool &effect) const
+{
+	const u8 mask = windowMask[x];
+	draw = (mask >> currBgNum) & 1;
+	effect = (mask >> 5) & 1;
 }
 
 /*****************************************************************************/
@@ -622,6 +672,39 @@ FORCEINLINE FASTCALL void GPU::_master_setFinal3dColor(int dstX, int srcX)
 	bgPixels[x] = 0;
 }
 
+//the 3d layer of a composited line: what _master_setFinal3dColor would need, for every pixel, since which ones the
+//3d covers isn't known here. GPU_screen and bgPixels are left as they were, as if the 3d were transparent
+void GPU::composite3D()
+{
+	const int mode = (BLDCNT >> 6) & 3;
+	u32 common = GPU_COMPOSITE_3D | (BLDY_EVY << 8);
+	if(blend1 && mode == 2) common |= GPU_COMPOSITE_3D_FADE_IN;
+	if(blend1 && mode == 3) common |= GPU_COMPOSITE_3D_FADE_OUT;
+
+	for(int x = 0; x < 256; x++)
+	{
+		compositeColors[x] = HostReadWord(currDst, x<<1) & 0x7FFF;
+		compositeAttrs[x] = common | (blend2[bgPixels[x]] ? GPU_COMPOSITE_3D_BLENDS : 0);
+	}
+}
+
+//a layer drawing over pixel x of a composited line, as it would have come out over the 3d
+void GPU::compositeOver(u16 over, bool blends, int eva, int evb, const u32 x)
+{
+	u32 &attr = compositeAttrs[x];
+	switch(attr & GPU_COMPOSITE_KIND)
+	{
+	case GPU_COMPOSITE_3D:
+		compositeColors[x] = (compositeColors[x] & 0xFFFF) | (over << 16);
+		attr = (attr & 0xFFFC) | GPU_COMPOSITE_3D_UNDER | (blends ? GPU_COMPOSITE_OVER_BLENDS : 0) | (eva << 16) | (evb << 24);
+		break;
+	case GPU_COMPOSITE_3D_UNDER:
+		//only one layer over the 3d could blend, so a second one comes out the same whatever is under the first
+		attr = 0;
+		break;
+	}
+}
+
 
 template<bool BACKDROP, BlendFunc FUNC, bool WINDOW>
 FORCEINLINE FASTCALL bool GPU::_master_setFinalBGColor(u16 &color, const u32 x)
@@ -666,6 +749,7 @@ template<BlendFunc FUNC, bool WINDOW>
 static FORCEINLINE void _master_setFinalOBJColor(GPU *gpu, u8 *dst, u16 color, u8 alpha, u8 type, u16 x)
 {
 	const bool isObjTranslucentType = type == GPU_OBJ_MODE_Transparent || type == GPU_OBJ_MODE_Bitmap;
+	const u16 raw = color & 0x7FFF;
 	
 	bool windowDraw = true;
 	bool windowEffectSatisfied = true;
@@ -726,19 +810,40 @@ static FORCEINLINE void _master_setFinalOBJColor(GPU *gpu, u8 *dst, u16 color, u
 		}
 	}
 
+	//the same choice again, with the 3d as the pixel under it (composited lines have no windows)
+	if(gpu->compositeAttrs && (gpu->compositeAttrs[x] & GPU_COMPOSITE_KIND))
+	{
+		const bool translucent = isObjTranslucentType && gpu->blend2[0];
+		const bool blends = translucent || (FUNC == Blend && gpu->blend1 && gpu->blend2[0]);
+		int eva = gpu->BLDALPHA_EVA, evb = gpu->BLDALPHA_EVB;
+		if(translucent && alpha != 255)
+		{
+			eva = alpha;
+			evb = 16 - alpha;
+		}
+		u16 over = raw;
+		if(!blends && gpu->blend1)
+		{
+			if(FUNC == Increase) over = gpu->currentFadeInColors[raw];
+			if(FUNC == Decrease) over = gpu->currentFadeOutColors[raw];
+		}
+		gpu->compositeOver(over, blends, eva, evb, x);
+	}
+
 	HostWriteWord(dst, x<<1, (color | 0x8000));
 	gpu->bgPixels[x] = 4;	
 }
 
 //FUNCNUM is only set for backdrop, for an optimization of looking it up early
 template<bool BACKDROP, int FUNCNUM> 
-FORCEINLINE void GPU::setFinalColorBG(u16 color, const u32 x)
+FORCEINLINE void GPU::setFinalColorBG(u16 color, const u32 x, const u32 color32)
 {
 	//It is not safe to assert this here.
 	//This is probably the best place to enforce it, since almost every single color that comes in here
 	//will be pulled from a palette that needs the top bit stripped off anyway.
 	//assert((color&0x8000)==0);
 	if(!BACKDROP) color &= 0x7FFF; //but for the backdrop we can easily guarantee earlier that theres no bit here
+	const u16 raw = color;
 
 	bool draw;
 
@@ -758,7 +863,15 @@ FORCEINLINE void GPU::setFinalColorBG(u16 color, const u32 x)
 
 	if(BACKDROP || draw) //backdrop must always be drawn
 	{
+		//what the 3d under this pixel would have made of it. composited lines have no windows, and in the blend
+		//mode the layer only blends with the 3d if the 3d is a second target
+		if(!BACKDROP && compositeAttrs)
+		{
+			const bool blendMode = setFinalColorBck_funcNum == 1;
+			compositeOver(blendMode ? raw : color, blendMode && blend1 && blend2[0], BLDALPHA_EVA, BLDALPHA_EVB, x);
+		}
 		HostWriteWord(currDst, x<<1, color | 0x8000);
+		if(nativeDst) nativeDst[x] = color32;
 		if(!BACKDROP) bgPixels[x] = currBgNum; //lets do this in the backdrop drawing loop, should be faster
 	}
 }
@@ -795,15 +908,15 @@ FORCEINLINE void setFinalColorSpr(GPU* gpu, u8 *dst, u16 color, u8 alpha, u8 typ
 }
 
 template<bool MOSAIC, bool BACKDROP>
-FORCEINLINE void GPU::__setFinalColorBck(u16 color, const u32 x, const int opaque)
+FORCEINLINE void GPU::__setFinalColorBck(u16 color, const u32 x, const int opaque, const u32 color32)
 {
-	return ___setFinalColorBck<MOSAIC, BACKDROP, 0>(color,x,opaque);
+	return ___setFinalColorBck<MOSAIC, BACKDROP, 0>(color,x,opaque,color32);
 }
 
 //this was forced inline because most of the time it just falls through to setFinalColorBck() and the function call
 //overhead was ridiculous and terrible
 template<bool MOSAIC, bool BACKDROP, int FUNCNUM>
-FORCEINLINE void GPU::___setFinalColorBck(u16 color, const u32 x, const int opaque)
+FORCEINLINE void GPU::___setFinalColorBck(u16 color, const u32 x, const int opaque, const u32 color32)
 {
 	//under ordinary circumstances, nobody should pass in something >=256
 	//but in fact, someone is going to try. specifically, that is the map viewer debug tools
@@ -823,17 +936,18 @@ FORCEINLINE void GPU::___setFinalColorBck(u16 color, const u32 x, const int opaq
 	else color &= 0x7FFF;
 
 	//due to the early out, enabled must always be true
-	//x_int = enabled ? GPU::mosaicLookup.width[x].trunc : x;
-	x_int = GPU::mosaicLookup.width[x].trunc;
+	//x_int = enabled ? mosaicWidth[x].trunc : x;
+	x_int = mosaicWidth[x].trunc;
 
-	if(GPU::mosaicLookup.width[x].begin && GPU::mosaicLookup.height[currLine].begin) {}
+	if(mosaicWidth[x].begin && mosaicHeight[currLine].begin) {}
 	else color = mosaicColors.bg[currBgNum][x_int];
 	mosaicColors.bg[currBgNum][x] = color;
 
 	if(color != 0xFFFF)
 	{
 finish:
-		setFinalColorBG<BACKDROP,FUNCNUM>(color,x);
+		//under mosaic the color may have come from another pixel, so it goes the long way
+		setFinalColorBG<BACKDROP,FUNCNUM>(color,x,MOSAIC?0:color32);
 	}
 }
 
@@ -897,11 +1011,11 @@ static void mosaicSpriteLinePixel(GPU * gpu, int x, u16 l, u8 * dst, u8 * dst_al
 	objColor.alpha = dst_alpha[x];
 	objColor.opaque = opaque;
 
-	x_int = enabled ? GPU::mosaicLookup.width[x].trunc : x;
+	x_int = enabled ? gpu->mosaicWidth[x].trunc : x;
 
 	if(enabled)
 	{
-		if(GPU::mosaicLookup.width[x].begin && GPU::mosaicLookup.height[y].begin) {}
+		if(gpu->mosaicWidth[x].begin && gpu->mosaicHeight[y].begin) {}
 		else objColor = gpu->mosaicColors.obj[x_int];
 	}
 	gpu->mosaicColors.obj[x] = objColor;
@@ -914,7 +1028,7 @@ static void mosaicSpriteLinePixel(GPU * gpu, int x, u16 l, u8 * dst, u8 * dst_al
 FORCEINLINE static void mosaicSpriteLine(GPU * gpu, u16 l, u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 {
 	//don't even try this unless the mosaic is effective
-	if(gpu->mosaicLookup.widthValue != 0 || gpu->mosaicLookup.heightValue != 0)
+	if(gpu->mosaicWidthValue != 0 || gpu->mosaicHeightValue != 0)
 		for(int i=0;i<256;i++)
 			mosaicSpriteLinePixel(gpu,i,l,dst,dst_alpha,typeTab,prioTab);
 }
@@ -956,6 +1070,55 @@ template<bool MOSAIC> void lineLarge8bpp(GPU * gpu)
 //			BACKGROUND RENDERING -TEXT-
 /*****************************************************************************/
 // render a text background to the combined pixelbuffer
+//looks up (and decodes, when it is missing or stale) the tile row at src.
+//pal is where the row's palette starts and palGen is MMU_gpu_generation(pal)
+template<bool DEPTH8> static FORCEINLINE const GPU_TileRow& GPU_tileRow(GPU * gpu, const u8 * src, const u8 * pal, u32 palGen)
+{
+	const u32 srcGen = MMU_gpu_generation(src);
+	GPU_TileRow &row = gpu->tileRowCache[(((u32)(src - MMU.ARM9_LCD)>>2) ^ ((u32)(pal - MMU.ARM9_VMEM)>>5)) & (GPU_TILEROW_CACHE_SIZE-1)];
+	if(row.src == src && row.pal == pal && row.srcGen == srcGen && row.palGen == palGen && row.depth8 == DEPTH8)
+		return row;
+
+	row.src = src;
+	row.pal = pal;
+	row.srcGen = srcGen;
+	row.palGen = palGen;
+	row.depth8 = DEPTH8;
+	for(int i = 0; i < 8; i++)
+	{
+		const u8 index = DEPTH8 ? src[i] : ((src[i>>1] >> ((i&1)<<2)) & 0xF);
+		row.index[i] = index;
+		row.color[i] = T1ReadWord(pal, index << 1);
+	}
+	return row;
+}
+
+const u32* GPU::palette32(const u8 *pal)
+{
+	//the brightness the whole line gets in GPU_RenderLine_MasterBrightness, 0 when it does nothing
+	int factor = std::min<int>(MasterBrightFactor, 16);
+	const int mode = (MasterBrightMode == 1 || MasterBrightMode == 2) ? MasterBrightMode : 0;
+	if(!mode) factor = 0;
+	const u32 brightness = factor ? (mode << 8) | factor : 0;
+
+	const u32 gen = MMU_gpu_generation(pal);
+	GPU_Palette32 &palette = palette32Cache[((uintptr_t)pal >> 9) & (GPU_PALETTE32_CACHE_SIZE-1)];
+	if(palette.src == pal && palette.gen == gen && palette.brightness == brightness)
+		return palette.color;
+
+	palette.src = pal;
+	palette.gen = gen;
+	palette.brightness = brightness;
+	for(int i = 0; i < 256; i++)
+	{
+		u16 color = LE_TO_LOCAL_16(((const u16*)pal)[i]) & 0x7FFF;
+		if(factor == 16) color = mode == 1 ? 0x7FFF : 0;
+		else if(factor) color = mode == 1 ? fadeInColors[factor][color] : fadeOutColors[factor][color];
+		palette.color[i] = 0xFF000000 | RGB15TO32_NOALPHA(color);
+	}
+	return palette.color;
+}
+
 template<bool MOSAIC> INLINE void renderline_textBG(GPU * gpu, u16 XBG, u16 YBG, u16 LG)
 {
 	u8 num = gpu->currBgNum;
@@ -968,14 +1131,13 @@ template<bool MOSAIC> INLINE void renderline_textBG(GPU * gpu, u16 XBG, u16 YBG,
 	u16 tmp    = ((YBG & hmask) >> 3);
 	u32 map;
 	u8 *pal, *line;
+	u32 palGen;
 	u32 tile;
-	u16 color;
 	u16 xoff;
 	u16 yoff;
 	u32 x      = 0;
 	u32 xfin;
 
-	s8 line_dir = 1;
 	u32 mapinfo;
 	TILEENTRY tileentry;
 
@@ -993,59 +1155,24 @@ template<bool MOSAIC> INLINE void renderline_textBG(GPU * gpu, u16 XBG, u16 YBG,
 	{
 		yoff = ((YBG&7)<<2);
 		xfin = 8 - (xoff&7);
+		palGen = MMU_gpu_generation(pal);
+		const u32 *pal32 = gpu->nativeDst ? gpu->palette32(pal) : NULL;
 		for(x = 0; x < LG; xfin = std::min<u16>(x+8, LG))
 		{
-			u16 tilePalette = 0;
 			tmp = ((xoff&wmask)>>3);
 			mapinfo = map + (tmp&0x1F) * 2;
 			if(tmp>31) mapinfo += 32*32*2;
 			tileentry.val = T1ReadWord(MMU_gpu_map(mapinfo), 0);
 
-			tilePalette = (tileentry.bits.Palette*16);
-
 			line = (u8*)MMU_gpu_map(tile + (tileentry.bits.TileNum * 0x20) + ((tileentry.bits.VFlip) ? (7*4)-yoff : yoff));
-			
-			if(tileentry.bits.HFlip)
-			{
-				line += (3 - ((xoff&7)>>1));
-				for(; x < xfin; line --) 
-				{	
-					u8 currLine = *line;
-
-					if(!(xoff&1))
-					{
-						color = T1ReadWord(pal, ((currLine>>4) + tilePalette) << 1);
-						gpu->__setFinalColorBck<MOSAIC,false>(color,x,currLine>>4);
-						x++; xoff++;
-					}
-					
-					if(x<xfin)
-					{
-						color = T1ReadWord(pal, ((currLine&0xF) + tilePalette) << 1);
-						gpu->__setFinalColorBck<MOSAIC,false>(color,x,currLine&0xF);
-						x++; xoff++;
-					}
-				}
-			} else {
-				line += ((xoff&7)>>1);
-				for(; x < xfin; line ++) 
-				{
-					u8 currLine = *line;
+			const GPU_TileRow &row = GPU_tileRow<false>(gpu, line, pal + (tileentry.bits.Palette<<5), palGen);
+			const u32 *rowPal32 = pal32 ? pal32 + (tileentry.bits.Palette<<4) : NULL;
 
-					if(!(xoff&1))
-					{
-						color = T1ReadWord(pal, ((currLine&0xF) + tilePalette) << 1);
-						gpu->__setFinalColorBck<MOSAIC,false>(color,x,currLine&0xF);
-						x++; xoff++;
-					}
-
-					if(x<xfin)
-					{
-						color = T1ReadWord(pal, ((currLine>>4) + tilePalette) << 1);
-						gpu->__setFinalColorBck<MOSAIC,false>(color,x,currLine>>4);
-						x++; xoff++;
-					}
-				}
+			const u32 flip = tileentry.bits.HFlip ? 7 : 0;
+			for(; x < xfin; x++, xoff++)
+			{
+				const u32 px = (xoff&7) ^ flip;
+				gpu->__setFinalColorBck<MOSAIC,false>(row.color[px],x,row.index[px],rowPal32?rowPal32[row.index[px]]:0);
 			}
 		}
 		return;
@@ -1063,6 +1190,7 @@ template<bool MOSAIC> INLINE void renderline_textBG(GPU * gpu, u16 XBG, u16 YBG,
 	u8* tilePal;
 	xfin = 8 - (xoff&7);
 	u32 extPalMask = -dispCnt->ExBGxPalette_Enable;
+	palGen = MMU_gpu_generation(pal);
 	for(x = 0; x < LG; xfin = std::min<u16>(x+8, LG))
 	{
 		tmp = (xoff & (lg-1))>>3;
@@ -1071,24 +1199,14 @@ template<bool MOSAIC> INLINE void renderline_textBG(GPU * gpu, u16 XBG, u16 YBG,
 		tileentry.val = T1ReadWord(MMU_gpu_map(mapinfo), 0);
 		tilePal = pal + ((tileentry.bits.Palette<<9)&extPalMask);
 		line = (u8*)MMU_gpu_map(tile + (tileentry.bits.TileNum*0x40) + ((tileentry.bits.VFlip) ? (7*8)-yoff : yoff));
+		const GPU_TileRow &row = GPU_tileRow<true>(gpu, line, tilePal, palGen);
+		const u32 *rowPal32 = gpu->nativeDst ? gpu->palette32(tilePal) : NULL;
 
-		if(tileentry.bits.HFlip)
+		const u32 flip = tileentry.bits.HFlip ? 7 : 0;
+		for(; x < xfin; x++, xoff++)
 		{
-			line += (7 - (xoff&7));
-			line_dir = -1;
-		} else {
-			line += (xoff&7);
-			line_dir = 1;
-		}
-		for(; x < xfin; )
-		{
-			color = T1ReadWord(tilePal, (*line) << 1);
-
-			gpu->__setFinalColorBck<MOSAIC,false>(color,x,*line);
-			
-			x++; xoff++;
-
-			line += line_dir;
+			const u32 px = (xoff&7) ^ flip;
+			gpu->__setFinalColorBck<MOSAIC,false>(row.color[px],x,row.index[px],rowPal32?rowPal32[row.index[px]]:0);
 		}
 	}
 }
@@ -1143,9 +1261,129 @@ template<bool MOSAIC> FORCEINLINE void rot_BMP_map(GPU * gpu, s32 auxX, s32 auxY
 	gpu->__setFinalColorBck<MOSAIC,false>(color, i, color&0x8000);
 }
 
+//the runs below render the n pixels from i on, of an unrotated and unscaled line starting at auxX,auxY.
+//the caller has already wrapped or clipped them, so that auxX..auxX+n-1 are all inside the bg
+
+template<bool MOSAIC> FORCEINLINE void rot_tiled_8bit_run(GPU * gpu, s32 auxX, s32 auxY, int lg, u32 map, u32 tile, u8 * pal, int i, int n) {
+	const u32 palGen = MMU_gpu_generation(pal);
+	const u32 mapRow = map + (auxY>>3) * (lg>>3);
+	const u32 yoff = (auxY&7)<<3;
+	const u32 *pal32 = gpu->nativeDst ? gpu->palette32(pal) : NULL;
+
+	for(const int end = i + n; i < end; )
+	{
+		const u8 tileindex = *(u8*)MMU_gpu_map(mapRow + (auxX>>3));
+		const GPU_TileRow &row = GPU_tileRow<true>(gpu, (u8*)MMU_gpu_map(tile + (tileindex<<6) + yoff), pal, palGen);
+
+		for(const int stop = std::min(end, i + 8 - (auxX&7)); i < stop; i++, auxX++)
+			gpu->__setFinalColorBck<MOSAIC,false>(row.color[auxX&7], i, row.index[auxX&7], pal32?pal32[row.index[auxX&7]]:0);
+	}
+}
+
+template<bool MOSAIC, bool extPal> FORCEINLINE void rot_tiled_16bit_run(GPU * gpu, s32 auxX, s32 auxY, int lg, u32 map, u32 tile, u8 * pal, int i, int n) {
+	const u32 palGen = MMU_gpu_generation(pal);
+	const u32 mapRow = map + (((auxY>>3) * (lg>>3))<<1);
+
+	for(const int end = i + n; i < end; )
+	{
+		TILEENTRY tileentry;
+		tileentry.val = T1ReadWord(MMU_gpu_map(mapRow + ((auxX>>3)<<1)), 0);
+
+		const u32 y = ((tileentry.bits.VFlip) ? 7 - (auxY) : (auxY))&7;
+		const u8 *tilePal = extPal ? pal + (tileentry.bits.Palette<<9) : pal;
+		const GPU_TileRow &row = GPU_tileRow<true>(gpu, (u8*)MMU_gpu_map(tile + (tileentry.bits.TileNum<<6) + (y<<3)), tilePal, palGen);
+		const u32 *rowPal32 = gpu->nativeDst ? gpu->palette32(tilePal) : NULL;
+
+		const u32 flip = tileentry.bits.HFlip ? 7 : 0;
+		for(const int stop = std::min(end, i + 8 - (auxX&7)); i < stop; i++, auxX++)
+		{
+			const u32 px = (auxX&7) ^ flip;
+			gpu->__setFinalColorBck<MOSAIC,false>(row.color[px], i, row.index[px], rowPal32?rowPal32[row.index[px]]:0);
+		}
+	}
+}
+
+//the bitmaps are read straight out of vram, a 16KB page at a time since that is what MMU_gpu_map maps
+template<bool MOSAIC> FORCEINLINE void rot_256_run(GPU * gpu, s32 auxX, s32 auxY, int lg, u32 map, u32 tile, u8 * pal, int i, int n) {
+	u32 adr = map + auxX + auxY * lg;
+
+	for(const int end = i + n; i < end; )
+	{
+		const u8 *src = (u8*)MMU_gpu_map(adr);
+		const int count = std::min<int>(end - i, 0x4000 - (adr & 0x3FFF));
+		adr += count;
+
+		for(const int stop = i + count; i < stop; i++)
+		{
+			const u8 palette_entry = *src++;
+			gpu->__setFinalColorBck<MOSAIC,false>(T1ReadWord(pal, palette_entry << 1), i, palette_entry);
+		}
+	}
+}
+
+template<bool MOSAIC> FORCEINLINE void rot_BMP_run(GPU * gpu, s32 auxX, s32 auxY, int lg, u32 map, u32 tile, u8 * pal, int i, int n) {
+	u32 adr = map + ((auxX + auxY * lg) << 1);
+
+	for(const int end = i + n; i < end; )
+	{
+		const u8 *src = (u8*)MMU_gpu_map(adr);
+		const int count = std::min<int>(end - i, (0x4000 - (adr & 0x3FFF)) >> 1);
+		adr += count << 1;
+
+		for(const int stop = i + count; i < stop; i++, src += 2)
+		{
+			const u16 color = LE_TO_LOCAL_16(*(const u16*)src);
+			gpu->__setFinalColorBck<MOSAIC,false>(color, i, color&0x8000);
+		}
+	}
+}
+
 typedef void (*rot_fun)(GPU * gpu, s32 auxX, s32 auxY, int lg, u32 map, u32 tile, u8 * pal, int i);
+typedef void (*rot_run)(GPU * gpu, s32 auxX, s32 auxY, int lg, u32 map, u32 tile, u8 * pal, int i, int n);
+
+//narrows [lo,hi) to the pixels i for which the integer part of v + i*d is in [0,size).
+//false when some coordinate of the line would not fit in ROTOCOORD, which the caller has to step through then
+static FORCEINLINE bool rot_clip(s32 v, s32 d, s32 size, int LG, int &lo, int &hi)
+{
+	const s64 last = (s64)v + (s64)d * (LG-1);
+	if(v < -(1<<27) || v >= (1<<27) || last < -(1<<27) || last >= (1<<27))
+		return false;
+
+	//min <= v + i*d <= max, turned around when d is negative so that d is always positive
+	s64 min = 0, max = ((s64)size << 8) - 1, v64 = v, d64 = d;
+	if(d64 < 0)
+	{
+		const s64 tmp = min;
+		min = -max;
+		max = -tmp;
+		v64 = -v64;
+		d64 = -d64;
+	}
+
+	if(d64 == 0)
+	{
+		if(v64 < min || v64 > max)
+			hi = lo;
+		return true;
+	}
+
+	//the line starts past the end, or it is rounded up and down
+	//(the numerator of first can be negative, and C++ rounds that towards 0)
+	if(v64 > max)
+	{
+		hi = lo;
+		return true;
+	}
+	const s64 first = (min - v64 <= 0) ? -((v64 - min) / d64) : (min - v64 + d64 - 1) / d64;
+	const s64 end = (max - v64) / d64 + 1;
+	lo = (int)std::max<s64>(lo, first);
+	hi = (int)std::min<s64>(hi, end);
+	if(hi < lo)
+		hi = lo;
+	return true;
+}
 
-template<rot_fun fun, bool WRAP>
+template<rot_fun fun, rot_run run, bool WRAP>
 FORCEINLINE void rot_scale_op(GPU * gpu, s32 X, s32 Y, s16 PA, s16 PB, s16 PC, s16 PD, u16 LG, s32 wh, s32 ht, u32 map, u32 tile, u8 * pal)
 {
 	ROTOCOORD x, y;
@@ -1156,27 +1394,48 @@ FORCEINLINE void rot_scale_op(GPU * gpu, s32 X, s32 Y, s16 PA, s16 PB, s16 PC, s
 	const s32 dy = (s32)PC;
 
 	// as an optimization, specially handle the fairly common case of
-	// "unrotated + unscaled + no boundary checking required"
+	// "unrotated + unscaled", which comes down to runs of consecutive pixels of one row
 	if(dx==0x100 && dy==0)
 	{
 		s32 auxX = x.bits.Integer;
 		s32 auxY = y.bits.Integer;
-		if(WRAP || (auxX + LG < wh && auxX >= 0 && auxY < ht && auxY >= 0))
+		if(WRAP)
 		{
-			if(WRAP)
-			{
-				auxY = auxY & (ht-1);
-				auxX = auxX & (wh-1);
-			}
-			for(int i = 0; i < LG; ++i)
+			auxY = auxY & (ht-1);
+			auxX = auxX & (wh-1);
+			for(int i = 0; i < LG; )
 			{
-				fun(gpu, auxX, auxY, wh, map, tile, pal, i);
-				auxX++;
-				if(WRAP)
-					auxX = auxX & (wh-1);
+				const int n = std::min<int>(LG - i, wh - auxX);
+				run(gpu, auxX, auxY, wh, map, tile, pal, i, n);
+				i += n;
+				auxX = 0;
 			}
 			return;
 		}
+
+		if(auxY < 0 || auxY >= ht)
+			return;
+		const int lo = std::max(0, -auxX);
+		const int hi = std::min<int>(LG, wh - auxX);
+		if(lo < hi)
+			run(gpu, auxX + lo, auxY, wh, map, tile, pal, lo, hi - lo);
+		return;
+	}
+
+	// without wrapping, work out the span of the line that lands inside the bg
+	// up front, rather than testing every pixel
+	int lo = 0, hi = LG;
+	if(!WRAP && rot_clip(X, dx, wh, LG, lo, hi) && rot_clip(Y, dy, ht, LG, lo, hi))
+	{
+		x.val = X + lo * dx;
+		y.val = Y + lo * dy;
+		for(int i = lo; i < hi; ++i)
+		{
+			fun(gpu, x.val >> 8, y.val >> 8, wh, map, tile, pal, i);
+			x.val += dx;
+			y.val += dy;
+		}
+		return;
 	}
 	
 	for(int i = 0; i < LG; ++i)
@@ -1199,15 +1458,15 @@ FORCEINLINE void rot_scale_op(GPU * gpu, s32 X, s32 Y, s16 PA, s16 PB, s16 PC, s
 	}
 }
 
-template<rot_fun fun>
+template<rot_fun fun, rot_run run>
 FORCEINLINE void apply_rot_fun(GPU * gpu, s32 X, s32 Y, s16 PA, s16 PB, s16 PC, s16 PD, u16 LG, u32 map, u32 tile, u8 * pal)
 {
 	struct _BGxCNT * bgCnt = &(gpu->dispx_st)->dispx_BGxCNT[gpu->currBgNum].bits;
 	s32 wh = gpu->BGSize[gpu->currBgNum][0];
 	s32 ht = gpu->BGSize[gpu->currBgNum][1];
 	if(bgCnt->PaletteSet_Wrap)
-		rot_scale_op<fun,true>(gpu, X, Y, PA, PB, PC, PD, LG, wh, ht, map, tile, pal);	
-	else rot_scale_op<fun,false>(gpu, X, Y, PA, PB, PC, PD, LG, wh, ht, map, tile, pal);	
+		rot_scale_op<fun,run,true>(gpu, X, Y, PA, PB, PC, PD, LG, wh, ht, map, tile, pal);	
+	else rot_scale_op<fun,run,false>(gpu, X, Y, PA, PB, PC, PD, LG, wh, ht, map, tile, pal);	
 }
 
 
@@ -1216,7 +1475,7 @@ template<bool MOSAIC> FORCEINLINE void rotBG2(GPU * gpu, s32 X, s32 Y, s16 PA, s
 	u8 num = gpu->currBgNum;
 	u8 * pal = MMU.ARM9_VMEM + gpu->core * 0x400;
 //	printf("rot mode\n");
-	apply_rot_fun<rot_tiled_8bit_entry<MOSAIC> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_map_ram[num], gpu->BG_tile_ram[num], pal);
+	apply_rot_fun<rot_tiled_8bit_entry<MOSAIC>, rot_tiled_8bit_run<MOSAIC> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_map_ram[num], gpu->BG_tile_ram[num], pal);
 }
 
 template<bool MOSAIC> FORCEINLINE void extRotBG2(GPU * gpu, s32 X, s32 Y, s16 PA, s16 PB, s16 PC, s16 PD, s16 LG)
@@ -1236,22 +1495,22 @@ template<bool MOSAIC> FORCEINLINE void extRotBG2(GPU * gpu, s32 X, s32 Y, s16 PA
 		if (!pal) return;
 		// 16  bit bgmap entries
 		if(dispCnt->ExBGxPalette_Enable)
-			apply_rot_fun<rot_tiled_16bit_entry<MOSAIC, true> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_map_ram[num], gpu->BG_tile_ram[num], pal);
-		else apply_rot_fun<rot_tiled_16bit_entry<MOSAIC, false> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_map_ram[num], gpu->BG_tile_ram[num], pal);
+			apply_rot_fun<rot_tiled_16bit_entry<MOSAIC, true>, rot_tiled_16bit_run<MOSAIC, true> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_map_ram[num], gpu->BG_tile_ram[num], pal);
+		else apply_rot_fun<rot_tiled_16bit_entry<MOSAIC, false>, rot_tiled_16bit_run<MOSAIC, false> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_map_ram[num], gpu->BG_tile_ram[num], pal);
 		return;
 	case BGType_AffineExt_256x1:
 		// 256 colors 
 		pal = MMU.ARM9_VMEM + gpu->core * 0x400;
-		apply_rot_fun<rot_256_map<MOSAIC> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_bmp_ram[num], 0, pal);
+		apply_rot_fun<rot_256_map<MOSAIC>, rot_256_run<MOSAIC> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_bmp_ram[num], 0, pal);
 		return;
 	case BGType_AffineExt_Direct:
 		// direct colors / BMP
-		apply_rot_fun<rot_BMP_map<MOSAIC> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_bmp_ram[num], 0, NULL);
+		apply_rot_fun<rot_BMP_map<MOSAIC>, rot_BMP_run<MOSAIC> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_bmp_ram[num], 0, NULL);
 		return;
 	case BGType_Large8bpp:
 		// large screen 256 colors
 		pal = MMU.ARM9_VMEM + gpu->core * 0x400;
-		apply_rot_fun<rot_256_map<MOSAIC> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_bmp_large_ram[num], 0, pal);
+		apply_rot_fun<rot_256_map<MOSAIC>, rot_256_run<MOSAIC> >(gpu,X,Y,PA,PB,PC,PD,LG, gpu->BG_bmp_large_ram[num], 0, pal);
 		return;
 	default: break;
 	}
@@ -1372,17 +1631,23 @@ INLINE void render_sprite_256(GPU * gpu, u8 spriteNum, u16 l, u8 * dst, u32 srca
 	int i; 
 	u8 palette_entry; 
 	u16 color;
+	const u32 palGen = MMU_gpu_generation((u8*)pal);
+	const GPU_TileRow *row = NULL;
+	int rowX = -1;
 
 	for(i = 0; i < lg; i++, ++sprX, x+=xdir)
 	{
-		u32 adr = srcadr + (x&0x7) + ((x&0xFFF8)<<3);
-		u8* src = (u8 *)MMU_gpu_map(adr);
-		palette_entry = *src;
+		if((x&0xFFF8) != rowX)
+		{
+			rowX = x&0xFFF8;
+			row = &GPU_tileRow<true>(gpu, (u8 *)MMU_gpu_map(srcadr + (rowX<<3)), (u8*)pal, palGen);
+		}
+		palette_entry = row->index[x&0x7];
 
 		//a zero value suppresses the pixel from processing entirely; it doesnt exist
 		if ((palette_entry>0)&&(prio<prioTab[sprX]))
 		{
-			color = LE_TO_LOCAL_16(pal[palette_entry]);
+			color = row->color[x&0x7];
 			HostWriteWord(dst, (sprX<<1), color);
 			dst_alpha[sprX] = -1;
 			typeTab[sprX] = (alpha ? 1 : 0);
@@ -1395,24 +1660,25 @@ INLINE void render_sprite_256(GPU * gpu, u8 spriteNum, u16 l, u8 * dst, u32 srca
 INLINE void render_sprite_16 (	GPU * gpu, u16 l, u8 * dst, u32 srcadr, u16 * pal, u8 * dst_alpha, u8 * typeTab, u8 * prioTab, u8 prio, int lg, int sprX, int x, int xdir, u8 alpha)
 {
 	int i; 
-	u8 palette, palette_entry;
-	u16 color, x1;
+	u8 palette_entry;
+	u16 color;
+	const u32 palGen = MMU_gpu_generation((u8*)pal);
+	const GPU_TileRow *row = NULL;
+	int rowX = -1;
 
 	for(i = 0; i < lg; i++, ++sprX, x+=xdir)
 	{
-		x1 = x>>1;
-		
-		u32 adr = srcadr + (x1&0x3) + ((x1&0xFFFC)<<3);
-		u8* src = (u8 *)MMU_gpu_map(adr);//
-		palette = *src;
-
-		if (x & 1) palette_entry = palette >> 4;
-		else       palette_entry = palette & 0xF;
+		if((x&0xFFF8) != rowX)
+		{
+			rowX = x&0xFFF8;
+			row = &GPU_tileRow<false>(gpu, (u8 *)MMU_gpu_map(srcadr + (rowX<<2)), (u8*)pal, palGen);
+		}
+		palette_entry = row->index[x&0x7];
 
 		//a zero value suppresses the pixel from processing entirely; it doesnt exist
 		if ((palette_entry>0)&&(prio<prioTab[sprX]))
 		{
-			color = LE_TO_LOCAL_16(pal[palette_entry]);
+			color = row->color[x&0x7];
 			HostWriteWord(dst, (sprX<<1), color);
 			dst_alpha[sprX] = -1;
 			typeTab[sprX] = (alpha ? 1 : 0);
@@ -1429,7 +1695,7 @@ INLINE void render_sprite_Win (GPU * gpu, u16 l, u8 * src,
 		for(i = 0; i < lg; i++, sprX++,x+=xdir)
 			//sprWin[sprX] = (src[x])?1:0;
 			if(src[(x&7) + ((x&0xFFF8)<<3)]) 
-				sprWin[sprX] = 1;
+				gpu->sprWin[sprX] = 1;
 	} else {
 		for(i = 0; i < lg; i++, ++sprX, x+=xdir)
 		{
@@ -1439,7 +1705,7 @@ INLINE void render_sprite_Win (GPU * gpu, u16 l, u8 * src,
 			else       palette_entry = palette & 0xF;
 			//sprWin[sprX] = (palette_entry)?1:0;
 			if(palette_entry)
-				sprWin[sprX] = 1;
+				gpu->sprWin[sprX] = 1;
 		}
 	}
 }
@@ -1500,6 +1766,136 @@ FORCEINLINE BOOL compute_sprite_vars(_OAM_ * spriteInfo, u16 l,
 //			SPRITE RENDERING
 /*****************************************************************************/
 
+//			ROTOZOOMED SPRITES
+//a line of an affine sprite steps the 8.8 texel coordinate by (dx, dy) a pixel. the pixels that land inside the
+//sprite are a single run, since each coordinate only moves one way, so that run is worked out first and the loops
+//below neither check bounds nor visit the pixels outside it
+
+static FORCEINLINE s32 floorDiv(s32 a, s32 b)
+{
+	const s32 q = a / b;
+	return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
+
+//narrows [first, last) to the pixels j whose (r + j*d)>>8 is in [0, size): 0 <= r + j*d <= (size<<8) - 1
+static FORCEINLINE void affineSpan(s32 r, s32 d, s32 size, s32 &first, s32 &last)
+{
+	const s32 lo = -r, hi = (size << 8) - 1 - r;
+	if (d == 0)
+	{
+		if (lo > 0 || hi < 0)
+			last = first;
+		return;
+	}
+	//dividing by a negative step turns the bounds around
+	const s32 a = d > 0 ? -floorDiv(-lo, d) : -floorDiv(-hi, d);
+	const s32 b = d > 0 ? floorDiv(hi, d) : floorDiv(lo, d);
+	first = std::max(first, a);
+	last = std::min(last, b + 1);
+}
+
+//the texel coordinates of n pixels of the run, from (x, y). all in the sprite, so they fit a byte. the vector
+//versions write up to 3 past n
+static FORCEINLINE void affineCoords(s32 x, s32 y, s32 dx, s32 dy, int n, u8 *cx, u8 *cy)
+{
+#if defined(ENABLE_SSE2)
+	__m128i vx = _mm_set_epi32(x + 3*dx, x + 2*dx, x + dx, x);
+	__m128i vy = _mm_set_epi32(y + 3*dy, y + 2*dy, y + dy, y);
+	const __m128i stepX = _mm_set1_epi32(4*dx);
+	const __m128i stepY = _mm_set1_epi32(4*dy);
+	for (int j = 0; j < n; j += 4)
+	{
+		const __m128i xy = _mm_packs_epi32(_mm_srai_epi32(vx, 8), _mm_srai_epi32(vy, 8));
+		const __m128i bytes = _mm_packus_epi16(xy, xy);
+		const u32 px = _mm_cvtsi128_si32(bytes), py = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 4));
+		memcpy(cx + j, &px, 4);
+		memcpy(cy + j, &py, 4);
+		vx = _mm_add_epi32(vx, stepX);
+		vy = _mm_add_epi32(vy, stepY);
+	}
+#elif defined(ENABLE_NEON)
+	static const s32 ramp[4] = { 0, 1, 2, 3 };
+	const int32x4_t steps = vld1q_s32(ramp);
+	int32x4_t vx = vmlaq_n_s32(vdupq_n_s32(x), steps, dx);
+	int32x4_t vy = vmlaq_n_s32(vdupq_n_s32(y), steps, dy);
+	const int32x4_t stepX = vdupq_n_s32(4*dx);
+	const int32x4_t stepY = vdupq_n_s32(4*dy);
+	for (int j = 0; j < n; j += 4)
+	{
+		const int16x8_t xy = vcombine_s16(vmovn_s32(vshrq_n_s32(vx, 8)), vmovn_s32(vshrq_n_s32(vy, 8)));
+		const uint32x2_t bytes = vreinterpret_u32_u8(vqmovun_s16(xy));
+		vst1_lane_u32((uint32_t *)(cx + j), bytes, 0);
+		vst1_lane_u32((uint32_t *)(cy + j), bytes, 1);
+		vx = vaddq_s32(vx, stepX);
+		vy = vaddq_s32(vy, stepY);
+	}
+#else
+	for (int j = 0; j < n; j++, x += dx, y += dy)
+	{
+		cx[j] = (u8)(x >> 8);
+		cy[j] = (u8)(y >> 8);
+	}
+#endif
+}
+
+//a run of a 256 or 16 color affine sprite, through the tile row cache like the other sprites. base is the sprite's
+//first tile and width its width in pixels, for the 1d mapping's rows of tiles. WINDOW for an obj window sprite,
+//which only marks sprWin
+template<GPU::SpriteRenderMode MODE, bool DEPTH8, bool WINDOW>
+static FORCEINLINE void render_sprite_affine(GPU * gpu, u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab, u8 prio, u8 type,
+	u32 base, const u8 * pal, s32 width, int sprX, int n, const u8 * cx, const u8 * cy)
+{
+	const u32 palGen = MMU_gpu_generation(pal);
+	//the bytes of a tile, of its rows, and of a row of tiles: 32 tiles in 2d mapping, the sprite's width in 1d
+	const u32 tileBytes = DEPTH8 ? 64 : 32;
+	const u32 rowBytes = DEPTH8 ? 8 : 4;
+	const u32 tileLine = (MODE == GPU::SPRITE_2D) ? 1024 : (width >> 3) * tileBytes;
+	const GPU_TileRow *row = NULL;
+	u32 rowAdr = 0xFFFFFFFF;
+
+	for (int j = 0; j < n; j++, sprX++)
+	{
+		const u32 x = cx[j], y = cy[j];
+		const u32 adr = base + (x >> 3) * tileBytes + (y >> 3) * tileLine + (y & 7) * rowBytes;
+		//scaled up, neighbouring pixels come from the same row
+		if (adr != rowAdr)
+		{
+			rowAdr = adr;
+			row = &GPU_tileRow<DEPTH8>(gpu, (u8 *)MMU_gpu_map(adr), pal, palGen);
+		}
+
+		if (row->index[x & 7] && prio < prioTab[sprX])
+		{
+			if (WINDOW)
+				gpu->sprWin[sprX] = 1;
+			else
+			{
+				HostWriteWord(dst, (sprX<<1), row->color[x & 7]);
+				dst_alpha[sprX] = -1;
+				typeTab[sprX] = type;
+				prioTab[sprX] = prio;
+			}
+		}
+	}
+}
+
+//a run of a direct color affine sprite. stride is the pixels from one of its lines to the next
+static FORCEINLINE void render_sprite_affine_BMP(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab, u8 prio, u8 alpha,
+	u32 srcadr, s32 stride, int sprX, int n, const u8 * cx, const u8 * cy)
+{
+	for (int j = 0; j < n; j++, sprX++)
+	{
+		const u16 colour = T1ReadWord((u16 *)MMU_gpu_map(srcadr + ((cx[j] + cy[j] * stride) << 1)), 0);
+		if ((colour & 0x8000) && prio < prioTab[sprX])
+		{
+			HostWriteWord(dst, (sprX<<1), colour);
+			dst_alpha[sprX] = alpha;
+			typeTab[sprX] = 3;
+			prioTab[sprX] = prio;
+		}
+	}
+}
+
 
 //TODO - refactor this so there isnt as much duped code between rotozoomed and non-rotozoomed versions
 
@@ -1525,6 +1921,38 @@ static u32 bmp_sprite_address(GPU* gpu, _OAM_ * spriteInfo, size sprSize, s32 y)
 }
 
 
+void GPU::updateSpriteLines()
+{
+	memset(spriteLineCount, 0, sizeof(spriteLineCount));
+
+	for(int i = 0; i < 128; i++)
+	{
+		_OAM_ *spriteInfo = &spriteOAM[i];
+		SlurpOAM(spriteInfo, oam, i);
+
+		if (spriteInfo->RotScale == 2)
+			continue;
+
+		//same vertical extent as the visibility checks in _spriteRender: the y line within the sprite is (l - sprY)&255
+		s32 sprY = spriteInfo->Y;
+		if (sprY >= 192)
+			sprY = (s32)((s8)(spriteInfo->Y));
+		s32 fieldY = sprSizeTab[spriteInfo->Size][spriteInfo->Shape].y;
+		if (spriteInfo->RotScale == 3)
+			fieldY <<= 1;
+
+		for(s32 y = 0; y < fieldY; y++)
+		{
+			const u32 l = (sprY + y) & 255;
+			if (l < 192)
+				spriteLines[l][spriteLineCount[l]++] = i;
+		}
+	}
+
+	spriteLinesGeneration = vram_oam_generation[core];
+	spriteLinesValid = true;
+}
+
 template<GPU::SpriteRenderMode MODE>
 void GPU::_spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 {
@@ -1536,11 +1964,16 @@ void GPU::_spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 	struct _DISPCNT * dispCnt = &(gpu->dispx_st)->dispx_DISPCNT.bits;
 	u8 block = gpu->sprBoundary;
 
-	for(int i = 0; i<128; i++)     
+	if (!gpu->spriteLinesValid || gpu->spriteLinesGeneration != vram_oam_generation[gpu->core])
+		gpu->updateSpriteLines();
+
+	//sprites that do not cover this line are never visited, so unlike the hardware they cost nothing here
+	const u8 *lineSprites = gpu->spriteLines[l];
+	const int lineSpriteCount = gpu->spriteLineCount[l];
+	for(int n = 0; n < lineSpriteCount; n++)
 	{
-		_OAM_ oam;
-		_OAM_* spriteInfo = &oam;
-		SlurpOAM(spriteInfo, gpu->oam, i);
+		const int i = lineSprites[n];
+		_OAM_* spriteInfo = &gpu->spriteOAM[i];
 
 		//for each sprite:
 		if(cost>=2130)
@@ -1558,7 +1991,6 @@ void GPU::_spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 		int xdir;
 		u8 prio, * src;
 		u32 srcadr;
-		u16 j;
 
 		// Check if sprite is disabled before everything
 		if (spriteInfo->RotScale == 2)
@@ -1569,10 +2001,9 @@ void GPU::_spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 
 		if (spriteInfo->RotScale & 1) 
 		{
-			s32		fieldX, fieldY, auxX, auxY, realX, realY, offset;
+			s32		fieldX, fieldY, realX, realY;
 			u8		blockparameter, *pal;
 			s16		dx, dmx, dy, dmy;
-			u16		colour;
 
 			// Get sprite positions and size
 			sprX = (spriteInfo->X<<23)>>23;
@@ -1640,48 +2071,28 @@ void GPU::_spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 					lg = 256 - sprX;
 			}
 
+			//the pixels of the line inside the sprite
+			s32 first = 0, last = lg;
+			affineSpan(realX, dx, sprSize.x, first, last);
+			affineSpan(realY, dy, sprSize.y, first, last);
+			if(first >= last)
+				continue;
+			const int n = last - first;
+			CACHE_ALIGN u8 cx[256 + 4], cy[256 + 4];
+			affineCoords(realX + first*dx, realY + first*dy, dx, dy, n, cx, cy);
+			sprX += first;
+
 			// If we are using 1 palette of 256 colours
 			if(spriteInfo->Depth)
 			{
-				src = (u8 *)MMU_gpu_map(gpu->sprMem + (spriteInfo->TileIndex << block));
-
 				// If extended palettes are set, use them
 				if (dispCnt->ExOBJPalette_Enable)
 					pal = (MMU.ObjExtPal[gpu->core][0]+(spriteInfo->PaletteIndex*0x200));
 				else
 					pal = (MMU.ARM9_VMEM + 0x200 + gpu->core *0x400);
 
-				for(j = 0; j < lg; ++j, ++sprX)
-				{
-					// Get the integer part of the fixed point 8.8, and check if it lies inside the sprite data
-					auxX = (realX>>8);
-					auxY = (realY>>8);
-
-					if (auxX >= 0 && auxY >= 0 && auxX < sprSize.x && auxY < sprSize.y)
-					{
-						if(MODE == SPRITE_2D)
-							offset = (auxX&0x7) + ((auxX&0xFFF8)<<3) + ((auxY>>3)<<10) + ((auxY&0x7)*8);
-						else
-							offset = (auxX&0x7) + ((auxX&0xFFF8)<<3) + ((auxY>>3)*sprSize.x*8) + ((auxY&0x7)*8);
-
-						colour = src[offset];
-
-						if (colour && (prio<prioTab[sprX]))
-						{ 
-							HostWriteWord(dst, (sprX<<1), HostReadWord(pal, (colour<<1)));
-							dst_alpha[sprX] = -1;
-							typeTab[sprX] = spriteInfo->Mode;
-							prioTab[sprX] = prio;
-						}
-					}
-
-					//  Add the rotation/scale coeficients, here the rotation/scaling
-					// is performed
-					realX += dx;
-					realY += dy;
-				}
-
-				continue;
+				render_sprite_affine<MODE, true, false>(gpu, dst, dst_alpha, typeTab, prioTab, prio, spriteInfo->Mode,
+					gpu->sprMem + (spriteInfo->TileIndex << block), pal, sprSize.x, sprX, n, cx, cy);
 			}
 			// Rotozoomed direct color
 			else if(spriteInfo->Mode == 3)
@@ -1692,101 +2103,23 @@ void GPU::_spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 
 				srcadr = bmp_sprite_address(this,spriteInfo,sprSize,0);
 
-				for(j = 0; j < lg; ++j, ++sprX)
-				{
-					// Get the integer part of the fixed point 8.8, and check if it lies inside the sprite data
-					auxX = (realX>>8);
-					auxY = (realY>>8);
-
-					//this is all very slow, and so much dup code with other rotozoomed modes.
-					//dont bother fixing speed until this whole thing gets reworked
-
-					if (auxX >= 0 && auxY >= 0 && auxX < sprSize.x && auxY < sprSize.y)
-					{
-						if(dispCnt->OBJ_BMP_2D_dim)
-							//tested by knights in the nightmare
-							offset = (bmp_sprite_address(this,spriteInfo,sprSize,auxY)-srcadr)/2+auxX;
-						else //tested by lego indiana jones (somehow?)
-							//tested by buffy sacrifice damage blood splatters in corner
-							offset = auxX + (auxY*sprSize.x);
-
-
-						u16* mem = (u16*)MMU_gpu_map(srcadr + (offset<<1));
-						
-						colour = T1ReadWord(mem,0);
-
-						if((colour&0x8000) && (prio<prioTab[sprX]))
-						{
-							HostWriteWord(dst, (sprX<<1), colour);
-							dst_alpha[sprX] = spriteInfo->PaletteIndex;
-							typeTab[sprX] = spriteInfo->Mode;
-							prioTab[sprX] = prio;
-						}
-					}
-
-					//  Add the rotation/scale coeficients, here the rotation/scaling
-					// is performed
-					realX += dx;
-					realY += dy;
-				}
-
-				continue;
+				//tested by knights in the nightmare (2d, 256 wide)
+				//tested by lego indiana jones (somehow?) and buffy sacrifice damage blood splatters in corner
+				const s32 stride = dispCnt->OBJ_BMP_2D_dim ? (bmp_sprite_address(this,spriteInfo,sprSize,1)-srcadr)/2 : sprSize.x;
+				render_sprite_affine_BMP(dst, dst_alpha, typeTab, prioTab, prio, spriteInfo->PaletteIndex, srcadr, stride, sprX, n, cx, cy);
 			}
 			// Rotozoomed 16/16 palette
 			else
 			{
-				if(MODE == SPRITE_2D)
-				{
-					src = (u8 *)MMU_gpu_map(gpu->sprMem + (spriteInfo->TileIndex<<5));
-					pal = MMU.ARM9_VMEM + 0x200 + (gpu->core*0x400 + (spriteInfo->PaletteIndex*32));
-				}
-				else
-				{
-					src = (u8 *)MMU_gpu_map(gpu->sprMem + (spriteInfo->TileIndex<<gpu->sprBoundary));
-					pal = MMU.ARM9_VMEM + 0x200 + gpu->core*0x400 + (spriteInfo->PaletteIndex*32);
-				}
+				const u32 base = gpu->sprMem + ((MODE == SPRITE_2D) ? (spriteInfo->TileIndex<<5) : (spriteInfo->TileIndex<<gpu->sprBoundary));
+				pal = MMU.ARM9_VMEM + 0x200 + gpu->core*0x400 + (spriteInfo->PaletteIndex*32);
 
-				for(j = 0; j < lg; ++j, ++sprX)
-				{
-					// Get the integer part of the fixed point 8.8, and check if it lies inside the sprite data
-					auxX = (realX>>8);
-					auxY = (realY>>8);
-
-					if (auxX >= 0 && auxY >= 0 && auxX < sprSize.x && auxY < sprSize.y)
-					{
-						if(MODE == SPRITE_2D)
-							offset = ((auxX>>1)&0x3) + (((auxX>>1)&0xFFFC)<<3) + ((auxY>>3)<<10) + ((auxY&0x7)*4);
-						else
-							offset = ((auxX>>1)&0x3) + (((auxX>>1)&0xFFFC)<<3) + ((auxY>>3)*sprSize.x)*4 + ((auxY&0x7)*4);
-						
-						colour = src[offset];
-
-						// Get 4bits value from the readed 8bits
-						if (auxX&1)	colour >>= 4;
-						else		colour &= 0xF;
-
-						if(colour && (prio<prioTab[sprX]))
-						{
-							if(spriteInfo->Mode==2)
-								sprWin[sprX] = 1;
-							else
-							{
-								HostWriteWord(dst, (sprX<<1), LE_TO_LOCAL_16(HostReadWord(pal, colour << 1)));
-								dst_alpha[sprX] = -1;
-								typeTab[sprX] = spriteInfo->Mode;
-								prioTab[sprX] = prio;
-							}
-						}
-					}
-
-					//  Add the rotation/scale coeficients, here the rotation/scaling
-					// is performed
-					realX += dx;
-					realY += dy;
-				}
-
-				continue;
+				if(spriteInfo->Mode == 2)
+					render_sprite_affine<MODE, false, true>(gpu, dst, dst_alpha, typeTab, prioTab, prio, 2, base, pal, sprSize.x, sprX, n, cx, cy);
+				else
+					render_sprite_affine<MODE, false, false>(gpu, dst, dst_alpha, typeTab, prioTab, prio, spriteInfo->Mode, base, pal, sprSize.x, sprX, n, cx, cy);
 			}
+			continue;
 		}
 		else //NOT rotozoomed
 		{
@@ -1964,6 +2297,48 @@ void GPU_set_DISPCAPCNT(u32 val)
 			gpu->dispCapCnt.srcA, gpu->dispCapCnt.srcB);*/
 }
 
+bool GPU_CompositeEnabled()
+{
+	return CommonSettings.GFX3D_GPUComposite && gpu3DFrame.texture != 0;
+}
+
+bool GPU_CompositePending()
+{
+	for(int l = 0; l < 192; l++)
+		if(gpuComposite.lines[l]) return true;
+	return false;
+}
+
+//whether this line of the main engine can leave its 3d to the frontend (see GPUCompositeFrame)
+static bool GPU_CompositeLine(GPU *gpu, const u8 *sprType, const u8 *sprPrio)
+{
+	if(!GPU_CompositeEnabled() || !gpu->dispCnt().BG0_3D || !gpu->LayersEnable[0]) return false;
+	if(gpu->dispMode != 1 || gpu->debug || gpu->dispCapCnt.enabled || gpu->setFinalColorBck_funcNum >= 4) return false;
+	if(gpu->getHOFS(0) & 0x1FF) return false;
+	if(gpu->MasterBrightFactor && (gpu->MasterBrightMode == 1 || gpu->MasterBrightMode == 2)) return false;
+
+	//one layer over the 3d may blend with it, but a second would blend with what the first made of the 3d
+	const bool blendMode = gpu->setFinalColorBck_funcNum == 1;
+	int blending = 0;
+	for(int i = 1; i < 4; i++)
+		if(gpu->LayersEnable[i] && gpu->bgPrio[i] < gpu->bgPrio[0] && blendMode && (gpu->BLDCNT & (1 << i)))
+			blending++;
+	if(gpu->LayersEnable[4])
+	{
+		const bool firstTarget = blendMode && (gpu->BLDCNT & 0x10);
+		for(int x = 0; x < 256; x++)
+		{
+			if(sprPrio[x] > gpu->bgPrio[0]) continue;
+			if(firstTarget || sprType[x] == GPU_OBJ_MODE_Transparent || sprType[x] == GPU_OBJ_MODE_Bitmap)
+			{
+				blending++;
+				break;
+			}
+		}
+	}
+	return blending <= 1;
+}
+
 static void GPU_RenderLine_layer(NDS_Screen * screen, u16 l)
 {
 	CACHE_ALIGN u8 spr[512];
@@ -1982,44 +2357,13 @@ static void GPU_RenderLine_layer(NDS_Screen * screen, u16 l)
 
 	u16 backdrop_color = T1ReadWord(MMU.ARM9_VMEM, gpu->core * 0x400) & 0x7FFF;
 
-	//we need to write backdrop colors in the same way as we do BG pixels in order to do correct window processing
-	//this is currently eating up 2fps or so. it is a reasonable candidate for optimization. 
-	gpu->currBgNum = 5;
-	switch(gpu->setFinalColorBck_funcNum)
-	{
-		//for backdrops, blend isnt applied (it's illogical, isnt it?)
-		case 0:
-		case 1:
-PLAIN_CLEAR:
-			memset_u16_le<256>(gpu->currDst,backdrop_color); 
-			break;
-
-		//for backdrops, fade in and fade out can be applied if it's a 1st target screen
-		case 2:
-			if(gpu->BLDCNT & 0x20) //backdrop is selected for color effect
-				memset_u16_le<256>(gpu->currDst,gpu->currentFadeInColors[backdrop_color]);
-			else goto PLAIN_CLEAR;
-			break;
-		case 3:
-			if(gpu->BLDCNT & 0x20) //backdrop is selected for color effect
-				memset_u16_le<256>(gpu->currDst,gpu->currentFadeOutColors[backdrop_color]);
-			else goto PLAIN_CLEAR;
-			break;
-
-		//windowed cases apparently need special treatment? why? can we not render the backdrop? how would that even work?
-		case 4: for(int x=0;x<256;x++) gpu->___setFinalColorBck<false,true,4>(backdrop_color,x,1); break;
-		case 5: for(int x=0;x<256;x++) gpu->___setFinalColorBck<false,true,5>(backdrop_color,x,1); break;
-		case 6: for(int x=0;x<256;x++) gpu->___setFinalColorBck<false,true,6>(backdrop_color,x,1); break;
-		case 7: for(int x=0;x<256;x++) gpu->___setFinalColorBck<false,true,7>(backdrop_color,x,1); break;
-	}
-	
 	memset(gpu->bgPixels,5,256);
 
 	// init background color & priorities
 	memset(sprAlpha, 0, 256);
 	memset(sprType, 0, 256);
 	memset(sprPrio, 0xFF, 256);
-	memset(sprWin, 0, 256);
+	memset(gpu->sprWin, 0, 256);
 	
 	// init pixels priorities
 	assert(NB_PRIORITIES==4);
@@ -2052,6 +2396,47 @@ PLAIN_CLEAR:
 		}
 	}
 
+	//the obj window is known now, so the window checks for the whole line can be resolved at once
+	if(gpu->setFinalColorBck_funcNum >= 4)
+		gpu->setup_windowMask();
+
+	//we need to write backdrop colors in the same way as we do BG pixels in order to do correct window processing
+	//this is currently eating up 2fps or so. it is a reasonable candidate for optimization. 
+	gpu->currBgNum = 5;
+	switch(gpu->setFinalColorBck_funcNum)
+	{
+		//for backdrops, blend isnt applied (it's illogical, isnt it?)
+		case 0:
+		case 1:
+PLAIN_CLEAR:
+			memset_u16_le<256>(gpu->currDst,backdrop_color); 
+			if(gpu->nativeDst)
+			{
+				const u32 backdrop32 = gpu->palette32(MMU.ARM9_VMEM + gpu->core * 0x400)[0];
+				for(int x = 0; x < 256; x++)
+					gpu->nativeDst[x] = backdrop32;
+			}
+			break;
+
+		//for backdrops, fade in and fade out can be applied if it's a 1st target screen
+		case 2:
+			if(gpu->BLDCNT & 0x20) //backdrop is selected for color effect
+				memset_u16_le<256>(gpu->currDst,gpu->currentFadeInColors[backdrop_color]);
+			else goto PLAIN_CLEAR;
+			break;
+		case 3:
+			if(gpu->BLDCNT & 0x20) //backdrop is selected for color effect
+				memset_u16_le<256>(gpu->currDst,gpu->currentFadeOutColors[backdrop_color]);
+			else goto PLAIN_CLEAR;
+			break;
+
+		//windowed cases apparently need special treatment? why? can we not render the backdrop? how would that even work?
+		case 4: for(int x=0;x<256;x++) gpu->___setFinalColorBck<false,true,4>(backdrop_color,x,1); break;
+		case 5: for(int x=0;x<256;x++) gpu->___setFinalColorBck<false,true,5>(backdrop_color,x,1); break;
+		case 6: for(int x=0;x<256;x++) gpu->___setFinalColorBck<false,true,6>(backdrop_color,x,1); break;
+		case 7: for(int x=0;x<256;x++) gpu->___setFinalColorBck<false,true,7>(backdrop_color,x,1); break;
+	}
+
 	
 	if (!gpu->LayersEnable[0] && !gpu->LayersEnable[1] && !gpu->LayersEnable[2] && !gpu->LayersEnable[3])
 		BG_enabled = FALSE;
@@ -2059,6 +2444,10 @@ PLAIN_CLEAR:
 	for(int j=0;j<8;j++)
 		gpu->blend2[j] = (gpu->BLDCNT & (0x100 << j))!=0;
 
+	const bool composite = gpu->core == GPU_MAIN && GPU_CompositeLine(gpu, sprType, sprPrio);
+	if(gpu->core == GPU_MAIN)
+		gpuComposite.lines[l] = composite;
+
 	// paint lower priorities first
 	// then higher priorities on top
 	for(int prio=NB_PRIORITIES; prio > 0; )
@@ -2079,12 +2468,27 @@ PLAIN_CLEAR:
 					struct _BGxCNT *bgCnt = &(gpu->dispx_st)->dispx_BGxCNT[i16].bits;
 					gpu->curr_mosaic_enabled = bgCnt->Mosaic_Enable;
 
+					//a layer the windows hide for the whole line doesn't need fetching. except under mosaic,
+					//which has to keep the colors of the line for the ones below it
+					if(gpu->setFinalColorBck_funcNum >= 4 && !gpu->curr_mosaic_enabled && !(gpu->windowLayers & (1 << i16)))
+						continue;
+
 					if (gpu->core == GPU_MAIN)
 					{
 						if (i16 == 0 && dispCnt->BG0_3D)
 						{
 							gpu->currBgNum = 0;
 
+							if (composite)
+							{
+								gpuComposite.texture3D = gpu3DFrame.texture;
+								gpuComposite.fence3D = gpu3DFrame.fence;
+								gpu->compositeColors = gpuComposite.colors + (l << 8);
+								gpu->compositeAttrs = gpuComposite.attrs + (l << 8);
+								gpu->composite3D();
+								continue;
+							}
+
 							const u16 hofs = gpu->getHOFS(i16);
 
 							gfx3d_GetLineData(l, &gpu->_3dColorLine);
@@ -2098,7 +2502,10 @@ PLAIN_CLEAR:
 									continue;
 
 								if(colorLine[(q<<2)+3])
+								{
 									gpu->setFinalColor3d(k, q);
+									if(gpu->nativeDst) gpu->nativeDst[k] = 0;
+								}
 							}
 
 							continue;
@@ -2122,7 +2529,7 @@ PLAIN_CLEAR:
 		}
 
 		// render sprite Pixels
-		if (gpu->LayersEnable[4])
+		if (gpu->LayersEnable[4] && (gpu->setFinalColorBck_funcNum < 4 || (gpu->windowLayers & 0x10)))
 		{
 			gpu->currBgNum = 4;
 			gpu->blend1 = (gpu->BLDCNT & (1 << gpu->currBgNum))!=0;
@@ -2131,27 +2538,133 @@ PLAIN_CLEAR:
 			{
 				i16=item->PixelsX[i];
 				setFinalColorSpr(gpu, gpu->currDst, HostReadWord(spr, (i16<<1)), sprAlpha[i16], sprType[i16], i16);
+				if(gpu->nativeDst) gpu->nativeDst[i16] = 0;
 			}
 		}
 	}
+
+	gpu->compositeColors = gpu->compositeAttrs = NULL;
 }
 
-template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
+//a line of a capture straight from one source. count is 128 or 256, so always a whole number of vectors
+template<bool SETALPHABIT>
+static FORCEINLINE void GPU_CaptureCopyLine(u16 *dst, const u16 *src, const int count)
 {
-	//this macro takes advantage of the fact that there are only two possible values for capx
-	#define CAPCOPY(SRC,DST,SETALPHABIT) \
-	switch(gpu->dispCapCnt.capx) { \
-		case DISPCAPCNT::_128: \
-			for (int i = 0; i < 128; i++)  \
-				HostWriteWord(DST, i << 1, HostReadWord(SRC, i << 1) | (SETALPHABIT?(1<<15):0)); \
-			break; \
-		case DISPCAPCNT::_256: \
-			for (int i = 0; i < 256; i++)  \
-				HostWriteWord(DST, i << 1, HostReadWord(SRC, i << 1) | (SETALPHABIT?(1<<15):0)); \
-			break; \
-			default: assert(false); \
+	if(!SETALPHABIT)
+	{
+		memcpy(dst, src, count * 2);
+		return;
+	}
+#if defined(ENABLE_SSE2)
+	const __m128i alpha = _mm_set1_epi16((s16)0x8000);
+	for(int i = 0; i < count; i += 8)
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_loadu_si128((const __m128i *)(src + i)), alpha));
+#elif defined(ENABLE_NEON)
+	const uint16x8_t alpha = vdupq_n_u16(0x8000);
+	for(int i = 0; i < count; i += 8)
+		vst1q_u16(dst + i, vorrq_u16(vld1q_u16(src + i), alpha));
+#else
+	for(int i = 0; i < count; i++)
+		dst[i] = src[i] | 0x8000;
+#endif
+}
+
+//a line of a capture blending sources A and B. each source only counts where its alpha bit is set, and the result
+//is opaque if either one is. the components are clamped, since eva+evb can be up to 32
+static FORCEINLINE void GPU_CaptureBlendLine(u16 *dst, const u16 *srcA, const u16 *srcB, const int count, const int eva, const int evb)
+{
+#if defined(ENABLE_SSE2)
+	const __m128i mask5 = _mm_set1_epi16(0x1F);
+	const __m128i eva_v = _mm_set1_epi16(eva);
+	const __m128i evb_v = _mm_set1_epi16(evb);
+
+	for(int i = 0; i < count; i += 8)
+	{
+		const __m128i a = _mm_loadu_si128((const __m128i *)(srcA + i));
+		const __m128i b = _mm_loadu_si128((const __m128i *)(srcB + i));
+		//all ones where the alpha bit is set
+		const __m128i aMask = _mm_srai_epi16(a, 15);
+		const __m128i bMask = _mm_srai_epi16(b, 15);
+		const __m128i aFactor = _mm_and_si128(aMask, eva_v);
+		const __m128i bFactor = _mm_and_si128(bMask, evb_v);
+
+		__m128i r = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(a, mask5), aFactor), _mm_mullo_epi16(_mm_and_si128(b, mask5), bFactor));
+		__m128i g = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(a, 5), mask5), aFactor), _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(b, 5), mask5), bFactor));
+		__m128i bl = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(a, 10), mask5), aFactor), _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(b, 10), mask5), bFactor));
+		r = _mm_min_epi16(_mm_srli_epi16(r, 4), mask5);
+		g = _mm_min_epi16(_mm_srli_epi16(g, 4), mask5);
+		bl = _mm_min_epi16(_mm_srli_epi16(bl, 4), mask5);
+
+		const __m128i alpha = _mm_slli_epi16(_mm_or_si128(aMask, bMask), 15);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_or_si128(alpha, r), _mm_or_si128(_mm_slli_epi16(g, 5), _mm_slli_epi16(bl, 10))));
+	}
+#elif defined(ENABLE_NEON)
+	const uint16x8_t mask5 = vdupq_n_u16(0x1F);
+	const uint16x8_t eva_v = vdupq_n_u16(eva);
+	const uint16x8_t evb_v = vdupq_n_u16(evb);
+
+	for(int i = 0; i < count; i += 8)
+	{
+		const uint16x8_t a = vld1q_u16(srcA + i);
+		const uint16x8_t b = vld1q_u16(srcB + i);
+		//all ones where the alpha bit is set
+		const uint16x8_t aMask = vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(a), 15));
+		const uint16x8_t bMask = vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(b), 15));
+		const uint16x8_t aFactor = vandq_u16(aMask, eva_v);
+		const uint16x8_t bFactor = vandq_u16(bMask, evb_v);
+
+		uint16x8_t r = vmlaq_u16(vmulq_u16(vandq_u16(a, mask5), aFactor), vandq_u16(b, mask5), bFactor);
+		uint16x8_t g = vmlaq_u16(vmulq_u16(vandq_u16(vshrq_n_u16(a, 5), mask5), aFactor), vandq_u16(vshrq_n_u16(b, 5), mask5), bFactor);
+		uint16x8_t bl = vmlaq_u16(vmulq_u16(vandq_u16(vshrq_n_u16(a, 10), mask5), aFactor), vandq_u16(vshrq_n_u16(b, 10), mask5), bFactor);
+		r = vminq_u16(vshrq_n_u16(r, 4), mask5);
+		g = vminq_u16(vshrq_n_u16(g, 4), mask5);
+		bl = vminq_u16(vshrq_n_u16(bl, 4), mask5);
+
+		const uint16x8_t alpha = vshlq_n_u16(vorrq_u16(aMask, bMask), 15);
+		vst1q_u16(dst + i, vorrq_u16(vorrq_u16(alpha, r), vorrq_u16(vshlq_n_u16(g, 5), vshlq_n_u16(bl, 10))));
+	}
+#else
+	for(int i = 0; i < count; i++)
+	{
+		u16 a,r,g,b;
+
+		u16 a_alpha = srcA[i] & 0x8000;
+		u16 b_alpha = srcB[i] & 0x8000;
+
+		if(a_alpha)
+		{
+			a = 0x8000;
+			r = ((srcA[i] & 0x1F) * eva);
+			g = (((srcA[i] >>  5) & 0x1F) * eva);
+			b = (((srcA[i] >>  10) & 0x1F) * eva);
+		} 
+		else
+			a = r = g = b = 0;
+
+		if(b_alpha)
+		{
+			a = 0x8000;
+			r += ((srcB[i] & 0x1F) * evb);
+			g += (((srcB[i] >>  5) & 0x1F) * evb);
+			b += (((srcB[i] >> 10) & 0x1F) * evb);
 		}
-	
+
+		r >>= 4;
+		g >>= 4;
+		b >>= 4;
+
+		//freedom wings sky will overflow while doing some fsaa/motionblur effect without this
+		r = std::min((u16)31,r);
+		g = std::min((u16)31,g);
+		b = std::min((u16)31,b);
+
+		dst[i] = a | (b << 10) | (g << 5) | r;
+	}
+#endif
+}
+
+template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
+{
 	GPU * gpu = MainScreen.gpu;
 
 	if (l == 0)
@@ -2183,6 +2696,7 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 
 		u8* cap_src = MMU.ARM9_LCD + cap_src_adr;
 		u8* cap_dst = MMU.ARM9_LCD + cap_dst_adr;
+		vram_page_generation[cap_dst_adr>>14]++;
 
 		//we must block captures when the capture dest is not mapped to LCDC
 		if(vramConfiguration.banks[gpu->dispCapCnt.writeBlock].purpose != VramConfiguration::LCDC)
@@ -2192,6 +2706,9 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 		if(vramConfiguration.banks[gpu->dispCapCnt.readBlock].purpose != VramConfiguration::LCDC)
 			cap_src = MMU.blank_memory;
 
+		//there are only two possible values for capx
+		const int capWidth = gpu->dispCapCnt.capx==DISPCAPCNT::_128 ? 128 : 256;
+
 		if(!skip)
 		if (l < gpu->dispCapCnt.capy)
 		{
@@ -2208,16 +2725,15 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 									u8 *src = (u8*)(gpu->tempScanline);
 #ifdef LOCAL_BE
 									static u16 swapSrc[256];
-									const size_t swapSrcSize = (gpu->dispCapCnt.capx == DISPCAPCNT::_128) ? 128 : 256;
 									
-									for(size_t i = 0; i < swapSrcSize; i++)
+									for(int i = 0; i < capWidth; i++)
 									{
 										swapSrc[i] = LE_TO_LOCAL_16(((u16 *)src)[i]);
 									}
 									
-									CAPCOPY((u8 *)swapSrc,cap_dst,true);
+									GPU_CaptureCopyLine<true>((u16*)cap_dst, swapSrc, capWidth);
 #else
-									CAPCOPY(src,cap_dst,true);
+									GPU_CaptureCopyLine<true>((u16*)cap_dst, (u16*)src, capWidth);
 #endif
 								}
 							break;
@@ -2226,7 +2742,7 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 									//INFO("Capture 3D\n");
 									u16* colorLine;
 									gfx3d_GetLineData15bpp(l, &colorLine);
-									CAPCOPY(((u8*)colorLine),cap_dst,false);
+									GPU_CaptureCopyLine<false>((u16*)cap_dst, colorLine, capWidth);
 								}
 							break;
 						}
@@ -2239,7 +2755,7 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 						{
 							case 0:	
 								//Capture VRAM
-								CAPCOPY(cap_src,cap_dst,true);
+								GPU_CaptureCopyLine<true>((u16*)cap_dst, (u16*)cap_src, capWidth);
 								break;
 							case 1:
 								//capture dispfifo
@@ -2279,44 +2795,7 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 						}
 
 
-						const int todo = (gpu->dispCapCnt.capx==DISPCAPCNT::_128?128:256);
-
-						for(u16 i = 0; i < todo; i++) 
-						{
-							u16 a,r,g,b;
-
-							u16 a_alpha = srcA[i] & 0x8000;
-							u16 b_alpha = srcB[i] & 0x8000;
-
-							if(a_alpha)
-							{
-								a = 0x8000;
-								r = ((srcA[i] & 0x1F) * gpu->dispCapCnt.EVA);
-								g = (((srcA[i] >>  5) & 0x1F) * gpu->dispCapCnt.EVA);
-								b = (((srcA[i] >>  10) & 0x1F) * gpu->dispCapCnt.EVA);
-							} 
-							else
-								a = r = g = b = 0;
-
-							if(b_alpha)
-							{
-								a = 0x8000;
-								r += ((srcB[i] & 0x1F) * gpu->dispCapCnt.EVB);
-								g += (((srcB[i] >>  5) & 0x1F) * gpu->dispCapCnt.EVB);
-								b += (((srcB[i] >> 10) & 0x1F) * gpu->dispCapCnt.EVB);
-							}
-
-							r >>= 4;
-							g >>= 4;
-							b >>= 4;
-
-							//freedom wings sky will overflow while doing some fsaa/motionblur effect without this
-							r = std::min((u16)31,r);
-							g = std::min((u16)31,g);
-							b = std::min((u16)31,b);
-
-							HostWriteWord(cap_dst, i << 1, a | (b << 10) | (g << 5) | r);
-						}
+						GPU_CaptureBlendLine((u16*)cap_dst, srcA, srcB, capWidth, gpu->dispCapCnt.EVA, gpu->dispCapCnt.EVB);
 					}
 				break;
 			}
@@ -2332,6 +2811,122 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 	}
 }
 
+//applies the master brightness to a line of 256 pixels. this gives the same results as the fadeInColors and
+//fadeOutColors tables, but works on all three components of several pixels at once instead of looking each one up
+template<bool BRIGHT_UP>
+static FORCEINLINE void GPU_MasterBrightnessLine(u16 *dst, const int factor)
+{
+#if defined(ENABLE_SSE2)
+	const __m128i mask5 = _mm_set1_epi16(0x1F);
+	const __m128i factor_v = _mm_set1_epi16(factor);
+
+	for(int i = 0; i < 256; i += 8)
+	{
+		const __m128i pix = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i r = _mm_and_si128(pix, mask5);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(pix, 5), mask5);
+		__m128i b = _mm_and_si128(_mm_srli_epi16(pix, 10), mask5);
+
+		if(BRIGHT_UP)
+		{
+			r = _mm_add_epi16(r, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(mask5, r), factor_v), 4));
+			g = _mm_add_epi16(g, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(mask5, g), factor_v), 4));
+			b = _mm_add_epi16(b, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(mask5, b), factor_v), 4));
+		}
+		else
+		{
+			r = _mm_sub_epi16(r, _mm_srli_epi16(_mm_mullo_epi16(r, factor_v), 4));
+			g = _mm_sub_epi16(g, _mm_srli_epi16(_mm_mullo_epi16(g, factor_v), 4));
+			b = _mm_sub_epi16(b, _mm_srli_epi16(_mm_mullo_epi16(b, factor_v), 4));
+		}
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(r, _mm_or_si128(_mm_slli_epi16(g, 5), _mm_slli_epi16(b, 10))));
+	}
+#elif defined(ENABLE_NEON)
+	const uint16x8_t mask5 = vdupq_n_u16(0x1F);
+	const uint16x8_t factor_v = vdupq_n_u16(factor);
+
+	for(int i = 0; i < 256; i += 8)
+	{
+		const uint16x8_t pix = vld1q_u16(dst + i);
+		uint16x8_t r = vandq_u16(pix, mask5);
+		uint16x8_t g = vandq_u16(vshrq_n_u16(pix, 5), mask5);
+		uint16x8_t b = vandq_u16(vshrq_n_u16(pix, 10), mask5);
+
+		if(BRIGHT_UP)
+		{
+			r = vsraq_n_u16(r, vmulq_u16(vsubq_u16(mask5, r), factor_v), 4);
+			g = vsraq_n_u16(g, vmulq_u16(vsubq_u16(mask5, g), factor_v), 4);
+			b = vsraq_n_u16(b, vmulq_u16(vsubq_u16(mask5, b), factor_v), 4);
+		}
+		else
+		{
+			r = vsubq_u16(r, vshrq_n_u16(vmulq_u16(r, factor_v), 4));
+			g = vsubq_u16(g, vshrq_n_u16(vmulq_u16(g, factor_v), 4));
+			b = vsubq_u16(b, vshrq_n_u16(vmulq_u16(b, factor_v), 4));
+		}
+
+		vst1q_u16(dst + i, vorrq_u16(r, vorrq_u16(vshlq_n_u16(g, 5), vshlq_n_u16(b, 10))));
+	}
+#else
+	const u16 *fadeColors = BRIGHT_UP ? fadeInColors[factor] : fadeOutColors[factor];
+
+	for(int i = 0; i < 256; i++)
+		dst[i] = fadeColors[dst[i] & 0x7FFF];
+#endif
+}
+
+#ifdef HOSTCPU_HAVE_X86_KERNELS
+#include <immintrin.h>
+
+//the same, 16 pixels at a time, for a cpu with avx2
+template<bool BRIGHT_UP>
+HOSTCPU_TARGET("avx2") static void GPU_MasterBrightnessLine_AVX2(u16 *dst, const int factor)
+{
+	const __m256i mask5 = _mm256_set1_epi16(0x1F);
+	const __m256i factor_v = _mm256_set1_epi16(factor);
+
+	for(int i = 0; i < 256; i += 16)
+	{
+		const __m256i pix = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i r = _mm256_and_si256(pix, mask5);
+		__m256i g = _mm256_and_si256(_mm256_srli_epi16(pix, 5), mask5);
+		__m256i b = _mm256_and_si256(_mm256_srli_epi16(pix, 10), mask5);
+
+		if(BRIGHT_UP)
+		{
+			r = _mm256_add_epi16(r, _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(mask5, r), factor_v), 4));
+			g = _mm256_add_epi16(g, _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(mask5, g), factor_v), 4));
+			b = _mm256_add_epi16(b, _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(mask5, b), factor_v), 4));
+		}
+		else
+		{
+			r = _mm256_sub_epi16(r, _mm256_srli_epi16(_mm256_mullo_epi16(r, factor_v), 4));
+			g = _mm256_sub_epi16(g, _mm256_srli_epi16(_mm256_mullo_epi16(g, factor_v), 4));
+			b = _mm256_sub_epi16(b, _mm256_srli_epi16(_mm256_mullo_epi16(b, factor_v), 4));
+		}
+
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(r, _mm256_or_si256(_mm256_slli_epi16(g, 5), _mm256_slli_epi16(b, 10))));
+	}
+}
+#endif
+
+//the master brightness kernels, the baseline ones unless GPU_Init finds the cpu has something wider
+typedef void (*MasterBrightnessLineFunc)(u16 *dst, const int factor);
+static MasterBrightnessLineFunc masterBrightnessUp = GPU_MasterBrightnessLine<true>;
+static MasterBrightnessLineFunc masterBrightnessDown = GPU_MasterBrightnessLine<false>;
+
+static void GPU_SelectKernels()
+{
+#ifdef HOSTCPU_HAVE_X86_KERNELS
+	if(hostcpu_has(HOSTCPU_AVX2))
+	{
+		masterBrightnessUp = GPU_MasterBrightnessLine_AVX2<true>;
+		masterBrightnessDown = GPU_MasterBrightnessLine_AVX2<false>;
+	}
+#endif
+}
+
 static INLINE void GPU_RenderLine_MasterBrightness(NDS_Screen * screen, u16 l)
 {
 	GPU * gpu = screen->gpu;
@@ -2360,10 +2955,7 @@ static INLINE void GPU_RenderLine_MasterBrightness(NDS_Screen * screen, u16 l)
 		{
 			if(factor != 16)
 			{
-				for(i16 = 0; i16 < 256; ++i16)
-				{
-					((u16*)dst)[i16] = fadeInColors[factor][((u16*)dst)[i16]&0x7FFF];
-				}
+				masterBrightnessUp((u16*)dst, factor);
 			}
 			else
 			{
@@ -2379,10 +2971,7 @@ static INLINE void GPU_RenderLine_MasterBrightness(NDS_Screen * screen, u16 l)
 		{
 			if(factor != 16)
 			{
-				for(i16 = 0; i16 < 256; ++i16)
-				{
-					((u16*)dst)[i16] = fadeOutColors[factor][((u16*)dst)[i16]&0x7FFF];
-				}
+				masterBrightnessDown((u16*)dst, factor);
 			}
 			else
 			{
@@ -2466,28 +3055,132 @@ void GPU::update_winh(int WIN_NUM)
 	//	if((x < startX) || (x >= endX)) return false;
 	//}
 
+	u8 *win = h_win[WIN_NUM];
 	if(startX > endX)
 	{
-		for(int i=0;i<=endX;i++)
-			h_win[WIN_NUM][i] = 1;
-		for(int i=endX+1;i<startX;i++)
-			h_win[WIN_NUM][i] = 0;
-		for(int i=startX;i<256;i++)
-			h_win[WIN_NUM][i] = 1;
+		memset(win, 1, endX+1);
+		memset(win+endX+1, 0, startX-(endX+1));
+		memset(win+startX, 1, 256-startX);
 	} else
 	{
-		for(int i=0;i<startX;i++)
-			h_win[WIN_NUM][i] = 0;
-		for(int i=startX;i<endX;i++)
-			h_win[WIN_NUM][i] = 1;
-		for(int i=endX;i<256;i++)
-			h_win[WIN_NUM][i] = 0;
+		memset(win, 0, startX);
+		memset(win+startX, 1, endX-startX);
+		memset(win+endX, 0, 256-endX);
+	}
+}
+
+//compares everything this line depends on against the previous frame. returns true when the line still in
+//GPU_screen can be kept, in which case the per line bookkeeping that rendering would have done is done here
+static bool GPU_RenderLine_reuse(NDS_Screen * screen, u16 l)
+{
+	GPU * gpu = screen->gpu;
+	GPU::LineSignature &prev = gpu->lineSignature[l];
+
+	//only lines rendered straight into GPU_screen can be kept. mosaic carries colors over from earlier lines
+	//and capture has to see the line being rendered (and starts and stops on lines 0 and 191), so those are always rendered too
+	if(gpu->dispMode != 1 || gpu->debug || T1ReadWord((u8 *)&gpu->dispx_st->dispx_MISC.MOSAIC, 0) != 0
+		|| (gpu->core == GPU_MAIN && (gpu->dispCapCnt.enabled || l == 0 || l == 191)))
+	{
+		prev.valid = false;
+		return false;
+	}
+
+	GPU::LineSignature curr;
+	memset(&curr, 0, sizeof(curr));
+	memcpy(&curr.regs, gpu->dispx_st, sizeof(REG_DISPx));
+	curr.vramGen = vram_engine_generation[gpu->core];
+	curr.palGen = vram_palette_generation[gpu->core];
+	curr.oamGen = vram_oam_generation[gpu->core];
+	if(gpu->core == GPU_MAIN && gpu->dispCnt().BG0_3D && gpu->LayersEnable[0])
+		curr.gen3d = gfx3d.flushGeneration;
+	curr.masterBrightFactor = gpu->MasterBrightFactor;
+	curr.masterBrightMode = gpu->MasterBrightMode;
+	curr.offset = screen->offset;
+	curr.composite = gpu->core == GPU_MAIN && GPU_CompositeEnabled();
+	for(int i = 0; i < 5; i++)
+		curr.layers |= (gpu->LayersEnable[i] ? 1 : 0) << i;
+	curr.valid = true;
+
+	if(memcmp(&curr, &prev, sizeof(curr)))
+	{
+		memcpy(&prev, &curr, sizeof(curr));
+		gpu->linesRendered++;
+		return false;
+	}
+
+	//the affine bgs step their reference point once per line whenever they are rendered
+	for(int num = 2; num < 4; num++)
+	{
+		if(!gpu->LayersEnable[num]) continue;
+		const BGType type = GPU_mode2type[gpu->dispCnt().BG_Mode][num];
+		if(type != BGType_Affine && type != BGType_AffineExt && type != BGType_Large8bpp) continue;
+		BGxPARMS * parms = (num == 2) ? &(gpu->dispx_st)->dispx_BG2PARMS : &(gpu->dispx_st)->dispx_BG3PARMS;
+		parms->BGxX += parms->BGxPB;
+		parms->BGxY += parms->BGxPD;
+	}
+
+	gpu->linesReused++;
+	return true;
+}
+
+void GPU_SetOutputFormat(GPUOutputFormat format)
+{
+	gpuOutputFormatWanted = format;
+}
+
+GPUOutputFormat GPU_GetOutputFormat()
+{
+	return gpuOutputFormat[0] == gpuOutputFormat[1] ? gpuOutputFormat[0] : GPU_OUTPUT_RGB555;
+}
+
+//the line as it came out, into GPU_screenNative
+static void GPU_RenderLine_Output(NDS_Screen * screen, u16 l, GPUOutputFormat format)
+{
+	const u16 *src = (const u16 *)(GPU_screen + (screen->offset + l) * 512);
+	if(format == GPU_OUTPUT_RGBA8888)
+	{
+		u32 *dst = GPU_screenNative + (screen->offset + l) * 256;
+		//a line drawn into nativeDst only has the pixels that didn't come from a palette left
+		if(screen->gpu->nativeDst)
+		{
+			for(int i = 0; i < 256; i++)
+				if(!dst[i]) dst[i] = 0xFF000000 | RGB15TO32_NOALPHA(src[i]);
+		}
+		else
+		{
+			for(int i = 0; i < 256; i++)
+				dst[i] = 0xFF000000 | RGB15TO32_NOALPHA(src[i]);
+		}
+	}
+	else
+	{
+		u16 *dst = (u16 *)GPU_screenNative + (screen->offset + l) * 256;
+		for(int i = 0; i < 256; i++)
+			dst[i] = RGB15TO16_REVERSE(src[i]);
 	}
 }
 
+static void GPU_RenderLine_Engine(NDS_Screen * screen, u16 l, bool skip);
+
 void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 {
 	GPU * gpu = screen->gpu;
+	if(l == 0)
+		gpuOutputFormat[gpu->core] = (GPUOutputFormat)gpuOutputFormatWanted;
+
+	GPU_RenderLine_Engine(screen, l, skip);
+
+	//a skipped line leaves what the last frame had, in both
+	const GPUOutputFormat format = gpuOutputFormat[gpu->core];
+	if(format != GPU_OUTPUT_RGB555 && !skip)
+		GPU_RenderLine_Output(screen, l, format);
+	gpu->nativeDst = NULL;
+}
+
+static void GPU_RenderLine_Engine(NDS_Screen * screen, u16 l, bool skip)
+{
+	PROFILE_ZONE(PROFILE_GPU_LINE);
+	GPU * gpu = screen->gpu;
 
 	//here is some setup which is only done on line 0
 	if(l == 0) {
@@ -2519,6 +3212,8 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 	//blacken the screen if it is turned off by the user
 	if(!CommonSettings.showGpu.screens[gpu->core])
 	{
+		gpu->lineSignature[l].valid = false;
+		if(gpu->core == GPU_MAIN) gpuComposite.lines[l] = false;
 		u8 * dst =  GPU_screen + (screen->offset + l) * 512;
 		memset(dst,0,512);
 		return;
@@ -2530,6 +3225,8 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 		// except if it could cause any side effects (for example if we're capturing), then don't skip anything
 		if(!(gpu->core == GPU_MAIN && (gpu->dispCapCnt.enabled || l == 0 || l == 191)))
 		{
+			gpu->lineSignature[l].valid = false;
+			if(gpu->core == GPU_MAIN) gpuComposite.lines[l] = false;
 			gpu->currLine = l;
 			GPU_RenderLine_MasterBrightness(screen, l);
 			return;
@@ -2545,10 +3242,10 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 	//mosaic test hacks
 	//mosaic_width = mosaic_height = 3;
 
-	GPU::mosaicLookup.widthValue = mosaic_width;
-	GPU::mosaicLookup.heightValue = mosaic_height;
-	GPU::mosaicLookup.width = &GPU::mosaicLookup.table[mosaic_width][0];
-	GPU::mosaicLookup.height = &GPU::mosaicLookup.table[mosaic_height][0];
+	gpu->mosaicWidthValue = mosaic_width;
+	gpu->mosaicHeightValue = mosaic_height;
+	gpu->mosaicWidth = &GPU::mosaicLookup.table[mosaic_width][0];
+	gpu->mosaicHeight = &GPU::mosaicLookup.table[mosaic_height][0];
 
 	if(gpu->need_update_winh[0]) gpu->update_winh(0);
 	if(gpu->need_update_winh[1]) gpu->update_winh(1);
@@ -2556,10 +3253,19 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 	gpu->setup_windows<0>();
 	gpu->setup_windows<1>();
 
+	if(GPU_RenderLine_reuse(screen, l))
+		return;
+
 	//generate the 2d engine output
 	if(gpu->dispMode == 1) {
 		//optimization: render straight to the output buffer when thats what we are going to end up displaying anyway
 		gpu->tempScanline = screen->gpu->currDst = (u8 *)(GPU_screen) + (screen->offset + l) * 512;
+		//with no window or color effect on the line, its palette colors can go out as RGBA8888 as they are drawn
+		if(gpuOutputFormat[gpu->core] == GPU_OUTPUT_RGBA8888 && gpu->setFinalColorBck_funcNum == 0 && !gpu->debug)
+		{
+			gpu->nativeDst = GPU_screenNative + (screen->offset + l) * 256;
+			memset(gpu->nativeDst, 0, 256 * sizeof(u32));
+		}
 	} else {
 		//otherwise, we need to go to a temp buffer
 		gpu->tempScanline = screen->gpu->currDst = (u8 *)gpu->tempScanlineBuffer;
@@ -2601,8 +3307,16 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 				//this has not been tested since the dma timing for dispfifo was changed around the time of
 				//newemuloop. it may not work.
 				u8 * dst =  GPU_screen + (screen->offset + l) * 512;
+#ifdef LOCAL_BE
 				for (int i=0; i < 128; i++)
 					T1WriteLong(dst, i << 2, DISP_FIFOrecv() & 0x7FFF7FFF);
+#else
+				//the line comes out of the fifo in one piece, then loses the bits the screen doesn't have
+				u32 * line = (u32 *)dst;
+				DISP_FIFOrecvBlock(line, 128);
+				for (int i=0; i < 128; i++)
+					line[i] &= 0x7FFF7FFF;
+#endif
 			}
 			break;
 	}
@@ -561,6 +561,31 @@ typedef struct
 	////<-- 256 + 24
 	//u8 pad2[256-24];
 } itemsForPriority_t;
+
+//one 8 pixel row of a text bg or obj tile, decoded to palette indices and resolved to colors.
+//it stays valid until the vram page it came from or the palette it was resolved against is written
+//(see MMU_gpu_generation), so a tile repeated across the screen or across frames is only decoded once
+#define GPU_TILEROW_CACHE_SIZE 1024
+typedef struct
+{
+	const u8 *src, *pal;
+	u32 srcGen, palGen;
+	u16 color[8];
+	u8 index[8];
+	bool depth8;
+} GPU_TileRow;
+
+//a palette of 256 colors (a standard one, or one of the 16 of an extended palette slot) expanded to RGBA8888 with
+//the engine's master brightness already done to it, for the lines whose colors go to GPU_screenNative as they are
+//drawn. it is expanded again once the palette's generation (see MMU_gpu_generation) or the brightness moves on
+#define GPU_PALETTE32_CACHE_SIZE 32
+typedef struct
+{
+	const u8 *src;
+	u32 gen;
+	u32 brightness;
+	u32 color[256];
+} GPU_Palette32;
 #define MMU_ABG		0x06000000
 #define MMU_BBG		0x06200000
 #define MMU_AOBJ	0x06400000
@@ -624,6 +649,11 @@ struct GPU
 	bool need_update_winh[2];
 	
 	template<int WIN_NUM> void setup_windows();
+	//the window control bits that apply to each pixel of the current line (enables for BG0-3 and OBJ, then color effects in bit 5)
+	u8 windowMask[256];
+	//all of windowMask or'd together: the layers that the windows let through somewhere on the line
+	u8 windowLayers;
+	void setup_windowMask();
 
 	u8 core;
 
@@ -689,6 +719,10 @@ struct GPU
 	u8* currDst;
 
 	u8* _3dColorLine;
+	//where this line keeps the 3d for the frontend to mix in (see GPUCompositeFrame), or NULL when it's mixed here
+	u32 *compositeColors, *compositeAttrs;
+	void composite3D();
+	void compositeOver(u16 over, bool blends, int eva, int evb, const u32 x);
 
 
 	static struct MosaicLookup {
@@ -707,10 +741,34 @@ struct GPU
 				}
 		}
 
-		TableEntry *width, *height;
-		int widthValue, heightValue;
-		
 	} mosaicLookup;
+	//the rows of the mosaic table this engine is using for the current line.
+	//these are per engine so that both engines can render a line at the same time
+	MosaicLookup::TableEntry *mosaicWidth, *mosaicHeight;
+	int mosaicWidthValue, mosaicHeightValue;
+	u8 sprWin[256];
+	GPU_TileRow tileRowCache[GPU_TILEROW_CACHE_SIZE];
+	GPU_Palette32 palette32Cache[GPU_PALETTE32_CACHE_SIZE];
+	//where the current line's RGBA8888 words go in GPU_screenNative while it is drawn, on lines with no window or
+	//color effect. the palette colors are written there straight from palette32(); every other pixel is left 0
+	//and converted from GPU_screen afterwards. NULL on any other line
+	u32 *nativeDst;
+	const u32* palette32(const u8 *pal);
+
+	//everything a line's output depends on. when a line's signature matches the one from the previous frame,
+	//the line still in GPU_screen is reused instead of rendering it again
+	struct LineSignature {
+		REG_DISPx regs;
+		u32 vramGen, palGen, oamGen, gen3d;
+		u32 masterBrightFactor;
+		u16 offset;
+		u8 masterBrightMode;
+		u8 layers;
+		bool composite;
+		bool valid;
+	} lineSignature[192];
+	//counts for the hud's reuse ratio; read and cleared by the frontend
+	u32 linesReused, linesRendered;
 	bool curr_mosaic_enabled;
 
 	u16 blend(u16 colA, u16 colB);
@@ -730,6 +788,15 @@ struct GPU
 		SPRITE_1D, SPRITE_2D
 	} spriteRenderMode;
 
+	//OAM unpacked once, and for each line the sprites that cover it, in OAM order.
+	//rebuilt whenever vram_oam_generation says this engine's OAM has been written
+	_OAM_ spriteOAM[128];
+	u8 spriteLines[192][128];
+	u8 spriteLineCount[192];
+	u32 spriteLinesGeneration;
+	bool spriteLinesValid;
+	void updateSpriteLines();
+
 	template<GPU::SpriteRenderMode MODE>
 	void _spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab);
 	
@@ -744,9 +811,10 @@ struct GPU
 
 	void setFinalColor3d(int dstX, int srcX);
 	
-	template<bool BACKDROP, int FUNCNUM> void setFinalColorBG(u16 color, const u32 x);
-	template<bool MOSAIC, bool BACKDROP> FORCEINLINE void __setFinalColorBck(u16 color, const u32 x, const int opaque);
-	template<bool MOSAIC, bool BACKDROP, int FUNCNUM> FORCEINLINE void ___setFinalColorBck(u16 color, const u32 x, const int opaque);
+	//color32 is the color from palette32() for nativeDst, or 0 when there isn't one
+	template<bool BACKDROP, int FUNCNUM> void setFinalColorBG(u16 color, const u32 x, const u32 color32 = 0);
+	template<bool MOSAIC, bool BACKDROP> FORCEINLINE void __setFinalColorBck(u16 color, const u32 x, const int opaque, const u32 color32 = 0);
+	template<bool MOSAIC, bool BACKDROP, int FUNCNUM> FORCEINLINE void ___setFinalColorBck(u16 color, const u32 x, const int opaque, const u32 color32 = 0);
 
 	void setAffineStart(int layer, int xy, u32 val);
 	void setAffineStartWord(int layer, int xy, u16 val, int word);
@@ -817,6 +885,54 @@ static void REG_DISPx_pack_test(GPU * gpu)
 
 CACHE_ALIGN extern u8 GPU_screen[4*256*192];
 
+//the screens can also come out in the format the frontend shows them in, so that it doesn't have to go over the whole
+//frame to convert it: each line is written to GPU_screenNative in that format as well, after its master brightness,
+//as RGBA8888 words or as RGB565 halfwords (then only the first half of it is used), both screens like GPU_screen.
+//GPU_screen stays RGB555 for everything else that reads it
+enum GPUOutputFormat
+{
+	GPU_OUTPUT_RGB555, //GPU_screen only
+	GPU_OUTPUT_RGBA8888,
+	GPU_OUTPUT_RGB565,
+};
+CACHE_ALIGN extern u32 GPU_screenNative[2*256*192];
+
+//from any thread; it takes effect from the next frame on
+void GPU_SetOutputFormat(GPUOutputFormat format);
+//what the frame in GPU_screenNative is in, GPU_OUTPUT_RGB555 if there isn't one (or the screens didn't agree)
+GPUOutputFormat GPU_GetOutputFormat();
+
+//the main screen's 3d can be left for the frontend to mix in on the gpu, from the texture the 3d renderer keeps its
+//frame in (gpu3DFrame), instead of being read back and mixed in here. a line that does has, for each pixel, the color
+//under the 3d, what was drawn over it and how they mix; GPU_screen has what the line came out as without the 3d,
+//which is what the pixels the 3d leaves transparent show. lines with windows, a capture, master brightness, a
+//scrolled 3d layer, or more than one layer over the 3d that could blend with it, mix their 3d here as usual
+enum
+{
+	GPU_COMPOSITE_3D = 1, //the 3d is on top
+	GPU_COMPOSITE_3D_UNDER = 2, //a layer is over the 3d, in the high half of the pixel's color
+	GPU_COMPOSITE_KIND = 3,
+	GPU_COMPOSITE_3D_BLENDS = 4, //the 3d alpha blends with the color under it
+	GPU_COMPOSITE_3D_FADE_IN = 8, //the 3d is brightened by evy
+	GPU_COMPOSITE_3D_FADE_OUT = 16, //the 3d is darkened by evy
+	GPU_COMPOSITE_OVER_BLENDS = 32, //the layer over the 3d blends with it by eva and evb
+};
+
+struct GPUCompositeFrame
+{
+	u32 colors[192*256]; //the color under the 3d, and in the high half the one over it
+	u32 attrs[192*256]; //from the low byte: the flags above, evy, eva and evb
+	bool lines[192]; //the lines whose attrs are in use; the rest have nothing to mix in
+	u32 texture3D; //gpu3DFrame as it was when the lines were rendered
+	void *fence3D;
+};
+extern GPUCompositeFrame gpuComposite;
+
+//whether the lines about to be rendered may leave their 3d to the frontend
+bool GPU_CompositeEnabled();
+//whether any line now in GPU_screen did
+bool GPU_CompositePending();
+
 
 GPU * GPU_Init(u8 l);
 void GPU_Reset(GPU *g, u8 l);
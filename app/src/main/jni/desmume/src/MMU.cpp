@@ -46,6 +46,7 @@
 #include "encrypt.h"
 #include "GPU.h"
 #include "SPU.h"
+#include "texcache.h"
 
 #ifdef DO_ASSERT_UNALIGNED
 #define ASSERT_UNALIGNED(x) assert(x)
@@ -285,6 +286,26 @@ u8 vram_arm9_map[VRAM_ARM9_PAGES];
 //this chooses which banks are mapped in the 128K banks starting at 0x06000000 in ARM7
 u8 vram_arm7_map[2];
 
+//write generations of the 16KB pages of the LCDC buffer and of each engine's standard palettes
+u32 vram_page_generation[VRAM_GENERATION_PAGES];
+u32 vram_palette_generation[2];
+//per engine: bumped by stores into any page the engine can see (bg, obj and extended palettes) and by remaps
+u32 vram_engine_generation[2];
+u32 vram_oam_generation[2];
+//which engines (bit 0 = main, bit 1 = sub) can see each page of the LCDC buffer
+static u8 vram_page_engines[VRAM_GENERATION_PAGES];
+//write generations of the 4KB pages of main memory
+u32 mainmem_page_generation[MAINMEM_GENERATION_PAGES];
+
+void MMU_touchAllMainMem()
+{
+	for(u32 i=0;i<MAINMEM_GENERATION_PAGES;i++) mainmem_page_generation[i]++;
+}
+
+//see MMU_fastmap_refresh
+u8* MMU_fastmap[2][MMU_FASTMAP_PAGES];
+u32 MMU_fastmap_adr[2][MMU_FASTMAP_WRITE_PAGES];
+
 //----->
 //consider these later, for better recordkeeping, instead of using the u8* in MMU
 
@@ -456,6 +477,23 @@ static FORCEINLINE u32 MMU_LCDmap(u32 addr, bool& unmapped, bool& restricted)
 		return LCDC_HACKY_LOCATION + (vram_page<<14) + ofs;
 }
 
+//call with an address returned by MMU_LCDmap right before storing to it,
+//so that anything decoded from that vram page or palette gets thrown away
+static FORCEINLINE void MMU_touchVRAM(u32 adr)
+{
+	if((adr>>24) == 0x06)
+	{
+		const u32 page = (adr-LCDC_HACKY_LOCATION)>>14;
+		vram_page_generation[page]++;
+		if(vram_page_engines[page]&1) vram_engine_generation[0]++;
+		if(vram_page_engines[page]&2) vram_engine_generation[1]++;
+	}
+	else if((adr>>24) == 0x05)
+		vram_palette_generation[(adr>>10)&1]++;
+	else if((adr>>24) == 0x07)
+		vram_oam_generation[(adr>>10)&1]++;
+}
+
 
 #define LOG_VRAM_ERROR() LOG("No data for block %i MST %i\n", block, VRAMBankCnt & 0x07);
 
@@ -796,13 +834,23 @@ static inline void MMU_VRAMmapControl(u8 block, u8 VRAMBankCnt)
 	//handle WRAM, first of all
 	if(block == 7)
 	{
+#if defined(HAVE_JIT) && !defined(MAPPED_JIT_FUNCS)
+		//both cpus see other code at 03000000-037FFFFF now
+		if(MMU.WRAMCNT != (VRAMBankCnt & 3))
+			arm_jit_invalidate_pages(0x03000000, 0x03800000);
+#endif
+		NDS_SyncCpus();
 		MMU.WRAMCNT = VRAMBankCnt & 3;
+		MMU_fastmap_refresh(0x03);
 		return;
 	}
 
 	//first, save the texture info so we can check it for changes and trigger purges of the texcache
 	MMU_struct::TextureInfo oldTexInfo = MMU.texInfo;
 
+	//textures the 3d renderer is still decoding on other threads must be read from the old mapping
+	TexCache_FinishDecodes();
+
 	//unmap everything
 	MMU_VRAM_unmap_all();
 
@@ -898,9 +946,56 @@ static inline void MMU_VRAMmapControl(u8 block, u8 VRAMBankCnt)
 		//}
 	}
 
+	//note which engines can see each page now, for vram_engine_generation
+	memset(vram_page_engines, 0, sizeof(vram_page_engines));
+	for(int t=0;t<4;t++)
+		for(int i=0;i<sizes[t];i++)
+			vram_page_engines[vram_arm9_map[types[t]+i]] |= 1<<(t&1);
+	for(int core=0;core<2;core++)
+	{
+		for(int i=0;i<4;i++)
+			vram_page_engines[(MMU.ExtPal[core][i]-MMU.ARM9_LCD)>>14] |= 1<<core;
+		for(int i=0;i<2;i++)
+			vram_page_engines[(MMU.ObjExtPal[core][i]-MMU.ARM9_LCD)>>14] |= 1<<core;
+	}
+	vram_engine_generation[0]++;
+	vram_engine_generation[1]++;
+
+	MMU_fastmap_refresh(0x06);
+
 	//-------------------------------
 }
 
+template<int PROCNUM>
+static void MMU_fastmap_refresh(u32 region)
+{
+	const u32 first = ((region<<24) - MMU_FASTMAP_BASE) >> MMU_FASTMAP_SHIFT;
+	const u32 last = first + (0x01000000 >> MMU_FASTMAP_SHIFT);
+	for(u32 page=first;page<last;page++)
+	{
+		const u32 adr = MMU_FASTMAP_BASE + (page<<MMU_FASTMAP_SHIFT);
+		MMU_fastmap[PROCNUM][page] = NULL;
+
+		bool unmapped, restricted;
+		const u32 mapped = MMU_LCDmap<PROCNUM>(adr, unmapped, restricted);
+		if(unmapped) continue;
+
+		//the whole page has to be in one piece of the buffer it maps to, or else the offsets into it would need the mask
+		const u32 mask = MMU.MMU_MASK[PROCNUM][mapped>>20];
+		if((mask & ((1<<MMU_FASTMAP_SHIFT)-1)) != (1<<MMU_FASTMAP_SHIFT)-1) continue;
+
+		MMU_fastmap[PROCNUM][page] = MMU.MMU_MEM[PROCNUM][mapped>>20] + (mapped & mask);
+		if(page < MMU_FASTMAP_WRITE_PAGES)
+			MMU_fastmap_adr[PROCNUM][page] = mapped;
+	}
+}
+
+void MMU_fastmap_refresh(u32 region)
+{
+	MMU_fastmap_refresh<ARMCPU_ARM9>(region);
+	MMU_fastmap_refresh<ARMCPU_ARM7>(region);
+}
+
 //////////////////////////////////////////////////////////////
 //end vram
 //////////////////////////////////////////////////////////////
@@ -960,8 +1055,16 @@ void MMU_Reset()
 	memset(MMU.ARM9_REG,  0, sizeof(MMU.ARM9_REG));
 	memset(MMU.ARM9_VMEM, 0, sizeof(MMU.ARM9_VMEM));
 	memset(MMU.MAIN_MEM,  0, sizeof(MMU.MAIN_MEM));
+	MMU_touchAllMainMem();
 
 	memset(MMU.blank_memory,  0, sizeof(MMU.blank_memory));
+	for(int i=0;i<VRAM_GENERATION_PAGES;i++) vram_page_generation[i]++;
+	for(int i=0;i<2;i++)
+	{
+		vram_palette_generation[i]++;
+		vram_engine_generation[i]++;
+		vram_oam_generation[i]++;
+	}
 	memset(MMU.UNUSED_RAM,    0, sizeof(MMU.UNUSED_RAM));
 	memset(MMU.MORE_UNUSED_RAM,    0, sizeof(MMU.UNUSED_RAM));
 	
@@ -1007,6 +1110,7 @@ void MMU_Reset()
 	reconstruct(&key2);
 
 	MMU.WRAMCNT = 0;
+	MMU_fastmap_refresh(0x03);
 
 	// Enable the sound speakers
 	T1WriteWord(MMU.ARM7_REG, 0x304, 0x0001);
@@ -1015,6 +1119,7 @@ void MMU_Reset()
 	SubScreen.offset  = 192;
 	
 	MMU_VRAM_unmap_all();
+	MMU_fastmap_refresh(0x06);
 
 	MMU.powerMan_CntReg = 0x00;
 	MMU.powerMan_CntRegWritten = FALSE;
@@ -1073,7 +1178,7 @@ static void execsqrt() {
 	MMU.sqrtCycles = nds_timer + 26;
 	MMU.sqrtResult = ret;
 	MMU.sqrtRunning = TRUE;
-	NDS_Reschedule();
+	NDS_RescheduleSqrt();
 }
 
 static void execdiv() {
@@ -1132,7 +1237,7 @@ static void execdiv() {
 	MMU.divResult = res;
 	MMU.divMod = mod;
 	MMU.divRunning = TRUE;
-	NDS_Reschedule();
+	NDS_RescheduleDivider();
 }
 
 DSI_TSC::DSI_TSC()
@@ -1393,6 +1498,27 @@ u32 MMU_readFromGC()
 	return val;
 }
 
+//a card dma's worth of MMU_readFromGC, fetched from the card in one go. returns how many words it read
+template<int PROCNUM>
+static u32 MMU_readFromGCBlock(u32* buf, u32 count)
+{
+	GCBUS_Controller& card = MMU.dscard[PROCNUM];
+
+	if(card.transfer_count <= 0)
+		return 0;
+	count = std::min(count, (u32)(card.transfer_count + 3) >> 2);
+
+	slot1_device->read_GCDATAIN_block(PROCNUM, buf, count);
+
+	card.transfer_count -= count*4;
+	if(card.transfer_count <= 0)
+	{
+		MMU_GC_endTransfer(PROCNUM);
+	}
+
+	return count;
+}
+
 template<int PROCNUM>
 void MMU_writeToGC(u32 val)
 {
@@ -1492,8 +1618,8 @@ void FASTCALL MMU_writeToSPIData(u16 val)
 					//our totally pathetic register handling, only the one thing we've wanted so far
 					if(MMU.powerMan_Reg[0]&PM_SYSTEM_PWR)
 					{
-						printf("SYSTEM POWERED OFF VIA ARM7 SPI POWER DEVICE\n");
-						printf("Did your main() return?\n");
+						CORELOG_INFO("SYSTEM POWERED OFF VIA ARM7 SPI POWER DEVICE\n");
+						CORELOG_INFO("Did your main() return?\n");
 						emu_halt();
 					}
 				}
@@ -1505,7 +1631,7 @@ void FASTCALL MMU_writeToSPIData(u16 val)
 		case SPI_DEVICE_FIRMWARE:
 			if(baudrate != SPI_BAUDRATE_4MHZ)		// check SPI baudrate (must be 4mhz)
 			{
-				printf("Wrong SPI baud rate for firmware access\n");
+				CORELOG_INFO("Wrong SPI baud rate for firmware access\n");
 				val = 0;
 			}
 			else
@@ -1873,6 +1999,7 @@ static void writereg_POWCNT1(const int size, const u32 adr, const u32 val) {
 
 static INLINE void MMU_IPCSync(u8 proc, u32 val)
 {
+	NDS_SyncCpus();
 	//INFO("IPC%s sync 0x%04X (0x%02X|%02X)\n", proc?"7":"9", val, val >> 8, val & 0xFF);
 	u32 sync_l = T1ReadLong(MMU.MMU_MEM[proc][0x40], 0x180) & 0xFFFF;
 	u32 sync_r = T1ReadLong(MMU.MMU_MEM[proc^1][0x40], 0x180) & 0xFFFF;
@@ -1887,7 +2014,7 @@ static INLINE void MMU_IPCSync(u8 proc, u32 val)
 
 		if(iteration==8-nds.ensataIpcSyncCounter)
 			nds.ensataIpcSyncCounter++;
-		else printf("ERROR: ENSATA IPC SYNC HACK FAILED; BAD THINGS MAY HAPPEN\n");
+		else CORELOG_ERROR("ERROR: ENSATA IPC SYNC HACK FAILED; BAD THINGS MAY HAPPEN\n");
 
 		//for some reason, the arm9 doesn't handshake when ensata is detected.
 		//so we complete the protocol here, which is to mirror the values 8..0 back to 
@@ -1907,6 +2034,17 @@ static INLINE void MMU_IPCSync(u8 proc, u32 val)
 	NDS_Reschedule();
 }
 
+void MMU_timerCatchUp(int proc, int timerIndex)
+{
+	if(!MMU.timerON[proc][timerIndex] || MMU.timerMODE[proc][timerIndex] == 0xFFFF) return;
+	u64& cycle = nds.timerCycle[proc][timerIndex];
+	if(cycle > nds_timer) return;
+
+	//skip the overflows that nobody was told about, the same as the timer event would have
+	const u64 period = (u64)(65536 - MMU.timerReload[proc][timerIndex]) << MMU.timerMODE[proc][timerIndex];
+	cycle += ((nds_timer - cycle) / period + 1) * period;
+}
+
 static INLINE u16 read_timer(int proc, int timerIndex)
 {
 	//chained timers are always up to date
@@ -1919,10 +2057,11 @@ static INLINE u16 read_timer(int proc, int timerIndex)
 		return MMU.timer[proc][timerIndex];
 
 	//for unchained timers, we do not keep the timer up to date. its value will need to be calculated here
+	MMU_timerCatchUp(proc,timerIndex);
 	s32 diff = (s32)(nds.timerCycle[proc][timerIndex] - nds_timer);
 	assert(diff>=0);
 	if(diff<0) 
-		printf("NEW EMULOOP BAD NEWS PLEASE REPORT: TIME READ DIFF < 0 (%d) (%d) (%d)\n",diff,timerIndex,MMU.timerMODE[proc][timerIndex]);
+		CORELOG_INFO("NEW EMULOOP BAD NEWS PLEASE REPORT: TIME READ DIFF < 0 (%d) (%d) (%d)\n",diff,timerIndex,MMU.timerMODE[proc][timerIndex]);
 	
 	s32 units = diff / (1<<MMU.timerMODE[proc][timerIndex]);
 	s32 ret;
@@ -1931,7 +2070,7 @@ static INLINE u16 read_timer(int proc, int timerIndex)
 		ret = 0; //I'm not sure why this is happening...
 		//whichever instruction setup this counter should advance nds_timer (I think?) and the division should truncate down to 65535 immediately
 	else if(units>65536) {
-		printf("NEW EMULOOP BAD NEWS PLEASE REPORT: UNITS %d:%d = %d\n",proc,timerIndex,units);
+		CORELOG_INFO("NEW EMULOOP BAD NEWS PLEASE REPORT: UNITS %d:%d = %d\n",proc,timerIndex,units);
 		ret = 0;
 	}
 	else ret = 65535 - units;
@@ -1986,6 +2125,9 @@ static INLINE void write_timer(int proc, int timerIndex, u16 val)
 extern CACHE_ALIGN MatrixStack	mtxStack[4];
 u32 TGXSTAT::read32()
 {
+	//the test bits and the matrix stacks are the geometry engine's
+	gfx3d_syncGeometry(true);
+
 	u32 ret = 0;
 
 	ret |= tb|(tr<<1);
@@ -2024,6 +2166,7 @@ u32 TGXSTAT::read32()
 
 void TGXSTAT::write32(const u32 val)
 {
+	gfx3d_syncGeometry(false);
 	gxfifo_irq = (val>>30)&3;
 	if(BIT15(val)) 
 	{
@@ -2213,7 +2356,7 @@ void DmaController::write32(const u32 val)
 
 	//printf("dma %d,%d set to startmode %d with wordcount set to: %08X\n",procnum,chan,_startmode,wordcount);
 	if (enable && procnum==1 && (!(chan&1)) && _startmode==6)
-		printf("!!!---!!! WIFI DMA: %08X TO %08X, %i WORDS !!!---!!!\n", saddr, daddr, wordcount);
+		CORELOG_INFO("!!!---!!! WIFI DMA: %08X TO %08X, %i WORDS !!!---!!!\n", saddr, daddr, wordcount);
 
 	//analyze enabling and startmode.
 	//note that we only do this if the dma was freshly enabled.
@@ -2307,6 +2450,97 @@ void DmaController::exec()
 	driver->DEBUG_UpdateIORegView(BaseDriver::EDEBUG_IOREG_DMA);
 }
 
+template<int PROCNUM>
+u8* MMU_hostPage(u32 adr, u32& mapped, bool& restricted)
+{
+	adr &= 0x0FFFF000;
+
+	//tcm is the cpu's alone (and reads as 0 to dmas), see _MMU_read32
+	if(PROCNUM==ARMCPU_ARM9 && (adr < 0x02000000 || (adr&(~0x3FFF)) == MMU.DTCMRegion)) return NULL;
+
+	if((adr & 0x0F000000) == 0x02000000)
+	{
+		mapped = adr;
+		restricted = false;
+		return MMU.MAIN_MEM + (adr & _MMU_MAIN_MEM_MASK);
+	}
+
+	if((adr>>24) != 0x03 && (adr>>24) != 0x06) return NULL;
+
+	bool unmapped;
+	mapped = MMU_LCDmap<PROCNUM>(adr, unmapped, restricted);
+	if(unmapped) return NULL;
+	return MMU.MMU_MEM[PROCNUM][mapped>>20] + (mapped & MMU.MMU_MASK[PROCNUM][mapped>>20]);
+}
+
+template<int PROCNUM>
+void MMU_hostPageStore(u32 mapped, u32 bytes)
+{
+#ifdef HAVE_JIT
+	//the functions of consecutive halfwords are next to each other within the 16KB pages of the table, and the range doesn't cross one
+#ifdef MAPPED_JIT_FUNCS
+	if((mapped & 0x0F000000) == 0x02000000)
+		memset(&JIT_COMPILED_FUNC_KNOWNBANK(mapped, MAIN_MEM, _MMU_MAIN_MEM_MASK, 0), 0, (bytes>>1)*sizeof(uintptr_t));
+	else if (JIT_MAPPED(mapped, PROCNUM))
+		memset(&JIT_COMPILED_FUNC_PREMASKED(mapped, PROCNUM, 0), 0, (bytes>>1)*sizeof(uintptr_t));
+#else
+	//and the range is within the 4KB of one bit of arm_jit_code_pages
+	if(arm_jit_has_code(mapped))
+	{
+		uintptr_t* funcs = &JIT_COMPILED_FUNC(mapped, PROCNUM);
+		for(u32 i=0;i<(bytes>>1);i++)
+			if(funcs[i])
+			{
+				funcs[i] = 0;
+				arm_jit_smc_invalidations++;
+			}
+	}
+#endif
+#endif
+	if((mapped & 0x0F000000) == 0x02000000) MMU_touchMainMem(mapped);
+	else MMU_touchVRAM(mapped);
+}
+
+template u8* MMU_hostPage<ARMCPU_ARM9>(u32 adr, u32& mapped, bool& restricted);
+template u8* MMU_hostPage<ARMCPU_ARM7>(u32 adr, u32& mapped, bool& restricted);
+template void MMU_hostPageStore<ARMCPU_ARM9>(u32 mapped, u32 bytes);
+template void MMU_hostPageStore<ARMCPU_ARM7>(u32 mapped, u32 bytes);
+
+//copies as much of an incrementing dma as stays within a 4KB page on both sides in one go, if both sides are plain memory.
+//the code compiled from the destination and whatever was decoded from it is thrown away once for the run instead of per unit.
+//returns how many units it copied, or 0 if the next one has to go through the handlers
+template<int PROCNUM, int SZ>
+static u32 MMU_DMAcopyRun(u32 src, u32 dst, u32 todo, int& time_elapsed)
+{
+	const u32 unit = SZ>>3;
+	if((src|dst) & (unit-1)) return 0;
+
+	//dmas don't have the cpu's 8 bit restrictions, and don't do 8 bits anyway
+	u32 srcmapped, dstmapped;
+	bool restricted;
+	u8* from = MMU_hostPage<PROCNUM>(src, srcmapped, restricted);
+	if(!from) return 0;
+	u8* to = MMU_hostPage<PROCNUM>(dst, dstmapped, restricted);
+	if(!to) return 0;
+	from += src & 0xFFF;
+	to += dst & 0xFFF;
+	dstmapped += dst & 0xFFF;
+
+	const u32 run = std::min(todo, std::min(0x1000 - (src & 0xFFF), 0x1000 - (dst & 0xFFF)) / unit);
+	const u32 bytes = run * unit;
+
+	//copying unit by unit onto a destination just ahead of the source repeats the start of it, which memmove wouldn't
+	if(to > from && to < from + bytes) return 0;
+
+	MMU_hostPageStore<PROCNUM>(dstmapped, bytes);
+	memmove(to, from, bytes);
+
+	//dma accesses are all sequential, so they take the same time anywhere in a page
+	time_elapsed += run * (_MMU_accesstime<PROCNUM,MMU_AT_DMA,SZ,MMU_AD_READ,TRUE>(src,true)
+	                     + _MMU_accesstime<PROCNUM,MMU_AT_DMA,SZ,MMU_AD_WRITE,TRUE>(dst,true));
+	return run;
+}
+
 template<int PROCNUM>
 void DmaController::doCopy()
 {
@@ -2347,7 +2581,7 @@ void DmaController::doCopy()
 	//need to figure out what to do about this
 	if(bogarted) 
 	{
-		printf("YOUR GAME IS BOGARTED!!! PLEASE REPORT!!!\n");
+		CORELOG_INFO("YOUR GAME IS BOGARTED!!! PLEASE REPORT!!!\n");
 		assert(false);
 		return;
 	}
@@ -2362,9 +2596,72 @@ void DmaController::doCopy()
 	//we might make another function to do just the raw copy op which can use them with checks
 	//outside the loop
 	int time_elapsed = 0;
-	if(sz==4) {
+
+	//runs of plain memory going up on both sides are copied a page at a time, see MMU_DMAcopyRun
+	bool direct = srcinc == sz && dstinc == sz && !CheckDebugEvent(DEBUG_EVENT_WRITE);
+#ifdef HAVE_LUA
+	direct = false; //the hooks want to see every unit
+#endif
+
+	if(sz==4 && PROCNUM==ARMCPU_ARM9 && dstinc==0 && (dst&0x0FFFFFC0)==0x04000400 && (dst&(~0x3FFF))!=MMU.DTCMRegion && nds.power1.gfx3d_geometry) {
+		//display list to the gxfifo: skip the io write dispatch and feed the packed commands
+		//straight into the fifo, with the per-command events and costs applied once for the run
+		GFX_FIFObeginBatch();
 		for(s32 i=(s32)todo; i>0; i--)
 		{
+			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_READ,TRUE>(src,true);
+			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_WRITE,TRUE>(dst,true);
+			u32 temp = _MMU_read32(procnum,MMU_AT_DMA,src);
+			CheckMemoryDebugEvent(DEBUG_EVENT_WRITE,MMU_AT_DMA,PROCNUM,dst,32,temp);
+			((u32 *)(MMU.MMU_MEM[ARMCPU_ARM9][0x40]))[(dst & 0xFFF) >> 2] = temp;
+			gfx3d_sendCommandToFIFO(temp);
+#ifdef HAVE_LUA
+			CallRegisteredLuaMemHook(dst, 4, temp, LUAMEMHOOK_WRITE);
+#endif
+			src += srcinc;
+		}
+		GFX_FIFOendBatch();
+#ifndef LOCAL_BE
+	} else if(sz==4 && PROCNUM==ARMCPU_ARM9 && startmode==EDMAMode_MemDisplay && srcinc==4 && dstinc==0 && dst==REG_DISPA_DISPMMEMFIFO
+		&& (src>>24)==0x02 && (src&_MMU_MAIN_MEM_MASK32) + todo*4 <= _MMU_MAIN_MEM_MASK32+1 && !CheckDebugEvent(DEBUG_EVENT_WRITE)) {
+		//a line of main memory to the display fifo: handed over with one copy instead of a read and an io write a word.
+		//dmas are sequential, so every word costs what the first does
+		DISP_FIFOsendBlock((const u32*)(MMU.MAIN_MEM + (src&_MMU_MAIN_MEM_MASK32)), todo);
+		time_elapsed += todo * (_MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_READ,TRUE>(src,true)
+		                      + _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_WRITE,TRUE>(dst,true));
+		src += todo*4;
+#endif
+	} else if(sz==4 && startmode==EDMAMode_Card && srcinc==0 && (src&0x0FFFFFFC)==0x04100010) {
+		//card to memory: fetch the data from the card a buffer at a time instead of going through the
+		//io read per word, which has the rom read a word at a time too
+		u32 buf[128];
+		for(s32 i=(s32)todo; i>0; )
+		{
+			const u32 got = MMU_readFromGCBlock<PROCNUM>(buf, std::min((u32)i,(u32)ARRAY_SIZE(buf)));
+			if(got == 0) break;
+			for(u32 j=0; j<got; j++)
+			{
+				time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_READ,TRUE>(src,true);
+				time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_WRITE,TRUE>(dst,true);
+				_MMU_write32(procnum,MMU_AT_DMA,dst, buf[j]);
+				dst += dstinc;
+			}
+			i -= got;
+		}
+	} else if(sz==4) {
+		for(s32 i=(s32)todo; i>0; i--)
+		{
+			if(direct)
+			{
+				const u32 run = MMU_DMAcopyRun<PROCNUM,32>(src,dst,i,time_elapsed);
+				if(run)
+				{
+					dst += run<<2;
+					src += run<<2;
+					i -= run-1; //and the loop counts the last one
+					continue;
+				}
+			}
 			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_READ,TRUE>(src,true);
 			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_WRITE,TRUE>(dst,true);
 			u32 temp = _MMU_read32(procnum,MMU_AT_DMA,src);
@@ -2375,6 +2672,17 @@ void DmaController::doCopy()
 	} else {
 		for(s32 i=(s32)todo; i>0; i--)
 		{
+			if(direct)
+			{
+				const u32 run = MMU_DMAcopyRun<PROCNUM,16>(src,dst,i,time_elapsed);
+				if(run)
+				{
+					dst += run<<1;
+					src += run<<1;
+					i -= run-1; //and the loop counts the last one
+					continue;
+				}
+			}
 			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,16,MMU_AD_READ,TRUE>(src,true);
 			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,16,MMU_AD_WRITE,TRUE>(dst,true);
 			u16 temp = _MMU_read16(procnum,MMU_AT_DMA,src);
@@ -2411,25 +2719,94 @@ void DmaController::doCopy()
 
 void triggerDma(EDMAMode mode)
 {
+	//hblank dmas onto the 2d registers may be done right away, as long as no dma is still waiting to start ahead of
+	//them: once one has to go around the sequencer, the ones after it do too, so they keep their order
+	bool direct = mode == EDMAMode_HBlank;
+	for(int i = 0; i < 2 && direct; i++)
+		for(int j = 0; j < 4; j++)
+			if(MMU_new.dma[i][j].dmaCheck && !MMU_new.dma[i][j].running)
+				direct = false;
+
 	MACRODO2(0, {
 		const int i=X;
 		MACRODO4(0, {
 			const int j=X;
-			MMU_new.dma[i][j].tryTrigger(mode);
+			direct = MMU_new.dma[i][j].tryTrigger(mode, direct);
 		});
 	});
 }
 
-void DmaController::tryTrigger(EDMAMode mode)
+bool DmaController::tryTrigger(EDMAMode mode, bool direct)
 {
-	if(startmode != mode) return;
-	if(!enable) return;
+	if(startmode != mode) return direct;
+	if(!enable) return direct;
 
 	//hmm dont trigger it if its already running! 
 	//but paused things need triggers to continue
-	if(running && !paused) return; 
+	if(running && !paused) return direct;
 	triggered = TRUE;
+	if(direct && isLineRegisterCopy())
+	{
+		copyLineRegisters();
+		return true;
+	}
 	doSchedule();
+	return false;
+}
+
+//the hdma of scroll, window and affine effects: an arm9 hblank dma repeating every line, of a few units from main
+//memory onto the 2d engines' registers, without an irq. the line it is for is drawn from the registers at the next
+//hblank, so nothing but the cpus could see it being done, and they are frozen while it is
+bool DmaController::isLineRegisterCopy() const
+{
+	if(procnum != ARMCPU_ARM9 || !repeatMode || irq || _startmode != EDMAMode_HBlank) return false;
+	if(wordcount == 0 || wordcount > 32) return false;
+	if(sar != EDMASourceUpdate_Increment) return false;
+	if(dar != EDMADestinationUpdate_Fixed && dar != EDMADestinationUpdate_Increment && dar != EDMADestinationUpdate_IncrementReload) return false;
+	if(CheckDebugEvent(DEBUG_EVENT_WRITE) || CheckDebugEvent(DEBUG_EVENT_READ)) return false;
+#ifdef HAVE_LUA
+	return false; //the hooks want to see every unit
+#endif
+
+	const u32 sz = (bitWidth==EDMABitWidth_16)?2:4;
+	const u32 bytes = wordcount * sz;
+	if((saddr | daddr) & (sz-1)) return false;
+	if((saddr & 0x0F000000) != 0x02000000 || (saddr & _MMU_MAIN_MEM_MASK) + bytes > _MMU_MAIN_MEM_MASK+1) return false;
+	//either engine's, 0x04000000 to MASTER_BRIGHT
+	const u32 reg = daddr & ~0x1000;
+	if(reg < 0x04000000 || reg + (dar == EDMADestinationUpdate_Fixed ? sz : bytes) > 0x04000070) return false;
+	return (daddr & ~0x3FFF) != MMU.DTCMRegion;
+}
+
+//doCopy for isLineRegisterCopy(), from the memory to the register writes with nothing in between, and with the bus
+//frozen for it by stalling the cpus instead of with an end event. it leaves the dma as its end event would have
+void DmaController::copyLineRegisters()
+{
+	const u32 sz = (bitWidth==EDMABitWidth_16)?2:4;
+	const u32 dstinc = (dar == EDMADestinationUpdate_Fixed) ? 0 : sz;
+	u32 src = saddr;
+	u32 dst = daddr;
+
+	if(sz == 4)
+		for(u32 i = 0; i < wordcount; i++, src += 4, dst += dstinc)
+			_MMU_ARM9_write32(dst, T1ReadLong(MMU.MAIN_MEM, src & _MMU_MAIN_MEM_MASK32));
+	else
+		for(u32 i = 0; i < wordcount; i++, src += 2, dst += dstinc)
+			_MMU_ARM9_write16(dst, T1ReadWord(MMU.MAIN_MEM, src & _MMU_MAIN_MEM_MASK16));
+
+	//dmas are sequential, so every unit costs what the first does
+	const s32 time_elapsed = (sz == 4)
+		? wordcount * (_MMU_accesstime<ARMCPU_ARM9,MMU_AT_DMA,32,MMU_AD_READ,TRUE>(saddr,true) + _MMU_accesstime<ARMCPU_ARM9,MMU_AT_DMA,32,MMU_AD_WRITE,TRUE>(daddr,true))
+		: wordcount * (_MMU_accesstime<ARMCPU_ARM9,MMU_AT_DMA,16,MMU_AD_READ,TRUE>(saddr,true) + _MMU_accesstime<ARMCPU_ARM9,MMU_AT_DMA,16,MMU_AD_WRITE,TRUE>(daddr,true));
+	NDS_StallCpus(time_elapsed);
+
+	saddr = src;
+	if(dar != EDMADestinationUpdate_IncrementReload)
+		daddr = dst;
+
+	//where exec() leaves a repeating dma once it has ended
+	running = FALSE;
+	dmaCheck = FALSE;
 }
 
 void DmaController::doSchedule()
@@ -2762,7 +3139,7 @@ bool validateIORegsWrite(u32 addr, u8 size, u32 val)
 
 			default:
 #ifdef DEVELOPER
-				printf("MMU9 write%02d to undefined register %08Xh = %08Xh (PC:%08X)\n", size, addr, val, ARMPROC.instruct_adr);
+				CORELOG_INFO("MMU9 write%02d to undefined register %08Xh = %08Xh (PC:%08X)\n", size, addr, val, ARMPROC.instruct_adr);
 #endif
 				return false;
 		}
@@ -2858,7 +3235,7 @@ bool validateIORegsWrite(u32 addr, u8 size, u32 val)
 
 			default:
 #ifdef DEVELOPER
-				printf("MMU7 write%02d to undefined register %08Xh = %08Xh (PC:%08X)\n", size, addr, val, ARMPROC.instruct_adr);
+				CORELOG_INFO("MMU7 write%02d to undefined register %08Xh = %08Xh (PC:%08X)\n", size, addr, val, ARMPROC.instruct_adr);
 #endif
 				return false;
 		}
@@ -3133,7 +3510,7 @@ bool validateIORegsRead(u32 addr, u8 size)
 
 			default:
 #ifdef DEVELOPER
-				printf("MMU9 read%02d from undefined register %08Xh = %08Xh (PC:%08X)\n", size, addr, T1ReadLong(MMU.ARM9_REG, addr & 0x00FFFFFF), ARMPROC.instruct_adr);
+				CORELOG_INFO("MMU9 read%02d from undefined register %08Xh = %08Xh (PC:%08X)\n", size, addr, T1ReadLong(MMU.ARM9_REG, addr & 0x00FFFFFF), ARMPROC.instruct_adr);
 #endif
 				return false;
 		}
@@ -3229,7 +3606,7 @@ bool validateIORegsRead(u32 addr, u8 size)
 
 			default:
 #ifdef DEVELOPER
-				printf("MMU7 read%02d from undefined register %08Xh = %08Xh (PC:%08X)\n", size, addr, T1ReadLong(MMU.ARM7_REG, addr & 0x00FFFFFF), ARMPROC.instruct_adr);
+				CORELOG_INFO("MMU7 read%02d from undefined register %08Xh = %08Xh (PC:%08X)\n", size, addr, T1ReadLong(MMU.ARM7_REG, addr & 0x00FFFFFF), ARMPROC.instruct_adr);
 #endif
 				return false;
 		}
@@ -3256,7 +3633,7 @@ void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val)
 	if(adr < 0x02000000)
 	{
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 0) = 0;
+		JIT_INVALIDATE_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 0);
 #endif
 		T1WriteByte(MMU.ARM9_ITCM, adr & 0x7FFF, val);
 		return;
@@ -3291,16 +3668,16 @@ void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val)
 
 		switch(adr)
 		{
-			case REG_SQRTCNT: printf("ERROR 8bit SQRTCNT WRITE\n"); return;
-			case REG_SQRTCNT+1: printf("ERROR 8bit SQRTCNT1 WRITE\n"); return;
-			case REG_SQRTCNT+2: printf("ERROR 8bit SQRTCNT2 WRITE\n"); return;
-			case REG_SQRTCNT+3: printf("ERROR 8bit SQRTCNT3 WRITE\n"); return;
+			case REG_SQRTCNT: CORELOG_ERROR("ERROR 8bit SQRTCNT WRITE\n"); return;
+			case REG_SQRTCNT+1: CORELOG_ERROR("ERROR 8bit SQRTCNT1 WRITE\n"); return;
+			case REG_SQRTCNT+2: CORELOG_ERROR("ERROR 8bit SQRTCNT2 WRITE\n"); return;
+			case REG_SQRTCNT+3: CORELOG_ERROR("ERROR 8bit SQRTCNT3 WRITE\n"); return;
 			
 #if 1
-			case REG_DIVCNT: printf("ERROR 8bit DIVCNT WRITE\n"); return;
-			case REG_DIVCNT+1: printf("ERROR 8bit DIVCNT+1 WRITE\n"); return;
-			case REG_DIVCNT+2: printf("ERROR 8bit DIVCNT+2 WRITE\n"); return;
-			case REG_DIVCNT+3: printf("ERROR 8bit DIVCNT+3 WRITE\n"); return;
+			case REG_DIVCNT: CORELOG_ERROR("ERROR 8bit DIVCNT WRITE\n"); return;
+			case REG_DIVCNT+1: CORELOG_ERROR("ERROR 8bit DIVCNT+1 WRITE\n"); return;
+			case REG_DIVCNT+2: CORELOG_ERROR("ERROR 8bit DIVCNT+2 WRITE\n"); return;
+			case REG_DIVCNT+3: CORELOG_ERROR("ERROR 8bit DIVCNT+3 WRITE\n"); return;
 #endif
 
 			//fog table: only write bottom 7 bits
@@ -3515,9 +3892,11 @@ void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val)
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM9))
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM9, 0) = 0;
+		JIT_INVALIDATE_PREMASKED(adr, ARMCPU_ARM9, 0);
 #endif
 
+	MMU_touchVRAM(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	MMU.MMU_MEM[ARMCPU_ARM9][adr>>20][adr&MMU.MMU_MASK[ARMCPU_ARM9][adr>>20]]=val;
 }
@@ -3532,7 +3911,7 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 	if (adr < 0x02000000)
 	{
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 0) = 0;
+		JIT_INVALIDATE_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 0);
 #endif
 		T1WriteWord(MMU.ARM9_ITCM, adr & 0x7FFF, val);
 		return;
@@ -3650,12 +4029,12 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 			case REG_DIVNUMER:
 			case REG_DIVNUMER+2:
 			case REG_DIVNUMER+4:
-				printf("DIV: 16 write NUMER %08X. PLEASE REPORT! \n", val);
+				CORELOG_INFO("DIV: 16 write NUMER %08X. PLEASE REPORT! \n", val);
 				break;
 			case REG_DIVDENOM:
 			case REG_DIVDENOM+2:
 			case REG_DIVDENOM+4:
-				printf("DIV: 16 write DENOM %08X. PLEASE REPORT! \n", val);
+				CORELOG_INFO("DIV: 16 write DENOM %08X. PLEASE REPORT! \n", val);
 				break;
 #endif
 			case REG_SQRTCNT:
@@ -3886,6 +4265,7 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
             case REG_TM1CNTL :
             case REG_TM2CNTL :
             case REG_TM3CNTL :
+				MMU_timerCatchUp(ARMCPU_ARM9,(adr>>2)&3);
 				MMU.timerReload[ARMCPU_ARM9][(adr>>2)&3] = val;
 				return;
 			case REG_TM0CNTH :
@@ -3968,9 +4348,11 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM9))
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM9, 0) = 0;
+		JIT_INVALIDATE_PREMASKED(adr, ARMCPU_ARM9, 0);
 #endif
 
+	MMU_touchVRAM(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	T1WriteWord(MMU.MMU_MEM[ARMCPU_ARM9][adr>>20], adr&MMU.MMU_MASK[ARMCPU_ARM9][adr>>20], val);
 } 
@@ -3985,8 +4367,8 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 	if(adr<0x02000000)
 	{
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 0) = 0;
-		JIT_COMPILED_FUNC_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 1) = 0;
+		JIT_INVALIDATE_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 0);
+		JIT_INVALIDATE_KNOWNBANK(adr, ARM9_ITCM, 0x7FFF, 1);
 #endif
 		T1WriteLong(MMU.ARM9_ITCM, adr & 0x7FFF, val);
 		return ;
@@ -4107,7 +4489,7 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 					nds.ensataHandshake = ENSATA_HANDSHAKE_confirm;
 				if(nds.ensataEmulation && nds.ensataHandshake == ENSATA_HANDSHAKE_confirm && val == 0xfdb97531)
 				{
-					printf("ENSATA HANDSHAKE COMPLETE\n");
+					CORELOG_INFO("ENSATA HANDSHAKE COMPLETE\n");
 					nds.ensataHandshake = ENSATA_HANDSHAKE_complete;
 				}
 				break;
@@ -4117,7 +4499,7 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 			case eng_3D_CLIPMTX_RESULT:
 				if(nds.ensataEmulation && nds.ensataHandshake == ENSATA_HANDSHAKE_none && val==0x2468ace0)
 				{
-					printf("ENSATA HANDSHAKE BEGIN\n");
+					CORELOG_INFO("ENSATA HANDSHAKE BEGIN\n");
 					nds.ensataHandshake = ENSATA_HANDSHAKE_query;
 				}
 				break;
@@ -4296,6 +4678,7 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
             case REG_TM3CNTL:
 			{
 				int timerIndex = (adr>>2)&0x3;
+				MMU_timerCatchUp(ARMCPU_ARM9,timerIndex);
 				MMU.timerReload[ARMCPU_ARM9][timerIndex] = (u16)val;
 				T1WriteWord(MMU.MMU_MEM[ARMCPU_ARM9][0x40], adr & 0xFFF, val);
 				write_timer(ARMCPU_ARM9, timerIndex, val>>16);
@@ -4400,11 +4783,13 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM9))
 	{
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM9, 0) = 0;
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM9, 1) = 0;
+		JIT_INVALIDATE_PREMASKED(adr, ARMCPU_ARM9, 0);
+		JIT_INVALIDATE_PREMASKED(adr, ARMCPU_ARM9, 1);
 	}
 #endif
 
+	MMU_touchVRAM(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][adr>>20], adr&MMU.MMU_MASK[ARMCPU_ARM9][adr>>20], val);
 }
@@ -4437,6 +4822,9 @@ u8 FASTCALL _MMU_ARM9_read08(u32 adr)
 			case REG_IF+2: return (MMU.gen_IF<ARMCPU_ARM9>()>>16);
 			case REG_IF+3: return (MMU.gen_IF<ARMCPU_ARM9>()>>24);
 
+			case REG_IPCFIFOCNT: return (u8)IPC_FIFOreadCnt(ARMCPU_ARM9);
+			case REG_IPCFIFOCNT+1: return (u8)(IPC_FIFOreadCnt(ARMCPU_ARM9)>>8);
+
 			case REG_WRAMCNT:
 				return MMU.WRAMCNT;
 
@@ -4451,8 +4839,8 @@ u8 FASTCALL _MMU_ARM9_read08(u32 adr)
 			case REG_SQRTCNT+1: return ((MMU_new.sqrt.read16()>>8) & 0xFF);
 				
 			//sqrtcnt isnt big enough for these to exist. but they'd probably return 0 so its ok
-			case REG_SQRTCNT+2: printf("ERROR 8bit SQRTCNT+2 READ\n"); return 0;
-			case REG_SQRTCNT+3: printf("ERROR 8bit SQRTCNT+3 READ\n"); return 0;
+			case REG_SQRTCNT+2: CORELOG_ERROR("ERROR 8bit SQRTCNT+2 READ\n"); return 0;
+			case REG_SQRTCNT+3: CORELOG_ERROR("ERROR 8bit SQRTCNT+3 READ\n"); return 0;
 
 			//these aren't readable
 			case REG_DISPA_BG0HOFS: case REG_DISPA_BG0HOFS+1:
@@ -4479,8 +4867,8 @@ u8 FASTCALL _MMU_ARM9_read08(u32 adr)
 			case REG_DIVCNT+1: return ((MMU_new.div.read16()>>8) & 0xFF);
 
 			//divcnt isnt big enough for these to exist. but they'd probably return 0 so its ok
-			case REG_DIVCNT+2: printf("ERROR 8bit DIVCNT+2 READ\n"); return 0;
-			case REG_DIVCNT+3: printf("ERROR 8bit DIVCNT+3 READ\n"); return 0;
+			case REG_DIVCNT+2: CORELOG_ERROR("ERROR 8bit DIVCNT+2 READ\n"); return 0;
+			case REG_DIVCNT+3: CORELOG_ERROR("ERROR 8bit DIVCNT+3 READ\n"); return 0;
 
 			//fog table: write only
 			case eng_3D_FOG_TABLE+0x00: case eng_3D_FOG_TABLE+0x01: case eng_3D_FOG_TABLE+0x02: case eng_3D_FOG_TABLE+0x03: 
@@ -4502,6 +4890,12 @@ u8 FASTCALL _MMU_ARM9_read08(u32 adr)
 			case eng_3D_GXSTAT:
 				return MMU_new.gxstat.read(8,adr);
 
+			//written by the vec test, which may not have run yet
+			case eng_3D_VEC_RESULT: case eng_3D_VEC_RESULT+1: case eng_3D_VEC_RESULT+2:
+			case eng_3D_VEC_RESULT+3: case eng_3D_VEC_RESULT+4: case eng_3D_VEC_RESULT+5:
+				gfx3d_syncGeometry(true);
+				break;
+
 			case REG_DISPA_DISP3DCNT: return readreg_DISP3DCNT(8,adr);
 			case REG_DISPA_DISP3DCNT+1: return readreg_DISP3DCNT(8,adr);
 			case REG_DISPA_DISP3DCNT+2: return readreg_DISP3DCNT(8,adr);
@@ -4555,13 +4949,16 @@ u16 FASTCALL _MMU_ARM9_read16(u32 adr)
 
 			case REG_SQRTCNT: return MMU_new.sqrt.read16();
 			//sqrtcnt isnt big enough for this to exist. but it'd probably return 0 so its ok
-			case REG_SQRTCNT+2: printf("ERROR 16bit SQRTCNT+2 READ\n"); return 0;
+			case REG_SQRTCNT+2: CORELOG_ERROR("ERROR 16bit SQRTCNT+2 READ\n"); return 0;
 
 			case REG_DIVCNT: return MMU_new.div.read16();
 			//divcnt isnt big enough for this to exist. but it'd probably return 0 so its ok
-			case REG_DIVCNT+2: printf("ERROR 16bit DIVCNT+2 READ\n"); return 0;
+			case REG_DIVCNT+2: CORELOG_ERROR("ERROR 16bit DIVCNT+2 READ\n"); return 0;
 
 			case eng_3D_GXSTAT: return MMU_new.gxstat.read(16,adr);
+			case eng_3D_VEC_RESULT: case eng_3D_VEC_RESULT+2: case eng_3D_VEC_RESULT+4:
+				gfx3d_syncGeometry(true);
+				break;
 
 			case REG_DISPA_VCOUNT:
 				if(nds.ensataEmulation && nds.ensataHandshake == ENSATA_HANDSHAKE_query)
@@ -4594,6 +4991,8 @@ u16 FASTCALL _MMU_ARM9_read16(u32 adr)
 			case REG_IF: return MMU.gen_IF<ARMCPU_ARM9>();
 			case REG_IF+2: return MMU.gen_IF<ARMCPU_ARM9>()>>16;
 
+			case REG_IPCFIFOCNT: return IPC_FIFOreadCnt(ARMCPU_ARM9);
+
 			case REG_TM0CNTL :
 			case REG_TM1CNTL :
 			case REG_TM2CNTL :
@@ -4735,6 +5134,9 @@ u32 FASTCALL _MMU_ARM9_read32(u32 adr)
 			}
 			case eng_3D_GXSTAT:
 				return MMU_new.gxstat.read(32,adr);
+			case eng_3D_VEC_RESULT: case eng_3D_VEC_RESULT+4:
+				gfx3d_syncGeometry(true);
+				break;
 			//	======================================== 3D end
 
 			
@@ -4744,6 +5146,7 @@ u32 FASTCALL _MMU_ARM9_read32(u32 adr)
 				return MMU.reg_IE[ARMCPU_ARM9];
 			
 			case REG_IF: return MMU.gen_IF<ARMCPU_ARM9>();
+			case REG_IPCFIFOCNT: return IPC_FIFOreadCnt(ARMCPU_ARM9) | (T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x186) << 16);
 
 			case REG_IPCFIFORECV :
 				return IPC_FIFOrecv(ARMCPU_ARM9);
@@ -4878,9 +5281,11 @@ void FASTCALL _MMU_ARM7_write08(u32 adr, u8 val)
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM7))
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM7, 0) = 0;
+		JIT_INVALIDATE_PREMASKED(adr, ARMCPU_ARM7, 0);
 #endif
 	
+	MMU_touchVRAM(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	MMU.MMU_MEM[ARMCPU_ARM7][adr>>20][adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20]]=val;
 }
@@ -4924,11 +5329,11 @@ void FASTCALL _MMU_ARM7_write16(u32 adr, u16 val)
 		case REG_DISPA_VCOUNT:
 			if (nds.VCount >= 202 && nds.VCount <= 212)
 			{
-				printf("VCOUNT set to %i (previous value %i)\n", val, nds.VCount);
+				CORELOG_INFO("VCOUNT set to %i (previous value %i)\n", val, nds.VCount);
 				nds.VCount = val;
 			}
 			else
-				printf("Attempt to set VCOUNT while not within 202-212 (%i), ignored\n", nds.VCount);
+				CORELOG_INFO("Attempt to set VCOUNT while not within 202-212 (%i), ignored\n", nds.VCount);
 			return;
 
 			case REG_RTC:
@@ -5030,6 +5435,7 @@ void FASTCALL _MMU_ARM7_write16(u32 adr, u16 val)
             case REG_TM1CNTL :
             case REG_TM2CNTL :
             case REG_TM3CNTL :
+				MMU_timerCatchUp(ARMCPU_ARM7,(adr>>2)&3);
 				MMU.timerReload[ARMCPU_ARM7][(adr>>2)&3] = val;
 				return;
 			case REG_TM0CNTH :
@@ -5060,9 +5466,11 @@ void FASTCALL _MMU_ARM7_write16(u32 adr, u16 val)
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM7))
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM7, 0) = 0;
+		JIT_INVALIDATE_PREMASKED(adr, ARMCPU_ARM7, 0);
 #endif
 
+	MMU_touchVRAM(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	T1WriteWord(MMU.MMU_MEM[ARMCPU_ARM7][adr>>20], adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20], val);
 }
@@ -5124,6 +5532,7 @@ void FASTCALL _MMU_ARM7_write32(u32 adr, u32 val)
             case REG_TM3CNTL:
 			{
 				int timerIndex = (adr>>2)&0x3;
+				MMU_timerCatchUp(ARMCPU_ARM7,timerIndex);
 				MMU.timerReload[ARMCPU_ARM7][timerIndex] = (u16)val;
 				T1WriteWord(MMU.MMU_MEM[ARMCPU_ARM7][0x40], adr & 0xFFF, val);
 				write_timer(ARMCPU_ARM7, timerIndex, val>>16);
@@ -5160,11 +5569,13 @@ void FASTCALL _MMU_ARM7_write32(u32 adr, u32 val)
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM7))
 	{
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM7, 0) = 0;
-		JIT_COMPILED_FUNC_PREMASKED(adr, ARMCPU_ARM7, 1) = 0;
+		JIT_INVALIDATE_PREMASKED(adr, ARMCPU_ARM7, 0);
+		JIT_INVALIDATE_PREMASKED(adr, ARMCPU_ARM7, 1);
 	}
 #endif
 
+	MMU_touchVRAM(adr);
+
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [shash]
 	T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM7][adr>>20], adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20], val);
 }
@@ -5219,6 +5630,9 @@ u8 FASTCALL _MMU_ARM7_read08(u32 adr)
 			case REG_IF+2: return (MMU.gen_IF<ARMCPU_ARM7>()>>16);
 			case REG_IF+3: return (MMU.gen_IF<ARMCPU_ARM7>()>>24);
 
+			case REG_IPCFIFOCNT: return (u8)IPC_FIFOreadCnt(ARMCPU_ARM7);
+			case REG_IPCFIFOCNT+1: return (u8)(IPC_FIFOreadCnt(ARMCPU_ARM7)>>8);
+
 			case REG_DISPx_VCOUNT: return nds.VCount&0xFF;
 			case REG_DISPx_VCOUNT+1: return (nds.VCount>>8)&0xFF;
 
@@ -5289,6 +5703,8 @@ u16 FASTCALL _MMU_ARM7_read16(u32 adr)
 			case REG_IF: return MMU.gen_IF<ARMCPU_ARM7>();
 			case REG_IF+2: return MMU.gen_IF<ARMCPU_ARM7>()>>16;
 
+			case REG_IPCFIFOCNT: return IPC_FIFOreadCnt(ARMCPU_ARM7);
+
 			case REG_TM0CNTL :
 			case REG_TM1CNTL :
 			case REG_TM2CNTL :
@@ -5377,6 +5793,7 @@ u32 FASTCALL _MMU_ARM7_read32(u32 adr)
 			case REG_IE :
 				return MMU.reg_IE[ARMCPU_ARM7];
 			case REG_IF: return MMU.gen_IF<ARMCPU_ARM7>();
+			case REG_IPCFIFOCNT: return IPC_FIFOreadCnt(ARMCPU_ARM7) | (T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM7][0x40], 0x186) << 16);
 			case REG_IPCFIFORECV :
 				return IPC_FIFOrecv(ARMCPU_ARM7);
 			case REG_TM0CNTL :
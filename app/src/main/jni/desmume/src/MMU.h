@@ -90,7 +90,7 @@ public:
 		else {
 			const u32 offset = adr&3;
 			if(size==8) {
-				printf("WARNING! 8BIT DMA ACCESS\n"); 
+				CORELOG_WARN("WARNING! 8BIT DMA ACCESS\n"); 
 				u32 mask = 0xFF<<(offset<<3);
 				write32((read32()&~mask)|(val<<(offset<<3)));
 			}
@@ -106,7 +106,7 @@ public:
 		if(size==32) return read32();
 		else {
 			const u32 offset = adr&3;
-			if(size==8) { printf("WARNING! 8BIT DMA ACCESS\n"); return (read32()>>(offset<<3))&0xFF; }
+			if(size==8) { CORELOG_WARN("WARNING! 8BIT DMA ACCESS\n"); return (read32()>>(offset<<3))&0xFF; }
 			else return (read32()>>(offset<<3))&0xFFFF;
 		}
 	}
@@ -206,7 +206,10 @@ public:
 	void doPause();
 	void doStop();
 	void doSchedule();
-	void tryTrigger(EDMAMode mode);
+	//direct says whether it may be done on the spot (copyLineRegisters), which it returns whether the next may too
+	bool tryTrigger(EDMAMode mode, bool direct = false);
+	bool isLineRegisterCopy() const;
+	void copyLineRegisters();
 
 	DmaController() :
 		enable(0), irq(0), repeatMode(0), _startmode(0),
@@ -502,6 +505,10 @@ void MMU_DeInit(void);
 
 void MMU_Reset( void);
 
+//an unchained timer isn't scheduled when nothing sees it overflow (see TSequenceItem_Timer::schedule),
+//so this brings its next overflow time past nds_timer before anything depends on it
+void MMU_timerCatchUp(int proc, int timerIndex);
+
 void print_memory_profiling( void);
 
 // Memory reading/writing (old)
@@ -583,6 +590,54 @@ FORCEINLINE void* MMU_gpu_map(u32 vram_addr)
 	return MMU.ARM9_LCD + (vram_page<<14) + ofs;
 }
 
+//every store into a 16KB page of the LCDC buffer (including the blank pages past its end) or into
+//an engine's standard palettes bumps a generation counter, so that anything decoded from vram can be
+//kept around until the memory it came from changes
+#define VRAM_GENERATION_PAGES ((sizeof(MMU.ARM9_LCD)+sizeof(MMU.blank_memory))>>14)
+extern u32 vram_page_generation[VRAM_GENERATION_PAGES];
+extern u32 vram_palette_generation[2];
+//these cover everything an engine can read from vram (after remaps too) and its OAM
+extern u32 vram_engine_generation[2];
+extern u32 vram_oam_generation[2];
+
+//main memory gets the same in 4KB pages, for whatever keeps a copy of it (the rewind buffer) to bring just the pages
+//that moved up to date, rather than copying or comparing all of it
+#define MAINMEM_GENERATION_SHIFT 12
+#define MAINMEM_GENERATION_PAGES (sizeof(MMU.MAIN_MEM)>>MAINMEM_GENERATION_SHIFT)
+extern u32 mainmem_page_generation[MAINMEM_GENERATION_PAGES];
+//for when main memory is replaced as a whole
+void MMU_touchAllMainMem();
+
+//a host pointer for each 4KB page of 03000000-06FFFFFF that is plain memory to the cpu: shared and arm7 WRAM
+//through WRAMCNT, and vram through the bank mappings. the inline reads and writes below go straight to these,
+//so only the pages that need more than that (unmapped, io, palettes, oam) get to the _MMU_ARMx handlers, as NULL.
+//MMU_fastmap_refresh rebuilds a region (0x03 or 0x06) of both cpus' maps whenever its mapping changes.
+#define MMU_FASTMAP_BASE 0x03000000
+#define MMU_FASTMAP_SHIFT 12
+#define MMU_FASTMAP_PAGES (0x04000000>>MMU_FASTMAP_SHIFT)
+//only the WRAM pages are written through the map. stores to vram bump its generations, so they take the long way
+#define MMU_FASTMAP_WRITE_PAGES (0x01000000>>MMU_FASTMAP_SHIFT)
+extern u8* MMU_fastmap[2][MMU_FASTMAP_PAGES];
+//the address each WRAM page maps to, for throwing away the code compiled from it
+extern u32 MMU_fastmap_adr[2][MMU_FASTMAP_WRITE_PAGES];
+void MMU_fastmap_refresh(u32 region);
+
+//the host memory behind the 4KB page of adr, for what goes through whole runs of it at once (dmas, the bios'
+//decompressors), when that page is plain memory: main memory, WRAM and mapped vram. NULL for anything else, tcm
+//included. mapped gets the address of the page after the WRAM and vram mappings, and restricted whether the cpu
+//can't store single bytes there (vram)
+template<int PROCNUM> u8* MMU_hostPage(u32 adr, u32& mapped, bool& restricted);
+//call before storing to [mapped,mapped+bytes) of a page MMU_hostPage gave, without going through the writes: throws
+//away the code compiled from it and bumps the generations of the memory
+template<int PROCNUM> void MMU_hostPageStore(u32 mapped, u32 bytes);
+FORCEINLINE u32 MMU_gpu_generation(const u8* host)
+{
+	//host is a pointer returned by MMU_gpu_map, an extended palette slot or a standard palette in ARM9_VMEM
+	if(host >= MMU.ARM9_VMEM && host < MMU.ARM9_VMEM + sizeof(MMU.ARM9_VMEM))
+		return vram_palette_generation[(host - MMU.ARM9_VMEM)>>10];
+	return vram_page_generation[(host - MMU.ARM9_LCD)>>14];
+}
+
 
 template<int PROCNUM, MMU_ACCESS_TYPE AT> u8 _MMU_read08(u32 addr);
 template<int PROCNUM, MMU_ACCESS_TYPE AT> u16 _MMU_read16(u32 addr);
@@ -617,6 +672,13 @@ extern u32 partie;
 extern u32 _MMU_MAIN_MEM_MASK;
 extern u32 _MMU_MAIN_MEM_MASK16;
 extern u32 _MMU_MAIN_MEM_MASK32;
+
+//call right before storing to the main memory at adr. anything that stores to MMU.MAIN_MEM
+//without going through the writes below has to do this for every 4KB page it stores to
+FORCEINLINE void MMU_touchMainMem(u32 adr)
+{
+	mainmem_page_generation[(adr & _MMU_MAIN_MEM_MASK) >> MAINMEM_GENERATION_SHIFT]++;
+}
 void SetupMMU(bool debugConsole, bool dsi);
 
 FORCEINLINE void CheckMemoryDebugEvent(EDEBUG_EVENT event, const MMU_ACCESS_TYPE type, const u32 procnum, const u32 addr, const u32 size, const u32 val)
@@ -671,6 +733,12 @@ FORCEINLINE u8 _MMU_read08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u3
 	if ( (addr & 0x0F000000) == 0x02000000)
 		return T1ReadByte( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK);
 
+	{
+		const u32 page = (addr - MMU_FASTMAP_BASE) >> MMU_FASTMAP_SHIFT;
+		if(page < MMU_FASTMAP_PAGES && MMU_fastmap[PROCNUM][page])
+			return T1ReadByte(MMU_fastmap[PROCNUM][page], addr & 0xFFF);
+	}
+
 	if(PROCNUM==ARMCPU_ARM9) return _MMU_ARM9_read08(addr);
 	else return _MMU_ARM7_read08(addr);
 }
@@ -719,6 +787,12 @@ FORCEINLINE u16 _MMU_read16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u
 		return T1ReadWord_guaranteedAligned( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16);
 
 dunno:
+	{
+		const u32 page = (addr - MMU_FASTMAP_BASE) >> MMU_FASTMAP_SHIFT;
+		if(page < MMU_FASTMAP_PAGES && MMU_fastmap[PROCNUM][page])
+			return T1ReadWord_guaranteedAligned(MMU_fastmap[PROCNUM][page], addr & 0xFFE);
+	}
+
 	if(PROCNUM==ARMCPU_ARM9) return _MMU_ARM9_read16(addr);
 	else return _MMU_ARM7_read16(addr);
 }
@@ -784,6 +858,12 @@ FORCEINLINE u32 _MMU_read32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u
 	}
 
 dunno:
+	{
+		const u32 page = (addr - MMU_FASTMAP_BASE) >> MMU_FASTMAP_SHIFT;
+		if(page < MMU_FASTMAP_PAGES && MMU_fastmap[PROCNUM][page])
+			return T1ReadLong_guaranteedAligned(MMU_fastmap[PROCNUM][page], addr & 0xFFC);
+	}
+
 	if(PROCNUM==ARMCPU_ARM9) return _MMU_ARM9_read32(addr);
 	else return _MMU_ARM7_read32(addr);
 }
@@ -811,8 +891,9 @@ FORCEINLINE void _MMU_write08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 
 	if ( (addr & 0x0F000000) == 0x02000000) {
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK, 0) = 0;
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK, 0);
 #endif
+		MMU_touchMainMem(addr);
 		T1WriteByte( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK, val);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 1, val, LUAMEMHOOK_WRITE);
@@ -820,6 +901,23 @@ FORCEINLINE void _MMU_write08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		return;
 	}
 
+	{
+		const u32 page = (addr - MMU_FASTMAP_BASE) >> MMU_FASTMAP_SHIFT;
+		if(page < MMU_FASTMAP_WRITE_PAGES && MMU_fastmap[PROCNUM][page])
+		{
+#ifdef HAVE_JIT
+			const u32 mapped = MMU_fastmap_adr[PROCNUM][page] + (addr & 0xFFF);
+			if (JIT_MAPPED(mapped, PROCNUM))
+				JIT_INVALIDATE_PREMASKED(mapped, PROCNUM, 0);
+#endif
+			T1WriteByte(MMU_fastmap[PROCNUM][page], addr & 0xFFF, val);
+#ifdef HAVE_LUA
+			CallRegisteredLuaMemHook(addr, 1, val, LUAMEMHOOK_WRITE);
+#endif
+			return;
+		}
+	}
+
 	if(PROCNUM==ARMCPU_ARM9) _MMU_ARM9_write08(addr,val);
 	else _MMU_ARM7_write08(addr,val);
 #ifdef HAVE_LUA
@@ -850,8 +948,9 @@ FORCEINLINE void _MMU_write16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 
 	if ( (addr & 0x0F000000) == 0x02000000) {
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 0) = 0;
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 0);
 #endif
+		MMU_touchMainMem(addr);
 		T1WriteWord( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16, val);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 2, val, LUAMEMHOOK_WRITE);
@@ -859,6 +958,23 @@ FORCEINLINE void _MMU_write16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		return;
 	}
 
+	{
+		const u32 page = (addr - MMU_FASTMAP_BASE) >> MMU_FASTMAP_SHIFT;
+		if(page < MMU_FASTMAP_WRITE_PAGES && MMU_fastmap[PROCNUM][page])
+		{
+#ifdef HAVE_JIT
+			const u32 mapped = MMU_fastmap_adr[PROCNUM][page] + (addr & 0xFFE);
+			if (JIT_MAPPED(mapped, PROCNUM))
+				JIT_INVALIDATE_PREMASKED(mapped, PROCNUM, 0);
+#endif
+			T1WriteWord(MMU_fastmap[PROCNUM][page], addr & 0xFFE, val);
+#ifdef HAVE_LUA
+			CallRegisteredLuaMemHook(addr, 2, val, LUAMEMHOOK_WRITE);
+#endif
+			return;
+		}
+	}
+
 	if(PROCNUM==ARMCPU_ARM9) _MMU_ARM9_write16(addr,val);
 	else _MMU_ARM7_write16(addr,val);
 #ifdef HAVE_LUA
@@ -889,9 +1005,10 @@ FORCEINLINE void _MMU_write32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 
 	if ( (addr & 0x0F000000) == 0x02000000) {
 #ifdef HAVE_JIT
-		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 0) = 0;
-		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 1) = 0;
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 0);
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 1);
 #endif
+		MMU_touchMainMem(addr);
 		T1WriteLong( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32, val);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 4, val, LUAMEMHOOK_WRITE);
@@ -899,6 +1016,26 @@ FORCEINLINE void _MMU_write32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		return;
 	}
 
+	{
+		const u32 page = (addr - MMU_FASTMAP_BASE) >> MMU_FASTMAP_SHIFT;
+		if(page < MMU_FASTMAP_WRITE_PAGES && MMU_fastmap[PROCNUM][page])
+		{
+#ifdef HAVE_JIT
+			const u32 mapped = MMU_fastmap_adr[PROCNUM][page] + (addr & 0xFFC);
+			if (JIT_MAPPED(mapped, PROCNUM))
+			{
+				JIT_INVALIDATE_PREMASKED(mapped, PROCNUM, 0);
+				JIT_INVALIDATE_PREMASKED(mapped, PROCNUM, 1);
+			}
+#endif
+			T1WriteLong(MMU_fastmap[PROCNUM][page], addr & 0xFFC, val);
+#ifdef HAVE_LUA
+			CallRegisteredLuaMemHook(addr, 4, val, LUAMEMHOOK_WRITE);
+#endif
+			return;
+		}
+	}
+
 	if(PROCNUM==ARMCPU_ARM9) _MMU_ARM9_write32(addr,val);
 	else _MMU_ARM7_write32(addr,val);
 #ifdef HAVE_LUA
@@ -23,12 +23,19 @@
 #define MMUTIMING_H
 
 #include <algorithm>
+#include <string.h>
 #include "MMU.h"
 #include "cp15.h"
 #include "readwrite.h"
 #include "debug.h"
 #include "NDSSystem.h"
 
+#if defined(ENABLE_SSE2)
+#include <emmintrin.h>
+#elif defined(ENABLE_NEON)
+#include <arm_neon.h>
+#endif
+
 ////////////////////////////////////////////////////////////////
 // MEMORY TIMING ACCURACY CONFIGURATION
 //
@@ -95,8 +102,8 @@ public:
 	
 	void Reset()
 	{
-		for(int blockIndex = 0; blockIndex < NUMBLOCKS; blockIndex++)
-			m_blocks[blockIndex].Reset();
+		memset(m_tags, 0, sizeof(m_tags));
+		memset(m_nextWay, 0, sizeof(m_nextWay));
 		m_cacheCache = ~0;
 	}
 	CacheController()
@@ -110,8 +117,8 @@ public:
 		for(int i = 0; i < NUMBLOCKS; i++)
 		{
 			for(int j = 0; j < ASSOCIATIVITY; j++)
-				write32le(m_blocks[i].tag[j],os);
-			write32le(m_blocks[i].nextWay,os);
+				write32le(m_tags[i][j],os);
+			write32le((u32)m_nextWay[i],os);
 		}
 	}
 	bool loadstate(EMUFILE* is, int version)
@@ -119,9 +126,11 @@ public:
 		read32le(&m_cacheCache, is);
 		for(int i = 0; i < NUMBLOCKS; i++)
 		{
+			u32 nextWay;
 			for(int j = 0; j < ASSOCIATIVITY; j++)
-				read32le(&m_blocks[i].tag[j],is);
-			read32le(&m_blocks[i].nextWay,is);
+				read32le(&m_tags[i][j],is);
+			read32le(&nextWay,is);
+			m_nextWay[i] = nextWay % ASSOCIATIVITY;
 		}
 		return true;
 	}
@@ -131,26 +140,46 @@ private:
 	bool CachedInternal(u32 addr, u32 blockMasked)
 	{
 		u32 blockIndex = blockMasked >> BLOCKSIZESHIFT;
-		CacheBlock& block = m_blocks[blockIndex];
+		u32* tags = m_tags[blockIndex];
 		addr &= TAGMASK;
 
-		for(int way = 0; way < ASSOCIATIVITY; way++)
-			if(addr == block.tag[way])
-			{
-				// found it, already allocated
-				m_cacheCache = blockMasked;
-				return true;
-			}
+		if(Find(tags, addr))
+		{
+			// found it, already allocated
+			m_cacheCache = blockMasked;
+			return true;
+		}
 		if(DIR == MMU_AD_READ)
 		{
 			// TODO: support other allocation orders?
-			block.tag[block.nextWay++] = addr;
-			block.nextWay %= ASSOCIATIVITY;
+			u8& nextWay = m_nextWay[blockIndex];
+			tags[nextWay] = addr;
+			nextWay = (nextWay + 1) % ASSOCIATIVITY;
 			m_cacheCache = blockMasked;
 		}
 		return false;
 	}
 
+	// the ways of a set are next to each other, so the four of the arm9's caches are compared at once
+	static FORCEINLINE bool Find(const u32* tags, u32 tag)
+	{
+#if defined(ENABLE_SSE2)
+		if(ASSOCIATIVITY == 4)
+			return _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_load_si128((const __m128i*)tags), _mm_set1_epi32(tag))) != 0;
+#elif defined(ENABLE_NEON)
+		if(ASSOCIATIVITY == 4)
+		{
+			const uint32x4_t eq = vceqq_u32(vld1q_u32(tags), vdupq_n_u32(tag));
+			const uint32x2_t half = vorr_u32(vget_low_u32(eq), vget_high_u32(eq));
+			return vget_lane_u32(vpmax_u32(half, half), 0) != 0;
+		}
+#endif
+		bool found = false;
+		for(int way = 0; way < ASSOCIATIVITY; way++)
+			found |= (tags[way] == tag);
+		return found;
+	}
+
 	enum { SIZE = 1 << SIZESHIFT };
 	enum { ASSOCIATIVITY = 1 << ASSOCIATIVESHIFT };
 	enum { BLOCKSIZE = 1 << BLOCKSIZESHIFT };
@@ -163,22 +192,10 @@ private:
 	enum { DATAPERBLOCK = DATAPERWORD * WORDSPERBLOCK };
 	enum { NUMBLOCKS = SIZE / DATAPERBLOCK };
 
-	struct CacheBlock
-	{
-		u32 tag [ASSOCIATIVITY];
-		u32 nextWay;
-
-		void Reset()
-		{
-			nextWay = 0;
-			for(int way = 0; way < ASSOCIATIVITY; way++)
-				tag[way] = 0;
-		}
-	};
-
 	u32 m_cacheCache; // optimization
 
-	CacheBlock m_blocks [NUMBLOCKS];
+	DS_ALIGN(16) u32 m_tags [NUMBLOCKS][ASSOCIATIVITY];
+	u8 m_nextWay [NUMBLOCKS];
 };
 
 
@@ -222,6 +239,38 @@ public:
 		return time;
 	}
 
+	// the time of n data accesses from address on, a word apart going up (dir 1) or down (dir -1), as n calls of
+	// Fetch would take them and leaving what they would. within a cache line only the first two accesses need to be
+	// worked out: the rest are sequential (or not) as the second was, and find the cache as the second left it
+	template<MMU_ACCESS_DIRECTION DIRECTION, bool TIMING>
+	u32 FetchBurst(u32 address, int n, int dir)
+	{
+		if(TIMING && CheckDebugEvent(DEBUG_EVENT_CACHE_MISS))
+		{
+			// each miss is reported
+			u32 time = 0;
+			for(; n > 0; n--, address += 4*dir)
+				time += Fetch<32,DIRECTION,TIMING>(address);
+			return time;
+		}
+
+		u32 time = 0;
+		while(n > 0)
+		{
+			const int line = (dir > 0) ? (32 - (address & 31)) >> 2 : ((address & 31) >> 2) + 1;
+			const int run = std::min(n, line);
+			time += Fetch<32,DIRECTION,TIMING>(address);
+			if(run > 1)
+				time += (run - 1) * Fetch<32,DIRECTION,TIMING>(address + 4*dir);
+#ifdef ACCOUNT_FOR_NON_SEQUENTIAL_ACCESS
+			m_lastAddress = address + (run - 1)*4*dir;
+#endif
+			address += run*4*dir;
+			n -= run;
+		}
+		return time;
+	}
+
 	void Reset()
 	{
 		m_lastAddress = ~0;
@@ -381,6 +430,17 @@ FORCEINLINE u32 MMU_memAccessCycles(u32 addr)
 		return MMU_memAccessCycles<PROCNUM,READSIZE,DIRECTION,false>(addr);
 }
 
+// calculates the summed cycle time of the n word accesses of an ldm or stm in the MEM stage,
+// from addr on in the direction dir (1 or -1). the same as n calls of MMU_memAccessCycles, only faster.
+template<int PROCNUM, MMU_ACCESS_DIRECTION DIRECTION>
+FORCEINLINE u32 MMU_memBurstCycles(u32 addr, int n, int dir)
+{
+	if(USE_TIMING())
+		return MMU_timing.armDataFetch<PROCNUM>().template FetchBurst<DIRECTION,true>(addr & ~3, n, dir);
+	else
+		return MMU_timing.armDataFetch<PROCNUM>().template FetchBurst<DIRECTION,false>(addr & ~3, n, dir);
+}
+
 // calculates the cycle time of a single code fetch in the FETCH stage
 // to be used to calculate the fetchCycles argument for MMU_fetchExecuteCycles.
 // this may have side effects, so don't call it more than necessary.
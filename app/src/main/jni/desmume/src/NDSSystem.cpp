@@ -28,6 +28,7 @@
 #include "utils/decrypt/crc.h"
 #include "utils/advanscene.h"
 #include "utils/task.h"
+#include "utils/fastcrc.h"
 
 #include "common.h"
 #include "armcpu.h"
@@ -41,7 +42,6 @@
 #include "debug.h"
 #include "cheatSystem.h"
 #include "movie.h"
-#include "Disassembler.h"
 #include "FIFO.h"
 #include "readwrite.h"
 #include "registers.h"
@@ -53,23 +53,30 @@
 #include "slot1.h"
 #include "slot2.h"
 #include "SPU.h"
+#include "texcache.h"
 #include "wifi.h"
+#include "frameprofile.h"
+#include "saves.h"
+#include "armtrace.h"
+#include "romreadahead.h"
+#include "hostcpu.h"
+#include "hostmem.h"
+#include "gamepreset.h"
 
 #ifdef GDB_STUB
 #include "gdbstub.h"
 #endif
 
-//int xxctr=0;
-//#define LOG_ARM9
-//#define LOG_ARM7
-//#define dolog (currFrameCounter>30)
-bool dolog = false;
-//#define LOG_TO_FILE
-//#define LOG_TO_FILE_REGS
+#ifdef HAVE_JIT
+#include "arm_jit.h"
+#endif
 
-//===============================================================
-FILE *fp_dis7 = NULL;
-FILE *fp_dis9 = NULL;
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 PathInfo path;
 
@@ -138,14 +145,31 @@ void NDS_RunAdvansceneAutoImport()
 	}
 }
 
+//renders the sub engine's scanline while the main engine renders its own.
+//the two engines only share vram, and nothing writes to it until both of them are done
+static Task taskSubGpu;
+static bool taskSubGpuStarted = false;
+static void* renderSubScreen(void*)
+{
+	GPU_RenderLine(&SubScreen, nds.VCount, false);
+	return NULL;
+}
+
 int NDS_Init()
 {
 	nds.idleFrameCounter = 0;
 	memset(nds.runCycleCollector,0,sizeof(nds.runCycleCollector));
+	hostcpu_init();
+
+	//MMU_Init's memset faults the whole of the ds' memory in, with it advised first on huge pages where there are.
+	//the faults that took are logged against what a frame takes later in the profiler's pageFaults
+	const u64 faultsBefore = hostmem_faults();
+	hostmem_advise_huge(&MMU, sizeof(MMU));
 	MMU_Init();
+	CORELOG_INFO("Emulated memory: %u KB mapped in at init with %u page faults\n", (u32)(sizeof(MMU) >> 10), (u32)(hostmem_faults() - faultsBefore));
 
 	//got to print this somewhere..
-	printf("%s\n", EMU_DESMUME_NAME_AND_VERSION());
+	CORELOG_INFO("%s\n", EMU_DESMUME_NAME_AND_VERSION());
 
 	if (Screen_Init() != 0)
 		return -1;
@@ -156,6 +180,9 @@ int NDS_Init()
 		strcpy(buf, path.pathToModule);
 		strcat(buf, "desmume.ddb");							// DeSmuME database	:)
 		advsc.setDatabase(buf);
+		strcpy(buf, path.pathToModule);
+		strcat(buf, "desmume.dgp");							// the games' known fastest settings
+		gamepreset_setDatabase(buf);
 
 		//why is this done here? shitty engineering. not intended.
 		NDS_RunAdvansceneAutoImport();
@@ -200,25 +227,17 @@ void NDS_DeInit(void)
 	delete cheatSearch;
 	cheatSearch = NULL;
 
-#ifdef HAVE_JIT
-	arm_jit_close();
-#endif
-
-#ifdef LOG_ARM7
-	if (fp_dis7 != NULL) 
+	if(taskSubGpuStarted)
 	{
-		fclose(fp_dis7);
-		fp_dis7 = NULL;
+		taskSubGpu.shutdown();
+		taskSubGpuStarted = false;
 	}
-#endif
 
-#ifdef LOG_ARM9
-	if (fp_dis9 != NULL) 
-	{
-		fclose(fp_dis9);
-		fp_dis9 = NULL;
-	}
+#ifdef HAVE_JIT
+	arm_jit_close();
 #endif
+
+	armtrace_close();
 }
 
 NDS_header* NDS_getROMHeader(void)
@@ -384,6 +403,12 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 	romsize = ftell(fROM) - headerOffset;
 	fseek(fROM, headerOffset, SEEK_SET);
 
+	//a streaming rom has its full size already, but only what the stream says is there is any good. the stdio buffer would
+	//keep what it read ahead of that, so it is left out
+	if (stream && stream->available != 0xFFFFFFFF)
+		setvbuf(fROM, NULL, _IONBF, 0);
+	waitROM(sizeof(header));
+
 	bool res = (fread(&header, 1, sizeof(header), fROM) == sizeof(header));
 
 	if (res)
@@ -475,12 +500,17 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 
 		if (type == ROM_NDS)
 		{
+			waitROM(0x8000);
 			fseek(fROM, 0x4000 + headerOffset, SEEK_SET);
 			fread(&secureArea[0], 1, 0x4000, fROM);
 		}
 
+		if (hasRomBanner())
+			waitROM(header.IconOff + sizeof(RomBanner));
+
 		if (CommonSettings.loadToMemory)
 		{
+			waitROM(romsize);
 			fseek(fROM, headerOffset, SEEK_SET);
 			
 			romdata = new u8[romsize + 4];
@@ -509,6 +539,53 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 			fclose(fROM); fROM = NULL;
 			return true;
 		}
+
+#ifndef WIN32
+		//otherwise the rom is mapped rather than streamed, if there is the address space for it. the kernel reads the pages in as the
+		//card gets to them and can drop them again, so big roms still don't need their size in memory. it is a private mapping so that
+		//DLDI patching works on a copy of the pages it changes, like it would on a rom loaded to memory
+		{
+			const size_t size = romsize + headerOffset;
+			void* map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fileno(fROM), 0);
+			if(map != MAP_FAILED)
+			{
+				romMap = (u8*)map;
+				romMapSize = size;
+				romdata = romMap + headerOffset;
+
+				//the binaries are read right away when the game boots
+				madvise(romMap, std::min<size_t>(size, 0x8000), MADV_WILLNEED);
+				const u32 page = (u32)sysconf(_SC_PAGESIZE);
+				const u32 bins[2][2] = {{header.ARM9src, header.ARM9binSize}, {header.ARM7src, header.ARM7binSize}};
+				for(int i = 0; i < 2; i++)
+				{
+					const u32 start = std::min<u32>(bins[i][0], romsize);
+					const u32 end = std::min<u32>(bins[i][0] + bins[i][1], romsize);
+					const size_t from = (start + headerOffset) & ~(size_t)(page-1);
+					if(end > start) madvise(romMap + from, end + headerOffset - from, MADV_WILLNEED);
+				}
+
+				if(hasRomBanner())
+				{
+					memcpy(&banner, romdata + header.IconOff, sizeof(RomBanner));
+
+					banner.version = LE_TO_LOCAL_16(banner.version);
+					banner.crc16 = LE_TO_LOCAL_16(banner.crc16);
+
+					for(size_t i = 0; i < ARRAY_SIZE(banner.palette); i++)
+					{
+						banner.palette[i] = LE_TO_LOCAL_16(banner.palette[i]);
+					}
+				}
+
+				_isDSiEnhanced = ((readROM(0x180) == 0x8D898581U) && (readROM(0x184) == 0x8C888480U));
+				fclose(fROM); fROM = NULL;
+				return true;
+			}
+			CORELOG_INFO("Couldn't map the rom (%s), streaming it from disk\n", strerror(errno));
+		}
+#endif
+
 		_isDSiEnhanced = ((readROM(0x180) == 0x8D898581U) && (readROM(0x184) == 0x8C888480U));
 		if (hasRomBanner())
 		{
@@ -533,22 +610,76 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 	return false;
 }
 
+static Task crcTask;
+static bool crcTaskStarted = false;
+
+//in pieces, so that a rom still coming in is hashed as it comes
+static void* hashROM(void*)
+{
+	static const u32 kChunk = 1 << 20;
+	u32 crc = 0;
+	for (u32 pos = 0; pos < gameInfo.romsize; pos += kChunk)
+	{
+		const u32 n = std::min(kChunk, gameInfo.romsize - pos);
+		gameInfo.waitROM(pos + n);
+		crc = fastcrc32(crc, gameInfo.romdata + pos, n);
+	}
+	gameInfo.crc = crc;
+	__atomic_store_n(&gameInfo.crcPending, false, __ATOMIC_RELEASE);
+	INFO("ROM crc: %08X (%s)\n", crc, fastcrc32_impl());
+	return NULL;
+}
+
+void GameInfo::startCRC()
+{
+	getCRC();
+	crc = 0;
+	if (!romdata)
+		return;
+	if (!crcTaskStarted)
+	{
+		crcTask.start(false, "ROM crc", THREAD_ROLE_BACKGROUND);
+		crcTaskStarted = true;
+	}
+	crcPending = true;
+	crcTask.execute(hashROM, NULL);
+}
+
+u32 GameInfo::getCRC()
+{
+	if (crcPending)
+		crcTask.finish();
+	return crc;
+}
+
 void GameInfo::closeROM()
 {
+	//the hash and the read ahead read romdata
+	getCRC();
+	romreadahead_close();
+
 	if (fROM)
 		fclose(fROM);
 
+#ifndef WIN32
+	if (romMap)
+		munmap(romMap, romMapSize);
+	else
+#endif
 	if (romdata)
 		delete [] romdata;
 
 	fROM = NULL;
 	romdata = NULL;
+	romMap = NULL;
+	romMapSize = 0;
 	romsize = 0;
 	lastReadPos = 0xFFFFFFFF;
 }
 
 u32 GameInfo::readROM(u32 pos)
 {
+	waitROM(pos + 4);
 	if (!romdata)
 	{
 		u32 data;
@@ -562,13 +693,42 @@ u32 GameInfo::readROM(u32 pos)
 	{
 		if(pos + 4 > romsize)
 		{
-			printf("Panic! GameInfo reading out of buffer!\n");
+			CORELOG_INFO("Panic! GameInfo reading out of buffer!\n");
 			exit(-1);
 		}
+		romreadahead_touch(pos);
 		return LE_TO_LOCAL_32(*(u32*)(romdata + pos));
 	}
 }
 
+void GameInfo::readROMBlock(u32 pos, u32* buf, u32 count)
+{
+	waitROM(pos + count*4);
+	if (!romdata)
+	{
+		if (lastReadPos != pos)
+			fseek(fROM, pos + headerOffset, SEEK_SET);
+		u32 num = fread(buf, 1, count*4, fROM);
+		lastReadPos = (pos + num);
+		if (num < count*4)
+			memset((u8*)buf + num, 0xFF, count*4 - num);
+	}
+	else
+	{
+		if(pos + count*4 > romsize)
+		{
+			CORELOG_INFO("Panic! GameInfo reading out of buffer!\n");
+			exit(-1);
+		}
+		romreadahead_touch(pos);
+		memcpy(buf, romdata + pos, count*4);
+	}
+#ifdef WORDS_BIGENDIAN
+	for(u32 i = 0; i < count; i++)
+		buf[i] = LE_TO_LOCAL_32(buf[i]);
+#endif
+}
+
 bool GameInfo::isDSiEnhanced()
 {
 	return _isDSiEnhanced;
@@ -613,6 +773,155 @@ static int rom_init_path(const char *filename, const char *physicalName, const c
 	return 1;
 }
 
+//with CommonSettings.cpu_skew set, the cpu loop runs each cpu in a stretch until it is that many cycles ahead of the
+//other one, instead of always running whichever is behind. cpuSkew is the window the loop is using right now.
+//when the cpus talk to each other (ipc sync and fifo, wramcnt) NDS_SyncCpus() closes it for the rest of this and
+//the next run of the loop, so the one that is behind catches up and they go on in lockstep for a while.
+static s32 cpuSkew = 0;
+static u32 cpuSkewHold = 0;
+
+//the cycles the interpreter's run (armRun) may still take, which NDS_Reschedule and NDS_SyncCpus cut short
+static s32 cpuRunBudget = 0;
+
+//the steps of loading a rom, which NDS_LoadROM times and logs, to show where the launch time goes on a device
+enum BootStep
+{
+	BOOT_OPEN,
+	BOOT_DATABASE,
+	BOOT_PRESET,
+	BOOT_CHEATS,
+	BOOT_TEXCACHE,
+	BOOT_JITPROFILE,
+	BOOT_READAHEAD,
+	BOOT_DLDI,
+	BOOT_JOIN,
+	BOOT_RESET,
+	BOOT_TOTAL,
+
+	BOOT_STEPS
+};
+
+static const char* const bootStepNames[BOOT_STEPS] = {
+	"open", "database", "preset", "cheats", "texcache", "jit profile", "readahead", "dldi", "join", "reset", "total"
+};
+
+static u64 bootStepNs[BOOT_STEPS];
+
+//the files the steps on the pool open, named on the loading thread, since path isn't the pool's to read
+static char bootGameCode[5];
+static char bootCheatsPath[MAX_PATH];
+static char bootTexCachePath[MAX_PATH];
+static char bootJitProfilePath[MAX_PATH];
+static char bootReadaheadPath[MAX_PATH];
+static char bootPresetPath[MAX_PATH];
+static GamePreset bootPreset;
+
+static void BootDatabase()
+{
+	//by the serial, and the crc only if the hash is done already: it isn't waited for
+	if (advsc.checkDB(bootGameCode, gameInfo.peekCRC()))
+	{
+		u8 sv = advsc.getSaveType();
+		CORELOG_INFO("Found in game database by %s:\n", advsc.getIdMethod());
+		CORELOG_INFO("\t* ROM serial:\t\t%s\n", advsc.getSerial());
+		printf("\t* ROM save type:\t");
+		if (sv == 0xFF)
+			printf("Unknown");
+		else
+			if (sv == 0xFE)
+				printf("None");
+			else
+			{
+				printf("%s", save_types[sv + 1].descr);
+				if (CommonSettings.autodetectBackupMethod == 1)
+					backup_setManualBackupType(sv + 1);
+			}
+		CORELOG_INFO("\n\t* ROM crc:\t\t%08X\n", advsc.getCRC32());
+	}
+	CORELOG_INFO("\n");
+}
+
+static void BootPreset()
+{
+	//by the crc too only if the hash is done, as above
+	if (!gamepreset_find(bootGameCode, gameInfo.peekCRC(), bootPresetPath, bootPreset))
+		bootPreset.fields = 0;
+}
+
+static void BootCheats()
+{
+	if (cheats != NULL)
+		cheats->init(bootCheatsPath);
+}
+
+static void BootTexCache()
+{
+	if (CommonSettings.GFX3D_TexCacheDisk)
+		TexCache_OpenDiskCache(bootTexCachePath);
+	else
+		TexCache_CloseDiskCache();
+}
+
+static void BootJitProfile()
+{
+#ifdef HAVE_JIT
+	arm_jit_profile_open(bootJitProfilePath);
+#endif
+}
+
+static void BootReadahead()
+{
+	romreadahead_open(bootReadaheadPath);
+}
+
+struct BootTask
+{
+	BootStep step;
+	void (*work)();
+};
+
+static void* RunBootTask(void* arg)
+{
+	const BootTask* task = (const BootTask*)arg;
+	const u64 start = frameprofile_now();
+	task->work();
+	bootStepNs[task->step] = frameprofile_now() - start;
+	return NULL;
+}
+
+//the steps that only read their own files, and that nothing before NDS_Reset needs, go on the pool together
+static const BootTask bootTasks[] = {
+	{ BOOT_DATABASE, BootDatabase },
+	{ BOOT_PRESET, BootPreset },
+	{ BOOT_CHEATS, BootCheats },
+	{ BOOT_TEXCACHE, BootTexCache },
+	{ BOOT_JITPROFILE, BootJitProfile },
+	{ BOOT_READAHEAD, BootReadahead },
+};
+
+//has the kernel start reading a file NDS_Reset is going to, while the boot's other steps go on
+static void BootWarmFile(const char* fname)
+{
+#ifndef WIN32
+	if (fname == NULL || fname[0] == 0)
+		return;
+	const int fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+#endif
+}
+
+static void BootLogTimes()
+{
+	char line[512];
+	int len = 0;
+	for (int i = 0; i < BOOT_STEPS && len < (int)sizeof(line); i++)
+		len += snprintf(line + len, sizeof(line) - len, "%s%s %.1fms", i ? ", " : "", bootStepNames[i], bootStepNs[i] / 1000000.0);
+	CORELOG_INFO("ROM boot: %s\n", line);
+}
+
 int NDS_LoadROM(const char *filename, const char *physicalName, const char *logicalFilename)
 {
 	int	ret;
@@ -621,6 +930,18 @@ int NDS_LoadROM(const char *filename, const char *physicalName, const char *logi
 	if (filename == NULL)
 		return -1;
 
+	memset(bootStepNs, 0, sizeof(bootStepNs));
+	const u64 bootStart = frameprofile_now();
+
+	//the bios and firmware are only read by NDS_Reset at the end, by which time they should be in memory
+	if (CommonSettings.UseExtBIOS)
+	{
+		BootWarmFile(CommonSettings.ARM7BIOS);
+		BootWarmFile(CommonSettings.ARM9BIOS);
+	}
+	if (CommonSettings.UseExtFirmware)
+		BootWarmFile(CommonSettings.Firmware);
+
 	ret = rom_init_path(filename, physicalName, logicalFilename);
 	if (ret < 1)
 		return ret;
@@ -633,17 +954,14 @@ int NDS_LoadROM(const char *filename, const char *physicalName, const char *logi
 	//check whether this rom is any kind of valid
 	if(!CheckValidRom((u8*)&gameInfo.header, gameInfo.secureArea))
 	{
-		printf("Specified file is not a valid rom\n");
+		CORELOG_INFO("Specified file is not a valid rom\n");
 		return -1;
 	}
 
 	gameInfo.populate();
 
 
-	if (CommonSettings.loadToMemory)
-		gameInfo.crc = crc32(0, (u8*)gameInfo.romdata, gameInfo.romsize);
-	else
-		gameInfo.crc = 0;
+	gameInfo.startCRC();
 
 	gameInfo.chipID  = 0xC2;														// The Manufacturer ID is defined by JEDEC (C2h = Macronix)
 	if (!gameInfo.isHomebrew())
@@ -667,8 +985,6 @@ int NDS_LoadROM(const char *filename, const char *physicalName, const char *logi
 	}
 
 	INFO("\nROM game code: %c%c%c%c\n", gameInfo.header.gameCode[0], gameInfo.header.gameCode[1], gameInfo.header.gameCode[2], gameInfo.header.gameCode[3]);
-	if (gameInfo.crc)
-		INFO("ROM crc: %08X\n", gameInfo.crc);
 	if (!gameInfo.isHomebrew())
 	{
 		INFO("ROM serial: %s\n", gameInfo.ROMserial);
@@ -683,31 +999,44 @@ int NDS_LoadROM(const char *filename, const char *physicalName, const char *logi
 	buf[2] = gameInfo.header.gameCode[2];
 	buf[3] = gameInfo.header.gameCode[3];
 	buf[4] = 0;
-	if (advsc.checkDB(buf, gameInfo.crc))
-	{
-		u8 sv = advsc.getSaveType();
-		printf("Found in game database by %s:\n", advsc.getIdMethod());
-		printf("\t* ROM serial:\t\t%s\n", advsc.getSerial());
-		printf("\t* ROM save type:\t");
-		if (sv == 0xFF)
-			printf("Unknown");
-		else
-			if (sv == 0xFE)
-				printf("None");
-			else
-			{
-				printf("%s", save_types[sv + 1].descr);
-				if (CommonSettings.autodetectBackupMethod == 1)
-					backup_setManualBackupType(sv + 1);
-			}
-		printf("\n\t* ROM crc:\t\t%08X\n", advsc.getCRC32());
-	}
-	printf("\n");
+	memcpy(bootGameCode, buf, sizeof(bootGameCode));
+
+	memset(bootCheatsPath, 0, MAX_PATH);
+	path.getpathnoext(path.CHEATS, bootCheatsPath);
+	strcat(bootCheatsPath, ".dct");						// DeSmuME cheat		:)
+	memset(bootTexCachePath, 0, MAX_PATH);
+	path.getpathnoext(path.BATTERY, bootTexCachePath);
+	strcat(bootTexCachePath, ".dtc");					// decoded texture cache, next to the battery save
+	memset(bootJitProfilePath, 0, MAX_PATH);
+	path.getpathnoext(path.BATTERY, bootJitProfilePath);
+	strcat(bootJitProfilePath, ".djp");					// blocks the jit compiled, next to the battery save
+	memset(bootReadaheadPath, 0, MAX_PATH);
+	path.getpathnoext(path.BATTERY, bootReadaheadPath);
+	strcat(bootReadaheadPath, ".dra");					// the files the game reads one after another, next to the battery save
+	memset(bootPresetPath, 0, MAX_PATH);
+	path.getpathnoext(path.BATTERY, bootPresetPath);
+	strcat(bootPresetPath, ".dgp");						// the user's own settings for the game, next to the battery save
+
+	//the previous game's preset is off the settings before this one's boot reads any of them
+	gamepreset_restore();
+
+	bootStepNs[BOOT_OPEN] = frameprofile_now() - bootStart;
+
+	//the database's save type has to be in before NDS_Reset makes the backup device, and the jit profile and the
+	//readahead before it boots, so the pool's steps are all waited for ahead of it. the homebrew's patching waits on
+	//the whole rom, which is done here meanwhile
+	TaskGroup bootGroup;
+	for (size_t i = 0; i < ARRAY_SIZE(bootTasks); i++)
+		bootGroup.run(RunBootTask, (void*)&bootTasks[i]);
 
 	//for homebrew, try auto-patching DLDI. should be benign if there is no DLDI or if it fails
+	const u64 dldiStart = frameprofile_now();
 	if(gameInfo.isHomebrew())
 	{
-		if(!CommonSettings.loadToMemory)
+		gameInfo.waitROM(gameInfo.romsize);
+		//the crc is of the rom before the patch
+		gameInfo.getCRC();
+		if(!gameInfo.romdata)
 			msgbox->warn("Sorry.. right now, you can't use the default (stream rom from disk) with homebrew due to a bug with DLDI-autopatching");
 		if (slot1_GetCurrentType() == NDS_SLOT1_R4)
 			DLDI::tryPatch((void*)gameInfo.romdata, gameInfo.romsize, 1);
@@ -716,16 +1045,22 @@ int NDS_LoadROM(const char *filename, const char *physicalName, const char *logi
 				DLDI::tryPatch((void*)gameInfo.romdata, gameInfo.romsize, 0);
 
 	}
+	bootStepNs[BOOT_DLDI] = frameprofile_now() - dldiStart;
 
-	if (cheats != NULL)
-	{
-		memset(buf, 0, MAX_PATH);
-		path.getpathnoext(path.CHEATS, buf);
-		strcat(buf, ".dct");						// DeSmuME cheat		:)
-		cheats->init(buf);
-	}
+	const u64 joinStart = frameprofile_now();
+	bootGroup.wait();
+	bootStepNs[BOOT_JOIN] = frameprofile_now() - joinStart;
+
+	//the jit's and the cpu loop's settings are taken up by NDS_Reset
+	if (CommonSettings.game_presets)
+		gamepreset_apply(bootPreset);
 
+	const u64 resetStart = frameprofile_now();
 	NDS_Reset();
+	bootStepNs[BOOT_RESET] = frameprofile_now() - resetStart;
+
+	bootStepNs[BOOT_TOTAL] = frameprofile_now() - bootStart;
+	BootLogTimes();
 
 	return ret;
 }
@@ -733,6 +1068,11 @@ int NDS_LoadROM(const char *filename, const char *physicalName, const char *logi
 void NDS_FreeROM(void)
 {
 	FCEUI_StopMovie();
+	TexCache_CloseDiskCache();
+#ifdef HAVE_JIT
+	arm_jit_profile_close();
+#endif
+	gamepreset_restore();
 	gameInfo.closeROM();
 }
 
@@ -748,9 +1088,15 @@ void NDS_TriggerCardEjectIRQ()
 class FrameSkipper
 {
 public:
-	void RequestSkip()
+	void RequestSkip(bool withSkip2D)
 	{
 		nextSkip = true;
+		nextSkip2D = withSkip2D;
+	}
+	bool Requested(bool& withSkip2D) const
+	{
+		withSkip2D = nextSkip2D;
+		return nextSkip;
 	}
 	void OmitSkip(bool force, bool forceEvenIfCapturing=false)
 	{
@@ -777,6 +1123,15 @@ public:
 			SkipNext2DFrame = false;
 			nextSkip = false;
 		}
+		else if(dualScreen3D)
+		{
+			//a game showing 3d on both screens renders it for one screen each frame, and captures it to keep it
+			//on the other. skipping one frame of such a pair leaves one screen stale, and with an odd skip pattern
+			//it never gets drawn at all, so the frames are skipped in pairs: the frame that goes on the bottom
+			//screen does what the top one before it did
+			if(MainScreen.offset == 0)
+				nextSkip = skipped;
+		}
 		else if(lastOffset != MainScreen.offset && lastSkip && !skipped)
 		{
 			// if we're switching from not skipping to skipping
@@ -791,15 +1146,32 @@ public:
 			consecutiveNonCaptures = 0;
 		else if(!(consecutiveNonCaptures > 9000)) // arbitrary cap to avoid eventual wrap
 			consecutiveNonCaptures++;
+
+		//the screens swapping every frame with a capture every frame, for a while
+		if(capturing && lastOffset != MainScreen.offset)
+		{
+			if(alternatingFrames < kDualScreen3DFrames)
+				alternatingFrames++;
+		}
+		else
+			alternatingFrames = 0;
+		if(dualScreen3D != (alternatingFrames == kDualScreen3DFrames))
+		{
+			dualScreen3D = !dualScreen3D;
+			INFO("Dual screen 3D %s\n", dualScreen3D ? "detected" : "ended");
+		}
 		lastLastOffset = lastOffset;
 		lastOffset = MainScreen.offset;
 		lastSkip = skipped;
 		skipped = nextSkip;
 		nextSkip = false;
 
+		//the 3d rendered at the end of this frame is what the next frame's 2d shows
+		Skipped2DFrame = SkipCur2DFrame;
+		Skipped3DFrame = SkipCur3DFrame;
 		SkipCur2DFrame = SkipNext2DFrame;
 		SkipCur3DFrame = skipped;
-		SkipNext2DFrame = skipped;
+		SkipNext2DFrame = skipped && nextSkip2D;
 	}
 	FORCEINLINE bool ShouldSkip2D()
 	{
@@ -809,43 +1181,83 @@ public:
 	{
 		return SkipCur3DFrame;
 	}
+	//this is advanced at the end of the emulated frame, so the frame that just ended is one back
+	bool WasSkipped2D()
+	{
+		return Skipped2DFrame;
+	}
+	bool WasSkipped3D()
+	{
+		return Skipped3DFrame;
+	}
+	bool DualScreen3D()
+	{
+		return dualScreen3D;
+	}
 	FrameSkipper()
 	{
 		nextSkip = false;
+		nextSkip2D = true;
 		skipped = false;
 		lastSkip = false;
 		lastOffset = 0;
 		SkipCur2DFrame = false;
 		SkipCur3DFrame = false;
 		SkipNext2DFrame = false;
+		Skipped2DFrame = false;
+		Skipped3DFrame = false;
 		consecutiveNonCaptures = 0;
+		alternatingFrames = 0;
+		dualScreen3D = false;
 	}
 private:
+	//frames the pattern has to keep up for, before the skipping goes by pairs
+	static const int kDualScreen3DFrames = 8;
+
 	bool nextSkip;
+	bool nextSkip2D; //false to only skip the 3d of the next frame
 	bool skipped;
 	bool lastSkip;
 	int lastOffset;
 	int lastLastOffset;
 	int consecutiveNonCaptures;
+	int alternatingFrames;
+	bool dualScreen3D;
 	bool SkipCur2DFrame;
 	bool SkipCur3DFrame;
 	bool SkipNext2DFrame;
+	bool Skipped2DFrame;
+	bool Skipped3DFrame;
 };
 static FrameSkipper frameSkipper;
 
 
 void NDS_SkipNextFrame() {
 	if (!driver->AVI_IsRecording()) {
-		frameSkipper.RequestSkip();
+		frameSkipper.RequestSkip(true);
+	}
+}
+void NDS_SkipNext3DFrame() {
+	if (!driver->AVI_IsRecording()) {
+		frameSkipper.RequestSkip(false);
 	}
 }
+bool NDS_SkipRequested(bool& with2D) {
+	return frameSkipper.Requested(with2D);
+}
+bool NDS_Skipped2DFrame() {
+	return frameSkipper.WasSkipped2D();
+}
+bool NDS_Skipped3DFrame() {
+	return frameSkipper.WasSkipped3D();
+}
+bool NDS_DualScreen3D() {
+	return frameSkipper.DualScreen3D();
+}
 void NDS_OmitFrameSkip(int force) {
 	frameSkipper.OmitSkip(force > 0, force > 1);
 }
 
-#define INDEX(i) ((((i)>>16)&0xFF0)|(((i)>>4)&0xF))
-
-
 enum ESI_DISPCNT
 {
 	ESI_DISPCNT_HStart, ESI_DISPCNT_HStartIRQ, ESI_DISPCNT_HDraw, ESI_DISPCNT_HBlank
@@ -856,12 +1268,37 @@ u64 nds_arm9_timer, nds_arm7_timer;
 
 static const u64 kNever = 0xFFFFFFFFFFFFFFFFULL;
 
+static void execHardware_dispcnt();
+static void execHardware_wifi();
+
+static FORCEINLINE int lowestBit(u32 v)
+{
+#ifdef __GNUC__
+	return __builtin_ctz(v);
+#else
+	int i = 0;
+	while(!(v & 1)) { v >>= 1; i++; }
+	return i;
+#endif
+}
+
+//an event source of the sequencer. when() says when it next has to run (kNever if it doesn't), and run() is called
+//once nds_timer gets there. the sequencer only asks for when() again after the source is touched, so whatever changes
+//it has to go through one of the NDS_Reschedule* functions (or be done from its own run())
 struct TSequenceItem
 {
 	u64 timestamp;
 	u32 param;
 	bool enabled;
 
+	//where the sequencer keeps this, see Sequencer::add
+	int index, heapPos;
+
+	TSequenceItem() : index(0), heapPos(0) {}
+
+	virtual u64 when() { return enabled ? timestamp : kNever; }
+	virtual void run() {}
+
 	virtual void save(EMUFILE* os)
 	{
 		write64le(timestamp,os);
@@ -888,6 +1325,18 @@ struct TSequenceItem
 	}
 };
 
+struct TSequenceItem_dispcnt : public TSequenceItem
+{
+	u64 when() { return timestamp; } //this one is always enabled
+	void run() { execHardware_dispcnt(); }
+};
+
+//the wifi runs at its next event, param microseconds after the last one it counted to (see WIFI_usUntilNextEvent)
+struct TSequenceItem_wifi : public TSequenceItem
+{
+	void run() { execHardware_wifi(); }
+};
+
 struct TSequenceItem_GXFIFO : public TSequenceItem
 {
 	FORCEINLINE bool isTriggered()
@@ -909,6 +1358,9 @@ struct TSequenceItem_GXFIFO : public TSequenceItem
 		if(enabled) return MMU.gfx3dCycles;
 		else return kNever;
 	}
+
+	u64 when() { return next(); }
+	void run() { exec(); }
 };
 
 template<int procnum, int num> struct TSequenceItem_Timer : public TSequenceItem
@@ -918,9 +1370,16 @@ template<int procnum, int num> struct TSequenceItem_Timer : public TSequenceItem
 		return enabled && nds_timer >= nds.timerCycle[procnum][num];
 	}
 
+	//an overflow only needs an event when it raises an irq or counts up the next timer. otherwise the count is
+	//worked out from timerCycle when it is read, which saves the events of fast timers nobody listens to
 	FORCEINLINE void schedule()
 	{
-		enabled = MMU.timerON[procnum][num] && MMU.timerMODE[procnum][num] != 0xFFFF;
+		const bool was = enabled;
+		u8* regs = procnum==0?MMU.ARM9_REG:MMU.ARM7_REG;
+		const bool irq = (T1ReadWord(regs, 0x102 + num*4) & 0x40) != 0;
+		const bool cascade = num < 3 && MMU.timerON[procnum][num+1] && MMU.timerMODE[procnum][num+1] == 0xFFFF;
+		enabled = MMU.timerON[procnum][num] && MMU.timerMODE[procnum][num] != 0xFFFF && (irq || cascade);
+		if(enabled && !was) MMU_timerCatchUp(procnum,num);
 	}
 
 	FORCEINLINE u64 next()
@@ -928,6 +1387,9 @@ template<int procnum, int num> struct TSequenceItem_Timer : public TSequenceItem
 		return nds.timerCycle[procnum][num];
 	}
 
+	u64 when() { return enabled ? next() : kNever; }
+	void run() { exec(); }
+
 	FORCEINLINE void exec()
 	{
 		IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[13+procnum*4+num]++);
@@ -959,7 +1421,7 @@ template<int procnum, int num> struct TSequenceItem_Timer : public TSequenceItem
 				}
 #ifndef NDEBUG
 				if(ctr>1) {
-					printf("yikes!!!!! please report!\n");
+					CORELOG_INFO("yikes!!!!! please report!\n");
 				}
 #endif
 			}
@@ -996,6 +1458,9 @@ template<int procnum, int chan> struct TSequenceItem_DMA : public TSequenceItem
 		return controller->nextEvent;
 	}
 
+	u64 when() { return isEnabled() ? next() : kNever; }
+	void run() { exec(); }
+
 	FORCEINLINE void exec()
 	{
 		IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[5+procnum*4+chan]++);
@@ -1052,6 +1517,9 @@ struct TSequenceItem_divider : public TSequenceItem
 		return MMU.divCycles;
 	}
 
+	u64 when() { return isEnabled() ? next() : kNever; }
+	void run() { exec(); }
+
 	void exec()
 	{
 		IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[2]++);
@@ -1084,6 +1552,9 @@ struct TSequenceItem_sqrtunit : public TSequenceItem
 		return MMU.sqrtCycles;
 	}
 
+	u64 when() { return isEnabled() ? next() : kNever; }
+	void run() { exec(); }
+
 	FORCEINLINE void exec()
 	{
 		IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[3]++);
@@ -1098,8 +1569,8 @@ struct Sequencer
 {
 	bool nds_vblankEnded;
 	bool reschedule;
-	TSequenceItem dispcnt;
-	TSequenceItem wifi;
+	TSequenceItem_dispcnt dispcnt;
+	TSequenceItem_wifi wifi;
 	TSequenceItem_divider divider;
 	TSequenceItem_sqrtunit sqrtunit;
 	TSequenceItem_GXFIFO gxfifo;
@@ -1112,6 +1583,25 @@ struct Sequencer
 	TSequenceItem_Timer<1,0> timer_1_0; TSequenceItem_Timer<1,1> timer_1_1;
 	TSequenceItem_Timer<1,2> timer_1_2; TSequenceItem_Timer<1,3> timer_1_3;
 
+	//the sources in the order they run in when several are due at once, and the same sources in a min-heap on
+	//their when() as of the last time they were touched. a source is added by giving it a member above, an add()
+	//in init() and its save and load
+	enum { kMaxItems = 32 };
+	TSequenceItem* items[kMaxItems];
+	TSequenceItem* heap[kMaxItems];
+	u64 heapKey[kMaxItems];
+	int numItems;
+	//bit per index of the sources touched since they were last put in order
+	u32 touched;
+
+	void add(TSequenceItem* item);
+	FORCEINLINE void touch(TSequenceItem* item) { touched |= 1<<item->index; }
+	void touchAll() { touched = 0xFFFFFFFF; }
+	void refresh();
+	void siftUp(int pos);
+	void siftDown(int pos);
+	void place(int pos, TSequenceItem* item, u64 key);
+
 	void init();
 
 	void execHardware();
@@ -1152,11 +1642,80 @@ struct Sequencer
 		LOAD(dma,1,0); LOAD(dma,1,1); LOAD(dma,1,2); LOAD(dma,1,3); 
 #undef LOAD
 
+		touchAll();
 		return true;
 	}
 
 } sequencer;
 
+void Sequencer::add(TSequenceItem* item)
+{
+	assert(numItems < kMaxItems);
+	item->index = numItems;
+	items[numItems] = item;
+	place(numItems, item, kNever);
+	numItems++;
+	siftUp(item->heapPos);
+	touch(item);
+}
+
+FORCEINLINE void Sequencer::place(int pos, TSequenceItem* item, u64 key)
+{
+	heap[pos] = item;
+	heapKey[pos] = key;
+	item->heapPos = pos;
+}
+
+void Sequencer::siftUp(int pos)
+{
+	TSequenceItem* item = heap[pos];
+	const u64 key = heapKey[pos];
+	while(pos > 0)
+	{
+		const int parent = (pos-1)>>1;
+		if(heapKey[parent] <= key) break;
+		place(pos, heap[parent], heapKey[parent]);
+		pos = parent;
+	}
+	place(pos, item, key);
+}
+
+void Sequencer::siftDown(int pos)
+{
+	TSequenceItem* item = heap[pos];
+	const u64 key = heapKey[pos];
+	for(;;)
+	{
+		int child = pos*2+1;
+		if(child >= numItems) break;
+		if(child+1 < numItems && heapKey[child+1] < heapKey[child]) child++;
+		if(key <= heapKey[child]) break;
+		place(pos, heap[child], heapKey[child]);
+		pos = child;
+	}
+	place(pos, item, key);
+}
+
+//puts the touched sources back in order, by asking them when they have to run now
+void Sequencer::refresh()
+{
+	u32 todo = touched & ((numItems == 32) ? 0xFFFFFFFF : ((1u<<numItems)-1));
+	touched = 0;
+	while(todo)
+	{
+		const int i = lowestBit(todo);
+		todo &= todo-1;
+
+		TSequenceItem* item = items[i];
+		const u64 key = item->when();
+		const int pos = item->heapPos;
+		if(key == heapKey[pos]) continue;
+		heapKey[pos] = key;
+		if(pos > 0 && key < heapKey[(pos-1)>>1]) siftUp(pos);
+		else siftDown(pos);
+	}
+}
+
 void NDS_RescheduleGXFIFO(u32 cost)
 {
 	if(!sequencer.gxfifo.enabled) {
@@ -1164,12 +1723,13 @@ void NDS_RescheduleGXFIFO(u32 cost)
 		sequencer.gxfifo.enabled = true;
 	}
 	MMU.gfx3dCycles += cost;
+	sequencer.touch(&sequencer.gxfifo);
 	NDS_Reschedule();
 }
 
 void NDS_RescheduleTimers()
 {
-#define check(X,Y) sequencer.timer_##X##_##Y .schedule();
+#define check(X,Y) sequencer.timer_##X##_##Y .schedule(); sequencer.touch(&sequencer.timer_##X##_##Y);
 	check(0,0); check(0,1); check(0,2); check(0,3);
 	check(1,0); check(1,1); check(1,2); check(1,3);
 #undef check
@@ -1179,22 +1739,26 @@ void NDS_RescheduleTimers()
 
 void NDS_RescheduleDMA()
 {
-	//TBD
+	//we aren't told which one it was, but touching them is cheap
+#define check(X,Y) sequencer.touch(&sequencer.dma_##X##_##Y);
+	check(0,0); check(0,1); check(0,2); check(0,3);
+	check(1,0); check(1,1); check(1,2); check(1,3);
+#undef check
 	NDS_Reschedule();
 
 }
 
-static void initSchedule()
+void NDS_RescheduleDivider()
 {
-	sequencer.init();
-
-	//begin at the very end of the last scanline
-	//so that at t=0 we can increment to scanline=0
-	nds.VCount = 262; 
-
-	sequencer.nds_vblankEnded = false;
+	sequencer.touch(&sequencer.divider);
+	NDS_Reschedule();
 }
 
+void NDS_RescheduleSqrt()
+{
+	sequencer.touch(&sequencer.sqrtunit);
+	NDS_Reschedule();
+}
 
 // 2196372 ~= (ARM7_CLOCK << 16) / 1000000
 // This value makes more sense to me, because:
@@ -1204,8 +1768,58 @@ static void initSchedule()
 const u64 kWifiCycles = 67;//34*2;
 //(this isn't very precise. I don't think it needs to be)
 
+void NDS_SyncWifi()
+{
+#ifdef EXPERIMENTAL_WIFI_COMM
+	//only as far as the microsecond before the event, which is the event's own to run
+	TSequenceItem_wifi& wifi = sequencer.wifi;
+	if(wifi.param <= 1) return;
+	const u64 counted = wifi.timestamp - wifi.param*kWifiCycles;
+	if(nds_timer < counted + kWifiCycles) return;
+	const u32 usecs = (u32)std::min<u64>((nds_timer - counted) / kWifiCycles, wifi.param - 1);
+	WIFI_usAdvance(usecs);
+	wifi.param -= usecs;
+#endif
+}
+
+void NDS_RescheduleWifi()
+{
+#ifdef EXPERIMENTAL_WIFI_COMM
+	TSequenceItem_wifi& wifi = sequencer.wifi;
+	const u64 counted = wifi.timestamp - wifi.param*kWifiCycles;
+	wifi.param = WIFI_usUntilNextEvent();
+	wifi.timestamp = counted + wifi.param*kWifiCycles;
+	sequencer.touch(&wifi);
+	NDS_Reschedule();
+#endif
+}
+
+static void initSchedule()
+{
+	sequencer.init();
+
+	//begin at the very end of the last scanline
+	//so that at t=0 we can increment to scanline=0
+	nds.VCount = 262; 
+
+	sequencer.nds_vblankEnded = false;
+}
+
+
 void Sequencer::init()
 {
+	//in the order of the checks this started out as, which is the order they run in when due at the same time
+	numItems = 0;
+	add(&dispcnt);
+	add(&wifi);
+	add(&divider);
+	add(&sqrtunit);
+	add(&gxfifo);
+	add(&dma_0_0); add(&dma_0_1); add(&dma_0_2); add(&dma_0_3);
+	add(&dma_1_0); add(&dma_1_1); add(&dma_1_2); add(&dma_1_3);
+	add(&timer_0_0); add(&timer_0_1); add(&timer_0_2); add(&timer_0_3);
+	add(&timer_1_0); add(&timer_1_1); add(&timer_1_2); add(&timer_1_3);
+
 	NDS_RescheduleTimers();
 	NDS_RescheduleDMA();
 
@@ -1233,19 +1847,13 @@ void Sequencer::init()
 	#ifdef EXPERIMENTAL_WIFI_COMM
 	wifi.enabled = true;
 	wifi.timestamp = kWifiCycles;
+	wifi.param = 1;
 	#else
 	wifi.enabled = false;
 	#endif
-}
 
-//this isnt helping much right now. work on it later
-//#include "utils/task.h"
-//Task taskSubGpu(true);
-//void* renderSubScreen(void*)
-//{
-//	GPU_RenderLine(&SubScreen, nds.VCount, SkipCur2DFrame);
-//	return NULL;
-//}
+	touchAll();
+}
 
 static void execHardware_hblank()
 {
@@ -1256,10 +1864,27 @@ static void execHardware_hblank()
 	//scroll regs for the next scanline
 	if(nds.VCount<192)
 	{
-		//taskSubGpu.execute(renderSubScreen,NULL);
-		GPU_RenderLine(&MainScreen, nds.VCount, frameSkipper.ShouldSkip2D());
-		GPU_RenderLine(&SubScreen, nds.VCount, frameSkipper.ShouldSkip2D());
-		//taskSubGpu.finish();
+		const bool skip = frameSkipper.ShouldSkip2D();
+
+		//display capture writes vram from the main engine while it renders, and that could be
+		//what the sub engine is reading. skipped lines are cheap enough to not bother
+		if(CommonSettings.GFX2D_ParallelEngines && CommonSettings.num_cores > 1 && !skip && !MainScreen.gpu->dispCapCnt.enabled)
+		{
+			if(!taskSubGpuStarted)
+			{
+				taskSubGpu.start(false, "Sub GPU");
+				taskSubGpuStarted = true;
+			}
+
+			taskSubGpu.execute(renderSubScreen,NULL);
+			GPU_RenderLine(&MainScreen, nds.VCount, false);
+			taskSubGpu.finish();
+		}
+		else
+		{
+			GPU_RenderLine(&MainScreen, nds.VCount, skip);
+			GPU_RenderLine(&SubScreen, nds.VCount, skip);
+		}
 
 		//trigger hblank dmas
 		//but notice, we do that just after we finished drawing the line
@@ -1483,6 +2108,38 @@ void NDS_Reschedule()
 {
 	IF_DEVELOPER(if(!sequencer.reschedule) DEBUG_statistics.sequencerExecutionCounters[0]++;);
 	sequencer.reschedule = true;
+	cpuRunBudget = -1;
+#ifdef HAVE_JIT
+	//whatever blocks are chained right now must return to the loop so the new event is seen
+	arm_jit_chain.budget = -1;
+#endif
+}
+
+void NDS_SyncCpus()
+{
+	if(!CommonSettings.cpu_skew) return;
+	cpuSkew = 0;
+	cpuSkewHold = 2;
+	cpuRunBudget = -1;
+#ifdef HAVE_JIT
+	arm_jit_chain.budget = -1;
+#endif
+}
+
+void NDS_StallCpus(s32 cycles)
+{
+	//the frozen cpus idle until the dma's end event, which is where they would pick up again
+	const u64 until = nds_timer + cycles;
+	if(nds_arm9_timer < until)
+	{
+		nds.idleCycles[0] += (s32)(until - nds_arm9_timer);
+		nds_arm9_timer = until;
+	}
+	if(nds_arm7_timer < until)
+	{
+		nds.idleCycles[1] += (s32)(until - nds_arm7_timer);
+		nds_arm7_timer = until;
+	}
 }
 
 FORCEINLINE u32 _fast_min32(u32 a, u32 b, u32 c, u32 d)
@@ -1517,92 +2174,94 @@ FORCEINLINE u64 _fast_min(u64 a, u64 b)
 
 u64 Sequencer::findNext()
 {
-	//this one is always enabled so dont bother to check it
-	u64 next = dispcnt.next();
-
-	if(divider.isEnabled()) next = _fast_min(next,divider.next());
-	if(sqrtunit.isEnabled()) next = _fast_min(next,sqrtunit.next());
-	if(gxfifo.enabled) next = _fast_min(next,gxfifo.next());
-
-#ifdef EXPERIMENTAL_WIFI_COMM
-	next = _fast_min(next,wifi.next());
-#endif
-
-#define test(X,Y) if(dma_##X##_##Y .isEnabled()) next = _fast_min(next,dma_##X##_##Y .next());
-	test(0,0); test(0,1); test(0,2); test(0,3);
-	test(1,0); test(1,1); test(1,2); test(1,3);
-#undef test
-#define test(X,Y) if(timer_##X##_##Y .enabled) next = _fast_min(next,timer_##X##_##Y .next());
-	test(0,0); test(0,1); test(0,2); test(0,3);
-	test(1,0); test(1,1); test(1,2); test(1,3);
-#undef test
-
-	return next;
+	refresh();
+	//the dispcnt events are always enabled, so the heap always has a real time on top
+	return heapKey[0];
 }
 
 void Sequencer::execHardware()
 {
-	if(dispcnt.isTriggered())
+	refresh();
+
+	//everything that is due is at the top of the heap, and nothing under a source that isn't due is
+	u32 due = 0;
+	int stack[kMaxItems];
+	int sp = 0;
+	if(heapKey[0] <= nds_timer) stack[sp++] = 0;
+	while(sp)
 	{
+		const int pos = stack[--sp];
+		due |= 1<<heap[pos]->index;
+		const int child = pos*2+1;
+		if(child < numItems && heapKey[child] <= nds_timer) stack[sp++] = child;
+		if(child+1 < numItems && heapKey[child+1] <= nds_timer) stack[sp++] = child+1;
+	}
 
-		IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[1]++);
+	//they run in the sources' order, and one that an earlier one touches still gets its turn in this pass if it comes later
+	while(due)
+	{
+		const int i = lowestBit(due);
+		due &= due-1;
 
-		switch(dispcnt.param)
+		TSequenceItem* item = items[i];
+		if(nds_timer >= item->when())
 		{
-		case ESI_DISPCNT_HStart:
-			execHardware_hstart();
-			//(used to be 3168)
-			//hstart is actually 8 dots before the visible drawing begins
-			//we're going to run 1 here and then run 7 in the next case
-			dispcnt.timestamp += 1*6*2;
-			dispcnt.param = ESI_DISPCNT_HStartIRQ;
-			break;
-		case ESI_DISPCNT_HStartIRQ:
-			execHardware_hstart_irq();
-			dispcnt.timestamp += 7*6*2;
-			dispcnt.param = ESI_DISPCNT_HDraw;
-			break;
-			
-		case ESI_DISPCNT_HDraw:
-			execHardware_hdraw();
-			//duration of non-blanking period is ~1606 clocks (gbatek agrees) [but says its different on arm7]
-			//im gonna call this 267 dots = 267*6=1602
-			//so, this event lasts 267 dots minus the 8 dot preroll
-			dispcnt.timestamp += (267-8)*6*2;
-			dispcnt.param = ESI_DISPCNT_HBlank;
-			break;
-
-		case ESI_DISPCNT_HBlank:
-			execHardware_hblank();
-			//(once this was 1092 or 1092/12=91 dots.)
-			//there are surely 355 dots per scanline, less 267 for non-blanking period. the rest is hblank and then after that is hstart
-			dispcnt.timestamp += (355-267)*6*2;
-			dispcnt.param = ESI_DISPCNT_HStart;
-			break;
+			item->run();
+			touch(item);
 		}
+		due |= touched & ~((2u<<i)-1);
 	}
+}
 
-#ifdef EXPERIMENTAL_WIFI_COMM
-	if(wifi.isTriggered())
+static void execHardware_dispcnt()
+{
+	IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[1]++);
+
+	switch(sequencer.dispcnt.param)
 	{
-		WIFI_usTrigger();
-		wifi.timestamp += kWifiCycles;
-	}
-#endif
-	
-	if(divider.isTriggered()) divider.exec();
-	if(sqrtunit.isTriggered()) sqrtunit.exec();
-	if(gxfifo.isTriggered()) gxfifo.exec();
+	case ESI_DISPCNT_HStart:
+		execHardware_hstart();
+		//(used to be 3168)
+		//hstart is actually 8 dots before the visible drawing begins
+		//we're going to run 1 here and then run 7 in the next case
+		sequencer.dispcnt.timestamp += 1*6*2;
+		sequencer.dispcnt.param = ESI_DISPCNT_HStartIRQ;
+		break;
+	case ESI_DISPCNT_HStartIRQ:
+		execHardware_hstart_irq();
+		sequencer.dispcnt.timestamp += 7*6*2;
+		sequencer.dispcnt.param = ESI_DISPCNT_HDraw;
+		break;
+		
+	case ESI_DISPCNT_HDraw:
+		execHardware_hdraw();
+		//duration of non-blanking period is ~1606 clocks (gbatek agrees) [but says its different on arm7]
+		//im gonna call this 267 dots = 267*6=1602
+		//so, this event lasts 267 dots minus the 8 dot preroll
+		sequencer.dispcnt.timestamp += (267-8)*6*2;
+		sequencer.dispcnt.param = ESI_DISPCNT_HBlank;
+		break;
 
+	case ESI_DISPCNT_HBlank:
+		execHardware_hblank();
+		//(once this was 1092 or 1092/12=91 dots.)
+		//there are surely 355 dots per scanline, less 267 for non-blanking period. the rest is hblank and then after that is hstart
+		sequencer.dispcnt.timestamp += (355-267)*6*2;
+		sequencer.dispcnt.param = ESI_DISPCNT_HStart;
+		break;
+	}
+}
 
-#define test(X,Y) if(dma_##X##_##Y .isTriggered()) dma_##X##_##Y .exec();
-	test(0,0); test(0,1); test(0,2); test(0,3);
-	test(1,0); test(1,1); test(1,2); test(1,3);
-#undef test
-#define test(X,Y) if(timer_##X##_##Y .enabled) if(timer_##X##_##Y .isTriggered()) timer_##X##_##Y .exec();
-	test(0,0); test(0,1); test(0,2); test(0,3);
-	test(1,0); test(1,1); test(1,2); test(1,3);
-#undef test
+static void execHardware_wifi()
+{
+#ifdef EXPERIMENTAL_WIFI_COMM
+	//the microseconds up to this one only count, this one is where something happens
+	TSequenceItem_wifi& wifi = sequencer.wifi;
+	if(wifi.param > 1) WIFI_usAdvance(wifi.param - 1);
+	WIFI_usTrigger();
+	wifi.param = WIFI_usUntilNextEvent();
+	wifi.timestamp += wifi.param*kWifiCycles;
+#endif
 }
 
 void execHardware_interrupts();
@@ -1648,77 +2307,22 @@ bool nds_loadstate(EMUFILE* is, int size)
 	return temp;
 }
 
-FORCEINLINE void arm9log()
+//the instruction the cpu is about to run, into the trace if one is being written. the jit runs a block at a time,
+//so it only has the block's first instruction, which nothing has fetched yet
+template<int PROCNUM, bool jit>
+FORCEINLINE static void armlog(u64 cycle)
 {
-#ifdef LOG_ARM9
-	if(dolog)
+	if(!armtrace_active) return;
+	armcpu_t* const cpu = &ARMPROC;
+	const u32 thumb = cpu->CPSR.bits.T ? ARMTRACE_THUMB : 0;
+	if(jit)
 	{
-		char dasmbuf[4096];
-		if(NDS_ARM9.CPSR.bits.T)
-			des_thumb_instructions_set[((NDS_ARM9.instruction)>>6)&1023](NDS_ARM9.instruct_adr, NDS_ARM9.instruction, dasmbuf);
-		else
-			des_arm_instructions_set[INDEX(NDS_ARM9.instruction)](NDS_ARM9.instruct_adr, NDS_ARM9.instruction, dasmbuf);
-
-#ifdef LOG_TO_FILE
-		if (!fp_dis9) return;
-#ifdef LOG_TO_FILE_REGS
-		fprintf(fp_dis9, "\t\t;%05d:%03d %12lld\n\t\t;R0:%08X R1:%08X R2:%08X R3:%08X R4:%08X R5:%08X R6:%08X R7:%08X R8:%08X R9:%08X\n\t\t;R10:%08X R11:%08X R12:%08X R13:%08X R14:%08X R15:%08X| next %08X, N:%i Z:%i C:%i V:%i\n",
-			currFrameCounter, nds.VCount, nds_timer,
-			NDS_ARM9.R[0],  NDS_ARM9.R[1],  NDS_ARM9.R[2],  NDS_ARM9.R[3],  NDS_ARM9.R[4],  NDS_ARM9.R[5],  NDS_ARM9.R[6],  NDS_ARM9.R[7], 
-			NDS_ARM9.R[8],  NDS_ARM9.R[9],  NDS_ARM9.R[10],  NDS_ARM9.R[11],  NDS_ARM9.R[12],  NDS_ARM9.R[13],  NDS_ARM9.R[14],  NDS_ARM9.R[15],
-			NDS_ARM9.next_instruction, NDS_ARM9.CPSR.bits.N, NDS_ARM9.CPSR.bits.Z, NDS_ARM9.CPSR.bits.C, NDS_ARM9.CPSR.bits.V);
-#endif
-		fprintf(fp_dis9, "%s %08X\t%08X \t%s\n", NDS_ARM9.CPSR.bits.T?"THUMB":"ARM", NDS_ARM9.instruct_adr, NDS_ARM9.instruction, dasmbuf);
-		/*if (NDS_ARM9.instruction == 0)
-		{
-			dolog = false;
-			INFO("Disassembler is stopped\n");
-		}*/
-#else
-		printf("%05d:%03d %12lld 9:%08X %08X %-30s R00:%08X R01:%08X R02:%08X R03:%08X R04:%08X R05:%08X R06:%08X R07:%08X R08:%08X R09:%08X R10:%08X R11:%08X R12:%08X R13:%08X R14:%08X R15:%08X\n",
-			currFrameCounter, nds.VCount, nds_timer, 
-			NDS_ARM9.instruct_adr,NDS_ARM9.instruction, dasmbuf, 
-			NDS_ARM9.R[0],  NDS_ARM9.R[1],  NDS_ARM9.R[2],  NDS_ARM9.R[3],  NDS_ARM9.R[4],  NDS_ARM9.R[5],  NDS_ARM9.R[6],  NDS_ARM9.R[7], 
-			NDS_ARM9.R[8],  NDS_ARM9.R[9],  NDS_ARM9.R[10],  NDS_ARM9.R[11],  NDS_ARM9.R[12],  NDS_ARM9.R[13],  NDS_ARM9.R[14],  NDS_ARM9.R[15]);  
-#endif
-	}
-#endif
-}
-
-FORCEINLINE void arm7log()
-{
-#ifdef LOG_ARM7
-	if(dolog)
-	{
-		char dasmbuf[4096];
-		if(NDS_ARM7.CPSR.bits.T)
-			des_thumb_instructions_set[((NDS_ARM7.instruction)>>6)&1023](NDS_ARM7.instruct_adr, NDS_ARM7.instruction, dasmbuf);
-		else
-			des_arm_instructions_set[INDEX(NDS_ARM7.instruction)](NDS_ARM7.instruct_adr, NDS_ARM7.instruction, dasmbuf);
-#ifdef LOG_TO_FILE
-		if (!fp_dis7) return;
-#ifdef LOG_TO_FILE_REGS
-		fprintf(fp_dis7, "\t\t;%05d:%03d %12lld\n\t\t;R0:%08X R1:%08X R2:%08X R3:%08X R4:%08X R5:%08X R6:%08X R7:%08X R8:%08X R9:%08X\n\t\t;R10:%08X R11:%08X R12:%08X R13:%08X R14:%08X R15:%08X| next %08X, N:%i Z:%i C:%i V:%i\n",
-			currFrameCounter, nds.VCount, nds_timer, 
-			NDS_ARM7.R[0],  NDS_ARM7.R[1],  NDS_ARM7.R[2],  NDS_ARM7.R[3],  NDS_ARM7.R[4],  NDS_ARM7.R[5],  NDS_ARM7.R[6],  NDS_ARM7.R[7], 
-			NDS_ARM7.R[8],  NDS_ARM7.R[9],  NDS_ARM7.R[10],  NDS_ARM7.R[11],  NDS_ARM7.R[12],  NDS_ARM7.R[13],  NDS_ARM7.R[14],  NDS_ARM7.R[15],
-			NDS_ARM7.next_instruction, NDS_ARM7.CPSR.bits.N, NDS_ARM7.CPSR.bits.Z, NDS_ARM7.CPSR.bits.C, NDS_ARM7.CPSR.bits.V);
-#endif
-		fprintf(fp_dis7, "%s %08X\t%08X \t%s\n", NDS_ARM7.CPSR.bits.T?"THUMB":"ARM", NDS_ARM7.instruct_adr, NDS_ARM7.instruction, dasmbuf);
-		/*if (NDS_ARM7.instruction == 0)
-		{
-			dolog = false;
-			INFO("Disassembler is stopped\n");
-		}*/
-#else		
-		printf("%05d:%03d %12lld 7:%08X %08X %-30s R00:%08X R01:%08X R02:%08X R03:%08X R04:%08X R05:%08X R06:%08X R07:%08X R08:%08X R09:%08X R10:%08X R11:%08X R12:%08X R13:%08X R14:%08X R15:%08X\n",
-			currFrameCounter, nds.VCount, nds_timer, 
-			NDS_ARM7.instruct_adr,NDS_ARM7.instruction, dasmbuf, 
-			NDS_ARM7.R[0],  NDS_ARM7.R[1],  NDS_ARM7.R[2],  NDS_ARM7.R[3],  NDS_ARM7.R[4],  NDS_ARM7.R[5],  NDS_ARM7.R[6],  NDS_ARM7.R[7], 
-			NDS_ARM7.R[8],  NDS_ARM7.R[9],  NDS_ARM7.R[10],  NDS_ARM7.R[11],  NDS_ARM7.R[12],  NDS_ARM7.R[13],  NDS_ARM7.R[14],  NDS_ARM7.R[15]);
-#endif
+		const u32 adr = cpu->instruct_adr;
+		const u32 opcode = thumb ? _MMU_read16<PROCNUM, MMU_AT_DEBUG>(adr) : _MMU_read32<PROCNUM, MMU_AT_DEBUG>(adr);
+		armtrace_write(PROCNUM, adr, opcode, thumb | ARMTRACE_BLOCK, cycle, cpu);
 	}
-#endif
+	else
+		armtrace_write(PROCNUM, cpu->instruct_adr, cpu->instruction, thumb, cycle, cpu);
 }
 
 //these have not been tuned very well yet.
@@ -1738,6 +2342,27 @@ static FORCEINLINE s32 minarmtime(s32 arm9, s32 arm7)
 		return arm7;
 }
 
+//the interpreter runs a cpu instruction after instruction for as long as armInnerLoop would keep choosing it, with
+//the cycles added up here instead of the loop going around for each one: until it is budget cycles (of the arm9)
+//further on, an event comes up, or it halts, idles or waits for the bus. the loop is left to step through the
+//instructions one by one while they are traced
+template<int PROCNUM>
+FORCEINLINE static s32 armRun(const u64 nds_timer_base, const s32 clock, const s32 other, const s32 budget)
+{
+	armcpu_t* const cpu = &ARMPROC;
+	if(armtrace_active)
+		return armcpu_exec<PROCNUM>() << PROCNUM;
+
+	cpuRunBudget = budget;
+	s32 cycles = 0;
+	do
+	{
+		cycles += armcpu_exec<PROCNUM>() << PROCNUM;
+		nds_timer = nds_timer_base + min(clock + cycles, other);
+	} while(cycles <= cpuRunBudget && execute && !cpu->waitIRQ && !cpu->idleLoop && !nds.freezeBus);
+	return cycles;
+}
+
 #ifdef HAVE_JIT
 template<bool doarm9, bool doarm7, bool jit>
 #else
@@ -1747,22 +2372,42 @@ static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 	const u64 nds_timer_base, const s32 s32next, s32 arm9, s32 arm7)
 {
 	s32 timer = minarmtime<doarm9,doarm7>(arm9,arm7);
+	//while the cpus may be out of step, the one whose turn it is runs until it is cpuSkew ahead or reaches s32next
+	bool turn9 = arm9 <= arm7;
 	while(timer < s32next && !sequencer.reschedule && execute)
 	{
-		if(doarm9 && (!doarm7 || arm9 <= timer))
+		if(doarm9 && (!doarm7 || (cpuSkew ? turn9 : arm9 <= timer)))
 		{
 			if(!NDS_ARM9.waitIRQ&&!nds.freezeBus)
 			{
-				arm9log();
+#ifdef HAVE_JIT
+				armlog<ARMCPU_ARM9,jit>(nds_timer_base + arm9);
+#else
+				armlog<ARMCPU_ARM9,false>(nds_timer_base + arm9);
+#endif
 				debug();
+				//blocks may chain, and the interpreter run, for as long as this loop would keep running the arm9 on its own
+				const s32 budget = (doarm7 ? min(arm7 + cpuSkew, s32next - 1) : s32next - 1) - arm9;
 #ifdef HAVE_JIT
-				arm9 += armcpu_exec<ARMCPU_ARM9,jit>();
+				if(jit) arm_jit_chain.budget = budget;
+				arm9 += jit ? armcpu_exec<ARMCPU_ARM9,true>() : armRun<ARMCPU_ARM9>(nds_timer_base, arm9, doarm7 ? arm7 : s32next, budget);
 #else
-				arm9 += armcpu_exec<ARMCPU_ARM9>();
+				arm9 += armRun<ARMCPU_ARM9>(nds_timer_base, arm9, doarm7 ? arm7 : s32next, budget);
 #endif
 				#ifdef DEVELOPER
 					nds_debug_continuing[0] = false;
 				#endif
+				if(NDS_ARM9.idleLoop)
+				{
+					//spinning in a loop that only polls memory: skip ahead as if it were halted
+					NDS_ARM9.idleLoop = FALSE;
+					if(arm9 < s32next)
+					{
+						s32 temp = arm9;
+						arm9 = min(s32next, arm9 + kIrqWait);
+						nds.idleCycles[0] += arm9-temp;
+					}
+				}
 			}
 			else
 			{
@@ -1771,20 +2416,37 @@ static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 				nds.idleCycles[0] += arm9-temp;
 				if (gxFIFO.size < 255) nds.freezeBus &= ~1;
 			}
+			if(arm9 > arm7 + cpuSkew || arm9 >= s32next) turn9 = false;
 		}
-		if(doarm7 && (!doarm9 || arm7 <= timer))
+		if(doarm7 && (!doarm9 || (cpuSkew ? !turn9 : arm7 <= timer)))
 		{
 			if(!NDS_ARM7.waitIRQ&&!nds.freezeBus)
 			{
-				arm7log();
 #ifdef HAVE_JIT
-				arm7 += (armcpu_exec<ARMCPU_ARM7,jit>()<<1);
+				armlog<ARMCPU_ARM7,jit>(nds_timer_base + arm7);
+#else
+				armlog<ARMCPU_ARM7,false>(nds_timer_base + arm7);
+#endif
+				const s32 budget = (doarm9 ? min(arm9 + cpuSkew, s32next - 1) : s32next - 1) - arm7;
+#ifdef HAVE_JIT
+				if(jit) arm_jit_chain.budget = budget >> 1;
+				arm7 += jit ? (armcpu_exec<ARMCPU_ARM7,true>()<<1) : armRun<ARMCPU_ARM7>(nds_timer_base, arm7, doarm9 ? arm9 : s32next, budget);
 #else
-				arm7 += (armcpu_exec<ARMCPU_ARM7>()<<1);
+				arm7 += armRun<ARMCPU_ARM7>(nds_timer_base, arm7, doarm9 ? arm9 : s32next, budget);
 #endif
 				#ifdef DEVELOPER
 					nds_debug_continuing[1] = false;
 				#endif
+				if(NDS_ARM7.idleLoop)
+				{
+					NDS_ARM7.idleLoop = FALSE;
+					if(arm7 < s32next)
+					{
+						s32 temp = arm7;
+						arm7 = min(s32next, arm7 + kIrqWait);
+						nds.idleCycles[1] += arm7-temp;
+					}
+				}
 			}
 			else
 			{
@@ -1801,6 +2463,7 @@ static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 #endif
 				}
 			}
+			if(arm7 > arm9 + cpuSkew || arm7 >= s32next) turn9 = true;
 		}
 
 		timer = minarmtime<doarm9,doarm7>(arm9,arm7);
@@ -1832,8 +2495,10 @@ void NDS_debug_step()
 template<bool FORCE>
 void NDS_exec(s32 nb)
 {
+	PROFILE_ZONE(PROFILE_NDS_EXEC);
+
 	#ifdef GDB_STUB
-	gdbstub_mutex_lock();
+	const bool gdbLocked = gdbstub_frame_begin();
 	#endif
 
 	LagFrameFlag=1;
@@ -1842,6 +2507,12 @@ void NDS_exec(s32 nb)
 
 	nds.cpuloopIterationCount = 0;
 
+#ifdef HAVE_JIT
+	//compile some of the blocks the last run had, ahead of getting to them
+	if(CommonSettings.use_jit)
+		arm_jit_profile_warm();
+#endif
+
 	IF_DEVELOPER(for(int i=0;i<32;i++) DEBUG_statistics.sequencerExecutionCounters[i] = 0);
 
 	if(nds.sleeping)
@@ -1869,11 +2540,11 @@ void NDS_exec(s32 nb)
 					while((NDS_ARM9.stalled || NDS_ARM7.stalled) && execute)
 					{
 					        #ifdef GDB_STUB
-					        gdbstub_mutex_unlock();
+					        if(gdbLocked) gdbstub_mutex_unlock();
 					        #endif
 						driver->EMU_DebugIdleUpdate();
 					        #ifdef GDB_STUB
-					        gdbstub_mutex_lock();
+					        if(gdbLocked) gdbstub_mutex_lock();
 					        #endif
 						nds_debug_continuing[0] = nds_debug_continuing[1] = true;
 					}
@@ -1903,6 +2574,9 @@ void NDS_exec(s32 nb)
 
 			sequencer.reschedule = false;
 
+			if(cpuSkewHold) cpuSkewHold--;
+			cpuSkew = !cpuSkewHold ? CommonSettings.cpu_skew : 0;
+
 			//cast these down to 32bits so that things run faster on 32bit procs
 			u64 nds_timer_base = nds_timer;
 			s32 arm9 = (s32)(nds_arm9_timer-nds_timer);
@@ -1916,13 +2590,17 @@ void NDS_exec(s32 nb)
 				}
 			#endif
 
+			std::pair<s32,s32> arm9arm7;
+			{
+				PROFILE_ZONE(PROFILE_CPU_LOOP);
 #ifdef HAVE_JIT
-			std::pair<s32,s32> arm9arm7 = CommonSettings.use_jit
-				? armInnerLoop<true,true,true>(nds_timer_base,s32next,arm9,arm7)
-				: armInnerLoop<true,true,false>(nds_timer_base,s32next,arm9,arm7);
+				arm9arm7 = CommonSettings.use_jit
+					? armInnerLoop<true,true,true>(nds_timer_base,s32next,arm9,arm7)
+					: armInnerLoop<true,true,false>(nds_timer_base,s32next,arm9,arm7);
 #else
-				std::pair<s32,s32> arm9arm7 = armInnerLoop<true,true>(nds_timer_base,s32next,arm9,arm7);
+				arm9arm7 = armInnerLoop<true,true>(nds_timer_base,s32next,arm9,arm7);
 #endif
+			}
 
 			#ifdef DEVELOPER
 				if(singleStep)
@@ -1972,12 +2650,14 @@ void NDS_exec(s32 nb)
 		lagframecounter = 0;
 	}
 	currFrameCounter++;
+	bootstate_frame();
+	MMU_new.backupDevice.flushIdle();
 	DEBUG_Notify.NextFrame();
 	if (cheats)
 		cheats->process();
 
         #ifdef GDB_STUB
-        gdbstub_mutex_unlock();
+        gdbstub_frame_end(gdbLocked);
         #endif
 }
 
@@ -2204,27 +2884,6 @@ static void JumbleMemory()
 	//}
 }
 
-static void PrepareLogfiles()
-{
-#ifdef LOG_ARM7
-	if (fp_dis7 != NULL) 
-	{
-		fclose(fp_dis7);
-		fp_dis7 = NULL;
-	}
-	fp_dis7 = fopen("D:\\desmume_dis7.asm", "w");
-#endif
-
-#ifdef LOG_ARM9
-	if (fp_dis9 != NULL) 
-	{
-		fclose(fp_dis9);
-		fp_dis9 = NULL;
-	}
-	fp_dis9 = fopen("D:\\desmume_dis9.asm", "w");
-#endif
-}
-
 bool NDS_LegitBoot()
 {
 	#ifdef HAVE_JIT
@@ -2267,7 +2926,7 @@ bool NDS_FakeBoot()
 		bool okRom = DecryptSecureArea((u8*)&gameInfo.header, (u8*)gameInfo.secureArea);
 
 		if(!okRom) {
-			printf("Specified file is not a valid rom\n");
+			CORELOG_INFO("Specified file is not a valid rom\n");
 			return false;
 		}
 	}
@@ -2421,8 +3080,6 @@ bool NDS_FakeBoot()
 bool _HACK_DONT_STOPMOVIE = false;
 void NDS_Reset()
 {
-	PrepareLogfiles();
-
 	if(movieMode != MOVIEMODE_INACTIVE && !_HACK_DONT_STOPMOVIE)
 		movie_reset_command = true;
 
@@ -2519,6 +3176,9 @@ void NDS_Reset()
 
 	//this needs to happen last, pretty much, since it establishes the correct scheduling state based on all of the above initialization
 	initSchedule();
+
+	if(canBootFromFirmware && bootResult)
+		bootstate_reset();
 }
 
 static std::string MakeInputDisplayString(u16 pad, const std::string* Buttons, int count) {
@@ -2887,25 +3547,6 @@ void NDS_swapScreen()
 void emu_halt() {
 	//printf("halting emu: ARM9 PC=%08X/%08X, ARM7 PC=%08X/%08X\n", NDS_ARM9.R[15], NDS_ARM9.instruct_adr, NDS_ARM7.R[15], NDS_ARM7.instruct_adr);
 	execute = false;
-#ifdef LOG_ARM9
-	if (fp_dis9)
-	{
-		char buf[256] = { 0 };
-		sprintf(buf, "halting emu: ARM9 PC=%08X/%08X\n", NDS_ARM9.R[15], NDS_ARM9.instruct_adr);
-		fwrite(buf, 1, strlen(buf), fp_dis9);
-		INFO("ARM9 halted\n");
-	}
-#endif
-
-#ifdef LOG_ARM7
-	if (fp_dis7)
-	{
-		char buf[256] = { 0 };
-		sprintf(buf, "halting emu: ARM7 PC=%08X/%08X\n", NDS_ARM7.R[15], NDS_ARM7.instruct_adr);
-		fwrite(buf, 1, strlen(buf), fp_dis7);
-		INFO("ARM7 halted\n");
-	}
-#endif
 }
 
 //returns true if exmemcnt specifies satisfactory parameters for the device, which calls this function
@@ -81,9 +81,6 @@ enum
 	ROM_DSGBA
 };
 
-//#define LOG_ARM9
-//#define LOG_ARM7
-
 #include "PACKED.h"
 struct NDS_header
 {
@@ -149,6 +146,17 @@ void NDS_Reschedule();
 void NDS_RescheduleGXFIFO(u32 cost);
 void NDS_RescheduleDMA();
 void NDS_RescheduleTimers();
+void NDS_RescheduleDivider();
+void NDS_RescheduleSqrt();
+//the wifi counts its microseconds in bulk, up to the next one something happens in: bring it up to now before its
+//registers are looked at, and tell the sequencer after they are written
+void NDS_SyncWifi();
+void NDS_RescheduleWifi();
+//the cpus just exchanged something: stop letting them run out of step for a while (CommonSettings.cpu_skew)
+void NDS_SyncCpus();
+//the cpus are off the bus until cycles from now, as if a dma started now had frozen it (nds.freezeBus), for one that
+//was done on the spot instead of through the sequencer
+void NDS_StallCpus(s32 cycles);
 
 enum ENSATA_HANDSHAKE
 {
@@ -310,14 +318,35 @@ struct RomBanner
   //840h  -    End of Icon/Title structure (next 1C0h bytes usually FFh-filled)
 };
 
+//a rom file that is still being written while the game runs, like an archive member that is extracted in the background.
+//the writer raises available as the data comes in and sets it to 0xFFFFFFFF once it is done, or has given up
+class ROMStream
+{
+public:
+	ROMStream() : available(0xFFFFFFFF) {}
+	virtual ~ROMStream() {}
+	//blocks until the first end bytes of the file are there, or the writer is done
+	virtual void waitFor(u32 end) = 0;
+	volatile u32 available;
+};
+
 struct GameInfo
 {
 	FILE *fROM;
+	//set while the rom file is still coming in. reads from gameInfo wait for the part they need
+	ROMStream *stream;
+	//the whole rom, when it is loaded to memory or mapped. otherwise readROM streams it from fROM
 	u8	*romdata;
+	//the mapping romdata points into (past the header offset), if it is mapped
+	u8	*romMap;
+	size_t romMapSize;
 	u32 romsize;
 	u32 cardSize;
 	u32 mask;
+	//zlib's crc32 of the rom, worked out in the background after loading. 0 for a rom that is streamed from fROM
 	u32 crc;
+	//while the background hash is running
+	volatile bool crcPending;
 	u32 chipID;
 	u32 lastReadPos;
 	u32	romType;
@@ -332,8 +361,12 @@ struct GameInfo
 	const RomBanner& getRomBanner();
 
 	GameInfo() :	fROM(NULL),
+					stream(NULL),
 					romdata(NULL),
+					romMap(NULL),
+					romMapSize(0),
 					crc(0),
+					crcPending(false),
 					chipID(0x00000FC2),
 					romsize(0),
 					cardSize(0),
@@ -353,7 +386,21 @@ struct GameInfo
 	bool loadROM(std::string fname, u32 type = ROM_NDS);
 	void closeROM();
 	u32 readROM(u32 pos);
+	//reads count words starting at pos, all at once
+	void readROMBlock(u32 pos, u32* buf, u32 count);
+	//makes sure the rom is there up to end, when it is still streaming in
+	FORCEINLINE void waitROM(u32 end)
+	{
+		if (stream && end + headerOffset > stream->available)
+			stream->waitFor(end + headerOffset);
+	}
 	void populate();
+	//starts hashing romdata in the background
+	void startCRC();
+	//the crc, waiting for the hash if it is still running
+	u32 getCRC();
+	//the crc if the hash is done, 0 if not
+	u32 peekCRC() const { return __atomic_load_n(&crcPending, __ATOMIC_ACQUIRE) ? 0 : crc; }
 	bool isDSiEnhanced();
 	bool isHomebrew();
 	bool hasRomBanner();
@@ -454,6 +501,17 @@ void NDS_Sleep();
 void NDS_TriggerCardEjectIRQ();
 
 void NDS_SkipNextFrame();
+//skips only rendering the 3d of the next frame. the 2d goes on with the 3d of the frame before
+void NDS_SkipNext3DFrame();
+//whether one of the two has been called for the next frame, and whether it was NDS_SkipNextFrame
+bool NDS_SkipRequested(bool& with2D);
+//whether the 2d of the frame NDS_exec last ran was skipped, which leaves the previous frame in GPU_screen,
+//and whether its 3d was
+bool NDS_Skipped2DFrame();
+bool NDS_Skipped3DFrame();
+//whether the game is showing 3d on both screens, by swapping them and capturing every frame. frames are skipped
+//by pairs while it is, so that both screens get drawn
+bool NDS_DualScreen3D();
 #define NDS_SkipFrame(s) if(s) NDS_SkipNext2DFrame();
 void NDS_OmitFrameSkip(int force=0);
 
@@ -480,7 +538,17 @@ extern struct TCommonSettings {
 		, GFX3D_Zelda_Shadow_Depth_Hack(0)
 		, GFX3D_Renderer_Multisample(false)
 		, GFX3D_TXTHack(false)
+		, GFX3D_PipelinedRender(false)
+		, GFX3D_GPUComposite(false)
+		, GFX3D_SoftRastScale(1)
+		, GFX3D_SoftRastCores(0)
+		, GFX3D_TexCacheDisk(false)
+		, GFX2D_ParallelEngines(false)
+		, GFX3D_ThreadedGeometry(false)
 		, jit_max_block_size(100)
+		, jit_cache_size(32)
+		, hle_sdk(true)
+		, game_presets(true)
 		, loadToMemory(false)
 		, UseExtBIOS(false)
 		, SWIFromBIOS(false)
@@ -488,6 +556,7 @@ extern struct TCommonSettings {
 		, UseExtFirmware(false)
 		, UseExtFirmwareSettings(false)
 		, BootFromFirmware(false)
+		, BootStateCache(false)
 		, DebugConsole(false)
 		, EnsataEmulation(false)
 		, cheatsDisable(false)
@@ -527,6 +596,7 @@ extern struct TCommonSettings {
 #else
 		use_jit = false;
 #endif
+		cpu_skew = 0;
 
 		num_cores = NDS_GetCPUCoreCount();
 		NDS_SetupDefaultFirmware();
@@ -539,6 +609,21 @@ extern struct TCommonSettings {
 	int  GFX3D_Zelda_Shadow_Depth_Hack;
 	bool GFX3D_Renderer_Multisample;
 	bool GFX3D_TXTHack;
+	//lets the 3d renderer finish a frame while the next one is emulated, at the cost of a frame of 3d latency
+	bool GFX3D_PipelinedRender;
+	//leave the 3d on the gpu for the frontend to mix with the 2d (see GPUCompositeFrame). the frontend sets this
+	//only while it can present such frames, and the renderers that can't keep their frame there ignore it
+	bool GFX3D_GPUComposite;
+	//multiple of the native resolution the software rasterizer renders at. the frame is scaled back down for the 2d engine
+	int GFX3D_SoftRastScale;
+	//the most cores the software rasterizer's units go on, 0 for all it has
+	int GFX3D_SoftRastCores;
+	//keep decoded textures in a file next to the battery save, so they needn't be decoded again next session
+	bool GFX3D_TexCacheDisk;
+	//render the sub 2d engine's scanlines on a worker thread while the main engine renders its own
+	bool GFX2D_ParallelEngines;
+	//run the geometry engine's commands on a worker thread, while the fifo and its timing stay with the emulation
+	bool GFX3D_ThreadedGeometry;
 
 	bool loadToMemory;
 
@@ -552,6 +637,8 @@ extern struct TCommonSettings {
 	bool UseExtFirmwareSettings;
 	char Firmware[256];
 	bool BootFromFirmware;
+	//the firmware boot starts from a boot state, after the first one (see bootstate_reset)
+	bool BootStateCache;
 	NDS_fw_config_data fw_config;
 
 	NDS_CONSOLE_TYPE ConsoleType;
@@ -573,6 +660,12 @@ extern struct TCommonSettings {
 
 	bool use_jit;
 	u32	jit_max_block_size;
+	u32 jit_cache_size; //MB of generated code kept before the cache is flushed, applied by arm_jit_reset
+	s32 cpu_skew; //cycles one cpu may run ahead of the other before they switch, 0 to keep them in lockstep
+	//run the sdk's memory copy and fill routines natively (hle_sdk.h)
+	bool hle_sdk;
+	//apply the game's settings from the preset database and the user's file for it when it loads (gamepreset.h)
+	bool game_presets;
 	
 	struct _Wifi {
 		int mode;
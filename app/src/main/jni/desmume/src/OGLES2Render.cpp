@@ -19,14 +19,25 @@
 
 #include "OGLES2Render.h"
 
+#include <algorithm>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "bits.h"
 #include "debug.h"
 #include "gfx3d.h"
+#include "MMU.h"
 #include "NDSSystem.h"
+#include "path.h"
 #include "texcache.h"
 
+#if defined(ENABLE_SSE2)
+#include <emmintrin.h>
+#elif defined(ENABLE_NEON)
+#include <arm_neon.h>
+#endif
+
 
 typedef struct
 {
@@ -129,6 +140,17 @@ OGLEXT(PFNGLFRAMEBUFFERTEXTUREEXTPROC, glFramebufferTextureEXT)
 OGLEXT(PFNGLDELETEFRAMEBUFFERSPROC, glESDeleteFramebuffers)
 //OGLEXT(PFNGLBLITFRAMEBUFFERANGLEPROC, glBlitFramebufferANGLE)
 
+// PBO readback
+OGLEXT(PFNGLMAPBUFFERRANGEPROC, glESMapBufferRange)
+OGLEXT(PFNGLUNMAPBUFFERPROC, glESUnmapBuffer)
+OGLEXT(PFNGLFENCESYNCPROC, glESFenceSync)
+OGLEXT(PFNGLCLIENTWAITSYNCPROC, glESClientWaitSync)
+OGLEXT(PFNGLDELETESYNCPROC, glESDeleteSync)
+
+// Program binaries
+OGLEXT(PFNGLGETPROGRAMBINARYOESPROC, glGetProgramBinaryOES)
+OGLEXT(PFNGLPROGRAMBINARYOESPROC, glProgramBinaryOES)
+
 static void OGLES2LoadEntryPoints()
 {
 	// Textures
@@ -182,6 +204,10 @@ static void OGLES2LoadEntryPoints()
 	INITOGLEXT(PFNGLMAPBUFFEROESPROC, glMapBufferOES)
 	INITOGLEXT(PFNGLUNMAPBUFFEROESPROC, glUnmapBufferOES)
 
+// Program binaries
+	INITOGLEXT(PFNGLGETPROGRAMBINARYOESPROC, glGetProgramBinaryOES)
+	INITOGLEXT(PFNGLPROGRAMBINARYOESPROC, glProgramBinaryOES)
+
 // FBO
 	INITOGLEXT(PFNGLGENFRAMEBUFFERSPROC, glESGenFramebuffers)
 	INITOGLEXT(PFNGLBINDFRAMEBUFFERPROC, glESBindFramebuffer)
@@ -192,6 +218,13 @@ static void OGLES2LoadEntryPoints()
 	INITOGLEXT(PFNGLDELETEFRAMEBUFFERSPROC, glESDeleteFramebuffers)
 	//INITOGLEXT(PFNGLBLITFRAMEBUFFERANGLEPROC, glBlitFramebufferANGLE)
 
+// PBO readback. These are core GLES3 functions, so they're looked up by their
+// real names, and stay NULL when the driver only gave us a GLES2 context.
+	glESMapBufferRange = (PFNGLMAPBUFFERRANGEPROC)eglGetProcAddress("glMapBufferRange");
+	glESUnmapBuffer = (PFNGLUNMAPBUFFERPROC)eglGetProcAddress("glUnmapBuffer");
+	glESFenceSync = (PFNGLFENCESYNCPROC)eglGetProcAddress("glFenceSync");
+	glESClientWaitSync = (PFNGLCLIENTWAITSYNCPROC)eglGetProcAddress("glClientWaitSync");
+	glESDeleteSync = (PFNGLDELETESYNCPROC)eglGetProcAddress("glDeleteSync");
 }
 
 // Vertex Shader GLSL 1.00
@@ -221,84 +254,119 @@ static const char *vertexShader_100 = {"\
 "};
 
 // Fragment Shader GLSL 1.00
+//
+// The render states that only change between frames or polygon modes are
+// compiled in through the ENABLE_TEXTURE, POLYGON_MODE, TOON_SHADING_MODE and
+// ENABLE_ALPHA_TEST macros, so each variant is left with only the code its
+// polygons run. See OpenGLES2Renderer::CreateShaderVariant().
+//
+// A texture in an atlas can't use the sampler's wrap modes, so with
+// ENABLE_TEXTURE_ATLAS the coordinate is repeated, mirrored or clamped here
+// within the texture (atlasWrap is the repeat and the mirror of S and T), kept
+// half a texel inside its edges (atlasClamp), and then moved into its cell
+// (atlasRect is the cell's origin and the texture's size, in the atlas).
+//
+// With ENABLE_ATTRIBUTES the second color attachment gets what the post pass
+// needs: the polygon ID and the fog flag (polyAttribute), the low and high
+// bytes of the depth, and whether the pixel is opaque. The alpha of a
+// translucent pixel is 0, so its blending leaves the opaque pixel's attributes
+// under it, which are the ones the edge marking goes by.
 static const char *fragmentShader_100 = {"\
+	#if ENABLE_ATTRIBUTES \n\
+	#extension GL_EXT_draw_buffers : require \n\
+	#endif \n\
 	precision mediump float; \n\
 	varying vec4 vtxPosition; \n\
+	#if ENABLE_TEXTURE_ATLAS && defined(GL_FRAGMENT_PRECISION_HIGH) \n\
+	varying highp vec2 vtxTexCoord; \n\
+	#else \n\
 	varying vec2 vtxTexCoord; \n\
+	#endif \n\
 	varying vec4 vtxColor; \n\
 	\n\
 	uniform sampler2D texMainRender; \n\
 	uniform sampler2D texToonTable; \n\
 	uniform int polyID; \n\
-	uniform bool hasTexture; \n\
-	uniform int polygonMode; \n\
-	uniform int toonShadingMode; \n\
-	uniform int oglWBuffer; \n\
-	uniform bool enableAlphaTest; \n\
 	uniform float alphaTestRef; \n\
+	#if ENABLE_TEXTURE_ATLAS \n\
+	uniform vec4 atlasRect; \n\
+	uniform vec4 atlasWrap; \n\
+	uniform vec4 atlasClamp; \n\
+	#endif \n\
+	#if ENABLE_ATTRIBUTES \n\
+	uniform float polyAttribute; \n\
+	#endif \n\
 	\n\
 	void main() \n\
 	{ \n\
+	#if ENABLE_TEXTURE && ENABLE_TEXTURE_ATLAS \n\
+		vec2 repeated = mix(fract(vtxTexCoord), 1.0 - abs(mod(vtxTexCoord, 2.0) - 1.0), atlasWrap.zw); \n\
+		vec2 texCoord = clamp(mix(vtxTexCoord, repeated, atlasWrap.xy), atlasClamp.xy, atlasClamp.zw); \n\
+		vec4 texColor = texture2D(texMainRender, atlasRect.xy + texCoord * atlasRect.zw); \n\
+	#elif ENABLE_TEXTURE \n\
+		vec4 texColor = texture2D(texMainRender, vtxTexCoord); \n\
+	#else \n\
 		vec4 texColor = vec4(1.0, 1.0, 1.0, 1.0); \n\
-		vec4 fragColor; \n\
+	#endif \n\
+		vec4 fragColor = texColor; \n\
 		\n\
-		if(hasTexture) \n\
+	#if POLYGON_MODE == 0 \n\
+		fragColor = vtxColor * texColor; \n\
+	#elif POLYGON_MODE == 1 \n\
+	#if ENABLE_TEXTURE \n\
+		if (texColor.a == 0.0) \n\
 		{ \n\
-			texColor = texture2D(texMainRender, vtxTexCoord); \n\
+			fragColor.rgb = vtxColor.rgb; \n\
 		} \n\
-		\n\
-		fragColor = texColor; \n\
-		\n\
-		if(polygonMode == 0) \n\
-		{ \n\
-			fragColor = vtxColor * texColor; \n\
-		} \n\
-		else if(polygonMode == 1) \n\
+		else if (texColor.a == 1.0) \n\
 		{ \n\
-			if (texColor.a == 0.0 || !hasTexture) \n\
-			{ \n\
-				fragColor.rgb = vtxColor.rgb; \n\
-			} \n\
-			else if (texColor.a == 1.0) \n\
-			{ \n\
-				fragColor.rgb = texColor.rgb; \n\
-			} \n\
-			else \n\
-			{ \n\
-				fragColor.rgb = texColor.rgb * (1.0-texColor.a) + vtxColor.rgb * texColor.a;\n\
-			} \n\
-			\n\
-			fragColor.a = vtxColor.a; \n\
+			fragColor.rgb = texColor.rgb; \n\
 		} \n\
-		else if(polygonMode == 2) \n\
+		else \n\
 		{ \n\
-			if (toonShadingMode == 0) \n\
-			{ \n\
-				vec3 toonColor = vec3(texture2D(texToonTable, vec2(vtxColor.r,0)).rgb); \n\
-				fragColor.rgb = texColor.rgb * toonColor.rgb;\n\
-				fragColor.a = texColor.a * vtxColor.a;\n\
-			} \n\
-			else \n\
-			{ \n\
-				vec3 toonColor = vec3(texture2D(texToonTable, vec2(vtxColor.r,0)).rgb); \n\
-				fragColor.rgb = texColor.rgb * vtxColor.rgb + toonColor.rgb; \n\
-				fragColor.a = texColor.a * vtxColor.a; \n\
-			} \n\
+			fragColor.rgb = texColor.rgb * (1.0-texColor.a) + vtxColor.rgb * texColor.a;\n\
 		} \n\
-		else if(polygonMode == 3) \n\
+	#else \n\
+		fragColor.rgb = vtxColor.rgb; \n\
+	#endif \n\
+		fragColor.a = vtxColor.a; \n\
+	#elif POLYGON_MODE == 2 \n\
+		vec3 toonColor = vec3(texture2D(texToonTable, vec2(vtxColor.r,0)).rgb); \n\
+	#if TOON_SHADING_MODE == 0 \n\
+		fragColor.rgb = texColor.rgb * toonColor.rgb;\n\
+	#else \n\
+		fragColor.rgb = texColor.rgb * vtxColor.rgb + toonColor.rgb; \n\
+	#endif \n\
+		fragColor.a = texColor.a * vtxColor.a;\n\
+	#elif POLYGON_MODE == 3 \n\
+		if (polyID != 0) \n\
 		{ \n\
-			if (polyID != 0) \n\
-			{ \n\
-				fragColor = vtxColor; \n\
-			} \n\
+			fragColor = vtxColor; \n\
 		} \n\
+	#endif \n\
 		\n\
-		if (fragColor.a == 0.0 || (enableAlphaTest && fragColor.a < alphaTestRef)) \n\
+	#if ENABLE_ALPHA_TEST \n\
+		if (fragColor.a == 0.0 || fragColor.a < alphaTestRef) \n\
+	#else \n\
+		if (fragColor.a == 0.0) \n\
+	#endif \n\
 		{ \n\
 			discard; \n\
 		} \n\
 		\n\
+	#if ENABLE_ATTRIBUTES \n\
+	#ifdef GL_FRAGMENT_PRECISION_HIGH \n\
+		highp float depth = floor(gl_FragCoord.z * 65535.0 + 0.5); \n\
+		highp float depthHigh = floor(depth / 256.0); \n\
+	#else \n\
+		float depth = floor(gl_FragCoord.z * 65535.0 + 0.5); \n\
+		float depthHigh = floor(depth / 256.0); \n\
+	#endif \n\
+		gl_FragData[0] = fragColor; \n\
+		gl_FragData[1] = vec4(polyAttribute, (depth - depthHigh * 256.0) / 255.0, depthHigh / 255.0, (fragColor.a == 1.0) ? 1.0 : 0.0); \n\
+	#else \n\
 		gl_FragColor = fragColor; \n\
+	#endif \n\
 	} \n\
 "
         /*"\
@@ -358,6 +426,169 @@ static const char *fragmentShader_100 = {"\
 	} \n\
 "*/};
 
+// Post Pass Shaders GLSL 1.00
+//
+// The post pass does what the rasterizer's framebufferProcess() does, the edge
+// marking and then the fog, in one full-screen draw that reads the frame's
+// color and attributes once. It works in the DS's color formats (6 bits of red,
+// green and blue, 5 of alpha) so that it comes out the same. The rasterizer
+// has each pixel draw its edges onto its neighbours. Here each pixel looks for
+// the neighbours that would draw onto it, in the order the rasterizer gets to
+// them, so it needs the polygon IDs of the 5x5 pixels around it. As with the
+// rasterizer, the antialiasing is the half alpha of the edge colors.
+//
+// With USE_FRAMEBUFFER_FETCH there is no edge marking, and the pass is drawn
+// over the frame where it already is, reading each pixel's own color and
+// attributes through gl_LastFragData. A tiled GPU can then do it in the tile,
+// without writing the attachments out to be sampled first.
+static const char *postVertexShader_100 = {"\
+	attribute vec2 inPosition; \n\
+	\n\
+	void main() \n\
+	{ \n\
+		gl_Position = vec4(inPosition, 0.0, 1.0); \n\
+	} \n\
+"};
+
+static const char *postFragmentShader_100 = {"\
+	#if USE_FRAMEBUFFER_FETCH \n\
+	#extension GL_EXT_shader_framebuffer_fetch : require \n\
+	#extension GL_EXT_draw_buffers : require \n\
+	#endif \n\
+	#ifdef GL_FRAGMENT_PRECISION_HIGH \n\
+	precision highp float; \n\
+	#else \n\
+	precision mediump float; \n\
+	#endif \n\
+	\n\
+	uniform sampler2D texPostColor; \n\
+	uniform sampler2D texPostAttributes; \n\
+	uniform sampler2D texEdgeColor; \n\
+	uniform sampler2D texFogTable; \n\
+	uniform vec4 fogColor; \n\
+	\n\
+	const vec2 framebufferSize = vec2(256.0, 192.0); \n\
+	\n\
+	vec4 toDS(vec4 color) \n\
+	{ \n\
+		return floor(floor(color * 255.0 + 0.5) / vec4(4.0, 4.0, 4.0, 8.0)); \n\
+	} \n\
+	\n\
+	vec4 fromDS(vec4 color) \n\
+	{ \n\
+		return color * vec4(4.0, 4.0, 4.0, 8.0) / 255.0; \n\
+	} \n\
+	\n\
+	#if ENABLE_EDGE_MARK \n\
+	vec4 attributesAt(vec2 p) \n\
+	{ \n\
+		return texture2D(texPostAttributes, (p + 0.5) / framebufferSize); \n\
+	} \n\
+	\n\
+	bool inFramebuffer(vec2 p) \n\
+	{ \n\
+		return all(greaterThanEqual(p, vec2(0.0))) && all(lessThan(p, framebufferSize)); \n\
+	} \n\
+	\n\
+	float polyIDAt(vec2 p) \n\
+	{ \n\
+		return inFramebuffer(p) ? floor(floor(attributesAt(p).r * 255.0 + 0.5) / 2.0) : 255.0; \n\
+	} \n\
+	\n\
+	vec4 alphaBlend(vec4 dst, vec4 src) \n\
+	{ \n\
+	#if ENABLE_ALPHA_BLEND \n\
+		if (src.a == 31.0 || dst.a == 0.0) \n\
+		{ \n\
+			return src; \n\
+		} \n\
+		float alpha = src.a + 1.0; \n\
+		return vec4(floor((alpha * src.rgb + (32.0 - alpha) * dst.rgb) / 32.0), max(src.a, dst.a)); \n\
+	#else \n\
+		return (src.a != 0.0) ? src : dst; \n\
+	#endif \n\
+	} \n\
+	#endif \n\
+	\n\
+	void main() \n\
+	{ \n\
+	#if USE_FRAMEBUFFER_FETCH \n\
+		vec4 color = toDS(gl_LastFragData[0]); \n\
+		vec4 attributes = gl_LastFragData[1]; \n\
+	#else \n\
+		vec4 color = toDS(texture2D(texPostColor, gl_FragCoord.xy / framebufferSize)); \n\
+		vec4 attributes = texture2D(texPostAttributes, gl_FragCoord.xy / framebufferSize); \n\
+	#endif \n\
+		\n\
+	#if ENABLE_EDGE_MARK \n\
+		vec2 q = floor(gl_FragCoord.xy); \n\
+		float ids[25]; \n\
+		for (int y = 0; y < 5; y++) \n\
+		{ \n\
+			for (int x = 0; x < 5; x++) \n\
+			{ \n\
+				ids[y * 5 + x] = polyIDAt(q + vec2(float(x - 2), float(2 - y))); \n\
+			} \n\
+		} \n\
+		\n\
+		for (int sy = 0; sy < 3; sy++) \n\
+		{ \n\
+			for (int sx = 0; sx < 3; sx++) \n\
+			{ \n\
+				vec2 p = q + vec2(float(sx - 1), float(1 - sy)); \n\
+				if ((sx == 1 && sy == 1) || !inFramebuffer(p) || attributesAt(p).a < 0.5) \n\
+				{ \n\
+					continue; \n\
+				} \n\
+				\n\
+				float self = ids[sy * 5 + sx + 6]; \n\
+				bool upleft    = self > ids[sy * 5 + sx]; \n\
+				bool up        = self > ids[sy * 5 + sx + 1]; \n\
+				bool upright   = self > ids[sy * 5 + sx + 2]; \n\
+				bool left      = self > ids[sy * 5 + sx + 5]; \n\
+				bool right     = self > ids[sy * 5 + sx + 7]; \n\
+				bool downleft  = self > ids[sy * 5 + sx + 10]; \n\
+				bool down      = self > ids[sy * 5 + sx + 11]; \n\
+				bool downright = self > ids[sy * 5 + sx + 12]; \n\
+				\n\
+				int direction = (2 - sy) * 3 + (2 - sx); \n\
+				bool draws = (direction == 0) ? (upleft && upright && downleft && !downright) : \n\
+				             (direction == 1) ? (up && !down) : \n\
+				             (direction == 2) ? (upleft && upright && !downleft && downright) : \n\
+				             (direction == 3) ? (left && !right) : \n\
+				             (direction == 5) ? (right && !left) : \n\
+				             (direction == 6) ? (upleft && !upright && downleft && downright) : \n\
+				             (direction == 7) ? (down && !up) : \n\
+				                                (!upleft && upright && downleft && downright); \n\
+				if (draws) \n\
+				{ \n\
+					color = alphaBlend(color, toDS(texture2D(texEdgeColor, vec2((floor(self / 8.0) + 0.5) / 8.0, 0.5)))); \n\
+				} \n\
+			} \n\
+		} \n\
+	#endif \n\
+		\n\
+	#if ENABLE_FOG \n\
+		float idAndFog = floor(attributes.r * 255.0 + 0.5); \n\
+		if (idAndFog - 2.0 * floor(idAndFog / 2.0) > 0.5) \n\
+		{ \n\
+			float fog = floor(texture2D(texFogTable, (floor(attributes.gb * 255.0 + 0.5) + 0.5) / 256.0).r * 255.0 + 0.5); \n\
+	#if !FOG_ALPHA_ONLY \n\
+			color.rgb = floor(((128.0 - fog) * color.rgb + fogColor.rgb * fog) / 128.0); \n\
+	#endif \n\
+			color.a = floor(((128.0 - fog) * color.a + fogColor.a * fog) / 128.0); \n\
+		} \n\
+	#endif \n\
+		\n\
+	#if USE_FRAMEBUFFER_FETCH \n\
+		gl_FragData[0] = fromDS(color); \n\
+		gl_FragData[1] = attributes; \n\
+	#else \n\
+		gl_FragColor = fromDS(color); \n\
+	#endif \n\
+	} \n\
+"};
+
 //FORCEINLINE u32 BGRA8888_32_To_RGBA6665_32(const u32 srcPix)
 //{
 //	const u32 dstPix = (srcPix >> 2) & 0x3F3F3F3F;
@@ -757,8 +988,42 @@ void OpenGLESRenderer::ConvertFramebuffer(const u32 *__restrict srcBuffer, u32 *
 	for(int i = 0, y = 191; y >= 0; y--)
 	{
 		u32 *__restrict dst = dstBuffer + (y << 8); // Same as dstBuffer + (y * 256)
+		unsigned int x = 0;
+		
+#ifndef WORDS_BIGENDIAN
+		// The same as RGBA8888_32Rev_To_RGBA6665_32Rev(), 16 pixels at a time. Rows are
+		// 1KB and both buffers are word aligned, so there is never a partial group.
+#if defined(ENABLE_SSE2)
+		const __m128i mask6 = _mm_set1_epi32(0x3F3F3F3F);
+		const __m128i maskAlpha = _mm_set1_epi32(0xFF000000);
+		
+		for(; x < 256; x += 16, i += 16)
+		{
+			for(unsigned int k = 0; k < 16; k += 4)
+			{
+				const __m128i pix = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i *)(srcBuffer + i + k)), 2), mask6);
+				const __m128i alpha = _mm_and_si128(_mm_srli_epi32(pix, 1), maskAlpha);
+				_mm_storeu_si128((__m128i *)(dst + k), _mm_or_si128(alpha, _mm_andnot_si128(maskAlpha, pix)));
+			}
+			dst += 16;
+		}
+#elif defined(ENABLE_NEON)
+		const uint32x4_t mask6 = vdupq_n_u32(0x3F3F3F3F);
+		const uint32x4_t maskAlpha = vdupq_n_u32(0xFF000000);
+		
+		for(; x < 256; x += 16, i += 16)
+		{
+			for(unsigned int k = 0; k < 16; k += 4)
+			{
+				const uint32x4_t pix = vandq_u32(vshrq_n_u32(vld1q_u32(srcBuffer + i + k), 2), mask6);
+				vst1q_u32(dst + k, vbslq_u32(maskAlpha, vshrq_n_u32(pix, 1), pix));
+			}
+			dst += 16;
+		}
+#endif
+#endif
 		
-		for(unsigned int x = 0; x < 256; x++, i++)
+		for(; x < 256; x++, i++)
 		{
 			// Use the correct endian format since OpenGLES2 uses the native endian of
 			// the architecture it is running on.
@@ -776,12 +1041,42 @@ void OpenGLESRenderer::ConvertFramebuffer(const u32 *__restrict srcBuffer, u32 *
 OpenGLES2Renderer::OpenGLES2Renderer()
 {
 	isVBOSupported = false;
+	isMapBufferSupported = false;
+	isPBOSupported = false;
 	isFBOSupported = false;
 	isShaderSupported = false;
+	isProgramBinarySupported = false;
 	isVAOSupported = false;
+	isSyncSupported = false;
+	isPostProcessSupported = false;
+	isFramebufferFetchSupported = false;
+	isASTCSupported = false;
+	
+	shaderVariantKey = OGLShaderVariantFlag_AlphaTest;
+	currShaderVariantKey = OGLRENDER_SHADER_VARIANT_COUNT;
+	shaderCacheTag = 0;
+	shaderUniformsDirty = true;
+	shaderPolyID = 0;
+	shaderPolyAlpha = 1.0f;
+	shaderTexScale[0] = 1.0f;
+	shaderTexScale[1] = 1.0f;
+	shaderAlphaTestRef = 0.0f;
+	shaderPolyAttribute = 0.0f;
+	postProgramKey = 0;
+	postTablesNeedUpdate = true;
 	
 	// Init OpenGLES2 rendering states
 	ref = new OGLESRenderRef;
+	ref->fenceRenderData[0] = NULL;
+	ref->fenceRenderData[1] = NULL;
+	memset(ref->shaderVariant, 0, sizeof(ref->shaderVariant));
+	memset(ref->postProgram, 0, sizeof(ref->postProgram));
+	ref->fboPostRenderID = 0;
+	memset(ref->texCompositeID, 0, sizeof(ref->texCompositeID));
+	memset(ref->fenceComposite, 0, sizeof(ref->fenceComposite));
+	ref->compositeIndex = 0;
+	gpuScreen3DInFramebuffer[0] = false;
+	gpuScreen3DInFramebuffer[1] = false;
 }
 
 OpenGLES2Renderer::~OpenGLES2Renderer()
@@ -802,10 +1097,12 @@ OpenGLES2Renderer::~OpenGLES2Renderer()
 	DestroyShaders();
 	DestroyVAOs();
 	DestroyVBOs();
+	DestroyPBOs();
 	DestroyFBOs();
+	DestroyPostProcess();
 	
-	//kill the tex cache to free all the texture ids
-	TexCache_Reset();
+	//give back all the texture ids. the decoded textures stay, for whichever renderer comes next
+	TexCache_ReleaseRendererData();
 	
 	glBindTexture(GL_TEXTURE_2D, 0);
 	
@@ -815,6 +1112,8 @@ OpenGLES2Renderer::~OpenGLES2Renderer()
 		ref->freeTextureIDs.pop();
 		glDeleteTextures(1, &temp);
 	}
+	DestroyTextureAtlases();
+	DestroyCompositeTextures();
 	
 	glFinish();
 	
@@ -838,6 +1137,24 @@ Render3DError OpenGLES2Renderer::InitExtensions() {
                               this->IsExtensionPresent(&oglExtensionSet, "GL_EXT_draw_buffers");*/
 
     //if (this->isShaderSupported) {
+    GLint programBinaryFormatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &programBinaryFormatCount);
+    this->isProgramBinarySupported = this->IsExtensionPresent(&oglExtensionSet, "GL_OES_get_program_binary") &&
+                                     programBinaryFormatCount > 0 &&
+                                     glGetProgramBinaryOES != NULL && glProgramBinaryOES != NULL;
+    
+    // The edge marking and the fog need the polygon attributes in a second
+    // color attachment. This has to be known before the shader variants that
+    // write them are built.
+    this->isPostProcessSupported = this->IsExtensionPresent(&oglExtensionSet, "GL_EXT_draw_buffers") &&
+                                   this->IsExtensionPresent(&oglExtensionSet, "GL_OES_packed_depth_stencil") &&
+                                   glDrawBuffersEXT != NULL;
+    this->isFramebufferFetchSupported = this->isPostProcessSupported &&
+                                        this->IsExtensionPresent(&oglExtensionSet, "GL_EXT_shader_framebuffer_fetch");
+    
+    // The 4x4 compressed textures go up as ASTC when they fit it exactly
+    this->isASTCSupported = this->IsExtensionPresent(&oglExtensionSet, "GL_KHR_texture_compression_astc_ldr");
+
     std::string vertexShaderProgram;
     std::string fragmentShaderProgram;
     error = this->LoadShaderPrograms(&vertexShaderProgram, &fragmentShaderProgram);
@@ -854,6 +1171,18 @@ Render3DError OpenGLES2Renderer::InitExtensions() {
 	//this->isVBOSupported = this->IsExtensionPresent(&oglExtensionSet, "GL_OES_mapbuffer");
 	//if (this->isVBOSupported)
 		this->CreateVBOs();
+	this->isMapBufferSupported = this->IsExtensionPresent(&oglExtensionSet, "GL_OES_mapbuffer");
+	
+	// A GLES3 context lets us read the frames back through PBOs without waiting on the GPU
+	this->isPBOSupported	= IsVersionSupported(3, 0) &&
+							  glESMapBufferRange != NULL && glESUnmapBuffer != NULL &&
+							  glESFenceSync != NULL && glESClientWaitSync != NULL && glESDeleteSync != NULL;
+	if (this->isPBOSupported)
+	{
+		this->CreatePBOs();
+	}
+	
+	this->isSyncSupported = IsVersionSupported(3, 0) && glESFenceSync != NULL && glESDeleteSync != NULL;
 
 	this->isVAOSupported = //this->isShaderSupported &&
 						   //this->isVBOSupported &&
@@ -880,6 +1209,20 @@ Render3DError OpenGLES2Renderer::InitExtensions() {
 		INFO("OpenGL ES: FBOs are unsupported. Some emulation features will be disabled.\n");
 	}
 	
+	if (this->isPostProcessSupported)
+	{
+		error = this->CreatePostProcess();
+		if (error != OGLERROR_NOERR)
+		{
+			this->isPostProcessSupported = false;
+			this->isFramebufferFetchSupported = false;
+		}
+	}
+	else
+	{
+		INFO("OpenGL ES: Multiple render targets are unsupported. Edge marking and fog will be disabled.\n");
+	}
+	
 	this->InitTextures();
 	this->InitFinalRenderStates(&oglExtensionSet); // This must be done last
 	
@@ -890,16 +1233,24 @@ Render3DError OpenGLES2Renderer::CreateVBOs()
 {
 	OGLESRenderRef &OGLRef = *this->ref;
 	
-	glGenBuffers(1, &OGLRef.vboVertexID);
-	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboVertexID);
-	glBufferData(GL_ARRAY_BUFFER, VERTLIST_SIZE * sizeof(VERT), NULL, GL_STREAM_DRAW);
+	// Each frame writes its vertices into the next buffer of the ring, so that we
+	// never wait on a buffer the GPU may still be drawing the previous frames from.
+	glGenBuffers(OGLRENDER_VERT_BUFFER_RING_SIZE, OGLRef.vboVertexID);
+	for (unsigned int i = 0; i < OGLRENDER_VERT_BUFFER_RING_SIZE; i++)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboVertexID[i]);
+		glBufferData(GL_ARRAY_BUFFER, VERTLIST_SIZE * sizeof(OGLESVertex), NULL, GL_STREAM_DRAW);
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	OGLRef.vboVertexRingIndex = 0;
 	
 	glGenBuffers(1, &OGLRef.iboIndexID);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboIndexID);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, OGLRENDER_VERT_INDEX_BUFFER_COUNT * sizeof(GLushort), NULL, GL_STREAM_DRAW);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	
+	this->isVBOSupported = true;
+	
 	return OGLERROR_NOERR;
 }
 
@@ -910,7 +1261,7 @@ void OpenGLES2Renderer::DestroyVBOs()
 	OGLESRenderRef &OGLRef = *this->ref;
 	
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glDeleteBuffers(1, &OGLRef.vboVertexID);
+	glDeleteBuffers(OGLRENDER_VERT_BUFFER_RING_SIZE, OGLRef.vboVertexID);
 	
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glDeleteBuffers(1, &OGLRef.iboIndexID);
@@ -918,6 +1269,45 @@ void OpenGLES2Renderer::DestroyVBOs()
 	this->isVBOSupported = false;
 }
 
+Render3DError OpenGLES2Renderer::CreatePBOs()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	glGenBuffers(2, OGLRef.pboRenderDataID);
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, GFX3D_FRAMEBUFFER_WIDTH * GFX3D_FRAMEBUFFER_HEIGHT * sizeof(u32), NULL, GL_STREAM_READ);
+	}
+	
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	
+	return OGLERROR_NOERR;
+}
+
+void OpenGLES2Renderer::DestroyPBOs()
+{
+	if (!this->isPBOSupported)
+	{
+		return;
+	}
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		if (OGLRef.fenceRenderData[i] != NULL)
+		{
+			glESDeleteSync(OGLRef.fenceRenderData[i]);
+			OGLRef.fenceRenderData[i] = NULL;
+		}
+	}
+	
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glDeleteBuffers(2, OGLRef.pboRenderDataID);
+	
+	this->isPBOSupported = false;
+}
+
 Render3DError OpenGLES2Renderer::LoadShaderPrograms(std::string *outVertexShaderProgram, std::string *outFragmentShaderProgram)
 {
 	outVertexShaderProgram->clear();
@@ -929,13 +1319,60 @@ Render3DError OpenGLES2Renderer::LoadShaderPrograms(std::string *outVertexShader
 	return OGLERROR_NOERR;
 }
 
-Render3DError OpenGLES2Renderer::SetupShaderIO()
+// Linked shader variants are saved to this file, so that later launches can
+// skip compiling them.
+#define OGLRENDER_SHADER_CACHE_FILENAME			"gles2shaders.cache"
+#define OGLRENDER_SHADER_CACHE_MAGIC			0x31435347 // "GSC1"
+#define OGLRENDER_SHADER_CACHE_MAX_BINARY_SIZE	(1024 * 1024)
+
+static std::string GetShaderCachePath()
 {
-	OGLESRenderRef &OGLRef = *this->ref;
+	return std::string(PathInfo::pathToModule) + "/Temp/" + OGLRENDER_SHADER_CACHE_FILENAME;
+}
+
+static u32 GetShaderCacheTag(const std::string *vertexShaderProgram, const std::string *fragmentShaderProgram)
+{
+	// FNV-1a over everything that decides whether a saved binary still fits
+	const char *tagStrings[5] = {
+		(const char *)glGetString(GL_VENDOR),
+		(const char *)glGetString(GL_RENDERER),
+		(const char *)glGetString(GL_VERSION),
+		vertexShaderProgram->c_str(),
+		fragmentShaderProgram->c_str()
+	};
+	
+	u32 tag = 0x811C9DC5;
+	for (unsigned int i = 0; i < 5; i++)
+	{
+		for (const char *c = tagStrings[i]; c != NULL && *c != '\0'; c++)
+		{
+			tag = (tag ^ (u8)*c) * 0x01000193;
+		}
+		
+		tag = (tag ^ 0xFF) * 0x01000193;
+	}
 	
-	glBindAttribLocation(OGLRef.shaderProgram, OGLVertexAttributeID_Position, "inPosition");
-	glBindAttribLocation(OGLRef.shaderProgram, OGLVertexAttributeID_TexCoord0, "inTexCoord0");
-	glBindAttribLocation(OGLRef.shaderProgram, OGLVertexAttributeID_Color, "inColor");
+	return tag;
+}
+
+// Drops the state bits that make no difference to the given variant, so that
+// equivalent render states share one program.
+static FORCEINLINE u32 GetShaderVariantKey(const u32 key)
+{
+	const u32 polygonMode = (key & OGLShaderVariantFlag_PolygonModeMask) >> OGLShaderVariantFlag_PolygonModeShift;
+	u32 result = (polygonMode == 2) ? key : (key & ~OGLShaderVariantFlag_ToonHighlight);
+	if (!(key & OGLShaderVariantFlag_Texture))
+	{
+		result &= ~OGLShaderVariantFlag_TextureAtlas;
+	}
+	return result;
+}
+
+Render3DError OpenGLES2Renderer::SetupShaderIO(const GLuint program)
+{
+	glBindAttribLocation(program, OGLVertexAttributeID_Position, "inPosition");
+	glBindAttribLocation(program, OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+	glBindAttribLocation(program, OGLVertexAttributeID_Color, "inColor");
 	
 	return OGLERROR_NOERR;
 }
@@ -961,73 +1398,49 @@ Render3DError OpenGLES2Renderer::CreateShaders(const std::string *vertexShaderPr
 		return OGLERROR_SHADER_CREATE_ERROR;
 	}
 	
-	OGLRef.fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-	if(!OGLRef.fragmentShaderID)
-	{
-		glDeleteShader(OGLRef.vertexShaderID);
-		INFO("OpenGL ES: Failed to create the fragment shader.\n");
-		return OGLERROR_SHADER_CREATE_ERROR;
-	}
+	this->fragmentShaderSource = *fragmentShaderProgram;
+	this->shaderCacheTag = GetShaderCacheTag(vertexShaderProgram, fragmentShaderProgram);
+	memset(OGLRef.shaderVariant, 0, sizeof(OGLRef.shaderVariant));
 	
-	const char *fragmentShaderProgramChar = fragmentShaderProgram->c_str();
-	glShaderSource(OGLRef.fragmentShaderID, 1, (const GLchar **)&fragmentShaderProgramChar, NULL);
-	glCompileShader(OGLRef.fragmentShaderID);
-	if (!this->ValidateShaderCompile(OGLRef.fragmentShaderID))
-	{
-		glDeleteShader(OGLRef.vertexShaderID);
-		glDeleteShader(OGLRef.fragmentShaderID);
-		INFO("OpenGL ES: Failed to compile the fragment shader.\n");
-		return OGLERROR_SHADER_CREATE_ERROR;
-	}
+	// Take whatever variants were linked on a previous launch, and build the
+	// rest now rather than in the middle of a frame.
+	this->LoadShaderCache();
 	
-	OGLRef.shaderProgram = glCreateProgram();
-	if(!OGLRef.shaderProgram)
+	bool didCreateVariant = false;
+	for (u32 key = 0; key < OGLRENDER_SHADER_VARIANT_COUNT; key++)
 	{
-		glDeleteShader(OGLRef.vertexShaderID);
-		glDeleteShader(OGLRef.fragmentShaderID);
-		INFO("OpenGL ES: Failed to create the shader program.\n");
-		return OGLERROR_SHADER_CREATE_ERROR;
+		if (key != GetShaderVariantKey(key) || OGLRef.shaderVariant[key].program != 0)
+		{
+			continue;
+		}
+		
+		if ((key & OGLShaderVariantFlag_Attributes) && !this->isPostProcessSupported)
+		{
+			continue;
+		}
+		
+		Render3DError error = this->CreateShaderVariant(key);
+		if (error != OGLERROR_NOERR)
+		{
+			glUseProgram(0);
+			for (u32 i = 0; i < OGLRENDER_SHADER_VARIANT_COUNT; i++)
+			{
+				glDeleteProgram(OGLRef.shaderVariant[i].program);
+				OGLRef.shaderVariant[i].program = 0;
+			}
+			
+			glDeleteShader(OGLRef.vertexShaderID);
+			return error;
+		}
+		
+		didCreateVariant = true;
 	}
 	
-	glAttachShader(OGLRef.shaderProgram, OGLRef.vertexShaderID);
-	glAttachShader(OGLRef.shaderProgram, OGLRef.fragmentShaderID);
-	
-	this->SetupShaderIO();
-	
-	glLinkProgram(OGLRef.shaderProgram);
-	if (!this->ValidateShaderProgramLink(OGLRef.shaderProgram))
+	if (didCreateVariant)
 	{
-		glDetachShader(OGLRef.shaderProgram, OGLRef.vertexShaderID);
-		glDetachShader(OGLRef.shaderProgram, OGLRef.fragmentShaderID);
-		glDeleteProgram(OGLRef.shaderProgram);
-		glDeleteShader(OGLRef.vertexShaderID);
-		glDeleteShader(OGLRef.fragmentShaderID);
-		INFO("OpenGL ES: Failed to link the shader program.\n");
-		return OGLERROR_SHADER_CREATE_ERROR;
+		this->SaveShaderCache();
 	}
 	
-	glValidateProgram(OGLRef.shaderProgram);
-	glUseProgram(OGLRef.shaderProgram);
-	
-	// Set up shader uniforms
-	GLint uniformTexSampler = glGetUniformLocation(OGLRef.shaderProgram, "texMainRender");
-	glUniform1i(uniformTexSampler, 0);
-	
-	uniformTexSampler = glGetUniformLocation(OGLRef.shaderProgram, "texToonTable");
-	glUniform1i(uniformTexSampler, OGLTextureUnitID_ToonTable);
-	
-	OGLRef.uniformPolyAlpha 		= glGetUniformLocation(OGLRef.shaderProgram, "polyAlpha");
-	OGLRef.uniformPolyID			= glGetUniformLocation(OGLRef.shaderProgram, "polyID");
-	OGLRef.uniformPolygonMode		= glGetUniformLocation(OGLRef.shaderProgram, "polygonMode");
-
-	OGLRef.uniformTexScale			= glGetUniformLocation(OGLRef.shaderProgram, "texScale");
-
-	OGLRef.uniformHasTexture		= glGetUniformLocation(OGLRef.shaderProgram, "hasTexture");
-	OGLRef.uniformToonShadingMode	= glGetUniformLocation(OGLRef.shaderProgram, "toonShadingMode");
-	OGLRef.uniformWBuffer			= glGetUniformLocation(OGLRef.shaderProgram, "oglWBuffer");
-	OGLRef.uniformEnableAlphaTest	= glGetUniformLocation(OGLRef.shaderProgram, "enableAlphaTest");
-	OGLRef.uniformAlphaTestRef		= glGetUniformLocation(OGLRef.shaderProgram, "alphaTestRef");
-	
 	INFO("OpenGL ES: Successfully created shaders.\n");
 	
 	return OGLERROR_NOERR;
@@ -1039,86 +1452,316 @@ void OpenGLES2Renderer::DestroyShaders()
 	
 	glUseProgram(0);
 	
-	glDetachShader(OGLRef.shaderProgram, OGLRef.vertexShaderID);
-	glDetachShader(OGLRef.shaderProgram, OGLRef.fragmentShaderID);
+	for (u32 key = 0; key < OGLRENDER_SHADER_VARIANT_COUNT; key++)
+	{
+		if (OGLRef.shaderVariant[key].program != 0)
+		{
+			glDeleteProgram(OGLRef.shaderVariant[key].program);
+			OGLRef.shaderVariant[key].program = 0;
+		}
+	}
 	
-	glDeleteProgram(OGLRef.shaderProgram);
 	glDeleteShader(OGLRef.vertexShaderID);
-	glDeleteShader(OGLRef.fragmentShaderID);
 	
 	this->DestroyToonTable();
 
 	this->isShaderSupported = false;
 }
 
-Render3DError OpenGLES2Renderer::CreateVAOs()
+Render3DError OpenGLES2Renderer::CreateShaderVariant(const u32 key)
 {
 	OGLESRenderRef &OGLRef = *this->ref;
 	
-	glGenVertexArraysOES(1, &OGLRef.vaoMainStatesID);
-	glBindVertexArrayOES(OGLRef.vaoMainStatesID);
+	char variantDefines[224];
+	snprintf(variantDefines, sizeof(variantDefines),
+			 "#define ENABLE_TEXTURE %u\n#define POLYGON_MODE %u\n#define TOON_SHADING_MODE %u\n#define ENABLE_ALPHA_TEST %u\n#define ENABLE_TEXTURE_ATLAS %u\n#define ENABLE_ATTRIBUTES %u\n",
+			 (key & OGLShaderVariantFlag_Texture) ? 1 : 0,
+			 (key & OGLShaderVariantFlag_PolygonModeMask) >> OGLShaderVariantFlag_PolygonModeShift,
+			 (key & OGLShaderVariantFlag_ToonHighlight) ? 1 : 0,
+			 (key & OGLShaderVariantFlag_AlphaTest) ? 1 : 0,
+			 (key & OGLShaderVariantFlag_TextureAtlas) ? 1 : 0,
+			 (key & OGLShaderVariantFlag_Attributes) ? 1 : 0);
+	
+	GLuint fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	if(!fragmentShaderID)
+	{
+		INFO("OpenGL ES: Failed to create the fragment shader.\n");
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
 	
-	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboVertexID);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboIndexID);
+	const char *fragmentShaderProgramChar[2] = {variantDefines, this->fragmentShaderSource.c_str()};
+	glShaderSource(fragmentShaderID, 2, (const GLchar **)fragmentShaderProgramChar, NULL);
+	glCompileShader(fragmentShaderID);
+	if (!this->ValidateShaderCompile(fragmentShaderID))
+	{
+		glDeleteShader(fragmentShaderID);
+		INFO("OpenGL ES: Failed to compile fragment shader variant %u.\n", key);
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
 	
-	glEnableVertexAttribArray(OGLVertexAttributeID_Position);
-	glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
-	glEnableVertexAttribArray(OGLVertexAttributeID_Color);
+	GLuint program = glCreateProgram();
+	if(!program)
+	{
+		glDeleteShader(fragmentShaderID);
+		INFO("OpenGL ES: Failed to create the shader program.\n");
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
 	
-	glVertexAttribPointer(OGLVertexAttributeID_Position, 4, GL_FLOAT, GL_FALSE, sizeof(VERT), (const GLvoid *)offsetof(VERT, coord));
-	glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_FLOAT, GL_FALSE, sizeof(VERT), (const GLvoid *)offsetof(VERT, texcoord));
-	glVertexAttribPointer(OGLVertexAttributeID_Color, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(VERT), (const GLvoid *)offsetof(VERT, color));
+	glAttachShader(program, OGLRef.vertexShaderID);
+	glAttachShader(program, fragmentShaderID);
 	
-	glBindVertexArrayOES(0);
+	this->SetupShaderIO(program);
 	
-	return OGLERROR_NOERR;
-}
-
-void OpenGLES2Renderer::DestroyVAOs()
-{
-	if (!this->isVAOSupported)
+	glLinkProgram(program);
+	
+	// A linked program doesn't need its shaders anymore. The vertex shader is
+	// shared with the other variants, so only the fragment shader goes away.
+	glDetachShader(program, OGLRef.vertexShaderID);
+	glDetachShader(program, fragmentShaderID);
+	glDeleteShader(fragmentShaderID);
+	
+	if (!this->ValidateShaderProgramLink(program))
 	{
-		return;
+		glDeleteProgram(program);
+		INFO("OpenGL ES: Failed to link shader program variant %u.\n", key);
+		return OGLERROR_SHADER_CREATE_ERROR;
 	}
 	
-	glBindVertexArrayOES(0);
-	glDeleteVertexArraysOES(1, &this->ref->vaoMainStatesID);
+	glValidateProgram(program);
+	OGLRef.shaderVariant[key].program = program;
 	
-	this->isVAOSupported = false;
+	return this->InitShaderVariant(key);
 }
 
-Render3DError OpenGLES2Renderer::CreateFBOs()
+Render3DError OpenGLES2Renderer::InitShaderVariant(const u32 key)
 {
-	OGLESRenderRef &OGLRef = *this->ref;
+	OGLESShaderVariant &variant = this->ref->shaderVariant[key];
 	
-	// Set up FBO render targets
-	this->CreateClearImage();
-	glGenTextures(1, &OGLRef.texClearImageColorID);
-	glGenTextures(1, &OGLRef.texClearImageDepthStencilID);
-
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texClearImageColorID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_INT_24_8_OES, NULL);
-
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texClearImageDepthStencilID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE_EXT, GL_NONE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8_OES, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, 0, GL_DEPTH_STENCIL_OES, GL_UNSIGNED_INT_24_8_OES, NULL);
-
+	glUseProgram(variant.program);
 	
-	// Set up FBOs
-	glGenFramebuffers(1, &OGLRef.fboClearImageID);
+	// Set up shader uniforms
+	GLint uniformTexSampler = glGetUniformLocation(variant.program, "texMainRender");
+	glUniform1i(uniformTexSampler, 0);
 	
-	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboClearImageID);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, OGLRef.texClearImageColorID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texClearImageDepthStencilID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texClearImageDepthStencilID, 0);
+	uniformTexSampler = glGetUniformLocation(variant.program, "texToonTable");
+	glUniform1i(uniformTexSampler, OGLTextureUnitID_ToonTable);
+	
+	variant.uniformPolyID		= glGetUniformLocation(variant.program, "polyID");
+	variant.uniformPolyAlpha	= glGetUniformLocation(variant.program, "polyAlpha");
+	variant.uniformTexScale		= glGetUniformLocation(variant.program, "texScale");
+	variant.uniformAlphaTestRef	= glGetUniformLocation(variant.program, "alphaTestRef");
+	variant.uniformAtlasRect	= glGetUniformLocation(variant.program, "atlasRect");
+	variant.uniformAtlasWrap	= glGetUniformLocation(variant.program, "atlasWrap");
+	variant.uniformAtlasClamp	= glGetUniformLocation(variant.program, "atlasClamp");
+	variant.uniformPolyAttribute = glGetUniformLocation(variant.program, "polyAttribute");
+	
+	// Whichever variant was selected before has to be bound again
+	this->currShaderVariantKey = OGLRENDER_SHADER_VARIANT_COUNT;
+	
+	return OGLERROR_NOERR;
+}
+
+Render3DError OpenGLES2Renderer::LoadShaderCache()
+{
+	if (!this->isProgramBinarySupported)
+	{
+		return OGLERROR_FEATURE_UNSUPPORTED;
+	}
+	
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	FILE *fp = fopen(GetShaderCachePath().c_str(), "rb");
+	if (fp == NULL)
+	{
+		return OGLERROR_NOERR;
+	}
+	
+	// The header is the magic number, the tag and the number of variants. The
+	// tag changes with the driver or the shader sources, which makes the
+	// saved binaries useless.
+	u32 header[3];
+	if (fread(header, sizeof(header), 1, fp) != 1 || header[0] != OGLRENDER_SHADER_CACHE_MAGIC || header[1] != this->shaderCacheTag)
+	{
+		fclose(fp);
+		return OGLERROR_NOERR;
+	}
+	
+	std::vector<u8> binary;
+	unsigned int loadedCount = 0;
+	
+	for (u32 i = 0; i < header[2]; i++)
+	{
+		// Each variant is its key, the binary format and the binary length,
+		// followed by the binary itself.
+		u32 entry[3];
+		if (fread(entry, sizeof(entry), 1, fp) != 1 || entry[0] >= OGLRENDER_SHADER_VARIANT_COUNT || entry[2] == 0 || entry[2] > OGLRENDER_SHADER_CACHE_MAX_BINARY_SIZE)
+		{
+			break;
+		}
+		
+		binary.resize(entry[2]);
+		if (fread(&binary[0], entry[2], 1, fp) != 1)
+		{
+			break;
+		}
+		
+		if (OGLRef.shaderVariant[entry[0]].program != 0)
+		{
+			continue;
+		}
+		
+		GLuint program = glCreateProgram();
+		glProgramBinaryOES(program, (GLenum)entry[1], &binary[0], (GLint)entry[2]);
+		
+		// The driver may still reject the binary, such as after an update. That
+		// variant is just compiled again.
+		GLint status = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE)
+		{
+			glDeleteProgram(program);
+			continue;
+		}
+		
+		OGLRef.shaderVariant[entry[0]].program = program;
+		this->InitShaderVariant(entry[0]);
+		loadedCount++;
+	}
+	
+	fclose(fp);
+	
+	INFO("OpenGL ES: Loaded %u shader variants from the cache.\n", loadedCount);
+	
+	return OGLERROR_NOERR;
+}
+
+Render3DError OpenGLES2Renderer::SaveShaderCache()
+{
+	if (!this->isProgramBinarySupported)
+	{
+		return OGLERROR_FEATURE_UNSUPPORTED;
+	}
+	
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	FILE *fp = fopen(GetShaderCachePath().c_str(), "wb");
+	if (fp == NULL)
+	{
+		INFO("OpenGL ES: Could not write the shader cache.\n");
+		return OGLERROR_NOERR;
+	}
+	
+	// The variant count is filled in once it's known
+	u32 header[3] = {OGLRENDER_SHADER_CACHE_MAGIC, this->shaderCacheTag, 0};
+	fwrite(header, sizeof(header), 1, fp);
+	
+	std::vector<u8> binary;
+	
+	for (u32 key = 0; key < OGLRENDER_SHADER_VARIANT_COUNT; key++)
+	{
+		const GLuint program = OGLRef.shaderVariant[key].program;
+		if (program == 0)
+		{
+			continue;
+		}
+		
+		GLint binaryLength = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &binaryLength);
+		if (binaryLength <= 0 || binaryLength > OGLRENDER_SHADER_CACHE_MAX_BINARY_SIZE)
+		{
+			continue;
+		}
+		
+		GLsizei writtenLength = 0;
+		GLenum binaryFormat = 0;
+		binary.resize(binaryLength);
+		glGetProgramBinaryOES(program, binaryLength, &writtenLength, &binaryFormat, &binary[0]);
+		if (writtenLength <= 0)
+		{
+			continue;
+		}
+		
+		const u32 entry[3] = {key, (u32)binaryFormat, (u32)writtenLength};
+		fwrite(entry, sizeof(entry), 1, fp);
+		fwrite(&binary[0], writtenLength, 1, fp);
+		header[2]++;
+	}
+	
+	fseek(fp, 0, SEEK_SET);
+	fwrite(header, sizeof(header), 1, fp);
+	fclose(fp);
+	
+	return OGLERROR_NOERR;
+}
+
+Render3DError OpenGLES2Renderer::CreateVAOs()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	glGenVertexArraysOES(1, &OGLRef.vaoMainStatesID);
+	glBindVertexArrayOES(OGLRef.vaoMainStatesID);
+	
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboVertexID[OGLRef.vboVertexRingIndex]);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboIndexID);
+	
+	glEnableVertexAttribArray(OGLVertexAttributeID_Position);
+	glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
+	glEnableVertexAttribArray(OGLVertexAttributeID_Color);
+	
+	glVertexAttribPointer(OGLVertexAttributeID_Position, 4, GL_FLOAT, GL_FALSE, sizeof(OGLESVertex), (const GLvoid *)offsetof(OGLESVertex, coord));
+	glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_FLOAT, GL_FALSE, sizeof(OGLESVertex), (const GLvoid *)offsetof(OGLESVertex, texcoord));
+	glVertexAttribPointer(OGLVertexAttributeID_Color, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(OGLESVertex), (const GLvoid *)offsetof(OGLESVertex, color));
+	
+	glBindVertexArrayOES(0);
+	
+	return OGLERROR_NOERR;
+}
+
+void OpenGLES2Renderer::DestroyVAOs()
+{
+	if (!this->isVAOSupported)
+	{
+		return;
+	}
+	
+	glBindVertexArrayOES(0);
+	glDeleteVertexArraysOES(1, &this->ref->vaoMainStatesID);
+	
+	this->isVAOSupported = false;
+}
+
+Render3DError OpenGLES2Renderer::CreateFBOs()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	// Set up FBO render targets
+	this->CreateClearImage();
+	glGenTextures(1, &OGLRef.texClearImageColorID);
+	glGenTextures(1, &OGLRef.texClearImageDepthStencilID);
+
+	glBindTexture(GL_TEXTURE_2D, OGLRef.texClearImageColorID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_INT_24_8_OES, NULL);
+
+	glBindTexture(GL_TEXTURE_2D, OGLRef.texClearImageDepthStencilID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE_EXT, GL_NONE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8_OES, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, 0, GL_DEPTH_STENCIL_OES, GL_UNSIGNED_INT_24_8_OES, NULL);
+
+	
+	// Set up FBOs
+	glGenFramebuffers(1, &OGLRef.fboClearImageID);
+	
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboClearImageID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, OGLRef.texClearImageColorID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texClearImageDepthStencilID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texClearImageDepthStencilID, 0);
 	
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 	{
@@ -1197,6 +1840,8 @@ Render3DError OpenGLES2Renderer::InitFinalRenderStates(const std::set<std::strin
 Render3DError OpenGLES2Renderer::InitTextures()
 {
 	this->ExpandFreeTextures();
+	this->CreateTextureAtlases();
+	this->CreateCompositeTextures();
 	
 	return OGLERROR_NOERR;
 }
@@ -1353,6 +1998,436 @@ Render3DError OpenGLES2Renderer::ExpandFreeTextures()
 	return OGLERROR_NOERR;
 }
 
+Render3DError OpenGLES2Renderer::CreateTextureAtlases()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	// The atlases wrap nothing themselves, since the shader keeps every sample
+	// inside its texture's cell.
+	glGenTextures(OGLRENDER_ATLAS_COUNT, OGLRef.texAtlasID);
+	for (unsigned int i = 0; i < OGLRENDER_ATLAS_COUNT; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, OGLRef.texAtlasID[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, OGLRENDER_ATLAS_SIZE, OGLRENDER_ATLAS_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		
+		for (unsigned int cell = 0; cell < OGLRENDER_ATLAS_CELLS; cell++)
+		{
+			OGLRef.freeAtlasCells.push(i * OGLRENDER_ATLAS_CELLS + cell);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	
+	return OGLERROR_NOERR;
+}
+
+void OpenGLES2Renderer::DestroyTextureAtlases()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	glDeleteTextures(OGLRENDER_ATLAS_COUNT, OGLRef.texAtlasID);
+	memset(OGLRef.texAtlasID, 0, sizeof(OGLRef.texAtlasID));
+	while (!OGLRef.freeAtlasCells.empty())
+	{
+		OGLRef.freeAtlasCells.pop();
+	}
+}
+
+Render3DError OpenGLES2Renderer::CreateCompositeTextures()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	glGenTextures(OGLRENDER_COMPOSITE_TEXTURE_COUNT, OGLRef.texCompositeID);
+	for (unsigned int i = 0; i < OGLRENDER_COMPOSITE_TEXTURE_COUNT; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, OGLRef.texCompositeID[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	
+	return OGLERROR_NOERR;
+}
+
+void OpenGLES2Renderer::DestroyCompositeTextures()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	gpu3DFrame.texture = 0;
+	gpu3DFrame.fence = NULL;
+	
+	for (unsigned int i = 0; i < OGLRENDER_COMPOSITE_TEXTURE_COUNT; i++)
+	{
+		if (OGLRef.fenceComposite[i] != NULL)
+		{
+			glESDeleteSync(OGLRef.fenceComposite[i]);
+			OGLRef.fenceComposite[i] = NULL;
+		}
+	}
+	glDeleteTextures(OGLRENDER_COMPOSITE_TEXTURE_COUNT, OGLRef.texCompositeID);
+	memset(OGLRef.texCompositeID, 0, sizeof(OGLRef.texCompositeID));
+}
+
+static void InitPostTexture(GLuint textureID, GLsizei width, GLsizei height, GLenum format)
+{
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+}
+
+Render3DError OpenGLES2Renderer::CreatePostProcess()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	glGenTextures(1, &OGLRef.texPostColorID);
+	glGenTextures(1, &OGLRef.texPostAttributesID);
+	glGenTextures(1, &OGLRef.texEdgeColorID);
+	glGenTextures(1, &OGLRef.texFogTableID);
+	InitPostTexture(OGLRef.texPostColorID, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, GL_RGBA);
+	InitPostTexture(OGLRef.texPostAttributesID, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, GL_RGBA);
+	InitPostTexture(OGLRef.texEdgeColorID, 8, 1, GL_RGBA);
+	InitPostTexture(OGLRef.texFogTableID, 256, 256, GL_LUMINANCE); // Indexed by the low and high bytes of the depth
+	glBindTexture(GL_TEXTURE_2D, 0);
+	this->currTextureBinding = 0;
+	
+	glGenRenderbuffers(1, &OGLRef.rboPostDepthStencilID);
+	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboPostDepthStencilID);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8_OES, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	
+	glGenFramebuffers(1, &OGLRef.fboPostRenderID);
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboPostRenderID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, OGLRef.texPostColorID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1_EXT, GL_TEXTURE_2D, OGLRef.texPostAttributesID, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, OGLRef.rboPostDepthStencilID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, OGLRef.rboPostDepthStencilID);
+	
+	// The draw buffers belong to the FBO, so they only need to be set once
+	const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT};
+	glDrawBuffersEXT(2, drawBuffers);
+	
+	const bool isComplete = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboFinalOutputID);
+	
+	// One triangle that covers the whole framebuffer
+	static const GLfloat postVertices[6] = {-1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f};
+	glGenBuffers(1, &OGLRef.vboPostVertexID);
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboPostVertexID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(postVertices), postVertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	OGLRef.postVertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(OGLRef.postVertexShaderID, 1, (const GLchar **)&postVertexShader_100, NULL);
+	glCompileShader(OGLRef.postVertexShaderID);
+	const bool isCompiled = this->ValidateShaderCompile(OGLRef.postVertexShaderID);
+	
+	memset(OGLRef.postProgram, 0, sizeof(OGLRef.postProgram));
+	this->postTablesNeedUpdate = true;
+	
+	if (!isComplete || !isCompiled)
+	{
+		INFO("OpenGL ES: Failed to create the post pass. Edge marking and fog will be disabled.\n");
+		this->DestroyPostProcess();
+		return OGLERROR_FBO_CREATE_ERROR;
+	}
+	
+	INFO("OpenGL ES: Successfully created the post pass%s.\n", this->isFramebufferFetchSupported ? ", with framebuffer fetch" : "");
+	
+	return OGLERROR_NOERR;
+}
+
+void OpenGLES2Renderer::DestroyPostProcess()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	
+	if (OGLRef.fboPostRenderID == 0)
+	{
+		return;
+	}
+	
+	glUseProgram(0);
+	for (u32 key = 0; key < OGLRENDER_POST_PROGRAM_COUNT; key++)
+	{
+		if (OGLRef.postProgram[key].program != 0)
+		{
+			glDeleteProgram(OGLRef.postProgram[key].program);
+		}
+	}
+	memset(OGLRef.postProgram, 0, sizeof(OGLRef.postProgram));
+	glDeleteShader(OGLRef.postVertexShaderID);
+	
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboFinalOutputID);
+	glDeleteFramebuffers(1, &OGLRef.fboPostRenderID);
+	glDeleteRenderbuffers(1, &OGLRef.rboPostDepthStencilID);
+	glDeleteBuffers(1, &OGLRef.vboPostVertexID);
+	glDeleteTextures(1, &OGLRef.texPostColorID);
+	glDeleteTextures(1, &OGLRef.texPostAttributesID);
+	glDeleteTextures(1, &OGLRef.texEdgeColorID);
+	glDeleteTextures(1, &OGLRef.texFogTableID);
+	
+	OGLRef.fboPostRenderID = 0;
+	this->postProgramKey = 0;
+	this->isPostProcessSupported = false;
+	this->isFramebufferFetchSupported = false;
+}
+
+Render3DError OpenGLES2Renderer::CreatePostProgram(const u32 key)
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	OGLESPostProgram &post = OGLRef.postProgram[key];
+	
+	char programDefines[160];
+	snprintf(programDefines, sizeof(programDefines),
+			 "#define ENABLE_EDGE_MARK %u\n#define ENABLE_FOG %u\n#define FOG_ALPHA_ONLY %u\n#define ENABLE_ALPHA_BLEND %u\n#define USE_FRAMEBUFFER_FETCH %u\n",
+			 (key & OGLPostProgramFlag_EdgeMark) ? 1 : 0,
+			 (key & OGLPostProgramFlag_Fog) ? 1 : 0,
+			 (key & OGLPostProgramFlag_FogAlphaOnly) ? 1 : 0,
+			 (key & OGLPostProgramFlag_AlphaBlend) ? 1 : 0,
+			 (key & OGLPostProgramFlag_FramebufferFetch) ? 1 : 0);
+	
+	GLuint fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	if (!fragmentShaderID)
+	{
+		INFO("OpenGL ES: Failed to create the post pass fragment shader.\n");
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
+	
+	const char *fragmentShaderProgramChar[2] = {programDefines, postFragmentShader_100};
+	glShaderSource(fragmentShaderID, 2, (const GLchar **)fragmentShaderProgramChar, NULL);
+	glCompileShader(fragmentShaderID);
+	if (!this->ValidateShaderCompile(fragmentShaderID))
+	{
+		glDeleteShader(fragmentShaderID);
+		INFO("OpenGL ES: Failed to compile post pass program %u.\n", key);
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
+	
+	GLuint program = glCreateProgram();
+	glAttachShader(program, OGLRef.postVertexShaderID);
+	glAttachShader(program, fragmentShaderID);
+	glBindAttribLocation(program, OGLVertexAttributeID_Position, "inPosition");
+	glLinkProgram(program);
+	glDetachShader(program, OGLRef.postVertexShaderID);
+	glDetachShader(program, fragmentShaderID);
+	glDeleteShader(fragmentShaderID);
+	
+	if (!this->ValidateShaderProgramLink(program))
+	{
+		glDeleteProgram(program);
+		INFO("OpenGL ES: Failed to link post pass program %u.\n", key);
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
+	
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "texPostColor"), OGLTextureUnitID_PostColor);
+	glUniform1i(glGetUniformLocation(program, "texPostAttributes"), OGLTextureUnitID_PostAttributes);
+	glUniform1i(glGetUniformLocation(program, "texEdgeColor"), OGLTextureUnitID_EdgeColor);
+	glUniform1i(glGetUniformLocation(program, "texFogTable"), OGLTextureUnitID_FogTable);
+	
+	post.program = program;
+	post.uniformFogColor = glGetUniformLocation(program, "fogColor");
+	
+	this->currShaderVariantKey = OGLRENDER_SHADER_VARIANT_COUNT;
+	
+	return OGLERROR_NOERR;
+}
+
+Render3DError OpenGLES2Renderer::UpdatePostTables(const GFX3D_State *renderState)
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	u8 *regs = MMU.MMU_MEM[ARMCPU_ARM9][0x40];
+	
+	// The same colors as the rasterizer's edge marking, with 6 bit red, green
+	// and blue and 5 bit alpha, in the top bits of each byte
+	if (this->postTablesNeedUpdate ||
+		this->currentEdgeAntialias != renderState->enableAntialiasing ||
+		memcmp(this->currentEdgeColors16, regs + 0x330, sizeof(this->currentEdgeColors16)))
+	{
+		memcpy(this->currentEdgeColors16, regs + 0x330, sizeof(this->currentEdgeColors16));
+		this->currentEdgeAntialias = renderState->enableAntialiasing;
+		
+		u8 edgeColors[8 * 4];
+		for (unsigned int i = 0; i < 8; i++)
+		{
+			const u16 edgeColor = T1ReadWord(regs, 0x330 + (i << 1));
+			edgeColors[i * 4 + 0] = GFX3D_5TO6(edgeColor & 0x1F) << 2;
+			edgeColors[i * 4 + 1] = GFX3D_5TO6((edgeColor >> 5) & 0x1F) << 2;
+			edgeColors[i * 4 + 2] = GFX3D_5TO6((edgeColor >> 10) & 0x1F) << 2;
+			edgeColors[i * 4 + 3] = (renderState->enableAntialiasing ? 0x0F : 0x1F) << 3;
+		}
+		
+		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_EdgeColor);
+		glBindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorID);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 8, 1, GL_RGBA, GL_UNSIGNED_BYTE, edgeColors);
+	}
+	
+	// The rasterizer's fog table, from updateFogTable(). A shift past 10 would
+	// shift by a negative amount there, so it's held at 10.
+	if (this->postTablesNeedUpdate ||
+		this->currentFogOffset != renderState->fogOffset ||
+		this->currentFogShift != renderState->fogShift ||
+		memcmp(this->currentFogDensity, regs + 0x360, sizeof(this->currentFogDensity)))
+	{
+		memcpy(this->currentFogDensity, regs + 0x360, sizeof(this->currentFogDensity));
+		this->currentFogOffset = renderState->fogOffset;
+		this->currentFogShift = renderState->fogShift;
+		
+		static CACHE_ALIGN u8 fogTable[32768];
+		static CACHE_ALIGN u8 fogTableTexture[256 * 256];
+		
+		const u8 *fogDensity = this->currentFogDensity;
+		const u32 fogShift = std::min<u32>(renderState->fogShift, 10);
+		const u32 increment = (1 << 10) >> fogShift;
+		const u32 incrementDivShift = 10 - fogShift;
+		const u32 fogOffset = std::min<u32>(renderState->fogOffset, 32768);
+		const u32 iMin = std::min<u32>(32768, ((1 + 1) << incrementDivShift) + fogOffset + 1 - increment);
+		const u32 iMax = std::min<u32>(32768, ((32 + 1) << incrementDivShift) + fogOffset + 1 - increment);
+		
+		memset(fogTable, fogDensity[0], iMin);
+		for (u32 i = iMin; i < iMax; i++)
+		{
+			const u32 num = i - fogOffset + (increment - 1);
+			const u32 j = (num >> incrementDivShift) - 1;
+			const u32 value = (num & ~(increment - 1)) + fogOffset;
+			const u32 diff = value - i;
+			fogTable[i] = (diff * fogDensity[j - 1] + (increment - diff) * fogDensity[j]) >> incrementDivShift;
+		}
+		memset(fogTable + iMax, fogDensity[31], 32768 - iMax);
+		
+		// The texture goes by the 16 bit depth of the attributes, which is
+		// twice as fine as the rasterizer's fog index
+		for (u32 i = 0; i < 256 * 256; i++)
+		{
+			const u8 fog = fogTable[i >> 1];
+			fogTableTexture[i] = (fog == 127) ? 128 : fog;
+		}
+		
+		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FogTable);
+		glBindTexture(GL_TEXTURE_2D, OGLRef.texFogTableID);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 256, GL_LUMINANCE, GL_UNSIGNED_BYTE, fogTableTexture);
+	}
+	
+	glActiveTexture(GL_TEXTURE0);
+	this->postTablesNeedUpdate = false;
+	
+	const u32 fogColor = renderState->fogColor;
+	this->postFogColor[0] = (GLfloat)GFX3D_5TO6(fogColor & 0x1F);
+	this->postFogColor[1] = (GLfloat)GFX3D_5TO6((fogColor >> 5) & 0x1F);
+	this->postFogColor[2] = (GLfloat)GFX3D_5TO6((fogColor >> 10) & 0x1F);
+	this->postFogColor[3] = (GLfloat)((fogColor >> 16) & 0x1F);
+	
+	return OGLERROR_NOERR;
+}
+
+Render3DError OpenGLES2Renderer::ClearAttributes(const GFX3D_State *renderState)
+{
+	// Only the attributes are cleared here, after the color was cleared with
+	// both draw buffers. The clear color is put back for ClearUsingValues(),
+	// which only sets it when it changes.
+	static const GLenum attributesBuffer[2] = {GL_NONE, GL_COLOR_ATTACHMENT1_EXT};
+	static const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT};
+	
+	const u32 polyID = (renderState->clearColor >> 24) & 0x3F;
+	const u32 depth = (renderState->clearDepth >> 8) & 0xFFFF;
+	
+	GLfloat clearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+	
+	glDrawBuffersEXT(2, attributesBuffer);
+	glClearColor((GLfloat)((polyID << 1) | (BIT15(renderState->clearColor) ? 1 : 0)) / 255.0f,
+				 (GLfloat)(depth & 0xFF) / 255.0f,
+				 (GLfloat)(depth >> 8) / 255.0f,
+				 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDrawBuffersEXT(2, drawBuffers);
+	glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+	
+	return OGLERROR_NOERR;
+}
+
+Render3DError OpenGLES2Renderer::RenderPostProcess()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	const u32 key = this->postProgramKey;
+	const OGLESPostProgram &post = OGLRef.postProgram[key];
+	
+	// The programs are only built once a frame needs them. If one can't be, the
+	// frame is left in the FBO as it is and read back from there.
+	if (post.program == 0)
+	{
+		Render3DError error = this->CreatePostProgram(key);
+		if (error != OGLERROR_NOERR)
+		{
+			INFO("OpenGL ES: Edge marking and fog will be disabled.\n");
+			this->isPostProcessSupported = false;
+			this->isFramebufferFetchSupported = false;
+			return error;
+		}
+	}
+	
+	// Shadow polygons may have left the color writes off, and SetupPolygon()
+	// expects them to be as it left them
+	GLboolean colorMask[4];
+	glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	
+	glDisable(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	xglDisable(GL_STENCIL_TEST);
+	xglDisable(GL_CULL_FACE);
+	glViewport(0, 0, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT);
+	
+	if (!(key & OGLPostProgramFlag_FramebufferFetch))
+	{
+		// The attachments are sampled, so the result goes into the final output
+		glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboFinalOutputID);
+		OGLRef.selectedRenderingFBO = OGLRef.fboFinalOutputID;
+		
+		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_PostColor);
+		glBindTexture(GL_TEXTURE_2D, OGLRef.texPostColorID);
+		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_PostAttributes);
+		glBindTexture(GL_TEXTURE_2D, OGLRef.texPostAttributesID);
+	}
+	
+	glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_EdgeColor);
+	glBindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorID);
+	glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FogTable);
+	glBindTexture(GL_TEXTURE_2D, OGLRef.texFogTableID);
+	
+	glUseProgram(OGLRef.postProgram[key].program);
+	this->currShaderVariantKey = OGLRENDER_SHADER_VARIANT_COUNT;
+	glUniform4fv(OGLRef.postProgram[key].uniformFogColor, 1, this->postFogColor);
+	
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboPostVertexID);
+	glEnableVertexAttribArray(OGLVertexAttributeID_Position);
+	glVertexAttribPointer(OGLVertexAttributeID_Position, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glDisableVertexAttribArray(OGLVertexAttributeID_Position);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	// The attachments can't stay bound while the next frame draws into them
+	for (GLenum unit = OGLTextureUnitID_PostColor; unit <= OGLTextureUnitID_FogTable; unit++)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	
+	glEnable(GL_DEPTH_TEST);
+	glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+	
+	return OGLERROR_NOERR;
+}
+
 Render3DError OpenGLES2Renderer::SetupVertices(const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList, GLushort *outIndexBuffer, unsigned int *outIndexCount)
 {
 	OGLESRenderRef &OGLRef = *this->ref;
@@ -1392,33 +2467,93 @@ Render3DError OpenGLES2Renderer::SetupVertices(const VERTLIST *vertList, const P
 	return OGLERROR_NOERR;
 }
 
+static FORCEINLINE void PackVertices(OGLESVertex *__restrict dst, const VERT *__restrict src, const int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		const VERT &vert = src[i];
+		OGLESVertex &out = dst[i];
+		
+		out.coord[0] = vert.coord[0];
+		out.coord[1] = vert.coord[1];
+		out.coord[2] = vert.coord[2];
+		out.coord[3] = vert.coord[3];
+		out.texcoord[0] = vert.texcoord[0];
+		out.texcoord[1] = vert.texcoord[1];
+		out.color[0] = vert.color[0];
+		out.color[1] = vert.color[1];
+		out.color[2] = vert.color[2];
+		out.color[3] = 0;
+	}
+}
+
+Render3DError OpenGLES2Renderer::UploadVertices(const VERTLIST *vertList)
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	const int vertCount = vertList->count;
+	
+	// Write the vertices straight into the buffer where we can map it. The
+	// buffer is write-only memory on most drivers, so this must only write.
+	if (this->isMapBufferSupported)
+	{
+		OGLESVertex *mappedVerts = (OGLESVertex *)glMapBufferOES(GL_ARRAY_BUFFER, GL_WRITE_ONLY_OES);
+		if (mappedVerts != NULL)
+		{
+			PackVertices(mappedVerts, vertList->list, vertCount);
+			
+			// The buffer contents are undefined if the driver lost them while it was
+			// mapped, in which case we fall back to uploading them normally.
+			if (glUnmapBufferOES(GL_ARRAY_BUFFER) == GL_TRUE)
+			{
+				return OGLERROR_NOERR;
+			}
+		}
+	}
+	
+	if (OGLRef.vertUploadBuffer.size() < (size_t)vertCount)
+	{
+		OGLRef.vertUploadBuffer.resize(vertCount);
+	}
+	
+	if (vertCount > 0)
+	{
+		PackVertices(&OGLRef.vertUploadBuffer[0], vertList->list, vertCount);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(OGLESVertex) * vertCount, &OGLRef.vertUploadBuffer[0]);
+	}
+	
+	return OGLERROR_NOERR;
+}
+
 Render3DError OpenGLES2Renderer::EnableVertexAttributes(const VERTLIST *vertList, const GLushort *indexBuffer, const unsigned int vertIndexCount)
 {
 	OGLESRenderRef &OGLRef = *this->ref;
 	
+	OGLRef.vboVertexRingIndex = (OGLRef.vboVertexRingIndex + 1) % OGLRENDER_VERT_BUFFER_RING_SIZE;
+	
 	if (this->isVAOSupported)
 	{
 		glBindVertexArrayOES(OGLRef.vaoMainStatesID);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VERT) * vertList->count, vertList);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, vertIndexCount * sizeof(GLushort), indexBuffer);
 	}
 	else
 	{
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboIndexID);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, vertIndexCount * sizeof(GLushort), indexBuffer);
-		
-		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboVertexID);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VERT) * vertList->count, vertList);
 		
 		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
 		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
 		glEnableVertexAttribArray(OGLVertexAttributeID_Color);
-		
-		glVertexAttribPointer(OGLVertexAttributeID_Position, 4, GL_FLOAT, GL_FALSE, sizeof(VERT), (const GLvoid *)offsetof(VERT, coord));
-		glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_FLOAT, GL_FALSE, sizeof(VERT), (const GLvoid *)offsetof(VERT, texcoord));
-		glVertexAttribPointer(OGLVertexAttributeID_Color, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(VERT), (const GLvoid *)offsetof(VERT, color));
 	}
 	
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, vertIndexCount * sizeof(GLushort), indexBuffer);
+	
+	// The attribute pointers are pointed at this frame's buffer of the ring. With a
+	// VAO bound, this also updates the buffer that the VAO draws from.
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboVertexID[OGLRef.vboVertexRingIndex]);
+	this->UploadVertices(vertList);
+	
+	glVertexAttribPointer(OGLVertexAttributeID_Position, 4, GL_FLOAT, GL_FALSE, sizeof(OGLESVertex), (const GLvoid *)offsetof(OGLESVertex, coord));
+	glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_FLOAT, GL_FALSE, sizeof(OGLESVertex), (const GLvoid *)offsetof(OGLESVertex, texcoord));
+	glVertexAttribPointer(OGLVertexAttributeID_Color, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(OGLESVertex), (const GLvoid *)offsetof(OGLESVertex, color));
+	
 	return OGLERROR_NOERR;
 }
 
@@ -1445,7 +2580,7 @@ Render3DError OpenGLES2Renderer::SelectRenderingFramebuffer()
 {
 	OGLESRenderRef &OGLRef = *this->ref;
 
-	OGLRef.selectedRenderingFBO = OGLRef.fboFinalOutputID;
+	OGLRef.selectedRenderingFBO = (this->postProgramKey != 0) ? OGLRef.fboPostRenderID : OGLRef.fboFinalOutputID;
 	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.selectedRenderingFBO);
 	
 	return OGLERROR_NOERR;
@@ -1454,15 +2589,78 @@ Render3DError OpenGLES2Renderer::SelectRenderingFramebuffer()
 Render3DError OpenGLES2Renderer::ReadBackPixels()
 {
 	const unsigned int i = this->doubleBufferIndex;
+	OGLESRenderRef &OGLRef = *this->ref;
 	
 	this->gpuScreen3DHasNewData[i] = true;
+	this->gpuScreen3DInFramebuffer[i] = CommonSettings.GFX3D_GPUComposite;
+	
+	if (CommonSettings.GFX3D_GPUComposite)
+	{
+		// Leave the frame in a texture for the frontend, whose context shares this
+		// one's. Only the lines that still mix their 3D on the CPU want it back,
+		// and RenderFinish() reads those straight from the framebuffer.
+		const unsigned int t = OGLRef.compositeIndex = (OGLRef.compositeIndex + 1) % OGLRENDER_COMPOSITE_TEXTURE_COUNT;
+		
+		glBindTexture(GL_TEXTURE_2D, OGLRef.texCompositeID[t]);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->currTextureBinding = 0;
+		
+		if (OGLRef.fenceComposite[t] != NULL)
+		{
+			glESDeleteSync(OGLRef.fenceComposite[t]);
+			OGLRef.fenceComposite[t] = NULL;
+		}
+		
+		if (this->isSyncSupported)
+		{
+			OGLRef.fenceComposite[t] = glESFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glFlush();
+		}
+		else
+		{
+			glFinish();
+		}
+		
+		gpu3DFrame.texture = OGLRef.texCompositeID[t];
+		gpu3DFrame.fence = OGLRef.fenceComposite[t];
+		
+		return OGLERROR_NOERR;
+	}
+	
+	gpu3DFrame.texture = 0;
+	gpu3DFrame.fence = NULL;
+	
+	if (this->isPBOSupported)
+	{
+		// Queue the copy into this frame's PBO and fence it. RenderFinish() only
+		// waits on the fence once the frame is actually needed, which by then has
+		// usually passed.
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[i]);
+		glReadPixels(0, 0, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		
+		if (OGLRef.fenceRenderData[i] != NULL)
+		{
+			glESDeleteSync(OGLRef.fenceRenderData[i]);
+		}
+		OGLRef.fenceRenderData[i] = glESFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+	}
 	
 	return OGLERROR_NOERR;
 }
 
 Render3DError OpenGLES2Renderer::DeleteTexture(const TexCacheItem *item)
 {
-	this->ref->freeTextureIDs.push((GLuint)item->texid);
+	if (item->texid & OGLRENDER_ATLAS_TEXID_FLAG)
+	{
+		this->ref->freeAtlasCells.push((u32)item->texid);
+	}
+	else
+	{
+		this->ref->freeTextureIDs.push((GLuint)item->texid);
+	}
 	if(this->currTexture == item)
 	{
 		this->currTexture = NULL;
@@ -1473,15 +2671,62 @@ Render3DError OpenGLES2Renderer::DeleteTexture(const TexCacheItem *item)
 
 Render3DError OpenGLES2Renderer::BeginRender(const GFX3D_State *renderState)
 {
-	OGLESRenderRef &OGLRef = *this->ref;
 	this->doubleBufferIndex = (this->doubleBufferIndex + 1) & 0x01;
 	
+	// Only the frames with edge marking or fog are drawn with their attributes
+	// for the post pass. The others go straight to the final output as before.
+	this->postProgramKey = 0;
+	if (this->isPostProcessSupported)
+	{
+		if (renderState->enableEdgeMarking)
+		{
+			this->postProgramKey |= OGLPostProgramFlag_EdgeMark;
+		}
+		if (renderState->enableFog)
+		{
+			this->postProgramKey |= OGLPostProgramFlag_Fog;
+			if (renderState->enableFogAlphaOnly)
+			{
+				this->postProgramKey |= OGLPostProgramFlag_FogAlphaOnly;
+			}
+		}
+		if (this->postProgramKey != 0)
+		{
+			if (renderState->enableAlphaBlending)
+			{
+				this->postProgramKey |= OGLPostProgramFlag_AlphaBlend;
+			}
+			if (this->isFramebufferFetchSupported && !(this->postProgramKey & OGLPostProgramFlag_EdgeMark))
+			{
+				this->postProgramKey |= OGLPostProgramFlag_FramebufferFetch;
+			}
+			
+			this->UpdatePostTables(renderState);
+		}
+	}
+	
 	this->SelectRenderingFramebuffer();
 	
-	glUniform1i(OGLRef.uniformEnableAlphaTest, renderState->enableAlphaTest ? GL_TRUE : GL_FALSE);
-	glUniform1f(OGLRef.uniformAlphaTestRef, divide5bitBy31_LUT[renderState->alphaTestRef]);
-	glUniform1i(OGLRef.uniformToonShadingMode, renderState->shading);
-	glUniform1i(OGLRef.uniformWBuffer, renderState->wbuffer);
+	// The alpha test, the toon shading mode and the attributes stay the same for the whole frame
+	this->shaderVariantKey &= ~(OGLShaderVariantFlag_AlphaTest | OGLShaderVariantFlag_ToonHighlight | OGLShaderVariantFlag_Attributes);
+	if (this->postProgramKey != 0)
+	{
+		this->shaderVariantKey |= OGLShaderVariantFlag_Attributes;
+	}
+	if (renderState->enableAlphaTest)
+	{
+		this->shaderVariantKey |= OGLShaderVariantFlag_AlphaTest;
+	}
+	if (renderState->shading)
+	{
+		this->shaderVariantKey |= OGLShaderVariantFlag_ToonHighlight;
+	}
+	
+	this->shaderAlphaTestRef = divide5bitBy31_LUT[renderState->alphaTestRef];
+	this->shaderUniformsDirty = true;
+	
+	// Something else may have been bound since the last frame
+	this->currTextureBinding = 0;
 	
 	if(renderState->enableAlphaBlending)
 	{
@@ -1502,6 +2747,11 @@ Render3DError OpenGLES2Renderer::PreRender(const GFX3D_State *renderState, const
 	OGLESRenderRef &OGLRef = *this->ref;
 	unsigned int vertIndexCount = 0;
 	
+	if (this->postProgramKey != 0)
+	{
+		this->ClearAttributes(renderState);
+	}
+	
 	this->SetupVertices(vertList, polyList, indexList, OGLRef.vertIndexBuffer, &vertIndexCount);
 	this->EnableVertexAttributes(vertList, OGLRef.vertIndexBuffer, vertIndexCount);
 	
@@ -1530,19 +2780,50 @@ Render3DError OpenGLES2Renderer::DoRender(const GFX3D_State *renderState, const
 	
 	static const unsigned int indexIncrementLUT[] = {3, 6, 3, 6, 3, 4, 3, 4};
 	
+	// Consecutive triangle polygons that change none of the states below are
+	// batched up and drawn together. Their indices are already contiguous.
+	GLenum drawPrimitive = GL_TRIANGLES;
+	unsigned int drawIndexCount = 0;
+	
 	for(unsigned int i = 0; i < polyCount; i++)
 	{
 		const POLY *poly = &polyList->list[indexList->list[i]];
 		
+		// In wireframe mode, redefine all primitives as GL_LINE_LOOP rather than
+		// setting the polygon mode to GL_LINE though glPolygonMode(). Not only is
+		// drawing more accurate this way, but it also allows GFX3D_QUADS and
+		// GFX3D_QUAD_STRIP primitives to properly draw as wireframe without the
+		// extra diagonal line.
+		const GLenum polyPrimitive = !poly->isWireframe() ? oglPrimitiveType[poly->vtxFormat] : GL_LINE_LOOP;
+		const unsigned int vertIndexCount = indexIncrementLUT[poly->vtxFormat];
+		
+		const bool polyChanged = (lastPolyAttr != poly->polyAttr || i == 0);
+		const bool texChanged = (lastTexParams != poly->texParam || lastTexPalette != poly->texPalette || i == 0);
+		const bool viewportChanged = (lastViewport != poly->viewport || i == 0);
+		
+		if (!polyChanged && !texChanged && !viewportChanged &&
+			polyPrimitive == GL_TRIANGLES && drawPrimitive == GL_TRIANGLES)
+		{
+			drawIndexCount += vertIndexCount;
+			continue;
+		}
+		
+		// Render the polygons so far before any state changes
+		if (drawIndexCount > 0)
+		{
+			glDrawElements(drawPrimitive, drawIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+			indexBufferPtr += drawIndexCount;
+		}
+		
 		// Set up the polygon if it changed
-		if(lastPolyAttr != poly->polyAttr || i == 0)
+		if (polyChanged)
 		{
 			lastPolyAttr = poly->polyAttr;
 			this->SetupPolygon(poly);
 		}
 		
 		// Set up the texture if it changed
-		if(lastTexParams != poly->texParam || lastTexPalette != poly->texPalette || i == 0)
+		if (texChanged)
 		{
 			lastTexParams = poly->texParam;
 			lastTexPalette = poly->texPalette;
@@ -1550,23 +2831,21 @@ Render3DError OpenGLES2Renderer::DoRender(const GFX3D_State *renderState, const
 		}
 		
 		// Set up the viewport if it changed
-		if(lastViewport != poly->viewport || i == 0)
+		if (viewportChanged)
 		{
 			lastViewport = poly->viewport;
 			this->SetupViewport(poly);
 		}
 		
-		// In wireframe mode, redefine all primitives as GL_LINE_LOOP rather than
-		// setting the polygon mode to GL_LINE though glPolygonMode(). Not only is
-		// drawing more accurate this way, but it also allows GFX3D_QUADS and
-		// GFX3D_QUAD_STRIP primitives to properly draw as wireframe without the
-		// extra diagonal line.
-		const GLenum polyPrimitive = !poly->isWireframe() ? oglPrimitiveType[poly->vtxFormat] : GL_LINE_LOOP;
+		this->SelectShaderVariant();
 		
-		// Render the polygon
-		const unsigned int vertIndexCount = indexIncrementLUT[poly->vtxFormat];
-		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-		indexBufferPtr += vertIndexCount;
+		drawPrimitive = polyPrimitive;
+		drawIndexCount = vertIndexCount;
+	}
+	
+	if (drawIndexCount > 0)
+	{
+		glDrawElements(drawPrimitive, drawIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
 	}
 	
 	return OGLERROR_NOERR;
@@ -1576,6 +2855,11 @@ Render3DError OpenGLES2Renderer::PostRender()
 {
 	this->DisableVertexAttributes();
 	
+	if (this->postProgramKey != 0)
+	{
+		this->RenderPostProcess();
+	}
+	
 	return OGLERROR_NOERR;
 }
 
@@ -1731,15 +3015,15 @@ Render3DError OpenGLES2Renderer::SetupPolygon(const POLY *thePoly)
 	static unsigned int lastTexBlendMode = 0;
 	static int lastStencilState = -1;
 	
-	OGLESRenderRef &OGLRef = *this->ref;
 	const PolygonAttributes attr = thePoly->getAttributes();
 	
 	// Set up polygon ID
-	glUniform1i(OGLRef.uniformPolyID, attr.polygonID);
+	this->shaderPolyID = attr.polygonID;
 	
 	// Set up alpha value
-	const GLfloat thePolyAlpha = (!attr.isWireframe && attr.isTranslucent) ? divide5bitBy31_LUT[attr.alpha] : 1.0f;
-	glUniform1f(OGLRef.uniformPolyAlpha, thePolyAlpha);
+	this->shaderPolyAlpha = (!attr.isWireframe && attr.isTranslucent) ? divide5bitBy31_LUT[attr.alpha] : 1.0f;
+	this->shaderPolyAttribute = (GLfloat)((attr.polygonID << 1) | (attr.enableRenderFog ? 1 : 0)) / 255.0f;
+	this->shaderUniformsDirty = true;
 	
 	// Set up depth test mode
 	static const GLenum oglDepthFunc[2] = {GL_LESS, GL_EQUAL};
@@ -1823,12 +3107,13 @@ Render3DError OpenGLES2Renderer::SetupPolygon(const POLY *thePoly)
 	glDepthMask(enableDepthWrite);
 	
 	// Set up texture blending mode
+	this->shaderVariantKey &= ~OGLShaderVariantFlag_PolygonModeMask;
+	this->shaderVariantKey |= attr.polygonMode << OGLShaderVariantFlag_PolygonModeShift;
+	
 	if(attr.polygonMode != lastTexBlendMode)
 	{
 		lastTexBlendMode = attr.polygonMode;
 		
-		glUniform1i(OGLRef.uniformPolygonMode, attr.polygonMode);
-			
 		// Update the toon table if necessary
 		if (this->toonTableNeedsUpdate && attr.polygonMode == 2)
 		{
@@ -1848,13 +3133,13 @@ Render3DError OpenGLES2Renderer::SetupTexture(const POLY *thePoly, bool enableTe
 	// Check if we need to use textures
 	if (thePoly->texParam == 0 || params.texFormat == TEXMODE_NONE || !enableTexturing)
 	{
-		glUniform1i(OGLRef.uniformHasTexture, GL_FALSE);
+		this->shaderVariantKey &= ~OGLShaderVariantFlag_Texture;
 		
 		return OGLERROR_NOERR;
 	}
 	
 	// Enable textures if they weren't already enabled
-	glUniform1i(OGLRef.uniformHasTexture, GL_TRUE);
+	this->shaderVariantKey |= OGLShaderVariantFlag_Texture;
 	
 	//	texCacheUnit.TexCache_SetTexture<TexFormat_32bpp>(format, texpal);
 	TexCacheItem *newTexture = TexCache_SetTexture(TexFormat_32bpp, thePoly->texParam, thePoly->texPalette);
@@ -1866,32 +3151,152 @@ Render3DError OpenGLES2Renderer::SetupTexture(const POLY *thePoly, bool enableTe
 		{
 			this->currTexture->deleteCallback = texDeleteCallback;
 			
-			if(OGLRef.freeTextureIDs.empty())
+			// A 4x4 texture is at most 4 colors a block, so ASTC 4x4 often
+			// holds it exactly, in a quarter of the memory. The atlas is
+			// RGBA, so those get a texture of their own
+			bool isASTC = false;
+			if (this->isASTCSupported && this->currTexture->getTextureMode() == TEXMODE_4X4)
 			{
-				this->ExpandFreeTextures();
+				OGLRef.astcBuffer.resize(TexCache_ASTC4x4Size(this->currTexture->sizeX, this->currTexture->sizeY));
+				isASTC = TexCache_EncodeASTC4x4((const u32 *)this->currTexture->views[TexFormat_32bpp].decoded,
+				                                this->currTexture->sizeX, this->currTexture->sizeY, &OGLRef.astcBuffer[0]);
 			}
 			
-			this->currTexture->texid = (u64)OGLRef.freeTextureIDs.front();
-			OGLRef.freeTextureIDs.pop();
-			
-			glBindTexture(GL_TEXTURE_2D, (GLuint)this->currTexture->texid);
-			
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (params.enableRepeatS ? (params.enableMirroredRepeatS ? OGLRef.stateTexMirroredRepeat : GL_REPEAT) : GL_CLAMP_TO_EDGE));
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (params.enableRepeatT ? (params.enableMirroredRepeatT ? OGLRef.stateTexMirroredRepeat : GL_REPEAT) : GL_CLAMP_TO_EDGE));
-			
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-						 this->currTexture->sizeX, this->currTexture->sizeY, 0,
-						 GL_RGBA, GL_UNSIGNED_BYTE, this->currTexture->decoded);
+			const bool fitsCell = this->currTexture->sizeX <= OGLRENDER_ATLAS_CELL_SIZE && this->currTexture->sizeY <= OGLRENDER_ATLAS_CELL_SIZE;
+			if (!isASTC && fitsCell && !OGLRef.freeAtlasCells.empty())
+			{
+				const u32 cell = OGLRef.freeAtlasCells.front();
+				OGLRef.freeAtlasCells.pop();
+				this->currTexture->texid = OGLRENDER_ATLAS_TEXID_FLAG | cell;
+				
+				const u32 cellInAtlas = cell % OGLRENDER_ATLAS_CELLS;
+				this->BindTexture(OGLRef.texAtlasID[cell / OGLRENDER_ATLAS_CELLS]);
+				glTexSubImage2D(GL_TEXTURE_2D, 0,
+								(cellInAtlas % OGLRENDER_ATLAS_CELLS_PER_ROW) * OGLRENDER_ATLAS_CELL_SIZE,
+								(cellInAtlas / OGLRENDER_ATLAS_CELLS_PER_ROW) * OGLRENDER_ATLAS_CELL_SIZE,
+								this->currTexture->sizeX, this->currTexture->sizeY,
+								GL_RGBA, GL_UNSIGNED_BYTE, this->currTexture->views[TexFormat_32bpp].decoded);
+			}
+			else
+			{
+				if(OGLRef.freeTextureIDs.empty())
+				{
+					this->ExpandFreeTextures();
+				}
+				
+				this->currTexture->texid = (u64)OGLRef.freeTextureIDs.front();
+				OGLRef.freeTextureIDs.pop();
+				
+				this->BindTexture((GLuint)this->currTexture->texid);
+				
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (params.enableRepeatS ? (params.enableMirroredRepeatS ? OGLRef.stateTexMirroredRepeat : GL_REPEAT) : GL_CLAMP_TO_EDGE));
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (params.enableRepeatT ? (params.enableMirroredRepeatT ? OGLRef.stateTexMirroredRepeat : GL_REPEAT) : GL_CLAMP_TO_EDGE));
+				
+				if (isASTC)
+				{
+					glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_ASTC_4x4_KHR,
+										   this->currTexture->sizeX, this->currTexture->sizeY, 0,
+										   (GLsizei)OGLRef.astcBuffer.size(), &OGLRef.astcBuffer[0]);
+				}
+				else
+				{
+					glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+								 this->currTexture->sizeX, this->currTexture->sizeY, 0,
+								 GL_RGBA, GL_UNSIGNED_BYTE, this->currTexture->views[TexFormat_32bpp].decoded);
+				}
+			}
+		}
+		else if (this->currTexture->texid & OGLRENDER_ATLAS_TEXID_FLAG)
+		{
+			//otherwise, just bind it. textures in the same atlas don't even need that
+			this->BindTexture(OGLRef.texAtlasID[(u32)this->currTexture->texid / OGLRENDER_ATLAS_CELLS]);
 		}
 		else
 		{
-			//otherwise, just bind it
-			glBindTexture(GL_TEXTURE_2D, (GLuint)this->currTexture->texid);
+			this->BindTexture((GLuint)this->currTexture->texid);
+		}
+		
+		this->shaderTexScale[0] = this->currTexture->invSizeX;
+		this->shaderTexScale[1] = this->currTexture->invSizeY;
+		this->shaderUniformsDirty = true;
+	}
+	
+	if (this->currTexture->texid & OGLRENDER_ATLAS_TEXID_FLAG)
+	{
+		// The wrap modes come from the polygon, which may not have been the
+		// one that made the texture
+		static const GLfloat invAtlasSize = 1.0f / OGLRENDER_ATLAS_SIZE;
+		const u32 cellInAtlas = (u32)this->currTexture->texid % OGLRENDER_ATLAS_CELLS;
+		
+		this->shaderVariantKey |= OGLShaderVariantFlag_TextureAtlas;
+		this->shaderAtlasRect[0] = (GLfloat)((cellInAtlas % OGLRENDER_ATLAS_CELLS_PER_ROW) * OGLRENDER_ATLAS_CELL_SIZE) * invAtlasSize;
+		this->shaderAtlasRect[1] = (GLfloat)((cellInAtlas / OGLRENDER_ATLAS_CELLS_PER_ROW) * OGLRENDER_ATLAS_CELL_SIZE) * invAtlasSize;
+		this->shaderAtlasRect[2] = (GLfloat)this->currTexture->sizeX * invAtlasSize;
+		this->shaderAtlasRect[3] = (GLfloat)this->currTexture->sizeY * invAtlasSize;
+		this->shaderAtlasWrap[0] = params.enableRepeatS ? 1.0f : 0.0f;
+		this->shaderAtlasWrap[1] = params.enableRepeatT ? 1.0f : 0.0f;
+		this->shaderAtlasWrap[2] = params.enableMirroredRepeatS ? 1.0f : 0.0f;
+		this->shaderAtlasWrap[3] = params.enableMirroredRepeatT ? 1.0f : 0.0f;
+		this->shaderAtlasClamp[0] = 0.5f * this->currTexture->invSizeX;
+		this->shaderAtlasClamp[1] = 0.5f * this->currTexture->invSizeY;
+		this->shaderAtlasClamp[2] = 1.0f - this->shaderAtlasClamp[0];
+		this->shaderAtlasClamp[3] = 1.0f - this->shaderAtlasClamp[1];
+		this->shaderUniformsDirty = true;
+	}
+	else
+	{
+		this->shaderVariantKey &= ~OGLShaderVariantFlag_TextureAtlas;
+	}
+	
+	return OGLERROR_NOERR;
+}
+
+void OpenGLES2Renderer::BindTexture(const GLuint textureID)
+{
+	if (textureID != this->currTextureBinding)
+	{
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		this->currTextureBinding = textureID;
+	}
+}
+
+Render3DError OpenGLES2Renderer::SelectShaderVariant()
+{
+	OGLESRenderRef &OGLRef = *this->ref;
+	const u32 key = GetShaderVariantKey(this->shaderVariantKey);
+	const OGLESShaderVariant &variant = OGLRef.shaderVariant[key];
+	
+	if (key != this->currShaderVariantKey)
+	{
+		if (variant.program == 0)
+		{
+			return OGLERROR_SHADER_CREATE_ERROR;
 		}
 		
-		glUniform2f(OGLRef.uniformTexScale, this->currTexture->invSizeX, this->currTexture->invSizeY);
+		glUseProgram(variant.program);
+		this->currShaderVariantKey = key;
+		this->shaderUniformsDirty = true;
+	}
+	
+	if (this->shaderUniformsDirty)
+	{
+		glUniform1i(variant.uniformPolyID, this->shaderPolyID);
+		glUniform1f(variant.uniformPolyAlpha, this->shaderPolyAlpha);
+		glUniform2f(variant.uniformTexScale, this->shaderTexScale[0], this->shaderTexScale[1]);
+		glUniform1f(variant.uniformAlphaTestRef, this->shaderAlphaTestRef);
+		if (key & OGLShaderVariantFlag_Attributes)
+		{
+			glUniform1f(variant.uniformPolyAttribute, this->shaderPolyAttribute);
+		}
+		if (key & OGLShaderVariantFlag_TextureAtlas)
+		{
+			glUniform4fv(variant.uniformAtlasRect, 1, this->shaderAtlasRect);
+			glUniform4fv(variant.uniformAtlasWrap, 1, this->shaderAtlasWrap);
+			glUniform4fv(variant.uniformAtlasClamp, 1, this->shaderAtlasClamp);
+		}
+		this->shaderUniformsDirty = false;
 	}
 	
 	return OGLERROR_NOERR;
@@ -1912,30 +3317,44 @@ Render3DError OpenGLES2Renderer::Reset()
 	
 	this->gpuScreen3DHasNewData[0] = false;
 	this->gpuScreen3DHasNewData[1] = false;
+	this->gpuScreen3DInFramebuffer[0] = false;
+	this->gpuScreen3DInFramebuffer[1] = false;
 	
 	glFinish();
 	
 	for (unsigned int i = 0; i < 2; i++)
 	{
 		memset(this->GPU_screen3D[i], 0, sizeof(this->GPU_screen3D[i]));
+		
+		if (OGLRef.fenceRenderData[i] != NULL)
+		{
+			glESDeleteSync(OGLRef.fenceRenderData[i]);
+			OGLRef.fenceRenderData[i] = NULL;
+		}
 	}
 	
 	memset(currentToonTable32, 0, sizeof(currentToonTable32));
 	this->UpdateToonTable((u16*)currentToonTable32);
 	this->toonTableNeedsUpdate = true;
 	
-	glUniform1f(OGLRef.uniformPolyAlpha, 1.0f);
-	glUniform2f(OGLRef.uniformTexScale, 1.0f, 1.0f);
-	glUniform1i(OGLRef.uniformPolyID, 0);
-	glUniform1i(OGLRef.uniformHasTexture, GL_FALSE);
-	glUniform1i(OGLRef.uniformPolygonMode, 0);
-	glUniform1i(OGLRef.uniformToonShadingMode, 0);
-	glUniform1i(OGLRef.uniformWBuffer, 0);
-	glUniform1i(OGLRef.uniformEnableAlphaTest, GL_TRUE);
-	glUniform1f(OGLRef.uniformAlphaTestRef, 0.0f);
+	this->shaderVariantKey = OGLShaderVariantFlag_AlphaTest;
+	this->currShaderVariantKey = OGLRENDER_SHADER_VARIANT_COUNT;
+	this->shaderUniformsDirty = true;
+	this->shaderPolyID = 0;
+	this->shaderPolyAlpha = 1.0f;
+	this->shaderTexScale[0] = 1.0f;
+	this->shaderTexScale[1] = 1.0f;
+	this->shaderAlphaTestRef = 0.0f;
+	this->shaderPolyAttribute = 0.0f;
+	this->postProgramKey = 0;
+	this->postTablesNeedUpdate = true;
+	memset(this->shaderAtlasRect, 0, sizeof(this->shaderAtlasRect));
+	memset(this->shaderAtlasWrap, 0, sizeof(this->shaderAtlasWrap));
+	memset(this->shaderAtlasClamp, 0, sizeof(this->shaderAtlasClamp));
 	
 	memset(OGLRef.vertIndexBuffer, 0, OGLRENDER_VERT_INDEX_BUFFER_COUNT * sizeof(GLushort));
 	this->currTexture = NULL;
+	this->currTextureBinding = 0;
 	this->doubleBufferIndex = 0;
 	this->clearImageStencilValue = 0;
 	
@@ -1953,9 +3372,43 @@ Render3DError OpenGLES2Renderer::RenderFinish()
 	
 	OGLESRenderRef &OGLRef = *this->ref;
 	
-	u32 *__restrict workingBuffer = this->GPU_screen3D[i];
-	glReadPixels(0, 0, 256, 192, GL_RGBA, GL_UNSIGNED_BYTE, workingBuffer);
-	this->ConvertFramebuffer(workingBuffer, (u32 *)gfx3d_convertedScreen);
+	bool didReadBack = false;
+	
+	if (this->isPBOSupported && !this->gpuScreen3DInFramebuffer[i])
+	{
+		if (OGLRef.fenceRenderData[i] != NULL)
+		{
+			GLenum waitResult;
+			do
+			{
+				waitResult = glESClientWaitSync(OGLRef.fenceRenderData[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+			} while (waitResult == GL_TIMEOUT_EXPIRED);
+			
+			glESDeleteSync(OGLRef.fenceRenderData[i]);
+			OGLRef.fenceRenderData[i] = NULL;
+		}
+		
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[i]);
+		
+		const u32 *__restrict mappedBufferPtr = (const u32 *__restrict)glESMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GFX3D_FRAMEBUFFER_WIDTH * GFX3D_FRAMEBUFFER_HEIGHT * sizeof(u32), GL_MAP_READ_BIT);
+		if (mappedBufferPtr != NULL)
+		{
+			this->ConvertFramebuffer(mappedBufferPtr, (u32 *)gfx3d_convertedScreen);
+			glESUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			didReadBack = true;
+		}
+		
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	
+	// Without PBOs, or if the PBO couldn't be mapped, read the framebuffer directly.
+	// It still holds this frame, since nothing is rendered before it is consumed.
+	if (!didReadBack)
+	{
+		u32 *__restrict workingBuffer = this->GPU_screen3D[i];
+		glReadPixels(0, 0, 256, 192, GL_RGBA, GL_UNSIGNED_BYTE, workingBuffer);
+		this->ConvertFramebuffer(workingBuffer, (u32 *)gfx3d_convertedScreen);
+	}
 	
 	this->gpuScreen3DHasNewData[i] = false;
 	
@@ -23,11 +23,13 @@
 #include <queue>
 #include <set>
 #include <string>
+#include <vector>
 #include "render3D.h"
 #include "types.h"
 
 #ifndef OGLES3RENDER_H
 #include <GLES2/gl2.h>
+#include <GLES3/gl3.h> // Only for the types of the GLES3 readback functions below
 #include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
 
@@ -96,6 +98,17 @@ EXTERNOGLEXT(PFNGLFRAMEBUFFERTEXTUREEXTPROC, glFramebufferTextureEXT)
 EXTERNOGLEXT(PFNGLDELETEFRAMEBUFFERSPROC, glESDeleteFramebuffers)
 //EXTERNOGLEXT(PFNGLBLITFRAMEBUFFERNVPROC, glBlitFramebufferNV)
 
+// PBO readback (GLES3 contexts only)
+EXTERNOGLEXT(PFNGLMAPBUFFERRANGEPROC, glESMapBufferRange)
+EXTERNOGLEXT(PFNGLUNMAPBUFFERPROC, glESUnmapBuffer)
+EXTERNOGLEXT(PFNGLFENCESYNCPROC, glESFenceSync)
+EXTERNOGLEXT(PFNGLCLIENTWAITSYNCPROC, glESClientWaitSync)
+EXTERNOGLEXT(PFNGLDELETESYNCPROC, glESDeleteSync)
+
+// Program binaries
+EXTERNOGLEXT(PFNGLGETPROGRAMBINARYOESPROC, glGetProgramBinaryOES)
+EXTERNOGLEXT(PFNGLPROGRAMBINARYOESPROC, glProgramBinaryOES)
+
 #else // OGLES3RENDER_H
 
 // Basic functions
@@ -176,6 +189,23 @@ EXTERNOGLEXT(PFNGLDELETERENDERBUFFERSPROC, glESDeleteRenderbuffers)
 
 #define OGLRENDER_MAX_MULTISAMPLES			16
 #define OGLRENDER_VERT_INDEX_BUFFER_COUNT	131072
+#define OGLRENDER_VERT_BUFFER_RING_SIZE		3
+#define OGLRENDER_SHADER_VARIANT_COUNT		128
+#define OGLRENDER_POST_PROGRAM_COUNT		32
+
+// Textures up to a cell in size share a few big atlas textures instead of each
+// having its own, so that drawing them doesn't mean binding each of them. The
+// texid of a texture in an atlas is its cell, with OGLRENDER_ATLAS_TEXID_FLAG.
+#define OGLRENDER_ATLAS_SIZE				512
+#define OGLRENDER_ATLAS_CELL_SIZE			64
+#define OGLRENDER_ATLAS_CELLS_PER_ROW		(OGLRENDER_ATLAS_SIZE / OGLRENDER_ATLAS_CELL_SIZE)
+#define OGLRENDER_ATLAS_CELLS				(OGLRENDER_ATLAS_CELLS_PER_ROW * OGLRENDER_ATLAS_CELLS_PER_ROW)
+#define OGLRENDER_ATLAS_COUNT				4
+#define OGLRENDER_ATLAS_TEXID_FLAG			0x100000000ULL
+
+// Frames left for the frontend to composite (CommonSettings.GFX3D_GPUComposite)
+// go round this many textures, so that the ones it has queued aren't drawn over.
+#define OGLRENDER_COMPOSITE_TEXTURE_COUNT	4
 
 enum OGLVertexAttributeID
 {
@@ -188,7 +218,37 @@ enum OGLTextureUnitID
 {
 	// Main textures will always be on texture unit 0.
 	OGLTextureUnitID_ToonTable = 1,
-	OGLTextureUnitID_ClearImage
+	OGLTextureUnitID_ClearImage,
+	OGLTextureUnitID_PostColor,
+	OGLTextureUnitID_PostAttributes,
+	OGLTextureUnitID_EdgeColor,
+	OGLTextureUnitID_FogTable
+};
+
+// The render states that are compiled into each fragment shader variant
+// instead of being branched on at runtime. Together they form the index
+// of the variant.
+enum OGLShaderVariantFlag
+{
+	OGLShaderVariantFlag_Texture			= 0x01,
+	OGLShaderVariantFlag_PolygonModeShift	= 1,
+	OGLShaderVariantFlag_PolygonModeMask	= 0x06,
+	OGLShaderVariantFlag_ToonHighlight		= 0x08, // Only meaningful for toon polygons
+	OGLShaderVariantFlag_AlphaTest			= 0x10,
+	OGLShaderVariantFlag_TextureAtlas		= 0x20, // Only meaningful for textured polygons
+	OGLShaderVariantFlag_Attributes			= 0x40  // Also writes what the post pass needs
+};
+
+// The states that are compiled into each program of the post pass, which
+// does the edge marking and the fog in one go. Together they form the index
+// of the program.
+enum OGLPostProgramFlag
+{
+	OGLPostProgramFlag_EdgeMark			= 0x01,
+	OGLPostProgramFlag_Fog				= 0x02,
+	OGLPostProgramFlag_FogAlphaOnly		= 0x04,
+	OGLPostProgramFlag_AlphaBlend		= 0x08,
+	OGLPostProgramFlag_FramebufferFetch	= 0x10  // Only without the edge marking, which reads the neighbours
 };
 
 enum OGLErrorCode
@@ -209,17 +269,49 @@ enum OGLErrorCode
 	OGLERROR_FBO_CREATE_ERROR
 };
 
+// The vertex layout uploaded to the GPU. It only holds what the shaders read,
+// which is less than a third of a VERT.
+struct OGLESVertex
+{
+	GLfloat coord[4];
+	GLfloat texcoord[2];
+	GLubyte color[4];
+};
+
+// A linked shader program and the locations of the uniforms that still
+// change between polygons.
+struct OGLESShaderVariant
+{
+	GLuint program;
+	GLint uniformPolyID;
+	GLint uniformPolyAlpha;
+	GLint uniformTexScale;
+	GLint uniformAlphaTestRef;
+	GLint uniformAtlasRect;
+	GLint uniformAtlasWrap;
+	GLint uniformAtlasClamp;
+	GLint uniformPolyAttribute;
+};
+
+struct OGLESPostProgram
+{
+	GLuint program;
+	GLint uniformFogColor;
+};
+
 struct OGLESRenderRef
 {	
 	// OpenGL Feature Support
 	GLint stateTexMirroredRepeat;
 	
 	// VBO
-	GLuint vboVertexID;
+	GLuint vboVertexID[OGLRENDER_VERT_BUFFER_RING_SIZE];
+	unsigned int vboVertexRingIndex;
 	GLuint iboIndexID;
 
 	// PBO
 	GLuint pboRenderDataID[2];
+	GLsync fenceRenderData[2];
 	
 	// FBO
 	GLuint texClearImageColorID;
@@ -237,32 +329,40 @@ struct OGLESRenderRef
 	
 	// Shader states
 	GLuint vertexShaderID;
-	GLuint fragmentShaderID;
-	GLuint shaderProgram;
-	
-	GLint uniformPolyID;
-	GLint uniformPolyAlpha;
-
-	GLint uniformTexScale;
-	GLint uniformHasTexture;
-	GLint uniformPolygonMode;
-	GLint uniformToonShadingMode;
-	GLint uniformWBuffer;
-	GLint uniformEnableAlphaTest;
-	GLint uniformAlphaTestRef;
+	OGLESShaderVariant shaderVariant[OGLRENDER_SHADER_VARIANT_COUNT];
 	
 	GLuint texToonTableID;
 	
+	// Post pass. The frames that need it are drawn into fboPostRenderID, whose
+	// second color attachment holds the polygon ID, the fog flag and the depth
+	// of each pixel.
+	GLuint fboPostRenderID;
+	GLuint texPostColorID;
+	GLuint texPostAttributesID;
+	GLuint rboPostDepthStencilID;
+	GLuint vboPostVertexID;
+	GLuint texEdgeColorID;
+	GLuint texFogTableID;
+	GLuint postVertexShaderID;
+	OGLESPostProgram postProgram[OGLRENDER_POST_PROGRAM_COUNT];
+	
 	// VAO
 	GLuint vaoMainStatesID;
 	
 	// Textures
 	std::queue<GLuint> freeTextureIDs;
+	GLuint texAtlasID[OGLRENDER_ATLAS_COUNT];
+	std::queue<u32> freeAtlasCells;
+	std::vector<u8> astcBuffer; // The 4x4 textures ASTC can hold, on their way up
+	GLuint texCompositeID[OGLRENDER_COMPOSITE_TEXTURE_COUNT];
+	GLsync fenceComposite[OGLRENDER_COMPOSITE_TEXTURE_COUNT];
+	unsigned int compositeIndex;
 	
 	// Client-side Buffers
     //DS_ALIGN(16) GLushort vertIndexBuffer[OGLRENDER_VERT_INDEX_BUFFER_COUNT];
     GLfloat *color4fBuffer;
     CACHE_ALIGN GLushort vertIndexBuffer[OGLRENDER_VERT_INDEX_BUFFER_COUNT];
+	std::vector<OGLESVertex> vertUploadBuffer; // Only used when the vertex buffers can't be mapped
 };
 
 struct GFX3D_State;
@@ -313,29 +413,69 @@ protected:
 	
 	// OpenGL Feature Support
     bool isVBOSupported;
+    bool isMapBufferSupported;
+    bool isPBOSupported;
     bool isFBOSupported;
 	bool isVAOSupported;
     bool isShaderSupported;
-
+	bool isProgramBinarySupported;
+	bool isSyncSupported;
+	bool isPostProcessSupported;
+	bool isFramebufferFetchSupported;
+	bool isASTCSupported;
+	
+	// Shader variants. The uniforms are kept here and only uploaded to the
+	// selected variant when it's about to draw.
+	std::string fragmentShaderSource;
+	u32 shaderVariantKey;
+	u32 currShaderVariantKey;
+	u32 shaderCacheTag;
+	bool shaderUniformsDirty;
+	GLint shaderPolyID;
+	GLfloat shaderPolyAlpha;
+	GLfloat shaderTexScale[2];
+	GLfloat shaderAlphaTestRef;
+	GLfloat shaderAtlasRect[4];
+	GLfloat shaderAtlasWrap[4];
+	GLfloat shaderAtlasClamp[4];
+	GLfloat shaderPolyAttribute;
+	
+	// The post pass of this frame, or 0 if it has none
+	u32 postProgramKey;
+	GLfloat postFogColor[4];
+	bool postTablesNeedUpdate;
+	u16 currentEdgeColors16[8];
+	bool currentEdgeAntialias;
+	u8 currentFogDensity[32];
+	u32 currentFogOffset;
+	u32 currentFogShift;
 	
 	// Textures
 	TexCacheItem *currTexture;
+	GLuint currTextureBinding;
 	
 	u32 currentToonTable32[32];
 	bool toonTableNeedsUpdate;
 	
 	DS_ALIGN(16) u32 GPU_screen3D[2][256 * 192 * sizeof(u32)];
 	bool gpuScreen3DHasNewData[2];
+	bool gpuScreen3DInFramebuffer[2]; // Left for compositing, so not queued for reading back
 	unsigned int doubleBufferIndex;
 	u8 clearImageStencilValue;
 	
 	// OpenGL-specific methods
 	virtual Render3DError CreateVBOs() = 0;
 	virtual void DestroyVBOs() = 0;
+	virtual Render3DError CreatePBOs() = 0;
+	virtual void DestroyPBOs() = 0;
 	virtual Render3DError CreateFBOs() = 0;
 	virtual void DestroyFBOs() = 0;
 	virtual Render3DError CreateShaders(const std::string *vertexShaderProgram, const std::string *fragmentShaderProgram) = 0;
 	virtual void DestroyShaders() = 0;
+	virtual Render3DError CreateShaderVariant(const u32 key) = 0;
+	virtual Render3DError InitShaderVariant(const u32 key) = 0;
+	virtual Render3DError LoadShaderCache() = 0;
+	virtual Render3DError SaveShaderCache() = 0;
 	virtual Render3DError CreateVAOs() = 0;
 	virtual void DestroyVAOs() = 0;
 	virtual Render3DError InitTextures() = 0;
@@ -343,7 +483,7 @@ protected:
 	virtual Render3DError InitTables() = 0;
 	
 	virtual Render3DError LoadShaderPrograms(std::string *outVertexShaderProgram, std::string *outFragmentShaderProgram) = 0;
-	virtual Render3DError SetupShaderIO() = 0;
+	virtual Render3DError SetupShaderIO(const GLuint program) = 0;
 	virtual Render3DError CreateToonTable() = 0;
 	virtual Render3DError DestroyToonTable() = 0;
 	virtual Render3DError UploadToonTable(const GLuint *toonTableBuffer) = 0;
@@ -353,10 +493,22 @@ protected:
 	
 	virtual void GetExtensionSet(std::set<std::string> *oglExtensionSet) = 0;
 	virtual Render3DError ExpandFreeTextures() = 0;
+	virtual Render3DError CreateTextureAtlases() = 0;
+	virtual void DestroyTextureAtlases() = 0;
+	virtual Render3DError CreateCompositeTextures() = 0;
+	virtual void DestroyCompositeTextures() = 0;
+	virtual Render3DError CreatePostProcess() = 0;
+	virtual void DestroyPostProcess() = 0;
+	virtual Render3DError CreatePostProgram(const u32 key) = 0;
+	virtual Render3DError UpdatePostTables(const GFX3D_State *renderState) = 0;
+	virtual Render3DError ClearAttributes(const GFX3D_State *renderState) = 0;
+	virtual Render3DError RenderPostProcess() = 0;
 	virtual Render3DError SetupVertices(const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList, GLushort *outIndexBuffer, unsigned int *outIndexCount) = 0;
+	virtual Render3DError UploadVertices(const VERTLIST *vertList) = 0;
 	virtual Render3DError EnableVertexAttributes(const VERTLIST *vertList, const GLushort *indexBuffer, const unsigned int vertIndexCount) = 0;
 	virtual Render3DError DisableVertexAttributes() = 0;
 	virtual Render3DError SelectRenderingFramebuffer() = 0;
+	virtual Render3DError SelectShaderVariant() = 0;
 	virtual Render3DError ReadBackPixels() = 0;
 	
 	// Base rendering methods
@@ -400,10 +552,16 @@ protected:
 	// OpenGL-specific methods
 	virtual Render3DError CreateVBOs();
 	virtual void DestroyVBOs();
+	virtual Render3DError CreatePBOs();
+	virtual void DestroyPBOs();
 	virtual Render3DError CreateFBOs();
 	virtual void DestroyFBOs();
 	virtual Render3DError CreateShaders(const std::string *vertexShaderProgram, const std::string *fragmentShaderProgram);
 	virtual void DestroyShaders();
+	virtual Render3DError CreateShaderVariant(const u32 key);
+	virtual Render3DError InitShaderVariant(const u32 key);
+	virtual Render3DError LoadShaderCache();
+	virtual Render3DError SaveShaderCache();
 	virtual Render3DError CreateVAOs();
 	virtual void DestroyVAOs();
 	virtual Render3DError InitTextures();
@@ -411,7 +569,7 @@ protected:
 	virtual Render3DError InitTables();
 	
 	virtual Render3DError LoadShaderPrograms(std::string *outVertexShaderProgram, std::string *outFragmentShaderProgram);
-	virtual Render3DError SetupShaderIO();
+	virtual Render3DError SetupShaderIO(const GLuint program);
 	virtual Render3DError CreateToonTable();
 	virtual Render3DError DestroyToonTable();
 	virtual Render3DError UploadToonTable(const GLuint *toonTableBuffer);
@@ -421,10 +579,23 @@ protected:
 	
 	virtual void GetExtensionSet(std::set<std::string> *oglExtensionSet);
 	virtual Render3DError ExpandFreeTextures();
+	virtual Render3DError CreateTextureAtlases();
+	virtual void DestroyTextureAtlases();
+	virtual Render3DError CreateCompositeTextures();
+	virtual void DestroyCompositeTextures();
+	virtual Render3DError CreatePostProcess();
+	virtual void DestroyPostProcess();
+	virtual Render3DError CreatePostProgram(const u32 key);
+	virtual Render3DError UpdatePostTables(const GFX3D_State *renderState);
+	virtual Render3DError ClearAttributes(const GFX3D_State *renderState);
+	virtual Render3DError RenderPostProcess();
 	virtual Render3DError SetupVertices(const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList, GLushort *outIndexBuffer, unsigned int *outIndexCount);
+	virtual Render3DError UploadVertices(const VERTLIST *vertList);
 	virtual Render3DError EnableVertexAttributes(const VERTLIST *vertList, const GLushort *indexBuffer, const unsigned int vertIndexCount);
 	virtual Render3DError DisableVertexAttributes();
 	virtual Render3DError SelectRenderingFramebuffer();
+	virtual Render3DError SelectShaderVariant();
+	void BindTexture(const GLuint textureID);
 	virtual Render3DError ReadBackPixels();
 	
 	// Base rendering methods
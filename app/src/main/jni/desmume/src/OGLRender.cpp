@@ -796,8 +796,8 @@ OpenGLRenderer_1_2::~OpenGLRenderer_1_2()
 	DestroyFBOs();
 	DestroyMultisampledFBO();
 	
-	//kill the tex cache to free all the texture ids
-	TexCache_Reset();
+	//give back all the texture ids. the decoded textures stay, for whichever renderer comes next
+	TexCache_ReleaseRendererData();
 	
 	glBindTexture(GL_TEXTURE_2D, 0);
 	
@@ -2061,7 +2061,7 @@ Render3DError OpenGLRenderer_1_2::SetupTexture(const POLY *thePoly, bool enableT
 			
 			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
 						 this->currTexture->sizeX, this->currTexture->sizeY, 0,
-						 GL_RGBA, GL_UNSIGNED_BYTE, this->currTexture->decoded);
+						 GL_RGBA, GL_UNSIGNED_BYTE, this->currTexture->views[TexFormat_32bpp].decoded);
 		}
 		else
 		{
@@ -2841,7 +2841,7 @@ Render3DError OpenGLRenderer_2_0::SetupTexture(const POLY *thePoly, bool enableT
 			
 			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
 						 this->currTexture->sizeX, this->currTexture->sizeY, 0,
-						 GL_RGBA, GL_UNSIGNED_BYTE, this->currTexture->decoded);
+						 GL_RGBA, GL_UNSIGNED_BYTE, this->currTexture->views[TexFormat_32bpp].decoded);
 		}
 		else
 		{
@@ -21,6 +21,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
 #ifdef HAVE_LIBZZIP
 #include <zzip/zzip.h>
 #endif
@@ -132,39 +135,319 @@ ROMReader_struct GZIPROMReader =
 	GZIPROMReaderRead
 };
 
+//a gzip rom is read through an index of places to start inflating from, one every GZIP_INDEX_SPAN bytes of the rom:
+//where a deflate block starts, the bits of its first byte that belong to the block before, and the 32KB the block
+//can refer back to. reading at any offset then inflates at most a span, where gzseek starts over from the front of
+//the file for every seek back. the index takes a pass through the file to build, the first time it is opened, and
+//is kept next to it (as .gzi) for the next time
+#define GZIP_INDEX_SPAN (1024*1024)
+#define GZIP_WINDOW 32768
+
+static const u32 kGzipIndexMagic = 0x31495A47; //GZI1
+
+struct GZIPIndexPoint
+{
+	u32 out; //where it is in the rom
+	u32 in; //the byte of the file the block starts in
+	u32 bits; //how many bits of that byte the block before has, 0 to 7
+	u8 window[GZIP_WINDOW]; //the 32KB of the rom before out
+};
+
+struct GZIPROMFile
+{
+	FILE* fp;
+	bool plain; //like gzopen, a file that isn't gzipped is read as it is
+	u32 size;
+	u32 pos;
+	std::vector<GZIPIndexPoint*> points;
+	//the inflating that goes on from the last read, for reads that follow on from it
+	z_stream strm;
+	bool inflating;
+	u32 strmOut;
+	u8 inbuf[16384];
+
+	GZIPROMFile() : fp(NULL), plain(false), size(0), pos(0), inflating(false), strmOut(0)
+	{
+		memset(&strm, 0, sizeof(strm));
+	}
+	~GZIPROMFile()
+	{
+		if(inflating) inflateEnd(&strm);
+		for(size_t i = 0; i < points.size(); i++) delete points[i];
+		if(fp) fclose(fp);
+	}
+};
+
+static void GZIPAddPoint(GZIPROMFile* gz, u32 bits, u32 in, u32 out, u32 left, const u8* window)
+{
+	GZIPIndexPoint* point = new GZIPIndexPoint();
+	point->out = out;
+	point->in = in;
+	point->bits = bits;
+	//the window is written round and round: what is left of it after the next write is the oldest
+	if(left) memcpy(point->window, window + GZIP_WINDOW - left, left);
+	if(left < GZIP_WINDOW) memcpy(point->window + left, window, GZIP_WINDOW - left);
+	gz->points.push_back(point);
+}
+
+//one pass through the file, inflating it all, which also gives the size
+static bool GZIPBuildIndex(GZIPROMFile* gz)
+{
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	if(inflateInit2(&strm, 15 + 16) != Z_OK) //a gzip header
+		return false;
+
+	u8 input[16384];
+	std::vector<u8> window(GZIP_WINDOW);
+	u64 totin = 0, totout = 0, last = 0;
+	int ret = Z_OK;
+	fseek(gz->fp, 0, SEEK_SET);
+	while(ret != Z_STREAM_END)
+	{
+		strm.avail_in = (uInt)fread(input, 1, sizeof(input), gz->fp);
+		if(strm.avail_in == 0)
+			break;
+		strm.next_in = input;
+		do
+		{
+			if(strm.avail_out == 0)
+			{
+				strm.avail_out = GZIP_WINDOW;
+				strm.next_out = &window[0];
+			}
+			//Z_BLOCK stops at the end of each block, which is where a point can go
+			totin += strm.avail_in;
+			totout += strm.avail_out;
+			ret = inflate(&strm, Z_BLOCK);
+			totin -= strm.avail_in;
+			totout -= strm.avail_out;
+			if(ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_END)
+				break;
+			if(totout > 0xFFFFFFFFULL)
+				ret = Z_DATA_ERROR;
+			else if((strm.data_type & 128) && !(strm.data_type & 64) && (totout == 0 || totout - last > GZIP_INDEX_SPAN))
+			{
+				GZIPAddPoint(gz, strm.data_type & 7, (u32)totin, (u32)totout, strm.avail_out, &window[0]);
+				last = totout;
+			}
+		} while(strm.avail_in != 0 && ret == Z_OK);
+		if(ret != Z_OK && ret != Z_STREAM_END)
+			break;
+	}
+	inflateEnd(&strm);
+
+	if(ret != Z_STREAM_END || gz->points.empty() || gz->points[0]->out != 0)
+		return false;
+	gz->size = (u32)totout;
+	return true;
+}
+
+static bool GZIPIndexKey(const char* filename, u32* key)
+{
+	struct stat sb;
+	if(stat(filename, &sb) == -1)
+		return false;
+	key[0] = kGzipIndexMagic;
+	key[1] = (u32)sb.st_size;
+	key[2] = (u32)sb.st_mtime;
+	key[3] = GZIP_INDEX_SPAN;
+	return true;
+}
+
+static bool GZIPLoadIndex(GZIPROMFile* gz, const char* filename, const std::string& indexName)
+{
+	u32 key[4], fileKey[4];
+	u32 header[2];
+	if(!GZIPIndexKey(filename, key))
+		return false;
+	FILE* f = fopen(indexName.c_str(), "rb");
+	if(!f)
+		return false;
+	bool ok = fread(fileKey, sizeof(fileKey), 1, f) == 1 && !memcmp(key, fileKey, sizeof(key))
+		&& fread(header, sizeof(header), 1, f) == 1 && header[1] != 0;
+	for(u32 i = 0; ok && i < header[1]; i++)
+	{
+		GZIPIndexPoint* point = new GZIPIndexPoint();
+		gz->points.push_back(point);
+		ok = fread(&point->out, 4, 1, f) == 1 && fread(&point->in, 4, 1, f) == 1 && fread(&point->bits, 4, 1, f) == 1
+			&& fread(point->window, GZIP_WINDOW, 1, f) == 1 && point->bits < 8 && (i == 0 ? point->out == 0 : point->out > gz->points[i-1]->out);
+	}
+	fclose(f);
+	if(!ok)
+	{
+		for(size_t i = 0; i < gz->points.size(); i++) delete gz->points[i];
+		gz->points.clear();
+		return false;
+	}
+	gz->size = header[0];
+	return true;
+}
+
+static void GZIPSaveIndex(GZIPROMFile* gz, const char* filename, const std::string& indexName)
+{
+	u32 key[4];
+	if(!GZIPIndexKey(filename, key))
+		return;
+	//written under another name, so that an index with the right name is always whole
+	const std::string partName = indexName + ".part";
+	FILE* f = fopen(partName.c_str(), "wb");
+	if(!f)
+		return;
+	const u32 header[2] = { gz->size, (u32)gz->points.size() };
+	bool ok = fwrite(key, sizeof(key), 1, f) == 1 && fwrite(header, sizeof(header), 1, f) == 1;
+	for(size_t i = 0; ok && i < gz->points.size(); i++)
+	{
+		const GZIPIndexPoint* point = gz->points[i];
+		ok = fwrite(&point->out, 4, 1, f) == 1 && fwrite(&point->in, 4, 1, f) == 1 && fwrite(&point->bits, 4, 1, f) == 1
+			&& fwrite(point->window, GZIP_WINDOW, 1, f) == 1;
+	}
+	ok = fclose(f) == 0 && ok;
+	if(!ok || rename(partName.c_str(), indexName.c_str()) != 0)
+		remove(partName.c_str());
+}
+
+//sets the inflating up to go on from a point
+static bool GZIPStartAt(GZIPROMFile* gz, const GZIPIndexPoint* point)
+{
+	if(gz->inflating)
+		inflateEnd(&gz->strm);
+	memset(&gz->strm, 0, sizeof(gz->strm));
+	gz->inflating = inflateInit2(&gz->strm, -15) == Z_OK; //raw deflate, from the middle of it
+	if(!gz->inflating)
+		return false;
+	if(fseek(gz->fp, point->in - (point->bits ? 1 : 0), SEEK_SET) != 0)
+		return false;
+	if(point->bits)
+	{
+		const int c = getc(gz->fp);
+		if(c == EOF)
+			return false;
+		inflatePrime(&gz->strm, point->bits, c >> (8 - point->bits));
+	}
+	if(point->out)
+		inflateSetDictionary(&gz->strm, point->window, GZIP_WINDOW);
+	gz->strmOut = point->out;
+	return true;
+}
+
+//inflates the next len bytes into dst, or drops them for a NULL dst, and returns how many there were
+static u32 GZIPInflate(GZIPROMFile* gz, u8* dst, u32 len)
+{
+	u8 discard[4096];
+	u32 done = 0;
+	while(done < len && gz->inflating)
+	{
+		const u32 chunk = dst ? len - done : std::min<u32>(len - done, sizeof(discard));
+		gz->strm.next_out = dst ? dst + done : discard;
+		gz->strm.avail_out = chunk;
+		int ret = Z_OK;
+		while(gz->strm.avail_out && ret == Z_OK)
+		{
+			if(gz->strm.avail_in == 0)
+			{
+				gz->strm.avail_in = (uInt)fread(gz->inbuf, 1, sizeof(gz->inbuf), gz->fp);
+				gz->strm.next_in = gz->inbuf;
+				if(gz->strm.avail_in == 0)
+					break;
+			}
+			ret = inflate(&gz->strm, Z_NO_FLUSH);
+		}
+		const u32 got = chunk - gz->strm.avail_out;
+		done += got;
+		gz->strmOut += got;
+		if(got < chunk)
+		{
+			//the end, or a file that went bad. the next read starts again from a point
+			inflateEnd(&gz->strm);
+			gz->inflating = false;
+		}
+	}
+	return done;
+}
+
 void * GZIPROMReaderInit(const char * filename)
 {
-	return (void*)gzopen(filename, "rb");
+	GZIPROMFile* gz = new GZIPROMFile();
+	gz->fp = fopen(filename, "rb");
+	if(!gz->fp)
+	{
+		delete gz;
+		return NULL;
+	}
+
+	u8 magic[2] = {0, 0};
+	gz->plain = fread(magic, 1, 2, gz->fp) != 2 || magic[0] != 0x1F || magic[1] != 0x8B;
+	if(gz->plain)
+	{
+		fseek(gz->fp, 0, SEEK_END);
+		gz->size = (u32)ftell(gz->fp);
+		return gz;
+	}
+
+	const std::string indexName = std::string(filename) + ".gzi";
+	if(!GZIPLoadIndex(gz, filename, indexName))
+	{
+		if(!GZIPBuildIndex(gz))
+		{
+			delete gz;
+			return NULL;
+		}
+		GZIPSaveIndex(gz, filename, indexName);
+	}
+	return gz;
 }
 
 void GZIPROMReaderDeInit(void * file)
 {
-	gzclose((gzFile)file);
+	delete (GZIPROMFile*)file;
 }
 
 u32 GZIPROMReaderSize(void * file)
 {
-	char useless[1024];
-	u32 size = 0;
-
-	/* FIXME this function should first save the current
-	 * position and restore it after size calculation */
-	gzrewind((gzFile)file);
-	while (gzeof ((gzFile)file) == 0)
-		size += gzread((gzFile)file, useless, 1024);
-	gzrewind((gzFile)file);
-
-	return size;
+	if (!file) return 0;
+	return ((GZIPROMFile*)file)->size;
 }
 
 int GZIPROMReaderSeek(void * file, int offset, int whence)
 {
-	return gzseek((gzFile)file, offset, whence);
+	GZIPROMFile* gz = (GZIPROMFile*)file;
+	if (!gz) return -1;
+	s64 pos = offset;
+	if(whence == SEEK_CUR) pos += gz->pos;
+	else if(whence == SEEK_END) pos += gz->size;
+	if(pos < 0 || pos > 0xFFFFFFFFLL)
+		return -1;
+	gz->pos = (u32)pos;
+	return (int)gz->pos;
 }
 
 int GZIPROMReaderRead(void * file, void * buffer, u32 size)
 {
-	return gzread((gzFile)file, buffer, size);
+	GZIPROMFile* gz = (GZIPROMFile*)file;
+	if (!gz || gz->pos >= gz->size) return 0;
+	size = std::min(size, gz->size - gz->pos);
+
+	if(gz->plain)
+	{
+		fseek(gz->fp, gz->pos, SEEK_SET);
+		const u32 got = (u32)fread(buffer, 1, size, gz->fp);
+		gz->pos += got;
+		return got;
+	}
+
+	//the last point at or before pos. a read that follows on from the last one goes on from where that left off,
+	//unless a point gets closer
+	struct PointBefore { bool operator()(u32 pos, const GZIPIndexPoint* point) const { return pos < point->out; } };
+	const GZIPIndexPoint* point = *(std::upper_bound(gz->points.begin(), gz->points.end(), gz->pos, PointBefore()) - 1);
+	if(!gz->inflating || gz->pos < gz->strmOut || point->out > gz->strmOut)
+		if(!GZIPStartAt(gz, point))
+			return 0;
+
+	GZIPInflate(gz, NULL, gz->pos - gz->strmOut);
+	const u32 got = gz->strmOut == gz->pos ? GZIPInflate(gz, (u8*)buffer, size) : 0;
+	gz->pos += got;
+	return got;
 }
 #endif
 
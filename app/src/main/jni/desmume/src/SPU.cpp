@@ -30,6 +30,8 @@
 #include <string.h>
 #include <queue>
 #include <vector>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "debug.h"
 #include "driver.h"
@@ -40,6 +42,13 @@
 #include "armcpu.h"
 #include "NDSSystem.h"
 #include "matrix.h"
+#include "utils/task.h"
+#include "frameprofile.h"
+#include "hostcpu.h"
+
+#ifdef ENABLE_NEON
+#include <arm_neon.h>
+#endif
 
 
 static inline s16 read16(u32 addr) { return (s16)_MMU_read16<ARMCPU_ARM7,MMU_AT_DEBUG>(addr); }
@@ -48,6 +57,9 @@ static inline s8 read_s8(u32 addr) { return (s8)_MMU_read08<ARMCPU_ARM7,MMU_AT_D
 
 #define K_ADPCM_LOOPING_RECOVERY_INDEX 99999
 #define COSINE_INTERPOLATION_RESOLUTION 8192
+//how many samples of a channel get fetched before they get interpolated and mixed together
+#define SPU_BLOCK_SIZE 64
+#define SPU_WEIGHT_BITS 14
 
 //#ifdef FASTBUILD
 	#undef FORCEINLINE
@@ -64,8 +76,40 @@ static int volume = 100;
 
 
 static size_t buffersize = 0;
+//what SPU_Emulate_user hands the sound core, sized for the most it ever asks for
+static s16 *postProcessBuffer = NULL;
+
+//held by the user spu's thread while it mixes, and by everything else that changes SPU_user or the sound core.
+//recursive, since those call each other
+class SPUUserLock
+{
+public:
+	SPUUserLock()
+	{
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+	void lock() { pthread_mutex_lock(&mutex); }
+	void unlock() { pthread_mutex_unlock(&mutex); }
+private:
+	pthread_mutex_t mutex;
+};
+static SPUUserLock userLock;
+
+struct SPUUserLocker
+{
+	SPUUserLocker() { userLock.lock(); }
+	~SPUUserLocker() { userLock.unlock(); }
+};
+
+static void SPU_LogClear();
+static void SPU_StopUserThread();
 static ESynchMode synchmode = ESynchMode_DualSynchAsynch;
 static ESynchMethod synchmethod = ESynchMethod_N;
+static u32 outputRate = 0x10000;
 
 static int SNDCoreId=-1;
 static SoundInterface_struct *SNDCore=NULL;
@@ -105,9 +149,18 @@ static const s16 wavedutytbl[8][8] = {
 	{ -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF }
 };
 
+//the noise channels' lfsr goes through all of the 32767 nonzero 15 bit states before it comes back around, so where
+//it gets to after any number of steps is a lookup: the states in the order it goes through them, and the position of
+//each one in that order (PSG_NOISE_OFF for 0, and for the states with bit 15 set that only a savestate brings)
+#define PSG_NOISE_PERIOD 32767
+#define PSG_NOISE_OFF 0xFFFF
+static u16 psgNoiseStates[PSG_NOISE_PERIOD];
+static u16 psgNoisePositions[0x10000];
+
 static s32 precalcdifftbl[89][16];
 static u8 precalcindextbl[89][8];
-static double cos_lut[COSINE_INTERPOLATION_RESOLUTION];
+//the cosine interpolation weights, out of 1 << SPU_WEIGHT_BITS
+static s32 cos_lut[COSINE_INTERPOLATION_RESOLUTION];
 
 static const double ARM7_CLOCK = 33513982;
 
@@ -131,11 +184,15 @@ static FORCEINLINE T MinMax(T val, T min, T max)
 int SPU_ChangeSoundCore(int coreid, int buffersize)
 {
 	int i;
+	SPUUserLocker lock;
 
 	::buffersize = buffersize;
 
 	delete SPU_user; SPU_user = NULL;
 
+	delete [] postProcessBuffer;
+	postProcessBuffer = new s16[buffersize * 2];
+
 	// Make sure the old core is freed
 	if (SNDCore)
 		SNDCore->DeInit();
@@ -195,13 +252,88 @@ void SPU_ReInit(bool fakeBoot)
 		SPU_WriteWord(0x04000504, 0x0200);
 }
 
+//applies the master volume to the mix and saturates it down to the 16 bit output. the wider x86 kernels are
+//built for their instruction sets on their own and only picked by SPU_Init when the cpu has them
+static void SPU_MasterOutput_Base(s32 *sndbuf, s16 *outbuf, int count, u8 vol)
+{
+	int i = 0;
+#ifdef ENABLE_NEON
+	const int32x4_t vol_v = vdupq_n_s32(vol == 127 ? 128 : vol);
+	for (; i + 4 <= count; i += 4)
+	{
+		const int32x4_t samples = vshrq_n_s32(vmulq_s32(vld1q_s32(sndbuf + i), vol_v), 7);
+		vst1q_s32(sndbuf + i, samples);
+		vst1_s16(outbuf + i, vqmovn_s32(samples));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		// Apply Master Volume
+		sndbuf[i] = spumuldiv7(sndbuf[i], vol);
+		s16 outsample = MinMax(sndbuf[i],-0x8000,0x7FFF);
+		outbuf[i] = outsample;
+	}
+}
+
+#ifdef HOSTCPU_HAVE_X86_KERNELS
+#include <immintrin.h>
+
+HOSTCPU_TARGET("sse4.1") static void SPU_MasterOutput_SSE41(s32 *sndbuf, s16 *outbuf, int count, u8 vol)
+{
+	int i = 0;
+	const __m128i vol_v = _mm_set1_epi32(vol == 127 ? 128 : vol);
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m128i lo = _mm_srai_epi32(_mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(sndbuf + i)), vol_v), 7);
+		const __m128i hi = _mm_srai_epi32(_mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(sndbuf + i + 4)), vol_v), 7);
+		_mm_storeu_si128((__m128i *)(sndbuf + i), lo);
+		_mm_storeu_si128((__m128i *)(sndbuf + i + 4), hi);
+		_mm_storeu_si128((__m128i *)(outbuf + i), _mm_packs_epi32(lo, hi));
+	}
+	for (; i < count; i++)
+	{
+		sndbuf[i] = spumuldiv7(sndbuf[i], vol);
+		outbuf[i] = MinMax(sndbuf[i],-0x8000,0x7FFF);
+	}
+}
+
+HOSTCPU_TARGET("avx2") static void SPU_MasterOutput_AVX2(s32 *sndbuf, s16 *outbuf, int count, u8 vol)
+{
+	int i = 0;
+	const __m256i vol_v = _mm256_set1_epi32(vol == 127 ? 128 : vol);
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m256i lo = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(sndbuf + i)), vol_v), 7);
+		const __m256i hi = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(sndbuf + i + 8)), vol_v), 7);
+		_mm256_storeu_si256((__m256i *)(sndbuf + i), lo);
+		_mm256_storeu_si256((__m256i *)(sndbuf + i + 8), hi);
+		//the pack works within each 128 bit lane, so the middle quarters come out swapped
+		_mm256_storeu_si256((__m256i *)(outbuf + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8));
+	}
+	for (; i < count; i++)
+	{
+		sndbuf[i] = spumuldiv7(sndbuf[i], vol);
+		outbuf[i] = MinMax(sndbuf[i],-0x8000,0x7FFF);
+	}
+}
+#endif
+
+static void (*SPU_MasterOutput)(s32 *sndbuf, s16 *outbuf, int count, u8 vol) = SPU_MasterOutput_Base;
+
 int SPU_Init(int coreid, int buffersize)
 {
 	int i, j;
+
+#ifdef HOSTCPU_HAVE_X86_KERNELS
+	if(hostcpu_has(HOSTCPU_AVX2))
+		SPU_MasterOutput = SPU_MasterOutput_AVX2;
+	else if(hostcpu_has(HOSTCPU_SSE41))
+		SPU_MasterOutput = SPU_MasterOutput_SSE41;
+#endif
 	
 	// Build the cosine interpolation LUT
 	for(unsigned int i = 0; i < COSINE_INTERPOLATION_RESOLUTION; i++)
-		cos_lut[i] = (1.0 - cos(((double)i/(double)COSINE_INTERPOLATION_RESOLUTION) * M_PI)) * 0.5;
+		cos_lut[i] = (s32)floor((1.0 - cos(((double)i/(double)COSINE_INTERPOLATION_RESOLUTION) * M_PI)) * 0.5 * (double)(1 << SPU_WEIGHT_BITS) + 0.5);
 
 	SPU_core = new SPU_struct((int)ceil(samples_per_hline));
 	SPU_Reset();
@@ -223,6 +355,15 @@ int SPU_Init(int coreid, int buffersize)
 		}
 	}
 
+	memset(psgNoisePositions, 0xFF, sizeof(psgNoisePositions));
+	u32 noise = 0x7FFF;
+	for(i = 0; i < PSG_NOISE_PERIOD; i++)
+	{
+		psgNoiseStates[i] = noise;
+		psgNoisePositions[noise] = i;
+		noise = (noise & 1) ? (noise >> 1) ^ 0x6000 : noise >> 1;
+	}
+
 	SPU_SetSynchMode(CommonSettings.SPU_sync_mode, CommonSettings.SPU_sync_method);
 
 	return SPU_ChangeSoundCore(coreid, buffersize);
@@ -240,6 +381,8 @@ void SPU_Pause(int pause)
 
 void SPU_CloneUser()
 {
+	SPUUserLocker lock;
+	SPU_LogClear();
 	if(SPU_user) {
 		memcpy(SPU_user->channels,SPU_core->channels,sizeof(SPU_core->channels));
 		SPU_user->regs = SPU_core->regs;
@@ -249,6 +392,7 @@ void SPU_CloneUser()
 
 void SPU_SetSynchMode(int mode, int method)
 {
+	SPUUserLocker lock;
 	synchmode = (ESynchMode)mode;
 	if(synchmethod != (ESynchMethod)method)
 	{
@@ -257,6 +401,7 @@ void SPU_SetSynchMode(int mode, int method)
 		//grr does this need to be locked? spu might need a lock method
 		  // or maybe not, maybe the platform-specific code that calls this function can deal with it.
 		synchronizer = metaspu_construct(synchmethod);
+		synchronizer->set_rate(outputRate);
 	}
 
 	delete SPU_user;
@@ -269,6 +414,15 @@ void SPU_SetSynchMode(int mode, int method)
 	}
 }
 
+void SPU_SetOutputRate(double ratio)
+{
+	const u32 rate = (u32)(ratio * 0x10000 + 0.5);
+	if(rate == outputRate) return;
+	SPUUserLocker lock;
+	outputRate = rate;
+	synchronizer->set_rate(rate);
+}
+
 void SPU_ClearOutputBuffer()
 {
 	if(SNDCore && SNDCore->ClearBuffer)
@@ -286,8 +440,10 @@ void SPU_SetVolume(int volume)
 void SPU_Reset(void)
 {
 	int i;
+	SPUUserLocker lock;
 
 	SPU_core->reset();
+	SPU_LogClear();
 
 	if(SPU_user) {
 		if(SNDCore)
@@ -345,6 +501,8 @@ SPU_struct::~SPU_struct()
 
 void SPU_DeInit(void)
 {
+	SPU_StopUserThread();
+	SPUUserLocker lock;
 	if(SNDCore)
 		SNDCore->DeInit();
 	SNDCore = 0;
@@ -442,7 +600,7 @@ void SPU_struct::KeyOn(int channel)
 	{
 		if(thischan.double_totlength_shifted == 0)
 		{
-			printf("INFO: Stopping channel %d due to zero length\n",channel);
+			CORELOG_INFO("INFO: Stopping channel %d due to zero length\n",channel);
 			thischan.status = CHANSTAT_STOPPED;
 		}
 	}
@@ -1010,10 +1168,9 @@ void SPU_struct::WriteLong(u32 addr, u32 val)
 	} //switch on address
 }
 
-template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE s32 Interpolate(s32 a, s32 b, double ratio)
+//the weight of the second sample, out of 1 << SPU_WEIGHT_BITS, at ratio between two samples
+template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE s32 InterpolationWeight(double ratio)
 {
-	double sampleA = (double)a;
-	double sampleB = (double)b;
 	ratio = ratio - sputrunc(ratio);
 	
 	switch (INTERPOLATE_MODE)
@@ -1022,75 +1179,136 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE s32 Interpola
 			// Cosine Interpolation Formula:
 			// ratio2 = (1 - cos(ratio * M_PI)) / 2
 			// sampleI = sampleA * (1 - ratio2) + sampleB * ratio2
-			return s32floor((cos_lut[(unsigned int)(ratio * (double)COSINE_INTERPOLATION_RESOLUTION)] * (sampleB - sampleA)) + sampleA);
-			break;
+			return cos_lut[(unsigned int)(ratio * (double)COSINE_INTERPOLATION_RESOLUTION)];
 			
 		case SPUInterpolation_Linear:
 			// Linear Interpolation Formula:
 			// sampleI = sampleA * (1 - ratio) + sampleB * ratio
-			return s32floor((ratio * (sampleB - sampleA)) + sampleA);
-			break;
+			return (s32)(ratio * (double)(1 << SPU_WEIGHT_BITS));
 			
 		default:
 			break;
 	}
 	
-	return a;
+	return 0;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
-template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch8BitData(channel_struct *chan, s32 *data)
+//the samples a block mixes: each one is a + (((b - a) * weight) >> SPU_WEIGHT_BITS), kept as a, b - a and weight
+struct SPU_Block
 {
+	DS_ALIGN(16) s32 a[SPU_BLOCK_SIZE];
+	DS_ALIGN(16) s32 diff[SPU_BLOCK_SIZE];
+	DS_ALIGN(16) s32 weight[SPU_BLOCK_SIZE];
+};
+
+template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchPCMData(const channel_struct * const chan, SPU_Block &block, int n)
+{
+	block.diff[n] = block.weight[n] = 0;
 	if (chan->sampcnt < 0)
 	{
-		*data = 0;
+		block.a[n] = 0;
 		return;
 	}
 
-	u32 loc = sputrunc(chan->sampcnt);
-	if(INTERPOLATE_MODE != SPUInterpolation_None)
+	const u32 loc = sputrunc(chan->sampcnt);
+	if (FORMAT == 0)
+		block.a[n] = (s32)read_s8(chan->addr + loc) << 8;
+	else
+		block.a[n] = (s32)read16(chan->addr + loc*2);
+
+	if(INTERPOLATE_MODE != SPUInterpolation_None && loc < (chan->totlength << (FORMAT == 0 ? 2 : 1)) - 1)
 	{
-		s32 a = (s32)(read_s8(chan->addr + loc) << 8);
-		if(loc < (chan->totlength << 2) - 1) {
-			s32 b = (s32)(read_s8(chan->addr + loc + 1) << 8);
-			a = Interpolate<INTERPOLATE_MODE>(a, b, chan->sampcnt);
-		}
-		*data = a;
+		const s32 b = FORMAT == 0 ? (s32)read_s8(chan->addr + loc + 1) << 8 : (s32)read16(chan->addr + loc*2 + 2);
+		block.diff[n] = b - block.a[n];
+		block.weight[n] = InterpolationWeight<INTERPOLATE_MODE>(chan->sampcnt);
 	}
-	else
-		*data = (s32)read_s8(chan->addr + loc)<< 8;
 }
 
-template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch16BitData(const channel_struct * const chan, s32 *data)
+//the samples adpcm channels decode, kept for the next time through their loops (or the next time they get keyed on)
+//so that they don't get decoded all over again. an entry is filled in as a channel first decodes its way through the
+//sample, and goes by main memory's page generations to know when what it was decoded from changes.
+//a channel only goes by it while its own decoder state matches it, so nothing comes out different than decoding would
+struct ADPCMCacheEntry
+{
+	ADPCMCacheEntry() : addr(0), totlength(0), firstPage(0), pages(0), generations(0), end(0), lastUse(0) {}
+	u32 addr, totlength;
+	u32 firstPage, pages;	//of main memory
+	u32 generations;		//the sum of those pages' generations when it was filled
+	u32 end;				//pcm and index are good from 7 (the header) up to here
+	u32 lastUse;
+	std::vector<s16> pcm;
+	std::vector<u8> index;
+};
+
+#define ADPCM_CACHE_ENTRIES 16
+//bigger samples are streams, which the game keeps writing new nibbles into anyway
+#define ADPCM_CACHE_MAX_BYTES (64*1024)
+
+//one for each spu, since the user spu can be mixing on a thread of its own
+static ADPCMCacheEntry adpcmCache[2][ADPCM_CACHE_ENTRIES];
+static u32 adpcmCacheClock[2] = {0, 0};
+
+SPU_MixStats spu_mixStats;
+
+static ADPCMCacheEntry* ADPCMCacheFind(const SPU_struct * const SPU, const channel_struct * const chan)
 {
-	if (chan->sampcnt < 0)
+	//only main memory has write generations to go by
+	const u32 bytes = chan->totlength << 2;
+	if ((chan->addr >> 24) != 0x02 || bytes <= 4 || bytes > ADPCM_CACHE_MAX_BYTES)
+		return NULL;
+	const u32 start = chan->addr & _MMU_MAIN_MEM_MASK;
+	if (start + bytes > _MMU_MAIN_MEM_MASK + 1)
+		return NULL;
+
+	const u32 firstPage = start >> MAINMEM_GENERATION_SHIFT;
+	const u32 pages = ((start + bytes - 1) >> MAINMEM_GENERATION_SHIFT) - firstPage + 1;
+	u32 generations = 0;
+	for (u32 i = 0; i < pages; i++)
+		generations += mainmem_page_generation[firstPage + i];
+
+	const int which = SPU == SPU_core ? 0 : 1;
+	ADPCMCacheEntry * const cache = adpcmCache[which];
+	ADPCMCacheEntry *entry = NULL, *oldest = &cache[0];
+	for (int i = 0; i < ADPCM_CACHE_ENTRIES && !entry; i++)
 	{
-		*data = 0;
-		return;
+		if (cache[i].addr == chan->addr && cache[i].totlength == chan->totlength)
+			entry = &cache[i];
+		else if (cache[i].lastUse < oldest->lastUse)
+			oldest = &cache[i];
 	}
 
-	if(INTERPOLATE_MODE != SPUInterpolation_None)
+	if (!entry)
 	{
-		u32 loc = sputrunc(chan->sampcnt);
-		
-		s32 a = (s32)read16(loc*2 + chan->addr), b;
-		if(loc < (chan->totlength << 1) - 1)
-		{
-			b = (s32)read16(loc*2 + chan->addr + 2);
-			a = Interpolate<INTERPOLATE_MODE>(a, b, chan->sampcnt);
-		}
-		*data = a;
+		entry = oldest;
+		entry->addr = chan->addr;
+		entry->totlength = chan->totlength;
+		//the channel can get as far as the length itself before it loops or stops
+		entry->pcm.resize((chan->totlength << 3) + 1);
+		entry->index.resize((chan->totlength << 3) + 1);
+		entry->end = 0;
 	}
-	else
-		*data = read16(chan->addr + sputrunc(chan->sampcnt)*2);
+	if (entry->end == 0 || entry->generations != generations || entry->firstPage != firstPage)
+	{
+		entry->firstPage = firstPage;
+		entry->pages = pages;
+		entry->generations = generations;
+		//what a channel starts decoding from when it is keyed on
+		entry->pcm[7] = (s16)read16(chan->addr);
+		entry->index[7] = read08(chan->addr + 2) & 0x7F;
+		entry->end = 8;
+	}
+	entry->lastUse = ++adpcmCacheClock[which];
+	return entry;
 }
 
-template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADPCMData(channel_struct * const chan, s32 * const data)
+template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADPCMData(channel_struct * const chan, ADPCMCacheEntry * const cache, SPU_Block &block, int n)
 {
+	block.diff[n] = block.weight[n] = 0;
 	if (chan->sampcnt < 8)
 	{
-		*data = 0;
+		block.a[n] = 0;
 		return;
 	}
 
@@ -1098,7 +1316,25 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADP
 	if (chan->lastsampcnt != sputrunc(chan->sampcnt)){
 
 		const u32 endExclusive = sputrunc(chan->sampcnt+1);
-		for (u32 i = chan->lastsampcnt+1; i < endExclusive; i++)
+
+		//whether the decoder is where the cache has it
+		const bool cached = cache && chan->lastsampcnt >= 7 && chan->lastsampcnt < cache->end
+			&& cache->pcm[chan->lastsampcnt] == chan->pcm16b && cache->index[chan->lastsampcnt] == chan->index;
+		if (cached && endExclusive <= cache->end && endExclusive > chan->lastsampcnt+1)
+		{
+			const u32 loc = endExclusive - 1;
+			const u32 loopSample = chan->loopstart<<3;
+			if(loopSample > chan->lastsampcnt && loopSample <= loc) {
+				if(chan->loop_index != K_ADPCM_LOOPING_RECOVERY_INDEX) CORELOG_INFO("over-snagging\n");
+				chan->loop_pcm16b = cache->pcm[loopSample];
+				chan->loop_index = cache->index[loopSample];
+			}
+			chan->pcm16b_last = cache->pcm[loc - 1];
+			chan->pcm16b = cache->pcm[loc];
+			chan->index = cache->index[loc];
+			spu_mixStats.adpcmCached += loc - chan->lastsampcnt;
+		}
+		else for (u32 i = chan->lastsampcnt+1; i < endExclusive; i++)
 		{
 			const u32 shift = (i&1)<<2;
 			const u32 data4bit = ((u32)read08(chan->addr + (i>>1))) >> shift;
@@ -1110,47 +1346,40 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADP
 			chan->pcm16b = MinMax(chan->pcm16b+diff, -0x8000, 0x7FFF);
 
 			if(i == (chan->loopstart<<3)) {
-				if(chan->loop_index != K_ADPCM_LOOPING_RECOVERY_INDEX) printf("over-snagging\n");
+				if(chan->loop_index != K_ADPCM_LOOPING_RECOVERY_INDEX) CORELOG_INFO("over-snagging\n");
 				chan->loop_pcm16b = chan->pcm16b;
 				chan->loop_index = chan->index;
 			}
+
+			//what the cache doesn't have yet carries on from what it does
+			if(cached && i == cache->end) {
+				cache->pcm[i] = chan->pcm16b;
+				cache->index[i] = chan->index;
+				cache->end++;
+			}
+			spu_mixStats.adpcmDecoded++;
 		}
 
 		chan->lastsampcnt = sputrunc(chan->sampcnt);
 	}
 
 	if(INTERPOLATE_MODE != SPUInterpolation_None)
-		*data = Interpolate<INTERPOLATE_MODE>((s32)chan->pcm16b_last,(s32)chan->pcm16b,chan->sampcnt);
+	{
+		block.a[n] = (s32)chan->pcm16b_last;
+		block.diff[n] = (s32)chan->pcm16b - (s32)chan->pcm16b_last;
+		block.weight[n] = InterpolationWeight<INTERPOLATE_MODE>(chan->sampcnt);
+	}
 	else
-		*data = (s32)chan->pcm16b;
+		block.a[n] = (s32)chan->pcm16b;
 }
 
-static FORCEINLINE void FetchPSGData(channel_struct *chan, s32 *data)
+//steps the noise lfsr the way the hardware does, steps times
+static FORCEINLINE void StepPSGNoise(channel_struct *chan, u32 steps)
 {
-	if (chan->sampcnt < 0)
+	const u32 pos = psgNoisePositions[chan->x];
+	if (pos == PSG_NOISE_OFF)
 	{
-		*data = 0;
-		return;
-	}
-
-	if(chan->num < 8)
-	{
-		*data = 0;
-	}
-	else if(chan->num < 14)
-	{
-		*data = (s32)wavedutytbl[chan->waveduty][(sputrunc(chan->sampcnt)) & 0x7];
-	}
-	else
-	{
-		if(chan->lastsampcnt == sputrunc(chan->sampcnt))
-		{
-			*data = (s32)chan->psgnoise_last;
-			return;
-		}
-
-		u32 max = sputrunc(chan->sampcnt);
-		for(u32 i = chan->lastsampcnt; i < max; i++)
+		for (u32 i = 0; i < steps; i++)
 		{
 			if(chan->x & 0x1)
 			{
@@ -1163,32 +1392,104 @@ static FORCEINLINE void FetchPSGData(channel_struct *chan, s32 *data)
 				chan->psgnoise_last = 0x7FFF;
 			}
 		}
+		return;
+	}
 
-		chan->lastsampcnt = sputrunc(chan->sampcnt);
+	//the output is from the state that the last step started from
+	const u32 last = (pos + (steps - 1) % PSG_NOISE_PERIOD) % PSG_NOISE_PERIOD;
+	chan->psgnoise_last = (psgNoiseStates[last] & 1) ? -0x7FFF : 0x7FFF;
+	chan->x = psgNoiseStates[last + 1 == PSG_NOISE_PERIOD ? 0 : last + 1];
+}
 
-		*data = (s32)chan->psgnoise_last;
+//a block of a psg channel's samples, moving it along as it goes (the channel position of a psg channel only ever
+//steps, so unlike the other formats it can't stop or loop in the middle of a block)
+static FORCEINLINE void FetchPSGBlock(channel_struct *chan, SPU_Block &block, int n)
+{
+	if (chan->num < 8)
+	{
+		//only channels 8 to 15 have a psg
+		memset(block.a, 0, n * sizeof(s32));
+		for (int i = 0; i < n; i++)
+			chan->sampcnt += chan->sampinc;
+		return;
+	}
+
+	if (chan->num < 14)
+	{
+		const s16 * const duty = wavedutytbl[chan->waveduty];
+		for (int i = 0; i < n; i++)
+		{
+			block.a[i] = chan->sampcnt < 0 ? 0 : (s32)duty[sputrunc(chan->sampcnt) & 0x7];
+			chan->sampcnt += chan->sampinc;
+		}
+		return;
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		if (chan->sampcnt < 0)
+			block.a[i] = 0;
+		else
+		{
+			const u32 pos = sputrunc(chan->sampcnt);
+			if (pos > chan->lastsampcnt)
+				StepPSGNoise(chan, pos - chan->lastsampcnt);
+			chan->lastsampcnt = pos;
+			block.a[i] = (s32)chan->psgnoise_last;
+		}
+		chan->sampcnt += chan->sampinc;
 	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
-static FORCEINLINE void MixL(SPU_struct* SPU, channel_struct *chan, s32 data)
-{
-	data = spumuldiv7(data, chan->vol) >> volume_shift[chan->volumeDiv];
-	SPU->sndbuf[SPU->bufpos<<1] += data;
-}
+//adds n samples of a channel to sndbuf from start on, scaled by its volume and panned
+template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void MixBlock(SPU_struct* const SPU, const channel_struct* const chan, const SPU_Block &block, int start, int n)
+{
+	//spumuldiv7 by 127 is no change, which is what 128 does with the shift; and the volume shift goes along with the
+	//volume's, the two of them being floor divisions by powers of two
+	const s32 vol = chan->vol == 127 ? 128 : chan->vol;
+	const int shift = 7 + volume_shift[chan->volumeDiv];
+	s32 left, right;
+	if (chan->pan == 0) { left = 128; right = 0; }
+	else if (chan->pan == 127) { left = 0; right = 128; }
+	else { left = 127 - chan->pan; right = chan->pan; }
+
+	s32 *out = SPU->sndbuf + start*2;
+	int i = 0;
+
+#ifdef ENABLE_NEON
+	const int32x4_t vol_v = vdupq_n_s32(vol);
+	const int32x4_t shift_v = vdupq_n_s32(-shift);
+	const int32x4_t left_v = vdupq_n_s32(left);
+	const int32x4_t right_v = vdupq_n_s32(right);
+	for (; i + 4 <= n; i += 4)
+	{
+		int32x4_t data = vld1q_s32(block.a + i);
+		if (INTERPOLATE_MODE != SPUInterpolation_None)
+			data = vaddq_s32(data, vshrq_n_s32(vmulq_s32(vld1q_s32(block.diff + i), vld1q_s32(block.weight + i)), SPU_WEIGHT_BITS));
+		data = vshlq_s32(vmulq_s32(data, vol_v), shift_v);
+
+		int32x4x2_t mixed = vld2q_s32(out + i*2);
+		mixed.val[0] = vaddq_s32(mixed.val[0], vshrq_n_s32(vmulq_s32(data, left_v), 7));
+		mixed.val[1] = vaddq_s32(mixed.val[1], vshrq_n_s32(vmulq_s32(data, right_v), 7));
+		vst2q_s32(out + i*2, mixed);
+	}
+#endif
 
-static FORCEINLINE void MixR(SPU_struct* SPU, channel_struct *chan, s32 data)
-{
-	data = spumuldiv7(data, chan->vol) >> volume_shift[chan->volumeDiv];
-	SPU->sndbuf[(SPU->bufpos<<1)+1] += data;
-}
+	for (; i < n; i++)
+	{
+		s32 data = block.a[i];
+		if (INTERPOLATE_MODE != SPUInterpolation_None)
+			data += (block.diff[i] * block.weight[i]) >> SPU_WEIGHT_BITS;
+		data = (data * vol) >> shift;
+		out[i*2] += (data * left) >> 7;
+		out[i*2+1] += (data * right) >> 7;
+	}
 
-static FORCEINLINE void MixLR(SPU_struct* SPU, channel_struct *chan, s32 data)
-{
-	data = spumuldiv7(data, chan->vol) >> volume_shift[chan->volumeDiv];
-	SPU->sndbuf[SPU->bufpos<<1] += spumuldiv7(data, 127 - chan->pan);
-	SPU->sndbuf[(SPU->bufpos<<1)+1] += spumuldiv7(data, chan->pan);
+	SPU->lastdata = block.a[n-1];
+	if (INTERPOLATE_MODE != SPUInterpolation_None)
+		SPU->lastdata += (block.diff[n-1] * block.weight[n-1]) >> SPU_WEIGHT_BITS;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1257,55 +1558,57 @@ static FORCEINLINE void TestForLoop2(SPU_struct *SPU, channel_struct *chan)
 	}
 }
 
-template<int CHANNELS> FORCEINLINE static void SPU_Mix(SPU_struct* SPU, channel_struct *chan, s32 data)
+template<int FORMAT> FORCEINLINE static void SPU_ChanAdvance(SPU_struct* const SPU, channel_struct* const chan)
 {
-	switch(CHANNELS)
-	{
-		case 0: MixL(SPU, chan, data); break;
-		case 1: MixLR(SPU, chan, data); break;
-		case 2: MixR(SPU, chan, data); break;
+	switch(FORMAT) {
+		case 0: case 1: TestForLoop<FORMAT>(SPU, chan); break;
+		case 2: TestForLoop2(SPU, chan); break;
+		case 3: chan->sampcnt += chan->sampinc; break;
 	}
-	SPU->lastdata = data;
 }
 
 //WORK
-template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE, int CHANNELS> 
+//the samples are fetched one at a time, since the channel position has to move the way it always has: it decides
+//on which sample a channel stops, which the game can see. only then are they interpolated and mixed, a block at a time
+template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE> 
 	FORCEINLINE static void ____SPU_ChanUpdate(SPU_struct* const SPU, channel_struct* const chan)
 {
-	for (; SPU->bufpos < SPU->buflength; SPU->bufpos++)
+	SPU_Block block;
+	ADPCMCacheEntry * const cache = FORMAT == 2 ? ADPCMCacheFind(SPU, chan) : NULL;
+	while (SPU->bufpos < SPU->buflength)
 	{
-		if(CHANNELS != -1)
+		const int start = SPU->bufpos;
+		int n = 0;
+		if (FORMAT == 3)
+		{
+			n = std::min<int>(SPU_BLOCK_SIZE, SPU->buflength - SPU->bufpos);
+			FetchPSGBlock(chan, block, n);
+			SPU->bufpos += n;
+		}
+		else for (; SPU->bufpos < SPU->buflength && n < SPU_BLOCK_SIZE; SPU->bufpos++, n++)
 		{
-			s32 data;
 			switch(FORMAT)
 			{
-				case 0: Fetch8BitData<INTERPOLATE_MODE>(chan, &data); break;
-				case 1: Fetch16BitData<INTERPOLATE_MODE>(chan, &data); break;
-				case 2: FetchADPCMData<INTERPOLATE_MODE>(chan, &data); break;
-				case 3: FetchPSGData(chan, &data); break;
+				case 0: case 1: FetchPCMData<FORMAT,INTERPOLATE_MODE>(chan, block, n); break;
+				case 2: FetchADPCMData<INTERPOLATE_MODE>(chan, cache, block, n); break;
 			}
-			SPU_Mix<CHANNELS>(SPU, chan, data);
-		}
-
-		switch(FORMAT) {
-			case 0: case 1: TestForLoop<FORMAT>(SPU, chan); break;
-			case 2: TestForLoop2(SPU, chan); break;
-			case 3: chan->sampcnt += chan->sampinc; break;
+			SPU_ChanAdvance<FORMAT>(SPU, chan);
 		}
+		MixBlock<FORMAT == 3 ? SPUInterpolation_None : INTERPOLATE_MODE>(SPU, chan, block, start, n);
+		spu_mixStats.samplesMixed += n;
 	}
 }
 
 template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE> 
 	FORCEINLINE static void ___SPU_ChanUpdate(const bool actuallyMix, SPU_struct* const SPU, channel_struct* const chan)
 {
-	if(!actuallyMix)
-		____SPU_ChanUpdate<FORMAT,INTERPOLATE_MODE,-1>(SPU,chan);
-	else if (chan->pan == 0)
-		____SPU_ChanUpdate<FORMAT,INTERPOLATE_MODE,0>(SPU,chan);
-	else if (chan->pan == 127)
-		____SPU_ChanUpdate<FORMAT,INTERPOLATE_MODE,2>(SPU,chan);
+	if(actuallyMix)
+		____SPU_ChanUpdate<FORMAT,INTERPOLATE_MODE>(SPU,chan);
 	else
-		____SPU_ChanUpdate<FORMAT,INTERPOLATE_MODE,1>(SPU,chan);
+	{
+		for (; SPU->bufpos < SPU->buflength; SPU->bufpos++)
+			SPU_ChanAdvance<FORMAT>(SPU, chan);
+	}
 }
 
 template<SPUInterpolationMode INTERPOLATE_MODE> 
@@ -1332,6 +1635,51 @@ FORCEINLINE static void _SPU_ChanUpdate(const bool actuallyMix, SPU_struct* cons
 	}
 }
 
+//what a capture unit makes during one mix, which goes out to memory in one go rather than a store at a time.
+//the mixes are a scanline's worth of samples, so it is a few bytes, and nearly always one run of the main memory
+#define SPU_CAPTURE_BLOCK_BYTES 256
+struct SPUCaptureBlock
+{
+	u32 start;
+	u32 size;
+	bool bits8;
+	u8 data[SPU_CAPTURE_BLOCK_BYTES];
+};
+
+static void SPU_FlushCapture(SPUCaptureBlock &block)
+{
+	const u32 start = block.start, size = block.size;
+	block.size = 0;
+	if (size == 0)
+		return;
+
+	const u32 offset = start & _MMU_MAIN_MEM_MASK;
+	if ((start & 0x0F000000) == 0x02000000 && offset + size <= _MMU_MAIN_MEM_MASK + 1)
+	{
+		u8 * const dst = MMU.MAIN_MEM + offset;
+		//capturing silence over silence, or a loop over the same loop, leaves the pages as they were, which
+		//keeps them out of what the rewind and the sample caches have to look at again
+		if (memcmp(dst, block.data, size) == 0)
+			return;
+#ifdef HAVE_JIT
+		for (u32 adr = start & ~1; adr < start + size; adr += 2)
+			JIT_INVALIDATE_KNOWNBANK(adr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 0);
+#endif
+		for (u32 page = offset >> MAINMEM_GENERATION_SHIFT; page <= (offset + size - 1) >> MAINMEM_GENERATION_SHIFT; page++)
+			mainmem_page_generation[page]++;
+		memcpy(dst, block.data, size);
+		return;
+	}
+
+	//anywhere else, the way the unit stores them
+	if (block.bits8)
+		for (u32 i = 0; i < size; i++)
+			_MMU_write08<1,MMU_AT_DMA>(start + i, block.data[i]);
+	else
+		for (u32 i = 0; i < size; i += 2)
+			_MMU_write16<1,MMU_AT_DMA>(start + i, T1ReadWord(block.data, i));
+}
+
 //ENTERNEW
 static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
 {
@@ -1351,6 +1699,8 @@ static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
 	//-----------------
 
 	s32 samp0[2];
+	SPUCaptureBlock capblock[2];
+	capblock[0].size = capblock[1].size = 0;
 	
 	//believe it or not, we are going to do this one sample at a time.
 	//like i said, it is slower.
@@ -1391,6 +1741,14 @@ static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
 				//internally at least, just in case they get used by the spu output
 				bool domix = outputToCap || outputToMix || i==1 || i==3;
 
+				//at zero volume a channel adds nothing to either mix. only 0-3 feed the capture units from before
+				//their volume, so the others can skip generating anything
+				if(domix && chan->vol == 0 && i >= 4)
+				{
+					spu_mixStats.samplesSilent++;
+					domix = false;
+				}
+
 				//clear the output buffer since this is where _SPU_ChanUpdate wants to accumulate things
 				SPU->sndbuf[0] = SPU->sndbuf[1] = 0;
 
@@ -1513,23 +1871,31 @@ static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
 					//if(!fp) fp = fopen("d:\\capout.raw","wb");
 					//fwrite(&sample,2,1,fp);
 					
+					SPUCaptureBlock &block = capblock[capchan];
+					if(block.size == 0)
+					{
+						block.start = cap.runtime.curdad;
+						block.bits8 = cap.bits8 != 0;
+					}
 					if(cap.bits8)
 					{
 						s8 sample8 = sample>>8;
-						if(skipcap) _MMU_write08<1,MMU_AT_DMA>(cap.runtime.curdad,0);
-						else _MMU_write08<1,MMU_AT_DMA>(cap.runtime.curdad,sample8);
+						block.data[block.size++] = skipcap ? 0 : (u8)sample8;
 						cap.runtime.curdad++;
 						multiplier = 4;
 					}
 					else
 					{
 						s16 sample16 = sample;
-						if(skipcap) _MMU_write16<1,MMU_AT_DMA>(cap.runtime.curdad,0);
-						else _MMU_write16<1,MMU_AT_DMA>(cap.runtime.curdad,sample16);
+						T1WriteWord(block.data, block.size, skipcap ? 0 : (u16)sample16);
+						block.size += 2;
 						cap.runtime.curdad+=2;
 						multiplier = 2;
 					}
 
+					//a block is one run of addresses
+					if(cap.runtime.curdad>=cap.runtime.maxdad || block.size == SPU_CAPTURE_BLOCK_BYTES)
+						SPU_FlushCapture(block);
 					if(cap.runtime.curdad>=cap.runtime.maxdad) {
 						cap.runtime.curdad = cap.dad;
 						cap.runtime.sampcnt -= cap.len*multiplier;
@@ -1539,6 +1905,11 @@ static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
 		} //capchan loop
 	} //main sample loop
 
+	//the channels that play the captured sound back read it well behind the unit, so it only has to be in
+	//memory by the end of the mix
+	SPU_FlushCapture(capblock[0]);
+	SPU_FlushCapture(capblock[1]);
+
 	SPU->sndbuf[0] = samp0[0];
 	SPU->sndbuf[1] = samp0[1];
 }
@@ -1579,8 +1950,16 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 			SPU->bufpos = 0;
 			SPU->buflength = length;
 
+			//a channel at zero volume adds nothing to the mix, so it only has to be moved along
+			bool domix = !CommonSettings.spu_muteChannels[i] && actuallyMix;
+			if(domix && chan->vol == 0)
+			{
+				spu_mixStats.samplesSilent += length;
+				domix = false;
+			}
+
 			// Mix audio
-			_SPU_ChanUpdate(!CommonSettings.spu_muteChannels[i] && actuallyMix, SPU, chan);
+			_SPU_ChanUpdate(domix, SPU, chan);
 		}
 	}
 
@@ -1595,18 +1974,191 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 
 	// convert from 32-bit->16-bit
 	if(actuallyMix && speakers)
-		for (int i = 0; i < length*2; i++)
+		SPU_MasterOutput(SPU->sndbuf, SPU->outbuf, length*2, vol);
+
+
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+//the user spu on a thread of its own, for dual synch/asynch. rather than going to SPU_user as they happen, the
+//writes to the spu registers get logged along with the core spu's sample clock, and the thread replays them as it
+//mixes: so each write lands on the sample it did on the core, and the thread can mix whenever the sound core has
+//room, instead of once a frame on the emulation thread after the frame is done.
+
+struct SPULogEntry
+{
+	u32 time;	//spuCoreClock when it was written
+	u32 addr;
+	u32 val;
+	u32 size;
+};
+
+//a power of two
+#define SPU_LOG_ENTRIES 16384
+//when the thread is this far behind the core (fast forward, or a sound core that doesn't want anything) it stops
+//trying to mix its way there, and just plays the writes back
+#define SPU_THREAD_MAX_BEHIND (DESMUME_SAMPLE_RATE / 4)
+
+static SPULogEntry spuLog[SPU_LOG_ENTRIES];
+DS_ALIGN(64) static u32 spuLogWritePos = 0;	//only the emulation thread moves it
+DS_ALIGN(64) static u32 spuLogReadPos = 0;	//only the user spu's thread moves it, or anyone with the lock while it is stopped
+static u32 spuCoreClock = 0;				//samples the core spu has run
+static u32 spuUserClock = 0;				//samples the user spu has caught up with
+
+bool spu_userThreaded = false;
+static volatile bool userThreadWanted = false;
+static volatile bool userThreadStop = false;
+static Task userThread;
+static bool userThreadStarted = false;
+
+void SPU_LogWrite(u32 addr, u32 val, u32 size)
+{
+	//the thread makes room as it catches up with the core, which it does without mixing if it has to
+	while (spuLogWritePos - __atomic_load_n(&spuLogReadPos, __ATOMIC_ACQUIRE) == SPU_LOG_ENTRIES)
+		usleep(500);
+
+	SPULogEntry &entry = spuLog[spuLogWritePos & (SPU_LOG_ENTRIES-1)];
+	entry.time = spuCoreClock;
+	entry.addr = addr;
+	entry.val = val;
+	entry.size = size;
+	__atomic_store_n(&spuLogWritePos, spuLogWritePos + 1, __ATOMIC_RELEASE);
+}
+
+//with the lock, for when the user spu gets set to the core's state, which already has all the logged writes
+static void SPU_LogClear()
+{
+	__atomic_store_n(&spuLogReadPos, __atomic_load_n(&spuLogWritePos, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	spuUserClock = __atomic_load_n(&spuCoreClock, __ATOMIC_ACQUIRE);
+}
+
+//applies the logged writes that are due by the user spu's clock, and returns how many samples it is until the next one,
+//or max if there isn't one that soon
+static u32 SPU_LogApply(u32 writePos, u32 max)
+{
+	while (spuLogReadPos != writePos)
+	{
+		const SPULogEntry &entry = spuLog[spuLogReadPos & (SPU_LOG_ENTRIES-1)];
+		const s32 until = (s32)(entry.time - spuUserClock);
+		if (until > 0)
+			return std::min((u32)until, max);
+
+		if (SPU_user)
 		{
-			// Apply Master Volume
-			SPU->sndbuf[i] = spumuldiv7(SPU->sndbuf[i], vol);
-			s16 outsample = MinMax(SPU->sndbuf[i],-0x8000,0x7FFF);
-			SPU->outbuf[i] = outsample;
+			switch (entry.size)
+			{
+				case 1: SPU_user->WriteByte(entry.addr, (u8)entry.val); break;
+				case 2: SPU_user->WriteWord(entry.addr, (u16)entry.val); break;
+				case 4: SPU_user->WriteLong(entry.addr, entry.val); break;
+			}
 		}
+		__atomic_store_n(&spuLogReadPos, spuLogReadPos + 1, __ATOMIC_RELEASE);
+	}
+	return max;
+}
+
+//runs the user spu up to the core's clock without mixing anything
+static void SPU_LogSkip(u32 writePos, u32 coreClock)
+{
+	while (spuUserClock != coreClock)
+	{
+		const u32 count = SPU_LogApply(writePos, coreClock - spuUserClock);
+		if (SPU_user)
+			SPU_MixAudio(false, SPU_user, count);
+		spuUserClock += count;
+	}
+	SPU_LogApply(writePos, 0);
+}
+
+//returns how many samples it mixed
+static u32 SPU_Emulate_user_thread()
+{
+	SPUUserLocker lock;
+	PROFILE_ZONE(PROFILE_SPU_USER);
+	SoundInterface_struct *soundProcessor = SPU_SoundCore();
+	const u32 coreClock = __atomic_load_n(&spuCoreClock, __ATOMIC_ACQUIRE);
+	const u32 writePos = __atomic_load_n(&spuLogWritePos, __ATOMIC_ACQUIRE);
+	const u32 behind = coreClock - spuUserClock;
+
+	if (!SPU_user || !soundProcessor || synchmode != ESynchMode_DualSynchAsynch || behind > SPU_THREAD_MAX_BEHIND
+		|| writePos - spuLogReadPos == SPU_LOG_ENTRIES)
+	{
+		SPU_LogSkip(writePos, coreClock);
+		return 0;
+	}
 
+	const u32 wanted = std::min<u32>(std::min<u32>(soundProcessor->GetAudioSpace(), buffersize), behind);
+	u32 done = 0;
+	while (done < wanted)
+	{
+		//mixed up to the next write, then that gets applied
+		const u32 count = SPU_LogApply(writePos, wanted - done);
+		SPU_MixAudio(true, SPU_user, count);
+		memcpy(postProcessBuffer + done*2, SPU_user->outbuf, count * 2 * sizeof(s16));
+		spuUserClock += count;
+		done += count;
+	}
+	SPU_LogApply(writePos, 0);
 
+	if (done)
+	{
+		soundProcessor->UpdateAudio(postProcessBuffer, done);
+		WAV_WavSoundUpdate(postProcessBuffer, done, WAVMODE_USER);
+	}
+	return done;
 }
 
-//////////////////////////////////////////////////////////////////////////////
+static void* SPU_UserThreadProc(void*)
+{
+	while (!userThreadStop)
+	{
+		//only as much as the sound core has room for at a time, so it is mixed shortly before it gets played
+		if (SPU_Emulate_user_thread() == 0)
+			usleep(1000);
+	}
+	return NULL;
+}
+
+static void SPU_StartUserThread()
+{
+	SPUUserLocker lock;
+	SPU_LogClear();
+	if (!userThreadStarted)
+	{
+		userThread.start(false, "SPU mixer");
+		userThreadStarted = true;
+	}
+	userThreadStop = false;
+	spu_userThreaded = true;
+	userThread.execute(SPU_UserThreadProc, NULL);
+}
+
+static void SPU_StopUserThread()
+{
+	if (!spu_userThreaded)
+		return;
+	userThreadStop = true;
+	userThread.finish();
+
+	//what the thread didn't get to yet goes straight to SPU_user, the way the writes after this do
+	SPUUserLocker lock;
+	spuUserClock = spuCoreClock;
+	SPU_LogApply(spuLogWritePos, 0);
+	spu_userThreaded = false;
+}
+
+void SPU_SetUserThread(bool enable)
+{
+	userThreadWanted = enable;
+}
+
+bool spu_unheard = false;
+
+void SPU_SetUnheard(bool enable)
+{
+	spu_unheard = enable;
+}
 
 
 //emulates one hline of the cpu core.
@@ -1621,6 +2173,14 @@ void SPU_Emulate_core()
 	samples += samples_per_hline;
 	spu_core_samples = (int)(samples);
 	samples -= spu_core_samples;
+
+	if (spu_unheard)
+	{
+		SPU_MixAudio(false, SPU_core, spu_core_samples);
+		return;
+	}
+	//the time the logged writes are stamped with, and that the user spu's thread can mix up to
+	__atomic_store_n(&spuCoreClock, spuCoreClock + spu_core_samples, __ATOMIC_RELEASE);
 	
 	// We don't need to mix audio for Dual Synch/Asynch mode since we do this
 	// later in SPU_Emulate_user(). Disable mixing here to speed up processing.
@@ -1651,11 +2211,21 @@ void SPU_Emulate_core()
 
 void SPU_Emulate_user(bool mix)
 {
-	static s16 *postProcessBuffer = NULL;
-	static size_t postProcessBufferSize = 0;
 	size_t freeSampleCount = 0;
 	size_t processedSampleCount = 0;
 	SoundInterface_struct *soundProcessor = SPU_SoundCore();
+	PROFILE_ZONE(PROFILE_SPU_USER);
+
+	//the thread gets started and stopped here, between frames, where nothing else is using the user spu
+	if (userThreadWanted != spu_userThreaded)
+	{
+		if (userThreadWanted)
+			SPU_StartUserThread();
+		else
+			SPU_StopUserThread();
+	}
+	if (spu_userThreaded && synchmode == ESynchMode_DualSynchAsynch)
+		return;
 	
 	if (soundProcessor == NULL)
 	{
@@ -1676,14 +2246,6 @@ void SPU_Emulate_user(bool mix)
 		freeSampleCount = buffersize;
 	}
 	
-	// If needed, resize the post-process buffer to guarantee that
-	// we can store all the sound data.
-	if (postProcessBufferSize < freeSampleCount * 2 * sizeof(s16))
-	{
-		postProcessBufferSize = freeSampleCount * 2 * sizeof(s16);
-		postProcessBuffer = (s16 *)realloc(postProcessBuffer, postProcessBufferSize);
-	}
-	
 	if (soundProcessor->PostProcessSamples != NULL)
 	{
 		processedSampleCount = soundProcessor->PostProcessSamples(postProcessBuffer, freeSampleCount, synchmode, synchronizer);
@@ -2066,8 +2628,10 @@ bool spu_loadstate(EMUFILE* is, int size)
 		spu->regs.masteren = BIT15(T1ReadWord(MMU.ARM7_REG, 0x500));
 	}
 
-	//copy the core spu (the more accurate) to the user spu
-	SPU_CloneUser();
+	//copy the core spu (the more accurate) to the user spu. going back from run-ahead frames, the user spu is
+	//already where the state is, having never seen them
+	if (!spu_unheard)
+		SPU_CloneUser();
 
 	return true;
 }
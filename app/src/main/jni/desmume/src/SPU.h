@@ -223,6 +223,16 @@ public:
 extern SPU_struct *SPU_core, *SPU_user;
 extern int spu_core_samples;
 
+//how much of the mixing got skipped, for the hud. it only ever counts up; whoever shows it resets it
+struct SPU_MixStats
+{
+	u32 samplesMixed;		//channel samples fetched and mixed
+	u32 samplesSilent;		//channel samples of keyed on channels at zero volume, which were only stepped over
+	u32 adpcmDecoded;		//adpcm samples decoded from their nibbles
+	u32 adpcmCached;		//adpcm samples taken from the cache instead
+};
+extern SPU_MixStats spu_mixStats;
+
 int SPU_ChangeSoundCore(int coreid, int buffersize);
 SoundInterface_struct *SPU_SoundCore();
 
@@ -231,33 +241,57 @@ int SPU_Init(int coreid, int buffersize);
 void SPU_Pause(int pause);
 void SPU_SetVolume(int volume);
 void SPU_SetSynchMode(int mode, int method);
+//for when the emulation is run this much faster than a ds (to match the display's refresh): the synchronous mode's
+//output is resampled by it, so that it keeps up without the synchronizer having to make up for it
+void SPU_SetOutputRate(double ratio);
 void SPU_ClearOutputBuffer(void);
 void SPU_Reset(void);
 void SPU_DeInit(void);
 void SPU_KeyOn(int channel);
+
+//the user spu can mix on a thread of its own in dual synch/asynch mode. the register writes
+//it would have got are then stamped with the core spu's sample clock and queued for it.
+extern bool spu_userThreaded;
+void SPU_SetUserThread(bool enable);
+void SPU_LogWrite(u32 addr, u32 val, u32 size);
+//for frames whose sound nobody hears (run-ahead, turbo): the core spu keeps running, but nothing it plays goes out
+//and the user spu doesn't see its writes, so that it stays where the last frame heard left it. after turbo, which
+//doesn't go back to that frame, SPU_CloneUser brings the user spu up to the core spu
+extern bool spu_unheard;
+void SPU_SetUnheard(bool enable);
+void SPU_CloneUser();
 static FORCEINLINE void SPU_WriteByte(u32 addr, u8 val)
 {
 	addr &= 0xFFF;
 
 	SPU_core->WriteByte(addr,val);
-	if(SPU_user)
-		SPU_user->WriteByte(addr,val);
+	if(SPU_user && !spu_unheard)
+	{
+		if(spu_userThreaded) SPU_LogWrite(addr,val,1);
+		else SPU_user->WriteByte(addr,val);
+	}
 }
 static FORCEINLINE void SPU_WriteWord(u32 addr, u16 val)
 {
 	addr &= 0xFFF;
 
 	SPU_core->WriteWord(addr,val);
-	if(SPU_user)
-		SPU_user->WriteWord(addr,val);
+	if(SPU_user && !spu_unheard)
+	{
+		if(spu_userThreaded) SPU_LogWrite(addr,val,2);
+		else SPU_user->WriteWord(addr,val);
+	}
 }
 static FORCEINLINE void SPU_WriteLong(u32 addr, u32 val)
 {
 	addr &= 0xFFF;
 
 	SPU_core->WriteLong(addr,val);
-	if(SPU_user) 
-		SPU_user->WriteLong(addr,val);
+	if(SPU_user && !spu_unheard)
+	{
+		if(spu_userThreaded) SPU_LogWrite(addr,val,4);
+		else SPU_user->WriteLong(addr,val);
+	}
 }
 static FORCEINLINE u8 SPU_ReadByte(u32 addr) { return SPU_core->ReadByte(addr & 0x0FFF); }
 static FORCEINLINE u16 SPU_ReadWord(u32 addr) { return SPU_core->ReadWord(addr & 0x0FFF); }
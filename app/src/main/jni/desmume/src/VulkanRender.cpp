@@ -0,0 +1,2546 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "VulkanRender.h"
+
+#include <algorithm>
+#include <dlfcn.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "bits.h"
+#include "debug.h"
+#include "gfx3d.h"
+#include "MMU.h"
+#include "NDSSystem.h"
+#include "path.h"
+#include "texcache.h"
+
+//the vulkan functions the renderer uses. the loader only exports the 1.0 ones on android, but going through
+//vkGetInstanceProcAddr and vkGetDeviceProcAddr skips its dispatch for the device ones
+#define VKRENDER_GLOBAL_FUNCS \
+	VKFUNC(vkCreateInstance)
+
+#define VKRENDER_INSTANCE_FUNCS \
+	VKFUNC(vkDestroyInstance) \
+	VKFUNC(vkEnumeratePhysicalDevices) \
+	VKFUNC(vkGetPhysicalDeviceProperties) \
+	VKFUNC(vkGetPhysicalDeviceFeatures) \
+	VKFUNC(vkGetPhysicalDeviceQueueFamilyProperties) \
+	VKFUNC(vkGetPhysicalDeviceMemoryProperties) \
+	VKFUNC(vkGetPhysicalDeviceFormatProperties) \
+	VKFUNC(vkCreateDevice) \
+	VKFUNC(vkGetDeviceProcAddr)
+
+#define VKRENDER_DEVICE_FUNCS \
+	VKFUNC(vkDestroyDevice) \
+	VKFUNC(vkGetDeviceQueue) \
+	VKFUNC(vkDeviceWaitIdle) \
+	VKFUNC(vkQueueSubmit) \
+	VKFUNC(vkCreateCommandPool) \
+	VKFUNC(vkDestroyCommandPool) \
+	VKFUNC(vkAllocateCommandBuffers) \
+	VKFUNC(vkBeginCommandBuffer) \
+	VKFUNC(vkEndCommandBuffer) \
+	VKFUNC(vkCreateFence) \
+	VKFUNC(vkDestroyFence) \
+	VKFUNC(vkWaitForFences) \
+	VKFUNC(vkResetFences) \
+	VKFUNC(vkCreateBuffer) \
+	VKFUNC(vkDestroyBuffer) \
+	VKFUNC(vkGetBufferMemoryRequirements) \
+	VKFUNC(vkBindBufferMemory) \
+	VKFUNC(vkCreateImage) \
+	VKFUNC(vkDestroyImage) \
+	VKFUNC(vkGetImageMemoryRequirements) \
+	VKFUNC(vkBindImageMemory) \
+	VKFUNC(vkCreateImageView) \
+	VKFUNC(vkDestroyImageView) \
+	VKFUNC(vkAllocateMemory) \
+	VKFUNC(vkFreeMemory) \
+	VKFUNC(vkMapMemory) \
+	VKFUNC(vkCreateSampler) \
+	VKFUNC(vkDestroySampler) \
+	VKFUNC(vkCreateDescriptorSetLayout) \
+	VKFUNC(vkDestroyDescriptorSetLayout) \
+	VKFUNC(vkCreatePipelineLayout) \
+	VKFUNC(vkDestroyPipelineLayout) \
+	VKFUNC(vkCreateDescriptorPool) \
+	VKFUNC(vkDestroyDescriptorPool) \
+	VKFUNC(vkAllocateDescriptorSets) \
+	VKFUNC(vkFreeDescriptorSets) \
+	VKFUNC(vkUpdateDescriptorSets) \
+	VKFUNC(vkCreateRenderPass) \
+	VKFUNC(vkDestroyRenderPass) \
+	VKFUNC(vkCreateFramebuffer) \
+	VKFUNC(vkDestroyFramebuffer) \
+	VKFUNC(vkCreateShaderModule) \
+	VKFUNC(vkDestroyShaderModule) \
+	VKFUNC(vkCreatePipelineCache) \
+	VKFUNC(vkDestroyPipelineCache) \
+	VKFUNC(vkGetPipelineCacheData) \
+	VKFUNC(vkCreateGraphicsPipelines) \
+	VKFUNC(vkDestroyPipeline) \
+	VKFUNC(vkCmdBeginRenderPass) \
+	VKFUNC(vkCmdNextSubpass) \
+	VKFUNC(vkCmdEndRenderPass) \
+	VKFUNC(vkCmdBindPipeline) \
+	VKFUNC(vkCmdBindDescriptorSets) \
+	VKFUNC(vkCmdBindVertexBuffers) \
+	VKFUNC(vkCmdBindIndexBuffer) \
+	VKFUNC(vkCmdPushConstants) \
+	VKFUNC(vkCmdSetViewport) \
+	VKFUNC(vkCmdSetScissor) \
+	VKFUNC(vkCmdSetStencilReference) \
+	VKFUNC(vkCmdDraw) \
+	VKFUNC(vkCmdDrawIndexed) \
+	VKFUNC(vkCmdPipelineBarrier) \
+	VKFUNC(vkCmdCopyBufferToImage) \
+	VKFUNC(vkCmdCopyImageToBuffer)
+
+#define VKFUNC(name) static PFN_##name name = NULL;
+static PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr = NULL;
+VKRENDER_GLOBAL_FUNCS
+VKRENDER_INSTANCE_FUNCS
+VKRENDER_DEVICE_FUNCS
+#undef VKFUNC
+
+//the pipelines are saved here, so that later launches can skip compiling them
+#define VKRENDER_PIPELINE_CACHE_FILENAME	"vulkanpipelines.cache"
+#define VKRENDER_PIPELINE_CACHE_MAX_SIZE	(4 * 1024 * 1024)
+
+//where each part of a frame's host ring starts
+static const VkDeviceSize hostVertexOffset = 0;
+static const VkDeviceSize hostIndexOffset = hostVertexOffset + VKRENDER_VERT_COUNT * sizeof(VulkanVertex);
+static const VkDeviceSize hostPostOffset = hostIndexOffset + VKRENDER_INDEX_COUNT * sizeof(u16);
+static const VkDeviceSize hostStagingOffset = hostPostOffset + 4096;
+static const VkDeviceSize hostRingSize = hostStagingOffset + VKRENDER_STAGING_SIZE;
+
+enum VulkanAttachment
+{
+	VulkanAttachment_Color = 0,
+	VulkanAttachment_Attributes, //the polygon id, whether it isn't fogged and whether it's translucent
+	VulkanAttachment_Depth, //the depth the fog goes by, which the shaders can't read from the depth buffer
+	VulkanAttachment_DepthStencil,
+	VulkanAttachment_Output //what the post pass makes, which is copied into the frame's readback buffer
+};
+
+static VulkanRenderer *_VulkanRenderer = NULL;
+
+bool (*vulkanrender_loadShader)(const char *name, std::vector<u32> *outCode) = NULL;
+
+static FORCEINLINE u32 RGBA8888_To_RGBA6665Rev(const u32 srcPix)
+{
+	//the same as RGBA8888_32Rev_To_RGBA6665_32Rev() in the gles renderer
+	const u32 dstPix = (srcPix >> 2) & 0x3F3F3F3F;
+	return ((dstPix >> 1) & 0xFF000000) | (dstPix & 0x00FFFFFF);
+}
+
+static std::string GetPipelineCachePath()
+{
+	return std::string(PathInfo::pathToModule) + "/Temp/" + VKRENDER_PIPELINE_CACHE_FILENAME;
+}
+
+static void texDeleteCallback(TexCacheItem *item)
+{
+	_VulkanRenderer->DeleteTexture(item);
+}
+
+static char VKInit(void)
+{
+	char result = Default3D_Init();
+	if (result == 0)
+	{
+		return result;
+	}
+
+	_VulkanRenderer = new VulkanRenderer;
+
+	Render3DError error = _VulkanRenderer->Init();
+	if (error != VKERROR_NOERR)
+	{
+		INFO("Vulkan: Renderer did not initialize (error %d). Disabling 3D renderer.\n", error);
+		delete _VulkanRenderer;
+		_VulkanRenderer = NULL;
+		result = 0;
+		return result;
+	}
+
+	_VulkanRenderer->Reset();
+
+	INFO("Vulkan: Renderer initialized successfully.\n");
+
+	return result;
+}
+
+static void VKReset()
+{
+	_VulkanRenderer->Reset();
+}
+
+static void VKClose()
+{
+	delete _VulkanRenderer;
+	_VulkanRenderer = NULL;
+
+	Default3D_Close();
+}
+
+static void VKRender()
+{
+	_VulkanRenderer->Render(&gfx3d.renderState, gfx3d.vertlist, gfx3d.polylist, &gfx3d.indexlist, gfx3d.frameCtr);
+}
+
+static void VKRenderFinish()
+{
+	_VulkanRenderer->RenderFinish();
+}
+
+static void VKVramReconfigureSignal()
+{
+	_VulkanRenderer->VramReconfigureSignal();
+}
+
+GPU3DInterface gpu3Dvulkan = {
+	"Vulkan",
+	VKInit,
+	VKReset,
+	VKClose,
+	VKRender,
+	VKRenderFinish,
+	VKVramReconfigureSignal
+};
+
+VulkanRenderer::VulkanRenderer()
+{
+	loader = NULL;
+	instance = VK_NULL_HANDLE;
+	physicalDevice = VK_NULL_HANDLE;
+	device = VK_NULL_HANDLE;
+	queue = VK_NULL_HANDLE;
+	queueFamily = 0;
+	memset(&memoryProperties, 0, sizeof(memoryProperties));
+	depthStencilFormat = VK_FORMAT_UNDEFINED;
+
+	commandPool = VK_NULL_HANDLE;
+	memset(frame, 0, sizeof(frame));
+	currFrame = &frame[0];
+	frameSerial = 0;
+	completedSerial = 0;
+	recording = false;
+
+	for (unsigned int i = 0; i < 5; i++)
+	{
+		attachmentImage[i] = VK_NULL_HANDLE;
+		attachmentMemory[i] = VK_NULL_HANDLE;
+		attachmentView[i] = VK_NULL_HANDLE;
+	}
+	renderPass = VK_NULL_HANDLE;
+	postRenderPass = VK_NULL_HANDLE;
+	framebuffer = VK_NULL_HANDLE;
+	postFramebuffer = VK_NULL_HANDLE;
+
+	for (unsigned int i = 0; i < 9; i++)
+	{
+		textureSampler[i] = VK_NULL_HANDLE;
+		samplerSet[i] = VK_NULL_HANDLE;
+	}
+	nearestSampler = VK_NULL_HANDLE;
+	textureSetLayout = VK_NULL_HANDLE;
+	samplerSetLayout = VK_NULL_HANDLE;
+	clearSetLayout = VK_NULL_HANDLE;
+	postSetLayout = VK_NULL_HANDLE;
+	polyPipelineLayout = VK_NULL_HANDLE;
+	clearPipelineLayout = VK_NULL_HANDLE;
+	postPipelineLayout = VK_NULL_HANDLE;
+	descriptorPool = VK_NULL_HANDLE;
+	clearSet = VK_NULL_HANDLE;
+
+	polyVertexShader = VK_NULL_HANDLE;
+	polyFragmentShader = VK_NULL_HANDLE;
+	screenVertexShader = VK_NULL_HANDLE;
+	clearFragmentShader = VK_NULL_HANDLE;
+	postFragmentShader = VK_NULL_HANDLE;
+	pipelineCache = VK_NULL_HANDLE;
+	clearPipeline = VK_NULL_HANDLE;
+	postPipeline = VK_NULL_HANDLE;
+
+	blankTexture = NULL;
+	toonImage = VK_NULL_HANDLE;
+	toonMemory = VK_NULL_HANDLE;
+	toonView = VK_NULL_HANDLE;
+	clearImage = VK_NULL_HANDLE;
+	clearMemory = VK_NULL_HANDLE;
+	clearView = VK_NULL_HANDLE;
+
+	memset(&polyState, 0, sizeof(polyState));
+	memset(&viewport, 0, sizeof(viewport));
+	currTexture = NULL;
+	textureSet = VK_NULL_HANDLE;
+	currTextureSet = VK_NULL_HANDLE;
+	memset(clearValues, 0, sizeof(clearValues));
+	useClearImage = false;
+	clearPolyID = 0;
+	clearImageValid = false;
+	toonTableNeedsUpdate = true;
+}
+
+VulkanRenderer::~VulkanRenderer()
+{
+	if (device != VK_NULL_HANDLE)
+	{
+		vkDeviceWaitIdle(device);
+
+		//everything in flight is done now, so the textures can go right away
+		TexCache_ReleaseRendererData();
+		completedSerial = frameSerial;
+		CollectGarbage();
+
+		if (blankTexture != NULL)
+		{
+			DestroyTexture(blankTexture);
+			blankTexture = NULL;
+		}
+
+		SavePipelineCache();
+
+		for (std::map<u32, VkPipeline>::iterator it = pipelines.begin(); it != pipelines.end(); ++it)
+		{
+			vkDestroyPipeline(device, it->second, NULL);
+		}
+		pipelines.clear();
+		vkDestroyPipeline(device, clearPipeline, NULL);
+		vkDestroyPipeline(device, postPipeline, NULL);
+		vkDestroyPipelineCache(device, pipelineCache, NULL);
+
+		vkDestroyShaderModule(device, polyVertexShader, NULL);
+		vkDestroyShaderModule(device, polyFragmentShader, NULL);
+		vkDestroyShaderModule(device, screenVertexShader, NULL);
+		vkDestroyShaderModule(device, clearFragmentShader, NULL);
+		vkDestroyShaderModule(device, postFragmentShader, NULL);
+
+		for (size_t i = 0; i < texturePools.size(); i++)
+		{
+			vkDestroyDescriptorPool(device, texturePools[i], NULL);
+		}
+		texturePools.clear();
+		vkDestroyDescriptorPool(device, descriptorPool, NULL);
+		vkDestroyPipelineLayout(device, polyPipelineLayout, NULL);
+		vkDestroyPipelineLayout(device, clearPipelineLayout, NULL);
+		vkDestroyPipelineLayout(device, postPipelineLayout, NULL);
+		vkDestroyDescriptorSetLayout(device, textureSetLayout, NULL);
+		vkDestroyDescriptorSetLayout(device, samplerSetLayout, NULL);
+		vkDestroyDescriptorSetLayout(device, clearSetLayout, NULL);
+		vkDestroyDescriptorSetLayout(device, postSetLayout, NULL);
+
+		for (unsigned int i = 0; i < 9; i++)
+		{
+			vkDestroySampler(device, textureSampler[i], NULL);
+		}
+		vkDestroySampler(device, nearestSampler, NULL);
+
+		DestroyImage(toonImage, toonMemory, toonView);
+		DestroyImage(clearImage, clearMemory, clearView);
+
+		vkDestroyFramebuffer(device, framebuffer, NULL);
+		vkDestroyFramebuffer(device, postFramebuffer, NULL);
+		vkDestroyRenderPass(device, renderPass, NULL);
+		vkDestroyRenderPass(device, postRenderPass, NULL);
+		for (unsigned int i = 0; i < 5; i++)
+		{
+			DestroyImage(attachmentImage[i], attachmentMemory[i], attachmentView[i]);
+		}
+
+		for (unsigned int i = 0; i < VKRENDER_FRAME_COUNT; i++)
+		{
+			vkDestroyBuffer(device, frame[i].hostBuffer, NULL);
+			vkFreeMemory(device, frame[i].hostMemory, NULL);
+			vkDestroyBuffer(device, frame[i].readbackBuffer, NULL);
+			vkFreeMemory(device, frame[i].readbackMemory, NULL);
+			vkDestroyFence(device, frame[i].fence, NULL);
+		}
+		vkDestroyCommandPool(device, commandPool, NULL);
+
+		vkDestroyDevice(device, NULL);
+		device = VK_NULL_HANDLE;
+	}
+
+	if (instance != VK_NULL_HANDLE && vkDestroyInstance != NULL)
+	{
+		vkDestroyInstance(instance, NULL);
+		instance = VK_NULL_HANDLE;
+	}
+
+	if (loader != NULL)
+	{
+		dlclose(loader);
+		loader = NULL;
+	}
+}
+
+Render3DError VulkanRenderer::Init()
+{
+	Render3DError error = InitDevice();
+	if (error != VKERROR_NOERR)
+	{
+		return error;
+	}
+
+	if ((error = CreateFrames()) != VKERROR_NOERR ||
+		(error = CreateAttachments()) != VKERROR_NOERR ||
+		(error = CreateRenderPasses()) != VKERROR_NOERR ||
+		(error = CreateTextures()) != VKERROR_NOERR ||
+		(error = CreateDescriptors()) != VKERROR_NOERR ||
+		(error = CreateShaders()) != VKERROR_NOERR)
+	{
+		return error;
+	}
+
+	//the blank texture is uploaded on its own, before any frame
+	VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	currFrame = &frame[0];
+	currFrame->stagingUsed = 0;
+	vkBeginCommandBuffer(currFrame->uploadCommands, &beginInfo);
+
+	static const u32 blankPixel = 0xFFFFFFFF;
+	blankTexture = CreateTexture(currFrame->uploadCommands, 1, 1, &blankPixel);
+
+	vkEndCommandBuffer(currFrame->uploadCommands);
+
+	VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &currFrame->uploadCommands;
+	if (blankTexture == NULL || vkQueueSubmit(queue, 1, &submitInfo, currFrame->fence) != VK_SUCCESS)
+	{
+		return VKERROR_CREATE_ERROR;
+	}
+	currFrame->submitted = true;
+	currFrame->serial = frameSerial;
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::InitDevice()
+{
+	loader = dlopen("libvulkan.so", RTLD_NOW | RTLD_LOCAL);
+	if (loader == NULL)
+	{
+		INFO("Vulkan: This system has no Vulkan loader.\n");
+		return VKERROR_LOADER_UNAVAILABLE;
+	}
+
+	vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr)dlsym(loader, "vkGetInstanceProcAddr");
+	if (vkGetInstanceProcAddr == NULL)
+	{
+		return VKERROR_LOADER_UNAVAILABLE;
+	}
+
+#define VKFUNC(name) if ((name = (PFN_##name)vkGetInstanceProcAddr(VK_NULL_HANDLE, #name)) == NULL) return VKERROR_LOADER_UNAVAILABLE;
+	VKRENDER_GLOBAL_FUNCS
+#undef VKFUNC
+
+	VkApplicationInfo appInfo = {VK_STRUCTURE_TYPE_APPLICATION_INFO};
+	appInfo.pApplicationName = "nds4droid";
+	appInfo.pEngineName = "DeSmuME";
+	appInfo.apiVersion = VK_MAKE_VERSION(1, 0, 0);
+
+	VkInstanceCreateInfo instanceInfo = {VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO};
+	instanceInfo.pApplicationInfo = &appInfo;
+
+	if (vkCreateInstance(&instanceInfo, NULL, &instance) != VK_SUCCESS)
+	{
+		instance = VK_NULL_HANDLE;
+		return VKERROR_LOADER_UNAVAILABLE;
+	}
+
+#define VKFUNC(name) if ((name = (PFN_##name)vkGetInstanceProcAddr(instance, #name)) == NULL) return VKERROR_LOADER_UNAVAILABLE;
+	VKRENDER_INSTANCE_FUNCS
+#undef VKFUNC
+
+	u32 deviceCount = 0;
+	vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
+	std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
+	if (deviceCount > 0)
+	{
+		vkEnumeratePhysicalDevices(instance, &deviceCount, &physicalDevices[0]);
+	}
+
+	//take the first device that can do all of it: the attachments are blended differently from each other, so
+	//independentBlend is needed
+	for (u32 i = 0; i < deviceCount && physicalDevice == VK_NULL_HANDLE; i++)
+	{
+		VkPhysicalDeviceFeatures features;
+		vkGetPhysicalDeviceFeatures(physicalDevices[i], &features);
+		if (!features.independentBlend)
+		{
+			continue;
+		}
+
+		static const VkFormat depthStencilFormats[] = {VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT};
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		for (unsigned int f = 0; f < ARRAY_SIZE(depthStencilFormats) && format == VK_FORMAT_UNDEFINED; f++)
+		{
+			VkFormatProperties formatProperties;
+			vkGetPhysicalDeviceFormatProperties(physicalDevices[i], depthStencilFormats[f], &formatProperties);
+			if (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+			{
+				format = depthStencilFormats[f];
+			}
+		}
+		if (format == VK_FORMAT_UNDEFINED)
+		{
+			continue;
+		}
+
+		u32 familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevices[i], &familyCount, NULL);
+		std::vector<VkQueueFamilyProperties> families(familyCount);
+		if (familyCount > 0)
+		{
+			vkGetPhysicalDeviceQueueFamilyProperties(physicalDevices[i], &familyCount, &families[0]);
+		}
+
+		for (u32 q = 0; q < familyCount; q++)
+		{
+			if (families[q].queueCount > 0 && (families[q].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+			{
+				physicalDevice = physicalDevices[i];
+				queueFamily = q;
+				depthStencilFormat = format;
+				break;
+			}
+		}
+	}
+
+	if (physicalDevice == VK_NULL_HANDLE)
+	{
+		INFO("Vulkan: No device has what the renderer needs.\n");
+		return VKERROR_DEVICE_UNSUPPORTED;
+	}
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	const float queuePriority = 1.0f;
+	VkDeviceQueueCreateInfo queueInfo = {VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
+	queueInfo.queueFamilyIndex = queueFamily;
+	queueInfo.queueCount = 1;
+	queueInfo.pQueuePriorities = &queuePriority;
+
+	VkPhysicalDeviceFeatures enabledFeatures;
+	memset(&enabledFeatures, 0, sizeof(enabledFeatures));
+	enabledFeatures.independentBlend = VK_TRUE;
+
+	VkDeviceCreateInfo deviceInfo = {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
+	deviceInfo.queueCreateInfoCount = 1;
+	deviceInfo.pQueueCreateInfos = &queueInfo;
+	deviceInfo.pEnabledFeatures = &enabledFeatures;
+
+	if (vkCreateDevice(physicalDevice, &deviceInfo, NULL, &device) != VK_SUCCESS)
+	{
+		device = VK_NULL_HANDLE;
+		return VKERROR_DEVICE_UNSUPPORTED;
+	}
+
+#define VKFUNC(name) if ((name = (PFN_##name)vkGetDeviceProcAddr(device, #name)) == NULL) { vkDestroyDevice = (PFN_vkDestroyDevice)vkGetDeviceProcAddr(device, "vkDestroyDevice"); if (vkDestroyDevice != NULL) vkDestroyDevice(device, NULL); device = VK_NULL_HANDLE; return VKERROR_LOADER_UNAVAILABLE; }
+	VKRENDER_DEVICE_FUNCS
+#undef VKFUNC
+
+	vkGetDeviceQueue(device, queueFamily, 0, &queue);
+
+	INFO("Vulkan: Using %s (Vulkan %u.%u.%u).\n", properties.deviceName,
+		 VK_VERSION_MAJOR(properties.apiVersion), VK_VERSION_MINOR(properties.apiVersion), VK_VERSION_PATCH(properties.apiVersion));
+
+	return VKERROR_NOERR;
+}
+
+bool VulkanRenderer::FindMemoryType(u32 typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, u32 *outType) const
+{
+	for (int pass = 0; pass < 2; pass++)
+	{
+		const VkMemoryPropertyFlags flags = (pass == 0) ? (required | preferred) : required;
+
+		for (u32 i = 0; i < memoryProperties.memoryTypeCount; i++)
+		{
+			if ((typeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+			{
+				*outType = i;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+Render3DError VulkanRenderer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VkBuffer *outBuffer, VkDeviceMemory *outMemory, void **outMapped)
+{
+	*outBuffer = VK_NULL_HANDLE;
+	*outMemory = VK_NULL_HANDLE;
+
+	VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, NULL, outBuffer) != VK_SUCCESS)
+	{
+		*outBuffer = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(device, *outBuffer, &requirements);
+
+	VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+	allocInfo.allocationSize = requirements.size;
+	if (!FindMemoryType(requirements.memoryTypeBits, required, preferred, &allocInfo.memoryTypeIndex) ||
+		vkAllocateMemory(device, &allocInfo, NULL, outMemory) != VK_SUCCESS)
+	{
+		vkDestroyBuffer(device, *outBuffer, NULL);
+		*outBuffer = VK_NULL_HANDLE;
+		*outMemory = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	vkBindBufferMemory(device, *outBuffer, *outMemory, 0);
+
+	if (outMapped != NULL && vkMapMemory(device, *outMemory, 0, VK_WHOLE_SIZE, 0, outMapped) != VK_SUCCESS)
+	{
+		vkDestroyBuffer(device, *outBuffer, NULL);
+		vkFreeMemory(device, *outMemory, NULL);
+		*outBuffer = VK_NULL_HANDLE;
+		*outMemory = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::CreateImage(u32 width, u32 height, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkImage *outImage, VkDeviceMemory *outMemory, VkImageView *outView)
+{
+	*outImage = VK_NULL_HANDLE;
+	*outMemory = VK_NULL_HANDLE;
+	*outView = VK_NULL_HANDLE;
+
+	VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent.width = width;
+	imageInfo.extent.height = height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = usage;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(device, &imageInfo, NULL, outImage) != VK_SUCCESS)
+	{
+		*outImage = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(device, *outImage, &requirements);
+
+	VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+	allocInfo.allocationSize = requirements.size;
+	if (!FindMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &allocInfo.memoryTypeIndex) &&
+		!FindMemoryType(requirements.memoryTypeBits, 0, 0, &allocInfo.memoryTypeIndex))
+	{
+		DestroyImage(*outImage, VK_NULL_HANDLE, VK_NULL_HANDLE);
+		*outImage = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	if (vkAllocateMemory(device, &allocInfo, NULL, outMemory) != VK_SUCCESS)
+	{
+		DestroyImage(*outImage, VK_NULL_HANDLE, VK_NULL_HANDLE);
+		*outImage = VK_NULL_HANDLE;
+		*outMemory = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	vkBindImageMemory(device, *outImage, *outMemory, 0);
+
+	VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+	viewInfo.image = *outImage;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange.aspectMask = aspect;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	if (vkCreateImageView(device, &viewInfo, NULL, outView) != VK_SUCCESS)
+	{
+		DestroyImage(*outImage, *outMemory, VK_NULL_HANDLE);
+		*outImage = VK_NULL_HANDLE;
+		*outMemory = VK_NULL_HANDLE;
+		*outView = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	return VKERROR_NOERR;
+}
+
+void VulkanRenderer::DestroyImage(VkImage image, VkDeviceMemory memory, VkImageView view)
+{
+	vkDestroyImageView(device, view, NULL);
+	vkDestroyImage(device, image, NULL);
+	vkFreeMemory(device, memory, NULL);
+}
+
+Render3DError VulkanRenderer::CreateFrames()
+{
+	VkCommandPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamily;
+
+	if (vkCreateCommandPool(device, &poolInfo, NULL, &commandPool) != VK_SUCCESS)
+	{
+		commandPool = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	for (unsigned int i = 0; i < VKRENDER_FRAME_COUNT; i++)
+	{
+		VulkanFrame &theFrame = frame[i];
+
+		VkCommandBuffer commands[2];
+		VkCommandBufferAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 2;
+		if (vkAllocateCommandBuffers(device, &allocInfo, commands) != VK_SUCCESS)
+		{
+			return VKERROR_CREATE_ERROR;
+		}
+		theFrame.uploadCommands = commands[0];
+		theFrame.renderCommands = commands[1];
+
+		VkFenceCreateInfo fenceInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+		if (vkCreateFence(device, &fenceInfo, NULL, &theFrame.fence) != VK_SUCCESS)
+		{
+			theFrame.fence = VK_NULL_HANDLE;
+			return VKERROR_CREATE_ERROR;
+		}
+
+		//host-coherent memory always exists, so nothing here needs flushing or invalidating. the readback is
+		//read by the cpu, so it had better be cached
+		void *mapped = NULL;
+		if (CreateBuffer(hostRingSize,
+						 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0,
+						 &theFrame.hostBuffer, &theFrame.hostMemory, &mapped) != VKERROR_NOERR)
+		{
+			return VKERROR_CREATE_ERROR;
+		}
+		theFrame.hostMapped = (u8 *)mapped;
+
+		if (CreateBuffer(GFX3D_FRAMEBUFFER_WIDTH * GFX3D_FRAMEBUFFER_HEIGHT * sizeof(u32),
+						 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+						 &theFrame.readbackBuffer, &theFrame.readbackMemory, &mapped) != VKERROR_NOERR)
+		{
+			return VKERROR_CREATE_ERROR;
+		}
+		theFrame.readbackMapped = (const u32 *)mapped;
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::CreateAttachments()
+{
+	static const VkImageUsageFlags colorUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	if (CreateImage(GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, VK_FORMAT_R8G8B8A8_UNORM, colorUsage, VK_IMAGE_ASPECT_COLOR_BIT,
+					&attachmentImage[VulkanAttachment_Color], &attachmentMemory[VulkanAttachment_Color], &attachmentView[VulkanAttachment_Color]) != VKERROR_NOERR ||
+		CreateImage(GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, VK_FORMAT_R8G8B8A8_UNORM, colorUsage, VK_IMAGE_ASPECT_COLOR_BIT,
+					&attachmentImage[VulkanAttachment_Attributes], &attachmentMemory[VulkanAttachment_Attributes], &attachmentView[VulkanAttachment_Attributes]) != VKERROR_NOERR ||
+		CreateImage(GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, VK_FORMAT_R32_SFLOAT, colorUsage, VK_IMAGE_ASPECT_COLOR_BIT,
+					&attachmentImage[VulkanAttachment_Depth], &attachmentMemory[VulkanAttachment_Depth], &attachmentView[VulkanAttachment_Depth]) != VKERROR_NOERR ||
+		CreateImage(GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, depthStencilFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT,
+					&attachmentImage[VulkanAttachment_DepthStencil], &attachmentMemory[VulkanAttachment_DepthStencil], &attachmentView[VulkanAttachment_DepthStencil]) != VKERROR_NOERR ||
+		CreateImage(GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+					&attachmentImage[VulkanAttachment_Output], &attachmentMemory[VulkanAttachment_Output], &attachmentView[VulkanAttachment_Output]) != VKERROR_NOERR)
+	{
+		return VKERROR_CREATE_ERROR;
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::CreateRenderPasses()
+{
+	//the main pass. its color attachments are read by the post pass right after, and the depth buffer isn't
+	//needed once it's done
+	VkAttachmentDescription attachments[4];
+	memset(attachments, 0, sizeof(attachments));
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+	attachments[VulkanAttachment_Color].format = VK_FORMAT_R8G8B8A8_UNORM;
+	attachments[VulkanAttachment_Attributes].format = VK_FORMAT_R8G8B8A8_UNORM;
+	attachments[VulkanAttachment_Depth].format = VK_FORMAT_R32_SFLOAT;
+	attachments[VulkanAttachment_DepthStencil].format = depthStencilFormat;
+	attachments[VulkanAttachment_DepthStencil].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[VulkanAttachment_DepthStencil].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[VulkanAttachment_DepthStencil].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	const VkAttachmentReference colorRefs[3] = {
+		{VulkanAttachment_Color, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+		{VulkanAttachment_Attributes, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+		{VulkanAttachment_Depth, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}
+	};
+	const VkAttachmentReference depthStencilRef = {VulkanAttachment_DepthStencil, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+	//subpass 0 draws the opaque polygons and subpass 1 the translucent ones, which keep the attributes of what's
+	//under them
+	VkSubpassDescription subpasses[2];
+	memset(subpasses, 0, sizeof(subpasses));
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		subpasses[i].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpasses[i].colorAttachmentCount = 3;
+		subpasses[i].pColorAttachments = colorRefs;
+		subpasses[i].pDepthStencilAttachment = &depthStencilRef;
+	}
+
+	VkSubpassDependency dependencies[3];
+	memset(dependencies, 0, sizeof(dependencies));
+	//the last frame's post pass has to be done reading the attachments
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = 1;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+									VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+	dependencies[2].srcSubpass = 1;
+	dependencies[2].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[2].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[2].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo passInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+	passInfo.attachmentCount = 4;
+	passInfo.pAttachments = attachments;
+	passInfo.subpassCount = 2;
+	passInfo.pSubpasses = subpasses;
+	passInfo.dependencyCount = 3;
+	passInfo.pDependencies = dependencies;
+
+	if (vkCreateRenderPass(device, &passInfo, NULL, &renderPass) != VK_SUCCESS)
+	{
+		renderPass = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	//the post pass, whose every pixel is drawn over. it ends ready to be copied into the readback buffer
+	VkAttachmentDescription outputAttachment;
+	memset(&outputAttachment, 0, sizeof(outputAttachment));
+	outputAttachment.format = VK_FORMAT_R8G8B8A8_UNORM;
+	outputAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	outputAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	outputAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	outputAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	outputAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	outputAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	outputAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	const VkAttachmentReference outputRef = {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+
+	VkSubpassDescription postSubpass;
+	memset(&postSubpass, 0, sizeof(postSubpass));
+	postSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	postSubpass.colorAttachmentCount = 1;
+	postSubpass.pColorAttachments = &outputRef;
+
+	VkSubpassDependency postDependencies[2];
+	memset(postDependencies, 0, sizeof(postDependencies));
+	//the last frame's copy has to be done with the output
+	postDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	postDependencies[0].dstSubpass = 0;
+	postDependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	postDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	postDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	postDependencies[1].srcSubpass = 0;
+	postDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	postDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	postDependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	postDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	postDependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	VkRenderPassCreateInfo postPassInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+	postPassInfo.attachmentCount = 1;
+	postPassInfo.pAttachments = &outputAttachment;
+	postPassInfo.subpassCount = 1;
+	postPassInfo.pSubpasses = &postSubpass;
+	postPassInfo.dependencyCount = 2;
+	postPassInfo.pDependencies = postDependencies;
+
+	if (vkCreateRenderPass(device, &postPassInfo, NULL, &postRenderPass) != VK_SUCCESS)
+	{
+		postRenderPass = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	VkFramebufferCreateInfo framebufferInfo = {VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+	framebufferInfo.renderPass = renderPass;
+	framebufferInfo.attachmentCount = 4;
+	framebufferInfo.pAttachments = attachmentView;
+	framebufferInfo.width = GFX3D_FRAMEBUFFER_WIDTH;
+	framebufferInfo.height = GFX3D_FRAMEBUFFER_HEIGHT;
+	framebufferInfo.layers = 1;
+
+	if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &framebuffer) != VK_SUCCESS)
+	{
+		framebuffer = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	framebufferInfo.renderPass = postRenderPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &attachmentView[VulkanAttachment_Output];
+
+	if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &postFramebuffer) != VK_SUCCESS)
+	{
+		postFramebuffer = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::CreateTextures()
+{
+	//the textures are sampled the way the gles renderer sets them up: nearest, and wrapped by the polygon
+	static const VkSamplerAddressMode addressModes[3] = {
+		VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT
+	};
+
+	VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = 0.0f;
+
+	for (unsigned int i = 0; i < 9; i++)
+	{
+		samplerInfo.addressModeU = addressModes[i / 3];
+		samplerInfo.addressModeV = addressModes[i % 3];
+		if (vkCreateSampler(device, &samplerInfo, NULL, &textureSampler[i]) != VK_SUCCESS)
+		{
+			textureSampler[i] = VK_NULL_HANDLE;
+			return VKERROR_CREATE_ERROR;
+		}
+	}
+
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	if (vkCreateSampler(device, &samplerInfo, NULL, &nearestSampler) != VK_SUCCESS)
+	{
+		nearestSampler = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	static const VkImageUsageFlags uploadUsage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+	if (CreateImage(32, 1, VK_FORMAT_R8G8B8A8_UNORM, uploadUsage, VK_IMAGE_ASPECT_COLOR_BIT, &toonImage, &toonMemory, &toonView) != VKERROR_NOERR ||
+		CreateImage(GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, VK_FORMAT_R32_UINT, uploadUsage, VK_IMAGE_ASPECT_COLOR_BIT, &clearImage, &clearMemory, &clearView) != VKERROR_NOERR)
+	{
+		return VKERROR_CREATE_ERROR;
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::CreateDescriptors()
+{
+	VkDescriptorSetLayoutBinding bindings[4];
+	memset(bindings, 0, sizeof(bindings));
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+	layoutInfo.pBindings = bindings;
+
+	//set 0 of the polygons: the texture
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	layoutInfo.bindingCount = 1;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &textureSetLayout) != VK_SUCCESS)
+	{
+		textureSetLayout = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	//set 1 of the polygons: how the texture wraps, and the toon table
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	bindings[1] = bindings[0];
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	layoutInfo.bindingCount = 2;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &samplerSetLayout) != VK_SUCCESS)
+	{
+		samplerSetLayout = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	//the clear image
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	layoutInfo.bindingCount = 1;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &clearSetLayout) != VK_SUCCESS)
+	{
+		clearSetLayout = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	//the post pass: the color, the attributes, the depth and its uniforms
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		bindings[i] = bindings[0];
+		bindings[i].binding = i;
+	}
+	bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	layoutInfo.bindingCount = 4;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &postSetLayout) != VK_SUCCESS)
+	{
+		postSetLayout = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	const VkDescriptorSetLayout polySetLayouts[2] = {textureSetLayout, samplerSetLayout};
+	VkPushConstantRange pushRange = {VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(VulkanPolyState)};
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+	pipelineLayoutInfo.setLayoutCount = 2;
+	pipelineLayoutInfo.pSetLayouts = polySetLayouts;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &polyPipelineLayout) != VK_SUCCESS)
+	{
+		polyPipelineLayout = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	pushRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushRange.size = sizeof(s32);
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &clearSetLayout;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &clearPipelineLayout) != VK_SUCCESS)
+	{
+		clearPipelineLayout = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	pipelineLayoutInfo.pSetLayouts = &postSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = NULL;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &postPipelineLayout) != VK_SUCCESS)
+	{
+		postPipelineLayout = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	//the sets that don't change: one for each way a texture wraps, the clear image's and each frame's post pass's
+	const VkDescriptorPoolSize poolSizes[3] = {
+		{VK_DESCRIPTOR_TYPE_SAMPLER, 9},
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 9 + 1 + 3 * VKRENDER_FRAME_COUNT},
+		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VKRENDER_FRAME_COUNT}
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+	poolInfo.maxSets = 9 + 1 + VKRENDER_FRAME_COUNT;
+	poolInfo.poolSizeCount = 3;
+	poolInfo.pPoolSizes = poolSizes;
+	if (vkCreateDescriptorPool(device, &poolInfo, NULL, &descriptorPool) != VK_SUCCESS)
+	{
+		descriptorPool = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+
+	VkDescriptorImageInfo imageInfo[3];
+	VkDescriptorBufferInfo bufferInfo;
+	VkWriteDescriptorSet writes[4];
+	memset(imageInfo, 0, sizeof(imageInfo));
+	memset(writes, 0, sizeof(writes));
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstBinding = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[i].pImageInfo = &imageInfo[(i < 3) ? i : 0];
+	}
+
+	for (unsigned int i = 0; i < 9; i++)
+	{
+		allocInfo.pSetLayouts = &samplerSetLayout;
+		if (vkAllocateDescriptorSets(device, &allocInfo, &samplerSet[i]) != VK_SUCCESS)
+		{
+			return VKERROR_CREATE_ERROR;
+		}
+
+		imageInfo[0].sampler = textureSampler[i];
+		imageInfo[1].sampler = nearestSampler;
+		imageInfo[1].imageView = toonView;
+		imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		writes[0].dstSet = samplerSet[i];
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+		writes[1].dstSet = samplerSet[i];
+		vkUpdateDescriptorSets(device, 2, writes, 0, NULL);
+	}
+
+	allocInfo.pSetLayouts = &clearSetLayout;
+	if (vkAllocateDescriptorSets(device, &allocInfo, &clearSet) != VK_SUCCESS)
+	{
+		return VKERROR_CREATE_ERROR;
+	}
+
+	imageInfo[0].sampler = nearestSampler;
+	imageInfo[0].imageView = clearView;
+	imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	writes[0].dstSet = clearSet;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	vkUpdateDescriptorSets(device, 1, writes, 0, NULL);
+
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		imageInfo[i].sampler = nearestSampler;
+		imageInfo[i].imageView = attachmentView[i];
+		imageInfo[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+	writes[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	writes[3].pImageInfo = NULL;
+	writes[3].pBufferInfo = &bufferInfo;
+
+	for (unsigned int i = 0; i < VKRENDER_FRAME_COUNT; i++)
+	{
+		allocInfo.pSetLayouts = &postSetLayout;
+		if (vkAllocateDescriptorSets(device, &allocInfo, &frame[i].postSet) != VK_SUCCESS)
+		{
+			return VKERROR_CREATE_ERROR;
+		}
+
+		bufferInfo.buffer = frame[i].hostBuffer;
+		bufferInfo.offset = hostPostOffset;
+		bufferInfo.range = sizeof(VulkanPostState);
+		for (unsigned int w = 0; w < 4; w++)
+		{
+			writes[w].dstSet = frame[i].postSet;
+		}
+		vkUpdateDescriptorSets(device, 4, writes, 0, NULL);
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::LoadShader(const char *name, VkShaderModule *outModule)
+{
+	std::vector<u32> code;
+	if (vulkanrender_loadShader == NULL || !vulkanrender_loadShader(name, &code) || code.empty())
+	{
+		INFO("Vulkan: Could not load the shader %s.\n", name);
+		return VKERROR_SHADER_LOAD_ERROR;
+	}
+
+	VkShaderModuleCreateInfo moduleInfo = {VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+	moduleInfo.codeSize = code.size() * sizeof(u32);
+	moduleInfo.pCode = &code[0];
+
+	if (vkCreateShaderModule(device, &moduleInfo, NULL, outModule) != VK_SUCCESS)
+	{
+		*outModule = VK_NULL_HANDLE;
+		INFO("Vulkan: The shader %s is not valid.\n", name);
+		return VKERROR_SHADER_LOAD_ERROR;
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::CreateShaders()
+{
+	if (LoadShader("vulkan3d.vert", &polyVertexShader) != VKERROR_NOERR ||
+		LoadShader("vulkan3d.frag", &polyFragmentShader) != VKERROR_NOERR ||
+		LoadShader("vulkanscreen.vert", &screenVertexShader) != VKERROR_NOERR ||
+		LoadShader("vulkanclear.frag", &clearFragmentShader) != VKERROR_NOERR ||
+		LoadShader("vulkanpost.frag", &postFragmentShader) != VKERROR_NOERR)
+	{
+		return VKERROR_SHADER_LOAD_ERROR;
+	}
+
+	LoadPipelineCache();
+
+	//the clear image and the post pass each have a single pipeline, which draws a triangle over the framebuffer
+	VkPipelineShaderStageCreateInfo stages[2];
+	memset(stages, 0, sizeof(stages));
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].module = screenVertexShader;
+	stages[0].pName = "main";
+	stages[1] = stages[0];
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	stages[1].module = clearFragmentShader;
+
+	VkPipelineVertexInputStateCreateInfo vertexInput = {VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	const VkViewport fullViewport = {0.0f, 0.0f, (float)GFX3D_FRAMEBUFFER_WIDTH, (float)GFX3D_FRAMEBUFFER_HEIGHT, 0.0f, 1.0f};
+	const VkRect2D fullScissor = {{0, 0}, {GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT}};
+
+	VkPipelineViewportStateCreateInfo viewportState = {VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = &fullViewport;
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = &fullScissor;
+
+	VkPipelineRasterizationStateCreateInfo rasterization = {VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+	rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterization.cullMode = VK_CULL_MODE_NONE;
+	rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterization.lineWidth = 1.0f;
+
+	VkPipelineMultisampleStateCreateInfo multisample = {VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+	multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	//the clear image replaces the depth, the stencil and all three colors
+	VkPipelineDepthStencilStateCreateInfo depthStencil = {VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+	depthStencil.stencilTestEnable = VK_TRUE;
+	depthStencil.front.failOp = VK_STENCIL_OP_REPLACE;
+	depthStencil.front.passOp = VK_STENCIL_OP_REPLACE;
+	depthStencil.front.depthFailOp = VK_STENCIL_OP_REPLACE;
+	depthStencil.front.compareOp = VK_COMPARE_OP_ALWAYS;
+	depthStencil.front.compareMask = 0xFF;
+	depthStencil.front.writeMask = 0xFF;
+	depthStencil.back = depthStencil.front;
+
+	VkPipelineColorBlendAttachmentState blendAttachments[3];
+	memset(blendAttachments, 0, sizeof(blendAttachments));
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		blendAttachments[i].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	}
+
+	VkPipelineColorBlendStateCreateInfo colorBlend = {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+	colorBlend.attachmentCount = 3;
+	colorBlend.pAttachments = blendAttachments;
+
+	static const VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_STENCIL_REFERENCE};
+	VkPipelineDynamicStateCreateInfo dynamicState = {VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+	dynamicState.dynamicStateCount = ARRAY_SIZE(dynamicStates);
+	dynamicState.pDynamicStates = dynamicStates;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = stages;
+	pipelineInfo.pVertexInputState = &vertexInput;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterization;
+	pipelineInfo.pMultisampleState = &multisample;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlend;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = clearPipelineLayout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = 0;
+
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &clearPipeline) != VK_SUCCESS)
+	{
+		clearPipeline = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	stages[1].module = postFragmentShader;
+	colorBlend.attachmentCount = 1;
+	pipelineInfo.pDepthStencilState = NULL;
+	pipelineInfo.pDynamicState = NULL;
+	pipelineInfo.layout = postPipelineLayout;
+	pipelineInfo.renderPass = postRenderPass;
+
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &postPipeline) != VK_SUCCESS)
+	{
+		postPipeline = VK_NULL_HANDLE;
+		return VKERROR_CREATE_ERROR;
+	}
+
+	return VKERROR_NOERR;
+}
+
+void VulkanRenderer::LoadPipelineCache()
+{
+	std::vector<u8> data;
+
+	FILE *fp = fopen(GetPipelineCachePath().c_str(), "rb");
+	if (fp != NULL)
+	{
+		fseek(fp, 0, SEEK_END);
+		const long size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		if (size > 0 && size <= VKRENDER_PIPELINE_CACHE_MAX_SIZE)
+		{
+			data.resize(size);
+			if (fread(&data[0], size, 1, fp) != 1)
+			{
+				data.clear();
+			}
+		}
+		fclose(fp);
+	}
+
+	//the driver checks the header itself, and starts out empty if the data was made by another device or driver
+	VkPipelineCacheCreateInfo cacheInfo = {VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData = data.empty() ? NULL : &data[0];
+
+	if (vkCreatePipelineCache(device, &cacheInfo, NULL, &pipelineCache) != VK_SUCCESS)
+	{
+		cacheInfo.initialDataSize = 0;
+		cacheInfo.pInitialData = NULL;
+		if (vkCreatePipelineCache(device, &cacheInfo, NULL, &pipelineCache) != VK_SUCCESS)
+		{
+			pipelineCache = VK_NULL_HANDLE;
+		}
+	}
+}
+
+void VulkanRenderer::SavePipelineCache()
+{
+	if (pipelineCache == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	size_t size = 0;
+	if (vkGetPipelineCacheData(device, pipelineCache, &size, NULL) != VK_SUCCESS || size == 0 || size > VKRENDER_PIPELINE_CACHE_MAX_SIZE)
+	{
+		return;
+	}
+
+	std::vector<u8> data(size);
+	if (vkGetPipelineCacheData(device, pipelineCache, &size, &data[0]) != VK_SUCCESS)
+	{
+		return;
+	}
+
+	FILE *fp = fopen(GetPipelineCachePath().c_str(), "wb");
+	if (fp == NULL)
+	{
+		INFO("Vulkan: Could not write the pipeline cache.\n");
+		return;
+	}
+
+	fwrite(&data[0], size, 1, fp);
+	fclose(fp);
+}
+
+VkPipeline VulkanRenderer::GetPipeline(const u32 key)
+{
+	std::map<u32, VkPipeline>::iterator it = pipelines.find(key);
+	if (it != pipelines.end())
+	{
+		return it->second;
+	}
+
+	//the specialization constants of vulkan3d.frag
+	struct
+	{
+		VkBool32 enableTexture;
+		s32 polygonMode;
+		s32 toonShadingMode;
+		VkBool32 enableAlphaTest;
+	} specData;
+
+	specData.enableTexture = (key & VulkanPipelineFlag_Texture) ? VK_TRUE : VK_FALSE;
+	specData.polygonMode = (key & VulkanPipelineFlag_PolygonModeMask) >> VulkanPipelineFlag_PolygonModeShift;
+	specData.toonShadingMode = (key & VulkanPipelineFlag_ToonHighlight) ? 1 : 0;
+	specData.enableAlphaTest = (key & VulkanPipelineFlag_AlphaTest) ? VK_TRUE : VK_FALSE;
+
+	const VkSpecializationMapEntry specEntries[4] = {
+		{0, 0, sizeof(VkBool32)},
+		{1, 4, sizeof(s32)},
+		{2, 8, sizeof(s32)},
+		{3, 12, sizeof(VkBool32)}
+	};
+
+	VkSpecializationInfo specInfo;
+	specInfo.mapEntryCount = 4;
+	specInfo.pMapEntries = specEntries;
+	specInfo.dataSize = sizeof(specData);
+	specInfo.pData = &specData;
+
+	VkPipelineShaderStageCreateInfo stages[2];
+	memset(stages, 0, sizeof(stages));
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].module = polyVertexShader;
+	stages[0].pName = "main";
+	stages[1] = stages[0];
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	stages[1].module = polyFragmentShader;
+	stages[1].pSpecializationInfo = &specInfo;
+
+	const VkVertexInputBindingDescription vertexBinding = {0, sizeof(VulkanVertex), VK_VERTEX_INPUT_RATE_VERTEX};
+	const VkVertexInputAttributeDescription vertexAttributes[3] = {
+		{0, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(VulkanVertex, coord)},
+		{1, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(VulkanVertex, texcoord)},
+		{2, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(VulkanVertex, color)}
+	};
+
+	VkPipelineVertexInputStateCreateInfo vertexInput = {VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+	vertexInput.vertexBindingDescriptionCount = 1;
+	vertexInput.pVertexBindingDescriptions = &vertexBinding;
+	vertexInput.vertexAttributeDescriptionCount = 3;
+	vertexInput.pVertexAttributeDescriptions = vertexAttributes;
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
+	inputAssembly.topology = (key & VulkanPipelineFlag_Lines) ? VK_PRIMITIVE_TOPOLOGY_LINE_LIST : VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	VkPipelineViewportStateCreateInfo viewportState = {VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	//the same as the gles renderer's culling, which is by the surfaceCullingMode. the vertex shader turns the frame
+	//upside down and back, so the polygons keep their winding
+	static const VkCullModeFlags cullModes[4] = {VK_CULL_MODE_FRONT_AND_BACK, VK_CULL_MODE_FRONT_BIT, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_NONE};
+
+	VkPipelineRasterizationStateCreateInfo rasterization = {VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+	rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterization.cullMode = cullModes[(key & VulkanPipelineFlag_CullMask) >> VulkanPipelineFlag_CullShift];
+	rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterization.lineWidth = 1.0f;
+
+	VkPipelineMultisampleStateCreateInfo multisample = {VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+	multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	const bool depthWrite = (key & VulkanPipelineFlag_DepthWrite) != 0;
+	const u32 stencilMode = (key & VulkanPipelineFlag_StencilMask) >> VulkanPipelineFlag_StencilShift;
+
+	//the stencil states of the gles renderer's SetupPolygon()
+	VkPipelineDepthStencilStateCreateInfo depthStencil = {VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = depthWrite ? VK_TRUE : VK_FALSE;
+	depthStencil.depthCompareOp = (key & VulkanPipelineFlag_DepthEqual) ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+	depthStencil.stencilTestEnable = VK_TRUE;
+	depthStencil.front.compareMask = 0xFF;
+	depthStencil.front.writeMask = 0xFF;
+	switch (stencilMode)
+	{
+		case VulkanStencilMode_Opaque:
+			depthStencil.front.compareOp = VK_COMPARE_OP_ALWAYS;
+			depthStencil.front.failOp = VK_STENCIL_OP_REPLACE;
+			depthStencil.front.passOp = VK_STENCIL_OP_REPLACE;
+			depthStencil.front.depthFailOp = VK_STENCIL_OP_REPLACE;
+			break;
+
+		case VulkanStencilMode_Translucent:
+			depthStencil.front.compareOp = VK_COMPARE_OP_NOT_EQUAL;
+			depthStencil.front.failOp = VK_STENCIL_OP_KEEP;
+			depthStencil.front.passOp = VK_STENCIL_OP_REPLACE;
+			depthStencil.front.depthFailOp = VK_STENCIL_OP_KEEP;
+			break;
+
+		case VulkanStencilMode_ShadowMask:
+			depthStencil.front.compareOp = VK_COMPARE_OP_ALWAYS;
+			depthStencil.front.failOp = VK_STENCIL_OP_KEEP;
+			depthStencil.front.passOp = VK_STENCIL_OP_KEEP;
+			depthStencil.front.depthFailOp = VK_STENCIL_OP_REPLACE;
+			break;
+
+		case VulkanStencilMode_Shadow:
+			depthStencil.front.compareOp = VK_COMPARE_OP_EQUAL;
+			depthStencil.front.failOp = VK_STENCIL_OP_KEEP;
+			depthStencil.front.passOp = VK_STENCIL_OP_KEEP;
+			depthStencil.front.depthFailOp = VK_STENCIL_OP_KEEP;
+			break;
+	}
+	depthStencil.back = depthStencil.front;
+
+	static const VkColorComponentFlags allComponents = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+	VkPipelineColorBlendAttachmentState blendAttachments[3];
+	memset(blendAttachments, 0, sizeof(blendAttachments));
+
+	if (stencilMode != VulkanStencilMode_ShadowMask)
+	{
+		//the color blends the way the gles renderer does it
+		blendAttachments[0].colorWriteMask = allComponents;
+		if (key & VulkanPipelineFlag_Blend)
+		{
+			blendAttachments[0].blendEnable = VK_TRUE;
+			blendAttachments[0].srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+			blendAttachments[0].dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+			blendAttachments[0].colorBlendOp = VK_BLEND_OP_ADD;
+			blendAttachments[0].srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+			blendAttachments[0].dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+			blendAttachments[0].alphaBlendOp = VK_BLEND_OP_MAX;
+		}
+
+		//an opaque polygon sets all of the attributes. a translucent one keeps the id the edges go by, and the
+		//rasterizer's fog flag is anded, which is a max of the "isn't fogged" flag
+		if (key & VulkanPipelineFlag_Translucent)
+		{
+			blendAttachments[1].blendEnable = VK_TRUE;
+			blendAttachments[1].srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+			blendAttachments[1].dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+			blendAttachments[1].colorBlendOp = VK_BLEND_OP_MAX;
+			blendAttachments[1].srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+			blendAttachments[1].dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+			blendAttachments[1].alphaBlendOp = VK_BLEND_OP_MAX;
+			blendAttachments[1].colorWriteMask = VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT;
+		}
+		else
+		{
+			blendAttachments[1].colorWriteMask = allComponents;
+		}
+
+		blendAttachments[2].colorWriteMask = depthWrite ? VK_COLOR_COMPONENT_R_BIT : 0;
+	}
+
+	VkPipelineColorBlendStateCreateInfo colorBlend = {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+	colorBlend.attachmentCount = 3;
+	colorBlend.pAttachments = blendAttachments;
+
+	static const VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_STENCIL_REFERENCE};
+	VkPipelineDynamicStateCreateInfo dynamicState = {VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+	dynamicState.dynamicStateCount = ARRAY_SIZE(dynamicStates);
+	dynamicState.pDynamicStates = dynamicStates;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = stages;
+	pipelineInfo.pVertexInputState = &vertexInput;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterization;
+	pipelineInfo.pMultisampleState = &multisample;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlend;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = polyPipelineLayout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = (key & VulkanPipelineFlag_Translucent) ? 1 : 0;
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS)
+	{
+		INFO("Vulkan: Could not create the pipeline 0x%04X.\n", key);
+		pipeline = VK_NULL_HANDLE;
+	}
+
+	//a pipeline that failed isn't tried again, its polygons are just left out
+	pipelines[key] = pipeline;
+
+	return pipeline;
+}
+
+bool VulkanRenderer::WaitFrame(VulkanFrame &theFrame)
+{
+	if (!theFrame.submitted)
+	{
+		return true;
+	}
+
+	VkResult result;
+	do
+	{
+		result = vkWaitForFences(device, 1, &theFrame.fence, VK_TRUE, 1000000000ULL);
+	} while (result == VK_TIMEOUT);
+
+	if (result != VK_SUCCESS)
+	{
+		INFO("Vulkan: Lost the device while waiting for a frame.\n");
+		return false;
+	}
+
+	vkResetFences(device, 1, &theFrame.fence);
+	theFrame.submitted = false;
+	if (theFrame.serial > completedSerial)
+	{
+		completedSerial = theFrame.serial;
+	}
+
+	return true;
+}
+
+void VulkanRenderer::CollectGarbage()
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < garbage.size(); i++)
+	{
+		VulkanGarbage &item = garbage[i];
+		if (item.serial > completedSerial)
+		{
+			garbage[kept++] = item;
+			continue;
+		}
+
+		if (item.texture != NULL)
+		{
+			DestroyTexture(item.texture);
+		}
+		vkDestroyBuffer(device, item.buffer, NULL);
+		vkFreeMemory(device, item.memory, NULL);
+	}
+
+	garbage.resize(kept);
+}
+
+void* VulkanRenderer::Stage(const VkDeviceSize size, VkBuffer *outBuffer, VkDeviceSize *outOffset)
+{
+	const VkDeviceSize offset = (currFrame->stagingUsed + 15) & ~(VkDeviceSize)15;
+
+	if (offset + size <= VKRENDER_STAGING_SIZE)
+	{
+		currFrame->stagingUsed = offset + size;
+		*outBuffer = currFrame->hostBuffer;
+		*outOffset = hostStagingOffset + offset;
+		return currFrame->hostMapped + hostStagingOffset + offset;
+	}
+
+	//the frame's staging space is used up, which only happens when a game loads a lot of textures at once. the
+	//buffer made for it goes away with the frame
+	VulkanGarbage item;
+	void *mapped = NULL;
+	if (CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0,
+					 &item.buffer, &item.memory, &mapped) != VKERROR_NOERR)
+	{
+		return NULL;
+	}
+
+	item.serial = frameSerial;
+	item.texture = NULL;
+	garbage.push_back(item);
+
+	*outBuffer = item.buffer;
+	*outOffset = 0;
+	return mapped;
+}
+
+void VulkanRenderer::UploadImage(VkCommandBuffer cmd, VkImage image, u32 width, u32 height, const void *pixels, const size_t size)
+{
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	void *staged = Stage(size, &buffer, &offset);
+	if (staged == NULL)
+	{
+		return;
+	}
+	memcpy(staged, pixels, size);
+
+	//the old contents are thrown away, but the frame before may still be sampling them
+	VkImageMemoryBarrier barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+	VkBufferImageCopy region;
+	memset(&region, 0, sizeof(region));
+	region.bufferOffset = offset;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.width = width;
+	region.imageExtent.height = height;
+	region.imageExtent.depth = 1;
+	vkCmdCopyBufferToImage(cmd, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+VulkanTexture* VulkanRenderer::CreateTexture(VkCommandBuffer cmd, u32 width, u32 height, const void *pixels)
+{
+	VulkanTexture *texture = new VulkanTexture;
+	memset(texture, 0, sizeof(VulkanTexture));
+
+	if (CreateImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+					&texture->image, &texture->memory, &texture->view) != VKERROR_NOERR)
+	{
+		delete texture;
+		return NULL;
+	}
+
+	//the textures' sets come from pools that are added as the cache grows. a pool a texture was freed from has
+	//room again, so the newest ones are tried first
+	VkDescriptorSetAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &textureSetLayout;
+
+	for (size_t i = texturePools.size(); i > 0 && texture->set == VK_NULL_HANDLE; i--)
+	{
+		allocInfo.descriptorPool = texturePools[i - 1];
+		if (vkAllocateDescriptorSets(device, &allocInfo, &texture->set) == VK_SUCCESS)
+		{
+			texture->pool = texturePools[i - 1];
+		}
+		else
+		{
+			texture->set = VK_NULL_HANDLE;
+		}
+	}
+
+	if (texture->set == VK_NULL_HANDLE)
+	{
+		const VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VKRENDER_TEXTURE_SETS_PER_POOL};
+
+		VkDescriptorPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+		poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+		poolInfo.maxSets = VKRENDER_TEXTURE_SETS_PER_POOL;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+
+		VkDescriptorPool pool;
+		if (vkCreateDescriptorPool(device, &poolInfo, NULL, &pool) == VK_SUCCESS)
+		{
+			texturePools.push_back(pool);
+			allocInfo.descriptorPool = pool;
+			if (vkAllocateDescriptorSets(device, &allocInfo, &texture->set) == VK_SUCCESS)
+			{
+				texture->pool = pool;
+			}
+			else
+			{
+				texture->set = VK_NULL_HANDLE;
+			}
+		}
+	}
+
+	if (texture->set == VK_NULL_HANDLE)
+	{
+		DestroyImage(texture->image, texture->memory, texture->view);
+		delete texture;
+		return NULL;
+	}
+
+	VkDescriptorImageInfo imageInfo;
+	imageInfo.sampler = VK_NULL_HANDLE;
+	imageInfo.imageView = texture->view;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet write = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+	write.dstSet = texture->set;
+	write.dstBinding = 0;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	write.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+
+	UploadImage(cmd, texture->image, width, height, pixels, width * height * sizeof(u32));
+
+	return texture;
+}
+
+void VulkanRenderer::DestroyTexture(VulkanTexture *texture)
+{
+	vkFreeDescriptorSets(device, texture->pool, 1, &texture->set);
+	DestroyImage(texture->image, texture->memory, texture->view);
+	delete texture;
+}
+
+Render3DError VulkanRenderer::DeleteTexture(const TexCacheItem *item)
+{
+	if (this->currTexture == item)
+	{
+		this->currTexture = NULL;
+	}
+
+	//the frame being recorded, or the last one submitted, may still sample it
+	VulkanTexture *texture = (VulkanTexture *)(uintptr_t)item->texid;
+	if (texture != NULL)
+	{
+		VulkanGarbage theGarbage;
+		theGarbage.serial = frameSerial;
+		theGarbage.texture = texture;
+		theGarbage.buffer = VK_NULL_HANDLE;
+		theGarbage.memory = VK_NULL_HANDLE;
+		garbage.push_back(theGarbage);
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::BeginRender(const GFX3D_State *renderState)
+{
+	frameSerial++;
+	currFrame = &frame[frameSerial % VKRENDER_FRAME_COUNT];
+
+	//this frame's command buffers and host ring were last used two frames ago, which is usually done by now
+	if (!WaitFrame(*currFrame))
+	{
+		frameSerial--;
+		return VKERROR_CREATE_ERROR;
+	}
+	CollectGarbage();
+
+	currFrame->serial = frameSerial;
+	currFrame->stagingUsed = 0;
+	currFrame->hasNewData = false;
+
+	VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(currFrame->uploadCommands, &beginInfo);
+	vkBeginCommandBuffer(currFrame->renderCommands, &beginInfo);
+	recording = true;
+
+	//the alpha test, the toon shading mode and the blending stay the same for the whole frame
+	pipelineKey &= ~(VulkanPipelineFlag_AlphaTest | VulkanPipelineFlag_ToonHighlight | VulkanPipelineFlag_Blend);
+	if (renderState->enableAlphaTest)
+	{
+		pipelineKey |= VulkanPipelineFlag_AlphaTest;
+	}
+	if (renderState->shading)
+	{
+		pipelineKey |= VulkanPipelineFlag_ToonHighlight;
+	}
+	if (renderState->enableAlphaBlending)
+	{
+		pipelineKey |= VulkanPipelineFlag_Blend;
+	}
+
+	polyState.alphaTestRef = (float)renderState->alphaTestRef / 31.0f;
+	polyStateDirty = true;
+
+	//nothing is bound in a new command buffer
+	currPipelineKey = 0xFFFFFFFF;
+	currStencilReference = 0xFFFFFFFF;
+	currSamplerIndex = 0xFFFFFFFF;
+	currTextureSet = VK_NULL_HANDLE;
+	textureSet = blankTexture->set;
+	viewportDirty = true;
+	translucentSubpass = false;
+
+	SetupPostState(renderState);
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::UpdateToonTable(const u16 *toonTableBuffer)
+{
+	static CACHE_ALIGN u16 currentToonTable16[32] = {0};
+
+	// Update the toon table if it changed.
+	if (toonTableNeedsUpdate || memcmp(currentToonTable16, toonTableBuffer, sizeof(currentToonTable16)))
+	{
+		memcpy(currentToonTable16, toonTableBuffer, sizeof(currentToonTable16));
+
+		for (int i = 0; i < 32; i++)
+		{
+			currentToonTable32[i] = RGB15TO32_NOALPHA(toonTableBuffer[i]);
+		}
+
+		UploadImage(currFrame->uploadCommands, toonImage, 32, 1, currentToonTable32, sizeof(currentToonTable32));
+		toonTableNeedsUpdate = false;
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::ClearFramebuffer(const GFX3D_State *renderState)
+{
+	//the clear is a part of beginning the render pass, or the clear image drawn at the start of it. either way
+	//the attributes are what the rasterizer clears them to
+	const u32 clearColor = renderState->clearColor;
+	clearPolyID = (clearColor >> 24) & 0x3F;
+
+	clearValues[VulkanAttachment_Color].color.float32[0] = (float)(clearColor & 0x1F) / 31.0f;
+	clearValues[VulkanAttachment_Color].color.float32[1] = (float)((clearColor >> 5) & 0x1F) / 31.0f;
+	clearValues[VulkanAttachment_Color].color.float32[2] = (float)((clearColor >> 10) & 0x1F) / 31.0f;
+	clearValues[VulkanAttachment_Color].color.float32[3] = (float)((clearColor >> 16) & 0x1F) / 31.0f;
+	clearValues[VulkanAttachment_Attributes].color.float32[0] = (float)clearPolyID / 255.0f;
+	clearValues[VulkanAttachment_Attributes].color.float32[1] = BIT15(clearColor) ? 0.0f : 1.0f;
+	clearValues[VulkanAttachment_Attributes].color.float32[2] = 0.0f;
+	clearValues[VulkanAttachment_Attributes].color.float32[3] = 1.0f;
+	clearValues[VulkanAttachment_Depth].color.float32[0] = (float)renderState->clearDepth / (float)0x00FFFFFF;
+	clearValues[VulkanAttachment_DepthStencil].depthStencil.depth = (float)renderState->clearDepth / (float)0x00FFFFFF;
+	clearValues[VulkanAttachment_DepthStencil].depthStencil.stencil = clearPolyID;
+
+	useClearImage = renderState->enableClearImage != 0;
+	if (!useClearImage)
+	{
+		return VKERROR_NOERR;
+	}
+
+	//the clear image is scrolled here, top line first like the frame, and only uploaded when it changes
+	const u16 *__restrict clearColorBuffer = (u16 *__restrict)MMU.texInfo.textureSlotAddr[2];
+	const u16 *__restrict clearDepthBuffer = (u16 *__restrict)MMU.texInfo.textureSlotAddr[3];
+	const u16 scrollBits = T1ReadWord(MMU.ARM9_REG, 0x356); //CLRIMAGE_OFFSET
+	const u8 xScroll = scrollBits & 0xFF;
+	const u8 yScroll = (scrollBits >> 8) & 0xFF;
+
+	bool changed = !clearImageValid;
+	size_t dd = 0;
+
+	for (size_t iy = 0; iy < GFX3D_FRAMEBUFFER_HEIGHT; iy++)
+	{
+		const size_t y = ((iy + yScroll) & 0xFF) << 8;
+
+		for (size_t ix = 0; ix < GFX3D_FRAMEBUFFER_WIDTH; ix++, dd++)
+		{
+			const size_t adr = y + ((ix + xScroll) & 0xFF);
+			const u32 texel = clearColorBuffer[adr] | ((u32)clearDepthBuffer[adr] << 16);
+
+			if (clearImageBuffer[dd] != texel)
+			{
+				clearImageBuffer[dd] = texel;
+				changed = true;
+			}
+		}
+	}
+
+	if (changed)
+	{
+		UploadImage(currFrame->uploadCommands, clearImage, GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, clearImageBuffer, sizeof(clearImageBuffer));
+		clearImageValid = true;
+	}
+
+	return VKERROR_NOERR;
+}
+
+void VulkanRenderer::SetupVertices(const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList)
+{
+	//the vertices are written straight into the frame's host ring, which the gpu reads from where it is
+	const int vertCount = std::min(vertList->count, VKRENDER_VERT_COUNT);
+	VulkanVertex *__restrict vertOut = (VulkanVertex *)(currFrame->hostMapped + hostVertexOffset);
+
+	for (int i = 0; i < vertCount; i++)
+	{
+		const VERT &vert = vertList->list[i];
+		VulkanVertex &out = vertOut[i];
+
+		out.coord[0] = vert.coord[0];
+		out.coord[1] = vert.coord[1];
+		out.coord[2] = vert.coord[2];
+		out.coord[3] = vert.coord[3];
+		out.texcoord[0] = vert.texcoord[0];
+		out.texcoord[1] = vert.texcoord[1];
+		out.color[0] = vert.color[0];
+		out.color[1] = vert.color[1];
+		out.color[2] = vert.color[2];
+		out.color[3] = 0;
+	}
+
+	//the triangles and quads are made into triangles as in the gles renderer. wireframe polygons and lines are
+	//made into line lists, which keeps every draw in one of two topologies: the outlines are closed, except for
+	//the polygons that came from strips and have no last edge
+	u16 *__restrict indexOut = (u16 *)(currFrame->hostMapped + hostIndexOffset);
+	const unsigned int polyCount = polyList->count;
+	u32 indexCount = 0;
+
+	polyIndexStart.resize(polyCount + 1);
+
+	for (unsigned int i = 0; i < polyCount; i++)
+	{
+		const POLY *poly = &polyList->list[indexList->list[i]];
+		const unsigned int polyType = poly->type;
+		const bool lines = poly->isWireframe() || poly->vtxFormat >= GFX3D_LINE;
+
+		polyIndexStart[i] = indexCount;
+
+		bool inRange = true;
+		for (unsigned int j = 0; j < polyType; j++)
+		{
+			if (poly->vertIndexes[j] >= vertCount)
+			{
+				inRange = false;
+			}
+		}
+
+		if (!inRange || indexCount + 8 > VKRENDER_INDEX_COUNT)
+		{
+			continue;
+		}
+
+		if (lines)
+		{
+			const bool closed = poly->isWireframe() || poly->vtxFormat < 6;
+			const unsigned int edgeCount = closed ? polyType : polyType - 1;
+
+			for (unsigned int j = 0; j < edgeCount; j++)
+			{
+				indexOut[indexCount++] = poly->vertIndexes[j];
+				indexOut[indexCount++] = poly->vertIndexes[(j + 1) % polyType];
+			}
+		}
+		else
+		{
+			for (unsigned int j = 0; j < polyType; j++)
+			{
+				const u16 vertIndex = poly->vertIndexes[j];
+
+				indexOut[indexCount++] = vertIndex;
+				if (poly->vtxFormat == GFX3D_QUADS || poly->vtxFormat == GFX3D_QUAD_STRIP)
+				{
+					if (j == 2)
+					{
+						indexOut[indexCount++] = vertIndex;
+					}
+					else if (j == 3)
+					{
+						indexOut[indexCount++] = poly->vertIndexes[0];
+					}
+				}
+			}
+		}
+	}
+
+	polyIndexStart[polyCount] = indexCount;
+}
+
+void VulkanRenderer::SetupPostState(const GFX3D_State *renderState)
+{
+	VulkanPostState *post = (VulkanPostState *)(currFrame->hostMapped + hostPostOffset);
+	u8 *regs = MMU.MMU_MEM[ARMCPU_ARM9][0x40];
+
+	for (unsigned int i = 0; i < 32; i++)
+	{
+		post->fogDensity[i] = regs[0x360 + i];
+	}
+
+	//the same colors as the rasterizer's edge marking and fog
+	for (unsigned int i = 0; i < 8; i++)
+	{
+		const u16 edgeColor = T1ReadWord(regs, 0x330 + (i << 1));
+		post->edgeColor[i][0] = GFX3D_5TO6(edgeColor & 0x1F);
+		post->edgeColor[i][1] = GFX3D_5TO6((edgeColor >> 5) & 0x1F);
+		post->edgeColor[i][2] = GFX3D_5TO6((edgeColor >> 10) & 0x1F);
+		post->edgeColor[i][3] = renderState->enableAntialiasing ? 0x0F : 0x1F;
+	}
+
+	const u32 fogColor = renderState->fogColor;
+	post->fogColor[0] = GFX3D_5TO6(fogColor & 0x1F);
+	post->fogColor[1] = GFX3D_5TO6((fogColor >> 5) & 0x1F);
+	post->fogColor[2] = GFX3D_5TO6((fogColor >> 10) & 0x1F);
+	post->fogColor[3] = (fogColor >> 16) & 0x1F;
+
+	//the fog table of the rasterizer's updateFogTable(), which the shader works out for each pixel. a shift past 10
+	//would shift by a negative amount there, so it's held at 10
+	const s32 fogShift = std::min<u32>(renderState->fogShift, 10);
+	const s32 fogOffset = std::min<u32>(renderState->fogOffset, 32768);
+	const s32 increment = (1 << 10) >> fogShift;
+	const s32 divShift = 10 - fogShift;
+
+	post->fogParams[0] = fogOffset;
+	post->fogParams[1] = increment;
+	post->fogParams[2] = divShift;
+	post->fogParams[3] = 0;
+	post->fogRange[0] = std::min<s32>(32768, ((1 + 1) << divShift) + fogOffset + 1 - increment);
+	post->fogRange[1] = std::min<s32>(32768, ((32 + 1) << divShift) + fogOffset + 1 - increment);
+	post->fogRange[2] = 0;
+	post->fogRange[3] = 0;
+
+	post->flags[0] = renderState->enableEdgeMarking ? 1 : 0;
+	post->flags[1] = renderState->enableFog ? 1 : 0;
+	post->flags[2] = renderState->enableFogAlphaOnly ? 1 : 0;
+	post->flags[3] = renderState->enableAlphaBlending ? 1 : 0;
+}
+
+Render3DError VulkanRenderer::PreRender(const GFX3D_State *renderState, const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList)
+{
+	VkCommandBuffer cmd = currFrame->renderCommands;
+
+	SetupVertices(vertList, polyList, indexList);
+
+	VkRenderPassBeginInfo passBeginInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+	passBeginInfo.renderPass = renderPass;
+	passBeginInfo.framebuffer = framebuffer;
+	passBeginInfo.renderArea.extent.width = GFX3D_FRAMEBUFFER_WIDTH;
+	passBeginInfo.renderArea.extent.height = GFX3D_FRAMEBUFFER_HEIGHT;
+	passBeginInfo.clearValueCount = 4;
+	passBeginInfo.pClearValues = clearValues;
+	vkCmdBeginRenderPass(cmd, &passBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+	if (useClearImage && clearImageValid)
+	{
+		const s32 polyID = clearPolyID;
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, clearPipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, clearPipelineLayout, 0, 1, &clearSet, 0, NULL);
+		vkCmdPushConstants(cmd, clearPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(polyID), &polyID);
+		vkCmdSetStencilReference(cmd, VK_STENCIL_FACE_FRONT_AND_BACK, clearPolyID);
+		vkCmdDraw(cmd, 3, 1, 0, 0);
+	}
+
+	const VkDeviceSize vertexOffset = hostVertexOffset;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &currFrame->hostBuffer, &vertexOffset);
+	vkCmdBindIndexBuffer(cmd, currFrame->hostBuffer, hostIndexOffset, VK_INDEX_TYPE_UINT16);
+
+	const VkRect2D scissor = {{0, 0}, {GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT}};
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	return VKERROR_NOERR;
+}
+
+void VulkanRenderer::FlushDraw(const u32 firstIndex, const u32 indexCount)
+{
+	if (indexCount == 0 || !viewportValid)
+	{
+		return;
+	}
+
+	VkCommandBuffer cmd = currFrame->renderCommands;
+	const u32 key = translucentSubpass ? (pipelineKey | VulkanPipelineFlag_Translucent) : pipelineKey;
+
+	if (key != currPipelineKey)
+	{
+		VkPipeline pipeline = GetPipeline(key);
+		if (pipeline == VK_NULL_HANDLE)
+		{
+			return;
+		}
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		currPipelineKey = key;
+	}
+
+	if (viewportDirty)
+	{
+		vkCmdSetViewport(cmd, 0, 1, &viewport);
+		viewportDirty = false;
+	}
+
+	if (stencilReference != currStencilReference)
+	{
+		vkCmdSetStencilReference(cmd, VK_STENCIL_FACE_FRONT_AND_BACK, stencilReference);
+		currStencilReference = stencilReference;
+	}
+
+	if (textureSet != currTextureSet)
+	{
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, polyPipelineLayout, 0, 1, &textureSet, 0, NULL);
+		currTextureSet = textureSet;
+	}
+
+	if (samplerIndex != currSamplerIndex)
+	{
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, polyPipelineLayout, 1, 1, &samplerSet[samplerIndex], 0, NULL);
+		currSamplerIndex = samplerIndex;
+	}
+
+	if (polyStateDirty)
+	{
+		vkCmdPushConstants(cmd, polyPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(polyState), &polyState);
+		polyStateDirty = false;
+	}
+
+	vkCmdDrawIndexed(cmd, indexCount, 1, firstIndex, 0, 0);
+}
+
+Render3DError VulkanRenderer::DoRender(const GFX3D_State *renderState, const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList)
+{
+	u32 lastTexParams = 0;
+	u32 lastTexPalette = 0;
+	u32 lastPolyAttr = 0;
+	u32 lastViewport = 0xFFFFFFFF;
+	bool lastLines = false;
+	bool first = true;
+	const unsigned int polyCount = polyList->count;
+
+	// Consecutive polygons that change none of the states below are batched
+	// up and drawn together, as in the gles renderer. Since the lines are line
+	// lists, they batch up the same as the triangles.
+	u32 drawFirst = 0;
+	u32 drawCount = 0;
+
+	for (unsigned int i = 0; i < polyCount; i++)
+	{
+		const POLY *poly = &polyList->list[indexList->list[i]];
+		const u32 indexStart = polyIndexStart[i];
+		const u32 indexCount = polyIndexStart[i + 1] - indexStart;
+
+		if (indexCount == 0)
+		{
+			continue;
+		}
+
+		// The translucent polygons come after all of the opaque ones
+		if (!translucentSubpass && poly->isTranslucent())
+		{
+			FlushDraw(drawFirst, drawCount);
+			drawCount = 0;
+
+			vkCmdNextSubpass(currFrame->renderCommands, VK_SUBPASS_CONTENTS_INLINE);
+			translucentSubpass = true;
+			currPipelineKey = 0xFFFFFFFF;
+		}
+
+		const bool lines = poly->isWireframe() || poly->vtxFormat >= GFX3D_LINE;
+		const bool polyChanged = (lastPolyAttr != poly->polyAttr || first);
+		const bool texChanged = (lastTexParams != poly->texParam || lastTexPalette != poly->texPalette || first);
+		const bool viewportChanged = (lastViewport != poly->viewport || first);
+
+		if (!polyChanged && !texChanged && !viewportChanged && lines == lastLines && drawCount > 0)
+		{
+			drawCount += indexCount;
+			continue;
+		}
+
+		// Draw the polygons so far before any state changes
+		FlushDraw(drawFirst, drawCount);
+		first = false;
+
+		if (polyChanged)
+		{
+			lastPolyAttr = poly->polyAttr;
+			SetupPolygon(poly);
+		}
+
+		if (texChanged)
+		{
+			lastTexParams = poly->texParam;
+			lastTexPalette = poly->texPalette;
+			SetupTexture(poly, renderState->enableTexturing);
+		}
+
+		if (viewportChanged)
+		{
+			lastViewport = poly->viewport;
+			SetupViewport(poly->viewport);
+		}
+
+		if (lines)
+		{
+			pipelineKey |= VulkanPipelineFlag_Lines;
+		}
+		else
+		{
+			pipelineKey &= ~VulkanPipelineFlag_Lines;
+		}
+		lastLines = lines;
+
+		drawFirst = indexStart;
+		drawCount = indexCount;
+	}
+
+	FlushDraw(drawFirst, drawCount);
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::PostRender()
+{
+	VkCommandBuffer cmd = currFrame->renderCommands;
+
+	if (!translucentSubpass)
+	{
+		vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+		translucentSubpass = true;
+	}
+	vkCmdEndRenderPass(cmd);
+
+	//the edge marking and the fog, into the output
+	VkRenderPassBeginInfo passBeginInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+	passBeginInfo.renderPass = postRenderPass;
+	passBeginInfo.framebuffer = postFramebuffer;
+	passBeginInfo.renderArea.extent.width = GFX3D_FRAMEBUFFER_WIDTH;
+	passBeginInfo.renderArea.extent.height = GFX3D_FRAMEBUFFER_HEIGHT;
+	vkCmdBeginRenderPass(cmd, &passBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, postPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, postPipelineLayout, 0, 1, &currFrame->postSet, 0, NULL);
+	vkCmdDraw(cmd, 3, 1, 0, 0);
+	vkCmdEndRenderPass(cmd);
+
+	//and the output into this frame's readback buffer, which RenderFinish() reads once the fence says it's there.
+	//the vertex shader already turned it top line first, so it needs no flipping
+	VkBufferImageCopy region;
+	memset(&region, 0, sizeof(region));
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.width = GFX3D_FRAMEBUFFER_WIDTH;
+	region.imageExtent.height = GFX3D_FRAMEBUFFER_HEIGHT;
+	region.imageExtent.depth = 1;
+	vkCmdCopyImageToBuffer(cmd, attachmentImage[VulkanAttachment_Output], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, currFrame->readbackBuffer, 1, &region);
+
+	VkBufferMemoryBarrier barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = currFrame->readbackBuffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &barrier, 0, NULL);
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::EndRender(const u64 frameCount)
+{
+	//needs to happen before the submit because it could free textures of expired cache items, which go in with
+	//this frame's garbage
+	TexCache_EvictFrame();
+
+	vkEndCommandBuffer(currFrame->uploadCommands);
+	vkEndCommandBuffer(currFrame->renderCommands);
+	recording = false;
+
+	const VkCommandBuffer commands[2] = {currFrame->uploadCommands, currFrame->renderCommands};
+	VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+	submitInfo.commandBufferCount = 2;
+	submitInfo.pCommandBuffers = commands;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, currFrame->fence) != VK_SUCCESS)
+	{
+		INFO("Vulkan: Could not submit the frame.\n");
+		return VKERROR_CREATE_ERROR;
+	}
+
+	currFrame->submitted = true;
+	currFrame->hasNewData = true;
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::SetupPolygon(const POLY *thePoly)
+{
+	const PolygonAttributes attr = thePoly->getAttributes();
+
+	polyState.polyID = attr.polygonID;
+	polyState.polyAlpha = (!attr.isWireframe && attr.isTranslucent) ? (float)attr.alpha / 31.0f : 1.0f;
+	polyState.attributes = (attr.enableRenderFog ? 0 : 1) | (attr.isTranslucent ? 2 : 0);
+	polyStateDirty = true;
+
+	pipelineKey &= ~(VulkanPipelineFlag_PolygonModeMask | VulkanPipelineFlag_StencilMask | VulkanPipelineFlag_DepthEqual |
+					 VulkanPipelineFlag_DepthWrite | VulkanPipelineFlag_CullMask);
+	pipelineKey |= attr.polygonMode << VulkanPipelineFlag_PolygonModeShift;
+	pipelineKey |= attr.surfaceCullingMode << VulkanPipelineFlag_CullShift;
+	if (attr.enableDepthTest)
+	{
+		pipelineKey |= VulkanPipelineFlag_DepthEqual;
+	}
+
+	// Handle shadow polys the same as the gles renderer: the stencil marks
+	// where the shadow volume is obstructed, then the shadow is drawn there
+	bool enableDepthWrite = true;
+	u32 stencilMode;
+
+	if (attr.polygonMode == 3)
+	{
+		stencilReference = 65;
+		if (attr.polygonID == 0)
+		{
+			stencilMode = VulkanStencilMode_ShadowMask;
+			enableDepthWrite = false;
+		}
+		else
+		{
+			stencilMode = VulkanStencilMode_Shadow;
+		}
+	}
+	else if (attr.isTranslucent)
+	{
+		stencilMode = VulkanStencilMode_Translucent;
+		stencilReference = attr.polygonID;
+	}
+	else
+	{
+		stencilMode = VulkanStencilMode_Opaque;
+		stencilReference = 64;
+	}
+
+	if (attr.isTranslucent && !attr.enableAlphaDepthWrite)
+	{
+		enableDepthWrite = false;
+	}
+
+	pipelineKey |= stencilMode << VulkanPipelineFlag_StencilShift;
+	if (enableDepthWrite)
+	{
+		pipelineKey |= VulkanPipelineFlag_DepthWrite;
+	}
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::SetupTexture(const POLY *thePoly, bool enableTexturing)
+{
+	const PolygonTexParams params = thePoly->getTexParams();
+
+	// Check if we need to use textures
+	if (thePoly->texParam == 0 || params.texFormat == TEXMODE_NONE || !enableTexturing)
+	{
+		pipelineKey &= ~VulkanPipelineFlag_Texture;
+		return VKERROR_NOERR;
+	}
+
+	pipelineKey |= VulkanPipelineFlag_Texture;
+
+	TexCacheItem *newTexture = TexCache_SetTexture(TexFormat_32bpp, thePoly->texParam, thePoly->texPalette);
+	if (newTexture != currTexture)
+	{
+		currTexture = newTexture;
+
+		//has the vulkan renderer made the texture?
+		if (!currTexture->deleteCallback)
+		{
+			currTexture->deleteCallback = texDeleteCallback;
+			currTexture->texid = (u64)(uintptr_t)CreateTexture(currFrame->uploadCommands, currTexture->sizeX, currTexture->sizeY,
+															   currTexture->views[TexFormat_32bpp].decoded);
+		}
+
+		//one that couldn't be made is drawn blank
+		const VulkanTexture *texture = (const VulkanTexture *)(uintptr_t)currTexture->texid;
+		textureSet = (texture != NULL) ? texture->set : blankTexture->set;
+
+		polyState.texScale[0] = currTexture->invSizeX;
+		polyState.texScale[1] = currTexture->invSizeY;
+		polyStateDirty = true;
+	}
+
+	// The wrap modes come from the polygon, which may not have been the one
+	// that made the texture
+	const u32 wrapS = params.enableRepeatS ? (params.enableMirroredRepeatS ? 2 : 1) : 0;
+	const u32 wrapT = params.enableRepeatT ? (params.enableMirroredRepeatT ? 2 : 1) : 0;
+	samplerIndex = wrapS * 3 + wrapT;
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::SetupViewport(const u32 viewportValue)
+{
+	VIEWPORT theViewport;
+	theViewport.decode(viewportValue);
+
+	//a viewport with nothing in it draws nothing, which vulkan doesn't allow to be set
+	viewportValid = theViewport.width > 0 && theViewport.height > 0;
+	if (!viewportValid)
+	{
+		return VKERROR_NOERR;
+	}
+
+	//the ds's viewport counts up from the bottom line, like opengl's, and this frame goes top line first
+	viewport.x = (float)theViewport.x;
+	viewport.y = (float)(GFX3D_FRAMEBUFFER_HEIGHT - (theViewport.y + theViewport.height));
+	viewport.width = (float)theViewport.width;
+	viewport.height = (float)theViewport.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	viewportDirty = true;
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::Reset()
+{
+	if (device != VK_NULL_HANDLE)
+	{
+		for (unsigned int i = 0; i < VKRENDER_FRAME_COUNT; i++)
+		{
+			WaitFrame(frame[i]);
+			frame[i].hasNewData = false;
+		}
+		CollectGarbage();
+	}
+
+	memset(currentToonTable32, 0, sizeof(currentToonTable32));
+	toonTableNeedsUpdate = true;
+	clearImageValid = false;
+
+	pipelineKey = VulkanPipelineFlag_AlphaTest;
+	currPipelineKey = 0xFFFFFFFF;
+	polyState.texScale[0] = 1.0f;
+	polyState.texScale[1] = 1.0f;
+	polyState.polyAlpha = 1.0f;
+	polyState.alphaTestRef = 0.0f;
+	polyState.polyID = 0;
+	polyState.attributes = 0;
+	polyStateDirty = true;
+	stencilReference = 64;
+	currStencilReference = 0xFFFFFFFF;
+	samplerIndex = 0;
+	currSamplerIndex = 0xFFFFFFFF;
+	viewportValid = false;
+	viewportDirty = true;
+	currTexture = NULL;
+
+	return VKERROR_NOERR;
+}
+
+Render3DError VulkanRenderer::RenderFinish()
+{
+	VulkanFrame &theFrame = *currFrame;
+
+	if (!theFrame.hasNewData)
+	{
+		return VKERROR_NOERR;
+	}
+
+	if (!WaitFrame(theFrame))
+	{
+		return VKERROR_CREATE_ERROR;
+	}
+
+	const u32 *__restrict src = theFrame.readbackMapped;
+	u32 *__restrict dst = (u32 *)gfx3d_convertedScreen;
+
+	for (unsigned int i = 0; i < GFX3D_FRAMEBUFFER_WIDTH * GFX3D_FRAMEBUFFER_HEIGHT; i++)
+	{
+		dst[i] = RGBA8888_To_RGBA6665Rev(src[i]);
+	}
+
+	theFrame.hasNewData = false;
+	CollectGarbage();
+
+	return VKERROR_NOERR;
+}
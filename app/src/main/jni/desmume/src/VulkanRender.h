@@ -0,0 +1,310 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VULKANRENDER_H
+#define VULKANRENDER_H
+
+#include <map>
+#include <vector>
+#include "render3D.h"
+#include "types.h"
+
+//the loader is opened at runtime, so that the library still loads on the systems that have no vulkan
+#define VK_NO_PROTOTYPES
+#include <vulkan/vulkan.h>
+
+//a 3d renderer on vulkan, for the devices whose gles drivers are worse than their vulkan ones. it draws what the
+//gles renderer does, and the rasterizer's edge marking and fog on top, in two render passes: one with a subpass
+//for the opaque polygons and one for the translucent ones (with the shadows, which go through the stencil), then
+//a post pass that does what SoftRasterizerEngine::framebufferProcess() does. the frame is copied into a buffer
+//that RenderFinish() converts into gfx3d_convertedScreen only once it's needed.
+//
+//the shaders are in app/src/main/shaders, which the build compiles to spir-v; see vulkanrender_loadShader
+
+//frames that can be in flight at once, each with its own command buffers, vertex ring and readback buffer
+#define VKRENDER_FRAME_COUNT			2
+#define VKRENDER_VERT_COUNT				65536
+#define VKRENDER_INDEX_COUNT			131072
+//what a frame can upload without a staging buffer of its own: new textures, the toon table and the clear image
+#define VKRENDER_STAGING_SIZE			(4 * 1024 * 1024)
+#define VKRENDER_TEXTURE_SETS_PER_POOL	1024
+
+//the render states a pipeline is made for. the shader's ones are specialization constants, the same as the
+//OGLShaderVariantFlag variants of the gles renderer
+enum VulkanPipelineFlag
+{
+	VulkanPipelineFlag_Texture				= 0x0001,
+	VulkanPipelineFlag_PolygonModeShift		= 1,
+	VulkanPipelineFlag_PolygonModeMask		= 0x0006,
+	VulkanPipelineFlag_ToonHighlight		= 0x0008,
+	VulkanPipelineFlag_AlphaTest			= 0x0010,
+	VulkanPipelineFlag_Translucent			= 0x0020, //drawn in the translucent subpass
+	VulkanPipelineFlag_StencilShift			= 6, //a VulkanStencilMode
+	VulkanPipelineFlag_StencilMask			= 0x00C0,
+	VulkanPipelineFlag_DepthEqual			= 0x0100,
+	VulkanPipelineFlag_DepthWrite			= 0x0200,
+	VulkanPipelineFlag_CullShift			= 10, //the polygon's surfaceCullingMode
+	VulkanPipelineFlag_CullMask				= 0x0C00,
+	VulkanPipelineFlag_Lines				= 0x1000,
+	VulkanPipelineFlag_Blend				= 0x2000
+};
+
+enum VulkanStencilMode
+{
+	VulkanStencilMode_Opaque = 0,
+	VulkanStencilMode_Translucent,
+	VulkanStencilMode_ShadowMask, //a shadow polygon with id 0, which marks where the shadow volume is obstructed
+	VulkanStencilMode_Shadow //a shadow polygon with another id, drawn only where that was marked
+};
+
+enum VKErrorCode
+{
+	VKERROR_NOERR = RENDER3DERROR_NOERR,
+
+	VKERROR_LOADER_UNAVAILABLE,
+	VKERROR_DEVICE_UNSUPPORTED,
+	VKERROR_SHADER_LOAD_ERROR,
+	VKERROR_CREATE_ERROR
+};
+
+//the vertex layout in the vertex ring, the same as OGLESVertex
+struct VulkanVertex
+{
+	float coord[4];
+	float texcoord[2];
+	u8 color[4];
+};
+
+//the push constants of the polygon shaders
+struct VulkanPolyState
+{
+	float texScale[2];
+	float polyAlpha;
+	float alphaTestRef;
+	s32 polyID;
+	s32 attributes; //1 if the polygon isn't fogged, 2 if it's translucent
+};
+
+//the uniform buffer of the post pass, in vulkanpost.frag's std140 layout
+struct VulkanPostState
+{
+	u32 fogDensity[32];
+	s32 edgeColor[8][4];
+	s32 fogColor[4];
+	s32 fogParams[4];
+	s32 fogRange[4];
+	s32 flags[4];
+};
+
+//a texture of the texture cache; TexCacheItem::texid points at it
+struct VulkanTexture
+{
+	VkImage image;
+	VkDeviceMemory memory;
+	VkImageView view;
+	VkDescriptorPool pool;
+	VkDescriptorSet set;
+};
+
+//what can only be destroyed once the frames that might still use it are done
+struct VulkanGarbage
+{
+	u64 serial; //the last frame that might use it
+	VulkanTexture *texture;
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+};
+
+struct VulkanFrame
+{
+	VkCommandBuffer uploadCommands; //submitted first: what this frame uploads, which can't be done in a render pass
+	VkCommandBuffer renderCommands;
+	VkFence fence;
+	u64 serial; //the frame that last used this, 0 if none has
+	bool submitted;
+
+	//the host ring: the vertices, the indices, the post pass's uniforms, then the staging space.
+	//it stays mapped for as long as the renderer runs
+	VkBuffer hostBuffer;
+	VkDeviceMemory hostMemory;
+	u8 *hostMapped;
+	VkDescriptorSet postSet;
+	VkDeviceSize stagingUsed;
+
+	VkBuffer readbackBuffer;
+	VkDeviceMemory readbackMemory;
+	const u32 *readbackMapped;
+	bool hasNewData;
+};
+
+struct GFX3D_State;
+struct VERTLIST;
+struct POLYLIST;
+struct INDEXLIST;
+struct POLY;
+class TexCacheItem;
+
+class VulkanRenderer : public Render3D
+{
+private:
+	void *loader;
+	VkInstance instance;
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	VkQueue queue;
+	u32 queueFamily;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkFormat depthStencilFormat;
+
+	VkCommandPool commandPool;
+	VulkanFrame frame[VKRENDER_FRAME_COUNT];
+	VulkanFrame *currFrame;
+	u64 frameSerial; //the frames begun so far
+	u64 completedSerial; //the frames known to be done
+	bool recording;
+	std::vector<VulkanGarbage> garbage;
+
+	//the attachments of the render pass, which all frames draw into one after the other
+	VkImage attachmentImage[5];
+	VkDeviceMemory attachmentMemory[5];
+	VkImageView attachmentView[5];
+	VkRenderPass renderPass;
+	VkRenderPass postRenderPass;
+	VkFramebuffer framebuffer;
+	VkFramebuffer postFramebuffer;
+
+	VkSampler textureSampler[9]; //by the repeat and mirror of s and t, see SetupTexture()
+	VkSampler nearestSampler;
+	VkDescriptorSetLayout textureSetLayout;
+	VkDescriptorSetLayout samplerSetLayout;
+	VkDescriptorSetLayout clearSetLayout;
+	VkDescriptorSetLayout postSetLayout;
+	VkPipelineLayout polyPipelineLayout;
+	VkPipelineLayout clearPipelineLayout;
+	VkPipelineLayout postPipelineLayout;
+	VkDescriptorPool descriptorPool;
+	std::vector<VkDescriptorPool> texturePools;
+	VkDescriptorSet samplerSet[9];
+	VkDescriptorSet clearSet;
+
+	VkShaderModule polyVertexShader;
+	VkShaderModule polyFragmentShader;
+	VkShaderModule screenVertexShader;
+	VkShaderModule clearFragmentShader;
+	VkShaderModule postFragmentShader;
+	VkPipelineCache pipelineCache;
+	std::map<u32, VkPipeline> pipelines;
+	VkPipeline clearPipeline;
+	VkPipeline postPipeline;
+
+	VulkanTexture *blankTexture; //bound for the polygons that aren't textured
+	VkImage toonImage;
+	VkDeviceMemory toonMemory;
+	VkImageView toonView;
+	VkImage clearImage;
+	VkDeviceMemory clearMemory;
+	VkImageView clearView;
+
+	//the state the draws are recorded with
+	u32 pipelineKey;
+	u32 currPipelineKey;
+	VulkanPolyState polyState;
+	bool polyStateDirty;
+	u32 stencilReference;
+	u32 currStencilReference;
+	u32 samplerIndex;
+	u32 currSamplerIndex;
+	TexCacheItem *currTexture;
+	VkDescriptorSet textureSet;
+	VkDescriptorSet currTextureSet;
+	VkViewport viewport;
+	bool viewportValid;
+	bool viewportDirty;
+	bool translucentSubpass;
+
+	//the frame's clear values, and the clear image if it has one
+	VkClearValue clearValues[4];
+	bool useClearImage;
+	u8 clearPolyID;
+	CACHE_ALIGN u32 clearImageBuffer[GFX3D_FRAMEBUFFER_WIDTH * GFX3D_FRAMEBUFFER_HEIGHT];
+	bool clearImageValid;
+
+	u32 currentToonTable32[32];
+	bool toonTableNeedsUpdate;
+
+	std::vector<u32> polyIndexStart; //where each polygon's indices start in the frame's indices, and where they stop
+
+	Render3DError InitDevice();
+	Render3DError CreateFrames();
+	Render3DError CreateAttachments();
+	Render3DError CreateRenderPasses();
+	Render3DError CreateDescriptors();
+	Render3DError CreateShaders();
+	Render3DError CreateTextures();
+	void DestroyImage(VkImage image, VkDeviceMemory memory, VkImageView view);
+
+	bool FindMemoryType(u32 typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, u32 *outType) const;
+	Render3DError CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VkBuffer *outBuffer, VkDeviceMemory *outMemory, void **outMapped);
+	Render3DError CreateImage(u32 width, u32 height, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkImage *outImage, VkDeviceMemory *outMemory, VkImageView *outView);
+	Render3DError LoadShader(const char *name, VkShaderModule *outModule);
+	VkPipeline GetPipeline(const u32 key);
+	void LoadPipelineCache();
+	void SavePipelineCache();
+
+	bool WaitFrame(VulkanFrame &theFrame);
+	void CollectGarbage();
+	void *Stage(const VkDeviceSize size, VkBuffer *outBuffer, VkDeviceSize *outOffset);
+	void UploadImage(VkCommandBuffer cmd, VkImage image, u32 width, u32 height, const void *pixels, const size_t size);
+	VulkanTexture* CreateTexture(VkCommandBuffer cmd, u32 width, u32 height, const void *pixels);
+	void DestroyTexture(VulkanTexture *texture);
+
+	void SetupVertices(const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList);
+	void SetupPostState(const GFX3D_State *renderState);
+	void FlushDraw(const u32 firstIndex, const u32 indexCount);
+
+protected:
+	virtual Render3DError BeginRender(const GFX3D_State *renderState);
+	virtual Render3DError PreRender(const GFX3D_State *renderState, const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList);
+	virtual Render3DError DoRender(const GFX3D_State *renderState, const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList);
+	virtual Render3DError PostRender();
+	virtual Render3DError EndRender(const u64 frameCount);
+
+	virtual Render3DError UpdateToonTable(const u16 *toonTableBuffer);
+	virtual Render3DError ClearFramebuffer(const GFX3D_State *renderState);
+
+	virtual Render3DError SetupPolygon(const POLY *thePoly);
+	virtual Render3DError SetupTexture(const POLY *thePoly, bool enableTexturing);
+	virtual Render3DError SetupViewport(const u32 viewportValue);
+
+public:
+	VulkanRenderer();
+	virtual ~VulkanRenderer();
+
+	Render3DError Init();
+	Render3DError DeleteTexture(const TexCacheItem *item);
+
+	virtual Render3DError Reset();
+	virtual Render3DError RenderFinish();
+};
+
+extern GPU3DInterface gpu3Dvulkan;
+
+//the platform gives the renderer the spir-v of its shaders, by the name of their source ("vulkan3d.vert").
+//returns false if there's no such shader
+extern bool (*vulkanrender_loadShader)(const char *name, std::vector<u32> *outCode);
+
+#endif
@@ -49,7 +49,7 @@ public:
 		slot1_selected_type = selection;
 		mSelectedImplementation = slot1_List[selection];
 		mSelectedImplementation->connect();
-		printf("Slot1 auto-selected device type: %s\n",mSelectedImplementation->info()->name());
+		CORELOG_INFO("Slot1 auto-selected device type: %s\n",mSelectedImplementation->info()->name());
 	}
 
 	virtual void disconnect()
@@ -73,6 +73,11 @@ public:
 		return mSelectedImplementation->read_GCDATAIN(PROCNUM);
 	}
 
+	virtual void read_GCDATAIN_block(u8 PROCNUM, u32* buf, u32 count)
+	{
+		mSelectedImplementation->read_GCDATAIN_block(PROCNUM, buf, count);
+	}
+
 	virtual u8 auxspi_transaction(int PROCNUM, u8 value)
 	{
 		return mSelectedImplementation->auxspi_transaction(PROCNUM, value);
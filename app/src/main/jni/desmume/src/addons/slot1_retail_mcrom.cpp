@@ -72,6 +72,10 @@ public:
 	{
 		return protocol.read_GCDATAIN(PROCNUM);
 	}
+	virtual void read_GCDATAIN_block(u8 PROCNUM, u32* buf, u32 count)
+	{
+		protocol.read_GCDATAIN_block(PROCNUM, buf, count);
+	}
 
 	virtual void slot1client_startOperation(eSlot1Operation operation)
 	{
@@ -102,6 +106,11 @@ private:
 	{
 		return rom.read();
 	}
+
+	void slot1client_read_GCDATAIN_block(eSlot1Operation operation, u32* buf, u32 count)
+	{
+		rom.readBlock(buf, count);
+	}
 };
 
 ISlot1Interface* construct_Slot1_Retail_MCROM() { return new Slot1_Retail_MCROM(); }
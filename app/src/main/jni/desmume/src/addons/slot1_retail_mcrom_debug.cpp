@@ -61,18 +61,38 @@ public:
 		fpROM = NULL;
 		fs = NULL;
 
-		if (!CommonSettings.loadToMemory) 
+		if (!gameInfo.romdata) 
 		{
-			printf("NitroFS: change load type to \"Load to RAM\"\n");
+			CORELOG_INFO("NitroFS: change load type to \"Load to RAM\"\n");
 			return;
 		}
 		pathData = path.getpath(path.SLOT1D) + path.GetRomNameWithoutExtension();
-		printf("Path to Slot1 data: %s\n", pathData.c_str());
+		CORELOG_INFO("Path to Slot1 data: %s\n", pathData.c_str());
 		
 		fs = new FS_NITRO(gameInfo.romdata);
 		fs->rebuildFAT(pathData);
 	}
 
+	virtual void disconnect()
+	{
+		if (fpROM)
+		{
+			fclose(fpROM);
+			fpROM = NULL;
+		}
+		if (!fs) return;
+
+		// what the game loaded from the card, for where its load times go
+		CORELOG_INFO("NitroFS: card reads by file\n");
+		for (u32 i = 0; i < fs->getNumFiles(); i++)
+		{
+			if (fs->getFileReadsById(i) == 0) continue;
+			CORELOG_INFO("%04X: %6u reads, %9u bytes %s\n", i, fs->getFileReadsById(i), fs->getFileReadBytesById(i), fs->getFullPathByFileID(i).c_str());
+		}
+		delete fs;
+		fs = NULL;
+	}
+
 	virtual u8 auxspi_transaction(int PROCNUM, u8 value)
 	{
 		return g_Slot1Comp_MC.auxspi_transaction(PROCNUM,value);
@@ -129,10 +149,11 @@ public:
 			{
 				if (fs && fs->getFileIdByAddr(protocol.address, file_id, offset)) 
 				{
+					fs->addFileRead(file_id, protocol.length);
 					if (file_id != curr_file_id)
 					{
 						string tmp = fs->getFullPathByFileID(file_id);
-						printf("%04X:[%08X, ofs %08X] %s\n", file_id, protocol.address, offset, tmp.c_str());
+						CORELOG_INFO("%04X:[%08X, ofs %08X] %s\n", file_id, protocol.address, offset, tmp.c_str());
 						
 						if (fpROM)
 						{
@@ -145,10 +166,10 @@ public:
 						if (fpROM)
 						{
 							bFromFile = true;
-							printf("\t * found at disk, offset %08X\n", offset);
+							CORELOG_INFO("\t * found at disk, offset %08X\n", offset);
 							if (fseek(fpROM, offset, SEEK_SET) != 0)
 							{
-								printf("\t\t - ERROR seek file position\n");
+								CORELOG_ERROR("\t\t - ERROR seek file position\n");
 							}
 						}
 					}
@@ -159,7 +180,7 @@ public:
 							bFromFile = true;
 							if (ftell(fpROM) != offset)
 							{
-								printf("\t * new file seek %08Xh\n", offset);
+								CORELOG_INFO("\t * new file seek %08Xh\n", offset);
 								fseek(fpROM, offset, SEEK_SET);
 							}
 						}
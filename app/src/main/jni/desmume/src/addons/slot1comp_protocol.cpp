@@ -107,7 +107,7 @@ void Slot1Comp_Protocol::write_command_KEY1(GC_Command command)
 				//todo - parse into blocknumber
 				u32 blocknumber = (cmd64>>44)&0xFFFF;
 				if(blocknumber<4||blocknumber>7)
-					printf("SLOT1 WARNING: INVALID BLOCKNUMBER FOR \"Get Secure Area Block\": 0x%04X\n",blocknumber);
+					CORELOG_WARN("SLOT1 WARNING: INVALID BLOCKNUMBER FOR \"Get Secure Area Block\": 0x%04X\n",blocknumber);
 				address = blocknumber*0x1000;
 			}
 			client->slot1client_startOperation(operation);
@@ -228,6 +228,24 @@ u32 Slot1Comp_Protocol::read_GCDATAIN(u8 PROCNUM)
 	return 0xFFFFFFFF;
 }
 
+void Slot1Comp_Protocol::read_GCDATAIN_block(u8 PROCNUM, u32* buf, u32 count)
+{
+	switch(operation)
+	{
+		default:
+			client->slot1client_read_GCDATAIN_block(operation, buf, count);
+			break;
+
+		case eSlot1Operation_9F_Dummy:
+		case eSlot1Operation_1x_ChipID:
+		case eSlot1Operation_90_ChipID:
+		case eSlot1Operation_B8_ChipID:
+			for(u32 i = 0; i < count; i++)
+				buf[i] = read_GCDATAIN(PROCNUM);
+			break;
+	}
+}
+
 void Slot1Comp_Protocol::savestate(EMUFILE* os)
 {
 	s32 version = 0;
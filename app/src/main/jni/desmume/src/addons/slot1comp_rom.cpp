@@ -17,6 +17,8 @@
 
 #include "slot1comp_rom.h"
 
+#include <algorithm>
+
 #include "../NDSSystem.h"
 #include "../emufile.h"
 
@@ -93,6 +95,40 @@ u32 Slot1Comp_Rom::read()
 	} //switch(operation)
 } //Slot1Comp_Rom::read()
 
+void Slot1Comp_Rom::readBlock(u32* buf, u32 count)
+{
+	if(operation != eSlot1Operation_B7_Read)
+	{
+		for(u32 i = 0; i < count; i++)
+			buf[i] = read();
+		return;
+	}
+
+	while(count)
+	{
+		//the same address handling as read(), see there
+		address &= gameInfo.mask;
+		if(address < 0x8000)
+			address = (0x8000 + (address & 0x1FF));
+
+		//the datastream wraps at the 4K boundary, so that is as far as a run goes
+		u32 run = std::min(count, (0x1000 - (address & 0xFFF)) >> 2);
+
+		//a word straddling the boundary or the end of the rom is left to read()
+		if(run == 0 || address + run*4 > gameInfo.romsize)
+		{
+			*buf++ = read();
+			count--;
+			continue;
+		}
+
+		gameInfo.readROMBlock(address, buf, run);
+		address = (address&~0xFFF) + ((address+run*4)&0xFFF);
+		buf += run;
+		count -= run;
+	}
+} //Slot1Comp_Rom::readBlock()
+
 u32 Slot1Comp_Rom::getAddress()
 {
 	return address & gameInfo.mask;
@@ -31,6 +31,8 @@ class Slot1Comp_Rom
 public:
 	void start(eSlot1Operation operation, u32 addr);
 	u32 read();
+	//the same as count calls to read(), but fetches the rom a whole run at a time
+	void readBlock(u32* buf, u32 count);
 	u32 getAddress();
 	u32 incAddress();
 
@@ -18,6 +18,7 @@
 #include <stdio.h>
 
 #include "../slot2.h"
+#include "../corelog.h"
 
 class Slot2_Auto : public ISlot2Interface
 {
@@ -41,7 +42,7 @@ public:
 		slot2_selected_type = slot2_DetermineType();
 		mSelectedImplementation = slot2_List[slot2_selected_type];
 		mSelectedImplementation->connect();
-		printf("Slot2 auto-selected device type: %s (0x%02X)\n", mSelectedImplementation->info()->name(), mSelectedImplementation->info()->id());
+		CORELOG_INFO("Slot2 auto-selected device type: %s (0x%02X)\n", mSelectedImplementation->info()->name(), mSelectedImplementation->info()->id());
 	}
 
 	virtual void disconnect()
@@ -19,6 +19,7 @@
 #include "../slot2.h"
 
 #include <string.h>
+#include <algorithm>
 
 #include "../debug.h"
 #include "../NDSSystem.h"
@@ -42,8 +43,11 @@ static const char *saveTypes[] = {
 class Slot2_GbaCart : public ISlot2Interface
 {
 private:
-	EMUFILE* fROM;
-	EMUFILE* fSRAM;
+	//both mapped: the reads come straight out of memory, and the sram's writes go back to its file in the background
+	EMUFILE_MMAP* fROM;
+	EMUFILE_MMAP* fSRAM;
+	const u8* rom;
+	u8* sram;
 	u32		romSize;
 	u32		sramSize;
 	u32		saveType;
@@ -58,27 +62,23 @@ private:
 		u8	bank;
 	} gbaFlash;
 
-	u32	readRom(const u32 pos, const u8 size) 
+	//past the end reads as 0xFF, as the file did
+	static FORCEINLINE u32 readMapped(const u8* mem, const u32 memSize, const u32 pos, const u8 size)
 	{
-		if (!fROM) return 0xFFFFFFFF;
-		
-		fROM->fseek(pos, SEEK_SET);
-	
 		u32 data = 0xFFFFFFFF;
-		u32 readed = fROM->fread(&data, size);
+		if (pos < memSize)
+			memcpy(&data, mem + pos, std::min<u32>(size, memSize - pos));
 		return data;
 	}
 
-	u32 readSRAM(const u32 pos, const u8 size) 
+	u32	readRom(const u32 pos, const u8 size) 
 	{
-		if (!fSRAM)
-			return 0xFFFFFFFF;
-			
-		fSRAM->fseek(pos, SEEK_SET);
+		return readMapped(rom, romSize, pos, size);
+	}
 
-		u32 data = 0xFFFFFFFF;
-		u32 readed = fSRAM->fread(&data, size);
-		return data;
+	u32 readSRAM(const u32 pos, const u8 size) 
+	{
+		return readMapped(sram, sramSize, pos, size);
 	}
 
 	void writeSRAM(const u32 pos, const u8 *data, u32 size) 
@@ -87,8 +87,6 @@ private:
 			return;
 
 		fSRAM->fseek(pos, SEEK_SET);
-
-		u32 writed = size;
 		fSRAM->fwrite(data, size);
 		fSRAM->fflush();
 	}
@@ -96,47 +94,19 @@ private:
 
 	u32 scanSaveTypeGBA()
 	{
-		if (!fROM) return 0xFF;
+		if (!rom) return 0xFF;
 
-		fROM->fseek(0, SEEK_SET);
-		int size = fROM->size();
-
-		int lastpct=1;
-
-		int len = fROM->size();
-		for(;;)
+		//a word at a time, up to (but not including) the last one
+		for (u32 pos = 0; pos + 4 < romSize; pos += 4)
 		{
-			u32 tmp;
-			u32 readed = fROM->fread(&tmp, 4);
-
-			int pos = fROM->ftell();
-			int currPct = pos*100/(size-1);
-			for(int i=lastpct;i<currPct;i++)
-			{
-				if(i%10==0)
-					printf(" %d%%\n",i/10*10);
-				else printf(".");
-				lastpct = currPct;
-			}
-
-			if (readed < 4) 
-				break;
-
-			if(pos >= len)
-				break;
-
-
-			switch (tmp)
+			switch (readRom(pos, 4))
 			{
 				case EEPROM:
 					return 1;
 				case SRAM_:
 					return 2;
 				case FLASH:
-				{
-					u32 tmp = fROM->read32le();
-					return ((tmp == FLASH1M_)?3:5);
-				}
+					return ((readRom(pos + 4, 4) == FLASH1M_)?3:5);
 				case SIIRTC_V:
 					return 4;
 			}
@@ -317,6 +287,8 @@ private:
 	{
 		delete fROM; fROM = NULL;
 		delete fSRAM; fSRAM = NULL;
+		rom = NULL;
+		sram = NULL;
 		romSize = 0;
 		sramSize = 0;
 	}
@@ -325,6 +297,8 @@ public:
 	Slot2_GbaCart()
 		: fROM(NULL)
 		, fSRAM(NULL)
+		, rom(NULL)
+		, sram(NULL)
 	{
 		Close();
 	}
@@ -357,37 +331,35 @@ public:
 			GBACartridge_SRAMPath = Path::GetFileNameWithoutExt(GBACartridge_RomPath) + "." + GBA_SRAM_FILE_EXT;
 		}
 		
-		printf("GBASlot opening ROM: %s\n", GBACartridge_RomPath.c_str());
-		EMUFILE_FILE *inf = new EMUFILE_FILE(GBACartridge_RomPath, "rb");
-		inf->EnablePositionCache();
-		fROM = inf;
-		if (fROM->fail())
+		CORELOG_INFO("GBASlot opening ROM: %s\n", GBACartridge_RomPath.c_str());
+		fROM = new EMUFILE_MMAP(GBACartridge_RomPath, EMUFILE_MMAP::RANDOM);
+		if (fROM->fail() || !fROM->buf())
 		{
-			printf(" - Failed\n");
+			CORELOG_ERROR(" - Failed\n");
 			Close();
 			
 			return;
 		}
 		
+		rom = fROM->buf();
 		romSize = fROM->size();
-		printf(" - Success (%u bytes)\n", romSize);
+		CORELOG_INFO(" - Success (%u bytes)\n", romSize);
 		
 		// Load the GBA cartridge SRAM.
-		inf = new EMUFILE_FILE(GBACartridge_SRAMPath, "rb+");
-		fSRAM = inf;
-		if(fSRAM->fail())
+		fSRAM = new EMUFILE_MMAP(GBACartridge_SRAMPath, EMUFILE_MMAP::WRITABLE);
+		if(fSRAM->fail() || !fSRAM->writableBuf())
 		{
 			delete fSRAM;
 			fSRAM = NULL;
-			printf("GBASlot did not load associated SRAM.\n");
+			CORELOG_INFO("GBASlot did not load associated SRAM.\n");
 		}
 		else
 		{
-			inf->EnablePositionCache();
+			sram = fSRAM->writableBuf();
 			sramSize = fSRAM->size();
-			printf("Scanning GBA rom to ID save type\n");
+			CORELOG_INFO("Scanning GBA rom to ID save type\n");
 			saveType = scanSaveTypeGBA();
-			printf("\nGBASlot found SRAM (%s - %u bytes) at:\n%s\n", (saveType == 0xFF)?"Unknown":saveTypes[saveType], sramSize, GBACartridge_SRAMPath.c_str());
+			CORELOG_INFO("\nGBASlot found SRAM (%s - %u bytes) at:\n%s\n", (saveType == 0xFF)?"Unknown":saveTypes[saveType], sramSize, GBACartridge_SRAMPath.c_str());
 			gbaFlash.size = sramSize;
 			if (gbaFlash.size <= (64 * 1024))
 			{
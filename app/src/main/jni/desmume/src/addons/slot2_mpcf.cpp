@@ -104,7 +104,7 @@ static BOOL cflash_init()
 
 		fileStartLBA = fileEndLBA = 0xFFFFFFFF;
 		VFAT vfat;
-		bool ret = vfat.build(sFlashPath.c_str(),16); //allocate 16MB extra for writing. this is probably enough for anyone, but maybe it should be configurable.
+		bool ret = vfat.mount(sFlashPath.c_str(),16); //allocate 16MB extra for writing. this is probably enough for anyone, but maybe it should be configurable.
 		//we could always suggest to users to add a big file to their directory to overwrite (that would cause the image to get padded)
 
 		if(!ret)
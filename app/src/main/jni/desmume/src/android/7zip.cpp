@@ -30,6 +30,9 @@ void Do7ZipRegistration();
 #include <string>
 #include <vector>
 #include <assert.h>
+#ifdef ANDROID
+#include <unistd.h>
+#endif
 
 #include "7zipstreams.h" // defines OutStream and InFileStream
 
@@ -222,6 +225,7 @@ ArchiveFile::ArchiveFile(const char* filename)
 		fseek(file, 0, SEEK_END);
 		m_items[0].size = ftell(file);
 
+		m_items[0].crc = 0;
 		m_items[0].name = new char[strlen(filename)+1];
 		strcpy(m_items[0].name, filename);
 	}
@@ -246,6 +250,9 @@ ArchiveFile::ArchiveFile(const char* filename)
 					object->GetProperty(i, kpidSize, &var);
 					item.size = var.uhVal.LowPart;
 
+					object->GetProperty(i, kpidCRC, &var);
+					item.crc = (var.vt == VT_UI4) ? var.ulVal : 0;
+
 					object->GetProperty(i, kpidPath, &var);
 					std::string path = wstrToStr(var.bstrVal);
 					item.name = new char[path.size()+1];
@@ -310,6 +317,12 @@ int ArchiveFile::GetItemSize(int item)
 	return m_items[item].size;
 }
 
+unsigned int ArchiveFile::GetItemCRC(int item)
+{
+	if(!(item >= 0 && item < m_numItems)) return 0;
+	return m_items[item].crc;
+}
+
 const char* ArchiveFile::GetItemName(int item)
 {
 	//assert(item >= 0 && item < m_numItems);
@@ -366,6 +379,11 @@ int ArchiveFile::ExtractItem(int index, unsigned char* outBuffer, int bufSize) c
 
 
 int ArchiveFile::ExtractItem(int index, const char* outFilename) const
+{
+	return ExtractItem(index, outFilename, NULL);
+}
+
+int ArchiveFile::ExtractItem(int index, const char* outFilename, ArchiveExtractProgress* progress) const
 {
 	assert(!s_formatInfos.empty());
 	//assert(index >= 0 && index < m_numItems);
@@ -398,7 +416,7 @@ int ArchiveFile::ExtractItem(int index, const char* outFilename) const
 			if(SUCCEEDED(object->Open(ifs,0,0)))
 			{
 				//gameInfo.resize(rv);
-				OutStream* os = new OutStream(index, outFilename);
+				OutStream* os = progress ? new OutStream(index, outFilename, item.size, progress) : new OutStream(index, outFilename);
 				const UInt32 indices [1] = {static_cast<UInt32>(index)};
 				hr = object->Extract(indices, 1, 0, os);
 				object->Close();
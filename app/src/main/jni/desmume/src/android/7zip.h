@@ -31,6 +31,14 @@ const char* GetSupportedFormatsFilter();
 // simplest way of extracting a file after calling InitDecoder():
 // int size = ArchiveFile(filename).ExtractItem(0, buf, sizeof(buf));
 
+// told how far ExtractItem has got writing an item out to a file, with all of that already in the file.
+// returning false stops the extraction
+struct ArchiveExtractProgress
+{
+	virtual ~ArchiveExtractProgress() {}
+	virtual bool Written(int total) = 0;
+};
+
 struct ArchiveFile
 {
 	ArchiveFile(const char* filename);
@@ -38,9 +46,11 @@ struct ArchiveFile
 
 	int GetNumItems();
 	int GetItemSize(int item);
+	unsigned int GetItemCRC(int item); // 0 if the archive doesn't say
 	const char* GetItemName(int item);
 	int ExtractItem(int item, unsigned char* outBuffer, int bufSize) const; // returns size, or 0 if failed
 	int ExtractItem(int item, const char* outFilename) const;
+	int ExtractItem(int item, const char* outFilename, ArchiveExtractProgress* progress) const; // the file gets the item's full size up front, and progress hears about the rest as it comes
 
 	bool IsCompressed();
 	const char* GetArchiveTypeName();
@@ -49,6 +59,7 @@ protected:
 	struct ArchiveItem
 	{
 		int size;
+		unsigned int crc;
 		char* name;
 	};
 	ArchiveItem* m_items;
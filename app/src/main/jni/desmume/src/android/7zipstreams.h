@@ -93,6 +93,7 @@ class SeqFileOutStream : public ICountedSequentialOutStream, private CMyUnknownI
 	FILE* file;
 	UINT32 pos;
 	ULONG refCount;
+	ArchiveExtractProgress* progress;
 
 	HRESULT STDMETHODCALLTYPE QueryInterface(REFGUID, void**)
 	{
@@ -114,6 +115,14 @@ class SeqFileOutStream : public ICountedSequentialOutStream, private CMyUnknownI
 			if (bytesWritten)
 				*bytesWritten = written;
 
+			if(progress)
+			{
+				// whoever is watching reads the file by itself, so it has to be in there
+				fflush(file);
+				if(!progress->Written(pos))
+					return E_ABORT;
+			}
+
 			return S_OK;
 		}
 		else
@@ -126,10 +135,19 @@ class SeqFileOutStream : public ICountedSequentialOutStream, private CMyUnknownI
 
 public:
 
-	SeqFileOutStream(const char* outFilename) : pos(0), refCount(0)
+	SeqFileOutStream(const char* outFilename) : pos(0), refCount(0), progress(NULL)
 	{
 		file = fopen(outFilename, "wb");
 	}
+	SeqFileOutStream(const char* outFilename, UINT32 size, ArchiveExtractProgress* progress) : pos(0), refCount(0), progress(progress)
+	{
+		file = fopen(outFilename, "wb");
+#ifdef ANDROID
+		// the file is its full size from the start, so it can be mapped while it is still being written
+		if(file)
+			ftruncate(fileno(file), size);
+#endif
+	}
 	virtual ~SeqFileOutStream()
 	{
 		if(file)
@@ -208,6 +226,11 @@ public:
 		seqStream = new SeqFileOutStream(outFilename);
 		seqStream->AddRef();
 	}
+	OutStream(UINT32 index, const char* outFilename, UINT32 size, ArchiveExtractProgress* progress) : index(index), refCount(0)
+	{
+		seqStream = new SeqFileOutStream(outFilename, size, progress);
+		seqStream->AddRef();
+	}
 	virtual ~OutStream()
 	{
 		//seqStream->Release(); // commented out because apparently IInArchive::Extract() calls Release one more time than it calls AddRef
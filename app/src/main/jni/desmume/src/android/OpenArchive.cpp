@@ -27,11 +27,18 @@
 #include <vector>
 #include <algorithm>
 #include <unistd.h>
+#ifdef ANDROID
+#include <pthread.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#endif
 #include "7zip.h"
 //#include "G_main.h"
 //#include "G_dsound.h"
 //#include "resource.h"
 #include "OpenArchive.h"
+#include "utils/task.h"
 
 static char Str_Tmp[1024];
 
@@ -444,12 +451,212 @@ void ReleaseTempFileCategory(const char* cat, const char* exceptionFilename)
 
 
 
+#ifdef ANDROID
+// a rom being extracted on a thread of its own, so the game can start on the part that is already out.
+// there is just the one, and it stays around: the game it was for may still be waiting on it when the next rom is opened
+static struct ArchiveROMStream : public ROMStream, public ArchiveExtractProgress
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running;
+	volatile bool cancel;
+	std::string archiveName;
+	std::string outName;
+	std::string cacheName;
+	int item;
+
+	ArchiveROMStream() : running(false), cancel(false), item(-1)
+	{
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+
+	void waitFor(u32 end)
+	{
+		pthread_mutex_lock(&lock);
+		while(available < end)
+			pthread_cond_wait(&cond, &lock);
+		pthread_mutex_unlock(&lock);
+	}
+
+	bool Written(int total)
+	{
+		publish(total);
+		return !cancel;
+	}
+
+	void publish(u32 total)
+	{
+		pthread_mutex_lock(&lock);
+		available = total;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+
+	static void* run(void* param)
+	{
+		ArchiveROMStream* s = (ArchiveROMStream*)param;
+		setCurrentThreadName("Archive reader");
+		ArchiveFile archive (s->archiveName.c_str());
+		if(archive.ExtractItem(s->item, s->outName.c_str(), s))
+		{
+			LOGI("Extracted %s", s->outName.c_str());
+			// the game keeps the file it opened, whatever it is called now
+			if(!s->cacheName.empty())
+				rename(s->outName.c_str(), s->cacheName.c_str());
+		}
+		else if(!s->cancel)
+			LOGI("Couldn't extract %s", s->outName.c_str());
+		// whatever didn't come out now never will, so nothing waits for it any more
+		s->publish(0xFFFFFFFF);
+		return NULL;
+	}
+
+	bool start(const char* archiveName, int item, const char* outName, const std::string& cacheName)
+	{
+		stop();
+		this->archiveName = archiveName;
+		this->outName = outName;
+		this->cacheName = cacheName;
+		this->item = item;
+		cancel = false;
+		available = 0;
+		running = pthread_create(&thread, NULL, run, this) == 0;
+		if(!running)
+			available = 0xFFFFFFFF;
+		return running;
+	}
+
+	void stop()
+	{
+		if(!running)
+			return;
+		cancel = true;
+		pthread_join(thread, NULL);
+		running = false;
+	}
+} s_romStream;
+
+static bool IsStreamableRom(const char* name)
+{
+	const char* ext = strrchr(name, '.');
+	return ext && !_stricmp(ext, ".nds");
+}
+
+// files extracted straight out of an archive are kept, so opening the same archive again doesn't extract it again.
+// a cached file is named after the archive's path and modification time and the member's crc and size, which
+// tells when an archive has changed. the ones used longest ago (by their modification time, which is bumped
+// on use) are deleted when the cache would get over its size
+static unsigned long long s_romCacheSize = 0;
+
+void SetROMCacheSize(unsigned int megabytes)
+{
+	s_romCacheSize = (unsigned long long)megabytes << 20;
+}
+
+static std::string RomCacheDir()
+{
+	char dir [1024];
+	GetTempPath(1024, dir);
+	return std::string(dir) + "romcache/";
+}
+
+static std::string RomCacheName(const char* archiveName, ArchiveFile& archive, int item)
+{
+	struct stat st;
+	if(!s_romCacheSize || (unsigned long long)archive.GetItemSize(item) > s_romCacheSize || stat(archiveName, &st))
+		return "";
+
+	// fnv-1a of the path
+	u32 hash = 2166136261u;
+	for(const char* c = archiveName; *c; c++)
+		hash = (hash ^ (u8)*c) * 16777619u;
+
+	const char* ext = strrchr(archive.GetItemName(item), '.');
+	if(!ext || strchr(ext, '/') || strchr(ext, '\\') || strlen(ext) > 8)
+		ext = "";
+
+	char name [64];
+	_snprintf(name, sizeof(name), "%08X%08X%08X%08X%s", hash, (u32)st.st_mtime, archive.GetItemCRC(item), (u32)archive.GetItemSize(item), ext);
+	return RomCacheDir() + name;
+}
+
+// true if the file is in the cache, which then counts it as just used
+static bool RomCacheUse(const std::string& cacheName, int size)
+{
+	struct stat st;
+	if(stat(cacheName.c_str(), &st) || st.st_size != size)
+		return false;
+	utime(cacheName.c_str(), NULL);
+	return true;
+}
+
+// deletes the least recently used files until there is room for one of size more. what is left of extractions
+// that didn't finish goes too, nothing is writing to the cache while this runs
+static void RomCacheMakeRoom(int size)
+{
+	const std::string dir = RomCacheDir();
+	mkdir(dir.c_str(), 0700);
+	DIR* d = opendir(dir.c_str());
+	if(!d)
+		return;
+
+	struct Entry
+	{
+		std::string path;
+		time_t used;
+		unsigned long long size;
+		bool operator<(const Entry& other) const { return used < other.used; }
+	};
+	std::vector<Entry> entries;
+	unsigned long long total = 0;
+	while(struct dirent* de = readdir(d))
+	{
+		if(de->d_name[0] == '.')
+			continue;
+		Entry e;
+		e.path = dir + de->d_name;
+		struct stat st;
+		if(stat(e.path.c_str(), &st) || !S_ISREG(st.st_mode))
+			continue;
+		const size_t len = strlen(de->d_name);
+		if(len > 5 && !strcmp(de->d_name + len - 5, ".part"))
+		{
+			_unlink(e.path.c_str());
+			continue;
+		}
+		e.used = st.st_mtime;
+		e.size = st.st_size;
+		total += e.size;
+		entries.push_back(e);
+	}
+	closedir(d);
+
+	std::sort(entries.begin(), entries.end());
+	for(size_t i = 0; i < entries.size() && total + size > s_romCacheSize; i++)
+	{
+		LOGI("Dropping cached ROM %s", entries[i].path.c_str());
+		if(_unlink(entries[i].path.c_str()) == 0)
+			total -= entries[i].size;
+	}
+}
+#endif
+
 // example input Name:          "C:\games.zip"
 // example output LogicalName:  "C:\games.zip|Sonic.nds"
 // example output PhysicalName: "C:\Documents and Settings\User\Local Settings\Temp\Desmume\dec3.tmp"
 // assumes arguments are character buffers with 1024 bytes each
-bool ObtainFile(const char* Name, char *const & LogicalName, char *const & PhysicalName, const char* category, const char** ignoreExtensions, int numIgnoreExtensions)
+bool ObtainFile(const char* Name, char *const & LogicalName, char *const & PhysicalName, const char* category, const char** ignoreExtensions, int numIgnoreExtensions, ROMStream** stream)
 {
+	if(stream)
+	{
+		*stream = NULL;
+#ifdef ANDROID
+		s_romStream.stop();
+#endif
+	}
+
 	char ArchivePaths [1024];
 	strcpy(LogicalName, Name);
 	strcpy(PhysicalName, Name);
@@ -462,6 +669,7 @@ bool ObtainFile(const char* Name, char *const & LogicalName, char *const & Physi
 		*bar++ = 0; // bar becomes the next logical archive path component
 	}
 
+	bool nested = false;
 	while(true)
 	{
 		ArchiveFile archive (PhysicalName);
@@ -501,12 +709,57 @@ bool ObtainFile(const char* Name, char *const & LogicalName, char *const & Physi
 			if(item < 0)
 				item = ChooseItemFromArchive(archive, !forceManual, ignoreExtensions, numIgnoreExtensions);
 
-			const char* TempFileName = s_tempFiles.GetFile(archive.GetItemName(item));
+			const char* TempFileName;
+			std::string cacheName, cachePart;
+#ifdef ANDROID
+			// the cache only has what came straight out of the archive that was asked for, a nested one is a temp file itself
+			if(!nested)
+				cacheName = RomCacheName(PhysicalName, archive, item);
+			if(!cacheName.empty() && RomCacheUse(cacheName, archive.GetItemSize(item)))
+			{
+				LOGI("Using cached ROM %s", cacheName.c_str());
+				strcpy(PhysicalName, cacheName.c_str());
+				nested = true;
+				continue;
+			}
+			if(!cacheName.empty())
+			{
+				RomCacheMakeRoom(archive.GetItemSize(item));
+				// extracted under another name first, so a file with the cache's name is always complete
+				cachePart = cacheName + ".part";
+				TempFileName = cachePart.c_str();
+			}
+			else
+#endif
+				TempFileName = s_tempFiles.GetFile(archive.GetItemName(item));
+#ifdef ANDROID
+			// only straight out of the archive that was asked for: the thread opens it again
+			if(stream && !nested && IsStreamableRom(archive.GetItemName(item)))
+			{
+				// a new file rather than the old one overwritten, the last game may still have the old one mapped
+				_unlink(TempFileName);
+				if(s_romStream.start(PhysicalName, item, TempFileName, cacheName))
+				{
+					LOGI("Streaming temporary ROM to %s", TempFileName);
+					*stream = &s_romStream;
+					strcpy(PhysicalName, TempFileName);
+					return true;
+				}
+			}
+#endif
 			if(!archive.ExtractItem(item, TempFileName))
-				s_tempFiles.ReleaseFile(TempFileName);
+			{
+				if(cacheName.empty())
+					s_tempFiles.ReleaseFile(TempFileName);
+				else
+					_unlink(TempFileName);
+			}
+			else if(!cacheName.empty() && rename(TempFileName, cacheName.c_str()) == 0)
+				TempFileName = cacheName.c_str();
 			LOGI("Extracting temporary ROM to %s", TempFileName);
 			s_tempFiles.ReleaseFile(PhysicalName);
 			strcpy(PhysicalName, TempFileName);
+			nested = true;
 			//_snprintf(LogicalName + strlen(LogicalName), 1024 - (strlen(LogicalName)+1), "|%s", archive.GetItemName(item));
 		}
 	}
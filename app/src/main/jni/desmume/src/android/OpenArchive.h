@@ -35,7 +35,15 @@
 // example output LogicalName:  "C:\games.zip|Sonic.nds"
 // example output PhysicalName: "C:\Documents and Settings\User\Local Settings\Temp\DeSmuME\rom7A37.smd"
 // assumes the three name arguments are unique character buffers with exactly 1024 bytes each
-bool ObtainFile(const char* Name, char *const & LogicalName, char *const & PhysicalName, const char* category=NULL, const char** ignoreExtensions=NULL, int numIgnoreExtensions=0);
+bool ObtainFile(const char* Name, char *const & LogicalName, char *const & PhysicalName, const char* category=NULL, const char** ignoreExtensions=NULL, int numIgnoreExtensions=0, ROMStream** stream=NULL);
+// if stream is given and the file is a .nds rom straight inside the archive, it doesn't wait for the extraction:
+// that goes on in the background, and *stream is set to what to give gameInfo so the rom can be used as it comes out.
+// otherwise *stream is set to NULL. either way, a rom still streaming from the last call is stopped
+
+// SetROMCacheSize()
+// how big the cache of files ObtainFile() has extracted may get, 0 to not keep them.
+// an archive opened again uses the file extracted last time, unless the archive has changed since
+void SetROMCacheSize(unsigned int megabytes);
 
 // ReleaseTempFileCategory()
 // this is for deleting the temporary files that ObtainFile() can create.
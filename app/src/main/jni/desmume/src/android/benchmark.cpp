@@ -0,0 +1,510 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//desmumebench: times the hot kernels of the core on their own, for tracking them from one commit to the next.
+//built by benchmark.mk (ndk-build DESMUME_BENCHMARK=1) and run from adb shell:
+//	desmumebench [-r runs] [-c cpu] [-w frames] [-b name] [-m movie.dsmb [-f frame]] [-l] [rom.nds [state.dst]]
+//the kernels that need a running game (2d lines, softrast, spu, savestates) run on the scene the rom (and state)
+//leaves after the warm up frames, and are left out without a rom. the others run on synthetic data.
+//with a movie, the warm up frames play it on from the keyframe of it before the given frame instead.
+//each benchmark runs once untimed, then the given number of times, and prints the median and the best time of one
+//iteration over those runs. the spread between the quartiles is printed too: over a few percent and the numbers
+//aren't worth comparing (thermal throttling, or something else running).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <android/bitmap.h>
+
+#include "../types.h"
+#include "../NDSSystem.h"
+#include "../MMU.h"
+#include "../GPU.h"
+#include "../gfx3d.h"
+#include "../render3D.h"
+#include "../texcache.h"
+#include "../matrix.h"
+#include "../SPU.h"
+#include "../saves.h"
+#include "../emufile.h"
+#include "../firmware.h"
+#include "../slot1.h"
+#include "../slot2.h"
+#include "../rtc.h"
+#include "../movie.h"
+#include "video.h"
+#include "drawbench.h"
+
+extern VideoInfo video;
+extern int rewindinterval;
+
+void doBitmapDraw(u8* pixels, u8* dest, int width, int height, int stride, int pixelFormat, int verticalOffset, bool rotate);
+void convertScreen8888(u32* dest, const u16* src, int count);
+void convertScreen565(u16* dest, const u16* src, int count);
+
+#define SCREEN_SIZE (256*384)
+
+//the rasterizer, in core3DList
+#define BENCH_3D_CORE 2
+
+struct Benchmark
+{
+	std::string name;
+	int iterations; //per timed run
+	void (*run)(int iterations, int param);
+	void (*prepare)(int param); //before each timed run, untimed. may be NULL
+	int param;
+	bool needsGame;
+};
+
+static u64 benchTicks()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static u32 benchSeed;
+
+static u32 benchRandom()
+{
+	benchSeed = benchSeed * 1103515245 + 12345;
+	return benchSeed >> 16;
+}
+
+static void fillRandom(u8* dest, int len)
+{
+	for(int i = 0 ; i < len ; ++i)
+		dest[i] = (u8)benchRandom();
+}
+
+//texture decoding. the texture slots are pointed at memory of our own, filled with noise, so every format decodes
+//the same data whatever the game has in vram
+#define BENCH_TEXTURES 8
+
+static u8* textureMem = NULL;
+static u8* paletteMem = NULL;
+
+static void benchTexture(int iterations, int param)
+{
+	const int mode = param & 7;
+	const TexCache_TexFormat format = (TexCache_TexFormat)(param >> 8);
+
+	u8* textureSlots[4];
+	u8* paletteSlots[6];
+	memcpy(textureSlots, MMU.texInfo.textureSlotAddr, sizeof(textureSlots));
+	memcpy(paletteSlots, MMU.texInfo.texPalSlot, sizeof(paletteSlots));
+	for(int i = 0 ; i < 4 ; ++i)
+		MMU.texInfo.textureSlotAddr[i] = textureMem + i * 0x20000;
+	for(int i = 0 ; i < 6 ; ++i)
+		MMU.texInfo.texPalSlot[i] = paletteMem + i * 0x4000;
+
+	//128x128, one after the other 16k apart
+	for(int i = 0 ; i < iterations ; ++i)
+	{
+		TexCache_Reset();
+		for(int t = 0 ; t < BENCH_TEXTURES ; ++t)
+			TexCache_SetTexture(format, (mode << 26) | (4 << 20) | (4 << 23) | (t * 0x800), t * 0x10);
+	}
+
+	//nothing decoded from our memory may stay in the cache
+	TexCache_Reset();
+	memcpy(MMU.texInfo.textureSlotAddr, textureSlots, sizeof(textureSlots));
+	memcpy(MMU.texInfo.texPalSlot, paletteSlots, sizeof(paletteSlots));
+}
+
+//the 2d engines compositing a whole frame of lines
+static void benchGpuLines(int iterations, int)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+		for(int l = 0 ; l < 192 ; ++l)
+		{
+			GPU_RenderLine(&MainScreen, l);
+			GPU_RenderLine(&SubScreen, l);
+		}
+}
+
+//the last frame's scene, rasterized again
+static void benchSoftRast(int iterations, int)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+	{
+		gpu3D->NDS_3D_Render();
+		gpu3D->NDS_3D_RenderFinish();
+	}
+}
+
+static CACHE_ALIGN u32 convertedScreen[SCREEN_SIZE];
+static CACHE_ALIGN u32 bitmap[SCREEN_SIZE];
+
+static void benchConvert8888(int iterations, int)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+		convertScreen8888(convertedScreen, (const u16*)GPU_screen, SCREEN_SIZE);
+}
+
+static void benchConvert565(int iterations, int)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+		convertScreen565((u16*)convertedScreen, (const u16*)GPU_screen, SCREEN_SIZE);
+}
+
+static void prepareDraw(int param)
+{
+	video.setfilter(VideoInfo::NONE);
+	if(param == ANDROID_BITMAP_FORMAT_RGBA_8888)
+		convertScreen8888(convertedScreen, (const u16*)GPU_screen, SCREEN_SIZE);
+	else
+		convertScreen565((u16*)convertedScreen, (const u16*)GPU_screen, SCREEN_SIZE);
+}
+
+//the one screen into a bitmap, as JNI(draw) does it
+static void benchDraw(int iterations, int param)
+{
+	const int bytes = param == ANDROID_BITMAP_FORMAT_RGBA_8888 ? 4 : 2;
+	for(int i = 0 ; i < iterations ; ++i)
+		doBitmapDraw((u8*)convertedScreen, (u8*)bitmap, 256, 192, 256 * bytes, param, 0, false);
+}
+
+static void benchRotate(int iterations, int param)
+{
+	const int bytes = param == ANDROID_BITMAP_FORMAT_RGBA_8888 ? 4 : 2;
+	for(int i = 0 ; i < iterations ; ++i)
+		doBitmapDraw((u8*)convertedScreen, (u8*)bitmap, 192, 256, 192 * bytes, param, 0, true);
+}
+
+static const char* const filterNames[VideoInfo::NUM_FILTERS] = {
+	"none", "lq2x", "lq2xs", "hq2x", "hq2xs", "hq4x", "hq4xs", "2xsai", "super2xsai", "supereagle", "scanline",
+	"bilinear", "nearest2x", "nearest1.5x", "nearestplus1.5x", "epx", "epxplus", "epx1.5x", "epxplus1.5x",
+	"2xbrz", "3xbrz", "4xbrz", "5xbrz",
+};
+
+static void prepareFilter(int param)
+{
+	video.setfilter(param);
+	convertScreen8888(video.buffer, (const u16*)GPU_screen, SCREEN_SIZE);
+}
+
+//both screens, on the worker pool like the frontend does it
+static void benchFilter(int iterations, int)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+		video.filter();
+}
+
+//a frame worth of mixing (a call a scanline), from the same spu state every run so that no sound runs out
+static EMUFILE_MEMORY spuState;
+
+static void prepareSpu(int)
+{
+	spuState.fseek(0, SEEK_SET);
+	spu_loadstate(&spuState, spuState.size());
+}
+
+static void benchSpu(int iterations, int)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+		for(int l = 0 ; l < 263 ; ++l)
+			SPU_Emulate_core();
+}
+
+//the transform every vertex goes through, with a rotation (in 20.12) that keeps the vectors from blowing up
+#define BENCH_VECTORS 1024
+
+static CACHE_ALIGN s32 benchMatrix[32];
+static CACHE_ALIGN s32 benchVectors[BENCH_VECTORS * 4];
+
+static void prepareMatrix(int)
+{
+	static const s32 rotation[16] = {
+		3547, 2048, 0, 0,
+		-2048, 3547, 0, 0,
+		0, 0, 4096, 0,
+		0, 0, 0, 4096,
+	};
+	memcpy(benchMatrix, rotation, sizeof(rotation));
+	memcpy(benchMatrix + 16, rotation, sizeof(rotation));
+	benchSeed = 0x9E3779B9;
+	for(int i = 0 ; i < BENCH_VECTORS * 4 ; ++i)
+		benchVectors[i] = (s32)(benchRandom() & 0xFFFF) - 0x8000;
+}
+
+static void benchMatrixMultVec4x4(int iterations, int)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+		for(int v = 0 ; v < BENCH_VECTORS ; ++v)
+			MatrixMultVec4x4(benchMatrix, benchVectors + v * 4);
+}
+
+static void benchMatrixMultVec4x4_M2(int iterations, int)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+		for(int v = 0 ; v < BENCH_VECTORS ; ++v)
+			MatrixMultVec4x4_M2(benchMatrix, benchVectors + v * 4);
+}
+
+static EMUFILE_MEMORY savestate;
+
+static void benchSavestate(int iterations, int param)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+	{
+		savestate.truncate(0);
+		savestate_save(&savestate, param);
+	}
+}
+
+//a state every call, which is what it does every rewind interval
+static void prepareRewind(int)
+{
+	rewindinterval = 1;
+}
+
+static void benchRewind(int iterations, int)
+{
+	for(int i = 0 ; i < iterations ; ++i)
+		rewindsave();
+}
+
+static void addBenchmarks(std::vector<Benchmark>& benchmarks)
+{
+	static const char* const textureModes[8] = {"none", "a3i5", "i2", "i4", "i8", "4x4", "a5i3", "16bpp"};
+	for(int format = TexFormat_32bpp ; format <= TexFormat_15bpp ; ++format)
+		for(int mode = TEXMODE_A3I5 ; mode <= TEXMODE_16BPP ; ++mode)
+		{
+			Benchmark b = {std::string("texture/") + textureModes[mode] + (format == TexFormat_32bpp ? "/32bpp" : "/15bpp"),
+				20, benchTexture, NULL, mode | (format << 8), false};
+			benchmarks.push_back(b);
+		}
+
+	Benchmark gpu = {"gpu2d/frame", 20, benchGpuLines, NULL, 0, true};
+	Benchmark softrast = {"softrast/frame", 20, benchSoftRast, NULL, 0, true};
+	benchmarks.push_back(gpu);
+	benchmarks.push_back(softrast);
+
+	Benchmark convert8888 = {"convert/rgba8888", 200, benchConvert8888, NULL, 0, false};
+	Benchmark convert565 = {"convert/rgb565", 200, benchConvert565, NULL, 0, false};
+	Benchmark draw8888 = {"draw/rgba8888", 200, benchDraw, prepareDraw, ANDROID_BITMAP_FORMAT_RGBA_8888, false};
+	Benchmark draw565 = {"draw/rgb565", 200, benchDraw, prepareDraw, ANDROID_BITMAP_FORMAT_RGB_565, false};
+	Benchmark rotate8888 = {"rotate/rgba8888", 200, benchRotate, prepareDraw, ANDROID_BITMAP_FORMAT_RGBA_8888, false};
+	Benchmark rotate565 = {"rotate/rgb565", 200, benchRotate, prepareDraw, ANDROID_BITMAP_FORMAT_RGB_565, false};
+	benchmarks.push_back(convert8888);
+	benchmarks.push_back(convert565);
+	benchmarks.push_back(draw8888);
+	benchmarks.push_back(draw565);
+	benchmarks.push_back(rotate8888);
+	benchmarks.push_back(rotate565);
+
+	for(int filter = VideoInfo::NONE + 1 ; filter < VideoInfo::NUM_FILTERS ; ++filter)
+	{
+		Benchmark b = {std::string("filter/") + filterNames[filter], 10, benchFilter, prepareFilter, filter, false};
+		benchmarks.push_back(b);
+	}
+
+	Benchmark spu = {"spu/frame", 20, benchSpu, prepareSpu, 0, true};
+	Benchmark matrix = {"matrix/MatrixMultVec4x4", 100, benchMatrixMultVec4x4, prepareMatrix, 0, false};
+	Benchmark matrixM2 = {"matrix/MatrixMultVec4x4_M2", 100, benchMatrixMultVec4x4_M2, prepareMatrix, 0, false};
+	Benchmark save = {"savestate/save", 10, benchSavestate, NULL, Z_DEFAULT_COMPRESSION, true};
+	Benchmark saveRaw = {"savestate/save_uncompressed", 10, benchSavestate, NULL, Z_NO_COMPRESSION, true};
+	Benchmark rewind = {"savestate/rewindsave", 20, benchRewind, prepareRewind, 0, true};
+	benchmarks.push_back(spu);
+	benchmarks.push_back(matrix);
+	benchmarks.push_back(matrixM2);
+	benchmarks.push_back(save);
+	benchmarks.push_back(saveRaw);
+	benchmarks.push_back(rewind);
+}
+
+static void runBenchmark(const Benchmark& b, int runs)
+{
+	std::vector<u64> times;
+	for(int r = -1 ; r < runs ; ++r)
+	{
+		if(b.prepare) b.prepare(b.param);
+		const u64 start = benchTicks();
+		b.run(b.iterations, b.param);
+		const u64 elapsed = benchTicks() - start;
+		//the first run only brings in the caches and the clocks
+		if(r >= 0) times.push_back(elapsed / b.iterations);
+	}
+
+	std::sort(times.begin(), times.end());
+	const u64 median = times[times.size() / 2];
+	const u64 spread = times[times.size() * 3 / 4] - times[times.size() / 4];
+	printf("%s,%d,%llu,%llu,%.1f\n", b.name.c_str(), b.iterations, (unsigned long long)median, (unsigned long long)times[0],
+		median ? spread * 100.0 / median : 0.0);
+	fflush(stdout);
+}
+
+static bool loadGame(const char* rom, const char* state, const char* movie, int movieFrame, int warmFrames)
+{
+	if(NDS_LoadROM(rom) < 0)
+	{
+		fprintf(stderr, "error while loading %s\n", rom);
+		return false;
+	}
+	if(movie)
+	{
+		const char* error = FCEUI_LoadMovie(movie, true, false, -1);
+		if(error)
+		{
+			fprintf(stderr, "error while loading movie %s: %s\n", movie, error);
+			return false;
+		}
+		//from the start of the movie when there is no keyframe before the frame
+		FCEUI_MovieSeek(movieFrame);
+	}
+	else if(state && !savestate_load(state))
+	{
+		fprintf(stderr, "error while loading state %s\n", state);
+		return false;
+	}
+
+	//the same frames every time. a movie has its own clock
+	rtcSetDeterministic(!movie, FCEUI_MovieGetRTCDefault(), currFrameCounter);
+	execute = true;
+	for(int i = 0 ; i < warmFrames ; ++i)
+	{
+		NDS_beginProcessingInput();
+		FCEUMOV_HandlePlayback();
+		NDS_endProcessingInput();
+		NDS_exec<false>();
+	}
+	gpu3D->NDS_3D_RenderFinish();
+	return true;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: desmumebench [-r runs] [-c cpu] [-w frames] [-b name] [-m movie.dsmb [-f frame]] [-l] [-k] [rom.nds [state.dst]]\n"
+		"  -r runs    timed runs of each benchmark (15)\n"
+		"  -c cpu     pins the benchmark (and the worker threads it starts) to a core\n"
+		"  -w frames  frames the game runs before the benchmarks (120)\n"
+		"  -b name    only the benchmarks whose name has this in it\n"
+		"  -m movie   plays the warm up frames from a movie, instead of from the state\n"
+		"  -f frame   starts them from the movie's last keyframe before this frame (0)\n"
+		"  -l         lists the benchmarks\n"
+		"  -k         checks the draw kernels against the scalar loops they replaced (results go to logcat)\n");
+}
+
+int main(int argc, char** argv)
+{
+	int runs = 15, cpu = -1, warmFrames = 120;
+	const char* only = NULL;
+	const char* movie = NULL;
+	int movieFrame = 0;
+	bool list = false;
+	bool kernels = false;
+
+	int opt;
+	while((opt = getopt(argc, argv, "r:c:w:b:m:f:lkh")) != -1)
+	{
+		switch(opt)
+		{
+			case 'r': runs = std::max(atoi(optarg), 1); break;
+			case 'c': cpu = atoi(optarg); break;
+			case 'w': warmFrames = std::max(atoi(optarg), 1); break;
+			case 'b': only = optarg; break;
+			case 'm': movie = optarg; break;
+			case 'f': movieFrame = std::max(atoi(optarg), 0); break;
+			case 'l': list = true; break;
+			case 'k': kernels = true; break;
+			default: usage(); return 1;
+		}
+	}
+	const char* rom = optind < argc ? argv[optind] : NULL;
+	const char* state = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+	std::vector<Benchmark> benchmarks;
+	addBenchmarks(benchmarks);
+	if(list)
+	{
+		for(size_t i = 0 ; i < benchmarks.size() ; ++i)
+			printf("%s%s\n", benchmarks[i].name.c_str(), benchmarks[i].needsGame ? " (needs a rom)" : "");
+		return 0;
+	}
+	if(kernels)
+	{
+		drawbench();
+		return 0;
+	}
+
+	//before any thread gets started, so that they all inherit it
+	if(cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if(sched_setaffinity(0, sizeof(set), &set) != 0)
+		{
+			fprintf(stderr, "couldn't pin to cpu %d\n", cpu);
+			return 1;
+		}
+	}
+
+	Desmume_InitOnce();
+	NDS_fw_config_data fw_config;
+	NDS_FillDefaultFirmwareConfigData(&fw_config);
+	slot1_Change(NDS_SLOT1_RETAIL_AUTO);
+	slot2_Change(NDS_SLOT2_AUTO);
+	NDS_Init();
+	NDS_3D_ChangeCore(BENCH_3D_CORE);
+	SPU_ChangeSoundCore(SNDCORE_DUMMY, 735 * 4);
+	//mixing in SPU_Emulate_core, as the benchmark of it expects
+	SPU_SetSynchMode(ESynchMode_Synchronous, 0);
+	NDS_CreateDummyFirmware(&fw_config);
+
+	const bool game = rom && loadGame(rom, state, movie, movieFrame, warmFrames);
+	if(rom && !game)
+		return 1;
+	if(game)
+		spu_savestate(&spuState);
+	else
+	{
+		//something for the conversions and the filters to work on
+		benchSeed = 0x12345678;
+		fillRandom(GPU_screen, sizeof(GPU_screen));
+	}
+
+	textureMem = new u8[4 * 0x20000];
+	paletteMem = new u8[6 * 0x4000];
+	benchSeed = 0xDEADBEEF;
+	fillRandom(textureMem, 4 * 0x20000);
+	fillRandom(paletteMem, 6 * 0x4000);
+
+	printf("# desmumebench: %d runs, cpu %d, %s\n", runs, cpu, game ? rom : "no rom");
+	printf("name,iterations,median_ns,min_ns,iqr_pct\n");
+	for(size_t i = 0 ; i < benchmarks.size() ; ++i)
+	{
+		const Benchmark& b = benchmarks[i];
+		if(only && !strstr(b.name.c_str(), only)) continue;
+		if(b.needsGame && !game) continue;
+		runBenchmark(b, runs);
+	}
+
+	delete[] textureMem;
+	delete[] paletteMem;
+	NDS_DeInit();
+	return 0;
+}
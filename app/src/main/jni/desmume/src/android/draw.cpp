@@ -1,10 +1,139 @@
 #include "main.h"
 #include "../NDSSystem.h"
 #include "video.h"
+#include "../gfx3d.h"
 #include <android/bitmap.h>
+#include <android/native_window.h>
+#ifdef ENABLE_NEON
+#include <arm_neon.h>
+#endif
 
 extern VideoInfo video;
 
+//RGB555 to the RGBA8888 and RGB565 layouts of the bitmaps, bit-exact with RGB15TO32_NOALPHA and RGB15TO16_REVERSE
+void convertScreen8888(u32* __restrict__ dest, const u16* __restrict__ src, int count)
+{
+	int i = 0;
+#ifdef ENABLE_NEON
+	const uint16x8_t mask = vdupq_n_u16(0x1F);
+	uint8x8x4_t rgba;
+	rgba.val[3] = vdup_n_u8(0xFF);
+	for(; i + 8 <= count ; i += 8)
+	{
+		const uint16x8_t color = vld1q_u16(src + i);
+		const uint16x8_t r = vandq_u16(color, mask);
+		const uint16x8_t g = vandq_u16(vshrq_n_u16(color, 5), mask);
+		const uint16x8_t b = vandq_u16(vshrq_n_u16(color, 10), mask);
+		rgba.val[0] = vmovn_u16(vorrq_u16(vshlq_n_u16(r, 3), vshrq_n_u16(r, 2)));
+		rgba.val[1] = vmovn_u16(vorrq_u16(vshlq_n_u16(g, 3), vshrq_n_u16(g, 2)));
+		rgba.val[2] = vmovn_u16(vorrq_u16(vshlq_n_u16(b, 3), vshrq_n_u16(b, 2)));
+		vst4_u8((u8*)(dest + i), rgba);
+	}
+#endif
+	for(; i < count ; ++i)
+		dest[i] = 0xFF000000 | RGB15TO32_NOALPHA(src[i]);
+}
+
+void convertScreen565(u16* __restrict__ dest, const u16* __restrict__ src, int count)
+{
+	int i = 0;
+#ifdef ENABLE_NEON
+	//green is not a plain shift in material_5bit_to_6bit, so look it up
+	uint8x8x4_t green;
+	for(int t = 0 ; t < 4 ; ++t)
+		green.val[t] = vld1_u8(material_5bit_to_6bit + t * 8);
+	const uint16x8_t mask = vdupq_n_u16(0x1F);
+	for(; i + 8 <= count ; i += 8)
+	{
+		const uint16x8_t color = vld1q_u16(src + i);
+		const uint16x8_t r = vshlq_n_u16(vandq_u16(color, mask), 11);
+		const uint16x8_t g = vmovl_u8(vtbl4_u8(green, vmovn_u16(vandq_u16(vshrq_n_u16(color, 5), mask))));
+		const uint16x8_t b = vandq_u16(vshrq_n_u16(color, 10), mask);
+		vst1q_u16(dest + i, vorrq_u16(vorrq_u16(r, vshlq_n_u16(g, 5)), b));
+	}
+#endif
+	for(; i < count ; ++i)
+		dest[i] = RGB15TO16_REVERSE(src[i]);
+}
+
+//the rotated bitmaps are the screen turned 90 degrees: dest(x,y) = src[(height - y - 1) + x * height].
+//walking that a column at a time touches a new source row for every pixel, so it is done in square
+//blocks that stay in the cache: 4x4 for 32bpp and 8x8 for 16bpp, transposed in registers with NEON.
+//OPAQUE forces the alpha of 32bpp pixels, for buffers coming out of the filters
+template<typename T, bool OPAQUE> static FORCEINLINE void rotatePixels(const T* __restrict__ src, u8* __restrict__ dest, int stride, int height, int x0, int x1, int y0, int y1)
+{
+	for(int y = y0 ; y < y1 ; ++y)
+	{
+		T* destline = (T*)(dest + y * stride);
+		const T* srccol = src + (height - y - 1);
+		for(int x = x0 ; x < x1 ; ++x)
+			destline[x] = OPAQUE ? (T)(0xFF000000 | srccol[x * height]) : srccol[x * height];
+	}
+}
+
+template<typename T> struct RotateBlock { enum { SIZE = sizeof(T) == 4 ? 4 : 8 }; };
+
+template<bool OPAQUE> static FORCEINLINE void rotateBlock(const u32* __restrict__ src, u8* __restrict__ dest, int stride, int height, int x0, int y0)
+{
+#ifdef ENABLE_NEON
+	//the block's source rows, from the leftmost column the block reads
+	const u32* row = src + (height - y0 - 4) + x0 * height;
+	const uint32x4x2_t t01 = vtrnq_u32(vld1q_u32(row), vld1q_u32(row + height));
+	const uint32x4x2_t t23 = vtrnq_u32(vld1q_u32(row + height * 2), vld1q_u32(row + height * 3));
+	uint32x4_t cols[4] = {
+		vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])),
+		vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])),
+		vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])),
+		vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])),
+	};
+	const uint32x4_t alpha = vdupq_n_u32(OPAQUE ? 0xFF000000 : 0);
+	for(int j = 0 ; j < 4 ; ++j)
+		vst1q_u32((u32*)(dest + (y0 + j) * stride) + x0, vorrq_u32(cols[3 - j], alpha));
+#else
+	rotatePixels<u32,OPAQUE>(src, dest, stride, height, x0, x0 + 4, y0, y0 + 4);
+#endif
+}
+
+template<bool OPAQUE> static FORCEINLINE void rotateBlock(const u16* __restrict__ src, u8* __restrict__ dest, int stride, int height, int x0, int y0)
+{
+#ifdef ENABLE_NEON
+	const u16* row = src + (height - y0 - 8) + x0 * height;
+	uint16x8x2_t t[4];
+	for(int i = 0 ; i < 4 ; ++i)
+		t[i] = vtrnq_u16(vld1q_u16(row + height * i * 2), vld1q_u16(row + height * (i * 2 + 1)));
+	const uint32x4x2_t u0 = vtrnq_u32(vreinterpretq_u32_u16(t[0].val[0]), vreinterpretq_u32_u16(t[1].val[0]));
+	const uint32x4x2_t u1 = vtrnq_u32(vreinterpretq_u32_u16(t[0].val[1]), vreinterpretq_u32_u16(t[1].val[1]));
+	const uint32x4x2_t u2 = vtrnq_u32(vreinterpretq_u32_u16(t[2].val[0]), vreinterpretq_u32_u16(t[3].val[0]));
+	const uint32x4x2_t u3 = vtrnq_u32(vreinterpretq_u32_u16(t[2].val[1]), vreinterpretq_u32_u16(t[3].val[1]));
+	const uint32x4_t cols[8] = {
+		vcombine_u32(vget_low_u32(u0.val[0]), vget_low_u32(u2.val[0])),
+		vcombine_u32(vget_low_u32(u1.val[0]), vget_low_u32(u3.val[0])),
+		vcombine_u32(vget_low_u32(u0.val[1]), vget_low_u32(u2.val[1])),
+		vcombine_u32(vget_low_u32(u1.val[1]), vget_low_u32(u3.val[1])),
+		vcombine_u32(vget_high_u32(u0.val[0]), vget_high_u32(u2.val[0])),
+		vcombine_u32(vget_high_u32(u1.val[0]), vget_high_u32(u3.val[0])),
+		vcombine_u32(vget_high_u32(u0.val[1]), vget_high_u32(u2.val[1])),
+		vcombine_u32(vget_high_u32(u1.val[1]), vget_high_u32(u3.val[1])),
+	};
+	for(int j = 0 ; j < 8 ; ++j)
+		vst1q_u16((u16*)(dest + (y0 + j) * stride) + x0, vreinterpretq_u16_u32(cols[7 - j]));
+#else
+	rotatePixels<u16,false>(src, dest, stride, height, x0, x0 + 8, y0, y0 + 8);
+#endif
+}
+
+template<typename T, bool OPAQUE> static void rotateScreen(const T* __restrict__ src, u8* __restrict__ dest, int width, int height, int stride)
+{
+	const int block = RotateBlock<T>::SIZE;
+	const int blockWidth = width - width % block;
+	const int blockHeight = height - height % block;
+	for(int y = 0 ; y < blockHeight ; y += block)
+		for(int x = 0 ; x < blockWidth ; x += block)
+			rotateBlock<OPAQUE>(src, dest, stride, height, x, y);
+	rotatePixels<T,OPAQUE>(src, dest, stride, height, blockWidth, width, 0, blockHeight);
+	rotatePixels<T,OPAQUE>(src, dest, stride, height, 0, width, blockHeight, height);
+}
+
 #define DOBITMAPIMPL 	if(pixelFormat == ANDROID_BITMAP_FORMAT_RGBA_8888) \
 	{ \
 		u32* src = (u32*)pixels; \
@@ -12,19 +141,7 @@ extern VideoInfo video;
 		if(video.currentfilter == VideoInfo::NONE) \
 		{ \
 			if(rotate) \
-			{ \
-				for(int y = 0 ; y < height ; ++y) \
-				{ \
-					u32* destline = (u32*)dest; \
-					u32* srccol = src + (height - y - 1); \
-					for(int x = 0 ; x < width ; ++x)  \
-					{ \
-						*destline++ = *srccol; \
-						srccol += height; \
-					} \
-					dest += stride; \
-				} \
-			} \
+				rotateScreen<u32,false>(src, dest, width, height, stride); \
 			else \
 			{ \
 				if(stride == width * sizeof(u32)) \
@@ -42,19 +159,7 @@ extern VideoInfo video;
 		else \
 		{ \
 			if(rotate) \
-			{ \
-				for(int y = 0 ; y < height ; ++y) \
-				{ \
-					u32* destline = (u32*)dest; \
-					u32* srccol = src + (height - y - 1); \
-					for(int x = 0 ; x < width ; ++x)  \
-					{ \
-						*destline++ = 0xFF000000 | *srccol; \
-						srccol += height; \
-					} \
-					dest += stride; \
-				} \
-			} \
+				rotateScreen<u32,true>(src, dest, width, height, stride); \
 			else \
 			{ \
 				for(int y = 0 ; y < height ; ++y) \
@@ -72,19 +177,7 @@ extern VideoInfo video;
 		u16* src = (u16*)pixels; \
 		src += (verticalOffset * (rotate ? height : width)); \
 		if(rotate) \
-		{ \
-			for(int y = 0 ; y < height ; ++y) \
-			{ \
-				u16* destline = (u16*)dest; \
-				u16* srccol = src + (height - y - 1); \
-				for(int x = 0 ; x < width ; ++x)  \
-				{ \
-					*destline++ = *srccol; \
-					srccol += height; \
-				} \
-				dest += stride; \
-			} \
-		} \
+			rotateScreen<u16,false>(src, dest, width, height, stride); \
 		else \
 		{ \
 			if(stride == width * sizeof(u16)) \
@@ -115,6 +208,84 @@ void doBitmapDraw(u8* pixels, u8* dest, int width, int height, int stride, int p
 {
 	if(width == 256 && height == 192)
 		doBitmapDrawTemplate<256,192>(pixels,dest,stride,pixelFormat,verticalOffset,rotate);
+	else if(width == 192 && height == 256)
+		doBitmapDrawTemplate<192,256>(pixels,dest,stride,pixelFormat,verticalOffset,rotate);
 	else
 		doBitmapDrawStandard(pixels,dest,width,height,stride,pixelFormat,verticalOffset,rotate);
+}
+
+static FORCEINLINE void windowPixel(u32& dest, u16 color) { dest = 0xFF000000 | RGB15TO32_NOALPHA(color); }
+static FORCEINLINE void windowPixel(u16& dest, u16 color) { dest = RGB15TO16_REVERSE(color); }
+
+//reads of the screen for each column of a screen's destination rect, hoisted out of the row loop
+static int windowColumns[2][4096];
+
+template<typename T> static void doWindowDrawImpl(const u16* screens, const ANativeWindow_Buffer& buffer, const int* rects, bool rotate)
+{
+	//the rotated bitmaps are 192 wide and 256 high: x walks down the screen's rows and y walks its columns backwards
+	const int srcWidth = rotate ? 192 : 256;
+	const int srcHeight = rotate ? 256 : 192;
+	int left[2], right[2], top[2], bottom[2];
+
+	for(int s = 0 ; s < 2 ; ++s)
+	{
+		const int* rect = rects + s * 4;
+		const int rectWidth = rect[2] - rect[0];
+		left[s] = std::max(rect[0], 0);
+		right[s] = std::min(std::min(rect[2], (int)buffer.width), left[s] + 4096);
+		top[s] = std::max(rect[1], 0);
+		bottom[s] = std::min(rect[3], (int)buffer.height);
+		for(int x = left[s] ; x < right[s] ; ++x)
+		{
+			const int srcX = (x - rect[0]) * srcWidth / rectWidth;
+			windowColumns[s][x - left[s]] = rotate ? srcX * 256 : srcX;
+		}
+	}
+
+	T* line = (T*)buffer.bits;
+	for(int y = 0 ; y < buffer.height ; ++y, line += buffer.stride)
+	{
+		const bool in0 = y >= top[0] && y < bottom[0] && left[0] < right[0];
+		const bool in1 = y >= top[1] && y < bottom[1] && left[1] < right[1];
+
+		//clear whatever the screens do not cover on this row
+		int covered = 0;
+		if(in0 && left[0] <= covered) covered = std::max(covered, right[0]);
+		if(in1 && left[1] <= covered) covered = std::max(covered, right[1]);
+		if(in0 && left[0] <= covered) covered = std::max(covered, right[0]);
+		if(covered < buffer.width)
+			memset(line, 0, buffer.width * sizeof(T));
+
+		for(int s = 0 ; s < 2 ; ++s)
+		{
+			if(!(s ? in1 : in0))
+				continue;
+			const int* rect = rects + s * 4;
+			const int srcY = (y - rect[1]) * srcHeight / (rect[3] - rect[1]);
+			const u16* src = screens + s * 256 * 192 + (rotate ? 255 - srcY : srcY * 256);
+			const int* columns = windowColumns[s];
+			T* dest = line + left[s];
+			for(int x = 0, count = right[s] - left[s] ; x < count ; ++x)
+				windowPixel(dest[x], src[columns[x]]);
+		}
+	}
+}
+
+//converts the 256x384 RGB555 framebuffer and scales it straight into a locked window buffer in one pass.
+//rects holds left, top, right, bottom for the main screen and then the touch screen; both are laid out
+//like the bitmaps of doBitmapDraw. returns false for window formats it can not write
+bool doWindowDraw(const u16* screens, const ANativeWindow_Buffer& buffer, const int* rects, bool rotate)
+{
+	switch(buffer.format)
+	{
+		case WINDOW_FORMAT_RGBA_8888:
+		case WINDOW_FORMAT_RGBX_8888:
+			doWindowDrawImpl<u32>(screens, buffer, rects, rotate);
+			return true;
+		case WINDOW_FORMAT_RGB_565:
+			doWindowDrawImpl<u16>(screens, buffer, rects, rotate);
+			return true;
+		default:
+			return false;
+	}
 }
\ No newline at end of file
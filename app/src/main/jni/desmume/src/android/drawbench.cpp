@@ -0,0 +1,145 @@
+/*
+	Copyright (C) 2012 Jeffrey Quesnelle
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "drawbench.h"
+#include "main.h"
+#include "../types.h"
+#include <string.h>
+#include <time.h>
+#include "video.h"
+#include "../gfx3d.h"
+#include <android/bitmap.h>
+
+extern VideoInfo video;
+
+void doBitmapDraw(u8* pixels, u8* dest, int width, int height, int stride, int pixelFormat, int verticalOffset, bool rotate);
+void convertScreen8888(u32* dest, const u16* src, int count);
+void convertScreen565(u16* dest, const u16* src, int count);
+
+#define BENCH_ROUNDS 200
+#define SCREEN_SIZE (256*384)
+
+static CACHE_ALIGN u16 screen[SCREEN_SIZE];
+static CACHE_ALIGN u32 expected[SCREEN_SIZE], actual[SCREEN_SIZE];
+
+static u64 benchTicks()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+//the scalar loops JNI(draw) and DOBITMAPIMPL had before the kernels, as the baseline
+static void referenceConvert8888(u32* dest, const u16* src, int count)
+{
+	for(int i = 0 ; i < count ; ++i)
+		dest[i] = 0xFF000000 | RGB15TO32_NOALPHA(src[i]);
+}
+
+static void referenceConvert565(u32* dest, const u16* src, int count)
+{
+	u16* dest16 = (u16*)dest;
+	for(int i = 0 ; i < count ; ++i)
+		dest16[i] = RGB15TO16_REVERSE(src[i]);
+}
+
+template<typename T> static void referenceRotate(const T* src, u8* dest, int width, int height, int stride, bool opaque)
+{
+	for(int y = 0 ; y < height ; ++y)
+	{
+		T* destline = (T*)dest;
+		const T* srccol = src + (height - y - 1);
+		for(int x = 0 ; x < width ; ++x)
+		{
+			*destline++ = opaque ? (T)(0xFF000000 | *srccol) : *srccol;
+			srccol += height;
+		}
+		dest += stride;
+	}
+}
+
+static void benchConvert(const char* name, void (*reference)(u32*, const u16*, int), void (*kernel)(u32*, const u16*, int), int bytes)
+{
+	memset(expected, 0, sizeof(expected));
+	memset(actual, 0, sizeof(actual));
+
+	u64 start = benchTicks();
+	for(int i = 0 ; i < BENCH_ROUNDS ; ++i)
+		reference(expected, screen, SCREEN_SIZE);
+	const u64 referenceTicks = benchTicks() - start;
+
+	start = benchTicks();
+	for(int i = 0 ; i < BENCH_ROUNDS ; ++i)
+		kernel(actual, screen, SCREEN_SIZE);
+	const u64 kernelTicks = benchTicks() - start;
+
+	LOGI("%s: reference %llu us, kernel %llu us per frame%s", name, referenceTicks / BENCH_ROUNDS / 1000, kernelTicks / BENCH_ROUNDS / 1000,
+		memcmp(expected, actual, SCREEN_SIZE * bytes) ? " MISMATCH" : "");
+}
+
+static void convertKernel565(u32* dest, const u16* src, int count)
+{
+	convertScreen565((u16*)dest, src, count);
+}
+
+//rotates the touch screen half of the converted screens into a bitmap, the padding of the stride must be left alone
+//and the source rows are as long as the bitmap is high, width of them per screen
+template<typename T> static void benchRotate(const char* name, int pixelFormat, int width, int height, int pad, bool opaque)
+{
+	const int stride = (width + pad) * sizeof(T);
+	const int offset = width;
+	const T* src = (const T*)expected + offset * height;
+	memset(actual, 0, sizeof(actual));
+	u8* referenceDest = (u8*)actual + SCREEN_SIZE * 2;
+
+	const int filter = video.currentfilter;
+	video.currentfilter = opaque ? VideoInfo::NEAREST2X : VideoInfo::NONE;
+
+	u64 start = benchTicks();
+	for(int i = 0 ; i < BENCH_ROUNDS ; ++i)
+		referenceRotate<T>(src, referenceDest, width, height, stride, opaque);
+	const u64 referenceTicks = benchTicks() - start;
+
+	start = benchTicks();
+	for(int i = 0 ; i < BENCH_ROUNDS ; ++i)
+		doBitmapDraw((u8*)expected, (u8*)actual, width, height, stride, pixelFormat, offset, true);
+	const u64 kernelTicks = benchTicks() - start;
+
+	video.currentfilter = filter;
+
+	LOGI("%s %ix%i: reference %llu us, kernel %llu us per screen%s", name, width, height, referenceTicks / BENCH_ROUNDS / 1000, kernelTicks / BENCH_ROUNDS / 1000,
+		memcmp(actual, referenceDest, stride * height) ? " MISMATCH" : "");
+}
+
+void drawbench()
+{
+	u32 seed = 0x12345678;
+	for(int i = 0 ; i < SCREEN_SIZE ; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		screen[i] = seed >> 16;
+	}
+
+	benchConvert("RGB555 to RGBA8888", referenceConvert8888, convertScreen8888, 4);
+	benchRotate<u32>("rotate RGBA8888", ANDROID_BITMAP_FORMAT_RGBA_8888, 192, 256, 0, false);
+	benchRotate<u32>("rotate RGBA8888 filtered", ANDROID_BITMAP_FORMAT_RGBA_8888, 192, 256, 0, true);
+	benchRotate<u32>("rotate RGBA8888 padded", ANDROID_BITMAP_FORMAT_RGBA_8888, 189, 254, 3, false);
+
+	benchConvert("RGB555 to RGB565", referenceConvert565, convertKernel565, 2);
+	benchRotate<u16>("rotate RGB565", ANDROID_BITMAP_FORMAT_RGB_565, 192, 256, 0, false);
+	benchRotate<u16>("rotate RGB565 padded", ANDROID_BITMAP_FORMAT_RGB_565, 189, 254, 3, false);
+}
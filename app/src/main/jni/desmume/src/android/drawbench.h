@@ -0,0 +1,6 @@
+#ifndef _DRAWBENCH_H
+#define _DRAWBENCH_H
+
+void drawbench();
+
+#endif
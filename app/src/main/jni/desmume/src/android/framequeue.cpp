@@ -0,0 +1,309 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "main.h"
+#include "framequeue.h"
+#include "GPU.h"
+#include "utils/task.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <android/looper.h>
+
+FrameQueue frameQueue;
+
+//a frame published longer ago than this means the emulation is paused, so nothing counts as repeated
+static const u64 RUNNING_TIMEOUT = 50000000;
+//the first period taken has to be shorter than this (a 20hz display), so that a missed vsync isn't taken for one
+static const u64 MAX_VSYNC_PERIOD = 50000000;
+
+//AChoreographer only exists from android 7.0 on and the app still runs on 5.0, so it is looked up at runtime
+typedef void (*ChoreographerFrameCallback)(long frameTimeNanos, void* data);
+typedef void* (*ChoreographerGetInstance)();
+typedef void (*ChoreographerPostFrameCallback)(void* choreographer, ChoreographerFrameCallback callback, void* data);
+
+static ChoreographerGetInstance choreographerGetInstance = NULL;
+static ChoreographerPostFrameCallback choreographerPostFrameCallback = NULL;
+
+static bool loadChoreographer()
+{
+	if(choreographerGetInstance && choreographerPostFrameCallback)
+		return true;
+	void* lib = dlopen("libandroid.so", RTLD_NOW);
+	if(!lib)
+		return false;
+	choreographerGetInstance = (ChoreographerGetInstance)dlsym(lib, "AChoreographer_getInstance");
+	choreographerPostFrameCallback = (ChoreographerPostFrameCallback)dlsym(lib, "AChoreographer_postFrameCallback");
+	return choreographerGetInstance && choreographerPostFrameCallback;
+}
+
+FrameQueue::FrameQueue()
+	: back(0)
+	, front(2)
+	, middle(1)
+	, newestSeq(0)
+	, newestTime(0)
+	, presentedSeq(0)
+	, dropped(0)
+	, repeated(0)
+	, signalledSeq(0)
+	, vsyncCount(0)
+	, newestVsync(0)
+	, presentedAtVsync(0)
+	, lastVsync(0)
+	, vsyncPeriod(0)
+	, vsyncRunning(false)
+	, vsyncLooper(NULL)
+	, pacingDraws(false)
+	, timingVsyncs(false)
+{
+	memset(slots, 0, sizeof(slots));
+	pthread_mutex_init(&waitLock, NULL);
+	pthread_cond_init(&waitCond, NULL);
+}
+
+u64 FrameQueue::now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool FrameQueue::running(u64 time) const
+{
+	const u64 newest = newestTime;
+	return newest != 0 && time - newest < RUNNING_TIMEOUT;
+}
+
+void FrameQueue::publish(const u16* screens, const GPUCompositeFrame* composite, int mainScreen,
+	const u32* native, int nativeFormat)
+{
+	Frame& frame = slots[back];
+	memcpy(frame.pixels, screens, sizeof(frame.pixels));
+	frame.nativeFormat = native ? nativeFormat : GPU_OUTPUT_RGB555;
+	if(frame.nativeFormat == GPU_OUTPUT_RGBA8888)
+		memcpy(frame.native, native, sizeof(frame.native));
+	else if(frame.nativeFormat == GPU_OUTPUT_RGB565)
+		memcpy(frame.native, native, sizeof(frame.native) / 2);
+	frame.composite = composite != NULL;
+	if(composite)
+	{
+		frame.compositeScreen = mainScreen;
+		frame.texture3D = composite->texture3D;
+		frame.fence3D = composite->fence3D;
+		memcpy(frame.compositeColors, composite->colors, sizeof(frame.compositeColors));
+		for(int l = 0; l < 192; l++)
+		{
+			if(composite->lines[l])
+				memcpy(frame.compositeAttrs + l * 256, composite->attrs + l * 256, 256 * 4);
+			else
+				memset(frame.compositeAttrs + l * 256, 0, 256 * 4);
+		}
+	}
+	frame.seq = newestSeq + 1;
+	frame.timestamp = now();
+
+	//the release half makes the pixels visible before the slot index; the acquire half hands us the slot
+	//the consumer gave up (or the unread frame we are dropping)
+	back = __atomic_exchange_n(&middle, back | SLOT_FRESH, __ATOMIC_ACQ_REL) & SLOT_MASK;
+
+	pthread_mutex_lock(&waitLock);
+	newestSeq = frame.seq;
+	newestTime = frame.timestamp;
+	newestVsync = vsyncCount;
+	pthread_cond_broadcast(&waitCond);
+	pthread_mutex_unlock(&waitLock);
+}
+
+const FrameQueue::Frame& FrameQueue::acquire()
+{
+	//only the consumer clears SLOT_FRESH, so a fresh middle stays fresh until the exchange below
+	if(__atomic_load_n(&middle, __ATOMIC_ACQUIRE) & SLOT_FRESH)
+	{
+		front = __atomic_exchange_n(&middle, front, __ATOMIC_ACQ_REL) & SLOT_MASK;
+		const u32 seq = slots[front].seq;
+		const u32 last = presentedSeq;
+		if(last != 0 && seq > last + 1)
+			__atomic_fetch_add(&dropped, seq - last - 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&presentedSeq, seq, __ATOMIC_RELEASE);
+	}
+	else if(!pacing() && running(now()))
+		__atomic_fetch_add(&repeated, 1, __ATOMIC_RELAXED);
+
+	return slots[front];
+}
+
+bool FrameQueue::waitForFrame(int timeoutMs)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (timeoutMs % 1000) * 1000000;
+	if(deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&waitLock);
+	for(;;)
+	{
+		//when paced, wait for the first vsync after the frame came in so the draw gets a whole refresh to finish
+		if(newestSeq != signalledSeq && (!pacing() || vsyncCount != newestVsync))
+		{
+			signalledSeq = newestSeq;
+			pthread_mutex_unlock(&waitLock);
+			return true;
+		}
+		if(pthread_cond_timedwait(&waitCond, &waitLock, &deadline) == ETIMEDOUT)
+		{
+			pthread_mutex_unlock(&waitLock);
+			return false;
+		}
+	}
+}
+
+void FrameQueue::resetCounters()
+{
+	__atomic_store_n(&dropped, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&repeated, 0, __ATOMIC_RELAXED);
+}
+
+void FrameQueue::onVsync(long frameTimeNanos, void* data)
+{
+	FrameQueue* queue = (FrameQueue*)data;
+	//the time is a long, which is 32 bits on the 32 bit abis and so wraps every few seconds there.
+	//when the callback runs is a little later than the vsync, but close enough for those
+	const u64 time = sizeof(frameTimeNanos) >= 8 ? (u64)frameTimeNanos : now();
+
+	pthread_mutex_lock(&queue->waitLock);
+	queue->vsyncCount++;
+	const u32 presented = __atomic_load_n(&queue->presentedSeq, __ATOMIC_ACQUIRE);
+	if(queue->pacingDraws && presented == queue->presentedAtVsync && queue->running(now()))
+		__atomic_fetch_add(&queue->repeated, 1, __ATOMIC_RELAXED);
+	queue->presentedAtVsync = presented;
+
+	//a vsync the thread was too late for shows up as a gap of a few periods, which still says what the period is
+	if(queue->lastVsync != 0 && time > queue->lastVsync)
+	{
+		const u64 delta = time - queue->lastVsync;
+		const u64 period = queue->vsyncPeriod;
+		if(period == 0)
+		{
+			if(delta < MAX_VSYNC_PERIOD)
+				queue->vsyncPeriod = delta;
+		}
+		else
+		{
+			const u64 n = (delta + period/2) / period;
+			if(n >= 1 && n <= 4 && (s64)(delta - n*period) < (s64)(period/4) && (s64)(n*period - delta) < (s64)(period/4))
+				queue->vsyncPeriod = period + ((s64)(delta/n - period) >> 4);
+		}
+	}
+	queue->lastVsync = time;
+	pthread_cond_broadcast(&queue->waitCond);
+	pthread_mutex_unlock(&queue->waitLock);
+
+	if(queue->vsyncRunning)
+		choreographerPostFrameCallback(choreographerGetInstance(), &onVsync, queue);
+}
+
+void* FrameQueue::vsyncMain(void* arg)
+{
+	FrameQueue* queue = (FrameQueue*)arg;
+	setCurrentThreadName("Vsync");
+
+	//the choreographer delivers its callbacks through the looper of the thread that asked for it
+	ALooper* looper = ALooper_prepare(ALOOPER_PREPARE_ALLOW_NON_CALLBACKS);
+	ALooper_acquire(looper);
+	pthread_mutex_lock(&queue->waitLock);
+	queue->vsyncLooper = looper;
+	pthread_cond_broadcast(&queue->waitCond);
+	pthread_mutex_unlock(&queue->waitLock);
+
+	choreographerPostFrameCallback(choreographerGetInstance(), &onVsync, queue);
+	while(queue->vsyncRunning)
+		ALooper_pollOnce(-1, NULL, NULL, NULL);
+
+	ALooper_release(looper);
+	return NULL;
+}
+
+bool FrameQueue::vsyncTiming(u64& last, u64& period)
+{
+	if(!vsyncRunning)
+		return false;
+	pthread_mutex_lock(&waitLock);
+	last = lastVsync;
+	period = vsyncPeriod;
+	pthread_mutex_unlock(&waitLock);
+	return period != 0;
+}
+
+void FrameQueue::setPacing(bool enable)
+{
+	pacingDraws = enable;
+	updateVsyncThread();
+}
+
+void FrameQueue::setVsyncTiming(bool enable)
+{
+	timingVsyncs = enable;
+	updateVsyncThread();
+}
+
+void FrameQueue::updateVsyncThread()
+{
+	const bool enable = pacingDraws || timingVsyncs;
+	if(enable == vsyncRunning)
+		return;
+
+	if(enable)
+	{
+		if(!loadChoreographer())
+		{
+			LOGW("AChoreographer is not available, frames will not be paced to vsync");
+			return;
+		}
+		vsyncLooper = NULL;
+		lastVsync = 0;
+		vsyncPeriod = 0;
+		vsyncRunning = true;
+		if(pthread_create(&vsyncThread, NULL, &vsyncMain, this) != 0)
+		{
+			vsyncRunning = false;
+			return;
+		}
+		pthread_mutex_lock(&waitLock);
+		while(!vsyncLooper)
+			pthread_cond_wait(&waitCond, &waitLock);
+		pthread_mutex_unlock(&waitLock);
+	}
+	else
+	{
+		vsyncRunning = false;
+		ALooper_wake((ALooper*)vsyncLooper);
+		pthread_join(vsyncThread, NULL);
+		vsyncLooper = NULL;
+
+		//whoever waits for a vsync should not sit out its timeout
+		pthread_mutex_lock(&waitLock);
+		pthread_cond_broadcast(&waitCond);
+		pthread_mutex_unlock(&waitLock);
+	}
+}
@@ -0,0 +1,127 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FRAMEQUEUE_H
+#define _FRAMEQUEUE_H
+
+#include "../types.h"
+#include "../GPU.h"
+#include <pthread.h>
+
+//hands finished frames from the emulation thread (the only producer) to the draw thread (the only consumer).
+//three slots are rotated through one atomic index, so neither side ever waits for the other to copy or read
+//a frame; a frame the consumer never picks up is overwritten and counted as dropped.
+//optionally the draw thread is paced to the display's vsync through AChoreographer, which also gives the times
+//of the vsyncs to whatever paces the emulation to the display.
+class FrameQueue
+{
+public:
+
+	enum {
+		FRAME_PIXELS = 256*192*2,
+	};
+
+	struct Frame
+	{
+		u16 pixels[FRAME_PIXELS];
+		//the same in the display's format when the core made one (GPU_SetOutputFormat), GPU_OUTPUT_RGB555 if not
+		int nativeFormat;
+		u32 native[FRAME_PIXELS];
+		u32 seq;		//1 for the first frame published, 0 for a slot that was never written
+		u64 timestamp;	//CLOCK_MONOTONIC nanoseconds of the publish
+
+		//the main screen's 3d, when it was left for the draw to mix in (see GPUCompositeFrame)
+		bool composite;
+		u8 compositeScreen;	//which of the two screens in pixels is the main one
+		u32 texture3D;
+		void* fence3D;
+		u32 compositeColors[256*192];
+		u32 compositeAttrs[256*192];	//cleared on the lines that have nothing to mix in
+	};
+
+	FrameQueue();
+
+	//emulation thread: copies a frame into the back slot and makes it the newest one. composite is the main
+	//screen's 3d still to be mixed in, if there is any, and mainScreen which of the screens that is
+	//screens. native is GPU_screenNative, in nativeFormat
+	void publish(const u16* screens, const GPUCompositeFrame* composite = NULL, int mainScreen = 0,
+		const u32* native = NULL, int nativeFormat = GPU_OUTPUT_RGB555);
+
+	//draw thread: takes the newest frame if there is one. the returned frame stays untouched until the next acquire
+	const Frame& acquire();
+
+	//frame pump: blocks until there is a frame that was not signalled yet (and, when pacing, until the next vsync
+	//after it). returns false on timeout
+	bool waitForFrame(int timeoutMs);
+
+	//paces the draws to vsync. falls back to unpaced when AChoreographer is not available (before android 7.0)
+	void setPacing(bool enable);
+	bool pacing() const { return pacingDraws && vsyncRunning; }
+
+	//keeps the vsync thread running for vsyncTiming even when the draws are not paced
+	void setVsyncTiming(bool enable);
+	//CLOCK_MONOTONIC nanoseconds of the newest vsync and the display's refresh period, once it has seen enough of them
+	bool vsyncTiming(u64& last, u64& period);
+
+	//frames published that were never presented, and vsyncs (or, unpaced, draws) that had nothing new to show
+	//while the emulation was running
+	u32 droppedFrames() const { return __atomic_load_n(&dropped, __ATOMIC_RELAXED); }
+	u32 repeatedFrames() const { return __atomic_load_n(&repeated, __ATOMIC_RELAXED); }
+	void resetCounters();
+
+	static u64 now();
+
+private:
+
+	enum {
+		SLOT_MASK = 3,
+		SLOT_FRESH = 4,	//set in middle while it holds a frame the consumer has not taken
+	};
+
+	Frame slots[3];
+	u32 back;			//owned by the producer
+	u32 front;			//owned by the consumer
+	volatile u32 middle;
+
+	volatile u32 newestSeq;
+	volatile u64 newestTime;
+	volatile u32 presentedSeq;
+	volatile u32 dropped, repeated;
+
+	pthread_mutex_t waitLock;
+	pthread_cond_t waitCond;
+	u32 signalledSeq;
+	u32 vsyncCount;
+	u32 newestVsync;	//vsyncCount when the newest frame came in
+	u32 presentedAtVsync;
+	u64 lastVsync;
+	u64 vsyncPeriod;	//averaged over the vsyncs, 0 until there were two close enough together
+
+	pthread_t vsyncThread;
+	volatile bool vsyncRunning;
+	void* vsyncLooper;
+	bool pacingDraws, timingVsyncs;
+
+	bool running(u64 time) const;
+	void updateVsyncThread();
+	static void* vsyncMain(void* arg);
+	static void onVsync(long frameTimeNanos, void* data);
+};
+
+extern FrameQueue frameQueue;
+
+#endif
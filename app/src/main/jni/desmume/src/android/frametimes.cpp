@@ -0,0 +1,79 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "frametimes.h"
+#include <string.h>
+#include <algorithm>
+
+FrameTimes::FrameTimes()
+	: frames(0)
+	, overBudget(0)
+	, worst(0)
+	, resetRequested(false)
+	, lastMark(0)
+{
+	memset(buckets, 0, sizeof(buckets));
+}
+
+void FrameTimes::add(u64 ns)
+{
+	if(__atomic_load_n(&resetRequested, __ATOMIC_ACQUIRE))
+	{
+		memset(buckets, 0, sizeof(buckets));
+		__atomic_store_n(&frames, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&overBudget, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&worst, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&resetRequested, false, __ATOMIC_RELEASE);
+	}
+
+	const u32 us = (u32)std::min<u64>(ns / 1000, 0xFFFFFFFF);
+	__atomic_fetch_add(&buckets[std::min<u32>(us / BUCKET_US, BUCKETS - 1)], 1, __ATOMIC_RELAXED);
+	if(us > BUDGET_US)
+		__atomic_store_n(&overBudget, overBudget + 1, __ATOMIC_RELAXED);
+	if(us > worst)
+		__atomic_store_n(&worst, us, __ATOMIC_RELAXED);
+	__atomic_store_n(&frames, frames + 1, __ATOMIC_RELEASE);
+}
+
+void FrameTimes::mark(u64 now)
+{
+	const u64 last = lastMark;
+	lastMark = now;
+	if(last && now - last < 1000000000ull)
+		add(now - last);
+}
+
+void FrameTimes::get(Stats& stats) const
+{
+	static const u32 kPercentiles[3] = {50, 95, 99};
+	u32* const out[3] = {&stats.p50, &stats.p95, &stats.p99};
+
+	stats.frames = __atomic_load_n(&frames, __ATOMIC_ACQUIRE);
+	stats.overBudget = __atomic_load_n(&overBudget, __ATOMIC_RELAXED);
+	stats.worst = __atomic_load_n(&worst, __ATOMIC_RELAXED);
+
+	//the upper end of the bucket the percentile falls in, so that a p99 of 17ms does mean over budget
+	u32 seen = 0;
+	int b = 0;
+	for(int p = 0; p < 3; p++)
+	{
+		const u32 wanted = (u32)(((u64)stats.frames * kPercentiles[p] + 99) / 100);
+		while(b < BUCKETS - 1 && seen + __atomic_load_n(&buckets[b], __ATOMIC_RELAXED) < wanted)
+			seen += __atomic_load_n(&buckets[b++], __ATOMIC_RELAXED);
+		*out[p] = stats.frames ? std::min<u32>((b + 1) * BUCKET_US, stats.worst) : 0;
+	}
+}
@@ -0,0 +1,64 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FRAMETIMES_H
+#define _FRAMETIMES_H
+
+#include "../types.h"
+
+//a histogram of how long each frame took, for the single slow frames a frames per second count averages away.
+//one thread (the only writer) adds the times, and any thread can read the statistics or ask for it to be reset.
+class FrameTimes
+{
+public:
+	enum {
+		BUCKET_US = 100,	//the resolution of the percentiles
+		BUCKETS = 1000,		//up to 100ms; anything longer goes in the last one
+	};
+
+	//what a 59.8261 fps frame gets
+	static const u32 BUDGET_US = 16715;
+
+	struct Stats
+	{
+		u32 p50, p95, p99, worst;	//microseconds
+		u32 overBudget;
+		u32 frames;
+	};
+
+	FrameTimes();
+
+	//writer
+	void add(u64 ns);
+	//adds the time since the last mark. a gap of over a second is the emulation having been paused, and is left out
+	void mark(u64 now);
+
+	//any thread. the counts may be a frame apart from each other while the writer is adding one
+	void get(Stats& stats) const;
+	//the writer starts over the next time it adds something
+	void reset() { __atomic_store_n(&resetRequested, true, __ATOMIC_RELEASE); }
+
+private:
+	u32 buckets[BUCKETS];
+	volatile u32 frames;
+	volatile u32 overBudget;
+	volatile u32 worst;
+	volatile bool resetRequested;
+	u64 lastMark;
+};
+
+#endif
@@ -0,0 +1,981 @@
+/*
+	Copyright (C) 2012 Jeffrey Quesnelle
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//presents the screens through GLES2 on the view's surface, running the screen filter as a fragment shader
+//on the native resolution screens instead of on the CPU. the filters that have no shader use the bitmaps.
+//the surface's context shares the 3d renderer's, so that a frame whose 3d was left on the gpu (GPUCompositeFrame)
+//gets it mixed in here, from the renderer's texture, before the filter. while recording, the screens are drawn
+//into the video encoder's surface too, from the same textures.
+//where the device has AHardwareBuffer and can bind one through an EGLImage, the screens' textures are such buffers:
+//the screens are converted to 565 straight into them and nothing is uploaded. a ring of them keeps the cpu from
+//writing into one the gpu may still be reading
+
+#include "main.h"
+#include "../types.h"
+#include <string.h>
+#include "video.h"
+#include "framequeue.h"
+#include "recorder.h"
+#include "GPU.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <android/native_window.h>
+#include <android/hardware_buffer.h>
+#include <dlfcn.h>
+
+void convertScreen565(u16* dest, const u16* src, int count);
+
+//the 3d renderer's context, in main.cpp
+extern EGLContext context;
+extern EGLint contextClientVersion;
+
+//glWaitSync is GLES3's, so it is looked up, and only there when the renderer's context is GLES3 too
+typedef void (*GLDrawWaitSync)(void* sync, GLbitfield flags, unsigned long long timeout);
+static const unsigned long long GLDRAW_TIMEOUT_IGNORED = 0xFFFFFFFFFFFFFFFFull;
+
+extern int scanline_filter_a, scanline_filter_b, scanline_filter_c, scanline_filter_d;
+
+//AHardwareBuffer only exists from android 8.0 on and the app still runs on 5.0, so it is looked up at runtime
+typedef int (*HardwareBufferAllocate)(const AHardwareBuffer_Desc* desc, AHardwareBuffer** outBuffer);
+typedef void (*HardwareBufferRelease)(AHardwareBuffer* buffer);
+typedef void (*HardwareBufferDescribe)(const AHardwareBuffer* buffer, AHardwareBuffer_Desc* outDesc);
+typedef int (*HardwareBufferLock)(AHardwareBuffer* buffer, uint64_t usage, int32_t fence, const ARect* rect, void** outVirtualAddress);
+typedef int (*HardwareBufferUnlock)(AHardwareBuffer* buffer, int32_t* fence);
+
+static struct GLDrawHardwareBufferFuncs
+{
+	HardwareBufferAllocate allocate;
+	HardwareBufferRelease release;
+	HardwareBufferDescribe describe;
+	HardwareBufferLock lock;
+	HardwareBufferUnlock unlock;
+	PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC getNativeClientBuffer;
+	PFNEGLCREATEIMAGEKHRPROC createImage;
+	PFNEGLDESTROYIMAGEKHRPROC destroyImage;
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC imageTargetTexture;
+	PFNEGLCREATESYNCKHRPROC createSync;
+	PFNEGLCLIENTWAITSYNCKHRPROC clientWaitSync;
+	PFNEGLDESTROYSYNCKHRPROC destroySync;
+} hwb;
+
+//the sets of screen textures the frames go round. two, so the cpu fills one while the gpu draws from the other
+static const int GLDRAW_HWB_RING = 2;
+static const u64 GLDRAW_HWB_USAGE = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN | AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE;
+
+enum GLDrawShader
+{
+	GLDRAW_NEAREST,
+	GLDRAW_BILINEAR,
+	GLDRAW_SCANLINE,
+	GLDRAW_EPX,
+	GLDRAW_HQX,
+	GLDRAW_XBR,
+
+	GLDRAW_NUM_SHADERS,
+	GLDRAW_UNSUPPORTED = -1
+};
+
+static int glDrawShaderFor(int filter)
+{
+	switch(filter)
+	{
+		case VideoInfo::NONE:
+		case VideoInfo::NEAREST2X:
+		case VideoInfo::NEAREST1_5X:
+		case VideoInfo::NEARESTPLUS1_5X:
+			return GLDRAW_NEAREST;
+		case VideoInfo::BILINEAR:
+			return GLDRAW_BILINEAR;
+		case VideoInfo::SCANLINE:
+			return GLDRAW_SCANLINE;
+		case VideoInfo::EPX:
+		case VideoInfo::EPXPLUS:
+		case VideoInfo::EPX1_5X:
+		case VideoInfo::EPXPLUS1_5X:
+			return GLDRAW_EPX;
+		case VideoInfo::LQ2X:
+		case VideoInfo::LQ2XS:
+		case VideoInfo::HQ2X:
+		case VideoInfo::HQ2XS:
+		case VideoInfo::HQ4X:
+		case VideoInfo::HQ4XS:
+			return GLDRAW_HQX;
+		case VideoInfo::_2XBRZ:
+		case VideoInfo::_3XBRZ:
+		case VideoInfo::_4XBRZ:
+		case VideoInfo::_5XBRZ:
+			return GLDRAW_XBR;
+		default:
+			//2xSaI, Super 2xSaI and Super Eagle
+			return GLDRAW_UNSUPPORTED;
+	}
+}
+
+static const char* vertexShader =
+	"attribute vec2 position;\n"
+	"attribute vec2 texPosition;\n"
+	"varying vec2 texCoord;\n"
+	"void main()\n"
+	"{\n"
+	"	gl_Position = vec4(position, 0.0, 1.0);\n"
+	"	texCoord = texPosition;\n"
+	"}\n";
+
+//px() reads the texel whose centre is at p, in texels
+static const char* fragmentHeader =
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+	"precision highp float;\n"
+	"#else\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"uniform sampler2D tex;\n"
+	"uniform vec2 texSize;\n"
+	"uniform vec4 scanline;\n"
+	"varying vec2 texCoord;\n"
+	"vec3 px(vec2 p) { return texture2D(tex, p / texSize).rgb; }\n"
+	"const vec3 lumaY = vec3(0.299, 0.587, 0.114);\n"
+	"const vec3 chromaU = vec3(-0.169, -0.331, 0.5);\n"
+	"const vec3 chromaV = vec3(0.5, -0.419, -0.081);\n";
+
+//mixes the main screen's 3d in the way GPU::_master_setFinal3dColor and the layers drawn over it would have.
+//the bytes of colors and attrs are those of GPUCompositeFrame; the 3d is bottom row first, in 8 bits per channel
+//where the 2d engine would have 6 (and 5 of alpha)
+static const char* compositeShader =
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+	"precision highp float;\n"
+	"#else\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"uniform sampler2D screen;\n"
+	"uniform sampler2D colors;\n"
+	"uniform sampler2D attrs;\n"
+	"uniform sampler2D image3D;\n"
+	"varying vec2 texCoord;\n"
+	"vec4 bytes(vec4 t) { return floor(t * 255.0 + 0.5); }\n"
+	"vec3 rgb555(vec2 b) { return vec3(mod(b.x, 32.0), floor(b.x / 32.0) + mod(b.y, 4.0) * 8.0, mod(floor(b.y / 4.0), 32.0)); }\n"
+	"bool flag(float flags, float f) { return mod(floor(flags / f), 2.0) == 1.0; }\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 attr = bytes(texture2D(attrs, texCoord));\n"
+	"	vec4 image = bytes(texture2D(image3D, vec2(texCoord.x, 1.0 - texCoord.y)));\n"
+	"	float kind = mod(attr.x, 4.0);\n"
+	"	float alpha = floor(image.a / 8.0);\n"
+	"	if(kind == 0.0 || alpha == 0.0)\n"
+	"	{\n"
+	"		gl_FragColor = texture2D(screen, texCoord);\n"
+	"		return;\n"
+	"	}\n"
+	"	vec4 color = bytes(texture2D(colors, texCoord));\n"
+	"	vec3 c = floor(image.rgb / 4.0);\n"
+	"	vec3 mid = floor(c / 2.0);\n"
+	"	if(flag(attr.x, 4.0))\n"
+	"	{\n"
+	"		if(alpha < 31.0)\n"
+	"			mid = floor((c * (alpha + 1.0) + rgb555(color.xy) * 2.0 * (31.0 - alpha)) / 64.0);\n"
+	"	}\n"
+	"	else if(flag(attr.x, 8.0))\n"
+	"		mid += floor((31.0 - mid) * attr.y / 16.0);\n"
+	"	else if(flag(attr.x, 16.0))\n"
+	"		mid -= floor(mid * attr.y / 16.0);\n"
+	"	if(kind == 2.0)\n"
+	"	{\n"
+	"		vec3 over = rgb555(color.zw);\n"
+	"		mid = flag(attr.x, 32.0) ? min(vec3(31.0), floor((over * attr.z + mid * attr.w) / 16.0)) : over;\n"
+	"	}\n"
+	"	gl_FragColor = vec4(mid / 31.0, 1.0);\n"
+	"}\n";
+
+static const char* fragmentShaders[GLDRAW_NUM_SHADERS] = {
+	//nearest and bilinear only differ in the texture's sampling
+	"void main() { gl_FragColor = texture2D(tex, texCoord); }\n",
+	"void main() { gl_FragColor = texture2D(tex, texCoord); }\n",
+
+	//each texel is 2x2 output pixels darkened by the factors of RenderScanline
+	"void main()\n"
+	"{\n"
+	"	vec2 pos = texCoord * texSize;\n"
+	"	vec2 q = fract(pos);\n"
+	"	float f = q.y < 0.5 ? (q.x < 0.5 ? scanline.x : scanline.y) : (q.x < 0.5 ? scanline.z : scanline.w);\n"
+	"	gl_FragColor = vec4(px(floor(pos) + 0.5) * f, 1.0);\n"
+	"}\n",
+
+	//scale2x: the quadrant takes the colour of its two neighbours when they agree and the opposite ones do not
+	"bool eq(vec3 a, vec3 b) { return dot(abs(a - b), vec3(1.0)) < 0.01; }\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 pos = texCoord * texSize;\n"
+	"	vec2 p = floor(pos) + 0.5;\n"
+	"	vec2 q = fract(pos);\n"
+	"	vec2 sx = vec2(q.x < 0.5 ? -1.0 : 1.0, 0.0);\n"
+	"	vec2 sy = vec2(0.0, q.y < 0.5 ? -1.0 : 1.0);\n"
+	"	vec3 E = px(p), X = px(p + sx), V = px(p + sy);\n"
+	"	gl_FragColor = vec4(eq(V, X) && !eq(V, px(p - sx)) && !eq(X, px(p - sy)) ? X : E, 1.0);\n"
+	"}\n",
+
+	//the YUV thresholds of hq2x decide whether a diagonal edge cuts the quadrant's corner
+	"bool similar(vec3 a, vec3 b)\n"
+	"{\n"
+	"	vec3 c = a - b;\n"
+	"	return abs(dot(c, lumaY)) <= 48.0 / 255.0 && abs(dot(c, chromaU)) <= 7.0 / 255.0 && abs(dot(c, chromaV)) <= 6.0 / 255.0;\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 pos = texCoord * texSize;\n"
+	"	vec2 p = floor(pos) + 0.5;\n"
+	"	vec2 q = fract(pos);\n"
+	"	vec2 sx = vec2(q.x < 0.5 ? -1.0 : 1.0, 0.0);\n"
+	"	vec2 sy = vec2(0.0, q.y < 0.5 ? -1.0 : 1.0);\n"
+	"	vec3 E = px(p), X = px(p + sx), V = px(p + sy);\n"
+	"	vec3 c = E;\n"
+	"	if(similar(X, V) && !similar(E, X))\n"
+	"		c = similar(E, px(p + sx + sy)) ? (E * 6.0 + X + V) / 8.0 : (E * 2.0 + X + V) / 4.0;\n"
+	"	gl_FragColor = vec4(c, 1.0);\n"
+	"}\n",
+
+	//xBR level 1, worked out for the corner of the pixel this fragment is nearest to
+	"float d(vec3 a, vec3 b)\n"
+	"{\n"
+	"	vec3 c = a - b;\n"
+	"	return 48.0 * abs(dot(c, lumaY)) + 7.0 * abs(dot(c, chromaU)) + 6.0 * abs(dot(c, chromaV));\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 pos = texCoord * texSize;\n"
+	"	vec2 p = floor(pos) + 0.5;\n"
+	"	vec2 q = fract(pos);\n"
+	"	vec2 sx = vec2(q.x < 0.5 ? -1.0 : 1.0, 0.0);\n"
+	"	vec2 sy = vec2(0.0, q.y < 0.5 ? -1.0 : 1.0);\n"
+	"	vec2 f = vec2(q.x < 0.5 ? 1.0 - q.x : q.x, q.y < 0.5 ? 1.0 - q.y : q.y);\n"
+	"	vec3 E = px(p), B = px(p - sy), D = px(p - sx), F = px(p + sx), H = px(p + sy);\n"
+	"	vec3 C = px(p + sx - sy), G = px(p - sx + sy), I = px(p + sx + sy);\n"
+	"	vec3 F4 = px(p + sx * 2.0), H5 = px(p + sy * 2.0), I4 = px(p + sx * 2.0 + sy), I5 = px(p + sx + sy * 2.0);\n"
+	"	float e = d(E, C) + d(E, G) + d(I, F4) + d(I, H5) + 4.0 * d(H, F);\n"
+	"	float i = d(H, D) + d(H, I5) + d(F, I4) + d(F, B) + 4.0 * d(E, I);\n"
+	"	vec3 c = E;\n"
+	"	if(e < i && d(E, F) > 0.0 && d(E, H) > 0.0)\n"
+	"		c = mix(E, d(E, F) <= d(E, H) ? F : H, smoothstep(1.35, 1.65, f.x + f.y));\n"
+	"	gl_FragColor = vec4(c, 1.0);\n"
+	"}\n",
+};
+
+static struct GLDrawState
+{
+	ANativeWindow* window;
+	EGLDisplay display;
+	EGLSurface surface;
+	EGLContext context;
+	GLuint textures[2];
+	//what the screens are drawn from this frame: textures, or a set of the ring
+	GLuint screens[2];
+	GLuint programs[GLDRAW_NUM_SHADERS];
+	GLint texSize[GLDRAW_NUM_SHADERS];
+	GLint scanline[GLDRAW_NUM_SHADERS];
+	int textureFilter;
+	//set when the window could not be used with EGL, so it is not retried every frame
+	bool failed;
+	//the renderer's context when this one was made, which it shares with if it could, and what mixes the 3d
+	//in with the 2d when it does
+	EGLContext shared;
+	GLuint compositeProgram;
+	GLuint compositeTextures[2];	//the colors and attrs of the frame
+	GLuint compositeTarget;			//the main screen with its 3d
+	GLuint compositeFBO;
+	GLDrawWaitSync waitSync;
+	//the encoder's input surface while recording, in a config that it can take
+	EGLConfig config;
+	bool recordable;
+	EGLSurface recordSurface;
+	ANativeWindow* recordWindow;
+	u32 recordSerial;	//the recording it is for
+	PFNEGLPRESENTATIONTIMEANDROIDPROC presentationTime;
+	//the hardware buffer textures, when they could be made. fence is set once the gpu has been given the draws
+	//that read the set, and is waited on before the set is written again
+	struct
+	{
+		AHardwareBuffer* buffers[2];
+		EGLImageKHR images[2];
+		GLuint textures[2];
+		u32 strides[2];	//in pixels
+		EGLSyncKHR fence;
+	} ring[GLDRAW_HWB_RING];
+	bool mapped;
+	int ringNext;
+} gl = { NULL, EGL_NO_DISPLAY, EGL_NO_SURFACE, EGL_NO_CONTEXT };
+
+//read by the emulation thread, which leaves the 3d on the gpu only while it is set
+static volatile bool glComposite = false;
+
+static CACHE_ALIGN u16 glScreens[256*192*2];
+
+static bool glDrawLoadHardwareBuffer()
+{
+	if(hwb.allocate)
+		return true;
+	void* lib = dlopen("libnativewindow.so", RTLD_NOW);
+	if(!lib)
+		return false;
+	GLDrawHardwareBufferFuncs funcs;
+	funcs.allocate = (HardwareBufferAllocate)dlsym(lib, "AHardwareBuffer_allocate");
+	funcs.release = (HardwareBufferRelease)dlsym(lib, "AHardwareBuffer_release");
+	funcs.describe = (HardwareBufferDescribe)dlsym(lib, "AHardwareBuffer_describe");
+	funcs.lock = (HardwareBufferLock)dlsym(lib, "AHardwareBuffer_lock");
+	funcs.unlock = (HardwareBufferUnlock)dlsym(lib, "AHardwareBuffer_unlock");
+	funcs.getNativeClientBuffer = (PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC)eglGetProcAddress("eglGetNativeClientBufferANDROID");
+	funcs.createImage = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+	funcs.destroyImage = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+	funcs.imageTargetTexture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+	funcs.createSync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+	funcs.clientWaitSync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+	funcs.destroySync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+	if(!funcs.allocate || !funcs.release || !funcs.describe || !funcs.lock || !funcs.unlock || !funcs.getNativeClientBuffer
+		|| !funcs.createImage || !funcs.destroyImage || !funcs.imageTargetTexture || !funcs.createSync || !funcs.clientWaitSync || !funcs.destroySync)
+		return false;
+	hwb = funcs;
+	return true;
+}
+
+static void glDrawMapRelease()
+{
+	for(int r = 0 ; r < GLDRAW_HWB_RING ; ++r)
+	{
+		if(gl.ring[r].fence != EGL_NO_SYNC_KHR)
+			hwb.destroySync(gl.display, gl.ring[r].fence);
+		glDeleteTextures(2, gl.ring[r].textures);
+		for(int i = 0 ; i < 2 ; ++i)
+		{
+			if(gl.ring[r].images[i] != EGL_NO_IMAGE_KHR)
+				hwb.destroyImage(gl.display, gl.ring[r].images[i]);
+			if(gl.ring[r].buffers[i])
+				hwb.release(gl.ring[r].buffers[i]);
+		}
+	}
+	memset(gl.ring, 0, sizeof(gl.ring));
+	gl.mapped = false;
+	gl.ringNext = 0;
+}
+
+//makes the ring of screen textures out of hardware buffers. false leaves the screens uploaded into textures
+static bool glDrawMapInit()
+{
+	memset(gl.ring, 0, sizeof(gl.ring));
+	const char* eglExtensions = eglQueryString(gl.display, EGL_EXTENSIONS);
+	const char* glExtensions = (const char*)glGetString(GL_EXTENSIONS);
+	if(!eglExtensions || !strstr(eglExtensions, "EGL_KHR_fence_sync") || !strstr(eglExtensions, "EGL_ANDROID_image_native_buffer")
+		|| !glExtensions || !strstr(glExtensions, "GL_OES_EGL_image") || !glDrawLoadHardwareBuffer())
+		return false;
+
+	AHardwareBuffer_Desc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.width = 256;
+	desc.height = 192;
+	desc.layers = 1;
+	desc.format = AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM;
+	desc.usage = GLDRAW_HWB_USAGE;
+	const EGLint imageAttribs[] = { EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE };
+	for(int r = 0 ; r < GLDRAW_HWB_RING ; ++r)
+	{
+		gl.ring[r].fence = EGL_NO_SYNC_KHR;
+		glGenTextures(2, gl.ring[r].textures);
+		for(int i = 0 ; i < 2 ; ++i)
+		{
+			gl.ring[r].images[i] = EGL_NO_IMAGE_KHR;
+			if(hwb.allocate(&desc, &gl.ring[r].buffers[i]) != 0)
+			{
+				gl.ring[r].buffers[i] = NULL;
+				glDrawMapRelease();
+				return false;
+			}
+			AHardwareBuffer_Desc allocated;
+			hwb.describe(gl.ring[r].buffers[i], &allocated);
+			gl.ring[r].strides[i] = allocated.stride;
+
+			const EGLClientBuffer clientBuffer = hwb.getNativeClientBuffer(gl.ring[r].buffers[i]);
+			gl.ring[r].images[i] = clientBuffer ? hwb.createImage(gl.display, EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID, clientBuffer, imageAttribs) : EGL_NO_IMAGE_KHR;
+			if(gl.ring[r].images[i] == EGL_NO_IMAGE_KHR)
+			{
+				glDrawMapRelease();
+				return false;
+			}
+			glBindTexture(GL_TEXTURE_2D, gl.ring[r].textures[i]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			hwb.imageTargetTexture(GL_TEXTURE_2D, (GLeglImageOES)gl.ring[r].images[i]);
+		}
+	}
+	if(glGetError() != GL_NO_ERROR)
+	{
+		glDrawMapRelease();
+		return false;
+	}
+	gl.mapped = true;
+	LOGI("Presenting the screens from hardware buffers");
+	return true;
+}
+
+//converts the screens into the next set of the ring and draws from it. false when the set could not be written,
+//and the screens have to be uploaded instead
+static bool glDrawMapScreens(const u16* screens)
+{
+	if(!gl.mapped)
+		return false;
+
+	const int r = gl.ringNext;
+	//the draws that read the set last went round, which is usually long done
+	if(gl.ring[r].fence != EGL_NO_SYNC_KHR)
+	{
+		hwb.clientWaitSync(gl.display, gl.ring[r].fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+		hwb.destroySync(gl.display, gl.ring[r].fence);
+		gl.ring[r].fence = EGL_NO_SYNC_KHR;
+	}
+
+	for(int i = 0 ; i < 2 ; ++i)
+	{
+		void* bits = NULL;
+		if(hwb.lock(gl.ring[r].buffers[i], AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN, -1, NULL, &bits) != 0)
+			return false;
+		const u16* src = screens + i * 256 * 192;
+		const u32 stride = gl.ring[r].strides[i];
+		if(stride == 256)
+			convertScreen565((u16*)bits, src, 256*192);
+		else
+			for(int y = 0 ; y < 192 ; ++y)
+				convertScreen565((u16*)bits + y * stride, src + y * 256, 256);
+		hwb.unlock(gl.ring[r].buffers[i], NULL);
+		gl.screens[i] = gl.ring[r].textures[i];
+	}
+	return true;
+}
+
+//called once everything that reads this frame's set has been issued
+static void glDrawMapFence()
+{
+	if(!gl.mapped || gl.screens[0] != gl.ring[gl.ringNext].textures[0])
+		return;
+	gl.ring[gl.ringNext].fence = hwb.createSync(gl.display, EGL_SYNC_FENCE_KHR, NULL);
+	//without the fence the set's next write could race the gpu, so the textures are uploaded from then on
+	if(gl.ring[gl.ringNext].fence == EGL_NO_SYNC_KHR)
+	{
+		glFinish();
+		glDrawMapRelease();
+		return;
+	}
+	gl.ringNext = (gl.ringNext + 1) % GLDRAW_HWB_RING;
+}
+
+static void glDrawSetFilter(GLint textureFilter)
+{
+	for(int i = 0 ; i < 2 ; ++i)
+	{
+		glBindTexture(GL_TEXTURE_2D, gl.textures[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, textureFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, textureFilter);
+		for(int r = 0 ; gl.mapped && r < GLDRAW_HWB_RING ; ++r)
+		{
+			glBindTexture(GL_TEXTURE_2D, gl.ring[r].textures[i]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, textureFilter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, textureFilter);
+		}
+	}
+	gl.textureFilter = textureFilter;
+}
+
+static GLuint glDrawCompile(GLenum type, const char* header, const char* source)
+{
+	const char* sources[2] = { header, source };
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 2, sources, NULL);
+	glCompileShader(shader);
+	GLint compiled = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if(!compiled)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		LOGW("Screen shader failed to compile: %s", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+static GLuint glDrawProgram(int shader)
+{
+	if(gl.programs[shader])
+		return gl.programs[shader];
+
+	GLuint vertex = glDrawCompile(GL_VERTEX_SHADER, "", vertexShader);
+	GLuint fragment = glDrawCompile(GL_FRAGMENT_SHADER, fragmentHeader, fragmentShaders[shader]);
+	GLuint program = 0;
+	if(vertex && fragment)
+	{
+		program = glCreateProgram();
+		glAttachShader(program, vertex);
+		glAttachShader(program, fragment);
+		glBindAttribLocation(program, 0, "position");
+		glBindAttribLocation(program, 1, "texPosition");
+		glLinkProgram(program);
+		GLint linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if(!linked)
+		{
+			LOGW("Screen shader %i failed to link", shader);
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	if(vertex)
+		glDeleteShader(vertex);
+	if(fragment)
+		glDeleteShader(fragment);
+	if(!program)
+		return 0;
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "tex"), 0);
+	gl.texSize[shader] = glGetUniformLocation(program, "texSize");
+	gl.scanline[shader] = glGetUniformLocation(program, "scanline");
+	gl.programs[shader] = program;
+	return program;
+}
+
+//gles3 when this context can wait for the renderer's fences
+static bool glDrawCompositeInit(bool gles3)
+{
+	GLuint vertex = glDrawCompile(GL_VERTEX_SHADER, "", vertexShader);
+	GLuint fragment = glDrawCompile(GL_FRAGMENT_SHADER, "", compositeShader);
+	GLuint program = 0;
+	if(vertex && fragment)
+	{
+		program = glCreateProgram();
+		glAttachShader(program, vertex);
+		glAttachShader(program, fragment);
+		glBindAttribLocation(program, 0, "position");
+		glBindAttribLocation(program, 1, "texPosition");
+		glLinkProgram(program);
+		GLint linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if(!linked)
+		{
+			LOGW("Composite shader failed to link");
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	if(vertex)
+		glDeleteShader(vertex);
+	if(fragment)
+		glDeleteShader(fragment);
+	if(!program)
+		return false;
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "screen"), 0);
+	glUniform1i(glGetUniformLocation(program, "colors"), 1);
+	glUniform1i(glGetUniformLocation(program, "attrs"), 2);
+	glUniform1i(glGetUniformLocation(program, "image3D"), 3);
+	gl.compositeProgram = program;
+
+	glGenTextures(2, gl.compositeTextures);
+	for(int i = 0 ; i < 2 ; ++i)
+	{
+		glBindTexture(GL_TEXTURE_2D, gl.compositeTextures[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 192, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+
+	//565 like the screens' textures, which GLES2 can always render to
+	glGenTextures(1, &gl.compositeTarget);
+	glBindTexture(GL_TEXTURE_2D, gl.compositeTarget);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 256, 192, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, NULL);
+	glGenFramebuffers(1, &gl.compositeFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, gl.compositeFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl.compositeTarget, 0);
+	const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if(!complete)
+		LOGW("Composite target is not renderable");
+
+	gl.waitSync = gles3 ? (GLDrawWaitSync)eglGetProcAddress("glWaitSync") : NULL;
+	return complete;
+}
+
+static void glDrawCompositeRelease()
+{
+	glComposite = false;
+	if(gl.compositeProgram)
+		glDeleteProgram(gl.compositeProgram);
+	glDeleteTextures(2, gl.compositeTextures);
+	glDeleteTextures(1, &gl.compositeTarget);
+	glDeleteFramebuffers(1, &gl.compositeFBO);
+	gl.compositeProgram = 0;
+	memset(gl.compositeTextures, 0, sizeof(gl.compositeTextures));
+	gl.compositeTarget = 0;
+	gl.compositeFBO = 0;
+}
+
+//mixes the 3d of frame's main screen into compositeTarget. returns the screen it replaces, or -1 if it can't
+static int glDrawComposite(const FrameQueue::Frame& frame, GLint textureFilter)
+{
+	if(!glComposite)
+		return -1;
+
+	//the renderer's commands for the 3d may not have finished; this only makes ours wait for them on the gpu
+	if(frame.fence3D && gl.waitSync)
+		gl.waitSync(frame.fence3D, 0, GLDRAW_TIMEOUT_IGNORED);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, gl.compositeTextures[0]);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 192, GL_RGBA, GL_UNSIGNED_BYTE, frame.compositeColors);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, gl.compositeTextures[1]);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 192, GL_RGBA, GL_UNSIGNED_BYTE, frame.compositeAttrs);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, frame.texture3D);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, gl.screens[frame.compositeScreen]);
+
+	//the screen's texture is sampled with the filter's filtering, but here only at texel centres
+	glBindFramebuffer(GL_FRAMEBUFFER, gl.compositeFBO);
+	glViewport(0, 0, 256, 192);
+	glUseProgram(gl.compositeProgram);
+	//row 0 of the target is the screen's top line, like the screens' textures
+	const GLfloat positions[] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+	const GLfloat texPositions[] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, positions);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texPositions);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glDisableVertexAttribArray(0);
+	glDisableVertexAttribArray(1);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glBindTexture(GL_TEXTURE_2D, gl.compositeTarget);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, textureFilter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, textureFilter);
+	return frame.compositeScreen;
+}
+
+static void glDrawRecordRelease()
+{
+	if(gl.recordSurface != EGL_NO_SURFACE)
+		eglDestroySurface(gl.display, gl.recordSurface);
+	if(gl.recordWindow)
+		ANativeWindow_release(gl.recordWindow);
+	gl.recordSurface = EGL_NO_SURFACE;
+	gl.recordWindow = NULL;
+	gl.recordSerial = 0;
+}
+
+//copies both screens, top over bottom and without the filter, into the encoder's surface at the frame's time
+static void glDrawRecord(int composited, u32 seq)
+{
+	const u32 serial = recorder_serial();
+	if(serial != gl.recordSerial)
+	{
+		glDrawRecordRelease();
+		gl.recordWindow = gl.recordable ? recorder_acquireWindow(&gl.recordSerial) : NULL;
+		if(gl.recordWindow)
+			gl.recordSurface = eglCreateWindowSurface(gl.display, gl.config, (EGLNativeWindowType)gl.recordWindow, NULL);
+		if(gl.recordSurface == EGL_NO_SURFACE && recorder_recording())
+			LOGW("Could not draw the screens into the recording");
+		gl.recordSerial = serial;
+		if(!gl.presentationTime)
+			gl.presentationTime = (PFNEGLPRESENTATIONTIMEANDROIDPROC)eglGetProcAddress("eglPresentationTimeANDROID");
+	}
+	if(gl.recordSurface == EGL_NO_SURFACE || !gl.presentationTime)
+		return;
+	const s64 time = recorder_frameTime(seq);
+	if(time < 0)
+		return;
+
+	const GLuint program = glDrawProgram(GLDRAW_NEAREST);
+	if(!program || !eglMakeCurrent(gl.display, gl.recordSurface, gl.recordSurface, gl.context))
+		return;
+	glViewport(0, 0, 256, 384);
+	glUseProgram(program);
+	glUniform2f(gl.texSize[GLDRAW_NEAREST], 256, 192);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	const GLfloat texPositions[] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texPositions);
+	for(int s = 0 ; s < 2 ; ++s)
+	{
+		const GLfloat top = 1 - s, bottom = -s;
+		const GLfloat positions[] = { -1, top, 1, top, -1, bottom, 1, bottom };
+		glBindTexture(GL_TEXTURE_2D, s == composited ? gl.compositeTarget : gl.screens[s]);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, positions);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+	glDisableVertexAttribArray(0);
+	glDisableVertexAttribArray(1);
+	gl.presentationTime(gl.display, gl.recordSurface, time);
+	eglSwapBuffers(gl.display, gl.recordSurface);
+	eglMakeCurrent(gl.display, gl.surface, gl.surface, gl.context);
+}
+
+bool glDrawCanComposite()
+{
+	return glComposite;
+}
+
+//drops the EGL surface and context, which hands the window back to ANativeWindow_lock
+void glDrawRelease()
+{
+	glComposite = false;
+	if(gl.display == EGL_NO_DISPLAY || (gl.surface == EGL_NO_SURFACE && gl.context == EGL_NO_CONTEXT))
+		return;
+
+	if(gl.context != EGL_NO_CONTEXT)
+	{
+		eglMakeCurrent(gl.display, gl.surface, gl.surface, gl.context);
+		glDeleteTextures(2, gl.textures);
+		for(int i = 0 ; i < GLDRAW_NUM_SHADERS ; ++i)
+			if(gl.programs[i])
+				glDeleteProgram(gl.programs[i]);
+		glDrawCompositeRelease();
+		if(gl.mapped)
+			glDrawMapRelease();
+	}
+	glDrawRecordRelease();
+	eglMakeCurrent(gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if(gl.context != EGL_NO_CONTEXT)
+		eglDestroyContext(gl.display, gl.context);
+	if(gl.surface != EGL_NO_SURFACE)
+		eglDestroySurface(gl.display, gl.surface);
+
+	memset(gl.textures, 0, sizeof(gl.textures));
+	memset(gl.screens, 0, sizeof(gl.screens));
+	memset(gl.programs, 0, sizeof(gl.programs));
+	gl.surface = EGL_NO_SURFACE;
+	gl.context = EGL_NO_CONTEXT;
+	gl.shared = EGL_NO_CONTEXT;
+	gl.window = NULL;
+}
+
+static bool glDrawAttach(ANativeWindow* window)
+{
+	const EGLint attribs[] = {
+		EGL_RED_SIZE, 5,
+		EGL_GREEN_SIZE, 6,
+		EGL_BLUE_SIZE, 5,
+		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+	//the same, that the encoders can take too
+	const EGLint recordableAttribs[] = {
+		EGL_RED_SIZE, 5,
+		EGL_GREEN_SIZE, 6,
+		EGL_BLUE_SIZE, 5,
+		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_RECORDABLE_ANDROID, EGL_TRUE,
+		EGL_NONE
+	};
+	//the version of the renderer's context first, which is the likeliest to share with it
+	const EGLContext renderContext = context;
+	const EGLint shareAttribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, contextClientVersion,
+		EGL_NONE
+	};
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+
+	if(gl.display == EGL_NO_DISPLAY)
+	{
+		gl.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if(gl.display == EGL_NO_DISPLAY || !eglInitialize(gl.display, NULL, NULL))
+		{
+			gl.display = EGL_NO_DISPLAY;
+			return false;
+		}
+	}
+
+	//a recordable one if there is, so that the screens can be recorded with the same context
+	EGLConfig config;
+	EGLint numConfigs = 0, format;
+	gl.recordable = eglChooseConfig(gl.display, recordableAttribs, &config, 1, &numConfigs) && numConfigs >= 1;
+	if(!gl.recordable && (!eglChooseConfig(gl.display, attribs, &config, 1, &numConfigs) || numConfigs < 1))
+		return false;
+	gl.config = config;
+	eglGetConfigAttrib(gl.display, config, EGL_NATIVE_VISUAL_ID, &format);
+	ANativeWindow_setBuffersGeometry(window, 0, 0, format);
+
+	gl.surface = eglCreateWindowSurface(gl.display, config, (EGLNativeWindowType)window, NULL);
+	if(gl.surface == EGL_NO_SURFACE)
+		return false;
+	gl.shared = renderContext;
+	bool sharing = false, gles3 = false;
+	if(renderContext != EGL_NO_CONTEXT)
+	{
+		gl.context = eglCreateContext(gl.display, config, renderContext, shareAttribs);
+		gles3 = gl.context != EGL_NO_CONTEXT && contextClientVersion >= 3;
+		if(gl.context == EGL_NO_CONTEXT)
+			gl.context = eglCreateContext(gl.display, config, renderContext, contextAttribs);
+		sharing = gl.context != EGL_NO_CONTEXT;
+		if(!sharing)
+			LOGW("Could not share the 3D renderer's context, its 3D is read back instead");
+	}
+	if(gl.context == EGL_NO_CONTEXT)
+		gl.context = eglCreateContext(gl.display, config, EGL_NO_CONTEXT, contextAttribs);
+	if(gl.context == EGL_NO_CONTEXT || !eglMakeCurrent(gl.display, gl.surface, gl.surface, gl.context))
+		return false;
+
+	//one texture per screen, so the filters clamp at the screen's edges instead of reading the other one
+	glGenTextures(2, gl.textures);
+	for(int i = 0 ; i < 2 ; ++i)
+	{
+		glBindTexture(GL_TEXTURE_2D, gl.textures[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 256, 192, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, NULL);
+	}
+	gl.textureFilter = -1;
+	glDrawMapInit();
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glClearColor(0, 0, 0, 1);
+
+	//a GLES3 renderer fences its frames instead of finishing them, and only a GLES3 context can wait for that
+	if(sharing && (gles3 || contextClientVersion < 3))
+		glComposite = glDrawCompositeInit(gles3);
+
+	gl.window = window;
+	LOGI("Presenting the screens through GLES2");
+	return true;
+}
+
+//draws both screens into the window with the filter's shader and posts it.
+//rects and rotate are the same as for doWindowDraw, and seq is the frame's, for the recording. returns false when
+//the filter has no shader or GLES can not be used on the window; the caller then has to draw another way
+bool glDrawScreens(ANativeWindow* window, const u16* screens, const int* rects, bool rotate, int filter, const FrameQueue::Frame* composite, u32 seq)
+{
+	const int shader = glDrawShaderFor(filter);
+	if(shader == GLDRAW_UNSUPPORTED)
+	{
+		glDrawRelease();
+		return false;
+	}
+
+	//a renderer made since the context was has a new context to share with
+	if(gl.window == window && context != EGL_NO_CONTEXT && gl.shared != context)
+		glDrawRelease();
+
+	if(gl.window != window)
+	{
+		glDrawRelease();
+		if(gl.failed)
+			return false;
+		if(!glDrawAttach(window))
+		{
+			LOGW("Could not present the screens through GLES2, falling back");
+			glDrawRelease();
+			gl.failed = true;
+			return false;
+		}
+	}
+	else if(!eglMakeCurrent(gl.display, gl.surface, gl.surface, gl.context))
+	{
+		glDrawRelease();
+		return false;
+	}
+
+	const GLuint program = glDrawProgram(shader);
+	if(!program)
+	{
+		glDrawRelease();
+		gl.failed = true;
+		return false;
+	}
+
+	const GLint textureFilter = shader == GLDRAW_BILINEAR ? GL_LINEAR : GL_NEAREST;
+	if(textureFilter != gl.textureFilter)
+		glDrawSetFilter(textureFilter);
+	if(!glDrawMapScreens(screens))
+	{
+		//RGB555 to RGB565 is lossless and halves the upload compared to RGBA
+		convertScreen565(glScreens, screens, 256*192*2);
+		for(int i = 0 ; i < 2 ; ++i)
+		{
+			glBindTexture(GL_TEXTURE_2D, gl.textures[i]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 192, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, glScreens + i * 256 * 192);
+			gl.screens[i] = gl.textures[i];
+		}
+	}
+	const int composited = composite ? glDrawComposite(*composite, textureFilter) : -1;
+
+	EGLint width = 0, height = 0;
+	eglQuerySurface(gl.display, gl.surface, EGL_WIDTH, &width);
+	eglQuerySurface(gl.display, gl.surface, EGL_HEIGHT, &height);
+	glViewport(0, 0, width, height);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glUseProgram(program);
+	glUniform2f(gl.texSize[shader], 256, 192);
+	if(gl.scanline[shader] >= 0)
+		glUniform4f(gl.scanline[shader], (16 - scanline_filter_a) / 16.0f, (16 - scanline_filter_b) / 16.0f,
+			(16 - scanline_filter_c) / 16.0f, (16 - scanline_filter_d) / 16.0f);
+
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	for(int s = 0 ; s < 2 ; ++s)
+	{
+		const int* rect = rects + s * 4;
+		if(rect[2] <= rect[0] || rect[3] <= rect[1] || width <= 0 || height <= 0)
+			continue;
+
+		const GLfloat left = rect[0] * 2.0f / width - 1, right = rect[2] * 2.0f / width - 1;
+		const GLfloat top = 1 - rect[1] * 2.0f / height, bottom = 1 - rect[3] * 2.0f / height;
+		//top left, top right, bottom left, bottom right. rotated, the rect's x walks down the screen and its y walks the columns backwards
+		const GLfloat positions[] = { left, top, right, top, left, bottom, right, bottom };
+		const GLfloat texPositions[] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+		const GLfloat rotatedPositions[] = { 1, 0, 1, 1, 0, 0, 0, 1 };
+
+		glBindTexture(GL_TEXTURE_2D, s == composited ? gl.compositeTarget : gl.screens[s]);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, positions);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, rotate ? rotatedPositions : texPositions);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+	glDisableVertexAttribArray(0);
+	glDisableVertexAttribArray(1);
+
+	if(!eglSwapBuffers(gl.display, gl.surface))
+	{
+		glDrawRelease();
+		return false;
+	}
+	glDrawRecord(composited, seq);
+	glDrawMapFence();
+	return true;
+}
+
+//called before the window changes; a new window gets another try at GLES
+void glDrawResetWindow()
+{
+	glDrawRelease();
+	gl.failed = false;
+}
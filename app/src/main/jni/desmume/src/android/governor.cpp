@@ -0,0 +1,111 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "governor.h"
+#include <dlfcn.h>
+#include <algorithm>
+#include "frametimes.h"
+#include "main.h"
+
+//AThermal is from android 10 on and the app still runs on 5.0, so it is looked up at runtime
+typedef void* (*ThermalAcquireManager)();
+typedef int (*ThermalGetCurrentThermalStatus)(void* manager);
+
+//AThermalStatus
+enum
+{
+	THERMAL_UNKNOWN = -1,
+	THERMAL_NONE,
+	THERMAL_LIGHT,
+	THERMAL_MODERATE,
+	THERMAL_SEVERE,
+};
+
+//frames that are gone by before each decision, two seconds
+static const int kWindowFrames = 120;
+//windows in a row the frames have to fit easily in before a step back up, so that it doesn't go back and forth
+static const int kRestoreWindows = 3;
+
+static int lowest = QUALITY_FULL;
+static int step = QUALITY_FULL;
+static int easyWindows = 0;
+static FrameTimes window;
+
+static bool thermalLooked = false;
+static void* thermalManager = NULL;
+static ThermalGetCurrentThermalStatus getThermalStatus = NULL;
+
+static int thermalStatus()
+{
+	if(!thermalLooked)
+	{
+		thermalLooked = true;
+		void* lib = dlopen("libandroid.so", RTLD_NOW);
+		ThermalAcquireManager acquire = lib ? (ThermalAcquireManager)dlsym(lib, "AThermal_acquireManager") : NULL;
+		getThermalStatus = lib ? (ThermalGetCurrentThermalStatus)dlsym(lib, "AThermal_getCurrentThermalStatus") : NULL;
+		thermalManager = acquire && getThermalStatus ? acquire() : NULL;
+	}
+	return thermalManager ? getThermalStatus(thermalManager) : THERMAL_UNKNOWN;
+}
+
+void governor_setLowest(int n)
+{
+	__atomic_store_n(&lowest, std::max((int)QUALITY_FULL, std::min(n, QUALITY_STEPS - 1)), __ATOMIC_RELAXED);
+}
+
+int governor_frame(u64 ns)
+{
+	const int most = __atomic_load_n(&lowest, __ATOMIC_RELAXED);
+	if(most == QUALITY_FULL)
+	{
+		step = QUALITY_FULL;
+		return step;
+	}
+	step = std::min(step, most);
+
+	window.add(ns);
+	FrameTimes::Stats stats;
+	window.get(stats);
+	if(stats.frames < kWindowFrames)
+		return step;
+	window.reset();
+
+	//a phone that can't tell how hot it is is taken to be hot, since slow is all there is to go by
+	const int thermal = thermalStatus();
+	const bool warm = thermal == THERMAL_UNKNOWN || thermal >= THERMAL_LIGHT;
+	const bool slow = stats.overBudget * 10 > stats.frames;
+	const bool easy = stats.p95 < FrameTimes::BUDGET_US * 3 / 4;
+
+	if(step < most && ((slow && warm) || thermal >= THERMAL_SEVERE))
+	{
+		step++;
+		easyWindows = 0;
+		LOGI("Quality down to step %d (thermal status %d, %u of %u frames over)", step, thermal, stats.overBudget, stats.frames);
+	}
+	else if(step > QUALITY_FULL && easy && thermal < THERMAL_MODERATE)
+	{
+		if(++easyWindows >= kRestoreWindows)
+		{
+			step--;
+			easyWindows = 0;
+			LOGI("Quality back up to step %d", step);
+		}
+	}
+	else
+		easyWindows = 0;
+	return step;
+}
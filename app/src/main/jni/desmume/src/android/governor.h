@@ -0,0 +1,42 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _GOVERNOR_H
+#define _GOVERNOR_H
+
+#include "../types.h"
+
+//the quality governor: when the frames stop fitting in their time while the phone is heating up (or has no say on
+//that), it goes one step down the ladder of what costs the most for the least to see, and back up once the frames
+//fit easily again and the phone has cooled down. each step keeps the ones before it
+enum QualityStep
+{
+	QUALITY_FULL,
+	QUALITY_NO_FILTER,		//the screen filter off
+	QUALITY_FEWER_CORES,	//the rasterizer on half the cores it has
+	QUALITY_SKIP_3D,		//every other frame's 3d skipped
+	QUALITY_NATIVE_3D,		//the rasterizer at the ds resolution
+	QUALITY_STEPS,
+};
+
+//the lowest step it may go to, QUALITY_FULL for off. from any thread
+void governor_setLowest(int step);
+
+//the emulation thread, with how long each paced frame took. returns the step to be at
+int governor_frame(u64 ns);
+
+#endif
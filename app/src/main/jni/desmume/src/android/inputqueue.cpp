@@ -0,0 +1,112 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "inputqueue.h"
+#include <string.h>
+#include <algorithm>
+#include "../NDSSystem.h"
+#include "../frameprofile.h"
+
+InputQueue inputQueue;
+
+InputQueue::InputQueue()
+	: buttons(0)
+	, touching(false)
+	, seenDropped(0)
+	, latencyTotal(0)
+	, latencyCount(0)
+{
+	memset(&shared, 0, sizeof(shared));
+}
+
+void InputQueue::applyButtons(u32 mask)
+{
+	NDS_setPad(mask & 1, (mask >> 1) & 1, (mask >> 2) & 1, (mask >> 3) & 1, (mask >> 4) & 1, (mask >> 5) & 1,
+		(mask >> 6) & 1, (mask >> 7) & 1, (mask >> 8) & 1, (mask >> 9) & 1, (mask >> 10) & 1, (mask >> 11) & 1,
+		(mask >> 12) & 1, (mask >> 13) & 1);
+}
+
+void InputQueue::applyTouch(u32 data)
+{
+	NDS_setTouchPos(std::min<u32>(data & 0xFFFF, 255), std::min<u32>((data >> 16) & 0x7FFF, 192));
+}
+
+void InputQueue::drain()
+{
+	const u32 end = __atomic_load_n(&shared.writePos, __ATOMIC_ACQUIRE);
+	const u64 now = frameprofile_now();
+	u32 pos = shared.readPos;
+	u32 pressed = 0;
+	bool touchedDown = false;
+	u64 latency = 0;
+	u32 latencyEvents = 0;
+	for(; pos != end; pos++)
+	{
+		const Record& rec = shared.records[pos % INPUT_QUEUE_SIZE];
+		if(rec.type == INPUT_BUTTONS)
+		{
+			if(buttons & ~rec.data & pressed) break;
+			pressed |= rec.data & ~buttons;
+			buttons = rec.data;
+			applyButtons(buttons);
+		}
+		else if(rec.type == INPUT_TOUCH)
+		{
+			touchedDown |= !touching;
+			touching = true;
+			applyTouch(rec.data);
+		}
+		else
+		{
+			if(touchedDown) break;
+			touching = false;
+			NDS_releaseTouch();
+		}
+		if(now > rec.time)
+		{
+			latency += now - rec.time;
+			latencyEvents++;
+		}
+	}
+	__atomic_store_n(&shared.readPos, pos, __ATOMIC_RELEASE);
+	if(latencyEvents)
+	{
+		__atomic_fetch_add(&latencyTotal, latency, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&latencyCount, latencyEvents, __ATOMIC_RELAXED);
+	}
+
+	//what didn't fit never got queued, but the state it left is there once the queue has caught up
+	const u32 dropped = __atomic_load_n(&shared.dropped, __ATOMIC_RELAXED);
+	if(pos == end && dropped != seenDropped)
+	{
+		seenDropped = dropped;
+		buttons = __atomic_load_n(&shared.latestButtons, __ATOMIC_RELAXED);
+		applyButtons(buttons);
+		const u32 touch = __atomic_load_n(&shared.latestTouch, __ATOMIC_RELAXED);
+		touching = (touch >> 31) != 0;
+		if(touching) applyTouch(touch);
+		else NDS_releaseTouch();
+	}
+}
+
+u32 InputQueue::takeLatency()
+{
+	//the two can be a frame apart, which is close enough for an average
+	const u64 total = __atomic_exchange_n(&latencyTotal, 0, __ATOMIC_RELAXED);
+	const u32 count = __atomic_exchange_n(&latencyCount, 0, __ATOMIC_RELAXED);
+	return count ? (u32)(total / count / 1000) : 0;
+}
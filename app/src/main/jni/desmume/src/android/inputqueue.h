@@ -0,0 +1,93 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _INPUTQUEUE_H
+#define _INPUTQUEUE_H
+
+#include "../types.h"
+
+//the buttons and touches on their way from the ui thread to the emulation thread, which applies them all at the
+//start of each frame instead of having them set from under it whenever they happen.
+//the memory is shared with java (InputQueue.java) as a direct buffer: java writes the events and the latest state
+//into it, and commit() publishes them. the emulation thread only moves the read position.
+//an event that comes and goes again within a frame (a tap, a quick press) is held for the frame it came in, and
+//whatever comes after it waits for the next frame, so that no game ever misses one.
+#define INPUT_QUEUE_SIZE 256
+
+enum
+{
+	INPUT_BUTTONS, //data is the buttons in NDS_setPad's order, from bit 0, with the lid closed as bit 13
+	INPUT_TOUCH, //data is x | y << 16
+	INPUT_RELEASE,
+};
+
+class InputQueue
+{
+public:
+	InputQueue();
+
+	void* buffer() { return &shared; }
+	u32 bufferSize() const { return sizeof(shared); }
+
+	//ui thread, with the events up to writePos written
+	void commit(u32 writePos) { __atomic_store_n(&shared.writePos, writePos, __ATOMIC_RELEASE); }
+
+	//emulation thread, before the frame's input is processed
+	void drain();
+	//emulation thread, true when there are events drain() has yet to take
+	bool pending() const { return __atomic_load_n(&shared.writePos, __ATOMIC_ACQUIRE) != shared.readPos; }
+	//microseconds from the events happening to the frames they got into, over what was drained since the last call.
+	//from any thread
+	u32 takeLatency();
+
+private:
+	enum { CACHE_LINE = 64 };
+
+	//the offsets are the ones InputQueue.java uses
+	struct Record
+	{
+		u64 time; //ns, on the clock of System.nanoTime() and frameprofile_now()
+		u32 type;
+		u32 data;
+	};
+	struct Shared
+	{
+		u32 readPos; //only the emulation thread moves it
+		u8 readPad[CACHE_LINE - sizeof(u32)];
+		u32 writePos; //only commit() moves it
+		u32 latestButtons; //what java last set, for catching up on what didn't fit in the queue
+		u32 latestTouch; //x | y << 16 | 1 << 31 while touching
+		u32 dropped; //how many events didn't fit
+		u8 writePad[CACHE_LINE - 4*sizeof(u32)];
+		Record records[INPUT_QUEUE_SIZE];
+	};
+
+	void applyButtons(u32 mask);
+	void applyTouch(u32 data);
+
+	DS_ALIGN(64) Shared shared;
+
+	u32 buttons;
+	bool touching;
+	u32 seenDropped;
+	u64 latencyTotal;
+	u32 latencyCount;
+};
+
+extern InputQueue inputQueue;
+
+#endif
@@ -18,8 +18,10 @@
 
 #include <jni.h>
 #include <errno.h>
+#include <zlib.h>
 
 #include <android/native_window_jni.h>
+#include <android/asset_manager_jni.h>
 
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
@@ -31,6 +33,7 @@
 
 #include "main.h"
 #include "../OGLES2Render.h"
+#include "../VulkanRender.h"
 #include "../rasterize.h"
 #include "../SPU.h"
 #include "../debug.h"
@@ -40,11 +43,26 @@
 #include "../slot1.h"
 #include "../slot2.h"
 #include "../saves.h"
+#include "../frameprofile.h"
+#include "../memusage.h"
+#include "../gamepreset.h"
 #include "throttle.h"
 #include "video.h"
+#include "framequeue.h"
 #include "OpenArchive.h"
 #include "sndopensl.h"
+#include "sndaaudio.h"
+#include "soundring.h"
+#include "frametimes.h"
+#include "settings.h"
+#include "inputqueue.h"
+#include "netplay.h"
+#include "runahead.h"
+#include "perfhint.h"
+#include "governor.h"
+#include "recorder.h"
 #include "cheatSystem.h"
+#include "../utils/task.h"
 
 #define JNI(X,...) Java_com_opendoorstudios_ds4droid_DeSmuME_##X(JNIEnv* env, jclass* clazz, __VA_ARGS__)
 #define JNI_NOARGS(X) Java_com_opendoorstudios_ds4droid_DeSmuME_##X(JNIEnv* env, jclass* clazz)
@@ -56,12 +74,15 @@ GPU3DInterface *core3DList[] = {
 	&gpu3DNull,
 	&gpu3Dgles2,
 	&gpu3DRasterize,
+	&gpu3DRasterizeFixed,
+	&gpu3Dvulkan,
 	NULL
 };
 
 SoundInterface_struct *SNDCoreList[] = {
 	&SNDDummy,
 	&SNDOpenSL,
+	&SNDAAudio,
 	NULL
 };
 
@@ -70,6 +91,8 @@ volatile bool paused = true;
 volatile BOOL pausedByMinimize = FALSE;
 bool autoframeskipenab=1;
 int frameskiprate=1;
+//frameskip from what the parts of each frame cost, instead of from the frame times alone
+static bool costframeskip = false;
 int lastskiprate=0;
 int emu_paused = 0;
 bool frameAdvance = false;
@@ -83,9 +106,23 @@ static int snd_synchmethod=0;
 AndroidBitmapInfo bitmapInfo;
 EGLSurface surface;
 EGLContext context;
+//the client version the 3d renderer's context was made with, which the surface's context asks for to share with it
+EGLint contextClientVersion = 0;
 const char* IniName = NULL;
 char androidTempPath[1024];
 extern bool enableMicrophone;
+extern int micBufferMs;
+// the zlib level the quick save and autosave slots are written with
+static int quickSaveCompression = Z_BEST_SPEED;
+//what loadSettings last read; the settings that only take effect later (on a reset, or in init) are read from here
+static NativeSettings settings;
+// for telling the java side from other threads
+static JavaVM* javaVM = NULL;
+static jclass deSmuMEClass = NULL;
+static jmethodID stateSavedMethod = NULL;
+//the apk's assets, which the vulkan renderer's shaders are in
+static jobject assetManagerRef = NULL;
+static AAssetManager *assetManager = NULL;
 
 #ifdef USE_PROFILER
 bool profiler_start = false;
@@ -101,11 +138,6 @@ const int mff_toMeasure = 600;
 #endif
 
 
-//triple buffering logic
-u16 displayBuffers[3][256*192*4];
-volatile int currDisplayBuffer=-1;
-volatile int newestDisplayBuffer=-2;
-
 struct HudStruct2
 {
 public:
@@ -120,6 +152,9 @@ public:
 		fps3d = 0;
 		cpuload[0] = cpuload[1] = 0;
 		cpuloopIterationCount = 0;
+		lineReuse = 0;
+		soundSilent = adpcmCached = 0;
+		skipped3d = 0;
 	}
 
 	void reset()
@@ -127,6 +162,10 @@ public:
 	}
 
 	int fps, fps3d, cpuload[2], cpuloopIterationCount;
+	int lineReuse; //percentage of 2d lines kept from the previous frame over the last second
+	int soundSilent; //percentage of channel samples that were at zero volume, and weren't mixed
+	int adpcmCached; //percentage of adpcm samples that didn't have to be decoded
+	int skipped3d; //3d frames over the last second that weren't rendered, being the same as the one before
 };
 
 HudStruct2 Hud;
@@ -150,13 +189,37 @@ struct MainLoopData
 VideoInfo video;
 
 void doBitmapDraw(u8* pixels, u8* dest, int width, int height, int stride, int pixelFormat, int verticalOffset, bool rotate);
+void convertScreen8888(u32* dest, const u16* src, int count);
+void convertScreen565(u16* dest, const u16* src, int count);
+bool doWindowDraw(const u16* screens, const ANativeWindow_Buffer& buffer, const int* rects, bool rotate);
+bool glDrawScreens(ANativeWindow* window, const u16* screens, const int* rects, bool rotate, int filter, const FrameQueue::Frame* composite, u32 seq);
+bool glDrawCanComposite();
+void glDrawRelease();
+void glDrawResetWindow();
+
+//the surface of the frontend's view, when it has asked for the emulated screens to be drawn into it directly
+static ANativeWindow* drawWindow = NULL;
+
+//how long nds4droid_core took for each frame, and the time between each new frame drawn and the one before it
+static FrameTimes emulationTimes, presentTimes;
+static u64 lastCoreNs = 0;
+
+//present the surface through GLES, which also runs the screen filters as shaders
+static bool gpuFilter = true;
 
 extern "C" {
 
 void logCallback(const Logger& logger, const char* message)
 {
 	if(message)
-		LOGI("%s", message);
+		CORELOG_INFO("%s", message);
+}
+
+//the core log's background thread writes it to logcat
+static void logcatSink(int level, const char* message)
+{
+	static const int priorities[] = { ANDROID_LOG_ERROR, ANDROID_LOG_WARN, ANDROID_LOG_INFO, ANDROID_LOG_DEBUG };
+	__android_log_write(priorities[level], APPNAME, message);
 }
 
 /**
@@ -180,8 +243,6 @@ static bool android_opengl_init() {
     EGLint w, h, format;
     EGLint numConfigs;
     EGLConfig config;
-    EGLSurface surface;
-    EGLContext context;
 
     EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
 
@@ -199,14 +260,34 @@ static bool android_opengl_init() {
 			EGL_NONE
     };
 	
+    //a renderer that was closed is done with the last ones
+    if (context != EGL_NO_CONTEXT)
+    {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+        eglDestroySurface(display, surface);
+    }
+
     surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
 
+	// Prefer a GLES3 context so the 3D renderer can read frames back through PBOs,
+	// but the renderer itself only needs GLES2.
+	const EGLint contextAttribs3[] = {
+			EGL_CONTEXT_CLIENT_VERSION, 3,
+			EGL_NONE
+    };
 	const EGLint contextAttribs[] = {
 			EGL_CONTEXT_CLIENT_VERSION, 2,
 			EGL_NONE
     };
 
-    context = eglCreateContext(display, config, NULL, contextAttribs);
+    contextClientVersion = 3;
+    context = eglCreateContext(display, config, NULL, contextAttribs3);
+    if (context == EGL_NO_CONTEXT)
+    {
+        contextClientVersion = 2;
+        context = eglCreateContext(display, config, NULL, contextAttribs);
+    }
 
     if (eglMakeCurrent(display, surface, surface, context) == EGL_FALSE) {
         LOGW("Unable to eglMakeCurrent\n");
@@ -217,6 +298,29 @@ static bool android_opengl_init() {
     return true;
 }
 
+//the build compiles app/src/main/shaders into the assets, as shaders/<name>.spv
+static bool android_vulkan_loadShader(const char *name, std::vector<u32> *outCode)
+{
+	if (assetManager == NULL)
+		return false;
+
+	const std::string assetName = std::string("shaders/") + name + ".spv";
+	AAsset *asset = AAssetManager_open(assetManager, assetName.c_str(), AASSET_MODE_BUFFER);
+	if (asset == NULL)
+		return false;
+
+	const off_t size = AAsset_getLength(asset);
+	bool loaded = false;
+	if (size > 0 && (size % sizeof(u32)) == 0)
+	{
+		outCode->resize(size / sizeof(u32));
+		loaded = AAsset_read(asset, &(*outCode)[0], size) == size;
+	}
+	AAsset_close(asset);
+
+	return loaded;
+}
+
 
 
 bool NDS_Pause(bool showMsg = true)
@@ -245,14 +349,26 @@ void NDS_UnPause(bool showMsg = true)
 	}
 }
 
-void nds4droid_display()
+// the sound setting is only on or off. on plays through aaudio where the device has it, for its lower latency,
+// and through opensl where it doesn't or the stream can't be opened
+static void changeSoundCore(int type)
 {
+	sndcoretype = type;
+	if(type == SNDCORE_OPENSL && SNDAAudioAvailable() && SPU_ChangeSoundCore(SNDCORE_AAUDIO, sndbuffersize) == 0)
+	{
+		sndcoretype = SNDCORE_AAUDIO;
+		return;
+	}
+	SPU_ChangeSoundCore(sndcoretype, sndbuffersize);
+}
 
-	if(int diff = (currDisplayBuffer+1)%3 - newestDisplayBuffer)
-		newestDisplayBuffer += diff;
-	else newestDisplayBuffer = (currDisplayBuffer+2)%3;
-
-	memcpy(displayBuffers[newestDisplayBuffer],GPU_screen,256*192*4);
+void nds4droid_display()
+{
+	//a frame that skipped its 2d still has the one before it in GPU_screen, which is on its way already
+	if(costframeskip && NDS_Skipped2DFrame())
+		return;
+	frameQueue.publish((const u16*)GPU_screen, GPU_CompositePending() ? &gpuComposite : NULL, MainScreen.offset ? 1 : 0,
+		GPU_screenNative, GPU_GetOutputFormat());
 }
 
 static void nds4droid_throttle(bool allowSleep = true, int forceFrameSkip = -1)
@@ -260,6 +376,18 @@ static void nds4droid_throttle(bool allowSleep = true, int forceFrameSkip = -1)
 	int skipRate = (forceFrameSkip < 0) ? frameskiprate : forceFrameSkip;
 	int ffSkipRate = (forceFrameSkip < 0) ? 9 : forceFrameSkip;
 
+	if(costframeskip && skipRate > 0 && forceFrameSkip < 0 && !FastForward && !frameAdvance && !continuousframeAdvancing)
+	{
+		if(FrameLimit && allowSleep)
+			SpeedThrottle();
+		switch(CostFrameSkip_NextFrame(lastCoreNs, skipRate))
+		{
+			case COSTFRAMESKIP_3D: NDS_SkipNext3DFrame(); break;
+			case COSTFRAMESKIP_ALL: NDS_SkipNextFrame(); break;
+		}
+		return;
+	}
+
 	if(lastskiprate != skipRate)
 	{
 		lastskiprate = skipRate;
@@ -360,6 +488,21 @@ void nds4droid_user()
 		mainLoopData.fps = mainLoopData.fpsframecount;
 		mainLoopData.fpsframecount = 0;
 		mainLoopData.fpsticks = GetTickCount();
+
+		const u32 reused = MainScreen.gpu->linesReused + SubScreen.gpu->linesReused;
+		const u32 total = reused + MainScreen.gpu->linesRendered + SubScreen.gpu->linesRendered;
+		Hud.lineReuse = total ? (int)((u64)reused * 100 / total) : 0;
+		MainScreen.gpu->linesReused = MainScreen.gpu->linesRendered = 0;
+		SubScreen.gpu->linesReused = SubScreen.gpu->linesRendered = 0;
+
+		const u32 channelSamples = spu_mixStats.samplesMixed + spu_mixStats.samplesSilent;
+		Hud.soundSilent = channelSamples ? (int)((u64)spu_mixStats.samplesSilent * 100 / channelSamples) : 0;
+		const u32 adpcmSamples = spu_mixStats.adpcmDecoded + spu_mixStats.adpcmCached;
+		Hud.adpcmCached = adpcmSamples ? (int)((u64)spu_mixStats.adpcmCached * 100 / adpcmSamples) : 0;
+		memset(&spu_mixStats, 0, sizeof(spu_mixStats));
+
+		Hud.skipped3d = gfx3d_unchangedFrames;
+		gfx3d_unchangedFrames = 0;
 	}
 
 	if(nds.idleFrameCounter==0 || oneSecond) 
@@ -396,11 +539,18 @@ void nds4droid_core()
 #ifdef MEASURE_FIRST_FRAMES
 	unsigned int start = GetTickCount();
 #endif
-	NDS_beginProcessingInput();
-	NDS_endProcessingInput();
-	NDS_exec<false>();
-	SPU_Emulate_user();
+	inputQueue.drain();
+	//the 3d can only be left on the gpu while the frames go out through a surface whose context shares the renderer's
+	CommonSettings.GFX3D_GPUComposite = settings.gpuComposite && gpu3D == &gpu3Dgles2 && glDrawCanComposite();
+	if(!netplay_frame() && (FastForward || !runahead_frame()))
+	{
+		NDS_beginProcessingInput();
+		NDS_endProcessingInput();
+		NDS_exec<false>();
+		SPU_Emulate_user();
+	}
     backup_setManualBackupType(0);
+	frameprofile_endframe();
 #ifdef MEASURE_FIRST_FRAMES
 	unsigned int end = GetTickCount();
 	if(mff_do)
@@ -422,7 +572,19 @@ void nds4droid_unpause()
 	NDS_UnPause();
 }
 
-bool doRomLoad(const char* path, const char* logical)
+//the frontend's fields of the game's preset, or the user's settings where it has none
+static void applyGamePreset()
+{
+	const GamePreset& preset = gamepreset_current();
+	frameskiprate = preset.has(GAMEPRESET_FRAMESKIP) ? preset.value[GAMEPRESET_FRAMESKIP] : settings.frameSkip;
+	int renderer = settings.renderer;
+	if(preset.has(GAMEPRESET_RENDERER) && preset.value[GAMEPRESET_RENDERER] < (int)ARRAY_SIZE(core3DList) - 1)
+		renderer = preset.value[GAMEPRESET_RENDERER];
+	if(renderer != cur3DCore)
+		NDS_3D_ChangeCore(renderer);
+}
+
+bool doRomLoad(const char* path, const char* logical, ROMStream* stream = NULL)
 {
 #ifdef USE_PROFILER
 	if(profiler_start && !profiler_end)
@@ -441,9 +603,15 @@ bool doRomLoad(const char* path, const char* logical)
 	}
 #endif
 	NDS_Pause(false);
+	gameInfo.stream = stream;
 	if(NDS_LoadROM(path, logical) >= 0)
 	{
 		INFO("Loading %s was successful\n",path);
+		applyGamePreset();
+		frameQueue.resetCounters();
+		emulationTimes.reset();
+		presentTimes.reset();
+		CostFrameSkip_Reset();
 		nds4droid_unpause();
 		if (autoframeskipenab && frameskiprate) AutoFrameSkip_IgnorePreviousDelay();
 		return true;
@@ -457,79 +625,223 @@ bool nds4droid_loadrom(const char* path)
 
 	const char* s_nonRomExtensions [] = {"txt", "nfo", "htm", "html", "jpg", "jpeg", "png", "bmp", "gif", "mp3", "wav", "lnk", "exe", "bat", "gmv", "gm2", "lua", "luasav", "sav", "srm", "brm", "cfg", "wch", "gs*", "dst"};
 
-	if(!ObtainFile(path, LogicalName, PhysicalName, "rom", s_nonRomExtensions, ARRAY_SIZE(s_nonRomExtensions)))
+	ROMStream* stream;
+	if(!ObtainFile(path, LogicalName, PhysicalName, "rom", s_nonRomExtensions, ARRAY_SIZE(s_nonRomExtensions), &stream))
 		return false;
 		
-	return doRomLoad(path, PhysicalName);
+	return doRomLoad(path, PhysicalName, stream);
 }
 
-jint JNI(draw, jobject bitmapMain, jobject bitmapTouch, jboolean rotate)
+static u32 lastDrawnSeq = 0;
+//the frame takeNewestDisplayBuffer took, for what it has besides the pixels
+static const FrameQueue::Frame* displayFrame = NULL;
+
+//the step the quality governor has the emulation at, and the screen filter chosen, which the step can turn off
+static int qualityStep = QUALITY_FULL;
+static volatile int wantedFilter = 0;
+static volatile bool filterOff = false;
+
+//what the settings ask for, less what the step takes away
+static void applyQuality()
 {
-	int todo;
-	bool alreadyDisplayed;
+	CommonSettings.GFX3D_SoftRastScale = qualityStep >= QUALITY_NATIVE_3D ? 1 : settings.softRastScale + 1;
+	CommonSettings.GFX3D_SoftRastCores = qualityStep >= QUALITY_FEWER_CORES ? std::max(1, CommonSettings.num_cores / 2) : 0;
+	filterOff = qualityStep >= QUALITY_NO_FILTER;
+}
 
+//cpuFilter for when the filter runs on the cpu, into a buffer the memory budget may not have room for
+static void takeNewestDisplayBuffer(bool cpuFilter)
+{
+	//the filter's buffers belong to the drawing, so it is the one that changes it
+	int filter = filterOff ? VideoInfo::NONE : wantedFilter;
+	if(cpuFilter && VideoInfo::filteredBytes(filter) > memusage_budget().filterBytes)
+		filter = VideoInfo::NONE;
+	if(video.currentfilter != filter)
+		video.setfilter(filter);
+
+	//keeps showing the previous frame when the emulation has not finished a new one
+	const FrameQueue::Frame& frame = frameQueue.acquire();
+	video.srcBuffer = (u8*)frame.pixels;
+	displayFrame = &frame;
+	if(frame.seq != lastDrawnSeq)
 	{
-		//find a buffer to display
-		todo = newestDisplayBuffer;
-		alreadyDisplayed = (todo == currDisplayBuffer);
-
-		//something new to display:
-		if(!alreadyDisplayed) {
-			//start displaying a new buffer
-			currDisplayBuffer = todo;
-			video.srcBuffer = (u8*)displayBuffers[currDisplayBuffer];
-		}
+		lastDrawnSeq = frame.seq;
+		presentTimes.mark(FrameQueue::now());
 	}
+}
+
+//the core's output format that the bitmaps take
+static GPUOutputFormat bitmapOutputFormat()
+{
+	if(bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGBA_8888)
+		return GPU_OUTPUT_RGBA8888;
+	if(bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGB_565)
+		return GPU_OUTPUT_RGB565;
+	return GPU_OUTPUT_RGB555;
+}
+
+static jint hudData()
+{
+	return ((Hud.fps & 0xFF)<<24)|((Hud.fps3d & 0xFF)<<16)|((Hud.cpuload[0] & 0xFF)<<8)|((Hud.cpuload[1] & 0xFF));
+}
+
+jint JNI(draw, jobject bitmapMain, jobject bitmapTouch, jboolean rotate)
+{
+	PROFILE_ZONE(PROFILE_DRAW);
+
+	takeNewestDisplayBuffer(true);
 
 	//convert pixel format to 32bpp for compositing
 	//why do we do this over and over? well, we are compositing to
 	//filteredbuffer32bpp, and it needs to get refreshed each frame..
-	const int size = video.size();
-	//const int size = 256*384;
+	//the two screens; the filters make the rest. when the core made the frame in the bitmap's format already, it is
+	//drawn from as it is, or copied for the filter
+	const int size = 256*384;
 	u16* src = (u16*)video.srcBuffer;
-	if(bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGBA_8888)
+	const u8* drawSrc = NULL;
+	if(displayFrame->nativeFormat != GPU_OUTPUT_RGB555 && displayFrame->nativeFormat == bitmapOutputFormat())
 	{
-		u32* dest = video.buffer;
-		for(int i=0;i<size;++i)
-			*dest++ = (u32) (0xFF000000ul | RGB15TO32_NOALPHA(*src++));
+		if(video.currentfilter == VideoInfo::NONE)
+			drawSrc = (const u8*)displayFrame->native;
+		else
+		{
+			memcpy(video.buffer, displayFrame->native, displayFrame->nativeFormat == GPU_OUTPUT_RGBA8888 ? size*4 : size*2);
+			video.filter();
+		}
+	}
+	else if(bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGBA_8888)
+	{
+		convertScreen8888(video.buffer, src, size);
 
 		video.filter();
 	}
 	else if(bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGB_565)
 	{
-		u16* dest = (u16 *) video.buffer;
-		for(int i=0;i<size;++i)
-			*dest++ = RGB15TO16_REVERSE(*src++);
+		convertScreen565((u16*)video.buffer, src, size);
 
 		video.filter();
 	}
+	if(!drawSrc)
+		drawSrc = (const u8*)video.finalBuffer();
 
 	//here the magic happens
 	void* pixels = NULL;
 	//LOGI("width = %i, height = %i", bitmapInfo.width, bitmapInfo.height);
 	if(AndroidBitmap_lockPixels(env,bitmapMain,&pixels) >= 0)
 	{
-		doBitmapDraw((u8*)video.finalBuffer(), (u8*)pixels, bitmapInfo.width, bitmapInfo.height, bitmapInfo.stride, bitmapInfo.format, 0, rotate == JNI_TRUE);
+		doBitmapDraw((u8*)drawSrc, (u8*)pixels, bitmapInfo.width, bitmapInfo.height, bitmapInfo.stride, bitmapInfo.format, 0, rotate == JNI_TRUE);
 		AndroidBitmap_unlockPixels(env, bitmapMain);
 	}
 	if(AndroidBitmap_lockPixels(env,bitmapTouch,&pixels) >= 0)
 	{
-		doBitmapDraw((u8*)video.finalBuffer(), (u8*)pixels, bitmapInfo.width, bitmapInfo.height, bitmapInfo.stride, bitmapInfo.format, video.height / 2, rotate == JNI_TRUE);
+		doBitmapDraw((u8*)drawSrc, (u8*)pixels, bitmapInfo.width, bitmapInfo.height, bitmapInfo.stride, bitmapInfo.format, video.height / 2, rotate == JNI_TRUE);
 		AndroidBitmap_unlockPixels(env, bitmapTouch);
 	}
 
-	return ((Hud.fps & 0xFF)<<24)|((Hud.fps3d & 0xFF)<<16)|((Hud.cpuload[0] & 0xFF)<<8)|((Hud.cpuload[1] & 0xFF));
+	return hudData();
+}
+
+void JNI(setDrawSurface, jobject surface)
+{
+	glDrawResetWindow();
+	if(drawWindow)
+		ANativeWindow_release(drawWindow);
+	drawWindow = surface ? ANativeWindow_fromSurface(env, surface) : NULL;
+	//the surface is drawn from RGB555 (by GLES or doWindowDraw), the bitmaps from their own format
+	GPU_SetOutputFormat(drawWindow ? GPU_OUTPUT_RGB555 : bitmapOutputFormat());
+}
+
+//draws both screens into the surface given to setDrawSurface, skipping the intermediate buffers of draw().
+//rects are the destination rects of the main and touch screens. returns -1 when the caller has to use draw() instead
+jint JNI(drawSurface, jintArray rects, jboolean rotate)
+{
+	if(!drawWindow)
+		return -1;
+
+	PROFILE_ZONE(PROFILE_DRAW);
+
+	jint dest[8];
+	env->GetIntArrayRegion(rects, 0, 8, dest);
+
+	takeNewestDisplayBuffer(false);
+
+	//the recording is drawn from the GLES presentation, so that is used while recording even without a gpu filter
+	if((gpuFilter || recorder_recording()) && glDrawScreens(drawWindow, (u16*)video.srcBuffer, (const int*)dest, rotate == JNI_TRUE, video.currentfilter,
+		displayFrame->composite ? displayFrame : NULL, displayFrame->seq))
+		return hudData();
+	glDrawRelease();
+
+	//the CPU filters work on their own sized buffers; those still go through the bitmaps
+	if(video.currentfilter != VideoInfo::NONE)
+		return -1;
+
+	ANativeWindow_Buffer buffer;
+	if(ANativeWindow_lock(drawWindow, &buffer, NULL) < 0)
+		return -1;
+	const bool drawn = doWindowDraw((u16*)video.srcBuffer, buffer, (const int*)dest, rotate == JNI_TRUE);
+	ANativeWindow_unlockAndPost(drawWindow);
+
+	return drawn ? hudData() : -1;
 }
 
 void JNI(resize, jobject bitmap)
 {
 	AndroidBitmap_getInfo(env, bitmap, &bitmapInfo);
+	if(!drawWindow)
+		GPU_SetOutputFormat(bitmapOutputFormat());
 	if(bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGBA_8888)
 		LOGI("bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGBA_8888");
 	else if(bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGB_565)
 		LOGI("bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGB_565");
 }
 
+// the per frame zone timings, PROFILE_ZONE_COUNT microsecond values for each frame, oldest first.
+// returns how many frames were written
+jint JNI(getProfile, jintArray out)
+{
+	static u32 frames[PROFILE_FRAMES * PROFILE_ZONE_COUNT];
+	const int count = frameprofile_getframes(frames, env->GetArrayLength(out) / PROFILE_ZONE_COUNT);
+	env->SetIntArrayRegion(out, 0, count * PROFILE_ZONE_COUNT, (const jint*)frames);
+	return count;
+}
+
+// writes the profile next to the saves, and returns where it went
+jstring JNI_NOARGS(dumpProfile)
+{
+	const std::string base = std::string(PathInfo::pathToModule) + "/profile";
+	if(!frameprofile_dump((base + ".csv").c_str(), (base + ".json").c_str()))
+		return NULL;
+	return env->NewStringUTF(base.c_str());
+}
+
+static void frontendMemoryUsage(std::vector<MemUsage>& out)
+{
+	MemUsage filters = { "filters", video.filterMemory() };
+	MemUsage screens = { "screen buffers", sizeof(video.buffer) + sizeof(frameQueue) };
+	out.push_back(filters);
+	out.push_back(screens);
+}
+
+// what the big allocations hold, a line each
+jstring JNI_NOARGS(getMemoryUsage)
+{
+	std::vector<MemUsage> usage;
+	memusage_report(usage);
+	std::string report;
+	u64 total = 0;
+	for(size_t i = 0; i < usage.size(); i++)
+	{
+		char line[96];
+		snprintf(line, sizeof(line), "%s: %u KB\n", usage[i].name, (u32)(usage[i].bytes >> 10));
+		report += line;
+		total += usage[i].bytes;
+	}
+	char line[96];
+	snprintf(line, sizeof(line), "total: %u KB", (u32)(total >> 10));
+	report += line;
+	return env->NewStringUTF(report.c_str());
+}
+
 int JNI_NOARGS(getNativeWidth)
 {
 	return video.width;
@@ -540,24 +852,324 @@ int JNI_NOARGS(getNativeHeight)
 	return video.height;
 }
 
+jint JNI_NOARGS(getLineReuse)
+{
+	return Hud.lineReuse;
+}
+
+jint JNI_NOARGS(getSoundSilent)
+{
+	return Hud.soundSilent;
+}
+
+jint JNI_NOARGS(getAdpcmCached)
+{
+	return Hud.adpcmCached;
+}
+
+jint JNI_NOARGS(getSkipped3D)
+{
+	return Hud.skipped3d;
+}
+
+// p50, p95, p99 and worst in microseconds, frames over budget and frames counted; for the emulation and then for
+// the presented frames
+jint JNI(getFrameTimes, jintArray out)
+{
+	FrameTimes::Stats stats[2];
+	emulationTimes.get(stats[0]);
+	presentTimes.get(stats[1]);
+	env->SetIntArrayRegion(out, 0, sizeof(stats) / sizeof(u32), (const jint*)stats);
+	return stats[0].frames;
+}
+
+void JNI_NOARGS(resetFrameTimes)
+{
+	emulationTimes.reset();
+	presentTimes.reset();
+}
+
+jboolean JNI(waitForFrame, int timeoutMs)
+{
+	return frameQueue.waitForFrame(timeoutMs) ? JNI_TRUE : JNI_FALSE;
+}
+
+jint JNI_NOARGS(getDroppedFrames)
+{
+	return frameQueue.droppedFrames();
+}
+
+jint JNI_NOARGS(getRepeatedFrames)
+{
+	return frameQueue.repeatedFrames();
+}
+
+jint JNI_NOARGS(getSoundUnderruns)
+{
+	return soundRing.underrunCount();
+}
+
+jint JNI_NOARGS(getSoundOverruns)
+{
+	return soundRing.overrunCount();
+}
+
 void JNI(setFilter, int index)
 {
-	video.setfilter(index);
+	wantedFilter = index;
+	video.setfilter(filterOff ? VideoInfo::NONE : index);
+}
+
+
+//turbo: as many frames as the device can run, with only one of them drawn and shown every kTurboPresentNs, and no
+//sound mixed at all
+static const u64 kTurboPresentNs = 1000000000ULL / 30;
+static bool turbo = false;
+static int turboFrames = 4; //frames to each one shown, made to fill the time between them
+
+static void endTurbo()
+{
+	if(!turbo)
+		return;
+	turbo = false;
+	SPU_SetUnheard(false);
+	SPU_CloneUser();
+}
+
+static void runTurbo()
+{
+	const u64 start = FrameQueue::now();
+	if(!turbo)
+	{
+		turbo = true;
+		SPU_SetUnheard(true);
+	}
+
+	//the 2d of a frame shows the 3d of the one before it, so the frame before the shown one is the one to render its
+	//3d. a frame with a display capture going is rendered too, since the game can read back what it captures
+	for(int i = 0; i < turboFrames; i++)
+	{
+		inputQueue.drain();
+		NDS_beginProcessingInput();
+		NDS_endProcessingInput();
+		const bool capturing = MainScreen.gpu->dispCapCnt.enabled || (MainScreen.gpu->dispCapCnt.val & 0x80000000);
+		if(i != turboFrames - 2 && !capturing)
+			NDS_SkipNextFrame();
+		NDS_exec<false>();
+		backup_setManualBackupType(0);
+		frameprofile_endframe();
+		nds4droid_throttle(false, 0);
+	}
+	nds4droid_user();
+
+	const u64 ns = std::max<u64>(FrameQueue::now() - start, 1);
+	emulationTimes.add(ns / turboFrames);
+	perfhint_frame(ns / turboFrames);
+	turboFrames = (int)std::max<u64>(2, std::min<u64>(std::min<u64>(turboFrames * kTurboPresentNs / ns, turboFrames * 2), 120));
+}
+
+static void runCore()
+{
+	endTurbo();
+	//every other frame's 3d, unless the frontend's frame skip has something for it already
+	static bool oddFrame = false;
+	oddFrame = !oddFrame;
+	bool with2D;
+	if(qualityStep >= QUALITY_SKIP_3D && oddFrame && !NDS_SkipRequested(with2D))
+		NDS_SkipNext3DFrame();
+	const u64 start = FrameQueue::now();
+	nds4droid_core();
+	lastCoreNs = FrameQueue::now() - start;
+	emulationTimes.add(lastCoreNs);
+	perfhint_frame(lastCoreNs);
+	nds4droid_user();
+
+	const int step = governor_frame(lastCoreNs);
+	if(step != qualityStep)
+	{
+		qualityStep = step;
+		applyQuality();
+	}
 }
 
+//the emulation thread, made in init. it runs frames while java has it running, each with frameLock held, and paces
+//them itself. java's own thread only starts and stops it, and takes frameLock for what it does between two frames
+static pthread_t loopThread;
+static pthread_mutex_t frameLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static pthread_mutex_t loopMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loopCond = PTHREAD_COND_INITIALIZER;
+static bool loopRunning = false;
+static volatile int frameLockWaiters = 0; //java threads waiting on frameLock, which the loop lets in first
+static int javaLockDepth = 0; //java's locks of frameLock, which can nest
+static volatile bool fastForward = false;
+static volatile bool fastForwardTurbo = false;
+
+//the 3d renderer's context goes with frameLock: it is current on the thread holding it for a frame, or on java's
+//while it does what it does between frames
+static void bindRenderContext()
+{
+	if(context != EGL_NO_CONTEXT && eglGetCurrentContext() != context)
+		eglMakeCurrent(eglGetDisplay(EGL_DEFAULT_DISPLAY), surface, surface, context);
+}
 
-void JNI_NOARGS(runCore)
+static void releaseRenderContext()
 {
+	if(context != EGL_NO_CONTEXT && eglGetCurrentContext() == context)
+		eglMakeCurrent(eglGetDisplay(EGL_DEFAULT_DISPLAY), EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+//a sleeping ds runs nothing until an irq it has enabled comes, and with the scheduler stopped only the input (a key
+//or the lid) or what java does between frames can raise one. so instead of going round at the frame rate the loop
+//waits for input, at most SLEEP_WAIT_MS at a time, with nothing published for drawing and the sound output paused
+static const int SLEEP_WAIT_MS = 100;
+static volatile bool loopAsleep = false;
+static bool soundHeldForSleep = false;
+
+static void setSoundOutputPaused(bool set)
+{
+	if(sndcoretype == SNDCORE_OPENSL)
+		SNDOpenSLPaused(set);
+	else if(sndcoretype == SNDCORE_AAUDIO)
+		SNDAAudioPaused(set);
+}
+
+static void runAsleep()
+{
+	endTurbo();
 	nds4droid_core();
+	if(nds.sleeping)
+	{
+		if(!soundHeldForSleep)
+			setSoundOutputPaused(true);
+		soundHeldForSleep = true;
+		return;
+	}
+
+	//woken: the time asleep is no frame the throttle or the frame skip should make up for
+	if(soundHeldForSleep)
+		setSoundOutputPaused(false);
+	soundHeldForSleep = false;
+	if(autoframeskipenab && frameskiprate)
+		AutoFrameSkip_IgnorePreviousDelay();
 	nds4droid_user();
-	nds4droid_throttle();
+}
+
+static void waitAsleep()
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += SLEEP_WAIT_MS * 1000000;
+	if(deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&loopMutex);
+	__atomic_store_n(&loopAsleep, true, __ATOMIC_SEQ_CST);
+	//commitInput signals once it sees loopAsleep, so an event either shows here or wakes the wait
+	while(loopRunning && !inputQueue.pending() && !__atomic_load_n(&frameLockWaiters, __ATOMIC_ACQUIRE))
+		if(pthread_cond_timedwait(&loopCond, &loopMutex, &deadline) == ETIMEDOUT)
+			break;
+	__atomic_store_n(&loopAsleep, false, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&loopMutex);
+}
+
+static void* emulationLoop(void*)
+{
+	placeCurrentThread(THREAD_ROLE_EMULATION);
+	for(;;)
+	{
+		pthread_mutex_lock(&loopMutex);
+		while(!loopRunning)
+			pthread_cond_wait(&loopCond, &loopMutex);
+		pthread_mutex_unlock(&loopMutex);
+
+		while(__atomic_load_n(&frameLockWaiters, __ATOMIC_ACQUIRE))
+			usleep(100);
+
+		pthread_mutex_lock(&frameLock);
+		//it may have been stopped while waiting for the lock
+		const bool running = __atomic_load_n(&loopRunning, __ATOMIC_ACQUIRE);
+		//netplay goes at the pace of the other side
+		const bool useTurbo = fastForward && fastForwardTurbo && netplay_status() != NETPLAY_CONNECTED;
+		//netplay keeps the frames going, since the other side waits on them
+		const bool asleep = running && nds.sleeping && netplay_status() != NETPLAY_CONNECTED;
+		if(running)
+		{
+			bindRenderContext();
+			if(asleep) runAsleep();
+			else if(useTurbo) runTurbo();
+			else runCore();
+		}
+		if(!running || __atomic_load_n(&frameLockWaiters, __ATOMIC_ACQUIRE))
+			releaseRenderContext();
+		pthread_mutex_unlock(&frameLock);
+
+		//the wait for the next frame leaves the lock to java
+		if(asleep && nds.sleeping)
+			waitAsleep();
+		else if(running && !useTurbo)
+			nds4droid_throttle();
+	}
+	return NULL;
+}
+
+static void startEmulationLoop()
+{
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if(pthread_create(&loopThread, &attr, emulationLoop, NULL) != 0)
+		LOGW("Couldn't start the emulation thread");
+	pthread_attr_destroy(&attr);
+}
+
+void JNI(setRunning, jboolean run)
+{
+	pthread_mutex_lock(&loopMutex);
+	__atomic_store_n(&loopRunning, run == JNI_TRUE, __ATOMIC_RELEASE);
+	pthread_cond_signal(&loopCond);
+	pthread_mutex_unlock(&loopMutex);
+}
+
+void JNI(setFastForward, jboolean enable, jboolean turbo)
+{
+	fastForwardTurbo = turbo == JNI_TRUE;
+	fastForward = enable == JNI_TRUE;
+	FastForward = fastForward && !fastForwardTurbo;
+}
+
+// ComponentCallbacks2.onTrimMemory's level. from the ui thread, which draws too, with the frame lock held
+void JNI(trimMemory, jint level)
+{
+	memusage_trim(level);
+	//nothing is drawn while the app can't be seen, and the next draw makes the filter's buffers again
+	if(level >= TRIM_UI_HIDDEN)
+		video.releaseFiltered();
+}
+
+void JNI_NOARGS(lockFrame)
+{
+	__atomic_fetch_add(&frameLockWaiters, 1, __ATOMIC_ACQ_REL);
+	pthread_mutex_lock(&frameLock);
+	__atomic_fetch_sub(&frameLockWaiters, 1, __ATOMIC_ACQ_REL);
+	if(javaLockDepth++ == 0)
+		bindRenderContext();
+}
+
+void JNI_NOARGS(unlockFrame)
+{
+	if(--javaLockDepth == 0)
+		releaseRenderContext();
+	pthread_mutex_unlock(&frameLock);
 }
 
 void JNI(setSoundPaused, int set)
 {
-	if(sndcoretype != 1)
-		return;
-	SNDOpenSLPaused(set == 0 ? false : true);
+	setSoundOutputPaused(set == 0 ? false : true);
+	//what java sets wins; a ds still asleep pauses it again on its next turn round the loop
+	soundHeldForSleep = false;
 }
 
 int JNI_NOARGS(runOther)
@@ -573,9 +1185,26 @@ int JNI_NOARGS(runOther)
 	return 1;
 }
 
+// called from the thread that writes the state
+static void stateSaved(int slot, bool ok)
+{
+	JNIEnv* env;
+	if(!stateSavedMethod || javaVM->AttachCurrentThread(&env, NULL) != JNI_OK)
+		return;
+	env->CallStaticVoidMethod(deSmuMEClass, stateSavedMethod, slot, ok ? JNI_TRUE : JNI_FALSE);
+	javaVM->DetachCurrentThread();
+}
+
 void JNI(saveState, int slot)
 {
-	savestate_slot(slot);
+	// the state is compressed and written off the emulation thread, and java hears about it when it is done
+	const bool quick = slot == 0 || slot == 10;
+	savestate_slot(slot, quick ? quickSaveCompression : Z_DEFAULT_COMPRESSION, stateSaved);
+}
+
+void JNI_NOARGS(flushBackup)
+{
+	MMU_new.backupDevice.flushBackup();
 }
 
 void JNI(restoreState, int slot)
@@ -590,63 +1219,111 @@ void JNI(restoreState, int slot)
 
 void loadSettings(JNIEnv* env)
 {
+	settings_load(env, settings);
+
 	CommonSettings.num_cores = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN ));
 	LOGI("%i cores detected", CommonSettings.num_cores); 
-	CommonSettings.cheatsDisable = GetPrivateProfileBool(env,"General", "cheatsDisable", false, IniName);
-	CommonSettings.autodetectBackupMethod = GetPrivateProfileInt(env,"General", "autoDetectMethod", 0, IniName);
-	enableMicrophone = GetPrivateProfileBool(env, "General", "EnableMicrophone", true, IniName);
+	// system, big cores, or the emulation pinned to the fastest one. when placed, the rasterizer splits its
+	// frames over the big cores only, so that none of its parts waits on a little one
+	setCorePlacement((CorePlacement)std::min((unsigned)settings.corePlacement, 2u));
+	if(getCorePlacement() != CORE_PLACEMENT_SYSTEM && getBigCores() > 1)
+	{
+		CommonSettings.num_cores = getBigCores();
+		LOGI("%i big cores", CommonSettings.num_cores);
+	}
+	CommonSettings.cheatsDisable = settings.cheatsDisable;
+	CommonSettings.autodetectBackupMethod = settings.autoDetectMethod;
+	enableMicrophone = settings.enableMicrophone;
+	micBufferMs = settings.micBuffer;
 
 	// This is the video settings
-	video.rotation =  GetPrivateProfileInt(env,"Video","WindowRotate", 0, IniName);
-	video.rotation_userset =  GetPrivateProfileInt(env,"Video","WindowRotateSet", video.rotation, IniName);
-	video.layout_old = video.layout = GetPrivateProfileInt(env,"Video", "LCDsLayout", 0, IniName);
-	video.swap = GetPrivateProfileInt(env,"Video", "LCDsSwap", 0, IniName);
+	video.rotation =  settings.windowRotate;
+	video.rotation_userset =  settings.windowRotateSet >= 0 ? settings.windowRotateSet : video.rotation;
+	video.layout_old = video.layout = settings.lcdsLayout;
+	video.swap = settings.lcdsSwap;
 
 	// This is for the HUD
-	CommonSettings.hud.FpsDisplay = GetPrivateProfileBool(env,"Display","DisplayFps", true, IniName);
-	CommonSettings.hud.FrameCounterDisplay = GetPrivateProfileBool(env,"Display","FrameCounter", false, IniName);
-	CommonSettings.hud.ShowInputDisplay = GetPrivateProfileBool(env,"Display","DisplayInput", false, IniName);
-	CommonSettings.hud.ShowGraphicalInputDisplay = GetPrivateProfileBool(env,"Display","DisplayGraphicalInput", false, IniName);
-	CommonSettings.hud.ShowLagFrameCounter = GetPrivateProfileBool(env,"Display","DisplayLagCounter", false, IniName);
-	CommonSettings.hud.ShowMicrophone = GetPrivateProfileBool(env,"Display","DisplayMicrophone", false, IniName);
-	CommonSettings.hud.ShowRTC = GetPrivateProfileBool(env,"Display","DisplayRTC", false, IniName);
-	video.screengap = GetPrivateProfileInt(env,"Display", "ScreenGap", 0, IniName);
-	CommonSettings.showGpu.main = GetPrivateProfileInt(env,"Display", "MainGpu", 1, IniName) != 0;
-	CommonSettings.showGpu.sub = GetPrivateProfileInt(env,"Display", "SubGpu", 1, IniName) != 0;
-	frameskiprate = GetPrivateProfileInt(env,"Display", "FrameSkip", 1, IniName);
+	CommonSettings.hud.FpsDisplay = settings.displayFps;
+	CommonSettings.hud.FrameCounterDisplay = settings.frameCounter;
+	frameprofile_enable(settings.profiler);
+	frameprofile_enableTrace(settings.systemTrace);
+	CommonSettings.hud.ShowInputDisplay = settings.displayInput;
+	CommonSettings.hud.ShowGraphicalInputDisplay = settings.displayGraphicalInput;
+	CommonSettings.hud.ShowLagFrameCounter = settings.displayLagCounter;
+	CommonSettings.hud.ShowMicrophone = settings.displayMicrophone;
+	CommonSettings.hud.ShowRTC = settings.displayRTC;
+	video.screengap = settings.screenGap;
+	CommonSettings.showGpu.main = settings.mainGpu;
+	CommonSettings.showGpu.sub = settings.subGpu;
+	frameskiprate = settings.frameSkip;
+	const bool costSkip = settings.costFrameSkip;
+	if(costSkip != costframeskip)
+		CostFrameSkip_Reset();
+	costframeskip = costSkip;
+	//the frame totals of the profiler are what it goes by
+	frameprofile_enableCosts(costframeskip);
 
 	// This is the microphone
-	CommonSettings.micMode = (TCommonSettings::MicMode)GetPrivateProfileInt(env,"MicSettings", "MicMode", (int)TCommonSettings::InternalNoise, IniName);
+	CommonSettings.micMode = (TCommonSettings::MicMode)settings.micMode;
 
     // This is for the sound.
-	CommonSettings.spu_advanced = GetPrivateProfileBool(env,"Sound", "SpuAdvanced", false, IniName);
+	CommonSettings.spu_advanced = settings.spuAdvanced;
 	// 0 for no Interpolation, 1 for Sine, 2 for Cosine.
-	CommonSettings.spuInterpolationMode = (SPUInterpolationMode)GetPrivateProfileInt(env, "Sound","SPUInterpolation", 1, IniName);
-	snd_synchmode = GetPrivateProfileInt(env, "Sound","SynchMode",0,IniName);
-	snd_synchmethod = GetPrivateProfileInt(env, "Sound","SynchMethod",0,IniName);
-	sndcoretype = GetPrivateProfileBool(env, "Sound","SoundCore", true, IniName);
+	CommonSettings.spuInterpolationMode = (SPUInterpolationMode)settings.spuInterpolation;
+	snd_synchmode = settings.synchMode;
+	snd_synchmethod = settings.synchMethod;
+	SPU_SetUserThread(settings.audioThread);
+	sndcoretype = settings.soundCore;
 	// The original was 8/60. By decreasing the buffer sample rate, we seem to be getting much better sound.
-	sndbuffersize = GetPrivateProfileInt(env, "Sound","SoundBufferSize", DESMUME_SAMPLE_RATE*8/120, IniName);
-
-	// This is for JIT. It only works on x86 and x86_64 devices right now.
-	CommonSettings.advanced_timing = GetPrivateProfileBool(env,"Emulation", "AdvancedTiming", false, IniName);
-	CommonSettings.use_jit = GetPrivateProfileBool(env, "Emulation","CpuMode", 0, IniName);
-	CommonSettings.jit_max_block_size = GetPrivateProfileInt(env, "Emulation", "JitSize", 10, IniName);
+	sndbuffersize = settings.soundBufferSize >= 0 ? settings.soundBufferSize : DESMUME_SAMPLE_RATE*8/120;
+
+	// This is for JIT, which every ABI is built with now.
+	CommonSettings.advanced_timing = settings.advancedTiming;
+	CommonSettings.use_jit = settings.cpuMode;
+	CommonSettings.jit_max_block_size = settings.jitSize;
+	CommonSettings.jit_cache_size = std::min(8u << settings.jitCacheSize, memusage_budget().jitCacheMB);
+	// 0 keeps the cpus in lockstep, then 128, 512 or 2048 cycles
+	int cpuSkew = settings.cpuSkew;
+	CommonSettings.cpu_skew = cpuSkew > 0 ? 32 << (2*std::min(cpuSkew, 3)) : 0;
+	CommonSettings.hle_sdk = settings.sdkHle;
+	CommonSettings.game_presets = settings.gamePresets;
 
 	// This is the Graphics settings
-	CommonSettings.GFX3D_Zelda_Shadow_Depth_Hack = GetPrivateProfileInt(env,"3D", "ZeldaShadowDepthHack", 0, IniName);
-	CommonSettings.GFX3D_HighResolutionInterpolateColor = GetPrivateProfileBool(env, "3D", "HighResolutionInterpolateColor", 0, IniName);
-	CommonSettings.GFX3D_EdgeMark = GetPrivateProfileBool(env, "3D", "EnableEdgeMark", 0, IniName);
-	CommonSettings.GFX3D_Fog = GetPrivateProfileBool(env, "3D", "EnableFog", 1, IniName);
-	CommonSettings.GFX3D_Texture = GetPrivateProfileBool(env, "3D", "EnableTexture", 1, IniName);
-	CommonSettings.GFX3D_LineHack = GetPrivateProfileBool(env, "3D", "EnableLineHack", 0, IniName);
-	CommonSettings.GFX3D_TXTHack = GetPrivateProfileBool(env, "3D", "EnableTXTHack", 0, IniName);
-	fw_config.language = GetPrivateProfileInt(env, "Firmware","Language", 1, IniName);
+	CommonSettings.GFX3D_Zelda_Shadow_Depth_Hack = settings.zeldaShadowDepthHack;
+	CommonSettings.GFX3D_HighResolutionInterpolateColor = settings.highResInterpolate;
+	CommonSettings.GFX3D_EdgeMark = settings.edgeMark;
+	CommonSettings.GFX3D_Fog = settings.fog;
+	CommonSettings.GFX3D_Texture = settings.texture;
+	CommonSettings.GFX3D_LineHack = settings.lineHack;
+	CommonSettings.GFX3D_TXTHack = settings.txtHack;
+	CommonSettings.GFX3D_PipelinedRender = settings.pipelinedRender;
+	CommonSettings.GFX3D_TexCacheDisk = settings.persistentTexCache;
+	CommonSettings.GFX2D_ParallelEngines = settings.parallelGPU2D;
+	CommonSettings.GFX3D_ThreadedGeometry = settings.threadedGeometry;
+	governor_setLowest(settings.qualityGovernor);
+	applyQuality();
+	runahead_setFrames(settings.runAhead);
+	gpuFilter = settings.gpuFilter;
+	frameQueue.setPacing(settings.vsyncPacing);
+	SpeedThrottle_SetDisplayPacing(settings.displayPacing,
+		settings.displayLockAudio);
+	fw_config.language = settings.language;
+	// off, then 512 MB, 1, 2 or 4 GB of roms extracted from archives
+	int romCacheSize = settings.romCacheSize;
+	SetROMCacheSize(romCacheSize > 0 ? 256 << std::min(romCacheSize, 4) : 0);
+	// zlib, fast zlib or none for the quick save and autosave slots
+	static const int quickSaveLevels[] = { Z_DEFAULT_COMPRESSION, Z_BEST_SPEED, Z_NO_COMPRESSION };
+	quickSaveCompression = quickSaveLevels[std::min((unsigned)settings.quickSaveCompression, 2u)];
 
 	// This is the wifi
-	CommonSettings.wifi.mode = GetPrivateProfileInt(env,"Wifi", "Mode", 0, IniName);
-	CommonSettings.wifi.infraBridgeAdapter = GetPrivateProfileInt(env,"Wifi", "BridgeAdapter", 0, IniName);
-
+	CommonSettings.wifi.mode = settings.wifiMode;
+	CommonSettings.wifi.infraBridgeAdapter = settings.wifiBridgeAdapter;
+
+	//the game loaded keeps its preset over what was just set
+	const GamePreset& preset = gamepreset_current();
+	gamepreset_apply(preset);
+	if(preset.has(GAMEPRESET_FRAMESKIP))
+		frameskiprate = preset.value[GAMEPRESET_FRAMESKIP];
 }
 
 void JNI_NOARGS(reloadFirmware)
@@ -660,18 +1337,32 @@ void JNI_NOARGS(loadSettings)
 }
 
 
-void JNI(init, jobject _inst)
+// memoryClass is ActivityManager.getMemoryClass(), which the caches are sized from
+void JNI(init, jint memoryClass, jobject assets)
 {
 #if defined(HAVE_NEON)
 
 #endif
+	corelog_setSink(logcatSink);
 	INFO("");
 
 	//Logger::setCallbackAll(logCallback);
 
 	oglrender_init = android_opengl_init;
+	if (assetManagerRef == NULL)
+	{
+		assetManagerRef = env->NewGlobalRef(assets);
+		assetManager = AAssetManager_fromJava(env, assetManagerRef);
+	}
+	vulkanrender_loadShader = android_vulkan_loadShader;
 	InitDecoder();
+	memusage_setFrontend(frontendMemoryUsage);
+	memusage_setBudget(memoryClass);
 	
+	env->GetJavaVM(&javaVM);
+	deSmuMEClass = (jclass)env->NewGlobalRef(env->FindClass("com/opendoorstudios/ds4droid/DeSmuME"));
+	stateSavedMethod = env->GetStaticMethodID(deSmuMEClass, "stateSaved", "(IZ)V");
+
 	path.ReadPathSettings();
 	if (video.layout > 2)
 	{
@@ -736,12 +1427,12 @@ void JNI(init, jobject _inst)
 	NDS_Init();
 
     // This is for the renderer used. Default is rasterizer.
-	cur3DCore = GetPrivateProfileInt(env, "3D", "Renderer", 2, IniName);
+	cur3DCore = settings.renderer;
 	NDS_3D_ChangeCore(cur3DCore);
 	
 	LOG("Init sound core\n");
 
-	SPU_ChangeSoundCore(sndcoretype, sndbuffersize);
+	changeSoundCore(sndcoretype);
 	SPU_SetSynchMode(snd_synchmode,snd_synchmethod);
 
     // Nobody can guess where this reference is from.
@@ -756,9 +1447,10 @@ void JNI(init, jobject _inst)
 		fw_config.message[i] = message[i];
     // End of reference
 
-	fw_config.language = GetPrivateProfileInt(env, "Firmware","Language", 1, IniName);
+	fw_config.language = settings.language;
 		
-	video.setfilter(GetPrivateProfileInt(env,"Video", "Filter", video.NONE, IniName));
+	wantedFilter = settings.filter;
+	video.setfilter(settings.filter);
 	
 	NDS_CreateDummyFirmware(&fw_config);
 	
@@ -766,10 +1458,17 @@ void JNI(init, jobject _inst)
 	
 	mainLoopData.freq = 1000;
 	mainLoopData.lastticks = GetTickCount();
+
+	//made current here by the renderer's init, but it is the emulation thread's to render with
+	releaseRenderContext();
+	startEmulationLoop();
 }
-#if defined(__x86_64__) || defined(__x86__)
+#ifdef HAVE_JIT
 void JNI(changeCpuMode, int type)
 {
+	//the block and cache size only change along with a reset
+	CommonSettings.jit_max_block_size = settings.jitSize;
+	CommonSettings.jit_cache_size = std::min(8u << settings.jitCacheSize, memusage_budget().jitCacheMB);
 	arm_jit_reset(type);
 }
 #endif
@@ -780,7 +1479,7 @@ void JNI(change3D, int type)
 
 void JNI(changeSound, int type)
 {
-	SPU_ChangeSoundCore(sndcoretype = type, sndbuffersize);
+	changeSoundCore(type);
 }
 
 void JNI(changeSoundSynchMode, int synchmode)
@@ -802,6 +1501,131 @@ jboolean JNI(loadRom, jstring path)
 	return ret ? JNI_TRUE : JNI_FALSE;
 }
 
+//the parts of a banner past RomBanner: a dsi banner (version 0103h) adds an animated icon, of 8 bitmaps and 8 palettes
+//that a sequence of up to 64 frames picks from
+static const u32 kRomInfoHeaderSize = 0x200;
+static const u32 kBannerSize = 0x840; //the part of RomBanner every version has
+static const u32 kBannerSizeDSi = 0x23C0;
+static const u32 kBannerDSiBitmaps = 0x1240, kBannerDSiPalettes = 0x2240, kBannerDSiSequence = 0x2340;
+static const u32 kBannerDSiSequenceLength = 64;
+
+//the start of a rom's header and its banner, as they are in the file, for the rom browser. the browser calls this from
+//several threads at once, so it reads the file by itself and leaves gameInfo alone. the banner is left off if there isn't one
+jbyteArray JNI(readRomInfo, jstring path)
+{
+	static const u32 kHeaderSize = kRomInfoHeaderSize;
+	u8 buf[kHeaderSize + kBannerSizeDSi];
+
+	jboolean isCopy;
+	const char* szPath = env->GetStringUTFChars(path, &isCopy);
+	FILE* f = fopen(szPath, "rb");
+	env->ReleaseStringUTFChars(path, szPath);
+	if(!f)
+		return NULL;
+
+	u32 size = 0;
+	if(fread(buf, 1, kHeaderSize, f) == kHeaderSize)
+	{
+		size = kHeaderSize;
+		const u32 iconOff = LE_TO_LOCAL_32(((NDS_header*)buf)->IconOff);
+		if(iconOff >= kHeaderSize && fseek(f, iconOff, SEEK_SET) == 0 && fread(buf + size, 1, kBannerSize, f) == kBannerSize)
+		{
+			size += kBannerSize;
+			//the animated icon too, when there is one
+			if(T1ReadWord(buf, kHeaderSize) == 0x0103 && fread(buf + size, 1, kBannerSizeDSi - kBannerSize, f) == kBannerSizeDSi - kBannerSize)
+				size += kBannerSizeDSi - kBannerSize;
+		}
+	}
+	fclose(f);
+	if(!size)
+		return NULL;
+
+	jbyteArray ret = env->NewByteArray(size);
+	if(ret)
+		env->SetByteArrayRegion(ret, 0, size, (const jbyte*)buf);
+	return ret;
+}
+
+//one 32x32 icon frame. the bitmap is 4x4 tiles of 8x8 4bit pixels, and color 0 is transparent
+static void decodeRomIcon(u32 *dst, const u8 *bitmap, const u8 *palette, bool hflip, bool vflip)
+{
+	u32 colors[16];
+	colors[0] = 0;
+	for(int i = 1; i < 16; i++)
+	{
+		const u16 c = LE_TO_LOCAL_16(((const u16*)palette)[i]);
+		const u32 r = c & 0x1F, g = (c >> 5) & 0x1F, b = (c >> 10) & 0x1F;
+		colors[i] = 0xFF000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 3) | (g >> 2)) << 8) | ((b << 3) | (b >> 2));
+	}
+
+	for(int y = 0; y < 32; y++)
+	{
+		const int sy = vflip ? 31 - y : y;
+		for(int x = 0; x < 32; x++)
+		{
+			const int sx = hflip ? 31 - x : x;
+			const u8 pair = bitmap[((sy >> 3) * 4 + (sx >> 3)) * 32 + (sy & 7) * 4 + ((sx & 7) >> 1)];
+			*dst++ = colors[(sx & 1) ? (pair >> 4) : (pair & 0xF)];
+		}
+	}
+}
+
+//the icons of what readRomInfo returned, for the rom browser to keep: the number of frames, the length of the animation,
+//for each step of the animation its frame and (in the upper 16 bits) how many 60ths of a second it shows, then the frames
+//as 32x32 ARGB_8888. frame 0 is the still icon, and the animation only has the frames that it uses, once each
+jintArray JNI(decodeRomIcons, jbyteArray info)
+{
+	const jsize size = info ? env->GetArrayLength(info) : 0;
+	if(size < (jsize)(kRomInfoHeaderSize + kBannerSize))
+		return NULL;
+
+	u8 *buf = new u8[size];
+	env->GetByteArrayRegion(info, 0, size, (jbyte*)buf);
+	const u8 *banner = buf + kRomInfoHeaderSize;
+	const RomBanner *still = (const RomBanner*)banner;
+
+	//the frames that the sequence uses, by bitmap, palette and flips
+	u32 steps[kBannerDSiSequenceLength];
+	u32 frames[kBannerDSiSequenceLength + 1];
+	s8 frameOf[256];
+	memset(frameOf, -1, sizeof(frameOf));
+	u32 numSteps = 0, numFrames = 1;
+	if(size >= (jsize)(kRomInfoHeaderSize + kBannerSizeDSi) && LE_TO_LOCAL_16(*(const u16*)banner) == 0x0103)
+	{
+		for(; numSteps < kBannerDSiSequenceLength; numSteps++)
+		{
+			const u16 entry = LE_TO_LOCAL_16(*(const u16*)(banner + kBannerDSiSequence + (numSteps << 1)));
+			if(!(entry & 0xFF))
+				break;
+			const u8 key = entry >> 8;
+			if(frameOf[key] < 0)
+			{
+				frameOf[key] = numFrames;
+				frames[numFrames++] = key;
+			}
+			steps[numSteps] = frameOf[key] | ((entry & 0xFF) << 16);
+		}
+	}
+
+	const u32 head = 2 + numSteps;
+	jintArray ret = env->NewIntArray(head + numFrames * 32 * 32);
+	if(ret)
+	{
+		u32 *out = new u32[head + numFrames * 32 * 32];
+		out[0] = numFrames;
+		out[1] = numSteps;
+		memcpy(out + 2, steps, numSteps * sizeof(u32));
+		decodeRomIcon(out + head, still->bitmap, (const u8*)still->palette, false, false);
+		for(u32 i = 1; i < numFrames; i++)
+			decodeRomIcon(out + head + i * 32 * 32, banner + kBannerDSiBitmaps + (frames[i] & 7) * 0x200,
+				banner + kBannerDSiPalettes + ((frames[i] >> 3) & 7) * 0x20, (frames[i] & 0x40) != 0, (frames[i] & 0x80) != 0);
+		env->SetIntArrayRegion(ret, 0, head + numFrames * 32 * 32, (const jint*)out);
+		delete[] out;
+	}
+	delete[] buf;
+	return ret;
+}
+
 void JNI(setWorkingDir, jstring path, jstring temp)
 {
 	jboolean isCopy;
@@ -814,21 +1638,37 @@ void JNI(setWorkingDir, jstring path, jstring temp)
 	env->ReleaseStringUTFChars(temp, szPath);
 }
 
-void JNI(touchScreenTouch, int x, int y)
+jobject JNI_NOARGS(getInputBuffer)
+{
+	return env->NewDirectByteBuffer(inputQueue.buffer(), inputQueue.bufferSize());
+}
+
+void JNI(commitInput, int writePos)
+{
+	inputQueue.commit(writePos);
+	//the event has to be seen before loopAsleep is, or waitAsleep could miss both
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&loopAsleep, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&loopMutex);
+		pthread_cond_signal(&loopCond);
+		pthread_mutex_unlock(&loopMutex);
+	}
+}
+
+jint JNI_NOARGS(getInputLatency)
 {
-	if(x<0) x = 0; else if(x>255) x = 255;
-	if(y<0) y = 0; else if(y>192) y = 192;
-	NDS_setTouchPos(x,y);
+	return inputQueue.takeLatency();
 }
 
-void JNI_NOARGS(touchScreenRelease)
+jint JNI_NOARGS(getRunAheadFrames)
 {
-	NDS_releaseTouch();
+	return runahead_frames();
 }
 
-void JNI(setButtons, int l, int r, int up, int down, int left, int right, int a, int b, int x, int y, int start, int select, int lid)
+jint JNI_NOARGS(getRunAheadHeadroom)
 {
-	NDS_setPad(right, left, down, up, select, start, b, a, y, x, l, r, false, !lid);
+	return runahead_takeHeadroom();
 }
 
 jint JNI_NOARGS(getNumberOfCheats)
@@ -900,7 +1740,10 @@ void JNI_NOARGS(saveCheats)
 void JNI(setCheatEnabled, int pos, jboolean enabled)
 {
 	if(cheats)
+	{
 		cheats->getItemByIndex(pos)->enabled = enabled == JNI_TRUE ? true : false;
+		cheats->invalidate();
+	}
 }
 
 void JNI(deleteCheat, jint pos)
@@ -909,8 +1752,56 @@ void JNI(deleteCheat, jint pos)
 		cheats->remove(pos);
 }
 
+jboolean JNI(netplayHost, int port)
+{
+	return netplay_host(port) ? JNI_TRUE : JNI_FALSE;
+}
+
+jboolean JNI(netplayJoin, jstring host, int port)
+{
+	const char* szHost = env->GetStringUTFChars(host, NULL);
+	const bool joined = netplay_join(szHost, port);
+	env->ReleaseStringUTFChars(host, szHost);
+	return joined ? JNI_TRUE : JNI_FALSE;
+}
+
+void JNI_NOARGS(netplayStop)
+{
+	netplay_stop();
+}
+
+jint JNI_NOARGS(netplayStatus)
+{
+	return netplay_status();
+}
+
+jboolean JNI(startRecording, jstring path)
+{
+	const char* szPath = env->GetStringUTFChars(path, NULL);
+	const bool started = recorder_start(szPath);
+	env->ReleaseStringUTFChars(path, szPath);
+	return started ? JNI_TRUE : JNI_FALSE;
+}
+
+void JNI_NOARGS(stopRecording)
+{
+	recorder_stop();
+}
+
+jboolean JNI_NOARGS(isRecording)
+{
+	return recorder_recording() ? JNI_TRUE : JNI_FALSE;
+}
+
+jboolean JNI_NOARGS(canRecord)
+{
+	return recorder_available() ? JNI_TRUE : JNI_FALSE;
+}
+
 void JNI_NOARGS(closeRom)
 {
+	recorder_stop();
+	netplay_stop();
 	NDS_FreeROM();
 	execute = false;
 	Hud.resetTransient();
@@ -928,29 +1819,12 @@ void JNI_NOARGS(exit)
 		INFO("profile end\n");
 	}
 #endif
+	recorder_stop();
+	savestate_flush();
+	MMU_new.backupDevice.flushBackup(true);
+	corelog_flush();
 	exit(0);
 }
 
 } //end extern "C"
 
-unsigned int GetPrivateProfileInt(JNIEnv* env, const char* lpAppName, const char* lpKeyName, int nDefault, const char* lpFileName)
-{
-	jclass javaClass = env->FindClass("com/opendoorstudios/ds4droid/DeSmuME");
-	if(!javaClass)
-		return nDefault;
-	jmethodID getSettingInt = env->GetStaticMethodID(javaClass, "getSettingInt","(Ljava/lang/String;I)I");
-	jstring key = env->NewStringUTF(lpKeyName);
-	int ret = env->CallStaticIntMethod(javaClass, getSettingInt, key, nDefault);
-	return ret;
-}
-
-bool GetPrivateProfileBool(JNIEnv* env, const char* lpAppName, const char* lpKeyName, bool bDefault, const char* lpFileName)
-{
-	/*jclass javaClass = env->FindClass("com/opendoorstudios/ds4droid/DeSmuME");
-	if (!javaClass)
-		return bDefault;
-	jmethodID getSettingBool = env->GetStaticMethodID(javaClass, "getSettingBool", "(Ljava/lang/Boolean;I)I");
-	jstring key = env->NewStringUTF(lpKeyName);
-	bool ret = env->CallStaticBooleanMethod(javaClass, getSettingBool, key, bDefault);*/
-	return GetPrivateProfileInt(env, lpAppName, lpKeyName, bDefault ? 1 : 0, lpFileName);
-}
@@ -21,12 +21,9 @@
 #include <jni.h>
 #include <android/log.h>
 
-unsigned int GetPrivateProfileInt(JNIEnv* env, const char* lpAppName, const char* lpKeyName, int nDefault, const char* lpFileName);
 unsigned int GetTickCount();
 
 #ifdef __cplusplus
-bool GetPrivateProfileBool(JNIEnv* env, const char* lpAppName, const char* lpKeyName, bool bDefault, const char* lpFileName);
-
 extern "C" {
 #endif
 
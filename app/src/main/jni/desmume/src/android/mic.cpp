@@ -27,9 +27,14 @@
 #include "../mic.h"
 #include "readwrite.h"
 #include "main.h"
+#include "utils/task.h"
 
 #include <SLES/OpenSLES.h>
 #include <SLES/OpenSLES_Android.h>
+#include <string.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <algorithm>
 
 extern SLObjectItf engineObject;
 extern SLEngineItf engineEngine;
@@ -37,45 +42,206 @@ extern SLEngineItf engineEngine;
 static SLObjectItf recorderObject = NULL;
 static SLRecordItf recorderRecord = NULL;
 static SLAndroidSimpleBufferQueueItf bqRecordBufferQueue;
-static bool samplesReady = false;
 
 #define MAX_NUMBER_INTERFACES 5 
 #define MAX_NUMBER_INPUT_DEVICES 3
 
 #define FAILED(X) (X) != SL_RESULT_SUCCESS
 
-#define MIC_BUFSIZE 2048
+//what opensl fills at a time, 16 bit at the mic's rate
+#define MIC_BUFSIZE 256
+#define MIC_RATE 16000
 
 static BOOL Mic_Inited = FALSE;
 
 static s16 Mic_Buffer[2][MIC_BUFSIZE];
-
-static int fullBuffer = -1;
 static int recordingBuffer = -1;
-static int fullBufferPos = 0;
+
+//the captured sound, already at the mic's rate and in its 8 bit format, on its way from the capture callback (the
+//only writer) to Mic_ReadSample on the emulation thread (the only reader). each side only moves its own index, so
+//neither ever waits on the other
+#define MIC_RING_SIZE 8192
+#define MIC_RING_MASK (MIC_RING_SIZE - 1)
+static u8 Mic_Ring[MIC_RING_SIZE];
+static u32 Mic_WritePos = 0;
+static u32 Mic_ReadPos = 0;
+//what is read while the ring is dry
+static u8 Mic_Last = 0x80;
+//the most the ring is let fall behind by before the oldest samples are skipped, from micBufferMs
+static u32 Mic_Depth = MIC_RATE * 40 / 1000;
+
+//the capture's rate stepped down to the mic's, in 16.16 fixed point: the samples of each of the mic's are averaged
+static u32 Mic_Step = 0x10000;
+static u32 Mic_Phase = 0;
+static s32 Mic_Sum = 0;
+static s32 Mic_SumCount = 0;
 
 #define JNI(X,...) Java_com_opendoorstudios_ds4droid_DeSmuME_##X(JNIEnv* env, jclass* clazz, __VA_ARGS__)
 #define JNI_NOARGS(X) Java_com_opendoorstudios_ds4droid_DeSmuME_##X(JNIEnv* env, jclass* clazz)
 
 bool enableMicrophone = false;
+//how far behind the game the microphone may fall, in milliseconds
+int micBufferMs = 40;
 
-int lastBufferTime;
+static void Mic_SetRate(int rate)
+{
+	Mic_Step = rate > MIC_RATE ? (u32)(((u64)MIC_RATE << 16) / rate) : 0x10000;
+	Mic_Phase = 0;
+	Mic_Sum = Mic_SumCount = 0;
+}
+
+//capture thread
+static void Mic_Write(const s16* samples, int count)
+{
+	u32 write = Mic_WritePos;
+	const u32 read = __atomic_load_n(&Mic_ReadPos, __ATOMIC_ACQUIRE);
+	for(int i = 0; i < count; i++)
+	{
+		Mic_Sum += samples[i];
+		Mic_SumCount++;
+		Mic_Phase += Mic_Step;
+		if(Mic_Phase < 0x10000)
+			continue;
+		Mic_Phase -= 0x10000;
+
+		const s32 sixteen = Mic_Sum / Mic_SumCount;
+		Mic_Sum = Mic_SumCount = 0;
+		//when the game stopped reading, what doesn't fit is dropped; the reader skips to the newest anyway
+		if(write - read >= MIC_RING_SIZE)
+			continue;
+		//16 bit -> 8 bit. pcm 8 bit encoding midpoint is 127, while it's signed 0 for 16-bit
+		Mic_Ring[write & MIC_RING_MASK] = (u8)((sixteen >> 8) + 128);
+		write++;
+	}
+	__atomic_store_n(&Mic_WritePos, write, __ATOMIC_RELEASE);
+}
 
 void bqRecorderCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 {
 	int nextBuffer = recordingBuffer == 1 ? 0 : 1;
 	(*bqRecordBufferQueue)->Enqueue(bqRecordBufferQueue, Mic_Buffer[nextBuffer], MIC_BUFSIZE * sizeof(s16));
 	if(recordingBuffer != -1)
+		Mic_Write(Mic_Buffer[recordingBuffer], MIC_BUFSIZE);
+	recordingBuffer = nextBuffer;
+}
+
+//aaudio (android 8.0 on) captures with less latency than opensl does, so it is used where there is one; it is
+//looked up at runtime like the sound output's
+typedef struct AAudioStreamBuilderStruct AAudioStreamBuilder;
+typedef struct AAudioStreamStruct AAudioStream;
+typedef int32_t aaudio_result_t;
+typedef aaudio_result_t (*AAudioDataCallback)(AAudioStream* stream, void* userData, void* audioData, int32_t numFrames);
+
+enum
+{
+	AAUDIO_OK = 0,
+	AAUDIO_DIRECTION_INPUT = 1,
+	AAUDIO_FORMAT_PCM_I16 = 1,
+	AAUDIO_SHARING_MODE_SHARED = 1,
+	AAUDIO_PERFORMANCE_MODE_LOW_LATENCY = 12,
+	AAUDIO_CALLBACK_RESULT_CONTINUE = 0,
+	AAUDIO_INPUT_PRESET_UNPROCESSED = 9,
+};
+
+static struct
+{
+	aaudio_result_t (*createStreamBuilder)(AAudioStreamBuilder** builder);
+	void (*setDirection)(AAudioStreamBuilder* builder, int32_t direction);
+	void (*setSharingMode)(AAudioStreamBuilder* builder, int32_t sharingMode);
+	void (*setPerformanceMode)(AAudioStreamBuilder* builder, int32_t mode);
+	void (*setFormat)(AAudioStreamBuilder* builder, int32_t format);
+	void (*setChannelCount)(AAudioStreamBuilder* builder, int32_t channelCount);
+	void (*setDataCallback)(AAudioStreamBuilder* builder, AAudioDataCallback callback, void* userData);
+	void (*setInputPreset)(AAudioStreamBuilder* builder, int32_t preset);	//from android 9.0, so it may be missing
+	aaudio_result_t (*openStream)(AAudioStreamBuilder* builder, AAudioStream** stream);
+	aaudio_result_t (*deleteBuilder)(AAudioStreamBuilder* builder);
+	aaudio_result_t (*requestStart)(AAudioStream* stream);
+	aaudio_result_t (*requestStop)(AAudioStream* stream);
+	aaudio_result_t (*close)(AAudioStream* stream);
+	int32_t (*getSampleRate)(AAudioStream* stream);
+} aaudio;
+
+static AAudioStream* captureStream = NULL;
+
+static bool loadAAudio()
+{
+	static bool looked = false, loaded = false;
+	if(looked)
+		return loaded;
+	looked = true;
+	void* lib = dlopen("libaaudio.so", RTLD_NOW);
+	if(!lib)
+		return false;
+
+	#define LOAD(field, name) if(!(*(void**)&aaudio.field = dlsym(lib, name))) return false;
+	LOAD(createStreamBuilder, "AAudio_createStreamBuilder");
+	LOAD(setDirection, "AAudioStreamBuilder_setDirection");
+	LOAD(setSharingMode, "AAudioStreamBuilder_setSharingMode");
+	LOAD(setPerformanceMode, "AAudioStreamBuilder_setPerformanceMode");
+	LOAD(setFormat, "AAudioStreamBuilder_setFormat");
+	LOAD(setChannelCount, "AAudioStreamBuilder_setChannelCount");
+	LOAD(setDataCallback, "AAudioStreamBuilder_setDataCallback");
+	LOAD(openStream, "AAudioStreamBuilder_openStream");
+	LOAD(deleteBuilder, "AAudioStreamBuilder_delete");
+	LOAD(requestStart, "AAudioStream_requestStart");
+	LOAD(requestStop, "AAudioStream_requestStop");
+	LOAD(close, "AAudioStream_close");
+	LOAD(getSampleRate, "AAudioStream_getSampleRate");
+	#undef LOAD
+	*(void**)&aaudio.setInputPreset = dlsym(lib, "AAudioStreamBuilder_setInputPreset");
+
+	loaded = true;
+	return true;
+}
+
+static aaudio_result_t captureCallback(AAudioStream* s, void* userData, void* audioData, int32_t numFrames)
+{
+	//a new stream may come with a new thread
+	static __thread bool named = false;
+	if(!named)
 	{
-		fullBufferPos = 0;
-		fullBuffer = recordingBuffer;
-		/*float bufferTime = GetTickCount() - lastBufferTime;
-		bufferTime = 1000.0 / bufferTime;
-		bufferTime *= MIC_BUFSIZE;*/
-		//LOGI("Approx mic sample rate is %d", (int)bufferTime);
+		setCurrentThreadName("AAudio capture");
+		named = true;
 	}
-	recordingBuffer = nextBuffer;
-	//lastBufferTime = GetTickCount();
+	Mic_Write((const s16*)audioData, numFrames);
+	return AAUDIO_CALLBACK_RESULT_CONTINUE;
+}
+
+static bool Mic_InitAAudio()
+{
+	if(!loadAAudio())
+		return false;
+
+	AAudioStreamBuilder* builder;
+	if(aaudio.createStreamBuilder(&builder) != AAUDIO_OK)
+		return false;
+	aaudio.setDirection(builder, AAUDIO_DIRECTION_INPUT);
+	aaudio.setSharingMode(builder, AAUDIO_SHARING_MODE_SHARED);
+	aaudio.setPerformanceMode(builder, AAUDIO_PERFORMANCE_MODE_LOW_LATENCY);
+	aaudio.setFormat(builder, AAUDIO_FORMAT_PCM_I16);
+	aaudio.setChannelCount(builder, 1);
+	//the games want the blowing and the shouting, not the voice processing that takes it out
+	if(aaudio.setInputPreset)
+		aaudio.setInputPreset(builder, AAUDIO_INPUT_PRESET_UNPROCESSED);
+	//no sample rate is asked for, so the stream gets the device's own, without a resampler of its own in the way
+	aaudio.setDataCallback(builder, captureCallback, NULL);
+	const aaudio_result_t result = aaudio.openStream(builder, &captureStream);
+	aaudio.deleteBuilder(builder);
+	if(result != AAUDIO_OK)
+	{
+		captureStream = NULL;
+		return false;
+	}
+
+	Mic_SetRate(aaudio.getSampleRate(captureStream));
+	if(aaudio.requestStart(captureStream) != AAUDIO_OK)
+	{
+		aaudio.close(captureStream);
+		captureStream = NULL;
+		return false;
+	}
+	LOGI("AAudio created (for audio input) at %d Hz", (int)aaudio.getSampleRate(captureStream));
+	return true;
 }
 
 extern "C"
@@ -87,13 +253,21 @@ void JNI(setMicPaused, int set)
 	{
 		if(set == 1)
 		{
-			(*recorderRecord)->SetRecordState(recorderRecord,SL_RECORDSTATE_STOPPED);
+			if(captureStream)
+				aaudio.requestStop(captureStream);
+			else
+				(*recorderRecord)->SetRecordState(recorderRecord,SL_RECORDSTATE_STOPPED);
 		}
 		else 
 		{
 			Mic_Reset();
-			(*recorderRecord)->SetRecordState(recorderRecord,SL_RECORDSTATE_RECORDING);
-			bqRecorderCallback(bqRecordBufferQueue, NULL);
+			if(captureStream)
+				aaudio.requestStart(captureStream);
+			else
+			{
+				(*recorderRecord)->SetRecordState(recorderRecord,SL_RECORDSTATE_RECORDING);
+				bqRecorderCallback(bqRecordBufferQueue, NULL);
+			}
 		}
 	}
 
@@ -103,6 +277,13 @@ void JNI(setMicPaused, int set)
 
 void Mic_DeInit()
 {
+	if(captureStream)
+	{
+		aaudio.requestStop(captureStream);
+		aaudio.close(captureStream);
+		captureStream = NULL;
+	}
+
 	if (recorderObject != NULL) {
         (*recorderObject)->Destroy(recorderObject);
 		recorderObject = NULL;
@@ -131,6 +312,10 @@ BOOL Mic_Init()
 	SLAudioInputDescriptor        AudioInputDescriptor;
 	
 	Mic_Inited = FALSE;
+	Mic_Reset();
+
+	if(Mic_InitAAudio())
+		return Mic_Inited = TRUE;
 	
 	//Some devices silently (literally haha) fail if you create multiple OpenSL ES instances.
 	//So now we share it with the regular audio output driver
@@ -183,7 +368,7 @@ BOOL Mic_Init()
 	if(FAILED(result = (*recorderRecord)->SetRecordState(recorderRecord,SL_RECORDSTATE_RECORDING)))
 		return FALSE;
 		
-	Mic_Reset();
+	Mic_SetRate(MIC_RATE);
 	
 	bqRecorderCallback(bqRecordBufferQueue, NULL);
 	
@@ -191,40 +376,32 @@ BOOL Mic_Init()
 	return Mic_Inited = TRUE;
 }
 
+//what was captured before now is not for the game; the reader just skips to the newest
 void Mic_Reset()
 {
-	recordingBuffer = fullBuffer = -1;
-	fullBufferPos = 0;
-	
-	if(!Mic_Inited)
-		return;
-
-	memset(Mic_Buffer[0], 0x80, MIC_BUFSIZE);
-	memset(Mic_Buffer[1], 0x80, MIC_BUFSIZE);
+	recordingBuffer = -1;
+	Mic_Last = 0x80;
+	Mic_Depth = std::min<u32>(MIC_RATE * std::max(micBufferMs, 1) / 1000, MIC_RING_SIZE);
+	__atomic_store_n(&Mic_ReadPos, __atomic_load_n(&Mic_WritePos, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
 }
 
+bool Mic_Deterministic = false;
+
 u8 Mic_ReadSample()
 {
-	u8 ret = 0;
-	//static u8 print = 0;
-	if(Mic_Inited == TRUE && fullBuffer != -1)
-	{
-		const s16 original = Mic_Buffer[fullBuffer][fullBufferPos];
-		s16 sixteen = original;
-		sixteen /= 256; //16 bit -> 8 bit
-		sixteen += 128; //pcm 8 bit encoding midpoint is 127, while it's signed 0 for 16-bit
-		ret = (u8)sixteen;
-		if(fullBufferPos != (MIC_BUFSIZE-1))
-			++fullBufferPos;
-		/*if(++print == 10)
-		{
-			LOGI("Sound: original = %i, sixteen = %i, ret = %x", (int)original, (int)sixteen, (int)ret);
-			print = 0;
-		}*/
-		
-	}
-	return ret;
-
+	if(Mic_Inited != TRUE || Mic_Deterministic)
+		return 0;
+
+	const u32 write = __atomic_load_n(&Mic_WritePos, __ATOMIC_ACQUIRE);
+	u32 read = Mic_ReadPos;
+	//never further behind than the depth, so that what the game hears is never older than that
+	if(write - read > Mic_Depth)
+		read = write - Mic_Depth;
+	//and when the game reads faster than the mic fills, it hears the last sample again
+	if(read != write)
+		Mic_Last = Mic_Ring[read++ & MIC_RING_MASK];
+	__atomic_store_n(&Mic_ReadPos, read, __ATOMIC_RELEASE);
+	return Mic_Last;
 }
 
 void mic_savestate(EMUFILE* os)
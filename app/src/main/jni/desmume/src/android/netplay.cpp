@@ -0,0 +1,578 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <algorithm>
+#include <vector>
+#include <zlib.h>
+
+#include "netplay.h"
+#include "main.h"
+#include "../NDSSystem.h"
+#include "../SPU.h"
+#include "../saves.h"
+#include "../rtc.h"
+#include "../mic.h"
+#include "../movie.h"
+#include "../emufile.h"
+#include "../GPU_osd.h"
+#include "../arm_jit.h"
+#include "../utils/datetime.h"
+
+static const u8 kMagic[4] = {'N','D','S','N'};
+static const u32 kVersion = 1;
+
+//frames between an input being read and it being used, which is how long it has to get to the other side
+//before the other side has to guess it
+static const int kInputDelay = 2;
+//how far the emulation runs ahead of the last input that came from the other side before it waits for it
+static const int kMaxRollback = 10;
+//frames of input kept, more than either side can be apart
+static const int kInputFrames = 64;
+
+static const int kHandshakeTimeoutMs = 5000;
+static const int kStallWaitMs = 16;
+
+//a frame of input from one side: the buttons in the order of buttonstruct, then touching, the mic, and the touch position
+typedef u64 NetInput;
+
+#define INPUT_TOUCH (1<<14)
+#define INPUT_MIC (1<<15)
+#define INPUT_LID (1<<13)
+#define INPUT_BUTTONS 0x1FFF
+
+struct JoinState
+{
+	int sock;
+	bool use_jit;
+	u32 jit_max_block_size;
+	bool advanced_timing;
+	s32 cpu_skew;
+	s64 rtcTicks;
+	std::vector<u8> state;
+};
+
+//shared with java's thread
+static pthread_mutex_t netplayMutex = PTHREAD_MUTEX_INITIALIZER;
+static int listenSocket = -1;
+static JoinState* pendingJoin = NULL;
+static volatile bool stopRequested = false;
+static volatile int status = NETPLAY_OFF;
+
+//the emulation thread's
+static int sock = -1;
+static bool isHost;
+static int frame;			//the next frame to run, counted from the start of the session
+static int confirmed;		//the newest frame with the other side's input in
+static NetInput localInput[kInputFrames];
+static NetInput remoteInput[kInputFrames];
+static NetInput guessedInput[kInputFrames];	//what the other side's input was taken to be when the frame ran
+static StateJournal* journal = NULL;
+static std::vector<u8> received;
+
+static struct
+{
+	bool use_jit;
+	u32 jit_max_block_size;
+	bool advanced_timing;
+	s32 cpu_skew;
+	bool cheatsDisable;
+} savedSettings;
+
+static void put8(std::vector<u8>& buf, u8 v) { buf.push_back(v); }
+static void put32(std::vector<u8>& buf, u32 v) { for(int i=0;i<4;i++) buf.push_back((u8)(v>>(i*8))); }
+static void put64(std::vector<u8>& buf, u64 v) { for(int i=0;i<8;i++) buf.push_back((u8)(v>>(i*8))); }
+static u32 get32(const u8* p) { return p[0] | (p[1]<<8) | (p[2]<<16) | ((u32)p[3]<<24); }
+static u64 get64(const u8* p) { return get32(p) | ((u64)get32(p+4)<<32); }
+
+static bool sendAll(int s, const void* data, size_t len)
+{
+	const u8* p = (const u8*)data;
+	while(len)
+	{
+		ssize_t n = send(s, p, len, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+//the socket has a receive timeout during the handshake, so this doesn't wait forever on a side that went quiet
+static bool recvAll(int s, void* data, size_t len)
+{
+	u8* p = (u8*)data;
+	while(len)
+	{
+		ssize_t n = recv(s, p, len, 0);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void setupSocket(int s)
+{
+	//the messages are a few bytes each frame, they shouldn't wait around to be sent together
+	int one = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	struct timeval tv;
+	tv.tv_sec = kHandshakeTimeoutMs / 1000;
+	tv.tv_usec = (kHandshakeTimeoutMs % 1000) * 1000;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+//what the guest says first, so the host can tell it is running the same game
+static void putHello(std::vector<u8>& buf)
+{
+	buf.insert(buf.end(), kMagic, kMagic+4);
+	put32(buf, kVersion);
+	buf.insert(buf.end(), gameInfo.header.gameCode, gameInfo.header.gameCode+4);
+	put32(buf, gameInfo.header.headerCRC16);
+}
+
+static NetInput packInput(const UserInput& input)
+{
+	NetInput v = 0;
+	for(int i=0;i<14;i++)
+		if(input.buttons.array[i]) v |= 1<<i;
+	if(input.touch.isTouch) v |= INPUT_TOUCH;
+	if(input.mic.micButtonPressed) v |= INPUT_MIC;
+	v |= (NetInput)input.touch.touchX << 16;
+	v |= (NetInput)input.touch.touchY << 32;
+	return v;
+}
+
+static void unpackInput(NetInput v, UserInput& input)
+{
+	for(int i=0;i<14;i++)
+		input.buttons.array[i] = (v & (1<<i)) != 0;
+	input.touch.isTouch = (v & INPUT_TOUCH) != 0;
+	input.touch.touchX = (u16)(v >> 16);
+	input.touch.touchY = (u16)(v >> 32);
+	input.mic.micButtonPressed = (v & INPUT_MIC) ? 1 : 0;
+}
+
+//both players' buttons count, the lid is the host's, and the host's touch wins over the guest's
+static NetInput mergeInput(NetInput host, NetInput guest)
+{
+	NetInput v = ((host | guest) & (INPUT_BUTTONS | INPUT_MIC)) | (host & INPUT_LID);
+	const NetInput touch = (host & INPUT_TOUCH) ? host : guest;
+	v |= touch & (INPUT_TOUCH | 0xFFFFFFFF0000ULL);
+	return v;
+}
+
+static void startSession(int s, bool host, const DateTime& rtcStart)
+{
+	sock = s;
+	isHost = host;
+	frame = 0;
+	//nobody presses anything for the frames before the first input can get across
+	confirmed = kInputDelay - 1;
+	memset(localInput, 0, sizeof(localInput));
+	memset(remoteInput, 0, sizeof(remoteInput));
+	memset(guessedInput, 0, sizeof(guessedInput));
+	received.clear();
+	journal = new StateJournal(kMaxRollback + 1);
+
+	//anything that differs between the two devices would send their emulations different ways
+	CommonSettings.cheatsDisable = true;
+	rtcSetDeterministic(true, rtcStart, currFrameCounter);
+	Mic_Deterministic = true;
+
+	status = NETPLAY_CONNECTED;
+	osd->addLine(host ? "Netplay: player 2 joined" : "Netplay: joined");
+}
+
+static void saveSettings()
+{
+	savedSettings.use_jit = CommonSettings.use_jit;
+	savedSettings.jit_max_block_size = CommonSettings.jit_max_block_size;
+	savedSettings.advanced_timing = CommonSettings.advanced_timing;
+	savedSettings.cpu_skew = CommonSettings.cpu_skew;
+	savedSettings.cheatsDisable = CommonSettings.cheatsDisable;
+}
+
+static void endSession(const char* why)
+{
+	if(sock >= 0)
+		close(sock);
+	sock = -1;
+	delete journal;
+	journal = NULL;
+
+	const bool jitChanged = CommonSettings.use_jit != savedSettings.use_jit || CommonSettings.jit_max_block_size != savedSettings.jit_max_block_size;
+	CommonSettings.use_jit = savedSettings.use_jit;
+	CommonSettings.jit_max_block_size = savedSettings.jit_max_block_size;
+	CommonSettings.advanced_timing = savedSettings.advanced_timing;
+	CommonSettings.cpu_skew = savedSettings.cpu_skew;
+	CommonSettings.cheatsDisable = savedSettings.cheatsDisable;
+#ifdef HAVE_JIT
+	if(jitChanged)
+		arm_jit_reset(CommonSettings.use_jit, true);
+#endif
+	rtcSetDeterministic(false);
+	Mic_Deterministic = false;
+
+	status = listenSocket >= 0 ? NETPLAY_WAITING : NETPLAY_OFF;
+	if(why)
+		osd->addLine(why);
+}
+
+//someone connected to the host: check they have the same game, then send them the settings and state to start from
+static void acceptGuest(int s)
+{
+	setupSocket(s);
+
+	u8 hello[16];
+	std::vector<u8> expected;
+	putHello(expected);
+	if(!recvAll(s, hello, sizeof(hello)) || memcmp(hello, &expected[0], sizeof(hello)))
+	{
+		u8 no = 0;
+		sendAll(s, &no, 1);
+		close(s);
+		osd->addLine("Netplay: player 2 has a different game");
+		return;
+	}
+
+	saveSettings();
+	const DateTime rtcStart = DateTime::get_Now();
+
+	EMUFILE_MEMORY ms;
+	if(!savestate_save(&ms, Z_BEST_SPEED))
+	{
+		close(s);
+		return;
+	}
+
+	std::vector<u8> buf;
+	put8(buf, 1);
+	put8(buf, CommonSettings.use_jit);
+	put32(buf, CommonSettings.jit_max_block_size);
+	put8(buf, CommonSettings.advanced_timing);
+	put32(buf, (u32)CommonSettings.cpu_skew);
+	put64(buf, (u64)rtcStart.get_Ticks());
+	put32(buf, ms.size());
+	buf.insert(buf.end(), ms.buf(), ms.buf() + ms.size());
+	if(!sendAll(s, &buf[0], buf.size()))
+	{
+		close(s);
+		osd->addLine("Netplay: couldn't send the game to player 2");
+		return;
+	}
+
+	startSession(s, true, rtcStart);
+}
+
+static void startGuest(JoinState* join)
+{
+	saveSettings();
+	CommonSettings.use_jit = join->use_jit;
+	CommonSettings.jit_max_block_size = join->jit_max_block_size;
+	CommonSettings.advanced_timing = join->advanced_timing;
+	CommonSettings.cpu_skew = join->cpu_skew;
+
+	//loading the state throws away the compiled code, so the host's jit settings take from here on
+	EMUFILE_MEMORY ms(&join->state);
+	if(!savestate_load(&ms))
+	{
+		close(join->sock);
+		sock = -1;
+		endSession("Netplay: couldn't load the host's game");
+		return;
+	}
+
+	startSession(join->sock, false, DateTime(join->rtcTicks));
+}
+
+//takes whatever input the other side sent. a frame that already ran with a wrong guess for it is where to go back to
+static bool receiveInput(int& rollbackFrom)
+{
+	for(;;)
+	{
+		u8 chunk[512];
+		ssize_t n = recv(sock, chunk, sizeof(chunk), MSG_DONTWAIT);
+		if(n == 0) return false;
+		if(n < 0)
+		{
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return false;
+		}
+		received.insert(received.end(), chunk, chunk + n);
+	}
+
+	size_t pos = 0;
+	for(; pos + 12 <= received.size(); pos += 12)
+	{
+		const int f = (int)get32(&received[pos]);
+		const NetInput input = get64(&received[pos+4]);
+		//tcp keeps them in order, one a frame
+		if(f != confirmed + 1) return false;
+		remoteInput[f % kInputFrames] = input;
+		confirmed = f;
+		if(f < frame && guessedInput[f % kInputFrames] != input && (rollbackFrom < 0 || f < rollbackFrom))
+			rollbackFrom = f;
+	}
+	received.erase(received.begin(), received.begin() + pos);
+	return true;
+}
+
+static void runFrame(int f, bool resimulating)
+{
+	const NetInput remote = remoteInput[std::min(f, confirmed) % kInputFrames];
+	guessedInput[f % kInputFrames] = remote;
+	const NetInput local = localInput[f % kInputFrames];
+
+	NDS_beginProcessingInput();
+	unpackInput(isHost ? mergeInput(local, remote) : mergeInput(remote, local), NDS_getProcessingUserInput());
+	NDS_endProcessingInput();
+
+	//frames run again only need to get the state right, nobody sees them
+	if(resimulating)
+		NDS_SkipNextFrame();
+	NDS_exec<false>();
+}
+
+bool netplay_frame()
+{
+	if(stopRequested)
+	{
+		pthread_mutex_lock(&netplayMutex);
+		stopRequested = false;
+		if(listenSocket >= 0)
+			close(listenSocket);
+		listenSocket = -1;
+		if(pendingJoin)
+		{
+			close(pendingJoin->sock);
+			delete pendingJoin;
+			pendingJoin = NULL;
+		}
+		pthread_mutex_unlock(&netplayMutex);
+		if(sock >= 0)
+			endSession("Netplay stopped");
+		status = NETPLAY_OFF;
+	}
+
+	if(sock < 0)
+	{
+		if(listenSocket >= 0)
+		{
+			int s = accept(listenSocket, NULL, NULL);
+			if(s >= 0)
+				acceptGuest(s);
+		}
+
+		pthread_mutex_lock(&netplayMutex);
+		JoinState* join = pendingJoin;
+		pendingJoin = NULL;
+		pthread_mutex_unlock(&netplayMutex);
+		if(join)
+		{
+			startGuest(join);
+			delete join;
+		}
+
+		if(sock < 0)
+			return false;
+	}
+
+	int rollbackFrom = -1;
+	if(!receiveInput(rollbackFrom))
+	{
+		endSession("Netplay: the other player left");
+		return false;
+	}
+
+	//too far ahead of the other side to be able to go back to where its input stops: wait for it
+	if(frame - confirmed >= kMaxRollback)
+	{
+		struct pollfd pfd = { sock, POLLIN, 0 };
+		poll(&pfd, 1, kStallWaitMs);
+		if(!receiveInput(rollbackFrom))
+		{
+			endSession("Netplay: the other player left");
+			return false;
+		}
+		if(frame - confirmed >= kMaxRollback)
+			return true;
+	}
+
+	const int inputFrame = frame + kInputDelay;
+	localInput[inputFrame % kInputFrames] = packInput(NDS_getRawUserInput());
+	std::vector<u8> msg;
+	put32(msg, inputFrame);
+	put64(msg, localInput[inputFrame % kInputFrames]);
+	if(!sendAll(sock, &msg[0], msg.size()))
+	{
+		endSession("Netplay: the other player left");
+		return false;
+	}
+
+	if(rollbackFrom >= 0)
+	{
+		if(!journal->restore(frame - 1 - rollbackFrom))
+		{
+			endSession("Netplay: lost track of the game");
+			return false;
+		}
+		for(int f = rollbackFrom; f < frame; f++)
+		{
+			//the state for the frame gone back to is the newest already
+			if(f != rollbackFrom)
+				journal->save();
+			runFrame(f, true);
+		}
+		//the sound of the frames that ran again was heard the first time
+		SPU_ClearOutputBuffer();
+	}
+
+	journal->save();
+	runFrame(frame, false);
+	frame++;
+	SPU_Emulate_user();
+	return true;
+}
+
+bool netplay_host(int port)
+{
+	netplay_stop();
+
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if(s < 0)
+		return false;
+	int one = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if(bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(s, 1) < 0)
+	{
+		LOGW("Netplay: couldn't listen on port %d (%s)", port, strerror(errno));
+		close(s);
+		return false;
+	}
+	//the emulation thread checks for someone connecting each frame
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+	pthread_mutex_lock(&netplayMutex);
+	stopRequested = false;
+	listenSocket = s;
+	status = NETPLAY_WAITING;
+	pthread_mutex_unlock(&netplayMutex);
+	return true;
+}
+
+bool netplay_join(const char* host, int port)
+{
+	netplay_stop();
+
+	char portName[16];
+	snprintf(portName, sizeof(portName), "%d", port);
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host, portName, &hints, &res) != 0)
+		return false;
+
+	int s = -1;
+	for(struct addrinfo* ai = res; ai; ai = ai->ai_next)
+	{
+		s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(s < 0) continue;
+		if(connect(s, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		close(s);
+		s = -1;
+	}
+	freeaddrinfo(res);
+	if(s < 0)
+	{
+		LOGW("Netplay: couldn't connect to %s:%d", host, port);
+		return false;
+	}
+	setupSocket(s);
+
+	std::vector<u8> hello;
+	putHello(hello);
+	u8 header[1+1+4+1+4+8+4];
+	if(!sendAll(s, &hello[0], hello.size()) || !recvAll(s, header, 1) || !header[0] || !recvAll(s, header+1, sizeof(header)-1))
+	{
+		LOGW("Netplay: %s:%d didn't take us, is it running the same game?", host, port);
+		close(s);
+		return false;
+	}
+
+	JoinState* join = new JoinState();
+	join->sock = s;
+	join->use_jit = header[1] != 0;
+	join->jit_max_block_size = get32(header+2);
+	join->advanced_timing = header[6] != 0;
+	join->cpu_skew = (s32)get32(header+7);
+	join->rtcTicks = (s64)get64(header+11);
+	join->state.resize(get32(header+19));
+	if(join->state.empty() || !recvAll(s, &join->state[0], join->state.size()))
+	{
+		close(s);
+		delete join;
+		return false;
+	}
+
+	pthread_mutex_lock(&netplayMutex);
+	stopRequested = false;
+	pendingJoin = join;
+	pthread_mutex_unlock(&netplayMutex);
+	return true;
+}
+
+void netplay_stop()
+{
+	pthread_mutex_lock(&netplayMutex);
+	if(listenSocket >= 0 || pendingJoin || status != NETPLAY_OFF)
+		stopRequested = true;
+	pthread_mutex_unlock(&netplayMutex);
+}
+
+int netplay_status()
+{
+	if(stopRequested)
+		return NETPLAY_OFF;
+	if(pendingJoin)
+		return NETPLAY_CONNECTED;
+	return status;
+}
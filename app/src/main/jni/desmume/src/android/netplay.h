@@ -0,0 +1,43 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NETPLAY_H
+#define _NETPLAY_H
+
+//two players on one emulated console over the network, each running their own copy of it.
+//the host sends its state when the guest joins, and from then on each side sends its input for a frame a couple
+//of frames ahead of when it is used. input from the other side that hasn't arrived is guessed to be what it last
+//was, and when a guess turns out wrong the emulation goes back to that frame and runs the frames since again.
+
+enum
+{
+	NETPLAY_OFF,
+	NETPLAY_WAITING,	//hosting, nobody joined yet
+	NETPLAY_CONNECTED,
+};
+
+//these are called from java's thread
+bool netplay_host(int port);
+//connects and takes the host's state, which the emulation thread switches to at its next frame
+bool netplay_join(const char* host, int port);
+void netplay_stop();
+int netplay_status();
+
+//the emulation thread's frame while there is netplay going on. false if there isn't, and the frame is left to run as usual
+bool netplay_frame();
+
+#endif
@@ -0,0 +1,109 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "perfhint.h"
+#include <dlfcn.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <algorithm>
+#include "frametimes.h"
+#include "../utils/task.h"
+
+//APerformanceHint is from android 13 on (setThreads from 14) and the app still runs on 5.0, so it is looked up at runtime
+typedef void* (*PerformanceHintGetManager)();
+typedef void* (*PerformanceHintCreateSession)(void* manager, const s32* threadIds, size_t size, s64 targetNs);
+typedef int (*PerformanceHintReportActualWorkDuration)(void* session, s64 actualNs);
+typedef int (*PerformanceHintSetThreads)(void* session, const pid_t* threadIds, size_t size);
+typedef void (*PerformanceHintCloseSession)(void* session);
+
+static PerformanceHintGetManager getManager = NULL;
+static PerformanceHintCreateSession createSession = NULL;
+static PerformanceHintReportActualWorkDuration reportActualWorkDuration = NULL;
+static PerformanceHintSetThreads setThreads = NULL;
+static PerformanceHintCloseSession closeSession = NULL;
+
+//more than the emulation thread and one worker for each core of any phone
+static const int kMaxThreads = 32;
+
+static bool looked = false;
+static void* session = NULL;
+static int sessionSerial = -1;
+
+static bool loadPerformanceHint()
+{
+	void* lib = dlopen("libandroid.so", RTLD_NOW);
+	if(!lib)
+		return false;
+	getManager = (PerformanceHintGetManager)dlsym(lib, "APerformanceHint_getManager");
+	createSession = (PerformanceHintCreateSession)dlsym(lib, "APerformanceHint_createSession");
+	reportActualWorkDuration = (PerformanceHintReportActualWorkDuration)dlsym(lib, "APerformanceHint_reportActualWorkDuration");
+	setThreads = (PerformanceHintSetThreads)dlsym(lib, "APerformanceHint_setThreads");
+	closeSession = (PerformanceHintCloseSession)dlsym(lib, "APerformanceHint_closeSession");
+	return getManager && createSession && reportActualWorkDuration && closeSession;
+}
+
+//the threads that are still there: a session can't be made with (or moved to) one that has ended
+static int liveFrameThreads(s32* ids)
+{
+	int listed[kMaxThreads];
+	const int count = std::min(getFrameThreads(listed, kMaxThreads), kMaxThreads);
+	int live = 0;
+	for(int i = 0; i < count; i++)
+	{
+		char path[48];
+		snprintf(path, sizeof(path), "/proc/self/task/%d", listed[i]);
+		if(access(path, F_OK) == 0)
+			ids[live++] = listed[i];
+	}
+	return live;
+}
+
+static void updateSession()
+{
+	const int serial = getFrameThreadsSerial();
+	if(serial == sessionSerial)
+		return;
+	sessionSerial = serial;
+
+	s32 ids[kMaxThreads];
+	const int count = liveFrameThreads(ids);
+	if(!count)
+		return;
+	if(session && setThreads && setThreads(session, (const pid_t*)ids, count) == 0)
+		return;
+	if(session)
+		closeSession(session);
+	void* manager = getManager();
+	session = manager ? createSession(manager, ids, count, FrameTimes::BUDGET_US * 1000LL) : NULL;
+}
+
+void perfhint_frame(u64 workNs)
+{
+	if(!looked)
+	{
+		looked = true;
+		if(!loadPerformanceHint())
+			getManager = NULL;
+	}
+	if(!getManager)
+		return;
+
+	updateSession();
+	if(session && workNs)
+		reportActualWorkDuration(session, (s64)workNs);
+}
@@ -0,0 +1,31 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PERFHINT_H
+#define _PERFHINT_H
+
+#include "../types.h"
+
+//a performance hint session (android 13 on) for the emulation thread and its workers: each frame the system is told
+//how long the frame's work took against the time a frame has, so that it raises the clocks for the bursts of work
+//instead of going by the sleeps in between. nothing happens on systems without them
+
+//the emulation thread, after each frame's work. the session is made on the first call, and takes in the threads
+//placed as workers since the last one
+void perfhint_frame(u64 workNs);
+
+#endif
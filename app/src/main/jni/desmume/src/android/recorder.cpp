@@ -0,0 +1,511 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "recorder.h"
+#include "main.h"
+#include "soundring.h"
+#include "../SPU.h"
+#include "../driver.h"
+#include "../NDSSystem.h"
+#include "../utils/task.h"
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <vector>
+#include <algorithm>
+
+//the media ndk is from android 5.0 but the encoder's input surface only from 8.0, and the app still runs on 5.0,
+//so what is used of NdkMediaCodec.h, NdkMediaFormat.h and NdkMediaMuxer.h is declared here and looked up at runtime
+struct AMediaCodec;
+struct AMediaFormat;
+struct AMediaMuxer;
+
+struct RecorderBufferInfo	//AMediaCodecBufferInfo
+{
+	s32 offset;
+	s32 size;
+	s64 presentationTimeUs;
+	u32 flags;
+};
+
+enum
+{
+	MEDIA_OK = 0,
+	MEDIACODEC_CONFIGURE_FLAG_ENCODE = 1,
+	MEDIACODEC_BUFFER_FLAG_CODEC_CONFIG = 2,
+	MEDIACODEC_BUFFER_FLAG_END_OF_STREAM = 4,
+	MEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED = -2,
+	MEDIAMUXER_OUTPUT_FORMAT_MPEG_4 = 0,
+	//MediaCodecInfo.CodecCapabilities.COLOR_FormatSurface and MediaCodecInfo.CodecProfileLevel.AACObjectLC
+	COLOR_FORMAT_SURFACE = 0x7F000789,
+	AAC_OBJECT_LC = 2,
+};
+
+typedef AMediaCodec* (*MediaCodecCreateEncoderByType)(const char* mime);
+typedef int (*MediaCodecConfigure)(AMediaCodec* codec, const AMediaFormat* format, ANativeWindow* surface, void* crypto, u32 flags);
+typedef int (*MediaCodecCreateInputSurface)(AMediaCodec* codec, ANativeWindow** surface);
+typedef int (*MediaCodecCall)(AMediaCodec* codec);
+typedef ssize_t (*MediaCodecDequeueInputBuffer)(AMediaCodec* codec, s64 timeoutUs);
+typedef u8* (*MediaCodecGetBuffer)(AMediaCodec* codec, size_t idx, size_t* size);
+typedef int (*MediaCodecQueueInputBuffer)(AMediaCodec* codec, size_t idx, off_t offset, size_t size, u64 time, u32 flags);
+typedef ssize_t (*MediaCodecDequeueOutputBuffer)(AMediaCodec* codec, RecorderBufferInfo* info, s64 timeoutUs);
+typedef AMediaFormat* (*MediaCodecGetOutputFormat)(AMediaCodec* codec);
+typedef int (*MediaCodecReleaseOutputBuffer)(AMediaCodec* codec, size_t idx, bool render);
+typedef AMediaFormat* (*MediaFormatNew)();
+typedef int (*MediaFormatDelete)(AMediaFormat* format);
+typedef void (*MediaFormatSetString)(AMediaFormat* format, const char* name, const char* value);
+typedef void (*MediaFormatSetInt32)(AMediaFormat* format, const char* name, s32 value);
+typedef AMediaMuxer* (*MediaMuxerNew)(int fd, int format);
+typedef ssize_t (*MediaMuxerAddTrack)(AMediaMuxer* muxer, const AMediaFormat* format);
+typedef int (*MediaMuxerCall)(AMediaMuxer* muxer);
+typedef int (*MediaMuxerWriteSampleData)(AMediaMuxer* muxer, size_t trackIdx, const u8* data, const RecorderBufferInfo* info);
+
+static struct
+{
+	MediaCodecCreateEncoderByType createEncoderByType;
+	MediaCodecConfigure configure;
+	MediaCodecCreateInputSurface createInputSurface;
+	MediaCodecCall start, stop, release, signalEndOfInputStream;
+	MediaCodecDequeueInputBuffer dequeueInputBuffer;
+	MediaCodecGetBuffer getInputBuffer, getOutputBuffer;
+	MediaCodecQueueInputBuffer queueInputBuffer;
+	MediaCodecDequeueOutputBuffer dequeueOutputBuffer;
+	MediaCodecGetOutputFormat getOutputFormat;
+	MediaCodecReleaseOutputBuffer releaseOutputBuffer;
+	MediaFormatNew formatNew;
+	MediaFormatDelete formatDelete;
+	MediaFormatSetString setString;
+	MediaFormatSetInt32 setInt32;
+	MediaMuxerNew muxerNew;
+	MediaMuxerAddTrack addTrack;
+	MediaMuxerCall muxerStart, muxerStop, muxerRelease;
+	MediaMuxerWriteSampleData writeSampleData;
+} media;
+
+static bool looked = false, loaded = false;
+
+static bool loadMedia()
+{
+	void* lib = dlopen("libmediandk.so", RTLD_NOW);
+	if(!lib)
+		return false;
+	media.createEncoderByType = (MediaCodecCreateEncoderByType)dlsym(lib, "AMediaCodec_createEncoderByType");
+	media.configure = (MediaCodecConfigure)dlsym(lib, "AMediaCodec_configure");
+	media.createInputSurface = (MediaCodecCreateInputSurface)dlsym(lib, "AMediaCodec_createInputSurface");
+	media.start = (MediaCodecCall)dlsym(lib, "AMediaCodec_start");
+	media.stop = (MediaCodecCall)dlsym(lib, "AMediaCodec_stop");
+	media.release = (MediaCodecCall)dlsym(lib, "AMediaCodec_delete");
+	media.signalEndOfInputStream = (MediaCodecCall)dlsym(lib, "AMediaCodec_signalEndOfInputStream");
+	media.dequeueInputBuffer = (MediaCodecDequeueInputBuffer)dlsym(lib, "AMediaCodec_dequeueInputBuffer");
+	media.getInputBuffer = (MediaCodecGetBuffer)dlsym(lib, "AMediaCodec_getInputBuffer");
+	media.getOutputBuffer = (MediaCodecGetBuffer)dlsym(lib, "AMediaCodec_getOutputBuffer");
+	media.queueInputBuffer = (MediaCodecQueueInputBuffer)dlsym(lib, "AMediaCodec_queueInputBuffer");
+	media.dequeueOutputBuffer = (MediaCodecDequeueOutputBuffer)dlsym(lib, "AMediaCodec_dequeueOutputBuffer");
+	media.getOutputFormat = (MediaCodecGetOutputFormat)dlsym(lib, "AMediaCodec_getOutputFormat");
+	media.releaseOutputBuffer = (MediaCodecReleaseOutputBuffer)dlsym(lib, "AMediaCodec_releaseOutputBuffer");
+	media.formatNew = (MediaFormatNew)dlsym(lib, "AMediaFormat_new");
+	media.formatDelete = (MediaFormatDelete)dlsym(lib, "AMediaFormat_delete");
+	media.setString = (MediaFormatSetString)dlsym(lib, "AMediaFormat_setString");
+	media.setInt32 = (MediaFormatSetInt32)dlsym(lib, "AMediaFormat_setInt32");
+	media.muxerNew = (MediaMuxerNew)dlsym(lib, "AMediaMuxer_new");
+	media.addTrack = (MediaMuxerAddTrack)dlsym(lib, "AMediaMuxer_addTrack");
+	media.muxerStart = (MediaMuxerCall)dlsym(lib, "AMediaMuxer_start");
+	media.muxerStop = (MediaMuxerCall)dlsym(lib, "AMediaMuxer_stop");
+	media.muxerRelease = (MediaMuxerCall)dlsym(lib, "AMediaMuxer_delete");
+	media.writeSampleData = (MediaMuxerWriteSampleData)dlsym(lib, "AMediaMuxer_writeSampleData");
+
+	const void* const* all = (const void* const*)&media;
+	for(size_t i = 0; i < sizeof(media) / sizeof(void*); i++)
+		if(!all[i])
+			return false;
+	return true;
+}
+
+bool recorder_available()
+{
+	if(!looked)
+	{
+		looked = true;
+		loaded = loadMedia();
+		if(!loaded)
+			LOGI("No hardware encoders to record with");
+	}
+	return loaded;
+}
+
+enum
+{
+	WIDTH = 256,
+	HEIGHT = 384,
+	VIDEO_BITRATE = 4000000,
+	AUDIO_BITRATE = 128000,
+	//stereo 16 bit, which the encoder is given in pieces of this many frames
+	AUDIO_CHUNK = 1024,
+	//about a second of sound, far more than the drain thread ever falls behind by
+	SOUND_CAPACITY = 32768,
+	TRACK_VIDEO = 0,
+	TRACK_AUDIO = 1,
+	//how long the drain thread waits on the video encoder each time around; the sound has to keep up at that
+	DRAIN_TIMEOUT_US = 5000,
+	//how long the streams get to end before the file is finished without the rest of them
+	STOP_TIMEOUT_US = 2000000,
+};
+
+//the length of an emulated frame, 560190 of the bus's 33513982Hz cycles
+static const double kFrameNs = 1000000000.0 * 560190.0 / 33513982.0;
+
+//the encoded samples that came out before the muxer could be started, which needs the formats of both tracks
+struct PendingSample
+{
+	int track;
+	RecorderBufferInfo info;
+	std::vector<u8> data;
+};
+
+static struct Recorder
+{
+	AMediaCodec* codecs[2];
+	AMediaMuxer* muxer;
+	int fd;
+	ANativeWindow* window;
+	ssize_t tracks[2];
+	bool muxing;
+	std::vector<PendingSample> pending;
+	u64 audioFrames;	//given to the encoder
+
+	//the draw thread's frames
+	bool haveFirstSeq;
+	u32 firstSeq, lastSeq;
+
+	SoundRing sound;
+	volatile bool recording;
+	volatile bool stopping;
+	u32 serial;
+	Task task;
+	bool taskStarted;
+} rec = { { NULL, NULL }, NULL, -1, NULL, { -1, -1 } };
+
+//the window, against the draw thread
+static pthread_mutex_t* recorderMutex()
+{
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	return &mutex;
+}
+
+//the mixed sound comes through the avi hooks, which also keep the core from skipping frames or the mixing
+class RecorderDriver : public BaseDriver
+{
+public:
+	virtual void AVI_SoundUpdate(void* soundData, int soundLen)
+	{
+		//run ahead's frames that are not shown are not heard either
+		if(rec.recording && !spu_unheard && soundLen > 0)
+			rec.sound.write((const s16*)soundData, soundLen);
+	}
+	virtual bool AVI_IsRecording() { return rec.recording; }
+};
+static RecorderDriver recorderDriver;
+
+static AMediaCodec* createVideoEncoder(ANativeWindow** window)
+{
+	AMediaCodec* codec = media.createEncoderByType("video/avc");
+	if(!codec)
+		return NULL;
+	AMediaFormat* format = media.formatNew();
+	media.setString(format, "mime", "video/avc");
+	media.setInt32(format, "width", WIDTH);
+	media.setInt32(format, "height", HEIGHT);
+	media.setInt32(format, "color-format", COLOR_FORMAT_SURFACE);
+	media.setInt32(format, "bitrate", VIDEO_BITRATE);
+	media.setInt32(format, "frame-rate", 60);
+	media.setInt32(format, "i-frame-interval", 1);
+	const bool configured = media.configure(codec, format, NULL, NULL, MEDIACODEC_CONFIGURE_FLAG_ENCODE) == MEDIA_OK;
+	media.formatDelete(format);
+	if(!configured || media.createInputSurface(codec, window) != MEDIA_OK || media.start(codec) != MEDIA_OK)
+	{
+		media.release(codec);
+		return NULL;
+	}
+	return codec;
+}
+
+static AMediaCodec* createAudioEncoder()
+{
+	AMediaCodec* codec = media.createEncoderByType("audio/mp4a-latm");
+	if(!codec)
+		return NULL;
+	AMediaFormat* format = media.formatNew();
+	media.setString(format, "mime", "audio/mp4a-latm");
+	media.setInt32(format, "sample-rate", DESMUME_SAMPLE_RATE);
+	media.setInt32(format, "channel-count", 2);
+	media.setInt32(format, "bitrate", AUDIO_BITRATE);
+	media.setInt32(format, "aac-profile", AAC_OBJECT_LC);
+	media.setInt32(format, "max-input-size", AUDIO_CHUNK * 2 * sizeof(s16));
+	const bool configured = media.configure(codec, format, NULL, NULL, MEDIACODEC_CONFIGURE_FLAG_ENCODE) == MEDIA_OK;
+	media.formatDelete(format);
+	if(!configured || media.start(codec) != MEDIA_OK)
+	{
+		media.release(codec);
+		return NULL;
+	}
+	return codec;
+}
+
+static void writeSample(int track, const u8* data, const RecorderBufferInfo& info)
+{
+	if(rec.muxing)
+	{
+		media.writeSampleData(rec.muxer, rec.tracks[track], data, &info);
+		return;
+	}
+	PendingSample sample;
+	sample.track = track;
+	sample.info = info;
+	sample.info.offset = 0;
+	sample.data.assign(data + info.offset, data + info.offset + info.size);
+	rec.pending.push_back(sample);
+}
+
+//takes what the codec has encoded. returns true once its stream has ended
+static bool drain(int track, s64 timeoutUs)
+{
+	AMediaCodec* codec = rec.codecs[track];
+	for(;;)
+	{
+		RecorderBufferInfo info;
+		const ssize_t index = media.dequeueOutputBuffer(codec, &info, timeoutUs);
+		if(index == MEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED)
+		{
+			AMediaFormat* format = media.getOutputFormat(codec);
+			rec.tracks[track] = media.addTrack(rec.muxer, format);
+			media.formatDelete(format);
+			if(rec.tracks[TRACK_VIDEO] >= 0 && rec.tracks[TRACK_AUDIO] >= 0 && media.muxerStart(rec.muxer) == MEDIA_OK)
+			{
+				rec.muxing = true;
+				for(size_t i = 0; i < rec.pending.size(); i++)
+					media.writeSampleData(rec.muxer, rec.tracks[rec.pending[i].track], &rec.pending[i].data[0], &rec.pending[i].info);
+				rec.pending.clear();
+			}
+			continue;
+		}
+		if(index < 0)
+			return false;
+
+		size_t size = 0;
+		const u8* data = media.getOutputBuffer(codec, index, &size);
+		//the codec config is in the format the track was added with
+		if(data && info.size > 0 && !(info.flags & MEDIACODEC_BUFFER_FLAG_CODEC_CONFIG))
+			writeSample(track, data, info);
+		media.releaseOutputBuffer(codec, index, false);
+		if(info.flags & MEDIACODEC_BUFFER_FLAG_END_OF_STREAM)
+			return true;
+		timeoutUs = 0;
+	}
+}
+
+//gives the encoder the sound there is, and the end of the stream when ending. returns true once the end was given
+static bool feedAudio(bool ending)
+{
+	AMediaCodec* codec = rec.codecs[TRACK_AUDIO];
+	for(;;)
+	{
+		const u32 readable = rec.sound.readable();
+		if(readable < AUDIO_CHUNK && !ending)
+			return false;
+
+		const ssize_t index = media.dequeueInputBuffer(codec, 0);
+		if(index < 0)
+			return false;
+		size_t capacity = 0;
+		s16* buffer = (s16*)media.getInputBuffer(codec, index, &capacity);
+		const u32 count = buffer ? std::min<u32>(readable, capacity / (2 * sizeof(s16))) : 0;
+		for(u32 i = 0; i < count; i++)
+			memcpy(buffer + i * 2, rec.sound.frame(i), 2 * sizeof(s16));
+		rec.sound.consume(count);
+
+		const u64 timeUs = rec.audioFrames * 1000000 / DESMUME_SAMPLE_RATE;
+		rec.audioFrames += count;
+		const bool last = ending && count == readable;
+		media.queueInputBuffer(codec, index, 0, count * 2 * sizeof(s16), timeUs, last ? MEDIACODEC_BUFFER_FLAG_END_OF_STREAM : 0);
+		if(last)
+			return true;
+	}
+}
+
+static void* recorderLoop(void*)
+{
+	bool audioEnded = false, videoEnded = false;
+	bool audioDone = false, videoDone = false;
+	s64 waitedUs = 0;
+	while(!audioDone || !videoDone)
+	{
+		const bool stopping = rec.stopping;
+		if(!audioEnded)
+			audioEnded = feedAudio(stopping);
+		if(stopping && !videoEnded)
+		{
+			media.signalEndOfInputStream(rec.codecs[TRACK_VIDEO]);
+			videoEnded = true;
+		}
+
+		if(!videoDone)
+			videoDone = drain(TRACK_VIDEO, DRAIN_TIMEOUT_US);
+		if(!audioDone)
+			audioDone = drain(TRACK_AUDIO, videoDone ? DRAIN_TIMEOUT_US : 0);
+
+		if(stopping)
+		{
+			waitedUs += DRAIN_TIMEOUT_US;
+			if(waitedUs > STOP_TIMEOUT_US)
+			{
+				LOGW("The recording's streams did not end, finishing it without the rest");
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void releaseRecorder()
+{
+	pthread_mutex_lock(recorderMutex());
+	if(rec.window)
+		ANativeWindow_release(rec.window);
+	rec.window = NULL;
+	pthread_mutex_unlock(recorderMutex());
+
+	for(int i = 0; i < 2; i++)
+	{
+		if(rec.codecs[i])
+		{
+			media.stop(rec.codecs[i]);
+			media.release(rec.codecs[i]);
+		}
+		rec.codecs[i] = NULL;
+		rec.tracks[i] = -1;
+	}
+	if(rec.muxer)
+	{
+		if(rec.muxing)
+			media.muxerStop(rec.muxer);
+		media.muxerRelease(rec.muxer);
+	}
+	rec.muxer = NULL;
+	rec.muxing = false;
+	rec.pending.clear();
+	if(rec.fd >= 0)
+		close(rec.fd);
+	rec.fd = -1;
+	rec.sound.free();
+}
+
+bool recorder_start(const char* path)
+{
+	if(rec.recording || !recorder_available())
+		return false;
+
+	rec.fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if(rec.fd < 0)
+	{
+		LOGW("Could not open %s to record to", path);
+		return false;
+	}
+	rec.muxer = media.muxerNew(rec.fd, MEDIAMUXER_OUTPUT_FORMAT_MPEG_4);
+	ANativeWindow* window = NULL;
+	if(rec.muxer)
+		rec.codecs[TRACK_VIDEO] = createVideoEncoder(&window);
+	if(rec.codecs[TRACK_VIDEO])
+		rec.codecs[TRACK_AUDIO] = createAudioEncoder();
+	if(!rec.codecs[TRACK_AUDIO])
+	{
+		LOGW("Could not set up the encoders to record with");
+		if(window)
+			ANativeWindow_release(window);
+		releaseRecorder();
+		unlink(path);
+		return false;
+	}
+
+	rec.sound.init(SOUND_CAPACITY, SOUND_CAPACITY);
+	rec.audioFrames = 0;
+	rec.haveFirstSeq = false;
+	rec.stopping = false;
+	pthread_mutex_lock(recorderMutex());
+	rec.window = window;
+	rec.serial = rec.serial + 1 ? rec.serial + 1 : 1;
+	pthread_mutex_unlock(recorderMutex());
+
+	if(!rec.taskStarted)
+	{
+		rec.task.start(false, "Recorder", THREAD_ROLE_BACKGROUND);
+		rec.taskStarted = true;
+	}
+	rec.task.execute(recorderLoop, NULL);
+
+	driver = &recorderDriver;
+	rec.recording = true;
+	LOGI("Recording to %s", path);
+	return true;
+}
+
+void recorder_stop()
+{
+	if(!rec.recording)
+		return;
+	rec.recording = false;
+	rec.stopping = true;
+	rec.task.finish();
+	releaseRecorder();
+	LOGI("Recording finished");
+}
+
+bool recorder_recording()
+{
+	return rec.recording;
+}
+
+ANativeWindow* recorder_acquireWindow(u32* serial)
+{
+	pthread_mutex_lock(recorderMutex());
+	ANativeWindow* window = rec.recording ? rec.window : NULL;
+	if(window)
+		ANativeWindow_acquire(window);
+	*serial = rec.serial;
+	pthread_mutex_unlock(recorderMutex());
+	return window;
+}
+
+u32 recorder_serial()
+{
+	return __atomic_load_n(&rec.serial, __ATOMIC_ACQUIRE);
+}
+
+s64 recorder_frameTime(u32 seq)
+{
+	if(!rec.recording || (rec.haveFirstSeq && seq == rec.lastSeq))
+		return -1;
+	if(!rec.haveFirstSeq || seq < rec.firstSeq)
+	{
+		rec.firstSeq = seq;
+		rec.haveFirstSeq = true;
+	}
+	rec.lastSeq = seq;
+	return (s64)((seq - rec.firstSeq) * kFrameNs);
+}
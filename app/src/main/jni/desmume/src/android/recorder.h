@@ -0,0 +1,48 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RECORDER_H
+#define _RECORDER_H
+
+#include "../types.h"
+#include <android/native_window.h>
+
+//records the game to an mp4 with the device's hardware encoders (android 8.0 on): the screens go in as h.264 through
+//the video encoder's input surface, which the GLES presentation draws them into on the gpu, and the sound goes in as
+//aac from the mixed output of the core. the encoded output is muxed on a thread of its own, so all the emulation
+//thread does is hand over the sound. both are timed by the emulated frames and samples, not by the wall clock
+
+//whether this system has what it takes
+bool recorder_available();
+
+//starts writing to path. false when it can't
+bool recorder_start(const char* path);
+//ends the streams and finishes the file
+void recorder_stop();
+bool recorder_recording();
+
+//draw thread
+//the encoder's input surface, with a reference for the caller, or NULL when not recording. serial is which
+//recording it is for, so that the caller knows to make its surface for the new one
+ANativeWindow* recorder_acquireWindow(u32* serial);
+//changes with each recording, and is never 0
+u32 recorder_serial();
+//the presentation time in nanoseconds of the published frame seq, or -1 when it is not to be recorded: when not
+//recording, or when it already was
+s64 recorder_frameTime(u32 seq);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "runahead.h"
+#include <algorithm>
+#include "frametimes.h"
+#include "../NDSSystem.h"
+#include "../SPU.h"
+#include "../saves.h"
+#include "../frameprofile.h"
+
+//frames the cost is averaged over before the frames run ahead are changed
+static const int kWindowFrames = 30;
+
+static int wanted = 0; //what the settings ask for
+static int lastWanted = 0;
+static int frames = 0; //fewer than wanted while they don't fit
+static StateJournal* journal = NULL;
+
+//the emulation thread's averages over the window
+static u64 windowNs = 0;
+static u32 windowFrames = 0;
+static u32 windowRun = 0; //the frames they ran, real and ahead
+
+//for runahead_takeHeadroom
+static s64 headroomTotal = 0;
+static u32 headroomCount = 0;
+
+void runahead_setFrames(int n)
+{
+	__atomic_store_n(&wanted, std::max(0, std::min(n, RUNAHEAD_MAX_FRAMES)), __ATOMIC_RELAXED);
+}
+
+int runahead_frames()
+{
+	return __atomic_load_n(&frames, __ATOMIC_RELAXED);
+}
+
+s32 runahead_takeHeadroom()
+{
+	const s64 total = __atomic_exchange_n(&headroomTotal, 0, __ATOMIC_RELAXED);
+	const u32 count = __atomic_exchange_n(&headroomCount, 0, __ATOMIC_RELAXED);
+	return count ? (s32)(total / count) : 0;
+}
+
+//one more frame ahead goes if the frames went over their time, and comes back once one more would fit in it
+static void adapt(u64 ns, int run)
+{
+	windowNs += ns;
+	windowRun += run;
+	if(++windowFrames < kWindowFrames)
+		return;
+
+	const u64 average = windowNs / windowFrames;
+	const u64 perFrame = windowNs / windowRun;
+	const u64 budget = FrameTimes::BUDGET_US * 1000ULL;
+	int n = frames;
+	if(average > budget && n > 0)
+		n--;
+	else if(average + perFrame < budget && n < wanted)
+		n++;
+	__atomic_store_n(&frames, n, __ATOMIC_RELAXED);
+	windowNs = 0;
+	windowFrames = 0;
+	windowRun = 0;
+}
+
+bool runahead_frame()
+{
+	const int want = __atomic_load_n(&wanted, __ATOMIC_RELAXED);
+	if(want != lastWanted)
+	{
+		lastWanted = want;
+		__atomic_store_n(&frames, want, __ATOMIC_RELAXED);
+		windowNs = 0;
+		windowFrames = 0;
+		windowRun = 0;
+	}
+	if(!want)
+	{
+		delete journal;
+		journal = NULL;
+		return false;
+	}
+
+	const u64 start = frameprofile_now();
+	const int ahead = frames;
+
+	//the frontend's frame skip is for the frame that gets shown
+	bool skipWith2D;
+	const bool skipAsked = NDS_SkipRequested(skipWith2D);
+
+	NDS_beginProcessingInput();
+	NDS_endProcessingInput();
+
+	//the 2d of a frame shows the 3d of the one before it, so that is the only one of the frames ahead to render its 3d.
+	//the rest are skipped whole, the shown one too: what it leaves undone is only seen by the frame after it, which is
+	//run again from the kept state
+	for(int i = 0; i <= ahead; i++)
+	{
+		if(ahead)
+		{
+			if(i != ahead - 1 || (skipAsked && skipWith2D))
+				NDS_SkipNextFrame();
+			else if(skipAsked)
+				NDS_SkipNext3DFrame();
+		}
+
+		NDS_exec<false>();
+
+		if(i == 0)
+		{
+			SPU_Emulate_user();
+			if(!ahead)
+				break;
+			if(!journal)
+				journal = new StateJournal(1);
+			journal->save();
+			SPU_SetUnheard(true);
+		}
+	}
+
+	if(ahead)
+	{
+		journal->restore(0);
+		SPU_SetUnheard(false);
+	}
+
+	const u64 ns = frameprofile_now() - start;
+	__atomic_fetch_add(&headroomTotal, (s64)FrameTimes::BUDGET_US - (s64)(ns / 1000), __ATOMIC_RELAXED);
+	__atomic_fetch_add(&headroomCount, 1, __ATOMIC_RELAXED);
+	adapt(ns, ahead + 1);
+	return true;
+}
@@ -0,0 +1,41 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RUNAHEAD_H
+#define _RUNAHEAD_H
+
+#include "../types.h"
+
+//run-ahead: games that take a few frames to show what the buttons did are made to show it sooner. each frame is run
+//for real (its sound heard, nothing it draws shown), the state is kept, and the frames after it are run on the same
+//input without their sound, the last of them shown. then the emulation goes back to the kept state.
+//it costs a frame's emulation for each frame ahead, so while the frames don't fit in the time a frame has, fewer
+//are run ahead than were asked for, and more again once they fit.
+#define RUNAHEAD_MAX_FRAMES 3
+
+//frames to run ahead, 0 for off. from any thread, taking effect at the next frame
+void runahead_setFrames(int frames);
+
+//the emulation thread's frame while run-ahead is on. false if it is off, and the frame is left to run as usual
+bool runahead_frame();
+
+//from any thread: the frames run ahead now, and the microseconds the frames had left of their time, on average
+//since the last call (negative for over it)
+int runahead_frames();
+s32 runahead_takeHeadroom();
+
+#endif
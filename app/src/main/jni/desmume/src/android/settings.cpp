@@ -0,0 +1,108 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "settings.h"
+#include "main.h"
+
+static const char* const settingKeys[] = {
+#define NATIVE_SETTING_KEY(type, field, key, def) key,
+	NATIVE_SETTINGS(NATIVE_SETTING_KEY)
+#undef NATIVE_SETTING_KEY
+};
+
+static const jint settingDefaults[] = {
+#define NATIVE_SETTING_DEFAULT(type, field, key, def) (jint)(def),
+	NATIVE_SETTINGS(NATIVE_SETTING_DEFAULT)
+#undef NATIVE_SETTING_DEFAULT
+};
+
+static const int settingCount = sizeof(settingKeys) / sizeof(settingKeys[0]);
+
+//made once and kept: the keys and defaults never change, so each load is just the one call
+static jclass settingsClass = NULL;
+static jmethodID getSettingsMethod = NULL;
+static jobjectArray keyArray = NULL;
+static jintArray defaultArray = NULL;
+
+static bool lookup(JNIEnv* env)
+{
+	if(keyArray) return true;
+
+	jclass javaClass = env->FindClass("com/opendoorstudios/ds4droid/DeSmuME");
+	if(!javaClass) return false;
+	jmethodID method = env->GetStaticMethodID(javaClass, "getSettings", "([Ljava/lang/String;[I)[I");
+	if(!method) return false;
+
+	jobjectArray keys = env->NewObjectArray(settingCount, env->FindClass("java/lang/String"), NULL);
+	jintArray defaults = env->NewIntArray(settingCount);
+	if(!keys || !defaults) return false;
+	for(int i = 0; i < settingCount; i++)
+	{
+		jstring key = env->NewStringUTF(settingKeys[i]);
+		if(!key) return false;
+		env->SetObjectArrayElement(keys, i, key);
+		env->DeleteLocalRef(key);
+	}
+	env->SetIntArrayRegion(defaults, 0, settingCount, settingDefaults);
+
+	settingsClass = (jclass)env->NewGlobalRef(javaClass);
+	getSettingsMethod = method;
+	defaultArray = (jintArray)env->NewGlobalRef(defaults);
+	keyArray = (jobjectArray)env->NewGlobalRef(keys);
+	env->DeleteLocalRef(keys);
+	env->DeleteLocalRef(defaults);
+	env->DeleteLocalRef(javaClass);
+	return true;
+}
+
+static void fill(NativeSettings& out, const jint* values)
+{
+	int i = 0;
+#define NATIVE_SETTING_READ(type, field, key, def) out.field = (type)values[i++];
+	NATIVE_SETTINGS(NATIVE_SETTING_READ)
+#undef NATIVE_SETTING_READ
+}
+
+bool settings_load(JNIEnv* env, NativeSettings& out)
+{
+	jint values[settingCount];
+	bool ok = false;
+	if(lookup(env))
+	{
+		jintArray result = (jintArray)env->CallStaticObjectMethod(settingsClass, getSettingsMethod, keyArray, defaultArray);
+		if(result && !env->ExceptionCheck() && env->GetArrayLength(result) == settingCount)
+		{
+			env->GetIntArrayRegion(result, 0, settingCount, values);
+			ok = true;
+		}
+		if(result) env->DeleteLocalRef(result);
+	}
+	if(env->ExceptionCheck())
+	{
+		env->ExceptionDescribe();
+		env->ExceptionClear();
+	}
+
+	if(!ok)
+	{
+		LOGW("Couldn't read the settings, using the defaults");
+		fill(out, settingDefaults);
+		return false;
+	}
+	fill(out, values);
+	return true;
+}
@@ -0,0 +1,104 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SETTINGS_H
+#define _SETTINGS_H
+
+#include <jni.h>
+#include "../types.h"
+
+//every preference the core reads: (type, field, preference key, default).
+//a default of -1 is for the ones whose default depends on another setting, and is sorted out after reading them
+#define NATIVE_SETTINGS(X) \
+	X(int,  corePlacement,        "CorePlacement",          0) \
+	X(bool, cheatsDisable,        "cheatsDisable",          false) \
+	X(int,  autoDetectMethod,     "autoDetectMethod",       0) \
+	X(bool, enableMicrophone,     "EnableMicrophone",       true) \
+	X(int,  windowRotate,         "WindowRotate",           0) \
+	X(int,  windowRotateSet,      "WindowRotateSet",        -1) \
+	X(int,  lcdsLayout,           "LCDsLayout",             0) \
+	X(int,  lcdsSwap,             "LCDsSwap",               0) \
+	X(int,  filter,               "Filter",                 0) \
+	X(bool, displayFps,           "DisplayFps",             true) \
+	X(bool, frameCounter,         "FrameCounter",           false) \
+	X(bool, profiler,             "Profiler",               false) \
+	X(bool, systemTrace,          "SystemTrace",            false) \
+	X(bool, displayInput,         "DisplayInput",           false) \
+	X(bool, displayGraphicalInput,"DisplayGraphicalInput",  false) \
+	X(bool, displayLagCounter,    "DisplayLagCounter",      false) \
+	X(bool, displayMicrophone,    "DisplayMicrophone",      false) \
+	X(bool, displayRTC,           "DisplayRTC",             false) \
+	X(int,  screenGap,            "ScreenGap",              0) \
+	X(bool, mainGpu,              "MainGpu",                true) \
+	X(bool, subGpu,               "SubGpu",                 true) \
+	X(int,  frameSkip,            "FrameSkip",              1) \
+	X(int,  runAhead,             "RunAhead",               0) \
+	X(bool, costFrameSkip,        "CostFrameSkip",          false) \
+	X(bool, parallelGPU2D,        "ParallelGPU2D",          false) \
+	X(bool, threadedGeometry,     "ThreadedGeometry",       false) \
+	X(bool, gpuFilter,            "GPUFilter",              true) \
+	X(bool, vsyncPacing,          "VsyncPacing",            true) \
+	X(bool, displayPacing,        "DisplayPacing",          false) \
+	X(bool, displayLockAudio,     "DisplayLockAudio",       false) \
+	X(int,  micMode,              "MicMode",                0) \
+	X(int,  micBuffer,            "MicBuffer",              40) \
+	X(bool, spuAdvanced,          "SpuAdvanced",            false) \
+	X(int,  spuInterpolation,     "SPUInterpolation",       1) \
+	X(int,  synchMode,            "SynchMode",              0) \
+	X(int,  synchMethod,          "SynchMethod",            0) \
+	X(bool, audioThread,          "AudioThread",            false) \
+	X(bool, soundCore,            "SoundCore",              true) \
+	X(int,  soundBufferSize,      "SoundBufferSize",        -1) \
+	X(bool, advancedTiming,       "AdvancedTiming",         false) \
+	X(bool, cpuMode,              "CpuMode",                false) \
+	X(int,  jitSize,              "JitSize",                10) \
+	X(int,  jitCacheSize,         "JitCacheSize",           2) \
+	X(int,  cpuSkew,              "CpuSkew",                0) \
+	X(bool, sdkHle,               "SdkHle",                 true) \
+	X(bool, gamePresets,          "GamePresets",            true) \
+	X(int,  renderer,             "Renderer",               2) \
+	X(int,  zeldaShadowDepthHack, "ZeldaShadowDepthHack",   0) \
+	X(bool, highResInterpolate,   "HighResolutionInterpolateColor", false) \
+	X(bool, edgeMark,             "EnableEdgeMark",         false) \
+	X(bool, fog,                  "EnableFog",              true) \
+	X(bool, texture,              "EnableTexture",          true) \
+	X(bool, lineHack,             "EnableLineHack",         false) \
+	X(bool, txtHack,              "EnableTXTHack",          false) \
+	X(bool, pipelinedRender,      "PipelinedRender",        false) \
+	X(bool, gpuComposite,         "GPUComposite",           false) \
+	X(int,  softRastScale,        "SoftRastScale",          0) \
+	X(int,  qualityGovernor,      "QualityGovernor",        0) \
+	X(bool, persistentTexCache,   "PersistentTexCache",     false) \
+	X(int,  language,             "Language",               1) \
+	X(int,  romCacheSize,         "RomCacheSize",           2) \
+	X(int,  quickSaveCompression, "QuickSaveCompression",   1) \
+	X(int,  wifiMode,             "Mode",                   0) \
+	X(int,  wifiBridgeAdapter,    "BridgeAdapter",          0)
+
+//the preferences as the core uses them, read from java all at once instead of with an upcall per key
+struct NativeSettings
+{
+#define NATIVE_SETTING_FIELD(type, field, key, def) type field;
+	NATIVE_SETTINGS(NATIVE_SETTING_FIELD)
+#undef NATIVE_SETTING_FIELD
+};
+
+//one call into java for the lot. on failure (the class or method not found, or out of memory) it fills in the defaults
+//and returns false. from a thread java called into, so the app's classes can be found
+bool settings_load(JNIEnv* env, NativeSettings& out);
+
+#endif
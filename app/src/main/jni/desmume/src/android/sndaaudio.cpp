@@ -0,0 +1,300 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SPU.h"
+#include "sndaaudio.h"
+#include "soundring.h"
+#include "main.h"
+#include "utils/task.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <algorithm>
+
+int SNDAAudioInit(int buffersize);
+void SNDAAudioDeInit();
+void SNDAAudioUpdateAudio(s16 *buffer, u32 num_samples);
+u32 SNDAAudioGetAudioSpace();
+void SNDAAudioMuteAudio();
+void SNDAAudioUnMuteAudio();
+void SNDAAudioSetVolume(int volume);
+void SNDAAudioClearAudioBuffer();
+
+SoundInterface_struct SNDAAudio = {
+	SNDCORE_AAUDIO,
+	"AAudio Sound Interface",
+	SNDAAudioInit,
+	SNDAAudioDeInit,
+	SNDAAudioUpdateAudio,
+	SNDAAudioGetAudioSpace,
+	SNDAAudioMuteAudio,
+	SNDAAudioUnMuteAudio,
+	SNDAAudioSetVolume,
+	SNDAAudioClearAudioBuffer,
+};
+
+//the app still runs on 5.0, so libaaudio is looked up at runtime, and the bits of its api used here are declared here
+typedef struct AAudioStreamBuilderStruct AAudioStreamBuilder;
+typedef struct AAudioStreamStruct AAudioStream;
+typedef int32_t aaudio_result_t;
+typedef aaudio_result_t (*AAudioDataCallback)(AAudioStream* stream, void* userData, void* audioData, int32_t numFrames);
+typedef void (*AAudioErrorCallback)(AAudioStream* stream, void* userData, aaudio_result_t error);
+
+enum
+{
+	AAUDIO_OK = 0,
+	AAUDIO_DIRECTION_OUTPUT = 0,
+	AAUDIO_FORMAT_PCM_I16 = 1,
+	AAUDIO_SHARING_MODE_EXCLUSIVE = 0,
+	AAUDIO_PERFORMANCE_MODE_LOW_LATENCY = 12,
+	AAUDIO_CALLBACK_RESULT_CONTINUE = 0,
+};
+
+static struct
+{
+	aaudio_result_t (*createStreamBuilder)(AAudioStreamBuilder** builder);
+	void (*setDirection)(AAudioStreamBuilder* builder, int32_t direction);
+	void (*setSharingMode)(AAudioStreamBuilder* builder, int32_t sharingMode);
+	void (*setPerformanceMode)(AAudioStreamBuilder* builder, int32_t mode);
+	void (*setFormat)(AAudioStreamBuilder* builder, int32_t format);
+	void (*setChannelCount)(AAudioStreamBuilder* builder, int32_t channelCount);
+	void (*setDataCallback)(AAudioStreamBuilder* builder, AAudioDataCallback callback, void* userData);
+	void (*setErrorCallback)(AAudioStreamBuilder* builder, AAudioErrorCallback callback, void* userData);
+	aaudio_result_t (*openStream)(AAudioStreamBuilder* builder, AAudioStream** stream);
+	aaudio_result_t (*deleteBuilder)(AAudioStreamBuilder* builder);
+	aaudio_result_t (*requestStart)(AAudioStream* stream);
+	aaudio_result_t (*requestPause)(AAudioStream* stream);
+	aaudio_result_t (*requestStop)(AAudioStream* stream);
+	aaudio_result_t (*close)(AAudioStream* stream);
+	int32_t (*getSampleRate)(AAudioStream* stream);
+	int32_t (*getFramesPerBurst)(AAudioStream* stream);
+	aaudio_result_t (*setBufferSizeInFrames)(AAudioStream* stream, int32_t numFrames);
+} aaudio;
+
+static bool aaudioLoaded = false;
+
+static bool loadAAudio()
+{
+	if(aaudioLoaded)
+		return true;
+	void* lib = dlopen("libaaudio.so", RTLD_NOW);
+	if(!lib)
+		return false;
+
+	#define LOAD(field, name) if(!(*(void**)&aaudio.field = dlsym(lib, name))) return false;
+	LOAD(createStreamBuilder, "AAudio_createStreamBuilder");
+	LOAD(setDirection, "AAudioStreamBuilder_setDirection");
+	LOAD(setSharingMode, "AAudioStreamBuilder_setSharingMode");
+	LOAD(setPerformanceMode, "AAudioStreamBuilder_setPerformanceMode");
+	LOAD(setFormat, "AAudioStreamBuilder_setFormat");
+	LOAD(setChannelCount, "AAudioStreamBuilder_setChannelCount");
+	LOAD(setDataCallback, "AAudioStreamBuilder_setDataCallback");
+	LOAD(setErrorCallback, "AAudioStreamBuilder_setErrorCallback");
+	LOAD(openStream, "AAudioStreamBuilder_openStream");
+	LOAD(deleteBuilder, "AAudioStreamBuilder_delete");
+	LOAD(requestStart, "AAudioStream_requestStart");
+	LOAD(requestPause, "AAudioStream_requestPause");
+	LOAD(requestStop, "AAudioStream_requestStop");
+	LOAD(close, "AAudioStream_close");
+	LOAD(getSampleRate, "AAudioStream_getSampleRate");
+	LOAD(getFramesPerBurst, "AAudioStream_getFramesPerBurst");
+	LOAD(setBufferSizeInFrames, "AAudioStream_setBufferSizeInFrames");
+	#undef LOAD
+
+	aaudioLoaded = true;
+	return true;
+}
+
+bool SNDAAudioAvailable()
+{
+	return loadAAudio();
+}
+
+static AAudioStream* stream = NULL;
+static volatile bool muted = false;
+static volatile bool paused = false;
+static volatile int gain = 256;		//of 256
+
+//the device runs at its own rate, so there is no resampling to do anywhere past here: the frames are stepped
+//through at 44100/its rate, in 16.16 fixed point, and the two either side blended
+static u32 step = 0x10000;
+static u32 phase = 0;
+static s16 last[2] = {0, 0};
+
+static aaudio_result_t dataCallback(AAudioStream* s, void* userData, void* audioData, int32_t numFrames)
+{
+	//a new stream may come with a new thread
+	static __thread bool named = false;
+	if(!named)
+	{
+		setCurrentThreadName("AAudio callback");
+		named = true;
+	}
+	s16* out = (s16*)audioData;
+	const u32 avail = soundRing.readable();
+	u32 used = 0;
+	bool dry = false;
+	const int g = muted ? 0 : gain;
+
+	for(int32_t i = 0; i < numFrames; i++)
+	{
+		if(used == avail)
+		{
+			//ran dry: hold the last level rather than clicking down to silence
+			if(!dry)
+				soundRing.underrun();
+			dry = true;
+			out[i*2] = (s16)((last[0] * g) >> 8);
+			out[i*2+1] = (s16)((last[1] * g) >> 8);
+			continue;
+		}
+		const s16* frame = soundRing.frame(used);
+		const s32 f = phase >> 4;
+		const s32 l = last[0] + (((frame[0] - last[0]) * f) >> 12);
+		const s32 r = last[1] + (((frame[1] - last[1]) * f) >> 12);
+		out[i*2] = (s16)((l * g) >> 8);
+		out[i*2+1] = (s16)((r * g) >> 8);
+
+		phase += step;
+		while(phase >= 0x10000 && used != avail)
+		{
+			phase -= 0x10000;
+			last[0] = soundRing.frame(used)[0];
+			last[1] = soundRing.frame(used)[1];
+			used++;
+		}
+	}
+
+	soundRing.consume(used);
+	return AAUDIO_CALLBACK_RESULT_CONTINUE;
+}
+
+static void errorCallback(AAudioStream* s, void* userData, aaudio_result_t error)
+{
+	//the device went away (headphones pulled out and the like). opening a new stream has to happen off this thread,
+	//so the sound just stops until the next time the sound core is changed
+	LOGW("AAudio stream error %d", (int)error);
+}
+
+int SNDAAudioInit(int buffersize)
+{
+	if(!loadAAudio())
+		return -1;
+
+	AAudioStreamBuilder* builder;
+	if(aaudio.createStreamBuilder(&builder) != AAUDIO_OK)
+		return -1;
+	aaudio.setDirection(builder, AAUDIO_DIRECTION_OUTPUT);
+	aaudio.setSharingMode(builder, AAUDIO_SHARING_MODE_EXCLUSIVE);
+	aaudio.setPerformanceMode(builder, AAUDIO_PERFORMANCE_MODE_LOW_LATENCY);
+	aaudio.setFormat(builder, AAUDIO_FORMAT_PCM_I16);
+	aaudio.setChannelCount(builder, 2);
+	//no sample rate is asked for, so the stream gets the device's own
+	aaudio.setDataCallback(builder, dataCallback, NULL);
+	aaudio.setErrorCallback(builder, errorCallback, NULL);
+	const aaudio_result_t result = aaudio.openStream(builder, &stream);
+	aaudio.deleteBuilder(builder);
+	if(result != AAUDIO_OK)
+	{
+		stream = NULL;
+		return -1;
+	}
+
+	const int32_t rate = aaudio.getSampleRate(stream);
+	step = rate > 0 ? (u32)(((u64)DESMUME_SAMPLE_RATE << 16) / rate) : 0x10000;
+	phase = 0;
+	last[0] = last[1] = 0;
+
+	//the least the device will play without glitching
+	const int32_t burst = aaudio.getFramesPerBurst(stream);
+	if(burst > 0)
+		aaudio.setBufferSizeInFrames(stream, burst * 2);
+
+	//kept topped up to a frame of emulation, what the device holds, and a bit for the emulation being late.
+	//that is all the latency there is past the device's
+	const u32 deviceFrames = burst > 0 && rate > 0 ? (u32)((u64)burst * 2 * DESMUME_SAMPLE_RATE / rate) : 512;
+	const u32 target = DESMUME_SAMPLE_RATE / 60 + deviceFrames + 256;
+	//and it can hold more than that, as much as the emulation is asked for at a time (buffersize is in bytes, for
+	//the two buffers opensl rotates through), for frames that are late by more than a bit
+	soundRing.init(std::max<u32>(target * 2, buffersize / (2 * sizeof(s16))), target);
+	muted = false;
+	paused = false;
+
+	if(aaudio.requestStart(stream) != AAUDIO_OK)
+	{
+		SNDAAudioDeInit();
+		return -1;
+	}
+
+	LOGI("AAudio created (for audio output) at %d Hz, %d frames a burst", (int)rate, (int)burst);
+	return 0;
+}
+
+void SNDAAudioDeInit()
+{
+	if(stream)
+	{
+		aaudio.requestStop(stream);
+		aaudio.close(stream);
+		stream = NULL;
+	}
+	//the callbacks are over with the stream
+	soundRing.free();
+}
+
+void SNDAAudioUpdateAudio(s16 *buffer, u32 num_samples)
+{
+	soundRing.write(buffer, num_samples);
+}
+
+u32 SNDAAudioGetAudioSpace()
+{
+	//just enough to keep the device going until the next frame of emulation, rather than all the ring has room for
+	return soundRing.space();
+}
+
+void SNDAAudioMuteAudio()
+{
+	muted = true;
+}
+
+void SNDAAudioUnMuteAudio()
+{
+	muted = false;
+}
+
+void SNDAAudioSetVolume(int volume)
+{
+	gain = volume * 256 / 100;
+}
+
+void SNDAAudioClearAudioBuffer()
+{
+	soundRing.clear();
+}
+
+void SNDAAudioPaused(bool set)
+{
+	if(!stream || paused == set)
+		return;
+	paused = set;
+	if(set)
+		aaudio.requestPause(stream);
+	else
+		aaudio.requestStart(stream);
+}
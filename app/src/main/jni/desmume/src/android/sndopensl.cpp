@@ -17,7 +17,9 @@
 
 #include "SPU.h"
 #include "sndopensl.h"
+#include "soundring.h"
 #include "main.h"
+#include "utils/task.h"
 
 #include <SLES/OpenSLES.h>
 #include <SLES/OpenSLES_Android.h>
@@ -53,55 +55,39 @@ static SLObjectItf bqPlayerObject = NULL;
 static SLPlayItf bqPlayerPlay;
 static SLAndroidSimpleBufferQueueItf bqPlayerBufferQueue;
 static SLVolumeItf bqPlayerVolume;
-static bool everEnqueued = false;
 
+//the two buffers opensl plays from, one playing and one queued after it. the callback fills the one that just
+//finished from the sound ring and queues it again; on running dry it fills out the rest with silence
+static const int NUM_BUFFERS = 2;
+static s16* buffers[NUM_BUFFERS] = {NULL, NULL};
+static int nextBuffer = 0;
+static u32 bufferFrames = 0;
+static SLmillibel maxVol;
 
-class SoundBuffer
+void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 {
-public:
-	SoundBuffer() : data(NULL)
-	{
-		reset();
-	}
-	~SoundBuffer()
+	//the callbacks come on a thread of OpenSL's, which otherwise goes without a name
+	static __thread bool named = false;
+	if(!named)
 	{
-		reset();
+		setCurrentThreadName("OpenSL callback");
+		named = true;
 	}
-	void reset()
-	{
-		if(data != NULL)
-			delete [] data;
-		data = NULL;
-		avail = true;
-		samples = 0;
-	}
-	s16* data;
-	bool avail;
-	int samples;
-};
-
-static const int NUM_BUFFERS = 2;
-SoundBuffer buffers[NUM_BUFFERS];
-SoundBuffer empty;
-
-static bool muted = false;
-static bool currentlyPlaying = false;
-static int soundbufsize = 0;
-static int nextSoundBuffer = -1;
-static SLmillibel maxVol;
+	soundRing.read(buffers[nextBuffer], bufferFrames);
+	(*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, buffers[nextBuffer], bufferFrames * sizeof(s16) * 2);
+	nextBuffer = (nextBuffer + 1) % NUM_BUFFERS;
+}
 
-void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
+//starts it playing silence, which keeps the callback coming back for more
+static void startQueue()
 {
-	SLresult result;
-	if(buffers[nextSoundBuffer].avail)
+	(*bqPlayerBufferQueue)->Clear(bqPlayerBufferQueue);
+	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
 	{
-		result = (*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, empty.data, soundbufsize);
-		//LOGI("Returned empty sound buffer");
-		return;
+		memset(buffers[i], 0, bufferFrames * sizeof(s16) * 2);
+		(*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, buffers[i], bufferFrames * sizeof(s16) * 2);
 	}
-	//LOGI("Returned sound buffer %d", nextSoundBuffer);
-	result = (*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, buffers[nextSoundBuffer].data, buffers[nextSoundBuffer].samples * sizeof(s16) * 2);
-	buffers[nextSoundBuffer == 0 ? 1 : 0].avail = true;
+	nextBuffer = 0;
 }
 
 int SNDOpenSLInit(int buffersize)
@@ -161,24 +147,20 @@ int SNDOpenSLInit(int buffersize)
 	if(FAILED(result = (*bqPlayerVolume)->GetMaxVolumeLevel(bqPlayerVolume, &maxVol)))
 		return -1;
 		
+	//buffersize is in bytes, for each of the buffers. the ring is kept full enough for the callback to find a whole
+	//buffer's worth each time, with a frame of emulation to spare
+	bufferFrames = buffersize / (sizeof(s16) * 2);
+	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
+	{
+		delete [] buffers[i];
+		buffers[i] = new s16[bufferFrames * 2];
+	}
+	soundRing.init(bufferFrames * 2 + DESMUME_SAMPLE_RATE / 60, bufferFrames + DESMUME_SAMPLE_RATE / 60);
+	startQueue();
+
     if(FAILED(result = (*bqPlayerPlay)->SetPlayState(bqPlayerPlay, SL_PLAYSTATE_PLAYING)))
 		return -1;
-		
-	buffers[0].reset();
-	buffers[1].reset();
-	soundbufsize = buffersize;
-	if ((buffers[0].data = new s16[soundbufsize / sizeof(s16)]) == NULL)
-		return -1;
-	if ((buffers[1].data = new s16[soundbufsize / sizeof(s16)]) == NULL)
-		return -1;
-	if ((empty.data = new s16[soundbufsize / sizeof(s16)]) == NULL)
-		return -1;
 
-	memset(buffers[0].data, 0, soundbufsize);
-	memset(buffers[1].data, 0, soundbufsize);
-	memset(empty.data, 0, soundbufsize);
-	muted = false;
-	currentlyPlaying = false;
 	LOGI("OpenSL created (for audio output)");
 	return 0;
 }
@@ -194,6 +176,14 @@ void SNDOpenSLDeInit()
         (*outputMixObject)->Destroy(outputMixObject);
         outputMixObject = NULL;
 	}
+
+	//the callbacks are over with the player
+	soundRing.free();
+	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
+	{
+		delete [] buffers[i];
+		buffers[i] = NULL;
+	}
 	
 	/*if (engineObject != NULL) {
         (*engineObject)->Destroy(engineObject);
@@ -203,36 +193,12 @@ void SNDOpenSLDeInit()
 
 void SNDOpenSLUpdateAudio(s16 *buffer, u32 num_samples)
 {
-	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
-	{
-		if(buffers[i].avail)
-		{
-			memcpy(buffers[i].data, buffer, sizeof(s16) * 2 * num_samples);
-			int currentSoundBuffer = nextSoundBuffer;
-			buffers[i].samples = num_samples;
-			buffers[i].avail = false;
-			nextSoundBuffer = i;
-			if(!currentlyPlaying)
-			{
-				(*bqPlayerBufferQueue)->Clear(bqPlayerBufferQueue);
-				bqPlayerCallback(bqPlayerBufferQueue, NULL);
-				currentlyPlaying = true;
-			}
-			//LOGI("Copied %d samples to buffer %d", num_samples, nextSoundBuffer);
-			return;
-		}
-	}
-	//should never get here...
+	soundRing.write(buffer, num_samples);
 }
 
 u32 SNDOpenSLGetAudioSpace()
 {
-	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
-	{
-		if(buffers[i].avail)
-			return soundbufsize / (sizeof(s16) * 2);
-	}
-	return 0;
+	return soundRing.space();
 }
 
 void SNDOpenSLMuteAudio()
@@ -257,13 +223,14 @@ void SNDOpenSLSetVolume(int volume)
 
 void SNDOpenSLClearAudioBuffer()
 {
-	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
-		memset(buffers[i].data, 0, soundbufsize);
+	soundRing.clear();
 }
 
 void SNDOpenSLPaused(bool paused)
 {
-	if(bqPlayerPlay == NULL)
+	if(bqPlayerObject == NULL)
 		return;
+	if(!paused)
+		startQueue();
 	(*bqPlayerPlay)->SetPlayState(bqPlayerPlay, paused ? SL_PLAYSTATE_STOPPED : SL_PLAYSTATE_PLAYING);
 }
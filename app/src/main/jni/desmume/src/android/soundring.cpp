@@ -0,0 +1,121 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "soundring.h"
+#include <string.h>
+#include <algorithm>
+
+SoundRing soundRing;
+
+SoundRing::SoundRing()
+	: data(NULL)
+	, mask(0)
+	, target(0)
+	, underruns(0)
+	, overruns(0)
+	, clearRequested(false)
+	, writePos(0)
+	, readPos(0)
+{
+}
+
+SoundRing::~SoundRing()
+{
+	free();
+}
+
+//only while no backend reads it: before its callbacks start, and after they stop
+void SoundRing::init(u32 capacity, u32 target)
+{
+	free();
+	u32 frames = 1;
+	while(frames < capacity)
+		frames <<= 1;
+	data = new s16[frames * 2];
+	memset(data, 0, frames * 2 * sizeof(s16));
+	mask = frames - 1;
+	this->target = std::min(target, frames);
+	writePos = readPos = 0;
+	clearRequested = false;
+}
+
+void SoundRing::free()
+{
+	delete [] data;
+	data = NULL;
+	mask = 0;
+	target = 0;
+	writePos = readPos = 0;
+}
+
+void SoundRing::write(const s16* frames, u32 count)
+{
+	if(!data)
+		return;
+	const u32 fill = writePos - __atomic_load_n(&readPos, __ATOMIC_ACQUIRE);
+	const u32 room = mask + 1 - fill;
+	if(count > room)
+	{
+		__atomic_fetch_add(&overruns, 1, __ATOMIC_RELAXED);
+		count = room;
+	}
+
+	//in at most two pieces, either side of the end
+	const u32 at = writePos & mask;
+	const u32 first = std::min(count, mask + 1 - at);
+	memcpy(data + at * 2, frames, first * 2 * sizeof(s16));
+	memcpy(data, frames + first * 2, (count - first) * 2 * sizeof(s16));
+	__atomic_store_n(&writePos, writePos + count, __ATOMIC_RELEASE);
+}
+
+u32 SoundRing::space() const
+{
+	if(!data)
+		return 0;
+	const u32 fill = __atomic_load_n(&writePos, __ATOMIC_RELAXED) - __atomic_load_n(&readPos, __ATOMIC_ACQUIRE);
+	return fill < target ? target - fill : 0;
+}
+
+u32 SoundRing::readable()
+{
+	const u32 w = __atomic_load_n(&writePos, __ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&clearRequested, __ATOMIC_ACQUIRE))
+	{
+		__atomic_store_n(&clearRequested, false, __ATOMIC_RELAXED);
+		__atomic_store_n(&readPos, w, __ATOMIC_RELEASE);
+	}
+	return w - readPos;
+}
+
+u32 SoundRing::read(s16* out, u32 count)
+{
+	const u32 n = data ? std::min(count, readable()) : 0;
+	const u32 at = readPos & mask;
+	const u32 first = std::min(n, mask + 1 - at);
+	if(n)
+	{
+		memcpy(out, data + at * 2, first * 2 * sizeof(s16));
+		memcpy(out + first * 2, data, (n - first) * 2 * sizeof(s16));
+		consume(n);
+	}
+	if(n < count)
+	{
+		memset(out + n * 2, 0, (count - n) * 2 * sizeof(s16));
+		underrun();
+	}
+	return n;
+}
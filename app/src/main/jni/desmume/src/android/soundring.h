@@ -0,0 +1,75 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SOUNDRING_H
+#define _SOUNDRING_H
+
+#include "../types.h"
+
+//the mixed stereo frames on their way from the emulation thread (the only writer) to the sound backend's callback
+//thread (the only reader). each side only moves its own index, and the two indexes are on cache lines of their own,
+//so neither side ever waits for the other or has the line it writes pulled away by the other's writes.
+class SoundRing
+{
+public:
+	SoundRing();
+	~SoundRing();
+
+	//capacity is in frames, rounded up to a power of two. target is how full space() keeps it
+	void init(u32 capacity, u32 target);
+	void free();
+
+	//emulation thread
+	//frames that don't fit are dropped, and counted as an overrun
+	void write(const s16* frames, u32 count);
+	//as many frames as it takes to fill it up to the target
+	u32 space() const;
+	//the reader drops what is in it the next time it reads
+	void clear() { __atomic_store_n(&clearRequested, true, __ATOMIC_RELEASE); }
+
+	//backend thread
+	//frames that can be read, which stay where frame() finds them until consume() moves past them
+	u32 readable();
+	const s16* frame(u32 i) const { return data + ((readPos + i) & mask) * 2; }
+	void consume(u32 count) { __atomic_store_n(&readPos, readPos + count, __ATOMIC_RELEASE); }
+	//copies up to count frames out and fills the rest with silence, which is counted as an underrun
+	u32 read(s16* out, u32 count);
+	//for a backend that notices running dry on its own
+	void underrun() { __atomic_fetch_add(&underruns, 1, __ATOMIC_RELAXED); }
+
+	u32 underrunCount() const { return __atomic_load_n(&underruns, __ATOMIC_RELAXED); }
+	u32 overrunCount() const { return __atomic_load_n(&overruns, __ATOMIC_RELAXED); }
+
+private:
+	enum { CACHE_LINE = 64 };
+
+	s16* data;
+	u32 mask;
+	u32 target;
+	u32 underruns, overruns;
+	bool clearRequested;
+
+	DS_ALIGN(64) u32 writePos;	//only the writer moves it
+	u8 writePad[CACHE_LINE - sizeof(u32)];
+	DS_ALIGN(64) u32 readPos;	//only the reader moves it
+	u8 readPad[CACHE_LINE - sizeof(u32)];
+};
+
+//the one for whichever sound core is running
+extern SoundRing soundRing;
+
+#endif
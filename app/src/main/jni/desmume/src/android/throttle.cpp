@@ -27,6 +27,10 @@
 #endif
 #include "throttle.h"
 #include "GPU_osd.h"
+#include "../frameprofile.h"
+#include "../NDSSystem.h"
+#include "../SPU.h"
+#include <algorithm>
 
 int FastForward=0;
 static u64 tmethod,tfreq,afsfreq;
@@ -60,6 +64,9 @@ static u64 desiredFpsScalers [] = {
 #include <time.h>
 #include <android/log.h>
 #include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include "framequeue.h"
 
 unsigned int GetTickCount()
 {
@@ -107,7 +114,7 @@ void IncreaseSpeed(void) {
 	u64 desiredFpsScaler = desiredFpsScalers[desiredFpsScalerIndex];
 	desiredfps = core_desiredfps * desiredFpsScaler / 256;
 	desiredspf = 65536.0f / desiredfps;
-	printf("Throttle fps scaling increased to: %f\n",desiredFpsScaler/256.0);
+	CORELOG_INFO("Throttle fps scaling increased to: %f\n",desiredFpsScaler/256.0);
 	osd->addLine("Target FPS up to %2.04f",desiredFpsScaler/256.0);
 	#ifndef ANDROID
 	WritePrivateProfileInt("Video","FPS Scaler Index", desiredFpsScalerIndex, IniName);
@@ -121,7 +128,7 @@ void DecreaseSpeed(void) {
 	u64 desiredFpsScaler = desiredFpsScalers[desiredFpsScalerIndex];
 	desiredfps = core_desiredfps * desiredFpsScaler / 256;
 	desiredspf = 65536.0f / desiredfps;
-	printf("Throttle fps scaling decreased to: %f\n",desiredFpsScaler/256.0);
+	CORELOG_INFO("Throttle fps scaling decreased to: %f\n",desiredFpsScaler/256.0);
 	osd->addLine("Target FPS down to %2.04f",desiredFpsScaler/256.0);
 #ifndef ANDROID
 	WritePrivateProfileInt("Video","FPS Scaler Index", desiredFpsScalerIndex, IniName);
@@ -162,10 +169,85 @@ static void AutoFrameSkip_BeforeThrottle();
 
 static u64 ltime;
 
+#ifdef ANDROID
+static bool displayPacing = false, displayLockAudio = false;
+//CLOCK_MONOTONIC nanoseconds the last frame was let go at
+static u64 paceTime = 0;
+//how far from a multiple of the display's period the ds's can be and still be locked to it: 60hz displays and
+//120hz ones are 0.3% off, 90hz ones aren't a multiple at all
+static const double kDisplayLockTolerance = 0.01;
+
+void SpeedThrottle_SetDisplayPacing(bool enable, bool lockAudio)
+{
+	displayPacing = enable;
+	displayLockAudio = enable && lockAudio;
+	paceTime = 0;
+	frameQueue.setVsyncTiming(enable);
+	if(!displayLockAudio)
+		SPU_SetOutputRate(1.0);
+}
+
+static void sleepUntil(u64 time)
+{
+	timespec ts;
+	ts.tv_sec = time / 1000000000ULL;
+	ts.tv_nsec = time % 1000000000ULL;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static void DisplayThrottle()
+{
+	const u64 now = RawGetTickCount();
+	u64 period = 1000000000ULL * 65536 / desiredfps;
+	double speed = 1.0;
+
+	u64 vsync, vsyncPeriod;
+	if(frameQueue.vsyncTiming(vsync, vsyncPeriod))
+	{
+		const u64 n = (period + vsyncPeriod/2) / vsyncPeriod;
+		if(n >= 1 && fabs((double)period / (double)(n*vsyncPeriod) - 1.0) < kDisplayLockTolerance)
+		{
+			speed = (double)period / (double)(n*vsyncPeriod);
+			period = n*vsyncPeriod;
+		}
+	}
+
+	u64 target = paceTime + period;
+	if(speed != 1.0)
+	{
+		//onto the vsync nearest to it, which takes out whatever the period was measured off by
+		const s64 offset = (s64)(target - vsync);
+		const s64 half = (s64)vsyncPeriod / 2;
+		const s64 k = offset >= 0 ? (offset + half) / (s64)vsyncPeriod : -((-offset + half) / (s64)vsyncPeriod);
+		target = vsync + k * (s64)vsyncPeriod;
+	}
+	if(displayLockAudio)
+		SPU_SetOutputRate(speed);
+
+	//more than a few frames behind (or the first frame): start over from now, instead of running fast to catch up
+	if(paceTime == 0 || (s64)(now - target) >= (s64)(period*4))
+	{
+		paceTime = now;
+		return;
+	}
+	if(target > now)
+		sleepUntil(target);
+	paceTime = target;
+}
+#endif
+
 void SpeedThrottle()
 {
 	AutoFrameSkip_BeforeThrottle();
 
+#ifdef ANDROID
+	if(displayPacing && !FastForward)
+	{
+		DisplayThrottle();
+		return;
+	}
+#endif
+
 waiter:
 	if(FastForward)
 		return;
@@ -317,3 +399,80 @@ int AutoFrameSkip_GetSkipAmount(int min, int max)
 }
 
 
+// cost aware frameskip
+
+//microseconds: a frame besides its rendering, the 2d and 3d of the frames that rendered them, and a draw
+static float costBase = 0, cost2D = 0, cost3D = 0, costDraw = 0;
+static float costSkipAccum = 0;
+static int costSkipRun = 0;
+
+static void costAverage(float& average, float sample)
+{
+	average += (sample - average) * 0.125f;
+}
+
+void CostFrameSkip_Reset()
+{
+	costBase = cost2D = cost3D = costDraw = 0;
+	costSkipAccum = 0;
+	costSkipRun = 0;
+}
+
+int CostFrameSkip_NextFrame(u64 frameNs, int maxSkip)
+{
+	u32 zones[PROFILE_ZONE_COUNT];
+	if(frameprofile_getframes(zones, 1) != 1)
+		return COSTFRAMESKIP_NONE;
+
+	//a skipped part costs next to nothing, so each part is only learned from the frames that rendered it
+	const bool rendered2D = !NDS_Skipped2DFrame();
+	const bool rendered3D = !NDS_Skipped3DFrame();
+	const float frame2D = (float)zones[PROFILE_GPU_LINE];
+	const float frame3D = (float)(zones[PROFILE_3D_RENDER] + zones[PROFILE_3D_FINISH]);
+	costAverage(costBase, std::max(frameNs / 1000.0f - (rendered2D ? frame2D : 0) - (rendered3D ? frame3D : 0), 0.0f));
+	if(rendered2D) costAverage(cost2D, frame2D);
+	if(rendered3D) costAverage(cost3D, frame3D);
+	//the draw thread's time isn't part of the frame, but a frame it can't keep up with gets dropped anyway
+	costAverage(costDraw, (float)zones[PROFILE_DRAW]);
+	const float costFrame = costBase + cost2D + cost3D;
+
+	//how much has to go from each frame, and the share of frames to skip to get there. skipping the 3d alone
+	//is preferred while it saves enough, since the 2d (menus, text, the other screen) then stays at full rate
+	const float budget = desiredspf * 1000000.0f * 0.95f;
+	const float excess = costFrame - budget;
+	int mode = COSTFRAMESKIP_NONE;
+	float share = 0;
+	if(excess > 0)
+	{
+		if(cost3D >= excess)
+		{
+			mode = COSTFRAMESKIP_3D;
+			share = excess / cost3D;
+		}
+		else if(cost2D + cost3D > 0)
+		{
+			mode = COSTFRAMESKIP_ALL;
+			share = excess / (cost2D + cost3D);
+		}
+	}
+	if(costDraw > budget && 1.0f - budget / costDraw > share)
+	{
+		mode = COSTFRAMESKIP_ALL;
+		share = 1.0f - budget / costDraw;
+	}
+	share = std::min(share, (float)maxSkip / (maxSkip + 1));
+
+	//spread the skips out evenly: one each time the share adds up to a whole frame
+	costSkipAccum += share;
+	if(mode == COSTFRAMESKIP_NONE || costSkipAccum < 1.0f || costSkipRun >= maxSkip)
+	{
+		costSkipAccum = std::min(costSkipAccum, 1.0f);
+		costSkipRun = 0;
+		return COSTFRAMESKIP_NONE;
+	}
+	costSkipAccum -= 1.0f;
+	costSkipRun++;
+	return mode;
+}
+
+
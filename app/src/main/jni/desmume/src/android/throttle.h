@@ -18,6 +18,8 @@
 #ifndef _THROTTLE_H_
 #define _THROTTLE_H_
 
+#include "../types.h"
+
 extern int FastForward;
 extern bool FrameLimit;
 void IncreaseSpeed();
@@ -25,11 +27,29 @@ void DecreaseSpeed();
 
 void InitSpeedThrottle();
 void SpeedThrottle();
+#ifdef ANDROID
+//paces to the display's vsyncs (from the frame queue) instead of sleeping whole milliseconds. when the display's
+//refresh is within a percent of a multiple of the ds's, the frames are let go on its vsyncs, so each gets the same
+//number of refreshes, and with lockAudio the sound is resampled by the difference. otherwise it keeps the ds's rate
+void SpeedThrottle_SetDisplayPacing(bool enable, bool lockAudio);
+#endif
 
 void AutoFrameSkip_NextFrame();
 void AutoFrameSkip_IgnorePreviousDelay();
 int AutoFrameSkip_GetSkipAmount(int min=0, int max=9);
 
+//frame skipping that only skips the rendering that costs the most, from what the profiler timed the frames' parts at
+enum
+{
+	COSTFRAMESKIP_NONE,
+	COSTFRAMESKIP_3D,	//the 3d alone, which the 2d keeps showing the previous one of
+	COSTFRAMESKIP_ALL,	//2d and 3d, and the frame isn't drawn either
+};
+
+void CostFrameSkip_Reset();
+//after each frame, with how long its emulation took. says what to skip of the next one, at most maxSkip in a row
+int CostFrameSkip_NextFrame(u64 frameNs, int maxSkip);
+
 #ifdef ANDROID
 unsigned int GetTickCount();
 #endif
@@ -16,6 +16,10 @@
 */
 
 #include "filter/filter.h"
+#include "utils/task.h"
+#include "frameprofile.h"
+#include <stdlib.h>
+#include <string.h>
 
 class VideoInfo
 {
@@ -34,8 +38,12 @@ public:
 	int currentfilter;
 
 	CACHE_ALIGN u8* srcBuffer;
-	CACHE_ALIGN u32 buffer[5*5*256*192*2];
-	CACHE_ALIGN u32 filteredbuffer[5*5*256*192*2];
+	//both screens as the filters take them, 32 or 16 bits a pixel
+	CACHE_ALIGN u32 buffer[256*192*2];
+	//what the filter made of them, width by height. it is allocated by filter(), which runs on the drawing thread like
+	//everything else that uses it, the first time it filters at that size, and freed when there is no filter any more
+	u32* filteredbuffer;
+	unsigned int filteredWidth, filteredHeight;
 
 	enum {
 		NONE,
@@ -71,57 +79,227 @@ public:
 		height = 384;
 	}
 
-	void setfilter(int filter) {
-
-		if(filter < 0 || filter >= NUM_FILTERS)
-			filter = NONE;
-
-		currentfilter = filter;
+	//the size a filter makes of both screens
+	static void filterSize(int filter, unsigned int& w, unsigned int& h) {
 
 		switch(filter) {
 
 			case NONE:
-				width = 256;
-				height = 384;
+				w = 256;
+				h = 384;
 				break;
 			case EPX1_5X:
 			case EPXPLUS1_5X:
 			case NEAREST1_5X:
 			case NEARESTPLUS1_5X:
-				width = 256*3/2;
-				height = 384*3/2;
+				w = 256*3/2;
+				h = 384*3/2;
 				break;
       		case HQ4X:
 			case HQ4XS:
 			case _4XBRZ:
-				width = 256*4;
-				height = 384*4;
+				w = 256*4;
+				h = 384*4;
         	break;
 			case _3XBRZ:
-				width = 256*3;
-				height = 384*3;
+				w = 256*3;
+				h = 384*3;
 				break;
 			case _5XBRZ:
-				width = 256*5;
-				height = 384*5;
+				w = 256*5;
+				h = 384*5;
 				break;
 			default:
-				width = 256*2;
-				height = 384*2;
+				w = 256*2;
+				h = 384*2;
 				break;
 		}
 	}
 
+	//the bytes of the buffer a filter draws into
+	static u64 filteredBytes(int filter) {
+		if(filter <= NONE || filter >= NUM_FILTERS)
+			return 0;
+		unsigned int w, h;
+		filterSize(filter, w, h);
+		return (u64)w * h * sizeof(u32);
+	}
+
+	void setfilter(int filter) {
+
+		if(filter < 0 || filter >= NUM_FILTERS)
+			filter = NONE;
+
+		currentfilter = filter;
+		filterSize(filter, width, height);
+	}
+
 	SSurface src;
 	SSurface dst;
 
 	u16* finalBuffer() const
 	{
-		if(currentfilter == NONE)
+		if(currentfilter == NONE || filteredbuffer == NULL)
 			return (u16*)buffer;
 		else return (u16*)filteredbuffer;
 	}
 
+	void allocFiltered() {
+		if(filteredbuffer != NULL && filteredWidth == width && filteredHeight == height)
+			return;
+		free(filteredbuffer);
+		filteredbuffer = (u32*)calloc(width * height, sizeof(u32));
+		filteredWidth = width;
+		filteredHeight = height;
+	}
+
+	void releaseFiltered() {
+		free(filteredbuffer);
+		filteredbuffer = NULL;
+		free(bandSlots);
+		bandSlots = NULL;
+	}
+
+	//the bytes of the buffers the filters use
+	u64 filterMemory() const {
+		u64 bytes = 0;
+		if(filteredbuffer) bytes += (u64)filteredWidth * filteredHeight * sizeof(u32);
+		if(bandSlots) bytes += (u64)(FILTER_BAND_ROWS + FILTER_BAND_HALO * 2) * bandSlotHeight / 384 * bandSlotWidth * bandSlotCount * sizeof(u32);
+		return bytes;
+	}
+
+	typedef void (*TFilterFunc)(SSurface Src, SSurface Dst);
+
+	TFilterFunc filterFunc() const {
+
+		switch(currentfilter)
+		{
+			case LQ2X: return RenderLQ2X;
+			case LQ2XS: return RenderLQ2XS;
+			case HQ2X: return RenderHQ2X;
+			case HQ4X: return RenderHQ4X;
+			case HQ2XS: return RenderHQ2XS;
+			case HQ4XS: return RenderHQ4XS;
+			case _2xSAI: return Render2xSaI;
+			case SUPER2XSAI: return RenderSuper2xSaI;
+			case SUPEREAGLE: return RenderSuperEagle;
+			case SCANLINE: return RenderScanline;
+			case BILINEAR: return RenderBilinear;
+			case NEAREST2X: return RenderNearest2X;
+			case EPX: return RenderEPX;
+			case EPXPLUS: return RenderEPXPlus;
+			case EPX1_5X: return RenderEPX_1Point5x;
+			case EPXPLUS1_5X: return RenderEPXPlus_1Point5x;
+			case NEAREST1_5X: return RenderNearest_1Point5x;
+			case NEARESTPLUS1_5X: return RenderNearestPlus_1Point5x;
+			case _2XBRZ: return Render2xBRZ;
+			case _3XBRZ: return Render3xBRZ;
+			case _4XBRZ: return Render4xBRZ;
+			case _5XBRZ: return Render5xBRZ;
+			case NONE:
+			default:
+				return NULL;
+		}
+	}
+
+	//each screen is cut into bands of FILTER_BAND_ROWS source rows that are filtered on the worker pool.
+	//a band is filtered together with FILTER_BAND_HALO rows of its neighbours into a scratch slot and only its
+	//own rows are copied out, so every output pixel sees the same neighbourhood as a whole-screen pass and
+	//there are no seams. bands never cross the middle so the screens stay separate images.
+	enum {
+		FILTER_BAND_ROWS = 24,
+		FILTER_BAND_HALO = 2,
+		FILTER_BANDS = 384 / FILTER_BAND_ROWS,
+		FILTER_MAX_SLOTS = 32,
+	};
+
+	u32* bandSlots;
+	int bandSlotCount;
+	unsigned int bandSlotWidth, bandSlotHeight;
+	volatile u32 bandSlotsBusy;
+
+	int bandSlotSize() const {
+		return (FILTER_BAND_ROWS + FILTER_BAND_HALO * 2) * height / 384 * width;
+	}
+
+	void allocBandSlots() {
+		if(bandSlots != NULL && bandSlotWidth == width && bandSlotHeight == height)
+			return;
+		free(bandSlots);
+		bandSlotCount = TaskPool::shared().getThreadCount() + 1;
+		if(bandSlotCount > FILTER_MAX_SLOTS)
+			bandSlotCount = FILTER_MAX_SLOTS;
+		bandSlots = (u32*)malloc(bandSlotSize() * bandSlotCount * sizeof(u32));
+		bandSlotWidth = width;
+		bandSlotHeight = height;
+	}
+
+	int acquireBandSlot() {
+		for(;;)
+			for(int i = 0; i < bandSlotCount; i++)
+				if(!(__sync_fetch_and_or(&bandSlotsBusy, 1u << i) & (1u << i)))
+					return i;
+	}
+
+	void releaseBandSlot(int slot) {
+		__sync_fetch_and_and(&bandSlotsBusy, ~(1u << slot));
+	}
+
+	//xBRZ can scale a slice of rows of the whole image itself, writing straight into the output
+	int xbrzFactor() const {
+		switch(currentfilter)
+		{
+			case _2XBRZ: return 2;
+			case _3XBRZ: return 3;
+			case _4XBRZ: return 4;
+			case _5XBRZ: return 5;
+			default: return 0;
+		}
+	}
+
+	void filterBand(TFilterFunc func, int band) {
+		const int screen = band / (FILTER_BANDS / 2);
+		const int y0 = (band % (FILTER_BANDS / 2)) * FILTER_BAND_ROWS;
+		const int y1 = y0 + FILTER_BAND_ROWS;
+
+		SSurface bandSrc = src;
+		bandSrc.Height = 192;
+		bandSrc.Surface = src.Surface + screen * 192 * src.Pitch * 2;
+		SSurface bandDst = dst;
+		bandDst.Height = dst.Height / 2;
+		bandDst.Surface = dst.Surface + screen * bandDst.Height * dst.Pitch * 2;
+
+		if(int factor = xbrzFactor())
+		{
+			RenderxBRZRows(factor, bandSrc, bandDst, y0, y1);
+			return;
+		}
+
+		const int top = y0 - FILTER_BAND_HALO < 0 ? 0 : y0 - FILTER_BAND_HALO;
+		const int bottom = y1 + FILTER_BAND_HALO > 192 ? 192 : y1 + FILTER_BAND_HALO;
+		const int slot = acquireBandSlot();
+
+		bandSrc.Height = bottom - top;
+		bandSrc.Surface += top * src.Pitch * 2;
+		SSurface scratch = dst;
+		scratch.Height = (bottom - top) * height / 384;
+		scratch.Surface = (u8*)(bandSlots + slot * bandSlotSize());
+		func(bandSrc, scratch);
+
+		const int rowBytes = width * 4;
+		const int skip = (y0 - top) * height / 384;
+		const int rows = (y1 - y0) * height / 384;
+		memcpy(bandDst.Surface + (y0 * height / 384) * rowBytes, scratch.Surface + skip * rowBytes, rows * rowBytes);
+		releaseBandSlot(slot);
+	}
+
+	static void runFilterBands(void* param, int begin, int end) {
+		VideoInfo* video = (VideoInfo*)param;
+		TFilterFunc func = video->filterFunc();
+		for(int band = begin; band < end; band++)
+			video->filterBand(func, band);
+	}
+
 	void filter() {
 
 		src.Height = 384;
@@ -129,84 +307,28 @@ public:
 		src.Pitch = 512;
 		src.Surface = (u8*)buffer;
 
+		if(filterFunc() == NULL)
+		{
+			releaseFiltered();
+			return;
+		}
+		allocFiltered();
+		if(filteredbuffer == NULL)
+		{
+			setfilter(NONE);
+			return;
+		}
+
 		dst.Height = height;
 		dst.Width = width;
 		dst.Pitch = width*2;
 		dst.Surface = (u8*)filteredbuffer;
 
-		switch(currentfilter)
-		{
-			case NONE:
-				break;
-			case LQ2X:
-				RenderLQ2X(src, dst);
-				break;
-			case LQ2XS:
-				RenderLQ2XS(src, dst);
-				break;
-			case HQ2X:
-				RenderHQ2X(src, dst);
-				break;
-			case HQ4X:
-				RenderHQ4X(src, dst);
-				break;
-			case HQ2XS:
-				RenderHQ2XS(src, dst);
-				break;
-			case HQ4XS:
-				RenderHQ4XS(src, dst);
-				break;
-			case _2xSAI:
-				Render2xSaI (src, dst);
-				break;
-			case SUPER2XSAI:
-				RenderSuper2xSaI (src, dst);
-				break;
-			case SUPEREAGLE:
-				RenderSuperEagle (src, dst);
-				break;
-			case SCANLINE:
-				RenderScanline(src, dst);
-				break;
-			case BILINEAR:
-				RenderBilinear(src, dst);
-				break;
-			case NEAREST2X:
-				RenderNearest2X(src,dst);
-				break;
-			case EPX:
-				RenderEPX(src,dst);
-				break;
-			case EPXPLUS:
-				RenderEPXPlus(src,dst);
-				break;
-			case EPX1_5X:
-				RenderEPX_1Point5x(src,dst);
-				break;
-			case EPXPLUS1_5X:
-				RenderEPXPlus_1Point5x(src,dst);
-				break;
-			case NEAREST1_5X:
-				RenderNearest_1Point5x(src,dst);
-				break;
-			case NEARESTPLUS1_5X:
-				RenderNearestPlus_1Point5x(src,dst);
-				break;
-			case _2XBRZ:
-				Render2xBRZ(src, dst);
-				break;
-			case _3XBRZ:
-				Render3xBRZ(src, dst);
-				break;
-			case _4XBRZ:
-				Render4xBRZ(src, dst);
-				break;
-			case _5XBRZ:
-				Render5xBRZ(src, dst);
-				break;
-			default:
-				break;
-		}
+		PROFILE_ZONE(PROFILE_FILTER);
+
+		if(!xbrzFactor())
+			allocBandSlots();
+		TaskPool::shared().parallelFor(0, FILTER_BANDS, 1, &runFilterBands, this);
 	}
 
 	int size() {
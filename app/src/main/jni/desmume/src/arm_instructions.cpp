@@ -3029,12 +3029,12 @@ TEMPLATE static u32 FASTCALL  OP_MSR_CPSR(const u32 i)
 	const u32 privMask =	PROCNUM?v4T_PRIV_MASK	: v5TE_PRIV_MASK;
 	const u32 stateMask =	PROCNUM?v4T_STATE_MASK	: v5TE_STATE_MASK;
 
-	if ((operand & unallocMask) != 0) printf("ARM%c: MSR_CPSR_REG UNPREDICTABLE UNALLOC (operand %08X)\n", PROCNUM?'7':'9', operand);
+	if ((operand & unallocMask) != 0) CORELOG_INFO("ARM%c: MSR_CPSR_REG UNPREDICTABLE UNALLOC (operand %08X)\n", PROCNUM?'7':'9', operand);
 	if (cpu->CPSR.bits.mode != USR) // Privileged mode
 	{
 		if (BIT16(i)) armcpu_switchMode(cpu, operand & 0x1F);
 		if ((operand & stateMask) != 0) 
-			printf("ARM%c: MSR_CPSR_REG UNPREDICTABLE STATE (operand %08X)\n", PROCNUM?'7':'9', operand);
+			CORELOG_INFO("ARM%c: MSR_CPSR_REG UNPREDICTABLE STATE (operand %08X)\n", PROCNUM?'7':'9', operand);
 		else
 			mask = byte_mask & (userMask | privMask);
 	}
@@ -3129,6 +3129,10 @@ TEMPLATE static u32 FASTCALL OP_B(const u32 i)
 	cpu->R[15] &= (0xFFFFFFFC|(cpu->CPSR.bits.T<<1));
 	cpu->next_instruction = cpu->R[15];
 
+	//a short loop back may be one that only polls memory
+	if(CONDITION(i)!=0xF && (s32)off <= -2 && (s32)off >= -(IDLE_LOOP_MAX_OPS+1))
+		armcpu_checkIdleLoop<PROCNUM>(cpu->R[15]);
+
 	return 3;
 }
 
@@ -3783,7 +3787,7 @@ TEMPLATE static u32 FASTCALL  OP_LDR_M_ROR_IMM_OFF_POSTIND(const u32 i)
 //-----------------------------------------------------------------------------
 TEMPLATE static u32 FASTCALL  OP_LDREX(const u32 i)
 {
-	printf("LDREX\n");
+	CORELOG_INFO("LDREX\n");
 	u32 adr = cpu->R[REG_POS(i,16)];
 	cpu->R[REG_POS(i,12)] = ROR(READ32(cpu->mem_if->data, adr), 8*(adr&3));
 	return MMU_aluMemAccessCycles<PROCNUM,32,MMU_AD_READ>(3,adr);
@@ -4370,7 +4374,7 @@ TEMPLATE static u32 FASTCALL  OP_STR_M_ROR_IMM_OFF_POSTIND(const u32 i)
 //-----------------------------------------------------------------------------
 TEMPLATE static u32 FASTCALL  OP_STREX(const u32 i)
 {
-	printf("STREX\n");
+	CORELOG_INFO("STREX\n");
 	u32 adr = cpu->R[REG_POS(i,16)];
 	WRITE32(cpu->mem_if->data, adr, cpu->R[REG_POS(i,0)]);
 	cpu->R[REG_POS(i,12)] = 0;
@@ -5085,7 +5089,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMIA2(const u32 i)
 
 	if(BIT15(i)==0)
 	{  
-		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { printf("ERROR1\n"); return 1; }
+		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { CORELOG_ERROR("ERROR1\n"); return 1; }
 		oldmode = armcpu_switchMode(cpu, SYS);
 	}
 
@@ -5140,7 +5144,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMIB2(const u32 i)
 
 	if(BIT15(i)==0)
 	{  
-		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { printf("ERROR1\n"); return 1; }
+		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { CORELOG_ERROR("ERROR1\n"); return 1; }
 		oldmode = armcpu_switchMode(cpu, SYS);
 	}
 
@@ -5196,7 +5200,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMDA2(const u32 i)
 
 	if(BIT15(i)==0)
 	{  
-		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { printf("ERROR1\n"); return 1; }
+		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { CORELOG_ERROR("ERROR1\n"); return 1; }
 		oldmode = armcpu_switchMode(cpu, SYS);
 	}
 	
@@ -5253,7 +5257,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMDB2(const u32 i)
 	u32 start = cpu->R[REG_POS(i,16)];
 	if(BIT15(i)==0)
 	{  
-		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { printf("ERROR1\n"); return 1; }
+		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { CORELOG_ERROR("ERROR1\n"); return 1; }
 		oldmode = armcpu_switchMode(cpu, SYS);
 	}
 
@@ -5314,7 +5318,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMIA2_W(const u32 i)
 //	emu_halt();	
 	if(BIT15(i)==0)
 	{  
-		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { printf("ERROR1\n"); return 1; }
+		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { CORELOG_ERROR("ERROR1\n"); return 1; }
 		oldmode = armcpu_switchMode(cpu, SYS);
 	}
 
@@ -5370,7 +5374,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMIB2_W(const u32 i)
 
 	if(BIT15(i)==0)
 	{  
-		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { printf("ERROR1\n"); return 1; }
+		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { CORELOG_ERROR("ERROR1\n"); return 1; }
 		oldmode = armcpu_switchMode(cpu, SYS);
 	}
 
@@ -5428,7 +5432,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMDA2_W(const u32 i)
 //	emu_halt();	
 	if(BIT15(i)==0)
 	{  
-		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { printf("ERROR1\n"); return 1; }
+		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { CORELOG_ERROR("ERROR1\n"); return 1; }
 		oldmode = armcpu_switchMode(cpu, SYS);
 	}
 
@@ -5436,7 +5440,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMDA2_W(const u32 i)
 	
 	if(BIT15(i))
 	{
-		if (BIT_N(i, REG_POS(i,16))) printf("error1_1\n");
+		if (BIT_N(i, REG_POS(i,16))) CORELOG_ERROR("error1_1\n");
 		u32 tmp = READ32(cpu->mem_if->data, start);
 		registres[15] = tmp & (0XFFFFFFFC | (BIT0(tmp)<<1));
 		c += MMU_memAccessCycles<PROCNUM,32,MMU_AD_READ>(start);
@@ -5487,7 +5491,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMDB2_W(const u32 i)
 //	emu_halt();	
 	if(BIT15(i)==0)
 	{  
-		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { printf("ERROR1\n"); return 1; }
+		if((cpu->CPSR.bits.mode==USR)||(cpu->CPSR.bits.mode==SYS)) { CORELOG_ERROR("ERROR1\n"); return 1; }
 		oldmode = armcpu_switchMode(cpu, SYS);
 	}
 
@@ -5495,7 +5499,7 @@ TEMPLATE static u32 FASTCALL  OP_LDMDB2_W(const u32 i)
 	
 	if(BIT15(i))
 	{
-		if (BIT_N(i, REG_POS(i,16))) printf("error1_2\n");
+		if (BIT_N(i, REG_POS(i,16))) CORELOG_ERROR("error1_2\n");
 		u32 tmp;
 		start -= 4;
 		tmp = READ32(cpu->mem_if->data, start);
@@ -6243,7 +6247,7 @@ TEMPLATE static u32 FASTCALL OP_BKPT(const u32 i)
 	/*
 	static u32 last_bkpt = 0xFFFFFFFF;
 	if(i != last_bkpt)
-		printf("ARM OP_BKPT triggered\n");
+		CORELOG_INFO("ARM OP_BKPT triggered\n");
 	last_bkpt = i;
 
 	//this is not 100% correctly emulated, but it does the job
@@ -6251,7 +6255,7 @@ TEMPLATE static u32 FASTCALL OP_BKPT(const u32 i)
 	return 4;
 	*/
 
-	printf("ARM OP_BKPT triggered\n");
+	CORELOG_INFO("ARM OP_BKPT triggered\n");
 	Status_Reg tmp = cpu->CPSR;
 	armcpu_switchMode(cpu, ABT);				// enter abt mode
 	cpu->R[14] = cpu->instruct_adr + 4;
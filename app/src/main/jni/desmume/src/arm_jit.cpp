@@ -42,6 +42,7 @@
 #include "utils/AsmJit/AsmJit.h"
 #include "arm_jit.h"
 #include "bios.h"
+#include "armtrace.h"
 
 #define LOG_JIT_LEVEL 0
 #define PROFILER_JIT_LEVEL 0
@@ -186,35 +187,51 @@ static void init_jit_mem()
 			JIT.JIT_MEM[proc][i] = JIT_MEM[proc][i>>9] + (((i<<14) & JIT_MASK[proc][i>>9]) >> 1);
 }
 
-#else
-DS_ALIGN(4096) uintptr_t compiled_funcs[1<<26] = {0};
+static u8 recompile_counts[(1<<26)/16];
+#define JIT_RECOMPILE_COUNT(adr) recompile_counts[((adr) & 0x07FFFFFE) >> 5]
 #endif
 
-static u8 recompile_counts[(1<<26)/16];
+// whether the block being compiled may push older ones out of the code cache, which it doesn't when compiled ahead
+static bool bb_evict = true;
 
 #ifdef HAVE_STATIC_CODE_BUFFER
-// On x86_64, allocate jitted code from a static buffer to ensure that it's within 2GB of .text
+// On x86_64, allocate jitted code from one buffer mapped right below .text to keep it within 2GB of it
 // Allows call instructions to use pcrel offsets, as opposed to slower indirect calls.
+// (asmjit still emits trampolines if the kernel placed the buffer elsewhere)
 // Reduces memory needed for function pointers.
 // FIXME win64 needs this too, x86_32 doesn't
 
-DS_ALIGN(4096) static u8 scratchpad[1<<25];
+static u8 *scratchpad = NULL;
+static uintptr_t scratchpad_size = 0;
 static u8 *scratchptr;
+static u8 *scratchend;
 
-struct ASMJIT_API StaticCodeGenerator : public Context
+// maps the buffer at CommonSettings.jit_cache_size, or maps it again if that changed.
+// only called from arm_jit_reset, when none of the code is in use any more.
+static void init_scratchpad()
 {
-	StaticCodeGenerator()
+	uintptr_t size = (uintptr_t)CommonSettings.jit_cache_size << 20;
+	if(scratchpad && scratchpad_size == size)
+		return;
+	if(scratchpad)
+		munmap(scratchpad, scratchpad_size);
+
+	uintptr_t text = (uintptr_t)&init_scratchpad;
+	void *hint = text > size + (1<<20) ? (void*)((text - size - (1<<20)) & ~(uintptr_t)0xFFFFF) : NULL;
+	void *p = mmap(hint, size, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
 	{
-		scratchptr = scratchpad;
-		int align = (uintptr_t)scratchpad & (sysconf(_SC_PAGESIZE) - 1);
-		int err = mprotect(scratchpad-align, sizeof(scratchpad)+align, PROT_READ|PROT_WRITE|PROT_EXEC);
-		if(err)
-		{
-			fprintf(stderr, "mprotect failed: %s\n", strerror(errno));
-			abort();
-		}
+		fprintf(stderr, "JIT: mmap failed: %s\n", strerror(errno));
+		scratchpad = NULL;
+		scratchpad_size = 0;
+		return;
 	}
+	scratchpad = (u8*)p;
+	scratchpad_size = size;
+}
 
+struct ASMJIT_API StaticCodeGenerator : public Context
+{
 	uint32_t generate(void** dest, Assembler* assembler)
 	{
 		uintptr_t size = assembler->getCodeSize();
@@ -223,13 +240,29 @@ struct ASMJIT_API StaticCodeGenerator : public Context
 			*dest = NULL;
 			return kErrorNoFunction;
 		}
-		if(size > (uintptr_t)(scratchpad+sizeof(scratchpad)-scratchptr))
+		if(!scratchpad)
 		{
+			*dest = NULL;
+			return kErrorNoVirtualMemory;
+		}
+		if(size > (uintptr_t)(scratchend-scratchptr))
+		{
+#ifdef MAPPED_JIT_FUNCS
 			fprintf(stderr, "Out of memory for asmjit. Clearing code cache.\n");
 			arm_jit_reset(1);
 			// If arm_jit_reset didn't involve recompiling op_cmp, we could keep the current function.
 			*dest = NULL;
 			return kErrorOk;
+#else
+			// compiling ahead only fills segments that were never used, it doesn't push out what the game runs
+			u8 *next = arm_jit_code_next_segment(&scratchend, bb_evict);
+			if(!next || size > (uintptr_t)(scratchend-next))
+			{
+				*dest = NULL;
+				return kErrorNoVirtualMemory;
+			}
+			scratchptr = next;
+#endif
 		}
 		void *p = scratchptr;
 		size = assembler->relocCode(p);
@@ -256,6 +289,12 @@ static int bb_opcodesize;
 static int bb_adr;
 static bool bb_thumb;
 static GpVar bb_cpu;
+
+// the ops of the block as far as it is scanned ahead, and which of them set flags nothing reads
+#define BB_SCAN_OPS 128
+static u32 bb_ops[BB_SCAN_OPS];
+static bool bb_ops_flags_unused[BB_SCAN_OPS];
+static bool bb_flags_unused;	// for the op being compiled
 static GpVar bb_cycles;
 static GpVar bb_total_cycles;
 static u32 bb_constant_cycles;
@@ -330,93 +369,105 @@ static GpVar bb_profiler_entry;
 //-----------------------------------------------------------------------------
 #define SET_NZCV(sign) { \
 	JIT_COMMENT("SET_NZCV"); \
-	GpVar x = c.newGpVar(kX86VarTypeGpd); \
-	GpVar y = c.newGpVar(kX86VarTypeGpd); \
-	c.sets(x.r8Lo()); \
-	c.setz(y.r8Lo()); \
-	c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
-	if (sign) { c.setnc(y.r8Lo()); } else { c.setc(y.r8Lo()); } \
-	c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
-	c.seto(y.r8Lo()); \
-	c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
-	c.movzx(y, flags_ptr); \
-	c.shl(x, 4); \
-	c.and_(y, 0xF); \
-	c.or_(x, y); \
-	c.mov(flags_ptr, x.r8Lo()); \
-	c.unuse(x); \
-	c.unuse(y); \
+	if(!bb_flags_unused) { \
+		GpVar x = c.newGpVar(kX86VarTypeGpd); \
+		GpVar y = c.newGpVar(kX86VarTypeGpd); \
+		c.sets(x.r8Lo()); \
+		c.setz(y.r8Lo()); \
+		c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
+		if (sign) { c.setnc(y.r8Lo()); } else { c.setc(y.r8Lo()); } \
+		c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
+		c.seto(y.r8Lo()); \
+		c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
+		c.movzx(y, flags_ptr); \
+		c.shl(x, 4); \
+		c.and_(y, 0xF); \
+		c.or_(x, y); \
+		c.mov(flags_ptr, x.r8Lo()); \
+		c.unuse(x); \
+		c.unuse(y); \
+	} \
 	JIT_COMMENT("end SET_NZCV"); \
 }
 
 #define SET_NZC { \
 	JIT_COMMENT("SET_NZC"); \
-	GpVar x = c.newGpVar(kX86VarTypeGpd); \
-	GpVar y = c.newGpVar(kX86VarTypeGpd); \
-	c.sets(x.r8Lo()); \
-	c.setz(y.r8Lo()); \
-	c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
-	if (cf_change) { c.lea(x, ptr(rcf.r64(), x.r64(), kScale2Times)); c.unuse(rcf); } \
-	c.movzx(y, flags_ptr); \
-	c.shl(x, 6 - cf_change); \
-	c.and_(y, cf_change?0x1F:0x3F); \
-	c.or_(x, y); \
-	c.mov(flags_ptr, x.r8Lo()); \
+	if(!bb_flags_unused) { \
+		GpVar x = c.newGpVar(kX86VarTypeGpd); \
+		GpVar y = c.newGpVar(kX86VarTypeGpd); \
+		c.sets(x.r8Lo()); \
+		c.setz(y.r8Lo()); \
+		c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
+		if (cf_change) { c.lea(x, ptr(rcf.r64(), x.r64(), kScale2Times)); c.unuse(rcf); } \
+		c.movzx(y, flags_ptr); \
+		c.shl(x, 6 - cf_change); \
+		c.and_(y, cf_change?0x1F:0x3F); \
+		c.or_(x, y); \
+		c.mov(flags_ptr, x.r8Lo()); \
+	} \
 	JIT_COMMENT("end SET_NZC"); \
 }
 
 #define SET_NZC_SHIFTS_ZERO(cf) { \
 	JIT_COMMENT("SET_NZC_SHIFTS_ZERO"); \
-	c.and_(flags_ptr, 0x1F); \
-	if(cf) \
-	{ \
-		c.shl(rcf, 5); \
-		c.or_(rcf, (1<<6)); \
-		c.or_(flags_ptr, rcf.r8Lo()); \
+	if(!bb_flags_unused) { \
+		c.and_(flags_ptr, 0x1F); \
+		if(cf) \
+		{ \
+			c.shl(rcf, 5); \
+			c.or_(rcf, (1<<6)); \
+			c.or_(flags_ptr, rcf.r8Lo()); \
+		} \
+		else \
+			c.or_(flags_ptr, (1<<6)); \
 	} \
-	else \
-		c.or_(flags_ptr, (1<<6)); \
 	JIT_COMMENT("end SET_NZC_SHIFTS_ZERO"); \
 }
 
 #define SET_NZ(clear_cv) { \
 	JIT_COMMENT("SET_NZ"); \
-	GpVar x = c.newGpVar(kX86VarTypeGpz); \
-	GpVar y = c.newGpVar(kX86VarTypeGpz); \
-	c.sets(x.r8Lo()); \
-	c.setz(y.r8Lo()); \
-	c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
-	c.movzx(y, flags_ptr); \
-	c.and_(y, clear_cv?0x0F:0x3F); \
-	c.shl(x, 6); \
-	c.or_(x, y); \
-	c.mov(flags_ptr, x.r8Lo()); \
+	if(!bb_flags_unused) { \
+		GpVar x = c.newGpVar(kX86VarTypeGpz); \
+		GpVar y = c.newGpVar(kX86VarTypeGpz); \
+		c.sets(x.r8Lo()); \
+		c.setz(y.r8Lo()); \
+		c.lea(x, ptr(y.r64(), x.r64(), kScale2Times)); \
+		c.movzx(y, flags_ptr); \
+		c.and_(y, clear_cv?0x0F:0x3F); \
+		c.shl(x, 6); \
+		c.or_(x, y); \
+		c.mov(flags_ptr, x.r8Lo()); \
+	} \
 	JIT_COMMENT("end SET_NZ"); \
 }
 
 #define SET_N { \
 	JIT_COMMENT("SET_N"); \
-	GpVar x = c.newGpVar(kX86VarTypeGpz); \
-	GpVar y = c.newGpVar(kX86VarTypeGpz); \
-	c.sets(x.r8Lo()); \
-	c.movzx(y, flags_ptr); \
-	c.and_(y, 0x7F); \
-	c.shl(x, 7); \
-	c.or_(x, y); \
-	c.mov(flags_ptr, x.r8Lo()); \
+	if(!bb_flags_unused) { \
+		GpVar x = c.newGpVar(kX86VarTypeGpz); \
+		GpVar y = c.newGpVar(kX86VarTypeGpz); \
+		c.sets(x.r8Lo()); \
+		c.movzx(y, flags_ptr); \
+		c.and_(y, 0x7F); \
+		c.shl(x, 7); \
+		c.or_(x, y); \
+		c.mov(flags_ptr, x.r8Lo()); \
+	} \
 	JIT_COMMENT("end SET_N"); \
 }
 
 #define SET_Z { \
 	JIT_COMMENT("SET_Z"); \
-	GpVar x = c.newGpVar(kX86VarTypeGpz); \
-	GpVar y = c.newGpVar(kX86VarTypeGpz); \
-	c.setz(x.r8Lo()); \
-	c.movzx(y, flags_ptr); \
-	c.and_(y, 0xBF); \
-	c.shl(x, 6); \
-	c.or_(x, y); \
-	c.mov(flags_ptr, x.r8Lo()); \
+	if(!bb_flags_unused) { \
+		GpVar x = c.newGpVar(kX86VarTypeGpz); \
+		GpVar y = c.newGpVar(kX86VarTypeGpz); \
+		c.setz(x.r8Lo()); \
+		c.movzx(y, flags_ptr); \
+		c.and_(y, 0xBF); \
+		c.shl(x, 6); \
+		c.or_(x, y); \
+		c.mov(flags_ptr, x.r8Lo()); \
+	} \
 	JIT_COMMENT("end SET_Z"); \
 }
 
@@ -1194,10 +1245,10 @@ static int OP_MVN_S_IMM_VAL(const u32 i) { OP_MOV_S(S_IMM_VAL; rhs = ~rhs); }
 //   QADD / QDADD / QSUB / QDSUB
 //-----------------------------------------------------------------------------
 // TODO
-static int OP_QADD(const u32 i) { printf("JIT: unimplemented OP_QADD\n"); return 0; }
-static int OP_QSUB(const u32 i) { printf("JIT: unimplemented OP_QSUB\n"); return 0; }
-static int OP_QDADD(const u32 i) { printf("JIT: unimplemented OP_QDADD\n"); return 0; }
-static int OP_QDSUB(const u32 i) { printf("JIT: unimplemented OP_QDSUB\n"); return 0; }
+static int OP_QADD(const u32 i) { CORELOG_WARN("JIT: unimplemented OP_QADD\n"); return 0; }
+static int OP_QSUB(const u32 i) { CORELOG_WARN("JIT: unimplemented OP_QSUB\n"); return 0; }
+static int OP_QDADD(const u32 i) { CORELOG_WARN("JIT: unimplemented OP_QDADD\n"); return 0; }
+static int OP_QDSUB(const u32 i) { CORELOG_WARN("JIT: unimplemented OP_QDSUB\n"); return 0; }
 
 //-----------------------------------------------------------------------------
 //   MUL
@@ -1931,12 +1982,12 @@ static int OP_LDRD_STRD_POST_INDEX(const u32 i)
 	
 	if (Rd_num == 14)
 	{
-		printf("OP_LDRD_STRD_POST_INDEX: use R14!!!!\n");
+		CORELOG_INFO("OP_LDRD_STRD_POST_INDEX: use R14!!!!\n");
 		return 0; // TODO: exception
 	}
 	if (Rd_num & 0x1)
 	{
-		printf("OP_LDRD_STRD_POST_INDEX: ERROR!!!!\n");
+		CORELOG_ERROR("OP_LDRD_STRD_POST_INDEX: ERROR!!!!\n");
 		return 0; // TODO: exception
 	}
 	GpVar Rd = c.newGpVar(kX86VarTypeGpd);
@@ -1972,12 +2023,12 @@ static int OP_LDRD_STRD_OFFSET_PRE_INDEX(const u32 i)
 	
 	if (Rd_num == 14)
 	{
-		printf("OP_LDRD_STRD_OFFSET_PRE_INDEX: use R14!!!!\n");
+		CORELOG_INFO("OP_LDRD_STRD_OFFSET_PRE_INDEX: use R14!!!!\n");
 		return 0; // TODO: exception
 	}
 	if (Rd_num & 0x1)
 	{
-		printf("OP_LDRD_STRD_OFFSET_PRE_INDEX: ERROR!!!!\n");
+		CORELOG_ERROR("OP_LDRD_STRD_OFFSET_PRE_INDEX: ERROR!!!!\n");
 		return 0; // TODO: exception
 	}
 	GpVar Rd = c.newGpVar(kX86VarTypeGpd);
@@ -2099,30 +2150,25 @@ static u64 get_reg_list(u32 reg_mask, int dir)
 template <int PROCNUM, bool store, int dir>
 static LDM_INLINE FASTCALL u32 OP_LDM_STM_generic(u32 adr, u64 regs, int n)
 {
-	u32 cycles = 0;
 	adr &= ~3;
+	const u32 cycles = MMU_memBurstCycles<PROCNUM,store?MMU_AD_WRITE:MMU_AD_READ>(adr, n, dir);
 	do {
 		if(store) _MMU_write32<PROCNUM>(adr, cpu->R[regs&0xF]);
 		else cpu->R[regs&0xF] = _MMU_read32<PROCNUM>(adr);
-		cycles += MMU_memAccessCycles<PROCNUM,32,store?MMU_AD_WRITE:MMU_AD_READ>(adr);
 		adr += 4*dir;
 		regs >>= 4;
 	} while(--n > 0);
 	return cycles;
 }
 
-#ifdef ENABLE_ADVANCED_TIMING
-#define ADV_CYCLES cycles += MMU_memAccessCycles<PROCNUM,32,store?MMU_AD_WRITE:MMU_AD_READ>(adr);
-#else
-#define ADV_CYCLES
-#endif
-
 template <int PROCNUM, bool store, int dir>
 static LDM_INLINE FASTCALL u32 OP_LDM_STM_other(u32 adr, u64 regs, int n)
 {
-	u32 cycles = 0;
+	u32 cycles;
 	adr &= ~3;
-#ifndef ENABLE_ADVANCED_TIMING
+#ifdef ENABLE_ADVANCED_TIMING
+	cycles = MMU_memBurstCycles<PROCNUM,store?MMU_AD_WRITE:MMU_AD_READ>(adr, n, dir);
+#else
 	cycles = n * MMU_memAccessCycles<PROCNUM,32,store?MMU_AD_WRITE:MMU_AD_READ>(adr);
 #endif
 	do {
@@ -2132,7 +2178,6 @@ static LDM_INLINE FASTCALL u32 OP_LDM_STM_other(u32 adr, u64 regs, int n)
 		else
 			if(store) _MMU_ARM7_write32(adr, cpu->R[regs&0xF]);
 			else cpu->R[regs&0xF] = _MMU_ARM7_read32(adr);
-		ADV_CYCLES;
 		adr += 4*dir;
 		regs >>= 4;
 	} while(--n > 0);
@@ -2143,7 +2188,7 @@ template <int PROCNUM, bool store, int dir, bool null_compiled>
 static FORCEINLINE FASTCALL u32 OP_LDM_STM_main(u32 adr, u64 regs, int n, u8 *ptr, u32 cycles)
 {
 #ifdef ENABLE_ADVANCED_TIMING
-	cycles = 0;
+	cycles = MMU_memBurstCycles<PROCNUM,store?MMU_AD_WRITE:MMU_AD_READ>(adr, n, dir);
 #endif
 	uintptr_t *func = (uintptr_t *)&JIT_COMPILED_FUNC(adr, PROCNUM);
 
@@ -2157,7 +2202,6 @@ static FORCEINLINE FASTCALL u32 OP_LDM_STM_main(u32 adr, u64 regs, int n, u8 *pt
 	int Rd = ((uintptr_t)regs >> (j*4)) & 0xF; \
 	if(store) *(u32*)ptr = cpu->R[Rd]; \
 	else cpu->R[Rd] = *(u32*)ptr; \
-	ADV_CYCLES; \
 	func += 2*dir; \
 	adr += 4*dir; \
 	ptr += 4*dir; }
@@ -2175,7 +2219,6 @@ static FORCEINLINE FASTCALL u32 OP_LDM_STM_main(u32 adr, u64 regs, int n, u8 *pt
 	} while(n > 0);
 	return cycles;
 #undef OP
-#undef ADV_CYCLES
 }
 
 template <int PROCNUM, bool store, int dir>
@@ -2203,6 +2246,12 @@ static u32 FASTCALL OP_LDM_STM(u32 adr, u64 regs, int n)
 	{
 		ptr = MMU.MAIN_MEM + (adr & _MMU_MAIN_MEM_MASK32);
 		cycles = n * ((PROCNUM==ARMCPU_ARM9) ? 4 : 2);
+		// the registers can take up to two 4KB pages
+		if(store)
+		{
+			MMU_touchMainMem(adr);
+			MMU_touchMainMem(adr + (n-1)*4*dir);
+		}
 	}
 	else if(PROCNUM==ARMCPU_ARM7 && !store && (adr & 0xFF800000) == 0x03800000)
 	{
@@ -2536,13 +2585,13 @@ static int OP_MCR(const u32 i)
 	if(cpnum != 15)
 	{
 		// TODO - exception?
-		printf("JIT: MCR P%i, 0, R%i, C%i, C%i, %i, %i (don't allocated coprocessor)\n", 
+		CORELOG_INFO("JIT: MCR P%i, 0, R%i, C%i, C%i, %i, %i (don't allocated coprocessor)\n", 
 			cpnum, REG_POS(i, 12), REG_POS(i, 16), REG_POS(i, 0), (i>>21)&0x7, (i>>5)&0x7);
 		return 2;
 	}
 	if (REG_POS(i, 12) == 15)
 	{
-		printf("JIT: MCR Rd=R15\n");
+		CORELOG_INFO("JIT: MCR Rd=R15\n");
 		return 2;
 	}
 
@@ -2743,7 +2792,7 @@ static int OP_MRC(const u32 i)
 	u32 cpnum = REG_POS(i, 8);
 	if(cpnum != 15)
 	{
-		printf("MRC P%i, 0, R%i, C%i, C%i, %i, %i (don't allocated coprocessor)\n", cpnum, REG_POS(i, 12), REG_POS(i, 16), REG_POS(i, 0), (i>>21)&0x7, (i>>5)&0x7);
+		CORELOG_INFO("MRC P%i, 0, R%i, C%i, C%i, %i, %i (don't allocated coprocessor)\n", cpnum, REG_POS(i, 12), REG_POS(i, 16), REG_POS(i, 0), (i>>21)&0x7, (i>>5)&0x7);
 		return 2;
 	}
 
@@ -2992,7 +3041,7 @@ static int OP_SWI(const u32 i) { return op_swi((i >> 16) & 0x1F); }
 //-----------------------------------------------------------------------------
 //   BKPT
 //-----------------------------------------------------------------------------
-static int OP_BKPT(const u32 i) { printf("JIT: unimplemented OP_BKPT\n"); return 0; }
+static int OP_BKPT(const u32 i) { CORELOG_WARN("JIT: unimplemented OP_BKPT\n"); return 0; }
 
 //-----------------------------------------------------------------------------
 //   THUMB
@@ -3954,7 +4003,8 @@ static const char *disassemble(u32 opcode)
 	return str;
 }
 
-static void sync_r15(u32 opcode, bool is_last, bool force)
+// the next instruction of a block that doesn't end in a branch is stored by the block itself
+static void sync_r15(u32 opcode, bool force)
 {
 	if(instr_does_prefetch(opcode))
 	{
@@ -3967,13 +4017,12 @@ static void sync_r15(u32 opcode, bool is_last, bool force)
 	}
 	else
 	{
-		if(force || (instr_attributes(opcode) & JIT_BYPASS) || (instr_attributes(opcode) & BRANCH_SWI) || (is_last && !instr_is_branch(opcode)))
+		if(force || (instr_attributes(opcode) & JIT_BYPASS) || (instr_attributes(opcode) & BRANCH_SWI))
 		{
-			JIT_COMMENT("sync_r15: next_instruction %08Xh - %s%s%s%s", bb_next_instruction,
+			JIT_COMMENT("sync_r15: next_instruction %08Xh - %s%s%s", bb_next_instruction,
 				force?" FORCE":"",
 				(instr_attributes(opcode) & JIT_BYPASS)?" BYPASS":"",
-				(instr_attributes(opcode) & BRANCH_SWI)?" SWI":"",
-				(is_last && !instr_is_branch(opcode))?" LAST":""
+				(instr_attributes(opcode) & BRANCH_SWI)?" SWI":""
 			);
 			c.mov(cpu_ptr(next_instruction), bb_next_instruction);
 		}
@@ -4033,44 +4082,30 @@ static void emit_armop_call(u32 opcode)
 	ctx->setReturn(bb_cycles);
 }
 
+//the instructions a block interprets, into the trace; the block's own record has its cycle
 static void _armlog(u8 proc, u32 addr, u32 opcode)
 {
-#if 0
-#if 0
-	fprintf(stderr, "\t\t;R0:%08X R1:%08X R2:%08X R3:%08X R4:%08X R5:%08X R6:%08X R7:%08X R8:%08X R9:%08X\n\t\t;R10:%08X R11:%08X R12:%08X R13:%08X R14:%08X R15:%08X| next %08X, N:%i Z:%i C:%i V:%i\n",
-		cpu->R[0],  cpu->R[1],  cpu->R[2],  cpu->R[3],  cpu->R[4],  cpu->R[5],  cpu->R[6],  cpu->R[7], 
-		cpu->R[8],  cpu->R[9],  cpu->R[10],  cpu->R[11],  cpu->R[12],  cpu->R[13],  cpu->R[14],  cpu->R[15],
-		cpu->next_instruction, cpu->CPSR.bits.N, cpu->CPSR.bits.Z, cpu->CPSR.bits.C, cpu->CPSR.bits.V);
-#endif
-	#define INDEX22(i) ((((i)>>16)&0xFF0)|(((i)>>4)&0xF))
-	char dasmbuf[4096];
-	if(cpu->CPSR.bits.T)
-		des_thumb_instructions_set[((opcode)>>6)&1023](addr, opcode, dasmbuf);
-	else
-		des_arm_instructions_set[INDEX22(opcode)](addr, opcode, dasmbuf);
-	#undef INDEX22
-	fprintf(stderr, "%s%c %08X\t%08X \t%s\n", cpu->CPSR.bits.T?"THUMB":"ARM", proc?'7':'9', addr, opcode, dasmbuf); 
-#else
-	return;
-#endif
+	if(!armtrace_active) return;
+	armcpu_t* const arm = proc ? &NDS_ARM7 : &NDS_ARM9;
+	armtrace_write(proc, addr, opcode, arm->CPSR.bits.T ? ARMTRACE_THUMB : 0, armtrace_lastCycle(proc), arm);
 }
 
+// runs the block as it is compiled, unless interpret is false, which is how the profile compiles ahead
 template<int PROCNUM>
-static u32 compile_basicblock()
+static u32 compile_basicblock(u32 start_adr, bool thumb, bool interpret)
 {
 #if LOG_JIT
 	bool has_variable_cycles = FALSE;
 #endif
 	u32 interpreted_cycles = 0;
-	u32 start_adr = cpu->instruct_adr;
 	u32 opcode = 0;
 	
-	bb_thumb = cpu->CPSR.bits.T;
+	bb_thumb = thumb;
 	bb_opcodesize = bb_thumb ? 2 : 4;
 
 	if (!JIT_MAPPED(start_adr & 0x0FFFFFFF, PROCNUM))
 	{
-		printf("JIT: use unmapped memory address %08X\n", start_adr);
+		CORELOG_INFO("JIT: use unmapped memory address %08X\n", start_adr);
 		execute = false;
 		return 1;
 	}
@@ -4098,6 +4133,17 @@ static u32 compile_basicblock()
 	c.mov(bb_profiler, (uintptr_t)&profiler_counter[PROCNUM]);
 #endif
 
+	// look ahead for the flag updates that are overwritten before anything reads them
+	u32 scanned = 0;
+	for(bool end = false; !end && scanned < BB_SCAN_OPS; scanned++)
+	{
+		u32 adr = start_adr + (scanned * bb_opcodesize);
+		bb_ops[scanned] = bb_thumb ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+		end = instr_is_branch(bb_ops[scanned]) || (scanned >= (CommonSettings.jit_max_block_size - 1))
+			|| arm_jit_break_after(PROCNUM, adr, bb_opcodesize);
+	}
+	instr_dead_flags(bb_ops, scanned, bb_thumb, bb_ops_flags_unused);
+
 	bb_constant_cycles = 0;
 	for(u32 i=0, bEndBlock = 0; bEndBlock == 0; i++)
 	{
@@ -4106,6 +4152,7 @@ static u32 compile_basicblock()
 			opcode = _MMU_read16<PROCNUM, MMU_AT_CODE>(bb_adr);
 		else
 			opcode = _MMU_read32<PROCNUM, MMU_AT_CODE>(bb_adr);
+		bb_flags_unused = i < scanned && bb_ops_flags_unused[i];
 
 #if LOG_JIT
 		char dasmbuf[1024] = {0};
@@ -4118,7 +4165,9 @@ static u32 compile_basicblock()
 
 		u32 cycles = instr_cycles(opcode);
 
-		bEndBlock = instr_is_branch(opcode) || (i >= (CommonSettings.jit_max_block_size - 1));
+		// a breakpoint on the next op has to be where a block starts, see arm_jit_set_breakpoint
+		bEndBlock = instr_is_branch(opcode) || (i >= (CommonSettings.jit_max_block_size - 1))
+			|| arm_jit_break_after(PROCNUM, bb_adr, bb_opcodesize);
 		
 #if LOG_JIT
 		if (instr_is_conditional(opcode) && (cycles > 1) || (cycles == 0))
@@ -4142,10 +4191,10 @@ static u32 compile_basicblock()
 			// 25% of conditional instructions are immediately followed by
 			// another with the same condition, but merging them into a
 			// single branch has negligible effect on speed.
-			if(bEndBlock) sync_r15(opcode, 1, 1);
+			if(bEndBlock) sync_r15(opcode, true);
 			Label skip = c.newLabel();
 			emit_branch(CONDITION(opcode), skip);
-			if(!bEndBlock) sync_r15(opcode, 0, 0);
+			if(!bEndBlock) sync_r15(opcode, false);
 			emit_armop_call(opcode);
 			
 			if(cycles == 0)
@@ -4163,7 +4212,7 @@ static u32 compile_basicblock()
 		}
 		else
 		{
-			sync_r15(opcode, bEndBlock, 0);
+			sync_r15(opcode, false);
 			emit_armop_call(opcode);
 			if(cycles == 0)
 			{
@@ -4171,10 +4220,16 @@ static u32 compile_basicblock()
 				c.lea(bb_total_cycles, ptr(bb_total_cycles.r64(), bb_cycles.r64(), kScaleNone));
 			}
 		}
-		interpreted_cycles += op_decode[PROCNUM][bb_thumb]();
+		if(interpret)
+			interpreted_cycles += op_decode[PROCNUM][bb_thumb]();
 	}
 	
-	if(!instr_does_prefetch(opcode))
+	if(!instr_is_branch(opcode))
+	{
+		JIT_COMMENT("!instr_is_branch: instruct_adr %08Xh", bb_next_instruction);
+		c.mov(cpu_ptr(instruct_adr), bb_next_instruction);
+	}
+	else if(!instr_does_prefetch(opcode))
 	{
 		JIT_COMMENT("!instr_does_prefetch: copy next_instruction (%08X) to instruct_adr (%08X)", cpu->next_instruction, cpu->instruct_adr);
 		GpVar x = c.newGpVar(kX86VarTypeGpd);
@@ -4205,10 +4260,14 @@ static u32 compile_basicblock()
 #endif
 	c.endFunc();
 
+	bb_evict = interpret;
 	ArmOpCompiled f = (ArmOpCompiled)c.make();
-	if(c.getError())
+	bool compiled = !c.getError();
+	if(!compiled)
 	{
 		fprintf(stderr, "JIT error at %s%c-%08X: %s\n", bb_thumb?"THUMB":"ARM", PROCNUM?'7':'9', start_adr, getErrorString(c.getError()));
+		if(!interpret)
+			return 0;
 		f = op_decode[PROCNUM][bb_thumb];
 	}
 #if LOG_JIT
@@ -4217,7 +4276,13 @@ static u32 compile_basicblock()
 	fflush(stderr);
 #endif
 	
-	JIT_COMPILED_FUNC(start_adr, PROCNUM) = (uintptr_t)f;
+	JIT_INSTALL_FUNC(start_adr, PROCNUM, f);
+#if defined(HAVE_STATIC_CODE_BUFFER) && !defined(MAPPED_JIT_FUNCS)
+	if(compiled)
+		arm_jit_code_block(start_adr);
+#endif
+	if(f)
+		arm_jit_profile_record(PROCNUM, start_adr, bb_thumb, (bb_adr - start_adr) / bb_opcodesize + 1);
 	return interpreted_cycles;
 }
 
@@ -4225,24 +4290,37 @@ template<int PROCNUM> u32 arm_jit_compile()
 {
 	*PROCNUM_ptr = PROCNUM;
 
-	// prevent endless recompilation of self-modifying code, which would be a memleak since we only free code all at once.
-	// also allows us to clear compiled_funcs[] while leaving it sparsely allocated, if the OS does memory overcommit.
+	// prevent endless recompilation of self-modifying code, which would keep pushing everything else out of the code cache.
 	u32 adr = cpu->instruct_adr;
-	u32 mask_adr = (adr & 0x07FFFFFE) >> 4;
-	if(((recompile_counts[mask_adr >> 1] >> 4*(mask_adr & 1)) & 0xF) > 8)
+	u8 &count = JIT_RECOMPILE_COUNT(adr);
+	u32 shift = 4*((adr >> 4) & 1);
+	if(((count >> shift) & 0xF) > 8)
 	{
 		ArmOpCompiled f = op_decode[PROCNUM][cpu->CPSR.bits.T];
-		JIT_COMPILED_FUNC(adr, PROCNUM) = (uintptr_t)f;
+		JIT_INSTALL_FUNC(adr, PROCNUM, f);
 		return f();
 	}
-	recompile_counts[mask_adr >> 1] += 1 << 4*(mask_adr & 1);
+	count += 1 << shift;
 
-	return compile_basicblock<PROCNUM>();
+	return compile_basicblock<PROCNUM>(adr, cpu->CPSR.bits.T, true);
 }
 
 template u32 arm_jit_compile<0>();
 template u32 arm_jit_compile<1>();
 
+// a full code cache is only noticed by asmjit, which fails the block (or clears the cache, on MAPPED_JIT_FUNCS builds)
+template<int PROCNUM> bool arm_jit_precompile(u32 adr, bool thumb)
+{
+	if(arm_jit_breakpoint_count && arm_jit_breakpoint_at(PROCNUM, adr))
+		return true;
+	*PROCNUM_ptr = PROCNUM;
+	compile_basicblock<PROCNUM>(adr, thumb, false);
+	return JIT_COMPILED_FUNC(adr, PROCNUM) != 0;
+}
+
+template bool arm_jit_precompile<0>(u32 adr, bool thumb);
+template bool arm_jit_precompile<1>(u32 adr, bool thumb);
+
 void arm_jit_reset(bool enable, bool suppress_msg)
 {
 #if LOG_JIT
@@ -4250,15 +4328,22 @@ void arm_jit_reset(bool enable, bool suppress_msg)
 	freopen("desmume_jit.log", "w", stderr);
 #endif
 #ifdef HAVE_STATIC_CODE_BUFFER
+	if (enable)
+		init_scratchpad();
+#ifdef MAPPED_JIT_FUNCS
 	scratchptr = scratchpad;
+	scratchend = scratchpad + scratchpad_size;
+#else
+	scratchptr = arm_jit_code_reset(scratchpad, scratchpad_size, &scratchend);
+#endif
 #endif
 	if (!suppress_msg)
-		printf("CPU mode: %s\n", enable?"JIT":"Interpreter");
+		CORELOG_INFO("CPU mode: %s\n", enable?"JIT":"Interpreter");
 	saveBlockSizeJIT = CommonSettings.jit_max_block_size;
 
 	if (enable)
 	{
-		printf("JIT: max block size %d instruction(s)\n", CommonSettings.jit_max_block_size);
+		CORELOG_INFO("JIT: max block size %d instruction(s)\n", CommonSettings.jit_max_block_size);
 
 #ifdef MAPPED_JIT_FUNCS
 
@@ -4277,15 +4362,12 @@ void arm_jit_reset(bool enable, bool suppress_msg)
 
 		memset(recompile_counts, 0, sizeof(recompile_counts));
 		init_jit_mem();
-#else
-		for(int i=0; i<sizeof(recompile_counts)/8; i++)
-			if(((u64*)recompile_counts)[i])
-			{
-				((u64*)recompile_counts)[i] = 0;
-				memset(compiled_funcs+128*i, 0, 128*sizeof(*compiled_funcs));
-			}
 #endif
 	}
+#ifndef MAPPED_JIT_FUNCS
+	// the interpreter keeps the opcodes it fetched in the same pages
+	arm_jit_free_pages();
+#endif
 
 	c.clear();
 
@@ -4319,7 +4401,7 @@ static int pcmp_entry(PROFILER_ENTRY *info1, PROFILER_ENTRY *info2)
 void arm_jit_close()
 {
 #if (PROFILER_JIT_LEVEL > 0)
-	printf("Generating profile report...");
+	CORELOG_INFO("Generating profile report...");
 
 	for (u8 proc = 0; proc < 2; proc++)
 	{
@@ -4451,7 +4533,7 @@ void arm_jit_close()
 		}
 #endif
 	}
-	printf(" done.\n");
+	CORELOG_INFO(" done.\n");
 #endif
 }
 #endif // HAVE_JIT
@@ -30,6 +30,44 @@ void arm_jit_reset(bool enable, bool suppress_msg = false);
 void arm_jit_close();
 void arm_jit_sync();
 template<int PROCNUM> u32 arm_jit_compile();
+// compiles the block at adr without running it, unless something is compiled there already.
+// false if the code cache has no room left for it.
+template<int PROCNUM> bool arm_jit_precompile(u32 adr, bool thumb);
+
+// the blocks a game compiled, kept in a file so they can be compiled ahead the next time it runs (arm_jit_profile.cpp).
+// arm_jit_profile_warm() compiles the next few of them whose code is in memory, and is called once per frame.
+void arm_jit_profile_open(const char *fname);
+void arm_jit_profile_close();
+void arm_jit_profile_warm();
+// for the backends, after compiling a block of ops instructions
+void arm_jit_profile_record(int PROCNUM, u32 adr, bool thumb, u32 ops);
+
+// a debugger's breakpoints (the gdb stub's), kept so that the blocks around them still run compiled. a block never
+// runs over one: the backends end a block right before an address that has one, and armcpu_exec traps there before
+// it looks for a block, which a breakpoint never gets of its own. so while there are none nothing is any slower.
+// setting or clearing one drops the blocks that may have run over it.
+// the trap may stop the cpus, and returns whether it did. if it didn't, or once they go on again, the interpreter
+// runs the instruction there.
+typedef bool (*ArmJitTrap)(void *data, u32 adr);
+void arm_jit_set_trap(int PROCNUM, ArmJitTrap trap, void *data);
+void arm_jit_set_breakpoint(int PROCNUM, u32 adr, bool set);
+bool arm_jit_breakpoint_at(int PROCNUM, u32 adr);
+extern u32 arm_jit_breakpoint_count;
+// whether a block has to end with the op at adr, for the backends
+FORCEINLINE bool arm_jit_break_after(int PROCNUM, u32 adr, u32 opsize)
+{
+	return arm_jit_breakpoint_count && arm_jit_breakpoint_at(PROCNUM, adr + opsize);
+}
+
+// lets a block jump straight on into the next one while the dispatcher would pick the same cpu
+// again anyway. budget is set before each block is entered and cleared by NDS_Reschedule(),
+// cycles adds up what the blocks that jumped away have run.
+struct arm_jit_chain_t
+{
+	s32 budget;
+	u32 cycles;
+};
+extern arm_jit_chain_t arm_jit_chain;
 
 #if defined(HOST_WINDOWS) || defined(DESMUME_COCOA)
 #define MAPPED_JIT_FUNCS
@@ -55,14 +93,91 @@ extern CACHE_ALIGN JIT_struct JIT;
 #define JIT_COMPILED_FUNC_PREMASKED(adr, PROCNUM, ofs) JIT.JIT_MEM[PROCNUM][(adr)>>14][(((adr)&0x00003FFE)>>1)+ofs]
 #define JIT_COMPILED_FUNC_KNOWNBANK(adr, bank, mask, ofs) JIT.bank[(((adr)&(mask))>>1)+ofs]
 #define JIT_MAPPED(adr, PROCNUM) JIT.JIT_MEM[PROCNUM][(adr)>>14]
+#define JIT_INSTALL_FUNC(adr, PROCNUM, f) (JIT_COMPILED_FUNC(adr, PROCNUM) = (uintptr_t)(f))
+// what a store to code memory does to the function compiled for that address
+#define JIT_INVALIDATE_PREMASKED(adr, PROCNUM, ofs) (JIT_COMPILED_FUNC_PREMASKED(adr, PROCNUM, ofs) = 0)
+#define JIT_INVALIDATE_KNOWNBANK(adr, bank, mask, ofs) (JIT_COMPILED_FUNC_KNOWNBANK(adr, bank, mask, ofs) = 0)
 #else
-// actually an array of function pointers, but they fit in 32bit address space, so might as well save memory
-extern uintptr_t compiled_funcs[];
-// there isn't anything mapped between 07000000 and 0EFFFFFF, so we can mask off bit 27 and get away with a smaller array
-#define JIT_COMPILED_FUNC(adr, PROCNUM) compiled_funcs[((adr) & 0x07FFFFFE) >> 1]
+// there isn't anything mapped between 07000000 and 0EFFFFFF, so we can mask off bit 27 and get away with a smaller array.
+// the 1<<26 entries are split into pages of 16KB of code, which are only allocated once something is compiled in them.
+// the other pages all point at one page of zeros, so a lookup is always two loads and invalidating code that was never
+// compiled just stores 0 over 0.
+#define JIT_PAGE_BITS 13
+#define JIT_PAGE_SIZE (1 << JIT_PAGE_BITS)
+#define JIT_PAGES (1 << (26 - JIT_PAGE_BITS))
+extern uintptr_t *compiled_funcs[JIT_PAGES];
+#define JIT_COMPILED_FUNC(adr, PROCNUM) compiled_funcs[((adr) & 0x07FFFFFE) >> (JIT_PAGE_BITS+1)][((adr) >> 1) & (JIT_PAGE_SIZE-1)]
 #define JIT_COMPILED_FUNC_PREMASKED(adr, PROCNUM, ofs) JIT_COMPILED_FUNC(adr+(ofs<<1), PROCNUM)
 #define JIT_COMPILED_FUNC_KNOWNBANK(adr, bank, mask, ofs) JIT_COMPILED_FUNC(adr+(ofs<<1), PROCNUM)
 #define JIT_MAPPED(adr, PROCNUM) true
+
+// a bit for each 4KB of memory that got anything stored for it in compiled_funcs since the last arm_jit_free_pages,
+// set by arm_jit_page. stores to memory that never ran as code (most of them) skip the table with just this test
+#define JIT_CODE_PAGE_BITS 12
+extern u32 arm_jit_code_pages[1 << (27 - JIT_CODE_PAGE_BITS - 5)];
+// how many compiled functions (or opcodes the interpreter kept) stores to code memory have thrown away, for profiling
+extern u32 arm_jit_smc_invalidations;
+// the backends may compile the words a block loads pc-relative (its literal pools, in main memory) into it as
+// constants. the two entries of such a word hold a guard rather than 0, so a store to it gets to arm_jit_literal_store
+// just like one to code would, which drops the blocks that used it. the guard itself, should the word be jumped to,
+// drops them as well and compiles what is there.
+extern uintptr_t arm_jit_literal_guards[2];
+void arm_jit_literal_store(u32 adr);
+// whether the word at adr can be compiled in: its entries are free for the guard (0 or the guard already), and it
+// wasn't stored to since it last was
+bool arm_jit_literal_free(u32 adr);
+// notes that the block at block has the word at adr, which held value, compiled into it. false if the word has since
+// changed or its entries got anything else, in which case the block mustn't be installed
+bool arm_jit_literal_use(int PROCNUM, u32 adr, u32 value, u32 block);
+FORCEINLINE bool arm_jit_has_code(u32 adr)
+{
+	adr &= 0x07FFFFFE;
+	return (arm_jit_code_pages[adr >> (JIT_CODE_PAGE_BITS+5)] >> ((adr >> JIT_CODE_PAGE_BITS) & 31)) & 1;
+}
+FORCEINLINE void arm_jit_invalidate(u32 adr)
+{
+	if(!arm_jit_has_code(adr)) return;
+	uintptr_t &f = JIT_COMPILED_FUNC(adr, 0);
+	if(f)
+	{
+		if(f == arm_jit_literal_guards[0] || f == arm_jit_literal_guards[1])
+			arm_jit_literal_store(adr);
+		f = 0;
+		arm_jit_smc_invalidations++;
+	}
+}
+#define JIT_INVALIDATE_PREMASKED(adr, PROCNUM, ofs) arm_jit_invalidate((adr)+((ofs)<<1))
+#define JIT_INVALIDATE_KNOWNBANK(adr, bank, mask, ofs) arm_jit_invalidate((adr)+((ofs)<<1))
+
+// the page of adr, allocated if it isn't yet. storing anything but 0 has to go through this.
+uintptr_t *arm_jit_page(u32 adr);
+// drops every compiled function along with the pages
+void arm_jit_free_pages();
+// drops what was compiled (or fetched by the interpreter) between start and end, when other memory comes into view there,
+// along with the blocks that have a literal from there compiled in
+void arm_jit_invalidate_pages(u32 start, u32 end);
+
+// the code buffer is split into segments that blocks are compiled into in turn. when the last one is full the first
+// one is emptied again, which drops the oldest blocks from compiled_funcs rather than everything that was compiled.
+// that is safe because blocks only reach each other through compiled_funcs and nothing is compiled while one runs.
+#define JIT_CODE_SEGMENTS 8
+// starts over at the first segment of buffer, with nothing compiled in it
+u8 *arm_jit_code_reset(u8 *buffer, uintptr_t size, u8 **segment_end);
+// moves on to the next segment and returns where it starts. its blocks, the oldest ones, are dropped if evict is set,
+// or else NULL is returned if it has any
+u8 *arm_jit_code_next_segment(u8 **segment_end, bool evict);
+// notes the block just compiled at adr, in the current segment
+void arm_jit_code_block(u32 adr);
+// how many times a segment was emptied to make room, for keeping an eye on the cache size
+extern u32 arm_jit_code_evictions;
+// the bytes of the code buffer, and of the compiled_funcs pages allocated, for the memory report
+void arm_jit_memory_usage(u64 *code, u64 *tables);
+#define JIT_INSTALL_FUNC(adr, PROCNUM, f) (arm_jit_page(adr)[((adr) >> 1) & (JIT_PAGE_SIZE-1)] = (uintptr_t)(f))
+// the recompile guard's 4 bit counters, two per byte for every 16 bytes of code, follow the functions in each page
+#define JIT_RECOMPILE_COUNT(adr) (((u8*)(arm_jit_page(adr) + JIT_PAGE_SIZE))[((adr) >> 5) & (JIT_PAGE_SIZE/16-1)])
+// and then a byte for every 16 bytes of code, of how many times the interpreter ran a block from there before it got
+// compiled, for the backends that compile the blocks the game gets to more than once on a worker thread
+#define JIT_RUN_COUNT(adr) (((u8*)(arm_jit_page(adr) + JIT_PAGE_SIZE))[JIT_PAGE_SIZE/16 + (((adr) >> 4) & (JIT_PAGE_SIZE/8-1))])
 #endif
 
 extern u32 saveBlockSizeJIT;
@@ -0,0 +1,2218 @@
+/*	Copyright (C) 2006 yopyop
+	Copyright (C) 2011 Loren Merritt
+	Copyright (C) 2012-2015 DeSmuME team
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// ARMv7 backend of the dynamic recompiler, for armeabi-v7a. Like arm_jit_arm64.cpp it keeps
+// the block frontend of arm_jit.cpp and only differs in the code emission. The guest is an ARM
+// too, so data processing ops are emitted with their own shifter operand and condition flags,
+// only with the registers renamed.
+
+#include "types.h"
+
+#ifdef HAVE_JIT
+#if !defined(__arm__) || __ARM_ARCH < 7
+#error "ERROR: JIT compiler - unsupported target platform"
+#endif
+
+#include <sys/mman.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stddef.h>
+
+#include "armcpu.h"
+#include "instructions.h"
+#include "instruction_attributes.h"
+#include "MMU.h"
+#include "MMU_timing.h"
+#include "NDSSystem.h"
+#include "arm_jit.h"
+#include "bios.h"
+
+u32 saveBlockSizeJIT = 0;
+
+// blocks are appended to one RWX mapping of CommonSettings.jit_cache_size MB, which is recycled as a
+// whole when it runs out.
+// upper bound of the words emitted for one guest instruction, conditional LDM with R15 being the worst
+#define MAX_OP_WORDS		128
+
+static u32 *code_buffer = NULL;
+static uintptr_t code_size = 0;
+static u32 *code_end;
+static u32 *code_ptr;
+
+static int PROCNUM;
+static int *PROCNUM_ptr = &PROCNUM;
+static int bb_opcodesize;
+static int bb_adr;
+static bool bb_thumb;
+static u32 bb_constant_cycles;
+
+// the ops of the block as far as it is scanned ahead, and which of them set flags nothing reads
+#define BB_SCAN_OPS 128
+static u32 bb_ops[BB_SCAN_OPS];
+static bool bb_ops_flags_unused[BB_SCAN_OPS];
+static bool bb_flags_unused;	// for the op being compiled
+
+#define cpu (&ARMPROC)
+#define bb_next_instruction (bb_adr + bb_opcodesize)
+#define bb_r15				(bb_adr + 2 * bb_opcodesize)
+
+#define cpu_off(x)			((u32)offsetof(armcpu_t, x))
+#define reg_off(x)			((u32)offsetof(armcpu_t, R) + 4*(x))
+#define _REG_NUM(i, n)		((i>>(n))&0x7)
+
+//-----------------------------------------------------------------------------
+//   ARM emitter
+//-----------------------------------------------------------------------------
+// only the encodings the op compilers below need. everything is emitted unconditionally;
+// guest conditions are tested with a branch around the op, as on the other backends.
+
+enum {
+	R0 = 0, R1 = 1, R2 = 2, R3 = 3,	// call arguments, scratch otherwise
+	RPSR = R1,		// guest CPSR while it is being updated, never across a call
+	RTMP2 = R2,		// immediates that don't fit an operand
+	RPC = R3,		// guest R15, which is a constant within a block
+	RCPU = 4,		// &ARMPROC
+	RCYC = 5,		// cycles of the variable length ops so far
+	RCACHE = 6,		// r6-r11 hold cached guest registers
+	RTMP0 = 12,		// scratch within one op
+	RTMP1 = 14,		// lr, which the prologue saved
+};
+
+enum {
+	SH_LSL = 0, SH_LSR = 1, SH_ASR = 2, SH_ROR = 3,
+};
+
+// the data processing opcodes, the same for guest and host
+enum {
+	ALU_AND = 0, ALU_EOR, ALU_SUB, ALU_RSB, ALU_ADD, ALU_ADC, ALU_SBC, ALU_RSC,
+	ALU_TST, ALU_TEQ, ALU_CMP, ALU_CMN, ALU_ORR, ALU_MOV, ALU_BIC, ALU_MVN,
+};
+
+#define COND_EQ		0x0
+#define COND_NE		0x1
+#define COND_GT		0xC
+#define COND_AL		0xE
+#define OP2_IMM		(1 << 25)
+
+static FORCEINLINE void emit(u32 insn) { *code_ptr++ = insn; }
+
+// shifter operands
+static u32 a32_reg(int rm, u32 type = SH_LSL, u32 amount = 0) { return (amount << 7) | (type << 5) | rm; }
+static u32 a32_reg_shift(int rm, u32 type, int rs) { return (rs << 8) | (type << 5) | 0x10 | rm; }
+
+// the rotated 8 bit form of imm, or false when there is none
+static bool a32_encode_imm(u32 imm, u32 *op2)
+{
+	for(u32 rot = 0; rot < 32; rot += 2)
+	{
+		u32 v = rot ? ((imm << rot) | (imm >> (32 - rot))) : imm;
+		if(v < 0x100)
+		{
+			*op2 = OP2_IMM | ((rot / 2) << 8) | v;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void a32_dp(u32 opc, bool s, int rd, int rn, u32 op2)
+{
+	emit((COND_AL << 28) | (opc << 21) | (s << 20) | (rn << 16) | (rd << 12) | op2);
+}
+
+static void a32_mov(int rd, int rm) { a32_dp(ALU_MOV, 0, rd, 0, a32_reg(rm)); }
+
+static void a32_mov32(int rd, u32 imm)
+{
+	u32 op2;
+	if(a32_encode_imm(imm, &op2))
+		a32_dp(ALU_MOV, 0, rd, 0, op2);
+	else if(a32_encode_imm(~imm, &op2))
+		a32_dp(ALU_MVN, 0, rd, 0, op2);
+	else
+	{
+		emit(0xE3000000 | ((imm & 0xF000) << 4) | (rd << 12) | (imm & 0xFFF));	// movw
+		if(imm >> 16)
+			emit(0xE3400000 | ((imm >> 12) & 0xF0000) | (rd << 12) | ((imm >> 16) & 0xFFF));	// movt
+	}
+}
+
+// an immediate operand, through RTMP2 when it doesn't fit
+static u32 op2_imm(u32 imm)
+{
+	u32 op2;
+	if(a32_encode_imm(imm, &op2))
+		return op2;
+	a32_mov32(RTMP2, imm);
+	return a32_reg(RTMP2);
+}
+
+// rd = rn <opc> imm without flags; ADD/SUB and AND/BIC try the negated or inverted immediate first
+static void a32_alu_imm(u32 opc, int rd, int rn, u32 imm)
+{
+	u32 op2;
+	if(a32_encode_imm(imm, &op2))
+		a32_dp(opc, 0, rd, rn, op2);
+	else if((opc == ALU_ADD || opc == ALU_SUB) && a32_encode_imm(-imm, &op2))
+		a32_dp(opc == ALU_ADD ? ALU_SUB : ALU_ADD, 0, rd, rn, op2);
+	else if((opc == ALU_AND || opc == ALU_BIC) && a32_encode_imm(~imm, &op2))
+		a32_dp(opc == ALU_AND ? ALU_BIC : ALU_AND, 0, rd, rn, op2);
+	else
+		a32_dp(opc, 0, rd, rn, op2_imm(imm));
+}
+
+static void a32_add_const(int rd, int rn, u32 imm) { a32_alu_imm(ALU_ADD, rd, rn, imm); }
+
+static void a32_bfi(int rd, int rn, u32 lsb, u32 width) { emit(0xE7C00010 | ((lsb + width - 1) << 16) | (rd << 12) | (lsb << 7) | rn); }
+
+static void a32_ldr_cpu(int rt, u32 off) { emit(0xE5900000 | (RCPU << 16) | (rt << 12) | off); }
+static void a32_str_cpu(int rt, u32 off) { emit(0xE5800000 | (RCPU << 16) | (rt << 12) | off); }
+
+static void a32_mrs_apsr(int rd) { emit(0xE10F0000 | (rd << 12)); }
+static void a32_msr_apsr(int rn) { emit(0xE128F000 | rn); }	// APSR_nzcvq
+
+// forward branches, patched by a32_bind
+static u32 *a32_b(u32 cond) { u32 *at = code_ptr; emit((cond << 28) | 0x0A000000); return at; }
+
+static void a32_bind(u32 *at)
+{
+	s32 off = (s32)(code_ptr - at) - 2;
+	*at |= off & 0x00FFFFFF;
+}
+
+// through a register, so that the callee may be thumb code too
+static void a32_call(const void *fn)
+{
+	a32_mov32(RTMP0, (u32)(uintptr_t)fn);
+	emit(0xE12FFF30 | RTMP0);	// blx
+}
+
+//-----------------------------------------------------------------------------
+//   Register cache
+//-----------------------------------------------------------------------------
+// guest R0-R14 are loaded into r6-r11 on first use and stay there until evicted (least
+// recently used first), flushed before anything that reads cpu->R[] behind our back and
+// forgotten after anything that writes it. R15 is never cached, it is a constant, and
+// sync_r15 only notes that it is due in cpu->R[] for the next flush that includes it.
+// an op reads all of its sources before it asks for its destination, and uses fewer
+// registers than there are slots, so a register it uses is never evicted under it.
+
+#define CACHE_SLOTS 6
+
+static int slot_reg[CACHE_SLOTS];		// guest register held by the slot, or -1
+static bool slot_dirty[CACHE_SLOTS];
+static u32 slot_used[CACHE_SLOTS];
+static int reg_slot[16];
+static u32 slot_stamp;
+static bool r15_dirty;
+static u32 r15_value;
+
+static void regs_reset()
+{
+	for(int s = 0; s < CACHE_SLOTS; s++)
+	{
+		slot_reg[s] = -1;
+		slot_dirty[s] = false;
+		slot_used[s] = 0;
+	}
+	for(int r = 0; r < 16; r++)
+		reg_slot[r] = -1;
+	slot_stamp = 0;
+	r15_dirty = false;
+}
+
+static void slot_store(int s)
+{
+	if(!slot_dirty[s]) return;
+	a32_str_cpu(RCACHE + s, reg_off(slot_reg[s]));
+	slot_dirty[s] = false;
+}
+
+static void slot_free(int s)
+{
+	reg_slot[slot_reg[s]] = -1;
+	slot_reg[s] = -1;
+	slot_dirty[s] = false;
+}
+
+static int reg_alloc(u32 r, bool load)
+{
+	int s = reg_slot[r];
+	if(s < 0)
+	{
+		s = 0;
+		for(int j = 0; j < CACHE_SLOTS; j++)
+		{
+			if(slot_reg[j] < 0) { s = j; break; }
+			if(slot_used[j] < slot_used[s]) s = j;
+		}
+		if(slot_reg[s] >= 0)
+		{
+			slot_store(s);
+			slot_free(s);
+		}
+		slot_reg[s] = r;
+		reg_slot[r] = s;
+		if(load)
+			a32_ldr_cpu(RCACHE + s, reg_off(r));
+	}
+	slot_used[s] = ++slot_stamp;
+	return s;
+}
+
+// host register holding the guest register
+static int reg_read(u32 r)
+{
+	if(r == 15)
+	{
+		a32_mov32(RPC, bb_r15);
+		return RPC;
+	}
+	return RCACHE + reg_alloc(r, true);
+}
+
+// host register to write the guest register to. never R15
+static int reg_write(u32 r)
+{
+	int s = reg_alloc(r, false);
+	slot_dirty[s] = true;
+	return RCACHE + s;
+}
+
+static void regs_flush(u32 mask = 0xFFFF)
+{
+	for(int s = 0; s < CACHE_SLOTS; s++)
+		if(slot_reg[s] >= 0 && (mask & (1 << slot_reg[s])))
+			slot_store(s);
+	if(r15_dirty && (mask & (1 << 15)))
+	{
+		a32_mov32(RTMP0, r15_value);
+		a32_str_cpu(RTMP0, reg_off(15));
+		r15_dirty = false;
+	}
+}
+
+// drops the cached copies without writing them back, after cpu->R[] was written
+static void regs_discard(u32 mask = 0xFFFF)
+{
+	for(int s = 0; s < CACHE_SLOTS; s++)
+		if(slot_reg[s] >= 0 && (mask & (1 << slot_reg[s])))
+			slot_free(s);
+	if(mask & (1 << 15))
+		r15_dirty = false;
+}
+
+//-----------------------------------------------------------------------------
+//   Flags
+//-----------------------------------------------------------------------------
+// the guest flags live in cpu->CPSR with the same layout as the host APSR, so they are
+// moved in before the ops that read them and out after the ops that set them.
+
+static void emit_load_flags()
+{
+	a32_ldr_cpu(RTMP0, cpu_off(CPSR.val));
+	a32_msr_apsr(RTMP0);
+}
+
+static void emit_store_flags()
+{
+	a32_mrs_apsr(RTMP0);
+	a32_ldr_cpu(RTMP1, cpu_off(CPSR.val));
+	a32_dp(ALU_MOV, 0, RTMP0, 0, a32_reg(RTMP0, SH_LSR, 28));
+	a32_bfi(RTMP1, RTMP0, 28, 4);
+	a32_str_cpu(RTMP1, cpu_off(CPSR.val));
+}
+
+// branches to the returned fixup when cond fails; NULL when it always holds
+static u32 *emit_branch_unless(u32 cond)
+{
+	if(cond == 0xE)
+		return NULL;
+	if(cond == 0xF)
+		return a32_b(COND_AL);
+	emit_load_flags();
+	return a32_b(cond ^ 1);
+}
+
+static void emit_MMU_aluMemCycles(int alu_cycles, int population)
+{
+	if(PROCNUM==ARMCPU_ARM9)
+	{
+		if(population < alu_cycles)
+		{
+			a32_dp(ALU_CMP, 1, 0, R0, OP2_IMM | alu_cycles);
+			emit(0xB3A00000 | (R0 << 12) | alu_cycles);	// movlt
+		}
+	}
+	else
+		a32_alu_imm(ALU_ADD, R0, R0, alu_cycles);
+}
+
+//-----------------------------------------------------------------------------
+//   Data processing
+//-----------------------------------------------------------------------------
+
+static bool alu_is_logic(u32 opc)
+{
+	return opc == ALU_AND || opc == ALU_EOR || opc == ALU_TST || opc == ALU_TEQ
+	    || opc == ALU_ORR || opc == ALU_MOV || opc == ALU_BIC || opc == ALU_MVN;
+}
+
+static bool op2_is_rrx(u32 op2)
+{
+	return !(op2 & OP2_IMM) && (op2 & 0xFF0) == (SH_ROR << 5);
+}
+
+// rd = rn <opc> op2. the guest carry is needed by ADC/SBC/RSC and RRX, and a flag setting
+// logical op keeps the C (when the shifter doesn't set it) and V it finds.
+static void emit_alu(u32 opc, bool s, int rd, int rn, u32 op2)
+{
+	const bool compare = opc >= ALU_TST && opc <= ALU_CMN;
+	if(compare && bb_flags_unused)
+		return;
+	const bool sets = (s || compare) && !bb_flags_unused;
+
+	if(op2_is_rrx(op2) || opc == ALU_ADC || opc == ALU_SBC || opc == ALU_RSC || (sets && alu_is_logic(opc)))
+		emit_load_flags();
+
+	a32_dp(opc, sets, compare ? 0 : rd, rn, op2);
+
+	if(sets)
+		emit_store_flags();
+}
+
+static int op_alu(const u32 i)
+{
+	const u32 opc = (i >> 21) & 0xF;
+	const bool writes_rd = opc < ALU_TST || opc > ALU_CMN;
+	const bool reg_shift = !BIT25(i) && BIT4(i);
+
+	if(i == 0xE1A00000)
+		return 1; // nop
+	// writes to R15 are branches, and may restore the CPSR
+	if(writes_rd && REG_POS(i,12) == 15)
+		return 0;
+	// R15 reads as +12 with register shifts
+	if(reg_shift && (REG_POS(i,0) == 15 || REG_POS(i,8) == 15 || REG_POS(i,16) == 15))
+		return 0;
+
+	u32 op2;
+	if(BIT25(i))
+		op2 = i & (OP2_IMM | 0xFFF);
+	else if(reg_shift)
+	{
+		int rm = reg_read(REG_POS(i,0));
+		int rs = reg_read(REG_POS(i,8));
+		op2 = a32_reg_shift(rm, (i >> 5) & 3, rs);
+	}
+	else
+		op2 = a32_reg(reg_read(REG_POS(i,0)), (i >> 5) & 3, (i >> 7) & 0x1F);
+
+	int rn = (opc == ALU_MOV || opc == ALU_MVN) ? 0 : reg_read(REG_POS(i,16));
+	int rd = writes_rd ? reg_write(REG_POS(i,12)) : 0;
+	emit_alu(opc, BIT20(i), rd, rn, op2);
+	return 1;
+}
+
+static int OP_CLZ(const u32 i)
+{
+	if(REG_POS(i,12) == 15)
+		return 0;
+	int rm = reg_read(REG_POS(i,0));
+	emit(0xE16F0F10 | (reg_write(REG_POS(i,12)) << 12) | rm);
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+//   LDR / STR
+//-----------------------------------------------------------------------------
+// the accesses go through the same helpers (and so the same cycle counts) as the x86 backend.
+
+typedef u32 (FASTCALL* OpLDR)(u32, u32*);
+typedef u32 (FASTCALL* OpSTR)(u32, u32);
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDR(u32 adr, u32 *dstreg)
+{
+	u32 data = READ32(cpu->mem_if->data, adr);
+	if(adr&3)
+		data = ROR(data, 8*(adr&3));
+	*dstreg = data;
+	return MMU_aluMemAccessCycles<PROCNUM,32,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRH(u32 adr, u32 *dstreg)
+{
+	*dstreg = READ16(cpu->mem_if->data, adr);
+	return MMU_aluMemAccessCycles<PROCNUM,16,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRSH(u32 adr, u32 *dstreg)
+{
+	*dstreg = (s16)READ16(cpu->mem_if->data, adr);
+	return MMU_aluMemAccessCycles<PROCNUM,16,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRB(u32 adr, u32 *dstreg)
+{
+	*dstreg = READ8(cpu->mem_if->data, adr);
+	return MMU_aluMemAccessCycles<PROCNUM,8,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRSB(u32 adr, u32 *dstreg)
+{
+	*dstreg = (s8)READ8(cpu->mem_if->data, adr);
+	return MMU_aluMemAccessCycles<PROCNUM,8,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_STR(u32 adr, u32 data)
+{
+	WRITE32(cpu->mem_if->data, adr, data);
+	return MMU_aluMemAccessCycles<PROCNUM,32,MMU_AD_WRITE>(2,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_STRH(u32 adr, u32 data)
+{
+	WRITE16(cpu->mem_if->data, adr, data);
+	return MMU_aluMemAccessCycles<PROCNUM,16,MMU_AD_WRITE>(2,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_STRB(u32 adr, u32 data)
+{
+	WRITE8(cpu->mem_if->data, adr, data);
+	return MMU_aluMemAccessCycles<PROCNUM,8,MMU_AD_WRITE>(2,adr);
+}
+
+static const OpLDR LDR_tab[2]   = { OP_LDR<0>, OP_LDR<1> };
+static const OpLDR LDRH_tab[2]  = { OP_LDRH<0>, OP_LDRH<1> };
+static const OpLDR LDRSH_tab[2] = { OP_LDRSH<0>, OP_LDRSH<1> };
+static const OpLDR LDRB_tab[2]  = { OP_LDRB<0>, OP_LDRB<1> };
+static const OpLDR LDRSB_tab[2] = { OP_LDRSB<0>, OP_LDRSB<1> };
+static const OpSTR STR_tab[2]   = { OP_STR<0>, OP_STR<1> };
+static const OpSTR STRH_tab[2]  = { OP_STRH<0>, OP_STRH<1> };
+static const OpSTR STRB_tab[2]  = { OP_STRB<0>, OP_STRB<1> };
+
+// rd = rn +/- the offset operand
+static void emit_offset(bool up, int rd, int rn, u32 offset)
+{
+	if(op2_is_rrx(offset))
+		emit_load_flags();
+	a32_dp(up ? ALU_ADD : ALU_SUB, 0, rd, rn, offset);
+}
+
+// the access is at Rn +/- offset (pre-indexed) or at Rn (post-indexed). the store data is read
+// before the writeback, and a loaded Rd wins over the writeback of the same register.
+static void emit_ldr_str(const void *fn, bool load, u32 Rd, u32 Rn, u32 offset, bool up, bool pre, bool writeback)
+{
+	int rn = reg_read(Rn);
+	if(pre)
+		emit_offset(up, R0, rn, offset);
+	else
+		a32_mov(R0, rn);
+
+	if(!load)
+		a32_mov(R1, reg_read(Rd));
+
+	if(writeback)
+	{
+		int rnw = reg_write(Rn);
+		if(pre)
+			a32_mov(rnw, R0);
+		else
+			emit_offset(up, rnw, rnw, offset);
+	}
+
+	if(load)
+	{
+		regs_flush(1 << Rd);
+		a32_add_const(R1, RCPU, reg_off(Rd));
+	}
+	a32_call(fn);
+	if(load)
+		regs_discard(1 << Rd);
+}
+
+static int op_ldr_str(const u32 i)
+{
+	const bool load = BIT20(i);
+	const bool pre = BIT24(i);
+	const bool writeback = !pre || BIT21(i);
+
+	if(load && REG_POS(i,12) == 15)
+		return 0;
+	if(writeback && REG_POS(i,16) == 15)
+		return 0;
+
+	// the scaled register offset has the encoding of a shifter operand
+	u32 offset;
+	if(BIT25(i))
+		offset = a32_reg(reg_read(REG_POS(i,0)), (i >> 5) & 3, (i >> 7) & 0x1F);
+	else
+		offset = op2_imm(i & 0xFFF);
+
+	const void *fn;
+	if(load)
+		fn = (const void*)(BIT22(i) ? LDRB_tab[PROCNUM] : LDR_tab[PROCNUM]);
+	else
+		fn = (const void*)(BIT22(i) ? STRB_tab[PROCNUM] : STR_tab[PROCNUM]);
+
+	emit_ldr_str(fn, load, REG_POS(i,12), REG_POS(i,16), offset, BIT23(i), pre, writeback);
+	return 1;
+}
+
+static int op_ldrh_strh(const u32 i)
+{
+	const bool load = BIT20(i);
+	const bool pre = BIT24(i);
+	const bool writeback = !pre || BIT21(i);
+	const u32 sh = (i >> 5) & 3; // 1: H, 2: SB, 3: SH
+
+	if(load && REG_POS(i,12) == 15)
+		return 0;
+	if(writeback && REG_POS(i,16) == 15)
+		return 0;
+	if(!load && sh != 1)
+		return 0;
+
+	u32 offset;
+	if(BIT22(i))
+		offset = op2_imm(((i >> 4) & 0xF0) | (i & 0xF));
+	else
+		offset = a32_reg(reg_read(REG_POS(i,0)));
+
+	const void *fn;
+	if(!load)
+		fn = (const void*)STRH_tab[PROCNUM];
+	else if(sh == 1)
+		fn = (const void*)LDRH_tab[PROCNUM];
+	else if(sh == 2)
+		fn = (const void*)LDRSB_tab[PROCNUM];
+	else
+		fn = (const void*)LDRSH_tab[PROCNUM];
+
+	emit_ldr_str(fn, load, REG_POS(i,12), REG_POS(i,16), offset, BIT23(i), pre, writeback);
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+//   LDMIA / LDMIB / LDMDA / LDMDB / STMIA / STMIB / STMDA / STMDB
+//-----------------------------------------------------------------------------
+static u32 popregcount(u32 x)
+{
+	uint32_t pop = 0;
+	for(; x; x>>=1)
+		pop += x&1;
+	return pop;
+}
+
+static u64 get_reg_list(u32 reg_mask, int dir)
+{
+	u64 regs = 0;
+	for(int j=0; j<16; j++)
+	{
+		int k = dir<0 ? j : 15-j;
+		if(BIT_N(reg_mask,k))
+			regs = (regs << 4) | k;
+	}
+	return regs;
+}
+
+// generic needs to spill regs and main doesn't; if it's inlined gcc isn't smart enough to keep the spills out of the common case.
+#define LDM_INLINE NOINLINE
+
+template <int PROCNUM, bool store, int dir>
+static LDM_INLINE FASTCALL u32 OP_LDM_STM_generic(u32 adr, u64 regs, int n)
+{
+	adr &= ~3;
+	const u32 cycles = MMU_memBurstCycles<PROCNUM,store?MMU_AD_WRITE:MMU_AD_READ>(adr, n, dir);
+	do {
+		if(store) _MMU_write32<PROCNUM>(adr, cpu->R[regs&0xF]);
+		else cpu->R[regs&0xF] = _MMU_read32<PROCNUM>(adr);
+		adr += 4*dir;
+		regs >>= 4;
+	} while(--n > 0);
+	return cycles;
+}
+
+template <int PROCNUM, bool store, int dir>
+static LDM_INLINE FASTCALL u32 OP_LDM_STM_other(u32 adr, u64 regs, int n)
+{
+	u32 cycles;
+	adr &= ~3;
+#ifdef ENABLE_ADVANCED_TIMING
+	cycles = MMU_memBurstCycles<PROCNUM,store?MMU_AD_WRITE:MMU_AD_READ>(adr, n, dir);
+#else
+	cycles = n * MMU_memAccessCycles<PROCNUM,32,store?MMU_AD_WRITE:MMU_AD_READ>(adr);
+#endif
+	do {
+		if(PROCNUM==ARMCPU_ARM9)
+			if(store) _MMU_ARM9_write32(adr, cpu->R[regs&0xF]);
+			else cpu->R[regs&0xF] = _MMU_ARM9_read32(adr);
+		else
+			if(store) _MMU_ARM7_write32(adr, cpu->R[regs&0xF]);
+			else cpu->R[regs&0xF] = _MMU_ARM7_read32(adr);
+		adr += 4*dir;
+		regs >>= 4;
+	} while(--n > 0);
+	return cycles;
+}
+
+template <int PROCNUM, bool store, int dir, bool null_compiled>
+static FORCEINLINE FASTCALL u32 OP_LDM_STM_main(u32 adr, u64 regs, int n, u8 *ptr, u32 cycles)
+{
+#ifdef ENABLE_ADVANCED_TIMING
+	cycles = MMU_memBurstCycles<PROCNUM,store?MMU_AD_WRITE:MMU_AD_READ>(adr, n, dir);
+#endif
+	uintptr_t *func = (uintptr_t *)&JIT_COMPILED_FUNC(adr, PROCNUM);
+
+#define OP(j) { \
+	/* no need to zero functions in DTCM, since we can't execute from it */ \
+	if(null_compiled && store) \
+	{ \
+		*func = 0; \
+		*(func+1) = 0; \
+	} \
+	int Rd = ((uintptr_t)regs >> (j*4)) & 0xF; \
+	if(store) *(u32*)ptr = cpu->R[Rd]; \
+	else cpu->R[Rd] = *(u32*)ptr; \
+	func += 2*dir; \
+	adr += 4*dir; \
+	ptr += 4*dir; }
+
+	do {
+		OP(0);
+		if(n == 1) break;
+		OP(1);
+		if(n == 2) break;
+		OP(2);
+		if(n == 3) break;
+		OP(3);
+		regs >>= 16;
+		n -= 4;
+	} while(n > 0);
+	return cycles;
+#undef OP
+}
+
+// n comes before regs so that regs is passed in r2:r3 rather than partly on the stack
+template <int PROCNUM, bool store, int dir>
+static u32 FASTCALL OP_LDM_STM(u32 adr, int n, u64 regs)
+{
+	u32 cycles;
+	u8 *ptr;
+
+	if((adr ^ (adr + (dir>0 ? (n-1)*4 : -15*4))) & ~0x3FFF) // a little conservative, but we don't want to run too many comparisons
+	{
+		// the memory region spans a page boundary, so we can't factor the address translation out of the loop
+		return OP_LDM_STM_generic<PROCNUM, store, dir>(adr, regs, n);
+	}
+	else if(PROCNUM==ARMCPU_ARM9 && (adr & ~0x3FFF) == MMU.DTCMRegion)
+	{
+		// don't special-case DTCM cycles, even though that would be both faster and more accurate,
+		// because that wouldn't match the non-jitted version with !ACCOUNT_FOR_DATA_TCM_SPEED
+		ptr = MMU.ARM9_DTCM + (adr & 0x3FFC);
+		cycles = n * MMU_memAccessCycles<PROCNUM,32,store?MMU_AD_WRITE:MMU_AD_READ>(adr);
+		if(store)
+			return OP_LDM_STM_main<PROCNUM, store, dir, 0>(adr, regs, n, ptr, cycles);
+	}
+	else if((adr & 0x0F000000) == 0x02000000)
+	{
+		ptr = MMU.MAIN_MEM + (adr & _MMU_MAIN_MEM_MASK32);
+		cycles = n * ((PROCNUM==ARMCPU_ARM9) ? 4 : 2);
+		// the registers can take up to two 4KB pages
+		if(store)
+		{
+			MMU_touchMainMem(adr);
+			MMU_touchMainMem(adr + (n-1)*4*dir);
+		}
+	}
+	else if(PROCNUM==ARMCPU_ARM7 && !store && (adr & 0xFF800000) == 0x03800000)
+	{
+		ptr = MMU.ARM7_ERAM + (adr & 0xFFFC);
+		cycles = n;
+	}
+	else if(PROCNUM==ARMCPU_ARM7 && !store && (adr & 0xFF800000) == 0x03000000)
+	{
+		ptr = MMU.SWIRAM + (adr & 0x7FFC);
+		cycles = n;
+	}
+	else
+		return OP_LDM_STM_other<PROCNUM, store, dir>(adr, regs, n);
+
+	return OP_LDM_STM_main<PROCNUM, store, dir, store>(adr, regs, n, ptr, cycles);
+}
+
+typedef u32 FASTCALL (*LDMOpFunc)(u32,int,u64);
+static const LDMOpFunc op_ldm_stm_tab[2][2][2] = {{
+	{ OP_LDM_STM<0,0,-1>, OP_LDM_STM<0,0,+1> },
+	{ OP_LDM_STM<0,1,-1>, OP_LDM_STM<0,1,+1> },
+},{
+	{ OP_LDM_STM<1,0,-1>, OP_LDM_STM<1,0,+1> },
+	{ OP_LDM_STM<1,1,-1>, OP_LDM_STM<1,1,+1> },
+}};
+
+// transfers the listed registers starting at the address in R0, leaves the cycles in R0.
+// the cached copies of the stored registers are written back first; the loaded ones are
+// dropped by the caller, which may still need the old base.
+static void call_ldm_stm(u32 bitmask, bool store, int dir)
+{
+	if(store)
+		regs_flush(bitmask);
+	u64 regs = get_reg_list(bitmask, dir);
+	a32_mov32(R1, popregcount(bitmask));
+	a32_mov32(R2, (u32)regs);
+	a32_mov32(R3, (u32)(regs >> 32));
+	a32_call((const void*)op_ldm_stm_tab[PROCNUM][store][dir>0]);
+}
+
+static void emit_bx(int src, bool blx, bool test_thumb);
+static void emit_bx_thumb(int src, bool blx, bool test_thumb);
+
+static int op_ldm_stm(u32 i, bool store, int dir, bool before, bool writeback)
+{
+	const u32 bitmask = i & 0xFFFF;
+	const u32 pop = popregcount(bitmask);
+	const u32 Rn = REG_POS(i,16);
+
+	if(!bitmask)
+		return 0;
+	if(writeback && Rn == 15)
+	{
+		if(store || !BIT15(i))
+			return 0;
+		writeback = false;
+	}
+
+	int rn = reg_read(Rn);
+	if(before)
+		a32_alu_imm(dir > 0 ? ALU_ADD : ALU_SUB, R0, rn, 4);
+	else
+		a32_mov(R0, rn);
+
+	call_ldm_stm(bitmask, store, dir);
+
+	if(BIT15(i) && !store)
+	{
+		a32_ldr_cpu(RTMP2, reg_off(15));
+		emit_bx(RTMP2, 0, PROCNUM == ARMCPU_ARM9);
+	}
+
+	u32 loaded = store ? 0 : (bitmask & 0x7FFF);
+	if(writeback)
+	{
+		// a base in the list keeps the loaded value, unless a higher register was loaded too
+		bool in_list = BIT_N(bitmask, Rn);
+		if(store || !in_list || (bitmask & ~((2 << Rn) - 1)))
+		{
+			int rnw = reg_write(Rn);
+			a32_alu_imm(dir > 0 ? ALU_ADD : ALU_SUB, rnw, rnw, 4*pop);
+			loaded &= ~(1 << Rn);
+		}
+	}
+	regs_discard(loaded);
+
+	emit_MMU_aluMemCycles(store ? 1 : 2, pop);
+	return 1;
+}
+
+static int OP_LDMIA(const u32 i) { return op_ldm_stm(i, 0, +1, 0, 0); }
+static int OP_LDMIA_W(const u32 i) { return op_ldm_stm(i, 0, +1, 0, 1); }
+static int OP_LDMIB(const u32 i) { return op_ldm_stm(i, 0, +1, 1, 0); }
+static int OP_LDMIB_W(const u32 i) { return op_ldm_stm(i, 0, +1, 1, 1); }
+static int OP_LDMDA(const u32 i) { return op_ldm_stm(i, 0, -1, 0, 0); }
+static int OP_LDMDA_W(const u32 i) { return op_ldm_stm(i, 0, -1, 0, 1); }
+static int OP_LDMDB(const u32 i) { return op_ldm_stm(i, 0, -1, 1, 0); }
+static int OP_LDMDB_W(const u32 i) { return op_ldm_stm(i, 0, -1, 1, 1); }
+static int OP_STMIA(const u32 i) { return op_ldm_stm(i, 1, +1, 0, 0); }
+static int OP_STMIA_W(const u32 i) { return op_ldm_stm(i, 1, +1, 0, 1); }
+static int OP_STMIB(const u32 i) { return op_ldm_stm(i, 1, +1, 1, 0); }
+static int OP_STMIB_W(const u32 i) { return op_ldm_stm(i, 1, +1, 1, 1); }
+static int OP_STMDA(const u32 i) { return op_ldm_stm(i, 1, -1, 0, 0); }
+static int OP_STMDA_W(const u32 i) { return op_ldm_stm(i, 1, -1, 0, 1); }
+static int OP_STMDB(const u32 i) { return op_ldm_stm(i, 1, -1, 1, 0); }
+static int OP_STMDB_W(const u32 i) { return op_ldm_stm(i, 1, -1, 1, 1); }
+
+//-----------------------------------------------------------------------------
+//   Branch
+//-----------------------------------------------------------------------------
+#define SIGNEXTEND_11(i) (((s32)i<<21)>>21)
+#define SIGNEXTEND_24(i) (((s32)i<<8)>>8)
+
+static int op_b(u32 i, bool bl)
+{
+	u32 dst = bb_r15 + (SIGNEXTEND_24(i) << 2);
+	if(CONDITION(i)==0xF)
+	{
+		if(bl)
+			dst += 2;
+		a32_ldr_cpu(RPSR, cpu_off(CPSR.val));
+		a32_alu_imm(ALU_ORR, RPSR, RPSR, 1<<5);
+		a32_str_cpu(RPSR, cpu_off(CPSR.val));
+	}
+	if(bl || CONDITION(i)==0xF)
+		a32_mov32(reg_write(14), bb_next_instruction);
+
+	a32_mov32(RTMP0, dst);
+	a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+	return 1;
+}
+
+static int OP_B(const u32 i) { return op_b(i, 0); }
+static int OP_BL(const u32 i) { return op_b(i, 1); }
+
+// RTMP0 = src & ~3, or & ~1 when its bit 0 (in RTMP1) asks for thumb
+static void emit_interwork_target(int src)
+{
+	a32_mov32(RTMP0, 0xFFFFFFFC);
+	a32_dp(ALU_ADD, 0, RTMP0, RTMP0, a32_reg(RTMP1, SH_LSL, 1));
+	a32_dp(ALU_AND, 0, RTMP0, src, a32_reg(RTMP0));
+}
+
+static void emit_bx(int src, bool blx, bool test_thumb)
+{
+	if(test_thumb)
+	{
+		a32_alu_imm(ALU_AND, RTMP1, src, 1);
+		a32_ldr_cpu(RPSR, cpu_off(CPSR.val));
+		a32_dp(ALU_ORR, 0, RPSR, RPSR, a32_reg(RTMP1, SH_LSL, 5));
+		a32_str_cpu(RPSR, cpu_off(CPSR.val));
+		emit_interwork_target(src);
+	}
+	else
+		a32_alu_imm(ALU_BIC, RTMP0, src, 3);
+
+	if(blx)
+		a32_mov32(reg_write(14), bb_next_instruction);
+	a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+}
+
+static int OP_BX(const u32 i) { emit_bx(reg_read(REG_POS(i,0)), 0, 1); return 1; }
+static int OP_BLX_REG(const u32 i) { emit_bx(reg_read(REG_POS(i,0)), 1, 1); return 1; }
+
+//-----------------------------------------------------------------------------
+//   THUMB
+//-----------------------------------------------------------------------------
+// every ALU op is emitted as the ARM op it is defined as, flags and all.
+
+static int thumb_alu(u32 opc, u32 Rd, u32 Rn, u32 op2, bool s = true)
+{
+	int rn = (opc == ALU_MOV || opc == ALU_MVN) ? 0 : reg_read(Rn);
+	int rd = (opc >= ALU_TST && opc <= ALU_CMN) ? 0 : reg_write(Rd);
+	emit_alu(opc, s, rd, rn, op2);
+	return 1;
+}
+
+static int thumb_alu_reg(const u32 i, u32 opc)
+{
+	return thumb_alu(opc, _REG_NUM(i, 0), _REG_NUM(i, 0), a32_reg(reg_read(_REG_NUM(i, 3))));
+}
+
+static int thumb_shift_imm(const u32 i, u32 type)
+{
+	return thumb_alu(ALU_MOV, _REG_NUM(i, 0), 0, a32_reg(reg_read(_REG_NUM(i, 3)), type, (i >> 6) & 0x1F));
+}
+
+static int thumb_shift_reg(const u32 i, u32 type)
+{
+	int rs = reg_read(_REG_NUM(i, 3));
+	int rm = reg_read(_REG_NUM(i, 0));
+	return thumb_alu(ALU_MOV, _REG_NUM(i, 0), 0, a32_reg_shift(rm, type, rs));
+}
+
+static int OP_LSL_0(const u32 i) { return thumb_shift_imm(i, SH_LSL); }
+static int OP_LSL(const u32 i) { return thumb_shift_imm(i, SH_LSL); }
+static int OP_LSR_0(const u32 i) { return thumb_shift_imm(i, SH_LSR); }
+static int OP_LSR(const u32 i) { return thumb_shift_imm(i, SH_LSR); }
+static int OP_ASR_0(const u32 i) { return thumb_shift_imm(i, SH_ASR); }
+static int OP_ASR(const u32 i) { return thumb_shift_imm(i, SH_ASR); }
+
+static int OP_LSL_REG(const u32 i) { return thumb_shift_reg(i, SH_LSL); }
+static int OP_LSR_REG(const u32 i) { return thumb_shift_reg(i, SH_LSR); }
+static int OP_ASR_REG(const u32 i) { return thumb_shift_reg(i, SH_ASR); }
+static int OP_ROR_REG(const u32 i) { return thumb_shift_reg(i, SH_ROR); }
+
+static int thumb_imm3(const u32 i, u32 opc)
+{
+	return thumb_alu(opc, _REG_NUM(i, 0), _REG_NUM(i, 3), op2_imm((i >> 6) & 7));
+}
+
+static int thumb_reg3(const u32 i, u32 opc)
+{
+	return thumb_alu(opc, _REG_NUM(i, 0), _REG_NUM(i, 3), a32_reg(reg_read(_REG_NUM(i, 6))));
+}
+
+static int thumb_imm8(const u32 i, u32 opc)
+{
+	return thumb_alu(opc, _REG_NUM(i, 8), _REG_NUM(i, 8), op2_imm(i & 0xFF));
+}
+
+static int OP_ADD_IMM3(const u32 i) { return thumb_imm3(i, ALU_ADD); }
+static int OP_SUB_IMM3(const u32 i) { return thumb_imm3(i, ALU_SUB); }
+static int OP_ADD_REG(const u32 i) { return thumb_reg3(i, ALU_ADD); }
+static int OP_SUB_REG(const u32 i) { return thumb_reg3(i, ALU_SUB); }
+static int OP_MOV_IMM8(const u32 i) { return thumb_imm8(i, ALU_MOV); }
+static int OP_CMP_IMM8(const u32 i) { return thumb_imm8(i, ALU_CMP); }
+static int OP_ADD_IMM8(const u32 i) { return thumb_imm8(i, ALU_ADD); }
+static int OP_SUB_IMM8(const u32 i) { return thumb_imm8(i, ALU_SUB); }
+
+static int OP_AND(const u32 i) { return thumb_alu_reg(i, ALU_AND); }
+static int OP_EOR(const u32 i) { return thumb_alu_reg(i, ALU_EOR); }
+static int OP_ADC_REG(const u32 i) { return thumb_alu_reg(i, ALU_ADC); }
+static int OP_SBC_REG(const u32 i) { return thumb_alu_reg(i, ALU_SBC); }
+static int OP_TST(const u32 i) { return thumb_alu_reg(i, ALU_TST); }
+static int OP_CMP(const u32 i) { return thumb_alu_reg(i, ALU_CMP); }
+static int OP_CMN(const u32 i) { return thumb_alu_reg(i, ALU_CMN); }
+static int OP_ORR(const u32 i) { return thumb_alu_reg(i, ALU_ORR); }
+static int OP_BIC(const u32 i) { return thumb_alu_reg(i, ALU_BIC); }
+static int OP_MVN(const u32 i) { return thumb_alu_reg(i, ALU_MVN); }
+
+static int OP_NEG(const u32 i)
+{
+	return thumb_alu(ALU_RSB, _REG_NUM(i, 0), _REG_NUM(i, 3), op2_imm(0));
+}
+
+static int thumb_spe(const u32 i, u32 opc, bool s)
+{
+	const u32 Rd = (i&7) | ((i>>4)&8);
+	if(opc != ALU_CMP && Rd == 15)
+		return 0;
+	return thumb_alu(opc, Rd, Rd, a32_reg(reg_read(REG_POS(i,3))), s);
+}
+
+static int OP_ADD_SPE(const u32 i) { return thumb_spe(i, ALU_ADD, false); }
+static int OP_CMP_SPE(const u32 i) { return thumb_spe(i, ALU_CMP, true); }
+static int OP_MOV_SPE(const u32 i) { return thumb_spe(i, ALU_MOV, false); }
+
+static int OP_ADD_2PC(const u32 i)
+{
+	a32_mov32(reg_write(_REG_NUM(i, 8)), (bb_r15 & 0xFFFFFFFC) + ((i&0xFF)<<2));
+	return 1;
+}
+
+static int OP_ADD_2SP(const u32 i)
+{
+	return thumb_alu(ALU_ADD, _REG_NUM(i, 8), 13, op2_imm((i&0xFF)<<2), false);
+}
+
+static int OP_ADJUST_P_SP(const u32 i)
+{
+	return thumb_alu(ALU_ADD, 13, 13, op2_imm((i&0x7F)<<2), false);
+}
+
+static int OP_ADJUST_M_SP(const u32 i)
+{
+	return thumb_alu(ALU_SUB, 13, 13, op2_imm((i&0x7F)<<2), false);
+}
+
+static int thumb_ldr_str(const void *fn, bool load, u32 Rd, u32 Rb, u32 offset)
+{
+	emit_ldr_str(fn, load, Rd, Rb, offset, true, true, false);
+	return 1;
+}
+
+static int thumb_imm_off(const u32 i, const void *fn, bool load, u32 off)
+{
+	return thumb_ldr_str(fn, load, _REG_NUM(i, 0), _REG_NUM(i, 3), op2_imm(off));
+}
+
+static int thumb_reg_off(const u32 i, const void *fn, bool load)
+{
+	return thumb_ldr_str(fn, load, _REG_NUM(i, 0), _REG_NUM(i, 3), a32_reg(reg_read(_REG_NUM(i, 6))));
+}
+
+static int OP_LDRB_IMM_OFF(const u32 i) { return thumb_imm_off(i, (const void*)LDRB_tab[PROCNUM], true, (i>>6)&0x1F); }
+static int OP_LDRH_IMM_OFF(const u32 i) { return thumb_imm_off(i, (const void*)LDRH_tab[PROCNUM], true, (i>>5)&0x3E); }
+static int OP_LDR_IMM_OFF(const u32 i) { return thumb_imm_off(i, (const void*)LDR_tab[PROCNUM], true, (i>>4)&0x7C); }
+static int OP_STRB_IMM_OFF(const u32 i) { return thumb_imm_off(i, (const void*)STRB_tab[PROCNUM], false, (i>>6)&0x1F); }
+static int OP_STRH_IMM_OFF(const u32 i) { return thumb_imm_off(i, (const void*)STRH_tab[PROCNUM], false, (i>>5)&0x3E); }
+static int OP_STR_IMM_OFF(const u32 i) { return thumb_imm_off(i, (const void*)STR_tab[PROCNUM], false, (i>>4)&0x7C); }
+
+static int OP_LDRB_REG_OFF(const u32 i) { return thumb_reg_off(i, (const void*)LDRB_tab[PROCNUM], true); }
+static int OP_LDRSB_REG_OFF(const u32 i) { return thumb_reg_off(i, (const void*)LDRSB_tab[PROCNUM], true); }
+static int OP_LDRH_REG_OFF(const u32 i) { return thumb_reg_off(i, (const void*)LDRH_tab[PROCNUM], true); }
+static int OP_LDRSH_REG_OFF(const u32 i) { return thumb_reg_off(i, (const void*)LDRSH_tab[PROCNUM], true); }
+static int OP_LDR_REG_OFF(const u32 i) { return thumb_reg_off(i, (const void*)LDR_tab[PROCNUM], true); }
+static int OP_STRB_REG_OFF(const u32 i) { return thumb_reg_off(i, (const void*)STRB_tab[PROCNUM], false); }
+static int OP_STRH_REG_OFF(const u32 i) { return thumb_reg_off(i, (const void*)STRH_tab[PROCNUM], false); }
+static int OP_STR_REG_OFF(const u32 i) { return thumb_reg_off(i, (const void*)STR_tab[PROCNUM], false); }
+
+static int OP_LDR_SPREL(const u32 i)
+{
+	return thumb_ldr_str((const void*)LDR_tab[PROCNUM], true, _REG_NUM(i, 8), 13, op2_imm((i&0xFF)<<2));
+}
+
+static int OP_STR_SPREL(const u32 i)
+{
+	return thumb_ldr_str((const void*)STR_tab[PROCNUM], false, _REG_NUM(i, 8), 13, op2_imm((i&0xFF)<<2));
+}
+
+static int OP_LDR_PCREL(const u32 i)
+{
+	const u32 Rd = _REG_NUM(i, 8);
+	a32_mov32(R0, (bb_r15 & 0xFFFFFFFC) + ((i&0xFF)<<2));
+	regs_flush(1 << Rd);
+	a32_add_const(R1, RCPU, reg_off(Rd));
+	a32_call((const void*)LDR_tab[PROCNUM]);
+	regs_discard(1 << Rd);
+	return 1;
+}
+
+static int op_ldm_stm_thumb(u32 i, bool store)
+{
+	const u32 bitmask = i & 0xFF;
+	const u32 pop = popregcount(bitmask);
+	const u32 Rb = _REG_NUM(i, 8);
+
+	if(!bitmask)
+		return 0;
+
+	a32_mov(R0, reg_read(Rb));
+	call_ldm_stm(bitmask, store, 1);
+
+	// ARM_REF:	THUMB: Causes base register write-back, and is not optional
+	// ARM_REF:	If the base register <Rn> is specified in <registers>, the final value of <Rn> is the loaded value
+	//			(not the written-back value).
+	u32 loaded = store ? 0 : bitmask;
+	if(store || !BIT_N(i, Rb))
+	{
+		int rbw = reg_write(Rb);
+		a32_alu_imm(ALU_ADD, rbw, rbw, 4*pop);
+	}
+	regs_discard(loaded);
+
+	emit_MMU_aluMemCycles(store ? 2 : 3, pop);
+	return 1;
+}
+
+static int OP_LDMIA_THUMB(const u32 i) { return op_ldm_stm_thumb(i, 0); }
+static int OP_STMIA_THUMB(const u32 i) { return op_ldm_stm_thumb(i, 1); }
+
+static int op_push_pop(u32 i, bool store, bool pc_lr)
+{
+	u32 bitmask = (i & 0xFF);
+	bitmask |= pc_lr << (store ? 14 : 15);
+	u32 pop = popregcount(bitmask);
+	int dir = store ? -1 : 1;
+
+	if(!bitmask)
+		return 0;
+
+	int sp = reg_read(13);
+	if(store)
+		a32_alu_imm(ALU_SUB, R0, sp, 4);
+	else
+		a32_mov(R0, sp);
+
+	call_ldm_stm(bitmask, store, dir);
+
+	if(pc_lr && !store)
+	{
+		a32_ldr_cpu(RTMP2, reg_off(15));
+		emit_bx_thumb(RTMP2, 0, PROCNUM == ARMCPU_ARM9);
+	}
+	int spw = reg_write(13);
+	a32_alu_imm(store ? ALU_SUB : ALU_ADD, spw, spw, 4*pop);
+	if(!store)
+		regs_discard(bitmask & 0x7FFF);
+
+	emit_MMU_aluMemCycles(store ? (pc_lr?4:3) : (pc_lr?5:2), pop);
+	return 1;
+}
+
+static int OP_PUSH(const u32 i)    { return op_push_pop(i, 1, 0); }
+static int OP_PUSH_LR(const u32 i) { return op_push_pop(i, 1, 1); }
+static int OP_POP(const u32 i)     { return op_push_pop(i, 0, 0); }
+static int OP_POP_PC(const u32 i)  { return op_push_pop(i, 0, 1); }
+
+static int OP_B_COND(const u32 i)
+{
+	u32 dst = bb_r15 + ((u32)((s8)(i&0xFF))<<1);
+
+	a32_mov32(RTMP0, bb_next_instruction);
+	a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+
+	u32 *skip = emit_branch_unless((i>>8)&0xF);
+	a32_mov32(RTMP0, dst);
+	a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+	a32_alu_imm(ALU_ADD, RCYC, RCYC, 2);
+	if(skip)
+		a32_bind(skip);
+
+	return 1;
+}
+
+static int OP_B_UNCOND(const u32 i)
+{
+	a32_mov32(RTMP0, bb_r15 + (SIGNEXTEND_11(i)<<1));
+	a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+	return 1;
+}
+
+static int OP_BLX(const u32 i)
+{
+	int lr = reg_read(14);
+	a32_add_const(RTMP0, lr, (i&0x7FF) << 1);
+	a32_alu_imm(ALU_BIC, RTMP0, RTMP0, 3);
+	a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+	a32_mov32(reg_write(14), bb_next_instruction | 1);
+	// reset T bit
+	a32_ldr_cpu(RPSR, cpu_off(CPSR.val));
+	a32_alu_imm(ALU_BIC, RPSR, RPSR, 1<<5);
+	a32_str_cpu(RPSR, cpu_off(CPSR.val));
+	return 1;
+}
+
+static int OP_BL_10(const u32 i)
+{
+	a32_mov32(reg_write(14), bb_r15 + (SIGNEXTEND_11(i)<<12));
+	return 1;
+}
+
+static int OP_BL_11(const u32 i)
+{
+	int lr = reg_read(14);
+	a32_add_const(RTMP0, lr, (i&0x7FF) << 1);
+	a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+	a32_mov32(reg_write(14), bb_next_instruction | 1);
+	return 1;
+}
+
+static void emit_bx_thumb(int src, bool blx, bool test_thumb)
+{
+	a32_alu_imm(ALU_AND, RTMP1, src, 1);
+	if(test_thumb)
+		emit_interwork_target(src);
+	else
+		a32_alu_imm(ALU_BIC, RTMP0, src, 1);
+
+	if(blx)
+		a32_mov32(reg_write(14), bb_next_instruction | 1);
+
+	a32_ldr_cpu(RPSR, cpu_off(CPSR.val));
+	a32_bfi(RPSR, RTMP1, 5, 1);
+	a32_str_cpu(RPSR, cpu_off(CPSR.val));
+
+	a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+}
+
+static int op_bx_thumbR15()
+{
+	const u32 r15 = (bb_r15 & 0xFFFFFFFC);
+	a32_mov32(RTMP0, r15);
+	a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+	a32_str_cpu(RTMP0, reg_off(15));
+	a32_ldr_cpu(RPSR, cpu_off(CPSR.val));
+	a32_alu_imm(ALU_BIC, RPSR, RPSR, 1<<5);
+	a32_str_cpu(RPSR, cpu_off(CPSR.val));
+	return 1;
+}
+
+static int OP_BX_THUMB(const u32 i) { if (REG_POS(i, 3) == 15) return op_bx_thumbR15(); emit_bx_thumb(reg_read(REG_POS(i, 3)), 0, 0); return 1; }
+static int OP_BLX_THUMB(const u32 i) { emit_bx_thumb(reg_read(REG_POS(i, 3)), 1, 1); return 1; }
+
+//-----------------------------------------------------------------------------
+//   Decoded by bit fields rather than one compiler per table entry
+//-----------------------------------------------------------------------------
+
+#define OP_AND_LSL_IMM         op_alu
+#define OP_AND_LSL_REG         op_alu
+#define OP_AND_LSR_IMM         op_alu
+#define OP_AND_LSR_REG         op_alu
+#define OP_AND_ASR_IMM         op_alu
+#define OP_AND_ASR_REG         op_alu
+#define OP_AND_ROR_IMM         op_alu
+#define OP_AND_ROR_REG         op_alu
+#define OP_AND_S_LSL_IMM       op_alu
+#define OP_AND_S_LSL_REG       op_alu
+#define OP_AND_S_LSR_IMM       op_alu
+#define OP_AND_S_LSR_REG       op_alu
+#define OP_AND_S_ASR_IMM       op_alu
+#define OP_AND_S_ASR_REG       op_alu
+#define OP_AND_S_ROR_IMM       op_alu
+#define OP_AND_S_ROR_REG       op_alu
+#define OP_EOR_LSL_IMM         op_alu
+#define OP_EOR_LSL_REG         op_alu
+#define OP_EOR_LSR_IMM         op_alu
+#define OP_EOR_LSR_REG         op_alu
+#define OP_EOR_ASR_IMM         op_alu
+#define OP_EOR_ASR_REG         op_alu
+#define OP_EOR_ROR_IMM         op_alu
+#define OP_EOR_ROR_REG         op_alu
+#define OP_EOR_S_LSL_IMM       op_alu
+#define OP_EOR_S_LSL_REG       op_alu
+#define OP_EOR_S_LSR_IMM       op_alu
+#define OP_EOR_S_LSR_REG       op_alu
+#define OP_EOR_S_ASR_IMM       op_alu
+#define OP_EOR_S_ASR_REG       op_alu
+#define OP_EOR_S_ROR_IMM       op_alu
+#define OP_EOR_S_ROR_REG       op_alu
+#define OP_SUB_LSL_IMM         op_alu
+#define OP_SUB_LSL_REG         op_alu
+#define OP_SUB_LSR_IMM         op_alu
+#define OP_SUB_LSR_REG         op_alu
+#define OP_SUB_ASR_IMM         op_alu
+#define OP_SUB_ASR_REG         op_alu
+#define OP_SUB_ROR_IMM         op_alu
+#define OP_SUB_ROR_REG         op_alu
+#define OP_SUB_S_LSL_IMM       op_alu
+#define OP_SUB_S_LSL_REG       op_alu
+#define OP_SUB_S_LSR_IMM       op_alu
+#define OP_SUB_S_LSR_REG       op_alu
+#define OP_SUB_S_ASR_IMM       op_alu
+#define OP_SUB_S_ASR_REG       op_alu
+#define OP_SUB_S_ROR_IMM       op_alu
+#define OP_SUB_S_ROR_REG       op_alu
+#define OP_RSB_LSL_IMM         op_alu
+#define OP_RSB_LSL_REG         op_alu
+#define OP_RSB_LSR_IMM         op_alu
+#define OP_RSB_LSR_REG         op_alu
+#define OP_RSB_ASR_IMM         op_alu
+#define OP_RSB_ASR_REG         op_alu
+#define OP_RSB_ROR_IMM         op_alu
+#define OP_RSB_ROR_REG         op_alu
+#define OP_RSB_S_LSL_IMM       op_alu
+#define OP_RSB_S_LSL_REG       op_alu
+#define OP_RSB_S_LSR_IMM       op_alu
+#define OP_RSB_S_LSR_REG       op_alu
+#define OP_RSB_S_ASR_IMM       op_alu
+#define OP_RSB_S_ASR_REG       op_alu
+#define OP_RSB_S_ROR_IMM       op_alu
+#define OP_RSB_S_ROR_REG       op_alu
+#define OP_ADD_LSL_IMM         op_alu
+#define OP_ADD_LSL_REG         op_alu
+#define OP_ADD_LSR_IMM         op_alu
+#define OP_ADD_LSR_REG         op_alu
+#define OP_ADD_ASR_IMM         op_alu
+#define OP_ADD_ASR_REG         op_alu
+#define OP_ADD_ROR_IMM         op_alu
+#define OP_ADD_ROR_REG         op_alu
+#define OP_ADD_S_LSL_IMM       op_alu
+#define OP_ADD_S_LSL_REG       op_alu
+#define OP_ADD_S_LSR_IMM       op_alu
+#define OP_ADD_S_LSR_REG       op_alu
+#define OP_ADD_S_ASR_IMM       op_alu
+#define OP_ADD_S_ASR_REG       op_alu
+#define OP_ADD_S_ROR_IMM       op_alu
+#define OP_ADD_S_ROR_REG       op_alu
+#define OP_ADC_LSL_IMM         op_alu
+#define OP_ADC_LSL_REG         op_alu
+#define OP_ADC_LSR_IMM         op_alu
+#define OP_ADC_LSR_REG         op_alu
+#define OP_ADC_ASR_IMM         op_alu
+#define OP_ADC_ASR_REG         op_alu
+#define OP_ADC_ROR_IMM         op_alu
+#define OP_ADC_ROR_REG         op_alu
+#define OP_ADC_S_LSL_IMM       op_alu
+#define OP_ADC_S_LSL_REG       op_alu
+#define OP_ADC_S_LSR_IMM       op_alu
+#define OP_ADC_S_LSR_REG       op_alu
+#define OP_ADC_S_ASR_IMM       op_alu
+#define OP_ADC_S_ASR_REG       op_alu
+#define OP_ADC_S_ROR_IMM       op_alu
+#define OP_ADC_S_ROR_REG       op_alu
+#define OP_SBC_LSL_IMM         op_alu
+#define OP_SBC_LSL_REG         op_alu
+#define OP_SBC_LSR_IMM         op_alu
+#define OP_SBC_LSR_REG         op_alu
+#define OP_SBC_ASR_IMM         op_alu
+#define OP_SBC_ASR_REG         op_alu
+#define OP_SBC_ROR_IMM         op_alu
+#define OP_SBC_ROR_REG         op_alu
+#define OP_SBC_S_LSL_IMM       op_alu
+#define OP_SBC_S_LSL_REG       op_alu
+#define OP_SBC_S_LSR_IMM       op_alu
+#define OP_SBC_S_LSR_REG       op_alu
+#define OP_SBC_S_ASR_IMM       op_alu
+#define OP_SBC_S_ASR_REG       op_alu
+#define OP_SBC_S_ROR_IMM       op_alu
+#define OP_SBC_S_ROR_REG       op_alu
+#define OP_RSC_LSL_IMM         op_alu
+#define OP_RSC_LSL_REG         op_alu
+#define OP_RSC_LSR_IMM         op_alu
+#define OP_RSC_LSR_REG         op_alu
+#define OP_RSC_ASR_IMM         op_alu
+#define OP_RSC_ASR_REG         op_alu
+#define OP_RSC_ROR_IMM         op_alu
+#define OP_RSC_ROR_REG         op_alu
+#define OP_RSC_S_LSL_IMM       op_alu
+#define OP_RSC_S_LSL_REG       op_alu
+#define OP_RSC_S_LSR_IMM       op_alu
+#define OP_RSC_S_LSR_REG       op_alu
+#define OP_RSC_S_ASR_IMM       op_alu
+#define OP_RSC_S_ASR_REG       op_alu
+#define OP_RSC_S_ROR_IMM       op_alu
+#define OP_RSC_S_ROR_REG       op_alu
+#define OP_TST_LSL_IMM         op_alu
+#define OP_TST_LSL_REG         op_alu
+#define OP_TST_LSR_IMM         op_alu
+#define OP_TST_LSR_REG         op_alu
+#define OP_TST_ASR_IMM         op_alu
+#define OP_TST_ASR_REG         op_alu
+#define OP_TST_ROR_IMM         op_alu
+#define OP_TST_ROR_REG         op_alu
+#define OP_TEQ_LSL_IMM         op_alu
+#define OP_TEQ_LSL_REG         op_alu
+#define OP_TEQ_LSR_IMM         op_alu
+#define OP_TEQ_LSR_REG         op_alu
+#define OP_TEQ_ASR_IMM         op_alu
+#define OP_TEQ_ASR_REG         op_alu
+#define OP_TEQ_ROR_IMM         op_alu
+#define OP_TEQ_ROR_REG         op_alu
+#define OP_CMP_LSL_IMM         op_alu
+#define OP_CMP_LSL_REG         op_alu
+#define OP_CMP_LSR_IMM         op_alu
+#define OP_CMP_LSR_REG         op_alu
+#define OP_CMP_ASR_IMM         op_alu
+#define OP_CMP_ASR_REG         op_alu
+#define OP_CMP_ROR_IMM         op_alu
+#define OP_CMP_ROR_REG         op_alu
+#define OP_CMN_LSL_IMM         op_alu
+#define OP_CMN_LSL_REG         op_alu
+#define OP_CMN_LSR_IMM         op_alu
+#define OP_CMN_LSR_REG         op_alu
+#define OP_CMN_ASR_IMM         op_alu
+#define OP_CMN_ASR_REG         op_alu
+#define OP_CMN_ROR_IMM         op_alu
+#define OP_CMN_ROR_REG         op_alu
+#define OP_ORR_LSL_IMM         op_alu
+#define OP_ORR_LSL_REG         op_alu
+#define OP_ORR_LSR_IMM         op_alu
+#define OP_ORR_LSR_REG         op_alu
+#define OP_ORR_ASR_IMM         op_alu
+#define OP_ORR_ASR_REG         op_alu
+#define OP_ORR_ROR_IMM         op_alu
+#define OP_ORR_ROR_REG         op_alu
+#define OP_ORR_S_LSL_IMM       op_alu
+#define OP_ORR_S_LSL_REG       op_alu
+#define OP_ORR_S_LSR_IMM       op_alu
+#define OP_ORR_S_LSR_REG       op_alu
+#define OP_ORR_S_ASR_IMM       op_alu
+#define OP_ORR_S_ASR_REG       op_alu
+#define OP_ORR_S_ROR_IMM       op_alu
+#define OP_ORR_S_ROR_REG       op_alu
+#define OP_MOV_LSL_IMM         op_alu
+#define OP_MOV_LSL_REG         op_alu
+#define OP_MOV_LSR_IMM         op_alu
+#define OP_MOV_LSR_REG         op_alu
+#define OP_MOV_ASR_IMM         op_alu
+#define OP_MOV_ASR_REG         op_alu
+#define OP_MOV_ROR_IMM         op_alu
+#define OP_MOV_ROR_REG         op_alu
+#define OP_MOV_S_LSL_IMM       op_alu
+#define OP_MOV_S_LSL_REG       op_alu
+#define OP_MOV_S_LSR_IMM       op_alu
+#define OP_MOV_S_LSR_REG       op_alu
+#define OP_MOV_S_ASR_IMM       op_alu
+#define OP_MOV_S_ASR_REG       op_alu
+#define OP_MOV_S_ROR_IMM       op_alu
+#define OP_MOV_S_ROR_REG       op_alu
+#define OP_BIC_LSL_IMM         op_alu
+#define OP_BIC_LSL_REG         op_alu
+#define OP_BIC_LSR_IMM         op_alu
+#define OP_BIC_LSR_REG         op_alu
+#define OP_BIC_ASR_IMM         op_alu
+#define OP_BIC_ASR_REG         op_alu
+#define OP_BIC_ROR_IMM         op_alu
+#define OP_BIC_ROR_REG         op_alu
+#define OP_BIC_S_LSL_IMM       op_alu
+#define OP_BIC_S_LSL_REG       op_alu
+#define OP_BIC_S_LSR_IMM       op_alu
+#define OP_BIC_S_LSR_REG       op_alu
+#define OP_BIC_S_ASR_IMM       op_alu
+#define OP_BIC_S_ASR_REG       op_alu
+#define OP_BIC_S_ROR_IMM       op_alu
+#define OP_BIC_S_ROR_REG       op_alu
+#define OP_MVN_LSL_IMM         op_alu
+#define OP_MVN_LSL_REG         op_alu
+#define OP_MVN_LSR_IMM         op_alu
+#define OP_MVN_LSR_REG         op_alu
+#define OP_MVN_ASR_IMM         op_alu
+#define OP_MVN_ASR_REG         op_alu
+#define OP_MVN_ROR_IMM         op_alu
+#define OP_MVN_ROR_REG         op_alu
+#define OP_MVN_S_LSL_IMM       op_alu
+#define OP_MVN_S_LSL_REG       op_alu
+#define OP_MVN_S_LSR_IMM       op_alu
+#define OP_MVN_S_LSR_REG       op_alu
+#define OP_MVN_S_ASR_IMM       op_alu
+#define OP_MVN_S_ASR_REG       op_alu
+#define OP_MVN_S_ROR_IMM       op_alu
+#define OP_MVN_S_ROR_REG       op_alu
+#define OP_AND_IMM_VAL         op_alu
+#define OP_AND_S_IMM_VAL       op_alu
+#define OP_EOR_IMM_VAL         op_alu
+#define OP_EOR_S_IMM_VAL       op_alu
+#define OP_SUB_IMM_VAL         op_alu
+#define OP_SUB_S_IMM_VAL       op_alu
+#define OP_RSB_IMM_VAL         op_alu
+#define OP_RSB_S_IMM_VAL       op_alu
+#define OP_ADD_IMM_VAL         op_alu
+#define OP_ADD_S_IMM_VAL       op_alu
+#define OP_ADC_IMM_VAL         op_alu
+#define OP_ADC_S_IMM_VAL       op_alu
+#define OP_SBC_IMM_VAL         op_alu
+#define OP_SBC_S_IMM_VAL       op_alu
+#define OP_RSC_IMM_VAL         op_alu
+#define OP_RSC_S_IMM_VAL       op_alu
+#define OP_TST_IMM_VAL         op_alu
+#define OP_TEQ_IMM_VAL         op_alu
+#define OP_CMP_IMM_VAL         op_alu
+#define OP_CMN_IMM_VAL         op_alu
+#define OP_ORR_IMM_VAL         op_alu
+#define OP_ORR_S_IMM_VAL       op_alu
+#define OP_MOV_IMM_VAL         op_alu
+#define OP_MOV_S_IMM_VAL       op_alu
+#define OP_BIC_IMM_VAL         op_alu
+#define OP_BIC_S_IMM_VAL       op_alu
+#define OP_MVN_IMM_VAL         op_alu
+#define OP_MVN_S_IMM_VAL       op_alu
+
+#define OP_STR_M_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_IMM_OFF       op_ldr_str
+#define OP_LDR_M_IMM_OFF       op_ldr_str
+#define OP_STR_M_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_IMM_OFF      op_ldr_str
+#define OP_LDRB_M_IMM_OFF      op_ldr_str
+#define OP_STRB_M_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_IMM_OFF       op_ldr_str
+#define OP_LDR_P_IMM_OFF       op_ldr_str
+#define OP_STR_P_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_IMM_OFF      op_ldr_str
+#define OP_LDRB_P_IMM_OFF      op_ldr_str
+#define OP_STRB_P_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_M_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_LSL_IMM_OFF   op_ldr_str
+#define OP_STR_M_LSR_IMM_OFF   op_ldr_str
+#define OP_STR_M_ASR_IMM_OFF   op_ldr_str
+#define OP_STR_M_ROR_IMM_OFF   op_ldr_str
+#define OP_LDR_M_LSL_IMM_OFF   op_ldr_str
+#define OP_LDR_M_LSR_IMM_OFF   op_ldr_str
+#define OP_LDR_M_ASR_IMM_OFF   op_ldr_str
+#define OP_LDR_M_ROR_IMM_OFF   op_ldr_str
+#define OP_STR_M_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_M_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_M_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_M_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_LSL_IMM_OFF  op_ldr_str
+#define OP_STRB_M_LSR_IMM_OFF  op_ldr_str
+#define OP_STRB_M_ASR_IMM_OFF  op_ldr_str
+#define OP_STRB_M_ROR_IMM_OFF  op_ldr_str
+#define OP_LDRB_M_LSL_IMM_OFF  op_ldr_str
+#define OP_LDRB_M_LSR_IMM_OFF  op_ldr_str
+#define OP_LDRB_M_ASR_IMM_OFF  op_ldr_str
+#define OP_LDRB_M_ROR_IMM_OFF  op_ldr_str
+#define OP_STRB_M_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_LSL_IMM_OFF   op_ldr_str
+#define OP_STR_P_LSR_IMM_OFF   op_ldr_str
+#define OP_STR_P_ASR_IMM_OFF   op_ldr_str
+#define OP_STR_P_ROR_IMM_OFF   op_ldr_str
+#define OP_LDR_P_LSL_IMM_OFF   op_ldr_str
+#define OP_LDR_P_LSR_IMM_OFF   op_ldr_str
+#define OP_LDR_P_ASR_IMM_OFF   op_ldr_str
+#define OP_LDR_P_ROR_IMM_OFF   op_ldr_str
+#define OP_STR_P_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_LSL_IMM_OFF  op_ldr_str
+#define OP_STRB_P_LSR_IMM_OFF  op_ldr_str
+#define OP_STRB_P_ASR_IMM_OFF  op_ldr_str
+#define OP_STRB_P_ROR_IMM_OFF  op_ldr_str
+#define OP_LDRB_P_LSL_IMM_OFF  op_ldr_str
+#define OP_LDRB_P_LSR_IMM_OFF  op_ldr_str
+#define OP_LDRB_P_ASR_IMM_OFF  op_ldr_str
+#define OP_LDRB_P_ROR_IMM_OFF  op_ldr_str
+#define OP_STRB_P_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_ROR_IMM_OFF_PREIND op_ldr_str
+
+#define OP_STRH_POS_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRH_POS_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRSB_POS_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRSH_POS_INDE_M_REG_OFF op_ldrh_strh
+#define OP_STRH_POS_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRH_POS_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRSB_POS_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRSH_POS_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_STRH_POS_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRH_POS_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRSB_POS_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRSH_POS_INDE_P_REG_OFF op_ldrh_strh
+#define OP_STRH_POS_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRH_POS_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRSB_POS_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRSH_POS_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_STRH_M_REG_OFF      op_ldrh_strh
+#define OP_LDRH_M_REG_OFF      op_ldrh_strh
+#define OP_LDRSB_M_REG_OFF     op_ldrh_strh
+#define OP_LDRSH_M_REG_OFF     op_ldrh_strh
+#define OP_STRH_PRE_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRH_PRE_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRSB_PRE_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRSH_PRE_INDE_M_REG_OFF op_ldrh_strh
+#define OP_STRH_M_IMM_OFF      op_ldrh_strh
+#define OP_LDRH_M_IMM_OFF      op_ldrh_strh
+#define OP_LDRSB_M_IMM_OFF     op_ldrh_strh
+#define OP_LDRSH_M_IMM_OFF     op_ldrh_strh
+#define OP_STRH_PRE_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRH_PRE_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRSB_PRE_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRSH_PRE_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_STRH_P_REG_OFF      op_ldrh_strh
+#define OP_LDRH_P_REG_OFF      op_ldrh_strh
+#define OP_LDRSB_P_REG_OFF     op_ldrh_strh
+#define OP_LDRSH_P_REG_OFF     op_ldrh_strh
+#define OP_STRH_PRE_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRH_PRE_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRSB_PRE_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRSH_PRE_INDE_P_REG_OFF op_ldrh_strh
+#define OP_STRH_P_IMM_OFF      op_ldrh_strh
+#define OP_LDRH_P_IMM_OFF      op_ldrh_strh
+#define OP_LDRSB_P_IMM_OFF     op_ldrh_strh
+#define OP_LDRSH_P_IMM_OFF     op_ldrh_strh
+#define OP_STRH_PRE_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRH_PRE_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRSB_PRE_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRSH_PRE_INDE_P_IMM_OFF op_ldrh_strh
+
+//-----------------------------------------------------------------------------
+//   Unimplemented; fall back to the C versions
+//-----------------------------------------------------------------------------
+
+#define OP_MUL                 NULL
+#define OP_LDRD_STRD_POST_INDEX NULL
+#define OP_MUL_S               NULL
+#define OP_MLA                 NULL
+#define OP_UND                 NULL
+#define OP_MLA_S               NULL
+#define OP_UMULL               NULL
+#define OP_UMULL_S             NULL
+#define OP_UMLAL               NULL
+#define OP_UMLAL_S             NULL
+#define OP_SMULL               NULL
+#define OP_SMULL_S             NULL
+#define OP_SMLAL               NULL
+#define OP_SMLAL_S             NULL
+#define OP_MRS_CPSR            NULL
+#define OP_QADD                NULL
+#define OP_SMLA_B_B            NULL
+#define OP_SWP                 NULL
+#define OP_SMLA_T_B            NULL
+#define OP_SMLA_B_T            NULL
+#define OP_LDRD_STRD_OFFSET_PRE_INDEX NULL
+#define OP_SMLA_T_T            NULL
+#define OP_MSR_CPSR            NULL
+#define OP_QSUB                NULL
+#define OP_BKPT                NULL
+#define OP_SMLAW_B             NULL
+#define OP_SMULW_B             NULL
+#define OP_SMLAW_T             NULL
+#define OP_SMULW_T             NULL
+#define OP_MRS_SPSR            NULL
+#define OP_QDADD               NULL
+#define OP_SMLAL_B_B           NULL
+#define OP_SWPB                NULL
+#define OP_SMLAL_T_B           NULL
+#define OP_SMLAL_B_T           NULL
+#define OP_SMLAL_T_T           NULL
+#define OP_MSR_SPSR            NULL
+#define OP_QDSUB               NULL
+#define OP_SMUL_B_B            NULL
+#define OP_SMUL_T_B            NULL
+#define OP_SMUL_B_T            NULL
+#define OP_SMUL_T_T            NULL
+#define OP_STREX               NULL
+#define OP_LDREX               NULL
+#define OP_MSR_CPSR_IMM_VAL    NULL
+#define OP_MSR_SPSR_IMM_VAL    NULL
+#define OP_STMDA2              NULL
+#define OP_LDMDA2              NULL
+#define OP_STMDA2_W            NULL
+#define OP_LDMDA2_W            NULL
+#define OP_STMIA2              NULL
+#define OP_LDMIA2              NULL
+#define OP_STMIA2_W            NULL
+#define OP_LDMIA2_W            NULL
+#define OP_STMDB2              NULL
+#define OP_LDMDB2              NULL
+#define OP_STMDB2_W            NULL
+#define OP_LDMDB2_W            NULL
+#define OP_STMIB2              NULL
+#define OP_LDMIB2              NULL
+#define OP_STMIB2_W            NULL
+#define OP_LDMIB2_W            NULL
+#define OP_STC_OPTION          NULL
+#define OP_LDC_OPTION          NULL
+#define OP_STC_M_POSTIND       NULL
+#define OP_LDC_M_POSTIND       NULL
+#define OP_STC_P_POSTIND       NULL
+#define OP_LDC_P_POSTIND       NULL
+#define OP_STC_M_IMM_OFF       NULL
+#define OP_LDC_M_IMM_OFF       NULL
+#define OP_STC_M_PREIND        NULL
+#define OP_LDC_M_PREIND        NULL
+#define OP_STC_P_IMM_OFF       NULL
+#define OP_LDC_P_IMM_OFF       NULL
+#define OP_STC_P_PREIND        NULL
+#define OP_LDC_P_PREIND        NULL
+#define OP_CDP                 NULL
+#define OP_MCR                 NULL
+#define OP_MRC                 NULL
+#define OP_SWI                 NULL
+
+#define OP_MUL_REG             NULL
+#define OP_UND_THUMB           NULL
+#define OP_BKPT_THUMB          NULL
+#define OP_SWI_THUMB           NULL
+
+//-----------------------------------------------------------------------------
+//   Dispatch table
+//-----------------------------------------------------------------------------
+
+typedef int (*ArmOpCompiler)(u32);
+static const ArmOpCompiler arm_instruction_compilers[4096] = {
+#define TABDECL(x) x
+#include "instruction_tabdef.inc"
+#undef TABDECL
+};
+
+static const ArmOpCompiler thumb_instruction_compilers[1024] = {
+#define TABDECL(x) x
+#include "thumb_tabdef.inc"
+#undef TABDECL
+};
+
+//-----------------------------------------------------------------------------
+//   Generic instruction wrapper
+//-----------------------------------------------------------------------------
+
+template<int PROCNUM, int thumb>
+static u32 FASTCALL OP_DECODE()
+{
+	u32 cycles;
+	u32 adr = cpu->instruct_adr;
+	if(thumb)
+	{
+		cpu->next_instruction = adr + 2;
+		cpu->R[15] = adr + 4;
+		u32 opcode = _MMU_read16<PROCNUM, MMU_AT_CODE>(adr);
+		cycles = thumb_instructions_set[PROCNUM][opcode>>6](opcode);
+	}
+	else
+	{
+		cpu->next_instruction = adr + 4;
+		cpu->R[15] = adr + 8;
+		u32 opcode = _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+		if(CONDITION(opcode) == 0xE || TEST_COND(CONDITION(opcode), CODE(opcode), cpu->CPSR))
+			cycles = arm_instructions_set[PROCNUM][INSTRUCTION_INDEX(opcode)](opcode);
+		else
+			cycles = 1;
+	}
+	cpu->instruct_adr = cpu->next_instruction;
+	return cycles;
+}
+
+static const ArmOpCompiled op_decode[2][2] = { OP_DECODE<0,0>, OP_DECODE<0,1>, OP_DECODE<1,0>, OP_DECODE<1,1> };
+
+//-----------------------------------------------------------------------------
+//   Compiler
+//-----------------------------------------------------------------------------
+
+static u32 instr_attributes(u32 opcode)
+{
+	return bb_thumb ? thumb_attributes[opcode>>6]
+		 : instruction_attributes[INSTRUCTION_INDEX(opcode)];
+}
+
+static bool instr_is_branch(u32 opcode)
+{
+	u32 x = instr_attributes(opcode);
+
+	if(bb_thumb)
+	{
+		// merge OP_BL_10+OP_BL_11
+		if (x & MERGE_NEXT) return false;
+		return (x & BRANCH_ALWAYS)
+		    || ((x & BRANCH_POS0) && ((opcode&7) | ((opcode>>4)&8)) == 15)
+			|| (x & BRANCH_SWI)
+		    || (x & JIT_BYPASS);
+	}
+	else
+		return (x & BRANCH_ALWAYS)
+		    || ((x & BRANCH_POS12) && REG_POS(opcode,12) == 15)
+		    || ((x & BRANCH_LDM) && BIT15(opcode))
+			|| (x & BRANCH_SWI)
+		    || (x & JIT_BYPASS);
+}
+
+static bool instr_uses_r15(u32 opcode)
+{
+	u32 x = instr_attributes(opcode);
+	if(bb_thumb)
+		return ((x & SRCREG_POS0) && ((opcode&7) | ((opcode>>4)&8)) == 15)
+			|| ((x & SRCREG_POS3) && REG_POS(opcode,3) == 15)
+			|| (x & JIT_BYPASS);
+	else
+		return ((x & SRCREG_POS0) && REG_POS(opcode,0) == 15)
+		    || ((x & SRCREG_POS8) && REG_POS(opcode,8) == 15)
+		    || ((x & SRCREG_POS12) && REG_POS(opcode,12) == 15)
+		    || ((x & SRCREG_POS16) && REG_POS(opcode,16) == 15)
+		    || ((x & SRCREG_STM) && BIT15(opcode))
+		    || (x & JIT_BYPASS);
+}
+
+static bool instr_is_conditional(u32 opcode)
+{
+	if(bb_thumb) return false;
+
+	return !(CONDITION(opcode) == 0xE
+	         || (CONDITION(opcode) == 0xF && CODE(opcode) == 5));
+}
+
+static int instr_cycles(u32 opcode)
+{
+	u32 x = instr_attributes(opcode);
+	u32 c = (x & INSTR_CYCLES_MASK);
+	if(c == INSTR_CYCLES_VARIABLE)
+	{
+		if ((x & BRANCH_SWI) && !cpu->swi_tab)
+			return 3;
+
+		return 0;
+	}
+	if(instr_is_branch(opcode) && !(instr_attributes(opcode) & (BRANCH_ALWAYS|BRANCH_LDM)))
+		c += 2;
+	return c;
+}
+
+static bool instr_does_prefetch(u32 opcode)
+{
+	u32 x = instr_attributes(opcode);
+	if(bb_thumb)
+		return thumb_instruction_compilers[opcode>>6]
+			   && (x & BRANCH_ALWAYS);
+	else
+		return instr_is_branch(opcode) && arm_instruction_compilers[INSTRUCTION_INDEX(opcode)]
+			   && ((x & BRANCH_ALWAYS) || (x & BRANCH_LDM));
+}
+
+
+// the next instruction of a block that doesn't end in a branch is stored by the block itself
+static void sync_r15(u32 opcode, bool force)
+{
+	if(instr_does_prefetch(opcode))
+	{
+		if(force)
+		{
+			a32_mov32(RTMP0, bb_next_instruction);
+			a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+		}
+	}
+	else
+	{
+		if(force || (instr_attributes(opcode) & JIT_BYPASS) || (instr_attributes(opcode) & BRANCH_SWI))
+		{
+			a32_mov32(RTMP0, bb_next_instruction);
+			a32_str_cpu(RTMP0, cpu_off(next_instruction));
+		}
+		if(instr_uses_r15(opcode))
+		{
+			r15_dirty = true;
+			r15_value = bb_r15;
+		}
+		if(instr_attributes(opcode) & JIT_BYPASS)
+		{
+			a32_mov32(RTMP0, bb_adr);
+			a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+		}
+	}
+}
+
+static void emit_armop_call(u32 opcode)
+{
+	ArmOpCompiler fc = bb_thumb?	thumb_instruction_compilers[opcode>>6]:
+									arm_instruction_compilers[INSTRUCTION_INDEX(opcode)];
+	if (fc && fc(opcode))
+		return;
+
+	// the interpreter may read and write any register
+	regs_flush();
+	a32_mov32(R0, opcode);
+	OpFunc f = bb_thumb ? thumb_instructions_set[PROCNUM][opcode>>6]
+	                     : arm_instructions_set[PROCNUM][INSTRUCTION_INDEX(opcode)];
+	a32_call((const void*)f);
+	regs_discard();
+}
+
+static void emit_prologue()
+{
+	emit(0xE92D4FF0);	// push {r4-r11, lr}
+	emit(0xE24DD004);	// sub sp, sp, #4, to keep sp 8 byte aligned
+}
+
+static void emit_epilogue()
+{
+	emit(0xE28DD004);	// add sp, sp, #4
+	emit(0xE8BD8FF0);	// pop {r4-r11, pc}
+}
+
+// with the block's cycles in R0: jump straight on to the block at the next pc if the dispatcher
+// would only have called it. that goes through the block table rather than a patched branch, so
+// an invalidated block is never entered again and a return (bx lr, pop {pc}) is followed exactly.
+static void emit_chain()
+{
+	a32_mov32(RTMP0, (u32)(uintptr_t)&arm_jit_chain);
+	emit(0xE5900000 | (RTMP0 << 16) | (R1 << 12));	// ldr r1, [r12]		budget
+	emit(0xE5900004 | (RTMP0 << 16) | (R2 << 12));	// ldr r2, [r12, #4]	cycles
+	a32_dp(ALU_ADD, 0, R2, R2, a32_reg(R0));
+	a32_dp(ALU_CMP, 1, 0, R2, a32_reg(R1));
+	u32 *over_budget = a32_b(COND_GT);
+
+	// the loop doesn't run a cpu that is halted or waits for the bus
+	a32_ldr_cpu(R3, cpu_off(waitIRQ));
+	a32_dp(ALU_CMP, 1, 0, R3, OP2_IMM | 0);
+	u32 *halted = a32_b(COND_NE);
+	a32_mov32(R3, (u32)(uintptr_t)&nds.freezeBus);
+	emit(0xE5900000 | (R3 << 16) | (R3 << 12));		// ldr r3, [r3]
+	a32_dp(ALU_CMP, 1, 0, R3, OP2_IMM | 0);
+	u32 *frozen = a32_b(COND_NE);
+
+	// the pc as the dispatcher aligns it: ~3 in arm mode, ~1 in thumb mode
+	a32_ldr_cpu(R1, cpu_off(CPSR));
+	a32_dp(ALU_AND, 0, R1, R1, OP2_IMM | 0x20);
+	a32_dp(ALU_MVN, 0, R3, 0, OP2_IMM | 3);
+	a32_dp(ALU_ADD, 0, R3, R3, a32_reg(R1, SH_LSR, 4));
+	a32_ldr_cpu(R1, cpu_off(instruct_adr));
+	a32_dp(ALU_AND, 0, R1, R1, a32_reg(R3));
+	a32_str_cpu(R1, cpu_off(instruct_adr));
+
+	// JIT_COMPILED_FUNC: bits 14-26 pick the page, bits 1-13 the entry
+	a32_dp(ALU_MOV, 0, RTMP1, 0, a32_reg(R1, SH_LSL, 5));
+	a32_dp(ALU_MOV, 0, RTMP1, 0, a32_reg(RTMP1, SH_LSR, JIT_PAGE_BITS + 6));
+	a32_dp(ALU_MOV, 0, R1, 0, a32_reg(R1, SH_LSL, 31 - JIT_PAGE_BITS));
+	a32_dp(ALU_MOV, 0, R1, 0, a32_reg(R1, SH_LSR, 32 - JIT_PAGE_BITS));
+	a32_mov32(R3, (u32)(uintptr_t)compiled_funcs);
+	emit(0xE7900100 | (R3 << 16) | (R3 << 12) | RTMP1);	// ldr r3, [r3, lr, lsl #2]
+	emit(0xE7900100 | (R3 << 16) | (R3 << 12) | R1);	// ldr r3, [r3, r1, lsl #2]
+	a32_dp(ALU_CMP, 1, 0, R3, OP2_IMM | 0);
+	u32 *missing = a32_b(COND_EQ);
+
+	emit(0xE5800004 | (RTMP0 << 16) | (R2 << 12));	// str r2, [r12, #4]
+	emit(0xE28DD004);	// add sp, sp, #4
+	emit(0xE8BD4FF0);	// pop {r4-r11, lr}
+	emit(0xE12FFF10 | R3);	// bx r3
+
+	a32_bind(over_budget);
+	a32_bind(halted);
+	a32_bind(frozen);
+	a32_bind(missing);
+}
+
+static bool init_code_buffer()
+{
+	if(code_buffer)
+		return true;
+	const uintptr_t size = (uintptr_t)CommonSettings.jit_cache_size << 20;
+	void *p = mmap(NULL, size, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+	{
+		fprintf(stderr, "JIT: mmap failed: %s\n", strerror(errno));
+		return false;
+	}
+	code_buffer = (u32*)p;
+	code_size = size;
+	u8 *end;
+	code_ptr = (u32*)arm_jit_code_reset((u8*)code_buffer, code_size, &end);
+	code_end = (u32*)end;
+	return true;
+}
+
+// runs the block as it is compiled, unless interpret is false, which is how the profile compiles ahead
+template<int PROCNUM>
+static u32 compile_basicblock(u32 start_adr, bool thumb, bool interpret)
+{
+	u32 interpreted_cycles = 0;
+	u32 opcode = 0;
+
+	bb_thumb = thumb;
+	bb_opcodesize = bb_thumb ? 2 : 4;
+
+	if (!JIT_MAPPED(start_adr & 0x0FFFFFFF, PROCNUM))
+	{
+		CORELOG_INFO("JIT: use unmapped memory address %08X\n", start_adr);
+		execute = false;
+		return 1;
+	}
+
+	if(!init_code_buffer())
+	{
+		if(!interpret)
+			return 0;
+		ArmOpCompiled f = op_decode[PROCNUM][bb_thumb];
+		JIT_INSTALL_FUNC(start_adr, PROCNUM, f);
+		return f();
+	}
+	if((uintptr_t)(code_end - code_ptr) < (CommonSettings.jit_max_block_size + 1) * MAX_OP_WORDS)
+	{
+		// compiling ahead only fills segments that were never used, it doesn't push out what the game runs
+		u8 *end;
+		u8 *next = arm_jit_code_next_segment(&end, interpret);
+		if(!next)
+			return 0;
+		code_ptr = (u32*)next;
+		code_end = (u32*)end;
+	}
+
+	u32 *block = code_ptr;
+	emit_prologue();
+	a32_mov32(RCPU, (u32)(uintptr_t)&ARMPROC);
+	a32_mov32(RCYC, 0);
+	regs_reset();
+
+	// look ahead for the flag updates that are overwritten before anything reads them
+	u32 scanned = 0;
+	for(bool end = false; !end && scanned < BB_SCAN_OPS; scanned++)
+	{
+		u32 adr = start_adr + (scanned * bb_opcodesize);
+		bb_ops[scanned] = bb_thumb ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+		end = instr_is_branch(bb_ops[scanned]) || (scanned >= (CommonSettings.jit_max_block_size - 1))
+			|| arm_jit_break_after(PROCNUM, adr, bb_opcodesize);
+	}
+	instr_dead_flags(bb_ops, scanned, bb_thumb, bb_ops_flags_unused);
+
+	bb_constant_cycles = 0;
+	for(u32 i=0, bEndBlock = 0; bEndBlock == 0; i++)
+	{
+		bb_adr = start_adr + (i * bb_opcodesize);
+		if(bb_thumb)
+			opcode = _MMU_read16<PROCNUM, MMU_AT_CODE>(bb_adr);
+		else
+			opcode = _MMU_read32<PROCNUM, MMU_AT_CODE>(bb_adr);
+		bb_flags_unused = i < scanned && bb_ops_flags_unused[i];
+
+		u32 cycles = instr_cycles(opcode);
+
+		// a breakpoint on the next op has to be where a block starts, see arm_jit_set_breakpoint
+		bEndBlock = instr_is_branch(opcode) || (i >= (CommonSettings.jit_max_block_size - 1))
+			|| arm_jit_break_after(PROCNUM, bb_adr, bb_opcodesize);
+
+		bb_constant_cycles += instr_is_conditional(opcode) ? 1 : cycles;
+
+		if(instr_is_conditional(opcode))
+		{
+			// both paths have to agree on which guest registers are cached where, so the
+			// skipped path must not see anything the op loaded or wrote
+			if(bEndBlock) sync_r15(opcode, true);
+			regs_flush();
+			int cached[CACHE_SLOTS];
+			memcpy(cached, slot_reg, sizeof(cached));
+			u32 *skip = emit_branch_unless(CONDITION(opcode));
+			if(!bEndBlock) sync_r15(opcode, false);
+			emit_armop_call(opcode);
+
+			if(cycles == 0)
+			{
+				a32_dp(ALU_ADD, 0, RCYC, RCYC, a32_reg(R0));
+				a32_alu_imm(ALU_SUB, RCYC, RCYC, 1);
+			}
+			else
+				if (cycles > 1)
+					a32_alu_imm(ALU_SUB, RCYC, RCYC, 1);
+
+			regs_flush();
+			for(int s = 0; s < CACHE_SLOTS; s++)
+				if(slot_reg[s] != cached[s] && slot_reg[s] >= 0)
+					slot_free(s);
+			a32_bind(skip);
+		}
+		else
+		{
+			sync_r15(opcode, false);
+			emit_armop_call(opcode);
+			if(cycles == 0)
+				a32_dp(ALU_ADD, 0, RCYC, RCYC, a32_reg(R0));
+		}
+		if(interpret)
+			interpreted_cycles += op_decode[PROCNUM][bb_thumb]();
+	}
+
+	// nothing after the block reads R15 from cpu->R[]
+	r15_dirty = false;
+	regs_flush();
+
+	if(!instr_is_branch(opcode))
+	{
+		a32_mov32(RTMP0, bb_next_instruction);
+		a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+	}
+	else if(!instr_does_prefetch(opcode))
+	{
+		a32_ldr_cpu(RTMP0, cpu_off(next_instruction));
+		a32_str_cpu(RTMP0, cpu_off(instruct_adr));
+	}
+
+	a32_add_const(R0, RCYC, bb_constant_cycles);
+	emit_chain();
+	emit_epilogue();
+
+	__builtin___clear_cache((char*)block, (char*)code_ptr);
+
+	JIT_INSTALL_FUNC(start_adr, PROCNUM, block);
+	arm_jit_code_block(start_adr);
+	arm_jit_profile_record(PROCNUM, start_adr, bb_thumb, (bb_adr - start_adr) / bb_opcodesize + 1);
+	return interpreted_cycles;
+}
+
+template<int PROCNUM> u32 arm_jit_compile()
+{
+	*PROCNUM_ptr = PROCNUM;
+
+	// prevent endless recompilation of self-modifying code, which would keep pushing everything else out of the code cache.
+	u32 adr = cpu->instruct_adr;
+	u8 &count = JIT_RECOMPILE_COUNT(adr);
+	u32 shift = 4*((adr >> 4) & 1);
+	if(((count >> shift) & 0xF) > 8)
+	{
+		ArmOpCompiled f = op_decode[PROCNUM][cpu->CPSR.bits.T];
+		JIT_INSTALL_FUNC(adr, PROCNUM, f);
+		return f();
+	}
+	count += 1 << shift;
+
+	return compile_basicblock<PROCNUM>(adr, cpu->CPSR.bits.T, true);
+}
+
+template u32 arm_jit_compile<0>();
+template u32 arm_jit_compile<1>();
+
+template<int PROCNUM> bool arm_jit_precompile(u32 adr, bool thumb)
+{
+	if(arm_jit_breakpoint_count && arm_jit_breakpoint_at(PROCNUM, adr))
+		return true;
+	*PROCNUM_ptr = PROCNUM;
+	compile_basicblock<PROCNUM>(adr, thumb, false);
+	return JIT_COMPILED_FUNC(adr, PROCNUM) != 0;
+}
+
+template bool arm_jit_precompile<0>(u32 adr, bool thumb);
+template bool arm_jit_precompile<1>(u32 adr, bool thumb);
+
+void arm_jit_reset(bool enable, bool suppress_msg)
+{
+	if (!suppress_msg)
+		CORELOG_INFO("CPU mode: %s\n", enable?"JIT":"Interpreter");
+	saveBlockSizeJIT = CommonSettings.jit_max_block_size;
+
+	// the interpreter keeps the opcodes it fetched in the same pages
+	arm_jit_free_pages();
+
+	if (enable)
+	{
+		CORELOG_INFO("JIT: max block size %d instruction(s)\n", CommonSettings.jit_max_block_size);
+
+		// every block is gone from compiled_funcs[] now, so the code can be overwritten,
+		// or unmapped if the cache size was changed; init_code_buffer maps it again
+		if(code_buffer && code_size != ((uintptr_t)CommonSettings.jit_cache_size << 20))
+		{
+			munmap(code_buffer, code_size);
+			code_buffer = NULL;
+		}
+		if(code_buffer)
+		{
+			u8 *end;
+			code_ptr = (u32*)arm_jit_code_reset((u8*)code_buffer, code_size, &end);
+			code_end = (u32*)end;
+		}
+	}
+}
+
+void arm_jit_close()
+{
+	// the code buffer is kept for the next game
+}
+#endif // HAVE_JIT
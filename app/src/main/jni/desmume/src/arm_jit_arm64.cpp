@@ -0,0 +1,3336 @@
+/*	Copyright (C) 2006 yopyop
+	Copyright (C) 2011 Loren Merritt
+	Copyright (C) 2012-2015 DeSmuME team
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// AArch64 backend of the dynamic recompiler. The block frontend (compile_basicblock, the
+// compiled_funcs[] block cache, the recompile guard and the cycle accounting) mirrors
+// arm_jit.cpp, which stays the x86 backend; only the code emission differs. Ops without a
+// compiler here run through the interpreter from inside the block, as on x86.
+
+#include "types.h"
+
+#ifdef HAVE_JIT
+#if !defined(__aarch64__)
+#error "ERROR: JIT compiler - unsupported target platform"
+#endif
+
+#include <sys/mman.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stddef.h>
+
+#include "armcpu.h"
+#include "instructions.h"
+#include "instruction_attributes.h"
+#include "MMU.h"
+#include "MMU_timing.h"
+#include "NDSSystem.h"
+#include "arm_jit.h"
+#include "bios.h"
+#include "utils/task.h"
+#include "armtrace.h"
+
+u32 saveBlockSizeJIT = 0;
+
+// blocks are appended to one RWX mapping of CommonSettings.jit_cache_size MB, which is recycled as a
+// whole (like the x86 scratchpad) when it runs out. the default 32MB is several times what a game
+// compiles between two resets.
+// upper bound of the words emitted for one guest instruction, conditional LDM with R15 being the worst
+#define MAX_OP_WORDS		128
+
+static u32 *code_buffer = NULL;
+static uintptr_t code_size = 0;
+static u32 *code_end;
+static u32 *code_ptr;
+
+static int PROCNUM;
+static int *PROCNUM_ptr = &PROCNUM;
+static int bb_opcodesize;
+static int bb_adr;
+static bool bb_thumb;
+static u32 bb_constant_cycles;
+
+// the ops of the block as far as it is scanned ahead, where they are, what the trace does at them
+// (see trace_step) and which of them set flags nothing reads
+#define BB_SCAN_OPS 128
+static u32 bb_ops[BB_SCAN_OPS];
+static u32 bb_ops_adr[BB_SCAN_OPS];
+static u32 bb_ops_dst[BB_SCAN_OPS];
+static int bb_ops_step[BB_SCAN_OPS];
+static bool bb_ops_flags_unused[BB_SCAN_OPS];
+static bool bb_flags_unused;	// for the op being compiled
+
+#define cpu (&ARMPROC)
+#define bb_next_instruction (bb_adr + bb_opcodesize)
+#define bb_r15				(bb_adr + 2 * bb_opcodesize)
+
+#define cpu_off(x)			((u32)offsetof(armcpu_t, x))
+#define reg_off(x)			((u32)offsetof(armcpu_t, R) + 4*(x))
+#define _REG_NUM(i, n)		((i>>(n))&0x7)
+
+//-----------------------------------------------------------------------------
+//   AArch64 emitter
+//-----------------------------------------------------------------------------
+// only the encodings the op compilers below need; guest values live in W registers.
+
+enum {
+	W0 = 0, W1 = 1, W2 = 2,
+	RTMP0 = 9, RTMP1 = 10, RTMP2 = 11,	// scratch within one op
+	RFLG = 12,		// host NZCV
+	RPSR = 13,		// guest CPSR while it is being updated
+	RCF = 14,		// shifter carry out
+	RPC = 15,		// guest R15, which is a constant within a block
+	RIP = 16,		// call target
+	RCPU = 19,		// &ARMPROC
+	RCYC = 20,		// cycles of the variable length ops so far
+	RCACHE = 21,	// x21-x28 hold cached guest registers
+	RZR = 31,
+};
+
+enum {
+	SH_LSL = 0, SH_LSR = 1, SH_ASR = 2, SH_ROR = 3,	// same encoding in the ARM and A64 shifters
+};
+
+enum {
+	CC_EQ = 0, CC_NE, CC_HS, CC_LO, CC_MI, CC_PL, CC_VS, CC_VC,	// same encoding as the ARM conditions
+	CC_HI, CC_LS, CC_GE, CC_LT, CC_GT, CC_LE, CC_AL,
+};
+
+// register forms; the immediate forms are derived from these
+enum {
+	A64_AND = 0x0A000000, A64_BIC = 0x0A200000, A64_ORR = 0x2A000000, A64_ORN = 0x2A200000,
+	A64_EOR = 0x4A000000, A64_ANDS = 0x6A000000, A64_BICS = 0x6A200000,
+	A64_ADD = 0x0B000000, A64_ADDS = 0x2B000000, A64_SUB = 0x4B000000, A64_SUBS = 0x6B000000,
+	A64_ADC = 0x1A000000, A64_ADCS = 0x3A000000, A64_SBC = 0x5A000000, A64_SBCS = 0x7A000000,
+	A64_LSLV = 0x1AC02000, A64_LSRV = 0x1AC02400, A64_ASRV = 0x1AC02800, A64_RORV = 0x1AC02C00,
+};
+
+#define ADDSUB_IMM(op)	(((op) & 0x60000000) | 0x11000000)
+#define LOGIC_IMM(op)	(((op) & 0x60000000) | 0x12000000)
+
+static FORCEINLINE void emit(u32 insn) { *code_ptr++ = insn; }
+
+static void a64_alu_reg(u32 op, int rd, int rn, int rm, u32 shift = SH_LSL, u32 amount = 0)
+{
+	emit(op | (shift << 22) | (rm << 16) | (amount << 10) | (rn << 5) | rd);
+}
+
+static void a64_mov(int rd, int rm) { a64_alu_reg(A64_ORR, rd, RZR, rm); }
+
+static void a64_mov32(int rd, u32 imm)
+{
+	if((imm & 0xFFFF0000) == 0)
+		emit(0x52800000 | (imm << 5) | rd);
+	else if((imm & 0x0000FFFF) == 0)
+		emit(0x52A00000 | ((imm >> 16) << 5) | rd);
+	else if((~imm & 0xFFFF0000) == 0)
+		emit(0x12800000 | ((~imm & 0xFFFF) << 5) | rd);
+	else if((~imm & 0x0000FFFF) == 0)
+		emit(0x12A00000 | ((~imm >> 16) << 5) | rd);
+	else
+	{
+		emit(0x52800000 | ((imm & 0xFFFF) << 5) | rd);
+		emit(0x72A00000 | ((imm >> 16) << 5) | rd);
+	}
+}
+
+static void a64_mov64(int rd, u64 imm)
+{
+	bool first = true;
+	for(int hw = 0; hw < 4; hw++)
+	{
+		u32 part = (imm >> (16*hw)) & 0xFFFF;
+		if(part == 0 && !(first && hw == 3))
+			continue;
+		emit((first ? 0xD2800000 : 0xF2800000) | (hw << 21) | (part << 5) | rd);
+		first = false;
+	}
+}
+
+// ADD/SUB(S) with a 12 bit immediate, optionally shifted by 12. returns false when imm doesn't fit
+static bool a64_addsub_imm(u32 op, int rd, int rn, u32 imm)
+{
+	if(imm < 0x1000)
+		emit(ADDSUB_IMM(op) | (imm << 10) | (rn << 5) | rd);
+	else if((imm & 0xFF000FFF) == 0)
+		emit(ADDSUB_IMM(op) | (1 << 22) | ((imm >> 12) << 10) | (rn << 5) | rd);
+	else
+		return false;
+	return true;
+}
+
+static void a64_add_const(int rd, int rn, u32 imm)
+{
+	if(!a64_addsub_imm(A64_ADD, rd, rn, imm))
+	{
+		a64_mov32(RIP, imm);
+		a64_alu_reg(A64_ADD, rd, rn, RIP);
+	}
+}
+
+// the N:immr:imms fields for a logical immediate, or false if imm isn't a rotated run of ones
+static bool a64_logical_imm(u32 imm, u32 *enc)
+{
+	if(imm == 0 || imm == 0xFFFFFFFF)
+		return false;
+
+	u32 size = 32;
+	while(size > 2)
+	{
+		u32 half = size / 2;
+		u32 mask = (1 << half) - 1;
+		if((imm & mask) != ((imm >> half) & mask))
+			break;
+		size = half;
+	}
+
+	u32 mask = size == 32 ? 0xFFFFFFFF : (1 << size) - 1;
+	u32 elt = imm & mask;
+	u32 ones = __builtin_popcount(elt);
+	u32 run = (1 << ones) - 1;
+	for(u32 r = 0; r < size; r++)
+	{
+		u32 rot = r ? (((run >> r) | (run << (size - r))) & mask) : run;
+		if(rot == elt)
+		{
+			*enc = (r << 16) | (((((~(size - 1)) << 1) & 0x3F) | (ones - 1)) << 10);
+			return true;
+		}
+	}
+	return false;
+}
+
+// AND/ORR/EOR/ANDS with an immediate; falls back to RIP
+static void a64_logic_imm(u32 op, int rd, int rn, u32 imm)
+{
+	u32 enc;
+	if(a64_logical_imm(imm, &enc))
+		emit(LOGIC_IMM(op) | enc | (rn << 5) | rd);
+	else
+	{
+		a64_mov32(RIP, imm);
+		a64_alu_reg(op, rd, rn, RIP);
+	}
+}
+
+static void a64_ubfm(int rd, int rn, u32 immr, u32 imms) { emit(0x53000000 | (immr << 16) | (imms << 10) | (rn << 5) | rd); }
+static void a64_sbfm(int rd, int rn, u32 immr, u32 imms) { emit(0x13000000 | (immr << 16) | (imms << 10) | (rn << 5) | rd); }
+static void a64_bfm(int rd, int rn, u32 immr, u32 imms) { emit(0x33000000 | (immr << 16) | (imms << 10) | (rn << 5) | rd); }
+static void a64_extr(int rd, int rn, int rm, u32 lsb) { emit(0x13800000 | (rm << 16) | (lsb << 10) | (rn << 5) | rd); }
+
+static void a64_ubfx(int rd, int rn, u32 lsb, u32 width) { a64_ubfm(rd, rn, lsb, lsb + width - 1); }
+static void a64_bfi(int rd, int rn, u32 lsb, u32 width) { a64_bfm(rd, rn, (32 - lsb) & 31, width - 1); }
+
+// rd = rn <type> amount, for amount 1..31
+static void a64_shift_imm(int rd, int rn, u32 type, u32 amount)
+{
+	switch(type)
+	{
+		case SH_LSL: a64_ubfm(rd, rn, (32 - amount) & 31, 31 - amount); break;
+		case SH_LSR: a64_ubfm(rd, rn, amount, 31); break;
+		case SH_ASR: a64_sbfm(rd, rn, amount, 31); break;
+		case SH_ROR: a64_extr(rd, rn, rn, amount); break;
+	}
+}
+
+static void a64_csel(int rd, int rn, int rm, int cond) { emit(0x1A800000 | (rm << 16) | (cond << 12) | (rn << 5) | rd); }
+static void a64_cmp_imm(int rn, u32 imm) { a64_addsub_imm(A64_SUBS, RZR, rn, imm); }
+
+static void a64_ldr_cpu(int rt, u32 off) { emit(0xB9400000 | ((off >> 2) << 10) | (RCPU << 5) | rt); }
+static void a64_str_cpu(int rt, u32 off) { emit(0xB9000000 | ((off >> 2) << 10) | (RCPU << 5) | rt); }
+
+// loads and stores at Xn + Wm (zero extended), optionally scaled by the size
+enum {
+	A64_LDR_R = 0xB8604800, A64_LDRH_R = 0x78604800, A64_LDRSH_R = 0x78E04800,
+	A64_LDRB_R = 0x38604800, A64_LDRSB_R = 0x38E04800,
+	A64_STR_R = 0xB8204800, A64_STRH_R = 0x78204800, A64_STRB_R = 0x38204800,
+	A64_SCALED = 0x1000,
+};
+static void a64_mem_reg(u32 op, int rt, int xn, int wm) { emit(op | (wm << 16) | (xn << 5) | rt); }
+static void a64_ldr(int rt, int xn) { emit(0xB9400000 | (xn << 5) | rt); }
+static void a64_ldrb(int rt, int xn) { emit(0x39400000 | (xn << 5) | rt); }
+
+static void a64_mrs_nzcv(int rt) { emit(0xD53B4200 | rt); }
+static void a64_msr_nzcv(int rt) { emit(0xD51B4200 | rt); }
+
+// forward branches, patched by a64_bind
+static u32 *a64_b() { u32 *at = code_ptr; emit(0x14000000); return at; }
+static u32 *a64_bcond(int cond) { u32 *at = code_ptr; emit(0x54000000 | cond); return at; }
+static u32 *a64_cbz(int rt, bool x = false) { u32 *at = code_ptr; emit(0x34000000 | ((u32)x << 31) | rt); return at; }
+static u32 *a64_cbnz(int rt) { u32 *at = code_ptr; emit(0x35000000 | rt); return at; }
+
+static void a64_bind(u32 *at)
+{
+	s32 off = (s32)(code_ptr - at);
+	if((*at & 0xFC000000) == 0x14000000)
+		*at |= off & 0x03FFFFFF;
+	else
+		*at |= (off & 0x7FFFF) << 5;
+}
+
+static void a64_call(const void *fn)
+{
+	intptr_t off = ((intptr_t)fn - (intptr_t)code_ptr) >> 2;
+	if(off >= -(1 << 25) && off < (1 << 25))
+		emit(0x94000000 | (off & 0x03FFFFFF));
+	else
+	{
+		a64_mov64(RIP, (uintptr_t)fn);
+		emit(0xD63F0000 | (RIP << 5));
+	}
+}
+
+//-----------------------------------------------------------------------------
+//   Register cache
+//-----------------------------------------------------------------------------
+// guest R0-R14 are loaded into x21-x28 on first use and stay there until evicted (least
+// recently used first), flushed before anything that reads cpu->R[] behind our back and
+// forgotten after anything that writes it. R15 is never cached, it is a constant, and
+// sync_r15 only notes that it is due in cpu->R[] for the next flush that includes it.
+// an op reads all of its sources before it asks for its destination, and uses fewer
+// registers than there are slots, so a register it uses is never evicted under it.
+
+#define CACHE_SLOTS 8
+
+static int slot_reg[CACHE_SLOTS];		// guest register held by the slot, or -1
+static bool slot_dirty[CACHE_SLOTS];
+static u32 slot_used[CACHE_SLOTS];
+static int reg_slot[16];
+static u32 slot_stamp;
+static bool r15_dirty;
+static u32 r15_value;
+
+// the guest registers whose value is known while compiling, from the constants the block put in them (immediates,
+// literals, adr) and what was worked out from those. the code still computes them; this only lets an address made
+// from them be compiled as the address it is. forgotten with the register by reg_write and regs_discard.
+static u32 known_mask;
+static u32 known_value[16];
+
+static bool reg_known(u32 r, u32 *value)
+{
+	if(r == 15)
+	{
+		*value = bb_r15;
+		return true;
+	}
+	if(!(known_mask & (1 << r)))
+		return false;
+	*value = known_value[r];
+	return true;
+}
+
+// after the register was written with value
+static void reg_set_known(u32 r, u32 value)
+{
+	known_mask |= 1 << r;
+	known_value[r] = value;
+}
+
+static void regs_reset()
+{
+	for(int s = 0; s < CACHE_SLOTS; s++)
+	{
+		slot_reg[s] = -1;
+		slot_dirty[s] = false;
+		slot_used[s] = 0;
+	}
+	for(int r = 0; r < 16; r++)
+		reg_slot[r] = -1;
+	slot_stamp = 0;
+	r15_dirty = false;
+	known_mask = 0;
+}
+
+static void slot_store(int s)
+{
+	if(!slot_dirty[s]) return;
+	a64_str_cpu(RCACHE + s, reg_off(slot_reg[s]));
+	slot_dirty[s] = false;
+}
+
+static void slot_free(int s)
+{
+	reg_slot[slot_reg[s]] = -1;
+	slot_reg[s] = -1;
+	slot_dirty[s] = false;
+}
+
+static int reg_alloc(u32 r, bool load)
+{
+	int s = reg_slot[r];
+	if(s < 0)
+	{
+		s = 0;
+		for(int j = 0; j < CACHE_SLOTS; j++)
+		{
+			if(slot_reg[j] < 0) { s = j; break; }
+			if(slot_used[j] < slot_used[s]) s = j;
+		}
+		if(slot_reg[s] >= 0)
+		{
+			slot_store(s);
+			slot_free(s);
+		}
+		slot_reg[s] = r;
+		reg_slot[r] = s;
+		if(load)
+			a64_ldr_cpu(RCACHE + s, reg_off(r));
+	}
+	slot_used[s] = ++slot_stamp;
+	return s;
+}
+
+// host register holding the guest register
+static int reg_read(u32 r)
+{
+	if(r == 15)
+	{
+		a64_mov32(RPC, bb_r15);
+		return RPC;
+	}
+	return RCACHE + reg_alloc(r, true);
+}
+
+// host register to write the guest register to. never R15
+static int reg_write(u32 r)
+{
+	int s = reg_alloc(r, false);
+	slot_dirty[s] = true;
+	known_mask &= ~(1 << r);
+	return RCACHE + s;
+}
+
+static void regs_flush(u32 mask = 0xFFFF)
+{
+	for(int s = 0; s < CACHE_SLOTS; s++)
+		if(slot_reg[s] >= 0 && (mask & (1 << slot_reg[s])))
+			slot_store(s);
+	if(r15_dirty && (mask & (1 << 15)))
+	{
+		a64_mov32(RTMP0, r15_value);
+		a64_str_cpu(RTMP0, reg_off(15));
+		r15_dirty = false;
+	}
+}
+
+// drops the cached copies without writing them back, after cpu->R[] was written
+static void regs_discard(u32 mask = 0xFFFF)
+{
+	for(int s = 0; s < CACHE_SLOTS; s++)
+		if(slot_reg[s] >= 0 && (mask & (1 << slot_reg[s])))
+			slot_free(s);
+	if(mask & (1 << 15))
+		r15_dirty = false;
+	known_mask &= ~mask;
+}
+
+//-----------------------------------------------------------------------------
+//   Flags
+//-----------------------------------------------------------------------------
+// the guest flags live in cpu->CPSR; A64 NZCV has the same layout in bits 31-28.
+
+static void emit_set_nzcv()
+{
+	a64_mrs_nzcv(RFLG);
+	a64_ldr_cpu(RPSR, cpu_off(CPSR.val));
+	a64_logic_imm(A64_AND, RPSR, RPSR, 0x0FFFFFFF);
+	a64_alu_reg(A64_ORR, RPSR, RPSR, RFLG);
+	a64_str_cpu(RPSR, cpu_off(CPSR.val));
+}
+
+// N and Z from the host flags, C from the carry register unless it is -1
+static void emit_set_nz(int carry)
+{
+	a64_mrs_nzcv(RFLG);
+	a64_ldr_cpu(RPSR, cpu_off(CPSR.val));
+	a64_ubfx(RFLG, RFLG, 30, 2);
+	a64_bfi(RPSR, RFLG, 30, 2);
+	if(carry >= 0)
+		a64_bfi(RPSR, carry, 29, 1);
+	a64_str_cpu(RPSR, cpu_off(CPSR.val));
+}
+
+static void emit_load_nzcv()
+{
+	a64_ldr_cpu(RPSR, cpu_off(CPSR.val));
+	a64_logic_imm(A64_AND, RFLG, RPSR, 0xF0000000);
+	a64_msr_nzcv(RFLG);
+}
+
+// branches to the returned fixup when cond fails; NULL when it always holds
+static u32 *emit_branch_unless(u32 cond)
+{
+	if(cond == 0xE)
+		return NULL;
+	if(cond == 0xF)
+		return a64_b();
+	emit_load_nzcv();
+	return a64_bcond(cond ^ 1);
+}
+
+static void emit_MMU_aluMemCycles(int alu_cycles, int population)
+{
+	if(PROCNUM==ARMCPU_ARM9)
+	{
+		if(population < alu_cycles)
+		{
+			a64_mov32(RTMP0, alu_cycles);
+			a64_cmp_imm(W0, alu_cycles);
+			a64_csel(W0, RTMP0, W0, CC_LT);
+		}
+	}
+	else
+		a64_addsub_imm(A64_ADD, W0, W0, alu_cycles);
+}
+
+//-----------------------------------------------------------------------------
+//   Shifter operand
+//-----------------------------------------------------------------------------
+
+struct Shifter
+{
+	bool is_imm;
+	u32 imm;
+	int reg;		// host register, to be shifted by the consumer
+	u32 shift;
+	u32 amount;
+	int carry;		// host register with the shifter carry out, or -1 to leave C alone
+};
+
+static void shifter_imm(Shifter &op, u32 imm)
+{
+	op.is_imm = true;
+	op.imm = imm;
+	op.reg = RZR;
+	op.shift = SH_LSL;
+	op.amount = 0;
+	op.carry = -1;
+}
+
+static void shifter_reg(Shifter &op, int reg)
+{
+	op.is_imm = false;
+	op.imm = 0;
+	op.reg = reg;
+	op.shift = SH_LSL;
+	op.amount = 0;
+	op.carry = -1;
+}
+
+// Rm shifted by an immediate, with the ARM meaning of a zero amount
+static void shifter_shift_imm(Shifter &op, int rm, u32 type, u32 amount, bool want_carry)
+{
+	shifter_reg(op, rm);
+	op.shift = type;
+	op.amount = amount;
+
+	switch(type)
+	{
+		case SH_LSL:
+			if(want_carry && amount)
+			{
+				a64_ubfx(RCF, rm, 32 - amount, 1);
+				op.carry = RCF;
+			}
+			break;
+
+		case SH_LSR:
+		case SH_ASR:
+			if(want_carry)
+			{
+				a64_ubfx(RCF, rm, amount ? amount - 1 : 31, 1);
+				op.carry = RCF;
+			}
+			if(amount == 0)
+			{
+				if(type == SH_LSR)
+				{
+					// LSR #32
+					op.reg = RZR;
+					op.shift = SH_LSL;
+				}
+				else
+					op.amount = 31; // ASR #32
+			}
+			break;
+
+		case SH_ROR:
+			if(want_carry)
+			{
+				a64_ubfx(RCF, rm, amount ? amount - 1 : 0, 1);
+				op.carry = RCF;
+			}
+			if(amount == 0)
+			{
+				// RRX
+				a64_ldr_cpu(RPSR, cpu_off(CPSR.val));
+				a64_ubfx(RTMP2, RPSR, 29, 1);
+				a64_extr(RTMP0, RTMP2, rm, 1);
+				op.reg = RTMP0;
+				op.shift = SH_LSL;
+			}
+			break;
+	}
+}
+
+// Rm shifted by the bottom byte of Rs, without the carry out
+static void shifter_shift_reg(Shifter &op, int rm, int rs, u32 type)
+{
+	switch(type)
+	{
+		case SH_LSL:
+		case SH_LSR:
+			a64_logic_imm(A64_AND, RTMP1, rs, 0xFF);
+			a64_alu_reg(type == SH_LSL ? A64_LSLV : A64_LSRV, RTMP0, rm, RTMP1);
+			a64_cmp_imm(RTMP1, 32);
+			a64_csel(RTMP0, RZR, RTMP0, CC_HS);
+			break;
+
+		case SH_ASR:
+			a64_logic_imm(A64_AND, RTMP1, rs, 0xFF);
+			a64_mov32(RTMP2, 31);
+			a64_cmp_imm(RTMP1, 31);
+			a64_csel(RTMP1, RTMP1, RTMP2, CC_LS);
+			a64_alu_reg(A64_ASRV, RTMP0, rm, RTMP1);
+			break;
+
+		case SH_ROR:
+			a64_alu_reg(A64_RORV, RTMP0, rm, rs);
+			break;
+	}
+	shifter_reg(op, RTMP0);
+}
+
+// turns the operand into a plain register
+static void shifter_flatten(Shifter &op, int tmp)
+{
+	if(op.is_imm)
+	{
+		if(op.imm)
+		{
+			a64_mov32(tmp, op.imm);
+			op.reg = tmp;
+		}
+		op.is_imm = false;
+	}
+	else if(op.amount && op.reg != RZR)
+	{
+		a64_shift_imm(tmp, op.reg, op.shift, op.amount);
+		op.reg = tmp;
+	}
+	op.shift = SH_LSL;
+	op.amount = 0;
+}
+
+//-----------------------------------------------------------------------------
+//   Data processing
+//-----------------------------------------------------------------------------
+
+enum {
+	ALU_AND = 0, ALU_EOR, ALU_SUB, ALU_RSB, ALU_ADD, ALU_ADC, ALU_SBC, ALU_RSC,
+	ALU_TST, ALU_TEQ, ALU_CMP, ALU_CMN, ALU_ORR, ALU_MOV, ALU_BIC, ALU_MVN,
+};
+
+static void emit_logic(u32 op, int rd, int rn, Shifter &rhs)
+{
+	if(rhs.is_imm)
+	{
+		u32 imm = rhs.imm;
+		u32 base = op;
+		u32 enc;
+		if(op & 0x00200000)
+		{
+			// BIC/ORN/BICS take the inverted immediate
+			imm = ~imm;
+			base &= ~0x00200000;
+		}
+		if(a64_logical_imm(imm, &enc))
+		{
+			emit(LOGIC_IMM(base) | enc | (rn << 5) | rd);
+			return;
+		}
+		shifter_flatten(rhs, RTMP0);
+	}
+	a64_alu_reg(op, rd, rn, rhs.reg, rhs.shift, rhs.amount);
+}
+
+static void emit_addsub(u32 op, int rd, int rn, Shifter &rhs)
+{
+	if(rhs.is_imm && a64_addsub_imm(op, rd, rn, rhs.imm))
+		return;
+	if(rhs.is_imm || rhs.shift == SH_ROR)
+		shifter_flatten(rhs, RTMP0);
+	a64_alu_reg(op, rd, rn, rhs.reg, rhs.shift, rhs.amount);
+}
+
+// rd = rn <opc> rhs. rd is RZR for the compares, rn is ignored by MOV and MVN
+static void emit_alu(u32 opc, bool s, int rd, int rn, Shifter &rhs)
+{
+	switch(opc)
+	{
+		case ALU_AND: emit_logic(s ? A64_ANDS : A64_AND, rd, rn, rhs); break;
+		case ALU_EOR: emit_logic(A64_EOR, rd, rn, rhs); break;
+		case ALU_ORR: emit_logic(A64_ORR, rd, rn, rhs); break;
+		case ALU_BIC: emit_logic(s ? A64_BICS : A64_BIC, rd, rn, rhs); break;
+		case ALU_TST: emit_logic(A64_ANDS, RZR, rn, rhs); break;
+		case ALU_TEQ: rd = RTMP1; emit_logic(A64_EOR, rd, rn, rhs); break;
+
+		case ALU_MOV:
+			if(rhs.is_imm) a64_mov32(rd, rhs.imm);
+			else a64_alu_reg(A64_ORR, rd, RZR, rhs.reg, rhs.shift, rhs.amount);
+			break;
+		case ALU_MVN:
+			if(rhs.is_imm) a64_mov32(rd, ~rhs.imm);
+			else a64_alu_reg(A64_ORN, rd, RZR, rhs.reg, rhs.shift, rhs.amount);
+			break;
+
+		case ALU_ADD: emit_addsub(s ? A64_ADDS : A64_ADD, rd, rn, rhs); break;
+		case ALU_SUB: emit_addsub(s ? A64_SUBS : A64_SUB, rd, rn, rhs); break;
+		case ALU_CMP: emit_addsub(A64_SUBS, RZR, rn, rhs); break;
+		case ALU_CMN: emit_addsub(A64_ADDS, RZR, rn, rhs); break;
+		case ALU_RSB:
+			shifter_flatten(rhs, RTMP0);
+			a64_alu_reg(s ? A64_SUBS : A64_SUB, rd, rhs.reg, rn);
+			break;
+
+		// the ARM carry has the same sense as the A64 one for subtraction too
+		case ALU_ADC:
+			shifter_flatten(rhs, RTMP0);
+			emit_load_nzcv();
+			a64_alu_reg(s ? A64_ADCS : A64_ADC, rd, rn, rhs.reg);
+			break;
+		case ALU_SBC:
+			shifter_flatten(rhs, RTMP0);
+			emit_load_nzcv();
+			a64_alu_reg(s ? A64_SBCS : A64_SBC, rd, rn, rhs.reg);
+			break;
+		case ALU_RSC:
+			shifter_flatten(rhs, RTMP0);
+			emit_load_nzcv();
+			a64_alu_reg(s ? A64_SBCS : A64_SBC, rd, rhs.reg, rn);
+			break;
+	}
+
+	if(!s || bb_flags_unused)
+		return;
+
+	switch(opc)
+	{
+		case ALU_SUB: case ALU_RSB: case ALU_ADD: case ALU_ADC:
+		case ALU_SBC: case ALU_RSC: case ALU_CMP: case ALU_CMN:
+			emit_set_nzcv();
+			break;
+
+		case ALU_AND: case ALU_BIC: case ALU_TST:
+			emit_set_nz(rhs.carry);
+			break;
+
+		default:
+			a64_alu_reg(A64_ANDS, RZR, rd, rd);
+			emit_set_nz(rhs.carry);
+			break;
+	}
+}
+
+// what opc makes of a and b, for the ops the result of which only depends on them
+static bool alu_fold(u32 opc, u32 a, u32 b, u32 *r)
+{
+	switch(opc)
+	{
+		case ALU_AND: *r = a & b; return true;
+		case ALU_EOR: *r = a ^ b; return true;
+		case ALU_SUB: *r = a - b; return true;
+		case ALU_RSB: *r = b - a; return true;
+		case ALU_ADD: *r = a + b; return true;
+		case ALU_ORR: *r = a | b; return true;
+		case ALU_MOV: *r = b; return true;
+		case ALU_BIC: *r = a & ~b; return true;
+		case ALU_MVN: *r = ~b; return true;
+		default: return false;
+	}
+}
+
+static int op_alu(const u32 i)
+{
+	const u32 opc = (i >> 21) & 0xF;
+	const bool s = BIT20(i);
+	const bool writes_rd = opc < ALU_TST || opc > ALU_CMN;
+	const bool logic = opc == ALU_AND || opc == ALU_EOR || opc == ALU_TST || opc == ALU_TEQ
+	                || opc == ALU_ORR || opc == ALU_MOV || opc == ALU_BIC || opc == ALU_MVN;
+	const bool reg_shift = !BIT25(i) && BIT4(i);
+
+	if(i == 0xE1A00000)
+		return 1; // nop
+	// writes to R15 are branches, and may restore the CPSR
+	if(writes_rd && REG_POS(i,12) == 15)
+		return 0;
+	// R15 reads as +12 with register shifts, and their carry out isn't worth the code
+	if(reg_shift && (s || REG_POS(i,0) == 15 || REG_POS(i,8) == 15 || REG_POS(i,16) == 15))
+		return 0;
+
+	Shifter rhs;
+	if(BIT25(i))
+	{
+		u32 rot = (i >> 7) & 0x1E;
+		shifter_imm(rhs, rot ? ROR(i & 0xFF, rot) : (i & 0xFF));
+		if(s && logic && rot)
+		{
+			a64_mov32(RCF, BIT31(rhs.imm));
+			rhs.carry = RCF;
+		}
+	}
+	else if(reg_shift)
+	{
+		int rm = reg_read(REG_POS(i,0));
+		int rs = reg_read(REG_POS(i,8));
+		shifter_shift_reg(rhs, rm, rs, (i >> 5) & 3);
+	}
+	else
+		shifter_shift_imm(rhs, reg_read(REG_POS(i,0)), (i >> 5) & 3, (i >> 7) & 0x1F, s && logic);
+
+	// an immediate with a known rn (or none) gives a known rd, looked at before rd is written as rn may be rd
+	u32 a = 0, folded = 0;
+	const bool fold = writes_rd && BIT25(i) && (opc == ALU_MOV || opc == ALU_MVN || reg_known(REG_POS(i,16), &a))
+	                  && alu_fold(opc, a, rhs.imm, &folded);
+
+	int rn = (opc == ALU_MOV || opc == ALU_MVN) ? RZR : reg_read(REG_POS(i,16));
+	int rd = writes_rd ? reg_write(REG_POS(i,12)) : RZR;
+	emit_alu(opc, s, rd, rn, rhs);
+	if(fold)
+		reg_set_known(REG_POS(i,12), folded);
+	return 1;
+}
+
+static int OP_CLZ(const u32 i)
+{
+	if(REG_POS(i,12) == 15)
+		return 0;
+	int rm = reg_read(REG_POS(i,0));
+	emit(0x5AC01000 | (rm << 5) | reg_write(REG_POS(i,12)));
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+//   LDR / STR
+//-----------------------------------------------------------------------------
+// the accesses go through the same helpers (and so the same cycle counts) as the x86 backend,
+// except for the ones to main memory and the tcms, which are done inline when the address the
+// op had while it was compiled is in one of them (see emit_inline_access).
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDR(u32 adr, u32 *dstreg)
+{
+	u32 data = READ32(cpu->mem_if->data, adr);
+	if(adr&3)
+		data = ROR(data, 8*(adr&3));
+	*dstreg = data;
+	return MMU_aluMemAccessCycles<PROCNUM,32,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRH(u32 adr, u32 *dstreg)
+{
+	*dstreg = READ16(cpu->mem_if->data, adr);
+	return MMU_aluMemAccessCycles<PROCNUM,16,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRSH(u32 adr, u32 *dstreg)
+{
+	*dstreg = (s16)READ16(cpu->mem_if->data, adr);
+	return MMU_aluMemAccessCycles<PROCNUM,16,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRB(u32 adr, u32 *dstreg)
+{
+	*dstreg = READ8(cpu->mem_if->data, adr);
+	return MMU_aluMemAccessCycles<PROCNUM,8,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRSB(u32 adr, u32 *dstreg)
+{
+	*dstreg = (s8)READ8(cpu->mem_if->data, adr);
+	return MMU_aluMemAccessCycles<PROCNUM,8,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_STR(u32 adr, u32 data)
+{
+	WRITE32(cpu->mem_if->data, adr, data);
+	return MMU_aluMemAccessCycles<PROCNUM,32,MMU_AD_WRITE>(2,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_STRH(u32 adr, u32 data)
+{
+	WRITE16(cpu->mem_if->data, adr, data);
+	return MMU_aluMemAccessCycles<PROCNUM,16,MMU_AD_WRITE>(2,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_STRB(u32 adr, u32 data)
+{
+	WRITE8(cpu->mem_if->data, adr, data);
+	return MMU_aluMemAccessCycles<PROCNUM,8,MMU_AD_WRITE>(2,adr);
+}
+
+enum {
+	MEM_LDR, MEM_LDRH, MEM_LDRSH, MEM_LDRB, MEM_LDRSB, MEM_STR, MEM_STRH, MEM_STRB,
+};
+
+struct MemOp
+{
+	const void *fn[2];
+	u32 insn;		// the host access, at base + offset
+	u32 size;
+	bool load;
+};
+
+static const MemOp mem_ops[] = {
+	{ { (const void*)OP_LDR<0>, (const void*)OP_LDR<1> }, A64_LDR_R, 32, true },
+	{ { (const void*)OP_LDRH<0>, (const void*)OP_LDRH<1> }, A64_LDRH_R, 16, true },
+	{ { (const void*)OP_LDRSH<0>, (const void*)OP_LDRSH<1> }, A64_LDRSH_R, 16, true },
+	{ { (const void*)OP_LDRB<0>, (const void*)OP_LDRB<1> }, A64_LDRB_R, 8, true },
+	{ { (const void*)OP_LDRSB<0>, (const void*)OP_LDRSB<1> }, A64_LDRSB_R, 8, true },
+	{ { (const void*)OP_STR<0>, (const void*)OP_STR<1> }, A64_STR_R, 32, false },
+	{ { (const void*)OP_STRH<0>, (const void*)OP_STRH<1> }, A64_STRH_R, 16, false },
+	{ { (const void*)OP_STRB<0>, (const void*)OP_STRB<1> }, A64_STRB_R, 8, false },
+};
+
+// the words the block has compiled in, see literal_resolve
+#define BB_LITERALS 8
+static u32 bb_literal_count;
+static u32 bb_literal_adr[BB_LITERALS];
+static u32 bb_literal_value[BB_LITERALS];
+
+// the inline accesses skip what READ32 and co do besides the access itself: the gdb stub's memory
+// interface, lua's memory hooks and the debug events
+#if !defined(GDB_STUB) && !defined(HAVE_LUA) && !defined(DEVELOPER)
+#define INLINE_MEM_ACCESS
+#endif
+
+#ifdef INLINE_MEM_ACCESS
+// the accesses to an i/o register at an address known while compiling go straight to the handler of the cpu's
+// registers, past the checks for the other regions that READ32 and co make first
+template<int PROCNUM>
+static u32 FASTCALL OP_LDR_IO(u32 adr, u32 *dstreg)
+{
+	u32 data = PROCNUM == ARMCPU_ARM9 ? _MMU_ARM9_read32(adr & 0xFFFFFFFC) : _MMU_ARM7_read32(adr & 0xFFFFFFFC);
+	if(adr&3)
+		data = ROR(data, 8*(adr&3));
+	*dstreg = data;
+	return MMU_aluMemAccessCycles<PROCNUM,32,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRH_IO(u32 adr, u32 *dstreg)
+{
+	*dstreg = PROCNUM == ARMCPU_ARM9 ? _MMU_ARM9_read16(adr & 0xFFFFFFFE) : _MMU_ARM7_read16(adr & 0xFFFFFFFE);
+	return MMU_aluMemAccessCycles<PROCNUM,16,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRSH_IO(u32 adr, u32 *dstreg)
+{
+	*dstreg = (s16)(PROCNUM == ARMCPU_ARM9 ? _MMU_ARM9_read16(adr & 0xFFFFFFFE) : _MMU_ARM7_read16(adr & 0xFFFFFFFE));
+	return MMU_aluMemAccessCycles<PROCNUM,16,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRB_IO(u32 adr, u32 *dstreg)
+{
+	*dstreg = PROCNUM == ARMCPU_ARM9 ? _MMU_ARM9_read08(adr) : _MMU_ARM7_read08(adr);
+	return MMU_aluMemAccessCycles<PROCNUM,8,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_LDRSB_IO(u32 adr, u32 *dstreg)
+{
+	*dstreg = (s8)(PROCNUM == ARMCPU_ARM9 ? _MMU_ARM9_read08(adr) : _MMU_ARM7_read08(adr));
+	return MMU_aluMemAccessCycles<PROCNUM,8,MMU_AD_READ>(3,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_STR_IO(u32 adr, u32 data)
+{
+	if(PROCNUM == ARMCPU_ARM9) _MMU_ARM9_write32(adr & 0xFFFFFFFC, data);
+	else _MMU_ARM7_write32(adr & 0xFFFFFFFC, data);
+	return MMU_aluMemAccessCycles<PROCNUM,32,MMU_AD_WRITE>(2,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_STRH_IO(u32 adr, u32 data)
+{
+	if(PROCNUM == ARMCPU_ARM9) _MMU_ARM9_write16(adr & 0xFFFFFFFE, data);
+	else _MMU_ARM7_write16(adr & 0xFFFFFFFE, data);
+	return MMU_aluMemAccessCycles<PROCNUM,16,MMU_AD_WRITE>(2,adr);
+}
+
+template<int PROCNUM>
+static u32 FASTCALL OP_STRB_IO(u32 adr, u32 data)
+{
+	if(PROCNUM == ARMCPU_ARM9) _MMU_ARM9_write08(adr, data);
+	else _MMU_ARM7_write08(adr, data);
+	return MMU_aluMemAccessCycles<PROCNUM,8,MMU_AD_WRITE>(2,adr);
+}
+
+// in the order of mem_ops
+static const void *const mem_io_ops[][2] = {
+	{ (const void*)OP_LDR_IO<0>, (const void*)OP_LDR_IO<1> },
+	{ (const void*)OP_LDRH_IO<0>, (const void*)OP_LDRH_IO<1> },
+	{ (const void*)OP_LDRSH_IO<0>, (const void*)OP_LDRSH_IO<1> },
+	{ (const void*)OP_LDRB_IO<0>, (const void*)OP_LDRB_IO<1> },
+	{ (const void*)OP_LDRSB_IO<0>, (const void*)OP_LDRSB_IO<1> },
+	{ (const void*)OP_STR_IO<0>, (const void*)OP_STR_IO<1> },
+	{ (const void*)OP_STRH_IO<0>, (const void*)OP_STRH_IO<1> },
+	{ (const void*)OP_STRB_IO<0>, (const void*)OP_STRB_IO<1> },
+};
+
+enum { INLINE_NONE, INLINE_MAIN, INLINE_ITCM, INLINE_DTCM };
+
+// in the order _MMU_read32 and _MMU_write32 look at them: the dtcm is on top of everything else
+static int classify_adr(u32 adr)
+{
+	if(PROCNUM==ARMCPU_ARM9 && (adr & ~0x3FFF) == MMU.DTCMRegion)
+		return INLINE_DTCM;
+	if((adr & 0x0F000000) == 0x02000000)
+		return INLINE_MAIN;
+	if(PROCNUM==ARMCPU_ARM9 && (adr & 0x0E000000) == 0)
+		return INLINE_ITCM;
+	return INLINE_NONE;
+}
+
+// what the helper returns for an access to the region of adr while the timing is off, which only
+// depends on adr >> 24
+template<int PROCNUM>
+static u32 inline_cycles(const MemOp &m, u32 adr)
+{
+	u32 mem;
+	if(m.load)
+	{
+		if(m.size == 32) mem = _MMU_accesstime<PROCNUM,MMU_AT_DATA,32,MMU_AD_READ,false>(adr & ~3, true);
+		else if(m.size == 16) mem = _MMU_accesstime<PROCNUM,MMU_AT_DATA,16,MMU_AD_READ,false>(adr & ~1, true);
+		else mem = _MMU_accesstime<PROCNUM,MMU_AT_DATA,8,MMU_AD_READ,false>(adr, true);
+	}
+	else
+	{
+		if(m.size == 32) mem = _MMU_accesstime<PROCNUM,MMU_AT_DATA,32,MMU_AD_WRITE,false>(adr & ~3, true);
+		else if(m.size == 16) mem = _MMU_accesstime<PROCNUM,MMU_AT_DATA,16,MMU_AD_WRITE,false>(adr & ~1, true);
+		else mem = _MMU_accesstime<PROCNUM,MMU_AT_DATA,8,MMU_AD_WRITE,false>(adr, true);
+	}
+	return MMU_aluMemCycles<PROCNUM>(m.load ? 3 : 2, mem);
+}
+
+// pc-relative loads of main memory are compiled in as the word that is there, which is then guarded like code so
+// that a store to it throws the block away (see arm_jit_literal_use). only as many as fit in a block's list are,
+// from main memory as the code addresses it and not a mirror (whose stores the guard wouldn't see), and none that
+// was stored to since it was once before: that is a variable rather than a constant.
+static bool literal_resolve(u32 adr, u32 *value)
+{
+	if(bb_literal_count == BB_LITERALS || (adr & ~_MMU_MAIN_MEM_MASK32) != 0x02000000
+	   || classify_adr(adr) != INLINE_MAIN || USE_TIMING() || !arm_jit_literal_free(adr))
+		return false;
+	*value = T1ReadLong(MMU.MAIN_MEM, adr & _MMU_MAIN_MEM_MASK32);
+	bb_literal_adr[bb_literal_count] = adr;
+	bb_literal_value[bb_literal_count++] = *value;
+	return true;
+}
+
+// an i/o access at guess, which the address is every time (see emit_inline_access)
+static u32 *emit_io_access(int op, u32 Rd, u32 guess)
+{
+	u32 *slow = NULL;
+	if(PROCNUM == ARMCPU_ARM9)
+	{
+		// nothing else can be on top of the registers
+		a64_mov64(2, (uintptr_t)&MMU.DTCMRegion);
+		a64_ldr(2, 2);
+		a64_mov32(3, guess & 0xFFFFC000);
+		a64_alu_reg(A64_SUBS, RZR, 3, 2);
+		slow = a64_bcond(CC_EQ);
+	}
+	if(mem_ops[op].load)
+		emit(0x91000000 | (reg_off(Rd) << 10) | (RCPU << 5) | W1);
+	a64_call(mem_io_ops[op][PROCNUM]);
+	u32 *done = a64_b();
+	if(slow)
+		a64_bind(slow);
+	return done;
+}
+
+// the access to guess's region done inline, for an address in W0 (and store data in W1), with the
+// cycles left in W0 like the helper does. every check that fails branches to the code after it,
+// which is the helper call, and the branch over that call is returned (NULL when nothing was emitted).
+// with exact the address is guess each time the op runs, so only the dtcm can move onto it, and
+// then literal is the word there if it was resolved (see literal_resolve), which the dtcm never is on.
+// x2-x8 are free here, the cache is in x21-x28.
+static u32 *emit_inline_access(int op, u32 Rd, u32 guess, bool exact, const u32 *literal)
+{
+	const MemOp &m = mem_ops[op];
+	const int region = classify_adr(guess);
+	if(region == INLINE_NONE)
+		return exact && (guess >> 24) == 0x04 ? emit_io_access(op, Rd, guess) : NULL;
+	if(USE_TIMING())
+		return NULL;
+
+	u32 *slow[8];
+	int nslow = 0;
+
+#ifdef ENABLE_ADVANCED_TIMING
+	// the block outlives the setting, and the timed accesses keep state the inline ones don't
+	a64_mov64(5, (uintptr_t)&CommonSettings.advanced_timing);
+	a64_ldrb(5, 5);
+	slow[nslow++] = a64_cbnz(5);
+#endif
+
+	if(PROCNUM == ARMCPU_ARM9 && exact && !literal)
+	{
+		// the cycles were worked out for where it was while compiling, on guess or not
+		a64_mov64(2, (uintptr_t)&MMU.DTCMRegion);
+		a64_ldr(2, 2);
+		a64_mov32(3, guess & 0xFFFFC000);
+		a64_alu_reg(A64_SUBS, RZR, 3, 2);
+		slow[nslow++] = a64_bcond(region == INLINE_DTCM ? CC_NE : CC_EQ);
+	}
+	else if(PROCNUM == ARMCPU_ARM9 && !exact)
+	{
+		// the dtcm moves with cp15, and blocks aren't thrown away when it does
+		a64_mov64(2, (uintptr_t)&MMU.DTCMRegion);
+		a64_ldr(2, 2);
+		a64_logic_imm(A64_AND, 3, W0, 0xFFFFC000);
+		a64_alu_reg(A64_SUBS, RZR, 3, 2);
+		if(region == INLINE_DTCM)
+		{
+			slow[nslow++] = a64_bcond(CC_NE);
+			// the cycles were worked out for where it was while compiling
+			a64_mov32(4, MMU.DTCMRegion);
+			a64_alu_reg(A64_SUBS, RZR, 2, 4);
+			slow[nslow++] = a64_bcond(CC_NE);
+		}
+		else
+			slow[nslow++] = a64_bcond(CC_EQ);
+	}
+
+	const u8 *base;
+	u32 mask;
+	const u32 align = ~(m.size / 8 - 1);
+	if(region == INLINE_MAIN)
+	{
+		if(!exact)
+		{
+			a64_ubfx(3, W0, 24, 4);
+			a64_cmp_imm(3, 2);
+			slow[nslow++] = a64_bcond(CC_NE);
+		}
+		base = MMU.MAIN_MEM;
+		mask = m.size == 32 ? _MMU_MAIN_MEM_MASK32 : m.size == 16 ? _MMU_MAIN_MEM_MASK16 : _MMU_MAIN_MEM_MASK;
+	}
+	else if(region == INLINE_ITCM)
+	{
+		if(!exact)
+		{
+			a64_ubfx(3, W0, 25, 3);
+			slow[nslow++] = a64_cbnz(3);
+		}
+		base = MMU.ARM9_ITCM;
+		mask = 0x7FFF & align;
+	}
+	else
+	{
+		base = MMU.ARM9_DTCM;
+		mask = 0x3FFF & align;
+	}
+
+	if(!m.load && region != INLINE_DTCM)
+	{
+		// stores to a page anything was compiled from are left to the helper, which throws the code away
+		if(exact)
+		{
+			const u32 page = (guess & 0x07FFFFFE) >> JIT_CODE_PAGE_BITS;
+			a64_mov64(6, (uintptr_t)&arm_jit_code_pages[page >> 5]);
+			a64_ldr(5, 6);
+			a64_ubfx(5, 5, page & 31, 1);
+		}
+		else
+		{
+			a64_ubfx(5, W0, JIT_CODE_PAGE_BITS + 5, 27 - JIT_CODE_PAGE_BITS - 5);
+			a64_mov64(6, (uintptr_t)arm_jit_code_pages);
+			a64_mem_reg(A64_LDR_R | A64_SCALED, 5, 6, 5);
+			a64_ubfx(6, W0, JIT_CODE_PAGE_BITS, 5);
+			a64_alu_reg(A64_LSRV, 5, 5, 6);
+			a64_logic_imm(A64_AND, 5, 5, 1);
+		}
+		slow[nslow++] = a64_cbnz(5);
+	}
+
+	if(literal)
+	{
+		a64_mov32(5, *literal);
+		a64_str_cpu(5, reg_off(Rd));
+	}
+	else
+	{
+		if(exact)
+			a64_mov32(3, guess & mask);
+		else
+			a64_logic_imm(A64_AND, 3, W0, mask);
+		a64_mov64(4, (uintptr_t)base);
+		if(m.load)
+		{
+			a64_mem_reg(m.insn, 5, 4, 3);
+			// rotated by the misaligned bytes, like OP_LDR
+			if(m.size == 32 && !exact)
+			{
+				a64_ubfm(6, W0, 29, 1);
+				a64_alu_reg(A64_RORV, 5, 5, 6);
+			}
+			else if(m.size == 32 && (guess & 3))
+				a64_extr(5, 5, 5, 8 * (guess & 3));
+			a64_str_cpu(5, reg_off(Rd));
+		}
+		else
+		{
+			if(region == INLINE_MAIN)
+			{
+				// MMU_touchMainMem
+				a64_shift_imm(5, 3, SH_LSR, MAINMEM_GENERATION_SHIFT);
+				a64_mov64(6, (uintptr_t)mainmem_page_generation);
+				a64_mem_reg(A64_LDR_R | A64_SCALED, 7, 6, 5);
+				a64_addsub_imm(A64_ADD, 7, 7, 1);
+				a64_mem_reg(A64_STR_R | A64_SCALED, 7, 6, 5);
+			}
+			a64_mem_reg(m.insn, W1, 4, 3);
+		}
+	}
+
+	a64_mov32(W0, PROCNUM == ARMCPU_ARM9 ? inline_cycles<ARMCPU_ARM9>(m, guess) : inline_cycles<ARMCPU_ARM7>(m, guess));
+	u32 *done = a64_b();
+	for(int s = 0; s < nslow; s++)
+		a64_bind(slow[s]);
+	return done;
+}
+#endif
+
+enum { ADR_GUESS, ADR_EXACT, ADR_LITERAL };
+
+// the access of op at W0, with the store data in W1. guess is the address the op would access if
+// it ran now, for picking the region to inline; with ADR_EXACT it is the address the op always
+// accesses, and with ADR_LITERAL that of a pc-relative load as well. returns the cycles in W0
+static void emit_mem_access(int op, u32 Rd, u32 guess, int how = ADR_GUESS)
+{
+	const MemOp &m = mem_ops[op];
+	if(m.load)
+		regs_flush(1 << Rd);
+#ifdef INLINE_MEM_ACCESS
+	u32 literal;
+	const bool resolved = how == ADR_LITERAL && op == MEM_LDR && literal_resolve(guess, &literal);
+	u32 *done = emit_inline_access(op, Rd, guess, how != ADR_GUESS, resolved ? &literal : NULL);
+#else
+	u32 *done = NULL;
+#endif
+	if(m.load)
+		emit(0x91000000 | (reg_off(Rd) << 10) | (RCPU << 5) | W1);
+	a64_call(m.fn[PROCNUM]);
+	if(done)
+		a64_bind(done);
+	if(m.load)
+		regs_discard(1 << Rd);
+#ifdef INLINE_MEM_ACCESS
+	if(resolved)
+		reg_set_known(Rd, literal);
+#endif
+}
+
+// the access is at Rn +/- offset (pre-indexed) or at Rn (post-indexed). the store data is read
+// before the writeback, and a loaded Rd wins over the writeback of the same register.
+static void emit_ldr_str(int op, u32 Rd, u32 Rn, Shifter &offset, bool up, bool pre, bool writeback)
+{
+	const bool load = mem_ops[op].load;
+	// a known rn (r15 always is) with an immediate offset is the address every time
+	const bool imm = offset.is_imm;
+	const u32 imm_value = offset.imm;
+	u32 base;
+	const bool known = reg_known(Rn, &base);
+	const bool exact = known && (!pre || imm);
+	u32 guess = known ? base : cpu->R[Rn];
+	if(pre && imm)
+		guess = up ? guess + imm_value : guess - imm_value;
+
+	if(exact && !writeback)
+		a64_mov32(W0, guess);
+	else
+	{
+		int rn = reg_read(Rn);
+		if(pre)
+			emit_addsub(up ? A64_ADD : A64_SUB, W0, rn, offset);
+		else
+			a64_mov(W0, rn);
+	}
+
+	if(!load)
+		a64_mov(W1, reg_read(Rd));
+
+	if(writeback)
+	{
+		int rnw = reg_write(Rn);
+		if(pre)
+			a64_mov(rnw, W0);
+		else
+			emit_addsub(up ? A64_ADD : A64_SUB, rnw, rnw, offset);
+		if(known && imm)
+			reg_set_known(Rn, up ? base + imm_value : base - imm_value);
+	}
+
+	emit_mem_access(op, Rd, guess, !exact ? ADR_GUESS : Rn == 15 && load ? ADR_LITERAL : ADR_EXACT);
+}
+
+static int op_ldr_str(const u32 i)
+{
+	const bool load = BIT20(i);
+	const bool pre = BIT24(i);
+	const bool writeback = !pre || BIT21(i);
+
+	if(load && REG_POS(i,12) == 15)
+		return 0;
+	if(writeback && REG_POS(i,16) == 15)
+		return 0;
+
+	Shifter offset;
+	if(BIT25(i))
+		shifter_shift_imm(offset, reg_read(REG_POS(i,0)), (i >> 5) & 3, (i >> 7) & 0x1F, false);
+	else
+		shifter_imm(offset, i & 0xFFF);
+
+	int op;
+	if(load)
+		op = BIT22(i) ? MEM_LDRB : MEM_LDR;
+	else
+		op = BIT22(i) ? MEM_STRB : MEM_STR;
+
+	emit_ldr_str(op, REG_POS(i,12), REG_POS(i,16), offset, BIT23(i), pre, writeback);
+	return 1;
+}
+
+static int op_ldrh_strh(const u32 i)
+{
+	const bool load = BIT20(i);
+	const bool pre = BIT24(i);
+	const bool writeback = !pre || BIT21(i);
+	const u32 sh = (i >> 5) & 3; // 1: H, 2: SB, 3: SH
+
+	if(load && REG_POS(i,12) == 15)
+		return 0;
+	if(writeback && REG_POS(i,16) == 15)
+		return 0;
+	if(!load && sh != 1)
+		return 0;
+
+	Shifter offset;
+	if(BIT22(i))
+		shifter_imm(offset, ((i >> 4) & 0xF0) | (i & 0xF));
+	else
+		shifter_reg(offset, reg_read(REG_POS(i,0)));
+
+	int op;
+	if(!load)
+		op = MEM_STRH;
+	else if(sh == 1)
+		op = MEM_LDRH;
+	else if(sh == 2)
+		op = MEM_LDRSB;
+	else
+		op = MEM_LDRSH;
+
+	emit_ldr_str(op, REG_POS(i,12), REG_POS(i,16), offset, BIT23(i), pre, writeback);
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+//   LDMIA / LDMIB / LDMDA / LDMDB / STMIA / STMIB / STMDA / STMDB
+//-----------------------------------------------------------------------------
+static u32 popregcount(u32 x)
+{
+	uint32_t pop = 0;
+	for(; x; x>>=1)
+		pop += x&1;
+	return pop;
+}
+
+static u64 get_reg_list(u32 reg_mask, int dir)
+{
+	u64 regs = 0;
+	for(int j=0; j<16; j++)
+	{
+		int k = dir<0 ? j : 15-j;
+		if(BIT_N(reg_mask,k))
+			regs = (regs << 4) | k;
+	}
+	return regs;
+}
+
+// generic needs to spill regs and main doesn't; if it's inlined gcc isn't smart enough to keep the spills out of the common case.
+#define LDM_INLINE NOINLINE
+
+template <int PROCNUM, bool store, int dir>
+static LDM_INLINE FASTCALL u32 OP_LDM_STM_generic(u32 adr, u64 regs, int n)
+{
+	adr &= ~3;
+	const u32 cycles = MMU_memBurstCycles<PROCNUM,store?MMU_AD_WRITE:MMU_AD_READ>(adr, n, dir);
+	do {
+		if(store) _MMU_write32<PROCNUM>(adr, cpu->R[regs&0xF]);
+		else cpu->R[regs&0xF] = _MMU_read32<PROCNUM>(adr);
+		adr += 4*dir;
+		regs >>= 4;
+	} while(--n > 0);
+	return cycles;
+}
+
+template <int PROCNUM, bool store, int dir>
+static LDM_INLINE FASTCALL u32 OP_LDM_STM_other(u32 adr, u64 regs, int n)
+{
+	u32 cycles;
+	adr &= ~3;
+#ifdef ENABLE_ADVANCED_TIMING
+	cycles = MMU_memBurstCycles<PROCNUM,store?MMU_AD_WRITE:MMU_AD_READ>(adr, n, dir);
+#else
+	cycles = n * MMU_memAccessCycles<PROCNUM,32,store?MMU_AD_WRITE:MMU_AD_READ>(adr);
+#endif
+	do {
+		if(PROCNUM==ARMCPU_ARM9)
+			if(store) _MMU_ARM9_write32(adr, cpu->R[regs&0xF]);
+			else cpu->R[regs&0xF] = _MMU_ARM9_read32(adr);
+		else
+			if(store) _MMU_ARM7_write32(adr, cpu->R[regs&0xF]);
+			else cpu->R[regs&0xF] = _MMU_ARM7_read32(adr);
+		adr += 4*dir;
+		regs >>= 4;
+	} while(--n > 0);
+	return cycles;
+}
+
+template <int PROCNUM, bool store, int dir, bool null_compiled>
+static FORCEINLINE FASTCALL u32 OP_LDM_STM_main(u32 adr, u64 regs, int n, u8 *ptr, u32 cycles)
+{
+#ifdef ENABLE_ADVANCED_TIMING
+	cycles = MMU_memBurstCycles<PROCNUM,store?MMU_AD_WRITE:MMU_AD_READ>(adr, n, dir);
+#endif
+	uintptr_t *func = (uintptr_t *)&JIT_COMPILED_FUNC(adr, PROCNUM);
+
+#define OP(j) { \
+	/* no need to zero functions in DTCM, since we can't execute from it */ \
+	if(null_compiled && store) \
+	{ \
+		/* the guard of a literal takes the blocks that have it with it */ \
+		if(*func == arm_jit_literal_guards[0] || *func == arm_jit_literal_guards[1]) \
+			arm_jit_literal_store(adr); \
+		*func = 0; \
+		*(func+1) = 0; \
+	} \
+	int Rd = ((uintptr_t)regs >> (j*4)) & 0xF; \
+	if(store) *(u32*)ptr = cpu->R[Rd]; \
+	else cpu->R[Rd] = *(u32*)ptr; \
+	func += 2*dir; \
+	adr += 4*dir; \
+	ptr += 4*dir; }
+
+	do {
+		OP(0);
+		if(n == 1) break;
+		OP(1);
+		if(n == 2) break;
+		OP(2);
+		if(n == 3) break;
+		OP(3);
+		regs >>= 16;
+		n -= 4;
+	} while(n > 0);
+	return cycles;
+#undef OP
+}
+
+template <int PROCNUM, bool store, int dir>
+static u32 FASTCALL OP_LDM_STM(u32 adr, u64 regs, int n)
+{
+	u32 cycles;
+	u8 *ptr;
+
+	if((adr ^ (adr + (dir>0 ? (n-1)*4 : -15*4))) & ~0x3FFF) // a little conservative, but we don't want to run too many comparisons
+	{
+		// the memory region spans a page boundary, so we can't factor the address translation out of the loop
+		return OP_LDM_STM_generic<PROCNUM, store, dir>(adr, regs, n);
+	}
+	else if(PROCNUM==ARMCPU_ARM9 && (adr & ~0x3FFF) == MMU.DTCMRegion)
+	{
+		// don't special-case DTCM cycles, even though that would be both faster and more accurate,
+		// because that wouldn't match the non-jitted version with !ACCOUNT_FOR_DATA_TCM_SPEED
+		ptr = MMU.ARM9_DTCM + (adr & 0x3FFC);
+		cycles = n * MMU_memAccessCycles<PROCNUM,32,store?MMU_AD_WRITE:MMU_AD_READ>(adr);
+		if(store)
+			return OP_LDM_STM_main<PROCNUM, store, dir, 0>(adr, regs, n, ptr, cycles);
+	}
+	else if((adr & 0x0F000000) == 0x02000000)
+	{
+		ptr = MMU.MAIN_MEM + (adr & _MMU_MAIN_MEM_MASK32);
+		cycles = n * ((PROCNUM==ARMCPU_ARM9) ? 4 : 2);
+		// the registers can take up to two 4KB pages
+		if(store)
+		{
+			MMU_touchMainMem(adr);
+			MMU_touchMainMem(adr + (n-1)*4*dir);
+		}
+	}
+	else if(PROCNUM==ARMCPU_ARM7 && !store && (adr & 0xFF800000) == 0x03800000)
+	{
+		ptr = MMU.ARM7_ERAM + (adr & 0xFFFC);
+		cycles = n;
+	}
+	else if(PROCNUM==ARMCPU_ARM7 && !store && (adr & 0xFF800000) == 0x03000000)
+	{
+		ptr = MMU.SWIRAM + (adr & 0x7FFC);
+		cycles = n;
+	}
+	else
+		return OP_LDM_STM_other<PROCNUM, store, dir>(adr, regs, n);
+
+	return OP_LDM_STM_main<PROCNUM, store, dir, store>(adr, regs, n, ptr, cycles);
+}
+
+typedef u32 FASTCALL (*LDMOpFunc)(u32,u64,int);
+static const LDMOpFunc op_ldm_stm_tab[2][2][2] = {{
+	{ OP_LDM_STM<0,0,-1>, OP_LDM_STM<0,0,+1> },
+	{ OP_LDM_STM<0,1,-1>, OP_LDM_STM<0,1,+1> },
+},{
+	{ OP_LDM_STM<1,0,-1>, OP_LDM_STM<1,0,+1> },
+	{ OP_LDM_STM<1,1,-1>, OP_LDM_STM<1,1,+1> },
+}};
+
+// transfers the listed registers starting at the address in W0, leaves the cycles in W0.
+// the cached copies of the stored registers are written back first; the loaded ones are
+// dropped by the caller, which may still need the old base.
+static void call_ldm_stm(u32 bitmask, bool store, int dir)
+{
+	if(store)
+		regs_flush(bitmask);
+	a64_mov64(W1, get_reg_list(bitmask, dir));
+	a64_mov32(W2, popregcount(bitmask));
+	a64_call((const void*)op_ldm_stm_tab[PROCNUM][store][dir>0]);
+}
+
+static void emit_bx(int src, bool blx, bool test_thumb);
+static void emit_bx_thumb(int src, bool blx, bool test_thumb);
+
+static int op_ldm_stm(u32 i, bool store, int dir, bool before, bool writeback)
+{
+	const u32 bitmask = i & 0xFFFF;
+	const u32 pop = popregcount(bitmask);
+	const u32 Rn = REG_POS(i,16);
+
+	if(!bitmask)
+		return 0;
+	if(writeback && Rn == 15)
+	{
+		if(store || !BIT15(i))
+			return 0;
+		writeback = false;
+	}
+
+	int rn = reg_read(Rn);
+	if(before)
+		a64_addsub_imm(dir > 0 ? A64_ADD : A64_SUB, W0, rn, 4);
+	else
+		a64_mov(W0, rn);
+
+	call_ldm_stm(bitmask, store, dir);
+
+	if(BIT15(i) && !store)
+	{
+		a64_ldr_cpu(RTMP2, reg_off(15));
+		emit_bx(RTMP2, 0, PROCNUM == ARMCPU_ARM9);
+	}
+
+	u32 loaded = store ? 0 : (bitmask & 0x7FFF);
+	if(writeback)
+	{
+		// a base in the list keeps the loaded value, unless a higher register was loaded too
+		bool in_list = BIT_N(bitmask, Rn);
+		if(store || !in_list || (bitmask & ~((2 << Rn) - 1)))
+		{
+			int rnw = reg_write(Rn);
+			a64_addsub_imm(dir > 0 ? A64_ADD : A64_SUB, rnw, rnw, 4*pop);
+			loaded &= ~(1 << Rn);
+		}
+	}
+	regs_discard(loaded);
+
+	emit_MMU_aluMemCycles(store ? 1 : 2, pop);
+	return 1;
+}
+
+static int OP_LDMIA(const u32 i) { return op_ldm_stm(i, 0, +1, 0, 0); }
+static int OP_LDMIA_W(const u32 i) { return op_ldm_stm(i, 0, +1, 0, 1); }
+static int OP_LDMIB(const u32 i) { return op_ldm_stm(i, 0, +1, 1, 0); }
+static int OP_LDMIB_W(const u32 i) { return op_ldm_stm(i, 0, +1, 1, 1); }
+static int OP_LDMDA(const u32 i) { return op_ldm_stm(i, 0, -1, 0, 0); }
+static int OP_LDMDA_W(const u32 i) { return op_ldm_stm(i, 0, -1, 0, 1); }
+static int OP_LDMDB(const u32 i) { return op_ldm_stm(i, 0, -1, 1, 0); }
+static int OP_LDMDB_W(const u32 i) { return op_ldm_stm(i, 0, -1, 1, 1); }
+static int OP_STMIA(const u32 i) { return op_ldm_stm(i, 1, +1, 0, 0); }
+static int OP_STMIA_W(const u32 i) { return op_ldm_stm(i, 1, +1, 0, 1); }
+static int OP_STMIB(const u32 i) { return op_ldm_stm(i, 1, +1, 1, 0); }
+static int OP_STMIB_W(const u32 i) { return op_ldm_stm(i, 1, +1, 1, 1); }
+static int OP_STMDA(const u32 i) { return op_ldm_stm(i, 1, -1, 0, 0); }
+static int OP_STMDA_W(const u32 i) { return op_ldm_stm(i, 1, -1, 0, 1); }
+static int OP_STMDB(const u32 i) { return op_ldm_stm(i, 1, -1, 1, 0); }
+static int OP_STMDB_W(const u32 i) { return op_ldm_stm(i, 1, -1, 1, 1); }
+
+//-----------------------------------------------------------------------------
+//   Branch
+//-----------------------------------------------------------------------------
+#define SIGNEXTEND_11(i) (((s32)i<<21)>>21)
+#define SIGNEXTEND_24(i) (((s32)i<<8)>>8)
+
+static int op_b(u32 i, bool bl)
+{
+	u32 dst = bb_r15 + (SIGNEXTEND_24(i) << 2);
+	if(CONDITION(i)==0xF)
+	{
+		if(bl)
+			dst += 2;
+		a64_ldr_cpu(RPSR, cpu_off(CPSR.val));
+		a64_logic_imm(A64_ORR, RPSR, RPSR, 1<<5);
+		a64_str_cpu(RPSR, cpu_off(CPSR.val));
+	}
+	if(bl || CONDITION(i)==0xF)
+		a64_mov32(reg_write(14), bb_next_instruction);
+
+	a64_mov32(RTMP0, dst);
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+	return 1;
+}
+
+static int OP_B(const u32 i) { return op_b(i, 0); }
+static int OP_BL(const u32 i) { return op_b(i, 1); }
+
+static void emit_bx(int src, bool blx, bool test_thumb)
+{
+	if(test_thumb)
+	{
+		a64_ubfx(RTMP1, src, 0, 1);
+		a64_ldr_cpu(RPSR, cpu_off(CPSR.val));
+		a64_alu_reg(A64_ORR, RPSR, RPSR, RTMP1, SH_LSL, 5);
+		a64_str_cpu(RPSR, cpu_off(CPSR.val));
+		a64_mov32(RTMP0, 0xFFFFFFFC);
+		a64_alu_reg(A64_ADD, RTMP0, RTMP0, RTMP1, SH_LSL, 1);
+		a64_alu_reg(A64_AND, RTMP0, src, RTMP0);
+	}
+	else
+		a64_logic_imm(A64_AND, RTMP0, src, 0xFFFFFFFC);
+
+	if(blx)
+		a64_mov32(reg_write(14), bb_next_instruction);
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+}
+
+static int OP_BX(const u32 i) { emit_bx(reg_read(REG_POS(i,0)), 0, 1); return 1; }
+static int OP_BLX_REG(const u32 i) { emit_bx(reg_read(REG_POS(i,0)), 1, 1); return 1; }
+
+//-----------------------------------------------------------------------------
+//   THUMB
+//-----------------------------------------------------------------------------
+// the ALU ops go through the ARM data processing emitter, which already has the
+// thumb flag semantics (logical ops leave V alone, shifts by 0 leave C alone).
+
+static int thumb_alu(u32 opc, u32 Rd, u32 Rn, Shifter &rhs, bool s = true)
+{
+	const bool writes_rd = opc < ALU_TST || opc > ALU_CMN;
+	u32 a = 0, folded = 0;
+	const bool fold = writes_rd && rhs.is_imm && (opc == ALU_MOV || opc == ALU_MVN || reg_known(Rn, &a))
+	                  && alu_fold(opc, a, rhs.imm, &folded);
+
+	int rn = (opc == ALU_MOV || opc == ALU_MVN) ? RZR : reg_read(Rn);
+	int rd = writes_rd ? reg_write(Rd) : RZR;
+	emit_alu(opc, s, rd, rn, rhs);
+	if(fold)
+		reg_set_known(Rd, folded);
+	return 1;
+}
+
+static int thumb_alu_reg(const u32 i, u32 opc)
+{
+	Shifter rhs;
+	shifter_reg(rhs, reg_read(_REG_NUM(i, 3)));
+	return thumb_alu(opc, _REG_NUM(i, 0), _REG_NUM(i, 0), rhs);
+}
+
+static int thumb_shift_imm(const u32 i, u32 type)
+{
+	// mov and a shift is how thumb code makes most of the i/o addresses
+	const u32 amount = (i >> 6) & 0x1F;
+	u32 v;
+	const bool fold = reg_known(_REG_NUM(i, 3), &v);
+
+	Shifter rhs;
+	shifter_shift_imm(rhs, reg_read(_REG_NUM(i, 3)), type, amount, true);
+	thumb_alu(ALU_MOV, _REG_NUM(i, 0), 0, rhs);
+	if(fold)
+	{
+		// a shift right by 0 is one by 32
+		if(type == SH_LSL) v <<= amount;
+		else if(type == SH_LSR) v = amount ? v >> amount : 0;
+		else v = (u32)((s32)v >> (amount ? amount : 31));
+		reg_set_known(_REG_NUM(i, 0), v);
+	}
+	return 1;
+}
+
+static int OP_LSL_0(const u32 i) { return thumb_shift_imm(i, SH_LSL); }
+static int OP_LSL(const u32 i) { return thumb_shift_imm(i, SH_LSL); }
+static int OP_LSR_0(const u32 i) { return thumb_shift_imm(i, SH_LSR); }
+static int OP_LSR(const u32 i) { return thumb_shift_imm(i, SH_LSR); }
+static int OP_ASR_0(const u32 i) { return thumb_shift_imm(i, SH_ASR); }
+static int OP_ASR(const u32 i) { return thumb_shift_imm(i, SH_ASR); }
+
+static int thumb_imm3(const u32 i, u32 opc)
+{
+	Shifter rhs;
+	shifter_imm(rhs, (i >> 6) & 7);
+	return thumb_alu(opc, _REG_NUM(i, 0), _REG_NUM(i, 3), rhs);
+}
+
+static int thumb_reg3(const u32 i, u32 opc)
+{
+	Shifter rhs;
+	shifter_reg(rhs, reg_read(_REG_NUM(i, 6)));
+	return thumb_alu(opc, _REG_NUM(i, 0), _REG_NUM(i, 3), rhs);
+}
+
+static int thumb_imm8(const u32 i, u32 opc)
+{
+	Shifter rhs;
+	shifter_imm(rhs, i & 0xFF);
+	return thumb_alu(opc, _REG_NUM(i, 8), _REG_NUM(i, 8), rhs);
+}
+
+static int OP_ADD_IMM3(const u32 i) { return thumb_imm3(i, ALU_ADD); }
+static int OP_SUB_IMM3(const u32 i) { return thumb_imm3(i, ALU_SUB); }
+static int OP_ADD_REG(const u32 i) { return thumb_reg3(i, ALU_ADD); }
+static int OP_SUB_REG(const u32 i) { return thumb_reg3(i, ALU_SUB); }
+static int OP_MOV_IMM8(const u32 i) { return thumb_imm8(i, ALU_MOV); }
+static int OP_CMP_IMM8(const u32 i) { return thumb_imm8(i, ALU_CMP); }
+static int OP_ADD_IMM8(const u32 i) { return thumb_imm8(i, ALU_ADD); }
+static int OP_SUB_IMM8(const u32 i) { return thumb_imm8(i, ALU_SUB); }
+
+static int OP_AND(const u32 i) { return thumb_alu_reg(i, ALU_AND); }
+static int OP_EOR(const u32 i) { return thumb_alu_reg(i, ALU_EOR); }
+static int OP_ADC_REG(const u32 i) { return thumb_alu_reg(i, ALU_ADC); }
+static int OP_SBC_REG(const u32 i) { return thumb_alu_reg(i, ALU_SBC); }
+static int OP_TST(const u32 i) { return thumb_alu_reg(i, ALU_TST); }
+static int OP_CMP(const u32 i) { return thumb_alu_reg(i, ALU_CMP); }
+static int OP_CMN(const u32 i) { return thumb_alu_reg(i, ALU_CMN); }
+static int OP_ORR(const u32 i) { return thumb_alu_reg(i, ALU_ORR); }
+static int OP_BIC(const u32 i) { return thumb_alu_reg(i, ALU_BIC); }
+static int OP_MVN(const u32 i) { return thumb_alu_reg(i, ALU_MVN); }
+
+static int OP_NEG(const u32 i)
+{
+	Shifter rhs;
+	shifter_imm(rhs, 0);
+	return thumb_alu(ALU_RSB, _REG_NUM(i, 0), _REG_NUM(i, 3), rhs);
+}
+
+static int thumb_spe(const u32 i, u32 opc, bool s)
+{
+	const u32 Rd = (i&7) | ((i>>4)&8);
+	if(opc != ALU_CMP && Rd == 15)
+		return 0;
+	Shifter rhs;
+	shifter_reg(rhs, reg_read(REG_POS(i,3)));
+	return thumb_alu(opc, Rd, Rd, rhs, s);
+}
+
+static int OP_ADD_SPE(const u32 i) { return thumb_spe(i, ALU_ADD, false); }
+static int OP_CMP_SPE(const u32 i) { return thumb_spe(i, ALU_CMP, true); }
+static int OP_MOV_SPE(const u32 i) { return thumb_spe(i, ALU_MOV, false); }
+
+static int OP_ADD_2PC(const u32 i)
+{
+	const u32 adr = (bb_r15 & 0xFFFFFFFC) + ((i&0xFF)<<2);
+	a64_mov32(reg_write(_REG_NUM(i, 8)), adr);
+	reg_set_known(_REG_NUM(i, 8), adr);
+	return 1;
+}
+
+static int OP_ADD_2SP(const u32 i)
+{
+	Shifter rhs;
+	shifter_imm(rhs, (i&0xFF)<<2);
+	return thumb_alu(ALU_ADD, _REG_NUM(i, 8), 13, rhs, false);
+}
+
+static int OP_ADJUST_P_SP(const u32 i)
+{
+	Shifter rhs;
+	shifter_imm(rhs, (i&0x7F)<<2);
+	return thumb_alu(ALU_ADD, 13, 13, rhs, false);
+}
+
+static int OP_ADJUST_M_SP(const u32 i)
+{
+	Shifter rhs;
+	shifter_imm(rhs, (i&0x7F)<<2);
+	return thumb_alu(ALU_SUB, 13, 13, rhs, false);
+}
+
+static int thumb_ldr_str(int op, u32 Rd, u32 Rb, Shifter &offset)
+{
+	emit_ldr_str(op, Rd, Rb, offset, true, true, false);
+	return 1;
+}
+
+static int thumb_imm_off(const u32 i, int op, u32 off)
+{
+	Shifter offset;
+	shifter_imm(offset, off);
+	return thumb_ldr_str(op, _REG_NUM(i, 0), _REG_NUM(i, 3), offset);
+}
+
+static int thumb_reg_off(const u32 i, int op)
+{
+	Shifter offset;
+	shifter_reg(offset, reg_read(_REG_NUM(i, 6)));
+	return thumb_ldr_str(op, _REG_NUM(i, 0), _REG_NUM(i, 3), offset);
+}
+
+static int OP_LDRB_IMM_OFF(const u32 i) { return thumb_imm_off(i, MEM_LDRB, (i>>6)&0x1F); }
+static int OP_LDRH_IMM_OFF(const u32 i) { return thumb_imm_off(i, MEM_LDRH, (i>>5)&0x3E); }
+static int OP_LDR_IMM_OFF(const u32 i) { return thumb_imm_off(i, MEM_LDR, (i>>4)&0x7C); }
+static int OP_STRB_IMM_OFF(const u32 i) { return thumb_imm_off(i, MEM_STRB, (i>>6)&0x1F); }
+static int OP_STRH_IMM_OFF(const u32 i) { return thumb_imm_off(i, MEM_STRH, (i>>5)&0x3E); }
+static int OP_STR_IMM_OFF(const u32 i) { return thumb_imm_off(i, MEM_STR, (i>>4)&0x7C); }
+
+static int OP_LDRB_REG_OFF(const u32 i) { return thumb_reg_off(i, MEM_LDRB); }
+static int OP_LDRSB_REG_OFF(const u32 i) { return thumb_reg_off(i, MEM_LDRSB); }
+static int OP_LDRH_REG_OFF(const u32 i) { return thumb_reg_off(i, MEM_LDRH); }
+static int OP_LDRSH_REG_OFF(const u32 i) { return thumb_reg_off(i, MEM_LDRSH); }
+static int OP_LDR_REG_OFF(const u32 i) { return thumb_reg_off(i, MEM_LDR); }
+static int OP_STRB_REG_OFF(const u32 i) { return thumb_reg_off(i, MEM_STRB); }
+static int OP_STRH_REG_OFF(const u32 i) { return thumb_reg_off(i, MEM_STRH); }
+static int OP_STR_REG_OFF(const u32 i) { return thumb_reg_off(i, MEM_STR); }
+
+static int OP_LDR_SPREL(const u32 i)
+{
+	Shifter offset;
+	shifter_imm(offset, (i&0xFF)<<2);
+	return thumb_ldr_str(MEM_LDR, _REG_NUM(i, 8), 13, offset);
+}
+
+static int OP_STR_SPREL(const u32 i)
+{
+	Shifter offset;
+	shifter_imm(offset, (i&0xFF)<<2);
+	return thumb_ldr_str(MEM_STR, _REG_NUM(i, 8), 13, offset);
+}
+
+static int OP_LDR_PCREL(const u32 i)
+{
+	const u32 adr = (bb_r15 & 0xFFFFFFFC) + ((i&0xFF)<<2);
+	a64_mov32(W0, adr);
+	emit_mem_access(MEM_LDR, _REG_NUM(i, 8), adr, ADR_LITERAL);
+	return 1;
+}
+
+static int op_ldm_stm_thumb(u32 i, bool store)
+{
+	const u32 bitmask = i & 0xFF;
+	const u32 pop = popregcount(bitmask);
+	const u32 Rb = _REG_NUM(i, 8);
+
+	if(!bitmask)
+		return 0;
+
+	a64_mov(W0, reg_read(Rb));
+	call_ldm_stm(bitmask, store, 1);
+
+	// ARM_REF:	THUMB: Causes base register write-back, and is not optional
+	// ARM_REF:	If the base register <Rn> is specified in <registers>, the final value of <Rn> is the loaded value
+	//			(not the written-back value).
+	u32 loaded = store ? 0 : bitmask;
+	if(store || !BIT_N(i, Rb))
+	{
+		int rbw = reg_write(Rb);
+		a64_addsub_imm(A64_ADD, rbw, rbw, 4*pop);
+	}
+	regs_discard(loaded);
+
+	emit_MMU_aluMemCycles(store ? 2 : 3, pop);
+	return 1;
+}
+
+static int OP_LDMIA_THUMB(const u32 i) { return op_ldm_stm_thumb(i, 0); }
+static int OP_STMIA_THUMB(const u32 i) { return op_ldm_stm_thumb(i, 1); }
+
+static int op_push_pop(u32 i, bool store, bool pc_lr)
+{
+	u32 bitmask = (i & 0xFF);
+	bitmask |= pc_lr << (store ? 14 : 15);
+	u32 pop = popregcount(bitmask);
+	int dir = store ? -1 : 1;
+
+	if(!bitmask)
+		return 0;
+
+	int sp = reg_read(13);
+	if(store)
+		a64_addsub_imm(A64_SUB, W0, sp, 4);
+	else
+		a64_mov(W0, sp);
+
+	call_ldm_stm(bitmask, store, dir);
+
+	if(pc_lr && !store)
+	{
+		a64_ldr_cpu(RTMP2, reg_off(15));
+		emit_bx_thumb(RTMP2, 0, PROCNUM == ARMCPU_ARM9);
+	}
+	int spw = reg_write(13);
+	a64_addsub_imm(store ? A64_SUB : A64_ADD, spw, spw, 4*pop);
+	if(!store)
+		regs_discard(bitmask & 0x7FFF);
+
+	emit_MMU_aluMemCycles(store ? (pc_lr?4:3) : (pc_lr?5:2), pop);
+	return 1;
+}
+
+static int OP_PUSH(const u32 i)    { return op_push_pop(i, 1, 0); }
+static int OP_PUSH_LR(const u32 i) { return op_push_pop(i, 1, 1); }
+static int OP_POP(const u32 i)     { return op_push_pop(i, 0, 0); }
+static int OP_POP_PC(const u32 i)  { return op_push_pop(i, 0, 1); }
+
+static int OP_B_COND(const u32 i)
+{
+	u32 dst = bb_r15 + ((u32)((s8)(i&0xFF))<<1);
+
+	a64_mov32(RTMP0, bb_next_instruction);
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+
+	u32 *skip = emit_branch_unless((i>>8)&0xF);
+	a64_mov32(RTMP0, dst);
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+	a64_addsub_imm(A64_ADD, RCYC, RCYC, 2);
+	if(skip)
+		a64_bind(skip);
+
+	return 1;
+}
+
+static int OP_B_UNCOND(const u32 i)
+{
+	a64_mov32(RTMP0, bb_r15 + (SIGNEXTEND_11(i)<<1));
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+	return 1;
+}
+
+static int OP_BLX(const u32 i)
+{
+	int lr = reg_read(14);
+	a64_add_const(RTMP0, lr, (i&0x7FF) << 1);
+	a64_logic_imm(A64_AND, RTMP0, RTMP0, 0xFFFFFFFC);
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+	a64_mov32(reg_write(14), bb_next_instruction | 1);
+	// reset T bit
+	a64_ldr_cpu(RPSR, cpu_off(CPSR.val));
+	a64_logic_imm(A64_AND, RPSR, RPSR, ~(1<<5));
+	a64_str_cpu(RPSR, cpu_off(CPSR.val));
+	return 1;
+}
+
+static int OP_BL_10(const u32 i)
+{
+	a64_mov32(reg_write(14), bb_r15 + (SIGNEXTEND_11(i)<<12));
+	return 1;
+}
+
+static int OP_BL_11(const u32 i)
+{
+	int lr = reg_read(14);
+	a64_add_const(RTMP0, lr, (i&0x7FF) << 1);
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+	a64_mov32(reg_write(14), bb_next_instruction | 1);
+	return 1;
+}
+
+static void emit_bx_thumb(int src, bool blx, bool test_thumb)
+{
+	a64_ubfx(RTMP1, src, 0, 1);
+	if(test_thumb)
+	{
+		a64_mov32(RTMP0, 0xFFFFFFFC);
+		a64_alu_reg(A64_ADD, RTMP0, RTMP0, RTMP1, SH_LSL, 1);
+		a64_alu_reg(A64_AND, RTMP0, src, RTMP0);
+	}
+	else
+		a64_logic_imm(A64_AND, RTMP0, src, 0xFFFFFFFE);
+
+	if(blx)
+		a64_mov32(reg_write(14), bb_next_instruction | 1);
+
+	a64_ldr_cpu(RPSR, cpu_off(CPSR.val));
+	a64_bfi(RPSR, RTMP1, 5, 1);
+	a64_str_cpu(RPSR, cpu_off(CPSR.val));
+
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+}
+
+static int op_bx_thumbR15()
+{
+	const u32 r15 = (bb_r15 & 0xFFFFFFFC);
+	a64_mov32(RTMP0, r15);
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+	a64_str_cpu(RTMP0, reg_off(15));
+	a64_ldr_cpu(RPSR, cpu_off(CPSR.val));
+	a64_logic_imm(A64_AND, RPSR, RPSR, ~(1<<5));
+	a64_str_cpu(RPSR, cpu_off(CPSR.val));
+	return 1;
+}
+
+static int OP_BX_THUMB(const u32 i) { if (REG_POS(i, 3) == 15) return op_bx_thumbR15(); emit_bx_thumb(reg_read(REG_POS(i, 3)), 0, 0); return 1; }
+static int OP_BLX_THUMB(const u32 i) { emit_bx_thumb(reg_read(REG_POS(i, 3)), 1, 1); return 1; }
+
+//-----------------------------------------------------------------------------
+//   Decoded by bit fields rather than one compiler per table entry
+//-----------------------------------------------------------------------------
+
+#define OP_AND_LSL_IMM         op_alu
+#define OP_AND_LSL_REG         op_alu
+#define OP_AND_LSR_IMM         op_alu
+#define OP_AND_LSR_REG         op_alu
+#define OP_AND_ASR_IMM         op_alu
+#define OP_AND_ASR_REG         op_alu
+#define OP_AND_ROR_IMM         op_alu
+#define OP_AND_ROR_REG         op_alu
+#define OP_AND_S_LSL_IMM       op_alu
+#define OP_AND_S_LSL_REG       op_alu
+#define OP_AND_S_LSR_IMM       op_alu
+#define OP_AND_S_LSR_REG       op_alu
+#define OP_AND_S_ASR_IMM       op_alu
+#define OP_AND_S_ASR_REG       op_alu
+#define OP_AND_S_ROR_IMM       op_alu
+#define OP_AND_S_ROR_REG       op_alu
+#define OP_EOR_LSL_IMM         op_alu
+#define OP_EOR_LSL_REG         op_alu
+#define OP_EOR_LSR_IMM         op_alu
+#define OP_EOR_LSR_REG         op_alu
+#define OP_EOR_ASR_IMM         op_alu
+#define OP_EOR_ASR_REG         op_alu
+#define OP_EOR_ROR_IMM         op_alu
+#define OP_EOR_ROR_REG         op_alu
+#define OP_EOR_S_LSL_IMM       op_alu
+#define OP_EOR_S_LSL_REG       op_alu
+#define OP_EOR_S_LSR_IMM       op_alu
+#define OP_EOR_S_LSR_REG       op_alu
+#define OP_EOR_S_ASR_IMM       op_alu
+#define OP_EOR_S_ASR_REG       op_alu
+#define OP_EOR_S_ROR_IMM       op_alu
+#define OP_EOR_S_ROR_REG       op_alu
+#define OP_SUB_LSL_IMM         op_alu
+#define OP_SUB_LSL_REG         op_alu
+#define OP_SUB_LSR_IMM         op_alu
+#define OP_SUB_LSR_REG         op_alu
+#define OP_SUB_ASR_IMM         op_alu
+#define OP_SUB_ASR_REG         op_alu
+#define OP_SUB_ROR_IMM         op_alu
+#define OP_SUB_ROR_REG         op_alu
+#define OP_SUB_S_LSL_IMM       op_alu
+#define OP_SUB_S_LSL_REG       op_alu
+#define OP_SUB_S_LSR_IMM       op_alu
+#define OP_SUB_S_LSR_REG       op_alu
+#define OP_SUB_S_ASR_IMM       op_alu
+#define OP_SUB_S_ASR_REG       op_alu
+#define OP_SUB_S_ROR_IMM       op_alu
+#define OP_SUB_S_ROR_REG       op_alu
+#define OP_RSB_LSL_IMM         op_alu
+#define OP_RSB_LSL_REG         op_alu
+#define OP_RSB_LSR_IMM         op_alu
+#define OP_RSB_LSR_REG         op_alu
+#define OP_RSB_ASR_IMM         op_alu
+#define OP_RSB_ASR_REG         op_alu
+#define OP_RSB_ROR_IMM         op_alu
+#define OP_RSB_ROR_REG         op_alu
+#define OP_RSB_S_LSL_IMM       op_alu
+#define OP_RSB_S_LSL_REG       op_alu
+#define OP_RSB_S_LSR_IMM       op_alu
+#define OP_RSB_S_LSR_REG       op_alu
+#define OP_RSB_S_ASR_IMM       op_alu
+#define OP_RSB_S_ASR_REG       op_alu
+#define OP_RSB_S_ROR_IMM       op_alu
+#define OP_RSB_S_ROR_REG       op_alu
+#define OP_ADD_LSL_IMM         op_alu
+#define OP_ADD_LSL_REG         op_alu
+#define OP_ADD_LSR_IMM         op_alu
+#define OP_ADD_LSR_REG         op_alu
+#define OP_ADD_ASR_IMM         op_alu
+#define OP_ADD_ASR_REG         op_alu
+#define OP_ADD_ROR_IMM         op_alu
+#define OP_ADD_ROR_REG         op_alu
+#define OP_ADD_S_LSL_IMM       op_alu
+#define OP_ADD_S_LSL_REG       op_alu
+#define OP_ADD_S_LSR_IMM       op_alu
+#define OP_ADD_S_LSR_REG       op_alu
+#define OP_ADD_S_ASR_IMM       op_alu
+#define OP_ADD_S_ASR_REG       op_alu
+#define OP_ADD_S_ROR_IMM       op_alu
+#define OP_ADD_S_ROR_REG       op_alu
+#define OP_ADC_LSL_IMM         op_alu
+#define OP_ADC_LSL_REG         op_alu
+#define OP_ADC_LSR_IMM         op_alu
+#define OP_ADC_LSR_REG         op_alu
+#define OP_ADC_ASR_IMM         op_alu
+#define OP_ADC_ASR_REG         op_alu
+#define OP_ADC_ROR_IMM         op_alu
+#define OP_ADC_ROR_REG         op_alu
+#define OP_ADC_S_LSL_IMM       op_alu
+#define OP_ADC_S_LSL_REG       op_alu
+#define OP_ADC_S_LSR_IMM       op_alu
+#define OP_ADC_S_LSR_REG       op_alu
+#define OP_ADC_S_ASR_IMM       op_alu
+#define OP_ADC_S_ASR_REG       op_alu
+#define OP_ADC_S_ROR_IMM       op_alu
+#define OP_ADC_S_ROR_REG       op_alu
+#define OP_SBC_LSL_IMM         op_alu
+#define OP_SBC_LSL_REG         op_alu
+#define OP_SBC_LSR_IMM         op_alu
+#define OP_SBC_LSR_REG         op_alu
+#define OP_SBC_ASR_IMM         op_alu
+#define OP_SBC_ASR_REG         op_alu
+#define OP_SBC_ROR_IMM         op_alu
+#define OP_SBC_ROR_REG         op_alu
+#define OP_SBC_S_LSL_IMM       op_alu
+#define OP_SBC_S_LSL_REG       op_alu
+#define OP_SBC_S_LSR_IMM       op_alu
+#define OP_SBC_S_LSR_REG       op_alu
+#define OP_SBC_S_ASR_IMM       op_alu
+#define OP_SBC_S_ASR_REG       op_alu
+#define OP_SBC_S_ROR_IMM       op_alu
+#define OP_SBC_S_ROR_REG       op_alu
+#define OP_RSC_LSL_IMM         op_alu
+#define OP_RSC_LSL_REG         op_alu
+#define OP_RSC_LSR_IMM         op_alu
+#define OP_RSC_LSR_REG         op_alu
+#define OP_RSC_ASR_IMM         op_alu
+#define OP_RSC_ASR_REG         op_alu
+#define OP_RSC_ROR_IMM         op_alu
+#define OP_RSC_ROR_REG         op_alu
+#define OP_RSC_S_LSL_IMM       op_alu
+#define OP_RSC_S_LSL_REG       op_alu
+#define OP_RSC_S_LSR_IMM       op_alu
+#define OP_RSC_S_LSR_REG       op_alu
+#define OP_RSC_S_ASR_IMM       op_alu
+#define OP_RSC_S_ASR_REG       op_alu
+#define OP_RSC_S_ROR_IMM       op_alu
+#define OP_RSC_S_ROR_REG       op_alu
+#define OP_TST_LSL_IMM         op_alu
+#define OP_TST_LSL_REG         op_alu
+#define OP_TST_LSR_IMM         op_alu
+#define OP_TST_LSR_REG         op_alu
+#define OP_TST_ASR_IMM         op_alu
+#define OP_TST_ASR_REG         op_alu
+#define OP_TST_ROR_IMM         op_alu
+#define OP_TST_ROR_REG         op_alu
+#define OP_TEQ_LSL_IMM         op_alu
+#define OP_TEQ_LSL_REG         op_alu
+#define OP_TEQ_LSR_IMM         op_alu
+#define OP_TEQ_LSR_REG         op_alu
+#define OP_TEQ_ASR_IMM         op_alu
+#define OP_TEQ_ASR_REG         op_alu
+#define OP_TEQ_ROR_IMM         op_alu
+#define OP_TEQ_ROR_REG         op_alu
+#define OP_CMP_LSL_IMM         op_alu
+#define OP_CMP_LSL_REG         op_alu
+#define OP_CMP_LSR_IMM         op_alu
+#define OP_CMP_LSR_REG         op_alu
+#define OP_CMP_ASR_IMM         op_alu
+#define OP_CMP_ASR_REG         op_alu
+#define OP_CMP_ROR_IMM         op_alu
+#define OP_CMP_ROR_REG         op_alu
+#define OP_CMN_LSL_IMM         op_alu
+#define OP_CMN_LSL_REG         op_alu
+#define OP_CMN_LSR_IMM         op_alu
+#define OP_CMN_LSR_REG         op_alu
+#define OP_CMN_ASR_IMM         op_alu
+#define OP_CMN_ASR_REG         op_alu
+#define OP_CMN_ROR_IMM         op_alu
+#define OP_CMN_ROR_REG         op_alu
+#define OP_ORR_LSL_IMM         op_alu
+#define OP_ORR_LSL_REG         op_alu
+#define OP_ORR_LSR_IMM         op_alu
+#define OP_ORR_LSR_REG         op_alu
+#define OP_ORR_ASR_IMM         op_alu
+#define OP_ORR_ASR_REG         op_alu
+#define OP_ORR_ROR_IMM         op_alu
+#define OP_ORR_ROR_REG         op_alu
+#define OP_ORR_S_LSL_IMM       op_alu
+#define OP_ORR_S_LSL_REG       op_alu
+#define OP_ORR_S_LSR_IMM       op_alu
+#define OP_ORR_S_LSR_REG       op_alu
+#define OP_ORR_S_ASR_IMM       op_alu
+#define OP_ORR_S_ASR_REG       op_alu
+#define OP_ORR_S_ROR_IMM       op_alu
+#define OP_ORR_S_ROR_REG       op_alu
+#define OP_MOV_LSL_IMM         op_alu
+#define OP_MOV_LSL_REG         op_alu
+#define OP_MOV_LSR_IMM         op_alu
+#define OP_MOV_LSR_REG         op_alu
+#define OP_MOV_ASR_IMM         op_alu
+#define OP_MOV_ASR_REG         op_alu
+#define OP_MOV_ROR_IMM         op_alu
+#define OP_MOV_ROR_REG         op_alu
+#define OP_MOV_S_LSL_IMM       op_alu
+#define OP_MOV_S_LSL_REG       op_alu
+#define OP_MOV_S_LSR_IMM       op_alu
+#define OP_MOV_S_LSR_REG       op_alu
+#define OP_MOV_S_ASR_IMM       op_alu
+#define OP_MOV_S_ASR_REG       op_alu
+#define OP_MOV_S_ROR_IMM       op_alu
+#define OP_MOV_S_ROR_REG       op_alu
+#define OP_BIC_LSL_IMM         op_alu
+#define OP_BIC_LSL_REG         op_alu
+#define OP_BIC_LSR_IMM         op_alu
+#define OP_BIC_LSR_REG         op_alu
+#define OP_BIC_ASR_IMM         op_alu
+#define OP_BIC_ASR_REG         op_alu
+#define OP_BIC_ROR_IMM         op_alu
+#define OP_BIC_ROR_REG         op_alu
+#define OP_BIC_S_LSL_IMM       op_alu
+#define OP_BIC_S_LSL_REG       op_alu
+#define OP_BIC_S_LSR_IMM       op_alu
+#define OP_BIC_S_LSR_REG       op_alu
+#define OP_BIC_S_ASR_IMM       op_alu
+#define OP_BIC_S_ASR_REG       op_alu
+#define OP_BIC_S_ROR_IMM       op_alu
+#define OP_BIC_S_ROR_REG       op_alu
+#define OP_MVN_LSL_IMM         op_alu
+#define OP_MVN_LSL_REG         op_alu
+#define OP_MVN_LSR_IMM         op_alu
+#define OP_MVN_LSR_REG         op_alu
+#define OP_MVN_ASR_IMM         op_alu
+#define OP_MVN_ASR_REG         op_alu
+#define OP_MVN_ROR_IMM         op_alu
+#define OP_MVN_ROR_REG         op_alu
+#define OP_MVN_S_LSL_IMM       op_alu
+#define OP_MVN_S_LSL_REG       op_alu
+#define OP_MVN_S_LSR_IMM       op_alu
+#define OP_MVN_S_LSR_REG       op_alu
+#define OP_MVN_S_ASR_IMM       op_alu
+#define OP_MVN_S_ASR_REG       op_alu
+#define OP_MVN_S_ROR_IMM       op_alu
+#define OP_MVN_S_ROR_REG       op_alu
+#define OP_AND_IMM_VAL         op_alu
+#define OP_AND_S_IMM_VAL       op_alu
+#define OP_EOR_IMM_VAL         op_alu
+#define OP_EOR_S_IMM_VAL       op_alu
+#define OP_SUB_IMM_VAL         op_alu
+#define OP_SUB_S_IMM_VAL       op_alu
+#define OP_RSB_IMM_VAL         op_alu
+#define OP_RSB_S_IMM_VAL       op_alu
+#define OP_ADD_IMM_VAL         op_alu
+#define OP_ADD_S_IMM_VAL       op_alu
+#define OP_ADC_IMM_VAL         op_alu
+#define OP_ADC_S_IMM_VAL       op_alu
+#define OP_SBC_IMM_VAL         op_alu
+#define OP_SBC_S_IMM_VAL       op_alu
+#define OP_RSC_IMM_VAL         op_alu
+#define OP_RSC_S_IMM_VAL       op_alu
+#define OP_TST_IMM_VAL         op_alu
+#define OP_TEQ_IMM_VAL         op_alu
+#define OP_CMP_IMM_VAL         op_alu
+#define OP_CMN_IMM_VAL         op_alu
+#define OP_ORR_IMM_VAL         op_alu
+#define OP_ORR_S_IMM_VAL       op_alu
+#define OP_MOV_IMM_VAL         op_alu
+#define OP_MOV_S_IMM_VAL       op_alu
+#define OP_BIC_IMM_VAL         op_alu
+#define OP_BIC_S_IMM_VAL       op_alu
+#define OP_MVN_IMM_VAL         op_alu
+#define OP_MVN_S_IMM_VAL       op_alu
+
+#define OP_STR_M_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_IMM_OFF       op_ldr_str
+#define OP_LDR_M_IMM_OFF       op_ldr_str
+#define OP_STR_M_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_IMM_OFF      op_ldr_str
+#define OP_LDRB_M_IMM_OFF      op_ldr_str
+#define OP_STRB_M_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_IMM_OFF       op_ldr_str
+#define OP_LDR_P_IMM_OFF       op_ldr_str
+#define OP_STR_P_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_IMM_OFF      op_ldr_str
+#define OP_LDRB_P_IMM_OFF      op_ldr_str
+#define OP_STRB_P_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_M_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_M_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_M_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_M_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_P_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDR_P_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STRB_P_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_LSL_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_LSR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_ASR_IMM_OFF_POSTIND op_ldr_str
+#define OP_LDRB_P_ROR_IMM_OFF_POSTIND op_ldr_str
+#define OP_STR_M_LSL_IMM_OFF   op_ldr_str
+#define OP_STR_M_LSR_IMM_OFF   op_ldr_str
+#define OP_STR_M_ASR_IMM_OFF   op_ldr_str
+#define OP_STR_M_ROR_IMM_OFF   op_ldr_str
+#define OP_LDR_M_LSL_IMM_OFF   op_ldr_str
+#define OP_LDR_M_LSR_IMM_OFF   op_ldr_str
+#define OP_LDR_M_ASR_IMM_OFF   op_ldr_str
+#define OP_LDR_M_ROR_IMM_OFF   op_ldr_str
+#define OP_STR_M_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_M_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_M_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_M_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_M_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_LSL_IMM_OFF  op_ldr_str
+#define OP_STRB_M_LSR_IMM_OFF  op_ldr_str
+#define OP_STRB_M_ASR_IMM_OFF  op_ldr_str
+#define OP_STRB_M_ROR_IMM_OFF  op_ldr_str
+#define OP_LDRB_M_LSL_IMM_OFF  op_ldr_str
+#define OP_LDRB_M_LSR_IMM_OFF  op_ldr_str
+#define OP_LDRB_M_ASR_IMM_OFF  op_ldr_str
+#define OP_LDRB_M_ROR_IMM_OFF  op_ldr_str
+#define OP_STRB_M_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_M_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_M_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_LSL_IMM_OFF   op_ldr_str
+#define OP_STR_P_LSR_IMM_OFF   op_ldr_str
+#define OP_STR_P_ASR_IMM_OFF   op_ldr_str
+#define OP_STR_P_ROR_IMM_OFF   op_ldr_str
+#define OP_LDR_P_LSL_IMM_OFF   op_ldr_str
+#define OP_LDR_P_LSR_IMM_OFF   op_ldr_str
+#define OP_LDR_P_ASR_IMM_OFF   op_ldr_str
+#define OP_LDR_P_ROR_IMM_OFF   op_ldr_str
+#define OP_STR_P_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_STR_P_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDR_P_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_LSL_IMM_OFF  op_ldr_str
+#define OP_STRB_P_LSR_IMM_OFF  op_ldr_str
+#define OP_STRB_P_ASR_IMM_OFF  op_ldr_str
+#define OP_STRB_P_ROR_IMM_OFF  op_ldr_str
+#define OP_LDRB_P_LSL_IMM_OFF  op_ldr_str
+#define OP_LDRB_P_LSR_IMM_OFF  op_ldr_str
+#define OP_LDRB_P_ASR_IMM_OFF  op_ldr_str
+#define OP_LDRB_P_ROR_IMM_OFF  op_ldr_str
+#define OP_STRB_P_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_STRB_P_ROR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_LSL_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_LSR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_ASR_IMM_OFF_PREIND op_ldr_str
+#define OP_LDRB_P_ROR_IMM_OFF_PREIND op_ldr_str
+
+#define OP_STRH_POS_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRH_POS_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRSB_POS_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRSH_POS_INDE_M_REG_OFF op_ldrh_strh
+#define OP_STRH_POS_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRH_POS_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRSB_POS_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRSH_POS_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_STRH_POS_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRH_POS_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRSB_POS_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRSH_POS_INDE_P_REG_OFF op_ldrh_strh
+#define OP_STRH_POS_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRH_POS_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRSB_POS_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRSH_POS_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_STRH_M_REG_OFF      op_ldrh_strh
+#define OP_LDRH_M_REG_OFF      op_ldrh_strh
+#define OP_LDRSB_M_REG_OFF     op_ldrh_strh
+#define OP_LDRSH_M_REG_OFF     op_ldrh_strh
+#define OP_STRH_PRE_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRH_PRE_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRSB_PRE_INDE_M_REG_OFF op_ldrh_strh
+#define OP_LDRSH_PRE_INDE_M_REG_OFF op_ldrh_strh
+#define OP_STRH_M_IMM_OFF      op_ldrh_strh
+#define OP_LDRH_M_IMM_OFF      op_ldrh_strh
+#define OP_LDRSB_M_IMM_OFF     op_ldrh_strh
+#define OP_LDRSH_M_IMM_OFF     op_ldrh_strh
+#define OP_STRH_PRE_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRH_PRE_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRSB_PRE_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_LDRSH_PRE_INDE_M_IMM_OFF op_ldrh_strh
+#define OP_STRH_P_REG_OFF      op_ldrh_strh
+#define OP_LDRH_P_REG_OFF      op_ldrh_strh
+#define OP_LDRSB_P_REG_OFF     op_ldrh_strh
+#define OP_LDRSH_P_REG_OFF     op_ldrh_strh
+#define OP_STRH_PRE_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRH_PRE_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRSB_PRE_INDE_P_REG_OFF op_ldrh_strh
+#define OP_LDRSH_PRE_INDE_P_REG_OFF op_ldrh_strh
+#define OP_STRH_P_IMM_OFF      op_ldrh_strh
+#define OP_LDRH_P_IMM_OFF      op_ldrh_strh
+#define OP_LDRSB_P_IMM_OFF     op_ldrh_strh
+#define OP_LDRSH_P_IMM_OFF     op_ldrh_strh
+#define OP_STRH_PRE_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRH_PRE_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRSB_PRE_INDE_P_IMM_OFF op_ldrh_strh
+#define OP_LDRSH_PRE_INDE_P_IMM_OFF op_ldrh_strh
+
+//-----------------------------------------------------------------------------
+//   Unimplemented; fall back to the C versions
+//-----------------------------------------------------------------------------
+
+#define OP_MUL                 NULL
+#define OP_LDRD_STRD_POST_INDEX NULL
+#define OP_MUL_S               NULL
+#define OP_MLA                 NULL
+#define OP_UND                 NULL
+#define OP_MLA_S               NULL
+#define OP_UMULL               NULL
+#define OP_UMULL_S             NULL
+#define OP_UMLAL               NULL
+#define OP_UMLAL_S             NULL
+#define OP_SMULL               NULL
+#define OP_SMULL_S             NULL
+#define OP_SMLAL               NULL
+#define OP_SMLAL_S             NULL
+#define OP_MRS_CPSR            NULL
+#define OP_QADD                NULL
+#define OP_SMLA_B_B            NULL
+#define OP_SWP                 NULL
+#define OP_SMLA_T_B            NULL
+#define OP_SMLA_B_T            NULL
+#define OP_LDRD_STRD_OFFSET_PRE_INDEX NULL
+#define OP_SMLA_T_T            NULL
+#define OP_MSR_CPSR            NULL
+#define OP_QSUB                NULL
+#define OP_BKPT                NULL
+#define OP_SMLAW_B             NULL
+#define OP_SMULW_B             NULL
+#define OP_SMLAW_T             NULL
+#define OP_SMULW_T             NULL
+#define OP_MRS_SPSR            NULL
+#define OP_QDADD               NULL
+#define OP_SMLAL_B_B           NULL
+#define OP_SWPB                NULL
+#define OP_SMLAL_T_B           NULL
+#define OP_SMLAL_B_T           NULL
+#define OP_SMLAL_T_T           NULL
+#define OP_MSR_SPSR            NULL
+#define OP_QDSUB               NULL
+#define OP_SMUL_B_B            NULL
+#define OP_SMUL_T_B            NULL
+#define OP_SMUL_B_T            NULL
+#define OP_SMUL_T_T            NULL
+#define OP_STREX               NULL
+#define OP_LDREX               NULL
+#define OP_MSR_CPSR_IMM_VAL    NULL
+#define OP_MSR_SPSR_IMM_VAL    NULL
+#define OP_STMDA2              NULL
+#define OP_LDMDA2              NULL
+#define OP_STMDA2_W            NULL
+#define OP_LDMDA2_W            NULL
+#define OP_STMIA2              NULL
+#define OP_LDMIA2              NULL
+#define OP_STMIA2_W            NULL
+#define OP_LDMIA2_W            NULL
+#define OP_STMDB2              NULL
+#define OP_LDMDB2              NULL
+#define OP_STMDB2_W            NULL
+#define OP_LDMDB2_W            NULL
+#define OP_STMIB2              NULL
+#define OP_LDMIB2              NULL
+#define OP_STMIB2_W            NULL
+#define OP_LDMIB2_W            NULL
+#define OP_STC_OPTION          NULL
+#define OP_LDC_OPTION          NULL
+#define OP_STC_M_POSTIND       NULL
+#define OP_LDC_M_POSTIND       NULL
+#define OP_STC_P_POSTIND       NULL
+#define OP_LDC_P_POSTIND       NULL
+#define OP_STC_M_IMM_OFF       NULL
+#define OP_LDC_M_IMM_OFF       NULL
+#define OP_STC_M_PREIND        NULL
+#define OP_LDC_M_PREIND        NULL
+#define OP_STC_P_IMM_OFF       NULL
+#define OP_LDC_P_IMM_OFF       NULL
+#define OP_STC_P_PREIND        NULL
+#define OP_LDC_P_PREIND        NULL
+#define OP_CDP                 NULL
+#define OP_MCR                 NULL
+#define OP_MRC                 NULL
+#define OP_SWI                 NULL
+
+#define OP_LSL_REG             NULL
+#define OP_LSR_REG             NULL
+#define OP_ASR_REG             NULL
+#define OP_ROR_REG             NULL
+#define OP_MUL_REG             NULL
+#define OP_UND_THUMB           NULL
+#define OP_BKPT_THUMB          NULL
+#define OP_SWI_THUMB           NULL
+
+//-----------------------------------------------------------------------------
+//   Dispatch table
+//-----------------------------------------------------------------------------
+
+typedef int (*ArmOpCompiler)(u32);
+static const ArmOpCompiler arm_instruction_compilers[4096] = {
+#define TABDECL(x) x
+#include "instruction_tabdef.inc"
+#undef TABDECL
+};
+
+static const ArmOpCompiler thumb_instruction_compilers[1024] = {
+#define TABDECL(x) x
+#include "thumb_tabdef.inc"
+#undef TABDECL
+};
+
+//-----------------------------------------------------------------------------
+//   Generic instruction wrapper
+//-----------------------------------------------------------------------------
+
+template<int PROCNUM, int thumb>
+static u32 FASTCALL OP_DECODE()
+{
+	u32 cycles;
+	u32 adr = cpu->instruct_adr;
+	if(thumb)
+	{
+		cpu->next_instruction = adr + 2;
+		cpu->R[15] = adr + 4;
+		u32 opcode = _MMU_read16<PROCNUM, MMU_AT_CODE>(adr);
+		if(armtrace_active) armtrace_write(PROCNUM, adr, opcode, ARMTRACE_THUMB, armtrace_lastCycle(PROCNUM), cpu);
+		cycles = thumb_instructions_set[PROCNUM][opcode>>6](opcode);
+	}
+	else
+	{
+		cpu->next_instruction = adr + 4;
+		cpu->R[15] = adr + 8;
+		u32 opcode = _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+		if(armtrace_active) armtrace_write(PROCNUM, adr, opcode, 0, armtrace_lastCycle(PROCNUM), cpu);
+		if(CONDITION(opcode) == 0xE || TEST_COND(CONDITION(opcode), CODE(opcode), cpu->CPSR))
+			cycles = arm_instructions_set[PROCNUM][INSTRUCTION_INDEX(opcode)](opcode);
+		else
+			cycles = 1;
+	}
+	cpu->instruct_adr = cpu->next_instruction;
+	return cycles;
+}
+
+static const ArmOpCompiled op_decode[2][2] = { OP_DECODE<0,0>, OP_DECODE<0,1>, OP_DECODE<1,0>, OP_DECODE<1,1> };
+
+//-----------------------------------------------------------------------------
+//   Compiler
+//-----------------------------------------------------------------------------
+
+static u32 instr_attributes(u32 opcode, bool thumb)
+{
+	return thumb ? thumb_attributes[opcode>>6]
+		 : instruction_attributes[INSTRUCTION_INDEX(opcode)];
+}
+
+static u32 instr_attributes(u32 opcode) { return instr_attributes(opcode, bb_thumb); }
+
+static bool instr_is_branch(u32 opcode, bool thumb)
+{
+	u32 x = instr_attributes(opcode, thumb);
+
+	if(thumb)
+	{
+		// merge OP_BL_10+OP_BL_11
+		if (x & MERGE_NEXT) return false;
+		return (x & BRANCH_ALWAYS)
+		    || ((x & BRANCH_POS0) && ((opcode&7) | ((opcode>>4)&8)) == 15)
+			|| (x & BRANCH_SWI)
+		    || (x & JIT_BYPASS);
+	}
+	else
+		return (x & BRANCH_ALWAYS)
+		    || ((x & BRANCH_POS12) && REG_POS(opcode,12) == 15)
+		    || ((x & BRANCH_LDM) && BIT15(opcode))
+			|| (x & BRANCH_SWI)
+		    || (x & JIT_BYPASS);
+}
+
+static bool instr_is_branch(u32 opcode) { return instr_is_branch(opcode, bb_thumb); }
+
+// a block goes on past the branches whose way is known when it is compiled: a direct unconditional branch forward
+// is followed to where it goes, and a conditional one forward is taken as not taken, leaving the block through a
+// side exit when it is. an if/else or the body of a loop is one block then rather than three or four. a branch
+// back still ends the block, so the addresses only ever go up along it and a loop is still a block that ends
+// where it starts (see checkIdleLoop).
+// it keeps to the 16KB of compiled_funcs the block starts in, so that arm_jit_invalidate_pages drops it along with
+// the code it ran over, and while there are breakpoints blocks are straight runs of code, for arm_jit_set_breakpoint
+enum { TRACE_NEXT, TRACE_END, TRACE_FOLLOW, TRACE_SIDE_EXIT };
+
+// what the block does at the op at adr, with dst set to where the branch goes for TRACE_FOLLOW and TRACE_SIDE_EXIT
+static int trace_step(u32 opcode, bool thumb, u32 adr, u32 start_adr, u32 &dst)
+{
+	if(!instr_is_branch(opcode, thumb))
+		return TRACE_NEXT;
+	if(arm_jit_breakpoint_count)
+		return TRACE_END;
+
+	bool conditional;
+	if(thumb)
+	{
+		if((opcode >> 11) == 0x1C)
+		{
+			conditional = false;
+			dst = adr + 4 + (SIGNEXTEND_11(opcode) << 1);
+		}
+		else if((opcode >> 12) == 0xD && ((opcode >> 8) & 0xF) < 0xE)
+		{
+			conditional = true;
+			dst = adr + 4 + ((u32)(s8)(opcode & 0xFF) << 1);
+		}
+		else
+			return TRACE_END;
+	}
+	else
+	{
+		// B, not BL or BLX
+		if((opcode & 0x0F000000) != 0x0A000000 || CONDITION(opcode) == 0xF)
+			return TRACE_END;
+		conditional = CONDITION(opcode) != 0xE;
+		dst = adr + 8 + (SIGNEXTEND_24(opcode) << 2);
+	}
+	if(dst <= adr || (dst >> (JIT_PAGE_BITS + 1)) != (start_adr >> (JIT_PAGE_BITS + 1)))
+		return TRACE_END;
+	return conditional ? TRACE_SIDE_EXIT : TRACE_FOLLOW;
+}
+
+static bool instr_uses_r15(u32 opcode)
+{
+	u32 x = instr_attributes(opcode);
+	if(bb_thumb)
+		return ((x & SRCREG_POS0) && ((opcode&7) | ((opcode>>4)&8)) == 15)
+			|| ((x & SRCREG_POS3) && REG_POS(opcode,3) == 15)
+			|| (x & JIT_BYPASS);
+	else
+		return ((x & SRCREG_POS0) && REG_POS(opcode,0) == 15)
+		    || ((x & SRCREG_POS8) && REG_POS(opcode,8) == 15)
+		    || ((x & SRCREG_POS12) && REG_POS(opcode,12) == 15)
+		    || ((x & SRCREG_POS16) && REG_POS(opcode,16) == 15)
+		    || ((x & SRCREG_STM) && BIT15(opcode))
+		    || (x & JIT_BYPASS);
+}
+
+static bool instr_is_conditional(u32 opcode)
+{
+	if(bb_thumb) return false;
+
+	return !(CONDITION(opcode) == 0xE
+	         || (CONDITION(opcode) == 0xF && CODE(opcode) == 5));
+}
+
+static int instr_cycles(u32 opcode)
+{
+	u32 x = instr_attributes(opcode);
+	u32 c = (x & INSTR_CYCLES_MASK);
+	if(c == INSTR_CYCLES_VARIABLE)
+	{
+		if ((x & BRANCH_SWI) && !cpu->swi_tab)
+			return 3;
+
+		return 0;
+	}
+	if(instr_is_branch(opcode) && !(instr_attributes(opcode) & (BRANCH_ALWAYS|BRANCH_LDM)))
+		c += 2;
+	return c;
+}
+
+static bool instr_does_prefetch(u32 opcode)
+{
+	u32 x = instr_attributes(opcode);
+	if(bb_thumb)
+		return thumb_instruction_compilers[opcode>>6]
+			   && (x & BRANCH_ALWAYS);
+	else
+		return instr_is_branch(opcode) && arm_instruction_compilers[INSTRUCTION_INDEX(opcode)]
+			   && ((x & BRANCH_ALWAYS) || (x & BRANCH_LDM));
+}
+
+// the next instruction of a block that doesn't end in a branch is stored by the block itself
+static void sync_r15(u32 opcode, bool force)
+{
+	if(instr_does_prefetch(opcode))
+	{
+		if(force)
+		{
+			a64_mov32(RTMP0, bb_next_instruction);
+			a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+		}
+	}
+	else
+	{
+		if(force || (instr_attributes(opcode) & JIT_BYPASS) || (instr_attributes(opcode) & BRANCH_SWI))
+		{
+			a64_mov32(RTMP0, bb_next_instruction);
+			a64_str_cpu(RTMP0, cpu_off(next_instruction));
+		}
+		if(instr_uses_r15(opcode))
+		{
+			r15_dirty = true;
+			r15_value = bb_r15;
+		}
+		if(instr_attributes(opcode) & JIT_BYPASS)
+		{
+			a64_mov32(RTMP0, bb_adr);
+			a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+		}
+	}
+}
+
+static void emit_armop_call(u32 opcode)
+{
+	ArmOpCompiler fc = bb_thumb?	thumb_instruction_compilers[opcode>>6]:
+									arm_instruction_compilers[INSTRUCTION_INDEX(opcode)];
+	if (fc && fc(opcode))
+		return;
+
+	// the interpreter may read and write any register
+	regs_flush();
+	a64_mov32(W0, opcode);
+	OpFunc f = bb_thumb ? thumb_instructions_set[PROCNUM][opcode>>6]
+	                     : arm_instructions_set[PROCNUM][INSTRUCTION_INDEX(opcode)];
+	a64_call((const void*)f);
+	regs_discard();
+}
+
+static void emit_prologue()
+{
+	emit(0xA9BA7BFD);	// stp x29, x30, [sp, #-96]!
+	emit(0x910003FD);	// mov x29, sp
+	for(int r = 19; r < 29; r += 2)
+		emit(0xA9000000 | ((r - 17) << 15) | ((r + 1) << 10) | (31 << 5) | r);	// stp xr, xr+1, [sp, #(r-17)*8]
+}
+
+static void emit_epilogue(bool ret = true)
+{
+	for(int r = 19; r < 29; r += 2)
+		emit(0xA9400000 | ((r - 17) << 15) | ((r + 1) << 10) | (31 << 5) | r);	// ldp xr, xr+1, [sp, #(r-17)*8]
+	emit(0xA8C67BFD);	// ldp x29, x30, [sp], #96
+	if(ret)
+		emit(0xD65F03C0);	// ret
+}
+
+// with the block's cycles in W0: jump straight on to the block at the next pc if the dispatcher
+// would only have called it. that goes through the block table rather than a patched branch, so
+// an invalidated block is never entered again and a return (bx lr, pop {pc}) is followed exactly.
+static void emit_chain()
+{
+	a64_mov64(RTMP0, (uintptr_t)&arm_jit_chain);
+	emit(0xB9400000 | (RTMP0 << 5) | RTMP1);	// ldr w10, [x9]		budget
+	emit(0xB9400400 | (RTMP0 << 5) | RTMP2);	// ldr w11, [x9, #4]	cycles
+	a64_alu_reg(A64_ADD, RTMP2, RTMP2, W0);
+	a64_alu_reg(A64_SUBS, RZR, RTMP2, RTMP1);
+	u32 *over_budget = a64_bcond(CC_GT);
+
+	// the loop doesn't run a cpu that is halted or waits for the bus
+	a64_ldr_cpu(W1, cpu_off(waitIRQ));
+	u32 *halted = a64_cbnz(W1);
+	a64_mov64(W1, (uintptr_t)&nds.freezeBus);
+	emit(0xB9400000 | (W1 << 5) | W1);			// ldr w1, [x1]
+	u32 *frozen = a64_cbnz(W1);
+
+	// the pc as the dispatcher aligns it: ~3 in arm mode, ~1 in thumb mode
+	a64_ldr_cpu(W1, cpu_off(CPSR));
+	a64_ubfx(W1, W1, 5, 1);
+	a64_mov32(W2, 0xFFFFFFFC);
+	a64_alu_reg(A64_ADD, W2, W2, W1, SH_LSL, 1);
+	a64_ldr_cpu(W1, cpu_off(instruct_adr));
+	a64_alu_reg(A64_AND, W1, W1, W2);
+	a64_str_cpu(W1, cpu_off(instruct_adr));
+
+	// JIT_COMPILED_FUNC
+	a64_ubfx(W2, W1, JIT_PAGE_BITS + 1, 26 - JIT_PAGE_BITS);
+	a64_ubfx(W1, W1, 1, JIT_PAGE_BITS);
+	a64_mov64(RIP, (uintptr_t)compiled_funcs);
+	emit(0xF8607800 | (W2 << 16) | (RIP << 5) | RIP);	// ldr x16, [x16, x2, lsl #3]
+	emit(0xF8607800 | (W1 << 16) | (RIP << 5) | RIP);	// ldr x16, [x16, x1, lsl #3]
+	u32 *missing = a64_cbz(RIP, true);
+
+	emit(0xB9000400 | (RTMP0 << 5) | RTMP2);	// str w11, [x9, #4]
+	emit_epilogue(false);
+	emit(0xD61F0000 | (RIP << 5));				// br x16
+
+	a64_bind(over_budget);
+	a64_bind(halted);
+	a64_bind(frozen);
+	a64_bind(missing);
+}
+
+// leaves the block where the branch at bb_adr goes if it is taken, with extra_cycles more than the block took
+// up to it. the registers stay cached as they are for the code that stays in the block
+static void emit_side_exit(u32 dst, u32 extra_cycles)
+{
+	for(int s = 0; s < CACHE_SLOTS; s++)
+		if(slot_reg[s] >= 0 && slot_dirty[s])
+			a64_str_cpu(RCACHE + s, reg_off(slot_reg[s]));
+	a64_mov32(RTMP0, dst);
+	a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+	a64_add_const(W0, RCYC, bb_constant_cycles + extra_cycles);
+	emit_chain();
+	emit_epilogue();
+}
+
+static bool init_code_buffer()
+{
+	if(code_buffer)
+		return true;
+	const uintptr_t size = (uintptr_t)CommonSettings.jit_cache_size << 20;
+	void *p = mmap(NULL, size, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+	{
+		fprintf(stderr, "JIT: mmap failed: %s\n", strerror(errno));
+		return false;
+	}
+	code_buffer = (u32*)p;
+	code_size = size;
+	u8 *end;
+	code_ptr = (u32*)arm_jit_code_reset((u8*)code_buffer, code_size, &end);
+	code_end = (u32*)end;
+	return true;
+}
+
+// what the worker compiled, for the emulation thread to install (see Tiering below)
+struct CompiledBlock
+{
+	u32 adr;
+	bool thumb;
+	int proc;
+	u32 *code;		// NULL if the code cache had no room for it
+	u32 ops;
+	u32 hash;		// of the opcodes it was compiled from
+	u32 literals;
+	u32 literal_adr[BB_LITERALS];
+	u32 literal_value[BB_LITERALS];
+};
+
+// guards the words the block at adr was compiled with, false if one of them isn't what it was any more
+static bool literals_install(int proc, u32 adr, u32 count, const u32 *literal_adr, const u32 *literal_value)
+{
+	for(u32 i = 0; i < count; i++)
+		if(!arm_jit_literal_use(proc, literal_adr[i], literal_value[i], adr))
+			return false;
+	return true;
+}
+
+static u32 block_hash(u32 hash, u32 opcode) { return (hash ^ opcode) * 16777619u; }
+#define BLOCK_HASH_SEED 2166136261u
+
+// runs the block as it is compiled, unless interpret is false, which is how the profile and the worker compile
+// ahead. with out the block is left for the caller to install
+template<int PROCNUM>
+static u32 compile_basicblock(u32 start_adr, bool thumb, bool interpret, CompiledBlock *out = NULL)
+{
+	u32 interpreted_cycles = 0;
+	u32 opcode = 0;
+	u32 hash = BLOCK_HASH_SEED;
+	if(out)
+		out->code = NULL;
+
+	bb_thumb = thumb;
+	bb_opcodesize = bb_thumb ? 2 : 4;
+
+	if (!JIT_MAPPED(start_adr & 0x0FFFFFFF, PROCNUM))
+	{
+		CORELOG_INFO("JIT: use unmapped memory address %08X\n", start_adr);
+		execute = false;
+		return 1;
+	}
+
+	if(!init_code_buffer())
+	{
+		if(!interpret)
+			return 0;
+		ArmOpCompiled f = op_decode[PROCNUM][bb_thumb];
+		JIT_INSTALL_FUNC(start_adr, PROCNUM, f);
+		return f();
+	}
+	if((uintptr_t)(code_end - code_ptr) < (CommonSettings.jit_max_block_size + 1) * MAX_OP_WORDS)
+	{
+		// compiling ahead only fills segments that were never used, it doesn't push out what the game runs
+		u8 *end;
+		u8 *next = arm_jit_code_next_segment(&end, interpret);
+		if(!next)
+			return 0;
+		code_ptr = (u32*)next;
+		code_end = (u32*)end;
+	}
+
+	u32 *block = code_ptr;
+	emit_prologue();
+	a64_mov64(RCPU, (uintptr_t)&ARMPROC);
+	a64_mov32(RCYC, 0);
+	regs_reset();
+	bb_literal_count = 0;
+
+	// the trace the block takes, and the flag updates along it that are overwritten before anything reads them.
+	// a side exit leaves them all to the code it goes to, so the flags are looked at up to each one on its own
+	u32 scanned = 0;
+	for(u32 adr = start_adr, end = 0; !end && scanned < BB_SCAN_OPS; scanned++)
+	{
+		u32 &op = bb_ops[scanned];
+		op = bb_thumb ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+		bb_ops_adr[scanned] = adr;
+		bb_ops_step[scanned] = trace_step(op, bb_thumb, adr, start_adr, bb_ops_dst[scanned]);
+		// a breakpoint on the next op has to be where a block starts, see arm_jit_set_breakpoint
+		end = bb_ops_step[scanned] == TRACE_END || (scanned >= (CommonSettings.jit_max_block_size - 1))
+			|| arm_jit_break_after(PROCNUM, adr, bb_opcodesize);
+		adr = bb_ops_step[scanned] == TRACE_FOLLOW ? bb_ops_dst[scanned] : adr + bb_opcodesize;
+	}
+	for(u32 i = 0, first = 0; i < scanned; i++)
+		if(bb_ops_step[i] == TRACE_SIDE_EXIT || i == scanned - 1)
+		{
+			instr_dead_flags(bb_ops + first, i + 1 - first, bb_thumb, bb_ops_flags_unused + first);
+			first = i + 1;
+		}
+
+	bb_constant_cycles = 0;
+	bool running = interpret;
+	for(u32 i = 0; i < scanned; i++)
+	{
+		bb_adr = bb_ops_adr[i];
+		opcode = bb_ops[i];
+		hash = block_hash(hash, opcode);
+		bb_flags_unused = bb_ops_flags_unused[i];
+
+		u32 cycles = instr_cycles(opcode);
+		const bool bEndBlock = i == scanned - 1;
+		const int step = bEndBlock ? TRACE_END : bb_ops_step[i];
+
+		if(step == TRACE_FOLLOW)
+		{
+			// nothing to do but count it, the op after it is compiled where it goes
+			bb_constant_cycles += cycles;
+		}
+		else if(step == TRACE_SIDE_EXIT)
+		{
+			// taken it costs what the branch does at the end of a block: 2 more than not taken
+			bb_constant_cycles += 1;
+			u32 *stay = emit_branch_unless(bb_thumb ? (opcode >> 8) & 0xF : CONDITION(opcode));
+			emit_side_exit(bb_ops_dst[i], bb_thumb ? 2 : cycles - 1);
+			a64_bind(stay);
+		}
+		else if(instr_is_conditional(opcode))
+		{
+			// both paths have to agree on which guest registers are cached where, so the
+			// skipped path must not see anything the op loaded or wrote
+			if(bEndBlock) sync_r15(opcode, true);
+			bb_constant_cycles += 1;
+			regs_flush();
+			int cached[CACHE_SLOTS];
+			memcpy(cached, slot_reg, sizeof(cached));
+			const u32 known = known_mask;
+			u32 known_values[16];
+			memcpy(known_values, known_value, sizeof(known_values));
+			u32 *skip = emit_branch_unless(CONDITION(opcode));
+			if(!bEndBlock) sync_r15(opcode, false);
+			emit_armop_call(opcode);
+
+			if(cycles == 0)
+			{
+				a64_alu_reg(A64_ADD, RCYC, RCYC, W0);
+				a64_addsub_imm(A64_SUB, RCYC, RCYC, 1);
+			}
+			else
+				if (cycles > 1)
+					a64_addsub_imm(A64_SUB, RCYC, RCYC, 1);
+
+			regs_flush();
+			for(int s = 0; s < CACHE_SLOTS; s++)
+				if(slot_reg[s] != cached[s] && slot_reg[s] >= 0)
+					slot_free(s);
+			// and that the op didn't run, for what is known
+			known_mask &= known;
+			for(int r = 0; r < 16; r++)
+				if(known_value[r] != known_values[r])
+					known_mask &= ~(1 << r);
+			a64_bind(skip);
+		}
+		else
+		{
+			bb_constant_cycles += cycles;
+			sync_r15(opcode, false);
+			emit_armop_call(opcode);
+			if(cycles == 0)
+				a64_alu_reg(A64_ADD, RCYC, RCYC, W0);
+		}
+		// the interpreter stops where it left the trace
+		if(running)
+		{
+			interpreted_cycles += op_decode[PROCNUM][bb_thumb]();
+			running = !bEndBlock && cpu->instruct_adr == bb_ops_adr[i + 1];
+		}
+	}
+
+	// nothing after the block reads R15 from cpu->R[]
+	r15_dirty = false;
+	regs_flush();
+
+	if(!instr_is_branch(opcode))
+	{
+		a64_mov32(RTMP0, bb_next_instruction);
+		a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+	}
+	else if(!instr_does_prefetch(opcode))
+	{
+		a64_ldr_cpu(RTMP0, cpu_off(next_instruction));
+		a64_str_cpu(RTMP0, cpu_off(instruct_adr));
+	}
+
+	a64_add_const(W0, RCYC, bb_constant_cycles);
+	emit_chain();
+	emit_epilogue();
+
+	__builtin___clear_cache((char*)block, (char*)code_ptr);
+
+	const u32 ops = scanned;
+	arm_jit_code_block(start_adr);
+	if(out)
+	{
+		out->code = block;
+		out->ops = ops;
+		out->hash = hash;
+		out->literals = bb_literal_count;
+		memcpy(out->literal_adr, bb_literal_adr, sizeof(bb_literal_adr));
+		memcpy(out->literal_value, bb_literal_value, sizeof(bb_literal_value));
+		return 0;
+	}
+	// what the interpreter ran of it may have stored to one, the compiling for the next time it runs sees that
+	if(!literals_install(PROCNUM, start_adr, bb_literal_count, bb_literal_adr, bb_literal_value))
+		return interpreted_cycles;
+	JIT_INSTALL_FUNC(start_adr, PROCNUM, block);
+	arm_jit_profile_record(PROCNUM, start_adr, bb_thumb, ops);
+	return interpreted_cycles;
+}
+
+// runs the block at start_adr in the interpreter, up to where compile_basicblock would end it
+template<int PROCNUM>
+static u32 interpret_basicblock(u32 start_adr, bool thumb)
+{
+	const u32 opsize = thumb ? 2 : 4;
+	u32 cycles = 0;
+	for(u32 i = 0, adr = start_adr; ; i++)
+	{
+		const u32 opcode = thumb ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+		u32 dst;
+		const int step = trace_step(opcode, thumb, adr, start_adr, dst);
+		const bool end = step == TRACE_END || (i >= (CommonSettings.jit_max_block_size - 1))
+			|| arm_jit_break_after(PROCNUM, adr, opsize);
+		cycles += op_decode[PROCNUM][thumb]();
+		adr = step == TRACE_FOLLOW ? dst : adr + opsize;
+		// or where a side exit was taken
+		if(end || cpu->instruct_adr != adr)
+			return cycles;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//   Tiering
+//-----------------------------------------------------------------------------
+// a block is run by the interpreter the first JIT_HOT_RUNS times it is got to, and on the last of them it is handed
+// to a worker thread to compile while the interpreter keeps running it. code that only ever runs once, which is most
+// of what runs while a level loads, never gets compiled then, and the rest doesn't hold up the emulation while it is.
+// the worker compiles a batch at a time, and while it has one it is the only thing compiling: the emulation thread
+// waits for it before compiling anything itself (which is also the only time it evicts a segment, so the worker
+// never does, and the blocks that run while it compiles are never overwritten under them). what it compiled is
+// installed by the emulation thread, once the code it was compiled from is seen to be the same still: the stores to
+// it in the meantime had nothing in compiled_funcs to throw away.
+// the interpreter takes as many cycles for a block as the compiled one, so when it gets compiled changes nothing.
+#define JIT_HOT_RUNS	2
+// the run counts of a block that is in a batch, and of one that has to be compiled right away
+#define JIT_RUNS_QUEUED	JIT_HOT_RUNS
+#define JIT_RUNS_NOW	0xFF
+#define JIT_BATCH		32
+
+static Task bg_task;
+static bool bg_started = false;
+static bool bg_enabled = false;
+static CompiledBlock bg_batches[2][JIT_BATCH];
+static u32 bg_count[2];
+static int bg_next = 0;			// the batch the emulation thread fills, the other one is the worker's
+static bool bg_busy = false;	// the worker's batch was handed to it and not installed yet
+static bool bg_done = false;	// set by the worker once it compiled its batch
+
+// the code the worker can read without touching anything but plain memory: main memory, wram and the itcm
+template<int PROCNUM>
+static bool bg_compilable(u32 adr)
+{
+	const u32 top = adr >> 24;
+	return top == 0x02 || top == 0x03 || (PROCNUM == ARMCPU_ARM9 && top < 0x02);
+}
+
+static void *bg_compile(void *param)
+{
+	const int b = (int)(intptr_t)param;
+	for(u32 i = 0; i < bg_count[b]; i++)
+	{
+		CompiledBlock &blk = bg_batches[b][i];
+		*PROCNUM_ptr = blk.proc;
+		if(blk.proc == ARMCPU_ARM9)
+			compile_basicblock<ARMCPU_ARM9>(blk.adr, blk.thumb, false, &blk);
+		else
+			compile_basicblock<ARMCPU_ARM7>(blk.adr, blk.thumb, false, &blk);
+	}
+	__atomic_store_n(&bg_done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+template<int PROCNUM>
+static bool bg_same_code(const CompiledBlock &blk)
+{
+	// along the trace as the code is now, which only goes where the block did if the ops are the same
+	u32 hash = BLOCK_HASH_SEED;
+	for(u32 i = 0, adr = blk.adr; i < blk.ops; i++)
+	{
+		const u32 opcode = blk.thumb ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+		hash = block_hash(hash, opcode);
+		u32 dst;
+		adr = trace_step(opcode, blk.thumb, adr, blk.adr, dst) == TRACE_FOLLOW ? dst : adr + (blk.thumb ? 2 : 4);
+	}
+	return hash == blk.hash;
+}
+
+// waits for the worker's batch and installs it, or with discard drops it (and the one being filled)
+static void bg_finish(bool discard)
+{
+	if(discard)
+		bg_count[bg_next] = 0;
+	if(!bg_busy)
+		return;
+	bg_task.finish();
+	bg_busy = false;
+	__atomic_store_n(&bg_done, false, __ATOMIC_RELAXED);
+
+	const int b = bg_next ^ 1;
+	const u32 count = bg_count[b];
+	bg_count[b] = 0;
+	if(discard)
+		return;
+
+	bool installed = false;
+	for(u32 i = 0; i < count; i++)
+	{
+		const CompiledBlock &blk = bg_batches[b][i];
+		u8 &runs = JIT_RUN_COUNT(blk.adr);
+		if(!blk.code)
+		{
+			// the cache is full, and making room evicts a segment, which only the emulation thread can
+			runs = JIT_RUNS_NOW;
+			continue;
+		}
+		// counted again from the start if the block is thrown away later on
+		runs = 0;
+		if(JIT_COMPILED_FUNC(blk.adr, blk.proc) != 0 || arm_jit_breakpoint_count)
+			continue;
+		if(!(blk.proc == ARMCPU_ARM9 ? bg_same_code<ARMCPU_ARM9>(blk) : bg_same_code<ARMCPU_ARM7>(blk)))
+			continue;
+		if(!literals_install(blk.proc, blk.adr, blk.literals, blk.literal_adr, blk.literal_value))
+			continue;
+		JIT_INSTALL_FUNC(blk.adr, blk.proc, blk.code);
+		arm_jit_profile_record(blk.proc, blk.adr, blk.thumb, blk.ops);
+		installed = true;
+	}
+	// the worker wrote the code from another core, and cleaned the cache over it there
+	if(installed)
+		__asm__ __volatile__("isb" ::: "memory");
+}
+
+// installs the worker's batch if it is done, and hands it the next one
+static void bg_kick()
+{
+	if(bg_busy)
+	{
+		if(!__atomic_load_n(&bg_done, __ATOMIC_ACQUIRE))
+			return;
+		bg_finish(false);
+	}
+	if(!bg_count[bg_next])
+		return;
+	if(!bg_started)
+	{
+		bg_task.start(false, "JIT compiler", THREAD_ROLE_WORKER);
+		bg_started = true;
+	}
+	const int b = bg_next;
+	bg_next ^= 1;
+	bg_busy = true;
+	bg_task.execute(bg_compile, (void*)(intptr_t)b);
+}
+
+template<int PROCNUM> u32 arm_jit_compile()
+{
+	u32 adr = cpu->instruct_adr;
+	const bool thumb = cpu->CPSR.bits.T;
+
+	if(bg_enabled)
+	{
+		// what the worker did may be the block that is missing
+		if(arm_jit_breakpoint_count)
+			bg_finish(false);
+		else
+			bg_kick();
+		ArmOpCompiled f = (ArmOpCompiled)JIT_COMPILED_FUNC(adr, PROCNUM);
+		if(f)
+			return f();
+	}
+
+	// prevent endless recompilation of self-modifying code, which would keep pushing everything else out of the code cache.
+	u8 &count = JIT_RECOMPILE_COUNT(adr);
+	u32 shift = 4*((adr >> 4) & 1);
+	if(((count >> shift) & 0xF) > 8)
+	{
+		ArmOpCompiled f = op_decode[PROCNUM][thumb];
+		JIT_INSTALL_FUNC(adr, PROCNUM, f);
+		return f();
+	}
+
+	if(bg_enabled && !arm_jit_breakpoint_count && bg_compilable<PROCNUM>(adr))
+	{
+		u8 &runs = JIT_RUN_COUNT(adr);
+		if(runs < JIT_HOT_RUNS - 1)
+			runs++;
+		else if(runs == JIT_HOT_RUNS - 1 && bg_count[bg_next] < JIT_BATCH)
+		{
+			runs = JIT_RUNS_QUEUED;
+			count += 1 << shift;
+			CompiledBlock &blk = bg_batches[bg_next][bg_count[bg_next]++];
+			blk.adr = adr;
+			blk.thumb = thumb;
+			blk.proc = PROCNUM;
+			bg_kick();
+		}
+		if(runs != JIT_RUNS_NOW)
+			return interpret_basicblock<PROCNUM>(adr, thumb);
+		runs = 0;
+		bg_finish(false);
+	}
+
+	*PROCNUM_ptr = PROCNUM;
+	count += 1 << shift;
+	return compile_basicblock<PROCNUM>(adr, thumb, true);
+}
+
+template u32 arm_jit_compile<0>();
+template u32 arm_jit_compile<1>();
+
+template<int PROCNUM> bool arm_jit_precompile(u32 adr, bool thumb)
+{
+	if(arm_jit_breakpoint_count && arm_jit_breakpoint_at(PROCNUM, adr))
+		return true;
+	bg_finish(false);
+	*PROCNUM_ptr = PROCNUM;
+	compile_basicblock<PROCNUM>(adr, thumb, false);
+	return JIT_COMPILED_FUNC(adr, PROCNUM) != 0;
+}
+
+template bool arm_jit_precompile<0>(u32 adr, bool thumb);
+template bool arm_jit_precompile<1>(u32 adr, bool thumb);
+
+void arm_jit_reset(bool enable, bool suppress_msg)
+{
+	if (!suppress_msg)
+		CORELOG_INFO("CPU mode: %s\n", enable?"JIT":"Interpreter");
+	saveBlockSizeJIT = CommonSettings.jit_max_block_size;
+
+	// nothing the worker compiled is in compiled_funcs yet, so none of it is running
+	bg_finish(true);
+	bg_enabled = enable && getOnlineCores() > 1;
+
+	// the interpreter keeps the opcodes it fetched in the same pages
+	arm_jit_free_pages();
+
+	if (enable)
+	{
+		CORELOG_INFO("JIT: max block size %d instruction(s)\n", CommonSettings.jit_max_block_size);
+
+		// every block is gone from compiled_funcs[] now, so the code can be overwritten,
+		// or unmapped if the cache size was changed; init_code_buffer maps it again
+		if(code_buffer && code_size != ((uintptr_t)CommonSettings.jit_cache_size << 20))
+		{
+			munmap(code_buffer, code_size);
+			code_buffer = NULL;
+		}
+		if(code_buffer)
+		{
+			u8 *end;
+			code_ptr = (u32*)arm_jit_code_reset((u8*)code_buffer, code_size, &end);
+			code_end = (u32*)end;
+		}
+	}
+}
+
+void arm_jit_close()
+{
+	// the code buffer is kept for the next game
+}
+#endif // HAVE_JIT
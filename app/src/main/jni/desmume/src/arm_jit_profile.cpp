@@ -0,0 +1,249 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "types.h"
+
+#ifdef HAVE_JIT
+
+#include <string.h>
+#include <stdio.h>
+#include <set>
+#include <vector>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "arm_jit.h"
+#include "debug.h"
+#include "MMU.h"
+#include "NDSSystem.h"
+
+//the blocks a game ran, kept next to its battery save so the next run can compile them before it gets to them.
+//the file is a header followed by records of (u32 adr, u32 hash, u16 ops, u8 proc, u8 thumb), appended as the
+//blocks get compiled, so a game that gets killed still keeps what it ran up to then.
+//the hash is only there to not fill the code cache with blocks whose code isn't loaded: a precompiled block is
+//invalidated by writes to its code like any other, so it is never wrong to compile one.
+struct JitProfileBlock
+{
+	u32 adr;
+	u32 hash;
+	u16 ops;
+	u8 proc;
+	u8 thumb;
+};
+
+static const u8 kHeader[8] = {'D','S','J','I','T','1',0,0};
+static const u32 kRecordSize = 12;
+
+//more than this many blocks and the file stops growing
+static const u32 kMaxBlocks = 65536;
+//how far each frame gets through the list: blocks to check against the code in memory, and blocks to compile
+static const u32 kWarmChecks = 1024;
+static const u32 kWarmCompiles = 64;
+//blocks whose code isn't there yet (overlays, or everything while the firmware boots) are checked again
+//on the next pass over the list, up to this many passes
+static const u32 kWarmPasses = 8;
+
+static FILE* profileFile = NULL;
+static u32 profileBlocks = 0;
+static std::set<u64> profileIndex;
+static std::vector<JitProfileBlock> warmList;
+static u32 warmPos = 0;
+static u32 warmPass = 0;
+
+//fnv-1a over the opcodes, read the way the compiler reads them
+template<int PROCNUM>
+static u32 hashCode(u32 adr, bool thumb, u32 ops)
+{
+	u32 hash = 2166136261u ^ (PROCNUM << 1) ^ thumb;
+	for(u32 i = 0; i < ops; i++)
+	{
+		u32 opcode = thumb ? _MMU_read16<PROCNUM, MMU_AT_CODE>(adr + i*2) : _MMU_read32<PROCNUM, MMU_AT_CODE>(adr + i*4);
+		for(int b = 0; b < 32; b += 8)
+		{
+			hash ^= (opcode >> b) & 0xFF;
+			hash *= 16777619u;
+		}
+	}
+	return hash;
+}
+
+static u32 hashCode(const JitProfileBlock& block)
+{
+	if(block.proc == ARMCPU_ARM9) return hashCode<ARMCPU_ARM9>(block.adr, block.thumb, block.ops);
+	else return hashCode<ARMCPU_ARM7>(block.adr, block.thumb, block.ops);
+}
+
+//the hash is seeded with the cpu and mode, so it tells apart the blocks both cpus have at adr
+static u64 blockKey(const JitProfileBlock& block)
+{
+	return ((u64)block.hash << 32) | block.adr | block.thumb;
+}
+
+void arm_jit_profile_open(const char* fname)
+{
+	arm_jit_profile_close();
+
+	u32 validSize = 0;
+	long fileSize = 0;
+	FILE* inf = fopen(fname,"rb");
+	if(inf)
+	{
+		u8 header[sizeof(kHeader)];
+		if(fread(header,1,sizeof(header),inf) == sizeof(header) && !memcmp(header,kHeader,sizeof(kHeader)))
+		{
+			validSize = sizeof(kHeader);
+			u8 rec[kRecordSize];
+			while(profileBlocks < kMaxBlocks && fread(rec,1,kRecordSize,inf) == kRecordSize)
+			{
+				JitProfileBlock block;
+				memcpy(&block.adr,rec,4);
+				memcpy(&block.hash,rec+4,4);
+				memcpy(&block.ops,rec+8,2);
+				block.proc = rec[10];
+				block.thumb = rec[11];
+				if(block.proc > 1 || block.thumb > 1 || block.ops == 0) break;
+
+				if(profileIndex.insert(blockKey(block)).second)
+					warmList.push_back(block);
+				profileBlocks++;
+				validSize += kRecordSize;
+			}
+		}
+		fseek(inf,0,SEEK_END);
+		fileSize = ftell(inf);
+		fclose(inf);
+	}
+
+	if(validSize != 0)
+	{
+		//drop a record torn by the app getting killed in the middle of writing it
+		if((long)validSize != fileSize)
+		{
+#ifdef WIN32
+			FILE* f = fopen(fname,"r+b");
+			if(f)
+			{
+				_chsize(_fileno(f),validSize);
+				fclose(f);
+			}
+#else
+			truncate(fname,validSize);
+#endif
+		}
+		profileFile = fopen(fname,"ab");
+	}
+	else
+	{
+		//missing, or not one of ours: start over
+		profileFile = fopen(fname,"wb");
+		if(profileFile) fwrite(kHeader,1,sizeof(kHeader),profileFile);
+	}
+
+	if(!profileFile)
+	{
+		PROGINFO("Couldn't open JIT profile %s\n",fname);
+		arm_jit_profile_close();
+		return;
+	}
+	CORELOG_INFO("JIT profile %s: %d blocks\n",fname,(int)warmList.size());
+}
+
+void arm_jit_profile_close()
+{
+	if(profileFile) fclose(profileFile);
+	profileFile = NULL;
+	profileBlocks = 0;
+	profileIndex.clear();
+	std::vector<JitProfileBlock>().swap(warmList);
+	warmPos = 0;
+	warmPass = 0;
+}
+
+void arm_jit_profile_record(int PROCNUM, u32 adr, bool thumb, u32 ops)
+{
+	if(!profileFile || profileBlocks >= kMaxBlocks) return;
+
+	JitProfileBlock block;
+	block.adr = adr;
+	block.ops = (u16)ops;
+	block.proc = (u8)PROCNUM;
+	block.thumb = thumb;
+	block.hash = hashCode(block);
+	if(!profileIndex.insert(blockKey(block)).second) return;
+
+	u8 rec[kRecordSize];
+	memcpy(rec,&block.adr,4);
+	memcpy(rec+4,&block.hash,4);
+	memcpy(rec+8,&block.ops,2);
+	rec[10] = block.proc;
+	rec[11] = block.thumb;
+	fwrite(rec,1,kRecordSize,profileFile);
+	profileBlocks++;
+}
+
+void arm_jit_profile_warm()
+{
+	u32 checks = 0, compiles = 0;
+	while(!warmList.empty() && checks < kWarmChecks && compiles < kWarmCompiles)
+	{
+		if(warmPos >= warmList.size())
+		{
+			warmPos = 0;
+			if(++warmPass == kWarmPasses)
+			{
+				std::vector<JitProfileBlock>().swap(warmList);
+				break;
+			}
+		}
+
+		const JitProfileBlock block = warmList[warmPos];
+		checks++;
+
+		bool done = true;
+		if(!JIT_MAPPED(block.adr & 0x0FFFFFFF, block.proc) || JIT_COMPILED_FUNC(block.adr, block.proc) != 0)
+		{
+			//the game got there first, or it is somewhere code can't be compiled any more
+		}
+		else if(hashCode(block) != block.hash)
+			done = false;
+		else
+		{
+			compiles++;
+			bool compiled = block.proc == ARMCPU_ARM9 ? arm_jit_precompile<ARMCPU_ARM9>(block.adr, block.thumb)
+			                                          : arm_jit_precompile<ARMCPU_ARM7>(block.adr, block.thumb);
+			if(!compiled)
+			{
+				//the code cache is full. whatever is left gets compiled when it runs, as usual
+				std::vector<JitProfileBlock>().swap(warmList);
+				break;
+			}
+		}
+
+		if(done)
+		{
+			warmList[warmPos] = warmList.back();
+			warmList.pop_back();
+		}
+		else
+			warmPos++;
+	}
+}
+
+#endif //HAVE_JIT
@@ -18,8 +18,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <algorithm>
+#include <vector>
+#include <map>
 
 #include "armcpu.h"
 #include "common.h"
@@ -30,18 +33,21 @@
 #include "Disassembler.h"
 #include "NDSSystem.h"
 #include "MMU_timing.h"
+#include "hle_sdk.h"
 #ifdef HAVE_LUA
 #include "lua-engine.h"
 #endif
 #ifdef HAVE_JIT
 #include "arm_jit.h"
+#include "hostmem.h"
 #endif
 
-template<u32> static u32 armcpu_prefetch();
+//decoded: fetch through the interpreter's cache of opcodes, for armcpu_exec only
+template<u32 PROCNUM, bool decoded> static u32 armcpu_prefetch();
 
 FORCEINLINE u32 armcpu_prefetch(armcpu_t *armcpu) { 
-	if(armcpu->proc_ID==0) return armcpu_prefetch<0>();
-	else return armcpu_prefetch<1>();
+	if(armcpu->proc_ID==0) return armcpu_prefetch<0,false>();
+	else return armcpu_prefetch<1,false>();
 }
 
 armcpu_t NDS_ARM7;
@@ -60,14 +66,14 @@ armcpu_t NDS_ARM9;
 static void
 stall_cpu( void *instance) {
   armcpu_t *armcpu = (armcpu_t *)instance;
-  printf("STALL\n");
+  CORELOG_INFO("STALL\n");
   armcpu->stalled = 1;
 }
                       
 static void
 unstall_cpu( void *instance) {
   armcpu_t *armcpu = (armcpu_t *)instance;
-  printf("UNSTALL\n");
+  CORELOG_INFO("UNSTALL\n");
   armcpu->stalled = 0;
 }
 
@@ -238,6 +244,7 @@ void armcpu_init(armcpu_t *armcpu, u32 adr)
 	armcpu->waitIRQ = FALSE;
 	armcpu->halt_IE_and_IF = FALSE;
 	armcpu->intrWaitARM_state = 0;
+	armcpu->idleLoop = FALSE;
 
 //#ifdef GDB_STUB
 //    armcpu->irq_flag = 0;
@@ -373,7 +380,7 @@ u32 armcpu_switchMode(armcpu_t *armcpu, u8 mode)
 				break;
 				
 			default :
-				printf("switchMode: WRONG mode %02X\n",mode);
+				CORELOG_INFO("switchMode: WRONG mode %02X\n",mode);
 				break;
 	}
 	
@@ -389,7 +396,469 @@ u32 armcpu_Wait4IRQ(armcpu_t *cpu)
 	return 1;
 }
 
+//-----------------------------------------------------------------------------
+//   idle loop detection
+//-----------------------------------------------------------------------------
+//lots of games wait for vblank or for the other cpu by polling VCOUNT, IPCSYNC, IF or some ram in a
+//tight loop instead of halting. a short loop that only loads, and computes every register it uses
+//from those loads in the same pass, goes around the same way until an irq or the other cpu changes
+//that memory. so the cpu loop may skip its time the way it does for a halted cpu.
+
+#define IDLE_LOOP_MAX_LOADS 4
+#define IDLE_LOOP_CACHE_SIZE 64
+#define IDLE_LOOP_RECHECK 64
+#define IDLE_NO_REG 0xFF
+#define IDLE_HASH_SEED 0x811C9DC5
+
+//the flags are tracked like registers 16-19
+#define IDLE_N (1<<16)
+#define IDLE_Z (1<<17)
+#define IDLE_C (1<<18)
+#define IDLE_V (1<<19)
+#define IDLE_NZ (IDLE_N|IDLE_Z)
+#define IDLE_NZCV (IDLE_N|IDLE_Z|IDLE_C|IDLE_V)
+
+struct IdleLoopLoad
+{
+	u8 base, index; //IDLE_NO_REG when unused
+	u8 size;
+	s32 offset;
+};
+
+struct IdleLoop
+{
+	u32 adr;
+	u32 hash; //of the opcodes that were looked at, so that changed code is looked at again
+	u8 thumb;
+	u8 ops;
+	u8 idle;
+	u8 recheck; //a loop that isn't idle is hashed again only this often
+	u8 loads;
+	IdleLoopLoad load[IDLE_LOOP_MAX_LOADS];
+};
+
+struct IdleLoopOp
+{
+	u32 reads, writes;
+	bool isLoad;
+	IdleLoopLoad load;
+};
+
+static IdleLoop idleLoops[2][IDLE_LOOP_CACHE_SIZE];
+
+//the flags each condition tests
+static const u32 idleCondFlags[15] = {
+	IDLE_Z, IDLE_Z, IDLE_C, IDLE_C, IDLE_N, IDLE_N, IDLE_V, IDLE_V,
+	IDLE_C|IDLE_Z, IDLE_C|IDLE_Z, IDLE_N|IDLE_V, IDLE_N|IDLE_V, IDLE_N|IDLE_Z|IDLE_V, IDLE_N|IDLE_Z|IDLE_V, 0
+};
+
+//the io registers that may be read without side effects, end exclusive
+static const u32 idleIoRanges[][2] = {
+	{ 0x004, 0x008 }, //DISPSTAT, VCOUNT
+	{ 0x0B0, 0x0F0 }, //dma
+	{ 0x100, 0x110 }, //timers
+	{ 0x130, 0x138 }, //keys
+	{ 0x180, 0x188 }, //IPCSYNC, IPCFIFOCNT
+	{ 0x1A0, 0x1A8 }, //AUXSPICNT, ROMCTRL
+	{ 0x1C0, 0x1C2 }, //SPICNT
+	{ 0x204, 0x20C }, //EXMEMCNT, IME
+	{ 0x210, 0x218 }, //IE, IF
+	{ 0x280, 0x2C0 }, //divider, square root
+	{ 0x300, 0x308 }, //POSTFLG, POWCNT
+	{ 0x400, 0x520 }, //sound
+	{ 0x600, 0x604 }, //GXSTAT
+};
+
+static FORCEINLINE u32 idleHash(u32 hash, u32 opcode) { return (hash ^ opcode) * 0x01000193; }
+
+template<int PROCNUM>
+static u32 idleFetch(u32 adr, bool thumb)
+{
+	return thumb ? _MMU_read16<PROCNUM,MMU_AT_DEBUG>(adr) : _MMU_read32<PROCNUM,MMU_AT_DEBUG>(adr);
+}
+
+static bool idleSafeRead(u32 adr, u32 size)
+{
+	const u32 region = adr >> 24;
+	if(region >= 0x08 && region <= 0x0A) return false; //slot-2 devices
+	if(region != 0x04) return true;
+
+	const u32 reg = adr - 0x04000000;
+	for(u32 i = 0; i < ARRAY_SIZE(idleIoRanges); i++)
+		if(reg >= idleIoRanges[i][0] && reg + size <= idleIoRanges[i][1])
+			return true;
+	return false;
+}
+
+static bool idleLoad(IdleLoopOp &op, u32 Rd, u32 base, u32 index, s32 offset, u32 size)
+{
+	if(Rd == 15) return false;
+	op.isLoad = true;
+	op.load.base = base;
+	op.load.index = index;
+	op.load.size = size;
+	op.load.offset = offset;
+	op.reads = (base != IDLE_NO_REG ? 1 << base : 0) | (index != IDLE_NO_REG ? 1 << index : 0);
+	op.writes = 1 << Rd;
+	return true;
+}
+
+//what an arm opcode reads and writes; false for anything that may have side effects or isn't handled
+static bool idleDecodeArm(u32 i, u32 adr, IdleLoopOp &op)
+{
+	op.reads = op.writes = 0;
+	op.isLoad = false;
+	if(CONDITION(i) != 0xE) return false;
+
+	const u32 Rd = REG_POS(i,12);
+	const u32 Rn = REG_POS(i,16);
+	const s32 sign = BIT23(i) ? 1 : -1;
+
+	if((i & 0x0C000000) == 0x04000000)
+	{
+		//ldr, ldrb pre-indexed without writeback
+		if((i & 0x01300000) != 0x01100000) return false;
+		const u32 size = BIT22(i) ? 1 : 4;
+		if(BIT25(i))
+		{
+			if((i & 0xFF0) || !BIT23(i) || Rn == 15) return false;
+			return idleLoad(op, Rd, Rn, REG_POS(i,0), 0, size);
+		}
+		if(Rn == 15) return idleLoad(op, Rd, IDLE_NO_REG, IDLE_NO_REG, adr + 8 + sign * (s32)(i & 0xFFF), size);
+		return idleLoad(op, Rd, Rn, IDLE_NO_REG, sign * (s32)(i & 0xFFF), size);
+	}
+
+	if((i & 0x0C000000) != 0) return false;
+
+	if((i & 0x02000090) == 0x00000090)
+	{
+		//ldrh, ldrsb, ldrsh pre-indexed without writeback
+		if((i & 0x01300000) != 0x01100000 || !(i & 0x60)) return false;
+		const u32 size = ((i >> 5) & 3) == 2 ? 1 : 2;
+		if(BIT22(i))
+		{
+			const s32 offset = sign * (s32)(((i >> 4) & 0xF0) | (i & 0xF));
+			if(Rn == 15) return idleLoad(op, Rd, IDLE_NO_REG, IDLE_NO_REG, adr + 8 + offset, size);
+			return idleLoad(op, Rd, Rn, IDLE_NO_REG, offset, size);
+		}
+		if((i & 0xF00) || !BIT23(i) || Rn == 15) return false;
+		return idleLoad(op, Rd, Rn, REG_POS(i,0), 0, size);
+	}
+
+	//data processing with an immediate or an immediate shift
+	const u32 opc = (i >> 21) & 0xF;
+	const bool s = BIT20(i);
+	const bool test = opc >= 8 && opc <= 11;
+	if(test && !s) return false; //mrs, msr, bx and the like
+	if(!BIT25(i) && BIT4(i)) return false;
+
+	const bool logical = opc <= 1 || opc == 8 || opc == 9 || opc >= 12;
+	bool shifterCarry;
+	if(opc != 13 && opc != 15) op.reads |= 1 << Rn;
+	if(BIT25(i))
+		shifterCarry = (i & 0xF00) != 0;
+	else
+	{
+		const u32 type = (i >> 5) & 3, amount = (i >> 7) & 0x1F;
+		op.reads |= 1 << REG_POS(i,0);
+		if(type == 3 && amount == 0) op.reads |= IDLE_C; //rrx
+		shifterCarry = type != 0 || amount != 0;
+	}
+	if(opc >= 5 && opc <= 7) op.reads |= IDLE_C; //adc, sbc, rsc
+
+	if(!test)
+	{
+		if(Rd == 15) return false;
+		op.writes |= 1 << Rd;
+	}
+	if(s) op.writes |= logical ? (IDLE_NZ | (shifterCarry ? IDLE_C : 0)) : IDLE_NZCV;
+	return true;
+}
+
+//the same for a thumb opcode
+static bool idleDecodeThumb(u32 i, u32 adr, IdleLoopOp &op)
+{
+	op.reads = op.writes = 0;
+	op.isLoad = false;
+
+	const u32 Rd = i & 7;
+	const u32 Rm = (i >> 3) & 7;
+	const u32 Ri = (i >> 8) & 7;
+
+	switch(i >> 11)
+	{
+		case 0x00: case 0x01: case 0x02: //lsl, lsr, asr by an immediate; lsl #0 keeps the carry
+			op.reads = 1 << Rm;
+			op.writes = (1 << Rd) | IDLE_NZ | ((i & 0x1FC0) ? IDLE_C : 0);
+			return true;
+
+		case 0x03: //add, sub with a register or a 3 bit immediate
+			op.reads = (1 << Rm) | (BIT10(i) ? 0 : 1 << ((i >> 6) & 7));
+			op.writes = (1 << Rd) | IDLE_NZCV;
+			return true;
+
+		case 0x04: //mov
+			op.writes = (1 << Ri) | IDLE_NZ;
+			return true;
+
+		case 0x05: //cmp
+			op.reads = 1 << Ri;
+			op.writes = IDLE_NZCV;
+			return true;
+
+		case 0x06: case 0x07: //add, sub with an 8 bit immediate
+			op.reads = 1 << Ri;
+			op.writes = (1 << Ri) | IDLE_NZCV;
+			return true;
+
+		case 0x08:
+			if(BIT10(i))
+			{
+				//high register add, cmp, mov
+				const u32 hop = (i >> 8) & 3;
+				const u32 Hd = (i & 7) | ((i >> 4) & 8);
+				const u32 Hm = (i >> 3) & 0xF;
+				if(hop == 3) return false; //bx, blx
+				op.reads = (1 << Hm) | (hop != 2 ? 1 << Hd : 0);
+				if(hop == 1)
+				{
+					op.writes = IDLE_NZCV;
+					return true;
+				}
+				if(Hd == 15) return false;
+				op.writes = 1 << Hd;
+				return true;
+			}
+			switch((i >> 6) & 0xF)
+			{
+				case 0x0: case 0x1: case 0xC: case 0xE: //and, eor, orr, bic
+					op.reads = (1 << Rd) | (1 << Rm);
+					op.writes = (1 << Rd) | IDLE_NZ;
+					return true;
+				case 0x2: case 0x3: case 0x4: case 0x7: //shifts by a register keep the carry for a shift by 0
+					op.reads = (1 << Rd) | (1 << Rm) | IDLE_C;
+					op.writes = (1 << Rd) | IDLE_NZ | IDLE_C;
+					return true;
+				case 0x5: case 0x6: //adc, sbc
+					op.reads = (1 << Rd) | (1 << Rm) | IDLE_C;
+					op.writes = (1 << Rd) | IDLE_NZCV;
+					return true;
+				case 0x8: //tst
+					op.reads = (1 << Rd) | (1 << Rm);
+					op.writes = IDLE_NZ;
+					return true;
+				case 0x9: //neg
+					op.reads = 1 << Rm;
+					op.writes = (1 << Rd) | IDLE_NZCV;
+					return true;
+				case 0xA: case 0xB: //cmp, cmn
+					op.reads = (1 << Rd) | (1 << Rm);
+					op.writes = IDLE_NZCV;
+					return true;
+				case 0xF: //mvn
+					op.reads = 1 << Rm;
+					op.writes = (1 << Rd) | IDLE_NZ;
+					return true;
+			}
+			return false; //mul
+
+		case 0x09: //ldr pc relative
+			return idleLoad(op, Ri, IDLE_NO_REG, IDLE_NO_REG, ((adr + 4) & ~3) + ((i & 0xFF) << 2), 4);
+
+		case 0x0A: case 0x0B: //register offset; the stores are 0
+		{
+			static const u8 sizes[8] = { 0, 0, 0, 1, 4, 2, 1, 2 };
+			const u32 size = sizes[(i >> 9) & 7];
+			if(!size) return false;
+			return idleLoad(op, Rd, Rm, (i >> 6) & 7, 0, size);
+		}
+
+		case 0x0D: //ldr
+			return idleLoad(op, Rd, Rm, IDLE_NO_REG, ((i >> 6) & 0x1F) << 2, 4);
+
+		case 0x0F: //ldrb
+			return idleLoad(op, Rd, Rm, IDLE_NO_REG, (i >> 6) & 0x1F, 1);
+
+		case 0x11: //ldrh
+			return idleLoad(op, Rd, Rm, IDLE_NO_REG, ((i >> 6) & 0x1F) << 1, 2);
+
+		case 0x13: //ldr sp relative
+			return idleLoad(op, Ri, 13, IDLE_NO_REG, (i & 0xFF) << 2, 4);
+	}
+	return false;
+}
+
+//true for a b or b<cond> back to loop, along with the flags it tests
+static bool idleBranchBack(u32 i, u32 adr, u32 loop, bool thumb, u32 &reads)
+{
+	u32 cond, target;
+	if(thumb)
+	{
+		if((i & 0xF000) == 0xD000 && ((i >> 8) & 0xF) < 0xE)
+		{
+			cond = (i >> 8) & 0xF;
+			target = adr + 4 + ((s32)(s8)i << 1);
+		}
+		else if((i & 0xF800) == 0xE000)
+		{
+			cond = 0xE;
+			target = adr + 4 + ((s32)(i << 21) >> 20);
+		}
+		else
+			return false;
+	}
+	else
+	{
+		if((i & 0x0F000000) != 0x0A000000 || CONDITION(i) == 0xF) return false;
+		cond = CONDITION(i);
+		target = adr + 8 + ((s32)(i << 8) >> 6);
+	}
+	if(target != loop) return false;
+	reads = idleCondFlags[cond];
+	return true;
+}
+
+template<int PROCNUM>
+static void idleAnalyze(IdleLoop &loop, u32 adr, bool thumb)
+{
+	IdleLoopOp ops[IDLE_LOOP_MAX_OPS];
+	const u32 size = thumb ? 2 : 4;
+	u32 hash = IDLE_HASH_SEED;
+	u32 branchReads = 0;
+	bool closed = false;
+	u32 n = 0, fetched = 0;
+
+	loop.adr = adr;
+	loop.thumb = thumb;
+	loop.idle = 0;
+	loop.recheck = IDLE_LOOP_RECHECK;
+	loop.loads = 0;
+
+	while(n < IDLE_LOOP_MAX_OPS)
+	{
+		const u32 at = adr + n * size;
+		const u32 i = idleFetch<PROCNUM>(at, thumb);
+		hash = idleHash(hash, i);
+		fetched++;
+		if(idleBranchBack(i, at, adr, thumb, branchReads))
+		{
+			closed = true;
+			break;
+		}
+		if(!(thumb ? idleDecodeThumb(i, at, ops[n]) : idleDecodeArm(i, at, ops[n])))
+			break;
+		n++;
+	}
+	loop.ops = fetched;
+	loop.hash = hash;
+	if(!closed) return;
+
+	//a register may only be read after the loop wrote it in the same pass, or if the loop never writes
+	//it. the address of a load must not depend on what the loop computes at all.
+	u32 written = 0, done = 0;
+	for(u32 k = 0; k < n; k++)
+		written |= ops[k].writes;
+	for(u32 k = 0; k < n; k++)
+	{
+		if(ops[k].reads & written & ~done) return;
+		if(ops[k].isLoad)
+		{
+			if(ops[k].reads & written) return;
+			if(loop.loads == IDLE_LOOP_MAX_LOADS) return;
+			loop.load[loop.loads++] = ops[k].load;
+		}
+		done |= ops[k].writes;
+	}
+	if(branchReads & written & ~done) return;
+
+	loop.idle = 1;
+}
+
+template<int PROCNUM>
+void armcpu_checkIdleLoop(u32 adr)
+{
+	const bool thumb = ARMPROC.CPSR.bits.T;
+	IdleLoop &loop = idleLoops[PROCNUM][(adr >> 1) & (IDLE_LOOP_CACHE_SIZE - 1)];
+
+	if(loop.adr != adr || loop.thumb != thumb)
+		idleAnalyze<PROCNUM>(loop, adr, thumb);
+	else if(loop.idle || --loop.recheck == 0)
+	{
+		u32 hash = IDLE_HASH_SEED;
+		for(u32 n = 0; n < loop.ops; n++)
+			hash = idleHash(hash, idleFetch<PROCNUM>(adr + n * (thumb ? 2 : 4), thumb));
+		if(hash != loop.hash)
+			idleAnalyze<PROCNUM>(loop, adr, thumb);
+		loop.recheck = IDLE_LOOP_RECHECK;
+	}
+	if(!loop.idle) return;
+
+	//the registers the addresses come from are the same on every pass
+	for(u32 k = 0; k < loop.loads; k++)
+	{
+		const IdleLoopLoad &load = loop.load[k];
+		u32 at = load.offset;
+		if(load.base != IDLE_NO_REG) at += ARMPROC.R[load.base];
+		if(load.index != IDLE_NO_REG) at += ARMPROC.R[load.index];
+		if(!idleSafeRead(at, load.size)) return;
+	}
+
+	ARMPROC.idleLoop = TRUE;
+}
+
+template void armcpu_checkIdleLoop<0>(u32 adr);
+template void armcpu_checkIdleLoop<1>(u32 adr);
+
+#if defined(HAVE_JIT) && !defined(MAPPED_JIT_FUNCS)
+//the interpreter keeps the opcodes it fetches in the pages of compiled_funcs, which the jit has no use for while it
+//is off, so the writes that throw away compiled code throw these away just the same and arm_jit_reset() clears them.
+//each halfword of code holds the halfword that was read there, tagged in bits 16+ with the cpu and whether it was
+//read as a thumb opcode or as the low or high half of an arm one. a fetch from the cache is then one or two loads
+//instead of a trip through the memory map, which is most of the cost outside of main memory and itcm.
+//vram (and everything above it) can be mapped to something else without being written to, so it isn't cached; the
+//shared wram is covered by arm_jit_invalidate_pages().
+#define DECODED_THUMB(PROCNUM) (1 + (PROCNUM))
+#define DECODED_ARM_LO(PROCNUM) (3 + (PROCNUM))
+#define DECODED_ARM_HI(PROCNUM) (5 + (PROCNUM))
+#define DECODED_CACHEABLE(adr) ((adr) < 0x06000000)
+
+template<u32 PROCNUM>
+FORCEINLINE static u32 armcpu_fetch32(u32 adr)
+{
+	if(!DECODED_CACHEABLE(adr))
+		return _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+
+	uintptr_t *op = &JIT_COMPILED_FUNC(adr, PROCNUM);
+	if((op[0] >> 16) == DECODED_ARM_LO(PROCNUM) && (op[1] >> 16) == DECODED_ARM_HI(PROCNUM))
+		return (u32)(op[0] & 0xFFFF) | ((u32)(op[1] & 0xFFFF) << 16);
+
+	const u32 opcode = _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+	op = &arm_jit_page(adr)[(adr >> 1) & (JIT_PAGE_SIZE-1)];
+	op[0] = ((uintptr_t)DECODED_ARM_LO(PROCNUM) << 16) | (opcode & 0xFFFF);
+	op[1] = ((uintptr_t)DECODED_ARM_HI(PROCNUM) << 16) | (opcode >> 16);
+	return opcode;
+}
+
 template<u32 PROCNUM>
+FORCEINLINE static u16 armcpu_fetch16(u32 adr)
+{
+	if(!DECODED_CACHEABLE(adr))
+		return _MMU_read16<PROCNUM, MMU_AT_CODE>(adr);
+
+	const uintptr_t op = JIT_COMPILED_FUNC(adr, PROCNUM);
+	if((op >> 16) == DECODED_THUMB(PROCNUM))
+		return (u16)op;
+
+	const u16 opcode = _MMU_read16<PROCNUM, MMU_AT_CODE>(adr);
+	arm_jit_page(adr)[(adr >> 1) & (JIT_PAGE_SIZE-1)] = ((uintptr_t)DECODED_THUMB(PROCNUM) << 16) | opcode;
+	return opcode;
+}
+#else
+template<u32 PROCNUM> FORCEINLINE static u32 armcpu_fetch32(u32 adr) { return _MMU_read32<PROCNUM, MMU_AT_CODE>(adr); }
+template<u32 PROCNUM> FORCEINLINE static u16 armcpu_fetch16(u32 adr) { return _MMU_read16<PROCNUM, MMU_AT_CODE>(adr); }
+#endif
+
+template<u32 PROCNUM, bool decoded>
 FORCEINLINE static u32 armcpu_prefetch()
 {
 	armcpu_t* const armcpu = &ARMPROC;
@@ -418,7 +887,7 @@ FORCEINLINE static u32 armcpu_prefetch()
 		armcpu->instruct_adr = curInstruction;
 		armcpu->next_instruction = curInstruction + 4;
 		armcpu->R[15] = curInstruction + 8;
-		armcpu->instruction = _MMU_read32<PROCNUM, MMU_AT_CODE>(curInstruction);
+		armcpu->instruction = decoded ? armcpu_fetch32<PROCNUM>(curInstruction) : _MMU_read32<PROCNUM, MMU_AT_CODE>(curInstruction);
 //#endif
 
 		return MMU_codeFetchCycles<PROCNUM,32>(curInstruction);
@@ -442,7 +911,7 @@ FORCEINLINE static u32 armcpu_prefetch()
 	armcpu->instruct_adr = curInstruction;
 	armcpu->next_instruction = curInstruction + 2;
 	armcpu->R[15] = curInstruction + 4;
-	armcpu->instruction = _MMU_read16<PROCNUM, MMU_AT_CODE>(curInstruction);
+	armcpu->instruction = decoded ? armcpu_fetch16<PROCNUM>(curInstruction) : _MMU_read16<PROCNUM, MMU_AT_CODE>(curInstruction);
 //#endif
 
 	if(PROCNUM==0)
@@ -515,7 +984,7 @@ void armcpu_exception(armcpu_t *cpu, u32 number)
 	cpu->changeCPSR();
 	cpu->R[15] = cpu->intVector + number;
 	cpu->next_instruction = cpu->R[15];
-	printf("armcpu_exception!\n");
+	CORELOG_INFO("armcpu_exception!\n");
 	//extern bool dolog;
 	//dolog=true;
 
@@ -597,8 +1066,9 @@ u32 TRAPUNDEF(armcpu_t* cpu)
 //  return TRUE;
 //}
 
-template<int PROCNUM>
-u32 armcpu_exec()
+//decoded as for armcpu_prefetch
+template<int PROCNUM, bool decoded>
+FORCEINLINE static u32 armcpu_execOp()
 {
 	// Usually, fetching and executing are processed parallelly.
 	// So this function stores the cycles of each process to
@@ -616,18 +1086,18 @@ u32 armcpu_exec()
 		switch (ARMPROC.instruct_adr & 0xFFFF)
 		{
 			case 0x00000000:
-				printf("BIOS%c: Reset!!!\n", PROCNUM?'7':'9');
+				CORELOG_INFO("BIOS%c: Reset!!!\n", PROCNUM?'7':'9');
 				emu_halt();
 				break;
 			case 0x00000004:
-				printf("BIOS%c: Undefined instruction\n", PROCNUM?'7':'9');
+				CORELOG_INFO("BIOS%c: Undefined instruction\n", PROCNUM?'7':'9');
 				//emu_halt();
 				break;
 			case 0x00000008:
 				//printf("BIOS%c: SWI\n", PROCNUM?'7':'9');
 				break;
 			case 0x0000000C:
-				printf("BIOS%c: Prefetch Abort!!!\n", PROCNUM?'7':'9');
+				CORELOG_INFO("BIOS%c: Prefetch Abort!!!\n", PROCNUM?'7':'9');
 				//emu_halt();
 				break;
 			case 0x00000010:
@@ -635,13 +1105,13 @@ u32 armcpu_exec()
 				//emu_halt();
 				break;
 			case 0x00000014:
-				printf("BIOS%c: Reserved!!!\n", PROCNUM?'7':'9');
+				CORELOG_INFO("BIOS%c: Reserved!!!\n", PROCNUM?'7':'9');
 				break;
 			case 0x00000018:
 				//printf("BIOS%c: IRQ\n", PROCNUM?'7':'9');
 				break;
 			case 0x0000001C:
-				printf("BIOS%c: Fast IRQ\n", PROCNUM?'7':'9');
+				CORELOG_INFO("BIOS%c: Fast IRQ\n", PROCNUM?'7':'9');
 				break;
 		}
 	}
@@ -692,7 +1162,7 @@ u32 armcpu_exec()
 		}
 		ARMPROC.mem_if->prefetch32( ARMPROC.mem_if->data, ARMPROC.next_instruction);
 #endif
-		cFetch = armcpu_prefetch<PROCNUM>();
+		cFetch = armcpu_prefetch<PROCNUM,decoded>();
 		return MMU_fetchExecuteCycles<PROCNUM>(cExecute, cFetch);
 	}
 
@@ -711,21 +1181,364 @@ u32 armcpu_exec()
 	}
 	ARMPROC.mem_if->prefetch32( ARMPROC.mem_if->data, ARMPROC.next_instruction);
 #endif
-	cFetch = armcpu_prefetch<PROCNUM>();
+	cFetch = armcpu_prefetch<PROCNUM,decoded>();
 	return MMU_fetchExecuteCycles<PROCNUM>(cExecute, cFetch);
 }
 
+#ifdef HLE_SDK
+//where the interpreter gets to next if the instruction doesn't branch. hle_sdk_find looks wherever it did
+static u32 hle_linear[2] = {1,1};
+#endif
+
+template<int PROCNUM>
+u32 armcpu_exec()
+{
+#ifdef HLE_SDK
+	if(ARMPROC.instruct_adr != hle_linear[PROCNUM] && !ARMPROC.CPSR.bits.T)
+	{
+		if(HleSdkRoutine f = hle_sdk_find<PROCNUM>(ARMPROC.instruct_adr))
+		{
+			const u32 cycles = f();
+			armcpu_prefetch<PROCNUM,true>();
+			hle_linear[PROCNUM] = ARMPROC.instruct_adr;
+			return cycles;
+		}
+	}
+	hle_linear[PROCNUM] = ARMPROC.instruct_adr + (ARMPROC.CPSR.bits.T ? 2 : 4);
+#endif
+	return armcpu_execOp<PROCNUM,true>();
+}
+
 //these templates needed to be instantiated manually
 template u32 armcpu_exec<0>();
 template u32 armcpu_exec<1>();
 
 #ifdef HAVE_JIT
+arm_jit_chain_t arm_jit_chain;
+
+#ifndef MAPPED_JIT_FUNCS
+#define JIT_PAGE_BYTES (JIT_PAGE_SIZE*sizeof(uintptr_t) + JIT_PAGE_SIZE/16 + JIT_PAGE_SIZE/8)
+
+uintptr_t *compiled_funcs[JIT_PAGES];
+u32 arm_jit_code_pages[1 << (27 - JIT_CODE_PAGE_BITS - 5)];
+u32 arm_jit_smc_invalidations = 0;
+DS_ALIGN(4096) static uintptr_t jit_zero_page[JIT_PAGE_SIZE];
+// where functions go when a page can't be allocated; they are never looked up, so the code is just interpreted
+static uintptr_t jit_lost_page[JIT_PAGE_BYTES/sizeof(uintptr_t) + 1];
+
+// the pages are cut from chunks of a huge page each, which come faulted in from hostmem_alloc: a page the jit starts
+// on costs no faults then, where a calloc'd one took one for each 4KB as the game first ran into it, and all the
+// tables are on a few tlb entries. the chunks are kept once made, arm_jit_free_pages just starts over at the first
+static std::vector<u8*> jit_page_chunks;
+static size_t jit_page_chunk = 0;
+static size_t jit_page_chunk_used = 0;
+
+static uintptr_t *jit_alloc_page()
+{
+	if(jit_page_chunk < jit_page_chunks.size() && jit_page_chunk_used + JIT_PAGE_BYTES > HOSTMEM_HUGE_PAGE)
+	{
+		jit_page_chunk++;
+		jit_page_chunk_used = 0;
+	}
+	if(jit_page_chunk == jit_page_chunks.size())
+	{
+		u8 *chunk = (u8*)hostmem_alloc(HOSTMEM_HUGE_PAGE);
+		if(!chunk)
+			return NULL;
+		jit_page_chunks.push_back(chunk);
+		jit_page_chunk_used = 0;
+	}
+	uintptr_t *p = (uintptr_t*)(jit_page_chunks[jit_page_chunk] + jit_page_chunk_used);
+	jit_page_chunk_used += JIT_PAGE_BYTES;
+	// a chunk used before arm_jit_free_pages still has the old tables in it
+	memset(p, 0, JIT_PAGE_BYTES);
+	return p;
+}
+
+static struct JitPagesInit
+{
+	JitPagesInit()
+	{
+		for(int i=0; i<JIT_PAGES; i++)
+			compiled_funcs[i] = jit_zero_page;
+	}
+} jit_pages_init;
+
+uintptr_t *arm_jit_page(u32 adr)
+{
+	//whatever the caller stores is for adr, so its 4KB are the ones that stores have to look at now
+	const u32 code_page = (adr & 0x07FFFFFE) >> JIT_CODE_PAGE_BITS;
+	arm_jit_code_pages[code_page >> 5] |= 1 << (code_page & 31);
+
+	uintptr_t *&page = compiled_funcs[(adr & 0x07FFFFFE) >> (JIT_PAGE_BITS+1)];
+	if(page == jit_zero_page)
+	{
+		uintptr_t *p = jit_alloc_page();
+		if(!p)
+			return jit_lost_page;
+		page = p;
+	}
+	return page;
+}
+
+//the blocks that have each literal word compiled into them, by the word's address
+static std::map<u32, std::vector<u32> > jit_literals;
+//a bit for every 16 bytes of main memory that had a literal stored to it, which is a variable then and isn't compiled
+//in again. it is read by the worker as well, which at worst compiles one in that arm_jit_literal_use turns down
+static u32 jit_literal_stored[(8 << 20) / 16 / 32];
+#define JIT_LITERAL_STORED_BIT(adr) (((adr) & 0x7FFFFF) >> 4)
+
+static void jit_literal_mark_stored(u32 adr)
+{
+	const u32 bit = JIT_LITERAL_STORED_BIT(adr);
+	jit_literal_stored[bit >> 5] |= 1 << (bit & 31);
+}
+
+static void jit_literal_drop(std::map<u32, std::vector<u32> >::iterator it)
+{
+	const std::vector<u32> &blocks = it->second;
+	for(size_t i=0; i<blocks.size(); i++)
+		JIT_COMPILED_FUNC(blocks[i], 0) = 0;
+	//the guard of the other halfword goes as well, the word is a literal no longer
+	for(u32 a = it->first; a < it->first + 4; a += 2)
+	{
+		uintptr_t &f = JIT_COMPILED_FUNC(a, 0);
+		if(f == arm_jit_literal_guards[0] || f == arm_jit_literal_guards[1])
+			f = 0;
+	}
+	jit_literals.erase(it);
+}
+
+//what was there gets compiled again, whichever way it is run
+template<int PROCNUM>
+static u32 FASTCALL jit_literal_guard()
+{
+	arm_jit_literal_store(ARMPROC.instruct_adr);
+	return arm_jit_compile<PROCNUM>();
+}
+
+uintptr_t arm_jit_literal_guards[2] = { (uintptr_t)&jit_literal_guard<0>, (uintptr_t)&jit_literal_guard<1> };
+
+void arm_jit_literal_store(u32 adr)
+{
+	std::map<u32, std::vector<u32> >::iterator it = jit_literals.find(adr & ~3);
+	if(it != jit_literals.end())
+	{
+		jit_literal_mark_stored(adr);
+		jit_literal_drop(it);
+	}
+}
+
+bool arm_jit_literal_free(u32 adr)
+{
+	const u32 bit = JIT_LITERAL_STORED_BIT(adr);
+	if((jit_literal_stored[bit >> 5] >> (bit & 31)) & 1)
+		return false;
+	for(u32 a = adr; a < adr + 4; a += 2)
+	{
+		const uintptr_t f = JIT_COMPILED_FUNC(a, 0);
+		if(f && f != arm_jit_literal_guards[0] && f != arm_jit_literal_guards[1])
+			return false;
+	}
+	return true;
+}
+
+bool arm_jit_literal_use(int PROCNUM, u32 adr, u32 value, u32 block)
+{
+	if(T1ReadLong(MMU.MAIN_MEM, adr & _MMU_MAIN_MEM_MASK32) != value)
+	{
+		jit_literal_mark_stored(adr);
+		return false;
+	}
+	//the dtcm covering it would be read instead, see arm_jit_invalidate_pages
+	if(!arm_jit_literal_free(adr) || (adr & ~0x3FFF) == MMU.DTCMRegion)
+		return false;
+	for(u32 a = adr; a < adr + 4; a += 2)
+	{
+		if(!JIT_COMPILED_FUNC(a, 0))
+			JIT_INSTALL_FUNC(a, PROCNUM, arm_jit_literal_guards[PROCNUM]);
+		//no page for the guard, so a store to the word wouldn't be seen
+		if(!JIT_COMPILED_FUNC(a, 0))
+			return false;
+	}
+	std::vector<u32> &blocks = jit_literals[adr];
+	if(std::find(blocks.begin(), blocks.end(), block) == blocks.end())
+		blocks.push_back(block);
+	return true;
+}
+
+void arm_jit_invalidate_pages(u32 start, u32 end)
+{
+	//the blocks elsewhere that used a literal from there, too
+	for(std::map<u32, std::vector<u32> >::iterator it = jit_literals.lower_bound(start); it != jit_literals.end() && it->first < end; )
+		jit_literal_drop(it++);
+	for(u32 adr = start; adr < end; adr += JIT_PAGE_SIZE*2)
+	{
+		uintptr_t *page = compiled_funcs[(adr & 0x07FFFFFE) >> (JIT_PAGE_BITS+1)];
+		if(page != jit_zero_page)
+			memset(page, 0, JIT_PAGE_SIZE*sizeof(uintptr_t));
+	}
+}
+
+void arm_jit_free_pages()
+{
+	for(int i=0; i<JIT_PAGES; i++)
+		compiled_funcs[i] = jit_zero_page;
+	jit_page_chunk = 0;
+	jit_page_chunk_used = 0;
+	memset(arm_jit_code_pages, 0, sizeof(arm_jit_code_pages));
+	jit_literals.clear();
+	memset(jit_literal_stored, 0, sizeof(jit_literal_stored));
+}
+
+static u8 *jit_code_base = NULL;
+static uintptr_t jit_code_segment_size = 0;
+static u32 jit_code_segment = 0;
+//the addresses of the blocks compiled into each segment. some may have been invalidated and compiled again elsewhere
+//since, so only the entries that still point into the segment are dropped
+static std::vector<u32> jit_code_blocks[JIT_CODE_SEGMENTS];
+u32 arm_jit_code_evictions = 0;
+
+u8 *arm_jit_code_reset(u8 *buffer, uintptr_t size, u8 **segment_end)
+{
+	const bool mapped = buffer != jit_code_base;
+	jit_code_base = buffer;
+	jit_code_segment_size = size / JIT_CODE_SEGMENTS;
+	jit_code_segment = 0;
+	for(int i=0; i<JIT_CODE_SEGMENTS; i++)
+		jit_code_blocks[i].clear();
+	// the code as well goes on huge pages where it can. the first segment of a buffer just mapped, which a game's
+	// boot is compiled into, is faulted in now rather than block by block
+	if(mapped)
+	{
+		hostmem_advise_huge(buffer, size);
+		hostmem_prefault(buffer, jit_code_segment_size);
+	}
+	*segment_end = buffer + jit_code_segment_size;
+	return buffer;
+}
+
+u8 *arm_jit_code_next_segment(u8 **segment_end, bool evict)
+{
+	const u32 next = (jit_code_segment + 1) % JIT_CODE_SEGMENTS;
+	std::vector<u32> &blocks = jit_code_blocks[next];
+	if(!evict && !blocks.empty())
+		return NULL;
+
+	jit_code_segment = next;
+	u8 *start = jit_code_base + jit_code_segment * jit_code_segment_size;
+	*segment_end = start + jit_code_segment_size;
+	if(blocks.empty())
+		return start;
+
+	const uintptr_t lo = (uintptr_t)start, hi = lo + jit_code_segment_size;
+	u32 dropped = 0;
+	for(size_t i=0; i<blocks.size(); i++)
+	{
+		uintptr_t &f = JIT_COMPILED_FUNC(blocks[i], 0);
+		if(f >= lo && f < hi)
+		{
+			f = 0;
+			dropped++;
+		}
+	}
+	blocks.clear();
+
+	arm_jit_code_evictions++;
+	CORELOG_INFO("JIT: code cache segment %u reused, %u blocks dropped (%u segments so far)\n", jit_code_segment, dropped, arm_jit_code_evictions);
+	return start;
+}
+
+void arm_jit_code_block(u32 adr)
+{
+	jit_code_blocks[jit_code_segment].push_back(adr);
+}
+
+void arm_jit_memory_usage(u64 *code, u64 *tables)
+{
+	*code = jit_code_base ? (u64)jit_code_segment_size * JIT_CODE_SEGMENTS : 0;
+	u32 pages = 0;
+	for(int i=0; i<JIT_PAGES; i++)
+		if(compiled_funcs[i] != jit_zero_page)
+			pages++;
+	*tables = (u64)pages * JIT_PAGE_BYTES;
+}
+#endif
+
 void arm_jit_sync()
 {
 	NDS_ARM7.next_instruction = NDS_ARM7.instruct_adr;
 	NDS_ARM9.next_instruction = NDS_ARM9.instruct_adr;
-	armcpu_prefetch<0>();
-	armcpu_prefetch<1>();
+	armcpu_prefetch<0,false>();
+	armcpu_prefetch<1,false>();
+}
+
+//the breakpoints, sorted, and what is called when one is got to
+static std::vector<u32> jit_breakpoints[2];
+u32 arm_jit_breakpoint_count = 0;
+static ArmJitTrap jit_trap[2];
+static void *jit_trap_data[2];
+//the breakpoint the cpu was stopped at, which it runs on from the next time: only ever the address it gets to next
+static u32 jit_trap_resume[2] = {1,1};
+
+void arm_jit_set_trap(int PROCNUM, ArmJitTrap trap, void *data)
+{
+	jit_trap[PROCNUM] = trap;
+	jit_trap_data[PROCNUM] = data;
+}
+
+bool arm_jit_breakpoint_at(int PROCNUM, u32 adr)
+{
+	return std::binary_search(jit_breakpoints[PROCNUM].begin(), jit_breakpoints[PROCNUM].end(), adr);
+}
+
+void arm_jit_set_breakpoint(int PROCNUM, u32 adr, bool set)
+{
+	adr &= ~1;
+	std::vector<u32> &list = jit_breakpoints[PROCNUM];
+	std::vector<u32>::iterator it = std::lower_bound(list.begin(), list.end(), adr);
+	const bool there = it != list.end() && *it == adr;
+	if(set == there) return;
+	if(set) list.insert(it, adr);
+	else list.erase(it);
+	const u32 had = arm_jit_breakpoint_count;
+	arm_jit_breakpoint_count = jit_breakpoints[0].size() + jit_breakpoints[1].size();
+
+#ifndef MAPPED_JIT_FUNCS
+	//the arm64 blocks follow branches while there are no breakpoints, so any of them may run over it
+	if(!had)
+	{
+		arm_jit_invalidate_pages(0, 0x08000000);
+		return;
+	}
+#endif
+
+	//the blocks that may run over it start up to a block's length before it, in either mode
+	const u32 reach = std::min<u32>(adr, CommonSettings.jit_max_block_size * 4);
+	for(u32 a = adr - reach; a <= adr; a += 2)
+	{
+		if(JIT_MAPPED(a & 0x0FFFFFFF, PROCNUM))
+			JIT_COMPILED_FUNC(a, PROCNUM) = 0;
+	}
+}
+
+//the instruction at a breakpoint, by the interpreter: a block for it would keep the trap from being seen again
+template<int PROCNUM>
+static u32 armcpu_execBreakpoint(u32 adr)
+{
+	//stopped, but the loop hasn't got to the stall yet
+	if(ARMPROC.stalled) return 1;
+	const bool resume = jit_trap_resume[PROCNUM] == adr;
+	jit_trap_resume[PROCNUM] = 1;
+	if(!resume && jit_trap[PROCNUM] && jit_trap[PROCNUM](jit_trap_data[PROCNUM], adr))
+	{
+		jit_trap_resume[PROCNUM] = adr;
+		return 1;
+	}
+
+	ARMPROC.next_instruction = adr;
+	armcpu_prefetch<PROCNUM,false>();
+	return armcpu_execOp<PROCNUM,false>();
 }
 
 template<int PROCNUM, bool jit>
@@ -734,8 +1547,37 @@ u32 armcpu_exec()
 	if (jit)
 	{
 		ARMPROC.instruct_adr &= ARMPROC.CPSR.bits.T?0xFFFFFFFE:0xFFFFFFFC;
-		ArmOpCompiled f = (ArmOpCompiled)JIT_COMPILED_FUNC(ARMPROC.instruct_adr, PROCNUM);
-		return f ? f() : arm_jit_compile<PROCNUM>();
+		const u32 adr = ARMPROC.instruct_adr;
+		if(arm_jit_breakpoint_count)
+		{
+			if(arm_jit_breakpoint_at(PROCNUM, adr))
+				return armcpu_execBreakpoint<PROCNUM>(adr);
+			jit_trap_resume[PROCNUM] = 1;
+		}
+#ifdef GDB_STUB
+		//stepping, or breaking in: one instruction at a time, for the function to see each of them
+		if(ARMPROC.post_ex_fn)
+		{
+			ARMPROC.next_instruction = adr;
+			armcpu_prefetch<PROCNUM,false>();
+			return armcpu_execOp<PROCNUM,false>();
+		}
+#endif
+		ArmOpCompiled f = (ArmOpCompiled)JIT_COMPILED_FUNC(adr, PROCNUM);
+#ifdef HLE_SDK
+		//an sdk routine that runs natively takes the place of its block
+		if(!f && !ARMPROC.CPSR.bits.T && !arm_jit_breakpoint_count && JIT_MAPPED(adr & 0x0FFFFFFF, PROCNUM))
+		{
+			if((f = hle_sdk_find<PROCNUM>(adr)) != NULL)
+				JIT_INSTALL_FUNC(adr, PROCNUM, f);
+		}
+#endif
+		arm_jit_chain.cycles = 0;
+		u32 cycles = f ? f() : arm_jit_compile<PROCNUM>();
+		//a block that ends up back at its own start may be an idle loop
+		if(ARMPROC.instruct_adr == adr)
+			armcpu_checkIdleLoop<PROCNUM>(adr);
+		return cycles + arm_jit_chain.cycles;
 	}
 
 	return armcpu_exec<PROCNUM>();
@@ -292,6 +292,7 @@ struct armcpu_t
 	BOOL waitIRQ;
 	BOOL halt_IE_and_IF; //the cpu is halted, waiting for IE&IF to signal something
 	u8 intrWaitARM_state;
+	BOOL idleLoop; //the last branch went around a loop that only polls memory, see armcpu_checkIdleLoop
 
 	BOOL BIOS_loaded;
 
@@ -332,6 +333,10 @@ void armcpu_exception(armcpu_t *cpu, u32 number);
 u32 TRAPUNDEF(armcpu_t* cpu);
 u32 armcpu_Wait4IRQ(armcpu_t *cpu);
 
+//the longest loop, branch included, that is looked at for idle loop detection
+#define IDLE_LOOP_MAX_OPS 8
+template<int PROCNUM> void armcpu_checkIdleLoop(u32 adr);
+
 extern armcpu_t NDS_ARM7;
 extern armcpu_t NDS_ARM9;
 extern const armcpu_ctrl_iface arm_default_ctrl_iface;
@@ -0,0 +1,186 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "armtrace.h"
+#include <stdlib.h>
+#include <string.h>
+#include "armcpu.h"
+#include "Disassembler.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+bool armtrace_active = false;
+
+static u8 *trace = NULL; //the header, then the ring
+static size_t traceBytes = 0;
+static u32 recordSize = 0;
+static u32 mask = 0;
+static u64 written = 0;
+static u64 lastCycle[2] = { 0, 0 };
+static bool regs = false;
+#ifdef WIN32
+static FILE *traceFile = NULL; //written at the close, from memory
+#endif
+
+bool armtrace_open(const char *path, u32 records, bool withRegs)
+{
+	armtrace_close();
+
+	u32 capacity = 1;
+	while(capacity < records && capacity < 0x80000000)
+		capacity <<= 1;
+	recordSize = sizeof(ArmTraceRecord) + (withRegs ? ARMTRACE_REGS_SIZE : 0);
+	traceBytes = sizeof(ArmTraceHeader) + (size_t)capacity * recordSize;
+
+#ifdef WIN32
+	traceFile = fopen(path, "wb");
+	if(!traceFile) return false;
+	trace = (u8*)calloc(1, traceBytes);
+	if(!trace)
+	{
+		fclose(traceFile);
+		traceFile = NULL;
+		return false;
+	}
+#else
+	const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) return false;
+	if(ftruncate(fd, traceBytes) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, traceBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) return false;
+	trace = (u8*)map;
+#endif
+
+	ArmTraceHeader *header = (ArmTraceHeader*)trace;
+	memcpy(header->magic, ARMTRACE_MAGIC, 8);
+	header->recordSize = recordSize;
+	header->capacity = capacity;
+	header->written = 0;
+	mask = capacity - 1;
+	written = 0;
+	regs = withRegs;
+	armtrace_active = true;
+	return true;
+}
+
+void armtrace_close()
+{
+	if(!trace) return;
+	armtrace_active = false;
+#ifdef WIN32
+	fwrite(trace, 1, traceBytes, traceFile);
+	fclose(traceFile);
+	traceFile = NULL;
+	free(trace);
+#else
+	munmap(trace, traceBytes);
+#endif
+	trace = NULL;
+}
+
+void armtrace_write(int PROCNUM, u32 pc, u32 opcode, u32 flags, u64 cycle, const armcpu_t *cpu)
+{
+	u8 *at = trace + sizeof(ArmTraceHeader) + (size_t)(written & mask) * recordSize;
+	ArmTraceRecord *rec = (ArmTraceRecord*)at;
+	rec->cycle = cycle;
+	rec->pc = pc;
+	rec->opcode = opcode;
+	rec->flags = flags | (PROCNUM ? ARMTRACE_ARM7 : 0);
+	if(regs)
+	{
+		memcpy(at + sizeof(ArmTraceRecord), cpu->R, 16 * 4);
+		memcpy(at + sizeof(ArmTraceRecord) + 16 * 4, &cpu->CPSR.val, 4);
+	}
+	lastCycle[PROCNUM] = cycle;
+	//a reader of the mapped file sees the record before the count that takes it in
+	__atomic_store_n(&((ArmTraceHeader*)trace)->written, ++written, __ATOMIC_RELEASE);
+}
+
+u64 armtrace_lastCycle(int PROCNUM)
+{
+	return lastCycle[PROCNUM];
+}
+
+bool armtrace_decode(const char *path, FILE *out)
+{
+	FILE *in = fopen(path, "rb");
+	if(!in) return false;
+
+	ArmTraceHeader header;
+	if(fread(&header, sizeof(header), 1, in) != 1
+		|| memcmp(header.magic, ARMTRACE_MAGIC, 8)
+		|| header.recordSize < sizeof(ArmTraceRecord)
+		|| !header.capacity || (header.capacity & (header.capacity - 1)))
+	{
+		fclose(in);
+		return false;
+	}
+
+	const size_t bytes = (size_t)header.capacity * header.recordSize;
+	u8 *ring = (u8*)malloc(bytes);
+	if(!ring || fread(ring, 1, bytes, in) != bytes)
+	{
+		free(ring);
+		fclose(in);
+		return false;
+	}
+	fclose(in);
+
+	const bool withRegs = header.recordSize >= sizeof(ArmTraceRecord) + ARMTRACE_REGS_SIZE;
+	const u64 first = header.written > header.capacity ? header.written - header.capacity : 0;
+	char dasmbuf[4096];
+	for(u64 i = first; i < header.written; i++)
+	{
+		const u8 *at = ring + (size_t)(i & (header.capacity - 1)) * header.recordSize;
+		const ArmTraceRecord *rec = (const ArmTraceRecord*)at;
+		const bool thumb = (rec->flags & ARMTRACE_THUMB) != 0;
+
+		dasmbuf[0] = 0;
+		if(thumb)
+			des_thumb_instructions_set[(rec->opcode>>6)&1023](rec->pc, rec->opcode, dasmbuf);
+		else
+			des_arm_instructions_set[INSTRUCTION_INDEX(rec->opcode)](rec->pc, rec->opcode, dasmbuf);
+
+		fprintf(out, "%12llu %c:%s %08X\t%0*X \t%s%s\n", (unsigned long long)rec->cycle,
+			(rec->flags & ARMTRACE_ARM7) ? '7' : '9', thumb ? "THUMB" : "ARM",
+			rec->pc, thumb ? 4 : 8, rec->opcode, dasmbuf,
+			(rec->flags & ARMTRACE_BLOCK) ? "\t;block" : "");
+
+		if(withRegs)
+		{
+			u32 R[17];
+			memcpy(R, at + sizeof(ArmTraceRecord), sizeof(R));
+			fprintf(out, "\t\t;R0:%08X R1:%08X R2:%08X R3:%08X R4:%08X R5:%08X R6:%08X R7:%08X R8:%08X R9:%08X\n"
+				"\t\t;R10:%08X R11:%08X R12:%08X R13:%08X R14:%08X R15:%08X| CPSR:%08X N:%i Z:%i C:%i V:%i\n",
+				R[0], R[1], R[2], R[3], R[4], R[5], R[6], R[7], R[8], R[9],
+				R[10], R[11], R[12], R[13], R[14], R[15], R[16],
+				(R[16]>>31)&1, (R[16]>>30)&1, (R[16]>>29)&1, (R[16]>>28)&1);
+		}
+	}
+
+	free(ring);
+	return true;
+}
@@ -0,0 +1,74 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ARMTRACE_H_
+#define _ARMTRACE_H_
+
+#include <stdio.h>
+#include "types.h"
+
+struct armcpu_t;
+
+//the instructions the cpus ran, kept as binary records in a ring in a file (mapped, on the systems that have mmap,
+//so what was written is there even if the emulator dies), and turned into text afterwards by armtrace_decode.
+//the interpreter records every instruction; the jit records the blocks it runs, and the instructions it interprets
+//from inside them. the ring keeps the last of them, so a trace can run for as long as a bug takes to show up.
+//only the emulation thread writes the records, and it publishes how many it wrote after each one
+#define ARMTRACE_MAGIC "DSTRACE1"
+#define ARMTRACE_REGS_SIZE (17 * 4)
+
+struct ArmTraceHeader
+{
+	char magic[8];
+	u32 recordSize; //sizeof(ArmTraceRecord), and ARMTRACE_REGS_SIZE more if R0-R15 and the CPSR follow each record
+	u32 capacity; //records in the ring, a power of two
+	u64 written; //records written since the trace started, the newest at (written-1) % capacity
+	u8 pad[40];
+};
+
+enum
+{
+	ARMTRACE_ARM7 = 1,
+	ARMTRACE_THUMB = 2,
+	ARMTRACE_BLOCK = 4, //a jit block starts at pc
+};
+
+struct ArmTraceRecord
+{
+	u64 cycle; //nds_timer's clock, in arm9 cycles
+	u32 pc;
+	u32 opcode;
+	u32 flags;
+};
+
+extern bool armtrace_active;
+
+//starts a trace into path, made or truncated, keeping the last records (rounded up to a power of two) instructions.
+//false if the file couldn't be made
+bool armtrace_open(const char *path, u32 records, bool regs);
+void armtrace_close();
+
+//the registers are as they were before the instruction
+void armtrace_write(int PROCNUM, u32 pc, u32 opcode, u32 flags, u64 cycle, const armcpu_t *cpu);
+
+//the cycle of the cpu's last record, for the instructions a jit block interprets, which don't know their own
+u64 armtrace_lastCycle(int PROCNUM);
+
+//the trace at path as text, oldest first, disassembled
+bool armtrace_decode(const char *path, FILE *out);
+
+#endif
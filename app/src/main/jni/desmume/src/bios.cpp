@@ -434,8 +434,97 @@ TEMPLATE static u32 fastCopy()
      return 1;
 }
 
+//the decompressors' memory accesses. where a 4KB page is plain memory (see MMU_hostPage) they go straight to it,
+//and anywhere else (io, tcm, palettes, bios) through the handlers as before, so those still see every access.
+//the writes of all of them go up, so each page is made ready for them once, from the first one in it to its end
+TEMPLATE class BiosMemory
+{
+public:
+	BiosMemory()
+		: readPage(1)
+		, writePage(1)
+		, readHost(NULL)
+		, writeHost(NULL)
+		, writeRestricted(false)
+	{
+		//the debugger's events and the lua hooks want to see each access
+		direct = !CheckDebugEvent(DEBUG_EVENT_READ) && !CheckDebugEvent(DEBUG_EVENT_WRITE);
+#ifdef HAVE_LUA
+		direct = false;
+#endif
+	}
+
+	u8 read08(u32 adr)
+	{
+		u8* host = hostRead(adr);
+		return host ? T1ReadByte(host, adr & 0xFFF) : _MMU_read08<PROCNUM>(adr);
+	}
+	u16 read16(u32 adr)
+	{
+		u8* host = hostRead(adr);
+		return host ? T1ReadWord(host, adr & 0xFFE) : _MMU_read16<PROCNUM>(adr);
+	}
+	u32 read32(u32 adr)
+	{
+		u8* host = hostRead(adr);
+		return host ? T1ReadLong(host, adr & 0xFFC) : _MMU_read32<PROCNUM>(adr);
+	}
+
+	void write08(u32 adr, u8 val)
+	{
+		u8* host = hostWrite(adr);
+		//vram takes no single bytes from the cpu: the handler drops them
+		if(host && !writeRestricted) T1WriteByte(host, adr & 0xFFF, val);
+		else _MMU_write08<PROCNUM>(adr, val);
+	}
+	void write16(u32 adr, u16 val)
+	{
+		u8* host = hostWrite(adr);
+		if(host) T1WriteWord(host, adr & 0xFFE, val);
+		else _MMU_write16<PROCNUM>(adr, val);
+	}
+	void write32(u32 adr, u32 val)
+	{
+		u8* host = hostWrite(adr);
+		if(host) T1WriteLong(host, adr & 0xFFC, val);
+		else _MMU_write32<PROCNUM>(adr, val);
+	}
+
+private:
+	FORCEINLINE u8* hostRead(u32 adr)
+	{
+		if((adr & ~0xFFF) != readPage)
+		{
+			readPage = adr & ~0xFFF;
+			u32 mapped;
+			bool restricted;
+			readHost = direct ? MMU_hostPage<PROCNUM>(adr, mapped, restricted) : NULL;
+		}
+		return readHost;
+	}
+
+	FORCEINLINE u8* hostWrite(u32 adr)
+	{
+		if((adr & ~0xFFF) != writePage)
+		{
+			writePage = adr & ~0xFFF;
+			u32 mapped;
+			writeHost = direct ? MMU_hostPage<PROCNUM>(adr, mapped, writeRestricted) : NULL;
+			if(writeHost)
+				MMU_hostPageStore<PROCNUM>(mapped + (adr & 0xFFF), 0x1000 - (adr & 0xFFF));
+		}
+		return writeHost;
+	}
+
+	bool direct;
+	u32 readPage, writePage;
+	u8 *readHost, *writeHost;
+	bool writeRestricted;
+};
+
 TEMPLATE static u32 LZ77UnCompVram()
 {
+  BiosMemory<PROCNUM> mem;
   int i1, i2;
   int byteCount;
   int byteShift;
@@ -443,7 +532,7 @@ TEMPLATE static u32 LZ77UnCompVram()
   int len;
   u32 source = cpu->R[0];
   u32 dest = cpu->R[1];
-  u32 header = _MMU_read32<PROCNUM>(source);
+  u32 header = mem.read32(source);
   source += 4;
 
   //INFO("swi lz77uncompvram\n");
@@ -459,7 +548,7 @@ TEMPLATE static u32 LZ77UnCompVram()
   len = header >> 8;
 
   while(len > 0) {
-    u8 d = _MMU_read08<PROCNUM>(source++);
+    u8 d = mem.read08(source++);
 
     if(d) {
       for(i1 = 0; i1 < 8; i1++) {
@@ -467,18 +556,18 @@ TEMPLATE static u32 LZ77UnCompVram()
           int length;
           int offset;
           u32 windowOffset;
-          u16 data = _MMU_read08<PROCNUM>(source++) << 8;
-          data |= _MMU_read08<PROCNUM>(source++);
+          u16 data = mem.read08(source++) << 8;
+          data |= mem.read08(source++);
           length = (data >> 12) + 3;
           offset = (data & 0x0FFF);
           windowOffset = dest + byteCount - offset - 1;
           for(i2 = 0; i2 < length; i2++) {
-            writeValue |= (_MMU_read08<PROCNUM>(windowOffset++) << byteShift);
+            writeValue |= (mem.read08(windowOffset++) << byteShift);
             byteShift += 8;
             byteCount++;
 
             if(byteCount == 2) {
-              _MMU_write16<PROCNUM>(dest, writeValue);
+              mem.write16(dest, writeValue);
               dest += 2;
               byteCount = 0;
               byteShift = 0;
@@ -489,11 +578,11 @@ TEMPLATE static u32 LZ77UnCompVram()
               return 0;
           }
         } else {
-          writeValue |= (_MMU_read08<PROCNUM>(source++) << byteShift);
+          writeValue |= (mem.read08(source++) << byteShift);
           byteShift += 8;
           byteCount++;
           if(byteCount == 2) {
-            _MMU_write16<PROCNUM>(dest, writeValue);
+            mem.write16(dest, writeValue);
             dest += 2;
             byteCount = 0;
             byteShift = 0;
@@ -507,11 +596,11 @@ TEMPLATE static u32 LZ77UnCompVram()
       }
     } else {
       for(i1 = 0; i1 < 8; i1++) {
-        writeValue |= (_MMU_read08<PROCNUM>(source++) << byteShift);
+        writeValue |= (mem.read08(source++) << byteShift);
         byteShift += 8;
         byteCount++;
         if(byteCount == 2) {
-          _MMU_write16<PROCNUM>(dest, writeValue);
+          mem.write16(dest, writeValue);
           dest += 2;      
           byteShift = 0;
           byteCount = 0;
@@ -528,12 +617,13 @@ TEMPLATE static u32 LZ77UnCompVram()
 
 TEMPLATE static u32 LZ77UnCompWram()
 {
+  BiosMemory<PROCNUM> mem;
   int i1, i2;
   int len;
   u32 source = cpu->R[0];
   u32 dest = cpu->R[1];
 
-  u32 header = _MMU_read32<PROCNUM>(source);
+  u32 header = mem.read32(source);
   source += 4;
 
   //INFO("swi lz77uncompwram\n");
@@ -545,7 +635,7 @@ TEMPLATE static u32 LZ77UnCompWram()
   len = header >> 8;
 
   while(len > 0) {
-    u8 d = _MMU_read08<PROCNUM>(source++);
+    u8 d = mem.read08(source++);
 
     if(d) {
       for(i1 = 0; i1 < 8; i1++) {
@@ -553,19 +643,19 @@ TEMPLATE static u32 LZ77UnCompWram()
           int length;
           int offset;
           u32 windowOffset;
-          u16 data = _MMU_read08<PROCNUM>(source++) << 8;
-          data |= _MMU_read08<PROCNUM>(source++);
+          u16 data = mem.read08(source++) << 8;
+          data |= mem.read08(source++);
           length = (data >> 12) + 3;
           offset = (data & 0x0FFF);
           windowOffset = dest - offset - 1;
           for(i2 = 0; i2 < length; i2++) {
-            _MMU_write08<PROCNUM>(dest++, _MMU_read08<PROCNUM>(windowOffset++));
+            mem.write08(dest++, mem.read08(windowOffset++));
             len--;
             if(len == 0)
               return 0;
           }
         } else {
-          _MMU_write08<PROCNUM>(dest++, _MMU_read08<PROCNUM>(source++));
+          mem.write08(dest++, mem.read08(source++));
           len--;
           if(len == 0)
             return 0;
@@ -574,7 +664,7 @@ TEMPLATE static u32 LZ77UnCompWram()
       }
     } else {
       for(i1 = 0; i1 < 8; i1++) {
-        _MMU_write08<PROCNUM>(dest++, _MMU_read08<PROCNUM>(source++));
+        mem.write08(dest++, mem.read08(source++));
         len--;
         if(len == 0)
           return 0;
@@ -586,6 +676,7 @@ TEMPLATE static u32 LZ77UnCompWram()
 
 TEMPLATE static u32 RLUnCompVram()
 {
+  BiosMemory<PROCNUM> mem;
   int i;
   int len;
   int byteCount;
@@ -594,7 +685,7 @@ TEMPLATE static u32 RLUnCompVram()
   u32 source = cpu->R[0];
   u32 dest = cpu->R[1];
 
-  u32 header = _MMU_read32<PROCNUM>(source);
+  u32 header = mem.read32(source);
   source += 4;
 
   //INFO("swi rluncompvram\n");
@@ -609,10 +700,10 @@ TEMPLATE static u32 RLUnCompVram()
   writeValue = 0;
 
   while(len > 0) {
-    u8 d = _MMU_read08<PROCNUM>(source++);
+    u8 d = mem.read08(source++);
     int l = d & 0x7F;
     if(d & 0x80) {
-      u8 data = _MMU_read08<PROCNUM>(source++);
+      u8 data = mem.read08(source++);
       l += 3;
       for(i = 0;i < l; i++) {
         writeValue |= (data << byteShift);
@@ -620,7 +711,7 @@ TEMPLATE static u32 RLUnCompVram()
         byteCount++;
 
         if(byteCount == 2) {
-          _MMU_write16<PROCNUM>(dest, writeValue);
+          mem.write16(dest, writeValue);
           dest += 2;
           byteCount = 0;
           byteShift = 0;
@@ -633,11 +724,11 @@ TEMPLATE static u32 RLUnCompVram()
     } else {
       l++;
       for(i = 0; i < l; i++) {
-        writeValue |= (_MMU_read08<PROCNUM>(source++) << byteShift);
+        writeValue |= (mem.read08(source++) << byteShift);
         byteShift += 8;
         byteCount++;
         if(byteCount == 2) {
-          _MMU_write16<PROCNUM>(dest, writeValue);
+          mem.write16(dest, writeValue);
           dest += 2;
           byteCount = 0;
           byteShift = 0;
@@ -654,6 +745,7 @@ TEMPLATE static u32 RLUnCompVram()
 
 TEMPLATE static u32 RLUnCompWram()
 {
+	BiosMemory<PROCNUM> mem;
 	//this routine is used by yoshi touch&go from the very beginning
 
 	//printf("RLUnCompWram\n");
@@ -663,7 +755,7 @@ TEMPLATE static u32 RLUnCompWram()
   u32 source = cpu->R[0];
   u32 dest = cpu->R[1];
 
-  u32 header = _MMU_read32<PROCNUM>(source);
+  u32 header = mem.read32(source);
   source += 4;
 
   //INFO("swi rluncompwram\n");
@@ -675,13 +767,13 @@ TEMPLATE static u32 RLUnCompWram()
   len = header >> 8;
 
   while(len > 0) {
-    u8 d = _MMU_read08<PROCNUM>(source++);
+    u8 d = mem.read08(source++);
     int l = d & 0x7F;
     if(d & 0x80) {
-      u8 data = _MMU_read08<PROCNUM>(source++);
+      u8 data = mem.read08(source++);
       l += 3;
       for(i = 0;i < l; i++) {
-        _MMU_write08<PROCNUM>(dest++, data);
+        mem.write08(dest++, data);
         len--;
         if(len == 0)
           return 0;
@@ -689,7 +781,7 @@ TEMPLATE static u32 RLUnCompWram()
     } else {
       l++;
       for(i = 0; i < l; i++) {
-        _MMU_write08<PROCNUM>(dest++,  _MMU_read08<PROCNUM>(source++));
+        mem.write08(dest++,  mem.read08(source++));
         len--;
         if(len == 0)
           return 0;
@@ -701,6 +793,7 @@ TEMPLATE static u32 RLUnCompWram()
 
 TEMPLATE static u32 UnCompHuffman()
 {
+	BiosMemory<PROCNUM> mem;
 	//this routine is used by the nintendo logo in the firmware boot screen
 
   u32 source, dest, writeValue, header, treeStart, mask;
@@ -712,7 +805,7 @@ TEMPLATE static u32 UnCompHuffman()
   source = cpu->R[0];
   dest = cpu->R[1];
 
-  header = _MMU_read32<PROCNUM>(source);
+  header = mem.read32(source);
   source += 4;
 
   //INFO("swi uncomphuffman\n");
@@ -721,7 +814,7 @@ TEMPLATE static u32 UnCompHuffman()
      ((source + ((header >> 8) & 0x1fffff)) & 0xe000000) == 0)
     return 0;  
   
-  treeSize = _MMU_read08<PROCNUM>(source++);
+  treeSize = mem.read08(source++);
 
   treeStart = source;
 
@@ -730,11 +823,11 @@ TEMPLATE static u32 UnCompHuffman()
   len = header >> 8;
 
   mask = 0x80000000;
-  data = _MMU_read32<PROCNUM>(source);
+  data = mem.read32(source);
   source += 4;
 
   pos = 0;
-  rootNode = _MMU_read08<PROCNUM>(treeStart);
+  rootNode = mem.read08(treeStart);
   currentNode = rootNode;
   writeData = 0;
   byteShift = 0;
@@ -753,12 +846,12 @@ TEMPLATE static u32 UnCompHuffman()
         // right
         if(currentNode & 0x40)
           writeData = 1;
-        currentNode = _MMU_read08<PROCNUM>(treeStart+pos+1);
+        currentNode = mem.read08(treeStart+pos+1);
       } else {
         // left
         if(currentNode & 0x80)
           writeData = 1;
-        currentNode = _MMU_read08<PROCNUM>(treeStart+pos);
+        currentNode = mem.read08(treeStart+pos);
       }
       
       if(writeData) {
@@ -773,7 +866,7 @@ TEMPLATE static u32 UnCompHuffman()
         if(byteCount == 4) {
           byteCount = 0;
           byteShift = 0;
-          _MMU_write32<PROCNUM>(dest, writeValue);
+          mem.write32(dest, writeValue);
           writeValue = 0;
           dest += 4;
           len -= 4;
@@ -782,7 +875,7 @@ TEMPLATE static u32 UnCompHuffman()
       mask >>= 1;
       if(mask == 0) {
         mask = 0x80000000;
-        data = _MMU_read32<PROCNUM>(source);
+        data = mem.read32(source);
         source += 4;
       }
     }
@@ -800,12 +893,12 @@ TEMPLATE static u32 UnCompHuffman()
         // right
         if(currentNode & 0x40)
           writeData = 1;
-        currentNode = _MMU_read08<PROCNUM>(treeStart+pos+1);
+        currentNode = mem.read08(treeStart+pos+1);
       } else {
         // left
         if(currentNode & 0x80)
           writeData = 1;
-        currentNode = _MMU_read08<PROCNUM>(treeStart+pos);
+        currentNode = mem.read08(treeStart+pos);
       }
       
       if(writeData) {
@@ -826,7 +919,7 @@ TEMPLATE static u32 UnCompHuffman()
           if(byteCount == 4) {
             byteCount = 0;
             byteShift = 0;
-            _MMU_write32<PROCNUM>(dest, writeValue);
+            mem.write32(dest, writeValue);
             dest += 4;
             writeValue = 0;
             len -= 4;
@@ -839,7 +932,7 @@ TEMPLATE static u32 UnCompHuffman()
       mask >>= 1;
       if(mask == 0) {
         mask = 0x80000000;
-        data = _MMU_read32<PROCNUM>(source);
+        data = mem.read32(source);
         source += 4;
       }
     }    
@@ -848,6 +941,7 @@ TEMPLATE static u32 UnCompHuffman()
 }
 TEMPLATE static u32 BitUnPack()
 {
+	BiosMemory<PROCNUM> mem;
 	u32 source,dest,header,base,temp;
 	int len,bits,revbits,dataSize,data,bitwritecount,mask,bitcount,addBase;
 	u8 b;
@@ -856,8 +950,8 @@ TEMPLATE static u32 BitUnPack()
 	dest = cpu->R[1];
 	header = cpu->R[2];
 
-	len = _MMU_read16<PROCNUM>(header);
-	bits = _MMU_read08<PROCNUM>(header+2);
+	len = mem.read16(header);
+	bits = mem.read08(header+2);
 	switch (bits)
 	{
 	case 1:
@@ -868,7 +962,7 @@ TEMPLATE static u32 BitUnPack()
 	default: 
 		return (0);	// error
 	}
-	dataSize = _MMU_read08<PROCNUM>(header+3);
+	dataSize = mem.read08(header+3);
 	switch (dataSize)
 	{
 	case 1:
@@ -883,7 +977,7 @@ TEMPLATE static u32 BitUnPack()
 	}
 
 	revbits = 8 - bits; 
-	base = _MMU_read32<PROCNUM>(header+4);
+	base = mem.read32(header+4);
 	addBase = (base & 0x80000000) ? 1 : 0;
 	base &= 0x7fffffff;
 
@@ -896,7 +990,7 @@ TEMPLATE static u32 BitUnPack()
 		if(len < 0)
 			break;
 		mask = 0xff >> revbits; 
-		b = _MMU_read08<PROCNUM>(source); 
+		b = mem.read08(source); 
 		source++;
 		bitcount = 0;
 		while(1) {
@@ -916,7 +1010,7 @@ TEMPLATE static u32 BitUnPack()
 			data |= temp << bitwritecount;
 			bitwritecount += dataSize;
 			if(bitwritecount >= 32) {
-				_MMU_write32<PROCNUM>(dest, data);
+				mem.write32(dest, data);
 				dest += 4;
 				data = 0;
 				bitwritecount = 0;
@@ -930,26 +1024,27 @@ TEMPLATE static u32 BitUnPack()
 
 TEMPLATE static u32 Diff8bitUnFilterWram() //this one might be different on arm7 and needs checking
 {
+	BiosMemory<PROCNUM> mem;
 	//INFO("swi Diff8bitUnFilterWram\n");
 
 	u32 source = cpu->R[0];
 	u32 dest = cpu->R[1];
 
-	CompressionHeader header(_MMU_read32<PROCNUM>(source));
+	CompressionHeader header(mem.read32(source));
 	source += 4;
 
-	if(header.DataSize() != 1) printf("WARNING: incorrect header passed to Diff8bitUnFilterWram\n");
-	if(header.Type() != 8) printf("WARNING: incorrect header passed to Diff8bitUnFilterWram\n");
+	if(header.DataSize() != 1) CORELOG_WARN("WARNING: incorrect header passed to Diff8bitUnFilterWram\n");
+	if(header.Type() != 8) CORELOG_WARN("WARNING: incorrect header passed to Diff8bitUnFilterWram\n");
 	u32 len = header.DecompressedSize();
 
-	u8 data = _MMU_read08<PROCNUM>(source++);
-	_MMU_write08<PROCNUM>(dest++, data);
+	u8 data = mem.read08(source++);
+	mem.write08(dest++, data);
 	len--;
 
 	while(len > 0) {
-		u8 diff = _MMU_read08<PROCNUM>(source++);
+		u8 diff = mem.read08(source++);
 		data += diff;
-		_MMU_write08<PROCNUM>(dest++, data);
+		mem.write08(dest++, data);
 		len--;
 	}
 	return 1;
@@ -957,29 +1052,30 @@ TEMPLATE static u32 Diff8bitUnFilterWram() //this one might be different on arm7
 
 TEMPLATE static u32 Diff16bitUnFilter()
 {
+	BiosMemory<PROCNUM> mem;
 	//INFO("swi Diff16bitUnFilter\n");
 
 	u32 source = cpu->R[0];
 	u32 dest = cpu->R[1];
 
-	CompressionHeader header(_MMU_read32<PROCNUM>(source));
+	CompressionHeader header(mem.read32(source));
 	source += 4;
 
-	if(header.DataSize() != 2) printf("WARNING: incorrect header passed to Diff16bitUnFilter\n");
-	if(header.Type() != 8) printf("WARNING: incorrect header passed to Diff16bitUnFilter\n");
+	if(header.DataSize() != 2) CORELOG_WARN("WARNING: incorrect header passed to Diff16bitUnFilter\n");
+	if(header.Type() != 8) CORELOG_WARN("WARNING: incorrect header passed to Diff16bitUnFilter\n");
 	u32 len = header.DecompressedSize();
 
-	u16 data = _MMU_read16<PROCNUM>(source);
+	u16 data = mem.read16(source);
 	source += 2;
-	_MMU_write16<PROCNUM>(dest, data);
+	mem.write16(dest, data);
 	dest += 2;
 	len -= 2;
 
 	while(len >= 2) {
-		u16 diff = _MMU_read16<PROCNUM>(source);
+		u16 diff = mem.read16(source);
 		source += 2;
 		data += diff;
-		_MMU_write16<PROCNUM>(dest, data);
+		mem.write16(dest, data);
 		dest += 2;
 		len -= 2;
 	}
@@ -1006,7 +1102,7 @@ TEMPLATE static u32 getSineTab()
 	//ds returns garbage according to gbatek, but we must protect ourselves
 	if(cpu->R[0] >= ARRAY_SIZE(getsinetbl))
 	{
-		printf("Invalid SWI getSineTab: %08X\n",cpu->R[0]);
+		CORELOG_INFO("Invalid SWI getSineTab: %08X\n",cpu->R[0]);
 		return 1;
 	}
 
@@ -1021,7 +1117,7 @@ TEMPLATE static u32 getPitchTab()
 	//ds returns garbage according to gbatek, but we must protect ourselves
 	if(cpu->R[0] >= ARRAY_SIZE(getpitchtbl))
 	{
-		printf("Invalid SWI getPitchTab: %08X\n",cpu->R[0]);
+		CORELOG_INFO("Invalid SWI getPitchTab: %08X\n",cpu->R[0]);
 		return 1;
 	}
 
@@ -1035,7 +1131,7 @@ TEMPLATE static u32 getVolumeTab()
 	//ds returns garbage according to gbatek, but we must protect ourselves
 	if(cpu->R[0] >= ARRAY_SIZE(getvoltbl))
 	{
-		printf("Invalid SWI getVolumeTab: %08X\n",cpu->R[0]);
+		CORELOG_INFO("Invalid SWI getVolumeTab: %08X\n",cpu->R[0]);
 		return 1;
 	}
 	cpu->R[0] = getvoltbl[cpu->R[0]];
@@ -24,10 +24,20 @@
 #include "MMU.h"
 #include "debug.h"
 #include "utils/xstring.h"
+#include "utils/task.h"
+
+#include <sys/stat.h>
 
 #ifndef _MSC_VER 
 #include <stdint.h>
 #endif
+#include <algorithm>
+
+#if defined(ENABLE_SSE2)
+#include <emmintrin.h>
+#elif defined(ENABLE_NEON)
+#include <arm_neon.h>
+#endif
 
 CHEATS *cheats = NULL;
 CHEATSEARCH *cheatSearch = NULL;
@@ -36,6 +46,7 @@ void CHEATS::clear()
 {
 	list.resize(0);
 	currentGet = 0;
+	programValid = false;
 }
 
 void CHEATS::init(char *path)
@@ -57,6 +68,7 @@ BOOL CHEATS::add(u8 size, u32 address, u32 val, char *description, BOOL enabled)
 	list[num].size = size;
 	this->setDescription(description, num);
 	list[num].enabled = enabled;
+	programValid = false;
 	return TRUE;
 }
 
@@ -70,340 +82,366 @@ BOOL CHEATS::update(u8 size, u32 address, u32 val, char *description, BOOL enabl
 	list[pos].size = size;
 	this->setDescription(description, pos);
 	list[pos].enabled = enabled;
+	programValid = false;
 	return TRUE;
 }
 
-void CHEATS::ARparser(CHEATS_LIST& list)
+//the action replay codes of the enabled cheats are decoded once, into one program for process() to run, instead of every frame.
+//there is still an op for each code line, so the jumps of the loops and the line skipping of the E codes mean what they did;
+//an op for the end of each cheat gives the next one fresh registers.
+enum CHEAT_OPCODE
 {
-	u8	type = 0;
-	u8	subtype = 0;
-	u32	hi = 0;
-	u32	lo = 0;
-	u32	addr = 0;
-	u32	val = 0;
-	// AR temporary vars & flags
-	u32	offset = 0;
-	u32	datareg = 0;
-	u32	loopcount = 0;
-	u32	counter = 0;
-	u32	if_flag = 0;
-	s32 loopbackline = 0;
-	u32 loop_flag = 0;
-	
-	for (int i=0; i < list.num; i++)
+	CHEAT_OP_NOP,
+	CHEAT_OP_WRITE32,		//0XXXXXXX YYYYYYYY   word[XXXXXXX+offset] = YYYYYYYY
+	CHEAT_OP_WRITE16,		//1XXXXXXX 0000YYYY   half[XXXXXXX+offset] = YYYY
+	CHEAT_OP_WRITE08,		//2XXXXXXX 000000YY   byte[XXXXXXX+offset] = YY
+	CHEAT_OP_IF_GT32,		//3XXXXXXX YYYYYYYY   IF YYYYYYYY > word[XXXXXXX]   ;unsigned
+	CHEAT_OP_IF_LT32,		//4XXXXXXX YYYYYYYY   IF YYYYYYYY < word[XXXXXXX]   ;unsigned
+	CHEAT_OP_IF_EQ32,		//5XXXXXXX YYYYYYYY   IF YYYYYYYY = word[XXXXXXX]
+	CHEAT_OP_IF_NE32,		//6XXXXXXX YYYYYYYY   IF YYYYYYYY <> word[XXXXXXX]
+	CHEAT_OP_IF_GT16,		//7XXXXXXX ZZZZYYYY   IF YYYY > ((not ZZZZ) AND half[XXXXXXX])
+	CHEAT_OP_IF_LT16,		//8XXXXXXX ZZZZYYYY   IF YYYY < ((not ZZZZ) AND half[XXXXXXX])
+	CHEAT_OP_IF_EQ16,		//9XXXXXXX ZZZZYYYY   IF YYYY = ((not ZZZZ) AND half[XXXXXXX])
+	CHEAT_OP_IF_NE16,		//AXXXXXXX ZZZZYYYY   IF YYYY <> ((not ZZZZ) AND half[XXXXXXX])
+	CHEAT_OP_LOAD_OFFSET,	//BXXXXXXX 00000000   offset = word[XXXXXXX+offset]
+	CHEAT_OP_FOR,			//C0000000 YYYYYYYY   FOR loopcount=0 to YYYYYYYY  ;execute Y+1 times
+	CHEAT_OP_OFFSET_HERE,	//C4000000 00000000   offset = address of the C4000000 code ; V1.54
+	CHEAT_OP_IF_COUNTER,	//C5000000 XXXXYYYY   counter=counter+1, IF (counter AND YYYY) = XXXX ; V1.54
+	CHEAT_OP_STORE_OFFSET,	//C6000000 XXXXXXXX   [XXXXXXXX]=offset ; V1.54
+	CHEAT_OP_ENDIF,			//D0000000 00000000   ENDIF
+	CHEAT_OP_NEXT,			//D1000000 00000000   NEXT loopcount
+	CHEAT_OP_NEXT_FLUSH,	//D2000000 00000000   NEXT loopcount, and then FLUSH everything
+	CHEAT_OP_SET_OFFSET,	//D3000000 XXXXXXXX   offset = XXXXXXXX
+	CHEAT_OP_ADD_DATA,		//D4000000 XXXXXXXX   datareg = datareg + XXXXXXXX
+	CHEAT_OP_SET_DATA,		//D5000000 XXXXXXXX   datareg = XXXXXXXX
+	CHEAT_OP_STORE_DATA32,	//D6000000 XXXXXXXX   word[XXXXXXXX+offset]=datareg, offset=offset+4
+	CHEAT_OP_STORE_DATA16,	//D7000000 XXXXXXXX   half[XXXXXXXX+offset]=datareg, offset=offset+2
+	CHEAT_OP_STORE_DATA08,	//D8000000 XXXXXXXX   byte[XXXXXXXX+offset]=datareg, offset=offset+1
+	CHEAT_OP_LOAD_DATA32,	//D9000000 XXXXXXXX   datareg = word[XXXXXXXX+offset]
+	CHEAT_OP_LOAD_DATA16,	//DA000000 XXXXXXXX   datareg = half[XXXXXXXX+offset]
+	CHEAT_OP_LOAD_DATA08,	//DB000000 XXXXXXXX   datareg = byte[XXXXXXXX+offset] ;bugged on pre-v1.54
+	CHEAT_OP_ADD_OFFSET,	//DC000000 XXXXXXXX   offset = offset + XXXXXXXX
+	CHEAT_OP_COPY_PARAMS,	//EXXXXXXX YYYYYYYY   Copy YYYYYYYY parameter bytes to [XXXXXXXX+offset...]
+	CHEAT_OP_COPY,			//FXXXXXXX YYYYYYYY   Copy YYYYYYYY bytes from [offset..] to [XXXXXXX...]
+	CHEAT_OP_END,
+	//the internal cheat system's, to 0x02000000|address
+	CHEAT_OP_INTERNAL08,
+	CHEAT_OP_INTERNAL16,
+	CHEAT_OP_INTERNAL24,
+	CHEAT_OP_INTERNAL32,
+};
+
+static const u8 cheatOpcodesCD[2][16] = {
+	{ CHEAT_OP_FOR, CHEAT_OP_NOP, CHEAT_OP_NOP, CHEAT_OP_NOP, CHEAT_OP_OFFSET_HERE, CHEAT_OP_IF_COUNTER, CHEAT_OP_STORE_OFFSET, CHEAT_OP_NOP,
+	  CHEAT_OP_NOP, CHEAT_OP_NOP, CHEAT_OP_NOP, CHEAT_OP_NOP, CHEAT_OP_NOP, CHEAT_OP_NOP, CHEAT_OP_NOP, CHEAT_OP_NOP },
+	{ CHEAT_OP_ENDIF, CHEAT_OP_NEXT, CHEAT_OP_NEXT_FLUSH, CHEAT_OP_SET_OFFSET, CHEAT_OP_ADD_DATA, CHEAT_OP_SET_DATA, CHEAT_OP_STORE_DATA32, CHEAT_OP_STORE_DATA16,
+	  CHEAT_OP_STORE_DATA08, CHEAT_OP_LOAD_DATA32, CHEAT_OP_LOAD_DATA16, CHEAT_OP_LOAD_DATA08, CHEAT_OP_ADD_OFFSET, CHEAT_OP_NOP, CHEAT_OP_NOP, CHEAT_OP_NOP },
+};
+
+void CHEATS::compile()
+{
+	program.clear();
+	programData.clear();
+
+	for (size_t n = 0; n < list.size(); n++)
 	{
-		type = list.code[i][0] >> 28;
-		subtype = (list.code[i][0] >> 24) & 0x0F;
+		const CHEATS_LIST& cheat = list[n];
+		if (!cheat.enabled) continue;
 
-		hi = list.code[i][0] & 0x0FFFFFFF;
-		lo = list.code[i][1];
+		CHEAT_OP op;
+		op.next = 0;
+		op.data = 0;
 
-		if (if_flag > 0) 
+		if (cheat.type == 0)
 		{
-			if ((type == 0x0E)) i += ((lo + 7) / 8);
-			if ( (type == 0x0D) && (subtype == 0)) if_flag--;	// ENDIF
-			if ( (type == 0x0D) && (subtype == 2))				// NEXT & Flush
-			{
-				if (loop_flag)
-					i = (loopbackline-1);
-				else
-				{
-					offset = 0;
-					datareg = 0;
-					loopcount = 0;
-					counter = 0;
-					if_flag = 0;
-					loop_flag = 0;
-				}
-			}
+			op.kind = CHEAT_OP_INTERNAL08 + std::min<u8>(cheat.size, 3);
+			op.hi = cheat.code[0][0] | 0x02000000;
+			op.lo = cheat.code[0][1];
+			program.push_back(op);
 			continue;
 		}
+		if (cheat.type != 1) continue;
 
-		switch (type)
+		const u32 base = program.size();
+		const int num = std::min(std::max(cheat.num, 0), MAX_XX_CODE);
+		const u32 end = base + num;
+		for (int i = 0; i < num; i++)
 		{
-			case 0x00:
+			const u8 type = cheat.code[i][0] >> 28;
+			const u8 subtype = (cheat.code[i][0] >> 24) & 0x0F;
+			op.hi = cheat.code[i][0] & 0x0FFFFFFF;
+			op.lo = cheat.code[i][1];
+			op.next = 0;
+			op.data = 0;
+
+			switch (type)
 			{
-				if (hi==0)
-				{
-					//manual hook
-				}
-				else
-				if ((hi==0x0000AA99) && (lo==0))	// 0000AA99 00000000   parameter bytes 9..10 for above code (padded with 00s)
-				{
-					//parameter bytes 9..10 for above code (padded with 00s)
-				}
-				else	// 0XXXXXXX YYYYYYYY   word[XXXXXXX+offset] = YYYYYYYY
+				case 0x0:
+					//manual hook, and the parameter bytes 9..10 of the code before it
+					if (op.hi == 0 || (op.hi == 0x0000AA99 && op.lo == 0)) op.kind = CHEAT_OP_NOP;
+					else op.kind = CHEAT_OP_WRITE32;
+					break;
+				case 0x4:
+					//44332211 88776655   parameter bytes 1..8 for above code  (example)
+					if (op.hi == 0x04332211 && op.lo == 88776655) op.kind = CHEAT_OP_NOP;
+					else op.kind = CHEAT_OP_IF_LT32;
+					break;
+				case 0xC: op.kind = cheatOpcodesCD[0][subtype]; break;
+				case 0xD: op.kind = cheatOpcodesCD[1][subtype]; break;
+				case 0xE:
 				{
-					addr = hi + offset;
-					_MMU_write32<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, lo);
+					op.kind = CHEAT_OP_COPY_PARAMS;
+					//the bytes are the code words of the lines after it, which are stepped over
+					u32 maxByteReadLocation = ((2 * 4) * (MAX_XX_CODE - i - 1)) - 1; // 2 = 2 array dimensions, 4 = 4 bytes per array element
+					if (op.lo <= maxByteReadLocation)
+					{
+						const u8 *params = (const u8*)cheat.code[i+1];
+						op.data = programData.size();
+						programData.insert(programData.end(), params, params + op.lo);
+					}
+					else
+						op.data = 0xFFFFFFFF;
+					break;
 				}
+				case 0xF: op.kind = CHEAT_OP_COPY; break;
+				default: op.kind = CHEAT_OP_WRITE32 + type - 0x0; break;
 			}
-			break;
-
-			case 0x01:	// 1XXXXXXX 0000YYYY   half[XXXXXXX+offset] = YYYY
-				addr = hi + offset;
-				_MMU_write16<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, lo);
-			break;
+			//where the E codes go on to, taken as well when they are skipped over
+			op.next = (u32)std::min<u64>((u64)base + i + 1 + (type == 0xE ? (op.lo + 7) / 8 : 0), end);
+			program.push_back(op);
+		}
 
-			case 0x02:	// 2XXXXXXX 000000YY   byte[XXXXXXX+offset] = YY
-				addr = hi + offset;
-				_MMU_write08<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, lo);
-			break;
+		op.kind = CHEAT_OP_END;
+		op.hi = op.lo = op.next = op.data = 0;
+		program.push_back(op);
+	}
 
-			case 0x03:	// 3XXXXXXX YYYYYYYY   IF YYYYYYYY > word[XXXXXXX]   ;unsigned
-				if (hi == 0) hi = offset;	// V1.54+
-				val = _MMU_read32<ARMCPU_ARM9,MMU_AT_DEBUG>(hi);
-				if ( lo > val )
-				{
-					if (if_flag > 0) if_flag--;
-				}
-				else
-				{
-					if_flag++;
-				}
-			break;
+	programValid = true;
+}
 
-			case 0x04:	// 4XXXXXXX YYYYYYYY   IF YYYYYYYY < word[XXXXXXX]   ;unsigned
-				if ((hi == 0x04332211) && (lo == 88776655))	//44332211 88776655   parameter bytes 1..8 for above code  (example)
-				{
-					break;
-				}
-				if (hi == 0) hi = offset;	// V1.54+
-				val = _MMU_read32<ARMCPU_ARM9,MMU_AT_DEBUG>(hi);
-				if ( lo < val )
-				{
-					if (if_flag > 0) if_flag--;
-				}
-				else
-				{
-					if_flag++;
-				}
-			break;
+//main memory goes straight to MMU.MAIN_MEM, the way the inline accessors do it, unless the dtcm is over it.
+//anything else goes through them as before, as does everything while the debugger or lua want to see it
+static bool cheatDirect;
 
-			case 0x05:	// 5XXXXXXX YYYYYYYY   IF YYYYYYYY = word[XXXXXXX]
-				if (hi == 0) hi = offset;	// V1.54+
-				val = _MMU_read32<ARMCPU_ARM9,MMU_AT_DEBUG>(hi);
-				if ( lo == val )
-				{
-					if (if_flag > 0) if_flag--;
-				}
-				else
-				{
-					if_flag++;
-				}
-			break;
+static FORCEINLINE bool cheatMainMem(u32 addr)
+{
+	return cheatDirect && (addr & 0x0F000000) == 0x02000000 && (addr & ~0x3FFF) != MMU.DTCMRegion;
+}
 
-			case 0x06:	// 6XXXXXXX YYYYYYYY   IF YYYYYYYY <> word[XXXXXXX]
-				if (hi == 0) hi = offset;	// V1.54+
-				val = _MMU_read32<ARMCPU_ARM9,MMU_AT_DEBUG>(hi);
-				if ( lo != val )
-				{
-					if (if_flag > 0) if_flag--;
-				}
-				else
-				{
-					if_flag++;
-				}
-			break;
+static FORCEINLINE u32 cheatRead32(u32 addr)
+{
+	if (cheatMainMem(addr)) return T1ReadLong_guaranteedAligned(MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32);
+	return _MMU_read32<ARMCPU_ARM9,MMU_AT_DEBUG>(addr);
+}
 
-			case 0x07:	// 7XXXXXXX ZZZZYYYY   IF YYYY > ((not ZZZZ) AND half[XXXXXXX])
-				if (hi == 0) hi = offset;	// V1.54+
-				val = _MMU_read16<ARMCPU_ARM9,MMU_AT_DEBUG>(hi);
-				if ( (lo & 0xFFFF) > ( (~(lo >> 16)) & val) )
-				{
-					if (if_flag > 0) if_flag--;
-				}
-				else
-				{
-					if_flag++;
-				}
-			break;
+static FORCEINLINE u16 cheatRead16(u32 addr)
+{
+	if (cheatMainMem(addr)) return T1ReadWord_guaranteedAligned(MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16);
+	return _MMU_read16<ARMCPU_ARM9,MMU_AT_DEBUG>(addr);
+}
 
-			case 0x08:	// 8XXXXXXX ZZZZYYYY   IF YYYY < ((not ZZZZ) AND half[XXXXXXX])
-				if (hi == 0) hi = offset;	// V1.54+
-				val = _MMU_read16<ARMCPU_ARM9,MMU_AT_DEBUG>(hi);
-				if ( (lo & 0xFFFF) < ( (~(lo >> 16)) & val) )
-				{
-					if (if_flag > 0) if_flag--;
-				}
-				else
-				{
-					if_flag++;
-				}
-			break;
+static FORCEINLINE u8 cheatRead08(u32 addr)
+{
+	if (cheatMainMem(addr)) return T1ReadByte(MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK);
+	return _MMU_read08<ARMCPU_ARM9,MMU_AT_DEBUG>(addr);
+}
 
-			case 0x09:	// 9XXXXXXX ZZZZYYYY   IF YYYY = ((not ZZZZ) AND half[XXXXXXX])
-				if (hi == 0) hi = offset;	// V1.54+
-				val = _MMU_read16<ARMCPU_ARM9,MMU_AT_DEBUG>(hi);
-				if ( (lo & 0xFFFF) == ( (~(lo >> 16)) & val) )
-				{
-					if (if_flag > 0) if_flag--;
-				}
-				else
-				{
-					if_flag++;
-				}
-			break;
+static FORCEINLINE void cheatWrite32(u32 addr, u32 val)
+{
+	if (cheatMainMem(addr))
+	{
+#ifdef HAVE_JIT
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 0);
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 1);
+#endif
+		MMU_touchMainMem(addr);
+		T1WriteLong(MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32, val);
+	}
+	else
+		_MMU_write32<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, val);
+}
 
-			case 0x0A:	// AXXXXXXX ZZZZYYYY   IF YYYY <> ((not ZZZZ) AND half[XXXXXXX])
-				if (hi == 0) hi = offset;	// V1.54+
-				val = _MMU_read16<ARMCPU_ARM9,MMU_AT_DEBUG>(hi);
-				if ( (lo & 0xFFFF) != ( (~(lo >> 16)) & val) )
-				{
-					if (if_flag > 0) if_flag--;
-				}
-				else
-				{
-					if_flag++;
-				}
-			break;
+static FORCEINLINE void cheatWrite16(u32 addr, u16 val)
+{
+	if (cheatMainMem(addr))
+	{
+#ifdef HAVE_JIT
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 0);
+#endif
+		MMU_touchMainMem(addr);
+		T1WriteWord(MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16, val);
+	}
+	else
+		_MMU_write16<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, val);
+}
 
-			case 0x0B:	// BXXXXXXX 00000000   offset = word[XXXXXXX+offset]
-				addr = hi + offset;
-				offset = _MMU_read32<ARMCPU_ARM9,MMU_AT_DEBUG>(addr);;
-			break;
+static FORCEINLINE void cheatWrite08(u32 addr, u8 val)
+{
+	if (cheatMainMem(addr))
+	{
+#ifdef HAVE_JIT
+		JIT_INVALIDATE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK, 0);
+#endif
+		MMU_touchMainMem(addr);
+		T1WriteByte(MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK, val);
+	}
+	else
+		_MMU_write08<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, val);
+}
 
-			case 0x0C:
-				switch (subtype)
-				{
-					case 0x0:	// C0000000 YYYYYYYY   FOR loopcount=0 to YYYYYYYY  ;execute Y+1 times
-						if (loopcount < (lo+1))
-							loop_flag = 1;
-						else
-							loop_flag = 0;
-						loopcount++;
-						loopbackline = i;
-					break;
+void CHEATS::run()
+{
+	cheatDirect = !CheckDebugEvent(DEBUG_EVENT_READ) && !CheckDebugEvent(DEBUG_EVENT_WRITE);
+#ifdef HAVE_LUA
+	cheatDirect = false;
+#endif
 
-					case 0x4:	// C4000000 00000000   offset = address of the C4000000 code ; V1.54
-						printf("AR: untested code C4\n");
-					break;
+	// AR temporary vars & flags
+	u32	offset = 0;
+	u32	datareg = 0;
+	u32	loopcount = 0;
+	u32	counter = 0;
+	u32	if_flag = 0;
+	u32 loopbackline = 0;
+	u32 loop_flag = 0;
 
-					case 0x5:	// C5000000 XXXXYYYY   counter=counter+1, IF (counter AND YYYY) = XXXX ; V1.54
-						counter++;
-						if ( (counter & (lo & 0xFFFF)) == ((lo >> 8) & 0xFFFF) )
-						{
-							if (if_flag > 0) if_flag--;
-						}
-						else
-						{
-							if_flag++;
-						}
-					break;
+	const CHEAT_OP *ops = &program[0];
+	const u32 count = program.size();
+	for (u32 i = 0; i < count; i++)
+	{
+		const CHEAT_OP& op = ops[i];
+		u32 hi = op.hi;
+		const u32 lo = op.lo;
+		bool cond;
 
-					case 0x6:	// C6000000 XXXXXXXX   [XXXXXXXX]=offset ; V1.54
-						_MMU_write32<ARMCPU_ARM9,MMU_AT_DEBUG>(lo, offset);
-					break;
-				}
-			break;
+		if (op.kind == CHEAT_OP_END)
+		{
+			offset = 0;
+			datareg = 0;
+			loopcount = 0;
+			counter = 0;
+			if_flag = 0;
+			loopbackline = i + 1;
+			loop_flag = 0;
+			continue;
+		}
 
-			case 0x0D:
+		if (if_flag > 0)
+		{
+			if (op.kind == CHEAT_OP_COPY_PARAMS) i = op.next - 1;
+			if (op.kind == CHEAT_OP_ENDIF) if_flag--;
+			if (op.kind == CHEAT_OP_NEXT_FLUSH)
 			{
-				switch (subtype)
+				if (loop_flag)
+					i = loopbackline - 1;
+				else
 				{
-					case 0x0:	// D0000000 00000000   ENDIF
-					break;
-
-					case 0x1:	// D1000000 00000000   NEXT loopcount
-						if (loop_flag)
-							i = (loopbackline-1);
-					break;
-
-					case 0x2:	// D2000000 00000000   NEXT loopcount, and then FLUSH everything
-						if (loop_flag)
-							i = (loopbackline-1);
-						else
-						{
-							offset = 0;
-							datareg = 0;
-							loopcount = 0;
-							counter = 0;
-							if_flag = 0;
-							loop_flag = 0;
-						}
-					break;
-
-					case 0x3:	// D3000000 XXXXXXXX   offset = XXXXXXXX
-						offset = lo;
-					break;
-
-					case 0x4:	// D4000000 XXXXXXXX   datareg = datareg + XXXXXXXX
-						datareg += lo;
-					break;
-
-					case 0x5:	// D5000000 XXXXXXXX   datareg = XXXXXXXX
-						datareg = lo;
-					break;
-
-					case 0x6:	// D6000000 XXXXXXXX   word[XXXXXXXX+offset]=datareg, offset=offset+4
-						addr = lo + offset;
-						_MMU_write32<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, datareg);
-						offset += 4;
-					break;
-
-					case 0x7:	// D7000000 XXXXXXXX   half[XXXXXXXX+offset]=datareg, offset=offset+2
-						addr = lo + offset;
-						_MMU_write16<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, datareg);
-						offset += 2;
-					break;
-
-					case 0x8:	// D8000000 XXXXXXXX   byte[XXXXXXXX+offset]=datareg, offset=offset+1
-						addr = lo + offset;
-						_MMU_write08<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, datareg);
-						offset += 1;
-					break;
+					offset = 0;
+					datareg = 0;
+					loopcount = 0;
+					counter = 0;
+					if_flag = 0;
+					loop_flag = 0;
+				}
+			}
+			continue;
+		}
 
-					case 0x9:	// D9000000 XXXXXXXX   datareg = word[XXXXXXXX+offset]
-						addr = lo + offset;
-						datareg = _MMU_read32<ARMCPU_ARM9,MMU_AT_DEBUG>(addr);
-					break;
+		switch (op.kind)
+		{
+			case CHEAT_OP_WRITE32: cheatWrite32(hi + offset, lo); continue;
+			case CHEAT_OP_WRITE16: cheatWrite16(hi + offset, lo); continue;
+			case CHEAT_OP_WRITE08: cheatWrite08(hi + offset, lo); continue;
+
+			case CHEAT_OP_IF_GT32: if (hi == 0) hi = offset; cond = lo > cheatRead32(hi); break;
+			case CHEAT_OP_IF_LT32: if (hi == 0) hi = offset; cond = lo < cheatRead32(hi); break;
+			case CHEAT_OP_IF_EQ32: if (hi == 0) hi = offset; cond = lo == cheatRead32(hi); break;
+			case CHEAT_OP_IF_NE32: if (hi == 0) hi = offset; cond = lo != cheatRead32(hi); break;
+			case CHEAT_OP_IF_GT16: if (hi == 0) hi = offset; cond = (lo & 0xFFFF) > ((~(lo >> 16)) & cheatRead16(hi)); break;
+			case CHEAT_OP_IF_LT16: if (hi == 0) hi = offset; cond = (lo & 0xFFFF) < ((~(lo >> 16)) & cheatRead16(hi)); break;
+			case CHEAT_OP_IF_EQ16: if (hi == 0) hi = offset; cond = (lo & 0xFFFF) == ((~(lo >> 16)) & cheatRead16(hi)); break;
+			case CHEAT_OP_IF_NE16: if (hi == 0) hi = offset; cond = (lo & 0xFFFF) != ((~(lo >> 16)) & cheatRead16(hi)); break;
+
+			case CHEAT_OP_LOAD_OFFSET: offset = cheatRead32(hi + offset); continue;
+
+			case CHEAT_OP_FOR:
+				loop_flag = loopcount < (lo+1);
+				loopcount++;
+				loopbackline = i;
+				continue;
+
+			case CHEAT_OP_OFFSET_HERE:
+				CORELOG_INFO("AR: untested code C4\n");
+				continue;
+
+			case CHEAT_OP_IF_COUNTER:
+				counter++;
+				cond = (counter & (lo & 0xFFFF)) == ((lo >> 8) & 0xFFFF);
+				break;
 
-					case 0xA:	// DA000000 XXXXXXXX   datareg = half[XXXXXXXX+offset]
-						addr = lo + offset;
-						datareg = _MMU_read16<ARMCPU_ARM9,MMU_AT_DEBUG>(addr);
-					break;
+			case CHEAT_OP_STORE_OFFSET: cheatWrite32(lo, offset); continue;
 
-					case 0xB:	// DB000000 XXXXXXXX   datareg = byte[XXXXXXXX+offset] ;bugged on pre-v1.54
-						addr = lo + offset;
-						datareg = _MMU_read08<ARMCPU_ARM9,MMU_AT_DEBUG>(addr);
-					break;
+			case CHEAT_OP_NEXT:
+				if (loop_flag)
+					i = loopbackline - 1;
+				continue;
 
-					case 0xC:	// DC000000 XXXXXXXX   offset = offset + XXXXXXXX
-						offset += lo;
-					break;
+			case CHEAT_OP_NEXT_FLUSH:
+				if (loop_flag)
+					i = loopbackline - 1;
+				else
+				{
+					offset = 0;
+					datareg = 0;
+					loopcount = 0;
+					counter = 0;
+					if_flag = 0;
+					loop_flag = 0;
 				}
-			}
-			break;
-
-			case 0xE:		// EXXXXXXX YYYYYYYY   Copy YYYYYYYY parameter bytes to [XXXXXXXX+offset...]
-			{
-				u8	*tmp_code = (u8*)(list.code[i+1]);
-				u32 addr = hi+offset;
-				u32 maxByteReadLocation = ((2 * 4) * (MAX_XX_CODE - i - 1)) - 1; // 2 = 2 array dimensions, 4 = 4 bytes per array element
-				
-				if (lo <= maxByteReadLocation)
+				continue;
+
+			case CHEAT_OP_SET_OFFSET: offset = lo; continue;
+			case CHEAT_OP_ADD_DATA: datareg += lo; continue;
+			case CHEAT_OP_SET_DATA: datareg = lo; continue;
+			case CHEAT_OP_STORE_DATA32: cheatWrite32(lo + offset, datareg); offset += 4; continue;
+			case CHEAT_OP_STORE_DATA16: cheatWrite16(lo + offset, datareg); offset += 2; continue;
+			case CHEAT_OP_STORE_DATA08: cheatWrite08(lo + offset, datareg); offset += 1; continue;
+			case CHEAT_OP_LOAD_DATA32: datareg = cheatRead32(lo + offset); continue;
+			case CHEAT_OP_LOAD_DATA16: datareg = cheatRead16(lo + offset); continue;
+			case CHEAT_OP_LOAD_DATA08: datareg = cheatRead08(lo + offset); continue;
+			case CHEAT_OP_ADD_OFFSET: offset += lo; continue;
+
+			case CHEAT_OP_COPY_PARAMS:
+				if (op.data != 0xFFFFFFFF)
 				{
+					const u8 *params = &programData[op.data];
+					u32 addr = hi + offset;
 					for (u32 t = 0; t < lo; t++)
-					{
-						u8	tmp = tmp_code[t];
-						_MMU_write08<ARMCPU_ARM9,MMU_AT_DEBUG>(addr, tmp);
-						addr++;
-					}
+						cheatWrite08(addr++, params[t]);
 				}
-				
-				i += ((lo + 7) / 8);
-			}
-			break;
+				i = op.next - 1;
+				continue;
 
-			case 0xF:		// FXXXXXXX YYYYYYYY   Copy YYYYYYYY bytes from [offset..] to [XXXXXXX...]
+			case CHEAT_OP_COPY:
 				for (u32 t = 0; t < lo; t++)
-				{
-					u8 tmp = _MMU_read08<ARMCPU_ARM9,MMU_AT_DEBUG>(offset+t);
-					_MMU_write08<ARMCPU_ARM9,MMU_AT_DEBUG>(hi+t, tmp);
-				}
-			break;
-			default: PROGINFO("AR: ERROR unknown command 0x%2X at %08X:%08X\n", type, hi, lo); break;
+					cheatWrite08(hi + t, cheatRead08(offset + t));
+				continue;
+
+			case CHEAT_OP_INTERNAL08: cheatWrite08(hi, lo); continue;
+			case CHEAT_OP_INTERNAL16: cheatWrite16(hi, lo); continue;
+			case CHEAT_OP_INTERNAL24: cheatWrite32(hi, (cheatRead32(hi) & 0xFF000000) | (lo & 0x00FFFFFF)); continue;
+			case CHEAT_OP_INTERNAL32: cheatWrite32(hi, lo); continue;
+
+			default: continue;
+		}
+
+		//the conditionals
+		if (cond)
+		{
+			if (if_flag > 0) if_flag--;
 		}
+		else
+			if_flag++;
 	}
 }
 
@@ -412,6 +450,7 @@ BOOL CHEATS::add_AR_Direct(CHEATS_LIST cheat)
 	size_t num = list.size();
 	list.push_back(cheat);
 	list[num].type = 1;
+	programValid = false;
 	return TRUE;
 }
 
@@ -429,6 +468,7 @@ BOOL CHEATS::add_AR(char *code, char *description, BOOL enabled)
 	
 	this->setDescription(description, num);
 	list[num].enabled = enabled;
+	programValid = false;
 	return TRUE;
 }
 
@@ -444,6 +484,7 @@ BOOL CHEATS::update_AR(char *code, char *description, BOOL enabled, u32 pos)
 	}
 	
 	list[pos].enabled = enabled;
+	programValid = false;
 	return TRUE;
 }
 
@@ -458,6 +499,7 @@ BOOL CHEATS::add_CB(char *code, char *description, BOOL enabled)
 	
 	this->setDescription(description, num);
 	list[num].enabled = enabled;
+	programValid = false;
 	return TRUE;
 }
 
@@ -472,6 +514,7 @@ BOOL CHEATS::update_CB(char *code, char *description, BOOL enabled, u32 pos)
 		this->setDescription(description, pos);
 	}
 	list[pos].enabled = enabled;
+	programValid = false;
 	return TRUE;
 }
 
@@ -481,6 +524,7 @@ BOOL CHEATS::remove(u32 pos)
 	if (list.size() == 0) return FALSE;
 
 	list.erase(list.begin()+pos);
+	programValid = false;
 
 	return TRUE;
 }
@@ -508,18 +552,18 @@ BOOL CHEATS::getList(CHEATS_LIST *cheat)
 
 CHEATS_LIST* CHEATS::getListPtr()
 {
+	programValid = false;
 	return &this->list[0];
 }
 
 BOOL CHEATS::get(CHEATS_LIST *cheat, u32 pos)
 {
-	CHEATS_LIST *item = this->getItemByIndex(pos);
-	if (item == NULL)
+	if (pos >= this->getSize())
 	{
 		return FALSE;
 	}
 	
-	*cheat = *item;
+	*cheat = this->list[pos];
 	
 	return TRUE;
 }
@@ -531,6 +575,7 @@ CHEATS_LIST* CHEATS::getItemByIndex(const u32 pos)
 		return NULL;
 	}
 	
+	programValid = false;
 	return &this->list[pos];
 }
 
@@ -742,6 +787,7 @@ BOOL CHEATS::load()
 	buf = NULL;
 
 	fclose(flist);
+	programValid = false;
 	INFO("Added %i cheat codes\n", list.size());
 	
 	return TRUE;
@@ -751,49 +797,9 @@ void CHEATS::process()
 {
 	if (CommonSettings.cheatsDisable) return;
 	if (list.size() == 0) return;
-	size_t num = list.size();
-	for (size_t i = 0; i < num; i++)
-	{
-		if (!list[i].enabled) continue;
-
-		switch (list[i].type)
-		{
-			case 0:		// internal cheat system
-			{
-				//INFO("list at 0x02|%06X value %i (size %i)\n",list[i].code[0], list[i].lo[0], list[i].size);
-				u32 addr = list[i].code[0][0] | 0x02000000;
-				u32 val = list[i].code[0][1];
-				switch (list[i].size)
-				{
-				case 0: 
-					_MMU_write08<ARMCPU_ARM9,MMU_AT_DEBUG>(addr,val);
-					break;
-				case 1: 
-					_MMU_write16<ARMCPU_ARM9,MMU_AT_DEBUG>(addr,val);
-					break;
-				case 2:
-					{
-						u32 tmp = _MMU_read32<ARMCPU_ARM9,MMU_AT_DEBUG>(addr);
-						tmp &= 0xFF000000;
-						tmp |= (val & 0x00FFFFFF);
-						_MMU_write32<ARMCPU_ARM9,MMU_AT_DEBUG>(addr,tmp);
-						break;
-					}
-				case 3: 
-					_MMU_write32<ARMCPU_ARM9,MMU_AT_DEBUG>(addr,val);
-					break;
-				}
-				break;
-			} //end case 0 internal cheat system
-
-			case 1:		// Action Replay
-				ARparser(list[i]);
-				break;
-			case 2:		// Codebreaker
-				break;
-			default: continue;
-		}
-	}
+	if (!programValid) compile();
+	if (program.empty()) return;
+	run();
 }
 
 void CHEATS::getXXcodeString(CHEATS_LIST list, char *res_buf)
@@ -864,23 +870,234 @@ BOOL CHEATS::XXCodeFromString(CHEATS_LIST *cheatItem, const char *codeString)
 }
 
 // ========================================== search
+#define SEARCH_MEM_SIZE		(4 * 1024 * 1024)
+//once a search leaves this many candidates or fewer, they are kept as a list
+#define SEARCH_LIST_MAX		65536
+//the bitmask words each job of a dense search goes through
+#define SEARCH_GRAIN		1024
+
+static FORCEINLINE u32 searchRead(const u8 *src, u32 adr, u32 size)
+{
+	switch (size)
+	{
+		case 0: return T1ReadByte((u8*)src, adr);
+		case 1: return T1ReadWord((u8*)src, adr);
+		case 2: return src[adr] | (src[adr+1] << 8) | (src[adr+2] << 16);
+		default: return T1ReadLong((u8*)src, adr);
+	}
+}
+
+//0: greater than before, 1: less than before, 2: the same, 3: different. the exact searches are 2 against the value
+static FORCEINLINE bool searchCompare(u32 cur, u32 ref, u8 comp)
+{
+	switch (comp)
+	{
+		case 0: return cur > ref;
+		case 1: return cur < ref;
+		case 2: return cur == ref;
+		case 3: return cur != ref;
+		default: return false;
+	}
+}
+
+//a bit for each of the 16 values of SIZE bytes at cur that compare true, against the ones at old or against val
+#if defined(ENABLE_SSE2)
+typedef __m128i SearchVec;
+
+template<int SIZE> static FORCEINLINE SearchVec searchSplat(u32 val)
+{
+	return SIZE == 1 ? _mm_set1_epi8((char)val) : SIZE == 2 ? _mm_set1_epi16((short)val) : _mm_set1_epi32(val);
+}
+
+template<int SIZE> static FORCEINLINE SearchVec searchEq(SearchVec a, SearchVec b)
+{
+	return SIZE == 1 ? _mm_cmpeq_epi8(a, b) : SIZE == 2 ? _mm_cmpeq_epi16(a, b) : _mm_cmpeq_epi32(a, b);
+}
+
+//unsigned, which sse2 only compares signed: flipping the top bits makes the one the other
+template<int SIZE> static FORCEINLINE SearchVec searchGt(SearchVec a, SearchVec b)
+{
+	const SearchVec bias = searchSplat<SIZE>(1u << (SIZE*8 - 1));
+	a = _mm_xor_si128(a, bias);
+	b = _mm_xor_si128(b, bias);
+	return SIZE == 1 ? _mm_cmpgt_epi8(a, b) : SIZE == 2 ? _mm_cmpgt_epi16(a, b) : _mm_cmpgt_epi32(a, b);
+}
+
+template<int SIZE> static FORCEINLINE u32 searchBits(const SearchVec *r)
+{
+	if (SIZE == 1) return _mm_movemask_epi8(r[0]);
+	if (SIZE == 2) return _mm_movemask_epi8(_mm_packs_epi16(r[0], r[1]));
+	return _mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(r[0], r[1]), _mm_packs_epi32(r[2], r[3])));
+}
+
+static FORCEINLINE SearchVec searchLoad(const u8 *src) { return _mm_loadu_si128((const __m128i *)src); }
+#define SEARCH_SIMD
+#elif defined(ENABLE_NEON)
+typedef uint8x16_t SearchVec;
+
+template<int SIZE> static FORCEINLINE SearchVec searchSplat(u32 val)
+{
+	return SIZE == 1 ? vdupq_n_u8(val) : SIZE == 2 ? vreinterpretq_u8_u16(vdupq_n_u16(val)) : vreinterpretq_u8_u32(vdupq_n_u32(val));
+}
+
+template<int SIZE> static FORCEINLINE SearchVec searchEq(SearchVec a, SearchVec b)
+{
+	if (SIZE == 1) return vceqq_u8(a, b);
+	if (SIZE == 2) return vreinterpretq_u8_u16(vceqq_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b)));
+	return vreinterpretq_u8_u32(vceqq_u32(vreinterpretq_u32_u8(a), vreinterpretq_u32_u8(b)));
+}
+
+template<int SIZE> static FORCEINLINE SearchVec searchGt(SearchVec a, SearchVec b)
+{
+	if (SIZE == 1) return vcgtq_u8(a, b);
+	if (SIZE == 2) return vreinterpretq_u8_u16(vcgtq_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b)));
+	return vreinterpretq_u8_u32(vcgtq_u32(vreinterpretq_u32_u8(a), vreinterpretq_u32_u8(b)));
+}
+
+//neon has no movemask: the lanes are narrowed to a byte each, and the bytes weighted and added up
+template<int SIZE> static FORCEINLINE u32 searchBits(const SearchVec *r)
+{
+	static const u8 weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t b;
+	if (SIZE == 1)
+		b = r[0];
+	else if (SIZE == 2)
+		b = vcombine_u8(vmovn_u16(vreinterpretq_u16_u8(r[0])), vmovn_u16(vreinterpretq_u16_u8(r[1])));
+	else
+	{
+		const uint16x8_t lo = vcombine_u16(vmovn_u32(vreinterpretq_u32_u8(r[0])), vmovn_u32(vreinterpretq_u32_u8(r[1])));
+		const uint16x8_t hi = vcombine_u16(vmovn_u32(vreinterpretq_u32_u8(r[2])), vmovn_u32(vreinterpretq_u32_u8(r[3])));
+		b = vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+	}
+	const uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vandq_u8(b, vld1q_u8(weights)))));
+	return (u32)vgetq_lane_u64(sum, 0) | ((u32)vgetq_lane_u64(sum, 1) << 8);
+}
+
+static FORCEINLINE SearchVec searchLoad(const u8 *src) { return vld1q_u8(src); }
+#define SEARCH_SIMD
+#endif
+
+#ifdef SEARCH_SIMD
+template<int SIZE, bool EXACT>
+static FORCEINLINE u32 searchMask16(const u8 *cur, const u8 *old, SearchVec val, u8 comp)
+{
+	SearchVec r[SIZE];
+	for (int v = 0; v < SIZE; v++)
+	{
+		const SearchVec a = searchLoad(cur + v*16);
+		const SearchVec b = EXACT ? val : searchLoad(old + v*16);
+		r[v] = comp == 0 ? searchGt<SIZE>(a, b) : comp == 1 ? searchGt<SIZE>(b, a) : searchEq<SIZE>(a, b);
+	}
+	const u32 bits = searchBits<SIZE>(r);
+	return comp == 3 ? bits ^ 0xFFFF : bits;
+}
+
+template<int SIZE, bool EXACT>
+static void searchWordsSimd(u32 *statMem, const u8 *cur, const u8 *old, u32 val, u8 comp, int begin, int end, u32 &found)
+{
+	const SearchVec splat = searchSplat<SIZE>(val);
+	for (int w = begin; w < end; w++)
+	{
+		const u32 flags = statMem[w];
+		if (!flags) continue;
+		const u32 adr = w * 32 * SIZE;
+		const u32 bits = searchMask16<SIZE,EXACT>(cur + adr, old + adr, splat, comp)
+			| (searchMask16<SIZE,EXACT>(cur + adr + 16*SIZE, old + adr + 16*SIZE, splat, comp) << 16);
+		statMem[w] = flags & bits;
+		found += __builtin_popcount(flags & bits);
+	}
+}
+#endif
+
+struct CheatSearchJob
+{
+	u32 *statMem;
+	const u8 *cur;
+	const u8 *old;
+	u32 size;
+	u32 val;
+	u8 comp;
+	bool exact;
+	u32 amount;
+};
+
+void CHEATSEARCH::searchWords(void *param, int begin, int end)
+{
+	CheatSearchJob &job = *(CheatSearchJob *)param;
+	u32 found = 0;
+
+#ifdef SEARCH_SIMD
+	switch (job.size)
+	{
+		case 0:
+			if (job.exact) searchWordsSimd<1,true>(job.statMem, job.cur, job.old, job.val, job.comp, begin, end, found);
+			else searchWordsSimd<1,false>(job.statMem, job.cur, job.old, job.val, job.comp, begin, end, found);
+			break;
+		case 1:
+			if (job.exact) searchWordsSimd<2,true>(job.statMem, job.cur, job.old, job.val, job.comp, begin, end, found);
+			else searchWordsSimd<2,false>(job.statMem, job.cur, job.old, job.val, job.comp, begin, end, found);
+			break;
+		case 3:
+			if (job.exact) searchWordsSimd<4,true>(job.statMem, job.cur, job.old, job.val, job.comp, begin, end, found);
+			else searchWordsSimd<4,false>(job.statMem, job.cur, job.old, job.val, job.comp, begin, end, found);
+			break;
+	}
+	if (job.size == 2)
+#endif
+	{
+		//the 3 byte values don't line up with the vectors, so they go one at a time; only the candidates are looked at
+		const u32 step = job.size + 1;
+		for (int w = begin; w < end; w++)
+		{
+			u32 flags = job.statMem[w];
+			u32 keep = flags;
+			while (flags)
+			{
+				const u32 b = __builtin_ctz(flags);
+				flags &= flags - 1;
+				const u32 adr = (w * 32 + b) * step;
+				const u32 ref = job.exact ? job.val : searchRead(job.old, adr, job.size);
+				if (!searchCompare(searchRead(job.cur, adr, job.size), ref, job.comp))
+					keep &= ~(1u << b);
+			}
+			job.statMem[w] = keep;
+			found += __builtin_popcount(keep);
+		}
+	}
+
+	//the bytes the comparative search just went by are the ones the next one compares to
+	if (!job.exact)
+	{
+		const u32 from = begin * 32 * (job.size + 1);
+		const u32 to = std::min<u32>(end * 32 * (job.size + 1), SEARCH_MEM_SIZE);
+		memcpy((u8 *)job.old + from, job.cur + from, to - from);
+	}
+
+	__atomic_fetch_add(&job.amount, found, __ATOMIC_RELAXED);
+}
+
 BOOL CHEATSEARCH::start(u8 type, u8 size, u8 sign)
 {
 	if (statMem) return FALSE;
 	if (mem) return FALSE;
-
-	statMem = new u8 [ ( 4 * 1024 * 1024 ) / 8 ];
-	memset(statMem, 0xFF, ( 4 * 1024 * 1024 ) / 8);
-
-	// comparative search type (need 8Mb RAM !!! (4+4))
-	mem = new u8 [ ( 4 * 1024 * 1024 ) ];
-	memcpy(mem, MMU.MMU_MEM[0][0x20], ( 4 * 1024 * 1024 ) );
+	if (listed) return FALSE;
 
 	_type = type;
 	_size = size;
 	_sign = sign;
 	amount = 0;
 	lastRecord = 0;
+
+	//the values that fit whole in main memory; the bits past the last of them stay clear
+	count = SEARCH_MEM_SIZE / (_size + 1);
+	const u32 words = (count + 31) / 32;
+	statMem = new u32 [words];
+	memset(statMem, 0xFF, words * 4);
+	if (count % 32) statMem[words - 1] = (1u << (count % 32)) - 1;
+
+	// comparative search type (need 4.5Mb RAM: the bits and the snapshot)
+	mem = new u8 [ SEARCH_MEM_SIZE ];
+	memcpy(mem, MMU.MMU_MEM[0][0x20], SEARCH_MEM_SIZE );
 	
 	//INFO("Cheat search system is inited (type %s)\n", type?"comparative":"exact");
 	return TRUE;
@@ -899,208 +1116,108 @@ BOOL CHEATSEARCH::close()
 		delete [] mem;
 		mem = NULL;
 	}
+	std::vector<u32>().swap(candidates);
+	std::vector<u32>().swap(candidateVals);
+	listed = false;
 	amount = 0;
 	lastRecord = 0;
 	//INFO("Cheat search system is closed\n");
 	return FALSE;
 }
 
-u32 CHEATSEARCH::search(u32 val)
+u32 CHEATSEARCH::searchDense(bool exact, u32 val, u8 comp)
 {
-	amount = 0;
+	CheatSearchJob job;
+	job.statMem = statMem;
+	job.cur = MMU.MMU_MEM[ARMCPU_ARM9][0x20];
+	job.old = mem;
+	job.size = _size;
+	job.val = val;
+	job.comp = comp;
+	job.exact = exact;
+	job.amount = 0;
+
+	TaskPool::shared().parallelFor(0, (count + 31) / 32, SEARCH_GRAIN, &searchWords, &job);
+	return job.amount;
+}
 
-	switch (_size)
+u32 CHEATSEARCH::searchList(bool exact, u32 val, u8 comp)
+{
+	const u8 *cur = MMU.MMU_MEM[ARMCPU_ARM9][0x20];
+	const u32 step = _size + 1;
+	size_t n = 0;
+	for (size_t i = 0; i < candidates.size(); i++)
 	{
-		case 0:		// 1 byte
-			for (u32 i = 0; i < (4 * 1024 * 1024); i++)
-			{
-				u32	addr = (i >> 3);
-				u32	offs = (i % 8);
-				if (statMem[addr] & (1<<offs))
-				{
-					if ( T1ReadByte(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) == val )
-					{
-						statMem[addr] |= (1<<offs);
-						amount++;
-						continue;
-					}
-					statMem[addr] &= ~(1<<offs);
-				}
-			}
-		break;
+		const u32 value = searchRead(cur, candidates[i] * step, _size);
+		if (!searchCompare(value, exact ? val : candidateVals[i], comp)) continue;
+		candidates[n] = candidates[i];
+		candidateVals[n] = exact ? candidateVals[i] : value;
+		n++;
+	}
+	candidates.resize(n);
+	candidateVals.resize(n);
+	return n;
+}
 
-		case 1:		// 2 bytes
-			for (u32 i = 0; i < (4 * 1024 * 1024); i+=2)
-			{
-				u32	addr = (i >> 3);
-				u32	offs = (i % 8);
-				if (statMem[addr] & (3<<offs))
-				{
-					if ( T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) == val )
-					{
-						statMem[addr] |= (3<<offs);
-						amount++;
-						continue;
-					}
-					statMem[addr] &= ~(3<<offs);
-				}
-			}
-		break;
+void CHEATSEARCH::makeList()
+{
+	const u32 step = _size + 1;
+	const u32 words = (count + 31) / 32;
+	candidates.clear();
+	candidateVals.clear();
+	candidates.reserve(amount);
+	candidateVals.reserve(amount);
+	for (u32 w = 0; w < words; w++)
+	{
+		for (u32 flags = statMem[w]; flags; flags &= flags - 1)
+		{
+			const u32 index = w * 32 + __builtin_ctz(flags);
+			candidates.push_back(index);
+			candidateVals.push_back(searchRead(mem, index * step, _size));
+		}
+	}
 
-		case 2:		// 3 bytes
-			for (u32 i = 0; i < (4 * 1024 * 1024); i+=3)
-			{
-				u32	addr = (i >> 3);
-				u32	offs = (i % 8);
-				if (statMem[addr] & (0x7<<offs))
-				{
-					if ( (T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) & 0x00FFFFFF) == val )
-					{
-						statMem[addr] |= (0x7<<offs);
-						amount++;
-						continue;
-					}
-					statMem[addr] &= ~(0x7<<offs);
-				}
-			}
-		break;
+	delete [] statMem;
+	statMem = NULL;
+	delete [] mem;
+	mem = NULL;
+	listed = true;
+	lastRecord = 0;
+}
 
-		case 3:		// 4 bytes
-			for (u32 i = 0; i < (4 * 1024 * 1024); i+=4)
-			{
-				u32	addr = (i >> 3);
-				u32	offs = (i % 8);
-				if (statMem[addr] & (0xF<<offs))
-				{
-					if ( T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) == val )
-					{
-						statMem[addr] |= (0xF<<offs);
-						amount++;
-						continue;
-					}
-					statMem[addr] &= ~(0xF<<offs);
-				}
-			}
-		break;
+u32 CHEATSEARCH::search(u32 val)
+{
+	//a value that doesn't fit in _size bytes is never found, and mustn't be cut down to one that does
+	const u32 max = _size == 0 ? 0xFF : _size == 1 ? 0xFFFF : _size == 2 ? 0xFFFFFF : 0xFFFFFFFF;
+	const u8 comp = val > max ? 0xFF : 2;
+
+	if (listed)
+		amount = searchList(true, val, comp);
+	else if (statMem)
+	{
+		amount = comp == 2 ? searchDense(true, val, comp) : 0;
+		if (amount <= SEARCH_LIST_MAX) makeList();
 	}
+	else
+		amount = 0;
 
 	return (amount);
 }
 
 u32 CHEATSEARCH::search(u8 comp)
 {
-	BOOL	res = FALSE;
+	if (comp > 3) comp = 0xFF;
 
-	amount = 0;
-	
-	switch (_size)
+	if (listed)
+		amount = searchList(false, 0, comp);
+	else if (statMem)
 	{
-		case 0:		// 1 byte
-			for (u32 i = 0; i < (4 * 1024 * 1024); i++)
-			{
-				u32	addr = (i >> 3);
-				u32	offs = (i % 8);
-				if (statMem[addr] & (1<<offs))
-				{
-					switch (comp)
-					{
-						case 0: res=(T1ReadByte(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) > T1ReadByte(mem, i)); break;
-						case 1: res=(T1ReadByte(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) < T1ReadByte(mem, i)); break;
-						case 2: res=(T1ReadByte(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) == T1ReadByte(mem, i)); break;
-						case 3: res=(T1ReadByte(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) != T1ReadByte(mem, i)); break;
-						default: res = FALSE; break;
-					}
-					if ( res )
-					{
-						statMem[addr] |= (1<<offs);
-						amount++;
-						continue;
-					}
-					statMem[addr] &= ~(1<<offs);
-				}
-			}
-		break;
-
-		case 1:		// 2 bytes
-			for (u32 i = 0; i < (4 * 1024 * 1024); i+=2)
-			{
-				u32	addr = (i >> 3);
-				u32	offs = (i % 8);
-				if (statMem[addr] & (3<<offs))
-				{
-					switch (comp)
-					{
-						case 0: res=(T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) > T1ReadWord(mem, i)); break;
-						case 1: res=(T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) < T1ReadWord(mem, i)); break;
-						case 2: res=(T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) == T1ReadWord(mem, i)); break;
-						case 3: res=(T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) != T1ReadWord(mem, i)); break;
-						default: res = FALSE; break;
-					}
-					if ( res )
-					{
-						statMem[addr] |= (3<<offs);
-						amount++;
-						continue;
-					}
-					statMem[addr] &= ~(3<<offs);
-				}
-			}
-		break;
-
-		case 2:		// 3 bytes
-			for (u32 i = 0; i < (4 * 1024 * 1024); i+=3)
-			{
-				u32	addr = (i >> 3);
-				u32	offs = (i % 8);
-				if (statMem[addr] & (7<<offs))
-				{
-					switch (comp)
-					{
-						case 0: res=((T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) & 0x00FFFFFF) > (T1ReadLong(mem, i) & 0x00FFFFFF) ); break;
-						case 1: res=((T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) & 0x00FFFFFF) < (T1ReadLong(mem, i) & 0x00FFFFFF) ); break;
-						case 2: res=((T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) & 0x00FFFFFF) == (T1ReadLong(mem, i) & 0x00FFFFFF) ); break;
-						case 3: res=((T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) & 0x00FFFFFF) != (T1ReadLong(mem, i) & 0x00FFFFFF) ); break;
-						default: res = FALSE; break;
-					}
-					if ( res )
-					{
-						statMem[addr] |= (7<<offs);
-						amount++;
-						continue;
-					}
-					statMem[addr] &= ~(7<<offs);
-				}
-			}
-		break;
-
-		case 3:		// 4 bytes
-			for (u32 i = 0; i < (4 * 1024 * 1024); i+=4)
-			{
-				u32	addr = (i >> 3);
-				u32	offs = (i % 8);
-				if (statMem[addr] & (0xF<<offs))
-				{
-					switch (comp)
-					{
-						case 0: res=(T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) > T1ReadLong(mem, i)); break;
-						case 1: res=(T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) < T1ReadLong(mem, i)); break;
-						case 2: res=(T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) == T1ReadLong(mem, i)); break;
-						case 3: res=(T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) != T1ReadLong(mem, i)); break;
-						default: res = FALSE; break;
-					}
-					if ( res )
-					{
-						statMem[addr] |= (0xF<<offs);
-						amount++;
-						continue;
-					}
-					statMem[addr] &= ~(0xF<<offs);
-				}
-			}
-		break;
+		amount = comp <= 3 ? searchDense(false, 0, comp) : 0;
+		if (comp > 3) memcpy(mem, MMU.MMU_MEM[0][0x20], SEARCH_MEM_SIZE );
+		if (amount <= SEARCH_LIST_MAX) makeList();
 	}
-
-	memcpy(mem, MMU.MMU_MEM[0][0x20], ( 4 * 1024 * 1024 ) );
+	else
+		amount = 0;
 
 	return (amount);
 }
@@ -1112,36 +1229,38 @@ u32 CHEATSEARCH::getAmount()
 
 BOOL CHEATSEARCH::getList(u32 *address, u32 *curVal)
 {
-	u8	step = (_size+1);
-	u8	stepMem = 1;
-	switch (_size)
+	const u32 step = _size + 1;
+	u32 index;
+
+	if (listed)
 	{
-		case 1: stepMem = 0x3; break;
-		case 2: stepMem = 0x7; break;
-		case 3: stepMem = 0xF; break;
+		if (lastRecord >= candidates.size())
+		{
+			lastRecord = 0;
+			return FALSE;
+		}
+		index = candidates[lastRecord++];
 	}
-
-	for (u32 i = lastRecord; i < (4 * 1024 * 1024); i+=step)
+	else
 	{
-		u32	addr = (i >> 3);
-		u32	offs = (i % 8);
-		if (statMem[addr] & (stepMem<<offs))
+		if (!statMem) return FALSE;
+		const u32 words = (count + 31) / 32;
+		u32 w = lastRecord / 32;
+		u32 flags = w < words ? statMem[w] & (0xFFFFFFFF << (lastRecord % 32)) : 0;
+		while (!flags && ++w < words)
+			flags = statMem[w];
+		if (!flags)
 		{
-			*address = i;
-			lastRecord = i+step;
-			
-			switch (_size)
-			{
-				case 0: *curVal=(u32)T1ReadByte(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i); return TRUE;
-				case 1: *curVal=(u32)T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i); return TRUE;
-				case 2: *curVal=(u32)T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i) & 0x00FFFFFF; return TRUE;
-				case 3: *curVal=(u32)T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM9][0x20], i); return TRUE;
-				default: return TRUE;
-			}
+			lastRecord = 0;
+			return FALSE;
 		}
+		index = w * 32 + __builtin_ctz(flags);
+		lastRecord = index + 1;
 	}
-	lastRecord = 0;
-	return FALSE;
+
+	*address = index * step;
+	*curVal = searchRead(MMU.MMU_MEM[ARMCPU_ARM9][0x20], index * step, _size);
+	return TRUE;
 }
 
 void CHEATSEARCH::getListReset()
@@ -1150,47 +1269,79 @@ void CHEATSEARCH::getListReset()
 }
 
 // ========================================================================= Export
+//the R4 cipher, a byte at a time: the byte is xor'd with bits picked out of a 16 bit key, and the key then steps on
+//from itself and the encrypted byte. both steps only xor bits together, so each is the xor of a lookup on the low
+//and on the high byte of what goes into it, and the tables are built once from the bit by bit definition
+static u8 R4xorBits(u16 key)
+{
+	u8 _xor = 0;
+	if (key & 0x4000) _xor |= 0x80;
+	if (key & 0x1000) _xor |= 0x40;
+	if (key & 0x0800) _xor |= 0x20;
+	if (key & 0x0200) _xor |= 0x10;
+	if (key & 0x0080) _xor |= 0x08;
+	if (key & 0x0040) _xor |= 0x04;
+	if (key & 0x0002) _xor |= 0x02;
+	if (key & 0x0001) _xor |= 0x01;
+	return _xor;
+}
+
+//v is the encrypted byte in the upper 8 bits, xor'd with the key
+static u16 R4nextKeyBits(u16 v)
+{
+	u32 k = (u32)v << 16;
+	u32 x = k;
+	for (u8 j = 1; j < 32; j ++)
+		x ^= k >> j;
+	u16 key = 0x0000;
+	if (BIT_N(x, 23)) key |= 0x8000;
+	if (BIT_N(k, 22)) key |= 0x4000;
+	if (BIT_N(k, 21)) key |= 0x2000;
+	if (BIT_N(k, 20)) key |= 0x1000;
+	if (BIT_N(k, 19)) key |= 0x0800;
+	if (BIT_N(k, 18)) key |= 0x0400;
+	if (BIT_N(k, 17) != BIT_N(x, 31)) key |= 0x0200;
+	if (BIT_N(k, 16) != BIT_N(x, 30)) key |= 0x0100;
+	if (BIT_N(k, 30) != BIT_N(k, 29)) key |= 0x0080;
+	if (BIT_N(k, 29) != BIT_N(k, 28)) key |= 0x0040;
+	if (BIT_N(k, 28) != BIT_N(k, 27)) key |= 0x0020;
+	if (BIT_N(k, 27) != BIT_N(k, 26)) key |= 0x0010;
+	if (BIT_N(k, 26) != BIT_N(k, 25)) key |= 0x0008;
+	if (BIT_N(k, 25) != BIT_N(k, 24)) key |= 0x0004;
+	if (BIT_N(k, 25) != BIT_N(x, 26)) key |= 0x0002;
+	if (BIT_N(k, 24) != BIT_N(x, 25)) key |= 0x0001;
+	return key;
+}
+
+static struct R4Tables
+{
+	u16 keyLo[256], keyHi[256];
+	u8 xorLo[256], xorHi[256];
+	R4Tables()
+	{
+		for (u32 i = 0; i < 256; i++)
+		{
+			keyLo[i] = R4nextKeyBits(i);
+			keyHi[i] = R4nextKeyBits(i << 8);
+			xorLo[i] = R4xorBits(i);
+			xorHi[i] = R4xorBits(i << 8);
+		}
+	}
+} R4tables;
+
+//every 512 byte block n starts over from a key of its own, so any run of whole blocks can be decrypted by itself
 void CHEATSEXPORT::R4decrypt(u8 *buf, u32 len, u32 n)
 {
 	size_t r = 0;
 	while (r < len)
 	{
-		size_t i ;
 		u16 key = n ^ 0x484A;
-		for (i = 0 ; i < 512 && i < len - r ; i ++)
+		const size_t count = std::min<size_t>(512, len - r);
+		for (size_t i = 0 ; i < count ; i ++)
 		{
-			u8 _xor = 0;
-			if (key & 0x4000) _xor |= 0x80;
-			if (key & 0x1000) _xor |= 0x40;
-			if (key & 0x0800) _xor |= 0x20;
-			if (key & 0x0200) _xor |= 0x10;
-			if (key & 0x0080) _xor |= 0x08;
-			if (key & 0x0040) _xor |= 0x04;
-			if (key & 0x0002) _xor |= 0x02;
-			if (key & 0x0001) _xor |= 0x01;
-
-			u32 k = ((buf[i] << 8) ^ key) << 16;
-			u32 x = k;
-			for (u8 j = 1; j < 32; j ++)
-				x ^= k >> j;
-			key = 0x0000;
-			if (BIT_N(x, 23)) key |= 0x8000;
-			if (BIT_N(k, 22)) key |= 0x4000;
-			if (BIT_N(k, 21)) key |= 0x2000;
-			if (BIT_N(k, 20)) key |= 0x1000;
-			if (BIT_N(k, 19)) key |= 0x0800;
-			if (BIT_N(k, 18)) key |= 0x0400;
-			if (BIT_N(k, 17) != BIT_N(x, 31)) key |= 0x0200;
-			if (BIT_N(k, 16) != BIT_N(x, 30)) key |= 0x0100;
-			if (BIT_N(k, 30) != BIT_N(k, 29)) key |= 0x0080;
-			if (BIT_N(k, 29) != BIT_N(k, 28)) key |= 0x0040;
-			if (BIT_N(k, 28) != BIT_N(k, 27)) key |= 0x0020;
-			if (BIT_N(k, 27) != BIT_N(k, 26)) key |= 0x0010;
-			if (BIT_N(k, 26) != BIT_N(k, 25)) key |= 0x0008;
-			if (BIT_N(k, 25) != BIT_N(k, 24)) key |= 0x0004;
-			if (BIT_N(k, 25) != BIT_N(x, 26)) key |= 0x0002;
-			if (BIT_N(k, 24) != BIT_N(x, 25)) key |= 0x0001;
-			buf[i] ^= _xor;
+			const u8 c = buf[i];
+			buf[i] ^= R4tables.xorLo[key & 0xFF] ^ R4tables.xorHi[key >> 8];
+			key = R4tables.keyLo[key & 0xFF] ^ R4tables.keyHi[c ^ (key >> 8)];
 		}
 
 		buf+= 512;
@@ -1206,7 +1357,7 @@ bool CHEATSEXPORT::load(char *path)
 	fp = fopen(path, "rb");
 	if (!fp)
 	{
-		printf("Error open database\n");
+		CORELOG_ERROR("Error open database\n");
 		error = 1;
 		return false;
 	}
@@ -1230,16 +1381,16 @@ bool CHEATSEXPORT::load(char *path)
 	fsize = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
 
-	if (!search())
+	if (!search(path))
 	{
-		printf("ERROR: cheat in database not found\n");
+		CORELOG_ERROR("ERROR: cheat in database not found\n");
 		error = 3;
 		return false;
 	}
 	
 	if (!getCodes())
 	{
-		printf("ERROR: export cheats failed\n");
+		CORELOG_ERROR("ERROR: export cheats failed\n");
 		error = 4;
 		return false;
 	}
@@ -1257,57 +1408,123 @@ void CHEATSEXPORT::close()
 	}
 }
 
-bool CHEATSEXPORT::search()
+//the index of a database is kept next to it, so that its table of games (tens of thousands of entries, most of them
+//encrypted) only has to be gone through again when the database changes
+struct R4IndexHeader
 {
-	if (!fp) return false;
-
-	u32		pos = 0x0100;
-	FAT_R4	fat_tmp = {0};
-	u8		buf[512] = {0};
-
-	CRC = 0;
-	encOffset = 0;
-	u32 t = 0;
-	memset(date, 0, sizeof(date));
-	if (encrypted)
+	char	magic[8];
+	u32		mtime;
+	u32		fsize;
+	u32		count;
+	u8		encrypted;
+	u8		date[16];
+};
+static const char R4IndexMagic[8] = "R4IDX01";
+
+bool CHEATSEXPORT::loadIndex(const char *path)
+{
+	struct stat st;
+	const u32 mtime = stat(path, &st) == 0 ? (u32)st.st_mtime : 0;
+	const std::string indexPath = std::string(path) + ".idx";
+
+	index.clear();
+	R4IndexHeader header;
+	FILE *idx = fopen(indexPath.c_str(), "rb");
+	if (idx)
 	{
-		fseek(fp, 0, SEEK_SET);
-		fread(&buf[0], 1, 512, fp);
-		R4decrypt((u8 *)&buf[0], 512, 0);
-		memcpy(&date[0], &buf[0x10], 16);
+		if (fread(&header, sizeof(header), 1, idx) == 1 && memcmp(header.magic, R4IndexMagic, sizeof(R4IndexMagic)) == 0
+			&& header.mtime == mtime && header.fsize == fsize && header.encrypted == encrypted && header.count)
+		{
+			index.resize(header.count);
+			if (fread(&index[0], sizeof(FAT_R4), header.count, idx) == header.count)
+				memcpy(date, header.date, sizeof(header.date));
+			else
+				index.clear();
+		}
+		fclose(idx);
 	}
-	else
+	if (!index.empty())
+		return true;
+
+	if (!buildIndex())
+		return false;
+
+	//not being able to keep it only means building it again next time
+	memcpy(header.magic, R4IndexMagic, sizeof(R4IndexMagic));
+	header.mtime = mtime;
+	header.fsize = fsize;
+	header.count = index.size();
+	header.encrypted = encrypted;
+	memcpy(header.date, date, sizeof(header.date));
+	idx = fopen(indexPath.c_str(), "wb");
+	if (idx)
 	{
-		fseek(fp, 0x10, SEEK_SET);
-		fread(&date, 16, 1, fp);
-		fseek(fp, pos, SEEK_SET);
-		fread(&fat_tmp, sizeof(fat), 1, fp);
+		if (fwrite(&header, sizeof(header), 1, idx) != 1 || fwrite(&index[0], sizeof(FAT_R4), index.size(), idx) != index.size())
+		{
+			fclose(idx);
+			remove(indexPath.c_str());
+		}
+		else
+			fclose(idx);
 	}
+	return true;
+}
+
+//reads the table of games at 0x100, up to and including the entry with no address that ends it. it is read in whole
+//512 byte blocks, in the order R4decrypt needs them, since the entries don't line up with the blocks
+bool CHEATSEXPORT::buildIndex()
+{
+	if (!fp) return false;
 
-	while (1)
+	std::vector<u8> table;
+	u32 pos = 0x0100;
+	bool done = false;
+	memset(date, 0, sizeof(date));
+	fseek(fp, 0, SEEK_SET);
+	for (u32 block = 0; !done; block++)
 	{
+		u8 buf[512];
+		const size_t got = fread(buf, 1, 512, fp);
+		if (got == 0) break;
 		if (encrypted)
+			R4decrypt(buf, got, block);
+		table.insert(table.end(), buf, buf + got);
+		if (block == 0 && got >= 0x20)
+			memcpy(&date[0], &table[0x10], 16);
+
+		for (; pos + sizeof(FAT_R4) <= table.size(); pos += sizeof(FAT_R4))
 		{
-			memcpy(&fat, &buf[pos % 512], sizeof(fat));
-			pos += sizeof(fat);
-			if ((pos>>9) > t)
+			FAT_R4 entry;
+			memcpy(&entry, &table[pos], sizeof(entry));
+			index.push_back(entry);
+			if (entry.addr == 0)
 			{
-				t++;
-				fread(&buf[0], 1, 512, fp);
-				R4decrypt((u8 *)&buf[0], 512, t);
+				done = true;
+				break;
 			}
-			memcpy(&fat_tmp, &buf[pos % 512], sizeof(fat_tmp));	// next
-		}
-		else
-		{
-			memcpy(&fat, &fat_tmp, sizeof(fat));
-			fread(&fat_tmp, sizeof(fat_tmp), 1, fp);
-			
 		}
+	}
+
+	return !index.empty();
+}
+
+bool CHEATSEXPORT::search(const char *path)
+{
+	if (!fp) return false;
+
+	CRC = 0;
+	encOffset = 0;
+	if (!loadIndex(path)) return false;
+
+	for (size_t i = 0; i < index.size(); i++)
+	{
+		memcpy(&fat, &index[i], sizeof(fat));
+		const u64 next = i + 1 < index.size() ? index[i + 1].addr : 0;
+
 		//printf("serial: %s, offset %08X\n", fat.serial, fat.addr);
 		if (memcmp(gameInfo.header.gameCode, &fat.serial[0], 4) == 0)
 		{
-			dataSize = fat_tmp.addr?(fat_tmp.addr - fat.addr):0;
+			dataSize = next?(next - fat.addr):0;
 			if (encrypted)
 			{
 				encOffset = fat.addr % 512;
@@ -1317,7 +1534,7 @@ bool CHEATSEXPORT::search()
 			CRC = fat.CRC;
 			char buf[5] = {0};
 			memcpy(&buf, &fat.serial[0], 4);
-			printf("Cheats: found %s CRC %08X at 0x%08llX, size %i byte(s)\n", buf, fat.CRC, fat.addr, dataSize - encOffset);
+			CORELOG_INFO("Cheats: found %s CRC %08X at 0x%08llX, size %i byte(s)\n", buf, fat.CRC, fat.addr, dataSize - encOffset);
 			return true;
 		}
 
@@ -50,6 +50,16 @@ struct CHEATS_LIST
 	u8		size;
 };
 
+//one line of the program the enabled cheats are compiled into (see CHEATS::compile)
+struct CHEAT_OP
+{
+	u8		kind;
+	u32		hi;
+	u32		lo;
+	u32		next;				// the op after it, past the parameter lines of an E code
+	u32		data;				// where the parameter bytes of an E code start in programData
+};
+
 class CHEATS
 {
 private:
@@ -57,13 +67,19 @@ private:
 	u8					filename[MAX_PATH];
 	u32					currentGet;
 
+	std::vector<CHEAT_OP>	program;
+	std::vector<u8>			programData;
+	bool					programValid;
+
 	void	clear();
-	void	ARparser(CHEATS_LIST& cheat);
+	void	compile();
+	void	run();
 	char	*clearCode(char *s);
 
 public:
 	CHEATS()
 		: currentGet(0)
+		, programValid(false)
 	{
 		memset(filename, 0, sizeof(filename));
 	}
@@ -89,17 +105,26 @@ public:
 	BOOL	save();
 	BOOL	load();
 	void	process();
+	//for whoever changes a cheat through the pointers it handed out after they took them
+	void	invalidate() { programValid = false; }
 	void	getXXcodeString(CHEATS_LIST cheat, char *res_buf);
 	
 	static BOOL XXCodeFromString(CHEATS_LIST *cheatItem, const std::string codeString);
 	static BOOL XXCodeFromString(CHEATS_LIST *cheatItem, const char *codeString);
 };
 
+//the candidates start as a bit for each value in main memory, which the searches go through 16 bytes at a time
+//on the threads of the pool; once few enough are left they become a list of addresses with their last values,
+//and the memory and the snapshot of it go away.
 class CHEATSEARCH
 {
 private:
-	u8	*statMem;
-	u8	*mem;
+	u32	*statMem;				// a bit for each value, while the candidates are many
+	u8	*mem;					// main memory as it was at the last comparative search, for as long as statMem is around
+	std::vector<u32>	candidates;		// the values' indices, once they are few
+	std::vector<u32>	candidateVals;	// and what they were at the last comparative search
+	bool	listed;
+	u32	count;					// how many values of _size there are in main memory
 	u32	amount;
 	u32	lastRecord;
 
@@ -107,9 +132,14 @@ private:
 	u32	_size;
 	u32	_sign;
 
+	u32		searchDense(bool exact, u32 val, u8 comp);
+	u32		searchList(bool exact, u32 val, u8 comp);
+	void	makeList();
+	static void	searchWords(void *param, int begin, int end);
+
 public:
 	CHEATSEARCH()
-			: statMem(0), mem(0), amount(0), lastRecord(0), _type(0), _size(0), _sign(0) 
+			: statMem(0), mem(0), listed(false), count(0), amount(0), lastRecord(0), _type(0), _size(0), _sign(0) 
 	{}
 	~CHEATSEARCH() { close(); }
 	BOOL start(u8 type, u8 size, u8 sign);
@@ -146,7 +176,10 @@ private:
 	u32					dataSize;
 	u32					encOffset;
 	FAT_R4				fat;
-	bool				search();
+	std::vector<FAT_R4>	index;		//	the database's table of games, decrypted
+	bool				loadIndex(const char *path);
+	bool				buildIndex();
+	bool				search(const char *path);
 	bool				getCodes();
 	void				R4decrypt(u8 *buf, u32 len, u32 n);
 
@@ -57,6 +57,10 @@
 #include "../desmume_config.h"
 #include "../commandline.h"
 #include "../slot2.h"
+#include "../movie.h"
+#include "../rtc.h"
+#include "../frameprofile.h"
+#include "../armtrace.h"
 #include "../utils/xstring.h"
 
 #ifdef GDB_STUB
@@ -142,6 +146,15 @@ public:
 #endif
 
   int firmware_language;
+
+  int benchmark_frames;
+  char *benchmark_state;
+  char *golden_hash;
+
+  char *trace_file;
+  int trace_records;
+  int trace_regs;
+  char *decode_trace;
 };
 
 static void
@@ -160,6 +173,15 @@ init_config( class configured_features *config) {
 
   /* use the default language */
   config->firmware_language = -1;
+
+  config->benchmark_frames = 0;
+  config->benchmark_state = NULL;
+  config->golden_hash = NULL;
+
+  config->trace_file = NULL;
+  config->trace_records = 1 << 20;
+  config->trace_regs = 0;
+  config->decode_trace = NULL;
 }
 
 
@@ -195,6 +217,13 @@ fill_config( class configured_features *config,
     "\t\t\t\t\t\t  4 = Italian\n"
     "\t\t\t\t\t\t  5 = Spanish\n",
     "LANG"},
+    { "benchmark", 0, 0, G_OPTION_ARG_INT, &config->benchmark_frames, "Run this many frames headless, as fast as they go, and report the timings", "FRAMES"},
+    { "benchmark-state", 0, 0, G_OPTION_ARG_FILENAME, &config->benchmark_state, "Savestate file the benchmark starts from", "PATH_TO_STATE"},
+    { "golden-hash", 0, 0, G_OPTION_ARG_STRING, &config->golden_hash, "Hash the benchmark's frames have to come out as, or it fails", "HASH"},
+    { "trace", 0, 0, G_OPTION_ARG_FILENAME, &config->trace_file, "Record the instructions the cpus run into this file, for decode-trace", "PATH_TO_TRACE"},
+    { "trace-records", 0, 0, G_OPTION_ARG_INT, &config->trace_records, "Instructions the trace keeps, the last ones run (default 1048576)", "RECORDS"},
+    { "trace-regs", 0, 0, G_OPTION_ARG_NONE, &config->trace_regs, "Record the registers with each instruction in the trace", NULL},
+    { "decode-trace", 0, 0, G_OPTION_ARG_FILENAME, &config->decode_trace, "Disassemble a trace to standard output and exit", "PATH_TO_TRACE"},
     { NULL }
   };
 
@@ -225,7 +254,22 @@ fill_config( class configured_features *config,
     goto error;
   }
 
-  if (config->nds_file == "") {
+  if (config->benchmark_frames < 0) {
+    g_printerr("Benchmark frames must be >= 0.\n");
+    goto error;
+  }
+
+  if (config->benchmark_frames == 0 && (config->benchmark_state || config->golden_hash)) {
+    g_printerr("benchmark-state and golden-hash go with benchmark.\n");
+    goto error;
+  }
+
+  if (config->trace_records <= 0) {
+    g_printerr("Trace records must be > 0.\n");
+    goto error;
+  }
+
+  if (config->nds_file == "" && !config->decode_trace) {
     g_printerr("Need to specify file to load.\n");
     goto error;
   }
@@ -487,6 +531,90 @@ static void desmume_cycle(struct ctrls_event_config * cfg)
     SPU_Emulate_user();
 }
 
+/*
+ * Headless benchmark: runs the frames with no display, sound or limiter,
+ * from a savestate and/or with a movie playing the input, and reports
+ * where the time went. The RTC counts frames instead of following the
+ * clock, so the same run renders the same frames every time: each
+ * frame's screens go into a hash, which a golden hash can be checked
+ * against to catch an optimization that changed what is drawn.
+ */
+static u64
+hash_screen( u64 hash) {
+  /* fnv-1a, a word at a time */
+  const u32 *words = (const u32 *)GPU_screen;
+  for ( u32 i = 0; i < sizeof(GPU_screen) / 4; i++) {
+    hash ^= words[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static int
+run_benchmark( class configured_features *config) {
+  if ( config->benchmark_state && !savestate_load( config->benchmark_state)) {
+    fprintf( stderr, "error while loading state %s\n", config->benchmark_state);
+    return 1;
+  }
+  config->process_movieCommands();
+  if ( movieMode == MOVIEMODE_INACTIVE)
+    rtcSetDeterministic( true, FCEUI_MovieGetRTCDefault(), currFrameCounter);
+
+  frameprofile_enable( true);
+
+  u64 zone_totals[PROFILE_ZONE_COUNT] = {0};
+  u32 zone_frame[PROFILE_ZONE_COUNT];
+  u64 hash = 14695981039346656037ULL;
+  u64 worst_frame = 0;
+  u64 elapsed = 0;
+
+  for ( int i = 0; i < config->benchmark_frames && execute; i++) {
+    const u64 start = frameprofile_now();
+    NDS_beginProcessingInput();
+    NDS_endProcessingInput();
+    NDS_exec<false>();
+    const u64 frame_time = frameprofile_now() - start;
+
+    elapsed += frame_time;
+    if ( frame_time > worst_frame)
+      worst_frame = frame_time;
+    frameprofile_endframe();
+    if ( frameprofile_getframes( zone_frame, 1) == 1) {
+      for ( int z = 0; z < PROFILE_ZONE_COUNT; z++)
+        zone_totals[z] += zone_frame[z];
+    }
+    hash = hash_screen( hash);
+  }
+
+  const double seconds = elapsed / 1000000000.0;
+  const int ran = config->benchmark_frames;
+
+  printf( "frames: %d\n", ran);
+  printf( "time: %.3f s\n", seconds);
+  printf( "fps: %.2f\n", seconds > 0 ? ran / seconds : 0.0);
+  printf( "worst frame: %.3f ms\n", worst_frame / 1000000.0);
+  /* zones include the zones they call */
+  for ( int z = 0; z < PROFILE_ZONE_COUNT; z++) {
+    if ( zone_totals[z] == 0)
+      continue;
+    printf( "zone %s: %.3f ms total, %.1f us/frame\n",
+            frameprofile_zonename( (FrameProfileZone)z),
+            zone_totals[z] / 1000.0, (double)zone_totals[z] / ran);
+  }
+  printf( "hash: %016llx\n", (unsigned long long)hash);
+
+  frameprofile_enable( false);
+
+  if ( config->golden_hash) {
+    const u64 golden = strtoull( config->golden_hash, NULL, 16);
+    if ( golden != hash) {
+      fprintf( stderr, "hash mismatch: expected %016llx\n", (unsigned long long)golden);
+      return 2;
+    }
+  }
+  return 0;
+}
+
 #ifdef HAVE_LIBAGG
 T_AGG_RGB555 agg_targetScreen_cli(GPU_screen, 256, 384, 512);
 #endif
@@ -529,6 +657,14 @@ int main(int argc, char ** argv) {
     exit(1);
   }
 
+  if ( my_config.decode_trace) {
+    if ( !armtrace_decode( my_config.decode_trace, stdout)) {
+      fprintf( stderr, "error while decoding trace %s\n", my_config.decode_trace);
+      return 1;
+    }
+    return 0;
+  }
+
   /* use any language set on the command line */
   if ( my_config.firmware_language != -1) {
     fw_config.language = my_config.firmware_language;
@@ -638,7 +774,7 @@ int main(int argc, char ** argv) {
   /* Create the dummy firmware */
   NDS_CreateDummyFirmware( &fw_config);
 
-  if ( !my_config.disable_sound) {
+  if ( !my_config.disable_sound && !my_config.benchmark_frames) {
     SPU_ChangeSoundCore(SNDCORE_SDL, 735 * 4);
   }
 
@@ -652,8 +788,20 @@ int main(int argc, char ** argv) {
     exit(-1);
   }
 
+  if ( my_config.trace_file &&
+       !armtrace_open( my_config.trace_file, my_config.trace_records, my_config.trace_regs)) {
+    fprintf( stderr, "error while creating trace %s\n", my_config.trace_file);
+    exit(-1);
+  }
+
   execute = true;
 
+  if ( my_config.benchmark_frames) {
+    const int result = run_benchmark( &my_config);
+    NDS_DeInit();
+    return result;
+  }
+
   if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) == -1)
     {
       fprintf(stderr, "Error trying to initialize SDL: %s\n",
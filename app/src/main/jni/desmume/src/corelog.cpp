@@ -0,0 +1,158 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "corelog.h"
+#include "utils/task.h"
+
+int corelog_level = CORELOG_LEVEL_INFO;
+
+//a bounded queue any number of threads write to and the drain thread reads. each slot's sequence number says whose
+//turn it is: counting lap = i&~kMask for the i'th message, a writer may fill slot i&kMask when it is lap, and the
+//reader may take it when it is lap+1. so the ring starts out ready as it is, all zeroes
+static const u32 kSlots = 256;
+static const u32 kMask = kSlots-1;
+static const int kMessageSize = 244;
+
+struct CoreLogSlot
+{
+	volatile u32 sequence;
+	s32 level;
+	char message[kMessageSize];
+};
+
+static CoreLogSlot ring[kSlots];
+static volatile u32 writePos = 0;
+static u32 readPos = 0;
+static volatile u32 dropped = 0;
+
+static volatile CoreLogSink sink = NULL;
+static volatile bool draining = false;
+static Task drainTask;
+
+//the drain thread holds this while it reads, so that corelog_flush can take the ring over
+static volatile s32 readerBusy = 0;
+
+static void defaultSink(int level, const char* message)
+{
+	fprintf(level <= CORELOG_LEVEL_WARN ? stderr : stdout, "%s\n", message);
+}
+
+//hands the messages written so far to the sink. only one thread at a time
+static void drain()
+{
+	CoreLogSink out = sink ? sink : defaultSink;
+	for(;;)
+	{
+		CoreLogSlot &slot = ring[readPos & kMask];
+		const u32 lap = readPos & ~kMask;
+		if(__atomic_load_n(&slot.sequence,__ATOMIC_ACQUIRE) != lap+1)
+			break;
+		out(slot.level,slot.message);
+		__atomic_store_n(&slot.sequence,lap+kSlots,__ATOMIC_RELEASE);
+		readPos++;
+	}
+
+	const u32 lost = __atomic_exchange_n(&dropped,0,__ATOMIC_RELAXED);
+	if(lost)
+	{
+		char message[64];
+		snprintf(message,sizeof(message),"(%u log messages dropped)",lost);
+		out(CORELOG_LEVEL_WARN,message);
+	}
+}
+
+static void* drainLoop(void*)
+{
+	//messages are not urgent; looking every 50ms keeps the thread asleep nearly all the time
+	const struct timespec interval = { 0, 50*1000*1000 };
+	for(;;)
+	{
+		if(__sync_bool_compare_and_swap(&readerBusy,0,1))
+		{
+			drain();
+			__atomic_store_n(&readerBusy,0,__ATOMIC_RELEASE);
+		}
+		nanosleep(&interval,NULL);
+	}
+	return NULL;
+}
+
+static void startDraining()
+{
+	if(!__sync_bool_compare_and_swap(&draining,false,true)) return;
+	drainTask.start(false,"CoreLog",THREAD_ROLE_BACKGROUND);
+	drainTask.execute(drainLoop,NULL);
+}
+
+void corelog_write(int level, const char* format, ...)
+{
+	if(!draining) startDraining();
+
+	u32 pos = __atomic_load_n(&writePos,__ATOMIC_RELAXED);
+	CoreLogSlot* slot;
+	for(;;)
+	{
+		slot = &ring[pos & kMask];
+		const u32 sequence = __atomic_load_n(&slot->sequence,__ATOMIC_ACQUIRE);
+		const s32 diff = (s32)(sequence - (pos & ~kMask));
+		if(diff == 0)
+		{
+			if(__atomic_compare_exchange_n(&writePos,&pos,pos+1,true,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+				break;
+		}
+		else if(diff < 0)
+		{
+			//the drain thread hasnt caught up
+			__atomic_fetch_add(&dropped,1,__ATOMIC_RELAXED);
+			return;
+		}
+		else
+			pos = __atomic_load_n(&writePos,__ATOMIC_RELAXED);
+	}
+
+	va_list args;
+	va_start(args,format);
+	vsnprintf(slot->message,kMessageSize,format,args);
+	va_end(args);
+
+	//the sinks add their own line ends
+	size_t len = strlen(slot->message);
+	while(len && (slot->message[len-1] == '\n' || slot->message[len-1] == '\r'))
+		slot->message[--len] = 0;
+
+	slot->level = level;
+	__atomic_store_n(&slot->sequence,(pos & ~kMask)+1,__ATOMIC_RELEASE);
+}
+
+void corelog_setSink(CoreLogSink newSink)
+{
+	sink = newSink;
+}
+
+void corelog_flush()
+{
+	if(!draining) return;
+	while(!__sync_bool_compare_and_swap(&readerBusy,0,1)) {}
+	drain();
+	__atomic_store_n(&readerBusy,0,__ATOMIC_RELEASE);
+}
@@ -0,0 +1,65 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CORELOG_H
+#define _CORELOG_H
+
+//the core's log. a message is formatted into a slot of a ring in memory, which is all that happens on the thread that
+//logs it: no syscall and no lock, so it can be used while a frame runs. a background thread hands the slots to the
+//sink, which is logcat on android and stdout otherwise. when the ring is full messages are dropped (and counted),
+//never waited on
+enum CoreLogLevel
+{
+	CORELOG_LEVEL_ERROR,
+	CORELOG_LEVEL_WARN,
+	CORELOG_LEVEL_INFO,
+	CORELOG_LEVEL_DEBUG,
+};
+
+//messages above this level are compiled out
+#ifndef CORELOG_MAX_LEVEL
+#ifdef DEVELOPER
+#define CORELOG_MAX_LEVEL CORELOG_LEVEL_DEBUG
+#else
+#define CORELOG_MAX_LEVEL CORELOG_LEVEL_INFO
+#endif
+#endif
+
+//and above this one they are skipped before they are formatted
+extern int corelog_level;
+
+void corelog_write(int level, const char* format, ...)
+#ifdef __GNUC__
+	__attribute__((format(printf, 2, 3)))
+#endif
+	;
+
+#define CORELOG(level, ...) do { if((level) <= CORELOG_MAX_LEVEL && (level) <= corelog_level) corelog_write((level), __VA_ARGS__); } while(0)
+#define CORELOG_ERROR(...) CORELOG(CORELOG_LEVEL_ERROR, __VA_ARGS__)
+#define CORELOG_WARN(...) CORELOG(CORELOG_LEVEL_WARN, __VA_ARGS__)
+#define CORELOG_INFO(...) CORELOG(CORELOG_LEVEL_INFO, __VA_ARGS__)
+#define CORELOG_DEBUG(...) CORELOG(CORELOG_LEVEL_DEBUG, __VA_ARGS__)
+
+//where the background thread writes the messages; each comes without its trailing newline.
+//NULL puts it back to stdout
+typedef void (*CoreLogSink)(int level, const char* message);
+void corelog_setSink(CoreLogSink sink);
+
+//hands whatever is in the ring to the sink on the calling thread, for before the process goes away
+void corelog_flush();
+
+#endif
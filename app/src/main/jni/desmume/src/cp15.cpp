@@ -24,6 +24,9 @@
 #include "MMU.h"
 #include "emufile.h"
 #include "readwrite.h"
+#ifdef HAVE_JIT
+#include "arm_jit.h"
+#endif
 
 armcp15_t cp15;
 
@@ -31,6 +34,8 @@ armcp15_t cp15;
 /* sets the precalculated regions to mask,set for the affected accesstypes */
 void armcp15_t::setSingleRegionAccess(u8 num, u32 mask, u32 set) {
 
+	pagePermsDirty = true ;
+
 	switch (CP15_ACCESSTYPE(DaccessPerm, num)) {
 		case 4: /* UNP */
 		case 7: /* UNP */
@@ -164,10 +169,48 @@ void armcp15_t::maskPrecalc()
 #undef precalc
 }
 
+void armcp15_t::buildPagePerms()
+{
+	const u32 *masks[6] = { regionWriteMask_USR, regionWriteMask_SYS, regionReadMask_USR,
+	                        regionReadMask_SYS, regionExecuteMask_USR, regionExecuteMask_SYS } ;
+	const u32 *sets[6] = { regionWriteSet_USR, regionWriteSet_SYS, regionReadSet_USR,
+	                       regionReadSet_SYS, regionExecuteSet_USR, regionExecuteSet_SYS } ;
+
+	if (!pagePerms) pagePerms = new u8[CP15_PAGE_COUNT] ;
+	memset(pagePerms, 0, CP15_PAGE_COUNT) ;
+	pagePermsDirty = false ;
+	pagePermsExact = true ;
+
+	for (int access=0;access<6;access++) {
+		const u8 bit = 1 << access ;
+		for (int i=0;i<8;i++) {
+			const u32 mask = masks[access][i], set = sets[access][i] ;
+			if (mask == 0) {
+				/* the 4GB region, or one that allows nothing of this kind */
+				if (set == 0)
+					for (u32 p=0;p<CP15_PAGE_COUNT;p++) pagePerms[p] |= bit ;
+				continue ;
+			}
+			if (set & ~mask) continue ; /* never matches */
+			/* the masks are a run of high bits, so a region is the block of ~mask+1 bytes at set */
+			const u32 size = ~mask + 1 ;
+			if (size < (1 << CP15_PAGE_SHIFT)) {
+				pagePermsExact = false ;
+				return ;
+			}
+			const u32 first = set >> CP15_PAGE_SHIFT ;
+			const u32 end = first + (size >> CP15_PAGE_SHIFT) ;
+			for (u32 p=first;p<end;p++) pagePerms[p] |= bit ;
+		}
+	}
+}
+
 BOOL armcp15_t::isAccessAllowed(u32 address,u32 access)
 {
 	int i ;
 	if (!(ctrl & 1)) return TRUE ;        /* protection checking is not enabled */
+	if (pagePermsDirty) buildPagePerms() ;
+	if (pagePermsExact) return (pagePerms[address >> CP15_PAGE_SHIFT] >> access) & 1 ;
 	for (i=0;i<8;i++) {
 		switch (access) {
 		case CP15_ACCESS_WRITEUSR:
@@ -437,6 +480,10 @@ BOOL armcp15_t::moveARM2CP(u32 val, u8 CRn, u8 CRm, u8 opcode1, u8 opcode2)
 				{
 				case 0:
 					MMU.DTCMRegion = DTCMRegion = val & 0x0FFFF000;
+#if defined(HAVE_JIT) && !defined(MAPPED_JIT_FUNCS)
+					//the literals compiled in from under it would be read from the dtcm now
+					arm_jit_invalidate_pages(MMU.DTCMRegion, MMU.DTCMRegion + 0x4000);
+#endif
 					return TRUE;
 				case 1:
 					ITCMRegion = val;
@@ -525,6 +572,7 @@ bool armcp15_t::loadone(EMUFILE* is)
     for(int i=0;i<8;i++) if(!read32le(&regionReadSet_SYS[i],is)) return false;
     for(int i=0;i<8;i++) if(!read32le(&regionExecuteSet_USR[i],is)) return false;
     for(int i=0;i<8;i++) if(!read32le(&regionExecuteSet_SYS[i],is)) return false;
+    pagePermsDirty = true;
 
     return true;
 }
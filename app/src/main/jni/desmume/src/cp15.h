@@ -39,6 +39,10 @@ class EMUFILE;
 #define CP15_MASKFROMREG(val)    (~((CP15_SIZEBINARY(val)-1) | 0x3F))
 #define CP15_SETFROMREG(val)     ((val) & CP15_MASKFROMREG(val))
 
+/* the permissions are also kept for each 4KB page, which is the smallest region the mpu has */
+#define CP15_PAGE_SHIFT           12
+#define CP15_PAGE_COUNT           (1 << (32 - CP15_PAGE_SHIFT))
+
 struct armcp15_t
 {
 public:
@@ -76,9 +80,16 @@ public:
         u32 regionReadSet_SYS[8] ;
         u32 regionExecuteSet_USR[8] ;
         u32 regionExecuteSet_SYS[8] ;
+        /* the regions above as a bit per access type (CP15_ACCESS_*) for each page, so that a check is one */
+        /* lookup. it is built on the first check after the regions change, and only allocated then */
+        u8 *pagePerms ;
+        bool pagePermsDirty ;
+        /* false while some region is smaller than a page, when the regions get checked one by one instead */
+        bool pagePermsExact ;
 
 		void setSingleRegionAccess(u8 num, u32 mask, u32 set);
 		void maskPrecalc();
+		void buildPagePerms();
 
 public:
 		armcp15_t() :	IDCode(0x41059461),
@@ -99,7 +110,10 @@ public:
 						processID(0),
 						RAM_TAG(0),
 						testState(0),
-						cacheDbg(0)
+						cacheDbg(0),
+						pagePerms(NULL),
+						pagePermsDirty(true),
+						pagePermsExact(false)
 		{
 			//printf("CP15 Reset\n");
 			memset(&protectBaseSize[0], 0, sizeof(protectBaseSize));
@@ -56,7 +56,7 @@ static bool acl_check_access(u32 adr, u32 access) {
 
 void HandleDebugEvent_ACL_Exception()
 {
-	printf("ACL EXCEPTION!\n");
+	CORELOG_INFO("ACL EXCEPTION!\n");
 	if(DebugEventData.memAccessType == MMU_AT_CODE)
 		armcpu_exception(DebugEventData.cpu(),EXCEPTION_PREFETCH_ABORT);
 	else if(DebugEventData.memAccessType == MMU_AT_DATA)
@@ -192,15 +192,15 @@ void DebugStatistics::print()
 	std::sort(sorts[1].thumb, sorts[1].thumb+1024, debugStatsSort<1,1>);
 
 	for(int i=0;i<2;i++) {
-		printf("Top arm instructions for ARM%d:\n",7+i*2);
+		CORELOG_INFO("Top arm instructions for ARM%d:\n",7+i*2);
 		for(int j=0;j<10;j++) {
 			int val = sorts[i].arm[j];
-			printf("%08d: %s\n", combinedHits[i].arm[val], arm_instruction_names[val]);
+			CORELOG_INFO("%08d: %s\n", combinedHits[i].arm[val], arm_instruction_names[val]);
 		}
-		printf("Top thumb instructions for ARM%d:\n",7+i*2);
+		CORELOG_INFO("Top thumb instructions for ARM%d:\n",7+i*2);
 		for(int j=0;j<10;j++) {
 			int val = sorts[i].thumb[j];
-			printf("%08d: %s\n", combinedHits[i].thumb[val], thumb_instruction_names[val]);
+			CORELOG_INFO("%08d: %s\n", combinedHits[i].thumb[val], thumb_instruction_names[val]);
 		}
 	}
 }
@@ -220,7 +220,7 @@ void DEBUG_reset()
 
 	DEBUG_Notify = DebugNotify();
 	DEBUG_statistics = DebugStatistics();
-	printf("DEBUG_reset: %08X\n",&DebugStatistics::print); //force a reference to this function
+	CORELOG_DEBUG("DEBUG_reset: %08X\n",&DebugStatistics::print); //force a reference to this function
 }
 
 static void DEBUG_dumpMemory_fill(EMUFILE *fp, u32 size)
@@ -248,8 +248,12 @@ void DEBUG_dumpMemory(EMUFILE* fp)
 std::vector<Logger *> Logger::channels;
 
 
+//what goes to stdout goes through the core log instead, so that logging from the emulation doesnt block on it
 static void defaultCallback(const Logger& logger, const char * message) {
-	logger.getOutput() << message;
+	if(&logger.getOutput() == &std::cout)
+		CORELOG_INFO("%s", message);
+	else
+		logger.getOutput() << message;
 }
 
 Logger::Logger() {
@@ -26,6 +26,7 @@
 
 #include "types.h"
 #include "mem.h"
+#include "corelog.h"
 
 struct armcpu_t;
 class EMUFILE;
@@ -0,0 +1,115 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _DESMUME_EMBED_H
+#define _DESMUME_EMBED_H
+
+//the core as a library, for programs that run it without a user interface of their own (test and streaming servers).
+//everything is called from the one thread. the frames and the sound are handed to callbacks as pointers into the
+//core's own buffers, which stay valid until the callback returns: nothing is copied on the way out
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//bumped whenever anything below changes in a way a program built against an older one would notice
+#define DESMUME_EMBED_VERSION 1
+
+//the buttons for desmume_set_input, as a mask
+enum
+{
+	DESMUME_BUTTON_RIGHT  = 1 << 0,
+	DESMUME_BUTTON_LEFT   = 1 << 1,
+	DESMUME_BUTTON_DOWN   = 1 << 2,
+	DESMUME_BUTTON_UP     = 1 << 3,
+	DESMUME_BUTTON_SELECT = 1 << 4,
+	DESMUME_BUTTON_START  = 1 << 5,
+	DESMUME_BUTTON_B      = 1 << 6,
+	DESMUME_BUTTON_A      = 1 << 7,
+	DESMUME_BUTTON_Y      = 1 << 8,
+	DESMUME_BUTTON_X      = 1 << 9,
+	DESMUME_BUTTON_L      = 1 << 10,
+	DESMUME_BUTTON_R      = 1 << 11,
+	DESMUME_BUTTON_DEBUG  = 1 << 12,
+	DESMUME_BUTTON_LID    = 1 << 13,
+};
+
+//what the frames come out as
+enum
+{
+	DESMUME_PIXELS_RGB555,   //16 bits, red in the low bits, the top bit unused
+	DESMUME_PIXELS_RGBA8888, //bytes r, g, b, a
+	DESMUME_PIXELS_RGB565,   //16 bits, red in the high bits
+};
+
+typedef struct desmume_embed_config
+{
+	int version;      //DESMUME_EMBED_VERSION
+	int pixels;       //DESMUME_PIXELS_*
+	int renderer;     //0 for no 3d, 1 for the soft rasterizer
+	int use_jit;
+	int advanced_timing;
+	int sound;        //0 to not mix any sound at all, which is faster
+	const char *bios7, *bios9, *firmware; //NULL for the built in ones
+} desmume_embed_config;
+
+//both screens, the main one on top, width x height pixels of the format asked for, pitch bytes from a line to the
+//next. frame counts up from the rom being loaded
+typedef struct desmume_embed_frame
+{
+	const void *pixels;
+	int format, width, height, pitch;
+	uint32_t frame;
+} desmume_embed_frame;
+
+typedef void (*desmume_embed_frame_callback)(const desmume_embed_frame *frame, void *user);
+//count stereo pairs of 16 bit samples at 44100hz, as the core makes them: a few at the end of every line
+typedef void (*desmume_embed_audio_callback)(const int16_t *samples, uint32_t count, void *user);
+
+//fills in the defaults for config->version's fields
+void desmume_embed_default_config(desmume_embed_config *config);
+
+//0 on success. once per process: what the core sets up can't be set up twice
+int desmume_embed_init(const desmume_embed_config *config);
+void desmume_embed_deinit(void);
+
+//0 on success. the battery save goes next to the rom
+int desmume_embed_load_rom(const char *path);
+
+void desmume_embed_set_frame_callback(desmume_embed_frame_callback callback, void *user);
+void desmume_embed_set_audio_callback(desmume_embed_audio_callback callback, void *user);
+
+//what the buttons and the touch screen are for the next frame. x and y are only looked at when touching
+void desmume_embed_set_input(uint32_t buttons, int touching, int x, int y);
+
+//one frame of emulation, with the frame callback at the end of it, unless render is 0: then the 2d and 3d aren't
+//drawn and there is no frame. the audio callback is called along the way
+void desmume_embed_run_frame(int render);
+
+//a savestate in memory. *data points into the library's own buffer, valid until the next save. 0 on success
+int desmume_embed_save_state_to_buffer(const void **data, size_t *size);
+int desmume_embed_load_state_from_buffer(const void *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,260 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include <zlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "desmume_embed.h"
+#include "../NDSSystem.h"
+#include "../GPU.h"
+#include "../SPU.h"
+#include "../render3D.h"
+#include "../rasterize.h"
+#include "../saves.h"
+#include "../slot1.h"
+#include "../slot2.h"
+#include "../emufile.h"
+#include "../firmware.h"
+
+#define SNDCORE_EMBED 1
+
+static void SNDEmbedFetchSamples(s16 *sampleBuffer, size_t sampleCount, ESynchMode synchMode, ISynchronizingAudioBuffer *theSynchronizer);
+
+static int SNDEmbedInit(int buffersize) { return 0; }
+static void SNDEmbedDeInit() {}
+static void SNDEmbedUpdateAudio(s16 *buffer, u32 num_samples) {}
+static u32 SNDEmbedGetAudioSpace() { return 0; }
+static void SNDEmbedMuteAudio() {}
+static void SNDEmbedUnMuteAudio() {}
+static void SNDEmbedSetVolume(int volume) {}
+static void SNDEmbedClearBuffer() {}
+static size_t SNDEmbedPostProcessSamples(s16 *postProcessBuffer, size_t requestedSampleCount, ESynchMode synchMode, ISynchronizingAudioBuffer *theSynchronizer) { return 0; }
+
+//takes the samples as the core mixes them into SPU_core->outbuf, at the end of every line
+static SoundInterface_struct SNDEmbed = {
+	SNDCORE_EMBED,
+	"Embedding program's callback",
+	SNDEmbedInit,
+	SNDEmbedDeInit,
+	SNDEmbedUpdateAudio,
+	SNDEmbedGetAudioSpace,
+	SNDEmbedMuteAudio,
+	SNDEmbedUnMuteAudio,
+	SNDEmbedSetVolume,
+	SNDEmbedClearBuffer,
+	SNDEmbedFetchSamples,
+	SNDEmbedPostProcessSamples
+};
+
+SoundInterface_struct *SNDCoreList[] = {
+	&SNDDummy,
+	&SNDEmbed,
+	NULL
+};
+
+GPU3DInterface *core3DList[] = {
+	&gpu3DNull,
+	&gpu3DRasterize,
+	NULL
+};
+
+volatile bool execute = false;
+struct NDS_fw_config_data fw_config;
+
+static bool initialized = false;
+static desmume_embed_config config;
+static desmume_embed_frame_callback frameCallback = NULL;
+static void *frameUser = NULL;
+static desmume_embed_audio_callback audioCallback = NULL;
+static void *audioUser = NULL;
+static u32 frameNumber = 0;
+//the last savestate, which desmume_embed_save_state_to_buffer hands out
+static std::vector<u8> stateBuffer;
+
+static void SNDEmbedFetchSamples(s16 *sampleBuffer, size_t sampleCount, ESynchMode synchMode, ISynchronizingAudioBuffer *theSynchronizer)
+{
+	if (audioCallback != NULL && sampleCount != 0)
+		audioCallback(sampleBuffer, (uint32_t)sampleCount, audioUser);
+}
+
+static void setPath(char *dst, size_t size, const char *src)
+{
+	strncpy(dst, src, size - 1);
+	dst[size - 1] = 0;
+}
+
+void desmume_embed_default_config(desmume_embed_config *c)
+{
+	memset(c, 0, sizeof(*c));
+	c->version = DESMUME_EMBED_VERSION;
+	c->pixels = DESMUME_PIXELS_RGB555;
+	c->renderer = 1;
+	c->advanced_timing = 1;
+	c->sound = 1;
+}
+
+int desmume_embed_init(const desmume_embed_config *c)
+{
+	if (initialized || c == NULL || c->version != DESMUME_EMBED_VERSION)
+		return -1;
+	config = *c;
+
+	CommonSettings.use_jit = config.use_jit != 0;
+	CommonSettings.advanced_timing = config.advanced_timing != 0;
+	if (config.bios7 && config.bios9)
+	{
+		CommonSettings.UseExtBIOS = true;
+		setPath(CommonSettings.ARM7BIOS, sizeof(CommonSettings.ARM7BIOS), config.bios7);
+		setPath(CommonSettings.ARM9BIOS, sizeof(CommonSettings.ARM9BIOS), config.bios9);
+	}
+	if (config.firmware)
+	{
+		CommonSettings.UseExtFirmware = true;
+		setPath(CommonSettings.Firmware, sizeof(CommonSettings.Firmware), config.firmware);
+	}
+
+	Desmume_InitOnce();
+	NDS_FillDefaultFirmwareConfigData(&fw_config);
+	slot1_Change(NDS_SLOT1_RETAIL_AUTO);
+	slot2_Change(NDS_SLOT2_AUTO);
+	if (NDS_Init() != 0)
+		return -1;
+
+	NDS_3D_ChangeCore(config.renderer == 1 ? 1 : 0);
+	//the samples are taken straight from the core as they are made, so there is nothing to synchronize them with
+	SPU_ChangeSoundCore(config.sound ? SNDCORE_EMBED : SNDCORE_DUMMY, 0);
+	SPU_SetSynchMode(ESynchMode_Synchronous, 0);
+	SPU_SetUnheard(!config.sound);
+
+	static const GPUOutputFormat formats[] = { GPU_OUTPUT_RGB555, GPU_OUTPUT_RGBA8888, GPU_OUTPUT_RGB565 };
+	GPU_SetOutputFormat(formats[(unsigned)config.pixels < 3 ? config.pixels : 0]);
+
+	NDS_CreateDummyFirmware(&fw_config);
+	initialized = true;
+	return 0;
+}
+
+void desmume_embed_deinit(void)
+{
+	if (!initialized)
+		return;
+	if (execute)
+	{
+		execute = false;
+		NDS_FreeROM();
+	}
+	NDS_DeInit();
+	initialized = false;
+}
+
+int desmume_embed_load_rom(const char *path)
+{
+	if (!initialized || NDS_LoadROM(path) < 0)
+		return -1;
+	frameNumber = 0;
+	execute = true;
+	return 0;
+}
+
+void desmume_embed_set_frame_callback(desmume_embed_frame_callback callback, void *user)
+{
+	frameCallback = callback;
+	frameUser = user;
+}
+
+void desmume_embed_set_audio_callback(desmume_embed_audio_callback callback, void *user)
+{
+	audioCallback = callback;
+	audioUser = user;
+}
+
+void desmume_embed_set_input(uint32_t buttons, int touching, int x, int y)
+{
+	NDS_setPad(buttons & DESMUME_BUTTON_RIGHT, buttons & DESMUME_BUTTON_LEFT, buttons & DESMUME_BUTTON_DOWN, buttons & DESMUME_BUTTON_UP,
+		buttons & DESMUME_BUTTON_SELECT, buttons & DESMUME_BUTTON_START, buttons & DESMUME_BUTTON_B, buttons & DESMUME_BUTTON_A,
+		buttons & DESMUME_BUTTON_Y, buttons & DESMUME_BUTTON_X, buttons & DESMUME_BUTTON_L, buttons & DESMUME_BUTTON_R,
+		buttons & DESMUME_BUTTON_DEBUG, buttons & DESMUME_BUTTON_LID);
+	if (touching)
+		NDS_setTouchPos((u16)std::min(std::max(x, 0), 255), (u16)std::min(std::max(y, 0), 191));
+	else
+		NDS_releaseTouch();
+}
+
+void desmume_embed_run_frame(int render)
+{
+	if (!execute)
+		return;
+
+	NDS_beginProcessingInput();
+	NDS_endProcessingInput();
+	if (!render)
+		NDS_SkipNextFrame();
+	NDS_exec<false>();
+	frameNumber++;
+
+	if (!render || frameCallback == NULL)
+		return;
+
+	//the screens in the format asked for, when both came out in it
+	desmume_embed_frame frame;
+	frame.width = 256;
+	frame.height = 384;
+	frame.frame = frameNumber;
+	switch (GPU_GetOutputFormat())
+	{
+	case GPU_OUTPUT_RGBA8888:
+		frame.pixels = GPU_screenNative;
+		frame.format = DESMUME_PIXELS_RGBA8888;
+		frame.pitch = 256 * 4;
+		break;
+	case GPU_OUTPUT_RGB565:
+		frame.pixels = GPU_screenNative;
+		frame.format = DESMUME_PIXELS_RGB565;
+		frame.pitch = 256 * 2;
+		break;
+	default:
+		frame.pixels = GPU_screen;
+		frame.format = DESMUME_PIXELS_RGB555;
+		frame.pitch = 256 * 2;
+		break;
+	}
+	frameCallback(&frame, frameUser);
+}
+
+int desmume_embed_save_state_to_buffer(const void **data, size_t *size)
+{
+	if (!execute)
+		return -1;
+	stateBuffer.clear();
+	EMUFILE_MEMORY os(&stateBuffer);
+	if (!savestate_save(&os, Z_NO_COMPRESSION))
+		return -1;
+	*data = os.buf();
+	*size = os.size();
+	return 0;
+}
+
+int desmume_embed_load_state_from_buffer(const void *data, size_t size)
+{
+	if (!execute)
+		return -1;
+	EMUFILE_MEMORY is((void *)data, (s32)size);
+	return savestate_load(&is) ? 0 : -1;
+}
@@ -25,6 +25,12 @@ THE SOFTWARE.
 #include "emufile.h"
 
 #include <vector>
+#include <stdlib.h>
+#ifndef HOST_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 bool EMUFILE::readAllBytes(std::vector<u8>* dstbuf, const std::string& fname)
 {
@@ -166,6 +172,197 @@ EMUFILE* EMUFILE_MEMORY::memwrap()
 	return this;
 }
 
+void EMUFILE_FILE_BUFFERED::flushWrites()
+{
+	if(wpos == 0) return;
+	const size_t bytes = wpos;
+	wpos = 0;
+	EMUFILE_FILE::fwrite(&wbuf[0], bytes);
+}
+
+size_t EMUFILE_FILE_BUFFERED::fwrite(const void *ptr, size_t bytes)
+{
+	if(wpos + bytes > wbuf.size())
+	{
+		flushWrites();
+		//what doesn't fit in the buffer wouldn't gain anything from going through it
+		if(bytes >= wbuf.size())
+			return EMUFILE_FILE::fwrite(ptr, bytes);
+	}
+	memcpy(&wbuf[wpos], ptr, bytes);
+	wpos += bytes;
+	return bytes;
+}
+
+int EMUFILE_FILE_BUFFERED::fprintf(const char *format, ...)
+{
+	va_list argptr;
+	va_start(argptr, format);
+	int amt = vsnprintf(0,0,format,argptr);
+	va_end(argptr);
+	if(amt <= 0) return amt;
+
+	std::vector<char> tempbuf(amt+1);
+	va_start(argptr, format);
+	vsnprintf(&tempbuf[0],amt+1,format,argptr);
+	va_end(argptr);
+
+	fwrite(&tempbuf[0],amt);
+	return amt;
+}
+
+void EMUFILE_MMAP::open(const char* fname)
+{
+	data = NULL;
+	pos = len = 0;
+	dirtyBegin = dirtyEnd = 0;
+#ifdef HOST_WINDOWS
+	std::vector<u8> contents;
+	if(!readAllBytes(&contents, fname))
+	{
+		failbit = true;
+		return;
+	}
+	len = (s32)contents.size();
+	if(len == 0) return;
+	data = (u8*)malloc(len);
+	memcpy(data, &contents[0], len);
+#else
+	const int fd = ::open(fname, access == WRITABLE ? O_RDWR : O_RDONLY);
+	if(fd < 0)
+	{
+		failbit = true;
+		return;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+		failbit = true;
+	else if(st.st_size > 0)
+	{
+		void* map = access == WRITABLE
+			? mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+			: mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map != MAP_FAILED)
+		{
+			data = (u8*)map;
+			len = (s32)st.st_size;
+			madvise(map, len, access == SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+		}
+		else failbit = true;
+	}
+	//the mapping keeps the file for itself
+	close(fd);
+#endif
+}
+
+EMUFILE_MMAP::~EMUFILE_MMAP()
+{
+	fflush();
+#ifdef HOST_WINDOWS
+	free(data);
+#else
+	if(data) munmap(data, len);
+#endif
+}
+
+size_t EMUFILE_MMAP::_fread(const void *ptr, size_t bytes)
+{
+	const u32 remain = pos < len ? len-pos : 0;
+	const u32 todo = std::min<u32>(remain,(u32)bytes);
+	if(todo)
+		memcpy((void*)ptr,data+pos,todo);
+	pos += todo;
+	if(todo<bytes)
+		failbit = true;
+	return todo;
+}
+
+size_t EMUFILE_MMAP::fwrite(const void *ptr, size_t bytes)
+{
+	if(access != WRITABLE)
+	{
+		failbit = true;
+		return 0;
+	}
+	const u32 remain = pos < len ? len-pos : 0;
+	const u32 todo = std::min<u32>(remain,(u32)bytes);
+	if(todo)
+	{
+		memcpy(data+pos,ptr,todo);
+		markDirty(pos, pos+todo);
+	}
+	pos += todo;
+	if(todo<bytes)
+		failbit = true;
+	return todo;
+}
+
+void EMUFILE_MMAP::markDirty(s32 begin, s32 end)
+{
+	if(dirtyBegin == dirtyEnd)
+	{
+		dirtyBegin = begin;
+		dirtyEnd = end;
+	}
+	else
+	{
+		dirtyBegin = std::min(dirtyBegin, begin);
+		dirtyEnd = std::max(dirtyEnd, end);
+	}
+}
+
+void EMUFILE_MMAP::fflush()
+{
+	if(dirtyBegin == dirtyEnd)
+		return;
+#ifdef HOST_WINDOWS
+	//a copy, so it is written back here
+	FILE* fp = ::fopen(fname.c_str(), "r+b");
+	if(fp)
+	{
+		::fseek(fp, dirtyBegin, SEEK_SET);
+		::fwrite(data+dirtyBegin, 1, dirtyEnd-dirtyBegin, fp);
+		::fclose(fp);
+	}
+#else
+	//msync wants the start of a page
+	const s32 page = (s32)sysconf(_SC_PAGESIZE);
+	const s32 begin = dirtyBegin & ~(page-1);
+	msync(data+begin, dirtyEnd-begin, MS_ASYNC);
+#endif
+	dirtyBegin = dirtyEnd = 0;
+}
+
+int EMUFILE_MMAP::fseek(int offset, int origin)
+{
+	switch(origin) {
+		case SEEK_SET:
+			pos = offset;
+			break;
+		case SEEK_CUR:
+			pos += offset;
+			break;
+		case SEEK_END:
+			pos = len+offset;
+			break;
+		default:
+			assert(false);
+	}
+	//like a file, it can be seeked past the end, where reading fails
+	if(pos < 0)
+	{
+		pos = 0;
+		return -1;
+	}
+	return 0;
+}
+
+EMUFILE* EMUFILE_MMAP::memwrap()
+{
+	//the mapping goes with this file, which may be deleted
+	return new EMUFILE_MEMORY(data, len);
+}
+
 void EMUFILE::write64le(u64* val)
 {
 	write64le(*val);
@@ -86,6 +86,10 @@ public:
 	virtual size_t _fread(const void *ptr, size_t bytes) = 0;
 	virtual size_t fwrite(const void *ptr, size_t bytes) = 0;
 
+	//the next bytes where they are in memory already, for reading them in place (then fseek past them),
+	//or NULL if the file doesn't have them in memory, or not that many of them
+	virtual const u8* peek(size_t bytes) { return NULL; }
+
 	void write64le(u64* val);
 	void write64le(u64 val);
 	size_t read64le(u64* val);
@@ -217,6 +221,10 @@ public:
 	}
 
 	virtual size_t _fread(const void *ptr, size_t bytes);
+	virtual const u8* peek(size_t bytes) {
+		if(pos < 0 || bytes > (size_t)(len-pos)) return NULL;
+		return buf()+pos;
+	}
 	virtual size_t fwrite(const void *ptr, size_t bytes){
 		reserve(pos+(s32)bytes);
 		memcpy(buf()+pos,ptr,bytes);
@@ -347,4 +355,113 @@ public:
 
 };
 
+//an EMUFILE_FILE that gathers what is written in a buffer of its own and hands it to stdio in big pieces, for files
+//written a few bytes at a time (movies). reading, seeking or anything else that needs the file as it is writes the
+//buffer out first
+class EMUFILE_FILE_BUFFERED : public EMUFILE_FILE {
+protected:
+	std::vector<u8> wbuf;
+	size_t wpos;
+
+	virtual void flushWrites();
+
+public:
+
+	EMUFILE_FILE_BUFFERED(const std::string& fname, const char* mode, size_t bufferSize = 256*1024)
+		: EMUFILE_FILE(fname, mode), wbuf(bufferSize), wpos(0) {}
+	EMUFILE_FILE_BUFFERED(const char* fname, const char* mode, size_t bufferSize = 256*1024)
+		: EMUFILE_FILE(fname, mode), wbuf(bufferSize), wpos(0) {}
+
+	virtual ~EMUFILE_FILE_BUFFERED() { flushWrites(); }
+
+	virtual FILE *get_fp() { flushWrites(); return fp; }
+	virtual EMUFILE* memwrap() { flushWrites(); return EMUFILE_FILE::memwrap(); }
+	virtual void truncate(s32 length) { flushWrites(); EMUFILE_FILE::truncate(length); }
+
+	virtual int fprintf(const char *format, ...);
+
+	virtual int fgetc() { flushWrites(); return EMUFILE_FILE::fgetc(); }
+	virtual int fputc(int c) {
+		if(wpos == wbuf.size())
+			flushWrites();
+		wbuf[wpos++] = (u8)c;
+		return (u8)c;
+	}
+
+	virtual size_t _fread(const void *ptr, size_t bytes) { flushWrites(); return EMUFILE_FILE::_fread(ptr, bytes); }
+	virtual size_t fwrite(const void *ptr, size_t bytes);
+
+	virtual int fseek(int offset, int origin) { flushWrites(); return EMUFILE_FILE::fseek(offset, origin); }
+	virtual int ftell() { return EMUFILE_FILE::ftell() + (int)wpos; }
+	virtual int size() { flushWrites(); return EMUFILE_FILE::size(); }
+	virtual void fflush() { flushWrites(); EMUFILE_FILE::fflush(); }
+};
+
+//a file mapped into memory to be read (savestates): every read is a copy straight out of the mapping, or none at all
+//through peek(). it can only be written to in place, when it is opened for that, and never grows
+class EMUFILE_MMAP : public EMUFILE {
+public:
+	enum Access
+	{
+		SEQUENTIAL, //read once from start to end
+		RANDOM, //read all over
+		WRITABLE, //read all over and written to. the os writes it back, starting to when fflush asks
+	};
+
+protected:
+	u8* data;
+	s32 pos, len;
+	Access access;
+	//the part written since the last fflush
+	s32 dirtyBegin, dirtyEnd;
+	std::string fname;
+
+private:
+	void open(const char* fname);
+
+public:
+
+	EMUFILE_MMAP(const std::string& fname, Access access = SEQUENTIAL) : access(access), fname(fname) { open(fname.c_str()); }
+	EMUFILE_MMAP(const char* fname, Access access = SEQUENTIAL) : access(access), fname(fname) { open(fname); }
+
+	virtual ~EMUFILE_MMAP();
+
+	const u8* buf() const { return data; }
+	//for WRITABLE only
+	u8* writableBuf() { return access == WRITABLE ? data : NULL; }
+
+	virtual FILE *get_fp() { return NULL; }
+
+	virtual EMUFILE* memwrap();
+
+	virtual void truncate(s32 length) { failbit = true; }
+
+	virtual int fprintf(const char *format, ...) { failbit = true; return 0; }
+
+	virtual int fgetc() {
+		if(pos >= len) {
+			failbit = true;
+			return -1;
+		}
+		return data[pos++];
+	}
+	virtual int fputc(int c) { failbit = true; return EOF; }
+
+	virtual size_t _fread(const void *ptr, size_t bytes);
+	virtual const u8* peek(size_t bytes) {
+		if(pos < 0 || bytes > (size_t)(len-pos)) return NULL;
+		return data+pos;
+	}
+	virtual size_t fwrite(const void *ptr, size_t bytes);
+
+	virtual int fseek(int offset, int origin);
+
+	virtual int ftell() { return pos; }
+	virtual int size() { return (int)len; }
+	//the writes go out in the background: this doesn't wait for them
+	virtual void fflush();
+	//for writes made through writableBuf()
+	void markDirty(s32 begin, s32 end);
+};
+
 #endif
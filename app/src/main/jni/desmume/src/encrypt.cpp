@@ -19,6 +19,7 @@
 #include "armcpu.h"
 #include "MMU.h"
 #include "registers.h"
+#include "utils/fastcrc.h"
 
 //TODO - a lot of redundant code (maybe?) with utils/decrypt.cpp
 //we should try unifying all that.
@@ -28,8 +29,36 @@
 //================================================================================== KEY1
 #define DWNUM(i) ((i) >> 2)
 
+//the tables init() derives, for the few key sets that are asked for again on every boot: the game's, the
+//firmware's. deriving them goes through the cipher over a thousand times, and the tables only depend on what
+//they were derived from
+struct KEY1CacheEntry
+{
+	bool valid;
+	u32 srcCrc;
+	u32 idcode;
+	u8 level, modulo;
+	u32 keyBuf[0x412];
+	u32 keyCode[3];
+};
+static KEY1CacheEntry key1Cache[4];
+static u32 key1CacheNext = 0;
+
 void _KEY1::init(u32 idcode, u8 level, u8 modulo)
 {
+	//the key tables can be in the bios, which may have been loaded since
+	const u32 srcCrc = fastcrc32(0, keyBufPtr, 0x1048);
+	for (u32 i = 0; i < ARRAY_SIZE(key1Cache); i++)
+	{
+		const KEY1CacheEntry &entry = key1Cache[i];
+		if (entry.valid && entry.srcCrc == srcCrc && entry.idcode == idcode && entry.level == level && entry.modulo == modulo)
+		{
+			memcpy(keyBuf, entry.keyBuf, sizeof(entry.keyBuf));
+			memcpy(keyCode, entry.keyCode, sizeof(entry.keyCode));
+			return;
+		}
+	}
+
 	memcpy(keyBuf, keyBufPtr, 0x1048);
 	keyCode[0] = idcode;
 	keyCode[1] = idcode >> 1;
@@ -42,6 +71,16 @@ void _KEY1::init(u32 idcode, u8 level, u8 modulo)
 	keyCode[2] >>= 1;
 	if (level >= 3)				// third apply (optional)
 		applyKeycode(modulo);
+
+	KEY1CacheEntry &entry = key1Cache[key1CacheNext];
+	key1CacheNext = (key1CacheNext + 1) % ARRAY_SIZE(key1Cache);
+	entry.valid = true;
+	entry.srcCrc = srcCrc;
+	entry.idcode = idcode;
+	entry.level = level;
+	entry.modulo = modulo;
+	memcpy(entry.keyBuf, keyBuf, sizeof(entry.keyBuf));
+	memcpy(entry.keyCode, keyCode, sizeof(entry.keyCode));
 }
 
 void _KEY1::applyKeycode(u8 modulo)
@@ -131,3 +170,42 @@ u8 _KEY2::apply(u8 data)
 	y = (((y >> 5) ^ (y >> 23) ^ (y >> 18) ^ (y >> 31)) & 0xFF) + (y << 8);
 	return ((data ^ x ^ y) & 0xFF);
 }
+
+u32 _KEY2::applyWord(u32 data)
+{
+	//each step reads at least 5 bits above the byte the one before put in, so the register is serial; but four
+	//of them run in a row on locals, and the data is gone over once as a word
+	u64 x = this->x, y = this->y;
+	u32 stream;
+	x = (((x >> 5) ^ (x >> 17) ^ (x >> 18) ^ (x >> 31)) & 0xFF) + (x << 8);
+	y = (((y >> 5) ^ (y >> 23) ^ (y >> 18) ^ (y >> 31)) & 0xFF) + (y << 8);
+	stream = (u32)((x ^ y) & 0xFF);
+	x = (((x >> 5) ^ (x >> 17) ^ (x >> 18) ^ (x >> 31)) & 0xFF) + (x << 8);
+	y = (((y >> 5) ^ (y >> 23) ^ (y >> 18) ^ (y >> 31)) & 0xFF) + (y << 8);
+	stream |= (u32)((x ^ y) & 0xFF) << 8;
+	x = (((x >> 5) ^ (x >> 17) ^ (x >> 18) ^ (x >> 31)) & 0xFF) + (x << 8);
+	y = (((y >> 5) ^ (y >> 23) ^ (y >> 18) ^ (y >> 31)) & 0xFF) + (y << 8);
+	stream |= (u32)((x ^ y) & 0xFF) << 16;
+	x = (((x >> 5) ^ (x >> 17) ^ (x >> 18) ^ (x >> 31)) & 0xFF) + (x << 8);
+	y = (((y >> 5) ^ (y >> 23) ^ (y >> 18) ^ (y >> 31)) & 0xFF) + (y << 8);
+	stream |= (u32)((x ^ y) & 0xFF) << 24;
+	this->x = x;
+	this->y = y;
+	return data ^ stream;
+}
+
+void _KEY2::apply(u8 *data, u32 len)
+{
+	u32 i = 0;
+	for (; i + 4 <= len; i += 4)
+	{
+		u32 word = data[i] | (data[i+1] << 8) | (data[i+2] << 16) | ((u32)data[i+3] << 24);
+		word = applyWord(word);
+		data[i] = (u8)word;
+		data[i+1] = (u8)(word >> 8);
+		data[i+2] = (u8)(word >> 16);
+		data[i+3] = (u8)(word >> 24);
+	}
+	for (; i < len; i++)
+		data[i] = apply(data[i]);
+}
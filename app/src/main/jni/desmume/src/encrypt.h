@@ -67,6 +67,9 @@ public:
 	
 	void applySeed(u8 PROCNUM);
 	u8 apply(u8 data);
+	//the same as apply() on the four bytes of the word, lowest first, and on a buffer
+	u32 applyWord(u32 data);
+	void apply(u8 *data, u32 len);
 };
 
 #endif
\ No newline at end of file
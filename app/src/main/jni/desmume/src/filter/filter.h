@@ -49,3 +49,4 @@ void Render2xBRZ(SSurface Src, SSurface Dst);
 void Render3xBRZ(SSurface Src, SSurface Dst);
 void Render4xBRZ(SSurface Src, SSurface Dst);
 void Render5xBRZ(SSurface Src, SSurface Dst);
+void RenderxBRZRows(int factor, SSurface Src, SSurface Dst, int yFirst, int yLast); //source rows [yFirst, yLast) only, for splitting across threads
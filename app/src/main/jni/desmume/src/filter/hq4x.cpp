@@ -80,24 +80,7 @@ void hq4x_32_def(u32* dst0, u32* dst1, u32* dst2, u32* dst3,
 			c[8] = src2[0];
 		}
 
-		mask = 0;
-
-		if (interp_32_diff(c[0], c[4]))
-			mask |= 1 << 0;
-		if (interp_32_diff(c[1], c[4]))
-			mask |= 1 << 1;
-		if (interp_32_diff(c[2], c[4]))
-			mask |= 1 << 2;
-		if (interp_32_diff(c[3], c[4]))
-			mask |= 1 << 3;
-		if (interp_32_diff(c[5], c[4]))
-			mask |= 1 << 4;
-		if (interp_32_diff(c[6], c[4]))
-			mask |= 1 << 5;
-		if (interp_32_diff(c[7], c[4]))
-			mask |= 1 << 6;
-		if (interp_32_diff(c[8], c[4]))
-			mask |= 1 << 7;
+		mask = interp_32_diffmask(c);
 
 #define P(a, b) dst##b[a]
 #define MUR interp_32_diff(c[1], c[5])
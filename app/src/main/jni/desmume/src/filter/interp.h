@@ -33,6 +33,10 @@
 
 #include "types.h"
 
+#ifdef ENABLE_NEON
+#include <arm_neon.h>
+#endif
+
 /***************************************************************************/
 /* Basic types */
 
@@ -273,6 +277,60 @@ static int interp_32_diff(u32 p1, u32 p2)
   return 0;
 }
 
+/* bit n of the hq2x/hq4x mask is set when the nth of the 8 neighbours around c[4] differs from it */
+#ifdef ENABLE_NEON
+static inline uint32x4_t interp_32_diff4(uint32x4_t p, uint32x4_t center)
+{
+  const uint32x4_t m = vdupq_n_u32(0xFF);
+  const int32x4_t b = vsubq_s32(vreinterpretq_s32_u32(vandq_u32(p, m)), vreinterpretq_s32_u32(vandq_u32(center, m)));
+  const int32x4_t g = vsubq_s32(vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(p, 8), m)), vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(center, 8), m)));
+  const int32x4_t r = vsubq_s32(vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(p, 16), m)), vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(center, 16), m)));
+
+  const int32x4_t y = vaddq_s32(vaddq_s32(r, g), b);
+  const int32x4_t u = vsubq_s32(r, b);
+  const int32x4_t v = vsubq_s32(vsubq_s32(vshlq_n_s32(g, 1), r), b);
+
+  uint32x4_t diff = vcgtq_s32(vabsq_s32(y), vdupq_n_s32(INTERP_Y_LIMIT));
+  diff = vorrq_u32(diff, vcgtq_s32(vabsq_s32(u), vdupq_n_s32(INTERP_U_LIMIT)));
+  return vorrq_u32(diff, vcgtq_s32(vabsq_s32(v), vdupq_n_s32(INTERP_V_LIMIT)));
+}
+
+static inline unsigned interp_32_diffmask(const u32* c)
+{
+  static const u32 bitsLow[4] = { 1 << 0, 1 << 1, 1 << 2, 1 << 3 };
+  static const u32 bitsHigh[4] = { 1 << 4, 1 << 5, 1 << 6, 1 << 7 };
+  const uint32x4_t center = vdupq_n_u32(c[4]);
+  const uint32x4_t bits = vorrq_u32(vandq_u32(interp_32_diff4(vld1q_u32(c), center), vld1q_u32(bitsLow)),
+    vandq_u32(interp_32_diff4(vld1q_u32(c + 5), center), vld1q_u32(bitsHigh)));
+  const uint32x2_t half = vorr_u32(vget_low_u32(bits), vget_high_u32(bits));
+  return vget_lane_u32(half, 0) | vget_lane_u32(half, 1);
+}
+#else
+static inline unsigned interp_32_diffmask(const u32* c)
+{
+  unsigned mask = 0;
+
+  if (interp_32_diff(c[0], c[4]))
+    mask |= 1 << 0;
+  if (interp_32_diff(c[1], c[4]))
+    mask |= 1 << 1;
+  if (interp_32_diff(c[2], c[4]))
+    mask |= 1 << 2;
+  if (interp_32_diff(c[3], c[4]))
+    mask |= 1 << 3;
+  if (interp_32_diff(c[5], c[4]))
+    mask |= 1 << 4;
+  if (interp_32_diff(c[6], c[4]))
+    mask |= 1 << 5;
+  if (interp_32_diff(c[7], c[4]))
+    mask |= 1 << 6;
+  if (interp_32_diff(c[8], c[4]))
+    mask |= 1 << 7;
+
+  return mask;
+}
+#endif
+
 
 #define INTERP_LIMIT2 (96000)
 //#define ABS(x) ((x) < 0 ? -(x) : (x))
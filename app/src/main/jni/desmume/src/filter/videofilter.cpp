@@ -111,7 +111,7 @@ VideoFilter::VideoFilter(size_t srcWidth,
 	ThreadLockInit(&_lockAttributes);
 	ThreadCondInit(&_condRunning);
 	
-	// Create all threads
+	// Set up the per-thread slices. The slices themselves run on the shared TaskPool.
 	_vfThread.resize(threadCount);
 	
 	for (size_t i = 0; i < threadCount; i++)
@@ -119,9 +119,6 @@ VideoFilter::VideoFilter(size_t srcWidth,
 		_vfThread[i].param.srcSurface = _vfSrcSurface;
 		_vfThread[i].param.dstSurface = _vfDstSurface;
 		_vfThread[i].param.filterFunction = NULL;
-		
-		_vfThread[i].task = new Task;
-		_vfThread[i].task->start(false);
 	}
 	
 	_vfFunc = _vfAttributes.filterFunction;
@@ -133,15 +130,6 @@ VideoFilter::VideoFilter(size_t srcWidth,
  ********************************************************************************************/
 VideoFilter::~VideoFilter()
 {
-	// Destroy all threads first
-	for (size_t i = 0; i < _vfThread.size(); i++)
-	{
-		_vfThread[i].task->finish();
-		_vfThread[i].task->shutdown();
-		
-		delete _vfThread[i].task;
-	}
-	
 	_vfThread.clear();
 	
 	// Destroy everything else
@@ -480,15 +468,14 @@ uint32_t* VideoFilter::RunFilter()
 		const size_t threadCount = this->_vfThread.size();
 		if (threadCount > 0)
 		{
-			for (size_t i = 0; i < threadCount; i++)
-			{
-				this->_vfThread[i].task->execute(&RunVideoFilterTask, &this->_vfThread[i].param);
-			}
+			TaskGroup filterGroup(TaskPool::shared());
 			
 			for (size_t i = 0; i < threadCount; i++)
 			{
-				this->_vfThread[i].task->finish();
+				filterGroup.run(&RunVideoFilterTask, &this->_vfThread[i].param);
 			}
+			
+			filterGroup.wait();
 		}
 		else
 		{
@@ -119,7 +119,6 @@ typedef struct
 
 typedef struct
 {
-	Task *task;
 	VideoFilterThreadParam param;
 } VideoFilterThread;
 
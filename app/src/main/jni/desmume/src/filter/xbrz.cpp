@@ -20,10 +20,15 @@
 
 #include "xbrz.h"
 #include "filter.h"
+#include "types.h"
 #include <cassert>
 #include <complex>
 #include <algorithm>
 
+#ifdef ENABLE_NEON
+#include <arm_neon.h>
+#endif
+
 #define COLOR_MASK_A	0xFF000000
 #define COLOR_MASK_R	0x00FF0000
 #define COLOR_MASK_G	0x0000FF00
@@ -499,6 +504,15 @@ input kernel area naming convention:
 | M | N | O | P |
 -----------------
 */
+template <class ColorDistance>
+FORCE_INLINE //weights of the two diagonals through the center of the 4x4 kernel
+void cornerGradients(const Kernel_4x4& ker, const xbrz::ScalerCfg& cfg, double& jg, double& fk)
+{
+    const int weight = 4;
+    jg = ColorDistance::dist(ker.i, ker.f, cfg.luminanceWeight_) + ColorDistance::dist(ker.f, ker.c, cfg.luminanceWeight_) + ColorDistance::dist(ker.n, ker.k, cfg.luminanceWeight_) + ColorDistance::dist(ker.k, ker.h, cfg.luminanceWeight_) + weight * ColorDistance::dist(ker.j, ker.g, cfg.luminanceWeight_);
+    fk = ColorDistance::dist(ker.e, ker.j, cfg.luminanceWeight_) + ColorDistance::dist(ker.j, ker.o, cfg.luminanceWeight_) + ColorDistance::dist(ker.b, ker.g, cfg.luminanceWeight_) + ColorDistance::dist(ker.g, ker.l, cfg.luminanceWeight_) + weight * ColorDistance::dist(ker.f, ker.k, cfg.luminanceWeight_);
+}
+
 template <class ColorDistance>
 FORCE_INLINE //detect blend direction
 BlendResult preProcessCorners(const Kernel_4x4& ker, const xbrz::ScalerCfg& cfg) //result: F, G, J, K corners of "GradientType"
@@ -513,9 +527,8 @@ BlendResult preProcessCorners(const Kernel_4x4& ker, const xbrz::ScalerCfg& cfg)
 
     //auto dist = [&](uint32_t pix1, uint32_t pix2) { return ColorDistance::dist(pix1, pix2, cfg.luminanceWeight_); };
 
-    const int weight = 4;
-    double jg = ColorDistance::dist(ker.i, ker.f, cfg.luminanceWeight_) + ColorDistance::dist(ker.f, ker.c, cfg.luminanceWeight_) + ColorDistance::dist(ker.n, ker.k, cfg.luminanceWeight_) + ColorDistance::dist(ker.k, ker.h, cfg.luminanceWeight_) + weight * ColorDistance::dist(ker.j, ker.g, cfg.luminanceWeight_);
-    double fk = ColorDistance::dist(ker.e, ker.j, cfg.luminanceWeight_) + ColorDistance::dist(ker.j, ker.o, cfg.luminanceWeight_) + ColorDistance::dist(ker.b, ker.g, cfg.luminanceWeight_) + ColorDistance::dist(ker.g, ker.l, cfg.luminanceWeight_) + weight * ColorDistance::dist(ker.f, ker.k, cfg.luminanceWeight_);
+    double jg, fk;
+    cornerGradients<ColorDistance>(ker, cfg, jg, fk);
 
     if (jg < fk) //test sample: 70% of values max(jg, fk) / min(jg, fk) are between 1.1 and 3.7 with median being 1.8
     {
@@ -1168,6 +1181,58 @@ struct ColorDistanceRGB
     }
 };
 
+#ifdef ENABLE_NEON
+//distYCbCr() of four pairs of pixels at once, in single precision
+inline
+float32x4_t distYCbCr4(uint32x4_t pix1, uint32x4_t pix2, float lumaWeight)
+{
+    const uint32x4_t mask = vdupq_n_u32(0xFF);
+    const float32x4_t r_diff = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(pix1, 16), mask)), vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(pix2, 16), mask))));
+    const float32x4_t g_diff = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(pix1, 8), mask)), vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(pix2, 8), mask))));
+    const float32x4_t b_diff = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vandq_u32(pix1, mask)), vreinterpretq_s32_u32(vandq_u32(pix2, mask))));
+
+    const float k_b = 0.0593f; //ITU-R BT.2020 conversion, as distYCbCr()
+    const float k_r = 0.2627f;
+    const float k_g = 1.0f - k_b - k_r;
+
+    const float32x4_t y   = vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(r_diff, k_r), g_diff, k_g), b_diff, k_b);
+    const float32x4_t c_b = vmulq_n_f32(vsubq_f32(b_diff, y), 0.5f / (1.0f - k_b));
+    const float32x4_t c_r = vmulq_n_f32(vsubq_f32(r_diff, y), 0.5f / (1.0f - k_r));
+    const float32x4_t l_y = vmulq_n_f32(y, lumaWeight);
+    const float32x4_t sq = vmlaq_f32(vmlaq_f32(vmulq_f32(l_y, l_y), c_b, c_b), c_r, c_r);
+#ifdef __aarch64__
+    return vsqrtq_f32(sq);
+#else
+    //sqrt(x) = x * rsqrt(x), with two newton steps on the estimate. the floor keeps x = 0 from becoming 0 * inf
+    const float32x4_t x = vmaxq_f32(sq, vdupq_n_f32(1e-10f));
+    float32x4_t e = vrsqrteq_f32(x);
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(x, e), e));
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(x, e), e));
+    return vmulq_f32(sq, e);
+#endif
+}
+
+//the ten distances of the two gradients go through NEON as three vectors instead of one by one in double precision
+template <>
+FORCE_INLINE
+void cornerGradients<ColorDistanceRGB>(const Kernel_4x4& ker, const xbrz::ScalerCfg& cfg, double& jg, double& fk)
+{
+    const uint32_t jg1[4] = { ker.i, ker.f, ker.n, ker.k }, jg2[4] = { ker.f, ker.c, ker.k, ker.h };
+    const uint32_t fk1[4] = { ker.e, ker.j, ker.b, ker.g }, fk2[4] = { ker.j, ker.o, ker.g, ker.l };
+    const uint32_t center1[4] = { ker.j, ker.f, 0, 0 }, center2[4] = { ker.g, ker.k, 0, 0 };
+    const float lumaWeight = static_cast<float>(cfg.luminanceWeight_);
+
+    float jgDist[4], fkDist[4], centerDist[4];
+    vst1q_f32(jgDist, distYCbCr4(vld1q_u32(jg1), vld1q_u32(jg2), lumaWeight));
+    vst1q_f32(fkDist, distYCbCr4(vld1q_u32(fk1), vld1q_u32(fk2), lumaWeight));
+    vst1q_f32(centerDist, distYCbCr4(vld1q_u32(center1), vld1q_u32(center2), lumaWeight));
+
+    const int weight = 4;
+    jg = jgDist[0] + jgDist[1] + jgDist[2] + jgDist[3] + weight * centerDist[0];
+    fk = fkDist[0] + fkDist[1] + fkDist[2] + fkDist[3] + weight * centerDist[1];
+}
+#endif
+
 struct ColorDistanceARGB
 {
     static double dist(uint32_t pix1, uint32_t pix2, double luminanceWeight)
@@ -1318,3 +1383,8 @@ void Render5xBRZ(SSurface Src, SSurface Dst)
 {
 	xbrz::scale(5, (const uint32_t *)Src.Surface, (uint32_t *)Dst.Surface, Src.Width, Src.Height, xbrz::ColorFormatRGB);
 }
+
+void RenderxBRZRows(int factor, SSurface Src, SSurface Dst, int yFirst, int yLast)
+{
+	xbrz::scale(factor, (const uint32_t *)Src.Surface, (uint32_t *)Dst.Surface, Src.Width, Src.Height, xbrz::ColorFormatRGB, xbrz::ScalerCfg(), yFirst, yLast);
+}
@@ -536,7 +536,7 @@ bool CFIRMWARE::loadSettings()
 							memcpy(&MMU.fw.data[userDataAddr + 0x100], usr, USER_SETTINGS_SIZE);
 							memcpy(&MMU.fw.data[WIFI_SETTINGS_OFF], usr + USER_SETTINGS_SIZE, WIFI_SETTINGS_SIZE);
 							memcpy(&MMU.fw.data[WIFI_AP_SETTINGS_OFF], usr + USER_SETTINGS_SIZE + WIFI_SETTINGS_SIZE, WIFI_AP_SETTINGS_SIZE);
-							printf("Loaded user settings from %s\n", MMU.fw.userfile);
+							CORELOG_INFO("Loaded user settings from %s\n", MMU.fw.userfile);
 						}
 					}
 				}
@@ -545,7 +545,7 @@ bool CFIRMWARE::loadSettings()
 			}
 		}
 		else
-			printf("Failed loading firmware config from %s (wrong file size)\n", MMU.fw.userfile);
+			CORELOG_ERROR("Failed loading firmware config from %s (wrong file size)\n", MMU.fw.userfile);
 
 		fclose(fp);
 	}
@@ -573,7 +573,7 @@ bool CFIRMWARE::saveSettings()
 		memcpy(data + 0x100, data, 0x100);
 	}
 	
-	printf("Firmware: saving config");
+	CORELOG_INFO("Firmware: saving config");
 	FILE *fp = fopen(MMU.fw.userfile, "wb");
 	if (fp)
 	{
@@ -585,16 +585,16 @@ bool CFIRMWARE::saveSettings()
 			memcpy(usr + DFC_ID_SIZE + USER_SETTINGS_SIZE, &MMU.fw.data[WIFI_SETTINGS_OFF], WIFI_SETTINGS_SIZE);
 			memcpy(usr + DFC_ID_SIZE + USER_SETTINGS_SIZE + WIFI_SETTINGS_SIZE, &MMU.fw.data[WIFI_AP_SETTINGS_OFF], WIFI_AP_SETTINGS_SIZE);
 			if (fwrite(usr, 1, DFC_FILE_SIZE, fp) == DFC_FILE_SIZE)
-				printf(" - done\n");
+				CORELOG_INFO(" - done\n");
 			else
-				printf(" - failed\n");
+				CORELOG_ERROR(" - failed\n");
 
 			delete [] usr;
 		}
 		fclose(fp);
 	}
 	else
-		printf(" - failed\n");
+		CORELOG_ERROR(" - failed\n");
 
 	return true;
 }
@@ -1092,7 +1092,7 @@ u8 fw_transfer(fw_memory_chip *mc, u8 data)
 				break;
 				
 			default:
-				printf("Unhandled FW command: %02X\n", data);
+				CORELOG_INFO("Unhandled FW command: %02X\n", data);
 				break;
 		}
 	}
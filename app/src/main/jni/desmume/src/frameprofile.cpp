@@ -0,0 +1,288 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "frameprofile.h"
+#include "hostmem.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#ifdef ANDROID
+#include <dlfcn.h>
+#endif
+
+u32 frameprofile_mode = 0;
+
+static const char* const zoneNames[PROFILE_ZONE_COUNT] = {
+	"NDS_exec",
+	"armInnerLoop",
+	"GPU_RenderLine",
+	"gfx3d_doFlush",
+	"SoftRastRender",
+	"SoftRastRenderFinish",
+	"SPU_Emulate_user",
+	"draw",
+	"filter",
+};
+
+static const char* const counterNames[PROFILE_COUNTER_COUNT] = {
+	"normals",
+	"normalsCached",
+	"pageFaults",
+};
+
+//the single timings, as many as this: a few frames' worth in a game that runs the cpu loop a lot
+#define PROFILE_EVENTS (1 << 17)
+
+struct ProfileEvent
+{
+	u64 start;
+	u32 duration;
+	u32 tid;
+	u32 zone;
+};
+
+//what the zones took so far this frame, added to from whichever thread they ran on
+static u64 frameTotals[PROFILE_ZONE_COUNT];
+static u32 frames[PROFILE_FRAMES][PROFILE_ZONE_COUNT];
+static u32 counterTotals[PROFILE_COUNTER_COUNT];
+static u32 counterFrames[PROFILE_FRAMES][PROFILE_COUNTER_COUNT];
+static u32 frameCount = 0;
+//the process' page faults when the last frame ended
+static u64 lastFaults = 0;
+
+//allocated the first time it is enabled, and kept from then on, since a zone on some other thread may be using it
+static ProfileEvent* events = NULL;
+static u32 eventPos = 0;
+
+static u32 threadId()
+{
+#ifdef WIN32
+	return GetCurrentThreadId();
+#else
+	static __thread u32 tid = 0;
+	if(!tid) tid = (u32)syscall(__NR_gettid);
+	return tid;
+#endif
+}
+
+#ifdef ANDROID
+//ATrace_beginSection only exists from android 6.0 on and the app still runs on 5.0, so it is looked up at runtime
+typedef void (*ATraceBeginSection)(const char* sectionName);
+typedef void (*ATraceEndSection)();
+
+static ATraceBeginSection atraceBeginSection = NULL;
+static ATraceEndSection atraceEndSection = NULL;
+
+static bool loadATrace()
+{
+	if(atraceBeginSection && atraceEndSection)
+		return true;
+	void* lib = dlopen("libandroid.so", RTLD_NOW);
+	if(!lib)
+		return false;
+	atraceBeginSection = (ATraceBeginSection)dlsym(lib, "ATrace_beginSection");
+	atraceEndSection = (ATraceEndSection)dlsym(lib, "ATrace_endSection");
+	return atraceBeginSection && atraceEndSection;
+}
+#endif
+
+static void setMode(u32 flag, bool enable)
+{
+	u32 mode = frameprofile_mode;
+	if(enable) mode |= flag;
+	else mode &= ~flag;
+	__atomic_store_n(&frameprofile_mode, mode, __ATOMIC_RELEASE);
+}
+
+void frameprofile_enable(bool enable)
+{
+	if(enable == ((frameprofile_mode & PROFILE_TIMING) != 0)) return;
+
+	if(enable)
+	{
+		if(!events) events = new ProfileEvent[PROFILE_EVENTS];
+		memset(frameTotals, 0, sizeof(frameTotals));
+		memset(frames, 0, sizeof(frames));
+		memset(counterTotals, 0, sizeof(counterTotals));
+		memset(counterFrames, 0, sizeof(counterFrames));
+		lastFaults = hostmem_faults();
+		frameCount = 0;
+		eventPos = 0;
+	}
+	setMode(PROFILE_TIMING, enable);
+}
+
+void frameprofile_enableTrace(bool enable)
+{
+#ifdef ANDROID
+	if(enable && !loadATrace())
+		enable = false;
+#else
+	enable = false;
+#endif
+	setMode(PROFILE_ATRACE, enable);
+}
+
+void frameprofile_enableCosts(bool enable)
+{
+	setMode(PROFILE_COSTS, enable);
+}
+
+void FrameProfileScope::begin()
+{
+#ifdef ANDROID
+	//the names are the ones the csv and the trace use
+	if(mode & PROFILE_ATRACE) atraceBeginSection(zoneNames[zone]);
+#endif
+	if(mode & (PROFILE_TIMING | PROFILE_COSTS)) start = frameprofile_now();
+}
+
+void FrameProfileScope::end()
+{
+	if(mode & (PROFILE_TIMING | PROFILE_COSTS)) frameprofile_add(zone, start, frameprofile_now());
+#ifdef ANDROID
+	if(mode & PROFILE_ATRACE) atraceEndSection();
+#endif
+}
+
+u64 frameprofile_now()
+{
+#ifdef WIN32
+	static LARGE_INTEGER freq;
+	if(!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (u64)((double)now.QuadPart * 1000000000.0 / (double)freq.QuadPart);
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+void frameprofile_add(FrameProfileZone zone, u64 start, u64 end)
+{
+	const u64 duration = end - start;
+	__atomic_fetch_add(&frameTotals[zone], duration, __ATOMIC_RELAXED);
+	if(!(frameprofile_mode & PROFILE_TIMING)) return;
+
+	ProfileEvent &event = events[__atomic_fetch_add(&eventPos, 1, __ATOMIC_RELAXED) & (PROFILE_EVENTS-1)];
+	event.start = start;
+	event.duration = (u32)std::min<u64>(duration, 0xFFFFFFFF);
+	event.tid = threadId();
+	event.zone = zone;
+}
+
+void frameprofile_count(FrameProfileCounter counter, u32 n)
+{
+	if(!(frameprofile_mode & PROFILE_TIMING)) return;
+	__atomic_fetch_add(&counterTotals[counter], n, __ATOMIC_RELAXED);
+}
+
+void frameprofile_endframe()
+{
+	if(!(frameprofile_mode & (PROFILE_TIMING | PROFILE_COSTS))) return;
+
+	u32 *frame = frames[frameCount % PROFILE_FRAMES];
+	for(int i = 0; i < PROFILE_ZONE_COUNT; i++)
+		frame[i] = (u32)std::min<u64>(__atomic_exchange_n(&frameTotals[i], 0, __ATOMIC_RELAXED) / 1000, 0xFFFFFFFF);
+	if(frameprofile_mode & PROFILE_TIMING)
+	{
+		const u64 faults = hostmem_faults();
+		__atomic_store_n(&counterTotals[PROFILE_PAGE_FAULTS], (u32)std::min<u64>(faults - lastFaults, 0xFFFFFFFF), __ATOMIC_RELAXED);
+		lastFaults = faults;
+	}
+	for(int i = 0; i < PROFILE_COUNTER_COUNT; i++)
+		counterFrames[frameCount % PROFILE_FRAMES][i] = __atomic_exchange_n(&counterTotals[i], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&frameCount, frameCount + 1, __ATOMIC_RELEASE);
+}
+
+//the newest frame may be getting written while this copies it: that is one bar of the graph off, for a frame
+int frameprofile_getframes(u32* out, int maxFrames)
+{
+	const u32 count = __atomic_load_n(&frameCount, __ATOMIC_ACQUIRE);
+	const u32 n = std::min<u32>(std::min<u32>(count, PROFILE_FRAMES), maxFrames);
+	for(u32 i = 0; i < n; i++)
+		memcpy(out + i*PROFILE_ZONE_COUNT, frames[(count - n + i) % PROFILE_FRAMES], sizeof(frames[0]));
+	return n;
+}
+
+const char* frameprofile_zonename(FrameProfileZone zone)
+{
+	return zoneNames[zone];
+}
+
+//with the emulation stopped, so nothing is added to what is being written out
+bool frameprofile_dump(const char* csvPath, const char* tracePath)
+{
+	if(!events) return false;
+
+	FILE* csv = fopen(csvPath, "w");
+	if(!csv) return false;
+	fprintf(csv, "frame");
+	for(int i = 0; i < PROFILE_ZONE_COUNT; i++)
+		fprintf(csv, ",%s", zoneNames[i]);
+	for(int i = 0; i < PROFILE_COUNTER_COUNT; i++)
+		fprintf(csv, ",%s", counterNames[i]);
+	fprintf(csv, "\n");
+
+	const u32 count = frameCount;
+	const u32 n = std::min<u32>(count, PROFILE_FRAMES);
+	for(u32 f = count - n; f < count; f++)
+	{
+		fprintf(csv, "%u", f);
+		for(int i = 0; i < PROFILE_ZONE_COUNT; i++)
+			fprintf(csv, ",%u", frames[f % PROFILE_FRAMES][i]);
+		for(int i = 0; i < PROFILE_COUNTER_COUNT; i++)
+			fprintf(csv, ",%u", counterFrames[f % PROFILE_FRAMES][i]);
+		fprintf(csv, "\n");
+	}
+	fclose(csv);
+
+	FILE* trace = fopen(tracePath, "w");
+	if(!trace) return false;
+
+	const u32 end = eventPos;
+	const u32 begin = end > PROFILE_EVENTS ? end - PROFILE_EVENTS : 0;
+	const u64 base = begin != end ? events[begin & (PROFILE_EVENTS-1)].start : 0;
+#ifdef WIN32
+	const u32 pid = GetCurrentProcessId();
+#else
+	const u32 pid = getpid();
+#endif
+
+	//the times are microseconds in the trace event format
+	fprintf(trace, "{\"traceEvents\":[\n");
+	for(u32 i = begin; i < end; i++)
+	{
+		const ProfileEvent &event = events[i & (PROFILE_EVENTS-1)];
+		fprintf(trace, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+			i == begin ? "" : ",\n", zoneNames[event.zone], pid, event.tid,
+			(s64)(event.start - base) / 1000.0, event.duration / 1000.0);
+	}
+	fprintf(trace, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(trace);
+	return true;
+}
@@ -0,0 +1,111 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FRAMEPROFILE_H
+#define _FRAMEPROFILE_H
+
+#include "types.h"
+
+//where the time of a frame goes. each zone is timed from where it is entered to where it is left, so the time of
+//a zone includes the zones it calls (the cpu loop runs the 2d lines and the 3d flush, for one).
+//the time each zone took is added up over an emulated frame, and the last PROFILE_FRAMES frames are kept.
+//the single zone timings are also kept, as many as fit, to be written out as a trace.
+//on android the zones can also be sections in the system trace (atrace, which perfetto and systrace record),
+//next to what the rest of the system was doing.
+enum FrameProfileZone
+{
+	PROFILE_NDS_EXEC,
+	PROFILE_CPU_LOOP,
+	PROFILE_GPU_LINE,
+	PROFILE_3D_FLUSH,
+	PROFILE_3D_RENDER,
+	PROFILE_3D_FINISH,
+	PROFILE_SPU_USER,
+	PROFILE_DRAW,
+	PROFILE_FILTER,
+	PROFILE_ZONE_COUNT
+};
+
+//what is counted over a frame, next to the times of the zones
+enum FrameProfileCounter
+{
+	PROFILE_NORMALS,		//normal commands the geometry engine ran
+	PROFILE_NORMALS_CACHED,	//and how many of them found their lighting already worked out
+	PROFILE_PAGE_FAULTS,	//page faults of the whole process, minor and major: memory first touched in the frame
+	PROFILE_COUNTER_COUNT
+};
+
+#define PROFILE_FRAMES 256
+
+enum
+{
+	PROFILE_TIMING = 1,
+	PROFILE_ATRACE = 2,
+	PROFILE_COSTS = 4, //only the frame totals, without the single timings, for what needs to know what frames cost
+};
+
+//which of the above the zones do. with none, they cost a test of this each
+extern u32 frameprofile_mode;
+
+void frameprofile_enable(bool enable);
+//only does something where there is an atrace to write to
+void frameprofile_enableTrace(bool enable);
+void frameprofile_enableCosts(bool enable);
+
+//nanoseconds from some fixed point
+u64 frameprofile_now();
+//from any thread
+void frameprofile_add(FrameProfileZone zone, u64 start, u64 end);
+//from any thread. the csv has the counts next to the times
+void frameprofile_count(FrameProfileCounter counter, u32 n);
+//the emulation thread, after each frame
+void frameprofile_endframe();
+
+//microseconds, for each frame (oldest first) PROFILE_ZONE_COUNT of them; returns how many frames it wrote
+int frameprofile_getframes(u32* out, int maxFrames);
+//the frames as csv, and the single timings as a chrome trace (chrome://tracing, or perfetto's ui)
+bool frameprofile_dump(const char* csvPath, const char* tracePath);
+
+const char* frameprofile_zonename(FrameProfileZone zone);
+
+class FrameProfileScope
+{
+public:
+	FrameProfileScope(FrameProfileZone zone)
+		: zone(zone)
+		, mode(frameprofile_mode)
+	{
+		if(mode) begin();
+	}
+	~FrameProfileScope()
+	{
+		if(mode) end();
+	}
+
+private:
+	void begin();
+	void end();
+
+	FrameProfileZone zone;
+	//what it started with, so that a section begun is always ended even if the mode changes in between
+	u32 mode;
+	u64 start;
+};
+
+#define PROFILE_ZONE(zone) FrameProfileScope _profileScope(zone)
+
+#endif
@@ -0,0 +1,192 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+#include "gamepreset.h"
+#include "NDSSystem.h"
+#include "corelog.h"
+
+//the keys of the fields, in GamePresetField order
+static const char* const fieldKeys[GAMEPRESET_FIELDS] = {
+	"jit", "block", "timing", "cores", "skew", "renderer", "frameskip"
+};
+
+static std::string databasePath;
+static GamePreset current;
+//the values CommonSettings had before the preset went over them
+static GamePreset saved;
+
+void gamepreset_setDatabase(const char* path)
+{
+	databasePath = path ? path : "";
+}
+
+//which of the game's lines this is: 1 for the three letters, 2 for the code, 3 for the code and crc. 0 for another game
+static int lineRank(const char* code, size_t codeLen, const char* crc, size_t crcLen, const char* gameCode, u32 gameCrc)
+{
+	if ((codeLen != 3 && codeLen != 4) || memcmp(code, gameCode, codeLen))
+		return 0;
+	if (crcLen == 1 && crc[0] == '*')
+		return codeLen - 2;
+	if (gameCrc == 0 || crcLen != 8)
+		return 0;
+	char* end;
+	const u32 lineCrc = strtoul(std::string(crc, crcLen).c_str(), &end, 16);
+	return (*end == 0 && lineCrc == gameCrc) ? 3 : 0;
+}
+
+static size_t nextToken(const char*& p)
+{
+	p += strspn(p, " \t\r\n");
+	return strcspn(p, " \t\r\n");
+}
+
+static bool parseFields(const char* p, GamePreset& preset)
+{
+	bool any = false;
+	for (size_t len; (len = nextToken(p)) != 0; p += len)
+	{
+		const char* eq = (const char*)memchr(p, '=', len);
+		if (eq == NULL)
+			continue;
+		for (int i = 0; i < GAMEPRESET_FIELDS; i++)
+		{
+			if (strlen(fieldKeys[i]) != (size_t)(eq - p) || memcmp(p, fieldKeys[i], eq - p))
+				continue;
+			char* end;
+			const long v = strtol(eq + 1, &end, 0);
+			if (end != eq + 1 && end == p + len && v >= 0)
+			{
+				preset.set((GamePresetField)i, (s32)v);
+				any = true;
+			}
+		}
+	}
+	return any;
+}
+
+//the fields of the game's lines in the file over preset, the less exact lines first. false if it has none
+static bool readFile(const char* path, const char* gameCode, u32 crc, GamePreset& preset)
+{
+	if (path == NULL || path[0] == 0)
+		return false;
+	FILE* f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
+
+	std::string lines[4];
+	char line[512];
+	while (fgets(line, sizeof(line), f))
+	{
+		char* comment = strchr(line, '#');
+		if (comment)
+			*comment = 0;
+		const char* p = line;
+		const size_t codeLen = nextToken(p);
+		const char* code = p;
+		p += codeLen;
+		const size_t crcLen = nextToken(p);
+		const int rank = lineRank(code, codeLen, p, crcLen, gameCode, crc);
+		if (rank)
+			lines[rank].append(p + crcLen).append(" ");
+	}
+	fclose(f);
+
+	bool any = false;
+	for (int rank = 1; rank < 4; rank++)
+		any |= parseFields(lines[rank].c_str(), preset);
+	return any;
+}
+
+bool gamepreset_find(const char* gameCode, u32 crc, const char* userPath, GamePreset& preset)
+{
+	memset(&preset, 0, sizeof(preset));
+	const bool known = readFile(databasePath.c_str(), gameCode, crc, preset);
+	const bool user = readFile(userPath, gameCode, crc, preset);
+	if (!preset.fields)
+		return false;
+
+	char line[256];
+	int len = 0;
+	for (int i = 0; i < GAMEPRESET_FIELDS && len < (int)sizeof(line); i++)
+		if (preset.has((GamePresetField)i))
+			len += snprintf(line + len, sizeof(line) - len, " %s=%d", fieldKeys[i], preset.value[i]);
+	CORELOG_INFO("Game preset from %s:%s\n", known ? (user ? "the database and the user's file" : "the database") : "the user's file", line);
+	return true;
+}
+
+//the CommonSettings field behind a preset field. false for the frontend's and for cores, which the rasterizer
+//takes from gamepreset_current() itself, since the frontend may change CommonSettings.GFX3D_SoftRastCores as it goes
+static bool getSetting(int field, s32& v)
+{
+	switch (field)
+	{
+	case GAMEPRESET_JIT: v = CommonSettings.use_jit; return true;
+	case GAMEPRESET_BLOCK_SIZE: v = CommonSettings.jit_max_block_size; return true;
+	case GAMEPRESET_TIMING: v = CommonSettings.advanced_timing; return true;
+	case GAMEPRESET_SKEW: v = CommonSettings.cpu_skew; return true;
+	}
+	return false;
+}
+
+static void setSetting(int field, s32 v)
+{
+	switch (field)
+	{
+	case GAMEPRESET_JIT: CommonSettings.use_jit = v != 0; break;
+	case GAMEPRESET_BLOCK_SIZE: CommonSettings.jit_max_block_size = std::max(v, 1); break;
+	case GAMEPRESET_TIMING: CommonSettings.advanced_timing = v != 0; break;
+	case GAMEPRESET_SKEW: CommonSettings.cpu_skew = v; break;
+	}
+}
+
+void gamepreset_apply(const GamePreset& preset)
+{
+	//preset may be current itself
+	const GamePreset next = preset;
+	saved.fields = 0;
+	for (int i = 0; i < GAMEPRESET_FIELDS; i++)
+	{
+		s32 v;
+		if (next.has((GamePresetField)i) && getSetting(i, v))
+		{
+			saved.set((GamePresetField)i, v);
+			setSetting(i, next.value[i]);
+		}
+	}
+	current = next;
+}
+
+void gamepreset_restore()
+{
+	for (int i = 0; i < GAMEPRESET_FIELDS; i++)
+		if (saved.has((GamePresetField)i))
+			setSetting(i, saved.value[i]);
+	saved.fields = 0;
+	current.fields = 0;
+}
+
+const GamePreset& gamepreset_current()
+{
+	return current;
+}
@@ -0,0 +1,73 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _GAMEPRESET_H
+#define _GAMEPRESET_H
+
+#include "types.h"
+
+//the settings a game is known to run fastest with and still right, looked up by its game code and crc like the
+//game database is. desmume.dgp next to desmume.ddb has the known ones, and a .dgp next to the battery save the
+//user's own for that game, which win over the database's field by field. a line is the game code, then the crc or
+//*, then the fields it sets, each key=value:
+//
+//	AMCE * jit=1 block=50 timing=0
+//	AMC  * skew=0				the first three letters alone are the game in every region
+//	AMCE 1C7A3B55 cores=2		only for that dump of it
+//
+//lines for the same game go from the least to the most exact one (three letters, the code, the code and crc), and
+//# starts a comment
+
+enum GamePresetField
+{
+	GAMEPRESET_JIT,			//jit: CommonSettings.use_jit
+	GAMEPRESET_BLOCK_SIZE,	//block: CommonSettings.jit_max_block_size
+	GAMEPRESET_TIMING,		//timing: CommonSettings.advanced_timing
+	GAMEPRESET_CORES,		//cores: the most cores the rasterizer splits a frame over, CommonSettings.GFX3D_SoftRastCores
+	GAMEPRESET_SKEW,		//skew: CommonSettings.cpu_skew, in cycles. 0 for the games that need the cpus in lockstep
+	GAMEPRESET_RENDERER,	//renderer: the frontend's 3d core, by its index in its core list
+	GAMEPRESET_FRAMESKIP,	//frameskip: the frontend's frame skip
+
+	GAMEPRESET_FIELDS
+};
+
+struct GamePreset
+{
+	u32 fields; //a bit for each GamePresetField it sets
+	s32 value[GAMEPRESET_FIELDS];
+
+	bool has(GamePresetField field) const { return (fields >> field) & 1; }
+	void set(GamePresetField field, s32 v) { fields |= 1 << field; value[field] = v; }
+};
+
+void gamepreset_setDatabase(const char* path);
+
+//the preset of a game from the database and the user's file at userPath (either may be missing). crc 0 for not
+//known yet, which only matches the * lines. false if neither has anything for it
+bool gamepreset_find(const char* gameCode, u32 crc, const char* userPath, GamePreset& preset);
+
+//puts the preset's core fields over CommonSettings, keeping the values they had to put back with
+//gamepreset_restore(). after the frontend sets CommonSettings from its own settings again, it calls this with
+//gamepreset_current() so the game keeps its preset
+void gamepreset_apply(const GamePreset& preset);
+void gamepreset_restore();
+
+//what was applied for the game loaded, fields 0 for none. the frontend applies the renderer and frameskip from it
+const GamePreset& gamepreset_current();
+
+#endif
@@ -30,6 +30,10 @@ void gdbstub_mutex_destroy();
 void gdbstub_mutex_lock();
 void gdbstub_mutex_unlock();
 
+// around each frame of the emulation thread: the mutex is only taken while a gdb is connected
+bool gdbstub_frame_begin();
+void gdbstub_frame_end(bool locked);
+
 /*
  * The function interface
  */
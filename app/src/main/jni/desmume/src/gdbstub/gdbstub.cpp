@@ -34,6 +34,9 @@
 #include "../NDSSystem.h"
 #include "../armcpu.h"
 #include "../MMU.h"
+#ifdef HAVE_JIT
+#include "../arm_jit.h"
+#endif
 
 // For cpu_mutex
 #ifdef HOST_WINDOWS
@@ -201,6 +204,50 @@ void gdbstub_mutex_unlock()
 #endif
 }
 
+/* the number of stubs with a gdb connected, and whether a frame is being run
+ * without the lock. a frame only takes the lock while some gdb is connected:
+ * the frame says it runs unlocked before it looks at the count, and a new
+ * connection counts itself before it waits for any unlocked frame to end, so
+ * one of the two always sees the other. */
+static int connected_stubs = 0;
+static int unlocked_frame = 0;
+
+bool gdbstub_frame_begin()
+{
+  __atomic_store_n( &unlocked_frame, 1, __ATOMIC_SEQ_CST);
+  if ( __atomic_load_n( &connected_stubs, __ATOMIC_SEQ_CST) == 0)
+    return false;
+
+  __atomic_store_n( &unlocked_frame, 0, __ATOMIC_SEQ_CST);
+  gdbstub_mutex_lock();
+  return true;
+}
+
+void gdbstub_frame_end( bool locked)
+{
+  if ( locked)
+    gdbstub_mutex_unlock();
+  else
+    __atomic_store_n( &unlocked_frame, 0, __ATOMIC_SEQ_CST);
+}
+
+static void
+connected_gdb( void) {
+  __atomic_add_fetch( &connected_stubs, 1, __ATOMIC_SEQ_CST);
+  while ( __atomic_load_n( &unlocked_frame, __ATOMIC_SEQ_CST)) {
+#ifdef WIN32
+    Sleep( 1);
+#else
+    usleep( 1000);
+#endif
+  }
+}
+
+static void
+disconnected_gdb( void) {
+  __atomic_sub_fetch( &connected_stubs, 1, __ATOMIC_SEQ_CST);
+}
+
 static void
 causeQuit_gdb( struct gdb_stub_state *stub) {
   uint8_t command = QUIT_STUB_MESSAGE;
@@ -223,6 +270,51 @@ indicateCPUStop_gdb( struct gdb_stub_state *stub) {
 #endif
 }
 
+static void
+mark_watch_pages_gdb( struct gdb_stub_state *stub,
+                      const struct breakpoint_gdb *bpoint_list) {
+  for ( ; bpoint_list != NULL; bpoint_list = bpoint_list->next) {
+    uint32_t pages = ((bpoint_list->addr + (bpoint_list->size ? bpoint_list->size - 1 : 0)) >> 12) -
+      (bpoint_list->addr >> 12) + 1;
+    uint32_t i;
+
+    if ( pages > WATCH_PAGE_COUNT)
+      pages = WATCH_PAGE_COUNT;
+    for ( i = 0; i < pages; i++) {
+      uint32_t page = ((bpoint_list->addr >> 12) + i) & (WATCH_PAGE_COUNT - 1);
+      stub->watch_pages[page >> 5] |= 1u << (page & 31);
+    }
+  }
+}
+
+/** rebuilds the watchpoint page filter, after a watchpoint was added or removed */
+static void
+update_watch_pages_gdb( struct gdb_stub_state *stub) {
+  memset( stub->watch_pages, 0, sizeof( stub->watch_pages));
+  mark_watch_pages_gdb( stub, stub->read_breakpoints);
+  mark_watch_pages_gdb( stub, stub->write_breakpoints);
+  mark_watch_pages_gdb( stub, stub->access_breakpoints);
+}
+
+INLINE static int
+watched_page_gdb( const struct gdb_stub_state *stub, uint32_t addr) {
+  uint32_t page = (addr >> 12) & (WATCH_PAGE_COUNT - 1);
+
+  return stub->watch_pages[page >> 5] & (1u << (page & 31));
+}
+
+#ifdef HAVE_JIT
+/** tells the jit whether there still is an instruction breakpoint at addr */
+static void
+update_jit_breakpoint_gdb( struct gdb_stub_state *stub, uint32_t addr) {
+  const struct breakpoint_gdb *bpoint = stub->instr_breakpoints;
+
+  while ( bpoint != NULL && bpoint->addr != addr)
+    bpoint = bpoint->next;
+  arm_jit_set_breakpoint( ((armcpu_t *)stub->arm_cpu_object)->proc_ID, addr, bpoint != NULL);
+}
+#endif
+
 
 
 
@@ -848,6 +940,17 @@ processPacket_gdb( SOCKET_TYPE sock, const uint8_t *packet,
                     error01 = 0;
                   }
 		}
+
+                if ( !error01) {
+                  if ( bpoint_list == &stub->instr_breakpoints) {
+#ifdef HAVE_JIT
+                    update_jit_breakpoint_gdb( stub, addr);
+#endif
+                  }
+                  else {
+                    update_watch_pages_gdb( stub);
+                  }
+                }
 	      }
 	    }
 	  }
@@ -1053,6 +1156,7 @@ check_breaks_gdb( struct gdb_stub_state *gdb_state,
     while ( bpoint != NULL && !found_break) {
       if ( addr == bpoint->addr) {
         DEBUG_LOG("Breakpoint hit at %08x\n", addr);
+        found_break = 1;
 
         /* stall the processor */
         gdb_state->cpu_ctrl->stall( gdb_state->cpu_ctrl->data);
@@ -1071,6 +1175,17 @@ check_breaks_gdb( struct gdb_stub_state *gdb_state,
   return found_break;
 }
 
+#ifdef HAVE_JIT
+/** the jit's trap, which it calls where there is an instruction breakpoint */
+static bool
+jit_trap_gdb( void *data, uint32_t addr) {
+  struct gdb_stub_state *stub = (struct gdb_stub_state *)data;
+
+  return check_breaks_gdb( stub, stub->instr_breakpoints, addr, 0,
+                           STOP_BREAKPOINT) != 0;
+}
+#endif
+
 static void
 WINAPI listenerThread_gdb( void *data) {
   struct gdb_stub_state *state = (struct gdb_stub_state *)data;
@@ -1190,6 +1305,7 @@ WINAPI listenerThread_gdb( void *data) {
 
               FD_SET( new_conn, &main_set);
               state->sock_fd = new_conn;
+              connected_gdb();
             }
 
             if ( close_sock) {
@@ -1225,6 +1341,7 @@ WINAPI listenerThread_gdb( void *data) {
 #endif
               state->sock_fd = -1;
               FD_CLR( gdb_sock, &main_set);
+              disconnected_gdb();
               break;
 
             case READ_BREAK: {
@@ -1269,8 +1386,15 @@ WINAPI listenerThread_gdb( void *data) {
                 close_socket = 1;
               }
               else {
-                if ( processPacket_gdb( gdb_sock, state->rx_packet.buffer,
-                                        state) == -1) {
+                int process_res;
+
+                /* the packet may look at the cpus, which the emulation thread
+                 * only lets go of between frames or while they are stalled */
+                gdbstub_mutex_lock();
+                process_res = processPacket_gdb( gdb_sock, state->rx_packet.buffer,
+                                                 state);
+                gdbstub_mutex_unlock();
+                if ( process_res == -1) {
                   close_socket = 1;
                 }
               }
@@ -1283,6 +1407,7 @@ WINAPI listenerThread_gdb( void *data) {
 #endif
                 state->sock_fd = -1;
                 FD_CLR( gdb_sock, &main_set);
+                disconnected_gdb();
               }
               break;
             }
@@ -1301,6 +1426,7 @@ WINAPI listenerThread_gdb( void *data) {
 #else
     close( state->sock_fd);
 #endif
+    disconnected_gdb();
   }
 
   /* close the listenering sockets */
@@ -1325,6 +1451,11 @@ static uint32_t FASTCALL gdb_prefetch32( void *data, uint32_t adr) {
   struct gdb_stub_state *stub = (struct gdb_stub_state *)data;
   int breakpoint;
 
+#ifdef HAVE_JIT
+  /* armcpu_exec traps there itself, before it fetches anything */
+  if ( CommonSettings.use_jit)
+    return 0;
+#endif
   breakpoint = check_breaks_gdb( stub, stub->instr_breakpoints, adr, 4,
                                  STOP_BREAKPOINT);
 
@@ -1336,6 +1467,11 @@ static uint16_t FASTCALL gdb_prefetch16( void *data, uint32_t adr) {
   struct gdb_stub_state *stub = (struct gdb_stub_state *)data;
   int breakpoint;
 
+#ifdef HAVE_JIT
+  /* armcpu_exec traps there itself, before it fetches anything */
+  if ( CommonSettings.use_jit)
+    return 0;
+#endif
   breakpoint = check_breaks_gdb( stub, stub->instr_breakpoints, adr, 2,
                                  STOP_BREAKPOINT);
 
@@ -1353,6 +1489,9 @@ gdb_read8( void *data, uint32_t adr) {
   /* pass down to the CPU's memory interface */
   value = stub->cpu_memio->read8( stub->cpu_memio->data, adr);
 
+  if ( !watched_page_gdb( stub, adr))
+    return value;
+
   breakpoint = check_breaks_gdb( stub, stub->read_breakpoints, adr, 1,
                                  STOP_RWATCHPOINT);
   if ( !breakpoint)
@@ -1372,6 +1511,9 @@ gdb_read16( void *data, uint32_t adr) {
   /* pass down to the CPU's memory interface */
   value = stub->cpu_memio->read16( stub->cpu_memio->data, adr);
 
+  if ( !watched_page_gdb( stub, adr))
+    return value;
+
   breakpoint = check_breaks_gdb( stub, stub->read_breakpoints, adr, 2,
                                  STOP_RWATCHPOINT);
   if ( !breakpoint)
@@ -1390,6 +1532,9 @@ gdb_read32( void *data, uint32_t adr) {
   /* pass down to the CPU's memory interface */
   value = stub->cpu_memio->read32( stub->cpu_memio->data, adr);
 
+  if ( !watched_page_gdb( stub, adr))
+    return value;
+
   breakpoint = check_breaks_gdb( stub, stub->read_breakpoints, adr, 4,
                                  STOP_RWATCHPOINT);
   if ( !breakpoint)
@@ -1408,6 +1553,9 @@ gdb_write8( void *data, uint32_t adr, uint8_t val) {
   /* pass down to the CPU's memory interface */
   stub->cpu_memio->write8( stub->cpu_memio->data, adr, val);
 
+  if ( !watched_page_gdb( stub, adr))
+    return;
+
   breakpoint = check_breaks_gdb( stub, stub->write_breakpoints, adr, 1,
                                  STOP_WATCHPOINT);
   if ( !breakpoint)
@@ -1424,6 +1572,9 @@ gdb_write16( void *data, uint32_t adr, uint16_t val) {
   /* pass down to the CPU's memory interface */
   stub->cpu_memio->write16( stub->cpu_memio->data, adr, val);
 
+  if ( !watched_page_gdb( stub, adr))
+    return;
+
   breakpoint = check_breaks_gdb( stub, stub->write_breakpoints, adr, 2,
                                  STOP_WATCHPOINT);
   if ( !breakpoint)
@@ -1440,6 +1591,9 @@ gdb_write32( void *data, uint32_t adr, uint32_t val) {
   /* pass down to the CPU's memory interface */
   stub->cpu_memio->write32( stub->cpu_memio->data, adr, val);
 
+  if ( !watched_page_gdb( stub, adr))
+    return;
+
   breakpoint = check_breaks_gdb( stub, stub->write_breakpoints, adr, 4,
                                  STOP_WATCHPOINT);
   if ( !breakpoint)
@@ -1544,6 +1698,7 @@ createStub_gdb( uint16_t port,
   stub->read_breakpoints = NULL;
   stub->write_breakpoints = NULL;
   stub->access_breakpoints = NULL;
+  memset( stub->watch_pages, 0, sizeof( stub->watch_pages));
 
 #ifdef WIN32
   /* initialise the winsock library */
@@ -1662,6 +1817,11 @@ destroyStub_gdb( gdbstub_handle_t instance) {
   //stub->cpu_ctl->remove_post_ex_fn( stub->cpu_ctl->data);
 
   theCPU->ResetMemoryInterfaceToBase();
+#ifdef HAVE_JIT
+  arm_jit_set_trap( theCPU->proc_ID, NULL, NULL);
+  for ( struct breakpoint_gdb *bpoint = stub->instr_breakpoints; bpoint != NULL; bpoint = bpoint->next)
+    arm_jit_set_breakpoint( theCPU->proc_ID, bpoint->addr, false);
+#endif
 	
   DEBUG_LOG("Destroyed GDB stub on port %d\n", stub->port_num);
   delete stub->direct_memio;
@@ -1677,6 +1837,9 @@ activateStub_gdb( gdbstub_handle_t instance) {
   armcpu_t *theCPU = (armcpu_t *)stub->arm_cpu_object;
 
   theCPU->SetCurrentMemoryInterface(stub->gdb_memio);
+#ifdef HAVE_JIT
+  arm_jit_set_trap( theCPU->proc_ID, jit_trap_gdb, stub);
+#endif
 
   /* stall the cpu */
   stub->cpu_ctrl->stall( stub->cpu_ctrl->data);
@@ -93,6 +93,9 @@ struct packet_reader_gdb {
 /** The maximum number of breakpoints (of all types) available to the stub */
 #define BREAKPOINT_POOL_SIZE 100
 
+/** The number of pages the watchpoint filter tells apart */
+#define WATCH_PAGE_COUNT 4096
+
 
 struct gdb_stub_state {
   /** flag indicating if the stub is active */
@@ -132,6 +135,11 @@ struct gdb_stub_state {
   /** the list of active access breakpoints */
   struct breakpoint_gdb *access_breakpoints;
 
+  /** a bit for each 4KB page (modulo 16MB) that has a read, write or access
+   * breakpoint in it, so that the memory interface only walks the lists for
+   * those */
+  uint32_t watch_pages[WATCH_PAGE_COUNT / 32];
+
   /** the pointer to the step break point (not NULL if set) */
   //struct breakpoint_gdb *step_breakpoint;
 
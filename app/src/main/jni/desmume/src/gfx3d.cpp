@@ -43,6 +43,7 @@
 #include "matrix.h"
 #include "bits.h"
 #include "MMU.h"
+#include "GPU.h"
 #include "render3D.h"
 #include "mem.h"
 #include "types.h"
@@ -50,7 +51,15 @@
 #include "NDSSystem.h"
 #include "readwrite.h"
 #include "FIFO.h"
+#include "frameprofile.h"
 #include "movie.h" //only for currframecounter which really ought to be moved into the core emu....
+#include "utils/task.h"
+#include "utils/fastcrc.h"
+#include "utils/tablegen.h"
+
+#ifdef ENABLE_NEON
+#include <arm_neon.h>
+#endif
 
 //#define _SHOW_VTX_COUNTERS	// show polygon/vertex counters on screen
 #ifdef _SHOW_VTX_COUNTERS
@@ -242,8 +251,13 @@ public:
 //while the fifo was full, apparently expecting the fifo not to be full by that time.
 //in general we are finding that 3d takes less time than we think....
 //although maybe the true culprit was charging the cpu less time for the dma.
-#define GFX_DELAY(x) NDS_RescheduleGXFIFO(1);
-#define GFX_DELAY_M2(x) NDS_RescheduleGXFIFO(1);
+//while gfx3d_execute3D runs a batch, the delays only have to keep the sequencer going;
+//the batch takes care of that once, after its last command.
+static bool gxBatch = false;
+//the geometry worker never touches the sequencer; its commands are charged by the batch that queued them
+static bool gxThreaded = false;
+#define GFX_DELAY(x) if(!gxBatch && !gxThreaded) NDS_RescheduleGXFIFO(1);
+#define GFX_DELAY_M2(x) if(!gxBatch && !gxThreaded) NDS_RescheduleGXFIFO(1);
 
 using std::max;
 using std::min;
@@ -252,13 +266,6 @@ GFX3D gfx3d;
 Viewer3d_State* viewer3d_state = NULL;
 static GFX3D_Clipper boxtestClipper;
 
-//tables that are provided to anyone
-CACHE_ALIGN u32 color_15bit_to_24bit_reverse[32768];
-CACHE_ALIGN u32 color_15bit_to_24bit[32768];
-CACHE_ALIGN u16 color_15bit_to_16bit_reverse[32768];
-CACHE_ALIGN u8 mixTable555[32][32][32];
-CACHE_ALIGN u32 dsDepthExtend_15bit_to_24bit[32768];
-
 //is this a crazy idea? this table spreads 5 bits evenly over 31 from exactly 0 to INT_MAX
 CACHE_ALIGN const int material_5bit_to_31bit[] = {
 	0x00000000, 0x04210842, 0x08421084, 0x0C6318C6,
@@ -299,15 +306,56 @@ CACHE_ALIGN const u8 material_3bit_to_6bit[] = {
 	0, 8, 16, 26, 34, 44, 52, 63
 };
 
-//private acceleration tables
-static float float16table[65536];
-static float float10Table[1024];
-static float float10RelTable[1024];
-static float normalTable[1024];
-
 #define fix2float(v)    (((float)((s32)(v))) / (float)(1<<12))
 #define fix10_2float(v) (((float)((s32)(v))) / (float)(1<<9))
 
+//the tables below are worked out by the compiler (see utils/tablegen.h), so they are in the read-only data and cost
+//nothing at startup
+
+//produce the color bits of a 24bpp color from a DS RGB15 using bit logic (internal use only)
+#define RGB15TO24_BITLOGIC(col) ( (material_5bit_to_8bit[((col)>>10)&0x1F]<<16) | (material_5bit_to_8bit[((col)>>5)&0x1F]<<8) | material_5bit_to_8bit[(col)&0x1F] )
+
+//produce the color bits of a 24bpp color from a DS RGB15 using bit logic (internal use only). RGB are reverse of usual
+#define RGB15TO24_BITLOGIC_REVERSE(col) ( (material_5bit_to_8bit[(col)&0x1F]<<16) | (material_5bit_to_8bit[((col)>>5)&0x1F]<<8) | material_5bit_to_8bit[((col)>>10)&0x1F] )
+
+#define COLOR24_ENTRY(i) (u32)LE_TO_LOCAL_32( RGB15TO24_BITLOGIC(i) )
+#define COLOR24_REVERSE_ENTRY(i) (u32)LE_TO_LOCAL_32( RGB15TO24_BITLOGIC_REVERSE(i) )
+#define COLOR16_REVERSE_ENTRY(i) (u16)((((i) & 0x001F) << 11) | (material_5bit_to_6bit[((i) & 0x03E0) >> 5] << 5) | (((i) & 0x7C00) >> 10))
+// 15-bit to 24-bit depth formula from http://nocash.emubase.de/gbatek.htm#ds3drearplane
+#define DEPTH24_ENTRY(i) (u32)LE_TO_LOCAL_32( ((i)*0x200)+(((i)+1)>>15)*0x01FF )
+//mixTable555[a][r][oldr] = (r*a + oldr*(31-a)) / 31
+#define MIX555_ENTRY(i) (u8)(((((i)>>5)&31)*((i)>>10) + ((i)&31)*(31-((i)>>10))) / 31)
+
+#define FLOAT16_ENTRY(i) fix2float((signed short)(i))
+#define FLOAT10_ENTRY(i) (((signed short)((i)<<6)) / (float)(1<<12))
+#define FLOAT10REL_ENTRY(i) (((signed short)((i)<<6)) / (float)(1<<18))
+#define NORMAL_ENTRY(i) (((signed short)((i)<<6)) / (float)(1<<15))
+
+//tables that are provided to anyone
+CACHE_ALIGN const u32 color_15bit_to_24bit_reverse[32768] = { TABLE_32768(COLOR24_REVERSE_ENTRY) };
+CACHE_ALIGN const u32 color_15bit_to_24bit[32768] = { TABLE_32768(COLOR24_ENTRY) };
+CACHE_ALIGN const u16 color_15bit_to_16bit_reverse[32768] = { TABLE_32768(COLOR16_REVERSE_ENTRY) };
+CACHE_ALIGN const u8 mixTable555[32][32][32] = { TABLE_32768(MIX555_ENTRY) };
+CACHE_ALIGN const u32 dsDepthExtend_15bit_to_24bit[32768] = { TABLE_32768(DEPTH24_ENTRY) };
+
+//private acceleration tables
+static const float float16table[65536] = { TABLE_65536(FLOAT16_ENTRY) };
+static const float float10Table[1024] = { TABLE_1024(FLOAT10_ENTRY) };
+static const float float10RelTable[1024] = { TABLE_1024(FLOAT10REL_ENTRY) };
+static const float normalTable[1024] = { TABLE_1024(NORMAL_ENTRY) };
+
+#undef RGB15TO24_BITLOGIC
+#undef RGB15TO24_BITLOGIC_REVERSE
+#undef COLOR24_ENTRY
+#undef COLOR24_REVERSE_ENTRY
+#undef COLOR16_REVERSE_ENTRY
+#undef DEPTH24_ENTRY
+#undef MIX555_ENTRY
+#undef FLOAT16_ENTRY
+#undef FLOAT10_ENTRY
+#undef FLOAT10REL_ENTRY
+#undef NORMAL_ENTRY
+
 CACHE_ALIGN u8 gfx3d_convertedScreen[GFX3D_FRAMEBUFFER_WIDTH*GFX3D_FRAMEBUFFER_HEIGHT*4];
 
 // Matrix stack handling
@@ -324,6 +372,30 @@ static CACHE_ALIGN s32		mtxCurrent [4][16];
 static CACHE_ALIGN s32		mtxTemporal[16];
 static u32 mode = 0;
 
+//the clip matrix, projection times position, which the vertices and the tests go through as on the hardware. games
+//run a lot of matrix commands in a row between vertices, so the commands only mark it stale and it is multiplied
+//out again when something uses it. the hardware's recalculation is in each command's cycles, which stay as they are
+static CACHE_ALIGN s32		mtxClip[16];
+static bool mtxClipDirty = true;
+
+//for the matrix commands: the texture matrix (mode 3) is the only one the clip matrix doesnt depend on
+static FORCEINLINE void gfx3d_matrixChanged()
+{
+	if(mode != 3)
+		mtxClipDirty = true;
+}
+
+static FORCEINLINE const s32* gfx3d_clipMatrix()
+{
+	if(mtxClipDirty)
+	{
+		MatrixCopy(mtxClip, mtxCurrent[0]);
+		MatrixMultiply(mtxClip, mtxCurrent[1]);
+		mtxClipDirty = false;
+	}
+	return mtxClip;
+}
+
 // Indexes for matrix loading/multiplication
 static u8 ML4x4ind = 0;
 static u8 ML4x3ind = 0;
@@ -387,6 +459,36 @@ static CACHE_ALIGN s32 cacheLightDirection[4][4];
 static CACHE_ALIGN s32 cacheHalfVector[4][4];
 //------------------
 
+//what the lighting made of a normal depends on the normal, the material, the lights and the vector matrix, and
+//models tend to send the same few normals over and over. the colors are kept by the normal, the material and the
+//light mask, and by lightGeneration for the rest, which moves on whenever a light or the shininess table changes
+//(and every frame). the vector matrix is compared as it is, since too many commands change it to track them
+#define LIGHT_CACHE_SIZE 256
+
+struct LightCacheEntry
+{
+	u32 normal;
+	u32 diffuseAmbient;
+	u32 specularEmission;
+	u32 generation; //0 for an entry that holds nothing
+	u8 lights;
+	u8 color[3];
+};
+
+static LightCacheEntry lightCache[LIGHT_CACHE_SIZE];
+static u32 lightGeneration = 1;
+static s32 lightCacheMatrix[12];
+static u32 lightCacheLookups = 0, lightCacheHits = 0;
+
+static void gfx3d_lightCacheInvalidate()
+{
+	if(++lightGeneration == 0)
+	{
+		memset(lightCache, 0, sizeof(lightCache));
+		lightGeneration = 1;
+	}
+}
+
 #define RENDER_FRONT_SURFACE 0x80
 #define RENDER_BACK_SURFACE 0X40
 
@@ -423,46 +525,20 @@ static void twiddleLists() {
 
 static BOOL flushPending = FALSE;
 static BOOL drawPending = FALSE;
+//the frame handed to the renderer is allowed to keep rendering until the next flush.
+//until then the GPU composites the last finished 3D frame instead of waiting on this one.
+static bool renderPipelined = false;
+
+//a frame that gives the renderer what the one before gave it comes out the same, so it isn't rendered again: the
+//converted screen keeps the last render. the hash covers the lists and the render state, and besides them what the
+//renderers read: the 3d registers, the vram the texture slots map (by its write generations), and their settings
+static u32 lastRenderHash = 0;
+static bool lastRenderValid = false;
+//whether gfx3d.renderState and the lists still hold a frame that was handed to the renderer
+static bool lastRenderStateKept = false;
+u32 gfx3d_unchangedFrames = 0;
 //------------------------------------------------------------
 
-static void makeTables() {
-
-	//produce the color bits of a 24bpp color from a DS RGB15 using bit logic (internal use only)
-	#define RGB15TO24_BITLOGIC(col) ( (material_5bit_to_8bit[((col)>>10)&0x1F]<<16) | (material_5bit_to_8bit[((col)>>5)&0x1F]<<8) | material_5bit_to_8bit[(col)&0x1F] )
-	
-	//produce the color bits of a 24bpp color from a DS RGB15 using bit logic (internal use only). RGB are reverse of usual
-	#define RGB15TO24_BITLOGIC_REVERSE(col) ( (material_5bit_to_8bit[(col)&0x1F]<<16) | (material_5bit_to_8bit[((col)>>5)&0x1F]<<8) | material_5bit_to_8bit[((col)>>10)&0x1F] )
-
-	for(u16 i=0;i<32768;i++)
-	{
-		color_15bit_to_24bit[i] = LE_TO_LOCAL_32( RGB15TO24_BITLOGIC(i) );
-		color_15bit_to_24bit_reverse[i] = LE_TO_LOCAL_32( RGB15TO24_BITLOGIC_REVERSE(i) );
-		color_15bit_to_16bit_reverse[i] = (((i & 0x001F) << 11) | (material_5bit_to_6bit[(i & 0x03E0) >> 5] << 5) | ((i & 0x7C00) >> 10));
-		
-		// 15-bit to 24-bit depth formula from http://nocash.emubase.de/gbatek.htm#ds3drearplane
-		dsDepthExtend_15bit_to_24bit[i] = LE_TO_LOCAL_32( (i*0x200)+((i+1)>>15)*0x01FF );
-	}
-
-	for (int i = 0; i < 65536; i++)
-		float16table[i] = fix2float((signed short)i);
-
-	for (int i = 0; i < 1024; i++)
-		float10Table[i] = ((signed short)(i<<6)) / (float)(1<<12);
-
-	for (int i = 0; i < 1024; i++)
-		float10RelTable[i] = ((signed short)(i<<6)) / (float)(1<<18);
-
-	for (int i = 0; i < 1024; i++)
-		normalTable[i] = ((signed short)(i<<6)) / (float)(1<<15);
-
-	for(int r=0;r<=31;r++) 
-		for(int oldr=0;oldr<=31;oldr++) 
-			for(int a=0;a<=31;a++)  {
-				int temp = (r*a + oldr*(31-a)) / 31;
-				mixTable555[a][r][oldr] = temp;
-			}
-}
-
 #define OSWRITE(x) os->fwrite((char*)&(x),sizeof((x)));
 #define OSREAD(x) is->fread((char*)&(x),sizeof((x)));
 
@@ -537,13 +613,21 @@ void gfx3d_init()
 		vertlist = &vertlists[0];
 	}
 	
-	makeTables();
 	gfx3d_reset();
 }
 
+void gfx3d_forgetRender()
+{
+	lastRenderValid = false;
+}
+
 void gfx3d_reset()
 {
+	gfx3d_syncGeometry(false);
+	gfx3d_lightCacheInvalidate();
 	gpu3D->NDS_3D_RenderFinish();
+	lastRenderValid = false;
+	lastRenderStateKept = false;
 	
 #ifdef _SHOW_VTX_COUNTERS
 	max_polys = max_verts = 0;
@@ -558,6 +642,7 @@ void gfx3d_reset()
 	control = 0;
 	drawPending = FALSE;
 	flushPending = FALSE;
+	renderPipelined = false;
 	memset(polylists, 0, sizeof(POLYLIST)*2);
 	memset(vertlists, 0, sizeof(VERTLIST)*2);
 	gfx3d.state.invalidateToon = true;
@@ -589,6 +674,7 @@ void gfx3d_reset()
 	MatrixInit (mtxCurrent[2]);
 	MatrixInit (mtxCurrent[3]);
 	MatrixInit (mtxTemporal);
+	mtxClipDirty = true;
 
 	MatrixStackInit(&mtxStack[0]);
 	MatrixStackInit(&mtxStack[1]);
@@ -642,6 +728,19 @@ FORCEINLINE s32 vec3dot_fixed32(const s32* a, const s32* b) {
 	return fx32_shiftdown(fx32_mul(a[0],b[0]) + fx32_mul(a[1],b[1]) + fx32_mul(a[2],b[2]));
 }
 
+#ifdef ENABLE_NEON
+//vec3dot_fixed32 of b with four vectors at once, given as their x, y and z lanes
+FORCEINLINE int32x4_t vec3dot_fixed32_x4(const int32x4x4_t &a, const s32* b) {
+	int64x2_t lo = vmull_n_s32(vget_low_s32(a.val[0]),b[0]);
+	int64x2_t hi = vmull_n_s32(vget_high_s32(a.val[0]),b[0]);
+	lo = vmlal_n_s32(lo,vget_low_s32(a.val[1]),b[1]);
+	hi = vmlal_n_s32(hi,vget_high_s32(a.val[1]),b[1]);
+	lo = vmlal_n_s32(lo,vget_low_s32(a.val[2]),b[2]);
+	hi = vmlal_n_s32(hi,vget_high_s32(a.val[2]),b[2]);
+	return vcombine_s32(vshrn_n_s64(lo,12),vshrn_n_s64(hi,12));
+}
+#endif
+
 #define SUBMITVERTEX(ii, nn) polylist->list[polylist->count].vertIndexes[ii] = tempVertInfo.map[nn];
 //Submit a vertex to the GE
 static void SetVertex()
@@ -674,11 +773,7 @@ static void SetVertex()
 	if(polylist->count >= POLYLIST_SIZE) 
 			return;
 	
-	//TODO - think about keeping the clip matrix concatenated,
-	//so that we only have to multiply one matrix here
-	//(we could lazy cache the concatenated clip matrix and only generate it
-	//when we need to)
-	MatrixMultVec4x4_M2(mtxCurrent[0], coordTransformed);
+	MatrixMultVec4x4(gfx3d_clipMatrix(), coordTransformed);
 
 	//printf("%f %f %f\n",s16coord[0]/4096.0f,s16coord[1]/4096.0f,s16coord[2]/4096.0f);
 	//printf("x %f %f %f %f\n",mtxCurrent[0][0]/4096.0f,mtxCurrent[0][1]/4096.0f,mtxCurrent[0][2]/4096.0f,mtxCurrent[0][3]/4096.0f);
@@ -697,7 +792,7 @@ static void SetVertex()
 	//VERT &vert = tempVertList.list[tempVertList.count];
 	int vertIndex = vertlist->count + tempVertInfo.count - continuation;
 	if(vertIndex<0) {
-		printf("wtf\n");
+		CORELOG_INFO("wtf\n");
 	}
 	VERT &vert = vertlist->list[vertIndex];
 
@@ -937,6 +1032,7 @@ static void gfx3d_glPopMatrix(s32 i)
 
 	if (mymode == 2)
 		MatrixStackPopMatrix(mtxCurrent[1], &mtxStack[1], i);
+	gfx3d_matrixChanged();
 }
 
 static void gfx3d_glStoreMatrix(u32 v)
@@ -992,6 +1088,7 @@ static void gfx3d_glRestoreMatrix(u32 v)
 
 	if (mymode == 2)
 		MatrixCopy (mtxCurrent[1], MatrixStackGetPos(&mtxStack[1], v));
+	gfx3d_matrixChanged();
 }
 
 static void gfx3d_glLoadIdentity()
@@ -1002,6 +1099,7 @@ static void gfx3d_glLoadIdentity()
 
 	if (mode == 2)
 		MatrixIdentity (mtxCurrent[1]);
+	gfx3d_matrixChanged();
 
 	//printf("identity: %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 }
@@ -1020,6 +1118,7 @@ static BOOL gfx3d_glLoadMatrix4x4(s32 v)
 
 	if (mode == 2)
 		MatrixCopy (mtxCurrent[1], mtxCurrent[2]);
+	gfx3d_matrixChanged();
 
 	//printf("load4x4: matrix %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 	return TRUE;
@@ -1044,6 +1143,7 @@ static BOOL gfx3d_glLoadMatrix4x3(s32 v)
 
 	if (mode == 2)
 		MatrixCopy (mtxCurrent[1], mtxCurrent[2]);
+	gfx3d_matrixChanged();
 	//printf("load4x3: matrix %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 	return TRUE;
 }
@@ -1067,6 +1167,7 @@ static BOOL gfx3d_glMultMatrix4x4(s32 v)
 		MatrixMultiply (mtxCurrent[1], mtxTemporal);
 		GFX_DELAY_M2(30);
 	}
+	gfx3d_matrixChanged();
 
 	//printf("mult4x4: matrix %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 
@@ -1098,6 +1199,7 @@ static BOOL gfx3d_glMultMatrix4x3(s32 v)
 		MatrixMultiply (mtxCurrent[1], mtxTemporal);
 		GFX_DELAY_M2(30);
 	}
+	gfx3d_matrixChanged();
 
 	//printf("mult4x3: matrix %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 
@@ -1132,6 +1234,7 @@ static BOOL gfx3d_glMultMatrix3x3(s32 v)
 		MatrixMultiply (mtxCurrent[1], mtxTemporal);
 		GFX_DELAY_M2(30);
 	}
+	gfx3d_matrixChanged();
 
 	//printf("mult3x3: matrix %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 
@@ -1151,6 +1254,7 @@ static BOOL gfx3d_glScale(s32 v)
 	scaleind = 0;
 
 	MatrixScale (mtxCurrent[(mode==2?1:mode)], scale);
+	gfx3d_matrixChanged();
 	//printf("scale: matrix %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 
 	GFX_DELAY(22);
@@ -1181,6 +1285,7 @@ static BOOL gfx3d_glTranslate(s32 v)
 		MatrixTranslate (mtxCurrent[1], trans);
 		GFX_DELAY_M2(30);
 	}
+	gfx3d_matrixChanged();
 
 	//printf("translate: matrix %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 
@@ -1195,6 +1300,34 @@ static void gfx3d_glColor3b(u32 v)
 	GFX_DELAY(1);
 }
 
+//the specular factor of a light, from the dot product of the normal with its negated half vector
+static FORCEINLINE s32 lightShininess(s32 dot)
+{
+	s32 fixedshininess = 0;
+	if(dot>0) //prevent shininess on opposite side
+	{
+		//we have cos(a). it seems that we need cos(2a). trig identity is a fast way to get it.
+		//cos^2(a)=(1/2)(1+cos(2a))
+		//2*cos^2(a)-1=cos(2a)
+		fixedshininess = 2*mul_fixed32(dot,dot)-4096;
+		//gbatek is almost right but not quite!
+	}
+
+	//this seems to need to be saturated, or else the table will overflow.
+	//even without a table, failure to saturate is bad news
+	fixedshininess = std::min(fixedshininess,4095);
+	fixedshininess = std::max(fixedshininess,0);
+	
+	if(dsSpecular & 0x8000)
+	{
+		//shininess is 20.12 fixed point, so >>5 gives us .7 which is 128 entries
+		//the entries are 8bits each so <<4 gives us .12 again, compatible with the lighting formulas below
+		//(according to other normal nds procedures, we might should fill the bottom bits with 1 or 0 according to rules...)
+		fixedshininess = gfx3d.state.shininessTable[fixedshininess>>5]<<4;
+	}
+	return fixedshininess;
+}
+
 static void gfx3d_glNormal(s32 v)
 {
 	s16 nx = ((v<<22)>>22)<<3;
@@ -1211,6 +1344,32 @@ static void gfx3d_glNormal(s32 v)
 		last_t = (s32)(((s64)normal[0] * mtxCurrent[3][1] + (s64)normal[1] * mtxCurrent[3][5] + (s64)normal[2] * mtxCurrent[3][9] + (((s64)_t)<<24))>>24);
 	}
 
+	GFX_DELAY(9);
+	GFX_DELAY_M2((lightMask) & 0x01);
+	GFX_DELAY_M2((lightMask>>1) & 0x01);
+	GFX_DELAY_M2((lightMask>>2) & 0x01);
+	GFX_DELAY_M2((lightMask>>3) & 0x01);
+
+	if(memcmp(lightCacheMatrix, mtxCurrent[2], sizeof(lightCacheMatrix)))
+	{
+		memcpy(lightCacheMatrix, mtxCurrent[2], sizeof(lightCacheMatrix));
+		gfx3d_lightCacheInvalidate();
+	}
+	const u32 normalBits = (u32)v & 0x3FFFFFFF;
+	LightCacheEntry &cached = lightCache[(normalBits ^ (normalBits >> 10) ^ (normalBits >> 20)) & (LIGHT_CACHE_SIZE-1)];
+	const u32 diffuseAmbient = dsDiffuse | ((u32)dsAmbient << 16);
+	const u32 specularEmission = dsSpecular | ((u32)dsEmission << 16);
+	lightCacheLookups++;
+	if(cached.generation == lightGeneration && cached.normal == normalBits && cached.lights == lightMask
+		&& cached.diffuseAmbient == diffuseAmbient && cached.specularEmission == specularEmission)
+	{
+		lightCacheHits++;
+		colorRGB[0] = cached.color[0];
+		colorRGB[1] = cached.color[1];
+		colorRGB[2] = cached.color[2];
+		return;
+	}
+
 	MatrixMultVec3x3_fixed(mtxCurrent[2],normal);
 
 	//apply lighting model
@@ -1236,6 +1395,46 @@ static void gfx3d_glNormal(s32 v)
 
 	int vertexColor[3] = { emission[0], emission[1], emission[2] };
 
+#ifdef ENABLE_NEON
+	//the four lights side by side, one per lane, with the same fixed point math as below.
+	//lights which are off get a zero color, so they add nothing
+	const int32x4x4_t lightDirs = vld4q_s32(&cacheLightDirection[0][0]);
+	const int32x4x4_t halfVectors = vld4q_s32(&cacheHalfVector[0][0]);
+
+	const int32x4_t fixed_diffuse = vmaxq_s32(vdupq_n_s32(0),vnegq_s32(vec3dot_fixed32_x4(lightDirs,normal)));
+	
+	//the half vectors are negated before the dot product, to round the same way
+	int32x4x4_t negativeHalves;
+	negativeHalves.val[0] = vnegq_s32(halfVectors.val[0]);
+	negativeHalves.val[1] = vnegq_s32(halfVectors.val[1]);
+	negativeHalves.val[2] = vnegq_s32(halfVectors.val[2]);
+	DS_ALIGN(16) s32 dots[4];
+	vst1q_s32(dots,vec3dot_fixed32_x4(negativeHalves,normal));
+
+	DS_ALIGN(16) s32 shininess[4];
+	for(int i=0; i<4; i++)
+		shininess[i] = lightShininess(dots[i]);
+	const int32x4_t fixedshininess = vld1q_s32(shininess);
+
+	static const DS_ALIGN(16) u32 lightBits[4] = {1,2,4,8};
+	const uint32x4_t lightsOn = vtstq_u32(vdupq_n_u32(lightMask),vld1q_u32(lightBits));
+	const uint32x4_t lightColors = vandq_u32(vld1q_u32(lightColor),lightsOn);
+	const int32x4_t lightComponents[3] = {
+		vreinterpretq_s32_u32(vandq_u32(lightColors,vdupq_n_u32(0x1F))),
+		vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(lightColors,5),vdupq_n_u32(0x1F))),
+		vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(lightColors,10),vdupq_n_u32(0x1F))) };
+
+	for(int c = 0; c < 3; c++)
+	{
+		const int32x4_t &_lightColor = lightComponents[c];
+		const int32x4_t specComp = vshrq_n_s32(vmulq_s32(vmulq_n_s32(_lightColor,specular[c]),fixedshininess),17);
+		const int32x4_t diffComp = vshrq_n_s32(vmulq_s32(vmulq_n_s32(_lightColor,diffuse[c]),fixed_diffuse),17);
+		const int32x4_t ambComp = vshrq_n_s32(vmulq_n_s32(_lightColor,ambient[c]),5);
+		const int32x4_t sum = vaddq_s32(vaddq_s32(specComp,diffComp),ambComp);
+		const int32x2_t pairs = vpadd_s32(vget_low_s32(sum),vget_high_s32(sum));
+		vertexColor[c] += vget_lane_s32(pairs,0) + vget_lane_s32(pairs,1);
+	}
+#else
 	for(int i=0; i<4; i++)
 	{
 		if(!((lightMask>>i)&1)) continue;
@@ -1253,28 +1452,7 @@ static void gfx3d_glNormal(s32 v)
 		s32 fixedTempNegativeHalf[] = {-cacheHalfVector[i][0],-cacheHalfVector[i][1],-cacheHalfVector[i][2],-cacheHalfVector[i][3]};
 		s32 dot = vec3dot_fixed32(fixedTempNegativeHalf, normal);
 
-		s32 fixedshininess = 0;
-		if(dot>0) //prevent shininess on opposite side
-		{
-			//we have cos(a). it seems that we need cos(2a). trig identity is a fast way to get it.
-			//cos^2(a)=(1/2)(1+cos(2a))
-			//2*cos^2(a)-1=cos(2a)
-			fixedshininess = 2*mul_fixed32(dot,dot)-4096;
-			//gbatek is almost right but not quite!
-		}
-
-		//this seems to need to be saturated, or else the table will overflow.
-		//even without a table, failure to saturate is bad news
-		fixedshininess = std::min(fixedshininess,4095);
-		fixedshininess = std::max(fixedshininess,0);
-		
-		if(dsSpecular & 0x8000)
-		{
-			//shininess is 20.12 fixed point, so >>5 gives us .7 which is 128 entries
-			//the entries are 8bits each so <<4 gives us .12 again, compatible with the lighting formulas below
-			//(according to other normal nds procedures, we might should fill the bottom bits with 1 or 0 according to rules...)
-			fixedshininess = gfx3d.state.shininessTable[fixedshininess>>5]<<4;
-		}
+		s32 fixedshininess = lightShininess(dot);
 
 		for(int c = 0; c < 3; c++)
 		{
@@ -1285,16 +1463,18 @@ static void gfx3d_glNormal(s32 v)
 		}
 	}
 
+#endif
+
 	for(int c=0;c<3;c++)
 	{
 		colorRGB[c] = std::min(31,vertexColor[c]);
+		cached.color[c] = colorRGB[c];
 	}
-
-	GFX_DELAY(9);
-	GFX_DELAY_M2((lightMask) & 0x01);
-	GFX_DELAY_M2((lightMask>>1) & 0x01);
-	GFX_DELAY_M2((lightMask>>2) & 0x01);
-	GFX_DELAY_M2((lightMask>>3) & 0x01);
+	cached.normal = normalBits;
+	cached.diffuseAmbient = diffuseAmbient;
+	cached.specularEmission = specularEmission;
+	cached.lights = lightMask;
+	cached.generation = lightGeneration;
 }
 
 static void gfx3d_glTexCoord(s32 val)
@@ -1439,6 +1619,7 @@ static void gfx3d_glLightDirection (u32 v)
 
 	lightDirection[index] = (s32)(v&0x3FFFFFFF);
 	gfx3d_glLightDirection_cache(index);
+	gfx3d_lightCacheInvalidate();
 	GFX_DELAY(6);
 }
 
@@ -1446,6 +1627,7 @@ static void gfx3d_glLightColor (u32 v)
 {
 	int index = v>>30;
 	lightColor[index] = v;
+	gfx3d_lightCacheInvalidate();
 	GFX_DELAY(1);
 }
 
@@ -1456,6 +1638,7 @@ static BOOL gfx3d_glShininess (u32 val)
 	gfx3d.state.shininessTable[shininessInd++] = (((val >> 16) & 0xFF));
 	gfx3d.state.shininessTable[shininessInd++] = (((val >> 24) & 0xFF));
 
+	gfx3d_lightCacheInvalidate();
 	if (shininessInd < 128) return FALSE;
 	shininessInd = 0;
 	GFX_DELAY(32);
@@ -1489,6 +1672,54 @@ static void gfx3d_glViewPort(u32 v)
 	GFX_DELAY(1);
 }
 
+//the tests work in floats, with the matrix they go through copied over once per test
+static FORCEINLINE void gfx3d_testMatrix(const s32* mtx, float* out)
+{
+	for(int i=0;i<16;i++)
+		out[i] = mtx[i]/4096.0f;
+}
+
+//transforms the 4 points in the lanes of x, y, z and w by a (column major) matrix, in place. the sums go as in
+//_NOSSE_MatrixMultVec4x4, so each lane comes out as that would have it. the box test's 8 corners are two
+//calls of it; the position and vector tests have their one point in lane 0
+static void gfx3d_testTransform4(const float* m, float* x, float* y, float* z, float* w)
+{
+#if defined(ENABLE_SSE)
+	const __m128 vx = _mm_load_ps(x), vy = _mm_load_ps(y), vz = _mm_load_ps(z), vw = _mm_load_ps(w);
+	float* const out[4] = { x, y, z, w };
+	for(int r=0;r<4;r++)
+	{
+		__m128 sum = _mm_mul_ps(vx, _mm_set1_ps(m[r]));
+		sum = _mm_add_ps(sum, _mm_mul_ps(vy, _mm_set1_ps(m[4+r])));
+		sum = _mm_add_ps(sum, _mm_mul_ps(vz, _mm_set1_ps(m[8+r])));
+		sum = _mm_add_ps(sum, _mm_mul_ps(vw, _mm_set1_ps(m[12+r])));
+		_mm_store_ps(out[r], sum);
+	}
+#elif defined(ENABLE_NEON)
+	//vmul and vadd rather than vmla, which on arm64 would fuse and round differently
+	const float32x4_t vx = vld1q_f32(x), vy = vld1q_f32(y), vz = vld1q_f32(z), vw = vld1q_f32(w);
+	float* const out[4] = { x, y, z, w };
+	for(int r=0;r<4;r++)
+	{
+		float32x4_t sum = vmulq_n_f32(vx, m[r]);
+		sum = vaddq_f32(sum, vmulq_n_f32(vy, m[4+r]));
+		sum = vaddq_f32(sum, vmulq_n_f32(vz, m[8+r]));
+		sum = vaddq_f32(sum, vmulq_n_f32(vw, m[12+r]));
+		vst1q_f32(out[r], sum);
+	}
+#else
+	for(int i=0;i<4;i++)
+	{
+		CACHE_ALIGN float vec[4] = { x[i], y[i], z[i], w[i] };
+		_NOSSE_MatrixMultVec4x4(m, vec);
+		x[i] = vec[0];
+		y[i] = vec[1];
+		z[i] = vec[2];
+		w[i] = vec[3];
+	}
+#endif
+}
+
 static BOOL gfx3d_glBoxTest(u32 v)
 {
 	//printf("boxtest\n");
@@ -1504,19 +1735,6 @@ static BOOL gfx3d_glBoxTest(u32 v)
 	MMU_new.gxstat.tb = 0;		// clear busy
 	GFX_DELAY(103);
 
-#if 0
-	INFO("BoxTEST: x %f y %f width %f height %f depth %f\n", 
-				BTcoords[0], BTcoords[1], BTcoords[2], BTcoords[3], BTcoords[4], BTcoords[5]);
-	/*for (int i = 0; i < 16; i++)
-	{
-		INFO("mtx1[%i] = %f ", i, mtxCurrent[1][i]);
-		if ((i+1) % 4 == 0) INFO("\n");
-	}
-	INFO("\n");*/
-#endif
-
-	//(crafted to be clear, not fast.)
-
 	//nanostray title, ff4, ice age 3 depend on this and work
 	//garfields nightmare and strawberry shortcake DO DEPEND on the overflow behavior.
 
@@ -1535,97 +1753,86 @@ static BOOL gfx3d_glBoxTest(u32 v)
 	float yh = float16table[(uy+uh)&0xFFFF];
 	float zd = float16table[(uz+ud)&0xFFFF];
 
-	//eight corners of cube
+	//eight corners of cube, a coordinate to an array so that they go through the matrices 4 at a time
+	CACHE_ALIGN float cx[8] = { x, xw, xw, x, x, xw, xw, x };
+	CACHE_ALIGN float cy[8] = { y, y, yh, yh, y, y, yh, yh };
+	CACHE_ALIGN float cz[8] = { z, z, z, z, zd, zd, zd, zd };
+	CACHE_ALIGN float cw[8] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+
+	//this cant work. its left as a reminder that we could (and probably should) do the boxtest in all fixed point values
+	//MatrixMultVec4x4(gfx3d_clipMatrix(), verts[i].coord);
+	//but change it all to floating point and do it that way instead
+	CACHE_ALIGN float clip[16];
+	gfx3d_testMatrix(gfx3d_clipMatrix(), clip);
+	for(int i=0;i<8;i+=4)
+		gfx3d_testTransform4(clip, cx+i, cy+i, cz+i, cw+i);
+
+	//the same outcodes the clipper would find. the box is gone if all its corners are outside one plane, and it is
+	//visible if any of them is inside all of them: the faces around such a corner keep it through every plane
+	u8 outcodes[8];
+	u8 andCode = 0x3F;
+	for(int i=0;i<8;i++)
+	{
+		u8 outcode = 0;
+		if(cx[i] < -cw[i]) outcode |= 1;
+		if(cy[i] < -cw[i]) outcode |= 2;
+		if(cz[i] < -cw[i]) outcode |= 4;
+		if(cx[i] > cw[i]) outcode |= 8;
+		if(cy[i] > cw[i]) outcode |= 16;
+		if(cz[i] > cw[i]) outcode |= 32;
+		if(outcode == 0)
+		{
+			MMU_new.gxstat.tr = 1;
+			return TRUE;
+		}
+		outcodes[i] = outcode;
+		andCode &= outcode;
+	}
+	if(andCode)
+		return TRUE;
+
+	//otherwise only clipping the faces says whether any of the box is left
 	CACHE_ALIGN VERT verts[8];
-	verts[0].set_coord(x,y,z,1);
-	verts[1].set_coord(xw,y,z,1);
-	verts[2].set_coord(xw,yh,z,1);
-	verts[3].set_coord(x,yh,z,1);
-	verts[4].set_coord(x,y,zd,1);
-	verts[5].set_coord(xw,y,zd,1);
-	verts[6].set_coord(xw,yh,zd,1);
-	verts[7].set_coord(x,yh,zd,1);
+	for(int i=0;i<8;i++)
+		verts[i].set_coord(cx[i],cy[i],cz[i],cw[i]);
 
 	//craft the faces of the box (clockwise)
-	POLY polys[6];
-	polys[0].setVertIndexes(7,6,5,4); //near 
-	polys[1].setVertIndexes(0,1,2,3); //far
-	polys[2].setVertIndexes(0,3,7,4); //left
-	polys[3].setVertIndexes(6,2,1,5); //right
-	polys[4].setVertIndexes(3,2,6,7); //top
-	polys[5].setVertIndexes(0,4,5,1); //bottom
+	static const u8 faces[6][4] = {
+		{7,6,5,4}, //near
+		{0,1,2,3}, //far
+		{0,3,7,4}, //left
+		{6,2,1,5}, //right
+		{3,2,6,7}, //top
+		{0,4,5,1}, //bottom
+	};
 
 	//setup the clipper
 	GFX3D_Clipper::TClippedPoly tempClippedPoly;
 	boxtestClipper.clippedPolys = &tempClippedPoly;
 	boxtestClipper.reset();
 
-	////-----------------------------
-	////awesome hack:
-	////emit the box as geometry for testing
-	//for(int i=0;i<6;i++) 
-	//{
-	//	POLY* poly = &polys[i];
-	//	VERT* vertTable[4] = {
-	//		&verts[poly->vertIndexes[0]],
-	//		&verts[poly->vertIndexes[1]],
-	//		&verts[poly->vertIndexes[2]],
-	//		&verts[poly->vertIndexes[3]]
-	//	};
-
-	//	gfx3d_glBegin(1);
-	//	for(int i=0;i<4;i++) {
-	//		coord[0] = vertTable[i]->x;
-	//		coord[1] = vertTable[i]->y;
-	//		coord[2] = vertTable[i]->z;
-	//		SetVertex();
-	//	}
-	//	gfx3d_glEnd();
-	//}
-	////---------------------
-
-	//transform all coords
-	for(int i=0;i<8;i++)
-	{
-		//this cant work. its left as a reminder that we could (and probably should) do the boxtest in all fixed point values
-		//MatrixMultVec4x4_M2(mtxCurrent[0], verts[i].coord);
-
-		//but change it all to floating point and do it that way instead
-		CACHE_ALIGN float temp1[16] = {mtxCurrent[1][0]/4096.0f,mtxCurrent[1][1]/4096.0f,mtxCurrent[1][2]/4096.0f,mtxCurrent[1][3]/4096.0f,mtxCurrent[1][4]/4096.0f,mtxCurrent[1][5]/4096.0f,mtxCurrent[1][6]/4096.0f,mtxCurrent[1][7]/4096.0f,mtxCurrent[1][8]/4096.0f,mtxCurrent[1][9]/4096.0f,mtxCurrent[1][10]/4096.0f,mtxCurrent[1][11]/4096.0f,mtxCurrent[1][12]/4096.0f,mtxCurrent[1][13]/4096.0f,mtxCurrent[1][14]/4096.0f,mtxCurrent[1][15]/4096.0f};
-		CACHE_ALIGN float temp0[16] = {mtxCurrent[0][0]/4096.0f,mtxCurrent[0][1]/4096.0f,mtxCurrent[0][2]/4096.0f,mtxCurrent[0][3]/4096.0f,mtxCurrent[0][4]/4096.0f,mtxCurrent[0][5]/4096.0f,mtxCurrent[0][6]/4096.0f,mtxCurrent[0][7]/4096.0f,mtxCurrent[0][8]/4096.0f,mtxCurrent[0][9]/4096.0f,mtxCurrent[0][10]/4096.0f,mtxCurrent[0][11]/4096.0f,mtxCurrent[0][12]/4096.0f,mtxCurrent[0][13]/4096.0f,mtxCurrent[0][14]/4096.0f,mtxCurrent[0][15]/4096.0f};
-
-		DS_ALIGN(16) VERT_POS4f vert = { verts[i].x, verts[i].y, verts[i].z, verts[i].w };
-
-		_NOSSE_MatrixMultVec4x4(temp1,verts[i].coord);
-		_NOSSE_MatrixMultVec4x4(temp0,verts[i].coord);
-	}
-
 	//clip each poly
-	for(int i=0;i<6;i++) 
+	for(int i=0;i<6;i++)
 	{
-		POLY* poly = &polys[i];
-		VERT* vertTable[4] = {
-			&verts[poly->vertIndexes[0]],
-			&verts[poly->vertIndexes[1]],
-			&verts[poly->vertIndexes[2]],
-			&verts[poly->vertIndexes[3]]
-		};
+		POLY poly;
+		poly.setVertIndexes(faces[i][0],faces[i][1],faces[i][2],faces[i][3]);
+		VERT* vertTable[4];
+		u8 faceOutcodes[4];
+		for(int j=0;j<4;j++)
+		{
+			vertTable[j] = &verts[faces[i][j]];
+			faceOutcodes[j] = outcodes[faces[i][j]];
+		}
+
+		boxtestClipper.clipPoly<false>(&poly,vertTable,faceOutcodes);
 
-		boxtestClipper.clipPoly<false>(poly,vertTable);
-		
 		//if any portion of this poly was retained, then the test passes.
 		if(boxtestClipper.clippedPolyCounter>0) {
-			//printf("%06d PASS %d\n",boxcounter,gxFIFO.size);
 			MMU_new.gxstat.tr = 1;
 			break;
 		}
 	}
 
-	if(MMU_new.gxstat.tr == 0)
-	{
-		//printf("%06d FAIL %d\n",boxcounter,gxFIFO.size);
-	}
-	
 	return TRUE;
 }
 
@@ -1645,11 +1852,18 @@ static BOOL gfx3d_glPosTest(u32 v)
 	
 	PTcoords[3] = 1.0f;
 
-	CACHE_ALIGN float temp1[16] = {mtxCurrent[1][0]/4096.0f,mtxCurrent[1][1]/4096.0f,mtxCurrent[1][2]/4096.0f,mtxCurrent[1][3]/4096.0f,mtxCurrent[1][4]/4096.0f,mtxCurrent[1][5]/4096.0f,mtxCurrent[1][6]/4096.0f,mtxCurrent[1][7]/4096.0f,mtxCurrent[1][8]/4096.0f,mtxCurrent[1][9]/4096.0f,mtxCurrent[1][10]/4096.0f,mtxCurrent[1][11]/4096.0f,mtxCurrent[1][12]/4096.0f,mtxCurrent[1][13]/4096.0f,mtxCurrent[1][14]/4096.0f,mtxCurrent[1][15]/4096.0f};
-	CACHE_ALIGN float temp0[16] = {mtxCurrent[0][0]/4096.0f,mtxCurrent[0][1]/4096.0f,mtxCurrent[0][2]/4096.0f,mtxCurrent[0][3]/4096.0f,mtxCurrent[0][4]/4096.0f,mtxCurrent[0][5]/4096.0f,mtxCurrent[0][6]/4096.0f,mtxCurrent[0][7]/4096.0f,mtxCurrent[0][8]/4096.0f,mtxCurrent[0][9]/4096.0f,mtxCurrent[0][10]/4096.0f,mtxCurrent[0][11]/4096.0f,mtxCurrent[0][12]/4096.0f,mtxCurrent[0][13]/4096.0f,mtxCurrent[0][14]/4096.0f,mtxCurrent[0][15]/4096.0f};
+	CACHE_ALIGN float clip[16];
+	gfx3d_testMatrix(gfx3d_clipMatrix(), clip);
 
-	MatrixMultVec4x4(temp1, PTcoords);
-	MatrixMultVec4x4(temp0, PTcoords);
+	CACHE_ALIGN float px[4] = { PTcoords[0] };
+	CACHE_ALIGN float py[4] = { PTcoords[1] };
+	CACHE_ALIGN float pz[4] = { PTcoords[2] };
+	CACHE_ALIGN float pw[4] = { PTcoords[3] };
+	gfx3d_testTransform4(clip, px, py, pz, pw);
+	PTcoords[0] = px[0];
+	PTcoords[1] = py[0];
+	PTcoords[2] = pz[0];
+	PTcoords[3] = pw[0];
 
 	MMU_new.gxstat.tb = 0;
 
@@ -1667,17 +1881,18 @@ static void gfx3d_glVecTest(u32 v)
 	//i am not sure exactly what it is doing, maybe it is testing to ensure
 	//that the normal vector for the point of interest is camera-facing.
 
-	CACHE_ALIGN float normal[4] = { normalTable[v&1023],
-						normalTable[(v>>10)&1023],
-						normalTable[(v>>20)&1023],
-						0};
+	CACHE_ALIGN float nx[4] = { normalTable[v&1023] };
+	CACHE_ALIGN float ny[4] = { normalTable[(v>>10)&1023] };
+	CACHE_ALIGN float nz[4] = { normalTable[(v>>20)&1023] };
+	CACHE_ALIGN float nw[4] = { 0 };
 
-	CACHE_ALIGN float temp[16] = {mtxCurrent[2][0]/4096.0f,mtxCurrent[2][1]/4096.0f,mtxCurrent[2][2]/4096.0f,mtxCurrent[2][3]/4096.0f,mtxCurrent[2][4]/4096.0f,mtxCurrent[2][5]/4096.0f,mtxCurrent[2][6]/4096.0f,mtxCurrent[2][7]/4096.0f,mtxCurrent[2][8]/4096.0f,mtxCurrent[2][9]/4096.0f,mtxCurrent[2][10]/4096.0f,mtxCurrent[2][11]/4096.0f,mtxCurrent[2][12]/4096.0f,mtxCurrent[2][13]/4096.0f,mtxCurrent[2][14]/4096.0f,mtxCurrent[2][15]/4096.0f};
-	MatrixMultVec4x4(temp, normal);
+	CACHE_ALIGN float temp[16];
+	gfx3d_testMatrix(mtxCurrent[2], temp);
+	gfx3d_testTransform4(temp, nx, ny, nz, nw);
 
-	s16 x = (s16)(normal[0]*4096);
-	s16 y = (s16)(normal[1]*4096);
-	s16 z = (s16)(normal[2]*4096);
+	s16 x = (s16)(nx[0]*4096);
+	s16 y = (s16)(ny[0]*4096);
+	s16 z = (s16)(nz[0]*4096);
 
 	MMU_new.gxstat.tb = 0;		// clear busy
 	T1WriteWord(MMU.MMU_MEM[0][0x40], 0x630, x);
@@ -1748,7 +1963,8 @@ void gfx3d_UpdateToonTable(u8 offset, u32 val)
 
 s32 gfx3d_GetClipMatrix (unsigned int index)
 {
-	s32 val = MatrixGetMultipliedIndex (index, mtxCurrent[0], mtxCurrent[1]);
+	gfx3d_syncGeometry(false);
+	s32 val = gfx3d_clipMatrix()[index];
 
 	//printf("reading clip matrix: %d\n",index);
 
@@ -1757,6 +1973,7 @@ s32 gfx3d_GetClipMatrix (unsigned int index)
 
 s32 gfx3d_GetDirectionalMatrix (unsigned int index)
 {
+	gfx3d_syncGeometry(false);
 	int _index = (((index / 3) * 4) + (index % 3));
 
 	//return (s32)(mtxCurrent[2][_index]*(1<<12));
@@ -1770,6 +1987,7 @@ void gfx3d_glAlphaFunc(u32 v)
 
 unsigned int gfx3d_glGetPosRes(unsigned int index)
 {
+	gfx3d_syncGeometry(true);
 	return (unsigned int)(int)(PTcoords[index] * 4096.0f);
 }
 
@@ -1895,7 +2113,7 @@ static void log3D(u8 cmd, u32 param)
 				INFO("!!! Unknown(%08X)", param);
 			break;
 		}
-		printf("\t\t(FIFO size %i)\n", gxFIFO.size);
+		CORELOG_INFO("\t\t(FIFO size %i)\n", gxFIFO.size);
 }
 #endif
 
@@ -2024,46 +2242,151 @@ static void gfx3d_execute(u8 cmd, u32 param)
 	}
 }
 
-void gfx3d_execute3D()
+//with CommonSettings.GFX3D_ThreadedGeometry the commands gfx3d_execute3D takes off the pipe are run by a worker:
+//the fifo and its timing (and so its irqs, dmas and gxstat) stay with the emulation, and only the matrix math,
+//lighting and clipping move off it. they go through this ring, which only the emulation writes and only the worker
+//reads. the emulation waits for the worker only when it looks at what the commands did (gfx3d_syncGeometry)
+#define GX_RING_SIZE 4096
+
+static struct
+{
+	u8 cmd[GX_RING_SIZE];
+	u32 param[GX_RING_SIZE];
+	u32 readPos;	//only the worker moves it, after running the commands before it
+	u32 writePos;	//only the emulation moves it
+	u32 resultPos;	//just past the last queued command whose results the cpu can read
+	bool running;	//the worker is draining the ring, or has been handed it to
+} gxRing;
+
+static Task gxTask;
+static bool gxTaskStarted = false;
+
+static void* gxWorker(void*)
+{
+	for(;;)
+	{
+		const u32 end = __atomic_load_n(&gxRing.writePos, __ATOMIC_ACQUIRE);
+		u32 pos = gxRing.readPos;
+		for(; pos != end; pos++)
+			gfx3d_execute(gxRing.cmd[pos % GX_RING_SIZE], gxRing.param[pos % GX_RING_SIZE]);
+		__atomic_store_n(&gxRing.readPos, pos, __ATOMIC_RELEASE);
+
+		//going idle: whatever was queued meanwhile is either seen here, or its gxKick hands the ring over again
+		__atomic_store_n(&gxRing.running, false, __ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&gxRing.writePos, __ATOMIC_SEQ_CST) == pos)
+			return NULL;
+		bool idle = false;
+		if(!__atomic_compare_exchange_n(&gxRing.running, &idle, true, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			return NULL;
+	}
+}
+
+static void gxKick()
+{
+	bool idle = false;
+	if(__atomic_compare_exchange_n(&gxRing.running, &idle, true, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+	{
+		//the last run may not have returned yet, though it has nothing left to do
+		gxTask.finish();
+		gxTask.execute(gxWorker, NULL);
+	}
+}
+
+void gfx3d_syncGeometry(bool results)
+{
+	if(!gxThreaded) return;
+	const u32 readPos = __atomic_load_n(&gxRing.readPos, __ATOMIC_ACQUIRE);
+	if(readPos == gxRing.writePos) return;
+	if(results && (s32)(readPos - gxRing.resultPos) >= 0) return;
+	//every queued command has been handed over, and the run that gets to the end of them is the last to return
+	gxTask.finish();
+}
+
+static void gxQueue(u8 cmd, u32 param)
+{
+	switch(cmd)
+	{
+		case 0x50:
+			//the flush changes what the emulation sees right away, so it happens here, after everything before it
+			gxKick();
+			gfx3d_syncGeometry(false);
+			gfx3d_execute(cmd, param);
+			return;
+	}
+
+	if(gxRing.writePos - __atomic_load_n(&gxRing.readPos, __ATOMIC_ACQUIRE) == GX_RING_SIZE)
+	{
+		gxKick();
+		gfx3d_syncGeometry(false);
+	}
+	const u32 pos = gxRing.writePos;
+	gxRing.cmd[pos % GX_RING_SIZE] = cmd;
+	gxRing.param[pos % GX_RING_SIZE] = param;
+	__atomic_store_n(&gxRing.writePos, pos + 1, __ATOMIC_SEQ_CST);
+
+	switch(cmd)
+	{
+		case 0x11: case 0x12: case 0x13: case 0x14: //the matrix stacks, which gxstat shows
+		case 0x70: case 0x71: case 0x72: //the tests
+			gxRing.resultPos = pos + 1;
+			break;
+	}
+}
+
+static void gxSetThreaded(bool threaded)
 {
-	u8	cmd = 0;
-	u32	param = 0;
+	if(threaded == gxThreaded) return;
+	gfx3d_syncGeometry(false);
+	if(threaded && !gxTaskStarted)
+	{
+		gxTask.start(false, "Geometry");
+		gxTaskStarted = true;
+	}
+	gxThreaded = threaded;
+}
 
+void gfx3d_execute3D()
+{
 #ifndef FLUSHMODE_HACK
 	if (isSwapBuffers) return;
 #endif
 
+	gxSetThreaded(CommonSettings.GFX3D_ThreadedGeometry && CommonSettings.num_cores > 1);
+
 	//this is a SPEED HACK
 	//fifo is currently emulated more accurately than it probably needs to be.
 	//without this batch size the emuloop will escape way too often to run fast.
 	const int HACK_FIFO_BATCH_SIZE = 64;
 
-	for(int i=0;i<HACK_FIFO_BATCH_SIZE;i++) {
-		if(GFX_PIPErecv(&cmd, &param))
-		{
-			//if (isSwapBuffers) printf("Executing while swapbuffers is pending: %d:%08X\n",cmd,param);
-
-			//since we did anything at all, incur a pipeline motion cost.
-			//also, we can't let gxfifo sequencer stall until the fifo is empty.
-			//see...
-			GFX_DELAY(1); 
-
-			//..these guys will ordinarily set a delay, but multi-param operations won't
-			//for the earlier params.
-			//printf("%05d:%03d:%12lld: executed 3d: %02X %08X\n",currFrameCounter, nds.VCount, nds_timer , cmd, param);
-			gfx3d_execute(cmd, param);
-
-			//this is a COMPATIBILITY HACK.
-			//this causes 3d to take virtually no time whatsoever to execute.
-			//this was done for marvel nemesis, but a similar family of 
-			//hacks for ridiculously fast 3d execution has proven necessary for a number of games.
-			//the true answer is probably dma bus blocking.. but lets go ahead and try this and
-			//check the compatibility, at the very least it will be nice to know if any games suffer from
-			//3d running too fast
-			MMU.gfx3dCycles = nds_timer+1;
-		} else break;
+	u8 cmds[HACK_FIFO_BATCH_SIZE];
+	u32 params[HACK_FIFO_BATCH_SIZE];
+	const u32 count = GFX_PIPErecvBatch(cmds, params, HACK_FIFO_BATCH_SIZE);
+	if(count == 0) return;
+
+	//since we did anything at all, incur a pipeline motion cost.
+	//also, we can't let gxfifo sequencer stall until the fifo is empty.
+	//the commands will ordinarily set a delay too, but every one of them is overwritten by the
+	//COMPATIBILITY HACK below, so the whole batch is charged once instead of per command.
+	gxBatch = true;
+	for(u32 i=0;i<count;i++)
+	{
+		//if (isSwapBuffers) printf("Executing while swapbuffers is pending: %d:%08X\n",cmds[i],params[i]);
+		//printf("%05d:%03d:%12lld: executed 3d: %02X %08X\n",currFrameCounter, nds.VCount, nds_timer , cmds[i], params[i]);
+		if(gxThreaded) gxQueue(cmds[i], params[i]);
+		else gfx3d_execute(cmds[i], params[i]);
 	}
+	if(gxThreaded) gxKick();
+	gxBatch = false;
+	NDS_RescheduleGXFIFO(1);
 
+	//this is a COMPATIBILITY HACK.
+	//this causes 3d to take virtually no time whatsoever to execute.
+	//this was done for marvel nemesis, but a similar family of 
+	//hacks for ridiculously fast 3d execution has proven necessary for a number of games.
+	//the true answer is probably dma bus blocking.. but lets go ahead and try this and
+	//check the compatibility, at the very least it will be nice to know if any games suffer from
+	//3d running too fast
+	MMU.gfx3dCycles = nds_timer+1;
 }
 
 void gfx3d_glFlush(u32 v)
@@ -2090,52 +2413,95 @@ void gfx3d_glFlush(u32 v)
 	GFX_DELAY(1);
 }
 
-static inline bool gfx3d_ysort_compare_orig(int num1, int num2)
+//turns a float into a u32 which sorts the same way, with -0 sorting together with +0
+static FORCEINLINE u32 gfx3d_ysort_floatkey(float f)
 {
-	const POLY &poly1 = polylist->list[num1];
-	const POLY &poly2 = polylist->list[num2];
-
-	if(poly1.maxy != poly2.maxy) 
-		return poly1.maxy < poly2.maxy; 
-	if(poly1.miny != poly2.miny) 
-		return poly1.miny < poly2.miny; 
-
-	return num1 < num2;
+	u32 u;
+	memcpy(&u, &f, 4);
+	if((u<<1) == 0) return 0x80000000;
+	return (u & 0x80000000) ? ~u : (u | 0x80000000);
 }
 
-static inline bool gfx3d_ysort_compare_kalven(int num1, int num2)
+static u64 ysortKeys[2][POLYLIST_SIZE];
+static int ysortIndexes[POLYLIST_SIZE];
+
+//sorts a run of the index list by maxy, then miny.
+//this may be verified by checking the game create menus in harvest moon island of happiness
+//also the buttons in the knights in the nightmare frontend depend on this and the perspective division
+//notably, the main shop interface in harvest moon will not have a correct RTN button
+//i think this is due to a math error rounding its position to one pixel too high and it popping behind
+//the bar that it sits on.
+//
+//we must respect the game's ordering in cases of complete ties, or else advance wars DOR will flicker
+//in the main map mode. the keys are built once per poly and LSD radix sorted a byte at a time, which is stable.
+//this is kept out of line so that it shows up on its own in the profiler.
+static NOINLINE void gfx3d_ysort(int *list, int count)
 {
-	const POLY &poly1 = polylist->list[num1];
-	const POLY &poly2 = polylist->list[num2];
+	if(count < 2) return;
 
-	//this may be verified by checking the game create menus in harvest moon island of happiness
-	//also the buttons in the knights in the nightmare frontend depend on this and the perspective division
-	if (poly1.maxy < poly2.maxy) return true;
-	if (poly1.maxy > poly2.maxy) return false;
-	if (poly1.miny < poly2.miny) return true;
-	if (poly1.miny > poly2.miny) return false;
-	//notably, the main shop interface in harvest moon will not have a correct RTN button
-	//i think this is due to a math error rounding its position to one pixel too high and it popping behind
-	//the bar that it sits on.
-	//everything else in all the other menus that I could find looks right..
+	u64 *keys = ysortKeys[0], *keysTmp = ysortKeys[1];
+	int *indexes = list, *indexesTmp = ysortIndexes;
 
-	//make sure we respect the game's ordering in cases of complete ties
-	//this makes it a stable sort.
-	//this must be a stable sort or else advance wars DOR will flicker in the main map mode
-	return (num1 < num2);
-}
+	u32 histogram[8][256];
+	memset(histogram, 0, sizeof(histogram));
+	for(int i=0;i<count;i++)
+	{
+		const POLY &poly = polylist->list[list[i]];
+		const u64 key = ((u64)gfx3d_ysort_floatkey(poly.maxy) << 32) | gfx3d_ysort_floatkey(poly.miny);
+		keys[i] = key;
+		for(int pass=0;pass<8;pass++)
+			histogram[pass][(key >> (pass*8)) & 0xFF]++;
+	}
 
-static bool gfx3d_ysort_compare(int num1, int num2)
-{
-	bool original = gfx3d_ysort_compare_orig(num1,num2);
-	bool kalven = gfx3d_ysort_compare_kalven(num1,num2);
-	assert(original == kalven);
-	return original;
+	for(int pass=0;pass<8;pass++)
+	{
+		const int shift = pass*8;
+		u32 *buckets = histogram[pass];
+
+		//the high bytes of the y keys are mostly the same for every poly
+		if(buckets[(keys[0] >> shift) & 0xFF] == (u32)count) continue;
+
+		u32 offset = 0;
+		for(int b=0;b<256;b++)
+		{
+			const u32 n = buckets[b];
+			buckets[b] = offset;
+			offset += n;
+		}
+
+		for(int i=0;i<count;i++)
+		{
+			const u32 dst = buckets[(keys[i] >> shift) & 0xFF]++;
+			keysTmp[dst] = keys[i];
+			indexesTmp[dst] = indexes[i];
+		}
+
+		std::swap(keys, keysTmp);
+		std::swap(indexes, indexesTmp);
+	}
+
+	if(indexes != list)
+		memcpy(list, indexes, count*sizeof(int));
 }
 
 static void gfx3d_doFlush()
 {
+	PROFILE_ZONE(PROFILE_3D_FLUSH);
+
+	gfx3d_syncGeometry(false);
+
+	frameprofile_count(PROFILE_NORMALS, lightCacheLookups);
+	frameprofile_count(PROFILE_NORMALS_CACHED, lightCacheHits);
+	lightCacheLookups = lightCacheHits = 0;
+	gfx3d_lightCacheInvalidate();
+
+	//the renderer may still be reading the lists and render state we are about to replace.
+	//one that leaves its frames on the gpu is done with them, and reads a frame back only if a line asks for it
+	if(!gpu3DFrame.texture)
+		gpu3D->NDS_3D_RenderFinish();
+
 	gfx3d.frameCtr++;
+	gfx3d.flushGeneration++;
 
 	//the renderer will get the lists we just built
 	gfx3d.polylist = polylist;
@@ -2222,21 +2588,16 @@ static void gfx3d_doFlush()
 			gfx3d.indexlist.list[ctr++] = i;
 	}
 	
-	//NOTE: the use of the stable_sort below must be here as a workaround for some compilers on osx and linux.
-	//we're hazy on the exact behaviour of the resulting bug, all thats known is the list gets mangled somehow.
-	//it should not in principle be relevant since the predicate results in no ties.
-	//perhaps the compiler is buggy. perhaps the predicate is wrong.
-
 	//now we have to sort the opaque polys by y-value.
 	//(test case: harvest moon island of happiness character cretor UI)
 	//should this be done after clipping??
-	std::stable_sort(gfx3d.indexlist.list, gfx3d.indexlist.list + opaqueCount, gfx3d_ysort_compare);
+	gfx3d_ysort(gfx3d.indexlist.list, opaqueCount);
 	
 	if(!gfx3d.state.sortmode)
 	{
 		//if we are autosorting translucent polys, we need to do this also
 		//TODO - this is unverified behavior. need a test case
-		std::stable_sort(gfx3d.indexlist.list + opaqueCount, gfx3d.indexlist.list + polycount, gfx3d_ysort_compare);
+		gfx3d_ysort(gfx3d.indexlist.list + opaqueCount, polycount - opaqueCount);
 	}
 
 	//switch to the new lists
@@ -2267,6 +2628,36 @@ void gfx3d_VBlankSignal()
 	}
 }
 
+static u32 gfx3d_renderHash()
+{
+	const POLYLIST *polys = gfx3d.polylist;
+	const VERTLIST *verts = gfx3d.vertlist;
+	u32 crc = fastcrc32(0, polys->list, polys->count * sizeof(POLY));
+	crc = fastcrc32(crc, verts->list, verts->count * sizeof(VERT));
+	crc = fastcrc32(crc, gfx3d.indexlist.list, polys->count * sizeof(gfx3d.indexlist.list[0]));
+
+	//invalidateToon is the renderer's to clear, and doesn't change what it draws
+	const u8 *state = (const u8*)&gfx3d.renderState;
+	crc = fastcrc32(crc, state, offsetof(GFX3D_State, invalidateToon));
+	crc = fastcrc32(crc, state + offsetof(GFX3D_State, u16ToonTable), sizeof(GFX3D_State) - offsetof(GFX3D_State, u16ToonTable));
+	crc = fastcrc32(crc, MMU.ARM9_REG + 0x320, 0x3C0 - 0x320);
+
+	crc = fastcrc32(crc, MMU.texInfo.texPalSlot, sizeof(MMU.texInfo.texPalSlot));
+	crc = fastcrc32(crc, MMU.texInfo.textureSlotAddr, sizeof(MMU.texInfo.textureSlotAddr));
+	crc = fastcrc32(crc, vram_page_generation, sizeof(vram_page_generation));
+	crc = fastcrc32(crc, vram_palette_generation, sizeof(vram_palette_generation));
+
+	//packed by hand, since a struct's padding would hash as whatever the stack held
+	const u32 extra[] = {
+		(u32)(uintptr_t)gpu3D,
+		(u32)CommonSettings.GFX3D_SoftRastScale,
+		(u32)CommonSettings.GFX3D_HighResolutionInterpolateColor | ((u32)CommonSettings.GFX3D_LineHack << 1) | ((u32)CommonSettings.GFX3D_TXTHack << 2),
+		(u32)CommonSettings.GFX3D_Zelda_Shadow_Depth_Hack,
+		(u32)polys->count, (u32)verts->count,
+	};
+	return fastcrc32(crc, extra, sizeof(extra));
+}
+
 void gfx3d_VBlankEndSignal(bool skipFrame)
 {
 	if (!drawPending) return;
@@ -2277,12 +2668,40 @@ void gfx3d_VBlankEndSignal(bool skipFrame)
 	if(!CommonSettings.showGpu.main)
 	{
 		memset(gfx3d_convertedScreen,0,sizeof(gfx3d_convertedScreen));
+		lastRenderValid = false;
+		lastRenderStateKept = false;
+		gpu3DFrame.texture = 0;
+		gpu3DFrame.fence = NULL;
+		return;
+	}
+
+	const u32 hash = gfx3d_renderHash();
+	if(lastRenderValid && hash == lastRenderHash)
+	{
+		gfx3d_unchangedFrames++;
 		return;
 	}
+	lastRenderHash = hash;
+	lastRenderValid = true;
+	lastRenderStateKept = true;
 	
+	//a display capture has to see this frame's 3D, so those frames are never pipelined
+	renderPipelined = CommonSettings.GFX3D_PipelinedRender && !(MainScreen.gpu->dispCapCnt.val & 0x80000000);
 	gpu3D->NDS_3D_Render();
 }
 
+void gfx3d_renderAgain()
+{
+	if(!lastRenderStateKept || !CommonSettings.showGpu.main)
+		return;
+
+	lastRenderHash = gfx3d_renderHash();
+	lastRenderValid = true;
+	renderPipelined = false;
+	gpu3D->NDS_3D_Render();
+	gpu3D->NDS_3D_RenderFinish();
+}
+
 //#define _3D_LOG
 
 void gfx3d_sendCommandToFIFO(u32 val)
@@ -2364,6 +2783,8 @@ void gfx3d_Control(u32 v)
 //other misc stuff
 void gfx3d_glGetMatrix(unsigned int m_mode, int index, float* dest)
 {
+	gfx3d_syncGeometry(false);
+
 	//if(index == -1)
 	//{
 	//	MatrixCopy(dest, mtxCurrent[m_mode]);
@@ -2381,17 +2802,21 @@ void gfx3d_glGetMatrix(unsigned int m_mode, int index, float* dest)
 
 void gfx3d_glGetLightDirection(unsigned int index, unsigned int* dest)
 {
+	gfx3d_syncGeometry(false);
 	*dest = lightDirection[index];
 }
 
 void gfx3d_glGetLightColor(unsigned int index, unsigned int* dest)
 {
+	gfx3d_syncGeometry(false);
 	*dest = lightColor[index];
 }
 
 void gfx3d_GetLineData(int line, u8** dst)
 {
-	gpu3D->NDS_3D_RenderFinish();
+	//a frame left on the gpu wasn't finished at the flush, pipelined or not
+	if(!renderPipelined || gpu3DFrame.texture)
+		gpu3D->NDS_3D_RenderFinish();
 	*dst = gfx3d_convertedScreen+((line)<<(8+2));
 }
 
@@ -2507,6 +2932,7 @@ SFORMAT SF_GFX3D[]={
 //-------------savestate
 void gfx3d_savestate(EMUFILE* os)
 {
+	gfx3d_syncGeometry(false);
 	gpu3D->NDS_3D_RenderFinish();
 	
 	//version
@@ -2540,6 +2966,13 @@ bool gfx3d_loadstate(EMUFILE* is, int size)
 	if(read32le(&version,is) != 1) return false;
 	if(size==8) version = 0;
 
+	gfx3d_syncGeometry(false);
+	gfx3d_lightCacheInvalidate();
+	gpu3D->NDS_3D_RenderFinish();
+	mtxClipDirty = true;
+	renderPipelined = false;
+	lastRenderValid = false;
+	lastRenderStateKept = false;
 
 	gfx3d_glPolygonAttrib_cache();
 	gfx3d_glTexImage_cache();
@@ -2786,11 +3219,80 @@ typedef ClipperPlane<1,-1,Stage4> Stage3;        static Stage3 clipper3 (clipper
 typedef ClipperPlane<0, 1,Stage3> Stage2;        static Stage2 clipper2 (clipper3); // right plane
 typedef ClipperPlane<0,-1,Stage2> Stage1;        static Stage1 clipper  (clipper2); // left plane
 
+static FORCEINLINE u8 clipOutcode(const VERT* vert)
+{
+#if defined(ENABLE_SSE)
+	const __m128 coord = _mm_loadu_ps(vert->coord);
+	const __m128 w = _mm_shuffle_ps(coord, coord, _MM_SHUFFLE(3,3,3,3));
+	const int below = _mm_movemask_ps(_mm_cmplt_ps(coord, _mm_sub_ps(_mm_setzero_ps(), w)));
+	const int above = _mm_movemask_ps(_mm_cmpgt_ps(coord, w));
+	return (u8)((below & 7) | ((above & 7) << 3));
+#elif defined(ENABLE_NEON)
+	static const u32 belowBits[4] = { 1, 2, 4, 0 };
+	static const u32 aboveBits[4] = { 8, 16, 32, 0 };
+	const float32x4_t coord = vld1q_f32(vert->coord);
+	const float32x4_t w = vdupq_n_f32(vert->coord[3]);
+	const uint32x4_t bits = vorrq_u32(vandq_u32(vcltq_f32(coord, vnegq_f32(w)), vld1q_u32(belowBits)),
+	                                  vandq_u32(vcgtq_f32(coord, w), vld1q_u32(aboveBits)));
+	const uint32x2_t halves = vorr_u32(vget_low_u32(bits), vget_high_u32(bits));
+	return (u8)(vget_lane_u32(halves, 0) | vget_lane_u32(halves, 1));
+#else
+	const float* coord = vert->coord;
+	const float w = coord[3];
+	u8 outcode = 0;
+	for(int i=0;i<3;i++)
+	{
+		if(coord[i] < -w) outcode |= 1<<i;
+		if(coord[i] > w) outcode |= 8<<i;
+	}
+	return outcode;
+#endif
+}
+
+void GFX3D_Clipper::calcOutcodes(const VERT* verts, int count, u8* outcodes)
+{
+	for(int i=0;i<count;i++)
+		outcodes[i] = clipOutcode(&verts[i]);
+}
+
 template<bool hirez> void GFX3D_Clipper::clipPoly(POLY* poly, VERT** verts)
+{
+	u8 outcodes[4];
+	for(int i=0;i<poly->type;i++)
+		outcodes[i] = clipOutcode(verts[i]);
+	clipPoly<hirez>(poly, verts, outcodes);
+}
+
+template<bool hirez> void GFX3D_Clipper::clipPoly(POLY* poly, VERT** verts, const u8* outcodes)
 {
 	CLIPLOG("==Begin poly==\n");
 
 	int type = poly->type;
+
+	u8 orCode = 0, andCode = 0x3F;
+	for(int i=0;i<type;i++)
+	{
+		orCode |= outcodes[i];
+		andCode &= outcodes[i];
+	}
+
+	//every vert is outside the same plane: the whole poly is clipped away
+	if(andCode)
+		return;
+
+	//every vert is inside: the planes pass the verts through unchanged, but each one
+	//rotates the loop by a vert, so emit them in the order the six planes would have
+	if(orCode == 0)
+	{
+		TClippedPoly &out = clippedPolys[clippedPolyCounter];
+		for(int i=0;i<type;i++)
+			out.srcVerts[i] = verts[(i+6)%type];
+		out.type = type;
+		out.poly = poly;
+		clippedPolyCounter++;
+		return;
+	}
+
 	numScratchClipVerts = 0;
 
 	clipper.init(clippedPolys[clippedPolyCounter].clipVerts);
@@ -2808,12 +3310,15 @@ template<bool hirez> void GFX3D_Clipper::clipPoly(POLY* poly, VERT** verts)
 	{
 		clippedPolys[clippedPolyCounter].type = outType;
 		clippedPolys[clippedPolyCounter].poly = poly;
+		clippedPolys[clippedPolyCounter].srcVerts[0] = NULL;
 		clippedPolyCounter++;
 	}
 }
 //these templates needed to be instantiated manually
 template void GFX3D_Clipper::clipPoly<true>(POLY* poly, VERT** verts);
 template void GFX3D_Clipper::clipPoly<false>(POLY* poly, VERT** verts);
+template void GFX3D_Clipper::clipPoly<true>(POLY* poly, VERT** verts, const u8* outcodes);
+template void GFX3D_Clipper::clipPoly<false>(POLY* poly, VERT** verts, const u8* outcodes);
 
 void GFX3D_Clipper::clipSegmentVsPlane(VERT** verts, const int coord, int which)
 {
@@ -2931,6 +3436,7 @@ void GFX3D_Clipper::clipPoly(POLY* poly, VERT** verts)
 		//TODO - build right in this list instead of copying
 		clippedPolys[clippedPolyCounter] = tempClippedPoly;
 		clippedPolys[clippedPolyCounter].poly = poly;
+		clippedPolys[clippedPolyCounter].srcVerts[0] = NULL;
 		clippedPolyCounter++;
 	}
 
@@ -584,10 +584,21 @@ public:
 		int type; //otherwise known as "count" of verts
 		POLY* poly;
 		VERT clipVerts[MAX_CLIPPED_VERTS];
+		//for a poly that needed no clipping, its verts where they are in the vertlist, in the order clipVerts would
+		//have them. they are shared with the poly's neighbours in a strip, so the renderer transforms each of them
+		//once and only then copies them into clipVerts. NULL when the clipper made the verts itself
+		VERT* srcVerts[4];
 	};
 
+	//computes for each vert the mask of clip planes it lies outside of:
+	//bit n is set for coord n < -w, bit n+3 for coord n > w
+	static void calcOutcodes(const VERT* verts, int count, u8* outcodes);
+
 	//the entry point for poly clipping
 	template<bool hirez> void clipPoly(POLY* poly, VERT** verts);
+	//the same, for when the outcodes of the poly's verts are already known.
+	//a poly that needs no clipping only gets its srcVerts set, and its clipVerts are left to the caller
+	template<bool hirez> void clipPoly(POLY* poly, VERT** verts, const u8* outcodes);
 
 	//the output of clipping operations goes into here.
 	//be sure you init it before clipping!
@@ -677,7 +688,8 @@ struct GFX3D
 		: polylist(0)
 		, vertlist(0)
 		, frameCtr(0)
-		, frameCtrRaw(0) {
+		, frameCtrRaw(0)
+		, flushGeneration(0) {
 	}
 
 	//currently set values
@@ -695,17 +707,21 @@ struct GFX3D
 
 	//you can use this to track how many real frames passed, for comparing to frameCtr;
 	int frameCtrRaw;
+
+	//like frameCtr, but never reset, so it tells whether a new frame of 3d output has been flushed since it was last looked at
+	u32 flushGeneration;
 };
 extern GFX3D gfx3d;
 
 //---------------------
 
-extern CACHE_ALIGN u32 color_15bit_to_24bit[32768];
-extern CACHE_ALIGN u32 color_15bit_to_24bit_reverse[32768];
-extern CACHE_ALIGN u16 color_15bit_to_16bit_reverse[32768];
-extern CACHE_ALIGN u32 dsDepthExtend_15bit_to_24bit[32768];
-extern CACHE_ALIGN u8 mixTable555[32][32][32];
+extern CACHE_ALIGN const u32 color_15bit_to_24bit[32768];
+extern CACHE_ALIGN const u32 color_15bit_to_24bit_reverse[32768];
+extern CACHE_ALIGN const u16 color_15bit_to_16bit_reverse[32768];
+extern CACHE_ALIGN const u32 dsDepthExtend_15bit_to_24bit[32768];
+extern CACHE_ALIGN const u8 mixTable555[32][32][32];
 extern CACHE_ALIGN const int material_5bit_to_31bit[32];
+extern CACHE_ALIGN const u8 material_5bit_to_6bit[32];
 extern CACHE_ALIGN const u8 material_5bit_to_8bit[32];
 extern CACHE_ALIGN const u8 material_3bit_to_5bit[8];
 extern CACHE_ALIGN const u8 material_3bit_to_6bit[8];
@@ -738,8 +754,18 @@ u32 gfx3d_glGetPosRes(u32 index);
 u16 gfx3d_glGetVecRes(u32 index);
 void gfx3d_VBlankSignal();
 void gfx3d_VBlankEndSignal(bool skipFrame);
+//the frames that weren't rendered because they would have come out as the one before, and the call that makes the
+//next frame render whatever it is (for when the converted screen has been changed under it)
+extern u32 gfx3d_unchangedFrames;
+void gfx3d_forgetRender();
+//renders the state the last frame handed to the renderer over again, and waits for it. for a renderer that has
+//just been switched to, so that it has drawn the screen before the game flushes another frame
+void gfx3d_renderAgain();
 void gfx3d_Control(u32 v);
 void gfx3d_execute3D();
+//waits for the geometry worker to run what has been queued for it: everything, or with results set, only as far as
+//the last command whose results the cpu can read (the matrix stack levels and errors, and the tests)
+void gfx3d_syncGeometry(bool results);
 void gfx3d_sendCommandToFIFO(u32 val);
 void gfx3d_sendCommand(u32 cmd, u32 param);
 
@@ -0,0 +1,280 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hle_sdk.h"
+#include "armcpu.h"
+#include "MMU.h"
+#include "MMU_timing.h"
+#include "NDSSystem.h"
+#include "mem.h"
+#ifdef HAVE_JIT
+#include "arm_jit.h"
+#endif
+
+//the sdk's routines are hand written arm (mi_memory.c), so their code is the same in every game that has them
+static const u32 kCopy32[] = {
+	0xE081C002, //add r12, r1, r2
+	0xE151000C, //cmp r1, r12
+	0xB8B00004, //ldmltia r0!, {r2}
+	0xB8A10004, //stmltia r1!, {r2}
+	0xBAFFFFFB, //blt (cmp)
+	0xE12FFF1E, //bx lr
+};
+static const u32 kFill32[] = {
+	0xE081C002, //add r12, r1, r2
+	0xE151000C, //cmp r1, r12
+	0xB8A10001, //stmltia r1!, {r0}
+	0xBAFFFFFC, //blt (cmp)
+	0xE12FFF1E, //bx lr
+};
+static const u32 kCopy16[] = {
+	0xE3A0C000, //mov r12, #0
+	0xE15C0002, //cmp r12, r2
+	0xB19030BC, //ldrlth r3, [r0, r12]
+	0xB18130BC, //strlth r3, [r1, r12]
+	0xB28CC002, //addlt r12, r12, #2
+	0xBAFFFFFA, //blt (cmp)
+	0xE12FFF1E, //bx lr
+};
+static const u32 kFill16[] = {
+	0xE3A03000, //mov r3, #0
+	0xE1530002, //cmp r3, r2
+	0xB18100B3, //strlth r0, [r1, r3]
+	0xB2833002, //addlt r3, r3, #2
+	0xBAFFFFFB, //blt (cmp)
+	0xE12FFF1E, //bx lr
+};
+
+//whether bytes from adr are all in main memory, to go through MMU.MAIN_MEM with. anything else (the dtcm over it
+//too) goes through the memory map, an access at a time
+template<int PROCNUM>
+static bool inMainMem(u32 adr, u32 bytes)
+{
+	if(!bytes) return true;
+	if(bytes > 0x01000000 || (adr >> 24) != 0x02 || ((adr + bytes - 1) >> 24) != 0x02) return false;
+	if(PROCNUM == ARMCPU_ARM9 && adr < MMU.DTCMRegion + 0x4000 && adr + bytes > MMU.DTCMRegion) return false;
+	return true;
+}
+
+//what _MMU_write32 and _MMU_write16 do with main memory
+FORCEINLINE static void storeMain32(u32 adr, u32 val)
+{
+#ifdef HAVE_JIT
+	JIT_INVALIDATE_KNOWNBANK(adr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 0);
+	JIT_INVALIDATE_KNOWNBANK(adr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 1);
+#endif
+	MMU_touchMainMem(adr);
+	T1WriteLong(MMU.MAIN_MEM, adr & _MMU_MAIN_MEM_MASK32, val);
+}
+
+FORCEINLINE static void storeMain16(u32 adr, u16 val)
+{
+#ifdef HAVE_JIT
+	JIT_INVALIDATE_KNOWNBANK(adr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 0);
+#endif
+	MMU_touchMainMem(adr);
+	T1WriteWord(MMU.MAIN_MEM, adr & _MMU_MAIN_MEM_MASK16, val);
+}
+
+//the cycles of the loop's load and store, as the jit times them
+template<int PROCNUM, int SIZE>
+static u32 loadCycles(u32 adr)
+{
+	return MMU_aluMemCycles<PROCNUM>(3, _MMU_accesstime<PROCNUM,MMU_AT_DATA,SIZE,MMU_AD_READ,false>(adr, true));
+}
+
+template<int PROCNUM, int SIZE>
+static u32 storeCycles(u32 adr)
+{
+	return MMU_aluMemCycles<PROCNUM>(2, _MMU_accesstime<PROCNUM,MMU_AT_DATA,SIZE,MMU_AD_WRITE,false>(adr, true));
+}
+
+//the bx lr at the end, with the flags of the cmp that left the loop
+template<int PROCNUM>
+static u32 leave(u32 left, u32 right, u32 cycles)
+{
+	armcpu_t* const cpu = &ARMPROC;
+	const u32 tmp = left - right;
+	cpu->CPSR.bits.N = BIT31(tmp);
+	cpu->CPSR.bits.Z = (tmp == 0);
+	cpu->CPSR.bits.C = !BorrowFrom(left, right);
+	cpu->CPSR.bits.V = OverflowFromSUB(tmp, left, right);
+
+	const u32 lr = cpu->R[14];
+	cpu->CPSR.bits.T = BIT0(lr);
+	cpu->instruct_adr = lr & (BIT0(lr) ? 0xFFFFFFFE : 0xFFFFFFFC);
+	cpu->next_instruction = cpu->instruct_adr;
+	return cycles + 3;
+}
+
+//MI_CpuCopy32(src, dest, size)
+template<int PROCNUM>
+static u32 FASTCALL cpuCopy32()
+{
+	armcpu_t* const cpu = &ARMPROC;
+	u32 src = cpu->R[0], dst = cpu->R[1], last = cpu->R[2];
+	const u32 end = dst + cpu->R[2];
+	const u32 n = (s32)dst < (s32)end ? (end - dst + 3) >> 2 : 0;
+	const u32 iteration = 1 + loadCycles<PROCNUM,32>(src) + storeCycles<PROCNUM,32>(dst) + 3;
+
+	if(inMainMem<PROCNUM>(src & ~3, n * 4) && inMainMem<PROCNUM>(dst & ~3, n * 4))
+	{
+		for(u32 i = 0; i < n; i++, src += 4, dst += 4)
+		{
+			last = T1ReadLong(MMU.MAIN_MEM, src & _MMU_MAIN_MEM_MASK32);
+			storeMain32(dst, last);
+		}
+	}
+	else
+	{
+		for(; (s32)dst < (s32)end; src += 4, dst += 4)
+		{
+			last = _MMU_read32<PROCNUM>(src & ~3);
+			_MMU_write32<PROCNUM>(dst & ~3, last);
+		}
+	}
+
+	cpu->R[0] = src;
+	cpu->R[1] = dst;
+	cpu->R[2] = last;
+	cpu->R[12] = end;
+	return leave<PROCNUM>(dst, end, 1 + n * iteration + 4);
+}
+
+//MI_CpuFill32(data, dest, size)
+template<int PROCNUM>
+static u32 FASTCALL cpuFill32()
+{
+	armcpu_t* const cpu = &ARMPROC;
+	const u32 data = cpu->R[0];
+	u32 dst = cpu->R[1];
+	const u32 end = dst + cpu->R[2];
+	const u32 n = (s32)dst < (s32)end ? (end - dst + 3) >> 2 : 0;
+	const u32 iteration = 1 + storeCycles<PROCNUM,32>(dst) + 3;
+
+	if(inMainMem<PROCNUM>(dst & ~3, n * 4))
+	{
+		for(u32 i = 0; i < n; i++, dst += 4)
+			storeMain32(dst, data);
+	}
+	else
+	{
+		for(; (s32)dst < (s32)end; dst += 4)
+			_MMU_write32<PROCNUM>(dst & ~3, data);
+	}
+
+	cpu->R[1] = dst;
+	cpu->R[12] = end;
+	return leave<PROCNUM>(dst, end, 1 + n * iteration + 3);
+}
+
+//MI_CpuCopy16(src, dest, size)
+template<int PROCNUM>
+static u32 FASTCALL cpuCopy16()
+{
+	armcpu_t* const cpu = &ARMPROC;
+	const u32 src = cpu->R[0], dst = cpu->R[1], size = cpu->R[2];
+	const u32 n = (s32)size > 0 ? (size + 1) >> 1 : 0;
+	const u32 iteration = 1 + loadCycles<PROCNUM,16>(src) + storeCycles<PROCNUM,16>(dst) + 1 + 3;
+	u32 ofs = 0, last = cpu->R[3];
+
+	if(!(src & 1) && !(dst & 1) && inMainMem<PROCNUM>(src, n * 2) && inMainMem<PROCNUM>(dst, n * 2))
+	{
+		for(; ofs < n * 2; ofs += 2)
+		{
+			last = T1ReadWord(MMU.MAIN_MEM, (src + ofs) & _MMU_MAIN_MEM_MASK16);
+			storeMain16(dst + ofs, last);
+		}
+	}
+	else
+	{
+		for(; (s32)ofs < (s32)size; ofs += 2)
+		{
+			last = _MMU_read16<PROCNUM>((src + ofs) & ~1);
+			_MMU_write16<PROCNUM>((dst + ofs) & ~1, last);
+		}
+	}
+
+	cpu->R[3] = last;
+	cpu->R[12] = ofs;
+	return leave<PROCNUM>(ofs, size, 1 + n * iteration + 5);
+}
+
+//MI_CpuFill16(data, dest, size)
+template<int PROCNUM>
+static u32 FASTCALL cpuFill16()
+{
+	armcpu_t* const cpu = &ARMPROC;
+	const u16 data = (u16)cpu->R[0];
+	const u32 dst = cpu->R[1], size = cpu->R[2];
+	const u32 n = (s32)size > 0 ? (size + 1) >> 1 : 0;
+	const u32 iteration = 1 + storeCycles<PROCNUM,16>(dst) + 1 + 3;
+	u32 ofs = 0;
+
+	if(!(dst & 1) && inMainMem<PROCNUM>(dst, n * 2))
+	{
+		for(; ofs < n * 2; ofs += 2)
+			storeMain16(dst + ofs, data);
+	}
+	else
+	{
+		for(; (s32)ofs < (s32)size; ofs += 2)
+			_MMU_write16<PROCNUM>((dst + ofs) & ~1, data);
+	}
+
+	cpu->R[3] = ofs;
+	return leave<PROCNUM>(ofs, size, 1 + n * iteration + 4);
+}
+
+struct Signature
+{
+	const u32 *code;
+	u32 words;
+	HleSdkRoutine routine[2];
+};
+
+#define SIGNATURE(code, fn) { code, ARRAY_SIZE(code), { fn<ARMCPU_ARM9>, fn<ARMCPU_ARM7> } }
+static const Signature signatures[] = {
+	SIGNATURE(kCopy32, cpuCopy32),
+	SIGNATURE(kFill32, cpuFill32),
+	SIGNATURE(kCopy16, cpuCopy16),
+	SIGNATURE(kFill16, cpuFill16),
+};
+#undef SIGNATURE
+
+template<int PROCNUM>
+HleSdkRoutine hle_sdk_find(u32 adr)
+{
+	if(!CommonSettings.hle_sdk || (adr & 3)) return NULL;
+
+	//the first word turns away nearly everything, with one read
+	const u32 first = _MMU_read32<PROCNUM, MMU_AT_CODE>(adr);
+	for(u32 i = 0; i < ARRAY_SIZE(signatures); i++)
+	{
+		const Signature &sig = signatures[i];
+		if(sig.code[0] != first) continue;
+		u32 w = 1;
+		while(w < sig.words && _MMU_read32<PROCNUM, MMU_AT_CODE>(adr + w * 4) == sig.code[w])
+			w++;
+		if(w == sig.words)
+			return sig.routine[PROCNUM];
+	}
+	return NULL;
+}
+
+template HleSdkRoutine hle_sdk_find<0>(u32 adr);
+template HleSdkRoutine hle_sdk_find<1>(u32 adr);
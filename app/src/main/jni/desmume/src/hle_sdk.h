@@ -0,0 +1,39 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HLE_SDK_H_
+#define _HLE_SDK_H_
+
+#include "types.h"
+
+//native versions of the nitro sdk's memory routines (MI_CpuCopy32, MI_CpuFill32 and the 16 bit ones), which games
+//spend a good share of their arm9 time in. they are recognized by their code where the cpu branches to it: the jit
+//looks before it compiles a block, and installs the native routine in its place, the interpreter looks wherever the
+//code doesn't run straight on. a routine does what the code would, down to the registers and flags it leaves, copying
+//through the host's pointer to main memory, and returns the cycles the code would have taken.
+//the debugger, the lua hooks and the statistics see every instruction, so they keep the routines as code
+#if !defined(GDB_STUB) && !defined(HAVE_LUA) && !defined(DEVELOPER)
+#define HLE_SDK
+#endif
+
+typedef u32 (FASTCALL* HleSdkRoutine)();
+
+//the routine for the arm code at adr, or NULL if it isn't one of them. it runs like a compiled block: it leaves the
+//cpu at the caller, with instruct_adr (and next_instruction) where it is to go on
+template<int PROCNUM> HleSdkRoutine hle_sdk_find(u32 adr);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#elif defined(__linux__) || defined(ANDROID)
+#include <sys/auxv.h>
+#endif
+
+#include "hostcpu.h"
+#include "debug.h"
+
+#ifndef AT_HWCAP2
+#define AT_HWCAP2 26
+#endif
+
+static u32 features = 0;
+static bool detected = false;
+static char description[128];
+
+#if defined(__i386__) || defined(__x86_64__)
+static u32 detectX86()
+{
+	u32 found = 0;
+	unsigned int eax, ebx, ecx, edx;
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+
+	if(ecx & bit_SSSE3) found |= HOSTCPU_SSSE3;
+	if(ecx & bit_SSE4_1) found |= HOSTCPU_SSE41;
+
+	//avx2 also needs the os to save the upper halves of the registers, which xgetbv says
+	const bool osxsave = (ecx & bit_OSXSAVE) != 0;
+	const bool avx = (ecx & bit_AVX) != 0;
+	if(osxsave && avx && __get_cpuid_max(0, NULL) >= 7)
+	{
+		unsigned int xcr0lo, xcr0hi;
+		__asm__ volatile("xgetbv" : "=a"(xcr0lo), "=d"(xcr0hi) : "c"(0));
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		if((xcr0lo & 6) == 6 && (ebx & bit_AVX2)) found |= HOSTCPU_AVX2;
+	}
+	return found;
+}
+#endif
+
+void hostcpu_init()
+{
+	if(detected) return;
+	detected = true;
+
+#if defined(__i386__) || defined(__x86_64__)
+	features = detectX86();
+#elif defined(__aarch64__)
+	const unsigned long hwcap = getauxval(AT_HWCAP);
+	const unsigned long hwcap2 = getauxval(AT_HWCAP2);
+	features = HOSTCPU_NEON;
+	if(hwcap & (1 << 20)) features |= HOSTCPU_DOTPROD; //HWCAP_ASIMDDP
+	if(hwcap & (1 << 22)) features |= HOSTCPU_SVE; //HWCAP_SVE
+	if(hwcap2 & (1 << 1)) features |= HOSTCPU_SVE2; //HWCAP2_SVE2
+#elif defined(__arm__) && (defined(__linux__) || defined(ANDROID))
+	if(getauxval(AT_HWCAP) & (1 << 12)) features |= HOSTCPU_NEON; //HWCAP_NEON
+#endif
+
+	static const struct { u32 feature; const char* name; } names[] = {
+		{ HOSTCPU_NEON, "neon" }, { HOSTCPU_DOTPROD, "dotprod" }, { HOSTCPU_SVE, "sve" }, { HOSTCPU_SVE2, "sve2" },
+		{ HOSTCPU_SSSE3, "ssse3" }, { HOSTCPU_SSE41, "sse4.1" }, { HOSTCPU_AVX2, "avx2" },
+	};
+	description[0] = 0;
+	for(size_t i = 0; i < ARRAY_SIZE(names); i++)
+	{
+		if(!(features & names[i].feature)) continue;
+		if(description[0]) strcat(description, " ");
+		strcat(description, names[i].name);
+	}
+	if(!description[0]) strcpy(description, "none");
+
+	CORELOG_INFO("host cpu features: %s\n", description);
+}
+
+u32 hostcpu_features()
+{
+	return features;
+}
+
+const char* hostcpu_describe()
+{
+	return description;
+}
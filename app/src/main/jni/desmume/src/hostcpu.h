@@ -0,0 +1,52 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HOSTCPU_H
+#define _HOSTCPU_H
+
+#include "types.h"
+
+//what the cpu the emulator runs on can do, found out when it starts. the library is built for the baseline of its
+//abi (ENABLE_SSE2 and such say what that is); the kernels that have something wider pick it at run time from these,
+//each module in its own init: see GPU_Init and SPU_Init
+enum HostCpuFeature
+{
+	HOSTCPU_NEON = 1<<0,
+	HOSTCPU_DOTPROD = 1<<1, //the arm64 dot product instructions
+	HOSTCPU_SVE = 1<<2,
+	HOSTCPU_SVE2 = 1<<3,
+	HOSTCPU_SSSE3 = 1<<4,
+	HOSTCPU_SSE41 = 1<<5,
+	HOSTCPU_AVX2 = 1<<6, //and the os saves the ymm registers
+};
+
+//detects the features, once. NDS_Init calls it before the modules set up
+void hostcpu_init();
+
+u32 hostcpu_features();
+inline bool hostcpu_has(u32 features) { return (hostcpu_features() & features) == features; }
+
+//the names of the features there are, for the log
+const char* hostcpu_describe();
+
+//marks a kernel built for more than the baseline. it may only be called once hostcpu_has() said so
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HOSTCPU_HAVE_X86_KERNELS
+#define HOSTCPU_TARGET(x) __attribute__((target(x)))
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+#include "hostmem.h"
+
+//linux 5.14 and up: faults the range in as if written, in one call. older kernels say EINVAL and get it touched
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#ifndef WIN32
+static uintptr_t pageSize()
+{
+	static uintptr_t size = 0;
+	if(!size)
+	{
+		const long s = sysconf(_SC_PAGESIZE);
+		size = s > 0 ? (uintptr_t)s : 4096;
+	}
+	return size;
+}
+
+static bool populateWrite = true;
+#endif
+
+void hostmem_advise_huge(void* p, size_t size)
+{
+#if !defined(WIN32) && defined(MADV_HUGEPAGE)
+	const uintptr_t page = pageSize();
+	const uintptr_t start = ((uintptr_t)p + page - 1) & ~(page - 1);
+	const uintptr_t end = ((uintptr_t)p + size) & ~(page - 1);
+	if(end > start)
+		madvise((void*)start, end - start, MADV_HUGEPAGE);
+#endif
+}
+
+void hostmem_prefault(void* p, size_t size)
+{
+	if(size == 0) return;
+#ifndef WIN32
+	const uintptr_t page = pageSize();
+	const uintptr_t start = (uintptr_t)p & ~(page - 1);
+	const uintptr_t end = ((uintptr_t)p + size + page - 1) & ~(page - 1);
+	if(populateWrite)
+	{
+		if(madvise((void*)start, end - start, MADV_POPULATE_WRITE) == 0)
+			return;
+		if(errno == EINVAL)
+			populateWrite = false;
+	}
+#else
+	const uintptr_t page = 4096;
+	const uintptr_t end = (uintptr_t)p + size;
+#endif
+	//a store to each page, of what is there already. the first is clipped to the range, the memory before it may not
+	//be ours to write
+	for(volatile u8* q = (volatile u8*)p; (uintptr_t)q < end; q = (volatile u8*)(((uintptr_t)q + page) & ~(page - 1)))
+		*q = *q;
+}
+
+void* hostmem_alloc(size_t size)
+{
+#ifdef WIN32
+	return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	//mapped a huge page over, and the ends that aren't aligned given back
+	const size_t mapped = size + HOSTMEM_HUGE_PAGE;
+	u8* map = (u8*)mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED)
+		return NULL;
+	u8* p = (u8*)(((uintptr_t)map + HOSTMEM_HUGE_PAGE - 1) & ~(uintptr_t)(HOSTMEM_HUGE_PAGE - 1));
+	const size_t tail = (size + pageSize() - 1) & ~(pageSize() - 1);
+	if(p > map)
+		munmap(map, p - map);
+	if(map + mapped > p + tail)
+		munmap(p + tail, map + mapped - (p + tail));
+
+	hostmem_advise_huge(p, size);
+	hostmem_prefault(p, size);
+	return p;
+#endif
+}
+
+void hostmem_free(void* p, size_t size)
+{
+	if(!p) return;
+#ifdef WIN32
+	VirtualFree(p, 0, MEM_RELEASE);
+#else
+	munmap(p, size);
+#endif
+}
+
+u64 hostmem_faults()
+{
+#ifdef WIN32
+	return 0;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return (u64)usage.ru_minflt + (u64)usage.ru_majflt;
+#endif
+}
@@ -0,0 +1,48 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HOSTMEM_H
+#define _HOSTMEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+//what the emulator asks of the memory the os gives it. the big tables (the ds' memory, the jit's) are touched all
+//over and early, so they are better off on huge pages (fewer tlb misses) and faulted in at once when they are set
+//up, instead of 4KB at a time as a game first gets to them
+
+//the size of a huge page, which is what the allocations below are aligned to
+#define HOSTMEM_HUGE_PAGE (2 << 20)
+
+//asks for [p, p+size) to be backed by huge pages where the kernel does them (transparent huge pages). only the
+//whole pages inside the range are asked for. it can be called on memory that is in use
+void hostmem_advise_huge(void* p, size_t size);
+
+//maps in the pages of [p, p+size) now, writable, instead of on first touch. the contents are kept; nothing else
+//may be writing to the range meanwhile
+void hostmem_prefault(void* p, size_t size);
+
+//zeroed memory straight from the os, aligned to a huge page, advised and prefaulted as above. NULL if there's none
+void* hostmem_alloc(size_t size);
+void hostmem_free(void* p, size_t size);
+
+//the page faults the process took so far, minor and major, for the profiler
+u64 hostmem_faults();
+
+#endif
@@ -5171,4 +5171,169 @@ INSTR_CYCLES(4) | BRANCH_ALWAYS, //OP_BL_11
 INSTR_CYCLES(4) | BRANCH_ALWAYS, //OP_BL_11
 };
 
+//-----------------------------------------------------------------------------
+//   Flag liveness
+//-----------------------------------------------------------------------------
+// which of NZCV an instruction reads, and which it always sets. an instruction that isn't
+// understood here reads all of them and sets none, and one that sets a flag only sometimes
+// (a shift by a register that may be zero) doesn't count as setting it.
+
+#define FLAG_N 8
+#define FLAG_Z 4
+#define FLAG_C 2
+#define FLAG_V 1
+#define FLAGS_NZ (FLAG_N|FLAG_Z)
+#define FLAGS_NZC (FLAG_N|FLAG_Z|FLAG_C)
+#define FLAGS_NZCV (FLAG_N|FLAG_Z|FLAG_C|FLAG_V)
+
+static const u8 cond_flags[16] = {
+	FLAG_Z, FLAG_Z, FLAG_C, FLAG_C, FLAG_N, FLAG_N, FLAG_V, FLAG_V,
+	FLAG_C|FLAG_Z, FLAG_C|FLAG_Z, FLAG_N|FLAG_V, FLAG_N|FLAG_V, FLAG_N|FLAG_Z|FLAG_V, FLAG_N|FLAG_Z|FLAG_V, 0, FLAGS_NZCV
+};
+
+static void instr_flags_arm(u32 i, u32 &read, u32 &written)
+{
+	read = cond_flags[i >> 28];
+	written = 0;
+
+	if((i >> 28) == 0xF)
+	{
+		// BLX, the rest of this space isn't anything the DS runs
+		read = ((i >> 25) & 7) == 5 ? 0 : FLAGS_NZCV;
+		return;
+	}
+
+	switch((i >> 25) & 7)
+	{
+		case 0:
+			// multiplies, swaps and the halfword transfers
+			if((i & 0x90) == 0x90)
+			{
+				if((i & 0x0F0000F0) == 0x00000090 && (i & (1 << 20)))
+					written = FLAGS_NZ;
+				break;
+			}
+		// fall through
+		case 1:
+		{
+			// MRS, MSR, BX, CLZ, the saturating ops
+			if((i & 0x01900000) == 0x01000000)
+			{
+				read = FLAGS_NZCV;
+				break;
+			}
+
+			const u32 opc = (i >> 21) & 0xF;
+			const bool imm = (i >> 25) & 1;
+			const bool rrx = !imm && (i & 0xFF0) == 0x060;
+			if(rrx || opc == 5 || opc == 6 || opc == 7)
+				read |= FLAG_C;
+			if(!(i & (1 << 20)))
+				break;
+
+			// with Rd = R15 the SPSR is copied to the CPSR
+			if(((i >> 12) & 0xF) == 15)
+			{
+				read = FLAGS_NZCV;
+				break;
+			}
+			if(opc == 0 || opc == 1 || opc == 8 || opc == 9 || opc >= 12)
+			{
+				written = FLAGS_NZ;
+				if(imm ? (i & 0xF00) != 0 : !(i & 0x10) && (i & 0xFE0) != 0)
+					written |= FLAG_C;
+			}
+			else
+				written = FLAGS_NZCV;
+			break;
+		}
+
+		case 2: case 3:
+			if((i >> 25) & 1)
+			{
+				if(i & 0x10)
+					read = FLAGS_NZCV;
+				else if((i & 0xFF0) == 0x060)
+					read |= FLAG_C;
+			}
+			break;
+
+		// the S bit of LDM/STM banks the registers or restores the CPSR
+		case 4:
+			if(i & (1 << 22))
+				read = FLAGS_NZCV;
+			break;
+
+		case 5:
+			break;
+
+		// coprocessor ops (MRC can set the flags) and SWI, which saves the CPSR
+		default:
+			read = FLAGS_NZCV;
+			break;
+	}
+}
+
+static void instr_flags_thumb(u32 i, u32 &read, u32 &written)
+{
+	read = 0;
+	written = 0;
+
+	switch(i >> 11)
+	{
+		case 0x00: written = (i & 0x07C0) ? FLAGS_NZC : FLAGS_NZ; break;	// LSL #0 is a MOVS
+		case 0x01: case 0x02: written = FLAGS_NZC; break;
+		case 0x03: written = FLAGS_NZCV; break;
+		case 0x04: written = FLAGS_NZ; break;
+		case 0x05: case 0x06: case 0x07: written = FLAGS_NZCV; break;
+
+		case 0x08:
+			if(i & 0x0400)
+			{
+				// of the high register ops only CMP touches the flags
+				if(((i >> 8) & 3) == 1)
+					written = FLAGS_NZCV;
+			}
+			else switch((i >> 6) & 0xF)
+			{
+				case 5: case 6: read = FLAG_C; written = FLAGS_NZCV; break;	// ADC, SBC
+				case 9: case 10: case 11: written = FLAGS_NZCV; break;		// NEG, CMP, CMN
+				default: written = FLAGS_NZ; break;
+			}
+			break;
+
+		case 0x17:
+			if((i & 0x0700) == 0x0600)	// BKPT
+				read = FLAGS_NZCV;
+			break;
+
+		// B<cond>, and SWI which saves the CPSR
+		case 0x1A: case 0x1B:
+			read = ((i >> 8) & 0xF) >= 0xE ? FLAGS_NZCV : cond_flags[(i >> 8) & 0xF];
+			break;
+	}
+}
+
+// sets dead[n] for the ops of the block that may set flags which nothing reads before they are set
+// again. cpu->CPSR is all that is left of them once the block is done, so they are all live at its end.
+static void instr_dead_flags(const u32 *ops, u32 count, bool thumb, bool *dead)
+{
+	u32 live = FLAGS_NZCV;
+	for(int n = (int)count - 1; n >= 0; n--)
+	{
+		u32 read, written;
+		if(thumb)
+			instr_flags_thumb(ops[n], read, written);
+		else
+			instr_flags_arm(ops[n], read, written);
+
+		dead[n] = live == 0;
+
+		// a conditional op might not set anything
+		if(thumb || (ops[n] >> 28) == 0xE)
+			live &= ~written;
+		live |= read;
+	}
+}
+
 #endif
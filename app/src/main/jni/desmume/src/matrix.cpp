@@ -24,6 +24,10 @@
 #include "matrix.h"
 #include "MMU.h"
 
+#ifdef ENABLE_NEON
+#include <arm_neon.h>
+#endif
+
 void _NOSSE_MatrixMultVec4x4 (const float *matrix, float *vecPtr)
 {
 	float x = vecPtr[0];
@@ -37,6 +41,64 @@ void _NOSSE_MatrixMultVec4x4 (const float *matrix, float *vecPtr)
 	vecPtr[3] = x * matrix[3] + y * matrix[7] + z * matrix[11] + w * matrix[15];
 }
 
+#ifdef ENABLE_NEON
+
+//the fixed point matrix math in neon. products are widened to 64 bits and the sums narrowed back with a
+//truncating >>12, so the results are bit for bit the same as with fx32_mul and fx32_shiftdown.
+//matrices are column major, so m*v is the columns of m scaled by the elements of v and summed.
+static FORCEINLINE int32x4_t neon_MatrixMultVec4x4(const s32 *matrix, const s32 *vecPtr)
+{
+	const s32 x = vecPtr[0];
+	const s32 y = vecPtr[1];
+	const s32 z = vecPtr[2];
+	const s32 w = vecPtr[3];
+
+	const int32x4_t c0 = vld1q_s32(matrix);
+	const int32x4_t c1 = vld1q_s32(matrix+4);
+	const int32x4_t c2 = vld1q_s32(matrix+8);
+	const int32x4_t c3 = vld1q_s32(matrix+12);
+
+	int64x2_t lo = vmull_n_s32(vget_low_s32(c0),x);
+	int64x2_t hi = vmull_n_s32(vget_high_s32(c0),x);
+	lo = vmlal_n_s32(lo,vget_low_s32(c1),y);
+	hi = vmlal_n_s32(hi,vget_high_s32(c1),y);
+	lo = vmlal_n_s32(lo,vget_low_s32(c2),z);
+	hi = vmlal_n_s32(hi,vget_high_s32(c2),z);
+	lo = vmlal_n_s32(lo,vget_low_s32(c3),w);
+	hi = vmlal_n_s32(hi,vget_high_s32(c3),w);
+
+	return vcombine_s32(vshrn_n_s64(lo,12),vshrn_n_s64(hi,12));
+}
+
+void MatrixMultVec4x4 (const s32 *matrix, s32 *vecPtr)
+{
+	vst1q_s32(vecPtr,neon_MatrixMultVec4x4(matrix,vecPtr));
+}
+
+void MatrixMultVec3x3_fixed(const s32 *matrix, s32 *vecPtr)
+{
+	const s32 x = vecPtr[0];
+	const s32 y = vecPtr[1];
+	const s32 z = vecPtr[2];
+
+	const int32x4_t c0 = vld1q_s32(matrix);
+	const int32x4_t c1 = vld1q_s32(matrix+4);
+	const int32x4_t c2 = vld1q_s32(matrix+8);
+
+	int64x2_t lo = vmull_n_s32(vget_low_s32(c0),x);
+	int64x2_t hi = vmull_n_s32(vget_high_s32(c0),x);
+	lo = vmlal_n_s32(lo,vget_low_s32(c1),y);
+	hi = vmlal_n_s32(hi,vget_high_s32(c1),y);
+	lo = vmlal_n_s32(lo,vget_low_s32(c2),z);
+	hi = vmlal_n_s32(hi,vget_high_s32(c2),z);
+
+	//w is left alone
+	vst1_s32(vecPtr,vshrn_n_s64(lo,12));
+	vst1_lane_s32(vecPtr+2,vshrn_n_s64(hi,12),0);
+}
+
+#else
+
 void MatrixMultVec4x4 (const s32 *matrix, s32 *vecPtr)
 {
 	const s32 x = vecPtr[0];
@@ -61,6 +123,8 @@ void MatrixMultVec3x3_fixed(const s32 *matrix, s32 *vecPtr)
 	vecPtr[2] = fx32_shiftdown(fx32_mul(x,matrix[2]) + fx32_mul(y,matrix[6]) + fx32_mul(z,matrix[10]));
 }
 
+#endif
+
 //-------------------------
 //switched SSE functions: implementations for no SSE
 #ifndef ENABLE_SSE
@@ -380,6 +444,53 @@ void Vector4Copy(float *dst, const float *src)
 }
 
 
+#ifdef ENABLE_NEON
+
+void MatrixMultiply (s32 *matrix, const s32 *rightMatrix)
+{
+	//each column of the product is the left matrix times that column of the right one
+	const int32x4_t col0 = neon_MatrixMultVec4x4(matrix,rightMatrix);
+	const int32x4_t col1 = neon_MatrixMultVec4x4(matrix,rightMatrix+4);
+	const int32x4_t col2 = neon_MatrixMultVec4x4(matrix,rightMatrix+8);
+	const int32x4_t col3 = neon_MatrixMultVec4x4(matrix,rightMatrix+12);
+	vst1q_s32(matrix,col0);
+	vst1q_s32(matrix+4,col1);
+	vst1q_s32(matrix+8,col2);
+	vst1q_s32(matrix+12,col3);
+}
+
+void MatrixScale(s32 *matrix, const s32 *ptr)
+{
+	for(int i=0;i<3;i++)
+	{
+		const int32x4_t col = vld1q_s32(matrix+i*4);
+		const int64x2_t lo = vmull_n_s32(vget_low_s32(col),ptr[i]);
+		const int64x2_t hi = vmull_n_s32(vget_high_s32(col),ptr[i]);
+		vst1q_s32(matrix+i*4,vcombine_s32(vshrn_n_s64(lo,12),vshrn_n_s64(hi,12)));
+	}
+}
+
+void MatrixTranslate(s32 *matrix, const s32 *ptr)
+{
+	const int32x4_t c0 = vld1q_s32(matrix);
+	const int32x4_t c1 = vld1q_s32(matrix+4);
+	const int32x4_t c2 = vld1q_s32(matrix+8);
+	const int32x4_t c3 = vld1q_s32(matrix+12);
+
+	int64x2_t lo = vshll_n_s32(vget_low_s32(c3),12);
+	int64x2_t hi = vshll_n_s32(vget_high_s32(c3),12);
+	lo = vmlal_n_s32(lo,vget_low_s32(c0),ptr[0]);
+	hi = vmlal_n_s32(hi,vget_high_s32(c0),ptr[0]);
+	lo = vmlal_n_s32(lo,vget_low_s32(c1),ptr[1]);
+	hi = vmlal_n_s32(hi,vget_high_s32(c1),ptr[1]);
+	lo = vmlal_n_s32(lo,vget_low_s32(c2),ptr[2]);
+	hi = vmlal_n_s32(hi,vget_high_s32(c2),ptr[2]);
+
+	vst1q_s32(matrix+12,vcombine_s32(vshrn_n_s64(lo,12),vshrn_n_s64(hi,12)));
+}
+
+#else
+
 void MatrixMultiply (s32 *matrix, const s32 *rightMatrix)
 {
 	s32 tmpMatrix[16];
@@ -427,6 +538,8 @@ void MatrixTranslate(s32 *matrix, const s32 *ptr)
 	});
 }
 
+#endif
+
 void MatrixMultVec4x4_M2(const s32 *matrix, s32 *vecPtr)
 {
 	MatrixMultVec4x4(matrix+16,vecPtr);
@@ -31,6 +31,7 @@
 #include "NDSSystem.h"
 #include "path.h"
 #include "utils/advanscene.h"
+#include "utils/task.h"
 
 //#define _DONT_SAVE_BACKUP
 //#define _MCLOG
@@ -62,7 +63,7 @@
 #define CARDFLASH_WAKEUP			0xAB    /* Not used*/
 
 #ifdef _MCLOG
-#define MCLOG(...) printf(__VA_ARGS__)
+#define MCLOG(...) CORELOG_INFO(__VA_ARGS__)
 #else
 #define MCLOG(...)
 #endif
@@ -70,6 +71,77 @@
 static const char* DESMUME_BACKUP_FOOTER_TXT = "|<--Snip above here to create a raw sav by excluding this DeSmuME savedata footer:";
 static const char* kDesmumeSaveCookie = "|-DESMUME SAVE-|";
 
+size_t BackupFile::fwrite(const void *ptr, size_t bytes)
+{
+	markDirty(ftell(), ftell() + bytes);
+	writes++;
+	return EMUFILE_MEMORY::fwrite(ptr, bytes);
+}
+
+void BackupFile::truncate(s32 length)
+{
+	if (length != size())
+		markDirty(std::min(length, size()), std::max(length, size()));
+	EMUFILE_MEMORY::truncate(length);
+}
+
+void BackupFile::markDirty(u32 start, u32 end)
+{
+	if (!dirty())
+	{
+		dirtyStart = start;
+		dirtyEnd = end;
+	}
+	else
+	{
+		dirtyStart = std::min(dirtyStart, start);
+		dirtyEnd = std::max(dirtyEnd, end);
+	}
+}
+
+//the save being written to its file, off the emulation thread
+static struct
+{
+	std::vector<u8> data;
+	std::string filename;
+} backupWrite;
+
+static Task backupWriteTask;
+static bool backupWriteTaskStarted = false;
+static bool backupWritePending = false;
+
+static void* backupWriteFile(void*)
+{
+	//the save is written next to the old one and only replaces it once it is all there,
+	//so a write that gets cut short never costs the save
+	std::string tmpname = backupWrite.filename + ".tmp";
+	FILE* file = fopen(tmpname.c_str(), "wb");
+	bool ok = file != NULL;
+	if (file)
+	{
+		if (!backupWrite.data.empty())
+			ok = fwrite(&backupWrite.data[0], 1, backupWrite.data.size(), file) == backupWrite.data.size();
+		ok = (fclose(file) == 0) && ok;
+	}
+	if (ok)
+		ok = rename(tmpname.c_str(), backupWrite.filename.c_str()) == 0;
+	if (!ok)
+	{
+		remove(tmpname.c_str());
+		CORELOG_INFO("BackupDevice: Couldn't write the save file %s\n", backupWrite.filename.c_str());
+	}
+	return NULL;
+}
+
+static void backupWriteFinish()
+{
+	if (backupWritePending)
+	{
+		backupWriteTask.finish();
+		backupWritePending = false;
+	}
+}
+
 static const u32 saveSizes[] = {512,			// 4k
 								8*1024,			// 64k
 								32*1024,		// 512k
@@ -213,6 +285,8 @@ bool BackupDevice::load_state(EMUFILE* is)
 BackupDevice::BackupDevice()
 {
 	fpMC = NULL;
+	fileBacked = true;
+	dirtyFrames = quietFrames = lastWrites = 0;
 	fsize = 0;
 	addr_size = 0;
 	isMovieMode = false;
@@ -255,7 +329,7 @@ BackupDevice::BackupDevice()
 				}
 				else
 				{
-					printf("BackupDevice: Could not create the backup save file.\n");
+					CORELOG_INFO("BackupDevice: Could not create the backup save file.\n");
 				}
 				
 				delete out;
@@ -263,7 +337,7 @@ BackupDevice::BackupDevice()
 		}
 		else
 		{
-			printf("BackupDevice: Could not read the save file for creating a backup.\n");
+			CORELOG_INFO("BackupDevice: Could not read the save file for creating a backup.\n");
 		}
 		
 		delete in;
@@ -271,7 +345,7 @@ BackupDevice::BackupDevice()
 
 	if (!fexists)
 	{
-		printf("BackupDevice: DeSmuME .dsv save file not found. Trying to load a .sav file.\n");
+		CORELOG_INFO("BackupDevice: DeSmuME .dsv save file not found. Trying to load a .sav file.\n");
 		std::string tmp_fsav = std::string(buf) + ".sav";
 
 		EMUFILE_FILE *fpTmp = new EMUFILE_FILE(tmp_fsav, "rb");
@@ -289,11 +363,11 @@ BackupDevice::BackupDevice()
 					{
 						if (no_gba_unpack(buf, sz))
 						{
-							printf("BackupDevice: Converting no$gba .sav file.\n");
+							CORELOG_INFO("BackupDevice: Converting no$gba .sav file.\n");
 						}
 						else
 						{
-							printf("BackupDevice: Converting old raw .sav file.\n");
+							CORELOG_INFO("BackupDevice: Converting old raw .sav file.\n");
 							sz = trim(buf, sz);
 						}
 
@@ -314,7 +388,7 @@ BackupDevice::BackupDevice()
 						}
 						else
 						{
-							printf("BackupDevice: Error converting .sav file.\n");
+							CORELOG_ERROR("BackupDevice: Error converting .sav file.\n");
 						}
 					}
 					delete [] buf;
@@ -325,14 +399,19 @@ BackupDevice::BackupDevice()
 		delete fpTmp;
 	}
 
-	fpMC = new EMUFILE_FILE(filename, fexists?"rb+":"wb+");
-	const bool fileCanReadWrite = (fpMC->get_fp() != NULL);
-	if (!fileCanReadWrite)
+	//the save is worked on in memory, and flushBackup writes it to the file when the game is done writing it
+	fpMC = new BackupFile();
+	if (fexists)
 	{
-		delete fpMC;
-		fpMC = new EMUFILE_MEMORY();
-		printf("BackupDevice: WARNING! Failed to get read/write access to the save file! Will operate in RAM instead.\n");
+		std::vector<u8> saveData;
+		fileBacked = EMUFILE::readAllBytes(&saveData, filename);
+		if (fileBacked && !saveData.empty())
+			fpMC->fwrite(&saveData[0], saveData.size());
+		fpMC->fseek(0, SEEK_SET);
+		fpMC->clean();
 	}
+	if (!fileBacked)
+		CORELOG_ERROR("BackupDevice: WARNING! Failed to get read/write access to the save file! Will operate in RAM instead.\n");
 	
 	if (!fpMC->fail())
 	{
@@ -399,7 +478,7 @@ BackupDevice::BackupDevice()
 		}
 
 		if (ss > 0)
-			printf("BackupDevice: size = %u %cbit\n", ss, _Mbit?'M':'K');
+			CORELOG_INFO("BackupDevice: size = %u %cbit\n", ss, _Mbit?'M':'K');
 	}
 
 	state = (fsize > 0)?RUNNING:DETECTING;
@@ -408,6 +487,7 @@ BackupDevice::BackupDevice()
 
 BackupDevice::~BackupDevice()
 {
+	flushBackup(true);
 	delete fpMC;
 	fpMC = NULL;
 }
@@ -567,9 +647,59 @@ void BackupDevice::seek(u32 pos)
 	fpMC->fseek(pos, SEEK_SET);
 }
 
-void BackupDevice::flushBackup()
+void BackupDevice::flushBackup(bool wait)
+{
+	if (fpMC && fpMC->dirty())
+	{
+		if (isMovieMode || !fileBacked)
+			fpMC->clean();
+		else
+		{
+			//the write before has to be done with the copy before it can be brought up to date
+			backupWriteFinish();
+
+			const u32 size = fpMC->size();
+			const u8* data = fpMC->buf();
+			if (backupWrite.data.size() != size || backupWrite.filename != filename)
+				backupWrite.data.assign(data, data + size);
+			else if (fpMC->dirtyStart < size)
+				memcpy(&backupWrite.data[fpMC->dirtyStart], data + fpMC->dirtyStart, std::min(fpMC->dirtyEnd, size) - fpMC->dirtyStart);
+			backupWrite.filename = filename;
+			fpMC->clean();
+
+			if (!backupWriteTaskStarted)
+			{
+				backupWriteTask.start(false, "Backup writer", THREAD_ROLE_BACKGROUND);
+				backupWriteTaskStarted = true;
+			}
+			backupWriteTask.execute(backupWriteFile, NULL);
+			backupWritePending = true;
+		}
+	}
+	dirtyFrames = quietFrames = 0;
+
+	if (wait)
+		backupWriteFinish();
+}
+
+void BackupDevice::flushIdle()
 {
-	fpMC->fflush();
+	if (!fpMC || !fpMC->dirty())
+		return;
+
+	//games that write their save a byte at a time get it all written in one go, a second after they stop.
+	//one that never stops still gets it written every ten seconds
+	dirtyFrames++;
+	if (fpMC->writes != lastWrites)
+	{
+		lastWrites = fpMC->writes;
+		quietFrames = 0;
+	}
+	else
+		quietFrames++;
+
+	if (quietFrames >= 60 || dirtyFrames >= 600)
+		flushBackup();
 }
 
 bool BackupDevice::saveBuffer(u8 *data, u32 size, bool _rewind, bool _truncate)
@@ -622,7 +752,7 @@ void BackupDevice::reset()
 
 void BackupDevice::close_rom()
 {
-	fpMC->fflush();
+	flushBackup(true);
 	delete fpMC;
 	fpMC = NULL;
 }
@@ -646,7 +776,7 @@ void BackupDevice::detect()
 		//we can now safely detect the save address size
 		u32 autodetect_size = data_autodetect.size();
 
-		printf("Autodetecting with autodetect_size=%d\n",autodetect_size);
+		CORELOG_INFO("Autodetecting with autodetect_size=%d\n",autodetect_size);
 
 		//detect based on rules
 		switch(autodetect_size)
@@ -742,7 +872,7 @@ u8 BackupDevice::data_command(u8 val, u8 PROCNUM)
 			if(state == DETECTING)
 			{
 				if(com == BM_CMD_WRITELOW)
-					printf("MC%c: Unexpected backup device initialization sequence using writes!\n", PROCNUM?'7':'9');
+					CORELOG_INFO("MC%c: Unexpected backup device initialization sequence using writes!\n", PROCNUM?'7':'9');
 
 				//just buffer the data until we're no longer detecting
 				data_autodetect.push_back(val);
@@ -801,14 +931,14 @@ u8 BackupDevice::data_command(u8 val, u8 PROCNUM)
 		break;
 
 		case BM_CMD_IRDA:
-			printf("MC%c: Unverified Backup Memory command: %02X FROM %08X\n", PROCNUM?'7':'9', com, PROCNUM?NDS_ARM7.instruct_adr:NDS_ARM9.instruct_adr);
+			CORELOG_INFO("MC%c: Unverified Backup Memory command: %02X FROM %08X\n", PROCNUM?'7':'9', com, PROCNUM?NDS_ARM7.instruct_adr:NDS_ARM9.instruct_adr);
 			val = 0xAA;
 		break;
 
 		default:
 			if (com != 0)
 			{
-				printf("MC%c: Unhandled Backup Memory command %02X, value %02X (PC:%08X)\n", PROCNUM?'7':'9', com, val, PROCNUM?NDS_ARM7.instruct_adr:NDS_ARM9.instruct_adr);
+				CORELOG_INFO("MC%c: Unhandled Backup Memory command %02X, value %02X (PC:%08X)\n", PROCNUM?'7':'9', com, val, PROCNUM?NDS_ARM7.instruct_adr:NDS_ARM9.instruct_adr);
 				break;
 			}
 
@@ -853,7 +983,7 @@ u8 BackupDevice::data_command(u8 val, u8 PROCNUM)
 #endif
 
 				case BM_CMD_IRDA:
-					printf("MC%c: Unverified Backup Memory command: %02X FROM %08X\n", PROCNUM?'7':'9', com, PROCNUM?NDS_ARM7.instruct_adr:NDS_ARM9.instruct_adr);
+					CORELOG_INFO("MC%c: Unverified Backup Memory command: %02X FROM %08X\n", PROCNUM?'7':'9', com, PROCNUM?NDS_ARM7.instruct_adr:NDS_ARM9.instruct_adr);
 					
 					val = 0xAA;
 					break;
@@ -902,7 +1032,7 @@ u8 BackupDevice::data_command(u8 val, u8 PROCNUM)
 					break;
 
 				default:
-					printf("MC%c: Unhandled Backup Memory command: %02X FROM %08X\n", PROCNUM?'7':'9', com, PROCNUM?NDS_ARM7.instruct_adr:NDS_ARM9.instruct_adr);
+					CORELOG_INFO("MC%c: Unhandled Backup Memory command: %02X FROM %08X\n", PROCNUM?'7':'9', com, PROCNUM?NDS_ARM7.instruct_adr:NDS_ARM9.instruct_adr);
 					break;
 			} //switch(val)
 		break;
@@ -1385,7 +1515,7 @@ u32 BackupDevice::pad_up_size(u32 startSize)
 	u32 padSize = saveSizes[ctr];
 	if(padSize == 0xFFFFFFFF)
 	{
-		printf("PANIC! Couldn't pad up save size. Refusing to pad.\n");
+		CORELOG_INFO("PANIC! Couldn't pad up save size. Refusing to pad.\n");
 		padSize = startSize;
 	}
 	
@@ -1496,7 +1626,7 @@ bool BackupDevice::import_duc(const char* filename, u32 force_size)
 
 	if (memcmp(id, "ARDS000000000001", 16) != 0)
 	{
-		printf("Not recognized as a valid DUC file\n");
+		CORELOG_INFO("Not recognized as a valid DUC file\n");
 		fclose(file);
 		return false;
 	}
@@ -1542,7 +1672,7 @@ bool BackupDevice::load_movie(EMUFILE* is) {
 	u32 version = 0xFFFFFFFF;
 	is->fread((char*)&version,4);
 	if(version!=0) {
-		printf("Unknown save file format\n");
+		CORELOG_WARN("Unknown save file format\n");
 		return false;
 	}
 	is->fseek(-24, SEEK_CUR);
@@ -1557,8 +1687,17 @@ bool BackupDevice::load_movie(EMUFILE* is) {
 	is->fread((char*)&info.addr_size,4);
 	is->fread((char*)&info.mem_size,4);
 
+	//the movie's save is worked on like any other, it just never goes to the file
+	std::vector<u8> movieSave(is->size());
 	is->fseek(0, SEEK_SET);
-	fpMC = (EMUFILE*)&is;
+	if (!movieSave.empty())
+		is->fread(&movieSave[0], movieSave.size());
+	if (!fpMC)
+		fpMC = new BackupFile();
+	fpMC->truncate(0);
+	if (!movieSave.empty())
+		fpMC->fwrite(&movieSave[0], movieSave.size());
+	fpMC->fseek(0, SEEK_SET);
 
 	state = RUNNING;
 	addr_size = info.addr_size;
@@ -25,6 +25,7 @@
 #include <string>
 
 #include "types.h"
+#include "emufile.h"
 
 #define MAX_SAVE_TYPES 13
 #define MC_TYPE_AUTODETECT      0x0
@@ -48,7 +49,24 @@
 #define MC_SIZE_256MBITS                0x2000000
 #define MC_SIZE_512MBITS                0x4000000
 
-class EMUFILE;
+//the save memory as the BackupDevice works on it: in memory, keeping track of the part written since it last went to the file
+class BackupFile : public EMUFILE_MEMORY
+{
+public:
+	BackupFile() : dirtyStart(0), dirtyEnd(0), writes(0) {}
+
+	virtual size_t fwrite(const void *ptr, size_t bytes);
+	virtual void truncate(s32 length);
+
+	bool dirty() const { return dirtyStart < dirtyEnd; }
+	void clean() { dirtyStart = dirtyEnd = 0; }
+
+	u32 dirtyStart, dirtyEnd;
+	u32 writes;
+
+private:
+	void markDirty(u32 start, u32 end);
+};
 
 //This "backup device" represents a typical retail NDS save memory accessible via AUXSPI.
 //It is managed as a core emulator service for historical reasons which are bad,
@@ -86,7 +104,10 @@ public:
 
 	void seek(u32 pos);
 
-	void flushBackup();
+	//writes the save to its file, off the emulation thread unless wait is set, which also waits for any write going on
+	void flushBackup(bool wait = false);
+	//called once a frame: the save is written once the game stops writing it for a moment
+	void flushIdle();
 	
 	u8 searchFileSaveType(u32 size);
 
@@ -144,8 +165,10 @@ public:
 	u8 uninitializedValue;
 
 private:
-	EMUFILE *fpMC;
+	BackupFile *fpMC;
 	std::string filename;
+	bool fileBacked;	//false when the save file can't be read, and the save only lives in memory
+	u32 dirtyFrames, quietFrames, lastWrites;
 	u32	fsize;
 	int readFooter();
 	bool write(u8 val);
@@ -58,6 +58,15 @@ static INLINE u16 T1ReadWord(void* const mem, const u32 addr)
 #endif
 }
 
+static INLINE u16 T1ReadWord(const void* const mem, const u32 addr)
+{
+#ifdef WORDS_BIGENDIAN
+   return (((const u8*)mem)[addr + 1] << 8) | ((const u8*)mem)[addr];
+#else
+   return *((const u16 *) ((const u8*)mem + addr));
+#endif
+}
+
 static INLINE u32 T1ReadLong_guaranteedAligned(u8* const  mem, const u32 addr)
 {
 	assert((addr&3)==0);
@@ -81,6 +90,17 @@ static INLINE u32 T1ReadLong(u8* const  mem, u32 addr)
 #endif
 }
 
+static INLINE u32 T1ReadLong(const u8* const  mem, u32 addr)
+{
+   addr &= ~3;
+#ifdef WORDS_BIGENDIAN
+   return (mem[addr + 3] << 24 | mem[addr + 2] << 16 |
+           mem[addr + 1] << 8 | mem[addr]);
+#else
+   return *(const u32*)(mem + addr);
+#endif
+}
+
 static INLINE u64 T1ReadQuad(u8* const mem, const u32 addr)
 {
 #ifdef WORDS_BIGENDIAN
@@ -0,0 +1,112 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "memusage.h"
+#include <algorithm>
+
+#include "GPU.h"
+#include "MMU.h"
+#include "NDSSystem.h"
+#include "saves.h"
+#include "texcache.h"
+#ifdef HAVE_JIT
+#include "arm_jit.h"
+#endif
+
+static MemUsageReporter frontend = NULL;
+
+static MemBudget budget = { 16*1024*1024, 16, 64, ~0ULL, 1024*1024 };
+
+void memusage_setFrontend(MemUsageReporter reporter)
+{
+	frontend = reporter;
+}
+
+static void add(std::vector<MemUsage>& out, const char* name, u64 bytes)
+{
+	MemUsage usage = { name, bytes };
+	out.push_back(usage);
+}
+
+void memusage_report(std::vector<MemUsage>& out)
+{
+	out.clear();
+
+	//a mapped rom only takes the pages the kernel has read in, which it can drop again; this is all of it
+	if(gameInfo.romMap)
+		add(out, "ROM (mapped)", gameInfo.romMapSize);
+	else if(gameInfo.romdata)
+		add(out, "ROM", gameInfo.romsize);
+
+	add(out, "emulated memory", sizeof(MMU) + sizeof(MMU_new));
+	add(out, "GPU screen", sizeof(GPU_screen));
+	add(out, "texture cache", TexCache_MemoryUsage());
+	add(out, "rewind", rewind_memoryUsage());
+
+#if defined(HAVE_JIT) && !defined(MAPPED_JIT_FUNCS)
+	u64 code, tables;
+	arm_jit_memory_usage(&code, &tables);
+	add(out, "JIT code", code);
+	add(out, "JIT tables", tables);
+#endif
+
+	if(frontend)
+		frontend(out);
+}
+
+static u32 clampBudget(u32 value, u32 lo, u32 hi)
+{
+	return value < lo ? lo : value > hi ? hi : value;
+}
+
+void memusage_setBudget(u32 memoryClassMB)
+{
+	//a memory class of 128MB gets the sizes the caches had before there was a budget
+	budget.texCacheBytes = clampBudget(memoryClassMB / 8, 4, 32) << 20;
+	budget.rewindStates = clampBudget(memoryClassMB / 8, 4, 32);
+	budget.jitCacheMB = clampBudget(memoryClassMB / 4, 8, 64);
+	budget.filterBytes = (u64)memoryClassMB << 17;
+	budget.fatCacheBytes = clampBudget(memoryClassMB / 64, 1, 8) << 20;
+	CORELOG_INFO("memory class %uMB: texture cache %uMB, %d rewind states, jit cache up to %uMB, filters up to %uKB, sd cache %uMB\n",
+		memoryClassMB, budget.texCacheBytes >> 20, budget.rewindStates, budget.jitCacheMB, (u32)(budget.filterBytes >> 10), budget.fatCacheBytes >> 20);
+
+	TexCache_SetMaxSize(budget.texCacheBytes);
+	rewind_setStates(budget.rewindStates);
+}
+
+const MemBudget& memusage_budget()
+{
+	return budget;
+}
+
+void memusage_trim(int level)
+{
+	//the textures are decoded again from vram as the game uses them, which costs a frame or two of decoding
+	TexCache_Trim(level >= TRIM_RUNNING_CRITICAL ? 0 : budget.texCacheBytes / 4);
+
+	if(level >= TRIM_BACKGROUND)
+	{
+		//next in line to be killed: only the newest state is kept, and the rewind grows back once the game runs again
+		rewind_shrink(1);
+	}
+	else if(level >= TRIM_RUNNING_LOW && level < TRIM_UI_HIDDEN)
+	{
+		//short of memory while being played: it stays shorter for the rest of the session
+		budget.rewindStates = std::max(2, budget.rewindStates / 2);
+		rewind_setStates(budget.rewindStates);
+	}
+}
@@ -0,0 +1,72 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MEMUSAGE_H
+#define _MEMUSAGE_H
+
+#include <vector>
+#include "types.h"
+
+//where the memory the emulator holds on to goes, for finding out what to cut on devices that have little of it.
+//each of the big parts says what it holds now; the frontend adds its own (the filter buffers, for one) through
+//memusage_setFrontend. the sizes are read without stopping anything, so one can be a frame behind
+struct MemUsage
+{
+	const char* name;
+	u64 bytes;
+};
+
+typedef void (*MemUsageReporter)(std::vector<MemUsage>& out);
+void memusage_setFrontend(MemUsageReporter reporter);
+
+void memusage_report(std::vector<MemUsage>& out);
+
+//how big the caches may grow. memusage_setBudget sizes them from the device's memory class (what
+//ActivityManager.getMemoryClass() says an app may take, in MB): a device that has little memory gets a smaller
+//texture cache, a shorter rewind and a smaller jit cache, and no screen filter bigger than it can afford.
+//until it is called they are what they always were
+struct MemBudget
+{
+	u32 texCacheBytes;
+	int rewindStates;
+	u32 jitCacheMB; //the most CommonSettings.jit_cache_size is set to
+	u64 filterBytes; //the most the buffer of a cpu screen filter may take
+	u32 fatCacheBytes; //the sector cache of the r4's sd image, for the next one mounted
+};
+
+//sets the texture cache and the rewind buffer to it right away; the jit and the filters are left to the frontend,
+//which keeps to memusage_budget() when it applies its settings. before the game runs
+void memusage_setBudget(u32 memoryClassMB);
+const MemBudget& memusage_budget();
+
+//the levels of ComponentCallbacks2.onTrimMemory
+enum
+{
+	TRIM_RUNNING_MODERATE = 5,
+	TRIM_RUNNING_LOW = 10,
+	TRIM_RUNNING_CRITICAL = 15,
+	TRIM_UI_HIDDEN = 20,
+	TRIM_BACKGROUND = 40,
+	TRIM_MODERATE = 60,
+	TRIM_COMPLETE = 80,
+};
+
+//gives back what the core's caches hold when the system is short of memory, more of it the higher the level.
+//between frames
+void memusage_trim(int level);
+
+#endif
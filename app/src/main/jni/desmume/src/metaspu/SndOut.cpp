@@ -17,6 +17,7 @@
 
 //#include "Global.h"
 #include "SndOut.h"
+#include "../corelog.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -148,7 +149,7 @@ bool SndBuffer::CheckUnderrunStatus( int& nSamples, int& quietSampleCount )
 		m_underrun_freeze = false;
 		//TODO
 		//if( MsgOverruns() )
-			printf(" * SPU2 > Underrun compensation (%d packets buffered)\n", toFill / SndOutPacketSize );
+			CORELOG_INFO(" * SPU2 > Underrun compensation (%d packets buffered)\n", toFill / SndOutPacketSize );
 		lastPct = 0.0;		// normalize timestretcher
 	}
 	else if( m_data < nSamples )
@@ -215,7 +216,7 @@ void SndBuffer::_WriteSamples(StereoOut32 *bData, int nSamples)
 		m_rpos = (m_rpos+comp) % m_size;
 		//TODO
 		//if( MsgOverruns() )
-			printf(" * SPU2 > Overrun Compensation (%d packets tossed)\n", comp / SndOutPacketSize );
+			CORELOG_INFO(" * SPU2 > Overrun Compensation (%d packets tossed)\n", comp / SndOutPacketSize );
 		lastPct = 0.0;		// normalize the timestretcher
 	}
 
@@ -271,7 +272,7 @@ void SndBuffer::Init()
 	{
 		// out of memory exception (most likely)
 
-		printf( "Out of memory error occurred while initializing SPU2." );
+		CORELOG_ERROR( "Out of memory error occurred while initializing SPU2.\n" );
 		_InitFail();
 		return;
 	}
@@ -302,7 +302,7 @@ void SndBuffer::timeStretchWrite()
 			if( ++ts_stats_logcounter > 300 )
 			{
 				ts_stats_logcounter = 0;
-				printf( " * SPU2 > Timestretch Stats > %d%% of packets stretched.\n",
+				CORELOG_INFO( " * SPU2 > Timestretch Stats > %d%% of packets stretched.\n",
 					( ts_stats_stretchblocks * 100 ) / ( ts_stats_normalblocks + ts_stats_stretchblocks ) );
 				ts_stats_normalblocks = 0;
 				ts_stats_stretchblocks = 0;
@@ -20,7 +20,6 @@
 #include "metaspu.h"
 
 #include <queue>
-#include <vector>
 #include <assert.h>
 
 //for pcsx2 method
@@ -48,6 +47,52 @@ template<typename T> inline T moveValueTowards(T val, T target, T incr)
 }
 
 
+//the stereo samples a synchronizer holds on to. it is allocated once, so that neither enqueue_samples nor
+//output_samples ever allocate; a producer that gets too far ahead loses its oldest samples.
+class SampleRing
+{
+public:
+	struct ssamp
+	{
+		s16 l, r;
+		ssamp() {}
+		ssamp(s16 ll, s16 rr) : l(ll), r(rr) {}
+	};
+
+	//capacity is a power of two
+	SampleRing(int capacity)
+		: buf(new ssamp[capacity])
+		, mask(capacity-1)
+		, head(0)
+		, count(0)
+	{}
+	~SampleRing() { delete[] buf; }
+
+	int size() const { return count; }
+
+	void push(s16 l, s16 r)
+	{
+		if(count > mask)
+			drop(1);
+		buf[(head+count)&mask] = ssamp(l,r);
+		count++;
+	}
+
+	//i counts from the oldest sample
+	ssamp& operator[](int i) { return buf[(head+i)&mask]; }
+
+	void drop(int n)
+	{
+		head = (head+n)&mask;
+		count -= n;
+	}
+
+private:
+	ssamp* buf;
+	int mask;
+	int head, count;
+};
+
 class ZeromusSynchronizer : public ISynchronizingAudioBuffer
 {
 public:
@@ -105,31 +150,37 @@ private:
 	{
 	public:
 		Adjustobuf(int _minLatency, int _maxLatency)
-			: size(0)
-			, minLatency(_minLatency)
+			: minLatency(_minLatency)
 			, maxLatency(_maxLatency)
+			, size(0)
+			, buffer(65536)
 		{
 			rollingTotalSize = 0;
 			targetLatency = (maxLatency + minLatency)/2;
-			rate = 1.0f;
-			cursor = 0.0f;
+			rate = 0x10000;
+			cursor = 0;
 			curr[0] = curr[1] = 0;
 			kAverageSize = 80000;
+			statsHistory = new int[kAverageSize];
+			statsPos = 0;
+			statsCount = 0;
 		}
+		~Adjustobuf() { delete[] statsHistory; }
 
-		float rate, cursor;
+		u32 rate, cursor; //16.16
 		int minLatency, targetLatency, maxLatency;
-		std::queue<s16> buffer;
 		int size;
+		SampleRing buffer;
 		s16 curr[2];
 
-		std::queue<int> statsHistory;
+		//the last kAverageSize sizes, the oldest at statsPos once it is full
+		int* statsHistory;
+		u32 statsPos, statsCount;
 
 		void enqueue(s16 left, s16 right) 
 		{
-			buffer.push(left);
-			buffer.push(right);
-			size++;
+			buffer.push(left,right);
+			size = buffer.size();
 		}
 
 		s64 rollingTotalSize;
@@ -138,32 +189,20 @@ private:
 
 		void addStatistic()
 		{
-			statsHistory.push(size);
 			rollingTotalSize += size;
-			if(statsHistory.size()>kAverageSize)
+			if(statsCount<kAverageSize)
 			{
-				rollingTotalSize -= statsHistory.front();
-				statsHistory.pop();
-
-				float averageSize = (float)(rollingTotalSize / kAverageSize);
-				//static int ctr=0;  ctr++; if((ctr&127)==0) printf("avg size: %f curr size: %d rate: %f\n",averageSize,size,rate);
-				{
-					float targetRate;
-					if(averageSize < targetLatency)
-					{
-						targetRate = 1.0f - (targetLatency-averageSize)/kAverageSize;
-					}
-					else if(averageSize > targetLatency) {
-						targetRate = 1.0f + (averageSize-targetLatency)/kAverageSize;
-					} else targetRate = 1.0f;
-				
-					//rate = moveValueTowards(rate,targetRate,0.001f);
-					rate = targetRate;
-				}
-
+				statsHistory[statsCount++] = size;
+				return;
 			}
 
+			rollingTotalSize -= statsHistory[statsPos];
+			statsHistory[statsPos] = size;
+			if(++statsPos == kAverageSize) statsPos = 0;
 
+			const s32 averageSize = (s32)(rollingTotalSize / kAverageSize);
+			//static int ctr=0;  ctr++; if((ctr&127)==0) printf("avg size: %d curr size: %d rate: %08X\n",averageSize,size,rate);
+			rate = (u32)(0x10000 + (s32)((s64)(averageSize - targetLatency) * 0x10000 / (s32)kAverageSize));
 		}
 
 		void dequeue(s16& left, s16& right)
@@ -172,11 +211,12 @@ private:
 			addStatistic();
 			if(size==0) { return; }
 			cursor += rate;
-			while(cursor>1.0f) {
-				cursor -= 1.0f;
+			while(cursor>0x10000) {
+				cursor -= 0x10000;
 				if(size>0) {
-					curr[0] = buffer.front(); buffer.pop();
-					curr[1] = buffer.front(); buffer.pop();
+					curr[0] = buffer[0].l;
+					curr[1] = buffer[0].r;
+					buffer.drop(1);
 					size--;
 				}
 			}
@@ -189,14 +229,9 @@ private:
 class NitsujaSynchronizer : public ISynchronizingAudioBuffer
 {
 private:
-	struct ssamp
-	{
-		s16 l, r;
-		ssamp() {}
-		ssamp(s16 ll, s16 rr) : l(ll), r(rr) {}
-	};
+	typedef SampleRing::ssamp ssamp;
 
-	std::vector<ssamp> sampleQueue;
+	SampleRing sampleQueue;
 
 	// returns values going between 0 and y-1 in a saw wave pattern, based on x
 	static FORCEINLINE int pingpong(int x, int y)
@@ -240,7 +275,7 @@ private:
 		*outbuf++ = sample.r;
 	}
 
-	static FORCEINLINE void emit_samples(s16*& outbuf, const ssamp* samplebuf, int samples)
+	static FORCEINLINE void emit_samples(s16*& outbuf, SampleRing& samplebuf, int samples)
 	{
 		for(int i=0;i<samples;i++)
 			emit_sample(outbuf,samplebuf[i]);
@@ -248,13 +283,14 @@ private:
 
 public:
 	NitsujaSynchronizer()
+		: sampleQueue(32768)
 	{}
 
 	virtual void enqueue_samples(s16* buf, int samples_provided)
 	{
 		for(int i=0;i<samples_provided;i++)
 		{
-			sampleQueue.push_back(ssamp(buf[0],buf[1]));
+			sampleQueue.push(buf[0],buf[1]);
 			buf += 2;
 		}
 	}
@@ -353,7 +389,7 @@ public:
 						{
 							emit_sample(buf,sampleQueue[x]);
 						}
-						sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + beststart);
+						sampleQueue.drop(beststart);
 					}
 
 
@@ -423,7 +459,7 @@ public:
 					audiosize += beststart + extraAtEnd;
 				} //end else
 
-				sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + queued);
+				sampleQueue.drop(queued);
 				return audiosize;
 			}
 			else
@@ -439,14 +475,14 @@ public:
 
 				if(audiosize >= queued)
 				{
-					emit_samples(buf,&sampleQueue[0],queued);
-					sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + queued);
+					emit_samples(buf,sampleQueue,queued);
+					sampleQueue.drop(queued);
 					return queued;
 				}
 				else
 				{
-					emit_samples(buf,&sampleQueue[0],audiosize);
-					sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin()+audiosize);
+					emit_samples(buf,sampleQueue,audiosize);
+					sampleQueue.drop(audiosize);
 					return audiosize;
 				}
 
@@ -464,6 +500,92 @@ private:
 
 }; //NitsujaSynchronizer
 
+//resamples what it is given to keep about kTargetFill samples queued: a little faster when it has more than
+//that, a little slower when it has less. at a steady speed it settles on the rate the two sides really run at, with
+//no more latency than kTargetFill and none of the stretching the others do. it doesn't follow fast forward or slow
+//motion by more than kMaxAdjust; past that the ring drops the oldest samples, or the output runs dry until it refills.
+//a rate given to it is where the adjusting starts from, so it keeps all of kMaxAdjust for the drift around that.
+class AdaptiveSynchronizer : public ISynchronizingAudioBuffer
+{
+public:
+	AdaptiveSynchronizer()
+		: sampleQueue(8192)
+		, running(false)
+		, phase(0)
+		, averageFill(kTargetFill << 8)
+		, rate(0x10000)
+	{}
+
+	virtual void set_rate(u32 newRate)
+	{
+		rate = newRate;
+	}
+
+	virtual void enqueue_samples(s16* buf, int samples_provided)
+	{
+		for(int i=0;i<samples_provided;i++)
+		{
+			sampleQueue.push(buf[0],buf[1]);
+			buf += 2;
+		}
+	}
+
+	virtual int output_samples(s16* buf, int samples_requested)
+	{
+		if(!running)
+		{
+			if(sampleQueue.size() < kTargetFill)
+				return 0;
+			running = true;
+			phase = 0;
+			averageFill = kTargetFill << 8;
+		}
+
+		//the fill moves in steps of a frame's worth as the two sides take turns, so it is averaged over a few calls
+		averageFill += ((sampleQueue.size() << 8) - averageFill) >> 3;
+		s32 adjust = (s32)(((s64)(averageFill - (kTargetFill << 8)) * kMaxAdjust) / (kTargetFill << 7));
+		Clampify<s32>(adjust, -kMaxAdjust, kMaxAdjust);
+		const u32 step = rate + adjust;
+
+		int done = 0;
+		for(; done < samples_requested; done++)
+		{
+			//linear between the two oldest samples, with the 16.16 phase between them
+			while(phase >= 0x10000 && sampleQueue.size() > 2)
+			{
+				phase -= 0x10000;
+				sampleQueue.drop(1);
+			}
+			if(phase >= 0x10000)
+			{
+				running = false;
+				break;
+			}
+			const SampleRing::ssamp& a = sampleQueue[0];
+			const SampleRing::ssamp& b = sampleQueue[1];
+			const s32 f = phase >> 4;
+			*buf++ = (s16)(a.l + (((b.l - a.l) * f) >> 12));
+			*buf++ = (s16)(a.r + (((b.r - a.r) * f) >> 12));
+			phase += step;
+		}
+		return done;
+	}
+
+private:
+	enum
+	{
+		kTargetFill = 1024,
+		//0x10000 is the source rate, so this is 2%
+		kMaxAdjust = 0x10000 / 50,
+	};
+
+	SampleRing sampleQueue;
+	bool running;
+	u32 phase;
+	s32 averageFill; //24.8
+	u32 rate; //what the fill is kept at kTargetFill around
+}; //AdaptiveSynchronizer
+
 
 #if defined(_MSC_VER) || defined(HAVE_LIBSOUNDTOUCH) || defined(DESMUME_COCOA) || defined(DESMUME_QT)
 class PCSX2Synchronizer : public ISynchronizingAudioBuffer
@@ -512,6 +634,7 @@ ISynchronizingAudioBuffer* metaspu_construct(ESynchMethod method)
 	{
 	case ESynchMethod_N: return new NitsujaSynchronizer();
 	case ESynchMethod_Z: return new ZeromusSynchronizer();
+	case ESynchMethod_A: return new AdaptiveSynchronizer();
 #if defined(_MSC_VER) || defined(HAVE_LIBSOUNDTOUCH) || defined(DESMUME_COCOA) || defined(DESMUME_QT)
 	case ESynchMethod_P: return new PCSX2Synchronizer();
 #endif
@@ -47,6 +47,10 @@ public:
 
 	//returns the number of samples actually supplied, which may not match the number requested
 	virtual int output_samples(s16* buf, int samples_requested) = 0;
+
+	//16.16 source samples to each output sample, for when the source is known to run that much faster or slower
+	//than it should. only the ones that resample do something with it
+	virtual void set_rate(u32 rate) {}
 };
 
 enum ESynchMode
@@ -60,6 +64,7 @@ enum ESynchMethod
 	ESynchMethod_N, //nitsuja's
 	ESynchMethod_Z, //zero's
 	ESynchMethod_P, //PCSX2 spu2-x
+	ESynchMethod_A, //adaptive rate
 };
 
 ISynchronizingAudioBuffer* metaspu_construct(ESynchMethod method);
@@ -117,11 +117,13 @@ static u8 Mic_DefaultBufferRead(void)
 	return theSample;
 }
 
+bool Mic_Deterministic = false;
+
 u8 Mic_ReadSample(void)
 {
 	// All mic modes other than Physical must have the mic hotkey pressed in order
 	// to work.
-	if (CommonSettings.micMode != TCommonSettings::Physical && !Mic_GetActivate()) {
+	if (Mic_Deterministic || (CommonSettings.micMode != TCommonSettings::Physical && !Mic_GetActivate())) {
 		return MIC_NULL_SAMPLE_VALUE;
 	}
 
@@ -38,6 +38,8 @@ BOOL Mic_Init(void);
 void Mic_Reset(void);
 void Mic_DeInit(void);
 u8 Mic_ReadSample(void);
+//while set, the microphone reads as if it were silent, so that every run of a frame reads the same (for netplay)
+extern bool Mic_Deterministic;
 
 void mic_savestate(EMUFILE* os);
 bool mic_loadstate(EMUFILE* is, int size);
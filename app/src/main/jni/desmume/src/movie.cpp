@@ -22,11 +22,14 @@
 #include <limits.h>
 #include <ctype.h>
 #include <time.h>
+#include <zlib.h>
+#include <algorithm>
 
 #include "utils/guid.h"
 #include "utils/xstring.h"
 #include "utils/datetime.h"
 #include "utils/ConvertUTF.h"
+#include "utils/task.h"
 
 #include "MMU.h"
 #include "NDSSystem.h"
@@ -40,6 +43,7 @@
 #include "GPU_osd.h"
 #include "path.h"
 #include "emufile.h"
+#include "saves.h"
 
 using namespace std;
 bool freshMovie = false;	  //True when a movie loads, false when movie is altered.  Used to determine if a movie has been altered since opening
@@ -69,6 +73,140 @@ char curMovieFilename[512] = {0};
 MovieData currMovieData;
 int currRerecordCount;
 bool movie_reset_command = false;
+
+int movie_keyframe_interval = 3600;
+//set while a keyframe is saved or loaded: they leave the movie out, which would otherwise be in every one of them
+static bool movieKeyframeIO = false;
+
+//the file a movie is recorded to, text or indexed. a write buffer that fills up (or is flushed) goes to a thread of
+//its own to be written while the recording goes on in a second one, so that the emulation doesn't wait on slow
+//storage, unless it gets a whole buffer ahead of it. anything but writing on at the end (reading keyframes back,
+//cutting the file) waits for the writes to be done first
+class EMUFILE_MOVIE_RECORDING : public EMUFILE_FILE_BUFFERED
+{
+	std::vector<u8> back;
+	size_t backBytes;
+	bool pending;
+	//where the file will be once the writes handed off are done
+	int filePos;
+	Task task;
+
+	static void* writeBack(void *param)
+	{
+		EMUFILE_MOVIE_RECORDING *self = (EMUFILE_MOVIE_RECORDING*)param;
+		self->EMUFILE_FILE::fwrite(&self->back[0], self->backBytes);
+		self->EMUFILE_FILE::fflush();
+		return NULL;
+	}
+
+	void finishWrites()
+	{
+		if(!pending) return;
+		task.finish();
+		pending = false;
+	}
+
+	//for what goes to the file itself
+	void sync()
+	{
+		flushWrites();
+		finishWrites();
+	}
+
+protected:
+	virtual void flushWrites()
+	{
+		if(wpos == 0) return;
+		finishWrites();
+		back.swap(wbuf);
+		if(wbuf.size() < back.size())
+			wbuf.resize(back.size());
+		backBytes = wpos;
+		filePos += (int)wpos;
+		wpos = 0;
+		task.execute(writeBack, this);
+		pending = true;
+	}
+
+public:
+	EMUFILE_MOVIE_RECORDING(const char* fname, const char* mode)
+		: EMUFILE_FILE_BUFFERED(fname, mode), backBytes(0), pending(false), filePos(0)
+	{
+		task.start(false, "Movie writer", THREAD_ROLE_BACKGROUND);
+	}
+
+	virtual ~EMUFILE_MOVIE_RECORDING()
+	{
+		sync();
+		task.shutdown();
+	}
+
+	virtual FILE *get_fp() { sync(); return fp; }
+	virtual EMUFILE* memwrap() { sync(); return EMUFILE_FILE::memwrap(); }
+	virtual void truncate(s32 length)
+	{
+		sync();
+		EMUFILE_FILE::truncate(length);
+		filePos = EMUFILE_FILE::ftell();
+	}
+
+	virtual int fgetc()
+	{
+		sync();
+		const int c = EMUFILE_FILE::fgetc();
+		filePos = EMUFILE_FILE::ftell();
+		return c;
+	}
+
+	virtual size_t _fread(const void *ptr, size_t bytes)
+	{
+		sync();
+		const size_t got = EMUFILE_FILE::_fread(ptr, bytes);
+		filePos = EMUFILE_FILE::ftell();
+		return got;
+	}
+
+	//everything goes through the buffers, the keyframes too, which can be bigger than one: it grows to fit them
+	virtual size_t fwrite(const void *ptr, size_t bytes)
+	{
+		if(wpos + bytes > wbuf.size())
+		{
+			flushWrites();
+			if(bytes > wbuf.size())
+				wbuf.resize(bytes);
+		}
+		memcpy(&wbuf[wpos], ptr, bytes);
+		wpos += bytes;
+		return bytes;
+	}
+
+	//seeking to where the writes go on anyway (the end of the chunks, before every one) doesn't need to wait for them
+	virtual int fseek(int offset, int origin)
+	{
+		if(origin == SEEK_SET && offset == ftell())
+			return 0;
+		sync();
+		const int ret = EMUFILE_FILE::fseek(offset, origin);
+		filePos = EMUFILE_FILE::ftell();
+		return ret;
+	}
+
+	virtual int ftell() { return filePos + (int)wpos; }
+
+	virtual int size()
+	{
+		sync();
+		const long pos = ::ftell(fp);
+		::fseek(fp, 0, SEEK_END);
+		const int len = (int)::ftell(fp);
+		::fseek(fp, pos, SEEK_SET);
+		mCondition = eCondition_Clean;
+		return len;
+	}
+
+	//handed off like a full buffer, and the thread flushes stdio after writing it
+	virtual void fflush() { flushWrites(); }
+};
 //--------------
 
 
@@ -203,6 +341,8 @@ MovieData::MovieData()
 	, rerecordCount(0)
 	, binaryFlag(false)
 	, rtcStart(FCEUI_MovieGetRTCDefault())
+	, indexedFlag(false)
+	, indexedEnd(0)
 {
 }
 
@@ -210,6 +350,8 @@ void MovieData::truncateAt(int frame)
 {
 	if((int)records.size() > frame)
 		records.resize(frame);
+	while(!keyframes.empty() && keyframes.back().frame > frame)
+		keyframes.pop_back();
 }
 
 void MovieData::installValue(std::string& key, std::string& val)
@@ -281,12 +423,31 @@ void MovieData::installValue(std::string& key, std::string& val)
 int MovieData::dump(EMUFILE* fp, bool binary)
 {
 	int start = fp->ftell();
+	dumpHeader(fp, binary);
+
+	if(binary)
+	{
+		//put one | to start the binary dump
+		fp->fputc('|');
+		for(int i=0;i<(int)records.size();i++)
+			records[i].dumpBinary(fp);
+	}
+	else
+		for(int i=0;i<(int)records.size();i++)
+			records[i].dump(fp);
+
+	int end = fp->ftell();
+	return end-start;
+}
+
+void MovieData::dumpHeader(EMUFILE* fp, bool binary)
+{
 	fp->fprintf("version %d\n", version);
 	fp->fprintf("emuVersion %d\n", emuVersion);
 	fp->fprintf("rerecordCount %d\n", rerecordCount);
 
 	fp->fprintf("romFilename %s\n", romFilename.c_str());
-	fp->fprintf("romChecksum %s\n", u32ToHexString(gameInfo.crc).c_str());
+	fp->fprintf("romChecksum %s\n", u32ToHexString(gameInfo.getCRC()).c_str());
 	fp->fprintf("romSerial %s\n", romSerial.c_str());
 	fp->fprintf("guid %s\n", guid.toString().c_str());
 	fp->fprintf("useExtBios %d\n", CommonSettings.UseExtBIOS?1:0);
@@ -333,20 +494,6 @@ int MovieData::dump(EMUFILE* fp, bool binary)
 		fp->fprintf("savestate %s\n", BytesToString(&savestate[0],savestate.size()).c_str());
 	if(sram.size() != 0)
 		fp->fprintf("sram %s\n", BytesToString(&sram[0],sram.size()).c_str());
-
-	if(binary)
-	{
-		//put one | to start the binary dump
-		fp->fputc('|');
-		for(int i=0;i<(int)records.size();i++)
-			records[i].dumpBinary(fp);
-	}
-	else
-		for(int i=0;i<(int)records.size();i++)
-			records[i].dump(fp);
-
-	int end = fp->ftell();
-	return end-start;
 }
 
 //yuck... another custom text parser.
@@ -451,10 +598,280 @@ bool LoadFM2(MovieData& movieData, EMUFILE* fp, int size, bool stopAfterHeader)
 }
 
 
+//----indexed binary movies
+//little endian 4-byte cookies
+static const u32 kDSMB = 0x424D5344;
+static const u32 kHEAD = 0x44414548;
+static const u32 kRECS = 0x53434552;
+static const u32 kKEYF = 0x4645454B;
+static const u32 kDSMBVersion = 1;
+static const int kChunkHeaderSize = 8;
+//records kept back from the file before they are written as a chunk, when no keyframe comes first
+static const int kPendingRecords = 600;
+
+static bool isIndexedMovieFilename(const char *fname)
+{
+	const size_t len = strlen(fname);
+	return len > 5 && !strcasecmp(fname + len - 5, ".dsmb");
+}
+
+bool MovieData::loadSavestateFrom(std::vector<u8>* buf)
+{
+	EMUFILE_MEMORY ms(buf);
+	movieKeyframeIO = true;
+	bool ret = savestate_load(&ms);
+	movieKeyframeIO = false;
+	return ret;
+}
+
+void MovieData::dumpSavestateTo(std::vector<u8>* buf, int compressionLevel)
+{
+	EMUFILE_MEMORY ms(buf);
+	movieKeyframeIO = true;
+	savestate_save(&ms, compressionLevel);
+	movieKeyframeIO = false;
+	buf->resize(ms.size());
+}
+
+const MovieKeyframe* MovieData::findKeyframe(int frame)
+{
+	const MovieKeyframe* ret = NULL;
+	int lo = 0, hi = (int)keyframes.size();
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if(keyframes[mid].frame <= frame)
+		{
+			ret = &keyframes[mid];
+			lo = mid + 1;
+		}
+		else hi = mid;
+	}
+	return ret;
+}
+
+static void writeRecordsChunk(MovieData& movieData, EMUFILE* fp, int start, int end)
+{
+	if(end <= start) return;
+	MovieChunk chunk = { fp->ftell(), end, false };
+	write32le(kRECS,fp);
+	write32le((end-start)*6,fp);
+	for(int i=start;i<end;i++)
+		movieData.records[i].dumpBinary(fp);
+	movieData.chunks.push_back(chunk);
+	movieData.indexedEnd = fp->ftell();
+}
+
+static void writeKeyframeChunk(MovieData& movieData, EMUFILE* fp, MovieKeyframe& key)
+{
+	MovieChunk chunk = { fp->ftell(), key.frame, true };
+	write32le(kKEYF,fp);
+	write32le(4+key.state.size(),fp);
+	write32le(key.frame,fp);
+	key.offset = fp->ftell();
+	key.size = key.state.size();
+	if(key.size) fp->fwrite(&key.state[0],key.size);
+	movieData.chunks.push_back(chunk);
+	movieData.indexedEnd = fp->ftell();
+}
+
+//the frames the records chunks in the file so far go up to
+static int indexedFramesWritten(const MovieData& movieData)
+{
+	for(int i=(int)movieData.chunks.size()-1;i>=0;i--)
+		if(!movieData.chunks[i].keyframe)
+			return movieData.chunks[i].frame;
+	return 0;
+}
+
+int MovieData::dumpIndexed(EMUFILE* fp)
+{
+	int start = fp->ftell();
+	chunks.clear();
+
+	write32le(kDSMB,fp);
+	write32le(kDSMBVersion,fp);
+	//here rather than in the header, so that a rerecord only has to write over it
+	write32le(rerecordCount,fp);
+
+	EMUFILE_MEMORY header;
+	dumpHeader(&header, false);
+	write32le(kHEAD,fp);
+	write32le(header.size(),fp);
+	fp->fwrite(header.buf(),header.size());
+	indexedEnd = fp->ftell();
+
+	int frame = 0;
+	for(size_t i=0;i<keyframes.size();i++)
+	{
+		const int keyFrame = std::min(keyframes[i].frame, (int)records.size());
+		writeRecordsChunk(*this, fp, frame, keyFrame);
+		frame = std::max(frame, keyFrame);
+		writeKeyframeChunk(*this, fp, keyframes[i]);
+	}
+	writeRecordsChunk(*this, fp, frame, records.size());
+
+	int end = fp->ftell();
+	return end-start;
+}
+
+bool LoadDSMB(MovieData& movieData, EMUFILE* fp)
+{
+	u32 cookie, version, rerecords;
+	if(read32le(&cookie,fp) != 1 || cookie != kDSMB) return false;
+	if(read32le(&version,fp) != 1 || version != kDSMBVersion) return false;
+	if(read32le(&rerecords,fp) != 1) return false;
+
+	movieData.indexedFlag = true;
+	movieData.chunks.clear();
+	movieData.keyframes.clear();
+	movieData.indexedEnd = fp->ftell();
+
+	bool haveHeader = false;
+	const int fileSize = fp->size();
+	for(;;)
+	{
+		const int offset = fp->ftell();
+		u32 tag, size;
+		if(read32le(&tag,fp) != 1 || read32le(&size,fp) != 1) break;
+		//a chunk the file ends in the middle of (it wasn't closed when recording) is left out, with what comes after it
+		if(size > (u32)(fileSize - offset - kChunkHeaderSize)) break;
+
+		if(tag == kHEAD)
+		{
+			std::vector<u8> text(size);
+			if(size) fp->fread(&text[0],size);
+			EMUFILE_MEMORY ms(&text);
+			if(!LoadFM2(movieData, &ms, size, true)) return false;
+			//the records are in their own chunks, never after the header
+			movieData.binaryFlag = false;
+			haveHeader = true;
+		}
+		else if(tag == kRECS)
+		{
+			const int start = movieData.records.size();
+			const int count = size / 6;
+			movieData.records.resize(start + count);
+			for(int i=0;i<count;i++)
+				movieData.records[start+i].parseBinary(fp);
+			MovieChunk chunk = { offset, start + count, false };
+			movieData.chunks.push_back(chunk);
+		}
+		else if(tag == kKEYF && size >= 4)
+		{
+			MovieKeyframe key;
+			u32 frame;
+			read32le(&frame,fp);
+			key.frame = frame;
+			key.offset = fp->ftell();
+			key.size = size - 4;
+			if(movieData.keyframes.empty() || movieData.keyframes.back().frame < key.frame)
+				movieData.keyframes.push_back(key);
+			MovieChunk chunk = { offset, key.frame, true };
+			movieData.chunks.push_back(chunk);
+		}
+
+		fp->fseek(offset + kChunkHeaderSize + size, SEEK_SET);
+		movieData.indexedEnd = fp->ftell();
+	}
+
+	movieData.rerecordCount = rerecords;
+	return haveHeader;
+}
+
+static bool readKeyframeState(const MovieKeyframe& key, std::vector<u8>* state)
+{
+	if(key.offset < 0)
+	{
+		*state = key.state;
+		return true;
+	}
+
+	state->resize(key.size);
+	if(key.size == 0) return false;
+	if(movieMode == MOVIEMODE_RECORD && osRecordingMovie)
+	{
+		const int pos = osRecordingMovie->ftell();
+		osRecordingMovie->fseek(key.offset, SEEK_SET);
+		const size_t got = osRecordingMovie->fread(&(*state)[0], key.size);
+		osRecordingMovie->fseek(pos, SEEK_SET);
+		return got == (size_t)key.size;
+	}
+
+	EMUFILE_FILE fp(curMovieFilename, "rb");
+	if(fp.fail()) return false;
+	fp.fseek(key.offset, SEEK_SET);
+	return fp.fread(&(*state)[0], key.size) == (size_t)key.size;
+}
+
+//writes what was recorded since the last chunk, which the file may end without
+static void flushRecordingMovie()
+{
+	if(!currMovieData.indexedFlag || !osRecordingMovie) return;
+	osRecordingMovie->fseek(currMovieData.indexedEnd, SEEK_SET);
+	writeRecordsChunk(currMovieData, osRecordingMovie, indexedFramesWritten(currMovieData), currMovieData.records.size());
+	osRecordingMovie->fflush();
+}
+
+//a keyframe for the frame that is about to run. it goes in the file, and from then on is read back from there
+static void recordKeyframe()
+{
+	MovieKeyframe key;
+	key.frame = currFrameCounter;
+	key.offset = -1;
+	key.size = 0;
+	MovieData::dumpSavestateTo(&key.state, Z_DEFAULT_COMPRESSION);
+
+	flushRecordingMovie();
+	osRecordingMovie->fseek(currMovieData.indexedEnd, SEEK_SET);
+	writeKeyframeChunk(currMovieData, osRecordingMovie, key);
+	osRecordingMovie->fflush();
+	std::vector<u8>().swap(key.state);
+	currMovieData.keyframes.push_back(key);
+}
+
+//cuts the file back to the chunks up to frame, then writes the records after them again
+static void cutIndexedMovie(int frame)
+{
+	std::vector<MovieChunk>& chunks = currMovieData.chunks;
+	size_t kept = 0;
+	while(kept < chunks.size() && chunks[kept].frame <= frame)
+		kept++;
+	if(kept < chunks.size())
+		currMovieData.indexedEnd = chunks[kept].offset;
+	chunks.resize(kept);
+
+	osRecordingMovie->truncate(currMovieData.indexedEnd);
+	osRecordingMovie->fseek(8, SEEK_SET);
+	write32le(currMovieData.rerecordCount, osRecordingMovie);
+	flushRecordingMovie();
+}
+
+//the index of an indexed movie, for a movie (a savestate's) that agrees with it on the first frames
+static void adoptMovieIndex(MovieData& to, const MovieData& from, int frames)
+{
+	to.indexedFlag = true;
+	to.indexedEnd = from.indexedEnd;
+	to.chunks.clear();
+	for(size_t i=0;i<from.chunks.size();i++)
+	{
+		if(from.chunks[i].frame > frames)
+		{
+			to.indexedEnd = from.chunks[i].offset;
+			break;
+		}
+		to.chunks.push_back(from.chunks[i]);
+	}
+	to.keyframes.clear();
+	for(size_t i=0;i<from.keyframes.size() && from.keyframes[i].frame <= frames;i++)
+		to.keyframes.push_back(from.keyframes[i]);
+}
+
 static void closeRecordingMovie()
 {
 	if(osRecordingMovie)
 	{
+		flushRecordingMovie();
 		delete osRecordingMovie;
 		osRecordingMovie = 0;
 	}
@@ -533,10 +950,16 @@ const char* _CDECL_ FCEUI_LoadMovie(const char *fname, bool _read_only, bool tas
 	bool loadedfm2 = false;
 	bool opened = false;
 //	{
-		EMUFILE* fp = new EMUFILE_FILE(fname, "rb");
+		EMUFILE* fp = new EMUFILE_MMAP(fname);
 //		if(fs.is_open())
 //		{
-			loadedfm2 = LoadFM2(currMovieData, fp, INT_MAX, false);
+			loadedfm2 = LoadDSMB(currMovieData, fp);
+			if(!loadedfm2)
+			{
+				currMovieData = MovieData();
+				fp->fseek(0,SEEK_SET);
+				loadedfm2 = LoadFM2(currMovieData, fp, INT_MAX, false);
+			}
 			opened = true;
 //		}
 //		fs.close();
@@ -602,7 +1025,18 @@ const char* _CDECL_ FCEUI_LoadMovie(const char *fname, bool _read_only, bool tas
 static void openRecordingMovie(const char* fname)
 {
 	//osRecordingMovie = FCEUD_UTF8_fstream(fname, "wb");
-	osRecordingMovie = new EMUFILE_FILE(fname, "wb");
+	osRecordingMovie = new EMUFILE_MOVIE_RECORDING(fname, "wb");
+	//the indexed movies are read back from (their keyframes) and cut back in place, so they are opened for both
+	if(isIndexedMovieFilename(fname) && !osRecordingMovie->fail())
+	{
+		delete osRecordingMovie;
+		osRecordingMovie = new EMUFILE_MOVIE_RECORDING(fname, "r+b");
+	}
+	if(osRecordingMovie->fail())
+	{
+		delete osRecordingMovie;
+		osRecordingMovie = 0;
+	}
 	/*if(!osRecordingMovie)
 		FCEU_PrintError("Error opening movie output file: %s",fname);*/
 	strcpy(curMovieFilename, fname);
@@ -666,9 +1100,10 @@ void FCEUI_SaveMovie(const char *fname, std::wstring author, int flag, std::stri
 
 	currMovieData = MovieData();
 	currMovieData.guid.newGuid();
+	currMovieData.indexedFlag = isIndexedMovieFilename(fname);
 
 	if(author != L"") currMovieData.comments.push_back(L"author " + author);
-	currMovieData.romChecksum = gameInfo.crc;
+	currMovieData.romChecksum = gameInfo.getCRC();
 	currMovieData.romSerial = gameInfo.ROMserial;
 	currMovieData.romFilename = path.GetRomName();
 	currMovieData.rtcStart = rtcstart;
@@ -690,7 +1125,13 @@ void FCEUI_SaveMovie(const char *fname, std::wstring author, int flag, std::stri
 		EMUFILE::readAllBytes(&currMovieData.sram, sramfname);
 
 	//we are going to go ahead and dump the header. from now on we will only be appending frames
-	currMovieData.dump(osRecordingMovie, false);
+	if(osRecordingMovie)
+	{
+		if(currMovieData.indexedFlag)
+			currMovieData.dumpIndexed(osRecordingMovie);
+		else
+			currMovieData.dump(osRecordingMovie, false);
+	}
 
 	currFrameCounter=0;
 	lagframecounter=0;
@@ -775,8 +1216,20 @@ void FCEUI_SaveMovie(const char *fname, std::wstring author, int flag, std::stri
 		 //assert(nds.touchX == input.touch.touchX && nds.touchY == input.touch.touchY);
 		 //assert((mr.touch.x << 4) == nds.touchX && (mr.touch.y << 4) == nds.touchY);
 
-		 mr.dump(osRecordingMovie);
-		 currMovieData.records.push_back(mr);
+		 if(currMovieData.indexedFlag)
+		 {
+			 if(osRecordingMovie && movie_keyframe_interval > 0 && currFrameCounter % movie_keyframe_interval == 0
+				 && (currMovieData.keyframes.empty() || currMovieData.keyframes.back().frame < currFrameCounter))
+				 recordKeyframe();
+			 currMovieData.records.push_back(mr);
+			 if((int)currMovieData.records.size() - indexedFramesWritten(currMovieData) >= kPendingRecords)
+				 flushRecordingMovie();
+		 }
+		 else
+		 {
+			 if(osRecordingMovie) mr.dump(osRecordingMovie);
+			 currMovieData.records.push_back(mr);
+		 }
 
 		 // it's apparently un-threadsafe to do this here
 		 // (causes crazy flickering in other OSD elements, at least)
@@ -814,7 +1267,7 @@ void mov_savestate(EMUFILE* fp)
 	//if(movieMode == MOVIEMODE_RECORD || movieMode == MOVIEMODE_PLAY)
 	//	return currMovieData.dump(os, true);
 	//else return 0;
-	if(movieMode != MOVIEMODE_INACTIVE)
+	if(movieMode != MOVIEMODE_INACTIVE && !movieKeyframeIO)
 	{
 		write32le(kMOVI,fp);
 		currMovieData.dump(fp, true);
@@ -861,6 +1314,12 @@ bool mov_loadstate(EMUFILE* fp, int size)
 
 	u32 cookie;
 	if(read32le(&cookie,fp) != 1) return false;
+	if(movieKeyframeIO)
+	{
+		//a keyframe of the movie that is playing
+		load_successful = true;
+		return true;
+	}
 	if(cookie == kNOMO)
 	{
 		if(movieMode == MOVIEMODE_RECORD || movieMode == MOVIEMODE_PLAY)
@@ -972,6 +1431,15 @@ bool mov_loadstate(EMUFILE* fp, int size)
 
 		if(!movie_readonly)
 		{
+			//the savestate's movie has none of the index, which is kept for as long as the two agree
+			if(currMovieData.indexedFlag)
+			{
+				int agree = 0;
+				const int common = std::min(tempMovieData.getNumRecords(), currMovieData.getNumRecords());
+				while(agree < common && tempMovieData.records[agree].Compare(currMovieData.records[agree]))
+					agree++;
+				adoptMovieIndex(tempMovieData, currMovieData, agree);
+			}
 			currMovieData = tempMovieData;
 			currMovieData.rerecordCount = currRerecordCount;
 		}
@@ -1020,15 +1488,29 @@ bool mov_loadstate(EMUFILE* fp, int size)
 			currMovieData.rerecordCount = currRerecordCount;
 			currMovieData.truncateAt(currFrameCounter);
 
-			openRecordingMovie(curMovieFilename);
+			if(currMovieData.indexedFlag)
+			{
+				osRecordingMovie = new EMUFILE_MOVIE_RECORDING(curMovieFilename, "r+b");
+				if(osRecordingMovie->fail())
+				{
+					delete osRecordingMovie;
+					osRecordingMovie = 0;
+				}
+			}
+			else
+				openRecordingMovie(curMovieFilename);
 			if(!osRecordingMovie)
 			{
 			   osd->setLineColor(255, 0, 0);
 			   osd->addLine("Can't save movie file!");
 			}
-
-			//printf("DUMPING MOVIE: %d FRAMES\n",currMovieData.records.size());
-			currMovieData.dump(osRecordingMovie, false);
+			else if(currMovieData.indexedFlag)
+				cutIndexedMovie(currFrameCounter);
+			else
+			{
+				//printf("DUMPING MOVIE: %d FRAMES\n",currMovieData.records.size());
+				currMovieData.dump(osRecordingMovie, false);
+			}
 			movieMode = MOVIEMODE_RECORD;
 		}
 	}
@@ -1039,6 +1521,32 @@ bool mov_loadstate(EMUFILE* fp, int size)
 	return true;
 }
 
+int FCEUI_MovieSeek(int frame)
+{
+	if(movieMode == MOVIEMODE_INACTIVE) return -1;
+
+	const MovieKeyframe* key = currMovieData.findKeyframe(frame);
+	if(!key) return -1;
+	std::vector<u8> state;
+	if(!readKeyframeState(*key, &state) || !MovieData::loadSavestateFrom(&state))
+		return -1;
+	currFrameCounter = key->frame;
+
+	//only the indexed movies have keyframes, so there is only the one way to cut it back
+	if(movieMode == MOVIEMODE_RECORD)
+	{
+		currRerecordCount++;
+		currMovieData.rerecordCount = currRerecordCount;
+		currMovieData.truncateAt(currFrameCounter);
+		if(osRecordingMovie)
+			cutIndexedMovie(currFrameCounter);
+	}
+	else if(movieMode == MOVIEMODE_FINISHED && currFrameCounter < currMovieData.getNumRecords())
+		movieMode = MOVIEMODE_PLAY;
+
+	return currFrameCounter;
+}
+
 static void FCEUMOV_PreLoad(void)
 {
 	load_successful=0;
@@ -62,6 +62,25 @@ enum EMOVIECMD
 
 //RLDUTSBAYXWEG
 
+//a savestate from the start of a frame of an indexed movie, so that seeking only has to go as far back as the one before
+struct MovieKeyframe
+{
+	int frame;
+	//where the state is in the movie file, or -1 while it is only in state
+	int offset;
+	int size;
+	std::vector<u8> state;
+};
+
+//where a chunk of an indexed movie file starts, and the frame it goes up to: the frame after its last record,
+//or the frame of its keyframe. cutting the file back to a frame keeps the chunks up to that frame
+struct MovieChunk
+{
+	int offset;
+	int frame;
+	bool keyframe;
+};
+
 class MovieData;
 class MovieRecord
 {
@@ -155,6 +174,13 @@ public:
 	//was the frame data stored in binary?
 	bool binaryFlag;
 
+	//is it the indexed binary format (LoadDSMB), which keeps keyframes to seek to?
+	bool indexedFlag;
+	std::vector<MovieKeyframe> keyframes;
+	std::vector<MovieChunk> chunks;
+	//the end of the last whole chunk in the file
+	int indexedEnd;
+
 	int getNumRecords() { return records.size(); }
 
 	class TDictionary : public std::map<std::string,std::string>
@@ -188,6 +214,11 @@ public:
 	void truncateAt(int frame);
 	void installValue(std::string& key, std::string& val);
 	int dump(EMUFILE* fp, bool binary);
+	void dumpHeader(EMUFILE* fp, bool binary);
+	//the whole indexed file, with the records between the keyframes. the keyframes must have their states
+	int dumpIndexed(EMUFILE* fp);
+	//the last keyframe at or before frame, or NULL
+	const MovieKeyframe* findKeyframe(int frame);
 	void clearRecordRange(int start, int len);
 	void insertEmpty(int at, int frames);
 	
@@ -226,6 +257,15 @@ void mov_savestate(EMUFILE* fp);
 bool mov_loadstate(EMUFILE* fp, int size);
 void LoadFM2_binarychunk(MovieData& movieData, EMUFILE* fp, int size);
 bool LoadFM2(MovieData& movieData, EMUFILE* fp, int size, bool stopAfterHeader);
+//the indexed binary movies (.dsmb): a header and then chunks, of records and of keyframes, in frame order.
+//the file only ever gets chunks added at the end, or gets cut back at the end of one, so a rerecord writes
+//no more than the records since the last keyframe
+bool LoadDSMB(MovieData& movieData, EMUFILE* fp);
+//loads the last keyframe at or before frame and returns its frame, from where the movie plays on as usual,
+//or -1 if there is none. while recording, the movie is cut back to there as a rerecord
+int FCEUI_MovieSeek(int frame);
+//how many frames apart the keyframes of an indexed movie are recorded; 0 records none
+extern int movie_keyframe_interval;
 extern bool movie_readonly;
 extern bool ShowInputDisplay;
 void FCEUI_MakeBackupMovie(bool dispMessage);
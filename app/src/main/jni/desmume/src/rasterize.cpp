@@ -54,6 +54,16 @@
 #include "MMU.h"
 #include "NDSSystem.h"
 #include "utils/task.h"
+#include "utils/tablegen.h"
+#include "frameprofile.h"
+#include "hostmem.h"
+#include "gamepreset.h"
+
+#ifdef ENABLE_NEON
+#include <arm_neon.h>
+#endif
+
+//#define _SHOW_HIZ_COUNTERS	// print how many span runs the hi-z buffer rejected each frame
 
 //#undef FORCEINLINE
 //#define FORCEINLINE
@@ -71,10 +81,13 @@ template<typename T> T _max(T a, T b, T c, T d) { return max(_max(a,b,d),c); }
 
 static const int kUnsetTranslucentPolyID = 255;
 
-static u8 modulate_table[64][64];
-static u8 decal_table[32][64][64];
-static u8 index_lookup_table[65];
-static u8 index_start_table[8];
+//modulate_table[i][j] = ((i+1)*(j+1)-1)>>6 and decal_table[a][i][j] = (i*a + j*(31-a))>>5, worked out by the compiler
+#define MODULATE_ENTRY(n) (u8)((((((n)>>6)+1) * (((n)&63)+1)) - 1) >> 6)
+#define DECAL_ENTRY(n) (u8)(((((n)>>6)&63)*((n)>>12) + ((n)&63)*(31-((n)>>12))) >> 5)
+static const CACHE_ALIGN u8 modulate_table[64][64] = { TABLE_4096(MODULATE_ENTRY) };
+static const CACHE_ALIGN u8 decal_table[32][64][64] = { TABLE_131072(DECAL_ENTRY) };
+#undef MODULATE_ENTRY
+#undef DECAL_ENTRY
 
 static bool softRastHasNewData = false;
 
@@ -124,8 +137,10 @@ static FORCEINLINE int fastFloor(float f)
 //	verts[vert_index] = &rawvert;
 //}
 
-static Fragment _screen[GFX3D_FRAMEBUFFER_WIDTH*GFX3D_FRAMEBUFFER_HEIGHT];
-static FragmentColor _screenColor[GFX3D_FRAMEBUFFER_WIDTH*GFX3D_FRAMEBUFFER_HEIGHT];
+//these are sized for the internal resolution, which is a multiple of the native one
+static std::vector<Fragment> _screen;
+static std::vector<FragmentColor> _screenColor;
+static int softRastScale = 1;
 
 static FORCEINLINE int iround(float f) {
 	return (int)f; //lol
@@ -195,15 +210,78 @@ static FORCEINLINE int Ceil28_4( fixed28_4 Value ) {
 	return ReturnValue;
 }
 
-struct edge_fx_fl {
+//the x stepping (a DDA over the 28.4 coords) which both kinds of edges are built on
+struct edge_fx {
+	long X, XStep, Numerator, Denominator;			// DDA info for x
+	long ErrorTerm;
+	int Y, Height;					// current y and vertical count
+
+	//sets up the stepping from the top vert down to the bottom one.
+	//returns false when both land on the same pixel, leaving nothing to interpolate between
+	FORCEINLINE bool setup(fixed28_4 xTop, fixed28_4 yTop, fixed28_4 xBottom, fixed28_4 yBottom, bool& failure)
+	{
+		Y = Ceil28_4(yTop);
+		int YEnd = Ceil28_4(yBottom);
+		Height = YEnd - Y;
+		X = Ceil28_4(xTop);
+		int XEnd = Ceil28_4(xBottom);
+		int Width = XEnd - X; // can be negative
+
+		// even if Height == 0, give some info for horizontal line poly
+		if(Height != 0 || Width != 0)
+		{
+			long dN = long(yBottom - yTop);
+			long dM = long(xBottom - xTop);
+			if (dN != 0)
+			{
+				long InitialNumerator = (long)(dM*16*Y - dM*yTop + dN*xTop - 1 + dN*16);
+				FloorDivMod(InitialNumerator,dN*16,X,ErrorTerm,failure);
+				FloorDivMod(dM*16,dN*16,XStep,Numerator,failure);
+				Denominator = dN*16;
+			}
+			else
+			{
+				XStep = Width;
+				Numerator = 0;
+				ErrorTerm = 0;
+				Denominator = 1;
+			}
+			return true;
+		}
+		else
+		{
+			// even if Width == 0 && Height == 0, give some info for pixel poly
+			// example: Castlevania Portrait of Ruin, warp stone
+			XStep = 1;
+			Numerator = 0;
+			Denominator = 1;
+			ErrorTerm = 0;
+			return false;
+		}
+	}
+
+	//steps down to the next scanline. returns true if x took the extra step for the error term
+	FORCEINLINE bool stepX()
+	{
+		X += XStep; Y++; Height--;
+		ErrorTerm += Numerator;
+		if(ErrorTerm >= Denominator) {
+			X++;
+			ErrorTerm -= Denominator;
+			return true;
+		}
+		return false;
+	}
+};
+
+struct edge_fx_fl : edge_fx {
+	typedef VERT Vert;
+
 	edge_fx_fl() {}
 	edge_fx_fl(int Top, int Bottom, VERT** verts, bool& failure);
 	FORCEINLINE int Step();
 
 	VERT** verts;
-	long X, XStep, Numerator, Denominator;			// DDA info for x
-	long ErrorTerm;
-	int Y, Height;					// current y and vertical count
 	
 	struct Interpolant {
 		float curr, step, stepExtra;
@@ -236,33 +314,12 @@ struct edge_fx_fl {
 
 FORCEINLINE edge_fx_fl::edge_fx_fl(int Top, int Bottom, VERT** verts, bool& failure) {
 	this->verts = verts;
-	Y = Ceil28_4((fixed28_4)verts[Top]->y);
-	int YEnd = Ceil28_4((fixed28_4)verts[Bottom]->y);
-	Height = YEnd - Y;
-	X = Ceil28_4((fixed28_4)verts[Top]->x);
-	int XEnd = Ceil28_4((fixed28_4)verts[Bottom]->x);
-	int Width = XEnd - X; // can be negative
-
-	// even if Height == 0, give some info for horizontal line poly
-	if(Height != 0 || Width != 0)
+	if(setup((fixed28_4)verts[Top]->x, (fixed28_4)verts[Top]->y, (fixed28_4)verts[Bottom]->x, (fixed28_4)verts[Bottom]->y, failure))
 	{
 		long dN = long(verts[Bottom]->y - verts[Top]->y);
 		long dM = long(verts[Bottom]->x - verts[Top]->x);
-		if (dN != 0)
-		{
-			long InitialNumerator = (long)(dM*16*Y - dM*verts[Top]->y + dN*verts[Top]->x - 1 + dN*16);
-			FloorDivMod(InitialNumerator,dN*16,X,ErrorTerm,failure);
-			FloorDivMod(dM*16,dN*16,XStep,Numerator,failure);
-			Denominator = dN*16;
-		}
-		else
-		{
-			XStep = Width;
-			Numerator = 0;
-			ErrorTerm = 0;
-			Denominator = 1;
+		if (dN == 0)
 			dN = 1;
-		}
 	
 		float YPrestep = Fixed28_4ToFloat((fixed28_4)(Y*16 - verts[Top]->y));
 		float XPrestep = Fixed28_4ToFloat((fixed28_4)(X*16 - verts[Top]->x));
@@ -279,12 +336,6 @@ FORCEINLINE edge_fx_fl::edge_fx_fl(int Top, int Bottom, VERT** verts, bool& fail
 	}
 	else
 	{
-		// even if Width == 0 && Height == 0, give some info for pixel poly
-		// example: Castlevania Portrait of Ruin, warp stone
-		XStep = 1;
-		Numerator = 0;
-		Denominator = 1;
-		ErrorTerm = 0;
 		invw.initialize(1/verts[Top]->w);
 		u.initialize(verts[Top]->u);
 		v.initialize(verts[Top]->v);
@@ -295,19 +346,134 @@ FORCEINLINE edge_fx_fl::edge_fx_fl(int Top, int Bottom, VERT** verts, bool& fail
 }
 
 FORCEINLINE int edge_fx_fl::Step() {
-	X += XStep; Y++; Height--;
+	const bool extra = stepX();
 	doStepInterpolants();
-
-	ErrorTerm += Numerator;
-	if(ErrorTerm >= Denominator) {
-		X++;
-		ErrorTerm -= Denominator;
+	if(extra)
 		doStepExtraInterpolants();
-	}
 	return Height;
 }	
 
+//a clipped vert converted to integers for the fixed point rasterizer
+struct FixedVert
+{
+	fixed28_4 x, y;
+	s32 w; //normalized to 16 bits for each poly, as the DS does
+	s32 z; //depth buffer value with 9 more fractional bits
+	s32 u, v; //texcoords in texels, with 4 fractional bits as the DS gets them
+	s32 color[3]; //6 bit colors with 4 fractional bits
+};
+
+//works out the values at a point partway along a run between two points the way the DS does:
+//perspective correct with a weight of PRECISION bits (9 down edges, 8 across spans),
+//or linear with full precision when both ends have the same w, which is the case for most 2D polys
+template<int PRECISION>
+struct FixedInterpolator
+{
+	s32 factor, linearFactor;
+	int shift;
+
+	//the point is pos along a run of len, and recip is (1<<30)/len
+	FORCEINLINE void setup(s32 pos, s32 len, s32 recip, s32 w0, s32 w1)
+	{
+		if(len <= 0)
+		{
+			factor = linearFactor = 0;
+			shift = 30;
+			return;
+		}
+
+		linearFactor = (pos >= len) ? (1<<30) : pos*recip;
+		if(w0 == w1)
+		{
+			factor = linearFactor;
+			shift = 30;
+		}
+		else
+		{
+			factor = (s32)((((s64)w0*pos) << PRECISION) / ((s64)w0*pos + (s64)w1*(len-pos)));
+			shift = PRECISION;
+		}
+	}
+
+	static FORCEINLINE s32 recip(s32 len) { return len > 0 ? (1<<30)/len : 0; }
+
+	//perspective correct value
+	FORCEINLINE s32 operator()(s32 a0, s32 a1) const { return lerp(a0, a1, factor, shift); }
+	//screen space linear value, which is how z goes
+	FORCEINLINE s32 linear(s32 a0, s32 a1) const { return lerp(a0, a1, linearFactor, 30); }
+
+	//always steps up from the smaller value, so that the rounding doesn't depend on which way round the ends are
+	static FORCEINLINE s32 lerp(s32 a0, s32 a1, s32 f, int shift)
+	{
+		if(a0 <= a1) return a0 + (s32)(((s64)(a1-a0)*f) >> shift);
+		else return a1 + (s32)(((s64)(a0-a1)*((1<<shift)-f)) >> shift);
+	}
+};
+
+//the edge for the fixed point rasterizer. rather than stepping its values down the edge in floats,
+//it works them out at each scanline from how far it is along the edge
+struct edge_fx_fx : edge_fx {
+	typedef FixedVert Vert;
+
+	edge_fx_fx() {}
+	edge_fx_fx(int Top, int Bottom, FixedVert** verts, bool& failure);
+	FORCEINLINE int Step();
+
+	const FixedVert *top, *bottom;
+	s32 yOffset, yLength, yRecip; //28.4 distances of the current scanline and the bottom vert from the top vert
+
+	//values at the current scanline
+	s32 w, z, u, v, color[3];
+
+	FORCEINLINE void interpolate()
+	{
+		FixedInterpolator<9> interp;
+		interp.setup(min(yOffset, yLength), yLength, yRecip, top->w, bottom->w);
+		w = interp(top->w, bottom->w);
+		z = interp.linear(top->z, bottom->z);
+		u = interp(top->u, bottom->u);
+		v = interp(top->v, bottom->v);
+		for(int i=0;i<3;i++)
+			color[i] = interp(top->color[i], bottom->color[i]);
+	}
+};
+
+FORCEINLINE edge_fx_fx::edge_fx_fx(int Top, int Bottom, FixedVert** verts, bool& failure) {
+	top = verts[Top];
+	bottom = verts[Bottom];
+	setup(top->x, top->y, bottom->x, bottom->y, failure);
+	yOffset = Y*16 - top->y;
+	yLength = bottom->y - top->y;
+	yRecip = FixedInterpolator<9>::recip(yLength);
+	interpolate();
+}
+
+FORCEINLINE int edge_fx_fx::Step() {
+	stepX();
+	yOffset += 16;
+	interpolate();
+	return Height;
+}
+
+//the number of pixels a scanline between two edges covers
+static FORCEINLINE int scanlineWidth(const edge_fx *pLeft, const edge_fx *pRight, bool lineHack)
+{
+	int width = pRight->X - pLeft->X;
+
+	// HACK: workaround for vertical/slant line poly
+	if (lineHack && width == 0)
+	{
+		int leftWidth = pLeft->XStep;
+		if (pLeft->ErrorTerm + pLeft->Numerator >= pLeft->Denominator)
+			leftWidth++;
+		int rightWidth = pRight->XStep;
+		if (pRight->ErrorTerm + pRight->Numerator >= pRight->Denominator)
+			rightWidth++;
+		width = max(1, max(abs(leftWidth), abs(rightWidth)));
+	}
 
+	return width;
+}
 
 static FORCEINLINE void alphaBlend(FragmentColor & dst, const FragmentColor & src)
 {
@@ -342,6 +508,53 @@ static FORCEINLINE void alphaBlend(FragmentColor & dst, const FragmentColor & sr
 	}
 }
 
+#ifdef ENABLE_NEON
+//helpers for RasterizerUnit::pixel4. a uint8x16_t holds four FragmentColors, with alpha in the top byte of each.
+
+static FORCEINLINE uint8x16_t neonAlphaLanes()
+{
+	return vreinterpretq_u8_u32(vdupq_n_u32(0xFF000000));
+}
+
+//GFX3D_5TO6 applied to every byte
+static FORCEINLINE uint8x16_t neon5to6(uint8x16_t x)
+{
+	return vandq_u8(vorrq_u8(vshlq_n_u8(x, 1), vdupq_n_u8(1)), vtstq_u8(x, x));
+}
+
+//modulate_table applied to every byte: ((a+1)*(b+1)-1)>>6
+static FORCEINLINE uint8x16_t neonModulate(uint8x16_t a, uint8x16_t b)
+{
+	const uint8x16_t one = vdupq_n_u8(1);
+	a = vaddq_u8(a, one);
+	b = vaddq_u8(b, one);
+	uint16x8_t lo = vsubq_u16(vmull_u8(vget_low_u8(a), vget_low_u8(b)), vdupq_n_u16(1));
+	uint16x8_t hi = vsubq_u16(vmull_u8(vget_high_u8(a), vget_high_u8(b)), vdupq_n_u16(1));
+	return vcombine_u8(vshrn_n_u16(lo, 6), vshrn_n_u16(hi, 6));
+}
+
+//same as the modulate shader mode
+static FORCEINLINE uint8x16_t neonShadeModulate(uint8x16_t tex, uint8x16_t mat)
+{
+	const uint8x16_t alphaLanes = neonAlphaLanes();
+	tex = vbslq_u8(alphaLanes, neon5to6(tex), tex);
+	mat = vbslq_u8(alphaLanes, neon5to6(mat), mat);
+	uint8x16_t ret = neonModulate(tex, mat);
+	return vbslq_u8(alphaLanes, vshrq_n_u8(ret, 1), ret);
+}
+
+//same as the decal shader mode: decal_table for the colors, material alpha
+static FORCEINLINE uint8x16_t neonShadeDecal(uint8x16_t tex, uint8x16_t mat)
+{
+	uint8x16_t a = vreinterpretq_u8_u32(vmulq_n_u32(vshrq_n_u32(vreinterpretq_u32_u8(tex), 24), 0x01010101));
+	uint8x16_t invA = vsubq_u8(vdupq_n_u8(31), a);
+	uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(tex), vget_low_u8(a)), vget_low_u8(mat), vget_low_u8(invA));
+	uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(tex), vget_high_u8(a)), vget_high_u8(mat), vget_high_u8(invA));
+	uint8x16_t ret = vcombine_u8(vshrn_n_u16(lo, 5), vshrn_n_u16(hi, 5));
+	return vbslq_u8(neonAlphaLanes(), mat, ret);
+}
+#endif
+
 // TODO: wire-frame
 struct PolyAttr
 {
@@ -356,6 +569,9 @@ struct PolyAttr
 	bool translucent;
 	u8 fogged;
 
+	//a shadow poly with id 0, which only marks where the shadow volume goes in the stencil
+	bool isShadowMask() const { return ((val>>4)&0x3) == 3 && polyid == 0; }
+
 	bool isVisible(bool backfacing) 
 	{
 		//this was added after adding multi-bit stencil buffer
@@ -394,11 +610,16 @@ class RasterizerUnit
 {
 public:
 
-	int SLI_MASK, SLI_VALUE;
+	int tileTop, tileBottom;
+	u32 hizTested, hizRejected;
 	bool _debug_thisPoly;
 
 	RasterizerUnit()
-		: _debug_thisPoly(false)
+		: tileTop(0)
+		, tileBottom(0)
+		, hizTested(0)
+		, hizRejected(0)
+		, _debug_thisPoly(false)
 	{
 	}
 
@@ -406,6 +627,14 @@ public:
 	
 	VERT* verts[MAX_CLIPPED_VERTS];
 
+	//the current poly's verts for the fixed point rasterizer
+	FixedVert fixedVertData[MAX_CLIPPED_VERTS];
+	FixedVert* fixedVerts[MAX_CLIPPED_VERTS];
+	int wShift; //turns the normalized w of the current poly back into 20.12
+
+	VERT** shapeVerts(VERT*) { return verts; }
+	FixedVert** shapeVerts(FixedVert*) { return fixedVerts; }
+
     PolyAttr polyAttr;
 	int polynum;
 
@@ -500,9 +729,18 @@ public:
 			iv = round_s(v);
 		}
 		
+		return sampleTexel(iu, iv);
+	}
+
+	//fetches the texel at integer texcoords, before wrapping
+	FORCEINLINE FragmentColor sampleTexel(s32 iu, s32 iv)
+	{
+		static const FragmentColor white = MakeFragmentColor(63,63,63,31);
+		if(!sampler.enabled) return white;
+
 		sampler.dowrap(iu, iv);
 		FragmentColor color;
-		color.color = ((u32*)lastTexKey->decoded)[(iv<<sampler.wshift)+iu];
+		color.color = ((u32*)lastTexKey->views[TexFormat_15bpp].decoded)[(iv<<sampler.wshift)+iu];
 		return color;
 	}
 
@@ -522,17 +760,50 @@ public:
 		FragmentColor materialColor;
 	} shader;
 
+	FORCEINLINE void shadeToon(FragmentColor& dst, const FragmentColor& texColor)
+	{
+		FragmentColor toonColor = engine->toonTable[shader.materialColor.r>>1];
+	
+		if(gfx3d.renderState.shading == GFX3D_State::HIGHLIGHT)
+		{
+			dst.r = modulate_table[texColor.r][shader.materialColor.r];
+			dst.g = modulate_table[texColor.g][shader.materialColor.r];
+			dst.b = modulate_table[texColor.b][shader.materialColor.r];
+			dst.a = modulate_table[GFX3D_5TO6(texColor.a)][GFX3D_5TO6(shader.materialColor.a)]>>1;
+
+			dst.r = min<u8>(63, (dst.r + toonColor.r));
+			dst.g = min<u8>(63, (dst.g + toonColor.g));
+			dst.b = min<u8>(63, (dst.b + toonColor.b));
+		}
+		else
+		{
+			dst.r = modulate_table[texColor.r][toonColor.r];
+			dst.g = modulate_table[texColor.g][toonColor.g];
+			dst.b = modulate_table[texColor.b][toonColor.b];
+			dst.a = modulate_table[GFX3D_5TO6(texColor.a)][GFX3D_5TO6(shader.materialColor.a)]>>1;
+		}
+	}
+
+	//whether the current shader mode looks at the texture at all
+	FORCEINLINE bool shaderUsesTexture() const
+	{
+		return shader.mode == 0 || shader.mode == 2 || (shader.mode == 1 && sampler.enabled);
+	}
+
 	FORCEINLINE void shade(FragmentColor& dst)
 	{
 		FragmentColor texColor;
-		float u,v;
+		if(shaderUsesTexture())
+			texColor = sample(shader.invu*shader.w, shader.invv*shader.w);
+		shade(dst, texColor);
+	}
 
+	//combines the material color with texColor, which is only valid if shaderUsesTexture()
+	FORCEINLINE void shade(FragmentColor& dst, const FragmentColor& texColor)
+	{
 		switch(shader.mode)
 		{
 		case 0: //modulate
-			u = shader.invu*shader.w;
-			v = shader.invv*shader.w;
-			texColor = sample(u,v);
 			dst.r = modulate_table[texColor.r][shader.materialColor.r];
 			dst.g = modulate_table[texColor.g][shader.materialColor.g];
 			dst.b = modulate_table[texColor.b][shader.materialColor.b];
@@ -553,9 +824,6 @@ public:
 		case 1: //decal
 			if(sampler.enabled)
 			{
-				u = shader.invu*shader.w;
-				v = shader.invv*shader.w;
-				texColor = sample(u,v);
 				dst.r = decal_table[texColor.a][texColor.r][shader.materialColor.r];
 				dst.g = decal_table[texColor.a][texColor.g][shader.materialColor.g];
 				dst.b = decal_table[texColor.a][texColor.b][shader.materialColor.b];
@@ -563,32 +831,7 @@ public:
 			} else dst = shader.materialColor;
 			break;
 		case 2: //toon/highlight shading
-			{
-				u = shader.invu*shader.w;
-				v = shader.invv*shader.w;
-				texColor = sample(u,v);
-				FragmentColor toonColor = engine->toonTable[shader.materialColor.r>>1];
-			
-				if(gfx3d.renderState.shading == GFX3D_State::HIGHLIGHT)
-				{
-					dst.r = modulate_table[texColor.r][shader.materialColor.r];
-					dst.g = modulate_table[texColor.g][shader.materialColor.r];
-					dst.b = modulate_table[texColor.b][shader.materialColor.r];
-					dst.a = modulate_table[GFX3D_5TO6(texColor.a)][GFX3D_5TO6(shader.materialColor.a)]>>1;
-
-					dst.r = min<u8>(63, (dst.r + toonColor.r));
-					dst.g = min<u8>(63, (dst.g + toonColor.g));
-					dst.b = min<u8>(63, (dst.b + toonColor.b));
-				}
-				else
-				{
-					dst.r = modulate_table[texColor.r][toonColor.r];
-					dst.g = modulate_table[texColor.g][toonColor.g];
-					dst.b = modulate_table[texColor.b][toonColor.b];
-					dst.a = modulate_table[GFX3D_5TO6(texColor.a)][GFX3D_5TO6(shader.materialColor.a)]>>1;
-				}
-
-			}
+			shadeToon(dst, texColor);
 			break;
 		case 3: //shadows
 			//is this right? only with the material color?
@@ -602,11 +845,30 @@ public:
 		shader.mode = (polyattr>>4)&0x3;
 	}
 
-	FORCEINLINE void pixel(int adr,float r, float g, float b, float invu, float invv, float w, float z)
+	//values of the interpolants at one pixel of a span, or their steps from one pixel to the next
+	struct SpanValues
 	{
-		Fragment &destFragment = engine->screen[adr];
-		FragmentColor &destFragmentColor = engine->screenColor[adr];
+		float invw, u, v, z, color[3];
+
+		FORCEINLINE void advance(const SpanValues &step, float count)
+		{
+			invw += step.invw * count;
+			u += step.u * count;
+			v += step.v * count;
+			z += step.z * count;
+			color[0] += step.color[0] * count;
+			color[1] += step.color[1] * count;
+			color[2] += step.color[2] * count;
+		}
+
+		//the w and z of the pixel k steps into the run. every path that computes a fragment depth goes through these,
+		//so that a pixel gets the same depth whichever of them draws it (decals depend on that for their equal test)
+		FORCEINLINE float wAt(const SpanValues &step, float k) const { return 1.0f/(invw + step.invw*k); }
+		FORCEINLINE float zAt(const SpanValues &step, float k) const { return z + step.z*k; }
+	};
 
+	FORCEINLINE u32 fragmentDepth(float w, float z)
+	{
 		u32 depth;
 		if(gfx3d.renderState.wbuffer)
 		{
@@ -619,7 +881,12 @@ public:
 			depth = u32floor(z*0x7FFF);
 			depth <<= 9;
 		}
+		return depth;
+	}
 
+	//depth and shadow tests. returns false if the fragment is discarded, in which case the stencil is already updated
+	FORCEINLINE bool testFragment(Fragment &destFragment, u32 depth)
+	{
 		if(polyAttr.decalMode)
 		{
 			if ( CommonSettings.GFX3D_Zelda_Shadow_Depth_Hack > 0)
@@ -669,30 +936,22 @@ public:
 					goto rejected_fragment;
 			}
 		}
-		
-		shader.w = w;
-		shader.invu = invu;
-		shader.invv = invv;
 
-		//perspective-correct the colors
-		r = (r * w) + 0.5f;
-		g = (g * w) + 0.5f;
-		b = (b * w) + 0.5f;
-
-
-		//this is a HACK: 
-		//we are being very sloppy with our interpolation precision right now
-		//and rather than fix it, i just want to clamp it
-		shader.materialColor.r = max(0U,min(63U,u32floor(r)));
-		shader.materialColor.g = max(0U,min(63U,u32floor(g)));
-		shader.materialColor.b = max(0U,min(63U,u32floor(b)));
+		return true;
 
-		shader.materialColor.a = polyAttr.alpha;
+		depth_fail:
+		if(shader.mode == 3 && polyAttr.polyid == 0)
+			destFragment.stencil++;
+		rejected_fragment:
 
-		//pixel shader
-		FragmentColor shaderOutput;
-		shade(shaderOutput);
+		if(shader.mode == 3 && polyAttr.polyid != 0 && destFragment.stencil)
+			destFragment.stencil--;
+		return false;
+	}
 
+	//writes the shader output of a fragment which passed testFragment
+	FORCEINLINE void writeFragment(Fragment &destFragment, FragmentColor &destFragmentColor, u32 depth, const FragmentColor &shaderOutput)
+	{
 		//we shouldnt do any of this if we generated a totally transparent pixel
 		if(shaderOutput.a != 0)
 		{
@@ -741,67 +1000,156 @@ public:
 		//3. mariokart (no junk beneath platform in kart selector / no shadow beneath grate floor in bowser stage)
 		//(specifically, the shadows in mario kart are complicated concave shapes)
 
-		goto done;
-		depth_fail:
-		if(shader.mode == 3 && polyAttr.polyid == 0)
-			destFragment.stencil++;
 		rejected_fragment:
-		done:
-		;
 
 		if(shader.mode == 3 && polyAttr.polyid != 0 && destFragment.stencil)
 			destFragment.stencil--;
 	}
 
-	//draws a single scanline
-	FORCEINLINE void drawscanline(edge_fx_fl *pLeft, edge_fx_fl *pRight, bool lineHack)
+	FORCEINLINE void pixel(int adr,float r, float g, float b, float invu, float invv, float w, float z)
 	{
-		int XStart = pLeft->X;
-		int width = pRight->X - XStart;
+		Fragment &destFragment = engine->screen[adr];
+
+		u32 depth = fragmentDepth(w, z);
+		if(!testFragment(destFragment, depth))
+			return;
+		
+		shader.w = w;
+		shader.invu = invu;
+		shader.invv = invv;
+
+		//perspective-correct the colors
+		r = (r * w) + 0.5f;
+		g = (g * w) + 0.5f;
+		b = (b * w) + 0.5f;
+
+
+		//this is a HACK: 
+		//we are being very sloppy with our interpolation precision right now
+		//and rather than fix it, i just want to clamp it
+		shader.materialColor.r = max(0U,min(63U,u32floor(r)));
+		shader.materialColor.g = max(0U,min(63U,u32floor(g)));
+		shader.materialColor.b = max(0U,min(63U,u32floor(b)));
+
+		shader.materialColor.a = polyAttr.alpha;
+
+		//pixel shader
+		FragmentColor shaderOutput;
+		shade(shaderOutput);
+
+		writeFragment(destFragment, engine->screenColor[adr], depth, shaderOutput);
+	}
+
+#ifdef ENABLE_NEON
+	//the same as four calls to pixel() for adr..adr+3, with each lane holding one pixel's interpolants.
+	//w and the depth come in already computed by the scalar code, since the depth has to match pixel()'s exactly;
+	//the color conversion and the texture combine run on all four lanes at once, and
+	//the depth/stencil tests, the texel fetches and the framebuffer writes are done per pixel.
+	FORCEINLINE void pixel4(int adr, float32x4_t color[3], float32x4_t invu, float32x4_t invv, const float ws[4], const u32 depth[4])
+	{
+		const float32x4_t w = vld1q_f32(ws);
+
+		//perspective-correct and clamp the colors, then pack them as FragmentColors with the poly alpha
+		const uint32x4_t max63 = vdupq_n_u32(63);
+		const float32x4_t half = vdupq_n_f32(0.5f);
+		uint32x4_t r = vminq_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(color[0], w), half)), max63);
+		uint32x4_t g = vminq_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(color[1], w), half)), max63);
+		uint32x4_t b = vminq_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(color[2], w), half)), max63);
+		uint32x4_t material4 = vorrq_u32(vorrq_u32(r, vshlq_n_u32(g, 8)), vorrq_u32(vshlq_n_u32(b, 16), vdupq_n_u32((u32)polyAttr.alpha << 24)));
+
+		u32 material[4];
+		float u[4], v[4];
+		vst1q_u32(material, material4);
+		vst1q_f32(u, vmulq_f32(invu, w));
+		vst1q_f32(v, vmulq_f32(invv, w));
+
+		const bool textured = shaderUsesTexture();
+		bool passed[4];
+		u32 texColor[4];
+		for(int i=0;i<4;i++)
+		{
+			passed[i] = testFragment(engine->screen[adr+i], depth[i]);
+			texColor[i] = (passed[i] && textured) ? sample(u[i],v[i]).color : 0;
+		}
+		if(!(passed[0] | passed[1] | passed[2] | passed[3]))
+			return;
+
+		u32 shaderOutput[4];
+		switch(shader.mode)
+		{
+		case 0: //modulate
+			vst1q_u32(shaderOutput, vreinterpretq_u32_u8(neonShadeModulate(vreinterpretq_u8_u32(vld1q_u32(texColor)), vreinterpretq_u8_u32(material4))));
+			break;
+		case 1: //decal
+			if(sampler.enabled)
+				vst1q_u32(shaderOutput, vreinterpretq_u32_u8(neonShadeDecal(vreinterpretq_u8_u32(vld1q_u32(texColor)), vreinterpretq_u8_u32(material4))));
+			else
+				vst1q_u32(shaderOutput, material4);
+			break;
+		case 2: //toon/highlight shading goes through the toon table, one pixel at a time
+			for(int i=0;i<4;i++)
+			{
+				if(!passed[i]) continue;
+				FragmentColor tex, dst;
+				tex.color = texColor[i];
+				shader.materialColor.color = material[i];
+				shadeToon(dst, tex);
+				shaderOutput[i] = dst.color;
+			}
+			break;
+		case 3: //shadows
+			vst1q_u32(shaderOutput, material4);
+			break;
+		}
 
-		// HACK: workaround for vertical/slant line poly
-		if (lineHack && width == 0)
+		for(int i=0;i<4;i++)
 		{
-			int leftWidth = pLeft->XStep;
-			if (pLeft->ErrorTerm + pLeft->Numerator >= pLeft->Denominator)
-				leftWidth++;
-			int rightWidth = pRight->XStep;
-			if (pRight->ErrorTerm + pRight->Numerator >= pRight->Denominator)
-				rightWidth++;
-			width = max(1, max(abs(leftWidth), abs(rightWidth)));
+			if(!passed[i]) continue;
+			FragmentColor output;
+			output.color = shaderOutput[i];
+			writeFragment(engine->screen[adr+i], engine->screenColor[adr+i], depth[i], output);
 		}
+	}
+#endif
+
+	//draws a single scanline
+	FORCEINLINE void drawscanline(edge_fx_fl *pLeft, edge_fx_fl *pRight, bool lineHack)
+	{
+		int XStart = pLeft->X;
+		int width = scanlineWidth(pLeft, pRight, lineHack);
 
 		//these are the starting values, taken from the left edge
-		float invw = pLeft->invw.curr;
-		float u = pLeft->u.curr;
-		float v = pLeft->v.curr;
-		float z = pLeft->z.curr;
-		float color[3] = {
-			pLeft->color[0].curr,
-			pLeft->color[1].curr,
-			pLeft->color[2].curr };
+		SpanValues start;
+		start.invw = pLeft->invw.curr;
+		start.u = pLeft->u.curr;
+		start.v = pLeft->v.curr;
+		start.z = pLeft->z.curr;
+		start.color[0] = pLeft->color[0].curr;
+		start.color[1] = pLeft->color[1].curr;
+		start.color[2] = pLeft->color[2].curr;
 
 		//our dx values are taken from the steps up until the right edge
 		float invWidth = 1.0f / width;
-		float dinvw_dx = (pRight->invw.curr - invw) * invWidth;
-		float du_dx = (pRight->u.curr - u) * invWidth;
-		float dv_dx = (pRight->v.curr - v) * invWidth;
-		float dz_dx = (pRight->z.curr - z) * invWidth;
-		float dc_dx[3] = {
-			(pRight->color[0].curr - color[0]) * invWidth,
-			(pRight->color[1].curr - color[1]) * invWidth,
-			(pRight->color[2].curr - color[2]) * invWidth };
-
-		int adr = (pLeft->Y*engine->width)+XStart;
+		SpanValues step;
+		step.invw = (pRight->invw.curr - start.invw) * invWidth;
+		step.u = (pRight->u.curr - start.u) * invWidth;
+		step.v = (pRight->v.curr - start.v) * invWidth;
+		step.z = (pRight->z.curr - start.z) * invWidth;
+		step.color[0] = (pRight->color[0].curr - start.color[0]) * invWidth;
+		step.color[1] = (pRight->color[1].curr - start.color[1]) * invWidth;
+		step.color[2] = (pRight->color[2].curr - start.color[2]) * invWidth;
+
+		const int y = pLeft->Y;
+		int adr = (y*engine->width)+XStart;
 
 		//CONSIDER: in case some other math is wrong (shouldve been clipped OK), we might go out of bounds here.
 		//better check the Y value.
-		if(RENDERER && (pLeft->Y<0 || pLeft->Y>191)) {
-			printf("rasterizer rendering at y=%d! oops!\n",pLeft->Y);
+		if(RENDERER && (y<0 || y>=engine->height)) {
+			CORELOG_INFO("rasterizer rendering at y=%d! oops!\n",y);
 			return;
 		}
-		if(!RENDERER && (pLeft->Y<0 || pLeft->Y>=engine->height)) {
-			printf("rasterizer rendering at y=%d! oops!\n",pLeft->Y);
+		if(!RENDERER && (y<0 || y>=engine->height)) {
+			CORELOG_INFO("rasterizer rendering at y=%d! oops!\n",y);
 			return;
 		}
 
@@ -811,65 +1159,293 @@ public:
 		{
 			if(RENDERER && !lineHack)
 			{
-				printf("rasterizer rendering at x=%d! oops!\n",x);
+				CORELOG_INFO("rasterizer rendering at x=%d! oops!\n",x);
 				return;
 			}
-			invw += dinvw_dx * -x;
-			u += du_dx * -x;
-			v += dv_dx * -x;
-			z += dz_dx * -x;
-			color[0] += dc_dx[0] * -x;
-			color[1] += dc_dx[1] * -x;
-			color[2] += dc_dx[2] * -x;
+			start.advance(step, (float)-x);
 			adr += -x;
 			width -= -x;
 			x = 0;
 		}
-		if(x+width > (RENDERER?GFX3D_FRAMEBUFFER_WIDTH:engine->width))
+		if(x+width > engine->width)
 		{
 			if(RENDERER && !lineHack)
 			{
-				printf("rasterizer rendering at x=%d! oops!\n",x+width-1);
+				CORELOG_INFO("rasterizer rendering at x=%d! oops!\n",x+width-1);
 				return;
 			}
-			width = (RENDERER?GFX3D_FRAMEBUFFER_WIDTH:engine->width)-x;
+			width = engine->width-x;
 		}
 
-		while(width-- > 0)
+		//walk the span one hi-z tile at a time, skipping the runs hizOccluded says can't pass the depth test.
+		//a decal's equal test and a shadow poly's stencil updates need every fragment, so those are never skipped.
+		//every run restarts from the span start, so skipping a run doesn't change what the following ones compute
+		const bool hizUsable = !polyAttr.decalMode && shader.mode != 3;
+		const bool shadowMask = shader.mode == 3 && polyAttr.polyid == 0;
+		for(int done=0;done<width;)
 		{
-			pixel(adr,color[0],color[1],color[2],u,v,1.0f/invw,z);
-			adr++;
-			x++;
+			const int runX = x+done;
+			const int count = min(width-done, SOFTRAST_HIZ_SIZE - (runX % SOFTRAST_HIZ_SIZE));
+			SpanValues run = start;
+			run.advance(step, (float)done);
+
+			if(shadowMask)
+			{
+				drawrunShadowMask(adr+done, count, run, step);
+				done += count;
+				continue;
+			}
+
+			SoftRasterizerHiZTile &hizTile = engine->hiz[(y/SOFTRAST_HIZ_SIZE)*engine->hizWidth + runX/SOFTRAST_HIZ_SIZE];
+			if(hizUsable && count >= SOFTRAST_HIZ_MIN_RUN)
+			{
+				//the depth is monotonic along the span, so the nearest fragment of the run is at one of its ends
+				const float last = (float)(count-1);
+				const u32 depthFirst = fragmentDepth(run.wAt(step, 0.0f), run.zAt(step, 0.0f));
+				const u32 depthLast = fragmentDepth(run.wAt(step, last), run.zAt(step, last));
+				if(hizOccluded(hizTile, runX, y, min(depthFirst, depthLast)))
+				{
+					done += count;
+					continue;
+				}
+			}
 
-			invw += dinvw_dx;
-			u += du_dx;
-			v += dv_dx;
-			z += dz_dx;
-			color[0] += dc_dx[0];
-			color[1] += dc_dx[1];
-			color[2] += dc_dx[2];
+			drawrun(adr+done, count, run, step);
+			hizTile.dirty = true;
+			hizTile.touched = true;
+			done += count;
 		}
 	}
 
-	//runs several scanlines, until an edge is finished
-	template<bool SLI>
-	void runscanlines(edge_fx_fl *left, edge_fx_fl *right, bool horizontal, bool lineHack)
+	//draws count pixels of a span. each pixel's interpolants are evaluated from the start of the run
+	//rather than accumulated, so that they come out the same as fragmentDepth's estimate in drawscanline
+	FORCEINLINE void drawrun(int adr, const int count, const SpanValues &run, const SpanValues &step)
 	{
-		//oh lord, hack city for edge drawing
-
-		//do not overstep either of the edges
-		int Height = min(left->Height,right->Height);
-		bool first=true;
+		int i = 0;
 
-		//HACK: special handling for horizontal line poly
-		if (lineHack && left->Height == 0 && right->Height == 0 && left->Y<GFX3D_FRAMEBUFFER_HEIGHT && left->Y>=0)
+#ifdef ENABLE_NEON
+		//shade the bulk of the run four pixels at a time; the scalar loop below finishes the last few
+		if(count >= 4)
 		{
-			bool draw = (!SLI || (left->Y & SLI_MASK) == SLI_VALUE);
-			if(draw) drawscanline(left,right,lineHack);
-		}
+			static const float laneOffsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+			const float32x4_t lanes = vld1q_f32(laneOffsets);
+			const int blockEnd = count & ~3;
+			for(;i<blockEnd;i+=4)
+			{
+				const float32x4_t offset = vaddq_f32(lanes, vdupq_n_f32((float)i));
+				//a vector reciprocal (vrecpe on armv7) or a fused multiply-add could land an ulp away from the scalar loop's depth
+				float w[4];
+				u32 depth[4];
+				for(int lane=0;lane<4;lane++)
+				{
+					const float k = (float)(i+lane);
+					w[lane] = run.wAt(step, k);
+					depth[lane] = fragmentDepth(w[lane], run.zAt(step, k));
+				}
+				float32x4_t color4[3] = {
+					vmlaq_n_f32(vdupq_n_f32(run.color[0]), offset, step.color[0]),
+					vmlaq_n_f32(vdupq_n_f32(run.color[1]), offset, step.color[1]),
+					vmlaq_n_f32(vdupq_n_f32(run.color[2]), offset, step.color[2]) };
+				pixel4(adr+i, color4,
+					vmlaq_n_f32(vdupq_n_f32(run.u), offset, step.u),
+					vmlaq_n_f32(vdupq_n_f32(run.v), offset, step.v),
+					w, depth);
+			}
+		}
+#endif
+
+		for(;i<count;i++)
+		{
+			const float k = (float)i;
+			pixel(adr+i,
+				run.color[0] + step.color[0]*k,
+				run.color[1] + step.color[1]*k,
+				run.color[2] + step.color[2]*k,
+				run.u + step.u*k,
+				run.v + step.v*k,
+				run.wAt(step, k),
+				run.zAt(step, k));
+		}
+	}
+
+	//the mask pass of a shadow volume: its fragments only count the stencil up where they fail the depth test, and
+	//never write a color, a depth or a poly id. so only the depth is interpolated, and the hi-z tile stays as it was
+	//(neither dirty nor touched, since nothing the hi-z or the edge marking look at changes)
+	FORCEINLINE void drawrunShadowMask(int adr, const int count, const SpanValues &run, const SpanValues &step)
+	{
+		for(int i=0;i<count;i++)
+		{
+			const float k = (float)i;
+			testFragment(engine->screen[adr+i], fragmentDepth(run.wAt(step, k), run.zAt(step, k)));
+		}
+	}
+
+	//true if no fragment of a run with this nearest depth can pass the depth test on the tile.
+	//the tile bound only ever gets looser as polys draw into it (depths only decrease), so it is refreshed
+	//lazily, and at most once per poly so a poly covering the tile doesn't rescan it on every scanline
+	FORCEINLINE bool hizOccluded(SoftRasterizerHiZTile &tile, int x, int y, u32 nearestDepth)
+	{
+		hizTested++;
+		if(nearestDepth < tile.maxDepth)
+		{
+			if(!tile.dirty || tile.refreshedBy == polynum)
+				return false;
+			engine->refreshHiZTile(x/SOFTRAST_HIZ_SIZE, y/SOFTRAST_HIZ_SIZE);
+			tile.refreshedBy = polynum;
+			if(nearestDepth < tile.maxDepth)
+				return false;
+		}
+		hizRejected++;
+		return true;
+	}
+
+	//the depth buffer value at a point of a fixed point span
+	FORCEINLINE u32 fixedDepth(const edge_fx_fx *pLeft, const edge_fx_fx *pRight, const FixedInterpolator<8> &interp)
+	{
+		if(gfx3d.renderState.wbuffer)
+		{
+			const u32 w = (u32)interp(pLeft->w, pRight->w);
+			return wShift >= 0 ? (w << wShift) : (w >> -wShift);
+		}
+		else
+		{
+			//drop the extra precision, so the depths come out like the float rasterizer's
+			return (u32)max(0, interp.linear(pLeft->z, pRight->z)) & ~0x1FF;
+		}
+	}
+
+	FORCEINLINE void pixelFixed(int adr, const edge_fx_fx *pLeft, const edge_fx_fx *pRight, const FixedInterpolator<8> &interp)
+	{
+		Fragment &destFragment = engine->screen[adr];
+
+		u32 depth = fixedDepth(pLeft, pRight, interp);
+		if(!testFragment(destFragment, depth))
+			return;
+
+		//round off the extra color precision
+		shader.materialColor.r = max(0, min(63, (interp(pLeft->color[0], pRight->color[0]) + 8) >> 4));
+		shader.materialColor.g = max(0, min(63, (interp(pLeft->color[1], pRight->color[1]) + 8) >> 4));
+		shader.materialColor.b = max(0, min(63, (interp(pLeft->color[2], pRight->color[2]) + 8) >> 4));
+		shader.materialColor.a = polyAttr.alpha;
+
+		FragmentColor texColor;
+		if(shaderUsesTexture())
+			texColor = sampleTexel(interp(pLeft->u, pRight->u) >> 4, interp(pLeft->v, pRight->v) >> 4);
+
+		FragmentColor shaderOutput;
+		shade(shaderOutput, texColor);
+
+		writeFragment(destFragment, engine->screenColor[adr], depth, shaderOutput);
+	}
+
+	//draws a single scanline for the fixed point rasterizer.
+	//this follows the float version, but every pixel's values are worked out from its position in the span
+	FORCEINLINE void drawscanline(edge_fx_fx *pLeft, edge_fx_fx *pRight, bool lineHack)
+	{
+		const int XStart = pLeft->X;
+		const int width = scanlineWidth(pLeft, pRight, lineHack);
+		if(width <= 0)
+			return;
+
+		const int y = pLeft->Y;
+		if(RENDERER && (y<0 || y>=engine->height)) {
+			CORELOG_INFO("rasterizer rendering at y=%d! oops!\n",y);
+			return;
+		}
+		if(!RENDERER && (y<0 || y>=engine->height)) {
+			CORELOG_INFO("rasterizer rendering at y=%d! oops!\n",y);
+			return;
+		}
+
+		int first = 0, last = width;
+		if(XStart<0)
+		{
+			if(RENDERER && !lineHack)
+			{
+				CORELOG_INFO("rasterizer rendering at x=%d! oops!\n",XStart);
+				return;
+			}
+			first = -XStart;
+		}
+		if(XStart+width > engine->width)
+		{
+			if(RENDERER && !lineHack)
+			{
+				CORELOG_INFO("rasterizer rendering at x=%d! oops!\n",XStart+width-1);
+				return;
+			}
+			last = engine->width-XStart;
+		}
+
+		//the values are interpolated from the left edge up to (but not including) the right edge, like the float version
+		const s32 recip = FixedInterpolator<8>::recip(width);
+		const int adr = (y*engine->width)+XStart;
+		FixedInterpolator<8> interp;
+
+		//see the float version for the hi-z runs. exact values at each pixel mean the ends of a run are exact too
+		const bool hizUsable = !polyAttr.decalMode && shader.mode != 3;
+		if(shader.mode == 3 && polyAttr.polyid == 0)
+		{
+			//a shadow volume's mask, as drawrunShadowMask does it
+			for(int i=first;i<last;i++)
+			{
+				interp.setup(i, width, recip, pLeft->w, pRight->w);
+				testFragment(engine->screen[adr+i], fixedDepth(pLeft, pRight, interp));
+			}
+			return;
+		}
+		for(int done=first;done<last;)
+		{
+			const int runX = XStart+done;
+			const int count = min(last-done, SOFTRAST_HIZ_SIZE - (runX % SOFTRAST_HIZ_SIZE));
+
+			SoftRasterizerHiZTile &hizTile = engine->hiz[(y/SOFTRAST_HIZ_SIZE)*engine->hizWidth + runX/SOFTRAST_HIZ_SIZE];
+			if(hizUsable && count >= SOFTRAST_HIZ_MIN_RUN)
+			{
+				interp.setup(done, width, recip, pLeft->w, pRight->w);
+				const u32 depthFirst = fixedDepth(pLeft, pRight, interp);
+				interp.setup(done+count-1, width, recip, pLeft->w, pRight->w);
+				const u32 depthLast = fixedDepth(pLeft, pRight, interp);
+				if(hizOccluded(hizTile, runX, y, min(depthFirst, depthLast)))
+				{
+					done += count;
+					continue;
+				}
+			}
+
+			for(int i=done;i<done+count;i++)
+			{
+				interp.setup(i, width, recip, pLeft->w, pRight->w);
+				pixelFixed(adr+i, pLeft, pRight, interp);
+			}
+			hizTile.dirty = true;
+			hizTile.touched = true;
+			done += count;
+		}
+	}
+
+	//runs several scanlines, until an edge is finished
+	//(or, when tiled, until the edges have walked past the bottom of the current tile)
+	template<bool TILED, typename EDGE>
+	void runscanlines(EDGE *left, EDGE *right, bool horizontal, bool lineHack)
+	{
+		//oh lord, hack city for edge drawing
+
+		//do not overstep either of the edges
+		int Height = min(left->Height,right->Height);
+		bool first=true;
+
+		//HACK: special handling for horizontal line poly
+		if (lineHack && left->Height == 0 && right->Height == 0 && left->Y<engine->height && left->Y>=0)
+		{
+			bool draw = (!TILED || (left->Y >= tileTop && left->Y < tileBottom));
+			if(draw) drawscanline(left,right,lineHack);
+		}
 
 		while(Height--) {
-			bool draw = (!SLI || (left->Y & SLI_MASK) == SLI_VALUE);
+			if(TILED && left->Y >= tileBottom)
+				return;
+			bool draw = (!TILED || left->Y >= tileTop);
 			if(draw) drawscanline(left,right,lineHack);
 			const int xl = left->X;
 			const int xr = right->X;
@@ -935,8 +1511,8 @@ public:
 
 	
 	//rotates verts counterclockwise
-	template<int type>
-	INLINE void rot_verts() {
+	template<int type, typename V>
+	INLINE void rot_verts(V** verts) {
 		#define ROTSWAP(X) if(type>X) swap(verts[X-1],verts[X]);
 		ROTSWAP(1); ROTSWAP(2); ROTSWAP(3); ROTSWAP(4);
 		ROTSWAP(5); ROTSWAP(6); ROTSWAP(7); ROTSWAP(8); ROTSWAP(9);
@@ -944,8 +1520,8 @@ public:
 
 	//rotate verts until vert0.y is minimum, and then vert0.x is minimum in case of ties
 	//this is a necessary precondition for our shape engine
-	template<int type>
-	void sort_verts(bool backwards) {
+	template<int type, typename V>
+	void sort_verts(V** verts, bool backwards) {
 		//if the verts are backwards, reorder them first
 		if(backwards)
 			for(int i=0;i<type/2;i++)
@@ -960,12 +1536,12 @@ public:
 			break;
 			
 		doswap:
-			rot_verts<type>();
+			rot_verts<type>(verts);
 		}
 		
 		while(verts[0]->y == verts[1]->y && verts[0]->x > verts[1]->x)
 		{
-			rot_verts<type>();
+			rot_verts<type>(verts);
 			// hack for VC++ 2010 (bug in compiler optimization?)
 			// freeze on 3D
 			// TODO: study it
@@ -980,21 +1556,22 @@ public:
 	//verts must be clockwise.
 	//I didnt reference anything for this algorithm but it seems like I've seen it somewhere before.
 	//Maybe it is like crow's algorithm
-	template<bool SLI>
+	template<bool TILED, typename EDGE>
 	void shape_engine(int type, bool backwards, bool lineHack)
 	{
 		bool failure = false;
+		typename EDGE::Vert** verts = shapeVerts((typename EDGE::Vert*)NULL);
 
 		switch(type) {
-			case 3: sort_verts<3>(backwards); break;
-			case 4: sort_verts<4>(backwards); break;
-			case 5: sort_verts<5>(backwards); break;
-			case 6: sort_verts<6>(backwards); break;
-			case 7: sort_verts<7>(backwards); break;
-			case 8: sort_verts<8>(backwards); break;
-			case 9: sort_verts<9>(backwards); break;
-			case 10: sort_verts<10>(backwards); break;
-			default: printf("skipping type %d\n",type); return;
+			case 3: sort_verts<3>(verts, backwards); break;
+			case 4: sort_verts<4>(verts, backwards); break;
+			case 5: sort_verts<5>(verts, backwards); break;
+			case 6: sort_verts<6>(verts, backwards); break;
+			case 7: sort_verts<7>(verts, backwards); break;
+			case 8: sort_verts<8>(verts, backwards); break;
+			case 9: sort_verts<9>(verts, backwards); break;
+			case 10: sort_verts<10>(verts, backwards); break;
+			default: CORELOG_INFO("skipping type %d\n",type); return;
 		}
 
 		//we are going to step around the polygon in both directions starting from vert 0.
@@ -1003,15 +1580,15 @@ public:
 		//for the counter we're decrementing.
 		int lv = type, rv = 0;
 
-		edge_fx_fl left, right;
+		EDGE left, right;
 		bool step_left = true, step_right = true;
 		for(;;) {
 			//generate new edges if necessary. we must avoid regenerating edges when they are incomplete
 			//so that they can be continued on down the shape
 			assert(rv != type);
 			int _lv = lv==type?0:lv; //make sure that we ask for vert 0 when the variable contains the starting value
-			if(step_left) left = edge_fx_fl(_lv,lv-1,(VERT**)&verts, failure);
-			if(step_right) right = edge_fx_fl(rv,rv+1,(VERT**)&verts, failure);
+			if(step_left) left = EDGE(_lv,lv-1,verts, failure);
+			if(step_right) right = EDGE(rv,rv+1,verts, failure);
 			step_left = step_right = false;
 
 			//handle a failure in the edge setup due to nutty polys
@@ -1019,7 +1596,11 @@ public:
 				return;
 
 			bool horizontal = left.Y == right.Y;
-			runscanlines<SLI>(&left,&right,horizontal, lineHack);
+			runscanlines<TILED>(&left,&right,horizontal, lineHack);
+
+			//nothing further down this shape can land in the current tile
+			if(TILED && left.Y >= tileBottom)
+				break;
 
 			//if we ran out of an edge, step to the next one
 			if(right.Height == 0) {
@@ -1039,57 +1620,135 @@ public:
 
 	SoftRasterizerEngine* engine;
 
-	template<bool SLI>
-	FORCEINLINE void mainLoop(SoftRasterizerEngine* const engine)
+	bool firstPoly;
+	u32 lastPolyAttr;
+	u32 lastTextureFormat, lastTexturePalette;
+
+	//converts the clipped verts for the fixed point rasterizer
+	void setupFixedVerts(const GFX3D_Clipper::TClippedPoly &clippedPoly)
 	{
-		this->engine = engine;
-		lastTexKey = NULL;
+		const int type = clippedPoly.type;
 
-		u32 lastPolyAttr = 0;
-		u32 lastTextureFormat = 0, lastTexturePalette = 0;
+		//w goes back to 20.12, and then gets shifted so the largest one in the poly has exactly 16 bits
+		s32 w[MAX_CLIPPED_VERTS];
+		s32 wmax = 1;
+		for(int j=0;j<type;j++)
+		{
+			w[j] = max(1, (s32)(clippedPoly.clipVerts[j].w * 4096.0f));
+			wmax = max(wmax, w[j]);
+		}
+		wShift = (32 - __builtin_clz((u32)wmax)) - 16;
 
-		//iterate over polys
-		bool first=true;
-		for(int i=0;i<engine->clippedPolyCounter;i++)
+		for(int j=0;j<type;j++)
 		{
-			if(!RENDERER) _debug_thisPoly = (i==engine->_debug_drawClippedUserPoly);
-			if(!engine->polyVisible[i]) continue;
-			polynum = i;
+			const VERT &vert = clippedPoly.clipVerts[j];
+			FixedVert &fixedVert = fixedVertData[j];
+
+			//the coords are already 28.4, and the texcoords and colors were divided by w for the float rasterizer
+			fixedVert.x = (fixed28_4)vert.x;
+			fixedVert.y = (fixed28_4)vert.y;
+			fixedVert.w = max(1, wShift >= 0 ? (w[j] >> wShift) : (w[j] << -wShift));
+			fixedVert.z = (s32)(max(0.0f, min(1.0f, vert.z)) * (float)(0x7FFF << 9));
+			fixedVert.u = (s32)floorf(vert.u * vert.w * 16.0f + 0.5f);
+			fixedVert.v = (s32)floorf(vert.v * vert.w * 16.0f + 0.5f);
+			for(int k=0;k<3;k++)
+				fixedVert.color[k] = (s32)(vert.fcolor[k] * vert.w * 16.0f + 0.5f);
+
+			fixedVerts[j] = &fixedVert;
+		}
+		for(int j=type;j<MAX_CLIPPED_VERTS;j++)
+			fixedVerts[j] = NULL;
+	}
+
+	template<bool TILED>
+	FORCEINLINE void renderPoly(const int i)
+	{
+		if(!RENDERER) _debug_thisPoly = (i==engine->_debug_drawClippedUserPoly);
+		polynum = i;
 
-			GFX3D_Clipper::TClippedPoly &clippedPoly = engine->clippedPolys[i];
-			POLY *poly = clippedPoly.poly;
-			int type = clippedPoly.type;
+		GFX3D_Clipper::TClippedPoly &clippedPoly = engine->clippedPolys[i];
+		POLY *poly = clippedPoly.poly;
+		int type = clippedPoly.type;
 
-			if(first || lastPolyAttr != poly->polyAttr)
-			{
-				polyAttr.setup(poly->polyAttr);
-				polyAttr.translucent = poly->isTranslucent();
-				lastPolyAttr = poly->polyAttr;
-			}
+		if(firstPoly || lastPolyAttr != poly->polyAttr)
+		{
+			polyAttr.setup(poly->polyAttr);
+			polyAttr.translucent = poly->isTranslucent();
+			lastPolyAttr = poly->polyAttr;
+		}
 
 
-			if(first || lastTextureFormat != poly->texParam || lastTexturePalette != poly->texPalette)
-			{
-				sampler.setup(poly->texParam);
-				lastTextureFormat = poly->texParam;
-				lastTexturePalette = poly->texPalette;
-			}
+		if(firstPoly || lastTextureFormat != poly->texParam || lastTexturePalette != poly->texPalette)
+		{
+			sampler.setup(poly->texParam);
+			lastTextureFormat = poly->texParam;
+			lastTexturePalette = poly->texPalette;
+		}
+
+		firstPoly = false;
+
+		lastTexKey = engine->polyTexKeys[i];
+		if(lastTexKey) //a shadow volume's mask has none
+			TexCache_Decode(lastTexKey,TexFormat_15bpp); //no-op unless no worker has got to it yet
+
+		//hmm... shader gets setup every time because it depends on sampler which may have just changed
+		setupShader(poly->polyAttr);
+
+		for(int j=0;j<type;j++)
+			this->verts[j] = &clippedPoly.clipVerts[j];
+		for(int j=type;j<MAX_CLIPPED_VERTS;j++)
+			this->verts[j] = NULL;
 
-			first = false;
+		polyAttr.backfacing = engine->polyBackfacing[i];
 
-			lastTexKey = engine->polyTexKeys[i];
+		const bool lineHack = (poly->vtxFormat & 4) && CommonSettings.GFX3D_LineHack;
+		if(engine->fixedPoint)
+		{
+			setupFixedVerts(clippedPoly);
+			shape_engine<TILED, edge_fx_fx>(type,!polyAttr.backfacing, lineHack);
+		}
+		else
+			shape_engine<TILED, edge_fx_fl>(type,!polyAttr.backfacing, lineHack);
+	}
+
+	template<bool TILED>
+	FORCEINLINE void mainLoop(SoftRasterizerEngine* const engine)
+	{
+		this->engine = engine;
+		lastTexKey = NULL;
 
-			//hmm... shader gets setup every time because it depends on sampler which may have just changed
-			setupShader(poly->polyAttr);
+		firstPoly = true;
+		lastPolyAttr = 0;
+		lastTextureFormat = lastTexturePalette = 0;
+		hizTested = hizRejected = 0;
 
-			for(int j=0;j<type;j++)
-				this->verts[j] = &clippedPoly.clipVerts[j];
-			for(int j=type;j<MAX_CLIPPED_VERTS;j++)
-				this->verts[j] = NULL;
+		if(TILED)
+		{
+			//keep pulling tiles off the shared queue until it runs dry.
+			//this way the faster cores simply end up doing more of the frame
+			for(;;)
+			{
+				const int tile = engine->takeTile();
+				if(tile >= engine->tileCount) break;
 
-			polyAttr.backfacing = engine->polyBackfacing[i];
+				const SoftRasterizerTile &currTile = engine->tiles[tile];
+				tileTop = currTile.top;
+				tileBottom = currTile.bottom;
+				engine->clearRows(tileTop, tileBottom);
 
-			shape_engine<SLI>(type,!polyAttr.backfacing, (poly->vtxFormat & 4) && CommonSettings.GFX3D_LineHack);
+				const size_t count = currTile.polys.size();
+				for(size_t j=0;j<count;j++)
+					renderPoly<true>(currTile.polys[j]);
+			}
+		}
+		else
+		{
+			//iterate over polys
+			for(int i=0;i<engine->clippedPolyCounter;i++)
+			{
+				if(!engine->polyVisible[i]) continue;
+				renderPoly<false>(i);
+			}
 		}
 	}
 
@@ -1099,10 +1758,12 @@ public:
 static SoftRasterizerEngine mainSoftRasterizer;
 
 #define _MAX_CORES 16
-static Task rasterizerUnitTask[_MAX_CORES];
+static TaskGroup* rasterizerUnitGroup = NULL;
 static RasterizerUnit<true> rasterizerUnit[_MAX_CORES];
 static RasterizerUnit<false> _HACK_viewer_rasterizerUnit;
 static unsigned int rasterizerCores = 0;
+//the units the frame being rendered went to, which can be fewer than the cores
+static unsigned int rasterizerUnits = 0;
 static bool rasterizerUnitTasksInited = false;
 
 static void* execRasterizerUnit(void* arg)
@@ -1112,6 +1773,12 @@ static void* execRasterizerUnit(void* arg)
 	return 0;
 }
 
+static void* execTexDecode(void* arg)
+{
+	TexCache_Decode((TexCacheItem*)arg,TexFormat_15bpp);
+	return 0;
+}
+
 static char SoftRastInit(void)
 {
 	char result = Default3D_Init();
@@ -1124,77 +1791,31 @@ static char SoftRastInit(void)
 	{
 		rasterizerUnitTasksInited = true;
 
-		_HACK_viewer_rasterizerUnit.SLI_MASK = 1;
-		_HACK_viewer_rasterizerUnit.SLI_VALUE = 0;
-
 		rasterizerCores = CommonSettings.num_cores;
 
 		if (rasterizerCores > _MAX_CORES) 
 			rasterizerCores = _MAX_CORES;
 
-		if(CommonSettings.num_cores == 1)
+		if(CommonSettings.num_cores <= 1)
 		{
 			rasterizerCores = 1;
-			rasterizerUnit[0].SLI_MASK = 0;
-			rasterizerUnit[0].SLI_VALUE = 0;
 		}
 		else
 		{
-			for (u8 i = 0; i < rasterizerCores; i++)
-			{
-				rasterizerUnit[i].SLI_MASK = (rasterizerCores - 1);
-				rasterizerUnit[i].SLI_VALUE = i;
-				rasterizerUnitTask[i].start(false);
-			}
-		}
-
-	}
-
-	static bool tables_generated = false;
-	if(!tables_generated)
-	{
-		tables_generated = true;
-
-		for(int i=0;i<64;i++)
-		{
-			for(int j=0;j<64;j++)
-			{
-				modulate_table[i][j] = ((i+1) * (j+1) - 1) >> 6;	
-				for(int a=0;a<32;a++)
-					decal_table[a][i][j] = ((i*a) + (j*(31-a))) >> 5;
-			}
+			//the units run on the shared worker pool; they pull tiles, so any core count works here
+			rasterizerUnitGroup = new TaskGroup(TaskPool::shared());
 		}
 
-		//these tables are used to increment through vert lists without having to do wrapping logic/math
-		int idx=0;
-		for(int i=3;i<=8;i++)
-		{
-			index_start_table[i-3] = idx;
-			for(int j=0;j<i;j++) {
-				int a = j;
-				int b = j+1;
-				if(b==i) b = 0;
-				index_lookup_table[idx++] = a;
-				index_lookup_table[idx++] = b;
-			}
-		}
 	}
 
-	TexCache_Reset();
-
-	printf("SoftRast Initialized with cores=%d\n",rasterizerCores);
+	CORELOG_INFO("SoftRast Initialized with cores=%d\n",rasterizerCores);
 	return result;
 }
 
 static void SoftRastReset()
 {
 	if (rasterizerCores > 1)
-	{
-		for(unsigned int i = 0; i < rasterizerCores; i++)
-		{
-			rasterizerUnitTask[i].finish();
-		}
-	}
+		rasterizerUnitGroup->wait();
 	
 	softRastHasNewData = false;
 	
@@ -1205,11 +1826,9 @@ static void SoftRastClose()
 {
 	if (rasterizerCores > 1)
 	{
-		for(unsigned int i = 0; i < rasterizerCores; i++)
-		{
-			rasterizerUnitTask[i].finish();
-			rasterizerUnitTask[i].shutdown();
-		}
+		rasterizerUnitGroup->wait();
+		delete rasterizerUnitGroup;
+		rasterizerUnitGroup = NULL;
 	}
 	
 	rasterizerUnitTasksInited = false;
@@ -1223,17 +1842,93 @@ static void SoftRastVramReconfigureSignal()
 	Default3D_VramReconfigureSignal();
 }
 
+//averages scale*scale blocks of the upscaled framebuffer down to native resolution pixels, for rows [begin,end).
+//the colors are weighted by alpha so that the clear color behind a transparent background doesn't bleed into the edges
+static void SoftRastDownsampleRows(void *param, int begin, int end)
+{
+	const int scale = softRastScale;
+	const int width = GFX3D_FRAMEBUFFER_WIDTH*scale;
+	const u32 samples = scale*scale;
+	FragmentColor *dst = (FragmentColor*)gfx3d_convertedScreen + begin*GFX3D_FRAMEBUFFER_WIDTH;
+
+	for(int y=begin;y<end;y++)
+	{
+		const FragmentColor *src = &_screenColor[y*scale*width];
+		for(int x=0;x<GFX3D_FRAMEBUFFER_WIDTH;x++,src+=scale,dst++)
+		{
+			u32 r=0, g=0, b=0, a=0, r0=0, g0=0, b0=0;
+			for(int sy=0;sy<scale;sy++)
+			{
+				const FragmentColor *row = src + sy*width;
+				for(int sx=0;sx<scale;sx++)
+				{
+					const FragmentColor col = row[sx];
+					r += col.r*col.a; g += col.g*col.a; b += col.b*col.a;
+					r0 += col.r; g0 += col.g; b0 += col.b;
+					a += col.a;
+				}
+			}
+
+			if(a)
+			{
+				dst->r = r/a; dst->g = g/a; dst->b = b/a;
+			}
+			else
+			{
+				dst->r = r0/samples; dst->g = g0/samples; dst->b = b0/samples;
+			}
+			dst->a = a/samples;
+		}
+	}
+}
+
 static void SoftRastConvertFramebuffer()
 {
-	memcpy(gfx3d_convertedScreen, _screenColor, GFX3D_FRAMEBUFFER_WIDTH*GFX3D_FRAMEBUFFER_HEIGHT*4);
+	//the 2d engine composites the 3d layer at native resolution, so an upscaled frame has to be brought back down for it
+	if(softRastScale == 1)
+		memcpy(gfx3d_convertedScreen, &_screenColor[0], GFX3D_FRAMEBUFFER_WIDTH*GFX3D_FRAMEBUFFER_HEIGHT*4);
+	else if(rasterizerCores > 1)
+		TaskPool::shared().parallelFor(0, GFX3D_FRAMEBUFFER_HEIGHT, 16, SoftRastDownsampleRows, NULL);
+	else
+		SoftRastDownsampleRows(NULL, 0, GFX3D_FRAMEBUFFER_HEIGHT);
 }
 
-void SoftRasterizerEngine::initFramebuffer(const int width, const int height, const bool clearImage)
+//a span of the clear image's colors and depths, count pixels from the same native line
+static void SoftRastClearImageSpan(FragmentColor *dstColor, Fragment *dst, const u16 *image, const u16 *depth, const int count)
 {
-	const int todo = width*height;
+	int i = 0;
+#ifdef ENABLE_NEON
+	//the same as RGB15TO6665 eight at a time, with the channels interleaved into the FragmentColors by the store
+	const uint16x8_t mask = vdupq_n_u16(0x1F), one = vdupq_n_u16(1);
+	for(; i+8 <= count; i += 8)
+	{
+		const uint16x8_t col = vld1q_u16(image+i);
+		uint8x8x4_t rgba;
+		rgba.val[0] = vmovn_u16(vorrq_u16(vshlq_n_u16(vandq_u16(col, mask), 1), one));
+		rgba.val[1] = vmovn_u16(vorrq_u16(vshlq_n_u16(vandq_u16(vshrq_n_u16(col, 5), mask), 1), one));
+		rgba.val[2] = vmovn_u16(vorrq_u16(vshlq_n_u16(vandq_u16(vshrq_n_u16(col, 10), mask), 1), one));
+		rgba.val[3] = vmovn_u16(vmulq_n_u16(vshrq_n_u16(col, 15), 31));
+		vst4_u8((u8*)(dstColor+i), rgba);
+	}
+#endif
+	for(; i < count; i++)
+	{
+		const u16 col = image[i];
+		dstColor[i].color = RGB15TO6665(col,31*(col>>15));
+	}
+	for(i = 0; i < count; i++)
+	{
+		const u16 d = depth[i];
+		dst[i].fogged = BIT15(d);
+		dst[i].depth = DS_DEPTH15TO24(d);
+	}
+}
+
+//deferClear leaves the clearing to the workers, a tile at a time with clearRows
+void SoftRasterizerEngine::initFramebuffer(const int width, const int height, const bool clearImage, const bool deferClear)
+{
+	clearImageUsed = clearImage;
 
-	Fragment clearFragment;
-	FragmentColor clearFragmentColor;
 	clearFragment.isTranslucentPoly = 0;
 	clearFragmentColor.r = GFX3D_5TO6(gfx3d.renderState.clearColor&0x1F);
 	clearFragmentColor.g = GFX3D_5TO6((gfx3d.renderState.clearColor>>5)&0x1F);
@@ -1248,52 +1943,125 @@ void SoftRasterizerEngine::initFramebuffer(const int width, const int height, co
 	clearFragment.stencil = 0;
 	clearFragment.isTranslucentPoly = 0;
 	clearFragment.fogged = BIT15(gfx3d.renderState.clearColor);
-	for(int i=0;i<todo;i++)
-		screen[i] = clearFragment;
 
 	if(clearImage)
 	{
-		//need to handle this somehow..
-		assert(width==GFX3D_FRAMEBUFFER_WIDTH && height==GFX3D_FRAMEBUFFER_HEIGHT);
+		//the clear image is native resolution, so it gets stretched when rendering upscaled
+		assert(width%GFX3D_FRAMEBUFFER_WIDTH == 0 && height%GFX3D_FRAMEBUFFER_HEIGHT == 0);
 
-		u16* clearImage = (u16*)MMU.texInfo.textureSlotAddr[2];
-		u16* clearDepth = (u16*)MMU.texInfo.textureSlotAddr[3];
+		const u16* clearImage = (u16*)MMU.texInfo.textureSlotAddr[2];
+		const u16* clearDepth = (u16*)MMU.texInfo.textureSlotAddr[3];
 
 		//the lion, the witch, and the wardrobe (thats book 1, suck it you new-school numberers)
 		//uses the scroll registers in the main game engine
 		u16 scroll = T1ReadWord(MMU.ARM9_REG,0x356); //CLRIMAGE_OFFSET
-		u16 xscroll = scroll&0xFF;
-		u16 yscroll = (scroll>>8)&0xFF;
-
-		FragmentColor *dstColor = screenColor;
-		Fragment *dst = screen;
-
-		for(int iy=0; iy<GFX3D_FRAMEBUFFER_HEIGHT; iy++) {
-			int y = ((iy + yscroll)&255)<<8;
-			for(int ix=0; ix<GFX3D_FRAMEBUFFER_WIDTH; ix++) {
-				int x = (ix + xscroll)&255;
-				int adr = y + x;
-				
-				//this is tested by harry potter and the order of the phoenix.
-				//TODO (optimization) dont do this if we are mapped to blank memory (such as in sonic chronicles)
-				//(or use a special zero fill in the bulk clearing above)
-				u16 col = clearImage[adr];
-				dstColor->color = RGB15TO6665(col,31*(col>>15));
-				
-				//this is tested quite well in the sonic chronicles main map mode
-				//where depth values are used for trees etc you can walk behind
-				u16 depth = clearDepth[adr];
-				dst->fogged = BIT15(depth);
-				dst->depth = DS_DEPTH15TO24(depth);
-
-				dstColor++;
-				dst++;
-			}
+		clearXScroll = scroll&0xFF;
+		const u16 yscroll = (scroll>>8)&0xFF;
+
+		clearImageLines.resize(GFX3D_FRAMEBUFFER_WIDTH*GFX3D_FRAMEBUFFER_HEIGHT);
+		clearDepthLines.resize(GFX3D_FRAMEBUFFER_WIDTH*GFX3D_FRAMEBUFFER_HEIGHT);
+		for(int y=0; y<GFX3D_FRAMEBUFFER_HEIGHT; y++)
+		{
+			const int adr = ((y + yscroll)&255)<<8;
+			memcpy(&clearImageLines[y*GFX3D_FRAMEBUFFER_WIDTH], clearImage+adr, GFX3D_FRAMEBUFFER_WIDTH*2);
+			memcpy(&clearDepthLines[y*GFX3D_FRAMEBUFFER_WIDTH], clearDepth+adr, GFX3D_FRAMEBUFFER_WIDTH*2);
 		}
 	}
-	else 
+
+	if(!deferClear)
+		clearRows(0, height);
+
+	//the hi-z tiles start out dirty, so they pick up the clear depths the first time they are asked
+	hizWidth = (width + SOFTRAST_HIZ_SIZE - 1) / SOFTRAST_HIZ_SIZE;
+	hizHeight = (height + SOFTRAST_HIZ_SIZE - 1) / SOFTRAST_HIZ_SIZE;
+	SoftRasterizerHiZTile unknownTile;
+	unknownTile.maxDepth = 0xFFFFFFFF;
+	unknownTile.refreshedBy = -1;
+	unknownTile.dirty = true;
+	unknownTile.touched = false;
+	hiz.assign(hizWidth*hizHeight, unknownTile);
+	hizTested = hizRejected = 0;
+}
+
+void SoftRasterizerEngine::clearRows(const int top, const int bottom)
+{
+	const int first = top*width;
+	const int todo = (bottom-top)*width;
+
+	//a Fragment is a word and a half of fields in 8 bytes, so the clear fragment goes down as one u64 and the loop vectorizes
+	if(sizeof(Fragment) == sizeof(u64))
+	{
+		u64 clearWord;
+		memcpy(&clearWord, &clearFragment, sizeof(clearWord));
+		u64 *dst = (u64*)(screen+first);
+		for(int i=0;i<todo;i++)
+			dst[i] = clearWord;
+	}
+	else
 		for(int i=0;i<todo;i++)
-			screenColor[i] = clearFragmentColor;
+			screen[first+i] = clearFragment;
+
+	if(!clearImageUsed)
+	{
+		const u32 clearColor = clearFragmentColor.color;
+		u32 *dstColor = (u32*)(screenColor+first);
+		for(int i=0;i<todo;i++)
+			dstColor[i] = clearColor;
+		return;
+	}
+
+	const int scaleX = width/GFX3D_FRAMEBUFFER_WIDTH;
+	const int scaleY = height/GFX3D_FRAMEBUFFER_HEIGHT;
+	for(int iy=top; iy<bottom; iy++)
+	{
+		//this is tested by harry potter and the order of the phoenix.
+		//TODO (optimization) dont do this if we are mapped to blank memory (such as in sonic chronicles)
+		//(or use a special zero fill in the bulk clearing above)
+		const u16 *image = &clearImageLines[(iy/scaleY)*GFX3D_FRAMEBUFFER_WIDTH];
+		//this is tested quite well in the sonic chronicles main map mode
+		//where depth values are used for trees etc you can walk behind
+		const u16 *depth = &clearDepthLines[(iy/scaleY)*GFX3D_FRAMEBUFFER_WIDTH];
+		FragmentColor *dstColor = screenColor + iy*width;
+		Fragment *dst = screen + iy*width;
+
+		if(scaleX == 1)
+		{
+			//the x scroll wraps the line round, which makes it two runs
+			const int right = GFX3D_FRAMEBUFFER_WIDTH - clearXScroll;
+			SoftRastClearImageSpan(dstColor, dst, image+clearXScroll, depth+clearXScroll, right);
+			SoftRastClearImageSpan(dstColor+right, dst+right, image, depth, clearXScroll);
+			continue;
+		}
+
+		for(int ix=0; ix<width; ix++)
+		{
+			const int x = (ix/scaleX + clearXScroll)&255;
+			const u16 col = image[x];
+			dstColor[ix].color = RGB15TO6665(col,31*(col>>15));
+			dst[ix].fogged = BIT15(depth[x]);
+			dst[ix].depth = DS_DEPTH15TO24(depth[x]);
+		}
+	}
+}
+
+void SoftRasterizerEngine::refreshHiZTile(int tx, int ty)
+{
+	const int left = tx*SOFTRAST_HIZ_SIZE;
+	const int right = min(width, left+SOFTRAST_HIZ_SIZE);
+	const int top = ty*SOFTRAST_HIZ_SIZE;
+	const int bottom = min(height, top+SOFTRAST_HIZ_SIZE);
+
+	u32 maxDepth = 0;
+	for(int y=top;y<bottom;y++)
+	{
+		const Fragment *row = &screen[y*width];
+		for(int x=left;x<right;x++)
+			maxDepth = max(maxDepth, row[x].depth);
+	}
+
+	SoftRasterizerHiZTile &tile = hiz[ty*hizWidth + tx];
+	tile.maxDepth = maxDepth;
+	tile.dirty = false;
 }
 
 void SoftRasterizerEngine::updateToonTable()
@@ -1371,10 +2139,107 @@ void SoftRasterizerEngine::updateFloatColors()
 
 SoftRasterizerEngine::SoftRasterizerEngine()
 	: _debug_drawClippedUserPoly(-1)
+	, clearImageUsed(false)
+	, tileCount(0)
+	, nextTile(0)
+	, hizWidth(0)
+	, hizHeight(0)
+	, hizTested(0)
+	, hizRejected(0)
+	, viewportStamp(0)
+	, fixedPoint(false)
 {
 	this->clippedPolys = clipper.clippedPolys = new GFX3D_Clipper::TClippedPoly[POLYLIST_SIZE*2];
 }
 
+//marks which of a tile's row of pixels have a lower poly id next to them, which is needed for them to make any edges.
+//returns false if none of them do
+static FORCEINLINE bool findEdgeCandidates(const u8 *ids, const int stride, u8 *candidates)
+{
+#if defined(ENABLE_NEON) && SOFTRAST_HIZ_SIZE == 8
+	const uint8x8_t self = vld1_u8(ids);
+	uint8x8_t any = vcgt_u8(self, vld1_u8(ids-stride-1));
+	any = vorr_u8(any, vcgt_u8(self, vld1_u8(ids-stride)));
+	any = vorr_u8(any, vcgt_u8(self, vld1_u8(ids-stride+1)));
+	any = vorr_u8(any, vcgt_u8(self, vld1_u8(ids-1)));
+	any = vorr_u8(any, vcgt_u8(self, vld1_u8(ids+1)));
+	any = vorr_u8(any, vcgt_u8(self, vld1_u8(ids+stride-1)));
+	any = vorr_u8(any, vcgt_u8(self, vld1_u8(ids+stride)));
+	any = vorr_u8(any, vcgt_u8(self, vld1_u8(ids+stride+1)));
+	vst1_u8(candidates, any);
+	return vget_lane_u64(vreinterpret_u64_u8(any), 0) != 0;
+#else
+	bool found = false;
+	for(int x=0;x<SOFTRAST_HIZ_SIZE;x++)
+	{
+		const u8 self = ids[x];
+		const u8 *above = ids+x-stride, *below = ids+x+stride;
+		candidates[x] = self > above[-1] || self > above[0] || self > above[1]
+			|| self > ids[x-1] || self > ids[x+1]
+			|| self > below[-1] || self > below[0] || self > below[1];
+		found |= candidates[x] != 0;
+	}
+	return found;
+#endif
+}
+
+//fogs count fragments starting at i
+void SoftRasterizerEngine::fogRun(int i, int count, const FragmentColor &fogColor)
+{
+	const bool alphaOnly = gfx3d.renderState.enableFogAlphaOnly;
+	int k = 0;
+
+#ifdef ENABLE_NEON
+	//the fog amounts are looked up one fragment at a time, then the colors are blended four at a time.
+	//fragments which aren't fogged get no fog, which leaves them as they are
+	const uint8x16_t fogColors = vreinterpretq_u8_u32(vdupq_n_u32(fogColor.color));
+	const uint8x16_t fullFog = vdupq_n_u8(128);
+	for(;k+4<=count;k+=4)
+	{
+		u8 weights[16];
+		for(int j=0;j<4;j++)
+		{
+			const Fragment &destFragment = screen[i+k+j];
+			u8 fog = 0;
+			if(destFragment.fogged)
+			{
+				assert((destFragment.depth>>9)<32768);
+				fog = fogTable[destFragment.depth>>9];
+				if(fog==127) fog=128;
+			}
+			weights[j*4+0] = weights[j*4+1] = weights[j*4+2] = alphaOnly ? 0 : fog;
+			weights[j*4+3] = fog;
+		}
+
+		u8 *dst = (u8*)&screenColor[i+k];
+		const uint8x16_t color = vld1q_u8(dst);
+		const uint8x16_t weight = vld1q_u8(weights);
+		const uint8x16_t invWeight = vsubq_u8(fullFog, weight);
+		const uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(color), vget_low_u8(invWeight)), vget_low_u8(fogColors), vget_low_u8(weight));
+		const uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(color), vget_high_u8(invWeight)), vget_high_u8(fogColors), vget_high_u8(weight));
+		vst1q_u8(dst, vcombine_u8(vshrn_n_u16(lo,7), vshrn_n_u16(hi,7)));
+	}
+#endif
+
+	for(;k<count;k++)
+	{
+		Fragment &destFragment = screen[i+k];
+		if(!destFragment.fogged) continue;
+		FragmentColor &destFragmentColor = screenColor[i+k];
+		u32 fogIndex = destFragment.depth>>9;
+		assert(fogIndex<32768);
+		u8 fog = fogTable[fogIndex];
+		if(fog==127) fog=128;
+		if(!alphaOnly)
+		{
+			destFragmentColor.r = ((128-fog)*destFragmentColor.r + fogColor.r*fog)>>7;
+			destFragmentColor.g = ((128-fog)*destFragmentColor.g + fogColor.g*fog)>>7;
+			destFragmentColor.b = ((128-fog)*destFragmentColor.b + fogColor.b*fog)>>7;
+		}
+		destFragmentColor.a = ((128-fog)*destFragmentColor.a + fogColor.a*fog)>>7;
+	}
+}
+
 void SoftRasterizerEngine::framebufferProcess()
 {
 	// this looks ok although it's still pretty much a hack,
@@ -1384,6 +2249,9 @@ void SoftRasterizerEngine::framebufferProcess()
 	// - the edges are completely sharp/opaque on the very brief title screen intro,
 	// - the level-start intro gets a pseudo-antialiasing effect around the silhouette,
 	// - the character edges in-level are clearly transparent, and also show well through shield powerups.
+	//the post passes go by the hi-z tiles to find out where anything was drawn
+	assert(width%SOFTRAST_HIZ_SIZE == 0 && height%SOFTRAST_HIZ_SIZE == 0);
+
 	if(gfx3d.renderState.enableEdgeMarking)
 	{ 
 		//TODO - need to test and find out whether these get grabbed at flush time, or at render time
@@ -1405,87 +2273,141 @@ void SoftRasterizerEngine::framebufferProcess()
 			edgeMarkDisabled[i] = 0;
 		}
 
-		for(int i=0,y=0; y<GFX3D_FRAMEBUFFER_HEIGHT; y++)
+		//pixels only get edges against a different poly id next to them. nothing was drawn outside the touched tiles,
+		//so they are all still the cleared poly id, and only the touched tiles and the ones around them can have edges
+		edgeMarkTiles.resize(hizWidth*hizHeight);
+		for(int ty=0;ty<hizHeight;ty++)
+			for(int tx=0;tx<hizWidth;tx++)
+			{
+				bool nearTouched = false;
+				for(int ny=max(0,ty-1);ny<=min(hizHeight-1,ty+1);ny++)
+					for(int nx=max(0,tx-1);nx<=min(hizWidth-1,tx+1);nx++)
+						nearTouched |= hiz[ny*hizWidth+nx].touched;
+				edgeMarkTiles[ty*hizWidth+tx] = nearTouched;
+			}
+
+		//the border is higher than any poly id, so it never makes an edge and the neighbours can be read without bounds checks
+		const int stride = width+2;
+		edgeMarkIds.resize(stride*(height+2));
+		memset(&edgeMarkIds[0], 0xFF, edgeMarkIds.size());
+		const u8 clearPolyID = (gfx3d.renderState.clearColor>>24)&0x3F;
+		for(int y=0; y<height; y++)
+		{
+			u8 *ids = &edgeMarkIds[(y+1)*stride+1];
+			memset(ids, clearPolyID, width);
+			for(int tx=0;tx<hizWidth;tx++)
+			{
+				if(!hiz[(y/SOFTRAST_HIZ_SIZE)*hizWidth+tx].touched) continue;
+				for(int x=tx*SOFTRAST_HIZ_SIZE;x<(tx+1)*SOFTRAST_HIZ_SIZE;x++)
+					ids[x] = screen[y*width+x].polyid.opaque;
+			}
+		}
+
+		//the tiles are walked in raster order, so neighbours blended onto by several pixels come out the same as before
+		for(int y=0; y<height; y++)
 		{
-			for(int x=0; x<GFX3D_FRAMEBUFFER_WIDTH; x++,i++)
+			const u8 *ids = &edgeMarkIds[(y+1)*stride+1];
+			for(int tx=0;tx<hizWidth;tx++)
 			{
-				Fragment destFragment = screen[i];
-				u8 self = destFragment.polyid.opaque;
-				if(edgeMarkDisabled[self>>3]) continue;
-				if(destFragment.isTranslucentPoly) continue;
+				if(!edgeMarkTiles[(y/SOFTRAST_HIZ_SIZE)*hizWidth+tx]) continue;
+
+				const int tileLeft = tx*SOFTRAST_HIZ_SIZE;
+				u8 candidates[SOFTRAST_HIZ_SIZE];
+				if(!findEdgeCandidates(ids+tileLeft, stride, candidates)) continue;
 
-				// > is used instead of != to prevent double edges
-				// between overlapping polys of different IDs.
-				// also note that the edge generally goes on the outside, not the inside, (maybe needs to change later)
-				// and that polys with the same edge color can make edges against each other.
+				for(int x=tileLeft; x<tileLeft+SOFTRAST_HIZ_SIZE; x++)
+				{
+					if(!candidates[x-tileLeft]) continue;
+
+					const int i = y*width+x;
+					Fragment destFragment = screen[i];
+					u8 self = destFragment.polyid.opaque;
+					if(edgeMarkDisabled[self>>3]) continue;
+					if(destFragment.isTranslucentPoly) continue;
+
+					// > is used instead of != to prevent double edges
+					// between overlapping polys of different IDs.
+					// also note that the edge generally goes on the outside, not the inside, (maybe needs to change later)
+					// and that polys with the same edge color can make edges against each other.
 
-				FragmentColor edgeColor = edgeMarkColors[self>>3];
+					FragmentColor edgeColor = edgeMarkColors[self>>3];
 
-#define PIXOFFSET(dx,dy) ((dx)+(GFX3D_FRAMEBUFFER_WIDTH*(dy)))
-#define ISEDGE(dx,dy) ((x+(dx)!=GFX3D_FRAMEBUFFER_WIDTH) && (x+(dx)!=-1) && (y+(dy)!=GFX3D_FRAMEBUFFER_HEIGHT) && (y+(dy)!=-1) && self > screen[i+PIXOFFSET(dx,dy)].polyid.opaque)
+#define PIXOFFSET(dx,dy) ((dx)+(width*(dy)))
+#define ISEDGE(dx,dy) (self > ids[x+(dx)+(stride*(dy))])
 #define DRAWEDGE(dx,dy) alphaBlend(screenColor[i+PIXOFFSET(dx,dy)], edgeColor)
 
-				bool upleft    = ISEDGE(-1,-1);
-				bool up        = ISEDGE( 0,-1);
-				bool upright   = ISEDGE( 1,-1);
-				bool left      = ISEDGE(-1, 0);
-				bool right     = ISEDGE( 1, 0);
-				bool downleft  = ISEDGE(-1, 1);
-				bool down      = ISEDGE( 0, 1);
-				bool downright = ISEDGE( 1, 1);
-
-				if(upleft && upright && downleft && !downright)
-					DRAWEDGE(-1,-1);
-				if(up && !down)
-					DRAWEDGE(0,-1);
-				if(upleft && upright && !downleft && downright)
-					DRAWEDGE(1,-1);
-				if(left && !right)
-					DRAWEDGE(-1,0);
-				if(right && !left)
-					DRAWEDGE(1,0);
-				if(upleft && !upright && downleft && downright)
-					DRAWEDGE(-1,1);
-				if(down && !up)
-					DRAWEDGE(0,1);
-				if(!upleft && upright && downleft && downright)
-					DRAWEDGE(1,1);
+					bool upleft    = ISEDGE(-1,-1);
+					bool up        = ISEDGE( 0,-1);
+					bool upright   = ISEDGE( 1,-1);
+					bool left      = ISEDGE(-1, 0);
+					bool right     = ISEDGE( 1, 0);
+					bool downleft  = ISEDGE(-1, 1);
+					bool down      = ISEDGE( 0, 1);
+					bool downright = ISEDGE( 1, 1);
+
+					if(upleft && upright && downleft && !downright)
+						DRAWEDGE(-1,-1);
+					if(up && !down)
+						DRAWEDGE(0,-1);
+					if(upleft && upright && !downleft && downright)
+						DRAWEDGE(1,-1);
+					if(left && !right)
+						DRAWEDGE(-1,0);
+					if(right && !left)
+						DRAWEDGE(1,0);
+					if(upleft && !upright && downleft && downright)
+						DRAWEDGE(-1,1);
+					if(down && !up)
+						DRAWEDGE(0,1);
+					if(!upleft && upright && downleft && downright)
+						DRAWEDGE(1,1);
 
 #undef PIXOFFSET
 #undef ISEDGE
 #undef DRAWEDGE
 
+				}
 			}
 		}
 	}
 
 	if(gfx3d.renderState.enableFog)
 	{
-		u32 r = GFX3D_5TO6((gfx3d.renderState.fogColor)&0x1F);
-		u32 g = GFX3D_5TO6((gfx3d.renderState.fogColor>>5)&0x1F);
-		u32 b = GFX3D_5TO6((gfx3d.renderState.fogColor>>10)&0x1F);
-		u32 a = (gfx3d.renderState.fogColor>>16)&0x1F;
-		for(int i=0; i<GFX3D_FRAMEBUFFER_WIDTH*GFX3D_FRAMEBUFFER_HEIGHT; i++)
-		{
-			Fragment &destFragment = screen[i];
-			if(!destFragment.fogged) continue;
-			FragmentColor &destFragmentColor = screenColor[i];
-			u32 fogIndex = destFragment.depth>>9;
-			assert(fogIndex<32768);
-			u8 fog = fogTable[fogIndex];
-			if(fog==127) fog=128;
-			if(!gfx3d.renderState.enableFogAlphaOnly)
+		FragmentColor fogColor;
+		fogColor.r = GFX3D_5TO6((gfx3d.renderState.fogColor)&0x1F);
+		fogColor.g = GFX3D_5TO6((gfx3d.renderState.fogColor>>5)&0x1F);
+		fogColor.b = GFX3D_5TO6((gfx3d.renderState.fogColor>>10)&0x1F);
+		fogColor.a = (gfx3d.renderState.fogColor>>16)&0x1F;
+
+		//without a clear image the untouched tiles are all the same cleared fragment, so they are fogged once and copied
+		bool haveFoggedClear = false;
+		FragmentColor foggedClear;
+		for(int y=0; y<height; y++)
+		{
+			for(int tx=0;tx<hizWidth;tx++)
 			{
-				destFragmentColor.r = ((128-fog)*destFragmentColor.r + r*fog)>>7;
-				destFragmentColor.g = ((128-fog)*destFragmentColor.g + g*fog)>>7;
-				destFragmentColor.b = ((128-fog)*destFragmentColor.b + b*fog)>>7;
+				const int i = y*width+tx*SOFTRAST_HIZ_SIZE;
+				if(!hiz[(y/SOFTRAST_HIZ_SIZE)*hizWidth+tx].touched && !clearImageUsed)
+				{
+					if(!screen[i].fogged) continue;
+					if(haveFoggedClear)
+					{
+						for(int k=0;k<SOFTRAST_HIZ_SIZE;k++)
+							screenColor[i+k] = foggedClear;
+						continue;
+					}
+					fogRun(i, SOFTRAST_HIZ_SIZE, fogColor);
+					foggedClear = screenColor[i];
+					haveFoggedClear = true;
+					continue;
+				}
+				fogRun(i, SOFTRAST_HIZ_SIZE, fogColor);
 			}
-			destFragmentColor.a = ((128-fog)*destFragmentColor.a + a*fog)>>7;
 		}
 	}
 
 	////debug alpha channel framebuffer contents
-	//for(int i=0;i<GFX3D_FRAMEBUFFER_WIDTH*GFX3D_FRAMEBUFFER_HEIGHT;i++)
+	//for(int i=0;i<width*height;i++)
 	//{
 	//	FragmentColor &destFragmentColor = screenColor[i];
 	//	destFragmentColor.r = destFragmentColor.a;
@@ -1496,6 +2418,12 @@ void SoftRasterizerEngine::framebufferProcess()
 
 void SoftRasterizerEngine::performClipping(bool hirez)
 {
+	//verts are shared between polys, so classify each of them against the clip planes once
+	if(vertOutcodes.size() < (size_t)vertlist->count)
+		vertOutcodes.resize(vertlist->count);
+	if(vertlist->count > 0)
+		GFX3D_Clipper::calcOutcodes(vertlist->list, vertlist->count, &vertOutcodes[0]);
+
 	//submit all polys to clipper
 	clipper.reset();
 	for(int i=0;i<polylist->count;i++)
@@ -1509,15 +2437,125 @@ void SoftRasterizerEngine::performClipping(bool hirez)
 				?&vertlist->list[poly->vertIndexes[3]]
 				:NULL
 		};
+		const u8 outcodes[4] = {
+			vertOutcodes[poly->vertIndexes[0]],
+			vertOutcodes[poly->vertIndexes[1]],
+			vertOutcodes[poly->vertIndexes[2]],
+			poly->type==4
+				?vertOutcodes[poly->vertIndexes[3]]
+				:(u8)0
+		};
 
 		if(hirez)
-			clipper.clipPoly<true>(poly,clipVerts);
+			clipper.clipPoly<true>(poly,clipVerts,outcodes);
 		else
-			clipper.clipPoly<false>(poly,clipVerts);
+			clipper.clipPoly<false>(poly,clipVerts,outcodes);
 	}
 	clippedPolyCounter = clipper.clippedPolyCounter;
 }
 
+static FORCEINLINE void viewportTransform(VERT &vert, const SoftRasterizerViewportJob &job, const float xmax, const float ymax)
+{
+	//homogeneous divide
+	vert.coord[0] = (vert.coord[0]+vert.coord[3]) / (2*vert.coord[3]);
+	vert.coord[1] = (vert.coord[1]+vert.coord[3]) / (2*vert.coord[3]);
+	vert.coord[2] = (vert.coord[2]+vert.coord[3]) / (2*vert.coord[3]);
+	vert.texcoord[0] /= vert.coord[3];
+	vert.texcoord[1] /= vert.coord[3];
+
+	//CONSIDER: do we need to guarantee that these are in bounds? perhaps not.
+	//vert.coord[0] = max(0.0f,min(1.0f,vert.coord[0]));
+	//vert.coord[1] = max(0.0f,min(1.0f,vert.coord[1]));
+	//vert.coord[2] = max(0.0f,min(1.0f,vert.coord[2]));
+
+	//perspective-correct the colors
+	vert.fcolor[0] /= vert.coord[3];
+	vert.fcolor[1] /= vert.coord[3];
+	vert.fcolor[2] /= vert.coord[3];
+
+	//viewport transformation
+	vert.coord[0] *= job.scaleX;
+	vert.coord[0] += job.offsetX;
+	vert.coord[1] *= job.scaleY;
+	vert.coord[1] += job.offsetY;
+	vert.coord[1] = ymax - vert.coord[1];
+
+	//well, i guess we need to do this to keep Princess Debut from rendering huge polys.
+	//there must be something strange going on
+	vert.coord[0] = max(0.0f,min(xmax,vert.coord[0]));
+	vert.coord[1] = max(0.0f,min(ymax,vert.coord[1]));
+}
+
+#ifdef ENABLE_NEON
+static FORCEINLINE float32x4_t viewportDivide(const float32x4_t n, const float32x4_t d)
+{
+#ifdef __aarch64__
+	return vdivq_f32(n, d);
+#else
+	//armv7 has no vector divide. two newton steps take the reciprocal estimate to within an ulp or so
+	float32x4_t r = vrecpeq_f32(d);
+	r = vmulq_f32(vrecpsq_f32(d, r), r);
+	r = vmulq_f32(vrecpsq_f32(d, r), r);
+	return vmulq_f32(n, r);
+#endif
+}
+
+//keeps v in [0,limit] the way max(0,min(limit,v)) does, so a NaN comes out as limit
+static FORCEINLINE float32x4_t viewportClamp(const float32x4_t v, const float32x4_t limit)
+{
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	const float32x4_t clamped = vbslq_f32(vcltq_f32(v, limit), v, limit);
+	return vbslq_f32(vcgtq_f32(clamped, zero), clamped, zero);
+}
+
+//the same as viewportTransform() for four verts at once. their fields are gathered into a lane each
+//so that the eight divides of each go through together, then scattered back
+static void viewportTransform4(const SoftRasterizerViewportJob *jobs, const float xmax, const float ymax)
+{
+	CACHE_ALIGN float lanes[13][4];
+	for(int k=0;k<4;k++)
+	{
+		const VERT &vert = *jobs[k].vert;
+		for(int c=0;c<4;c++)
+			lanes[c][k] = vert.coord[c];
+		lanes[4][k] = vert.texcoord[0];
+		lanes[5][k] = vert.texcoord[1];
+		for(int c=0;c<3;c++)
+			lanes[6+c][k] = vert.fcolor[c];
+		lanes[9][k] = jobs[k].scaleX;
+		lanes[10][k] = jobs[k].offsetX;
+		lanes[11][k] = jobs[k].scaleY;
+		lanes[12][k] = jobs[k].offsetY;
+	}
+
+	const float32x4_t w = vld1q_f32(lanes[3]);
+	const float32x4_t w2 = vaddq_f32(w, w);
+	float32x4_t x = viewportDivide(vaddq_f32(vld1q_f32(lanes[0]), w), w2);
+	float32x4_t y = viewportDivide(vaddq_f32(vld1q_f32(lanes[1]), w), w2);
+	vst1q_f32(lanes[2], viewportDivide(vaddq_f32(vld1q_f32(lanes[2]), w), w2));
+	for(int c=4;c<9;c++)
+		vst1q_f32(lanes[c], viewportDivide(vld1q_f32(lanes[c]), w));
+
+	//kept as a separate multiply and add so that they round like the scalar ones
+	x = vaddq_f32(vmulq_f32(x, vld1q_f32(lanes[9])), vld1q_f32(lanes[10]));
+	y = vaddq_f32(vmulq_f32(y, vld1q_f32(lanes[11])), vld1q_f32(lanes[12]));
+	y = vsubq_f32(vdupq_n_f32(ymax), y);
+	vst1q_f32(lanes[0], viewportClamp(x, vdupq_n_f32(xmax)));
+	vst1q_f32(lanes[1], viewportClamp(y, vdupq_n_f32(ymax)));
+
+	for(int k=0;k<4;k++)
+	{
+		VERT &vert = *jobs[k].vert;
+		for(int c=0;c<3;c++)
+			vert.coord[c] = lanes[c][k];
+		vert.texcoord[0] = lanes[4][k];
+		vert.texcoord[1] = lanes[5][k];
+		for(int c=0;c<3;c++)
+			vert.fcolor[c] = lanes[6+c][k];
+	}
+}
+#endif
+
 template<bool CUSTOM> void SoftRasterizerEngine::performViewportTransforms(int width, int height)
 {
 	const float xfactor = (float)width/GFX3D_FRAMEBUFFER_WIDTH;
@@ -1525,45 +2563,85 @@ template<bool CUSTOM> void SoftRasterizerEngine::performViewportTransforms(int w
 	const float xmax = GFX3D_FRAMEBUFFER_WIDTH*xfactor-(CUSTOM?0.001f:0); //fudge factor to keep from overrunning render buffers
 	const float ymax = GFX3D_FRAMEBUFFER_HEIGHT*yfactor-(CUSTOM?0.001f:0);
 
+	//a vert shared by the polys of a strip is transformed the first time one of them needs it
+	if(viewportVerts.size() < (size_t)vertlist->count)
+	{
+		viewportVerts.resize(vertlist->count);
+		viewportVertStamps.resize(vertlist->count, 0);
+		viewportVertViewports.resize(vertlist->count, 0);
+	}
+	if(++viewportStamp == 0)
+	{
+		std::fill(viewportVertStamps.begin(), viewportVertStamps.end(), 0);
+		viewportStamp = 1;
+	}
 
-	//viewport transforms
+	//gather the verts which need transforming first, so that they can go through four at a time
+	viewportJobs.clear();
 	for(int i=0;i<clippedPolyCounter;i++)
 	{
 		GFX3D_Clipper::TClippedPoly &poly = clippedPolys[i];
-		for(int j=0;j<poly.type;j++)
-		{
-			VERT &vert = poly.clipVerts[j];
+		VIEWPORT viewport;
+		viewport.decode(poly.poly->viewport);
 
-			//homogeneous divide
-			vert.coord[0] = (vert.coord[0]+vert.coord[3]) / (2*vert.coord[3]);
-			vert.coord[1] = (vert.coord[1]+vert.coord[3]) / (2*vert.coord[3]);
-			vert.coord[2] = (vert.coord[2]+vert.coord[3]) / (2*vert.coord[3]);
-			vert.texcoord[0] /= vert.coord[3];
-			vert.texcoord[1] /= vert.coord[3];
+		SoftRasterizerViewportJob job;
+		job.scaleX = viewport.width * xfactor;
+		job.offsetX = viewport.x * xfactor;
+		job.scaleY = viewport.height * yfactor;
+		job.offsetY = viewport.y * yfactor;
 
-			//CONSIDER: do we need to guarantee that these are in bounds? perhaps not.
-			//vert.coord[0] = max(0.0f,min(1.0f,vert.coord[0]));
-			//vert.coord[1] = max(0.0f,min(1.0f,vert.coord[1]));
-			//vert.coord[2] = max(0.0f,min(1.0f,vert.coord[2]));
-
-			//perspective-correct the colors
-			vert.fcolor[0] /= vert.coord[3];
-			vert.fcolor[1] /= vert.coord[3];
-			vert.fcolor[2] /= vert.coord[3];
+		if(poly.srcVerts[0])
+		{
+			for(int j=0;j<poly.type;j++)
+			{
+				const int index = poly.srcVerts[j] - vertlist->list;
+				//the strip keeps the vert on the viewport it first needed it with.
+				//a strip can change viewports halfway along, and then the poly transforms its own copy
+				if(viewportVertStamps[index] != viewportStamp)
+				{
+					viewportVerts[index] = *poly.srcVerts[j];
+					viewportVertStamps[index] = viewportStamp;
+					viewportVertViewports[index] = poly.poly->viewport;
+					job.vert = &viewportVerts[index];
+					viewportJobs.push_back(job);
+				}
+				else if(viewportVertViewports[index] != poly.poly->viewport)
+				{
+					poly.clipVerts[j] = *poly.srcVerts[j];
+					job.vert = &poly.clipVerts[j];
+					viewportJobs.push_back(job);
+				}
+			}
+		}
+		else
+		{
+			for(int j=0;j<poly.type;j++)
+			{
+				job.vert = &poly.clipVerts[j];
+				viewportJobs.push_back(job);
+			}
+		}
+	}
 
-			//viewport transformation
-			VIEWPORT viewport;
-			viewport.decode(poly.poly->viewport);
-			vert.coord[0] *= viewport.width * xfactor;
-			vert.coord[0] += viewport.x * xfactor;
-			vert.coord[1] *= viewport.height * yfactor;
-			vert.coord[1] += viewport.y * yfactor;
-			vert.coord[1] = ymax - vert.coord[1];
+	//viewport transforms
+	size_t k = 0;
+#ifdef ENABLE_NEON
+	for(;k+4<=viewportJobs.size();k+=4)
+		viewportTransform4(&viewportJobs[k], xmax, ymax);
+#endif
+	for(;k<viewportJobs.size();k++)
+		viewportTransform(*viewportJobs[k].vert, viewportJobs[k], xmax, ymax);
 
-			//well, i guess we need to do this to keep Princess Debut from rendering huge polys.
-			//there must be something strange going on
-			vert.coord[0] = max(0.0f,min(xmax,vert.coord[0]));
-			vert.coord[1] = max(0.0f,min(ymax,vert.coord[1]));
+	//the unclipped polys pick up the verts they share with the strip
+	for(int i=0;i<clippedPolyCounter;i++)
+	{
+		GFX3D_Clipper::TClippedPoly &poly = clippedPolys[i];
+		if(!poly.srcVerts[0]) continue;
+		for(int j=0;j<poly.type;j++)
+		{
+			const int index = poly.srcVerts[j] - vertlist->list;
+			if(viewportVertViewports[index] == poly.poly->viewport)
+				poly.clipVerts[j] = viewportVerts[index];
 		}
 	}
 }
@@ -1582,7 +2660,19 @@ void SoftRasterizerEngine::performCoordAdjustment(const bool skipBackfacing)
 		//here is a hack which needs to be removed.
 		//at some point our shape engine needs these to be converted to "fixed point"
 		//which is currently just a float
-		for(int j=0;j<type;j++)
+		int j = 0;
+#ifdef ENABLE_NEON
+		//the x and y of two verts at a time. the conversion truncates like iround() does
+		const float32x4_t sixteen = vdupq_n_f32(16.0f);
+		for(;j+2<=type;j+=2)
+		{
+			const float32x4_t xy = vcombine_f32(vld1_f32(verts[j].coord), vld1_f32(verts[j+1].coord));
+			const float32x4_t adjusted = vcvtq_f32_s32(vcvtq_s32_f32(vmulq_f32(xy, sixteen)));
+			vst1_f32(verts[j].coord, vget_low_f32(adjusted));
+			vst1_f32(verts[j+1].coord, vget_high_f32(adjusted));
+		}
+#endif
+		for(;j<type;j++)
 			for(int k=0;k<2;k++)
 				verts[j].coord[k] = (float)iround(16.0f * verts[j].coord[k]);
 	}
@@ -1593,6 +2683,7 @@ void SoftRasterizerEngine::setupTextures(const bool skipBackfacing)
 	TexCacheItem* lastTexKey = NULL;
 	u32 lastTextureFormat = 0, lastTexturePalette = 0;
 	bool needInitTexture = true;
+	newTextures.clear();
 	for(int i=0;i<clippedPolyCounter;i++)
 	{
 		GFX3D_Clipper::TClippedPoly &clippedPoly = clippedPolys[i];
@@ -1601,13 +2692,23 @@ void SoftRasterizerEngine::setupTextures(const bool skipBackfacing)
 		PolyAttr polyAttr;
 		polyAttr.setup(poly->polyAttr);
 
-		//make sure all the textures we'll need are cached
+		//the mask pass of a shadow volume never samples its texture (see drawrunShadowMask), so it isn't looked up
+		if(polyAttr.isShadowMask())
+		{
+			polyTexKeys[i] = NULL;
+			continue;
+		}
+
+		//make sure all the textures we'll need are in the cache
 		//(otherwise on a multithreaded system there will be multiple writers-- 
 		//this SHOULD be read-only, although some day the texcache may collect statistics or something
 		//and then it won't be safe.
+		//only the lookup happens here; new textures get decoded on the workers, or by the first unit to sample them
 		if(needInitTexture || lastTextureFormat != poly->texParam || lastTexturePalette != poly->texPalette)
 		{
-			lastTexKey = TexCache_SetTexture(TexFormat_15bpp,poly->texParam,poly->texPalette);
+			lastTexKey = TexCache_SetTextureDeferred(TexFormat_15bpp,poly->texParam,poly->texPalette);
+			if(lastTexKey->views[TexFormat_15bpp].decodeState != TexCacheItem::DECODE_DONE)
+				newTextures.push_back(lastTexKey);
 			lastTextureFormat = poly->texParam;
 			lastTexturePalette = poly->texPalette;
 			needInitTexture = false;
@@ -1616,6 +2717,10 @@ void SoftRasterizerEngine::setupTextures(const bool skipBackfacing)
 		//printf("%08X %d\n",poly->texParam,rasterizerUnit[0].textures.currentNum);
 		polyTexKeys[i] = lastTexKey;
 	}
+
+	//a texture used by polys that arent adjacent comes up more than once
+	std::sort(newTextures.begin(),newTextures.end());
+	newTextures.erase(std::unique(newTextures.begin(),newTextures.end()),newTextures.end());
 }
 
 void SoftRasterizerEngine::performBackfaceTests()
@@ -1655,6 +2760,52 @@ void SoftRasterizerEngine::performBackfaceTests()
 	}
 }
 
+void SoftRasterizerEngine::performTileBinning()
+{
+	tileCount = (height + SOFTRAST_TILE_HEIGHT - 1) / SOFTRAST_TILE_HEIGHT;
+	if((int)tiles.size() < tileCount)
+		tiles.resize(tileCount);
+
+	for(int t=0;t<tileCount;t++)
+	{
+		tiles[t].top = t*SOFTRAST_TILE_HEIGHT;
+		tiles[t].bottom = min(height, (t+1)*SOFTRAST_TILE_HEIGHT);
+		tiles[t].polys.clear();
+	}
+
+	//the coords have been through performCoordAdjustment by now, so they are 28.4.
+	//the shape engine draws scanlines ceil(ymin) through ceil(ymax)-1 (and ceil(ymin) for the line hack),
+	//so binning on that range is conservative.
+	for(int i=0;i<clippedPolyCounter;i++)
+	{
+		if(!polyVisible[i]) continue;
+
+		GFX3D_Clipper::TClippedPoly &clippedPoly = clippedPolys[i];
+		VERT* verts = &clippedPoly.clipVerts[0];
+
+		float ymin = verts[0].y, ymax = verts[0].y;
+		for(int j=1;j<clippedPoly.type;j++)
+		{
+			ymin = min(ymin, verts[j].y);
+			ymax = max(ymax, verts[j].y);
+		}
+
+		const int first = max(0, Ceil28_4((fixed28_4)ymin));
+		const int last = min(height-1, max(first, Ceil28_4((fixed28_4)ymax) - 1));
+		if(first > last) continue;
+
+		for(int t=first/SOFTRAST_TILE_HEIGHT; t<=last/SOFTRAST_TILE_HEIGHT; t++)
+			tiles[t].polys.push_back(i);
+	}
+
+	nextTile = 0;
+}
+
+int SoftRasterizerEngine::takeTile()
+{
+	return __sync_fetch_and_add(&nextTile, 1);
+}
+
 void _HACK_Viewer_ExecUnit(SoftRasterizerEngine* engine)
 {
 	_HACK_viewer_rasterizerUnit.mainLoop<false>(engine);
@@ -1662,47 +2813,78 @@ void _HACK_Viewer_ExecUnit(SoftRasterizerEngine* engine)
 
 static void SoftRastRender()
 {
+	PROFILE_ZONE(PROFILE_3D_RENDER);
+
 	// Force threads to finish before rendering with new data
 	if (rasterizerCores > 1)
-	{
-		for(unsigned int i = 0; i < rasterizerCores; i++)
-		{
-			rasterizerUnitTask[i].finish();
-		}
-	}
+		rasterizerUnitGroup->wait();
 	
 	mainSoftRasterizer.polylist = gfx3d.polylist;
 	mainSoftRasterizer.vertlist = gfx3d.vertlist;
 	mainSoftRasterizer.indexlist = &gfx3d.indexlist;
-	mainSoftRasterizer.screen = _screen;
-	mainSoftRasterizer.screenColor = _screenColor;
-	mainSoftRasterizer.width = GFX3D_FRAMEBUFFER_WIDTH;
-	mainSoftRasterizer.height = GFX3D_FRAMEBUFFER_HEIGHT;
+
+	softRastScale = max(1, min(SOFTRAST_MAX_SCALE, CommonSettings.GFX3D_SoftRastScale));
+	const int width = GFX3D_FRAMEBUFFER_WIDTH*softRastScale;
+	const int height = GFX3D_FRAMEBUFFER_HEIGHT*softRastScale;
+	if((int)_screen.size() != width*height)
+	{
+		//advised before they are filled, so that the upscaled ones can start out on huge pages
+		_screen.reserve(width*height);
+		_screenColor.reserve(width*height);
+		hostmem_advise_huge(_screen.data(), _screen.capacity()*sizeof(Fragment));
+		hostmem_advise_huge(_screenColor.data(), _screenColor.capacity()*sizeof(FragmentColor));
+		_screen.resize(width*height);
+		_screenColor.resize(width*height);
+	}
+
+	mainSoftRasterizer.screen = &_screen[0];
+	mainSoftRasterizer.screenColor = &_screenColor[0];
+	mainSoftRasterizer.width = width;
+	mainSoftRasterizer.height = height;
 
 	//setup fog variables (but only if fog is enabled)
 	if(gfx3d.renderState.enableFog)
 		mainSoftRasterizer.updateFogTable();
 	
-	mainSoftRasterizer.initFramebuffer(GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT, gfx3d.renderState.enableClearImage?true:false);
+	//with the workers each tile gets cleared by the one that draws it, just before
+	mainSoftRasterizer.initFramebuffer(width, height, gfx3d.renderState.enableClearImage?true:false, rasterizerCores > 1);
 	mainSoftRasterizer.updateToonTable();
 	mainSoftRasterizer.updateFloatColors();
 	mainSoftRasterizer.performClipping(CommonSettings.GFX3D_HighResolutionInterpolateColor);
-	mainSoftRasterizer.performViewportTransforms<false>(GFX3D_FRAMEBUFFER_WIDTH, GFX3D_FRAMEBUFFER_HEIGHT);
+	if(softRastScale == 1)
+		mainSoftRasterizer.performViewportTransforms<false>(width, height);
+	else
+		mainSoftRasterizer.performViewportTransforms<true>(width, height);
 	mainSoftRasterizer.performBackfaceTests();
 	mainSoftRasterizer.performCoordAdjustment(true);
 	mainSoftRasterizer.setupTextures(true);
+	if (rasterizerCores > 1)
+		mainSoftRasterizer.performTileBinning();
 
 	softRastHasNewData = true;
 	
 	if (rasterizerCores > 1)
 	{
-		for(unsigned int i = 0; i < rasterizerCores; i++)
+		//queue the decodes first so the workers pick them up ahead of the tiles
+		for(size_t i = 0; i < mainSoftRasterizer.newTextures.size(); i++)
+			rasterizerUnitGroup->run(&execTexDecode, mainSoftRasterizer.newTextures[i]);
+
+		//the units take the tiles as they come, so any number of them covers the frame
+		rasterizerUnits = rasterizerCores;
+		if(CommonSettings.GFX3D_SoftRastCores > 0)
+			rasterizerUnits = min(rasterizerUnits, (unsigned int)CommonSettings.GFX3D_SoftRastCores);
+		//the game's preset caps it on top of what the frontend asks for
+		const GamePreset& preset = gamepreset_current();
+		if(preset.has(GAMEPRESET_CORES) && preset.value[GAMEPRESET_CORES] > 0)
+			rasterizerUnits = min(rasterizerUnits, (unsigned int)preset.value[GAMEPRESET_CORES]);
+		for(unsigned int i = 0; i < rasterizerUnits; i++)
 		{
-			rasterizerUnitTask[i].execute(&execRasterizerUnit, (void *)i);
+			rasterizerUnitGroup->run(&execRasterizerUnit, (void *)i);
 		}
 	}
 	else
 	{
+		rasterizerUnits = 1;
 		rasterizerUnit[0].mainLoop<false>(&mainSoftRasterizer);
 	}
 }
@@ -1713,15 +2895,22 @@ static void SoftRastRenderFinish()
 	{
 		return;
 	}
+	PROFILE_ZONE(PROFILE_3D_FINISH);
 	
 	if (rasterizerCores > 1)
+		rasterizerUnitGroup->wait();
+	
+	for(unsigned int i = 0; i < rasterizerUnits; i++)
 	{
-		for(unsigned int i = 0; i < rasterizerCores; i++)
-		{
-			rasterizerUnitTask[i].finish();
-		}
+		mainSoftRasterizer.hizTested += rasterizerUnit[i].hizTested;
+		mainSoftRasterizer.hizRejected += rasterizerUnit[i].hizRejected;
 	}
+#ifdef _SHOW_HIZ_COUNTERS
+	CORELOG_INFO("hi-z rejected %u of %u span runs\n", mainSoftRasterizer.hizRejected, mainSoftRasterizer.hizTested);
+#endif
 	
+	//textures no poly got around to sampling are still pending
+	TexCache_FinishDecodes();
 	TexCache_EvictFrame();
 	
 	mainSoftRasterizer.framebufferProcess();
@@ -1732,9 +2921,31 @@ static void SoftRastRenderFinish()
 	softRastHasNewData = false;
 }
 
+static char SoftRastInitFloat(void)
+{
+	mainSoftRasterizer.fixedPoint = false;
+	return SoftRastInit();
+}
+
+static char SoftRastInitFixed(void)
+{
+	mainSoftRasterizer.fixedPoint = true;
+	return SoftRastInit();
+}
+
 GPU3DInterface gpu3DRasterize = {
 	"SoftRasterizer",
-	SoftRastInit,
+	SoftRastInitFloat,
+	SoftRastReset,
+	SoftRastClose,
+	SoftRastRender,
+	SoftRastRenderFinish,
+	SoftRastVramReconfigureSignal
+};
+
+GPU3DInterface gpu3DRasterizeFixed = {
+	"SoftRasterizer (fixed point)",
+	SoftRastInitFixed,
 	SoftRastReset,
 	SoftRastClose,
 	SoftRastRender,
@@ -18,10 +18,13 @@
 #ifndef _RASTERIZE_H_
 #define _RASTERIZE_H_
 
+#include <vector>
+
 #include "render3D.h"
 #include "gfx3d.h"
 
 extern GPU3DInterface gpu3DRasterize;
+extern GPU3DInterface gpu3DRasterizeFixed;
 
 union FragmentColor {
 	u32 color;
@@ -57,6 +60,39 @@ struct Fragment
 
 class TexCacheItem;
 
+//the largest multiple of the native resolution the 3d can be rendered at
+#define SOFTRAST_MAX_SCALE 4
+
+//height in scanlines of the horizontal screen tiles which the rasterizer threads pull work from
+#define SOFTRAST_TILE_HEIGHT 8
+
+struct SoftRasterizerTile
+{
+	int top, bottom; //scanlines [top,bottom) covered by this tile
+	std::vector<int> polys; //indexes of the visible clipped polys touching this tile, in draw order
+};
+
+//size in pixels of the square coarse depth (hi-z) tiles.
+//it must divide SOFTRAST_TILE_HEIGHT so that every hi-z tile is only touched by one rasterizer thread
+#define SOFTRAST_HIZ_SIZE 8
+//span runs shorter than this are drawn without asking the hi-z buffer
+#define SOFTRAST_HIZ_MIN_RUN 4
+
+struct SoftRasterizerHiZTile
+{
+	u32 maxDepth; //no depth in the tile is greater than this
+	int refreshedBy; //the last poly which rescanned maxDepth
+	bool dirty; //depths have been written since maxDepth was rescanned
+	bool touched; //anything has been drawn into the tile this frame. the post passes skip tiles which are still cleared
+};
+
+//a vert waiting in performViewportTransforms, with its poly's viewport already scaled to the framebuffer
+struct SoftRasterizerViewportJob
+{
+	VERT *vert;
+	float scaleX, offsetX, scaleY, offsetY;
+};
+
 class SoftRasterizerEngine
 {
 public:
@@ -65,7 +101,8 @@ public:
 
 	SoftRasterizerEngine();
 	
-	void initFramebuffer(const int width, const int height, const bool clearImage);
+	void initFramebuffer(const int width, const int height, const bool clearImage, const bool deferClear);
+	void clearRows(const int top, const int bottom);
 	void framebufferProcess();
 	void updateToonTable();
 	void updateFogTable();
@@ -74,7 +111,11 @@ public:
 	template<bool CUSTOM> void performViewportTransforms(int width, int height);
 	void performCoordAdjustment(const bool skipBackfacing);
 	void performBackfaceTests();
+	void performTileBinning();
 	void setupTextures(const bool skipBackfacing);
+	int takeTile();
+	void refreshHiZTile(int tx, int ty);
+	void fogRun(int i, int count, const FragmentColor &fogColor);
 
 	FragmentColor toonTable[32];
 	u8 fogTable[32768];
@@ -82,6 +123,13 @@ public:
 	GFX3D_Clipper::TClippedPoly *clippedPolys;
 	int clippedPolyCounter;
 	TexCacheItem* polyTexKeys[POLYLIST_SIZE];
+	std::vector<TexCacheItem*> newTextures; //textures setupTextures left for the workers to decode
+	std::vector<u8> vertOutcodes; //clip plane outcodes of each vert in the vertlist
+	std::vector<VERT> viewportVerts; //the verts in the vertlist after the viewport transform, for the unclipped polys
+	std::vector<u32> viewportVertStamps; //the transform viewportVerts holds for each: the frame's stamp and its viewport
+	std::vector<u32> viewportVertViewports;
+	std::vector<SoftRasterizerViewportJob> viewportJobs; //the verts performViewportTransforms gathers, so it can transform them four at a time
+	u32 viewportStamp;
 	bool polyVisible[POLYLIST_SIZE];
 	bool polyBackfacing[POLYLIST_SIZE];
 	Fragment *screen;
@@ -90,6 +138,22 @@ public:
 	VERTLIST* vertlist;
 	INDEXLIST* indexlist;
 	int width, height;
+	bool clearImageUsed;
+	//what initFramebuffer clears to. the clear image's native lines are copied in the order they are shown, so that
+	//the workers which clear their tiles with them don't read the vram the emulation goes on writing
+	Fragment clearFragment;
+	FragmentColor clearFragmentColor;
+	u16 clearXScroll;
+	std::vector<u16> clearImageLines, clearDepthLines;
+	std::vector<SoftRasterizerTile> tiles;
+	int tileCount;
+	volatile s32 nextTile;
+	std::vector<SoftRasterizerHiZTile> hiz;
+	int hizWidth, hizHeight;
+	u32 hizTested, hizRejected; //span runs checked against the hi-z buffer last frame, and how many were skipped
+	std::vector<u8> edgeMarkIds; //opaque poly ids with a border, for edge marking
+	std::vector<u8> edgeMarkTiles; //the hi-z tiles which can have edges
+	bool fixedPoint; //interpolate edges and spans with integer math, like the hardware
 };
 
 
@@ -38,6 +38,7 @@ GPU3DInterface gpu3DNull = {
 };
 
 GPU3DInterface *gpu3D = &gpu3DNull;
+Render3DGPUFrame gpu3DFrame = { 0, NULL };
 static bool default3DAlreadyClearedLayer = false;
 
 char Default3D_Init()
@@ -87,15 +88,25 @@ void NDS_3D_SetDriver (int core3DIndex)
 
 bool NDS_3D_ChangeCore(int newCore)
 {
+	//a pipelined frame the old core is still on lands before it closes. the texture cache is kept through the
+	//switch: the old core only gives back its own texture ids, and the decoded textures are there for the new one
+	gpu3D->NDS_3D_RenderFinish();
 	gpu3D->NDS_3D_Close();
+	gpu3DFrame.texture = 0;
+	gpu3DFrame.fence = NULL;
 	NDS_3D_SetDriver(newCore);
+	bool ok = true;
 	if(gpu3D->NDS_3D_Init() == 0)
 	{
 		NDS_3D_SetDriver(GPU3D_NULL);
 		gpu3D->NDS_3D_Init();
-		return false;
+		ok = false;
 	}
-	return true;
+
+	//closing the core cleared the screen the last render left, so the new one draws the same frame straight away
+	//rather than leaving it blank until the game flushes again
+	gfx3d_renderAgain();
+	return ok;
 }
 
 Render3D::Render3D()
@@ -74,6 +74,16 @@ void Default3D_VramReconfigureSignal();
 void NDS_3D_SetDriver (int core3DIndex);
 bool NDS_3D_ChangeCore(int newCore);
 
+//a renderer that can leave its frame on the gpu, for the frontend to mix with the 2d there (GPUCompositeFrame),
+//sets this when CommonSettings.GFX3D_GPUComposite asks for it: the texture the last frame is in, bottom row first, and the
+//fence that is signalled once it's done (NULL if it was finished before). texture is 0 when there's no such frame
+struct Render3DGPUFrame
+{
+	u32 texture;
+	void *fence;
+};
+extern Render3DGPUFrame gpu3DFrame;
+
 enum Render3DErrorCode
 {
 	RENDER3DERROR_NOERR = 0
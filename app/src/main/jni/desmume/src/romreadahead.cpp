@@ -0,0 +1,226 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <map>
+#include <set>
+#include <vector>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "romreadahead.h"
+#include "debug.h"
+#include "NDSSystem.h"
+#include "utils/fsnitro.h"
+#include "utils/task.h"
+
+//the learned sequences are a header followed by records of (u16 file, u16 next file): next was the file the game
+//went on to read after it. they are appended as they are learned, like the jit profile
+static const u8 kHeader[8] = {'D','S','R','A','1',0,0,0};
+static const u32 kRecordSize = 4;
+static const u32 kMaxRecords = 16384;
+//how many of the files learned to follow one are read ahead with it
+static const u32 kMaxFollowers = 4;
+//how much of one file is asked for; a bigger one is streamed, not loaded
+static const u32 kMaxFileReadAhead = 8*1024*1024;
+
+u32 romreadahead_rangeStart = 0;
+u32 romreadahead_rangeEnd = 0xFFFFFFFF;
+
+static FS_NITRO* fs = NULL;
+static FILE* sequenceFile = NULL;
+static u32 sequenceRecords = 0;
+static std::set<u32> sequenceIndex;
+static std::multimap<u16,u16> followers;
+//the files already asked for this session
+static std::vector<bool> readAhead;
+static u16 lastFile = 0xFFFF;
+
+//the ranges for the background thread to ask for, offsets into gameInfo.romMap. only the emulation thread adds
+static const u32 kQueueSize = 64;
+static struct { u32 from, len; } queue[kQueueSize];
+static volatile u32 queueHead = 0, queueTail = 0;
+static volatile bool running = false;
+static Task readAheadTask;
+
+static void* readAheadLoop(void*)
+{
+#ifndef WIN32
+	//a file that was asked for gets its pages started within a few ms; that is nothing next to reading them
+	const struct timespec interval = { 0, 4*1000*1000 };
+	const u32 page = (u32)sysconf(_SC_PAGESIZE);
+	while(__atomic_load_n(&running,__ATOMIC_ACQUIRE))
+	{
+		u32 tail = queueTail;
+		while(tail != __atomic_load_n(&queueHead,__ATOMIC_ACQUIRE))
+		{
+			const u32 from = queue[tail % kQueueSize].from & ~(page-1);
+			const u32 end = queue[tail % kQueueSize].from + queue[tail % kQueueSize].len;
+			madvise(gameInfo.romMap + from, end - from, MADV_WILLNEED);
+			tail++;
+			__atomic_store_n(&queueTail,tail,__ATOMIC_RELEASE);
+		}
+		nanosleep(&interval,NULL);
+	}
+#endif
+	return NULL;
+}
+
+static void requestFile(u16 id, u32 from)
+{
+	if(id >= readAhead.size() || readAhead[id]) return;
+	readAhead[id] = true;
+
+	const u32 start = std::max(from, fs->getStartAddrById(id));
+	const u32 end = std::min(fs->getEndAddrById(id), gameInfo.romsize);
+	if(end <= start) return;
+
+	const u32 head = queueHead;
+	if(head - queueTail >= kQueueSize) return; //the thread is behind; the kernel's own read ahead will do
+	queue[head % kQueueSize].from = start + gameInfo.headerOffset;
+	queue[head % kQueueSize].len = std::min(end - start, kMaxFileReadAhead);
+	__atomic_store_n(&queueHead,head+1,__ATOMIC_RELEASE);
+}
+
+static void learn(u16 from, u16 to)
+{
+	const u32 key = ((u32)from << 16) | to;
+	if(!sequenceIndex.insert(key).second) return;
+	followers.insert(std::make_pair(from,to));
+
+	if(!sequenceFile || sequenceRecords >= kMaxRecords) return;
+	u8 rec[kRecordSize];
+	memcpy(rec,&from,2);
+	memcpy(rec+2,&to,2);
+	fwrite(rec,1,kRecordSize,sequenceFile);
+	fflush(sequenceFile);
+	sequenceRecords++;
+}
+
+void romreadahead_enter(u32 pos)
+{
+	u16 id;
+	if(!fs || !fs->getFileIdByAddr(pos, id))
+	{
+		//between files (the header, the tables, padding): look again once the card leaves the 4K it is in
+		romreadahead_rangeStart = pos & ~0xFFF;
+		romreadahead_rangeEnd = romreadahead_rangeStart + 0x1000;
+		return;
+	}
+
+	romreadahead_rangeStart = fs->getStartAddrById(id);
+	romreadahead_rangeEnd = fs->getEndAddrById(id);
+	if(id == lastFile) return;
+
+	if(lastFile != 0xFFFF) learn(lastFile, id);
+	lastFile = id;
+
+	requestFile(id, pos);
+	u32 n = 0;
+	for(std::multimap<u16,u16>::const_iterator it = followers.lower_bound(id); it != followers.end() && it->first == id && n < kMaxFollowers; ++it, n++)
+		requestFile(it->second, 0);
+}
+
+void romreadahead_open(const char* fname)
+{
+	romreadahead_close();
+#ifndef WIN32
+	if(!gameInfo.romMap) return;
+
+	fs = new FS_NITRO(gameInfo.romdata);
+	if(fs->getNumFiles() == 0)
+	{
+		romreadahead_close();
+		return;
+	}
+	readAhead.assign(fs->getNumFiles(), false);
+
+	u32 validSize = 0;
+	long fileSize = 0;
+	FILE* inf = fopen(fname,"rb");
+	if(inf)
+	{
+		u8 header[sizeof(kHeader)];
+		if(fread(header,1,sizeof(header),inf) == sizeof(header) && !memcmp(header,kHeader,sizeof(kHeader)))
+		{
+			validSize = sizeof(kHeader);
+			u8 rec[kRecordSize];
+			while(sequenceRecords < kMaxRecords && fread(rec,1,kRecordSize,inf) == kRecordSize)
+			{
+				u16 from, to;
+				memcpy(&from,rec,2);
+				memcpy(&to,rec+2,2);
+				if(sequenceIndex.insert(((u32)from << 16) | to).second)
+					followers.insert(std::make_pair(from,to));
+				sequenceRecords++;
+				validSize += kRecordSize;
+			}
+		}
+		fseek(inf,0,SEEK_END);
+		fileSize = ftell(inf);
+		fclose(inf);
+	}
+
+	if(validSize != 0)
+	{
+		//drop a record torn by the app getting killed in the middle of writing it
+		if((long)validSize != fileSize)
+			truncate(fname,validSize);
+		sequenceFile = fopen(fname,"ab");
+	}
+	else
+	{
+		sequenceFile = fopen(fname,"wb");
+		if(sequenceFile) fwrite(kHeader,1,sizeof(kHeader),sequenceFile);
+	}
+
+	queueHead = queueTail = 0;
+	running = true;
+	readAheadTask.start(false,"ROMReadAhead",THREAD_ROLE_BACKGROUND);
+	readAheadTask.execute(readAheadLoop,NULL);
+
+	romreadahead_rangeStart = romreadahead_rangeEnd = 0;
+	CORELOG_INFO("ROM read ahead: %u files, %u learned sequences\n", fs->getNumFiles(), (u32)sequenceIndex.size());
+#endif
+}
+
+void romreadahead_close()
+{
+	//the thread reads from the mapping, so it is stopped before the rom goes
+	if(running)
+	{
+		__atomic_store_n(&running,false,__ATOMIC_RELEASE);
+		readAheadTask.finish();
+		readAheadTask.shutdown();
+	}
+
+	romreadahead_rangeStart = 0;
+	romreadahead_rangeEnd = 0xFFFFFFFF;
+	if(sequenceFile) fclose(sequenceFile);
+	sequenceFile = NULL;
+	sequenceRecords = 0;
+	sequenceIndex.clear();
+	followers.clear();
+	std::vector<bool>().swap(readAhead);
+	lastFile = 0xFFFF;
+	delete fs;
+	fs = NULL;
+}
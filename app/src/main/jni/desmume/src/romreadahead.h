@@ -0,0 +1,45 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ROMREADAHEAD_H
+#define _ROMREADAHEAD_H
+
+#include "types.h"
+
+//reads ahead of the card for a mapped rom. the first time the card reads from a nitrofs file, the rest of the file
+//is asked of the kernel (MADV_WILLNEED) from a background thread, so that a game loading it doesnt fault its pages
+//in one at a time off the sd card. the files the game went on to read next are learned and kept next to the
+//battery save, so that the next session asks for those along with it.
+//a rom loaded to memory or streamed through stdio has nothing to read ahead, and this stays off
+
+//starts it for the rom in gameInfo, learned sequences kept in fname
+void romreadahead_open(const char* fname);
+void romreadahead_close();
+
+//the range of the rom the card was last seen reading in, so that a read which stays in it costs two compares.
+//everything while it is off
+extern u32 romreadahead_rangeStart, romreadahead_rangeEnd;
+void romreadahead_enter(u32 pos);
+
+//card reads at pos call this
+FORCEINLINE void romreadahead_touch(u32 pos)
+{
+	if (pos - romreadahead_rangeStart >= romreadahead_rangeEnd - romreadahead_rangeStart)
+		romreadahead_enter(pos);
+}
+
+#endif
@@ -24,6 +24,7 @@
 #include "debug.h"
 #include "armcpu.h"
 #include <string.h>
+#include <algorithm>
 #include "saves.h"
 #ifdef WIN32
 #include "windows/main.h"
@@ -94,10 +95,21 @@ static inline u8 toBCD(u8 x)
 
 bool moviemode=false;
 
+static bool rtcDeterministic = false;
+static DateTime rtcDeterministicStart;
+static int rtcDeterministicFrame = 0;
+
+void rtcSetDeterministic(bool enable, const DateTime& start, int startFrame)
+{
+	rtcDeterministic = enable;
+	rtcDeterministicStart = start;
+	rtcDeterministicFrame = startFrame;
+}
+
 DateTime rtcGetTime(void)
 {
 	DateTime tm;
-	if(movieMode == MOVIEMODE_INACTIVE) {
+	if(movieMode == MOVIEMODE_INACTIVE && !rtcDeterministic) {
 		return DateTime::get_Now();
 	}
 	else {
@@ -108,10 +120,11 @@ DateTime rtcGetTime(void)
 		const u32 arm9rate_unitsperframe = 560190<<1;
 		const u32 arm9rate_unitspersecond = (u32)(arm9rate_unitsperframe * 59.8261);
 
-		u64 totalcycles = (u64)arm9rate_unitsperframe * currFrameCounter;
+		const int frames = rtcDeterministic ? std::max(currFrameCounter - rtcDeterministicFrame, 0) : currFrameCounter;
+		u64 totalcycles = (u64)arm9rate_unitsperframe * frames;
 		u64 totalseconds=totalcycles/arm9rate_unitspersecond;
 
-		DateTime timer = currMovieData.rtcStart;
+		DateTime timer = rtcDeterministic ? rtcDeterministicStart : currMovieData.rtcStart;
 		return timer.AddSeconds(totalseconds);
 	}
 }
@@ -25,6 +25,9 @@
 #include "utils/datetime.h"
 
 DateTime rtcGetTime(void);
+//makes the clock count emulated frames from start on, the way it does for movies, so that every run of a frame reads
+//the same time (for netplay). startFrame is the frame counter start is for
+void rtcSetDeterministic(bool enable, const DateTime& start = DateTime(), int startFrame = 0);
 
 extern	void rtcInit();
 extern	u16 rtcRead();
@@ -23,6 +23,8 @@
 #endif
 #include <stack>
 #include <set>
+#include <deque>
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -54,6 +56,8 @@
 #include "wifi.h"
 
 #include "path.h"
+#include "utils/task.h"
+#include "utils/fastcrc.h"
 
 #ifdef HOST_WINDOWS
 #include "windows/main.h"
@@ -663,9 +667,68 @@ void scan_savestates()
   return ;
 }
 
-void savestate_slot(int num)
+static void writechunks(EMUFILE* os);
+static bool savestate_write(EMUFILE_MEMORY* ms, EMUFILE* outstream, int compressionLevel);
+
+//the slot save being written
+static struct
+{
+	EMUFILE_MEMORY ms;
+	std::string filename;
+	int num;
+	int compressionLevel;
+	void (*done)(int num, bool ok);
+	bool ok;
+} slotSave;
+
+static Task slotSaveTask;
+static bool slotSaveTaskStarted = false;
+
+static void* slotSaveWrite(void*)
+{
+	//the state is written next to the old one and only replaces it once it is all there,
+	//so a save that gets cut short never costs the state that was in the slot
+	std::string tmpname = slotSave.filename + ".tmp";
+	EMUFILE_MEMORY out;
+	slotSave.ok = savestate_write(&slotSave.ms, &out, slotSave.compressionLevel);
+	if(slotSave.ok)
+	{
+		FILE* file = fopen(tmpname.c_str(),"wb");
+		slotSave.ok = file != NULL;
+		if(file)
+		{
+			slotSave.ok = fwrite(out.buf(),1,out.size(),file) == (size_t)out.size();
+			slotSave.ok = (fclose(file) == 0) && slotSave.ok;
+		}
+		if(slotSave.ok)
+			slotSave.ok = rename(tmpname.c_str(), slotSave.filename.c_str()) == 0;
+		if(!slotSave.ok)
+			remove(tmpname.c_str());
+	}
+	slotSave.ms.truncate(0);
+
+	struct stat sbuf;
+	int num = slotSave.num;
+	if (slotSave.ok && num >= 0 && num < NB_STATES && stat(slotSave.filename.c_str(),&sbuf) != -1)
+	{
+		savestates[num].exists = TRUE;
+		strncpy(savestates[num].date, format_time(sbuf.st_mtime),40);
+		savestates[num].date[40-1] = '\0';
+	}
+
+	if(slotSave.done)
+		slotSave.done(num, slotSave.ok);
+	return NULL;
+}
+
+void savestate_flush()
+{
+	if(slotSaveTaskStarted)
+		slotSaveTask.finish();
+}
+
+void savestate_slot(int num, int compressionLevel, void (*done)(int num, bool ok))
 {
-   struct stat sbuf;
    char filename[MAX_PATH+1];
 
 	lastSaveState = num;		//Set last savestate used
@@ -675,7 +738,30 @@ void savestate_slot(int num)
    if (strlen(filename) + strlen(".dsx") + strlen("-2147483648") /* = biggest string for num */ >MAX_PATH) return ;
    sprintf(filename+strlen(filename), ".ds%d", num);
 
-   if (savestate_save(filename))
+   if(!slotSaveTaskStarted)
+   {
+	   slotSaveTask.start(false, "Savestate", THREAD_ROLE_BACKGROUND);
+	   slotSaveTaskStarted = true;
+   }
+   //one save at a time: the one before has to be written before its buffer can be reused
+   slotSaveTask.finish();
+
+#ifdef HAVE_JIT 
+	arm_jit_sync();
+#endif
+   slotSave.ms.truncate(0);
+   writechunks(&slotSave.ms);
+   slotSave.filename = filename;
+   slotSave.num = num;
+   slotSave.compressionLevel = compressionLevel;
+   slotSave.done = done;
+   slotSaveTask.execute(slotSaveWrite, NULL);
+
+   if(done)
+	   return;
+
+   slotSaveTask.finish();
+   if (slotSave.ok)
    {
 	   osd->setLineColor(255, 255, 255);
 	   osd->addLine("Saved to %i slot", num);
@@ -684,17 +770,6 @@ void savestate_slot(int num)
    {
 	   osd->setLineColor(255, 0, 0);
 	   osd->addLine("Error saving %i slot", num);
-	   return;
-   }
-
-   if (num >= 0 && num < NB_STATES)
-   {
-	   if (stat(filename,&sbuf) != -1)
-	   {
-		   savestates[num].exists = TRUE;
-		   strncpy(savestates[num].date, format_time(sbuf.st_mtime),40);
-		   savestates[num].date[40-1] = '\0';
-	   }
    }
 }
 
@@ -708,6 +783,7 @@ void loadstate_slot(int num)
 
    if (strlen(filename) + strlen(".dsx") + strlen("-2147483648") /* = biggest string for num */ >MAX_PATH) return ;
    sprintf(filename+strlen(filename), ".ds%d", num);
+   savestate_flush();
    if (savestate_load(filename))
    {
 	   osd->setLineColor(255, 255, 255);
@@ -807,6 +883,12 @@ static bool ReadStateChunk(EMUFILE* is, const SFORMAT *sf, int size)
 
 
 
+//set while the rewind buffer (or a StateJournal) saves, which keeps main memory on its own
+static bool savestateSkipMainMem = false;
+//the main memory a state covers
+#define SAVESTATE_MEM_PAGES (0x800000>>MAINMEM_GENERATION_SHIFT)
+#define SAVESTATE_MEM_PAGE_SIZE (1<<MAINMEM_GENERATION_SHIFT)
+
 static int SubWrite(EMUFILE* os, const SFORMAT *sf)
 {
 	uint32 acc=0;
@@ -820,7 +902,7 @@ static int SubWrite(EMUFILE* os, const SFORMAT *sf)
 		const SFORMAT* seek = sf;
 		while(seek->v && seek != temp) {
 			if(!strcmp(seek->desc,temp->desc)) {
-				printf("ERROR! duplicated chunk name: %s\n", temp->desc);
+				CORELOG_ERROR("ERROR! duplicated chunk name: %s\n", temp->desc);
 			}
 			seek++;
 		}
@@ -829,6 +911,12 @@ static int SubWrite(EMUFILE* os, const SFORMAT *sf)
 
 	while(sf->v)
 	{
+		if(savestateSkipMainMem && (sf->v == MMU.MAIN_MEM || sf->v == MMU.MAIN_MEM+0x400000))
+		{
+			sf++;
+			continue;
+		}
+
 		//not supported right now
 		//if(sf->size==~0)		//Link to another struct
 		//{
@@ -858,7 +946,7 @@ static int SubWrite(EMUFILE* os, const SFORMAT *sf)
 			//make sure we dont dup any keys
 			if(keyset.find(sf->desc) != keyset.end())
 			{
-				printf("duplicate save key!\n");
+				CORELOG_INFO("duplicate save key!\n");
 				assert(false);
 			}
 			keyset.insert(sf->desc);
@@ -902,6 +990,162 @@ static int savestate_WriteChunk(EMUFILE* os, int type, const SFORMAT *sf)
 	return (bsize+8);
 }
 
+//a chunk made from one of the SFORMAT tables that live as long as the program, laid out the first time it is used.
+//the headers of its entries never change, so writing it is copying the data of each entry in between them, and
+//a chunk that loads with the same headers is copied back out the same way; one laid out any other way (an older
+//version's) goes through ReadStateChunk like before
+class SFORMAT_CHUNK
+{
+public:
+	SFORMAT_CHUNK(const SFORMAT* sf) : sf(sf) {}
+	int write(EMUFILE* os, int type);
+	bool read(EMUFILE* is, int size);
+
+private:
+	//entries bigger than this are written and read straight from where they are, instead of through the image
+	enum { DIRECT_SIZE = 1024 };
+
+	struct Span
+	{
+		u8* v;
+		u32 len;
+		u32 header;	//where its header is in the image
+		u32 at;		//where its data is in the image, or would be if it were there
+		bool direct;
+	};
+
+	struct Layout
+	{
+		bool built;
+		u32 size;					//of the whole chunk
+		std::vector<u8> image;		//the chunk, leaving out the data of the direct entries
+		std::vector<u8> scratch;	//the same, as read for a load
+		std::vector<Span> spans;
+		Layout() : built(false), size(0) {}
+	};
+
+	const SFORMAT* sf;
+	Layout layouts[2];	//with main memory, and without it for the rewind buffer
+
+	Layout& layout(bool skipMainMem);
+	bool readSegment(Layout& l, EMUFILE* is, u32 pos, u32 end, size_t& checked);
+	bool read(Layout& l, EMUFILE* is);
+};
+
+SFORMAT_CHUNK::Layout& SFORMAT_CHUNK::layout(bool skipMainMem)
+{
+	Layout& l = layouts[skipMainMem ? 1 : 0];
+	if(l.built)
+		return l;
+
+	for(const SFORMAT* e = sf; e->v; e++)
+	{
+		if(skipMainMem && (e->v == MMU.MAIN_MEM || e->v == MMU.MAIN_MEM+0x400000))
+			continue;
+
+		Span s;
+		s.v = (u8*)e->v;
+		s.len = e->size * e->count;
+		s.header = l.image.size();
+		l.image.insert(l.image.end(), e->desc, e->desc + 4);
+		for(int i = 0; i < 4; i++) l.image.push_back((u8)(e->size >> (i*8)));
+		for(int i = 0; i < 4; i++) l.image.push_back((u8)(e->count >> (i*8)));
+		s.at = l.image.size();
+		s.direct = s.len >= DIRECT_SIZE;
+		if(!s.direct)
+			l.image.resize(l.image.size() + s.len);
+		l.size += 12 + s.len;
+		l.spans.push_back(s);
+	}
+	l.scratch.resize(l.image.size());
+	l.built = true;
+	return l;
+}
+
+int SFORMAT_CHUNK::write(EMUFILE* os, int type)
+{
+#ifndef LOCAL_LE
+	return savestate_WriteChunk(os, type, sf);
+#else
+	Layout& l = layout(savestateSkipMainMem);
+	u8* image = &l.image[0];
+
+	for(size_t i = 0; i < l.spans.size(); i++)
+		if(!l.spans[i].direct)
+			memcpy(image + l.spans[i].at, l.spans[i].v, l.spans[i].len);
+
+	write32le(type, os);
+	write32le(l.size, os);
+	u32 pos = 0;
+	for(size_t i = 0; i < l.spans.size(); i++)
+	{
+		const Span& s = l.spans[i];
+		if(!s.direct) continue;
+		os->fwrite(image + pos, s.at - pos);
+		os->fwrite(s.v, s.len);
+		pos = s.at;
+	}
+	os->fwrite(image + pos, l.image.size() - pos);
+	return l.size + 8;
+#endif
+}
+
+//reads the image from pos up to end, checking the headers of the entries in it against ours
+bool SFORMAT_CHUNK::readSegment(Layout& l, EMUFILE* is, u32 pos, u32 end, size_t& checked)
+{
+	if(is->fread(&l.scratch[0] + pos, end - pos) != end - pos)
+		return false;
+	for(; checked < l.spans.size() && l.spans[checked].header < end; checked++)
+		if(memcmp(&l.scratch[l.spans[checked].header], &l.image[l.spans[checked].header], 12))
+			return false;
+	return true;
+}
+
+bool SFORMAT_CHUNK::read(Layout& l, EMUFILE* is)
+{
+	u32 pos = 0;
+	size_t checked = 0;
+	for(size_t i = 0; i < l.spans.size(); i++)
+	{
+		const Span& s = l.spans[i];
+		if(!s.direct) continue;
+		if(!readSegment(l, is, pos, s.at, checked))
+			return false;
+		if(is->fread(s.v, s.len) != s.len)
+			return false;
+		pos = s.at;
+	}
+	if(!readSegment(l, is, pos, l.image.size(), checked))
+		return false;
+
+	for(size_t i = 0; i < l.spans.size(); i++)
+		if(!l.spans[i].direct)
+			memcpy(l.spans[i].v, &l.scratch[l.spans[i].at], l.spans[i].len);
+	return true;
+}
+
+bool SFORMAT_CHUNK::read(EMUFILE* is, int size)
+{
+#ifdef LOCAL_LE
+	const int start = is->ftell();
+	for(int skip = 0; skip < 2; skip++)
+	{
+		Layout& l = layout(skip != 0);
+		if((int)l.size != size)
+			continue;
+		if(read(l, is))
+			return true;
+		//the entries that were read went where they belong, and ReadStateChunk reads them again
+		is->fseek(start, SEEK_SET);
+		break;
+	}
+#endif
+	return ReadStateChunk(is, sf, size);
+}
+
+static SFORMAT_CHUNK chunkARM9(SF_ARM9), chunkARM7(SF_ARM7), chunkMEM(SF_MEM), chunkNDS(SF_NDS), chunkMMU(SF_MMU),
+	chunkGFX3D(SF_GFX3D), chunkMOVIE(SF_MOVIE), chunkWIFI(SF_WIFI), chunkRTC(SF_RTC), chunkNDS_INFO(SF_NDS_INFO);
+
 static void savestate_WriteChunk(EMUFILE* os, int type, void (*saveproc)(EMUFILE* os))
 {
 	u32 pos1 = os->ftell();
@@ -941,54 +1185,133 @@ static void savestate_WriteChunk(EMUFILE* os, int type, void (*saveproc)(EMUFILE
 */
 }
 
-static void writechunks(EMUFILE* os);
+//a compressed state is cut into blocks of SAVESTATE_ZBLOCK_SIZE bytes, each its own zlib stream, so that the pool
+//compresses and decompresses all of them at once. the compressed data is the tag (which can't start the single zlib
+//stream older versions wrote, so those still load), the block size, the number of blocks, then for each block its
+//compressed length and the crc32 of what it holds, then the blocks one after the other
+#define SAVESTATE_ZBLOCK_TAG 0x5A425344 //"DSBZ"
+#define SAVESTATE_ZBLOCK_SIZE (256*1024)
+#define SAVESTATE_ZBLOCK_HEADER 12
 
-bool savestate_save(EMUFILE* outstream, int compressionLevel)
+#ifdef HAVE_LIBZ
+struct SavestateZBlocks
 {
-#ifdef HAVE_JIT 
-	arm_jit_sync();
-#endif
-	#ifndef HAVE_LIBZ
-	compressionLevel = Z_NO_COMPRESSION;
-	#endif
+	u8 *data; //uncompressed
+	u32 len;
+	int compressionLevel;
+	std::vector<const u8*> src; //where each compressed block is, when decompressing
+	std::vector<std::vector<u8> > compressed; //each compressed block, when compressing
+	std::vector<u32> comprlens, crcs;
+	std::vector<u8> failed;
+
+	SavestateZBlocks(u8 *data, u32 len) : data(data), len(len), compressionLevel(0)
+	{
+		const u32 count = (len + SAVESTATE_ZBLOCK_SIZE - 1) / SAVESTATE_ZBLOCK_SIZE;
+		comprlens.resize(count);
+		crcs.resize(count);
+		failed.resize(count, 1);
+	}
+	u32 count() const { return (u32)comprlens.size(); }
+	u32 blockLen(int i) const { return std::min<u32>(SAVESTATE_ZBLOCK_SIZE, len - i * SAVESTATE_ZBLOCK_SIZE); }
 
-	EMUFILE_MEMORY ms;
-	EMUFILE* os;
-	
-	if(compressionLevel != Z_NO_COMPRESSION)
+	static void compress(void *param, int begin, int end)
 	{
-		//generate the savestate in memory first
-		os = (EMUFILE*)&ms;
-		writechunks(os);
+		SavestateZBlocks &blocks = *(SavestateZBlocks*)param;
+		for(int i = begin; i < end; i++)
+		{
+			const u8 *block = blocks.data + i * SAVESTATE_ZBLOCK_SIZE;
+			const u32 n = blocks.blockLen(i);
+			uLongf comprlen = compressBound(n);
+			blocks.compressed[i].resize(comprlen);
+			blocks.failed[i] = compress2(&blocks.compressed[i][0], &comprlen, block, n, blocks.compressionLevel) != Z_OK;
+			blocks.comprlens[i] = (u32)comprlen;
+			blocks.crcs[i] = fastcrc32(0, block, n);
+		}
 	}
-	else
+
+	static void decompress(void *param, int begin, int end)
 	{
-		os = outstream;
-		os->fseek(32,SEEK_SET); //skip the header
-		writechunks(os);
+		SavestateZBlocks &blocks = *(SavestateZBlocks*)param;
+		for(int i = begin; i < end; i++)
+		{
+			u8 *block = blocks.data + i * SAVESTATE_ZBLOCK_SIZE;
+			const u32 n = blocks.blockLen(i);
+			uLongf uncomprlen = n;
+			blocks.failed[i] = uncompress(block, &uncomprlen, blocks.src[i], blocks.comprlens[i]) != Z_OK
+				|| uncomprlen != n || fastcrc32(0, block, n) != blocks.crcs[i];
+		}
 	}
 
+	bool ok() const { return std::find(failed.begin(), failed.end(), 1) == failed.end(); }
+};
+
+static u32 savestate_zword(const u8 *p)
+{
+	return p[0] | (p[1]<<8) | (p[2]<<16) | ((u32)p[3]<<24);
+}
+
+//decompresses a state's comprlen bytes at src into the len bytes at dst, from either kind of compressed data
+static bool savestate_decompress(const u8 *src, u32 comprlen, u8 *dst, u32 len)
+{
+	if(comprlen < SAVESTATE_ZBLOCK_HEADER || savestate_zword(src) != SAVESTATE_ZBLOCK_TAG)
+	{
+		uLongf uncomprlen = len;
+		const int error = uncompress(dst,&uncomprlen,src,comprlen);
+		return error == Z_OK && uncomprlen == len;
+	}
+
+	SavestateZBlocks blocks(dst, len);
+	if(savestate_zword(src+4) != SAVESTATE_ZBLOCK_SIZE || savestate_zword(src+8) != blocks.count())
+		return false;
+	const u8 *table = src + SAVESTATE_ZBLOCK_HEADER;
+	u32 ofs = SAVESTATE_ZBLOCK_HEADER + blocks.count() * 8;
+	if(ofs > comprlen) return false;
+	blocks.src.resize(blocks.count());
+	for(u32 i = 0; i < blocks.count(); i++)
+	{
+		blocks.comprlens[i] = savestate_zword(table + i*8);
+		blocks.crcs[i] = savestate_zword(table + i*8 + 4);
+		if(blocks.comprlens[i] > comprlen - ofs) return false;
+		blocks.src[i] = src + ofs;
+		ofs += blocks.comprlens[i];
+	}
+
+	TaskPool::shared().parallelFor(0, blocks.count(), 1, &SavestateZBlocks::decompress, &blocks);
+	return blocks.ok();
+}
+#endif
+
+//writes the header for the chunks in ms, and them, compressed unless compressionLevel says not to.
+//ms is only read, so this can run away from the emulation
+static bool savestate_write(EMUFILE_MEMORY* ms, EMUFILE* outstream, int compressionLevel)
+{
+	#ifndef HAVE_LIBZ
+	compressionLevel = Z_NO_COMPRESSION;
+	#endif
+
 	//save the length of the file
-	u32 len = os->ftell();
+	u32 len = ms->size();
 
 	u32 comprlen = 0xFFFFFFFF;
-	u8* cbuf;
 
 	//compress the data
-	int error = Z_OK;
+	bool ok = true;
+#ifdef HAVE_LIBZ
+	SavestateZBlocks blocks(ms->buf(), len);
 	if(compressionLevel != Z_NO_COMPRESSION)
 	{
-		cbuf = ms.buf();
-		uLongf comprlen2;
-		//worst case compression.
-		//zlib says "0.1% larger than sourceLen plus 12 bytes"
-		comprlen = (len>>9)+12 + len;
-		cbuf = new u8[comprlen];
-		// Workaround to make it compile under linux 64bit
-		comprlen2 = comprlen;
-		error = compress2(cbuf,&comprlen2,ms.buf(),len,compressionLevel);
-		comprlen = (u32)comprlen2;
+		blocks.compressionLevel = compressionLevel;
+		blocks.compressed.resize(blocks.count());
+		TaskPool::shared().parallelFor(0, blocks.count(), 1, &SavestateZBlocks::compress, &blocks);
+		ok = blocks.ok();
+
+		comprlen = SAVESTATE_ZBLOCK_HEADER + blocks.count() * 8;
+		for(u32 i = 0; i < blocks.count(); i++)
+			comprlen += blocks.comprlens[i];
 	}
+	else
+#endif
+		len += 32; //the length of a state that isn't compressed counts the header
 
 	//dump the header
 	outstream->fseek(0,SEEK_SET);
@@ -998,13 +1321,61 @@ bool savestate_save(EMUFILE* outstream, int compressionLevel)
 	write32le(len,outstream); //uncompressed length
 	write32le(comprlen,outstream); //compressed length (-1 if it is not compressed)
 
+#ifdef HAVE_LIBZ
+	if(compressionLevel != Z_NO_COMPRESSION)
+	{
+		write32le(SAVESTATE_ZBLOCK_TAG,outstream);
+		write32le(SAVESTATE_ZBLOCK_SIZE,outstream);
+		write32le(blocks.count(),outstream);
+		for(u32 i = 0; i < blocks.count(); i++)
+		{
+			write32le(blocks.comprlens[i],outstream);
+			write32le(blocks.crcs[i],outstream);
+		}
+		for(u32 i = 0; i < blocks.count(); i++)
+			outstream->fwrite((char*)&blocks.compressed[i][0],blocks.comprlens[i]);
+	}
+	else
+#endif
+	if(ms->size() != 0)
+		outstream->fwrite((char*)ms->buf(),ms->size());
+
+	return ok;
+}
+
+bool savestate_save(EMUFILE* outstream, int compressionLevel)
+{
+#ifdef HAVE_JIT 
+	arm_jit_sync();
+#endif
+	#ifndef HAVE_LIBZ
+	compressionLevel = Z_NO_COMPRESSION;
+	#endif
+
 	if(compressionLevel != Z_NO_COMPRESSION)
 	{
-		outstream->fwrite((char*)cbuf,comprlen==(u32)-1?len:comprlen);
-		delete[] cbuf;
+		//generate the savestate in memory first
+		EMUFILE_MEMORY ms;
+		writechunks(&ms);
+		return savestate_write(&ms, outstream, compressionLevel);
 	}
 
-	return error == Z_OK;
+	//write the chunks straight to the stream after the space for the header, which goes in after
+	outstream->fseek(32,SEEK_SET); //skip the header
+	writechunks(outstream);
+
+	//save the length of the file
+	u32 len = outstream->ftell();
+
+	//dump the header
+	outstream->fseek(0,SEEK_SET);
+	outstream->fwrite(magic,16);
+	write32le(SAVESTATE_VERSION,outstream);
+	write32le(EMU_DESMUME_VERSION_NUMERIC(),outstream); //desmume version
+	write32le(len,outstream); //uncompressed length
+	write32le(0xFFFFFFFF,outstream); //compressed length (-1 if it is not compressed)
+
+	return true;
 }
 
 bool savestate_save (const char *file_name)
@@ -1033,24 +1404,24 @@ static void writechunks(EMUFILE* os) {
 
 	save_time = tm.get_Ticks();
 
-	savestate_WriteChunk(os,1,SF_ARM9);
-	savestate_WriteChunk(os,2,SF_ARM7);
+	chunkARM9.write(os,1);
+	chunkARM7.write(os,2);
 	savestate_WriteChunk(os,3,cp15_savestate);
-	savestate_WriteChunk(os,4,SF_MEM);
-	savestate_WriteChunk(os,5,SF_NDS);
+	chunkMEM.write(os,4);
+	chunkNDS.write(os,5);
 	savestate_WriteChunk(os,51,nds_savestate);
-	savestate_WriteChunk(os,60,SF_MMU);
+	chunkMMU.write(os,60);
 	savestate_WriteChunk(os,61,mmu_savestate);
 	savestate_WriteChunk(os,7,gpu_savestate);
 	savestate_WriteChunk(os,8,spu_savestate);
 	savestate_WriteChunk(os,81,mic_savestate);
-	savestate_WriteChunk(os,90,SF_GFX3D);
+	chunkGFX3D.write(os,90);
 	savestate_WriteChunk(os,91,gfx3d_savestate);
-	savestate_WriteChunk(os,100,SF_MOVIE);
+	chunkMOVIE.write(os,100);
 	savestate_WriteChunk(os,101,mov_savestate);
-	savestate_WriteChunk(os,110,SF_WIFI);
-	savestate_WriteChunk(os,120,SF_RTC);
-	savestate_WriteChunk(os,130,SF_NDS_INFO);
+	chunkWIFI.write(os,110);
+	chunkRTC.write(os,120);
+	chunkNDS_INFO.write(os,130);
 	savestate_WriteChunk(os,140,s_slot1_savestate);
 	savestate_WriteChunk(os,150,s_slot2_savestate);
 	// reserved for future versions
@@ -1094,23 +1465,23 @@ static bool ReadStateChunks(EMUFILE* is, s32 totalsize)
 		if(!read32le(&size,is))  { ret=false; break; }
 		switch(t)
 		{
-			case 1: if(!ReadStateChunk(is,SF_ARM9,size)) ret=false; break;
-			case 2: if(!ReadStateChunk(is,SF_ARM7,size)) ret=false; break;
+			case 1: if(!chunkARM9.read(is,size)) ret=false; break;
+			case 2: if(!chunkARM7.read(is,size)) ret=false; break;
 			case 3: if(!cp15_loadstate(is,size)) ret=false; break;
-			case 4: if(!ReadStateChunk(is,SF_MEM,size)) ret=false; break;
-			case 5: if(!ReadStateChunk(is,SF_NDS,size)) ret=false; break;
+			case 4: if(!chunkMEM.read(is,size)) ret=false; break;
+			case 5: if(!chunkNDS.read(is,size)) ret=false; break;
 			case 51: if(!nds_loadstate(is,size)) ret=false; break;
-			case 60: if(!ReadStateChunk(is,SF_MMU,size)) ret=false; break;
+			case 60: if(!chunkMMU.read(is,size)) ret=false; break;
 			case 61: if(!mmu_loadstate(is,size)) ret=false; break;
 			case 7: if(!gpu_loadstate(is,size)) ret=false; break;
 			case 8: if(!spu_loadstate(is,size)) ret=false; break;
 			case 81: if(!mic_loadstate(is,size)) ret=false; break;
-			case 90: if(!ReadStateChunk(is,SF_GFX3D,size)) ret=false; break;
+			case 90: if(!chunkGFX3D.read(is,size)) ret=false; break;
 			case 91: if(!gfx3d_loadstate(is,size)) ret=false; break;
-			case 100: if(!ReadStateChunk(is,SF_MOVIE, size)) ret=false; break;
+			case 100: if(!chunkMOVIE.read(is,size)) ret=false; break;
 			case 101: if(!mov_loadstate(is, size)) ret=false; break;
-			case 110: if(!ReadStateChunk(is,SF_WIFI,size)) ret=false; break;
-			case 120: if(!ReadStateChunk(is,SF_RTC,size)) ret=false; break;
+			case 110: if(!chunkWIFI.read(is,size)) ret=false; break;
+			case 120: if(!chunkRTC.read(is,size)) ret=false; break;
 			case 130: if(!ReadStateChunk(is,SF_INFO,size)) ret=false; else haveInfo=true; break;
 			case 140: if(!s_slot1_loadstate(is, size)) ret=false; break;
 			case 150: if(!s_slot2_loadstate(is, size)) ret=false; break;
@@ -1134,29 +1505,29 @@ static bool ReadStateChunks(EMUFILE* is, s32 totalsize)
 		char buf[14] = {0};
 		memset(&buf[0], 0, sizeof(buf));
 		memcpy(buf, header.gameTile, sizeof(header.gameTile));
-		printf("Savestate info:\n");
+		CORELOG_INFO("Savestate info:\n");
 		if (version_major | version_minor | version_build)
 		{
 			char buf[32] = {0};
 			if (svn_rev != 0xFFFFFFFF)
 				sprintf(buf, " svn %u", svn_rev);
-			printf("\tDeSmuME version: %u.%u.%u%s\n", version_major, version_minor, version_build, buf);
+			CORELOG_INFO("\tDeSmuME version: %u.%u.%u%s\n", version_major, version_minor, version_build, buf);
 		}
 
 		if (save_time)
 		{
 			static const char *wday[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
 			DateTime tm = save_time;
-			printf("\tSave created: %04d-%03s-%02d %s %02d:%02d:%02d\n", tm.get_Year(), DateTime::GetNameOfMonth(tm.get_Month()), tm.get_Day(), wday[tm.get_DayOfWeek()%7], tm.get_Hour(), tm.get_Minute(), tm.get_Second());
+			CORELOG_INFO("\tSave created: %04d-%03s-%02d %s %02d:%02d:%02d\n", tm.get_Year(), DateTime::GetNameOfMonth(tm.get_Month()), tm.get_Day(), wday[tm.get_DayOfWeek()%7], tm.get_Hour(), tm.get_Minute(), tm.get_Second());
 		}
-		printf("\tGame title: %s\n", buf);
-		printf("\tGame code: %c%c%c%c\n", header.gameCode[0], header.gameCode[1], header.gameCode[2], header.gameCode[3]);
-		printf("\tMaker code: %c%c (0x%04X) - %s\n", header.makerCode & 0xFF, header.makerCode >> 8, header.makerCode, getDeveloperNameByID(header.makerCode).c_str());
-		printf("\tDevice capacity: %dMb (real size %dMb)\n", ((128 * 1024) << header.cardSize) / (1024 * 1024), romsize / (1024 * 1024));
-		printf("\tCRC16: %04Xh\n", header.CRC16);
-		printf("\tHeader CRC16: %04Xh\n", header.headerCRC16);
-		printf("\tSlot1: %s\n", slot1_List[slot1Type]->info()->name());
-		printf("\tSlot2: %s\n", slot2_List[slot2Type]->info()->name());
+		CORELOG_INFO("\tGame title: %s\n", buf);
+		CORELOG_INFO("\tGame code: %c%c%c%c\n", header.gameCode[0], header.gameCode[1], header.gameCode[2], header.gameCode[3]);
+		CORELOG_INFO("\tMaker code: %c%c (0x%04X) - %s\n", header.makerCode & 0xFF, header.makerCode >> 8, header.makerCode, getDeveloperNameByID(header.makerCode).c_str());
+		CORELOG_INFO("\tDevice capacity: %dMb (real size %dMb)\n", ((128 * 1024) << header.cardSize) / (1024 * 1024), romsize / (1024 * 1024));
+		CORELOG_INFO("\tCRC16: %04Xh\n", header.CRC16);
+		CORELOG_INFO("\tHeader CRC16: %04Xh\n", header.headerCRC16);
+		CORELOG_INFO("\tSlot1: %s\n", slot1_List[slot1Type]->info()->name());
+		CORELOG_INFO("\tSlot2: %s\n", slot2_List[slot2Type]->info()->name());
 
 		if (gameInfo.romsize != romsize || memcmp(&gameInfo.header, &header, sizeof(header)) != 0)
 			msgbox->warn("The savestate you are loading does not match the ROM you are running.\nYou should find the correct ROM");
@@ -1165,8 +1536,13 @@ static bool ReadStateChunks(EMUFILE* is, s32 totalsize)
 	return ret;
 }
 
-static void loadstate()
+//mainMemPages, if given, are the pages of main memory that the caller changed, when it knows. the code compiled from
+//just them is thrown away then, rather than everything
+static void loadstate(const std::vector<u32>* mainMemPages = NULL)
 {
+    // Main memory was replaced without going through the writes, as far as anything keeping a copy of it can tell
+    MMU_touchAllMainMem();
+
     // This should regenerate the vram banks
     for (int i = 0; i < 0xA; i++)
        _MMU_write08<ARMCPU_ARM9>(0x04000240+i, _MMU_read08<ARMCPU_ARM9>(0x04000240+i));
@@ -1192,6 +1568,28 @@ static void loadstate()
 
 	SetupMMU(nds.Is_DebugConsole(),nds.Is_DSI());
 
+#ifdef HAVE_JIT
+	//the memory was replaced without going through the writes that throw away compiled code
+#ifndef MAPPED_JIT_FUNCS
+	if(mainMemPages)
+	{
+		for(size_t i=0;i<mainMemPages->size();i++)
+		{
+			const u32 adr = 0x02000000 + (*mainMemPages)[i] * SAVESTATE_MEM_PAGE_SIZE;
+			arm_jit_invalidate_pages(adr, adr + SAVESTATE_MEM_PAGE_SIZE);
+		}
+		//the rest of the memory code runs from is small enough to just all go: itcm, WRAM and vram
+		arm_jit_invalidate_pages(0x00000000, 0x02000000);
+		arm_jit_invalidate_pages(0x03000000, 0x04000000);
+		arm_jit_invalidate_pages(0x06000000, 0x07000000);
+		//and the literals under the dtcm, which may be somewhere else now
+		arm_jit_invalidate_pages(MMU.DTCMRegion, MMU.DTCMRegion + 0x4000);
+	}
+	else
+#endif
+	arm_jit_reset(CommonSettings.use_jit, true);
+#endif
+
 	execute = !driver->EMU_IsEmulationPaused();
 }
 
@@ -1210,25 +1608,38 @@ bool savestate_load(EMUFILE* is)
 	if(!read32le(&comprlen,is)) return false;
 
 	if(ssversion != SAVESTATE_VERSION) return false;
+	if(len < 32) return false;
 
-	std::vector<u8> buf(len);
+	std::vector<u8> buf;
+	//an uncompressed state is read from where it is: a mapped file (see savestate_load(const char*)) or memory
+	//reads its chunks in place. all of it has to be there before the emulator gets reset for it, though
+	const bool inPlace = comprlen == 0xFFFFFFFF && is->size() - is->ftell() >= (int)(len-32);
 
 	if(comprlen != 0xFFFFFFFF) {
 #ifndef HAVE_LIBZ
 		//without libz, we can't decompress this savestate
 		return false;
 #endif
-		std::vector<char> cbuf(comprlen);
-		is->fread(&cbuf[0],comprlen);
-		if(is->fail()) return false;
+		buf.resize(len);
+		//a file in memory is decompressed from there
+		std::vector<char> cbuf;
+		const u8* src = is->peek(comprlen);
+		if(src)
+			is->fseek(comprlen,SEEK_CUR);
+		else
+		{
+			cbuf.resize(comprlen);
+			is->fread(&cbuf[0],comprlen);
+			if(is->fail()) return false;
+			src = (const u8*)&cbuf[0];
+		}
 
 #ifdef HAVE_LIBZ
-		uLongf uncomprlen = len;
-		int error = uncompress((uint8*)&buf[0],&uncomprlen,(uint8*)&cbuf[0],comprlen);
-		if(error != Z_OK || uncomprlen != len)
+		if(!savestate_decompress(src, comprlen, &buf[0], len))
 			return false;
 #endif
-	} else {
+	} else if(!inPlace) {
+		buf.resize(len);
 		is->fread((char*)&buf[0],len-32);
 	}
 
@@ -1253,8 +1664,14 @@ bool savestate_load(EMUFILE* is)
 	//gpu3D->NDS_3D_Reset();
 	//SPU_Reset();
 
-	EMUFILE_MEMORY mstemp(&buf);
-	bool x = ReadStateChunks(&mstemp,(s32)len);
+	bool x;
+	if(inPlace)
+		x = ReadStateChunks(is,(s32)(len-32));
+	else
+	{
+		EMUFILE_MEMORY mstemp(&buf);
+		x = ReadStateChunks(&mstemp,(s32)len);
+	}
 
 	if(!x && !SAV_silent_fail_flag)
 	{
@@ -1265,11 +1682,11 @@ bool savestate_load(EMUFILE* is)
 	loadstate();
 
 	if(nds.ConsoleType != CommonSettings.ConsoleType) {
-		printf("WARNING: forcing console type to: ConsoleType=%d\n",nds.ConsoleType);
+		CORELOG_WARN("WARNING: forcing console type to: ConsoleType=%d\n",nds.ConsoleType);
 	}
 
 	if((nds._DebugConsole!=0) != CommonSettings.DebugConsole) {
-			printf("WARNING: forcing console debug mode to: debugmode=%s\n",nds._DebugConsole?"TRUE":"FALSE");
+			CORELOG_WARN("WARNING: forcing console debug mode to: debugmode=%s\n",nds._DebugConsole?"TRUE":"FALSE");
 	}
 
 
@@ -1278,18 +1695,285 @@ bool savestate_load(EMUFILE* is)
 
 bool savestate_load(const char *file_name)
 {
-	EMUFILE_FILE f(file_name,"rb");
+	savestate_flush();
+	EMUFILE_MMAP f(file_name);
 	if(f.fail()) return false;
 
 	return savestate_load(&f);
 }
 
-static std::stack<EMUFILE_MEMORY*> rewindFreeList;
-static std::vector<EMUFILE_MEMORY*> rewindbuffer;
+//the boot state is a savestate behind a header of its own: the magic and a crc of what the boot depends on
+static const u32 kBootStateMagic = 0x31425344; //DSB1
+//frames the firmware gets to reach the game. a boot that takes longer (the user in the firmware menu) isn't kept
+static const u32 kBootStateFrames = 60*60;
+
+enum BootStateMode
+{
+	BOOTSTATE_NONE,
+	BOOTSTATE_CAPTURE,
+	BOOTSTATE_RESTORE,
+};
+
+static BootStateMode bootStateMode = BOOTSTATE_NONE;
+static u32 bootStateKey = 0;
+static u32 bootStateFrame = 0;
+static bool bootStateLoading = false;
+
+static void bootstate_filename(char* filename)
+{
+	path.getpathnoext(path.STATES, filename);
+	if(strlen(filename) + strlen(".dsb") < MAX_PATH)
+		strcat(filename, ".dsb");
+}
+
+//the game, the firmware (with the user settings the boot wrote into it) and the bioses, and the console
+static u32 bootstate_key()
+{
+	u32 crc = crc32(0, (const Bytef*)&gameInfo.header, sizeof(gameInfo.header));
+	const u32 romCRC = gameInfo.getCRC();
+	crc = crc32(crc, (const Bytef*)&romCRC, sizeof(romCRC));
+	crc = crc32(crc, MMU.fw.data, MMU.fw.size);
+	crc = crc32(crc, MMU.ARM9_BIOS, sizeof(MMU.ARM9_BIOS));
+	crc = crc32(crc, MMU.ARM7_BIOS, sizeof(MMU.ARM7_BIOS));
+	const u32 console = (u32)CommonSettings.ConsoleType | (CommonSettings.DebugConsole ? 0x100 : 0);
+	return crc32(crc, (const Bytef*)&console, sizeof(console));
+}
+
+void bootstate_reset()
+{
+	bootStateMode = BOOTSTATE_NONE;
+	//the reset savestate_load does on the way to loading the boot state, and movies, which have to boot for real
+	if(bootStateLoading || !CommonSettings.BootStateCache || movieMode != MOVIEMODE_INACTIVE)
+		return;
+
+	char filename[MAX_PATH];
+	bootstate_filename(filename);
+	bootStateKey = bootstate_key();
+	bootStateFrame = 0;
+
+	EMUFILE_FILE f(filename, "rb");
+	u32 magic = 0, key = 0;
+	if(!f.fail() && read32le(&magic, &f) && read32le(&key, &f) && magic == kBootStateMagic && key == bootStateKey)
+		bootStateMode = BOOTSTATE_RESTORE;
+	else
+		bootStateMode = BOOTSTATE_CAPTURE;
+}
+
+static bool bootstate_restore()
+{
+	char filename[MAX_PATH];
+	bootstate_filename(filename);
+	EMUFILE_MMAP f(filename);
+	if(f.fail()) return false;
+	f.fseek(8, SEEK_SET);
+
+	//the game's save data is whatever it is now, not what it was when the boot state was made
+	EMUFILE_MEMORY backup;
+	MMU_new.backupDevice.save_state(&backup);
+
+	bootStateLoading = true;
+	const bool ok = savestate_load(&f);
+	bootStateLoading = false;
+
+	backup.fseek(0, SEEK_SET);
+	MMU_new.backupDevice.load_state(&backup);
+	return ok;
+}
+
+static void bootstate_capture()
+{
+	EMUFILE_MEMORY ms;
+	write32le(kBootStateMagic, &ms);
+	write32le(bootStateKey, &ms);
+	if(!savestate_save(&ms, Z_BEST_SPEED)) return;
+
+	char filename[MAX_PATH];
+	bootstate_filename(filename);
+	EMUFILE_FILE f(filename, "wb");
+	if(f.fail()) return;
+	f.fwrite(ms.buf(), ms.size());
+	CORELOG_INFO("Boot state saved to %s\n", filename);
+}
+
+void bootstate_frame()
+{
+	switch(bootStateMode)
+	{
+		case BOOTSTATE_NONE:
+			return;
+
+		case BOOTSTATE_RESTORE:
+			bootStateMode = BOOTSTATE_NONE;
+			if(!bootstate_restore())
+			{
+				//a version it can't read, or a file that went bad: it boots for real and makes a new one
+				bootStateMode = BOOTSTATE_CAPTURE;
+				bootStateFrame = 0;
+			}
+			return;
+
+		case BOOTSTATE_CAPTURE:
+		{
+			//the first frame that ends with the arm9 in the game's own code
+			const u32 pc = NDS_ARM9.instruct_adr;
+			if(pc - gameInfo.header.ARM9cpy < gameInfo.header.ARM9binSize)
+			{
+				bootStateMode = BOOTSTATE_NONE;
+				bootstate_capture();
+			}
+			else if(++bootStateFrame >= kBootStateFrames)
+				bootStateMode = BOOTSTATE_NONE;
+			return;
+		}
+	}
+}
+
+//the rewind buffer only keeps the newest state whole. every older one is kept as its difference from the one after it:
+//the runs of words that are the same, to skip, and the runs that aren't, xor-ed together. between two states a few frames
+//apart that is mostly the skips, so a long rewind window costs a fraction of whole states. rewinding loads the newest
+//state as it is and then applies its difference to it, which turns it into the one before, ready for the next rewind.
+//the differences are worked out, and applied, on a thread of their own; the emulation only waits for that when it
+//needs the buffers again, a rewind interval later.
+//main memory is most of a state, so it is left out of them and kept in a copy of its own instead. the write generations
+//of its pages tell which ones moved since the newest state, and only those are copied, and kept in the difference
+struct RewindDelta
+{
+	u32 len; //the length of the older state
+	std::vector<u32> runs; //(skip, count, count xor-ed words)...
+	std::vector<u32> pages; //the main memory pages that changed
+	std::vector<u8> pageData; //and what they held in the older state
+};
+
+static Task rewindTask;
+static bool rewindTaskStarted = false;
+static EMUFILE_MEMORY *rewindNewest = NULL; //the newest state
+static EMUFILE_MEMORY *rewindIncoming = NULL; //where the next one is saved to
+static std::vector<u8> rewindMem; //main memory in the newest state
+static u32 rewindMemGeneration[SAVESTATE_MEM_PAGES]; //the generations of the pages of main memory that match it
+static RewindDelta *rewindPending = NULL; //the difference rewindEncode finishes
+static std::deque<RewindDelta*> rewindbuffer; //the differences back from the newest state, the most recent last
+static std::stack<RewindDelta*> rewindFreeList;
 
 int rewindstates = 16;
 int rewindinterval = 4;
 
+//what all of the above holds, worked out by the rewind task each time it is done changing it
+static u64 rewindBytes = 0;
+
+static void rewindCount()
+{
+	u64 bytes = rewindMem.size();
+	if(rewindNewest) bytes += rewindNewest->get_vec()->capacity() + rewindIncoming->get_vec()->capacity();
+	for(size_t i = 0; i < rewindbuffer.size(); i++)
+	{
+		const RewindDelta* delta = rewindbuffer[i];
+		bytes += sizeof(RewindDelta) + (delta->runs.capacity() + delta->pages.capacity()) * sizeof(u32) + delta->pageData.capacity();
+	}
+	__atomic_store_n(&rewindBytes, bytes, __ATOMIC_RELAXED);
+}
+
+u64 rewind_memoryUsage()
+{
+	return __atomic_load_n(&rewindBytes, __ATOMIC_RELAXED);
+}
+
+void rewind_shrink(int states)
+{
+	if(rewindTaskStarted)
+		rewindTask.finish();
+
+	//the newest state is kept whole, so it is a state less of differences
+	while(!rewindbuffer.empty() && (int)rewindbuffer.size() >= std::max(states, 1)) {
+		delete rewindbuffer.front();
+		rewindbuffer.pop_front();
+	}
+	while(!rewindFreeList.empty()) {
+		delete rewindFreeList.top();
+		rewindFreeList.pop();
+	}
+	rewindCount();
+}
+
+void rewind_setStates(int states)
+{
+	rewindstates = std::max(states, 1);
+	rewind_shrink(rewindstates);
+}
+
+//pads the state with zeroes to a whole number of words, at least words long
+static u32* rewindWords(EMUFILE_MEMORY* ms, u32 words)
+{
+	std::vector<u8>& vec = *ms->get_vec();
+	vec.resize(ms->size());
+	vec.resize(words*4);
+	return (u32*)&vec[0];
+}
+
+static void* rewindEncode(void*)
+{
+	RewindDelta* delta = rewindPending;
+	if(delta)
+	{
+		const u32 n = (std::max(rewindNewest->size(), rewindIncoming->size()) + 3) / 4;
+		const u32* older = rewindWords(rewindNewest, n);
+		const u32* newer = rewindWords(rewindIncoming, n);
+		std::vector<u32>& runs = delta->runs;
+		runs.clear();
+		delta->len = rewindNewest->size();
+		for(u32 i = 0; i < n; )
+		{
+			const u32 start = i;
+			while(i < n && older[i] == newer[i]) i++;
+			const u32 skip = i - start;
+			if(i == n) break;
+
+			const u32 changed = i;
+			while(i < n && older[i] != newer[i]) i++;
+			runs.push_back(skip);
+			runs.push_back(i - changed);
+			for(u32 j = changed; j < i; j++)
+				runs.push_back(older[j] ^ newer[j]);
+		}
+
+		rewindbuffer.push_back(delta);
+		while((int)rewindbuffer.size() >= std::max(rewindstates, 1)) {
+			delete rewindbuffer.front();
+			rewindbuffer.pop_front();
+		}
+	}
+
+	std::swap(rewindNewest, rewindIncoming);
+	rewindCount();
+	return NULL;
+}
+
+//turns the newest state into the one before it
+static void* rewindDecode(void*)
+{
+	RewindDelta* delta = rewindbuffer.back();
+	rewindbuffer.pop_back();
+
+	const u32 n = (std::max((u32)rewindNewest->size(), delta->len) + 3) / 4;
+	u32* state = rewindWords(rewindNewest, n);
+	const std::vector<u32>& runs = delta->runs;
+	u32 i = 0;
+	for(size_t r = 0; r < runs.size(); )
+	{
+		i += runs[r++];
+		const u32 count = runs[r++];
+		for(u32 j = 0; j < count; j++)
+			state[i++] ^= runs[r++];
+	}
+	rewindNewest->truncate(delta->len);
+
+	for(size_t p = 0; p < delta->pages.size(); p++)
+		memcpy(&rewindMem[delta->pages[p] * SAVESTATE_MEM_PAGE_SIZE], &delta->pageData[p * SAVESTATE_MEM_PAGE_SIZE], SAVESTATE_MEM_PAGE_SIZE);
+
+	rewindFreeList.push(delta);
+	rewindCount();
+	return NULL;
+}
+
 void rewindsave () {
 
 	if(currFrameCounter % rewindinterval)
@@ -1297,24 +1981,52 @@ void rewindsave () {
 
 	//printf("rewindsave"); printf("%d%s", currFrameCounter, "\n");
 
-	
-	EMUFILE_MEMORY *ms;
-	if(!rewindFreeList.empty()) {
-		ms = rewindFreeList.top();
-		rewindFreeList.pop();
-	} else {
-		ms = new EMUFILE_MEMORY(1024*1024*12);
+	if(!rewindTaskStarted) {
+		rewindTask.start(false, "Rewind", THREAD_ROLE_BACKGROUND);
+		rewindTaskStarted = true;
+		rewindNewest = new EMUFILE_MEMORY();
+		rewindIncoming = new EMUFILE_MEMORY();
+		rewindMem.resize(SAVESTATE_MEM_PAGES * SAVESTATE_MEM_PAGE_SIZE);
 	}
+	rewindTask.finish();
 
-	if(!savestate_save(ms, Z_NO_COMPRESSION))
+	rewindIncoming->truncate(0);
+	savestateSkipMainMem = true;
+	const bool saved = savestate_save(rewindIncoming, Z_NO_COMPRESSION);
+	savestateSkipMainMem = false;
+	if(!saved)
 		return;
 
-	rewindbuffer.push_back(ms);
-	
-	if((int)rewindbuffer.size() > rewindstates) {
-		delete *rewindbuffer.begin();
-		rewindbuffer.erase(rewindbuffer.begin());
+	//the first state takes all of main memory
+	const bool first = rewindNewest->size() == 0;
+	RewindDelta* delta = NULL;
+	if(!first) {
+		if(!rewindFreeList.empty()) {
+			delta = rewindFreeList.top();
+			rewindFreeList.pop();
+		} else {
+			delta = new RewindDelta();
+		}
+		delta->pages.clear();
+		delta->pageData.clear();
+	}
+
+	for(u32 p = 0; p < SAVESTATE_MEM_PAGES; p++)
+	{
+		if(!first && rewindMemGeneration[p] == mainmem_page_generation[p])
+			continue;
+		rewindMemGeneration[p] = mainmem_page_generation[p];
+
+		u8* copy = &rewindMem[p * SAVESTATE_MEM_PAGE_SIZE];
+		if(delta) {
+			delta->pages.push_back(p);
+			delta->pageData.insert(delta->pageData.end(), copy, copy + SAVESTATE_MEM_PAGE_SIZE);
+		}
+		memcpy(copy, MMU.MAIN_MEM + p * SAVESTATE_MEM_PAGE_SIZE, SAVESTATE_MEM_PAGE_SIZE);
 	}
+
+	rewindPending = delta;
+	rewindTask.execute(rewindEncode, NULL);
 }
 
 void dorewind()
@@ -1324,25 +2036,240 @@ void dorewind()
 
 	//printf("rewind\n");
 
-	int size = rewindbuffer.size();
+	if(rewindTaskStarted)
+		rewindTask.finish();
 
-	if(size < 1) {
-		printf("rewind buffer empty\n");
+	if(!rewindNewest || rewindNewest->size() == 0) {
+		CORELOG_INFO("rewind buffer empty\n");
 		return;
 	}
 
-	printf("%d", size);
+	CORELOG_DEBUG("rewind: %d states\n", (int)rewindbuffer.size() + 1);
+
+	rewindNewest->fseek(32, SEEK_SET);
+
+	ReadStateChunks(rewindNewest,rewindNewest->size()-32);
 
-	EMUFILE_MEMORY* loadms = rewindbuffer[size-1];
-	loadms->fseek(32, SEEK_SET);
+	//main memory only differs from the newest state in the pages written since
+	for(u32 p = 0; p < SAVESTATE_MEM_PAGES; p++)
+		if(rewindMemGeneration[p] != mainmem_page_generation[p])
+			memcpy(MMU.MAIN_MEM + p * SAVESTATE_MEM_PAGE_SIZE, &rewindMem[p * SAVESTATE_MEM_PAGE_SIZE], SAVESTATE_MEM_PAGE_SIZE);
 
-	ReadStateChunks(loadms,loadms->size()-32);
 	loadstate();
 
-	if(rewindbuffer.size()>1)
+	for(u32 p = 0; p < SAVESTATE_MEM_PAGES; p++)
+		rewindMemGeneration[p] = mainmem_page_generation[p];
+
+	if(!rewindbuffer.empty())
+	{
+		//the copy is going back to the state before, so the pages that go back no longer match
+		const std::vector<u32>& pages = rewindbuffer.back()->pages;
+		for(size_t p = 0; p < pages.size(); p++)
+			rewindMemGeneration[pages[p]] = mainmem_page_generation[pages[p]] - 1;
+		rewindTask.execute(rewindDecode, NULL);
+	}
+
+}
+
+struct StateJournal::Frame
+{
+	EMUFILE_MEMORY state;
+	std::vector<u32> pages; //the main memory pages written between this save and the next
+	std::vector<u8> pageData; //and what they held at this one
+};
+
+StateJournal::StateJournal(int capacity)
+	: capacity(std::max(capacity, 1))
+{
+}
+
+StateJournal::~StateJournal()
+{
+	clear();
+	for(size_t i = 0; i < spare.size(); i++)
+		delete spare[i];
+}
+
+void StateJournal::clear()
+{
+	spare.insert(spare.end(), frames.begin(), frames.end());
+	frames.clear();
+}
+
+bool StateJournal::save()
+{
+	if(mem.empty()) {
+		mem.resize(SAVESTATE_MEM_PAGES * SAVESTATE_MEM_PAGE_SIZE);
+		memGeneration.resize(SAVESTATE_MEM_PAGES);
+	}
+
+	//what the pages written since the newest save held at it goes with it, the first save takes all of main memory
+	Frame* prev = frames.empty() ? NULL : frames.back();
+	for(u32 p = 0; p < SAVESTATE_MEM_PAGES; p++)
+	{
+		if(prev && memGeneration[p] == mainmem_page_generation[p])
+			continue;
+		memGeneration[p] = mainmem_page_generation[p];
+
+		u8* copy = &mem[p * SAVESTATE_MEM_PAGE_SIZE];
+		if(prev) {
+			prev->pages.push_back(p);
+			prev->pageData.insert(prev->pageData.end(), copy, copy + SAVESTATE_MEM_PAGE_SIZE);
+		}
+		memcpy(copy, MMU.MAIN_MEM + p * SAVESTATE_MEM_PAGE_SIZE, SAVESTATE_MEM_PAGE_SIZE);
+	}
+
+	Frame* frame;
+	if((int)frames.size() == capacity) {
+		frame = frames.front();
+		frames.pop_front();
+	} else if(!spare.empty()) {
+		frame = spare.back();
+		spare.pop_back();
+	} else {
+		frame = new Frame();
+	}
+	frame->pages.clear();
+	frame->pageData.clear();
+
+	frame->state.truncate(0);
+	savestateSkipMainMem = true;
+	const bool saved = savestate_save(&frame->state, Z_NO_COMPRESSION);
+	savestateSkipMainMem = false;
+	if(!saved) {
+		//the copy of main memory went on past the newest save already
+		spare.push_back(frame);
+		clear();
+		return false;
+	}
+
+	frames.push_back(frame);
+	return true;
+}
+
+bool StateJournal::restore(int framesAgo)
+{
+	if(framesAgo < 0 || framesAgo >= (int)frames.size())
+		return false;
+
+	std::vector<u32> changed;
+
+	//main memory back to the newest save first: only the pages written since differ from the copy
+	for(u32 p = 0; p < SAVESTATE_MEM_PAGES; p++)
+		if(memGeneration[p] != mainmem_page_generation[p]) {
+			memcpy(MMU.MAIN_MEM + p * SAVESTATE_MEM_PAGE_SIZE, &mem[p * SAVESTATE_MEM_PAGE_SIZE], SAVESTATE_MEM_PAGE_SIZE);
+			changed.push_back(p);
+		}
+
+	//then back through the saves after the one to go to, each putting back what the pages its frame wrote held at it
+	const int target = (int)frames.size() - 1 - framesAgo;
+	for(int i = (int)frames.size() - 2; i >= target; i--)
 	{
-		rewindFreeList.push(loadms);
-		rewindbuffer.pop_back();
+		const Frame* frame = frames[i];
+		for(size_t j = 0; j < frame->pages.size(); j++)
+		{
+			const u32 p = frame->pages[j];
+			const u8* data = &frame->pageData[j * SAVESTATE_MEM_PAGE_SIZE];
+			memcpy(MMU.MAIN_MEM + p * SAVESTATE_MEM_PAGE_SIZE, data, SAVESTATE_MEM_PAGE_SIZE);
+			memcpy(&mem[p * SAVESTATE_MEM_PAGE_SIZE], data, SAVESTATE_MEM_PAGE_SIZE);
+			changed.push_back(p);
+		}
+	}
+	while((int)frames.size() - 1 > target) {
+		spare.push_back(frames.back());
+		frames.pop_back();
 	}
 
+	Frame* frame = frames.back();
+	frame->pages.clear();
+	frame->pageData.clear();
+
+	frame->state.fseek(32, SEEK_SET);
+	const bool ok = ReadStateChunks(&frame->state, frame->state.size()-32);
+	loadstate(&changed);
+
+	for(u32 p = 0; p < SAVESTATE_MEM_PAGES; p++)
+		memGeneration[p] = mainmem_page_generation[p];
+
+	return ok;
+}
+
+EmuSession* EmuSession::active = NULL;
+
+EmuSession& EmuSession::defaultSession()
+{
+	//it is the active one until some other is activated, so it has nothing to copy in
+	static EmuSession session(false);
+	return session;
+}
+
+EmuSession::EmuSession()
+	: state(new EMUFILE_MEMORY())
+	, isDefault(false)
+{
+	store();
+}
+
+EmuSession::EmuSession(bool copy)
+	: state(new EMUFILE_MEMORY())
+	, isDefault(!copy)
+{
+	if(copy) store();
+}
+
+EmuSession::~EmuSession()
+{
+	if(active == this)
+	{
+		active = NULL;
+		//the globals hold this one's state, so the default session's has to come back in before it runs again
+		if(!isDefault)
+		{
+			savestate_flush();
+			defaultSession().restore();
+		}
+	}
+	delete state;
+}
+
+bool EmuSession::store()
+{
+	mem.resize(SAVESTATE_MEM_PAGES * SAVESTATE_MEM_PAGE_SIZE);
+	memcpy(&mem[0], MMU.MAIN_MEM, mem.size());
+
+	state->truncate(0);
+	savestateSkipMainMem = true;
+	const bool saved = savestate_save(state, Z_NO_COMPRESSION);
+	savestateSkipMainMem = false;
+	return saved;
+}
+
+bool EmuSession::restore()
+{
+	if(state->size() == 0)
+		return false;
+
+	memcpy(MMU.MAIN_MEM, &mem[0], mem.size());
+	state->fseek(32, SEEK_SET);
+	const bool ok = ReadStateChunks(state, state->size()-32);
+	loadstate();
+	return ok;
+}
+
+bool EmuSession::activate()
+{
+	if(isActive())
+		return true;
+
+	EmuSession& was = activeSession();
+	savestate_flush();
+	if(!was.store())
+		return false;
+	if(!restore()) {
+		//it may have failed halfway, so the one that was running goes back in
+		was.restore();
+		return false;
+	}
+	active = this;
+	return true;
 }
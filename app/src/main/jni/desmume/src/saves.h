@@ -20,6 +20,8 @@
 #ifndef _SRAM_H
 #define _SRAM_H
 
+#include <deque>
+#include <vector>
 #include "types.h"
 
 #define NB_STATES 10
@@ -60,13 +62,90 @@ int sram_save (const char *file_name);
 bool savestate_load (const char *file_name);
 bool savestate_save (const char *file_name);
 
-void savestate_slot(int num);
+//saving to a slot only serializes the state on the calling thread; compressing it and writing the file is done on a
+//thread of its own. done, if given, is called from that thread once the file is written, and the call returns without
+//waiting for it. without it the call waits, as it always did
+void savestate_slot(int num, int compressionLevel = -1, void (*done)(int num, bool ok) = NULL);
 void loadstate_slot(int num);
+//waits for a slot save that is still being written
+void savestate_flush();
 
 bool savestate_load(class EMUFILE* is);
 bool savestate_save(class EMUFILE* outstream, int compressionLevel);
 
+//a firmware boot, once it has got to the game, is saved (without the game's save data) as a boot state next to the
+//savestates, and the next firmware boot of the same game, firmware and bioses starts from it instead of running
+//through the firmware again. CommonSettings.BootStateCache turns it on.
+//NDS_Reset calls this after a firmware boot, and NDS_exec the other one at the end of each frame
+void bootstate_reset();
+void bootstate_frame();
+
 void dorewind();
 void rewindsave();
+//the bytes the rewind buffer holds, from any thread
+u64 rewind_memoryUsage();
+//how many states the rewind buffer keeps, dropping the oldest ones over it
+void rewind_setStates(int states);
+//drops the oldest states over the given number and gives their memory back, leaving what it keeps as it was.
+//like rewindsave, between frames
+void rewind_shrink(int states);
+
+//the last few frames of the emulation in memory, for going back a few frames and running them again (rollback netplay).
+//like the rewind buffer, the states leave main memory out; it is kept as the pages each frame wrote, with what they held
+class StateJournal
+{
+public:
+	StateJournal(int capacity);
+	~StateJournal();
+
+	//the state the emulation is in now becomes the newest. the oldest goes once there are capacity of them
+	bool save();
+	//goes back to the state framesAgo saves before the newest (0 for the newest), which is the newest after
+	bool restore(int framesAgo);
+	int size() const { return (int)frames.size(); }
+	void clear();
+
+private:
+	struct Frame;
+	std::deque<Frame*> frames; //the oldest first
+	std::vector<Frame*> spare;
+	int capacity;
+	std::vector<u8> mem; //main memory at the newest save
+	std::vector<u32> memGeneration; //the write generations of the pages of main memory that match it
+};
+
+//a savestate-swapped session: an emulator of its own, for taking turns with several of the same game in one process
+//(regression and performance runs). this is not a context the core runs in. the core keeps its state in globals, so one
+//session runs at a time: the globals are the state of the active one, and the others keep theirs put away (a whole
+//state, and main memory) until they are activated again, which swaps them in.
+//the emulation as it was before there were any sessions is the default one. the game, the settings and the frontend
+//(renderers, sound output, input) are shared: only what a savestate holds is a session's own
+class EmuSession
+{
+public:
+	//a copy of the active session as it is now, which goes its own way from there
+	EmuSession();
+	//if this is the active one, its state goes with it and the default session's is brought back in
+	~EmuSession();
+
+	//puts the active session's state away and brings this one's in
+	bool activate();
+	bool isActive() const { return active == this; }
+
+	static EmuSession& defaultSession();
+	static EmuSession& activeSession() { return active ? *active : defaultSession(); }
+
+private:
+	EmuSession(bool copy);
+	EmuSession(const EmuSession&);
+	EmuSession& operator=(const EmuSession&);
+	bool store();
+	bool restore();
+
+	class EMUFILE_MEMORY* state;
+	std::vector<u8> mem;
+	bool isDefault;
+	static EmuSession* active;
+};
 
 #endif
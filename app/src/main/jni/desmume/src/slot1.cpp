@@ -35,6 +35,7 @@ Since GCROMCTRL[26:24] can't represent 'data block size' of 1 or 2, it is assume
 #include "emufile.h"
 #include "utils/vfat.h"
 #include "path.h"
+#include "memusage.h"
 
 bool slot1_R4_path_type = false;
 
@@ -54,7 +55,7 @@ static void scanDir()
 	}
 
 	VFAT vfat;
-	if(vfat.build(slot1_R4_path_type?path.RomDirectory.c_str():fatDir.c_str(), 16))
+	if(vfat.mount(slot1_R4_path_type?path.RomDirectory.c_str():fatDir.c_str(), 16, memusage_budget().fatCacheBytes))
 	{
 		fatImage = vfat.detach();
 	}
@@ -159,8 +160,8 @@ bool slot1_Change(NDS_SLOT1_TYPE changeToType)
 		slot1_device->disconnect();
 	slot1_device_type = changeToType;
 	slot1_device = slot1_List[slot1_device_type];
-	printf("Slot 1: %s\n", slot1_device->info()->name());
-	printf("sending eject signal to SLOT-1\n");
+	CORELOG_INFO("Slot 1: %s\n", slot1_device->info()->name());
+	CORELOG_INFO("sending eject signal to SLOT-1\n");
 	NDS_TriggerCardEjectIRQ();
 	slot1_device->connect();
 	return true;
@@ -77,6 +77,13 @@ public:
 	//called when the cpu reads from the GC bus
 	virtual u32 read_GCDATAIN(u8 PROCNUM) { return 0xFFFFFFFF; }
 
+	//called when the cpu reads count words from the GC bus in one go (a card dma)
+	virtual void read_GCDATAIN_block(u8 PROCNUM, u32* buf, u32 count)
+	{
+		for(u32 i = 0; i < count; i++)
+			buf[i] = read_GCDATAIN(PROCNUM);
+	}
+
 	//transfers a byte to the slot-1 device via auxspi, and returns the incoming byte
 	//cpu is provided for diagnostic purposes only.. the slot-1 device wouldn't know which CPU it is.
 	virtual u8 auxspi_transaction(int PROCNUM, u8 value) { return 0x00; }
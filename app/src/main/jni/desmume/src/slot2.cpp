@@ -170,7 +170,7 @@ void slot2_setDeviceByType(NDS_SLOT2_TYPE theType)
 	
 	slot2_device_type = theType;
 	slot2_device = slot2_List[slot2_device_type];
-	printf("Slot 2: %s\n", slot2_device->info()->name());
+	CORELOG_INFO("Slot 2: %s\n", slot2_device->info()->name());
 }
 
 bool slot2_getTypeByID(u8 ID, NDS_SLOT2_TYPE &type)
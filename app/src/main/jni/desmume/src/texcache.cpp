@@ -21,6 +21,16 @@
 #include <algorithm>
 #include <assert.h>
 #include <map>
+#include <vector>
+#include <stdio.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "texcache.h"
 
@@ -39,6 +49,319 @@ using std::max;
 
 #define CONVERT(color,alpha) ((TEXFORMAT == TexFormat_32bpp)?(RGB15TO32(color,alpha)):RGB15TO6665(color,alpha))
 
+//vector helpers for the texture decoders.
+//small palettes are kept as planes of converted color bytes, so that 16 texels can be looked up at once with byte shuffles.
+//everything works on bytes in memory order, so the decoded colors come out the same as from CONVERT
+#if defined(ENABLE_NEON) && !defined(LOCAL_BE)
+#include <arm_neon.h>
+#define TEXCACHE_SIMD
+typedef uint8x16_t TexVec;
+#elif defined(ENABLE_SSSE3) && !defined(LOCAL_BE)
+#include <tmmintrin.h>
+#define TEXCACHE_SIMD
+typedef __m128i TexVec;
+#endif
+
+#ifdef TEXCACHE_SIMD
+
+#ifdef ENABLE_NEON
+
+static FORCEINLINE TexVec texvec_load(const u8* src) { return vld1q_u8(src); }
+static FORCEINLINE void texvec_store(u32* dst, TexVec v) { vst1q_u8((u8*)dst, v); }
+static FORCEINLINE TexVec texvec_set(u8 v) { return vdupq_n_u8(v); }
+static FORCEINLINE TexVec texvec_and(TexVec a, TexVec b) { return vandq_u8(a, b); }
+static FORCEINLINE TexVec texvec_or(TexVec a, TexVec b) { return vorrq_u8(a, b); }
+static FORCEINLINE TexVec texvec_add(TexVec a, TexVec b) { return vaddq_u8(a, b); }
+template<int N> static FORCEINLINE TexVec texvec_shr(TexVec a) { return vshrq_n_u8(a, N); }
+template<int N> static FORCEINLINE TexVec texvec_shl(TexVec a) { return vshlq_n_u8(a, N); }
+//0xFF in the bytes which have their top bit set
+static FORCEINLINE TexVec texvec_topbit(TexVec a) { return vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(a), 7)); }
+//0xFF in the bytes which have all of the mask's bits set
+static FORCEINLINE TexVec texvec_test(TexVec a, TexVec mask) { return vceqq_u8(vandq_u8(a, mask), mask); }
+
+//looks up 16 bytes from a 16 byte table. the indexes must be less than 16
+static FORCEINLINE TexVec texvec_lookup16(const u8* table, TexVec idx)
+{
+#ifdef __aarch64__
+	return vqtbl1q_u8(vld1q_u8(table), idx);
+#else
+	const uint8x8x2_t t = {{ vld1_u8(table), vld1_u8(table+8) }};
+	return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)), vtbl2_u8(t, vget_high_u8(idx)));
+#endif
+}
+
+//looks up 16 bytes from a 32 byte table. the indexes must be less than 32
+static FORCEINLINE TexVec texvec_lookup32(const u8* table, TexVec idx)
+{
+#ifdef __aarch64__
+	const uint8x16x2_t t = {{ vld1q_u8(table), vld1q_u8(table+16) }};
+	return vqtbl2q_u8(t, idx);
+#else
+	const uint8x8x4_t t = {{ vld1_u8(table), vld1_u8(table+8), vld1_u8(table+16), vld1_u8(table+24) }};
+	return vcombine_u8(vtbl4_u8(t, vget_low_u8(idx)), vtbl4_u8(t, vget_high_u8(idx)));
+#endif
+}
+
+//interleaves the four channels of 16 texels and stores them
+static FORCEINLINE void texvec_store4(u32* dst, TexVec r, TexVec g, TexVec b, TexVec a)
+{
+	const uint8x16x4_t texels = {{ r, g, b, a }};
+	vst4q_u8((u8*)dst, texels);
+}
+
+//splits the 8 bytes of 4 bit indexes at src into 16 indexes, low nibble first
+static FORCEINLINE TexVec texvec_unpack4bit(const u8* src)
+{
+	const uint8x8_t v = vld1_u8(src);
+	const uint8x8x2_t z = vzip_u8(vand_u8(v, vdup_n_u8(0x0F)), vshr_n_u8(v, 4));
+	return vcombine_u8(z.val[0], z.val[1]);
+}
+
+//loads 16 16bpp texels split into their low and high bytes
+static FORCEINLINE void texvec_load16bpp(const u8* src, TexVec &lo, TexVec &hi)
+{
+	const uint8x16x2_t v = vld2q_u8(src);
+	lo = v.val[0];
+	hi = v.val[1];
+}
+
+#else //ENABLE_SSSE3
+
+static FORCEINLINE TexVec texvec_load(const u8* src) { return _mm_loadu_si128((const __m128i*)src); }
+static FORCEINLINE void texvec_store(u32* dst, TexVec v) { _mm_storeu_si128((__m128i*)dst, v); }
+static FORCEINLINE TexVec texvec_set(u8 v) { return _mm_set1_epi8((char)v); }
+static FORCEINLINE TexVec texvec_and(TexVec a, TexVec b) { return _mm_and_si128(a, b); }
+static FORCEINLINE TexVec texvec_or(TexVec a, TexVec b) { return _mm_or_si128(a, b); }
+static FORCEINLINE TexVec texvec_add(TexVec a, TexVec b) { return _mm_add_epi8(a, b); }
+//there are no byte shifts, so these shift words and mask off what came in from the neighbouring byte
+template<int N> static FORCEINLINE TexVec texvec_shr(TexVec a) { return _mm_and_si128(_mm_srli_epi16(a, N), _mm_set1_epi8((char)(0xFF>>N))); }
+template<int N> static FORCEINLINE TexVec texvec_shl(TexVec a) { return _mm_and_si128(_mm_slli_epi16(a, N), _mm_set1_epi8((char)((0xFF<<N)&0xFF))); }
+static FORCEINLINE TexVec texvec_topbit(TexVec a) { return _mm_cmplt_epi8(a, _mm_setzero_si128()); }
+static FORCEINLINE TexVec texvec_test(TexVec a, TexVec mask) { return _mm_cmpeq_epi8(_mm_and_si128(a, mask), mask); }
+
+static FORCEINLINE TexVec texvec_lookup16(const u8* table, TexVec idx)
+{
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)table), idx);
+}
+
+//pshufb only looks at the low 4 bits of each index, so both halves are looked up and then picked between with bit 4
+static FORCEINLINE TexVec texvec_lookup32(const u8* table, TexVec idx)
+{
+	const __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)table), idx);
+	const __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(table+16)), idx);
+	const __m128i useHi = texvec_test(idx, _mm_set1_epi8(16));
+	return _mm_or_si128(_mm_and_si128(useHi, hi), _mm_andnot_si128(useHi, lo));
+}
+
+static FORCEINLINE void texvec_store4(u32* dst, TexVec r, TexVec g, TexVec b, TexVec a)
+{
+	const __m128i rgLo = _mm_unpacklo_epi8(r, g), rgHi = _mm_unpackhi_epi8(r, g);
+	const __m128i baLo = _mm_unpacklo_epi8(b, a), baHi = _mm_unpackhi_epi8(b, a);
+	_mm_storeu_si128((__m128i*)dst+0, _mm_unpacklo_epi16(rgLo, baLo));
+	_mm_storeu_si128((__m128i*)dst+1, _mm_unpackhi_epi16(rgLo, baLo));
+	_mm_storeu_si128((__m128i*)dst+2, _mm_unpacklo_epi16(rgHi, baHi));
+	_mm_storeu_si128((__m128i*)dst+3, _mm_unpackhi_epi16(rgHi, baHi));
+}
+
+static FORCEINLINE TexVec texvec_unpack4bit(const u8* src)
+{
+	const __m128i v = _mm_loadl_epi64((const __m128i*)src);
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	return _mm_unpacklo_epi8(_mm_and_si128(v, mask), _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+}
+
+static FORCEINLINE void texvec_load16bpp(const u8* src, TexVec &lo, TexVec &hi)
+{
+	const __m128i split = _mm_setr_epi8(0,2,4,6,8,10,12,14, 1,3,5,7,9,11,13,15);
+	const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), split);
+	const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src+16)), split);
+	lo = _mm_unpacklo_epi64(a, b);
+	hi = _mm_unpackhi_epi64(a, b);
+}
+
+#endif
+
+//picks 2 bit values out of each byte: bit 0 of the result is set where the byte has bit0mask, and bit 1 where it has bit1mask
+static FORCEINLINE TexVec texvec_extract2bit(TexVec v, const u8* bit0mask, const u8* bit1mask)
+{
+	const TexVec b0 = texvec_and(texvec_test(v, texvec_load(bit0mask)), texvec_set(1));
+	const TexVec b1 = texvec_and(texvec_test(v, texvec_load(bit1mask)), texvec_set(2));
+	return texvec_or(b0, b1);
+}
+
+//the colors of a palette split up into a plane for each byte
+struct TexPalettePlanes
+{
+	CACHE_ALIGN u8 plane[4][32];
+
+	void setup(const u32* colors, int count)
+	{
+		memset(plane, 0, sizeof(plane));
+		for(int i=0;i<count;i++)
+		{
+			const u8* bytes = (const u8*)&colors[i];
+			for(int c=0;c<4;c++)
+				plane[c][i] = bytes[c];
+		}
+	}
+};
+
+//each of these decodes as many whole groups of 16 texels as there are in len bytes of texture data,
+//and returns how many bytes it used. the rest get finished off by the scalar code
+
+static int TexDecode_I2(const u8* src, int len, const TexPalettePlanes &pal, u32* dst)
+{
+	static const u8 spread[16] = {0,0,0,0, 1,1,1,1, 2,2,2,2, 3,3,3,3};
+	static const u8 bit0[16] = {0x01,0x04,0x10,0x40, 0x01,0x04,0x10,0x40, 0x01,0x04,0x10,0x40, 0x01,0x04,0x10,0x40};
+	static const u8 bit1[16] = {0x02,0x08,0x20,0x80, 0x02,0x08,0x20,0x80, 0x02,0x08,0x20,0x80, 0x02,0x08,0x20,0x80};
+	const TexVec spreadIdx = texvec_load(spread);
+	int done = 0;
+	for(;done+4<=len;done+=4,dst+=16)
+	{
+		u8 bytes[16] = {0};
+		memcpy(bytes, src+done, 4);
+		const TexVec idx = texvec_extract2bit(texvec_lookup16(bytes, spreadIdx), bit0, bit1);
+		texvec_store4(dst, texvec_lookup16(pal.plane[0], idx), texvec_lookup16(pal.plane[1], idx),
+			texvec_lookup16(pal.plane[2], idx), texvec_lookup16(pal.plane[3], idx));
+	}
+	return done;
+}
+
+static int TexDecode_I4(const u8* src, int len, const TexPalettePlanes &pal, u32* dst)
+{
+	int done = 0;
+	for(;done+8<=len;done+=8,dst+=16)
+	{
+		const TexVec idx = texvec_unpack4bit(src+done);
+		texvec_store4(dst, texvec_lookup16(pal.plane[0], idx), texvec_lookup16(pal.plane[1], idx),
+			texvec_lookup16(pal.plane[2], idx), texvec_lookup16(pal.plane[3], idx));
+	}
+	return done;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+static int TexDecode_A3I5(const u8* src, int len, const TexPalettePlanes &pal, u32* dst)
+{
+	u8 alphas[16] = {0};
+	for(int i=0;i<8;i++)
+		alphas[i] = (TEXFORMAT == TexFormat_15bpp) ? material_3bit_to_5bit[i] : material_3bit_to_8bit[i];
+
+	int done = 0;
+	for(;done+16<=len;done+=16,dst+=16)
+	{
+		const TexVec v = texvec_load(src+done);
+		const TexVec idx = texvec_and(v, texvec_set(31));
+		texvec_store4(dst, texvec_lookup32(pal.plane[0], idx), texvec_lookup32(pal.plane[1], idx),
+			texvec_lookup32(pal.plane[2], idx), texvec_lookup16(alphas, texvec_shr<5>(v)));
+	}
+	return done;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+static int TexDecode_A5I3(const u8* src, int len, const TexPalettePlanes &pal, u32* dst)
+{
+	int done = 0;
+	for(;done+16<=len;done+=16,dst+=16)
+	{
+		const TexVec v = texvec_load(src+done);
+		const TexVec idx = texvec_and(v, texvec_set(7));
+		const TexVec alpha = (TEXFORMAT == TexFormat_15bpp) ? texvec_shr<3>(v) : texvec_lookup32(material_5bit_to_8bit, texvec_shr<3>(v));
+		texvec_store4(dst, texvec_lookup16(pal.plane[0], idx), texvec_lookup16(pal.plane[1], idx),
+			texvec_lookup16(pal.plane[2], idx), alpha);
+	}
+	return done;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+static int TexDecode_16bpp(const u8* src, int len, u32* dst)
+{
+	const TexVec opaque = texvec_set((TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F);
+	const TexVec five = texvec_set(31);
+	int done = 0;
+	for(;done+32<=len;done+=32,dst+=16)
+	{
+		TexVec lo, hi;
+		texvec_load16bpp(src+done, lo, hi);
+		TexVec r = texvec_and(lo, five);
+		TexVec g = texvec_or(texvec_shr<5>(lo), texvec_shl<3>(texvec_and(hi, texvec_set(3))));
+		TexVec b = texvec_and(texvec_shr<2>(hi), five);
+		const TexVec a = texvec_and(texvec_topbit(hi), opaque);
+		if(TEXFORMAT == TexFormat_15bpp)
+		{
+			//RGB15TO6665
+			const TexVec one = texvec_set(1);
+			r = texvec_add(texvec_shl<1>(r), one);
+			g = texvec_add(texvec_shl<1>(g), one);
+			b = texvec_add(texvec_shl<1>(b), one);
+		}
+		else
+		{
+			//material_5bit_to_8bit
+			r = texvec_or(texvec_shl<3>(r), texvec_shr<2>(r));
+			g = texvec_or(texvec_shl<3>(g), texvec_shr<2>(g));
+			b = texvec_or(texvec_shl<3>(b), texvec_shr<2>(b));
+		}
+		texvec_store4(dst, r, g, b, a);
+	}
+	return done;
+}
+
+//sets the 16 texels of a 4x4 block from its four colors
+static FORCEINLINE void TexDecode_4x4Block(u32 currBlock, const u32* colors, u32* dst, u32 pitch)
+{
+	static const u8 bit0[16] = {0x01,0x01,0x01,0x01, 0x04,0x04,0x04,0x04, 0x10,0x10,0x10,0x10, 0x40,0x40,0x40,0x40};
+	static const u8 bit1[16] = {0x02,0x02,0x02,0x02, 0x08,0x08,0x08,0x08, 0x20,0x20,0x20,0x20, 0x80,0x80,0x80,0x80};
+	static const u8 channel[16] = {0,1,2,3, 0,1,2,3, 0,1,2,3, 0,1,2,3};
+	const TexVec channelIdx = texvec_load(channel);
+	for(int sy=0;sy<4;sy++,dst+=pitch)
+	{
+		//turn each texel's color index into the indexes of its 4 bytes in the colors
+		const TexVec idx = texvec_extract2bit(texvec_set((u8)(currBlock>>(sy<<3))), bit0, bit1);
+		texvec_store(dst, texvec_lookup16((const u8*)colors, texvec_or(texvec_shl<2>(idx), channelIdx)));
+	}
+}
+
+#endif //TEXCACHE_SIMD
+
+//a fast 64 bit hash of a buffer (using the MurmurHash64A mixing), continuing on from h.
+//this is what the cache checks textures against vram with, instead of keeping a copy of the data
+static u64 TexCache_Hash(const u8* buf, u32 len, u64 h)
+{
+	const u64 m = 0xC6A4A7935BD1E995ULL;
+	const int r = 47;
+
+	h ^= len * m;
+
+	const u8* end = buf + (len & ~7);
+	for(; buf != end; buf += 8)
+	{
+		u64 k;
+		memcpy(&k, buf, 8); //the 4x4 index data is only 4 byte aligned
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	switch(len & 7)
+	{
+	case 7: h ^= (u64)buf[6] << 48;
+	case 6: h ^= (u64)buf[5] << 40;
+	case 5: h ^= (u64)buf[4] << 32;
+	case 4: h ^= (u64)buf[3] << 24;
+	case 3: h ^= (u64)buf[2] << 16;
+	case 2: h ^= (u64)buf[1] << 8;
+	case 1: h ^= (u64)buf[0];
+		h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
 //This class represents a number of regions of memory which should be viewed as contiguous
 class MemSpan
 {
@@ -78,6 +401,14 @@ public:
 		return 0;
 	}
 
+	//hashes the memspan with TexCache_Hash, continuing on from h
+	u64 hash(u64 h)
+	{
+		for(int i=0;i<numItems;i++)
+			h = TexCache_Hash(items[i].ptr,items[i].len,h);
+		return h;
+	}
+
 	//TODO - get rid of duplication between these two methods.
 
 	//dumps the memspan to the specified buffer
@@ -190,51 +521,213 @@ static MemSpan MemSpan_TexPalette(u32 ofs, u32 len, bool silent)
 
 #if defined (DEBUG_DUMP_TEXTURE) && defined (WIN32)
 #define DO_DEBUG_DUMP_TEXTURE
-static void DebugDumpTexture(TexCacheItem* item)
+static void DebugDumpTexture(TexCacheItem* item, u8* decoded)
 {
 	static int ctr=0;
 	char fname[100];
 	sprintf(fname,"c:\\dump\\%d.bmp", ctr);
 	ctr++;
 
-	NDS_WriteBMP_32bppBuffer(item->sizeX,item->sizeY,item->decoded,fname);
+	NDS_WriteBMP_32bppBuffer(item->sizeX,item->sizeY,decoded,fname);
 }
 #endif
 
-class TexCache
+//decoded textures kept on disk between sessions, keyed by a hash of their content.
+//the file is just a header followed by records of (u64 key, u32 len, len bytes of decoded data).
+//whatever was there when it was opened is mapped for reading; new textures are appended behind it
+//and so only get found the next time around.
+class TexDiskCache
 {
 public:
-	TexCache()
-		: cache_size(0)
+	TexDiskCache()
+		: map(NULL)
+		, mapSize(0)
+		, out(NULL)
+		, outSize(0)
+	{}
+
+	~TexDiskCache() { close(); }
+
+	//more than this and the file stops growing
+	static const u32 kMaxFileSize = 128*1024*1024;
+
+	bool isOpen() const { return out != NULL; }
+
+	void open(const char* fname)
 	{
-		memset(paletteDump,0,sizeof(paletteDump));
+		close();
+
+		//map the existing file and index its records
+		u32 validSize = 0;
+		mapFile(fname);
+		if(mapSize >= sizeof(kHeader) && !memcmp(map,kHeader,sizeof(kHeader)))
+		{
+			u32 pos = sizeof(kHeader);
+			while(pos + 12 <= mapSize)
+			{
+				u64 key; u32 len;
+				memcpy(&key,map+pos,8);
+				memcpy(&len,map+pos+8,4);
+				if(len > mapSize - pos - 12) break;
+				Entry &entry = index[key];
+				entry.ofs = pos+12;
+				entry.len = len;
+				pos += 12+len;
+			}
+			validSize = pos;
+		}
+
+		if(validSize != 0)
+		{
+			//drop a record torn by the app getting killed in the middle of writing it
+			if(validSize != mapSize) truncateFile(fname,validSize);
+			out = fopen(fname,"ab");
+		}
+		else
+		{
+			//missing, or not one of ours: start over
+			unmapFile();
+			index.clear();
+			out = fopen(fname,"wb");
+			if(out) fwrite(kHeader,1,sizeof(kHeader),out);
+			validSize = sizeof(kHeader);
+		}
+
+		if(!out)
+		{
+			PROGINFO("Couldn't open texture cache %s\n",fname);
+			close();
+			return;
+		}
+		outSize = validSize;
+		CORELOG_INFO("Texture cache %s: %d textures\n",fname,(int)index.size());
 	}
 
-	TTexCacheItemMultimap index;
+	void close()
+	{
+		if(out) fclose(out);
+		out = NULL;
+		outSize = 0;
+		index.clear();
+		unmapFile();
+	}
 
-	//this ought to be enough for anyone
-	//static const u32 kMaxCacheSize = 64*1024*1024; 
-	//changed by zeromus on 15-dec. I couldnt find any games that were getting anywhere NEAR 64
-	static const u32 kMaxCacheSize = 16*1024*1024; 
-	//metal slug burns through sprites so fast, it can test it pretty quickly though
+	//copies the texture for key into dst if it is on disk
+	bool load(u64 key, void* dst, u32 len)
+	{
+		TIndex::iterator it = index.find(key);
+		if(it == index.end() || it->second.ofs == 0 || it->second.len != len) return false;
+		memcpy(dst,map+it->second.ofs,len);
+		return true;
+	}
 
-	//this is not really precise, it is off by a constant factor
-	u32 cache_size;
+	void store(u64 key, const void* src, u32 len)
+	{
+		if(!out || index.count(key)) return;
+		if(outSize + 12 + len > kMaxFileSize) return;
+
+		fwrite(&key,1,8,out);
+		fwrite(&len,1,4,out);
+		fwrite(src,1,len,out);
+		outSize += 12+len;
+
+		//remember it was written so it goes in only once. it cant be loaded until it has been mapped, though
+		Entry &entry = index[key];
+		entry.ofs = 0;
+		entry.len = len;
+	}
 
-	void list_remove(TexCacheItem* item)
+private:
+	static const u8 kHeader[8];
+
+	struct Entry {
+		u32 ofs; //offset of the data in the mapping, or 0 if it was written this session
+		u32 len;
+	};
+	typedef std::map<u64,Entry> TIndex;
+	TIndex index;
+
+	u8* map;
+	u32 mapSize;
+	FILE* out;
+	u32 outSize;
+
+#ifdef WIN32
+	std::vector<u8> mapBuffer;
+
+	void mapFile(const char* fname)
 	{
-		index.erase(item->iterator);
-		cache_size -= item->decode_len;
+		FILE* inf = fopen(fname,"rb");
+		if(!inf) return;
+		fseek(inf,0,SEEK_END);
+		long size = ftell(inf);
+		fseek(inf,0,SEEK_SET);
+		if(size > 0 && size <= (long)kMaxFileSize)
+		{
+			mapBuffer.resize(size);
+			if(fread(&mapBuffer[0],1,size,inf) == (size_t)size)
+			{
+				map = &mapBuffer[0];
+				mapSize = (u32)size;
+			}
+		}
+		fclose(inf);
 	}
 
-	void list_push_front(TexCacheItem* item)
+	void unmapFile()
 	{
-		item->iterator = index.insert(std::make_pair(item->texformat,item));
-		cache_size += item->decode_len;
+		std::vector<u8>().swap(mapBuffer);
+		map = NULL;
+		mapSize = 0;
 	}
 
-	template<TexCache_TexFormat TEXFORMAT>
-	TexCacheItem* scan(u32 format, u32 texpal)
+	static void truncateFile(const char* fname, u32 size)
+	{
+		FILE* f = fopen(fname,"r+b");
+		if(!f) return;
+		_chsize(_fileno(f),size);
+		fclose(f);
+	}
+#else
+	void mapFile(const char* fname)
+	{
+		int fd = ::open(fname,O_RDONLY);
+		if(fd < 0) return;
+		struct stat st;
+		if(fstat(fd,&st) == 0 && st.st_size > 0 && st.st_size <= (off_t)kMaxFileSize)
+		{
+			void* ptr = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+			if(ptr != MAP_FAILED)
+			{
+				map = (u8*)ptr;
+				mapSize = (u32)st.st_size;
+			}
+		}
+		::close(fd);
+	}
+
+	void unmapFile()
+	{
+		if(map) munmap(map,mapSize);
+		map = NULL;
+		mapSize = 0;
+	}
+
+	static void truncateFile(const char* fname, u32 size)
+	{
+		truncate(fname,size);
+	}
+#endif
+};
+
+const u8 TexDiskCache::kHeader[8] = {'D','S','T','X','C','1',0,0};
+
+static TexDiskCache texDiskCache;
+
+//where the data for a texture lives in vram, worked out from its texformat and texpal params
+struct TexSource
+{
+	TexSource(u32 format, u32 texpal)
 	{
 		//for each texformat, number of palette entries
 		static const int palSizes[] = {0, 32, 4, 16, 256, 0, 8, 0};
@@ -242,17 +735,10 @@ public:
 		//for each texformat, multiplier from numtexels to numbytes (fixed point 30.2)
 		static const int texSizes[] = {0, 4, 1, 2, 4, 1, 4, 8};
 
-		//used to hold a copy of the palette specified for this texture
-		u16 pal[256];
-
-		u32 textureMode = (unsigned short)((format>>26)&0x07);
-		u32 sizeX=(8 << ((format>>20)&0x07));
-		u32 sizeY=(8 << ((format>>23)&0x07));
-		u32 imageSize = sizeX*sizeY;
-
-		u8 *adr;
-
-		u32 paletteAddress;
+		textureMode = (unsigned short)((format>>26)&0x07);
+		sizeX=(8 << ((format>>20)&0x07));
+		sizeY=(8 << ((format>>23)&0x07));
+		imageSize = sizeX*sizeY;
 
 		switch (textureMode)
 		{
@@ -271,10 +757,10 @@ public:
 		}
 
 		//analyze the texture memory mapping and the specifications of this texture
-		int palSize = palSizes[textureMode];
+		palSize = palSizes[textureMode];
 		int texSize = (imageSize*texSizes[textureMode])>>2; //shifted because the texSizes multiplier is fixed point
-		MemSpan ms = MemSpan_TexMem((format&0xFFFF)<<3,texSize);
-		MemSpan mspal = MemSpan_TexPalette(paletteAddress,palSize*2,false);
+		ms = MemSpan_TexMem((format&0xFFFF)<<3,texSize);
+		mspal = MemSpan_TexPalette(paletteAddress,palSize*2,false);
 
 		//determine the location for 4x4 index data
 		u32 indexBase;
@@ -284,14 +770,12 @@ public:
 		u32 indexOffset = (format&0x3FFF)<<2;
 
 		int indexSize = 0;
-		MemSpan msIndex;
 		if(textureMode == TEXMODE_4X4)
 		{
 			indexSize = imageSize>>3;
 			msIndex = MemSpan_TexMem(indexOffset+indexBase,indexSize);
 		}
 
-
 		//dump the palette to a temp buffer, so that we don't have to worry about memory mapping.
 		//this isnt such a problem with texture memory, because we read sequentially from it.
 		//however, we read randomly from palette memory, so the mapping is more costly.
@@ -300,63 +784,284 @@ public:
 		#else
 			mspal.dump(pal);
 		#endif
+	}
+
+	u32 textureMode;
+	u32 sizeX, sizeY, imageSize;
+	u32 paletteAddress;
+	int palSize;
+	MemSpan ms, mspal, msIndex;
+
+	//used to hold a copy of the palette specified for this texture
+	u16 pal[256];
+};
+
+//textures are a power of two on each side, from 8 to 1024, so their decoded buffers fall in a handful of sizes.
+//the buffers of evicted views are kept on a free list for each size for the next textures of that size to take
+//over, rather than going back to the heap, up to kMaxPooled bytes of them in all
+class TexBufferPool
+{
+public:
+	TexBufferPool()
+		: pooled(0)
+	{
+		memset(heads,0,sizeof(heads));
+	}
+
+	static const u32 kMaxPooled = 4*1024*1024;
 
-			//TODO - as a special optimization, keep the last item returned and check it first
+	//bytes sitting on the free lists
+	u32 pooled;
 
-		for(std::pair<TTexCacheItemMultimap::iterator,TTexCacheItemMultimap::iterator>
-			iters = index.equal_range(format);
-			iters.first != iters.second;
-			++iters.first)
+	u8* alloc(u32 len)
+	{
+		const int c = sizeClass(len);
+		if(c >= 0 && heads[c])
 		{
-			TexCacheItem* curr = iters.first->second;
-			
-			//conditions where we reject matches:
-			//when the teximage or texpal params dont match 
-			//(this is our key for identifying textures in the cache)
-			//NEW: due to using format as a key we dont need to check this anymore
-			//if(curr->texformat != format) continue;
-			if(curr->texpal != texpal) continue;
+			FreeBuffer* buf = heads[c];
+			heads[c] = buf->next;
+			pooled -= len;
+			return (u8*)buf;
+		}
+		return new u8[len];
+	}
 
-			//we're being asked for a different format than what we had cached.
-			//TODO - this could be done at the entire cache level instead of checking repeatedly
-			if(curr->cacheFormat != TEXFORMAT) goto REJECT;
+	void free(u8* buf, u32 len)
+	{
+		if(!buf) return;
+		const int c = sizeClass(len);
+		if(c < 0 || pooled + len > kMaxPooled)
+		{
+			delete[] buf;
+			return;
+		}
+		FreeBuffer* fb = (FreeBuffer*)buf;
+		fb->next = heads[c];
+		heads[c] = fb;
+		pooled += len;
+	}
+
+	//gives every pooled buffer back to the heap
+	void release()
+	{
+		for(int c=0;c<kNumClasses;c++)
+		{
+			while(heads[c])
+			{
+				FreeBuffer* buf = heads[c];
+				heads[c] = buf->next;
+				delete[] (u8*)buf;
+			}
+		}
+		pooled = 0;
+	}
+
+private:
+	struct FreeBuffer { FreeBuffer* next; };
+
+	//1024x1024 at 4 bytes a texel is 1<<22
+	static const int kNumClasses = 23;
+	FreeBuffer* heads[kNumClasses];
+
+	//the free list for buffers of len bytes, or -1 for a size that isnt pooled
+	static int sizeClass(u32 len)
+	{
+		if(len < sizeof(FreeBuffer) || (len & (len-1))) return -1;
+		const int c = 31 - __builtin_clz(len);
+		return c < kNumClasses ? c : -1;
+	}
+} texBufferPool;
+
+//the items themselves are carved out of blocks of kItemsPerBlock, and the ones deleted are kept on a list for the
+//next misses to reuse. the blocks are never given back; there are only as many as the cache has ever held at once
+static const int kItemsPerBlock = 64;
+static const size_t kItemSlotSize = (sizeof(TexCacheItem) + 15) & ~(size_t)15;
+static void* freeItems = NULL;
+
+void* TexCacheItem::operator new(size_t size)
+{
+	assert(size <= kItemSlotSize);
+	if(!freeItems)
+	{
+		u8* block = new u8[kItemSlotSize*kItemsPerBlock];
+		for(int i=kItemsPerBlock-1;i>=0;i--)
+		{
+			*(void**)(block + i*kItemSlotSize) = freeItems;
+			freeItems = block + i*kItemSlotSize;
+		}
+	}
+	void* item = freeItems;
+	freeItems = *(void**)item;
+	return item;
+}
+
+void TexCacheItem::operator delete(void* p)
+{
+	if(!p) return;
+	*(void**)p = freeItems;
+	freeItems = p;
+}
+
+TexCacheItem::~TexCacheItem()
+{
+	for(int i=0;i<3;i++)
+		texBufferPool.free(views[i].decoded,views[i].decode_len);
+	if(deleteCallback) deleteCallback(this);
+}
+
+class TexCache
+{
+public:
+	TexCache()
+		: cache_size(0)
+		, maxCacheSize(kMaxCacheSize)
+		, lru_head(NULL)
+		, lru_tail(NULL)
+	{
+		memset(paletteDump,0,sizeof(paletteDump));
+	}
+
+	TTexCacheItemMap index;
+
+	//this ought to be enough for anyone
+	//static const u32 kMaxCacheSize = 64*1024*1024; 
+	//changed by zeromus on 15-dec. I couldnt find any games that were getting anywhere NEAR 64
+	static const u32 kMaxCacheSize = 16*1024*1024; 
+	//metal slug burns through sprites so fast, it can test it pretty quickly though
+
+	//this is not really precise, it is off by a constant factor
+	u32 cache_size;
+	//what the cache may grow to before it gets cut; kMaxCacheSize unless the memory budget says otherwise
+	u32 maxCacheSize;
+
+	//every item, in the order they were last used. eviction goes from the tail
+	TexCacheItem *lru_head, *lru_tail;
+
+	//views created by deferred scans which may not have been decoded yet
+	typedef std::pair<TexCacheItem*,TexCache_TexFormat> PendingView;
+	std::vector<PendingView> pending;
+
+	static u64 makeKey(u32 format, u32 texpal) { return ((u64)format<<32) | texpal; }
+
+	void lru_unlink(TexCacheItem* item)
+	{
+		if(item->lruPrev) item->lruPrev->lruNext = item->lruNext;
+		else lru_head = item->lruNext;
+		if(item->lruNext) item->lruNext->lruPrev = item->lruPrev;
+		else lru_tail = item->lruPrev;
+		item->lruPrev = item->lruNext = NULL;
+	}
+
+	void lru_link_front(TexCacheItem* item)
+	{
+		item->lruPrev = NULL;
+		item->lruNext = lru_head;
+		if(lru_head) lru_head->lruPrev = item;
+		else lru_tail = item;
+		lru_head = item;
+	}
+
+	//marks an item as the most recently used
+	void touch(TexCacheItem* item)
+	{
+		if(item == lru_head) return;
+		lru_unlink(item);
+		lru_link_front(item);
+	}
+
+	void list_remove(TexCacheItem* item)
+	{
+		index.erase(item->iterator);
+		lru_unlink(item);
+		cache_size -= item->decodedSize();
+	}
+
+	void list_push_front(TexCacheItem* item)
+	{
+		item->iterator = index.insert(std::make_pair(makeKey(item->texformat,item->texpal),item)).first;
+		lru_link_front(item);
+	}
+
+	//hashes everything a texture is decoded from
+	static u64 dumpHash(const u16* pal, int palSize, MemSpan &ms, MemSpan &msIndex)
+	{
+		u64 h = TexCache_Hash((const u8*)pal,palSize*2,0);
+		h = ms.hash(h);
+		return msIndex.hash(h);
+	}
+
+	//the key for the disk cache: a hash of everything the texture is decoded from, and of the params
+	//which change how it decodes (size, format, color 0 transparency), but not of where it lives
+	static u64 diskKey(TexCacheItem* item, TexCache_TexFormat TEXFORMAT, TexSource& src)
+	{
+		const u32 params[2] = { item->texformat & 0x3FF00000, (u32)TEXFORMAT };
+		u64 h = TexCache_Hash((const u8*)params,sizeof(params),item->dumpHash);
+
+		//4x4 textures pick colors from anywhere in palette memory, through their index data,
+		//so hash the part of the palette the index data reaches
+		if(src.textureMode == TEXMODE_4X4)
+		{
+			u32 maxOffset = 0;
+			for(int j=0;j<src.msIndex.numItems;j++)
+			{
+				const u8* idx = src.msIndex.items[j].ptr;
+				for(u32 x=0;x+1<src.msIndex.items[j].len;x+=2)
+					maxOffset = max(maxOffset,(u32)(LE_TO_LOCAL_16(*(const u16*)(idx+x))&0x3FFF));
+			}
+			MemSpan mspal4x4 = MemSpan_TexPalette(src.paletteAddress,(maxOffset*2+4)*2,true);
+			h = mspal4x4.hash(h);
+		}
+		return h;
+	}
+
+	void storeToDisk(TexCacheItem* item, TexCache_TexFormat TEXFORMAT)
+	{
+		const TexCacheItem::View &view = item->views[TEXFORMAT];
+		if(view.diskKey != 0)
+			texDiskCache.store(view.diskKey,view.decoded,view.decode_len);
+	}
+
+	template<TexCache_TexFormat TEXFORMAT>
+	TexCacheItem* scan(u32 format, u32 texpal, bool defer)
+	{
+		TexSource src(format,texpal);
+
+		//TODO - as a special optimization, keep the last item returned and check it first
+
+		TTexCacheItemMap::iterator found = index.find(makeKey(format,texpal));
+		if(found != index.end())
+		{
+			TexCacheItem* curr = found->second;
 
 			//if the texture is assumed invalid, reject it
 			if(curr->assumedInvalid) goto REJECT; 
 
 			//the texture matches params, but isnt suspected invalid. accept it.
-			if(!curr->suspectedInvalid) return curr;
-
-			//we suspect the texture may be invalid. we need to do a byte-for-byte comparison to re-establish that it is valid:
+			if(!curr->suspectedInvalid)
+			{
+				touch(curr);
+				return view<TEXFORMAT>(curr,src,defer);
+			}
 
-			//when the palettes dont match:
+			//we suspect the texture may be invalid. we need to check the palette, texture and 4x4 index data
+			//against what it was decoded from to re-establish that it is valid.
 			//note that we are considering 4x4 textures to have a palette size of 0.
 			//they really have a potentially HUGE palette, too big for us to handle like a normal palette,
 			//so they go through a different system
-			if(mspal.size != 0 && memcmp(curr->dump.palette,pal,mspal.size)) goto REJECT;
-
-			//when the texture data doesn't match
-			if(ms.memcmp(&curr->dump.texture[0],curr->dump.textureSize)) goto REJECT;
-
-			//if the texture is 4x4 then the index data must match
-			if(textureMode == TEXMODE_4X4)
-			{
-				if(msIndex.memcmp(curr->dump.texture + curr->dump.textureSize,curr->dump.indexSize)) goto REJECT; 
-			}
+			if(dumpHash(src.pal,src.palSize,src.ms,src.msIndex) != curr->dumpHash) goto REJECT;
 
 			//we found a match. just return it
-			//REMINDER to make it primary/newest when we have smarter code
-			//list_remove(curr);
-			//list_push_front(curr);
 			curr->suspectedInvalid = false;
-			return curr;
+			touch(curr);
+			return view<TEXFORMAT>(curr,src,defer);
 
 		REJECT:
 			//we found a cached item for the current address, but the data is stale.
 			//for a variety of complicated reasons, we need to throw it out right this instant.
+			//an item still waiting to be decoded is referenced from the pending list, so settle that first
+			if(curr->isPending()) finishDecodes();
 			list_remove(curr);
 			delete curr;
-			break;
 		}
 
 		//item was not found. recruit an existing one (the oldest), or create a new one
@@ -366,34 +1071,72 @@ public:
 		TexCacheItem* newitem = new TexCacheItem();
 		newitem->suspectedInvalid = false;
 		newitem->texformat = format;
-		newitem->cacheFormat = TEXFORMAT;
 		newitem->texpal = texpal;
-		newitem->sizeX=sizeX;
-		newitem->sizeY=sizeY;
-		newitem->invSizeX=1.0f/((float)(sizeX));
-		newitem->invSizeY=1.0f/((float)(sizeY));
-		newitem->decode_len = sizeX*sizeY*4;
-		newitem->mode = textureMode;
-		newitem->decoded = new u8[newitem->decode_len];
+		newitem->sizeX=src.sizeX;
+		newitem->sizeY=src.sizeY;
+		newitem->invSizeX=1.0f/((float)(src.sizeX));
+		newitem->invSizeY=1.0f/((float)(src.sizeY));
+		newitem->mode = src.textureMode;
 		list_push_front(newitem);
 		//printf("allocating: up to %d with %d items\n",cache_size,index.size());
 
-		u32 *dwdst = (u32*)newitem->decoded;
-		
-		//dump palette data for cache keying
-		if(palSize)
+		//remember what the texture was decoded from, for validating it later
+		newitem->dumpHash = dumpHash(src.pal,src.palSize,src.ms,src.msIndex);
+
+		return view<TEXFORMAT>(newitem,src,defer);
+	} //scan()
+
+	//makes sure a valid item has its view in TEXFORMAT, decoding it (or leaving it pending) if it is new
+	template<TexCache_TexFormat TEXFORMAT>
+	TexCacheItem* view(TexCacheItem* item, TexSource& src, bool defer)
+	{
+		TexCacheItem::View &view = item->views[TEXFORMAT];
+		if(view.decoded)
 		{
-			memcpy(newitem->dump.palette, pal, palSize*2);
+			if(!defer) TexCache_Decode(item,TEXFORMAT);
+			return item;
 		}
 
-		//dump texture and 4x4 index data for cache keying
-		const int texsize = newitem->dump.textureSize = ms.size;
-		const int indexsize = newitem->dump.indexSize = msIndex.size;
-		newitem->dump.texture = new u8[texsize+indexsize];
-		ms.dump(&newitem->dump.texture[0],newitem->dump.maxTextureSize); //dump texture
-		if(textureMode == TEXMODE_4X4)
-			msIndex.dump(newitem->dump.texture+newitem->dump.textureSize,newitem->dump.indexSize); //dump 4x4
+		view.decode_len = item->sizeX*item->sizeY*4;
+		view.decoded = texBufferPool.alloc(view.decode_len);
+		cache_size += view.decode_len;
+
+		//a texture seen in an earlier session can be copied off the disk instead of decoded
+		if(texDiskCache.isOpen())
+		{
+			view.diskKey = diskKey(item,TEXFORMAT,src);
+			if(texDiskCache.load(view.diskKey,view.decoded,view.decode_len))
+				return item;
+		}
 
+		if(defer)
+		{
+			//leave the conversion to whoever samples it first, or to finishDecodes()
+			view.decodeState = TexCacheItem::DECODE_PENDING;
+			pending.push_back(std::make_pair(item,TEXFORMAT));
+		}
+		else
+		{
+			decode<TEXFORMAT>(item,src);
+			storeToDisk(item,TEXFORMAT);
+		}
+
+		return item;
+	}
+
+	//converts the vram data described by src into the item's decoded buffer.
+	//this only reads vram and the item, so it may run on any thread while the vram mapping holds still
+	template<TexCache_TexFormat TEXFORMAT>
+	static void decode(TexCacheItem* item, const TexSource& src)
+	{
+		const u32 format = item->texformat;
+		const u32 sizeX = src.sizeX, sizeY = src.sizeY;
+		const u32 paletteAddress = src.paletteAddress;
+		const u16* pal = src.pal;
+		const MemSpan& ms = src.ms;
+
+		u8 *adr;
+		u32 *dwdst = (u32*)item->views[TEXFORMAT].decoded;
 
 		//============================================================================ 
 		//Texture conversion
@@ -402,13 +1145,26 @@ public:
 		const u8 opaqueColor = (TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F;
 		const u8 palZeroTransparent = ( 1 - ((format>>29) & 1) ) * opaqueColor;
 
-		switch (newitem->mode)
+		switch (item->mode)
 		{
 		case TEXMODE_A3I5:
 			{
+#ifdef TEXCACHE_SIMD
+				u32 colors[32];
+				for(int i=0;i<32;i++)
+					colors[i] = CONVERT(pal[i],0);
+				TexPalettePlanes planes;
+				planes.setup(colors,32);
+#endif
 				for(int j=0;j<ms.numItems;j++) {
 					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
+					u32 x = 0;
+#ifdef TEXCACHE_SIMD
+					x = TexDecode_A3I5<TEXFORMAT>(adr, ms.items[j].len, planes, dwdst);
+					adr += x;
+					dwdst += x;
+#endif
+					for(; x < ms.items[j].len; x++)
 					{
 						u16 c = pal[*adr&31];
 						u8 alpha = *adr>>5;
@@ -424,9 +1180,22 @@ public:
 
 		case TEXMODE_I2:
 			{
+#ifdef TEXCACHE_SIMD
+				u32 colors[4];
+				for(int i=0;i<4;i++)
+					colors[i] = CONVERT(pal[i],(i == 0) ? palZeroTransparent : opaqueColor);
+				TexPalettePlanes planes;
+				planes.setup(colors,4);
+#endif
 				for(int j=0;j<ms.numItems;j++) {
 					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
+					u32 x = 0;
+#ifdef TEXCACHE_SIMD
+					x = TexDecode_I2(adr, ms.items[j].len, planes, dwdst);
+					adr += x;
+					dwdst += x*4;
+#endif
+					for(; x < ms.items[j].len; x++)
 					{
 						u8 bits;
 						u16 c;
@@ -454,9 +1223,22 @@ public:
 			}
 		case TEXMODE_I4:
 			{
+#ifdef TEXCACHE_SIMD
+				u32 colors[16];
+				for(int i=0;i<16;i++)
+					colors[i] = CONVERT(pal[i],(i == 0) ? palZeroTransparent : opaqueColor);
+				TexPalettePlanes planes;
+				planes.setup(colors,16);
+#endif
 				for(int j=0;j<ms.numItems;j++) {
 					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
+					u32 x = 0;
+#ifdef TEXCACHE_SIMD
+					x = TexDecode_I4(adr, ms.items[j].len, planes, dwdst);
+					adr += x;
+					dwdst += x*2;
+#endif
+					for(; x < ms.items[j].len; x++)
 					{
 						u8 bits;
 						u16 c;
@@ -619,6 +1401,9 @@ public:
 						//TODO - this could be more precise for 32bpp mode (run it through the color separation table)
 
 						//set all 16 texels
+#ifdef TEXCACHE_SIMD
+						TexDecode_4x4Block(currBlock, tmp_col, dwdst + (x<<2) + tmpPos[0], sizeX);
+#else
 						for (size_t sy = 0; sy < 4; sy++)
 						{
 							// Texture offset
@@ -630,15 +1415,29 @@ public:
 							dwdst[currentPos+2] = tmp_col[(currRow>>4)&3];
 							dwdst[currentPos+3] = tmp_col[(currRow>>6)&3];
 						}
+#endif
 					}
 				}
 				break;
 			}
 		case TEXMODE_A5I3:
 			{
+#ifdef TEXCACHE_SIMD
+				u32 colors[8];
+				for(int i=0;i<8;i++)
+					colors[i] = CONVERT(pal[i],0);
+				TexPalettePlanes planes;
+				planes.setup(colors,8);
+#endif
 				for(int j=0;j<ms.numItems;j++) {
 					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; ++x)
+					u32 x = 0;
+#ifdef TEXCACHE_SIMD
+					x = TexDecode_A5I3<TEXFORMAT>(adr, ms.items[j].len, planes, dwdst);
+					adr += x;
+					dwdst += x;
+#endif
+					for(; x < ms.items[j].len; ++x)
 					{
 						u16 c = pal[*adr&0x07];
 						u8 alpha = (*adr>>3);
@@ -656,7 +1455,12 @@ public:
 				for(int j=0;j<ms.numItems;j++) {
 					u16* map = (u16*)ms.items[j].ptr;
 					int len = ms.items[j].len>>1;
-					for(int x = 0; x < len; ++x)
+					int x = 0;
+#ifdef TEXCACHE_SIMD
+					x = TexDecode_16bpp<TEXFORMAT>(ms.items[j].ptr, len<<1, dwdst)>>1;
+					dwdst += x;
+#endif
+					for(; x < len; ++x)
 					{
 						u16 c = map[x];
 						int alpha = ((c&0x8000)?opaqueColor:0);
@@ -668,11 +1472,20 @@ public:
 		} //switch(texture format)
 
 #ifdef DO_DEBUG_DUMP_TEXTURE
-	DebugDumpTexture(newitem);
+	DebugDumpTexture(item,item->views[TEXFORMAT].decoded);
 #endif
+	} //decode()
 
-		return newitem;
-	} //scan()
+	//decodes everything still pending, on this thread if no one else has picked it up
+	void finishDecodes()
+	{
+		for(size_t i=0;i<pending.size();i++)
+		{
+			TexCache_Decode(pending[i].first,pending[i].second);
+			storeToDisk(pending[i].first,pending[i].second);
+		}
+		pending.clear();
+	}
 
 	static const int PALETTE_DUMP_SIZE = (64+16+16)*1024;
 	u8 paletteDump[PALETTE_DUMP_SIZE];
@@ -689,7 +1502,7 @@ public:
 			mspal.dump(paletteDump);
 		}
 
-		for(TTexCacheItemMultimap::iterator it(index.begin()); it != index.end(); ++it)
+		for(TTexCacheItemMap::iterator it(index.begin()); it != index.end(); ++it)
 		{
 			it->second->suspectedInvalid = true;
 			
@@ -703,24 +1516,35 @@ public:
 		}
 	}
 
-	void evict(u32 target = kMaxCacheSize)
+	void releaseRendererData()
+	{
+		for(TTexCacheItemMap::iterator it(index.begin()); it != index.end(); ++it)
+		{
+			TexCacheItem* item = it->second;
+			if(!item->deleteCallback) continue;
+			item->deleteCallback(item);
+			item->deleteCallback = NULL;
+		}
+	}
+
+	//cuts the cache down to target once it has grown to limit
+	void evict(u32 limit, u32 target)
 	{
 		//debug print
-		//printf("%d %d/%d\n",index.size(),cache_size/1024,target/1024);
+		//printf("%d %d/%d\n",index.size(),cache_size/1024,limit/1024);
 
-		//dont do anything unless we're over the target
-		if(cache_size<target) return;
+		//dont do anything unless we're over the limit
+		if(cache_size<limit) return;
 
-		//aim at cutting the cache to half of the max size
-		target/=2;
+		//nothing may be deleted while a worker could still be decoding into it
+		finishDecodes();
 
-		//evicts items in an arbitrary order until it is less than the max cache size
-		//TODO - do this based on age and not arbitrarily
+		//evicts the least recently used items until it is less than the max cache size
 		while(cache_size > target)
 		{
-			if(index.size()==0) break; //just in case.. doesnt seem possible, cache_size wouldve been 0
+			if(lru_tail == NULL) break; //just in case.. doesnt seem possible, cache_size wouldve been 0
 
-			TexCacheItem* item = index.begin()->second;
+			TexCacheItem* item = lru_tail;
 			list_remove(item);
 			//printf("evicting! totalsize:%d\n",cache_size);
 			delete item;
@@ -730,7 +1554,30 @@ public:
 
 void TexCache_Reset()
 {
-	texCache.evict(0);
+	texCache.evict(0,0);
+}
+
+void TexCache_SetMaxSize(u32 bytes)
+{
+	texCache.maxCacheSize = bytes;
+	texCache.evict(bytes,bytes/2);
+	texBufferPool.release();
+}
+
+void TexCache_Trim(u32 bytes)
+{
+	texCache.evict(0,bytes);
+	texBufferPool.release();
+}
+
+u32 TexCache_MemoryUsage()
+{
+	return texCache.cache_size + texBufferPool.pooled;
+}
+
+void TexCache_ReleaseRendererData()
+{
+	texCache.releaseRendererData();
 }
 
 void TexCache_Invalidate()
@@ -743,14 +1590,143 @@ TexCacheItem* TexCache_SetTexture(TexCache_TexFormat TEXFORMAT, u32 format, u32
 {
 	switch(TEXFORMAT)
 	{
-	case TexFormat_32bpp: return texCache.scan<TexFormat_32bpp>(format,texpal);
-	case TexFormat_15bpp: return texCache.scan<TexFormat_15bpp>(format,texpal);
+	case TexFormat_32bpp: return texCache.scan<TexFormat_32bpp>(format,texpal,false);
+	case TexFormat_15bpp: return texCache.scan<TexFormat_15bpp>(format,texpal,false);
 	default: assert(false); return NULL;
 	}
 }
 
+TexCacheItem* TexCache_SetTextureDeferred(TexCache_TexFormat TEXFORMAT, u32 format, u32 texpal)
+{
+	switch(TEXFORMAT)
+	{
+	case TexFormat_32bpp: return texCache.scan<TexFormat_32bpp>(format,texpal,true);
+	case TexFormat_15bpp: return texCache.scan<TexFormat_15bpp>(format,texpal,true);
+	default: assert(false); return NULL;
+	}
+}
+
+void TexCache_DecodeSlow(TexCacheItem* item, TexCache_TexFormat TEXFORMAT)
+{
+	volatile s32 &state = item->views[TEXFORMAT].decodeState;
+	if(__sync_bool_compare_and_swap(&state,TexCacheItem::DECODE_PENDING,TexCacheItem::DECODE_BUSY))
+	{
+		TexSource src(item->texformat,item->texpal);
+		if(TEXFORMAT == TexFormat_32bpp)
+			TexCache::decode<TexFormat_32bpp>(item,src);
+		else
+			TexCache::decode<TexFormat_15bpp>(item,src);
+		__atomic_store_n(&state,(s32)TexCacheItem::DECODE_DONE,__ATOMIC_RELEASE);
+		return;
+	}
+
+	//someone else is on it. it is a single texture, so just wait
+	while(__atomic_load_n(&state,__ATOMIC_ACQUIRE) != TexCacheItem::DECODE_DONE) {}
+}
+
+void TexCache_FinishDecodes()
+{
+	texCache.finishDecodes();
+}
+
+void TexCache_OpenDiskCache(const char* fname)
+{
+	texDiskCache.open(fname);
+}
+
+void TexCache_CloseDiskCache()
+{
+	texDiskCache.close();
+}
+
+//what an LDR ASTC texel comes to between endpoints e0 and e1 with unquantized weight w, in 16 bits before it is
+//turned into 8, which the decoders do either by dropping the low byte or by rounding the unorm16
+static FORCEINLINE bool ASTC_InterpolatesTo(u32 e0, u32 e1, u32 w, u32 target)
+{
+	const u32 c = ((e0*257)*(64-w) + (e1*257)*w + 32) >> 6;
+	return (c>>8) == target && (c+128)/257 == target;
+}
+
+static FORCEINLINE u32 ASTC_ColorDistance(const u8* a, const u8* b)
+{
+	return abs(a[0]-b[0]) + abs(a[1]-b[1]) + abs(a[2]-b[2]) + abs(a[3]-b[3]);
+}
+
+static FORCEINLINE void ASTC_PutBits(u8* block, u32 pos, u32 count, u32 value)
+{
+	for(u32 i=0;i<count;i++)
+		if(value & (1<<i))
+			block[(pos+i)>>3] |= 1<<((pos+i)&7);
+}
+
+//the 16 texels (4 rows, pitch apart) as one partition of CEM 12 (rgba endpoints, at 8 bits) and 2 bit weights per
+//texel, which unquantize to 0, 21, 43 and 64. a 4x4 block is at most 4 colors, so those that are two colors and points
+//on the line between them come out exactly; the rest make it return false
+static bool ASTC_EncodeBlock(const u32* texels, u32 pitch, u8* block)
+{
+	static const u32 weights[4] = {0, 21, 43, 64};
+
+	const u8* t[16];
+	for(int i=0;i<16;i++)
+		t[i] = (const u8*)&texels[(i>>2)*pitch + (i&3)];
+
+	//the endpoints are the two texels furthest apart, found from the first as usual
+	const u8 *e0 = t[0], *e1 = t[0];
+	u32 best = 0;
+	for(int i=1;i<16;i++)
+	{
+		const u32 d = ASTC_ColorDistance(t[0], t[i]);
+		if(d > best) { best = d; e1 = t[i]; }
+	}
+	best = 0;
+	for(int i=0;i<16;i++)
+	{
+		const u32 d = ASTC_ColorDistance(e1, t[i]);
+		if(d > best) { best = d; e0 = t[i]; }
+	}
+	//CEM 12 swaps the endpoints and contracts blue when the second is the darker, so it never is
+	if(e1[0]+e1[1]+e1[2] < e0[0]+e0[1]+e0[2])
+		std::swap(e0, e1);
+
+	memset(block, 0, 16);
+	for(int i=0;i<16;i++)
+	{
+		u32 q = 0;
+		while(q < 4 && !(ASTC_InterpolatesTo(e0[0], e1[0], weights[q], t[i][0]) && ASTC_InterpolatesTo(e0[1], e1[1], weights[q], t[i][1])
+			&& ASTC_InterpolatesTo(e0[2], e1[2], weights[q], t[i][2]) && ASTC_InterpolatesTo(e0[3], e1[3], weights[q], t[i][3])))
+			q++;
+		if(q == 4)
+			return false;
+		//the weights are read from the top of the block down
+		ASTC_PutBits(block, 127-2*i, 1, q & 1);
+		ASTC_PutBits(block, 126-2*i, 1, q >> 1);
+	}
+
+	//block mode: a 4x4 grid of 2 bit weights, one plane. then one partition (0) and its endpoint mode
+	ASTC_PutBits(block, 0, 11, 0x042);
+	ASTC_PutBits(block, 11, 2, 0);
+	ASTC_PutBits(block, 13, 4, 12);
+	//79 bits are left for the 8 endpoint values, which makes them 8 bits each, in the order r0 r1 g0 g1 b0 b1 a0 a1
+	for(int c=0;c<4;c++)
+	{
+		ASTC_PutBits(block, 17 + c*16, 8, e0[c]);
+		ASTC_PutBits(block, 25 + c*16, 8, e1[c]);
+	}
+	return true;
+}
+
+bool TexCache_EncodeASTC4x4(const u32* decoded, u32 sizeX, u32 sizeY, u8* out)
+{
+	for(u32 y=0;y<sizeY;y+=4)
+		for(u32 x=0;x<sizeX;x+=4,out+=16)
+			if(!ASTC_EncodeBlock(decoded + y*sizeX + x, sizeX, out))
+				return false;
+	return true;
+}
+
 //call this periodically to keep the tex cache clean
 void TexCache_EvictFrame()
 {
-	texCache.evict();
+	//aim at cutting the cache to half of the max size
+	texCache.evict(texCache.maxCacheSize,texCache.maxCacheSize/2);
 }
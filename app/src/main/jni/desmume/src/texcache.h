@@ -33,56 +33,115 @@ enum TexCache_TexFormat
 
 class TexCacheItem;
 
-typedef std::multimap<u32,TexCacheItem*> TTexCacheItemMultimap;
+//the cache is keyed on the texformat and texpal params together
+typedef std::map<u64,TexCacheItem*> TTexCacheItemMap;
 
 class TexCacheItem
 {
 public:
+	//views from TexCache_SetTextureDeferred start out pending; whoever claims one moves it to busy, then done
+	enum { DECODE_DONE, DECODE_PENDING, DECODE_BUSY };
+
+	//the texture decoded in one format. each is made the first time a renderer asks for that format,
+	//so the ogl renderer and the rasterizer can share an item without evicting each other's data
+	struct View
+	{
+		View()
+			: decoded(NULL)
+			, decode_len(0)
+			, decodeState(DECODE_DONE)
+			, diskKey(0)
+		{}
+		u8* decoded; //decoded texture data, or NULL if the format hasnt been asked for
+		u32 decode_len;
+		volatile s32 decodeState;
+		u64 diskKey; //content hash this is filed under in the disk cache, or 0 if there is none
+	};
+
 	TexCacheItem() 
-		: decode_len(0)
-		, decoded(NULL)
-		, suspectedInvalid(false)
+		: suspectedInvalid(false)
 		, assumedInvalid(false)
+		, lruPrev(NULL)
+		, lruNext(NULL)
+		, dumpHash(0)
 		, deleteCallback(NULL)
-		, cacheFormat(TexFormat_None)
 	{}
-	~TexCacheItem() {
-		delete[] decoded;
-		if(deleteCallback) deleteCallback(this);
-	}
-	u32 decode_len;
+	~TexCacheItem();
+
+	//items and their decoded buffers come from pools in texcache.cpp rather than straight from the heap,
+	//since textures are missed and evicted all the time
+	static void* operator new(size_t size);
+	static void operator delete(void* p);
+
 	u32 mode;
-	u8* decoded; //decoded texture data
+	View views[3]; //indexed by TexCache_TexFormat. the TexFormat_None one stays empty
 	bool suspectedInvalid;
 	bool assumedInvalid;
-	TTexCacheItemMultimap::iterator iterator;
+	TTexCacheItemMap::iterator iterator;
+	TexCacheItem *lruPrev, *lruNext; //neighbours in the order the items were last used, newest first
 
 	int getTextureMode() const { return (int)((texformat>>26)&0x07); }
 
+	//what all the views together take up, for the cache budget
+	u32 decodedSize() const { return views[TexFormat_32bpp].decode_len + views[TexFormat_15bpp].decode_len; }
+
+	bool isPending() const { return views[TexFormat_32bpp].decodeState != DECODE_DONE || views[TexFormat_15bpp].decodeState != DECODE_DONE; }
+
 	u32 texformat, texpal;
 	u32 sizeX, sizeY;
 	float invSizeX, invSizeY;
 
+	//hash of the palette, texture and 4x4 index data this was decoded from, to check it against vram
+	u64 dumpHash;
+
 	u64 texid; //used by ogl renderer for the texid
 	void (*deleteCallback)(TexCacheItem*);
-
-	TexCache_TexFormat cacheFormat;
-
-	struct Dump {
-		~Dump() {
-			delete[] texture;
-		}
-		int textureSize, indexSize;
-		static const int maxTextureSize=128*1024;
-		u8* texture;
-		u8 palette[256*2];
-	} dump;
 };
 
 void TexCache_Invalidate();
 void TexCache_Reset();
 void TexCache_EvictFrame();
 
+//gives every item's renderer data (the ogl texture ids) back through its deleteCallback, but keeps the decoded textures.
+//for a renderer that is shutting down
+void TexCache_ReleaseRendererData();
+
 TexCacheItem* TexCache_SetTexture(TexCache_TexFormat TEXFORMAT, u32 format, u32 texpal);
 
+//like TexCache_SetTexture, but a view that is new is only allocated and left for TexCache_Decode to fill in,
+//so that the decoding can be spread over worker threads. the view must not be sampled before that.
+TexCacheItem* TexCache_SetTextureDeferred(TexCache_TexFormat TEXFORMAT, u32 format, u32 texpal);
+
+//makes sure a deferred view is decoded, doing it on the calling thread or waiting for whoever already is.
+//safe to call from any thread, as long as vram isnt remapped meanwhile
+void TexCache_DecodeSlow(TexCacheItem* item, TexCache_TexFormat TEXFORMAT);
+inline void TexCache_Decode(TexCacheItem* item, TexCache_TexFormat TEXFORMAT)
+{
+	if(__atomic_load_n(&item->views[TEXFORMAT].decodeState,__ATOMIC_ACQUIRE) != TexCacheItem::DECODE_DONE)
+		TexCache_DecodeSlow(item,TEXFORMAT);
+}
+
+//decodes every deferred view that is still pending. call this before vram gets remapped
+void TexCache_FinishDecodes();
+
+//keeps decoded textures in the given file across sessions, and starts using the ones already in it
+void TexCache_OpenDiskCache(const char* fname);
+void TexCache_CloseDiskCache();
+
+//about how many bytes the decoded textures take, with the buffers pooled for reuse
+u32 TexCache_MemoryUsage();
+
+//how many bytes of them the cache keeps before it evicts the least recently used half (see memusage_setBudget)
+void TexCache_SetMaxSize(u32 bytes);
+//evicts the least recently used items until no more than bytes are left, for when the system is short of memory.
+//like TexCache_Reset, only between frames
+void TexCache_Trim(u32 bytes);
+
+//the bytes an ASTC 4x4 copy of a sizeX by sizeY texture takes
+inline u32 TexCache_ASTC4x4Size(u32 sizeX, u32 sizeY) { return (sizeX>>2)*(sizeY>>2)*16; }
+//writes a 32bpp decoded texture (in the byte order GL_RGBA/GL_UNSIGNED_BYTE reads it) as ASTC 4x4 blocks into out,
+//which has TexCache_ASTC4x4Size of room. only does it if every block comes out exactly as it was, and returns false
+//otherwise, for the texture to be uploaded as it is. the sizes have to be multiples of 4
+bool TexCache_EncodeASTC4x4(const u32* decoded, u32 sizeX, u32 sizeY, u8* out);
+
 #endif
@@ -934,7 +934,7 @@ TEMPLATE static  u32 FASTCALL OP_STMIA_THUMB(const u32 i)
 	// ------	* If <Rn> is the lowest-numbered register specified in <registers>, the original value of <Rn> is stored.
 	// ------	* Otherwise, the stored value of <Rn> is UNPREDICTABLE.
 	if (BIT_N(i, REG_NUM(i, 8)))
-		printf("STMIA with Rb in Rlist\n");
+		CORELOG_INFO("STMIA with Rb in Rlist\n");
 
 	for(j = 0; j<8; j++)
 	{
@@ -948,7 +948,7 @@ TEMPLATE static  u32 FASTCALL OP_STMIA_THUMB(const u32 i)
 	}
 
 	if (erList)
-		 printf("STMIA with Empty Rlist\n");
+		 CORELOG_INFO("STMIA with Empty Rlist\n");
 
 	cpu->R[REG_NUM(i, 8)] = adr;
 	return MMU_aluMemCycles<PROCNUM>(2, c);
@@ -976,7 +976,7 @@ TEMPLATE static  u32 FASTCALL OP_LDMIA_THUMB(const u32 i)
 	}
 
 	if (erList)
-		 printf("LDMIA with Empty Rlist\n");
+		 CORELOG_INFO("LDMIA with Empty Rlist\n");
 
 	// ARM_REF:	THUMB: Causes base register write-back, and is not optional
 	// ARM_REF:	If the base register <Rn> is specified in <registers>, the final value of <Rn> is the loaded value
@@ -993,7 +993,7 @@ TEMPLATE static  u32 FASTCALL OP_LDMIA_THUMB(const u32 i)
 
 TEMPLATE static  u32 FASTCALL OP_BKPT_THUMB(const u32 i)
 {
-	printf("THUMB%c: OP_BKPT triggered\n", PROCNUM?'7':'9');
+	CORELOG_INFO("THUMB%c: OP_BKPT triggered\n", PROCNUM?'7':'9');
 	Status_Reg tmp = cpu->CPSR;
 	armcpu_switchMode(cpu, ABT);				// enter abt mode
 	cpu->R[14] = cpu->instruct_adr + 4;
@@ -1064,8 +1064,13 @@ TEMPLATE static  u32 FASTCALL OP_B_COND(const u32 i)
 	if(!TEST_COND((i>>8)&0xF, 0, cpu->CPSR))
 		return 1;
 	
-	cpu->R[15] += (u32)((s8)(i&0xFF))<<1;
+	const s32 off = (s8)(i&0xFF);
+	cpu->R[15] += (u32)off<<1;
 	cpu->next_instruction = cpu->R[15];
+
+	//a short loop back may be one that only polls memory
+	if(off <= -2 && off >= -(IDLE_LOOP_MAX_OPS+1))
+		armcpu_checkIdleLoop<PROCNUM>(cpu->R[15]);
 	return 3;
 }
 
@@ -1080,8 +1085,12 @@ TEMPLATE static  u32 FASTCALL OP_B_UNCOND(const u32 i)
 		NocashMessage(cpu,6);
 	}
 
-	cpu->R[15] += (SIGNEEXT_IMM11(i)<<1);
+	const s32 off = SIGNEEXT_IMM11(i);
+	cpu->R[15] += (off<<1);
 	cpu->next_instruction = cpu->R[15];
+
+	if(off <= -2 && off >= -(IDLE_LOOP_MAX_OPS+1))
+		armcpu_checkIdleLoop<PROCNUM>(cpu->R[15]);
 	return 1;
 }
  
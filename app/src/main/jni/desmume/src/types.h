@@ -67,6 +67,12 @@
 #ifdef __SSE2__
 #define ENABLE_SSE2
 #endif
+#ifdef __SSSE3__
+#define ENABLE_SSSE3
+#endif
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define ENABLE_NEON
+#endif
 #endif
 
 #ifdef NOSSE
@@ -77,6 +83,14 @@
 #undef ENABLE_SSE2
 #endif
 
+#ifdef NOSSSE3
+#undef ENABLE_SSSE3
+#endif
+
+#ifdef NONEON
+#undef ENABLE_NEON
+#endif
+
 #ifdef _MSC_VER 
 #define strcasecmp(x,y) _stricmp(x,y)
 #define strncasecmp(x, y, l) strnicmp(x, y, l)
@@ -17,6 +17,12 @@
 
 #include <stdio.h>
 #include <time.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define TIXML_USE_STL
 #include "tinyxml/tinyxml.h"
@@ -25,68 +31,206 @@
 #include "../common.h"
 #include "../mc.h"
 #include "../emufile.h"
+#include "../corelog.h"
 
 ADVANsCEne advsc;
 
 #define _ADVANsCEne_BASE_ID "DeSmuME database (ADVANsCEne)\0x1A"
-#define _ADVANsCEne_BASE_VERSION_MAJOR 1
+#define _ADVANsCEne_BASE_VERSION_MAJOR 2
 #define _ADVANsCEne_BASE_VERSION_MINOR 0
 #define _ADVANsCEne_BASE_NAME "ADVANsCEne Nintendo DS Collection"
 
-u8 ADVANsCEne::checkDB(const char *ROMserial, u32 crc)
+//the converted database. version 1 is the header and then the records one after the other, which
+//has to be read through to find a game. version 2 (what convertDB writes) has, after the same id
+//and version bytes:
+//  version(4) + count(4) + tableSize(4) + createTime(8)
+//  count records of serial(8) + crc32(4) + save_type(1) + reserved(3)
+//  two hash tables of tableSize u32, by the 4 letter game code and by crc32. each slot holds a record
+//  number plus one, or 0 where the probing stops; a key's records are found in the order they were added.
+//everything little endian.
+static const u32 kHeaderSize2 = 4 + 4 + 4 + 8;
+static const u32 kRecordSize2 = 16;
+
+static u32 hashSerial(const char *serial)
+{
+	u32 hash = 2166136261u;
+	for (int i = 0; i < 4; i++)
+	{
+		hash ^= (u8)serial[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static u32 hashCRC(u32 crc)
+{
+	return crc * 2654435761u;
+}
+
+static u32 readLE32(const u8 *p)
+{
+	u32 val;
+	memcpy(&val, p, 4);
+	return LE_TO_LOCAL_32(val);
+}
+
+#ifdef WIN32
+void ADVANsCEne::mapDB()
 {
-	loaded = false;
 	FILE *fp = fopen(database_path.c_str(), "rb");
-	if (fp)
+	if (!fp) return;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (size > 0)
 	{
-		char buf[64];
-		memset(buf, 0, sizeof(buf));
-		if (fread(buf, 1, strlen(_ADVANsCEne_BASE_ID), fp) == strlen(_ADVANsCEne_BASE_ID))
+		mapBuffer.resize(size);
+		if (fread(&mapBuffer[0], 1, size, fp) == (size_t)size)
 		{
-			//printf("ID: %s\n", buf);
-			if (strcmp(buf, _ADVANsCEne_BASE_ID) == 0)
-			{
-				if (fread(&versionBase[0], 1, 2, fp) == 2)
-				{
-					//printf("Version base: %i.%i\n", versionBase[0], versionBase[1]);
-					if (fread(&version[0], 1, 4, fp) == 4)
-					{
-						//printf("Version: %c%c%c%c\n", version[3], version[2], version[1], version[0]);
-						if (fread(&createTime, 1, sizeof(time_t), fp) == sizeof(time_t))
-						{
-							memset(buf, 0,sizeof(buf));
-							// serial(8) + crc32(4) + save_type(1) = 13 + reserved(8) = 21
-							while (true)
-							{
-								if (fread(buf, 1, 21, fp) != 21) break;
-
-								bool serialFound = (memcmp(&buf[4], ROMserial, 4) == 0);
-								u32 dbcrc = LE_TO_LOCAL_32(*(u32*)(buf+8));
-								bool crcFound = (crc == dbcrc);
-
-								if(serialFound || crcFound)
-								{
-									foundAsCrc = crcFound;
-									foundAsSerial = serialFound;
-									memcpy(&crc32, &buf[8], 4);
-									memcpy(&serial[0], &buf[4], 4);
-									//printf("%s founded: crc32=%04X, save type %02X\n", ROMserial, crc32, buf[12]);
-									saveType = buf[12];
-									fclose(fp);
-									loaded = true;
-									return true;
-								}
-							}
-						}
-					}
-				}
-			}
+			map = &mapBuffer[0];
+			mapSize = (u32)size;
+		}
+	}
+	fclose(fp);
+}
+
+void ADVANsCEne::unmapDB()
+{
+	std::vector<u8>().swap(mapBuffer);
+	map = NULL;
+	mapSize = 0;
+}
+#else
+void ADVANsCEne::mapDB()
+{
+	int fd = ::open(database_path.c_str(), O_RDONLY);
+	if (fd < 0) return;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size <= 0x7FFFFFFF)
+	{
+		void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr != MAP_FAILED)
+		{
+			map = (u8*)ptr;
+			mapSize = (u32)st.st_size;
+		}
+	}
+	::close(fd);
+}
+
+void ADVANsCEne::unmapDB()
+{
+	if (map) munmap(map, mapSize);
+	map = NULL;
+	mapSize = 0;
+}
+#endif
+
+bool ADVANsCEne::findIndexed(const char *ROMserial, u32 crc)
+{
+	const u32 base = strlen(_ADVANsCEne_BASE_ID) + 2;
+	if (mapSize < base + kHeaderSize2) return false;
+	const u8 *header = map + base;
+	memcpy(version, header, 4);
+	const u32 count = readLE32(header + 4);
+	const u32 tableSize = readLE32(header + 8);
+	u64 time;
+	memcpy(&time, header + 12, 8);
+	createTime = (time_t)LE_TO_LOCAL_64(time);
+
+	const u8 *records = header + kHeaderSize2;
+	const u8 *serialTable = records + (u64)count * kRecordSize2;
+	const u8 *crcTable = serialTable + (u64)tableSize * 4;
+	if (tableSize == 0 || (tableSize & (tableSize - 1)) || count >= tableSize) return false;
+	if ((u64)(crcTable - map) + (u64)tableSize * 4 > mapSize) return false;
+
+	//a record with both wins. otherwise, like in version 1, the first one with either
+	u32 found = 0xFFFFFFFF;
+	bool exact = false;
+	for (u32 pos = hashSerial(ROMserial) & (tableSize - 1); ; pos = (pos + 1) & (tableSize - 1))
+	{
+		const u32 slot = readLE32(serialTable + pos * 4);
+		if (slot == 0 || slot > count) break;
+		const u8 *rec = records + (slot - 1) * kRecordSize2;
+		if (memcmp(rec + 4, ROMserial, 4) != 0) continue;
+		if (readLE32(rec + 8) == crc)
+		{
+			found = slot - 1;
+			exact = true;
+			break;
+		}
+		if (found == 0xFFFFFFFF) found = slot - 1;
+	}
+	if (!exact)
+	{
+		for (u32 pos = hashCRC(crc) & (tableSize - 1); ; pos = (pos + 1) & (tableSize - 1))
+		{
+			const u32 slot = readLE32(crcTable + pos * 4);
+			if (slot == 0 || slot > count) break;
+			if (readLE32(records + (slot - 1) * kRecordSize2 + 8) != crc) continue;
+			if (slot - 1 < found) found = slot - 1;
+			break;
+		}
+	}
+	if (found == 0xFFFFFFFF) return false;
+
+	const u8 *rec = records + found * kRecordSize2;
+	foundAsSerial = (memcmp(rec + 4, ROMserial, 4) == 0);
+	foundAsCrc = (readLE32(rec + 8) == crc);
+	crc32 = readLE32(rec + 8);
+	memcpy(&serial[0], rec + 4, 4);
+	saveType = rec[12];
+	return true;
+}
+
+bool ADVANsCEne::findLinear(const char *ROMserial, u32 crc)
+{
+	u32 pos = strlen(_ADVANsCEne_BASE_ID) + 2;
+	if (mapSize < pos + 4 + sizeof(time_t)) return false;
+	memcpy(&version[0], map + pos, 4);
+	memcpy(&createTime, map + pos + 4, sizeof(time_t));
+	pos += 4 + sizeof(time_t);
+
+	// serial(8) + crc32(4) + save_type(1) = 13 + reserved(8) = 21
+	for (; pos + 21 <= mapSize; pos += 21)
+	{
+		const u8 *buf = map + pos;
+		bool serialFound = (memcmp(&buf[4], ROMserial, 4) == 0);
+		u32 dbcrc = readLE32(buf + 8);
+		bool crcFound = (crc == dbcrc);
+
+		if(serialFound || crcFound)
+		{
+			foundAsCrc = crcFound;
+			foundAsSerial = serialFound;
+			crc32 = dbcrc;
+			memcpy(&serial[0], &buf[4], 4);
+			//printf("%s founded: crc32=%04X, save type %02X\n", ROMserial, crc32, buf[12]);
+			saveType = buf[12];
+			return true;
 		}
-		fclose(fp);
 	}
 	return false;
 }
 
+u8 ADVANsCEne::checkDB(const char *ROMserial, u32 crc)
+{
+	loaded = false;
+	if (!map) mapDB();
+	if (!map) return false;
+
+	const u32 idSize = strlen(_ADVANsCEne_BASE_ID);
+	if (mapSize < idSize + 2 || memcmp(map, _ADVANsCEne_BASE_ID, idSize) != 0) return false;
+	memcpy(&versionBase[0], map + idSize, 2);
+	//printf("Version base: %i.%i\n", versionBase[0], versionBase[1]);
+
+	if (versionBase[0] >= 2)
+		loaded = findIndexed(ROMserial, crc);
+	else
+		loaded = findLinear(ROMserial, crc);
+	return loaded;
+}
+
  
 void ADVANsCEne::setDatabase(const char *path)
 {
@@ -94,6 +238,7 @@ void ADVANsCEne::setDatabase(const char *path)
 	
 	//i guess this means it needs (re)loading on account of the path having changed
 	loaded = false;
+	unmapDB();
 }
 
 bool ADVANsCEne::getXMLConfig(const char *in_filename)
@@ -149,28 +294,17 @@ u32 ADVANsCEne::convertDB(const char *in_filename, EMUFILE* output)
 	TiXmlElement	*el_crc32 = NULL;
 	TiXmlElement	*el_saveType = NULL;
 	u32				crc32 = 0;
-	u32				reserved = 0;
+	std::vector<u8>	records;
 
 	lastImportErrorMessage = "";
 
-	printf("Converting DB...\n");
+	CORELOG_INFO("Converting DB...\n");
 	if (getXMLConfig(in_filename))
 	{
 		if (datName.size()==0) return 0;
 		if (datName != _ADVANsCEne_BASE_NAME) return 0;
 	}
 
-	// Header
-	output->fwrite(_ADVANsCEne_BASE_ID, strlen(_ADVANsCEne_BASE_ID));
-	output->fputc(_ADVANsCEne_BASE_VERSION_MAJOR);
-	output->fputc(_ADVANsCEne_BASE_VERSION_MINOR);
-	if (datVersion.size()) 
-		output->fwrite(&datVersion[0], datVersion.size());
-	else
-		output->fputc(0);
-	time_t __time = time(NULL);
-	output->fwrite(&__time, sizeof(time_t));
-
 	xml = new TiXmlDocument();
 	if (!xml) return 0;
 	if (!xml->LoadFile(in_filename)) return 0;
@@ -198,12 +332,15 @@ u32 ADVANsCEne::convertDB(const char *in_filename, EMUFILE* output)
 			lastImportErrorMessage = "Missing <serial> element. Did you use the right xml file? We need the RtoolDS one.";
 			return 0;
 		}
-		output->fwrite(el_serial->GetText(), 8);
+		u8 rec[kRecordSize2] = {0};
+		if (el_serial->GetText())
+			strncpy((char*)rec, el_serial->GetText(), 8);
 
 		// CRC32
 		el_crc32 = el->FirstChildElement("files"); 
 		sscanf_s(el_crc32->FirstChildElement("romCRC")->GetText(), "%x", &crc32);
-		output->fwrite(&crc32, sizeof(u32));
+		crc32 = LOCAL_TO_LE_32(crc32);
+		memcpy(rec + 8, &crc32, 4);
 		
 		// Save type
 		el_saveType = el->FirstChildElement("saveType"); 
@@ -229,18 +366,50 @@ u32 ADVANsCEne::convertDB(const char *in_filename, EMUFILE* output)
 				}
 			}
 		}
-		output->fputc(selectedSaveType);
-		output->fwrite(&reserved, sizeof(u32));
-		output->fwrite(&reserved, sizeof(u32));
+		rec[12] = selectedSaveType;
+		records.insert(records.end(), rec, rec + kRecordSize2);
 		count++;
 		el = el->NextSiblingElement("game");
 	}
 	printf("\n");
 	delete xml;
+
+	//at most half full, so that the probing stays short
+	u32 tableSize = 16;
+	while (tableSize < count * 2) tableSize <<= 1;
+	std::vector<u32> serialTable(tableSize, 0), crcTable(tableSize, 0);
+	for (u32 i = 0; i < count; i++)
+	{
+		const u8 *rec = &records[i * kRecordSize2];
+		u32 pos = hashSerial((const char*)rec + 4) & (tableSize - 1);
+		while (serialTable[pos]) pos = (pos + 1) & (tableSize - 1);
+		serialTable[pos] = i + 1;
+		pos = hashCRC(readLE32(rec + 8)) & (tableSize - 1);
+		while (crcTable[pos]) pos = (pos + 1) & (tableSize - 1);
+		crcTable[pos] = i + 1;
+	}
+
+	// Header
+	output->fwrite(_ADVANsCEne_BASE_ID, strlen(_ADVANsCEne_BASE_ID));
+	output->fputc(_ADVANsCEne_BASE_VERSION_MAJOR);
+	output->fputc(_ADVANsCEne_BASE_VERSION_MINOR);
+	char ver[4] = {0};
+	strncpy(ver, datVersion.c_str(), 4);
+	output->fwrite(ver, 4);
+	output->write32le(count);
+	output->write32le(tableSize);
+	output->write64le((u64)time(NULL));
+
+	if (count > 0)
+		output->fwrite(&records[0], records.size());
+	for (u32 i = 0; i < tableSize; i++)
+		output->write32le(serialTable[i]);
+	for (u32 i = 0; i < tableSize; i++)
+		output->write32le(crcTable[i]);
 	if (count > 0) 
-		printf("done\n");
+		CORELOG_INFO("done\n");
 	else
-		printf("error\n");
-	printf("ADVANsCEne converter: %i found\n", count);
+		CORELOG_ERROR("error\n");
+	CORELOG_INFO("ADVANsCEne converter: %i found\n", count);
 	return count;
 }
@@ -16,6 +16,7 @@
 */
 
 #include <string>
+#include <vector>
 #include "../types.h"
 
 class EMUFILE;
@@ -34,6 +35,17 @@ private:
 	bool			loaded;
 	bool foundAsCrc, foundAsSerial;
 
+	// the database file, mapped while the path stays the same
+	u8				*map;
+	u32				mapSize;
+#ifdef WIN32
+	std::vector<u8>	mapBuffer;
+#endif
+	void mapDB();
+	void unmapDB();
+	bool findIndexed(const char *ROMserial, u32 crc);
+	bool findLinear(const char *ROMserial, u32 crc);
+
 	// XML
 	std::string datName;
 	std::string datVersion;
@@ -45,12 +57,15 @@ public:
 	ADVANsCEne()
 		: saveType(0xFF),
 		crc32(0),
-		loaded(false)
+		loaded(false),
+		map(NULL),
+		mapSize(0)
 	{
 		memset(versionBase, 0, sizeof(versionBase));
 		memset(version, 0, sizeof(version));
 		memset(serial, 0, sizeof(serial));
 	}
+	~ADVANsCEne() { unmapDB(); }
 	void setDatabase(const char *path);
 	std::string getDatabase() const { return database_path; }
 	u32 convertDB(const char *in_filename, EMUFILE* output);
@@ -28,6 +28,7 @@
 
 #include "crc.h"
 #include "header.h"
+#include "../../corelog.h"
 
 //encr_data
 const unsigned char arm7_key[] =
@@ -501,7 +502,7 @@ bool DecryptSecureArea(u8 *romheader, u8 *secure)
 	// check if ROM is already encrypted
 	if (romType == ROMTYPE_NDSDUMPED)
 	{
-		printf("Already decrypted.\n");
+		CORELOG_INFO("Already decrypted.\n");
 	}
 	else if (romType >= ROMTYPE_ENCRSECURE)		// includes ROMTYPE_MASKROM
 	{
@@ -516,11 +517,11 @@ bool DecryptSecureArea(u8 *romheader, u8 *secure)
 		if (!decrypt_arm9(*(u32 *)header->gamecode, secure))
 			return false;
 
-		printf("Decrypted.\n");
+		CORELOG_INFO("Decrypted.\n");
 	}
 	else
 	{
-		printf("File doesn't appear to have a secure area.\n");
+		CORELOG_INFO("File doesn't appear to have a secure area.\n");
 	}
 
 	return true;
@@ -548,7 +549,7 @@ bool EncryptSecureArea(u8 *romheader, u8 *secure)
 
 		encrypt_arm9(*(u32 *)header->gamecode, secure);
 
-		printf("Encrypted.\n");
+		CORELOG_INFO("Encrypted.\n");
 	}
 
 	return true;
@@ -18,11 +18,11 @@
 //based on Arduino SdFat Library ( http://code.google.com/p/sdfatlib/ )
 //Copyright (C) 2009 by William Greiman
 
-//based on mkdosfs - utility to create FAT/MS-DOS filesystems
-//Copyright (C) 1991 Linus Torvalds <torvalds@klaava.helsinki.fi>
-//Copyright (C) 1992-1993 Remy Card <card@masi.ibp.fr>
-//Copyright (C) 1993-1994 David Hudson <dave@humbug.demon.co.uk>
-//Copyright (C) 1998 H. Peter Anvin <hpa@zytor.com>
+//based on mkdosfs - utility to create FAT/MS-DOS filesystems
+//Copyright (C) 1991 Linus Torvalds <torvalds@klaava.helsinki.fi>
+//Copyright (C) 1992-1993 Remy Card <card@masi.ibp.fr>
+//Copyright (C) 1993-1994 David Hudson <dave@humbug.demon.co.uk>
+//Copyright (C) 1998 H. Peter Anvin <hpa@zytor.com>
 //Copyright (C) 1998-2005 Roman Hodek <Roman.Hodek@informatik.uni-erlangen.de>
 
 #include "emufat.h"
@@ -31,6 +31,7 @@
 #include <wctype.h>
 #include <string.h>
 #include "../emufile.h"
+#include "../corelog.h"
 
 
 #define LE16(x) (x)
@@ -230,7 +231,7 @@ bool calculateClusterSize(TFat32BootSector* bsp, u32 avail_sectors, u32& cluster
 		u32 maxclust12, maxclust16, maxclust32;
 		u32 clust12, clust16, clust32;
 do {
-				printf( "Trying with %d sectors/cluster:\n", bs.sectorsPerCluster );
+				CORELOG_INFO( "Trying with %d sectors/cluster:\n", bs.sectorsPerCluster );
 
 			/* The factor 2 below avoids cut-off errors for nr_fats == 1.
 			* The "nr_fats*3" is for the reserved first two FAT entries */
@@ -244,11 +245,11 @@ do {
 			maxclust12 = (fatlength12 * 2 * sector_size) / 3;
 			if (maxclust12 > MAX_CLUST_12)
 				maxclust12 = MAX_CLUST_12;
-				printf( "FAT12: #clu=%u, fatlen=%u, maxclu=%u, limit=%u\n",
+				CORELOG_INFO( "FAT12: #clu=%u, fatlen=%u, maxclu=%u, limit=%u\n",
 				clust12, fatlength12, maxclust12, MAX_CLUST_12 );
 			if (clust12 > maxclust12-2) {
 				clust12 = 0;
-					printf( "FAT12: too much clusters\n" );
+					CORELOG_ERROR( "FAT12: too much clusters\n" );
 			}
 
 			clust16 = ((u64) fatdata *sector_size + bs.fatCount*4) /
@@ -261,16 +262,16 @@ do {
 			maxclust16 = (fatlength16 * sector_size) / 2;
 			if (maxclust16 > MAX_CLUST_16)
 				maxclust16 = MAX_CLUST_16;
-			printf( "FAT16: #clu=%u, fatlen=%u, maxclu=%u, limit=%u\n",
+			CORELOG_INFO( "FAT16: #clu=%u, fatlen=%u, maxclu=%u, limit=%u\n",
 				clust16, fatlength16, maxclust16, MAX_CLUST_16 );
 			if (clust16 > maxclust16-2) {
-				printf( "FAT16: too much clusters\n" );
+				CORELOG_ERROR( "FAT16: too much clusters\n" );
 				clust16 = 0;
 			}
 			/* The < 4078 avoids that the filesystem will be misdetected as having a
 			* 12 bit FAT. */
 			if (clust16 < FAT12_THRESHOLD && !(size_fat_by_user && size_fat == 16)) {
-				printf( clust16 < FAT12_THRESHOLD ?
+				CORELOG_ERROR( clust16 < FAT12_THRESHOLD ?
 					"FAT16: would be misdetected as FAT12\n" :
 				"FAT16: too much clusters\n" );
 				clust16 = 0;
@@ -288,13 +289,13 @@ do {
 				maxclust32 = MAX_CLUST_32;
 			if (clust32 && clust32 < MIN_CLUST_32 && !(size_fat_by_user && size_fat == 32)) {
 				clust32 = 0;
-					printf( "FAT32: not enough clusters (%d)\n", MIN_CLUST_32);
+					CORELOG_INFO( "FAT32: not enough clusters (%d)\n", MIN_CLUST_32);
 			}
-				printf( "FAT32: #clu=%u, fatlen=%u, maxclu=%u, limit=%u\n",
+				CORELOG_INFO( "FAT32: #clu=%u, fatlen=%u, maxclu=%u, limit=%u\n",
 				clust32, fatlength32, maxclust32, MAX_CLUST_32 );
 			if (clust32 > maxclust32) {
 				clust32 = 0;
-					printf( "FAT32: too much clusters\n" );
+					CORELOG_ERROR( "FAT32: too much clusters\n" );
 			}
 
 			if ((clust12 && (size_fat == 0 || size_fat == 12)) ||
@@ -310,7 +311,7 @@ do {
 	* FAT32 is (not yet) choosen automatically */
 	if (!size_fat) {
 		size_fat = (clust16 > clust12) ? 16 : 12;
-		printf( "Choosing %d bits for FAT\n", size_fat );
+		CORELOG_INFO( "Choosing %d bits for FAT\n", size_fat );
 	}
 
 	switch (size_fat) {
@@ -322,14 +323,14 @@ do {
 		case 16:
 	if (clust16 < FAT12_THRESHOLD) {
 		if (size_fat_by_user) {
-			printf("WARNING: Not enough clusters for a "
+			CORELOG_WARN("WARNING: Not enough clusters for a "
 				"16 bit FAT! The filesystem will be\n"
 				"misinterpreted as having a 12 bit FAT without "
 				"mount option \"fat=16\".\n" );
 			return false;
 		}
 		else {
-			printf("This filesystem has an unfortunate size. "
+			CORELOG_INFO("This filesystem has an unfortunate size. "
 				"A 12 bit FAT cannot provide\n"
 				"enough clusters, but a 16 bit FAT takes up a little "
 				"bit more space so that\n"
@@ -346,7 +347,7 @@ do {
 
 case 32:
 	if (clust32 < MIN_CLUST_32)
-		printf("WARNING: Not enough clusters for a 32 bit FAT!\n");
+		CORELOG_WARN("WARNING: Not enough clusters for a 32 bit FAT!\n");
 	cluster_count = clust32;
 	fat_length = fatlength32;
 	bs.sectorsPerFat16 = LE16(0);
@@ -459,7 +460,7 @@ bool EmuFatVolume::formatNew(u32 sectors)
 	bs->fat32.fat32RootCluster = LE32(2);
 	bs->fat32.fat32FSInfo = LE16(1);
 	u32 backup_boot = (bs->reservedSectorCount>= 7) ? 6 : (bs->reservedSectorCount >= 2) ? bs->reservedSectorCount-1 : 0;
-	printf( "Using sector %d as backup boot sector (0 = none)\n",backup_boot );
+	CORELOG_INFO( "Using sector %d as backup boot sector (0 = none)\n",backup_boot );
 	bs->fat32.fat32BackBootBlock = LE16(backup_boot);
 	memset(bs->fat32.fat32Reserved,0,sizeof(bs->fat32.fat32Reserved));
 
@@ -476,7 +477,7 @@ bool EmuFatVolume::formatNew(u32 sectors)
 		//if (sectors_per_cluster)	/* If yes, die if we'd spec'd sectors per cluster */
 		//	die ("Too many clusters for file system - try more sectors per cluster");
 		//else
-			printf("Attempting to create a too large file system");
+			CORELOG_ERROR("Attempting to create a too large file system");
 			return false;
 	}
 
@@ -485,7 +486,7 @@ bool EmuFatVolume::formatNew(u32 sectors)
 
 	if (sectors < start_data_block + 32)	/* Arbitrary undersize file system! */
 	{
-		printf("Too few blocks for viable file system");
+		CORELOG_ERROR("Too few blocks for viable file system");
 		return false;
 	}
 
@@ -0,0 +1,223 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "fastcrc.h"
+#include <string.h>
+#include <zlib.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_PMULL
+#define HWCAP_PMULL (1 << 4)
+#endif
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+//the folding: the crc of a message is its remainder by the polynomial, and so is the crc of anything with the same
+//remainder. a 128 bit block followed by n more bits has the same remainder as its two halves multiplied by the
+//remainders of x^(n+64) and x^n, so four running blocks are each multiplied over the 64 bytes after them and added
+//(xor-ed) into those, until there are no more whole blocks. then the four are folded into one the same way, 16 bytes
+//at a time, and what is left is a 16 byte message with the same crc, which is finished with the rest.
+//the constants are those remainders, bit-reflected like the crc is (and shifted by one for that), for
+//x^(512+64), x^512 (the four) and x^(128+64), x^128 (the one)
+static const u64 kFold4Lo = 0x154442bd4ULL, kFold4Hi = 0x1c6e41596ULL;
+static const u64 kFold1Lo = 0x1751997d0ULL, kFold1Hi = 0x0ccaa009eULL;
+
+//the crc without the inversions zlib's has at the start and the end, from zlib
+static u32 tableUpdate(u32 raw, const u8* data, size_t len)
+{
+	while(len)
+	{
+		const uInt n = len > 0x40000000 ? 0x40000000 : (uInt)len;
+		raw = ~(u32)crc32(~raw, data, n);
+		data += n;
+		len -= n;
+	}
+	return raw;
+}
+
+#if defined(__aarch64__)
+
+__attribute__((target("crc")))
+static u32 armUpdate(u32 raw, const u8* data, size_t len)
+{
+	for(; len && ((uintptr_t)data & 7); len--)
+		raw = __crc32b(raw, *data++);
+	for(; len >= 8; len -= 8, data += 8)
+	{
+		u64 v;
+		memcpy(&v, data, 8);
+		raw = __crc32d(raw, v);
+	}
+	for(; len; len--)
+		raw = __crc32b(raw, *data++);
+	return raw;
+}
+
+static inline uint64x2_t pmullFold(uint64x2_t x, poly64x2_t k)
+{
+	const poly64x2_t p = vreinterpretq_p64_u64(x);
+	const uint64x2_t lo = vreinterpretq_u64_p128(vmull_p64(vgetq_lane_p64(p, 0), vgetq_lane_p64(k, 0)));
+	const uint64x2_t hi = vreinterpretq_u64_p128(vmull_high_p64(p, k));
+	return veorq_u64(lo, hi);
+}
+
+//at least 64 bytes. returns the 16 bytes that are left in place of the whole blocks, and the data after them
+__attribute__((target("aes")))
+static const u8* pmullFoldBlocks(u32 raw, const u8* data, size_t& len, u8 out[16])
+{
+	const u64 k4[2] = { kFold4Lo, kFold4Hi };
+	const u64 k1[2] = { kFold1Lo, kFold1Hi };
+	const poly64x2_t fold4 = vreinterpretq_p64_u64(vld1q_u64(k4));
+	const poly64x2_t fold1 = vreinterpretq_p64_u64(vld1q_u64(k1));
+
+	uint64x2_t x0 = vld1q_u64((const u64*)data);
+	uint64x2_t x1 = vld1q_u64((const u64*)(data + 16));
+	uint64x2_t x2 = vld1q_u64((const u64*)(data + 32));
+	uint64x2_t x3 = vld1q_u64((const u64*)(data + 48));
+	x0 = veorq_u64(x0, vcombine_u64(vcreate_u64(raw), vcreate_u64(0)));
+	data += 64;
+	len -= 64;
+
+	for(; len >= 64; len -= 64, data += 64)
+	{
+		x0 = veorq_u64(pmullFold(x0, fold4), vld1q_u64((const u64*)data));
+		x1 = veorq_u64(pmullFold(x1, fold4), vld1q_u64((const u64*)(data + 16)));
+		x2 = veorq_u64(pmullFold(x2, fold4), vld1q_u64((const u64*)(data + 32)));
+		x3 = veorq_u64(pmullFold(x3, fold4), vld1q_u64((const u64*)(data + 48)));
+	}
+
+	x0 = veorq_u64(pmullFold(x0, fold1), x1);
+	x0 = veorq_u64(pmullFold(x0, fold1), x2);
+	x0 = veorq_u64(pmullFold(x0, fold1), x3);
+	for(; len >= 16; len -= 16, data += 16)
+		x0 = veorq_u64(pmullFold(x0, fold1), vld1q_u64((const u64*)data));
+
+	vst1q_u64((u64*)out, x0);
+	return data;
+}
+
+static u32 pmullCrcUpdate(u32 raw, const u8* data, size_t len)
+{
+	if(len < 64)
+		return armUpdate(raw, data, len);
+	u8 folded[16];
+	data = pmullFoldBlocks(raw, data, len, folded);
+	return armUpdate(armUpdate(0, folded, 16), data, len);
+}
+
+static u32 pmullTableUpdate(u32 raw, const u8* data, size_t len)
+{
+	if(len < 64)
+		return tableUpdate(raw, data, len);
+	u8 folded[16];
+	data = pmullFoldBlocks(raw, data, len, folded);
+	return tableUpdate(tableUpdate(0, folded, 16), data, len);
+}
+
+#elif defined(__i386__) || defined(__x86_64__)
+
+__attribute__((target("pclmul,sse2")))
+static inline __m128i clmulFold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+}
+
+__attribute__((target("pclmul,sse2")))
+static u32 pclmulUpdate(u32 raw, const u8* data, size_t len)
+{
+	if(len < 64)
+		return tableUpdate(raw, data, len);
+
+	const __m128i fold4 = _mm_set_epi64x((long long)kFold4Hi, (long long)kFold4Lo);
+	const __m128i fold1 = _mm_set_epi64x((long long)kFold1Hi, (long long)kFold1Lo);
+
+	__m128i x0 = _mm_loadu_si128((const __m128i*)data);
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(data + 16));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(data + 32));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(data + 48));
+	x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128((int)raw));
+	data += 64;
+	len -= 64;
+
+	for(; len >= 64; len -= 64, data += 64)
+	{
+		x0 = _mm_xor_si128(clmulFold(x0, fold4), _mm_loadu_si128((const __m128i*)data));
+		x1 = _mm_xor_si128(clmulFold(x1, fold4), _mm_loadu_si128((const __m128i*)(data + 16)));
+		x2 = _mm_xor_si128(clmulFold(x2, fold4), _mm_loadu_si128((const __m128i*)(data + 32)));
+		x3 = _mm_xor_si128(clmulFold(x3, fold4), _mm_loadu_si128((const __m128i*)(data + 48)));
+	}
+
+	x0 = _mm_xor_si128(clmulFold(x0, fold1), x1);
+	x0 = _mm_xor_si128(clmulFold(x0, fold1), x2);
+	x0 = _mm_xor_si128(clmulFold(x0, fold1), x3);
+	for(; len >= 16; len -= 16, data += 16)
+		x0 = _mm_xor_si128(clmulFold(x0, fold1), _mm_loadu_si128((const __m128i*)data));
+
+	u8 folded[16];
+	_mm_storeu_si128((__m128i*)folded, x0);
+	return tableUpdate(tableUpdate(0, folded, 16), data, len);
+}
+
+#endif
+
+typedef u32 (*RawUpdate)(u32 raw, const u8* data, size_t len);
+
+static RawUpdate update = NULL;
+static const char* updateName = "table";
+
+static RawUpdate pick()
+{
+	RawUpdate picked = tableUpdate;
+	const char* name = "table";
+#if defined(__aarch64__)
+	const unsigned long hwcap = getauxval(AT_HWCAP);
+	if((hwcap & HWCAP_PMULL) && (hwcap & HWCAP_CRC32)) { picked = pmullCrcUpdate; name = "pmull+crc32"; }
+	else if(hwcap & HWCAP_PMULL) { picked = pmullTableUpdate; name = "pmull"; }
+	else if(hwcap & HWCAP_CRC32) { picked = armUpdate; name = "crc32"; }
+#elif defined(__i386__) || defined(__x86_64__)
+	unsigned int eax, ebx, ecx, edx;
+	if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL) && (edx & bit_SSE2)) { picked = pclmulUpdate; name = "pclmul"; }
+#endif
+	//the same whichever thread gets here first
+	updateName = name;
+	__atomic_store_n(&update, picked, __ATOMIC_RELEASE);
+	return picked;
+}
+
+u32 fastcrc32(u32 crc, const void* data, size_t len)
+{
+	RawUpdate fn = __atomic_load_n(&update, __ATOMIC_ACQUIRE);
+	if(!fn)
+		fn = pick();
+	return ~fn(~crc, (const u8*)data, len);
+}
+
+const char* fastcrc32_impl()
+{
+	if(!__atomic_load_n(&update, __ATOMIC_ACQUIRE))
+		pick();
+	return updateName;
+}
@@ -0,0 +1,32 @@
+/*
+	Copyright (C) 2017 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FASTCRC_H
+#define _FASTCRC_H
+
+#include <stddef.h>
+#include "../types.h"
+
+//zlib's crc32 (the one of gzip, zip and 802.11 frames), done with whatever the cpu has for it: where it can multiply
+//without carries (arm64 pmull, x86 pclmulqdq) the data is folded a 64 byte block at a time, and arm64's crc32
+//instructions take the rest 8 bytes at a time. zlib's tables do it otherwise. which one is found out on the first call
+u32 fastcrc32(u32 crc, const void* data, size_t len);
+
+//what the first call picked, for the log
+const char* fastcrc32_impl();
+
+#endif
@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <string>
+#include <algorithm>
 #ifdef HOST_WINDOWS 
 #include <direct.h>
 #include <windows.h>
@@ -31,6 +32,7 @@
 #define __mkdir(x) mkdir(x, 0777)
 #endif
 #include "fsnitro.h"
+#include "../corelog.h"
 
 using namespace std;
 
@@ -93,17 +95,17 @@ FS_NITRO::FS_NITRO(u8 *cart_rom)
 	numOverlay9 = ARM9OverlaySize / sizeof(OVR_NITRO);
 	numOverlay7 = ARM7OverlaySize / sizeof(OVR_NITRO);
 
-	printf("Nitro File System:\n");
-	printf("\t* FNT at 0x%08X, size 0x%08X\n", FNameTblOff, FNameTblSize);
-	printf("\t* FAT at 0x%08X, size 0x%08X\n", FATOff, FATSize);
-	printf("\t* ARM9 at Overlay 0x%08X, size 0x%08X\n", ARM9OverlayOff, ARM9OverlaySize);
-	printf("\t* ARM7 at Overlay 0x%08X, size 0x%08X\n", ARM7OverlayOff, ARM7OverlaySize);
-	printf("\t* ARM9 exe at %08X, size %08Xh\n", ARM9exeStart, ARM9exeSize);
-	printf("\t* ARM7 exe at %08X, size %08Xh\n", ARM7exeStart, ARM7exeSize);
-	printf("\t* Directories: %u\n", numDirs);
-	printf("\t* Files %u\n", numFiles);
-	printf("\t* ARM9 Overlays %u\n", numOverlay9);
-	printf("\t* ARM7 Overlays %u\n", numOverlay7);
+	CORELOG_INFO("Nitro File System:\n");
+	CORELOG_INFO("\t* FNT at 0x%08X, size 0x%08X\n", FNameTblOff, FNameTblSize);
+	CORELOG_INFO("\t* FAT at 0x%08X, size 0x%08X\n", FATOff, FATSize);
+	CORELOG_INFO("\t* ARM9 at Overlay 0x%08X, size 0x%08X\n", ARM9OverlayOff, ARM9OverlaySize);
+	CORELOG_INFO("\t* ARM7 at Overlay 0x%08X, size 0x%08X\n", ARM7OverlayOff, ARM7OverlaySize);
+	CORELOG_INFO("\t* ARM9 exe at %08X, size %08Xh\n", ARM9exeStart, ARM9exeSize);
+	CORELOG_INFO("\t* ARM7 exe at %08X, size %08Xh\n", ARM7exeStart, ARM7exeSize);
+	CORELOG_INFO("\t* Directories: %u\n", numDirs);
+	CORELOG_INFO("\t* Files %u\n", numFiles);
+	CORELOG_INFO("\t* ARM9 Overlays %u\n", numOverlay9);
+	CORELOG_INFO("\t* ARM7 Overlays %u\n", numOverlay7);
 
 	fat = new FAT_NITRO[numFiles];
 	fnt = new FNT_NITRO[numDirs];
@@ -113,7 +115,7 @@ FS_NITRO::FS_NITRO(u8 *cart_rom)
 	if (!loadFileTables())
 	{
 		destroy();
-		printf("FSNITRO: Error loading file system tables\n");
+		CORELOG_ERROR("FSNITRO: Error loading file system tables\n");
 		return;
 	}
 
@@ -131,10 +133,19 @@ void FS_NITRO::destroy()
 	if (fnt) { delete [] fnt; fnt = NULL; }
 	if (ovr9) { delete [] ovr9; ovr9 = NULL; }
 	if (ovr7) { delete [] ovr7; ovr7 = NULL; }
+	byStart.clear();
 	numDirs = numFiles = numOverlay7 = numOverlay9 = currentID = 0;
 	inited = false;
 }
 
+struct FATStartLess
+{
+	FATStartLess(const FAT_NITRO *fat) : fat(fat) {}
+	bool operator()(u16 a, u16 b) const { return fat[a].start < fat[b].start; }
+	bool operator()(u32 addr, u16 id) const { return addr < fat[id].start; }
+	const FAT_NITRO *fat;
+};
+
 FNT_TYPES FS_NITRO::getFNTType(u8 type)
 {
 	if (type == 0x00) return FS_END_SUBTABLE;
@@ -268,12 +279,22 @@ bool FS_NITRO::loadFileTables()
 
 		if (type == FS_RESERVED)
 		{
-			printf("********** FS_RESERVED\n");
+			CORELOG_INFO("********** FS_RESERVED\n");
 			break;
 		}
 	}
 	delete [] store; store = NULL;
 
+	// ========= Index of the files by address
+	byStart.clear();
+	byStart.reserve(numFiles);
+	for (u32 i = 0; i < numFiles; i++)
+	{
+		if (fat[i].start < fat[i].end)
+			byStart.push_back(i);
+	}
+	sort(byStart.begin(), byStart.end(), FATStartLess(fat));
+
 	return true;
 }
 
@@ -348,23 +369,8 @@ u32 FS_NITRO::getFATRecord(u32 addr)
 
 bool FS_NITRO::getFileIdByAddr(u32 addr, u16 &id)
 {
-	id = 0xFFFF;
-	if (!inited) return false;
-
-	u32 pos = currentID;
-	while (true)
-	{
-		if ((addr >= fat[pos].start) && (addr < fat[pos].end))
-		{
-			id = pos;
-			currentID = pos;
-			return true;
-		}
-		pos++;
-		if (pos >= numFiles) pos = 0;
-		if (pos == currentID) break;
-	}
-	return false;
+	u32 offset;
+	return getFileIdByAddr(addr, id, offset);
 }
 
 bool FS_NITRO::getFileIdByAddr(u32 addr, u16 &id, u32 &offset)
@@ -372,22 +378,52 @@ bool FS_NITRO::getFileIdByAddr(u32 addr, u16 &id, u32 &offset)
 	id = 0xFFFF; offset = 0;
 	if (!inited) return false;
 
+	// reads mostly go on in the file the last one was in
 	u32 pos = currentID;
-	while (true)
+	if ((addr < fat[pos].start) || (addr >= fat[pos].end))
 	{
-		if ((addr >= fat[pos].start) && (addr < fat[pos].end))
-		{
-			id = pos;
-			offset = addr - fat[pos].start;
-			currentID = pos;
-			return true;
-		}
-		pos++;
-		if (pos >= numFiles) pos = 0;
-		if (pos == currentID) break;
+		// the last file that starts at or before addr
+		vector<u16>::const_iterator it = upper_bound(byStart.begin(), byStart.end(), addr, FATStartLess(fat));
+		if (it == byStart.begin()) return false;
+		pos = *(it - 1);
+		if (addr >= fat[pos].end) return false;
 	}
 
-	return false;
+	id = pos;
+	offset = addr - fat[pos].start;
+	currentID = pos;
+	return true;
+}
+
+void FS_NITRO::addFileRead(u16 id, u32 bytes)
+{
+	if (!inited) return;
+	if (id >= numFiles) return;
+
+	fat[id].reads++;
+	fat[id].readBytes += bytes;
+}
+
+u32 FS_NITRO::getFileReadsById(u16 id)
+{
+	if (!inited) return 0;
+	if (id >= numFiles) return 0;
+
+	return fat[id].reads;
+}
+
+u32 FS_NITRO::getFileReadBytesById(u16 id)
+{
+	if (!inited) return 0;
+	if (id >= numFiles) return 0;
+
+	return fat[id].readBytes;
+}
+
+void FS_NITRO::resetFileReads()
+{
+	for (u32 i = 0; i < numFiles; i++)
+		fat[i].reads = fat[i].readBytes = 0;
 }
 
 string FS_NITRO::getDirNameByID(u16 id)
@@ -479,7 +515,7 @@ u32 FS_NITRO::getEndAddrById(u16 id)
 
 bool FS_NITRO::extract(u16 id, string to)
 {
-	printf("Extract to %s\n", to.c_str());
+	CORELOG_INFO("Extract to %s\n", to.c_str());
 
 	FILE *fp = fopen(to.c_str(), "wb");
 	if (fp)
@@ -18,6 +18,7 @@
 #ifndef _FS_NITRO_H_
 #define _FS_NITRO_H_
 #include <string>
+#include <vector>
 #ifndef _MSC_VER
 #include <stdint.h>
 #include <string.h>
@@ -46,6 +47,8 @@ struct FAT_NITRO
 		, file(false)
 		, sizeFile(0)
 		, parentID(0)
+		, reads(0)
+		, readBytes(0)
 	{
 	}
 	u32 start;
@@ -57,6 +60,9 @@ struct FAT_NITRO
 	u32 sizeFile;
 	u16 parentID;
 	string filename;
+	// card reads that started in the file, and the bytes they asked for
+	u32 reads;
+	u32 readBytes;
 };
 
 struct FNT_MAIN
@@ -129,6 +135,9 @@ private:
 	OVR_NITRO	*ovr9;
 	OVR_NITRO	*ovr7;
 
+	// the ids of the files that aren't empty, by start address (files don't overlap)
+	vector<u16>	byStart;
+
 	FNT_TYPES getFNTType(u8 type);
 	bool loadFileTables();
 
@@ -162,6 +171,11 @@ public:
 	bool rebuildFAT(string pathData);
 	u32 getFATRecord(u32 addr);
 
+	void addFileRead(u16 id, u32 bytes);
+	u32 getFileReadsById(u16 id);
+	u32 getFileReadBytesById(u16 id);
+	void resetFileReads();
+
 	bool extractFile(u16 id, string to);
 	bool extractAll(string to, void (*callback)(u32 current, u32 num) = NULL);
 	
@@ -0,0 +1,56 @@
+/*
+	Copyright (C) 2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TABLEGEN_H_
+#define _TABLEGEN_H_
+
+//these write out the initializer of a lookup table that is a formula of its index, so that the compiler works the
+//table out and it goes in the read-only data instead of being filled in when the emulator starts.
+//TABLE_n(FN) expands to FN(0x0), FN(0x1), ... FN(n-1): the indexes are pasted together as hex literals a digit at a
+//time, so each entry costs the preprocessor one short token whatever the table's size. FN must be a macro that is
+//a constant expression of its argument, cast to the table's type (a narrowing conversion is an error in a braced
+//initializer). multidimensional tables take the flat list, their index being the entries' offset.
+
+#define TABLEGEN_16(FN,p) \
+	FN(0x##p##0), FN(0x##p##1), FN(0x##p##2), FN(0x##p##3), FN(0x##p##4), FN(0x##p##5), FN(0x##p##6), FN(0x##p##7), \
+	FN(0x##p##8), FN(0x##p##9), FN(0x##p##A), FN(0x##p##B), FN(0x##p##C), FN(0x##p##D), FN(0x##p##E), FN(0x##p##F)
+#define TABLEGEN_256(FN,p) \
+	TABLEGEN_16(FN,p##0), TABLEGEN_16(FN,p##1), TABLEGEN_16(FN,p##2), TABLEGEN_16(FN,p##3), \
+	TABLEGEN_16(FN,p##4), TABLEGEN_16(FN,p##5), TABLEGEN_16(FN,p##6), TABLEGEN_16(FN,p##7), \
+	TABLEGEN_16(FN,p##8), TABLEGEN_16(FN,p##9), TABLEGEN_16(FN,p##A), TABLEGEN_16(FN,p##B), \
+	TABLEGEN_16(FN,p##C), TABLEGEN_16(FN,p##D), TABLEGEN_16(FN,p##E), TABLEGEN_16(FN,p##F)
+#define TABLEGEN_4096(FN,p) \
+	TABLEGEN_256(FN,p##0), TABLEGEN_256(FN,p##1), TABLEGEN_256(FN,p##2), TABLEGEN_256(FN,p##3), \
+	TABLEGEN_256(FN,p##4), TABLEGEN_256(FN,p##5), TABLEGEN_256(FN,p##6), TABLEGEN_256(FN,p##7), \
+	TABLEGEN_256(FN,p##8), TABLEGEN_256(FN,p##9), TABLEGEN_256(FN,p##A), TABLEGEN_256(FN,p##B), \
+	TABLEGEN_256(FN,p##C), TABLEGEN_256(FN,p##D), TABLEGEN_256(FN,p##E), TABLEGEN_256(FN,p##F)
+#define TABLEGEN_65536(FN,p) \
+	TABLEGEN_4096(FN,p##0), TABLEGEN_4096(FN,p##1), TABLEGEN_4096(FN,p##2), TABLEGEN_4096(FN,p##3), \
+	TABLEGEN_4096(FN,p##4), TABLEGEN_4096(FN,p##5), TABLEGEN_4096(FN,p##6), TABLEGEN_4096(FN,p##7), \
+	TABLEGEN_4096(FN,p##8), TABLEGEN_4096(FN,p##9), TABLEGEN_4096(FN,p##A), TABLEGEN_4096(FN,p##B), \
+	TABLEGEN_4096(FN,p##C), TABLEGEN_4096(FN,p##D), TABLEGEN_4096(FN,p##E), TABLEGEN_4096(FN,p##F)
+
+#define TABLE_256(FN) TABLEGEN_256(FN,)
+#define TABLE_1024(FN) TABLEGEN_256(FN,0), TABLEGEN_256(FN,1), TABLEGEN_256(FN,2), TABLEGEN_256(FN,3)
+#define TABLE_4096(FN) TABLEGEN_4096(FN,)
+#define TABLE_32768(FN) \
+	TABLEGEN_4096(FN,0), TABLEGEN_4096(FN,1), TABLEGEN_4096(FN,2), TABLEGEN_4096(FN,3), \
+	TABLEGEN_4096(FN,4), TABLEGEN_4096(FN,5), TABLEGEN_4096(FN,6), TABLEGEN_4096(FN,7)
+#define TABLE_65536(FN) TABLEGEN_65536(FN,)
+#define TABLE_131072(FN) TABLEGEN_65536(FN,0), TABLEGEN_65536(FN,1)
+
+#endif
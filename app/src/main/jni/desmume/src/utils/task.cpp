@@ -18,13 +18,18 @@
 #include "types.h"
 #include "task.h"
 #include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include <algorithm>
 
 #ifdef HOST_WINDOWS
 #include <windows.h>
 #else
 #include <pthread.h>
-#if defined HOST_LINUX
+#if defined HOST_LINUX || defined ANDROID
 #include <unistd.h>
+#include <sched.h>
 #elif defined HOST_BSD || defined HOST_DARWIN
 #include <sys/sysctl.h>
 #endif
@@ -37,7 +42,7 @@ int getOnlineCores (void)
 	SYSTEM_INFO sysinfo;
 	GetSystemInfo(&sysinfo);
 	return sysinfo.dwNumberOfProcessors;
-#elif defined HOST_LINUX
+#elif defined HOST_LINUX || defined ANDROID
 	return sysconf(_SC_NPROCESSORS_ONLN);
 #elif defined HOST_BSD || defined HOST_DARWIN
 	int cores;
@@ -50,6 +55,202 @@ int getOnlineCores (void)
 #endif
 }
 
+void setCurrentThreadName(const char *name)
+{
+#if defined HOST_LINUX || defined ANDROID
+	char truncated[16];
+	strncpy(truncated, name, sizeof(truncated) - 1);
+	truncated[sizeof(truncated) - 1] = 0;
+	pthread_setname_np(pthread_self(), truncated);
+#elif defined HOST_DARWIN
+	pthread_setname_np(name);
+#endif
+}
+
+static volatile int corePlacement = CORE_PLACEMENT_SYSTEM;
+//bumped for each change, so that each thread can tell whether it moved for the current one
+static volatile int corePlacementSerial = 0;
+
+#if defined HOST_LINUX || defined ANDROID
+
+static int cpuCount = 0;
+static std::vector<int> bigCpus, littleCpus;
+static int fastestCpu = -1;
+
+static u32 readCpuValue(int cpu, const char *file)
+{
+	char path[96];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return 0;
+	unsigned int value = 0;
+	if (fscanf(f, "%u", &value) != 1)
+		value = 0;
+	fclose(f);
+	return value;
+}
+
+//the big ones are those above halfway between the slowest and the fastest, so the middle cores of a
+//three cluster cpu go with the fastest
+static void readCpuCapacities()
+{
+	cpuCount = (int)sysconf(_SC_NPROCESSORS_CONF);
+	if (cpuCount < 1 || cpuCount > CPU_SETSIZE)
+		return;
+
+	std::vector<u32> capacity(cpuCount);
+	u32 slowest = 0xFFFFFFFF, fastest = 0;
+	for (int i = 0; i < cpuCount; i++)
+	{
+		capacity[i] = readCpuValue(i, "cpu_capacity");
+		if (capacity[i] == 0)
+			capacity[i] = readCpuValue(i, "cpufreq/cpuinfo_max_freq");
+		if (capacity[i] == 0)
+			continue;
+		slowest = std::min(slowest, capacity[i]);
+		if (capacity[i] >= fastest)
+		{
+			fastest = capacity[i];
+			fastestCpu = i;
+		}
+	}
+	if (fastest == 0 || slowest == fastest)
+	{
+		fastestCpu = -1;
+		return;
+	}
+
+	const u32 middle = slowest + (fastest - slowest) / 2;
+	for (int i = 0; i < cpuCount; i++)
+	{
+		if (capacity[i] > middle)
+			bigCpus.push_back(i);
+		else if (capacity[i] != 0)
+			littleCpus.push_back(i);
+	}
+}
+
+static pthread_once_t cpuCapacitiesOnce = PTHREAD_ONCE_INIT;
+
+int getBigCores()
+{
+	pthread_once(&cpuCapacitiesOnce, &readCpuCapacities);
+	return (int)bigCpus.size();
+}
+
+static void setCurrentThreadCpus(const std::vector<int> *cpus, int single)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (single >= 0)
+		CPU_SET(single, &set);
+	else if (cpus)
+		for (size_t i = 0; i < cpus->size(); i++)
+			CPU_SET((*cpus)[i], &set);
+	else
+		for (int i = 0; i < cpuCount; i++)
+			CPU_SET(i, &set);
+	//pid 0 is the calling thread. a core the app isn't allowed on is left out by the kernel, which fails it only
+	//when that leaves none; the thread then stays where it was
+	sched_setaffinity(0, sizeof(set), &set);
+}
+
+#else
+
+int getBigCores() { return 0; }
+
+#endif
+
+void setCorePlacement(CorePlacement placement)
+{
+	if (placement == corePlacement)
+		return;
+	corePlacement = placement;
+	__sync_add_and_fetch(&corePlacementSerial, 1);
+}
+
+CorePlacement getCorePlacement()
+{
+	return (CorePlacement)corePlacement;
+}
+
+#if defined HOST_LINUX || defined ANDROID
+
+static pthread_mutex_t frameThreadsLock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<int> frameThreads;
+static volatile int frameThreadsSerial = 0;
+
+static void addFrameThread()
+{
+	pthread_mutex_lock(&frameThreadsLock);
+	frameThreads.push_back((int)gettid());
+	__atomic_add_fetch(&frameThreadsSerial, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&frameThreadsLock);
+}
+
+int getFrameThreads(int *ids, int max)
+{
+	pthread_mutex_lock(&frameThreadsLock);
+	const int count = (int)frameThreads.size();
+	for (int i = 0; i < count && i < max; i++)
+		ids[i] = frameThreads[i];
+	pthread_mutex_unlock(&frameThreadsLock);
+	return count;
+}
+
+int getFrameThreadsSerial()
+{
+	return __atomic_load_n(&frameThreadsSerial, __ATOMIC_ACQUIRE);
+}
+
+#else
+
+int getFrameThreads(int *ids, int max) { return 0; }
+int getFrameThreadsSerial() { return 0; }
+
+#endif
+
+void placeCurrentThread(ThreadRole role)
+{
+#if defined HOST_LINUX || defined ANDROID
+	static __thread bool listed = false;
+	if (!listed)
+	{
+		listed = true;
+		if (role != THREAD_ROLE_BACKGROUND)
+			addFrameThread();
+	}
+#endif
+
+	static __thread int placedSerial = 0;
+	const int serial = __atomic_load_n(&corePlacementSerial, __ATOMIC_ACQUIRE);
+	if (serial == placedSerial)
+		return;
+	placedSerial = serial;
+
+#if defined HOST_LINUX || defined ANDROID
+	if (getBigCores() == 0)
+		return;
+
+	switch (corePlacement)
+	{
+		case CORE_PLACEMENT_SYSTEM:
+			setCurrentThreadCpus(NULL, -1);
+			break;
+		case CORE_PLACEMENT_BIG:
+		case CORE_PLACEMENT_PIN:
+			if (role == THREAD_ROLE_BACKGROUND)
+				setCurrentThreadCpus(&littleCpus, -1);
+			else if (role == THREAD_ROLE_EMULATION && corePlacement == CORE_PLACEMENT_PIN)
+				setCurrentThreadCpus(NULL, fastestCpu);
+			else
+				setCurrentThreadCpus(&bigCpus, -1);
+			break;
+	}
+#endif
+}
+
 #ifdef HOST_WINDOWS
 class Task::Impl {
 public:
@@ -58,7 +259,7 @@ public:
 
 	bool spinlock;
 
-	void start(bool spinlock);
+	void start(bool spinlock, const char *name, ThreadRole role);
 	void shutdown();
 
 	//execute some work
@@ -128,7 +329,7 @@ void Task::Impl::taskProc()
 	}
 }
 
-void Task::Impl::start(bool spinlock)
+void Task::Impl::start(bool spinlock, const char *name, ThreadRole role)
 {
 	bIncomingWork = false;
 	bWorkDone = true;
@@ -195,12 +396,14 @@ public:
 	Impl();
 	~Impl();
 
-	void start(bool spinlock);
+	void start(bool spinlock, const char *name, ThreadRole role);
 	void execute(const TWork &work, void *param);
 	void* finish();
 	void shutdown();
 
 	pthread_mutex_t mutex;
+	char name[16];
+	ThreadRole role;
 	pthread_cond_t condWork;
 	TWork workFunc;
 	void *workFuncParam;
@@ -211,6 +414,8 @@ public:
 static void* taskProc(void *arg)
 {
 	Task::Impl *ctx = (Task::Impl *)arg;
+	if (ctx->name[0])
+		setCurrentThreadName(ctx->name);
 
 	do {
 		pthread_mutex_lock(&ctx->mutex);
@@ -220,6 +425,7 @@ static void* taskProc(void *arg)
 		}
 
 		if (ctx->workFunc != NULL) {
+			placeCurrentThread(ctx->role);
 			ctx->ret = ctx->workFunc(ctx->workFuncParam);
 		} else {
 			ctx->ret = NULL;
@@ -242,6 +448,8 @@ Task::Impl::Impl()
 	workFuncParam = NULL;
 	ret = NULL;
 	exitThread = false;
+	name[0] = 0;
+	role = THREAD_ROLE_WORKER;
 
 	pthread_mutex_init(&mutex, NULL);
 	pthread_cond_init(&condWork, NULL);
@@ -254,7 +462,7 @@ Task::Impl::~Impl()
 	pthread_cond_destroy(&condWork);
 }
 
-void Task::Impl::start(bool spinlock)
+void Task::Impl::start(bool spinlock, const char *name, ThreadRole role)
 {
 	pthread_mutex_lock(&this->mutex);
 
@@ -267,6 +475,9 @@ void Task::Impl::start(bool spinlock)
 	this->workFuncParam = NULL;
 	this->ret = NULL;
 	this->exitThread = false;
+	strncpy(this->name, name ? name : "", sizeof(this->name) - 1);
+	this->name[sizeof(this->name) - 1] = 0;
+	this->role = role;
 	pthread_create(&this->_thread, NULL, &taskProc, this);
 	this->_isThreadRunning = true;
 
@@ -334,7 +545,7 @@ void Task::Impl::shutdown()
 }
 #endif
 
-void Task::start(bool spinlock) { impl->start(spinlock); }
+void Task::start(bool spinlock, const char *name, ThreadRole role) { impl->start(spinlock, name, role); }
 void Task::shutdown() { impl->shutdown(); }
 Task::Task() : impl(new Task::Impl()) {}
 Task::~Task() { delete impl; }
@@ -342,3 +553,337 @@ void Task::execute(const TWork &work, void* param) { impl->execute(work,param);
 void* Task::finish() { return impl->finish(); }
 
 
+
+struct TaskPoolJob
+{
+	Task::TWork work;
+	void *param;
+	TaskGroup *group;
+};
+
+static void completeJob(const TaskPoolJob &job);
+
+#ifdef HOST_WINDOWS
+
+//no worker threads here; everything handed to the pool just runs on the caller
+class TaskPool::Impl {
+public:
+	Impl() : threadCount(0) {}
+	void start(int threadCount) {}
+	void shutdown() {}
+	void submit(const TaskPoolJob &job) { job.work(job.param); completeJob(job); }
+	bool takeJob(TaskPoolJob &job) { return false; }
+	void waitForGroup(TaskGroup *group) {}
+	void signalGroupDone() {}
+	int threadCount;
+};
+
+#else
+
+static __thread int currentWorkerIndex = -1;
+
+class TaskPool::Impl {
+public:
+	Impl();
+	~Impl();
+
+	struct Worker
+	{
+		Impl *pool;
+		int index;
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		std::deque<TaskPoolJob> jobs;
+	};
+
+	void start(int threadCount);
+	void shutdown();
+	void submit(const TaskPoolJob &job);
+	bool takeJob(TaskPoolJob &job);
+	void waitForGroup(TaskGroup *group);
+	void signalGroupDone();
+
+	static void* workerProc(void *arg);
+
+	std::vector<Worker*> workers;
+	int threadCount;
+	volatile int queued;
+	volatile int nextQueue;
+	bool exitThreads;
+
+	pthread_mutex_t mutexWork;
+	pthread_cond_t condWork;
+	pthread_mutex_t mutexDone;
+	pthread_cond_t condDone;
+};
+
+TaskPool::Impl::Impl()
+	: threadCount(0)
+	, queued(0)
+	, nextQueue(0)
+	, exitThreads(false)
+{
+	pthread_mutex_init(&mutexWork, NULL);
+	pthread_cond_init(&condWork, NULL);
+	pthread_mutex_init(&mutexDone, NULL);
+	pthread_cond_init(&condDone, NULL);
+}
+
+TaskPool::Impl::~Impl()
+{
+	shutdown();
+	pthread_mutex_destroy(&mutexWork);
+	pthread_cond_destroy(&condWork);
+	pthread_mutex_destroy(&mutexDone);
+	pthread_cond_destroy(&condDone);
+}
+
+void* TaskPool::Impl::workerProc(void *arg)
+{
+	Worker *self = (Worker *)arg;
+	Impl *pool = self->pool;
+	currentWorkerIndex = self->index;
+
+	char name[16];
+	snprintf(name, sizeof(name), "TaskPool %d", self->index);
+	setCurrentThreadName(name);
+
+	for (;;)
+	{
+		TaskPoolJob job;
+		if (pool->takeJob(job))
+		{
+			placeCurrentThread(THREAD_ROLE_WORKER);
+			job.work(job.param);
+			completeJob(job);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->mutexWork);
+		while (__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0 && !pool->exitThreads)
+			pthread_cond_wait(&pool->condWork, &pool->mutexWork);
+		const bool exitThread = pool->exitThreads && __atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0;
+		pthread_mutex_unlock(&pool->mutexWork);
+
+		if (exitThread)
+			break;
+	}
+
+	return NULL;
+}
+
+void TaskPool::Impl::start(int threadCount)
+{
+	if (this->threadCount > 0)
+		return;
+
+	exitThreads = false;
+	for (int i = 0; i < threadCount; i++)
+	{
+		Worker *worker = new Worker();
+		worker->pool = this;
+		worker->index = i;
+		pthread_mutex_init(&worker->mutex, NULL);
+		workers.push_back(worker);
+	}
+
+	for (int i = 0; i < threadCount; i++)
+		pthread_create(&workers[i]->thread, NULL, &workerProc, workers[i]);
+
+	this->threadCount = threadCount;
+}
+
+void TaskPool::Impl::shutdown()
+{
+	if (threadCount == 0)
+		return;
+
+	pthread_mutex_lock(&mutexWork);
+	exitThreads = true;
+	pthread_cond_broadcast(&condWork);
+	pthread_mutex_unlock(&mutexWork);
+
+	for (int i = 0; i < threadCount; i++)
+	{
+		pthread_join(workers[i]->thread, NULL);
+		pthread_mutex_destroy(&workers[i]->mutex);
+		delete workers[i];
+	}
+
+	workers.clear();
+	threadCount = 0;
+}
+
+void TaskPool::Impl::submit(const TaskPoolJob &job)
+{
+	//workers push onto their own queue so the job stays warm in that core's cache;
+	//anyone else spreads jobs around all the queues
+	int which = currentWorkerIndex;
+	if (which < 0 || which >= threadCount)
+		which = (int)((unsigned int)__sync_fetch_and_add(&nextQueue, 1) % (unsigned int)threadCount);
+
+	Worker *worker = workers[which];
+	pthread_mutex_lock(&worker->mutex);
+	worker->jobs.push_back(job);
+	pthread_mutex_unlock(&worker->mutex);
+
+	__sync_fetch_and_add(&queued, 1);
+
+	pthread_mutex_lock(&mutexWork);
+	pthread_cond_signal(&condWork);
+	pthread_mutex_unlock(&mutexWork);
+}
+
+bool TaskPool::Impl::takeJob(TaskPoolJob &job)
+{
+	if (__atomic_load_n(&queued, __ATOMIC_ACQUIRE) == 0)
+		return false;
+
+	//newest job from our own queue first, then steal the oldest job from somebody else
+	const int self = currentWorkerIndex;
+	if (self >= 0 && self < threadCount)
+	{
+		Worker *worker = workers[self];
+		pthread_mutex_lock(&worker->mutex);
+		if (!worker->jobs.empty())
+		{
+			job = worker->jobs.back();
+			worker->jobs.pop_back();
+			pthread_mutex_unlock(&worker->mutex);
+			__sync_fetch_and_sub(&queued, 1);
+			return true;
+		}
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	const int first = (self < 0) ? 0 : self + 1;
+	for (int i = 0; i < threadCount; i++)
+	{
+		Worker *victim = workers[(first + i) % threadCount];
+		if (victim->index == self)
+			continue;
+
+		pthread_mutex_lock(&victim->mutex);
+		if (!victim->jobs.empty())
+		{
+			job = victim->jobs.front();
+			victim->jobs.pop_front();
+			pthread_mutex_unlock(&victim->mutex);
+			__sync_fetch_and_sub(&queued, 1);
+			return true;
+		}
+		pthread_mutex_unlock(&victim->mutex);
+	}
+
+	return false;
+}
+
+void TaskPool::Impl::waitForGroup(TaskGroup *group)
+{
+	pthread_mutex_lock(&mutexDone);
+	if (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0)
+		pthread_cond_wait(&condDone, &mutexDone);
+	pthread_mutex_unlock(&mutexDone);
+}
+
+void TaskPool::Impl::signalGroupDone()
+{
+	pthread_mutex_lock(&mutexDone);
+	pthread_cond_broadcast(&condDone);
+	pthread_mutex_unlock(&mutexDone);
+}
+
+#endif
+
+static void completeJob(const TaskPoolJob &job)
+{
+	//the group may be gone as soon as its last job is accounted for, so don't touch it afterwards
+	TaskPool::Impl *pool = job.group->pool.impl;
+	if (__sync_sub_and_fetch(&job.group->pending, 1) == 0)
+		pool->signalGroupDone();
+}
+
+TaskPool::TaskPool() : impl(new TaskPool::Impl()) {}
+TaskPool::~TaskPool() { delete impl; }
+void TaskPool::start(int threadCount) { impl->start(threadCount); }
+void TaskPool::shutdown() { impl->shutdown(); }
+int TaskPool::getThreadCount() const { return impl->threadCount; }
+
+TaskPool& TaskPool::shared()
+{
+	static TaskPool pool;
+	static bool started = false;
+	if (!started)
+	{
+		started = true;
+		const int cores = getOnlineCores();
+		pool.start((cores > 1) ? cores - 1 : 1);
+	}
+	return pool;
+}
+
+struct TaskPoolRange
+{
+	TaskPool::TRangeWork work;
+	void *param;
+	int begin, end;
+};
+
+static void* runRange(void *arg)
+{
+	TaskPoolRange *range = (TaskPoolRange *)arg;
+	range->work(range->param, range->begin, range->end);
+	return NULL;
+}
+
+void TaskPool::parallelFor(int begin, int end, int grain, TRangeWork work, void *param)
+{
+	if (end <= begin)
+		return;
+	if (grain < 1)
+		grain = 1;
+
+	if (impl->threadCount == 0 || end - begin <= grain)
+	{
+		work(param, begin, end);
+		return;
+	}
+
+	std::vector<TaskPoolRange> ranges;
+	for (int i = begin; i < end; i += grain)
+	{
+		TaskPoolRange range = { work, param, i, (i + grain < end) ? i + grain : end };
+		ranges.push_back(range);
+	}
+
+	TaskGroup group(*this);
+	for (size_t i = 0; i < ranges.size(); i++)
+		group.run(&runRange, &ranges[i]);
+	group.wait();
+}
+
+TaskGroup::TaskGroup(TaskPool &pool) : pool(pool), pending(0) {}
+TaskGroup::~TaskGroup() { wait(); }
+
+void TaskGroup::run(const Task::TWork &work, void *param)
+{
+	TaskPoolJob job = { work, param, this };
+	__sync_fetch_and_add(&pending, 1);
+	pool.impl->submit(job);
+}
+
+void TaskGroup::wait()
+{
+	while (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) > 0)
+	{
+		TaskPoolJob job;
+		if (pool.impl->takeJob(job))
+		{
+			job.work(job.param);
+			completeJob(job);
+			continue;
+		}
+
+		pool.impl->waitForGroup(this);
+	}
+}
@@ -18,6 +18,23 @@
 #ifndef _TASK_H_
 #define _TASK_H_
 
+#include <stddef.h>
+
+//what a thread does, for where it goes on a cpu with big and little cores
+enum ThreadRole
+{
+	THREAD_ROLE_EMULATION,	//runs the emulation, so it is what holds up every frame
+	THREAD_ROLE_WORKER,		//helps it get its frames done: the pool, the sub gpu, the mixer
+	THREAD_ROLE_BACKGROUND,	//writes files and such, which nothing is waiting on
+};
+
+enum CorePlacement
+{
+	CORE_PLACEMENT_SYSTEM,		//wherever the scheduler puts them
+	CORE_PLACEMENT_BIG,			//the emulation and its workers on the big cores, the background on the little ones
+	CORE_PLACEMENT_PIN,			//the same, with the emulation on the fastest core alone
+};
+
 //Sort of like a single-thread thread pool.
 //You hand it a worker function and then call finish() to synch with its completion
 class Task
@@ -28,8 +45,9 @@ public:
 	
 	typedef void * (*TWork)(void *);
 
-	// initialize task runner
-	void start(bool spinlock);
+	// initialize task runner. the thread gets the name, if there is one, for debuggers and profilers,
+	// and goes where the core placement puts its role
+	void start(bool spinlock, const char *name = NULL, ThreadRole role = THREAD_ROLE_WORKER);
 
 	//execute some work
 	void execute(const TWork &work, void* param);
@@ -45,6 +63,70 @@ public:
 
 };
 
+//A persistent pool of worker threads shared by everything that wants parallelism
+//(the 3d rasterizer, the video filters, ...) so that each of them doesn't have to own its own threads.
+//Every worker has its own queue of jobs. Idle workers steal from the other queues,
+//so a worker which finishes early takes on the slack from one that is still busy.
+class TaskPool
+{
+public:
+	TaskPool();
+	~TaskPool();
+
+	typedef void (*TRangeWork)(void *param, int begin, int end);
+
+	//the pool used by the emulator; started on first use with one worker per core, minus one for the caller
+	static TaskPool& shared();
+
+	void start(int threadCount);
+	void shutdown();
+	int getThreadCount() const;
+
+	//runs work(param,begin,end) over [begin,end) in chunks of grain iterations and waits for all of them.
+	//the calling thread works on chunks too while it waits.
+	void parallelFor(int begin, int end, int grain, TRangeWork work, void *param);
+
+	class Impl;
+	Impl *impl;
+};
+
+//A batch of jobs submitted to a TaskPool which can be waited on as a unit.
+//run() returns immediately, so the submitter can go off and do something else until it calls wait().
+class TaskGroup
+{
+public:
+	TaskGroup(TaskPool &pool = TaskPool::shared());
+	~TaskGroup();
+
+	void run(const Task::TWork &work, void *param);
+
+	//blocks until every job handed to run() has completed, helping to execute queued jobs in the meantime
+	void wait();
+
+	TaskPool &pool;
+	volatile int pending;
+};
+
 int getOnlineCores (void);
 
+//names the calling thread, as debuggers and profilers show it. at most 15 characters are kept
+void setCurrentThreadName(const char *name);
+
+//the cores that are faster than the rest, from the capacities the kernel gives them (or their top clocks, on kernels
+//without those). 0 where the cores are all alike or it can't tell, and then no placement does anything
+int getBigCores();
+
+//the threads move when they next get to placeCurrentThread, which the tasks and the pool do before each job
+void setCorePlacement(CorePlacement placement);
+CorePlacement getCorePlacement();
+//moves the calling thread to where its role goes, if the placement changed since it last did
+void placeCurrentThread(ThreadRole role);
+
+//the kernel ids of the threads that have been placed as the emulation or its workers, for telling the system which
+//threads hold up the frames (performance hints). returns how many there are, putting at most max of them in ids.
+//threads that have since ended are still listed
+int getFrameThreads(int *ids, int max);
+//changes whenever a thread is added to them
+int getFrameThreadsSerial();
+
 #endif
@@ -23,6 +23,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stack>
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "../types.h"
 #include "../debug.h"
@@ -58,7 +67,7 @@ static void list_files(const char *filepath, ListCallback list_callback)
 	do {
 		fname = (strlen(entry.cAlternateFileName)>0) ? entry.cAlternateFileName : entry.cFileName;
 		list_callback(&entry,EListCallbackArg_Item);
-		printf("cflash added %s\n",entry.cFileName);
+		CORELOG_INFO("cflash added %s\n",entry.cFileName);
 
 		if ((entry.flags & FS_IS_DIR) && (strcmp(fname, ".")) && (strcmp(fname, ".."))) 
 		{
@@ -121,7 +130,7 @@ void build_ListCallback(FsEntry* fs, EListCallbackArg arg)
 		bool ok = LIBFAT::MkDir(currVirtPath.c_str());
 
 		if(!ok)
-			printf("ERROR adding dir %s via libfat\n",currVirtPath.c_str());
+			CORELOG_ERROR("ERROR adding dir %s via libfat\n",currVirtPath.c_str());
 
 		currPath = currPath + std::string(1,FS_SEPARATOR) + fname;
 		return;
@@ -141,12 +150,12 @@ void build_ListCallback(FsEntry* fs, EListCallbackArg arg)
 			fclose(inf);
 
 			std::string path = currVirtPath + "/" + fname;
-			printf("adding path %s for libfat\n",path.c_str());
+			CORELOG_INFO("adding path %s for libfat\n",path.c_str());
 			bool ok = LIBFAT::WriteFile(path.c_str(),buf,len);
 			if(!ok) 
-				printf("ERROR adding file to fat\n");
+				CORELOG_ERROR("ERROR adding file to fat\n");
 			delete[] buf;
-		} else printf("ERROR opening file for fat\n");
+		} else CORELOG_ERROR("ERROR opening file for fat\n");
 	}
 		
 }
@@ -172,8 +181,8 @@ bool VFAT::build(const char* path, int extra_MB)
 
 	if(dataSectors>=(0x80000000>>9))
 	{
-		printf("error allocating memory for fat (%d KBytes)\n",(dataSectors*512)/1024);
-		printf("total fat sizes > 2GB are never going to work\n");
+		CORELOG_ERROR("error allocating memory for fat (%d KBytes)\n",(dataSectors*512)/1024);
+		CORELOG_ERROR("total fat sizes > 2GB are never going to work\n");
 	}
 	
 	delete file;
@@ -183,8 +192,8 @@ bool VFAT::build(const char* path, int extra_MB)
 	}
 	catch(std::bad_alloc)
 	{
-		printf("error allocating memory for fat (%d KBytes)\n",(dataSectors*512)/1024);
-		printf("(out of memory)\n");
+		CORELOG_ERROR("error allocating memory for fat (%d KBytes)\n",(dataSectors*512)/1024);
+		CORELOG_ERROR("(out of memory)\n");
 		return false;
 	}
 
@@ -212,6 +221,680 @@ bool VFAT::build(const char* path, int extra_MB)
 	return true;
 }
 
+//-------
+//the lazy image: the same kind of fat32 that build() formats, but laid out from the sizes alone. the boot
+//sectors and the fat are made from the layout whenever they are read, a directory's entries the first time it is read,
+//and a file's clusters are read from the host file right then. what the ds writes goes to sectors kept on the side,
+//like it went to the memory image before: nothing is written back to the host folder.
+
+static const u32 kSectorSize = 512;
+static const u32 kReservedSectors = 32;
+static const u32 kFatCount = 2;
+static const u32 kRootCluster = 2;
+static const u32 kFatEOF = 0x0FFFFFFF;
+//2017-01-01 00:00, for every entry
+static const u16 kEntryDate = ((2017-1980) << 9) | (1 << 5) | 1;
+static const u16 kEntryTime = 0;
+//the sectors read are kept in pages of this many, as many pages as the cache size allows
+static const u32 kPageSectors = 8;
+static const u32 kPageBytes = kPageSectors*kSectorSize;
+//how many pages are read at once when a file looks to be streamed, that is when a miss comes right after the last one
+static const u32 kReadAheadPages = 8;
+
+class EMUFILE_VFAT : public EMUFILE
+{
+public:
+	EMUFILE_VFAT()
+		: pos(0)
+		, totalSectors(0)
+		, sectorsPerCluster(1)
+		, fatSectors(0)
+		, clusterCount(0)
+		, nextFree(0)
+		, pageCount(0)
+		, nextMissPage(0xFFFFFFFF)
+		, lastWrittenSector(0xFFFFFFFF)
+		, lastWritten(NULL)
+		, openNode(0xFFFFFFFF)
+		, openFile(NULL)
+		, openMap(NULL)
+		, openMapSize(0)
+	{}
+
+	~EMUFILE_VFAT()
+	{
+		closeHostFile();
+		for(std::map<u32,u8*>::iterator it = written.begin(); it != written.end(); ++it)
+			delete[] it->second;
+	}
+
+	bool mount(const char* path, int extra_MB, u32 cacheBytes);
+
+	virtual FILE *get_fp() { return NULL; }
+	virtual int fprintf(const char *format, ...) { return 0; }
+
+	virtual int fgetc()
+	{
+		u8 temp;
+		if(_fread(&temp,1) != 1)
+			return -1;
+		return temp;
+	}
+	virtual int fputc(int c)
+	{
+		u8 temp = (u8)c;
+		fwrite(&temp,1);
+		return 0;
+	}
+
+	virtual size_t _fread(const void *ptr, size_t bytes);
+	virtual size_t fwrite(const void *ptr, size_t bytes);
+
+	virtual int fseek(int offset, int origin)
+	{
+		switch(origin)
+		{
+			case SEEK_SET: pos = offset; break;
+			case SEEK_CUR: pos += offset; break;
+			case SEEK_END: pos = size()+offset; break;
+		}
+		return 0;
+	}
+
+	virtual int ftell() { return pos; }
+	virtual int size() { return (int)(totalSectors*kSectorSize); }
+	virtual void fflush() {}
+	virtual void truncate(s32 length) {}
+
+	//the whole image, made up front after all
+	virtual EMUFILE* memwrap()
+	{
+		EMUFILE_MEMORY* mem = new EMUFILE_MEMORY(size());
+		for(u32 i=0;i<totalSectors;i++)
+			readSector(i, mem->buf() + i*kSectorSize);
+		delete this;
+		return mem;
+	}
+
+private:
+	struct Node
+	{
+		std::string name;
+		std::string hostPath;
+		bool dir;
+		u32 size;
+		u32 parent;
+		u32 firstCluster; //0 for an empty file
+		u32 clusters;
+		u32 entrySlots; //what the node takes in its parent's directory: the long name's entries and the short one
+		std::vector<u32> children;
+		std::vector<u8> entries; //a directory's, made when it is first read
+		bool entriesMade;
+	};
+
+	void addDir(u32 node);
+	void makeEntries(u32 node);
+	u32 nodeAt(u32 cluster) const;
+	void readSector(u32 sector, u8* out);
+	void readFat(u32 fatSector, u8* out);
+	void readData(u32 cluster, u32 offset, u8* out);
+	void loadPages(u32 page);
+	const u8* sector(u32 sector);
+	void closeHostFile();
+
+	s32 pos;
+	u32 totalSectors;
+	u32 sectorsPerCluster;
+	u32 fatSectors;
+	u32 clusterCount;
+	u32 nextFree;
+
+	std::vector<Node> nodes; //in the order their clusters are laid out, the root first
+	std::vector<u32> byCluster; //the nodes that have clusters, by firstCluster
+
+	std::map<u32,u8*> written;
+
+	//the page cache, direct mapped: page p can only be in slot p % pageCount, so the pages read ahead never push
+	//each other out
+	u32 pageCount;
+	std::vector<u32> pageTags;
+	std::vector<u8> pageData;
+	u32 nextMissPage; //the page after the last ones loadPages read
+
+	//the r4 writes a sector a word at a time, so the sector last written to is kept at hand
+	u32 lastWrittenSector;
+	u8* lastWritten;
+
+	//the host file of the node read last: mapped if it can be, so that its sectors are copied straight out of the
+	//page cache of the os, read with stdio if not
+	u32 openNode;
+	FILE* openFile;
+	u8* openMap;
+	size_t openMapSize;
+};
+
+//the utf-16 of a host (utf-8) name, for its long name entries
+static void toUCS2(const std::string& name, std::vector<u16>& out)
+{
+	out.clear();
+	for(size_t i=0;i<name.size();)
+	{
+		u8 c = (u8)name[i];
+		u32 cp, extra;
+		if(c < 0x80) { cp = c; extra = 0; }
+		else if((c & 0xE0) == 0xC0) { cp = c & 0x1F; extra = 1; }
+		else if((c & 0xF0) == 0xE0) { cp = c & 0x0F; extra = 2; }
+		else { cp = c & 0x07; extra = 3; }
+		i++;
+		for(; extra && i<name.size(); extra--, i++)
+			cp = (cp << 6) | ((u8)name[i] & 0x3F);
+		if(cp >= 0x10000)
+		{
+			cp -= 0x10000;
+			out.push_back((u16)(0xD800 | (cp >> 10)));
+			out.push_back((u16)(0xDC00 | (cp & 0x3FF)));
+		}
+		else out.push_back((u16)cp);
+	}
+}
+
+static bool validShortChar(char c)
+{
+	if(c >= 'A' && c <= 'Z') return true;
+	if(c >= '0' && c <= '9') return true;
+	return strchr("$%'-_@~`!(){}^#&", c) != NULL && c != 0;
+}
+
+//whether the name is a short name already, as it is: then it needs no long name
+static bool isShortName(const std::string& name, char out[11])
+{
+	memset(out, ' ', 11);
+	const size_t dot = name.find('.');
+	const std::string base = name.substr(0, dot);
+	const std::string ext = dot == std::string::npos ? "" : name.substr(dot+1);
+	if(base.empty() || base.size() > 8 || ext.size() > 3) return false;
+	if(dot != std::string::npos && (ext.empty() || ext.find('.') != std::string::npos)) return false;
+	for(size_t i=0;i<base.size();i++) { if(!validShortChar(base[i])) return false; out[i] = base[i]; }
+	for(size_t i=0;i<ext.size();i++) { if(!validShortChar(ext[i])) return false; out[8+i] = ext[i]; }
+	return true;
+}
+
+static void shortBasis(const std::string& name, std::string& base, std::string& ext)
+{
+	const size_t dot = name.rfind('.');
+	std::string b = (dot == std::string::npos || dot == 0) ? name : name.substr(0, dot);
+	std::string e = (dot == std::string::npos || dot == 0) ? "" : name.substr(dot+1);
+	base.clear(); ext.clear();
+	for(size_t i=0;i<b.size();i++)
+	{
+		char c = (char)toupper((u8)b[i]);
+		if(c == ' ' || c == '.') continue;
+		base += validShortChar(c) ? c : '_';
+	}
+	for(size_t i=0;i<e.size() && ext.size()<3;i++)
+	{
+		char c = (char)toupper((u8)e[i]);
+		if(c == ' ') continue;
+		ext += validShortChar(c) ? c : '_';
+	}
+	if(base.empty()) base = "_";
+}
+
+static u8 shortNameChecksum(const u8* name)
+{
+	u8 sum = 0;
+	for(int i=0;i<11;i++)
+		sum = (u8)(((sum & 1) << 7) + (sum >> 1) + name[i]);
+	return sum;
+}
+
+static void putEntry(u8* e, const char name[11], u8 attr, u32 cluster, u32 size)
+{
+	memset(e, 0, 32);
+	memcpy(e, name, 11);
+	e[11] = attr;
+	e[14] = kEntryTime & 0xFF; e[15] = kEntryTime >> 8;
+	e[16] = kEntryDate & 0xFF; e[17] = kEntryDate >> 8;
+	e[18] = kEntryDate & 0xFF; e[19] = kEntryDate >> 8;
+	e[20] = (cluster >> 16) & 0xFF; e[21] = (cluster >> 24) & 0xFF;
+	e[22] = kEntryTime & 0xFF; e[23] = kEntryTime >> 8;
+	e[24] = kEntryDate & 0xFF; e[25] = kEntryDate >> 8;
+	e[26] = cluster & 0xFF; e[27] = (cluster >> 8) & 0xFF;
+	e[28] = size & 0xFF; e[29] = (size >> 8) & 0xFF; e[30] = (size >> 16) & 0xFF; e[31] = size >> 24;
+}
+
+//adds the children of a directory node, and theirs, only looking at the names and sizes
+void EMUFILE_VFAT::addDir(u32 node)
+{
+	FsEntry entry;
+	const std::string dirPath = nodes[node].hostPath;
+	void* hFind = FsReadFirst(dirPath.c_str(), &entry);
+	if(hFind == NULL) return;
+
+	std::vector<u32> subdirs;
+	do {
+		if(!strcmp(entry.cFileName, ".") || !strcmp(entry.cFileName, "..")) continue;
+
+		Node child;
+		child.name = entry.cFileName;
+		child.hostPath = dirPath + std::string(1,FS_SEPARATOR) + entry.cFileName;
+		child.dir = (entry.flags & FS_IS_DIR) != 0;
+		child.size = child.dir ? 0 : entry.fileSize;
+		child.parent = node;
+		child.firstCluster = 0;
+		child.clusters = 0;
+		child.entriesMade = false;
+		char sfn[11];
+		std::vector<u16> ucs2;
+		toUCS2(child.name, ucs2);
+		child.entrySlots = isShortName(child.name, sfn) ? 1 : 1 + (u32)(ucs2.size()+12)/13;
+
+		const u32 index = (u32)nodes.size();
+		nodes[node].children.push_back(index);
+		nodes.push_back(child);
+		if(child.dir) subdirs.push_back(index);
+	} while (FsReadNext(hFind, &entry) != 0);
+	FsClose(hFind);
+
+	for(size_t i=0;i<subdirs.size();i++)
+		addDir(subdirs[i]);
+}
+
+void EMUFILE_VFAT::makeEntries(u32 index)
+{
+	Node& node = nodes[index];
+	node.entriesMade = true;
+	node.entries.assign(node.clusters * sectorsPerCluster * kSectorSize, 0);
+	u8* e = &node.entries[0];
+
+	if(index != 0)
+	{
+		char dotName[11];
+		memset(dotName, ' ', 11);
+		dotName[0] = '.';
+		putEntry(e, dotName, 0x10, node.firstCluster, 0);
+		dotName[1] = '.';
+		const u32 parentCluster = node.parent == 0 ? 0 : nodes[node.parent].firstCluster;
+		putEntry(e + 32, dotName, 0x10, parentCluster, 0);
+		e += 64;
+	}
+
+	//the names that are short names already first, so that the ones made up go around them
+	std::set<std::string> used;
+	for(size_t i=0;i<node.children.size();i++)
+	{
+		char sfn[11];
+		if(isShortName(nodes[node.children[i]].name, sfn))
+			used.insert(std::string(sfn, 11));
+	}
+
+	for(size_t i=0;i<node.children.size();i++)
+	{
+		const Node& child = nodes[node.children[i]];
+		char sfn[11];
+		if(!isShortName(child.name, sfn))
+		{
+			std::string base, ext;
+			shortBasis(child.name, base, ext);
+			for(u32 n=1;;n++)
+			{
+				char tail[12];
+				sprintf(tail, "~%u", n);
+				const std::string shortBase = base.substr(0, 8 - strlen(tail)) + tail;
+				memset(sfn, ' ', 11);
+				memcpy(sfn, shortBase.data(), shortBase.size());
+				memcpy(sfn + 8, ext.data(), ext.size());
+				if(used.insert(std::string(sfn, 11)).second) break;
+			}
+
+			std::vector<u16> ucs2;
+			toUCS2(child.name, ucs2);
+			const u32 lfnCount = child.entrySlots - 1;
+			const u8 sum = shortNameChecksum((const u8*)sfn);
+			static const u8 kCharOffsets[13] = { 1,3,5,7,9, 14,16,18,20,22,24, 28,30 };
+			for(u32 k=lfnCount;k>=1;k--)
+			{
+				memset(e, 0, 32);
+				e[0] = (u8)(k | (k == lfnCount ? 0x40 : 0));
+				e[11] = 0x0F;
+				e[13] = sum;
+				for(u32 c=0;c<13;c++)
+				{
+					const size_t at = (k-1)*13 + c;
+					const u16 ch = at < ucs2.size() ? ucs2[at] : at == ucs2.size() ? 0 : 0xFFFF;
+					e[kCharOffsets[c]] = ch & 0xFF;
+					e[kCharOffsets[c]+1] = ch >> 8;
+				}
+				e += 32;
+			}
+		}
+		putEntry(e, sfn, child.dir ? 0x10 : 0x20, child.firstCluster, child.size);
+		e += 32;
+	}
+}
+
+bool EMUFILE_VFAT::mount(const char* path, int extra_MB, u32 cacheBytes)
+{
+	pageCount = std::max<u32>(cacheBytes / kPageBytes, kReadAheadPages);
+	pageTags.assign(pageCount, 0xFFFFFFFF);
+	pageData.resize((size_t)pageCount*kPageBytes);
+
+	Node root;
+	root.hostPath = path;
+	root.dir = true;
+	root.size = 0;
+	root.parent = 0;
+	root.firstCluster = 0;
+	root.clusters = 0;
+	root.entrySlots = 0;
+	root.entriesMade = false;
+	nodes.push_back(root);
+	addDir(0);
+
+	//the cluster size goes by the size of the image, as mkdosfs (and so build()) picks it
+	u64 bytes = 0;
+	for(size_t i=0;i<nodes.size();i++)
+		bytes += nodes[i].dir ? kSectorSize : nodes[i].size + 2*kSectorSize;
+	bytes += (u64)extra_MB*1024*1024;
+	bytes = std::max<u64>(bytes, 36*1024*1024);
+	const u64 sz_mb = (bytes + (1<<20) - 1) >> 20;
+	sectorsPerCluster = sz_mb > 16*1024 ? 32 : sz_mb > 8*1024 ? 16 : sz_mb > 260 ? 8 : 1;
+	const u32 clusterBytes = sectorsPerCluster*kSectorSize;
+
+	//the clusters, one stretch for each node in order
+	u32 cluster = kRootCluster;
+	for(size_t i=0;i<nodes.size();i++)
+	{
+		Node& node = nodes[i];
+		u64 size = node.size;
+		if(node.dir)
+		{
+			size = (u64)(i == 0 ? 0 : 2)*32;
+			for(size_t c=0;c<node.children.size();c++)
+				size += (u64)nodes[node.children[c]].entrySlots*32;
+		}
+		node.clusters = (u32)((size + clusterBytes - 1) / clusterBytes);
+		if(node.dir && !node.clusters) node.clusters = 1;
+		if(!node.clusters) continue;
+		node.firstCluster = cluster;
+		cluster += node.clusters;
+		byCluster.push_back((u32)i);
+	}
+	nextFree = cluster;
+
+	u64 dataSectors = (u64)(cluster - kRootCluster)*sectorsPerCluster + (u64)extra_MB*1024*1024/kSectorSize;
+	dataSectors = std::max<u64>(dataSectors, 36*1024*1024/kSectorSize - kReservedSectors);
+	clusterCount = (u32)(dataSectors / sectorsPerCluster);
+	fatSectors = (u32)(((u64)clusterCount + 2)*4 + kSectorSize - 1) / kSectorSize;
+	const u64 total = kReservedSectors + (u64)kFatCount*fatSectors + (u64)clusterCount*sectorsPerCluster;
+	if(total >= (0x80000000>>9))
+	{
+		CORELOG_ERROR("error mounting fat (%d KBytes)\n",(int)(total/2));
+		CORELOG_ERROR("total fat sizes > 2GB are never going to work\n");
+		return false;
+	}
+	totalSectors = (u32)total;
+
+	CORELOG_INFO("fat mounted from %s: %d entries, %d KBytes, %d KBytes cached\n", path, (int)nodes.size(), (int)(totalSectors/2), (int)(pageCount*kPageBytes/1024));
+	return true;
+}
+
+u32 EMUFILE_VFAT::nodeAt(u32 cluster) const
+{
+	//the last node starting at or before the cluster
+	size_t lo = 0, hi = byCluster.size();
+	while(lo < hi)
+	{
+		const size_t mid = (lo+hi)/2;
+		if(nodes[byCluster[mid]].firstCluster <= cluster) lo = mid+1;
+		else hi = mid;
+	}
+	if(lo == 0) return 0xFFFFFFFF;
+	const u32 index = byCluster[lo-1];
+	const Node& node = nodes[index];
+	return cluster < node.firstCluster + node.clusters ? index : 0xFFFFFFFF;
+}
+
+void EMUFILE_VFAT::readFat(u32 fatSector, u8* out)
+{
+	const u32 perSector = kSectorSize/4;
+	u32 first = fatSector*perSector;
+	u32 index = 0xFFFFFFFF;
+	for(u32 i=0;i<perSector;i++)
+	{
+		const u32 c = first+i;
+		u32 value = 0;
+		if(c == 0) value = 0x0FFFFFF8;
+		else if(c == 1) value = kFatEOF;
+		else if(c < clusterCount+2)
+		{
+			if(index == 0xFFFFFFFF || c >= nodes[index].firstCluster + nodes[index].clusters)
+				index = nodeAt(c);
+			if(index != 0xFFFFFFFF)
+				value = c+1 == nodes[index].firstCluster + nodes[index].clusters ? kFatEOF : c+1;
+		}
+		out[i*4+0] = value & 0xFF;
+		out[i*4+1] = (value >> 8) & 0xFF;
+		out[i*4+2] = (value >> 16) & 0xFF;
+		out[i*4+3] = value >> 24;
+	}
+}
+
+void EMUFILE_VFAT::readData(u32 cluster, u32 offset, u8* out)
+{
+	memset(out, 0, kSectorSize);
+	const u32 index = nodeAt(cluster);
+	if(index == 0xFFFFFFFF) return;
+	Node& node = nodes[index];
+	const u32 at = (cluster - node.firstCluster)*sectorsPerCluster*kSectorSize + offset;
+
+	if(node.dir)
+	{
+		if(!node.entriesMade) makeEntries(index);
+		memcpy(out, &node.entries[at], kSectorSize);
+		return;
+	}
+
+	if(at >= node.size) return;
+	if(openNode != index)
+	{
+		closeHostFile();
+		openNode = index;
+		const int fd = open(node.hostPath.c_str(), O_RDONLY);
+		if(fd >= 0)
+		{
+			void* map = mmap(NULL, node.size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if(map != MAP_FAILED)
+			{
+				//the ds reads files front to back mostly, so the kernel can read ahead well past what is asked for
+				madvise(map, node.size, MADV_SEQUENTIAL);
+				openMap = (u8*)map;
+				openMapSize = node.size;
+			}
+		}
+		if(!openMap)
+		{
+			openFile = fopen(node.hostPath.c_str(), "rb");
+			if(!openFile) CORELOG_ERROR("ERROR opening file for fat: %s\n", node.hostPath.c_str());
+		}
+	}
+	const u32 n = std::min(kSectorSize, node.size - at);
+	if(openMap)
+	{
+		//the host file may have been cut short since it was mounted. reading past its end would fault
+		if(at + n <= openMapSize)
+			memcpy(out, openMap + at, n);
+		return;
+	}
+	if(!openFile) return;
+	::fseek(openFile, at, SEEK_SET);
+	::fread(out, 1, n, openFile);
+}
+
+void EMUFILE_VFAT::closeHostFile()
+{
+	if(openFile) fclose(openFile);
+	if(openMap) munmap(openMap, openMapSize);
+	openFile = NULL;
+	openMap = NULL;
+	openMapSize = 0;
+	openNode = 0xFFFFFFFF;
+}
+
+void EMUFILE_VFAT::readSector(u32 sector, u8* out)
+{
+	std::map<u32,u8*>::const_iterator it = written.find(sector);
+	if(it != written.end())
+	{
+		memcpy(out, it->second, kSectorSize);
+		return;
+	}
+
+	memset(out, 0, kSectorSize);
+	const u32 dataStart = kReservedSectors + kFatCount*fatSectors;
+	if(sector == 0 || sector == 6)
+	{
+		//the boot sector and its backup
+		out[0] = 0xEB; out[1] = 0x58; out[2] = 0x90;
+		memcpy(out+3, "mkdosfs ", 8);
+		out[11] = kSectorSize & 0xFF; out[12] = kSectorSize >> 8;
+		out[13] = (u8)sectorsPerCluster;
+		out[14] = kReservedSectors;
+		out[16] = kFatCount;
+		out[21] = 0xF8;
+		out[24] = 32; out[26] = 64;
+		memcpy(out+32, &totalSectors, 4);
+		memcpy(out+36, &fatSectors, 4);
+		out[44] = kRootCluster;
+		out[48] = 1;
+		out[50] = 6;
+		out[66] = 0x29;
+		memcpy(out+71, "           ", 11);
+		memcpy(out+82, "FAT32   ", 8);
+		out[510] = 0x55; out[511] = 0xAA;
+	}
+	else if(sector == 1 || sector == 7)
+	{
+		//the fs info sector: the free count left for the driver to work out
+		const u32 lead = 0x41615252, mid = 0x61417272, freeCount = 0xFFFFFFFF, trail = 0xAA550000;
+		memcpy(out, &lead, 4);
+		memcpy(out+484, &mid, 4);
+		memcpy(out+488, &freeCount, 4);
+		memcpy(out+492, &nextFree, 4);
+		memcpy(out+508, &trail, 4);
+	}
+	else if(sector >= kReservedSectors && sector < dataStart)
+		readFat((sector - kReservedSectors) % fatSectors, out);
+	else if(sector >= dataStart)
+	{
+		const u32 rel = sector - dataStart;
+		readData(kRootCluster + rel/sectorsPerCluster, (rel%sectorsPerCluster)*kSectorSize, out);
+	}
+}
+
+//reads the page into the cache, and when it comes right after the last pages read, the ones after it as well
+void EMUFILE_VFAT::loadPages(u32 page)
+{
+	const u32 lastPage = (totalSectors - 1) / kPageSectors;
+	const u32 count = page == nextMissPage ? std::min(kReadAheadPages, lastPage - page + 1) : 1;
+	for(u32 p = page; p < page + count; p++)
+	{
+		const u32 slot = p % pageCount;
+		if(p != page && pageTags[slot] == p) continue;
+		u8* data = &pageData[(size_t)slot*kPageBytes];
+		for(u32 i=0;i<kPageSectors;i++)
+		{
+			const u32 s = p*kPageSectors + i;
+			if(s < totalSectors) readSector(s, data + i*kSectorSize);
+			else memset(data + i*kSectorSize, 0, kSectorSize);
+		}
+		pageTags[slot] = p;
+	}
+	nextMissPage = page + count;
+}
+
+//the ds reads in words, so the sectors are kept in the page cache
+const u8* EMUFILE_VFAT::sector(u32 index)
+{
+	const u32 page = index / kPageSectors;
+	const u32 slot = page % pageCount;
+	if(pageTags[slot] != page)
+		loadPages(page);
+	return &pageData[(size_t)slot*kPageBytes + (index % kPageSectors)*kSectorSize];
+}
+
+size_t EMUFILE_VFAT::_fread(const void *ptr, size_t bytes)
+{
+	u8* dst = (u8*)ptr;
+	size_t done = 0;
+	while(done < bytes)
+	{
+		if(pos < 0 || pos >= size())
+		{
+			failbit = true;
+			break;
+		}
+		const u32 offset = (u32)pos % kSectorSize;
+		const size_t n = std::min<size_t>(bytes - done, kSectorSize - offset);
+		memcpy(dst + done, sector((u32)pos / kSectorSize) + offset, n);
+		done += n;
+		pos += (s32)n;
+	}
+	return done;
+}
+
+size_t EMUFILE_VFAT::fwrite(const void *ptr, size_t bytes)
+{
+	const u8* src = (const u8*)ptr;
+	size_t done = 0;
+	while(done < bytes)
+	{
+		if(pos < 0 || pos >= size())
+		{
+			failbit = true;
+			break;
+		}
+		const u32 index = (u32)pos / kSectorSize;
+		const u32 offset = (u32)pos % kSectorSize;
+		const size_t n = std::min<size_t>(bytes - done, kSectorSize - offset);
+		if(index != lastWrittenSector)
+		{
+			std::map<u32,u8*>::iterator it = written.find(index);
+			if(it == written.end())
+			{
+				u8* copy = new u8[kSectorSize];
+				readSector(index, copy);
+				it = written.insert(std::make_pair(index, copy)).first;
+			}
+			lastWrittenSector = index;
+			lastWritten = it->second;
+		}
+		memcpy(lastWritten + offset, src + done, n);
+		const u32 page = index / kPageSectors;
+		const u32 slot = page % pageCount;
+		if(pageTags[slot] == page)
+			memcpy(&pageData[(size_t)slot*kPageBytes + (index % kPageSectors)*kSectorSize + offset], src + done, n);
+		done += n;
+		pos += (s32)n;
+	}
+	return done;
+}
+
+bool VFAT::mount(const char* path, int extra_MB, u32 cacheBytes)
+{
+	delete file;
+	file = NULL;
+	EMUFILE_VFAT* vfat = new EMUFILE_VFAT();
+	if(!vfat->mount(path, extra_MB, cacheBytes))
+	{
+		delete vfat;
+		return false;
+	}
+	file = vfat;
+	return true;
+}
+
 VFAT::VFAT()
 	: file(NULL)
 {
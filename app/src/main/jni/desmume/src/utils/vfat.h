@@ -16,6 +16,9 @@
 */
 
 #ifndef _VFAT_H
+#define _VFAT_H
+
+#include "../types.h"
 
 class EMUFILE;
 
@@ -27,6 +30,12 @@ public:
 	~VFAT();
 	bool build(const char* path, int extra_MB=0);
 
+	//the same image without making it: only the names and sizes under the path are looked at here. the device that is
+	//detached makes the fat and the directories as they are read, and reads the files from the host when they are
+	//(so they had better stay there while it is in use). it keeps about cacheBytes of the sectors read, and reads
+	//ahead when a file is streamed
+	bool mount(const char* path, int extra_MB=0, u32 cacheBytes=1024*1024);
+
 	EMUFILE* detach();
 
 private:
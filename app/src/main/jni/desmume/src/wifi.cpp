@@ -40,12 +40,15 @@
 #include "wifi.h"
 
 #include <assert.h>
+#include <algorithm>
 
 #include "armcpu.h"
 #include "NDSSystem.h"
 #include "debug.h"
 #include "bits.h"
 #include "registers.h"
+#include "utils/task.h"
+#include "utils/fastcrc.h"
 
 #ifndef INVALID_SOCKET 	 
 	#define INVALID_SOCKET  (socket_t)-1 	 
@@ -296,6 +299,95 @@ WifiComInterface* wifiComs[] = {
 };
 WifiComInterface* wifiCom;
 
+#ifdef EXPERIMENTAL_WIFI_COMM
+/*******************************************************************************
+
+	Receive thread
+
+	The connection is read on a thread of its own, which waits on the socket
+	(or the pcap device) and puts what arrives in this ring. The emulation takes
+	the packets out on its millisecond trigger, so the emulation never waits
+	on the network and neither side ever waits on the other.
+
+ *******************************************************************************/
+
+#define WIFI_RXRING_SIZE 64 // a power of two
+#define WIFI_RXRING_PACKET 2048
+
+struct WifiRawPacket
+{
+	u32 len;
+	u8 data[WIFI_RXRING_PACKET];
+};
+
+static WifiRawPacket wifiRXRing[WIFI_RXRING_SIZE];
+// the head is only written by the thread, the tail only by the emulation
+static u32 wifiRXRingHead = 0;
+static u32 wifiRXRingTail = 0;
+// where the thread receives to when the ring is full: the packet is lost, as it would be on a busy radio
+static WifiRawPacket wifiRXDropped;
+static bool wifiRXStop = false;
+static bool wifiRXRunning = false;
+static Task wifiRXTask;
+
+// waits a little (a few ms at most) for a packet and puts it in the ring
+typedef void (*WifiReceiveFunc)();
+
+static WifiRawPacket* WIFI_RXRingBack()
+{
+	const u32 head = wifiRXRingHead;
+	if (head - __atomic_load_n(&wifiRXRingTail, __ATOMIC_ACQUIRE) >= WIFI_RXRING_SIZE)
+		return &wifiRXDropped;
+	return &wifiRXRing[head & (WIFI_RXRING_SIZE-1)];
+}
+
+static void WIFI_RXRingPush(WifiRawPacket* pkt)
+{
+	if (pkt != &wifiRXDropped)
+		__atomic_store_n(&wifiRXRingHead, wifiRXRingHead + 1, __ATOMIC_RELEASE);
+}
+
+static WifiRawPacket* WIFI_RXRingFront()
+{
+	const u32 tail = wifiRXRingTail;
+	if (tail == __atomic_load_n(&wifiRXRingHead, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &wifiRXRing[tail & (WIFI_RXRING_SIZE-1)];
+}
+
+static void WIFI_RXRingPop()
+{
+	__atomic_store_n(&wifiRXRingTail, wifiRXRingTail + 1, __ATOMIC_RELEASE);
+}
+
+static void* WIFI_RXThreadProc(void* param)
+{
+	WifiReceiveFunc receive = (WifiReceiveFunc)param;
+	while (!__atomic_load_n(&wifiRXStop, __ATOMIC_ACQUIRE))
+		receive();
+	return NULL;
+}
+
+static void WIFI_StartRXThread(WifiReceiveFunc receive)
+{
+	wifiRXRingHead = wifiRXRingTail = 0;
+	wifiRXStop = false;
+	wifiRXTask.start(false, "wifi rx", THREAD_ROLE_BACKGROUND);
+	wifiRXTask.execute(WIFI_RXThreadProc, (void*)receive);
+	wifiRXRunning = true;
+}
+
+static void WIFI_StopRXThread()
+{
+	if (!wifiRXRunning)
+		return;
+	__atomic_store_n(&wifiRXStop, true, __ATOMIC_RELEASE);
+	wifiRXTask.finish();
+	wifiRXTask.shutdown();
+	wifiRXRunning = false;
+}
+#endif
+
 /*******************************************************************************
 
 	Logging
@@ -316,7 +408,7 @@ WifiComInterface* wifiCom;
 	#if WIFI_LOG_USE_LOGC
 		#define WIFI_LOG(level, ...) if(level <= WIFI_LOGGING_LEVEL) LOGC(8, "WIFI: "__VA_ARGS__);
 	#else
-		#define WIFI_LOG(level, ...) if(level <= WIFI_LOGGING_LEVEL) printf("WIFI: "__VA_ARGS__);
+		#define WIFI_LOG(level, ...) if(level <= WIFI_LOGGING_LEVEL) CORELOG_INFO("WIFI: " __VA_ARGS__);
 	#endif
 #else
 #define WIFI_LOG(level, ...) {}
@@ -366,47 +458,10 @@ INLINE bool WIFI_isBroadcastMAC(u8* a)
 
  *******************************************************************************/
 
-u32 WIFI_CRC32Table[256];
-
-static u32 reflect(u32 ref, char ch)
-{
-    u32 value = 0;
-
-    for(int i = 1; i < (ch + 1); i++)
-    {
-        if (ref & 1)
-            value |= 1 << (ch - i);
-        ref >>= 1;
-    } 
-	
-	return value;
-}
-
+//the reflected 0x04C11DB7 crc of the 802.11 frame check sequence, with what the cpu has for it
 static u32 WIFI_calcCRC32(u8 *data, int len)
 {
-	u32 crc = 0xFFFFFFFF;
-
-	while(len--)
-        crc = (crc >> 8) ^ WIFI_CRC32Table[(crc & 0xFF) ^ *data++];
-
-	return (crc ^ 0xFFFFFFFF);
-}
-
-static void WIFI_initCRC32Table()
-{
-	static bool initialized = false;
-	if(initialized) return;
-	initialized = true;
-
-	u32 polynomial = 0x04C11DB7;
-
-	for(int i = 0; i < 0x100; i++)
-    {
-        WIFI_CRC32Table[i] = reflect(i, 8) << 24;
-        for(int j = 0; j < 8; j++)
-            WIFI_CRC32Table[i] = (WIFI_CRC32Table[i] << 1) ^ (WIFI_CRC32Table[i] & (1 << 31) ? polynomial : 0);
-        WIFI_CRC32Table[i] = reflect(WIFI_CRC32Table[i],  32);
-    }
+	return fastcrc32(0, data, len);
 }
 
 /*******************************************************************************
@@ -655,7 +710,6 @@ static void WIFI_triggerIRQ(u8 irq)
 
 bool WIFI_Init()
 {
-	WIFI_initCRC32Table();
 	wifi_lastmode = -999;
 	WIFI_Reset();
 	return true;
@@ -974,7 +1028,7 @@ void WIFI_write16(u32 address, u16 val)
 	WIFI_LOG(5, "Write at address %08X, %04X\n", address, val);
 	/*if (address == 0x04804008 && val == 0x0200)
 	{
-		printf("WIFI: Write at address %08X, %04X, pc=%08X\n", address, val, NDS_ARM7.instruct_adr);
+		CORELOG_INFO("WIFI: Write at address %08X, %04X, pc=%08X\n", address, val, NDS_ARM7.instruct_adr);
 		emu_halt();
 	}*/
 
@@ -984,13 +1038,16 @@ void WIFI_write16(u32 address, u16 val)
 		/* access to the circular buffer */
 		address &= 0x1FFF;
 		/*if (address >= 0x958 && address < (0x95A)) //address < (0x958+0x2A)) 
-			printf("PACKET[%04X] = %04X %08X %08X\n", 
+			CORELOG_INFO("PACKET[%04X] = %04X %08X %08X\n", 
 			NDS_ARM7.R[12], val, NDS_ARM7.R[14], NDS_ARM7.R[5]);*/
         wifiMac.RAM[address >> 1] = val;
 		return;
 	}
 
 	// anything else: I/O ports
+	// the counters are only brought up to date when they are looked at
+	NDS_SyncWifi();
+
 	// only the first mirror (0x0000 - 0x0FFF) causes a special action
 	if (page == 0x0000) action = TRUE;
 
@@ -1324,7 +1381,7 @@ void WIFI_write16(u32 address, u16 val)
 			break;
 
 		case 0x94:
-			printf("!!!!! TXBUF_REPLY = %04X !!!!!\n", val);
+			CORELOG_INFO("!!!!! TXBUF_REPLY = %04X !!!!!\n", val);
 			break;
 
 		case REG_WIFI_RXSTAT_INC_IE: wifiMac.RXStatIncIE = val; break;
@@ -1344,7 +1401,7 @@ void WIFI_write16(u32 address, u16 val)
 			break;
 
 		case 0x194:
-			printf("TX_HDR_CNT = %04X\n", val);
+			CORELOG_INFO("TX_HDR_CNT = %04X\n", val);
 			break;
 
 		default:
@@ -1352,6 +1409,9 @@ void WIFI_write16(u32 address, u16 val)
 	}
 
 	WIFI_IOREG(address) = val;
+
+	// whatever was written may have moved the next event (a counter, a transfer started...)
+	NDS_RescheduleWifi();
 }
 
 u16 WIFI_read16(u32 address)
@@ -1374,6 +1434,8 @@ u16 WIFI_read16(u32 address)
 	}
 
 	// anything else: I/O ports
+	NDS_SyncWifi();
+
 	// only the first mirror causes a special action
 	if (page == 0x0000) action = TRUE;
 
@@ -1569,6 +1631,68 @@ u16 WIFI_read16(u32 address)
 }
 
 
+// Only some microseconds have something happen in them: a counter running out, a beacon
+// millisecond, the next halfword of a transfer, the millisecond the connection is polled on.
+// This is how many microseconds away the next of those is (at least 1), so the ones in between
+// can be counted all at once with WIFI_usAdvance instead of running WIFI_usTrigger for each.
+u32 WIFI_usUntilNextEvent()
+{
+	const u64 timer = wifiMac.GlobalUsecTimer;
+	u64 next = 1024 - (timer & 1023);
+
+	if (wifiMac.crystalEnabled)
+	{
+		if (wifiMac.eCountEnable && (wifiMac.eCount > 0))
+			next = std::min<u64>(next, wifiMac.eCount);
+
+		if (wifiMac.usecEnable)
+			next = std::min<u64>(next, 1024 - (wifiMac.usec & 1023));
+		else if (!(wifiMac.usec & 1023))
+			next = 1;
+	}
+
+	if (wifiMac.ucmpEnable)
+	{
+		const bool counting = wifiMac.crystalEnabled && wifiMac.usecEnable;
+		if (counting && (wifiMac.ucmp > wifiMac.usec))
+			next = std::min<u64>(next, wifiMac.ucmp - wifiMac.usec);
+		else if (!counting && (wifiMac.ucmp == wifiMac.usec))
+			next = 1;
+	}
+
+	if (wifiMac.TXCurSlot >= 0)
+	{
+		// the preamble, then the first microsecond on the slot's rate
+		const Wifi_TXSlot& slot = wifiMac.TXSlots[wifiMac.TXCurSlot];
+		const u64 start = std::max(slot.RemPreamble, 0) + 1;
+		next = std::min<u64>(next, start + ((0 - (timer + start)) & slot.TimeMask));
+	}
+	else if (!wifiMac.RXPacketQueue.empty())
+		next = std::min<u64>(next, 8 - (timer & 7));
+
+	return (u32)next;
+}
+
+// Counts usecs microseconds that WIFI_usUntilNextEvent said nothing happens in
+void WIFI_usAdvance(u32 usecs)
+{
+	wifiMac.GlobalUsecTimer += usecs;
+
+	if (wifiMac.crystalEnabled)
+	{
+		if (wifiMac.usecEnable)
+			wifiMac.usec += usecs;
+		if (wifiMac.eCountEnable && (wifiMac.eCount > 0))
+			wifiMac.eCount -= usecs;
+	}
+
+	if (wifiMac.TXCurSlot >= 0)
+	{
+		Wifi_TXSlot& slot = wifiMac.TXSlots[wifiMac.TXCurSlot];
+		slot.RemPreamble = std::max(slot.RemPreamble - (int)usecs, 0);
+	}
+}
+
 void WIFI_usTrigger()
 {
 	wifiMac.GlobalUsecTimer++;
@@ -1775,6 +1899,8 @@ typedef struct _Adhoc_FrameHeader
 } Adhoc_FrameHeader;
 
 
+static void Adhoc_Receive();
+
 bool Adhoc_Init()
 {
 	BOOL opt_true = TRUE;
@@ -1829,6 +1955,8 @@ bool Adhoc_Init()
 
 	Adhoc_Reset();
 
+	WIFI_StartRXThread(Adhoc_Receive);
+
 	WIFI_LOG(1, "Ad-hoc: initialization successful.\n");
 
 	return true;
@@ -1836,6 +1964,7 @@ bool Adhoc_Init()
 
 void Adhoc_DeInit()
 {
+	WIFI_StopRXThread();
 	if (wifi_socket >= 0)
 		closesocket(wifi_socket);
 }
@@ -1845,7 +1974,7 @@ void Adhoc_Reset()
 	CurrentWifiHandler->WIFI_GetUniqueMAC(FW_Mac);
 	NDS_PatchFirmwareMAC();
 
-	printf("WIFI: ADHOC: MAC = %02X:%02X:%02X:%02X:%02X:%02X\n",
+	CORELOG_INFO("WIFI: ADHOC: MAC = %02X:%02X:%02X:%02X:%02X:%02X\n",
 		FW_Mac[0], FW_Mac[1], FW_Mac[2], FW_Mac[3], FW_Mac[4], FW_Mac[5]);
 }
 
@@ -1877,73 +2006,91 @@ void Adhoc_SendPacket(u8* packet, u32 len)
 	delete[] frame;
 }
 
-void Adhoc_msTrigger()
+// On the receive thread
+static void Adhoc_Receive()
 {
-	if (wifi_socket < 0)
-		return;
-
-	// Check every millisecond if we received a packet
+	// Wait a bit for a packet, so that the thread can see when it is asked to stop
 	fd_set fd;
 	struct timeval tv;
 
 	FD_ZERO(&fd);
 	FD_SET(wifi_socket, &fd);
 	tv.tv_sec = 0; 
-	tv.tv_usec = 0;
+	tv.tv_usec = 10000;
 
-	if (select(1, &fd, 0, 0, &tv))
-	{
-		sockaddr_t fromAddr;
-		socklen_t fromLen = sizeof(sockaddr_t);
-		u8 buf[1536];
-		u8* ptr;
-		u16 packetLen;
+	if (select(wifi_socket + 1, &fd, 0, 0, &tv) <= 0)
+		return;
 
-		int nbytes = recvfrom(wifi_socket, (char*)buf, 1536, 0, &fromAddr, &fromLen);
+	WifiRawPacket* pkt = WIFI_RXRingBack();
+	sockaddr_t fromAddr;
+	socklen_t fromLen = sizeof(sockaddr_t);
 
-		// No packet arrived (or there was an error)
-		if (nbytes <= 0)
-			return;
+	int nbytes = recvfrom(wifi_socket, (char*)pkt->data, WIFI_RXRING_PACKET, 0, &fromAddr, &fromLen);
 
-		ptr = buf;
-		Adhoc_FrameHeader header = *(Adhoc_FrameHeader*)ptr;
-		
-		// Check the magic string in header
-		if (strncmp(header.magic, ADHOC_MAGIC, 8))
-			return;
+	// No packet arrived (or there was an error)
+	if (nbytes <= 0)
+		return;
 
-		// Check the ad-hoc protocol version
-		if (header.version != ADHOC_PROTOCOL_VERSION)
-			return;
+	pkt->len = nbytes;
+	WIFI_RXRingPush(pkt);
+}
+
+static void Adhoc_RXHandler(u8* buf, u32 nbytes)
+{
+	u8* ptr;
+	u16 packetLen;
 
-		packetLen = header.packetLen - 4;
-		ptr += sizeof(Adhoc_FrameHeader);
+	if (nbytes < sizeof(Adhoc_FrameHeader))
+		return;
 
-		// If the packet is for us, send it to the wifi core
-		if (!WIFI_compareMAC(&ptr[10], &wifiMac.mac.bytes[0]))
+	ptr = buf;
+	Adhoc_FrameHeader header = *(Adhoc_FrameHeader*)ptr;
+	
+	// Check the magic string in header
+	if (strncmp(header.magic, ADHOC_MAGIC, 8))
+		return;
+
+	// Check the ad-hoc protocol version
+	if (header.version != ADHOC_PROTOCOL_VERSION)
+		return;
+
+	packetLen = header.packetLen - 4;
+	ptr += sizeof(Adhoc_FrameHeader);
+
+	// If the packet is for us, send it to the wifi core
+	if (!WIFI_compareMAC(&ptr[10], &wifiMac.mac.bytes[0]))
+	{
+		if (WIFI_isBroadcastMAC(&ptr[16]) ||
+			WIFI_compareMAC(&ptr[16], &wifiMac.bss.bytes[0]) ||
+			WIFI_isBroadcastMAC(&wifiMac.bss.bytes[0]))
 		{
-			if (WIFI_isBroadcastMAC(&ptr[16]) ||
-				WIFI_compareMAC(&ptr[16], &wifiMac.bss.bytes[0]) ||
-				WIFI_isBroadcastMAC(&wifiMac.bss.bytes[0]))
-			{
-			/*	WIFI_LOG(3, "Ad-hoc: received a packet of %i bytes from %i.%i.%i.%i (port %i).\n",
-					nbytes,
-					(u8)fromAddr.sa_data[2], (u8)fromAddr.sa_data[3], 
-					(u8)fromAddr.sa_data[4], (u8)fromAddr.sa_data[5],
-					ntohs(*(u16*)&fromAddr.sa_data[0]));*/
-				WIFI_LOG(3, "Ad-hoc: received a packet of %i bytes, frame control: %04X\n", packetLen, *(u16*)&ptr[0]);
-				WIFI_LOG(4, "Storing packet at %08X.\n", 0x04804000 + (wifiMac.RXWriteCursor<<1));
-
-				u8* packet = new u8[12 + packetLen];
-
-				WIFI_MakeRXHeader(packet, WIFI_GetRXFlags(ptr), 20, packetLen, 0, 0);
-				memcpy(&packet[12], ptr, packetLen);
-				WIFI_RXQueuePacket(packet, 12+packetLen);
-			}
+		/*	WIFI_LOG(3, "Ad-hoc: received a packet of %i bytes from %i.%i.%i.%i (port %i).\n",
+				nbytes,
+				(u8)fromAddr.sa_data[2], (u8)fromAddr.sa_data[3], 
+				(u8)fromAddr.sa_data[4], (u8)fromAddr.sa_data[5],
+				ntohs(*(u16*)&fromAddr.sa_data[0]));*/
+			WIFI_LOG(3, "Ad-hoc: received a packet of %i bytes, frame control: %04X\n", packetLen, *(u16*)&ptr[0]);
+			WIFI_LOG(4, "Storing packet at %08X.\n", 0x04804000 + (wifiMac.RXWriteCursor<<1));
+
+			u8* packet = new u8[12 + packetLen];
+
+			WIFI_MakeRXHeader(packet, WIFI_GetRXFlags(ptr), 20, packetLen, 0, 0);
+			memcpy(&packet[12], ptr, packetLen);
+			WIFI_RXQueuePacket(packet, 12+packetLen);
 		}
 	}
 }
 
+void Adhoc_msTrigger()
+{
+	// Whatever the receive thread got since the last millisecond
+	while (WifiRawPacket* pkt = WIFI_RXRingFront())
+	{
+		Adhoc_RXHandler(pkt->data, pkt->len);
+		WIFI_RXRingPop();
+	}
+}
+
 /*******************************************************************************
 
 	SoftAP (fake wifi access point)
@@ -2065,6 +2212,8 @@ static pcap_if_t * WIFI_index_device(pcap_if_t *alldevs, int index)
 	return curr;
 }
 
+static void SoftAP_Receive();
+
 bool SoftAP_Init()
 {
 	if (!CurrentWifiHandler->WIFI_PCapAvailable())
@@ -2095,21 +2244,18 @@ bool SoftAP_Init()
 
 	CurrentWifiHandler->PCAP_freealldevs(alldevs);
 
-	// Set non-blocking mode
-	if (CurrentWifiHandler->PCAP_setnonblock(wifi_bridge, 1, errbuf) == -1)
-	{
-		WIFI_LOG(1, "SoftAP: PCap: failed to set non-blocking mode: %s\n", errbuf);
-		CurrentWifiHandler->PCAP_close(wifi_bridge); wifi_bridge = NULL;
-		return false;
-	}
+	// The device is left blocking: the receive thread waits in it, for the 1 ms read timeout it was opened with
 
 	SoftAP_Reset();
 
+	WIFI_StartRXThread(SoftAP_Receive);
+
 	return true;
 }
 
 void SoftAP_DeInit()
 {
+	WIFI_StopRXThread();
 	if(wifi_bridge != NULL)
 		CurrentWifiHandler->PCAP_close(wifi_bridge);
 }
@@ -2327,13 +2473,34 @@ INLINE void SoftAP_SendBeacon()
 	WIFI_RXQueuePacket(packet, 12 + packetLen);
 }
 
-static void SoftAP_RXHandler(u_char* user, const struct pcap_pkthdr* h, const u_char* _data)
+// On the receive thread
+static void SoftAP_RXCopy(u_char* user, const struct pcap_pkthdr* h, const u_char* data)
 {
 	// safety checks
-	if ((_data == NULL) || (h == NULL))
+	if ((data == NULL) || (h == NULL) || (h->caplen < 14) || (h->caplen > WIFI_RXRING_PACKET))
 		return;
 
-	u8* data = (u8*)_data;
+	WifiRawPacket* pkt = WIFI_RXRingBack();
+	memcpy(pkt->data, data, h->caplen);
+	pkt->len = h->caplen;
+	WIFI_RXRingPush(pkt);
+}
+
+static void SoftAP_Receive()
+{
+	if (CurrentWifiHandler->PCAP_dispatch(wifi_bridge, 64, SoftAP_RXCopy, NULL) < 0)
+	{
+		// the device is gone; don't spin on it until we're told to stop
+#ifdef HOST_WINDOWS
+		Sleep(10);
+#else
+		usleep(10000);
+#endif
+	}
+}
+
+static void SoftAP_RXHandler(u8* data, u32 len)
+{
 
 	// reject the packet if it wasn't for us
 	if (!(WIFI_isBroadcastMAC(&data[0]) || WIFI_compareMAC(&data[0], wifiMac.mac.bytes)))
@@ -2344,7 +2511,7 @@ static void SoftAP_RXHandler(u_char* user, const struct pcap_pkthdr* h, const u_
 		return;
 
 	// The packet was for us. Let's process it then.
-	int wpacketLen = WIFI_alignedLen(26 + 6 + (h->len-14));
+	int wpacketLen = WIFI_alignedLen(26 + 6 + (len-14));
 	u8* wpacket = new u8[12 + wpacketLen];
 
 	u16 rxflags = 0x0018;
@@ -2363,7 +2530,7 @@ static void SoftAP_RXHandler(u_char* user, const struct pcap_pkthdr* h, const u_
 	*(u16*)&wpacket[12+26] = 0x0003;
 	*(u16*)&wpacket[12+28] = 0x0000;
 	*(u16*)&wpacket[12+30] = *(u16*)&data[12];
-	memcpy(&wpacket[12+32], &data[14], h->len-14);
+	memcpy(&wpacket[12+32], &data[14], len-14);
 
 	SoftAP.seqNum++;
 
@@ -2378,10 +2545,12 @@ void SoftAP_msTrigger()
 		SoftAP_SendBeacon();
 
 	// EXTREMELY EXPERIMENTAL packet receiving code
-	// Can now receive 64 packets per millisecond. Completely arbitrary limit. Todo: tweak if needed.
-	// But due to using non-blocking mode, this shouldn't be as slow as it used to be.
-	if (wifi_bridge != NULL)
-		CurrentWifiHandler->PCAP_dispatch(wifi_bridge, 64, SoftAP_RXHandler, NULL);
+	// Whatever the receive thread got since the last millisecond
+	while (WifiRawPacket* pkt = WIFI_RXRingFront())
+	{
+		SoftAP_RXHandler(pkt->data, pkt->len);
+		WIFI_RXRingPop();
+	}
 }
 
 #endif
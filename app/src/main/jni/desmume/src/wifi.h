@@ -592,6 +592,8 @@ u16  WIFI_read16(u32 address);
 
 /* wifimac timing */
 void WIFI_usTrigger();
+u32  WIFI_usUntilNextEvent();
+void WIFI_usAdvance(u32 usecs);
 
 
 /* DS WFC profile data documented here : */
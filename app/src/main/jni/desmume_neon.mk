@@ -58,6 +58,7 @@ LOCAL_SRC_FILES			:= 	desmume/src/addons/slot1_none.cpp \
 							desmume/src/utils/fsnitro.cpp \
 							desmume/src/utils/guid.cpp \
 							desmume/src/utils/md5.cpp \
+							desmume/src/utils/fastcrc.cpp \
 							desmume/src/utils/task.cpp \
 							desmume/src/utils/vfat.cpp \
 							desmume/src/utils/xstring.cpp \
@@ -72,6 +73,8 @@ LOCAL_SRC_FILES			:= 	desmume/src/addons/slot1_none.cpp \
 							desmume/src/filter/xbrz.cpp \
 							desmume/src/arm_instructions.cpp \
 							desmume/src/armcpu.cpp \
+							desmume/src/arm_jit_arm.cpp \
+							desmume/src/arm_jit_profile.cpp \
 							desmume/src/bios.cpp \
 							desmume/src/cheatSystem.cpp \
 							desmume/src/common.cpp \
@@ -83,16 +86,26 @@ LOCAL_SRC_FILES			:= 	desmume/src/addons/slot1_none.cpp \
 							desmume/src/encrypt.cpp \
 							desmume/src/FIFO.cpp \
 							desmume/src/firmware.cpp \
+							desmume/src/frameprofile.cpp \
 							desmume/src/fs-linux.cpp \
 							desmume/src/gfx3d.cpp \
 							desmume/src/GPU.cpp \
 							desmume/src/GPU_osd_stub.cpp \
+							desmume/src/hle_sdk.cpp \
+							desmume/src/armtrace.cpp \
 							desmume/src/matrix.cpp \
 							desmume/src/mc.cpp \
+							desmume/src/memusage.cpp \
+							desmume/src/corelog.cpp \
+							desmume/src/romreadahead.cpp \
+							desmume/src/hostcpu.cpp \
+							desmume/src/hostmem.cpp \
+							desmume/src/gamepreset.cpp \
 							desmume/src/MMU.cpp \
 							desmume/src/movie.cpp \
 							desmume/src/NDSSystem.cpp \
 							desmume/src/OGLES2Render.cpp \
+							desmume/src/VulkanRender.cpp \
 							desmume/src/path.cpp \
 							desmume/src/rasterize.cpp \
 							desmume/src/readwrite.cpp \
@@ -110,14 +123,26 @@ LOCAL_SRC_FILES			:= 	desmume/src/addons/slot1_none.cpp \
 							desmume/src/android/mic.cpp \
 							desmume/src/android/throttle.cpp \
 							desmume/src/android/main.cpp \
+							desmume/src/android/netplay.cpp \
+							desmume/src/android/runahead.cpp \
+							desmume/src/android/perfhint.cpp \
+							desmume/src/android/recorder.cpp \
+							desmume/src/android/governor.cpp \
 							desmume/src/android/OpenArchive.cpp \
 							desmume/src/android/7zip.cpp \
 							desmume/src/android/sndopensl.cpp \
-							desmume/src/android/draw.cpp
+							desmume/src/android/sndaaudio.cpp \
+							desmume/src/android/soundring.cpp \
+							desmume/src/android/frametimes.cpp \
+							desmume/src/android/draw.cpp \
+							desmume/src/android/gldraw.cpp \
+							desmume/src/android/framequeue.cpp \
+							desmume/src/android/settings.cpp \
+							desmume/src/android/inputqueue.cpp
 
 LOCAL_ARM_NEON 			:= true
 LOCAL_ARM_MODE 			:= arm
-LOCAL_CFLAGS			:= -DANDROID -DHAVE_LIBZ -DNO_MEMDEBUG -DNO_GPUDEBUG -DHAVE_NEON=1 -mfloat-abi=softfp -mfpu=neon-fp16 -marm -march=armv7-a -mtune=cortex-a7
+LOCAL_CFLAGS			:= -DANDROID -DHAVE_LIBZ -DNO_MEMDEBUG -DNO_GPUDEBUG -DHAVE_JIT -DHAVE_NEON=1 -mfloat-abi=softfp -mfpu=neon-fp16 -marm -march=armv7-a -mtune=cortex-a7
 #To increase performance for the Qualcomm Krait CPU
 #LOCAL_CFLAGS            := -DANDROID -DHAVE-LIBZ -DNO_MEMDEBUG -DNO_GPUDEBUG -DHAVE_NEON=1 -mfloat-abi=softfp -mfpu=neon-vfpv4 -marm -march=armv7-a -mcpu=krait2
 LOCAL_STATIC_LIBRARIES 	:= sevenzip
@@ -0,0 +1,100 @@
+#version 450
+
+// The polygons of the Vulkan 3D renderer (VulkanRender.cpp). The render states
+// that only change between frames or polygon modes are specialization
+// constants, so each pipeline is left with only the code its polygons run,
+// like the shader variants of the OpenGL ES renderer.
+//
+// Besides the color, each fragment leaves what the edge marking and the fog
+// of the post pass (vulkanpost.frag) need: its polygon ID, whether it isn't
+// fogged and whether it's translucent, and its depth. Like the rasterizer,
+// only a fragment that comes out opaque marks its pixel as translucent.
+
+layout(constant_id = 0) const bool ENABLE_TEXTURE = false;
+layout(constant_id = 1) const int POLYGON_MODE = 0;
+layout(constant_id = 2) const int TOON_SHADING_MODE = 0;
+layout(constant_id = 3) const bool ENABLE_ALPHA_TEST = false;
+
+layout(set = 0, binding = 0) uniform texture2D texMainRender;
+layout(set = 1, binding = 0) uniform sampler texMainSampler;
+layout(set = 1, binding = 1) uniform sampler2D texToonTable;
+
+layout(push_constant) uniform PolyState
+{
+	vec2 texScale;
+	float polyAlpha;
+	float alphaTestRef;
+	int polyID;
+	int attributes; // 1 if the polygon isn't fogged, 2 if it's translucent
+} poly;
+
+layout(location = 0) in vec2 vtxTexCoord;
+layout(location = 1) in vec4 vtxColor;
+
+layout(location = 0) out vec4 outFragColor;
+layout(location = 1) out vec4 outFragAttributes;
+layout(location = 2) out float outFragDepth;
+
+void main()
+{
+	vec4 texColor = vec4(1.0, 1.0, 1.0, 1.0);
+	if (ENABLE_TEXTURE)
+	{
+		texColor = texture(sampler2D(texMainRender, texMainSampler), vtxTexCoord);
+	}
+
+	vec4 fragColor = texColor;
+
+	if (POLYGON_MODE == 0)
+	{
+		fragColor = vtxColor * texColor;
+	}
+	else if (POLYGON_MODE == 1)
+	{
+		if (!ENABLE_TEXTURE || texColor.a == 0.0)
+		{
+			fragColor.rgb = vtxColor.rgb;
+		}
+		else if (texColor.a == 1.0)
+		{
+			fragColor.rgb = texColor.rgb;
+		}
+		else
+		{
+			fragColor.rgb = texColor.rgb * (1.0 - texColor.a) + vtxColor.rgb * texColor.a;
+		}
+		fragColor.a = vtxColor.a;
+	}
+	else if (POLYGON_MODE == 2)
+	{
+		vec3 toonColor = texture(texToonTable, vec2(vtxColor.r, 0.0)).rgb;
+		if (TOON_SHADING_MODE == 0)
+		{
+			fragColor.rgb = texColor.rgb * toonColor;
+		}
+		else
+		{
+			fragColor.rgb = texColor.rgb * vtxColor.rgb + toonColor;
+		}
+		fragColor.a = texColor.a * vtxColor.a;
+	}
+	else if (POLYGON_MODE == 3)
+	{
+		if (poly.polyID != 0)
+		{
+			fragColor = vtxColor;
+		}
+	}
+
+	if (fragColor.a == 0.0 || (ENABLE_ALPHA_TEST && fragColor.a < poly.alphaTestRef))
+	{
+		discard;
+	}
+
+	outFragColor = fragColor;
+	outFragAttributes = vec4(float(poly.polyID) / 255.0,
+	                         float(poly.attributes & 1),
+	                         (fragColor.a == 1.0) ? float((poly.attributes >> 1) & 1) : 0.0,
+	                         1.0);
+	outFragDepth = gl_FragCoord.z;
+}
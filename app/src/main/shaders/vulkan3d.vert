@@ -0,0 +1,31 @@
+#version 450
+
+// The polygons of the Vulkan 3D renderer (VulkanRender.cpp). The build
+// compiles this into assets/shaders/vulkan3d.vert.spv.
+
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inTexCoord0;
+layout(location = 2) in vec4 inColor;
+
+layout(push_constant) uniform PolyState
+{
+	vec2 texScale;
+	float polyAlpha;
+	float alphaTestRef;
+	int polyID;
+	int attributes;
+} poly;
+
+layout(location = 0) out vec2 vtxTexCoord;
+layout(location = 1) out vec4 vtxColor;
+
+void main()
+{
+	vtxTexCoord = inTexCoord0 * poly.texScale;
+	vtxColor = vec4(inColor.rgb * 4.0, poly.polyAlpha);
+
+	// The DS's clip space is OpenGL's. Vulkan's framebuffer is the other way up
+	// and its depth goes from 0 to 1, so the frame comes out top line first,
+	// like the DS draws it.
+	gl_Position = vec4(inPosition.x, -inPosition.y, (inPosition.z + inPosition.w) * 0.5, inPosition.w);
+}
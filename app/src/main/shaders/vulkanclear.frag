@@ -0,0 +1,36 @@
+#version 450
+
+// Draws the clear image of the Vulkan 3D renderer under the polygons. Each
+// texel holds the clear color in its low half and the clear depth in its high
+// half, in the DS's formats, already scrolled.
+
+layout(set = 0, binding = 0) uniform usampler2D texClearImage;
+
+layout(push_constant) uniform ClearState
+{
+	int polyID;
+} clear;
+
+layout(location = 0) out vec4 outFragColor;
+layout(location = 1) out vec4 outFragAttributes;
+layout(location = 2) out float outFragDepth;
+
+void main()
+{
+	uint texel = texelFetch(texClearImage, ivec2(gl_FragCoord.xy), 0).r;
+	uint color = texel & 0xFFFFu;
+	uint depth = texel >> 16;
+
+	outFragColor = vec4(float(color & 0x1Fu) / 31.0,
+	                    float((color >> 5) & 0x1Fu) / 31.0,
+	                    float((color >> 10) & 0x1Fu) / 31.0,
+	                    float(color >> 15));
+
+	// The same as DS_DEPTH15TO24()
+	uint depth15 = depth & 0x7FFFu;
+	uint depth24 = depth15 * 0x200u + ((depth15 + 1u) >> 15) * 0x1FFu;
+	gl_FragDepth = float(depth24) / 16777215.0;
+
+	outFragAttributes = vec4(float(clear.polyID) / 255.0, float((depth >> 15) ^ 1u), 0.0, 1.0);
+	outFragDepth = gl_FragDepth;
+}
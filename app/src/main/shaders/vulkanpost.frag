@@ -0,0 +1,181 @@
+#version 450
+
+// The post pass of the Vulkan 3D renderer, which does what the rasterizer's
+// SoftRasterizerEngine::framebufferProcess() does: the edge marking, then the
+// fog. It works in the DS's color formats (6 bits of red, green and blue, 5 of
+// alpha) so that it comes out the same.
+//
+// The rasterizer has each pixel draw its edges onto its neighbours. Here each
+// pixel looks for the neighbours that would draw onto it, in the order the
+// rasterizer gets to them, so it needs the polygon IDs of the 5x5 pixels
+// around it.
+
+layout(set = 0, binding = 0) uniform sampler2D texColor;
+layout(set = 0, binding = 1) uniform sampler2D texAttributes;
+layout(set = 0, binding = 2) uniform sampler2D texDepth;
+
+layout(set = 0, binding = 3) uniform PostState
+{
+	uvec4 fogDensity[8]; // The 32 densities, 4 to a vector
+	ivec4 edgeColor[8];
+	ivec4 fogColor;
+	ivec4 fogParams; // The offset, the increment and its shift
+	ivec4 fogRange; // Below x the density is the first, from y on the last
+	ivec4 flags; // Edge marking, fog, fog only on alpha, alpha blending
+} post;
+
+layout(location = 0) out vec4 outFragColor;
+
+const ivec2 framebufferSize = ivec2(256, 192);
+
+ivec4 toDS(vec4 color)
+{
+	return ivec4(color * 255.0 + 0.5) >> ivec4(2, 2, 2, 3);
+}
+
+vec4 fromDS(ivec4 color)
+{
+	return vec4(color.rgb * 4, color.a * 8) / 255.0;
+}
+
+bool inFramebuffer(ivec2 p)
+{
+	return all(greaterThanEqual(p, ivec2(0))) && all(lessThan(p, framebufferSize));
+}
+
+int polyIDAt(ivec2 p)
+{
+	// Outside the framebuffer is higher than any polygon ID, so it never makes an edge
+	return inFramebuffer(p) ? int(texelFetch(texAttributes, p, 0).r * 255.0 + 0.5) : 255;
+}
+
+ivec4 alphaBlend(ivec4 dst, ivec4 src)
+{
+	if (post.flags.w != 0)
+	{
+		if (src.a == 31 || dst.a == 0)
+		{
+			dst = src;
+		}
+		else
+		{
+			int alpha = src.a + 1;
+			int invAlpha = 32 - alpha;
+			dst.rgb = (alpha * src.rgb + invAlpha * dst.rgb) >> 5;
+			dst.a = max(src.a, dst.a);
+		}
+	}
+	else if (src.a != 0)
+	{
+		dst = src;
+	}
+
+	return dst;
+}
+
+int fogDensity(int j)
+{
+	return int(post.fogDensity[j >> 2][j & 3]);
+}
+
+// The same as the rasterizer's fog table at i
+int fogAmount(int i)
+{
+	if (i < post.fogRange.x)
+	{
+		return fogDensity(0);
+	}
+	if (i >= post.fogRange.y)
+	{
+		return fogDensity(31);
+	}
+
+	int increment = post.fogParams.y;
+	int shift = post.fogParams.z;
+	int num = i - post.fogParams.x + (increment - 1);
+	int j = (num >> shift) - 1;
+	int value = (num & ~(increment - 1)) + post.fogParams.x;
+	int diff = value - i;
+
+	return (diff * fogDensity(j - 1) + (increment - diff) * fogDensity(j)) >> shift;
+}
+
+void main()
+{
+	ivec2 q = ivec2(gl_FragCoord.xy);
+	ivec4 color = toDS(texelFetch(texColor, q, 0));
+
+	if (post.flags.x != 0)
+	{
+		int ids[25];
+		for (int y = 0; y < 5; y++)
+		{
+			for (int x = 0; x < 5; x++)
+			{
+				ids[y * 5 + x] = polyIDAt(q + ivec2(x - 2, y - 2));
+			}
+		}
+
+		for (int sy = -1; sy <= 1; sy++)
+		{
+			for (int sx = -1; sx <= 1; sx++)
+			{
+				ivec2 p = q + ivec2(sx, sy);
+				if ((sx == 0 && sy == 0) || !inFramebuffer(p) || texelFetch(texAttributes, p, 0).b > 0.5)
+				{
+					continue;
+				}
+
+				// > is used instead of != so that overlapping polygons of
+				// different IDs don't make double edges
+				int c = (sy + 2) * 5 + (sx + 2);
+				int self = ids[c];
+				bool upleft    = self > ids[c - 6];
+				bool up        = self > ids[c - 5];
+				bool upright   = self > ids[c - 4];
+				bool left      = self > ids[c - 1];
+				bool right     = self > ids[c + 1];
+				bool downleft  = self > ids[c + 4];
+				bool down      = self > ids[c + 5];
+				bool downright = self > ids[c + 6];
+
+				// Which way this pixel is from p
+				bool draws = false;
+				switch ((1 - sy) * 3 + (1 - sx))
+				{
+					case 0: draws = upleft && upright && downleft && !downright; break;
+					case 1: draws = up && !down; break;
+					case 2: draws = upleft && upright && !downleft && downright; break;
+					case 3: draws = left && !right; break;
+					case 5: draws = right && !left; break;
+					case 6: draws = upleft && !upright && downleft && downright; break;
+					case 7: draws = down && !up; break;
+					case 8: draws = !upleft && upright && downleft && downright; break;
+				}
+
+				if (draws)
+				{
+					color = alphaBlend(color, post.edgeColor[self >> 3]);
+				}
+			}
+		}
+	}
+
+	if (post.flags.y != 0 && texelFetch(texAttributes, q, 0).g < 0.5)
+	{
+		int depth = int(texelFetch(texDepth, q, 0).r * 16777215.0 + 0.5);
+		int fog = fogAmount(depth >> 9);
+		if (fog == 127)
+		{
+			fog = 128;
+		}
+
+		if (post.flags.z == 0)
+		{
+			color.rgb = ((128 - fog) * color.rgb + post.fogColor.rgb * fog) >> 7;
+		}
+		color.a = ((128 - fog) * color.a + post.fogColor.a * fog) >> 7;
+	}
+
+	outFragColor = fromDS(color);
+}
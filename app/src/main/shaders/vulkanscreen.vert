@@ -0,0 +1,10 @@
+#version 450
+
+// A triangle that covers the whole framebuffer, for the clear image and the
+// post pass of the Vulkan 3D renderer. It needs no vertex buffer.
+
+void main()
+{
+	vec2 position = vec2(float((gl_VertexIndex << 1) & 2), float(gl_VertexIndex & 2));
+	gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}